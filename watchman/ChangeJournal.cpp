@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChangeJournal.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <system_error>
+#include "watchman/Logging.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/watchman_hash.h"
+#include "watchman/watchman_stream.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr uint8_t kChangeExists = 1;
+
+// The ticks, timestamp and flags of a change, and the length of its name,
+// which follows them
+constexpr size_t kRecordHeaderSize =
+    sizeof(uint32_t) + sizeof(int64_t) + sizeof(uint8_t) + sizeof(uint32_t);
+
+// Changes are written out once this many bytes of them have been buffered
+constexpr size_t kFlushSize = 64 * 1024;
+// forEachSince reads the segments this many bytes at a time
+constexpr size_t kReadSize = 256 * 1024;
+
+template <typename T>
+void put(std::string& out, const T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T get(const char* data) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+} // namespace
+
+ChangeJournal::ChangeJournal(w_string pathPrefix, uint64_t maxBytes)
+    : pathPrefix_{std::move(pathPrefix)}, maxBytes_{maxBytes} {}
+
+ChangeJournal::~ChangeJournal() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  discardSegmentsLocked();
+}
+
+void ChangeJournal::begin(uint32_t ticks) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (recording_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  lastTicks_ = ticks;
+  try {
+    startSegmentLocked(ticks);
+  } catch (const std::exception& exc) {
+    failLocked(exc);
+    return;
+  }
+  recording_.store(true, std::memory_order_release);
+}
+
+void ChangeJournal::append(
+    const w_clock_t& clock,
+    bool exists,
+    w_string_piece name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!recording_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  put(buffer_, clock.ticks);
+  put(buffer_, int64_t(clock.timestamp));
+  put(buffer_, uint8_t(exists ? kChangeExists : 0));
+  put(buffer_, uint32_t(name.size()));
+  buffer_.append(name.data(), name.size());
+  ++bufferedChanges_;
+  lastTicks_ = std::max(lastTicks_, clock.ticks);
+
+  if (buffer_.size() < kFlushSize) {
+    return;
+  }
+  try {
+    flushLocked();
+    if (segments_.back().bytes >= maxBytes_ / 2) {
+      startSegmentLocked(lastTicks_);
+    }
+  } catch (const std::exception& exc) {
+    failLocked(exc);
+  }
+}
+
+uint32_t ChangeJournal::coversTicksAfter() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!recording_.load(std::memory_order_relaxed)) {
+    return UINT32_MAX;
+  }
+  return segments_.front().afterTicks;
+}
+
+void ChangeJournal::forEachSince(
+    uint32_t ticks,
+    folly::FunctionRef<void(const Change&)> fn) {
+  std::vector<Segment> segments;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!recording_.load(std::memory_order_relaxed)) {
+      return;
+    }
+    try {
+      flushLocked();
+    } catch (const std::exception& exc) {
+      failLocked(exc);
+      throw;
+    }
+    for (auto& segment : segments_) {
+      if (segment.lastTicks > ticks) {
+        segments.push_back(segment);
+      }
+    }
+  }
+
+  // Appends made from here on go past the sizes copied above, and a
+  // segment discarded in the meantime stays open until we're done with it
+  std::string data;
+  for (auto& segment : segments) {
+    auto& fd = segment.file->getFileDescriptor();
+    data.clear();
+    // How far into data the records parsed so far go
+    size_t parsed = 0;
+    uint64_t offset = 0;
+    while (offset < segment.bytes) {
+      data.erase(0, parsed);
+      parsed = 0;
+
+      auto want =
+          size_t(std::min<uint64_t>(kReadSize, segment.bytes - offset));
+      auto start = data.size();
+      data.resize(start + want);
+      auto got = fd.pread(&data[start], int(want), int64_t(offset)).value();
+      if (got <= 0) {
+        throw std::system_error(
+            std::make_error_code(std::errc::io_error),
+            fmt::format("change journal {} is truncated", segment.path));
+      }
+      data.resize(start + size_t(got));
+      offset += uint64_t(got);
+
+      while (data.size() - parsed >= kRecordHeaderSize) {
+        auto record = data.data() + parsed;
+        auto nameSize = get<uint32_t>(
+            record + sizeof(uint32_t) + sizeof(int64_t) + sizeof(uint8_t));
+        if (data.size() - parsed - kRecordHeaderSize < nameSize) {
+          break;
+        }
+        parsed += kRecordHeaderSize + nameSize;
+
+        Change change;
+        change.clock.ticks = get<uint32_t>(record);
+        if (change.clock.ticks <= ticks) {
+          continue;
+        }
+        change.clock.timestamp =
+            time_t(get<int64_t>(record + sizeof(uint32_t)));
+        change.exists =
+            get<uint8_t>(record + sizeof(uint32_t) + sizeof(int64_t)) &
+            kChangeExists;
+        change.name =
+            w_string_piece(record + kRecordHeaderSize, size_t(nameSize));
+        fn(change);
+      }
+    }
+  }
+}
+
+ChangeJournal::Stats ChangeJournal::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats;
+  if (!recording_.load(std::memory_order_relaxed)) {
+    return stats;
+  }
+  for (auto& segment : segments_) {
+    stats.bytes += segment.bytes;
+    stats.changes += segment.changes;
+  }
+  stats.bytes += buffer_.size();
+  stats.changes += bufferedChanges_;
+  stats.segments = segments_.size();
+  stats.coversTicksAfter = segments_.front().afterTicks;
+  return stats;
+}
+
+void ChangeJournal::startSegmentLocked(uint32_t afterTicks) {
+  Segment segment;
+  segment.path = w_string::format("{}.{}", pathPrefix_, nextSequence_++);
+  segment.file = w_stm_open(
+      segment.path.c_str(), O_RDWR | O_CLOEXEC | O_CREAT | O_TRUNC, 0600);
+  if (!segment.file) {
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        fmt::format("creating change journal {}", segment.path));
+  }
+  segment.afterTicks = afterTicks;
+  segment.lastTicks = afterTicks;
+  segments_.push_back(std::move(segment));
+
+  // Only the changes in the segment before this one are still needed to
+  // cover the most recent half of maxBytes
+  while (segments_.size() > 2) {
+    unlink(segments_.front().path.c_str());
+    segments_.erase(segments_.begin());
+  }
+}
+
+void ChangeJournal::flushLocked() {
+  if (buffer_.empty()) {
+    return;
+  }
+  auto& segment = segments_.back();
+  size_t written = 0;
+  while (written < buffer_.size()) {
+    auto size = int(std::min<size_t>(buffer_.size() - written, INT_MAX));
+    auto result = segment.file->write(buffer_.data() + written, size);
+    if (result <= 0) {
+      throw std::system_error(
+          errno,
+          std::generic_category(),
+          fmt::format("writing change journal {}", segment.path));
+    }
+    written += size_t(result);
+  }
+  segment.bytes += buffer_.size();
+  segment.changes += bufferedChanges_;
+  segment.lastTicks = lastTicks_;
+  buffer_.clear();
+  bufferedChanges_ = 0;
+}
+
+void ChangeJournal::failLocked(const std::exception& error) {
+  logf(
+      ERR,
+      "no longer journaling changes to {}: {}\n",
+      pathPrefix_,
+      error.what());
+  recording_.store(false, std::memory_order_release);
+  discardSegmentsLocked();
+}
+
+void ChangeJournal::discardSegmentsLocked() {
+  for (auto& segment : segments_) {
+    unlink(segment.path.c_str());
+  }
+  segments_.clear();
+  buffer_.clear();
+  bufferedChanges_ = 0;
+}
+
+w_string ChangeJournal::pathForRoot(
+    const std::string& stateFile,
+    const w_string& rootPath,
+    uint32_t rootNumber) {
+  if (stateFile.empty()) {
+    return w_string();
+  }
+  return w_string::format(
+      "{}.journal-{:08x}-{}",
+      stateFile,
+      w_hash_bytes_lookup3(rootPath.data(), rootPath.size(), 0),
+      rootNumber);
+}
+
+} // namespace watchman
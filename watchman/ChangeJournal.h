@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Function.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "watchman/Clock.h"
+#include "watchman/watchman_string.h"
+
+class watchman_stream;
+
+namespace watchman {
+
+/**
+ * An append-only record of the changes made to a view, kept on disk so
+ * that the view needn't hold on to deleted files for since queries to be
+ * able to report them.
+ *
+ * Each change is recorded as the clock of the change, whether the file
+ * existed after it, and the name of the file relative to the root.  The
+ * records are written to a segment file until it holds half of maxBytes,
+ * at which point a new segment is started and the one before it is
+ * discarded, so the journal holds at least the most recent half of
+ * maxBytes of changes, and coversTicksAfter() says how far back that goes.
+ *
+ * The files are scratch space for the daemon that writes them: they are
+ * truncated when opened, unlinked when the journal is destroyed, and hold
+ * their records in host byte order.
+ */
+class ChangeJournal {
+ public:
+  struct Change {
+    w_clock_t clock;
+    bool exists;
+    // Relative to the root; only valid for the duration of the callback
+    w_string_piece name;
+  };
+
+  struct Stats {
+    // Including the changes yet to be written out
+    uint64_t bytes{0};
+    uint64_t changes{0};
+    size_t segments{0};
+    uint32_t coversTicksAfter{UINT32_MAX};
+  };
+
+  // The segments are stored at pathPrefix followed by a sequence number
+  ChangeJournal(w_string pathPrefix, uint64_t maxBytes);
+  ~ChangeJournal();
+
+  ChangeJournal(const ChangeJournal&) = delete;
+  ChangeJournal& operator=(const ChangeJournal&) = delete;
+
+  /**
+   * Starts recording the changes made after ticks.  Until then the journal
+   * covers nothing and append() does nothing; the view calls this once its
+   * initial crawl is done, rather than journaling every file in the tree.
+   */
+  void begin(uint32_t ticks);
+
+  // Cheap enough to check before building the name to append()
+  bool isRecording() const {
+    return recording_.load(std::memory_order_acquire);
+  }
+
+  void append(const w_clock_t& clock, bool exists, w_string_piece name);
+
+  /**
+   * Returns the tick after which every change has been recorded, or
+   * UINT32_MAX if the journal isn't recording.
+   */
+  uint32_t coversTicksAfter() const;
+
+  /**
+   * Calls fn for each change recorded with ticks greater than `ticks`,
+   * oldest first.  The records are read from disk without blocking
+   * append().  Throws std::system_error if they can't be read.
+   */
+  void forEachSince(
+      uint32_t ticks,
+      folly::FunctionRef<void(const Change&)> fn);
+
+  Stats getStats() const;
+
+  /**
+   * Returns the path prefix for the journal of the view of rootPath that
+   * is numbered rootNumber, which is alongside stateFile, the state file
+   * of the daemon.  Returns a null w_string if stateFile is empty.
+   */
+  static w_string pathForRoot(
+      const std::string& stateFile,
+      const w_string& rootPath,
+      uint32_t rootNumber);
+
+ private:
+  struct Segment {
+    w_string path;
+    // Shared with forEachSince, which reads without holding the lock
+    std::shared_ptr<watchman_stream> file;
+    // Holds the changes after afterTicks, up to and including lastTicks
+    uint32_t afterTicks{0};
+    uint32_t lastTicks{0};
+    // Written out so far
+    uint64_t bytes{0};
+    uint64_t changes{0};
+  };
+
+  void startSegmentLocked(uint32_t afterTicks);
+  // Writes out buffer_ to the current segment
+  void flushLocked();
+  // Stops recording after an IO error, discarding the journal
+  void failLocked(const std::exception& error);
+  void discardSegmentsLocked();
+
+  const w_string pathPrefix_;
+  const uint64_t maxBytes_;
+  std::atomic<bool> recording_{false};
+
+  mutable std::mutex mutex_;
+  // Oldest first; the last one is appended to
+  std::vector<Segment> segments_;
+  // Records that have yet to be written to the last segment
+  std::string buffer_;
+  uint64_t bufferedChanges_{0};
+  uint32_t lastTicks_{0};
+  uint64_t nextSequence_{0};
+};
+
+} // namespace watchman
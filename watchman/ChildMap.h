@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "watchman/watchman_hash.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+inline char foldAsciiCase(char c) {
+  return (c >= 'A' && c <= 'Z') ? char(c | 0x20) : c;
+}
+
+inline bool equalsAsciiCaseless(w_string_piece a, w_string_piece b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (foldAsciiCase(a[i]) != foldAsciiCase(b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * The container used for the children of a watchman_dir.
+ *
+ * Most directories hold only a handful of entries, so rather than paying for
+ * a hash table bucket array in every directory the entries are stored in a
+ * vector that is kept sorted by name and searched with a binary search.
+ * Once the number of entries exceeds kMaxSorted a hash index is built over
+ * the vector and the entries are no longer kept in order; if the directory
+ * later shrinks well below the threshold the index is discarded again.
+ *
+ * The interface is the subset of std::unordered_map that the view uses.
+ * As with the unordered_map it replaces, keys are non-owning string pieces
+ * and must be kept alive by the mapped value.
+ *
+ * Inserting or erasing invalidates iterators and references to other
+ * entries; the mapped values are typically unique_ptrs, so the pointees
+ * remain stable.
+ *
+ * Names can also be looked up with their ASCII case ignored, which is how
+ * case insensitive roots match names.  The hash index folds case when it
+ * hashes, so that such a lookup only has to visit a single bucket.
+ */
+template <typename Value>
+class ChildMap {
+ public:
+  using key_type = w_string_piece;
+  using mapped_type = Value;
+  using value_type = std::pair<w_string_piece, Value>;
+  using iterator = typename std::vector<value_type>::iterator;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  static constexpr size_t kMaxSorted = 32;
+
+  iterator begin() {
+    return entries_.begin();
+  }
+  iterator end() {
+    return entries_.end();
+  }
+  const_iterator begin() const {
+    return entries_.begin();
+  }
+  const_iterator end() const {
+    return entries_.end();
+  }
+
+  size_t size() const {
+    return entries_.size();
+  }
+  bool empty() const {
+    return entries_.empty();
+  }
+
+  // The heap memory held by the map itself, not counting whatever the
+  // values point to.  The hash index is estimated, as its node layout is up
+  // to the standard library.
+  size_t allocatedBytes() const {
+    size_t bytes = entries_.capacity() * sizeof(value_type);
+    if (index_) {
+      bytes += sizeof(Index) + index_->bucket_count() * sizeof(void*) +
+          index_->size() *
+              (sizeof(typename Index::value_type) + sizeof(void*));
+    }
+    return bytes;
+  }
+
+  void clear() {
+    entries_.clear();
+    index_.reset();
+  }
+
+  /**
+   * Reserve space for n entries.  The sorted representation is cheap to
+   * grow, so this only pre-sizes up to kMaxSorted entries.
+   */
+  void reserve(size_t n) {
+    entries_.reserve(std::min(n, kMaxSorted));
+  }
+
+  iterator find(w_string_piece name) {
+    return entries_.begin() + findIndex(name);
+  }
+  const_iterator find(w_string_piece name) const {
+    return entries_.begin() + findIndex(name);
+  }
+
+  /**
+   * Returns the value for name, inserting a default constructed value if
+   * there is no such entry.
+   */
+  Value& operator[](w_string_piece name) {
+    if (index_) {
+      auto [it, inserted] = index_->emplace(name, entries_.size());
+      if (inserted) {
+        entries_.emplace_back(name, Value());
+      }
+      return entries_[it->second].second;
+    }
+
+    auto it = lowerBound(name);
+    if (it != entries_.end() && it->first == name) {
+      return it->second;
+    }
+    if (entries_.size() < kMaxSorted) {
+      return entries_.emplace(it, name, Value())->second;
+    }
+
+    // Outgrowing the sorted representation
+    buildIndex();
+    auto pos = entries_.size();
+    index_->emplace(name, pos);
+    entries_.emplace_back(name, Value());
+    return entries_[pos].second;
+  }
+
+  /**
+   * Remove the entry for name, if any.  Returns the number of entries
+   * removed.
+   */
+  size_t erase(w_string_piece name) {
+    auto pos = findIndex(name);
+    if (pos == entries_.size()) {
+      return 0;
+    }
+
+    if (!index_) {
+      entries_.erase(entries_.begin() + pos);
+      return 1;
+    }
+
+    index_->erase(name);
+    auto last = entries_.size() - 1;
+    if (pos != last) {
+      entries_[pos] = std::move(entries_[last]);
+      (*index_)[entries_[pos].first] = pos;
+    }
+    entries_.pop_back();
+
+    if (entries_.size() < kMaxSorted / 2) {
+      dropIndex();
+    }
+    return 1;
+  }
+
+  /**
+   * Call func(name, value) for each entry whose name matches name when
+   * ASCII case is ignored.
+   */
+  template <typename Func>
+  void forEachCaseless(w_string_piece name, Func&& func) const {
+    if (!index_) {
+      for (auto& entry : entries_) {
+        if (equalsAsciiCaseless(entry.first, name)) {
+          func(entry.first, entry.second);
+        }
+      }
+      return;
+    }
+
+    auto bucket = index_->bucket(name);
+    for (auto it = index_->begin(bucket); it != index_->end(bucket); ++it) {
+      if (equalsAsciiCaseless(it->first, name)) {
+        auto& entry = entries_[it->second];
+        func(entry.first, entry.second);
+      }
+    }
+  }
+
+  /**
+   * Call func(name, value) for each entry in name order.
+   */
+  template <typename Func>
+  void forEachInOrder(Func&& func) const {
+    if (!index_) {
+      for (auto& entry : entries_) {
+        func(entry.first, entry.second);
+      }
+      return;
+    }
+
+    std::vector<const value_type*> sorted;
+    sorted.reserve(entries_.size());
+    for (auto& entry : entries_) {
+      sorted.push_back(&entry);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](auto* a, auto* b) {
+      return a->first < b->first;
+    });
+    for (auto* entry : sorted) {
+      func(entry->first, entry->second);
+    }
+  }
+
+ private:
+  // Names that differ only in case hash alike; equality is still exact
+  struct FoldedHash {
+    size_t operator()(w_string_piece name) const {
+      char buf[64];
+      uint32_t hash = 0;
+      const char* data = name.data();
+      size_t remaining = name.size();
+      do {
+        auto len = std::min(remaining, sizeof(buf));
+        for (size_t i = 0; i < len; ++i) {
+          buf[i] = foldAsciiCase(data[i]);
+        }
+        hash = w_hash_bytes(buf, len, hash);
+        data += len;
+        remaining -= len;
+      } while (remaining > 0);
+      return hash;
+    }
+  };
+  using Index = std::unordered_map<w_string_piece, size_t, FoldedHash>;
+
+  iterator lowerBound(w_string_piece name) {
+    return std::lower_bound(
+        entries_.begin(),
+        entries_.end(),
+        name,
+        [](const value_type& entry, w_string_piece key) {
+          return entry.first < key;
+        });
+  }
+
+  size_t findIndex(w_string_piece name) const {
+    if (index_) {
+      auto it = index_->find(name);
+      return it == index_->end() ? entries_.size() : it->second;
+    }
+    auto it = const_cast<ChildMap*>(this)->lowerBound(name);
+    if (it != entries_.end() && it->first == name) {
+      return it - entries_.begin();
+    }
+    return entries_.size();
+  }
+
+  void buildIndex() {
+    index_ = std::make_unique<Index>();
+    index_->reserve(entries_.size() * 2);
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      index_->emplace(entries_[i].first, i);
+    }
+  }
+
+  void dropIndex() {
+    index_.reset();
+    std::sort(
+        entries_.begin(),
+        entries_.end(),
+        [](const value_type& a, const value_type& b) {
+          return a.first < b.first;
+        });
+  }
+
+  std::vector<value_type> entries_;
+  std::unique_ptr<Index> index_;
+};
+
+} // namespace watchman
@@ -48,16 +48,9 @@ ChildProcess::Environment::Environment(
     const std::unordered_map<w_string, w_string>& map)
     : map_(map) {}
 
-/* Constructs an envp array from a hash table.
- * The returned array occupies a single contiguous block of memory
- * such that it can be released by a single call to free(3).
- * The last element of the returned array is set to NULL for compatibility
- * with posix_spawn() */
-std::unique_ptr<char*, ChildProcess::Deleter>
-ChildProcess::Environment::asEnviron(size_t* env_size) const {
+size_t ChildProcess::Environment::environSize() const {
   size_t len = (1 + map_.size()) * sizeof(char*);
 
-  // Make a pass through to compute the required memory size
   for (const auto& it : map_) {
     const auto& key = it.first;
     const auto& val = it.second;
@@ -65,6 +58,17 @@ ChildProcess::Environment::asEnviron(size_t* env_size) const {
     // key=value\0
     len += key.size() + 1 + val.size() + 1;
   }
+  return len;
+}
+
+/* Constructs an envp array from a hash table.
+ * The returned array occupies a single contiguous block of memory
+ * such that it can be released by a single call to free(3).
+ * The last element of the returned array is set to NULL for compatibility
+ * with posix_spawn() */
+std::unique_ptr<char*, ChildProcess::Deleter>
+ChildProcess::Environment::asEnviron(size_t* env_size) const {
+  size_t len = environSize();
 
   auto envp = (char**)malloc(len);
   if (!envp) {
@@ -130,6 +134,12 @@ ChildProcess::Options::Options() : inner_(std::make_unique<Inner>()) {
 #ifdef POSIX_SPAWN_CLOEXEC_DEFAULT
   setFlags(POSIX_SPAWN_CLOEXEC_DEFAULT);
 #endif
+#ifdef POSIX_SPAWN_USEVFORK
+  // Current glibc always spawns without copying our address space, but
+  // older versions need to be asked, and the copy is expensive for a
+  // server with a large view in memory
+  setFlags(POSIX_SPAWN_USEVFORK);
+#endif
 }
 
 ChildProcess::Options::Inner::Inner() {
@@ -154,12 +164,16 @@ void ChildProcess::Options::setFlags(short flags) {
     throw std::system_error(
         err, std::generic_category(), "posix_spawnattr_setflags");
   }
+#ifndef _WIN32
+  request_.flags |= flags;
+#endif
 }
 
 #ifdef POSIX_SPAWN_SETSIGMASK
 void ChildProcess::Options::setSigMask(const sigset_t& mask) {
   posix_spawnattr_setsigmask(&inner_->attr, &mask);
   setFlags(POSIX_SPAWN_SETSIGMASK);
+  request_.sigMask = mask;
 }
 #endif
 
@@ -173,6 +187,9 @@ void ChildProcess::Options::dup2(int fd, int targetFd) {
     throw std::system_error(
         err, std::generic_category(), "posix_spawn_file_actions_adddup2");
   }
+#ifndef _WIN32
+  request_.actions.push_back({SpawnRequest::FileAction::Dup2, fd, targetFd});
+#endif
 }
 
 void ChildProcess::Options::dup2(const FileDescriptor& fd, int targetFd) {
@@ -186,12 +203,7 @@ void ChildProcess::Options::dup2(const FileDescriptor& fd, int targetFd) {
         "posix_spawn_file_actions_adddup2_handle_np");
   }
 #else
-  auto err =
-      posix_spawn_file_actions_adddup2(&inner_->actions, fd.fd(), targetFd);
-  if (err) {
-    throw std::system_error(
-        err, std::generic_category(), "posix_spawn_file_actions_adddup2");
-  }
+  dup2(fd.fd(), targetFd);
 #endif
 }
 
@@ -206,6 +218,10 @@ void ChildProcess::Options::open(
     throw std::system_error(
         err, std::generic_category(), "posix_spawn_file_actions_addopen");
   }
+#ifndef _WIN32
+  request_.actions.push_back(
+      {SpawnRequest::FileAction::Open, -1, targetFd, path, flags, mode});
+#endif
 }
 
 void ChildProcess::Options::pipe(int targetFd, bool childRead) {
@@ -249,6 +265,16 @@ void ChildProcess::Options::chdir(w_string_piece path) {
   cwd_ = std::string(path.data(), path.size());
 #ifdef _WIN32
   posix_spawnattr_setcwd_np(&inner_->attr, cwd_.c_str());
+#else
+  request_.actions.push_back({SpawnRequest::FileAction::Chdir, -1, -1, cwd_});
+#endif
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+  auto err =
+      posix_spawn_file_actions_addchdir_np(&inner_->actions, cwd_.c_str());
+  if (err) {
+    throw std::system_error(
+        err, std::generic_category(), "posix_spawn_file_actions_addchdir_np");
+  }
 #endif
 }
 
@@ -282,41 +308,25 @@ ChildProcess::ChildProcess(
   }
   argv.emplace_back(nullptr);
 
+  auto envp = options.env_.asEnviron();
+  int ret;
 #ifndef _WIN32
-  auto lock = lockCwdMutex();
-  char savedCwd[WATCHMAN_NAME_MAX];
-  if (!getcwd(savedCwd, sizeof(savedCwd))) {
-    throw std::system_error(errno, std::generic_category(), "failed to getcwd");
-  }
-  SCOPE_EXIT {
-    if (!options.cwd_.empty()) {
-      if (chdir(savedCwd) != 0) {
-        // log(FATAL) rather than throw because SCOPE_EXIT is
-        // a noexcept destructor and will call std::terminate
-        // in this case anyway.
-        log(FATAL, "failed to restore cwd of ", savedCwd);
-      }
+  auto helper = SpawnHelper::get();
+  if (helper) {
+    auto& req = options.request_;
+    req.argv = argStrings;
+    for (size_t i = 0; envp.get()[i]; ++i) {
+      req.envp.emplace_back(envp.get()[i]);
     }
-  };
-
-  if (!options.cwd_.empty()) {
-    if (chdir(options.cwd_.c_str()) != 0) {
-      throw std::system_error(
-          errno,
-          std::generic_category(),
-          folly::to<std::string>("failed to chdir to ", options.cwd_));
+    if (helper->spawn(req, &pid_, &ret)) {
+      helper_ = helper;
     }
   }
+  if (!helper_)
 #endif
-
-  auto envp = options.env_.asEnviron();
-  auto ret = posix_spawnp(
-      &pid_,
-      argv[0],
-      &options.inner_->actions,
-      &options.inner_->attr,
-      &argv[0],
-      envp.get());
+  {
+    ret = spawnHere(&argv[0], options, envp.get());
+  }
 
   if (ret) {
     // Failed, so the creator cannot call wait() on us.
@@ -348,6 +358,45 @@ ChildProcess::ChildProcess(
   }
 }
 
+int ChildProcess::spawnHere(char** argv, Options& options, char** envp) {
+#if !defined(_WIN32) && !defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP)
+  // Without a way to have the child change directory, we change ours
+  // around the spawn, which means that only one spawn can happen at a time
+  auto lock = lockCwdMutex();
+  char savedCwd[WATCHMAN_NAME_MAX];
+  if (!getcwd(savedCwd, sizeof(savedCwd))) {
+    throw std::system_error(errno, std::generic_category(), "failed to getcwd");
+  }
+  SCOPE_EXIT {
+    if (!options.cwd_.empty()) {
+      if (chdir(savedCwd) != 0) {
+        // log(FATAL) rather than throw because SCOPE_EXIT is
+        // a noexcept destructor and will call std::terminate
+        // in this case anyway.
+        log(FATAL, "failed to restore cwd of ", savedCwd);
+      }
+    }
+  };
+
+  if (!options.cwd_.empty()) {
+    if (chdir(options.cwd_.c_str()) != 0) {
+      throw std::system_error(
+          errno,
+          std::generic_category(),
+          folly::to<std::string>("failed to chdir to ", options.cwd_));
+    }
+  }
+#endif
+
+  return posix_spawnp(
+      &pid_,
+      argv[0],
+      &options.inner_->actions,
+      &options.inner_->attr,
+      argv,
+      envp);
+}
+
 static std::mutex& getCwdMutex() {
   // Meyers singleton
   static std::mutex m;
@@ -367,6 +416,11 @@ ChildProcess::~ChildProcess() {
 }
 
 void ChildProcess::disown() {
+#ifndef _WIN32
+  if (helper_ && !waited_) {
+    helper_->disown(pid_);
+  }
+#endif
   waited_ = true;
 }
 
@@ -375,6 +429,13 @@ bool ChildProcess::terminated() {
     return true;
   }
 
+#ifndef _WIN32
+  if (helper_) {
+    waited_ = helper_->poll(pid_, &status_);
+    return waited_;
+  }
+#endif
+
   auto pid = waitpid(pid_, &status_, WNOHANG);
   if (pid == pid_) {
     waited_ = true;
@@ -388,6 +449,15 @@ int ChildProcess::wait() {
     return status_;
   }
 
+#ifndef _WIN32
+  if (helper_) {
+    // As below, we're done with the child even if this throws
+    waited_ = true;
+    status_ = helper_->wait(pid_);
+    return status_;
+  }
+#endif
+
   while (true) {
     auto pid = waitpid(pid_, &status_, 0);
     if (pid == pid_) {
@@ -423,6 +493,16 @@ std::unique_ptr<Pipe> ChildProcess::takeStdin() {
   return pipe;
 }
 
+std::unique_ptr<Pipe> ChildProcess::takePipe(int targetFd) {
+  auto it = pipes_.find(targetFd);
+  if (it == pipes_.end()) {
+    return nullptr;
+  }
+  auto pipe = std::move(it->second);
+  pipes_.erase(it);
+  return pipe;
+}
+
 std::pair<w_string, w_string> ChildProcess::communicate(
     pipeWriteCallback writeCallback) {
 #ifdef _WIN32
@@ -12,6 +12,7 @@
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include "watchman/SpawnHelper.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
@@ -40,6 +41,10 @@ class ChildProcess {
     // Returns the environment as an environ compatible array
     std::unique_ptr<char*, Deleter> asEnviron(size_t* env_size = nullptr) const;
 
+    // Returns the size of the array that asEnviron would build, without
+    // building it
+    size_t environSize() const;
+
     // Set a value in the environment
     void set(const w_string& key, const w_string& value);
     void set(
@@ -97,7 +102,9 @@ class ChildProcess {
     // it available as targetFd
     void open(int targetFd, const char* path, int flags, int mode);
 
-    // Arrange to set the cwd for the child process
+    // Arrange to set the cwd for the child process.  Where the platform
+    // allows, this is done by the child, in order with the other file
+    // actions, so call this before open() with a path relative to it.
     void chdir(w_string_piece path);
 
    private:
@@ -115,6 +122,10 @@ class ChildProcess {
     Environment env_;
     std::unordered_map<int, std::unique_ptr<Pipe>> pipes_;
     std::string cwd_;
+#ifndef _WIN32
+    // The same actions and attributes, for the spawn helper to replay
+    SpawnRequest request_;
+#endif
 
     friend class ChildProcess;
   };
@@ -154,6 +165,11 @@ class ChildProcess {
   // terminate.
   std::unique_ptr<Pipe> takeStdin();
 
+  // Extracts the pipe that was set up as targetFd in the child, for callers
+  // that speak a protocol with a long-running child rather than waiting for
+  // it to finish via communicate().  Returns nullptr if there is no such pipe.
+  std::unique_ptr<Pipe> takePipe(int targetFd);
+
   // The pipeWriteCallback is called by communicate when it is safe to write
   // data to the pipe.  The callback should then attempt to write to it.
   // The callback must return true when it has nothing more
@@ -188,7 +204,15 @@ class ChildProcess {
   static size_t getArgMax();
 
  private:
+  // Spawns the child from this process rather than via the spawn helper,
+  // returning the posix_spawnp result
+  int spawnHere(char** argv, Options& options, char** envp);
+
   pid_t pid_;
+#ifndef _WIN32
+  // Set if the spawn helper spawned the child, and will report its exit
+  SpawnHelper* helper_{nullptr};
+#endif
   bool waited_{false};
   int status_;
   std::unordered_map<int, std::unique_ptr<Pipe>> pipes_;
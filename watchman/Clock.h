@@ -39,6 +39,13 @@ struct ClockPosition {
       : rootNumber(rootNumber), ticks(ticks) {}
 
   w_string toClockString() const;
+
+  bool operator==(const ClockPosition& other) const {
+    return rootNumber == other.rootNumber && ticks == other.ticks;
+  }
+  bool operator!=(const ClockPosition& other) const {
+    return !(*this == other);
+  }
 };
 
 enum w_clockspec_tag { w_cs_timestamp, w_cs_clock, w_cs_named_cursor };
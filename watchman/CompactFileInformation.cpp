@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CompactFileInformation.h"
+#include <folly/hash/Hash.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+namespace {
+
+struct Owner {
+  dev_t dev{0};
+  uid_t uid{0};
+  gid_t gid{0};
+
+  bool operator==(const Owner& other) const {
+    return dev == other.dev && uid == other.uid && gid == other.gid;
+  }
+};
+
+struct OwnerHash {
+  size_t operator()(const Owner& owner) const {
+    return folly::hash::hash_combine(owner.dev, owner.uid, owner.gid);
+  }
+};
+
+/**
+ * The distinct dev, uid and gid combinations of every file in every view.
+ * Entries are never removed or changed, so they are read without the lock:
+ * an index only reaches a reader through the view that it was stored in,
+ * under the view's lock, after the entry was written.
+ */
+class OwnerTable {
+ public:
+  OwnerTable() {
+    // Index 0 is the owner of a default constructed FileInformation
+    intern(Owner{});
+  }
+
+  uint32_t intern(const Owner& owner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = indices_.find(owner);
+    if (it != indices_.end()) {
+      return it->second;
+    }
+    if (size_ == kChunkSize * kMaxChunks) {
+      // Only if something is badly wrong
+      logf(ERR, "too many distinct owners of files, reporting them as 0\n");
+      return 0;
+    }
+    auto& chunk = chunks_[size_ / kChunkSize];
+    auto* entries = chunk.load(std::memory_order_relaxed);
+    if (!entries) {
+      entries = new Owner[kChunkSize];
+      chunk.store(entries, std::memory_order_release);
+    }
+    entries[size_ % kChunkSize] = owner;
+    auto index = uint32_t(size_++);
+    indices_.emplace(owner, index);
+    return index;
+  }
+
+  const Owner& get(uint32_t index) const {
+    return chunks_[index / kChunkSize].load(
+        std::memory_order_acquire)[index % kChunkSize];
+  }
+
+ private:
+  static constexpr size_t kChunkSize = 1024;
+  static constexpr size_t kMaxChunks = 1024;
+
+  std::mutex mutex_;
+  std::unordered_map<Owner, uint32_t, OwnerHash> indices_;
+  size_t size_{0};
+  // Never freed, as the table lives as long as the process
+  std::array<std::atomic<Owner*>, kMaxChunks> chunks_{};
+};
+
+OwnerTable& getOwnerTable() {
+  static auto* table = new OwnerTable;
+  return *table;
+}
+
+uint32_t internOwner(const Owner& owner) {
+  // Nearly every file has the same owner as the one before it
+  thread_local Owner lastOwner;
+  thread_local uint32_t lastIndex = 0;
+  if (!(owner == lastOwner)) {
+    lastIndex = getOwnerTable().intern(owner);
+    lastOwner = owner;
+  }
+  return lastIndex;
+}
+
+// A FileInformation with just enough to tell the type of the file
+FileInformation typeOnly(const CompactFileInformation& info) {
+  FileInformation result;
+  result.mode = mode_t(info.mode);
+#ifdef _WIN32
+  result.fileAttributes = info.fileAttributes;
+#endif
+  return result;
+}
+
+} // namespace
+
+CompactFileInformation::CompactFileInformation(const FileInformation& info)
+    : size(info.size),
+      ino(info.ino),
+      mtimeNs(timespecToNs(info.mtime)),
+      ctimeNs(timespecToNs(info.ctime)),
+      mode(uint32_t(info.mode)),
+      nlink(uint32_t(info.nlink)),
+      owner(internOwner(Owner{info.dev, info.uid, info.gid}))
+#ifdef _WIN32
+      ,
+      fileAttributes(info.fileAttributes)
+#endif
+{
+}
+
+FileInformation CompactFileInformation::expand() const {
+  FileInformation info = typeOnly(*this);
+  info.size = off_t(size);
+  info.ino = ino_t(ino);
+  info.nlink = nlink_t(nlink);
+  const auto& o = getOwnerTable().get(owner);
+  info.dev = o.dev;
+  info.uid = o.uid;
+  info.gid = o.gid;
+  info.mtime = mtime();
+  info.ctime = ctime();
+  return info;
+}
+
+DType CompactFileInformation::dtype() const {
+  return typeOnly(*this).dtype();
+}
+
+bool CompactFileInformation::isSymlink() const {
+  return typeOnly(*this).isSymlink();
+}
+
+bool CompactFileInformation::isDir() const {
+  return typeOnly(*this).isDir();
+}
+
+bool CompactFileInformation::isFile() const {
+  return typeOnly(*this).isFile();
+}
+
+int64_t CompactFileInformation::timespecToNs(const struct timespec& ts) {
+  return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+struct timespec CompactFileInformation::nsToTimespec(int64_t ns) {
+  struct timespec ts;
+  auto sec = ns / 1000000000;
+  auto nsec = ns % 1000000000;
+  // Round towards negative infinity for times before the epoch
+  if (nsec < 0) {
+    sec -= 1;
+    nsec += 1000000000;
+  }
+  ts.tv_sec = decltype(ts.tv_sec)(sec);
+  ts.tv_nsec = decltype(ts.tv_nsec)(nsec);
+  return ts;
+}
+
+} // namespace watchman
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include "watchman/fs/FileInformation.h"
+
+namespace watchman {
+
+/**
+ * The FileInformation that the view keeps for each of its files, in half
+ * the space.  The times are packed into nanoseconds since the epoch, and
+ * the dev, uid and gid, of which a root only ever has a handful of
+ * combinations, are replaced by their index in a table that the whole
+ * process shares.
+ *
+ * The atime isn't consulted to tell whether a file changed, so it isn't
+ * kept here.  watchman_file keeps it, if at all, after its name.
+ */
+struct CompactFileInformation {
+  int64_t size{0};
+  uint64_t ino{0};
+  int64_t mtimeNs{0};
+  int64_t ctimeNs{0};
+  uint32_t mode{0};
+  uint32_t nlink{0};
+  // Index of the dev, uid and gid in the shared table; 0 is all zeros
+  uint32_t owner{0};
+#ifdef _WIN32
+  uint32_t fileAttributes{0};
+#endif
+
+  CompactFileInformation() = default;
+  explicit CompactFileInformation(const FileInformation& info);
+
+  // Returns the full information, with a zero atime
+  FileInformation expand() const;
+
+  struct timespec mtime() const {
+    return nsToTimespec(mtimeNs);
+  }
+  struct timespec ctime() const {
+    return nsToTimespec(ctimeNs);
+  }
+
+  DType dtype() const;
+  bool isSymlink() const;
+  bool isDir() const;
+  bool isFile() const;
+
+  static int64_t timespecToNs(const struct timespec& ts);
+  static struct timespec nsToTimespec(int64_t ns);
+};
+
+} // namespace watchman
@@ -6,10 +6,15 @@
  */
 
 #include "watchman/ContentHash.h"
+#include <folly/FileUtil.h>
 #include <folly/ScopeGuard.h>
+#include <cstring>
 #include <string>
+#include <vector>
 #include "watchman/Logging.h"
+#include "watchman/Options.h"
 #include "watchman/ThreadPool.h"
+#include "watchman/Tracing.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/watchman_hash.h"
 #include "watchman/watchman_stream.h"
@@ -23,10 +28,24 @@
 #include <openssl/sha.h>
 #endif
 
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/xattr.h>
+#endif
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
 using folly::to;
 
 namespace watchman {
 
+namespace {
+// Files are read in chunks of this size.  Larger reads mean fewer syscalls
+// and hash update calls per file; the buffer is allocated per hash rather
+// than on the stack of the thread pool worker.
+constexpr size_t kReadSize = 256 * 1024;
+} // namespace
+
 using HashValue = typename ContentHashCache::HashValue;
 using Node = typename ContentHashCache::Node;
 
@@ -42,78 +61,196 @@ std::size_t ContentHashCacheKey::hashValue() const {
       hash_128_to_64(fileSize, hash_128_to_64(mtime.tv_sec, mtime.tv_nsec)));
 }
 
+namespace {
+
+constexpr char kMagic[8] = {'W', 'M', 'H', 'A', 'S', 'H', 'E', 'S'};
+constexpr uint32_t kVersion = 1;
+
+template <typename T>
+void put(std::string& out, const T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+class Reader {
+ public:
+  explicit Reader(std::string_view data) : data_(data) {}
+
+  template <typename T>
+  T get() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    memcpy(&value, take(sizeof(value)).data(), sizeof(value));
+    return value;
+  }
+
+  std::string_view take(size_t len) {
+    if (data_.size() < len) {
+      throw std::runtime_error("content hash cache is truncated");
+    }
+    auto result = data_.substr(0, len);
+    data_.remove_prefix(len);
+    return result;
+  }
+
+  bool empty() const {
+    return data_.empty();
+  }
+
+ private:
+  std::string_view data_;
+};
+
+int hexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+} // namespace
+
 ContentHashCache::ContentHashCache(
     const w_string& rootPath,
     size_t maxItems,
-    std::chrono::milliseconds errorTTL)
-    : cache_(maxItems, errorTTL), rootPath_(rootPath) {}
+    std::chrono::milliseconds errorTTL,
+    w_string xattrName)
+    : cache_(maxItems, errorTTL),
+      rootPath_(rootPath),
+      xattrName_(std::move(xattrName)) {}
 
 folly::Future<std::shared_ptr<const Node>> ContentHashCache::get(
+    const ContentHashCacheKey& key,
+    ThreadPool::Priority priority) {
+  return cache_.get(key, [this, priority](const ContentHashCacheKey& k) {
+    WATCHMAN_TRACE(content_hash_miss, k.relativePath.c_str());
+    return computeHash(k, priority);
+  });
+}
+
+std::optional<HashValue> ContentHashCache::getCached(
     const ContentHashCacheKey& key) {
-  return cache_.get(
-      key, [this](const ContentHashCacheKey& k) { return computeHash(k); });
+  std::shared_ptr<const Node> node;
+  try {
+    node = cache_.get(key);
+  } catch (const std::runtime_error&) {
+    // The hash is still being computed
+    return std::nullopt;
+  }
+  if (!node || !node->result().hasValue()) {
+    return std::nullopt;
+  }
+  return node->value();
 }
 
-HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
-  HashValue result;
-  uint8_t buf[8192];
+namespace {
 
-  auto stm = w_stm_open(fullPath, O_RDONLY);
-  if (!stm) {
-    throw std::system_error(
-        errno,
-        std::generic_category(),
-        to<std::string>("w_stm_open ", fullPath));
+// Computes a SHA-1 incrementally, with the implementation that the platform
+// provides.  Use the built-in crypt provider API on windows to avoid
+// introducing a dependency on openssl in the windows build.
+class Sha1 {
+ public:
+  Sha1() {
+#ifndef _WIN32
+    SHA1_Init(&ctx_);
+#else
+    if (!CryptAcquireContext(
+            &provider_,
+            nullptr,
+            nullptr,
+            PROV_RSA_FULL,
+            CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
+      throw std::system_error(
+          GetLastError(), std::system_category(), "CryptAcquireContext");
+    }
+    if (!CryptCreateHash(provider_, CALG_SHA1, 0, 0, &ctx_)) {
+      auto err = GetLastError();
+      CryptReleaseContext(provider_, 0);
+      throw std::system_error(err, std::system_category(), "CryptCreateHash");
+    }
+#endif
   }
 
-#ifndef _WIN32
-  SHA_CTX ctx;
-  SHA1_Init(&ctx);
+  Sha1(const Sha1&) = delete;
+  Sha1& operator=(const Sha1&) = delete;
 
-  while (true) {
-    auto n = stm->read(buf, sizeof(buf));
-    if (n == 0) {
-      break;
-    }
-    if (n < 0) {
+  ~Sha1() {
+#ifdef _WIN32
+    CryptDestroyHash(ctx_);
+    CryptReleaseContext(provider_, 0);
+#endif
+  }
+
+  void update(const void* data, size_t size) {
+#ifndef _WIN32
+    SHA1_Update(&ctx_, data, size);
+#else
+    if (!CryptHashData(ctx_, static_cast<const BYTE*>(data), DWORD(size), 0)) {
       throw std::system_error(
-          errno,
-          std::generic_category(),
-          to<std::string>("while reading from ", fullPath));
+          GetLastError(), std::system_category(), "CryptHashData");
     }
-    SHA1_Update(&ctx, buf, n);
+#endif
   }
 
-  SHA1_Final(result.data(), &ctx);
+  HashValue finish() {
+    HashValue result;
+#ifndef _WIN32
+    SHA1_Final(result.data(), &ctx_);
 #else
-  // Use the built-in crypt provider API on windows to avoid introducing a
-  // dependency on openssl in the windows build.
-  HCRYPTPROV provider{0};
-  HCRYPTHASH ctx{0};
-
-  if (!CryptAcquireContext(
-          &provider,
-          nullptr,
-          nullptr,
-          PROV_RSA_FULL,
-          CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
-    throw std::system_error(
-        GetLastError(), std::system_category(), "CryptAcquireContext");
+    DWORD size = result.size();
+    if (!CryptGetHashParam(ctx_, HP_HASHVAL, result.data(), &size, 0)) {
+      throw std::system_error(
+          GetLastError(),
+          std::system_category(),
+          "CryptGetHashParam HP_HASHVAL");
+    }
+#endif
+    return result;
   }
-  SCOPE_EXIT {
-    CryptReleaseContext(provider, 0);
-  };
 
-  if (!CryptCreateHash(provider, CALG_SHA1, 0, 0, &ctx)) {
+ private:
+#ifndef _WIN32
+  SHA_CTX ctx_;
+#else
+  HCRYPTPROV provider_{0};
+  HCRYPTHASH ctx_{0};
+#endif
+};
+
+std::unique_ptr<watchman_stream> openForHashing(const char* fullPath) {
+  auto stm = w_stm_open(fullPath, O_RDONLY);
+  if (!stm) {
     throw std::system_error(
-        GetLastError(), std::system_category(), "CryptCreateHash");
+        errno,
+        std::generic_category(),
+        to<std::string>("w_stm_open ", fullPath));
   }
-  SCOPE_EXIT {
-    CryptDestroyHash(ctx);
-  };
+  return stm;
+}
+
+} // namespace
+
+HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
+  std::vector<uint8_t> buffer(kReadSize);
+  auto* buf = buffer.data();
+
+  auto stm = openForHashing(fullPath);
+
+#ifdef __linux__
+  // We read the whole file exactly once, front to back, so let the kernel
+  // read ahead more aggressively.
+  posix_fadvise(stm->getFileDescriptor().fd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 
+  Sha1 sha1;
   while (true) {
-    auto n = stm->read(buf, sizeof(buf));
+    auto n = stm->read(buf, int(buffer.size()));
     if (n == 0) {
       break;
     }
@@ -123,26 +260,103 @@ HashValue ContentHashCache::computeHashImmediate(const char* fullPath) {
           std::generic_category(),
           to<std::string>("while reading from ", fullPath));
     }
+    sha1.update(buf, n);
+  }
+  return sha1.finish();
+}
 
-    if (!CryptHashData(ctx, buf, n, 0)) {
-      throw std::system_error(
-          GetLastError(), std::system_category(), "CryptHashData");
+HashValue ContentHashCache::computeFingerprintImmediate(
+    const char* fullPath,
+    const FileInformation& st) {
+  auto stm = openForHashing(fullPath);
+  auto& fd = stm->getFileDescriptor();
+
+  Sha1 sha1;
+  // The metadata, so that a change that misses the sampled blocks, but
+  // moves the mtime, is still seen
+  int64_t meta[] = {
+      int64_t(st.size),
+      int64_t(st.mtime.tv_sec),
+      int64_t(st.mtime.tv_nsec),
+      int64_t(st.ino)};
+  sha1.update(meta, sizeof(meta));
+
+  // The whole of a small file, or else the first, middle and last blocks
+  // of it.  Offsets are taken from st rather than the file as it is now,
+  // so that a file that is being appended to has a stable fingerprint
+  // until watchman sees it change.
+  size_t size = size_t(st.size);
+  std::vector<std::pair<int64_t, size_t>> ranges;
+  if (size <= 3 * kFingerprintBlockSize) {
+    ranges.emplace_back(0, size);
+  } else {
+    ranges.emplace_back(0, kFingerprintBlockSize);
+    ranges.emplace_back(
+        int64_t(size / 2 - kFingerprintBlockSize / 2), kFingerprintBlockSize);
+    ranges.emplace_back(
+        int64_t(size - kFingerprintBlockSize), kFingerprintBlockSize);
+  }
+
+  std::vector<uint8_t> buffer(
+      ranges.size() == 1 ? size : kFingerprintBlockSize);
+  for (auto [offset, len] : ranges) {
+    while (len > 0) {
+      auto n = fd.pread(buffer.data(), int(len), offset).value();
+      if (n == 0) {
+        // Truncated since st was taken; hash what there is
+        break;
+      }
+      sha1.update(buffer.data(), n);
+      offset += n;
+      len -= size_t(n);
     }
   }
+  return sha1.finish();
+}
 
-  DWORD size = result.size();
-  if (!CryptGetHashParam(ctx, HP_HASHVAL, result.data(), &size, 0)) {
-    throw std::system_error(
-        GetLastError(), std::system_category(), "CryptGetHashParam HP_HASHVAL");
+std::optional<HashValue> ContentHashCache::hashFromXattr(
+    const char* fullPath,
+    const w_string& xattrName) {
+#if defined(__linux__) || defined(__APPLE__)
+  char buf[64];
+#ifdef __APPLE__
+  auto len =
+      getxattr(fullPath, xattrName.c_str(), buf, sizeof(buf), 0, XATTR_NOFOLLOW);
+#else
+  auto len = lgetxattr(fullPath, xattrName.c_str(), buf, sizeof(buf));
+#endif
+  HashValue result;
+  if (len == ssize_t(result.size())) {
+    memcpy(result.data(), buf, result.size());
+    return result;
+  }
+  if (len == ssize_t(result.size() * 2)) {
+    for (size_t i = 0; i < result.size(); ++i) {
+      int hi = hexDigit(buf[i * 2]);
+      int lo = hexDigit(buf[i * 2 + 1]);
+      if (hi < 0 || lo < 0) {
+        return std::nullopt;
+      }
+      result[i] = uint8_t((hi << 4) | lo);
+    }
+    return result;
   }
+#else
+  (void)fullPath;
+  (void)xattrName;
 #endif
-  return result;
+  return std::nullopt;
 }
 
 HashValue ContentHashCache::computeHashImmediate(
     const ContentHashCacheKey& key) const {
   auto fullPath = w_string::pathCat({rootPath_, key.relativePath});
-  auto result = computeHashImmediate(fullPath.c_str());
+  std::optional<HashValue> fromXattr;
+  if (!xattrName_.empty()) {
+    fromXattr = hashFromXattr(fullPath.c_str(), xattrName_);
+  }
+  auto result =
+      fromXattr ? *fromXattr : computeHashImmediate(fullPath.c_str());
 
   // Since TOCTOU is everywhere and everything, double check to make sure that
   // the file looks like we were expecting at the start.  If it isn't, then
@@ -159,10 +373,22 @@ HashValue ContentHashCache::computeHashImmediate(
   return result;
 }
 
+folly::Future<HashValue> ContentHashCache::computeFingerprint(
+    const w_string& relativePath,
+    const FileInformation& st,
+    ThreadPool::Priority priority) const {
+  auto fullPath = w_string::pathCat({rootPath_, relativePath});
+  return folly::via(&getThreadPool(priority), [fullPath, st] {
+    return computeFingerprintImmediate(fullPath.c_str(), st);
+  });
+}
+
 folly::Future<HashValue> ContentHashCache::computeHash(
-    const ContentHashCacheKey& key) const {
-  return folly::via(
-      &getThreadPool(), [key, this] { return computeHashImmediate(key); });
+    const ContentHashCacheKey& key,
+    ThreadPool::Priority priority) const {
+  return folly::via(&getThreadPool(priority), [key, this] {
+    return computeHashImmediate(key);
+  });
 }
 
 const w_string& ContentHashCache::rootPath() const {
@@ -172,4 +398,83 @@ const w_string& ContentHashCache::rootPath() const {
 CacheStats ContentHashCache::stats() const {
   return cache_.stats();
 }
+
+std::string ContentHashCache::serialize() const {
+  std::string out(kMagic, sizeof(kMagic));
+  put(out, kVersion);
+
+  cache_.forEachValue(
+      [&](const ContentHashCacheKey& key, const HashValue& value) {
+        put(out, uint32_t(key.relativePath.size()));
+        out.append(key.relativePath.data(), key.relativePath.size());
+        put(out, uint64_t(key.fileSize));
+        put(out, int64_t(key.mtime.tv_sec));
+        put(out, int64_t(key.mtime.tv_nsec));
+        out.append(reinterpret_cast<const char*>(value.data()), value.size());
+      });
+  return out;
+}
+
+size_t ContentHashCache::deserialize(std::string_view data) {
+  Reader in(data);
+  if (in.take(sizeof(kMagic)) != std::string_view(kMagic, sizeof(kMagic))) {
+    throw std::runtime_error("not a content hash cache");
+  }
+  if (in.get<uint32_t>() != kVersion) {
+    throw std::runtime_error("unsupported content hash cache version");
+  }
+
+  size_t added = 0;
+  while (!in.empty()) {
+    auto path = in.take(in.get<uint32_t>());
+    ContentHashCacheKey key;
+    key.relativePath = w_string(path.data(), path.size(), W_STRING_BYTE);
+    key.fileSize = size_t(in.get<uint64_t>());
+    key.mtime.tv_sec = time_t(in.get<int64_t>());
+    key.mtime.tv_nsec = long(in.get<int64_t>());
+    HashValue value;
+    memcpy(value.data(), in.take(value.size()).data(), value.size());
+    cache_.set(key, std::move(value));
+    ++added;
+  }
+  return added;
+}
+
+void ContentHashCache::save(const w_string& path) const {
+  auto data = serialize();
+  int err = folly::writeFileAtomicNoThrow(
+      folly::StringPiece(path.data(), path.size()),
+      folly::ByteRange(folly::StringPiece(data)),
+      0600);
+  if (err) {
+    throw std::system_error(
+        err,
+        std::generic_category(),
+        to<std::string>("writing content hash cache ", path.view()));
+  }
+}
+
+size_t ContentHashCache::load(const w_string& path) {
+  std::string data;
+  if (!folly::readFile(path.c_str(), data)) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        to<std::string>("reading content hash cache ", path.view()));
+  }
+  return deserialize(data);
+}
+
+w_string ContentHashCache::pathForRoot(const w_string& rootPath) {
+  if (flags.watchman_state_file.empty()) {
+    return w_string();
+  }
+  return w_string::format(
+      "{}.hashes-{:08x}",
+      flags.watchman_state_file,
+      w_hash_bytes_lookup3(rootPath.data(), rootPath.size(), 0));
+}
 } // namespace watchman
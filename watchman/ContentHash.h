@@ -7,7 +7,12 @@
 
 #pragma once
 #include <array>
+#include <optional>
+#include <string>
+#include <string_view>
 #include "watchman/LRUCache.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/fs/FileInformation.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
@@ -39,23 +44,31 @@ namespace watchman {
 class ContentHashCache {
  public:
   using HashValue = std::array<uint8_t, 20>;
-  using Node = LRUCache<ContentHashCacheKey, HashValue>::NodeType;
+  using Node = ShardedLRUCache<ContentHashCacheKey, HashValue>::NodeType;
 
   // Construct a cache for a given root, holding the specified
   // maximum number of items, using the configured negative
-  // caching TTL.
+  // caching TTL.  If xattrName is not empty, hashes are taken from
+  // that extended attribute when files have it.
   ContentHashCache(
       const w_string& rootPath,
       size_t maxItems,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      w_string xattrName = w_string());
 
   // Obtain the content hash for the given input.
   // If the result is in the cache it will return a ready future
   // holding the result.  Otherwise, computeHash will be invoked
   // to populate the cache.  Returns a future with the result
-  // of the lookup.
+  // of the lookup.  priority is that of the thread pool work used to
+  // compute the hash, should it not already be cached.
   folly::Future<std::shared_ptr<const Node>> get(
-      const ContentHashCacheKey& key);
+      const ContentHashCacheKey& key,
+      ThreadPool::Priority priority = ThreadPool::Priority::Hashing);
+
+  // Returns the hash for the given input if it is already in the cache,
+  // without computing it or waiting for a computation in progress.
+  std::optional<HashValue> getCached(const ContentHashCacheKey& key);
 
   // Compute the hash value for a given input.
   // This will block the calling thread while the I/O is performed.
@@ -67,9 +80,41 @@ class ContentHashCache {
   // Throws exceptions for any errors that may occur.
   static HashValue computeHashImmediate(const char* fullPath);
 
+  // The most that computeFingerprintImmediate reads from each of the
+  // start, middle and end of a file.
+  static constexpr size_t kFingerprintBlockSize = 64 * 1024;
+
+  // Compute a fingerprint of the file at fullPath, whose stat is st: a
+  // SHA-1 of its size, mtime and inode number and of its first, middle
+  // and last kFingerprintBlockSize bytes, or of all of it if it is no
+  // larger than three of them.  Unlike the content hash, this costs the
+  // same to compute however large the file is, but a change that alters
+  // neither the sampled bytes nor the metadata goes unnoticed.
+  // This will block the calling thread while the I/O is performed.
+  // Throws exceptions for any errors that may occur.
+  static HashValue computeFingerprintImmediate(
+      const char* fullPath,
+      const FileInformation& st);
+
+  // As above, for the file at relativePath, via the thread pool.
+  // Fingerprints are cheap enough that they are not cached.
+  folly::Future<HashValue> computeFingerprint(
+      const w_string& relativePath,
+      const FileInformation& st,
+      ThreadPool::Priority priority = ThreadPool::Priority::Hashing) const;
+
   // Compute the hash value for a given input via the thread pool.
   // Returns a future to operate on the result of this async operation
-  folly::Future<HashValue> computeHash(const ContentHashCacheKey& key) const;
+  folly::Future<HashValue> computeHash(
+      const ContentHashCacheKey& key,
+      ThreadPool::Priority priority = ThreadPool::Priority::Hashing) const;
+
+  // Returns the SHA-1 stored in the named extended attribute of fullPath,
+  // either as 20 raw bytes or as 40 hex digits, or std::nullopt if the file
+  // has no such attribute or it is malformed.
+  static std::optional<HashValue> hashFromXattr(
+      const char* fullPath,
+      const w_string& xattrName);
 
   // Returns the root path that this cache is associated with
   const w_string& rootPath() const;
@@ -77,8 +122,31 @@ class ContentHashCache {
   // Returns cache statistics
   CacheStats stats() const;
 
+  // Encode the successfully computed hashes, least recently used first.
+  std::string serialize() const;
+
+  // Add the hashes encoded by serialize() to the cache, preserving their
+  // order of use.  Returns the number of hashes added.
+  // Throws std::runtime_error if the data is malformed.
+  size_t deserialize(std::string_view data);
+
+  // Atomically replace the file at path with the serialized hashes.
+  // Throws std::system_error on failure.
+  void save(const w_string& path) const;
+
+  // Add the hashes saved at path to the cache.  Returns the number of hashes
+  // added, which is 0 if there is no such file.
+  // Throws if the file is unreadable or malformed.
+  size_t load(const w_string& path);
+
+  // Returns the path at which the hashes for rootPath should be saved,
+  // which is alongside the state file.  Returns a null w_string if there
+  // is no state file.
+  static w_string pathForRoot(const w_string& rootPath);
+
  private:
-  LRUCache<ContentHashCacheKey, HashValue> cache_;
+  ShardedLRUCache<ContentHashCacheKey, HashValue> cache_;
   w_string rootPath_;
+  w_string xattrName_;
 };
 } // namespace watchman
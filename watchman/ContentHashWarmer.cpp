@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHashWarmer.h"
+#include <folly/futures/Future.h>
+#include <algorithm>
+#include <vector>
+
+namespace watchman {
+
+namespace {
+// Don't sleep for longer than this waiting for the byte budget to recover,
+// so that a change in the budget or shutdown is noticed promptly.
+constexpr std::chrono::milliseconds kMaxBudgetWait{100};
+} // namespace
+
+ContentHashWarmer::ContentHashWarmer(ContentHashCache& cache)
+    : cache_(cache) {}
+
+ContentHashWarmer::~ContentHashWarmer() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  stopping_ = true;
+  waiting_.clear();
+  idle_.wait(lock, [this] { return inFlight_ == 0 && !timerArmed_; });
+}
+
+void ContentHashWarmer::setBudget(Budget budget) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  budget_ = budget;
+  budget_.maxInFlight = std::max(size_t(1), budget_.maxInFlight);
+  availableBytes_ = double(budget_.bytesPerSecond);
+  lastRefill_ = std::chrono::steady_clock::now();
+}
+
+void ContentHashWarmer::schedule(ContentHashCacheKey key) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (stopping_) {
+    return;
+  }
+  auto [it, inserted] = waiting_.try_emplace(key.relativePath, key);
+  if (!inserted) {
+    // It changed again before we got to it; only the latest matters
+    it->second = std::move(key);
+    ++superseded_;
+    return;
+  }
+  if (recentlyQueried_.count(it->first)) {
+    queried_.push_back(it->first);
+  } else {
+    others_.push_back(it->first);
+  }
+  pump(lock);
+}
+
+void ContentHashWarmer::cancel(const w_string& relativePath) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (waiting_.erase(relativePath)) {
+    ++superseded_;
+    if (waiting_.empty() && inFlight_ == 0) {
+      idle_.notify_all();
+    }
+  }
+}
+
+void ContentHashWarmer::noteQueried(const w_string& relativePath) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!recentlyQueried_.insert(relativePath).second) {
+    return;
+  }
+  recentlyQueriedOrder_.push_back(relativePath);
+  if (recentlyQueriedOrder_.size() > kMaxRecentlyQueried) {
+    recentlyQueried_.erase(recentlyQueriedOrder_.front());
+    recentlyQueriedOrder_.pop_front();
+  }
+  if (waiting_.count(relativePath)) {
+    // Move it to the front of the line; its entry in others_ will find
+    // that it has already been taken and be skipped.
+    queried_.push_back(relativePath);
+  }
+}
+
+void ContentHashWarmer::waitUntilIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return waiting_.empty() && inFlight_ == 0; });
+}
+
+ContentHashWarmer::Stats ContentHashWarmer::getStats() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return Stats{waiting_.size(), inFlight_, warmed_, superseded_};
+}
+
+void ContentHashWarmer::refillBudget(
+    std::chrono::steady_clock::time_point now) {
+  auto rate = double(budget_.bytesPerSecond);
+  auto elapsed = std::chrono::duration<double>(now - lastRefill_).count();
+  availableBytes_ = std::min(rate, availableBytes_ + rate * elapsed);
+  lastRefill_ = now;
+}
+
+void ContentHashWarmer::pump(std::unique_lock<std::mutex>& lock) {
+  if (stopping_) {
+    return;
+  }
+
+  bool limitBytes = budget_.bytesPerSecond > 0;
+  if (limitBytes) {
+    refillBudget(std::chrono::steady_clock::now());
+  }
+
+  std::vector<ContentHashCacheKey> toStart;
+  std::chrono::steady_clock::duration budgetWait{0};
+  while (inFlight_ < budget_.maxInFlight) {
+    auto& queue = queried_.empty() ? others_ : queried_;
+    if (queue.empty()) {
+      break;
+    }
+    if (limitBytes && availableBytes_ <= 0) {
+      if (!timerArmed_) {
+        auto seconds = (1 - availableBytes_) / budget_.bytesPerSecond;
+        budgetWait = std::clamp(
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(seconds)),
+            std::chrono::steady_clock::duration(std::chrono::milliseconds(1)),
+            std::chrono::steady_clock::duration(kMaxBudgetWait));
+        timerArmed_ = true;
+      }
+      break;
+    }
+
+    auto path = std::move(queue.front());
+    queue.pop_front();
+    auto it = waiting_.find(path);
+    if (it == waiting_.end()) {
+      // Cancelled, or already taken via the other queue
+      continue;
+    }
+
+    if (limitBytes) {
+      availableBytes_ -= double(it->second.fileSize);
+    }
+    ++inFlight_;
+    toStart.push_back(std::move(it->second));
+    waiting_.erase(it);
+  }
+
+  if (toStart.empty() && budgetWait.count() == 0) {
+    return;
+  }
+
+  // The continuations below may run inline, so must not find us holding
+  // the lock.
+  lock.unlock();
+  for (auto& key : toStart) {
+    using NodePtr = std::shared_ptr<const ContentHashCache::Node>;
+    cache_.get(key, ThreadPool::Priority::Warming)
+        .thenTry([this](folly::Try<NodePtr>&&) {
+          // Errors are of no interest here; a query that wants the hash
+          // will see them for itself.
+          std::unique_lock<std::mutex> lock(mutex_);
+          --inFlight_;
+          ++warmed_;
+          pump(lock);
+          idle_.notify_all();
+        });
+  }
+  if (budgetWait.count() != 0) {
+    folly::futures::sleep(budgetWait)
+        .toUnsafeFuture()
+        .thenTry([this](folly::Try<folly::Unit>&& result) {
+          std::unique_lock<std::mutex> lock(mutex_);
+          timerArmed_ = false;
+          // If we have no timer then we can't honor the budget; leave the
+          // work for the next schedule() rather than spinning here.
+          if (result.hasValue()) {
+            pump(lock);
+          }
+          idle_.notify_all();
+        });
+  }
+  lock.lock();
+}
+
+} // namespace watchman
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "watchman/ContentHash.h"
+
+namespace watchman {
+
+/**
+ * Populates a ContentHashCache in the background, at warming priority in
+ * the thread pool, while keeping the I/O that it induces within a budget.
+ *
+ * Files whose hashes were recently asked for by a query are warmed ahead
+ * of the others, on the basis that they are likely to be asked for again.
+ * Scheduling a file that is already waiting replaces its key, so that a
+ * file that changes again before it is reached is only hashed once, in its
+ * latest state.
+ */
+class ContentHashWarmer {
+ public:
+  struct Budget {
+    // Upper bound on the bytes read per second; 0 for no limit.  A file
+    // larger than this may still be hashed, but then nothing else will be
+    // started until the budget has caught up.
+    uint64_t bytesPerSecond{0};
+    // Upper bound on the number of files being hashed at once.
+    size_t maxInFlight{8};
+  };
+
+  struct Stats {
+    size_t queued{0};
+    size_t inFlight{0};
+    uint64_t warmed{0};
+    uint64_t superseded{0};
+  };
+
+  explicit ContentHashWarmer(ContentHashCache& cache);
+  ~ContentHashWarmer();
+
+  void setBudget(Budget budget);
+
+  // Queue key to be hashed.  Replaces any key that is already waiting for
+  // the same file.
+  void schedule(ContentHashCacheKey key);
+
+  // Forget any waiting key for relativePath, such as because it has been
+  // deleted.
+  void cancel(const w_string& relativePath);
+
+  // Note that a query asked for the hash of relativePath.
+  void noteQueried(const w_string& relativePath);
+
+  // Block until nothing is waiting or being hashed.
+  void waitUntilIdle();
+
+  Stats getStats();
+
+ private:
+  // How many recently queried paths to remember.
+  static constexpr size_t kMaxRecentlyQueried = 16 * 1024;
+
+  // Starts as much waiting work as the budget allows.  If the byte budget
+  // is what stopped us, arranges to be called again once it has recovered.
+  void pump(std::unique_lock<std::mutex>& lock);
+  void refillBudget(std::chrono::steady_clock::time_point now);
+
+  ContentHashCache& cache_;
+
+  std::mutex mutex_;
+  // Signalled when work finishes or is cancelled, or the timer fires
+  std::condition_variable idle_;
+  Budget budget_;
+  // The waiting keys, by path
+  std::unordered_map<w_string, ContentHashCacheKey> waiting_;
+  // The order in which to visit waiting_; a path that is no longer in
+  // waiting_ has been cancelled and is skipped.
+  std::deque<w_string> queried_;
+  std::deque<w_string> others_;
+
+  std::unordered_set<w_string> recentlyQueried_;
+  std::deque<w_string> recentlyQueriedOrder_;
+
+  size_t inFlight_{0};
+  // Bytes that may be read right now; negative when a large file has
+  // overdrawn the budget.
+  double availableBytes_{0};
+  std::chrono::steady_clock::time_point lastRefill_;
+  bool timerArmed_{false};
+  bool stopping_{false};
+
+  uint64_t warmed_{0};
+  uint64_t superseded_{0};
+};
+
+} // namespace watchman
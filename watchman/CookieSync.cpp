@@ -7,15 +7,27 @@
 
 #include "watchman/CookieSync.h"
 #include <folly/String.h>
+#include <algorithm>
 #include <exception>
 #include <optional>
 #include "watchman/Logging.h"
+#include "watchman/Tracing.h"
 #include "watchman/watchman_stream.h"
 #include "watchman/watchman_system.h"
 
 namespace watchman {
 
-CookieSync::Cookie::Cookie(uint64_t numCookies) : numPending(numCookies) {}
+namespace {
+// How long new syncs wait behind the cookie in flight, before giving up on
+// it and writing a cookie of their own
+constexpr std::chrono::seconds kMaxBatchWait{1};
+
+bool isAtOrBelow(w_string_piece path, w_string_piece dir) {
+  return path == dir ||
+      (path.size() > dir.size() && path.startsWith(dir) &&
+       is_slash(path[dir.size()]));
+}
+} // namespace
 
 CookieSync::CookieSync(FileSystem& fs, const w_string& dir) : fileSystem_{fs} {
   char hostname[256];
@@ -30,8 +42,18 @@ CookieSync::CookieSync(FileSystem& fs, const w_string& dir) : fileSystem_{fs} {
 }
 
 CookieSync::~CookieSync() {
-  // Wake up anyone that might have been waiting on us
+  // Wake up anyone that might have been waiting on us, including the syncs
+  // batched up behind the cookies in flight
+  std::shared_ptr<Cookie> next;
+  {
+    auto batch = batch_.lock();
+    next = std::move(batch->next);
+  }
   abortAllCookies();
+  if (next) {
+    next->promise.setException(
+        folly::make_exception_wrapper<CookieSyncAborted>());
+  }
 }
 
 void CookieSync::addCookieDir(const w_string& dir) {
@@ -47,11 +69,23 @@ void CookieSync::removeCookieDir(const w_string& dir) {
 
   // Cancel the cookies in the removed directory. These are considered to be
   // serviced.
-  auto cookies = cookies_.wlock();
-  for (const auto& [cookiePath, cookie] : *cookies) {
-    if (w_string_startswith(cookiePath, dir)) {
-      cookie->notify();
-      cookies->erase(cookiePath);
+  std::vector<std::shared_ptr<Cookie>> removed;
+  {
+    auto cookies = cookies_.wlock();
+    for (auto it = cookies->begin(); it != cookies->end();) {
+      if (w_string_startswith(it->first, dir)) {
+        removed.push_back(std::move(it->second));
+        it = cookies->erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  // Notify outside of the lock, as the waiters' callbacks may sync again
+  for (auto& cookie : removed) {
+    if (cookie->notify()) {
+      writeNextCookie();
     }
   }
 }
@@ -71,11 +105,112 @@ std::vector<w_string> CookieSync::getOutstandingCookieFileList() const {
   return result;
 }
 
-folly::Future<CookieSync::SyncResult> CookieSync::sync() {
-  auto prefixes = cookiePrefix();
+std::vector<w_string> CookieSync::getPendingScopes() const {
+  std::vector<w_string> result;
+  for (auto& it : *cookies_.rlock()) {
+    auto& cookie = *it.second;
+    if (cookie.wholeView) {
+      continue;
+    }
+    for (auto& scope : cookie.scopes) {
+      if (std::find(result.begin(), result.end(), scope) == result.end()) {
+        result.push_back(scope);
+      }
+    }
+  }
+  return result;
+}
+
+bool CookieSync::isScopedCookie(const w_string& path) const {
+  auto cookies = cookies_.rlock();
+  auto it = cookies->find(path);
+  return it != cookies->end() && !it->second->wholeView;
+}
+
+folly::Future<CookieSync::SyncResult> CookieSync::sync(
+    const w_string& scope) {
+  std::shared_ptr<Cookie> cookie;
+  bool writeNow = false;
+  {
+    auto batch = batch_.lock();
+    if (!batch->next) {
+      batch->next = std::make_shared<Cookie>();
+    }
+    cookie = batch->next;
+    // The cookie isn't touched yet, so its scope can still change
+    if (scope.empty()) {
+      cookie->wholeView = true;
+    } else if (
+        std::find(cookie->scopes.begin(), cookie->scopes.end(), scope) ==
+        cookie->scopes.end()) {
+      cookie->scopes.push_back(scope);
+    }
+    if (batch->numInFlight == 0 ||
+        std::chrono::steady_clock::now() - batch->lastWrite > kMaxBatchWait) {
+      // There is nothing worth waiting behind, so don't wait for company
+      batch->next.reset();
+      batch->numInFlight++;
+      batch->lastWrite = std::chrono::steady_clock::now();
+      writeNow = true;
+    }
+    // Otherwise the cookie is written once the one in flight is observed.
+    // Anything this sync needs to see happened before that, so the shared
+    // cookie ordering after it is enough.
+  }
+
+  auto future = cookie->promise.getFuture();
+  if (writeNow) {
+    try {
+      writeCookie(cookie);
+    } catch (const std::system_error&) {
+      // No other sync can have joined this cookie, but some may have
+      // batched up behind it
+      writeNextCookie();
+      throw;
+    }
+  }
+  return future;
+}
+
+void CookieSync::writeNextCookie() {
+  while (true) {
+    std::shared_ptr<Cookie> cookie;
+    {
+      auto batch = batch_.lock();
+      batch->numInFlight--;
+      if (!batch->next) {
+        return;
+      }
+      cookie = std::move(batch->next);
+      batch->numInFlight++;
+      batch->lastWrite = std::chrono::steady_clock::now();
+    }
+
+    try {
+      writeCookie(cookie);
+      return;
+    } catch (const std::system_error& e) {
+      // Fail this batch, and give the syncs made since then their turn
+      cookie->promise.setException(
+          folly::exception_wrapper{std::current_exception(), e});
+    }
+  }
+}
+
+void CookieSync::writeCookie(const std::shared_ptr<Cookie>& cookie) {
+  std::unordered_set<w_string> prefixes;
+  {
+    // The scopes are fixed now that the cookie is being written
+    auto dirs = cookieDirsForScopes(
+        cookie->wholeView ? std::vector<w_string>{} : cookie->scopes);
+    auto guard = cookieDirs_.rlock();
+    for (const auto& dir : dirs) {
+      prefixes.insert(w_string::build(dir, "/", guard->cookiePrefix_));
+    }
+  }
   auto serial = serial_++;
 
-  auto cookie = std::make_shared<Cookie>(prefixes.size());
+  cookie->numPending.store(prefixes.size(), std::memory_order_release);
 
   // Even though we only write to the cookie at the end of the function, we
   // need to hold it while the files are written on disk to avoid a race where
@@ -87,11 +222,10 @@ folly::Future<CookieSync::SyncResult> CookieSync::sync() {
   CookieMap pendingCookies;
   std::optional<std::tuple<w_string, int>> lastError;
 
-  std::vector<w_string> cookieFileNames;
-  cookieFileNames.reserve(prefixes.size());
+  cookie->fileNames.reserve(prefixes.size());
   for (const auto& prefix : prefixes) {
     auto path_str = w_string::build(prefix, serial);
-    cookieFileNames.push_back(path_str);
+    cookie->fileNames.push_back(path_str);
 
     /* then touch the file */
     try {
@@ -108,6 +242,7 @@ folly::Future<CookieSync::SyncResult> CookieSync::sync() {
     }
 
     /* insert the cookie into the temporary map */
+    WATCHMAN_TRACE(cookie_create, path_str.c_str());
     pendingCookies[path_str] = cookie;
     logf(DBG, "sync created cookie file {}\n", path_str);
   }
@@ -126,21 +261,18 @@ folly::Future<CookieSync::SyncResult> CookieSync::sync() {
   }
 
   cookiesLock->insert(pendingCookies.begin(), pendingCookies.end());
-
-  return cookie->promise.getFuture().thenValue(
-      [cookieFileNames = std::move(cookieFileNames)](folly::Unit) mutable {
-        return SyncResult{std::move(cookieFileNames)};
-      });
 }
 
 CookieSync::SyncResult CookieSync::syncToNow(
-    std::chrono::milliseconds timeout) {
+    std::chrono::milliseconds timeout,
+    const w_string& scope) {
   /* compute deadline */
   using namespace std::chrono;
   auto deadline = system_clock::now() + timeout;
+  auto start = steady_clock::now();
 
   while (true) {
-    auto cookieFuture = sync();
+    auto cookieFuture = sync(scope);
 
     folly::Try<SyncResult> result;
     try {
@@ -157,9 +289,15 @@ CookieSync::SyncResult CookieSync::syncToNow(
 
     if (result.hasValue()) {
       // Success!
+      syncLatency_.record(steady_clock::now() - start);
       return std::move(result).value();
     }
 
+    if (!result.hasException<CookieSyncAborted>()) {
+      // The batch this sync joined couldn't write its cookie
+      result.throwUnlessValue();
+    }
+
     // Sync was aborted by a recrawl; recompute the timeout
     // and wait again if we still have time
     timeout = duration_cast<milliseconds>(deadline - system_clock::now());
@@ -184,14 +322,17 @@ void CookieSync::abortAllCookies() {
     if (cookie->numPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
       cookie->promise.setException(
           folly::make_exception_wrapper<CookieSyncAborted>());
+      writeNextCookie();
     }
   }
 }
 
-void CookieSync::Cookie::notify() {
+bool CookieSync::Cookie::notify() {
   if (numPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
-    promise.setValue();
+    promise.setValue(SyncResult{fileNames});
+    return true;
   }
+  return false;
 }
 
 void CookieSync::notifyCookie(const w_string& path) {
@@ -212,9 +353,12 @@ void CookieSync::notifyCookie(const w_string& path) {
       map->erase(cookie_iter);
     }
   }
+  WATCHMAN_TRACE(cookie_observe, path.c_str(), int(bool(cookie)));
 
   if (cookie) {
-    cookie->notify();
+    if (cookie->notify()) {
+      writeNextCookie();
+    }
 
     // The file may not exist at this point; we're just taking this
     // opportunity to remove it if nothing else has done so already.
@@ -262,4 +406,32 @@ std::unordered_set<w_string> CookieSync::cookieDirs() const {
   return res;
 }
 
+std::unordered_set<w_string> CookieSync::cookieDirsForScopes(
+    const std::vector<w_string>& scopes) const {
+  auto guard = cookieDirs_.rlock();
+  const auto& dirs = guard->dirs_;
+  if (scopes.empty() || dirs.size() == 1) {
+    return dirs;
+  }
+
+  std::unordered_set<w_string> res;
+  for (const auto& scope : scopes) {
+    const w_string* covering = nullptr;
+    for (const auto& dir : dirs) {
+      if (isAtOrBelow(scope, dir)) {
+        if (!covering || dir.size() > covering->size()) {
+          covering = &dir;
+        }
+      } else if (isAtOrBelow(dir, scope)) {
+        res.insert(dir);
+      }
+    }
+    if (!covering) {
+      return dirs;
+    }
+    res.insert(*covering);
+  }
+  return res;
+}
+
 } // namespace watchman
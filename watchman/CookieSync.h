@@ -8,7 +8,9 @@
 #pragma once
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
 #include "watchman/Cookie.h"
+#include "watchman/Metrics.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/watchman_string.h"
 
@@ -47,19 +49,32 @@ class CookieSync {
    * Throws a std::system_error with an ETIMEDOUT
    * error if the timeout expires before we observe the change, or a
    * runtime_error if the root has been deleted or rendered inaccessible.
+   *
+   * If scope names a dir, the caller only needs the changes beneath it, and
+   * the IO thread may settle the cookie as soon as it has processed those,
+   * ahead of the rest of its backlog.  Cookies are then only written to
+   * the cookie dirs that cover the scope; see cookieDirsForScopes.
    */
-  SyncResult syncToNow(std::chrono::milliseconds timeout);
+  SyncResult syncToNow(
+      std::chrono::milliseconds timeout,
+      const w_string& scope = w_string());
 
   /**
    * Touches a cookie file and returns a Future that will
    * be ready when that cookie file is processed by the IO
    * thread at some future time.
+   * Syncs that are made while a cookie is already waiting to be observed
+   * are batched: they share the next cookie, which is touched once the
+   * outstanding one has been observed, so that a burst of queries costs
+   * two round trips through the watcher rather than one cookie each.
    * Important: if you chain a lambda onto the future, it
    * will execute in the context of the IO thread.
    * It is recommended that you minimize the actions performed
    * in that context to avoid holding up the IO thread.
+   * scope is as for syncToNow; a cookie shared by several syncs is only
+   * scoped if all of them are, to the union of their scopes.
    **/
-  folly::Future<SyncResult> sync();
+  folly::Future<SyncResult> sync(const w_string& scope = w_string());
 
   /* If path is a valid cookie in the map, notify the waiter.
    * Returns true if the path matches the cookie prefix (not just
@@ -83,23 +98,69 @@ class CookieSync {
 
   std::unordered_set<w_string> cookieDirs() const;
 
+  // Returns the cookie dirs that a sync scoped to scopes needs cookies in:
+  // for each scope, the innermost cookie dir at or above it, whose watcher
+  // reports the changes beneath it, along with any cookie dirs beneath the
+  // scope.  Returns all of them if scopes is empty, or if some scope isn't
+  // covered by any of them.
+  std::unordered_set<w_string> cookieDirsForScopes(
+      const std::vector<w_string>& scopes) const;
+
   // Returns the list of cookies that are pending observation; each of
   // these has an associated waiting client.
   std::vector<w_string> getOutstandingCookieFileList() const;
 
+  // Returns the dirs that the scoped cookies pending observation are scoped
+  // to, for the IO thread to process the changes beneath them first.
+  std::vector<w_string> getPendingScopes() const;
+
+  // Returns true if path is a cookie pending observation that is scoped,
+  // and so can be settled once the changes in its scope are processed.
+  bool isScopedCookie(const w_string& path) const;
+
+  // How long successful syncToNow calls took to observe their cookies.
+  const LatencyHistogram& getSyncLatency() const {
+    return syncLatency_;
+  }
+
  private:
   CookieSync(CookieSync&&) = delete;
   CookieSync& operator=(CookieSync&&) = delete;
 
   struct Cookie {
-    folly::Promise<folly::Unit> promise;
-    std::atomic<uint64_t> numPending;
-
-    explicit Cookie(uint64_t numCookies);
+    // Fulfilled for every sync in the batch that shares this cookie
+    folly::SharedPromise<SyncResult> promise;
+    std::atomic<uint64_t> numPending{0};
+    // Set once the cookie files have been touched
+    std::vector<w_string> fileNames;
+    // The dirs that the syncs sharing this cookie are scoped to, unless
+    // one of them needs the whole view.  Fixed once the files are touched.
+    std::vector<w_string> scopes;
+    bool wholeView{false};
+
+    // Returns true if this completed the cookie
+    bool notify();
+  };
 
-    void notify();
+  struct Batch {
+    // The cookie that new syncs join while another is in flight
+    std::shared_ptr<Cookie> next;
+    // Cookies that have been touched and not yet observed or aborted
+    size_t numInFlight{0};
+    // When the most recent cookie was touched.  A cookie whose notification
+    // went astray would otherwise hold up every later sync, so syncs stop
+    // waiting behind one that is taking too long and write their own.
+    std::chrono::steady_clock::time_point lastWrite;
   };
 
+  // Touches the cookie files for cookie and starts watching for them.
+  // Throws std::system_error if not one of them could be created.
+  void writeCookie(const std::shared_ptr<Cookie>& cookie);
+
+  // Called when the cookie in flight completes; touches the batched cookie,
+  // if any syncs are waiting on one.
+  void writeNextCookie();
+
   struct CookieDirectories {
     // paths to the query cookies directories. A cookie will be written to each
     // of these when calling `sync`.
@@ -115,5 +176,7 @@ class CookieSync {
   std::atomic<uint32_t> serial_{0};
   using CookieMap = std::unordered_map<w_string, std::shared_ptr<Cookie>>;
   folly::Synchronized<CookieMap> cookies_;
+  folly::Synchronized<Batch, std::mutex> batch_;
+  LatencyHistogram syncLatency_;
 };
 } // namespace watchman
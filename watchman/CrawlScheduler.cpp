@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CrawlScheduler.h"
+
+namespace watchman {
+
+namespace {
+// Priorities change without telling the scheduler, such as when a client
+// starts querying a root, so waiting crawls compare them again this often
+constexpr std::chrono::seconds kRecheckInterval{1};
+
+json_int_t millisecondsSince(std::chrono::steady_clock::time_point then) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now() - then)
+      .count();
+}
+} // namespace
+
+CrawlScheduler::Slot::Slot(Slot&& other) noexcept
+    : scheduler_{other.scheduler_}, crawl_{other.crawl_} {
+  other.scheduler_ = nullptr;
+}
+
+CrawlScheduler::Slot& CrawlScheduler::Slot::operator=(Slot&& other) noexcept {
+  if (this != &other) {
+    if (scheduler_) {
+      scheduler_->release(crawl_);
+    }
+    scheduler_ = other.scheduler_;
+    crawl_ = other.crawl_;
+    other.scheduler_ = nullptr;
+  }
+  return *this;
+}
+
+CrawlScheduler::Slot::~Slot() {
+  if (scheduler_) {
+    scheduler_->release(crawl_);
+  }
+}
+
+void CrawlScheduler::Slot::setProgress(uint64_t items) {
+  if (!scheduler_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(scheduler_->mutex_);
+  crawl_->progress = items;
+}
+
+CrawlScheduler& CrawlScheduler::get() {
+  // Leaked, as IO threads may still be crawling as the process exits
+  static auto* scheduler = new CrawlScheduler;
+  return *scheduler;
+}
+
+void CrawlScheduler::setOptions(const Options& options) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    options_ = options;
+  }
+  cond_.notify_all();
+}
+
+bool CrawlScheduler::mayStart(const Crawl& crawl) {
+  bool mayStart = options_.maxConcurrent == 0 ||
+      running_ < options_.maxConcurrent;
+
+  // The one with the highest priority goes first, or the one queued first
+  // among those with the same priority
+  const Crawl* best = nullptr;
+  for (auto& other : crawls_) {
+    if (other.running) {
+      continue;
+    }
+    other.lastPriority = other.priority();
+    if (!best || other.lastPriority > best->lastPriority) {
+      best = &other;
+    }
+  }
+  if (best != &crawl) {
+    return false;
+  }
+  if (crawl.lastPriority <= 0 && runningBackground_ > 0) {
+    return false;
+  }
+  return mayStart;
+}
+
+CrawlScheduler::Slot CrawlScheduler::acquire(
+    const std::string& name,
+    Priority priority,
+    std::function<bool()> stop) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto crawl = crawls_.emplace(crawls_.end());
+  crawl->name = name;
+  crawl->priority = std::move(priority);
+  crawl->queued = std::chrono::steady_clock::now();
+
+  while (!mayStart(*crawl)) {
+    if (stop()) {
+      crawls_.erase(crawl);
+      // It may have been holding up the others
+      lock.unlock();
+      cond_.notify_all();
+      return Slot();
+    }
+    cond_.wait_for(lock, kRecheckInterval);
+  }
+
+  crawl->running = true;
+  crawl->background = crawl->lastPriority <= 0;
+  crawl->started = std::chrono::steady_clock::now();
+  ++running_;
+  if (crawl->background) {
+    ++runningBackground_;
+  }
+  return Slot(this, crawl);
+}
+
+void CrawlScheduler::release(std::list<Crawl>::iterator crawl) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --running_;
+    if (crawl->background) {
+      --runningBackground_;
+    }
+    crawls_.erase(crawl);
+  }
+  cond_.notify_all();
+}
+
+void CrawlScheduler::wake() {
+  cond_.notify_all();
+}
+
+json_ref CrawlScheduler::getStatus(const std::string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& crawl : crawls_) {
+    if (crawl.name != name) {
+      continue;
+    }
+    if (crawl.running) {
+      return json_object(
+          {{"state", typed_string_to_json("crawling")},
+           {"background", json_boolean(crawl.background)},
+           {"crawl_ms", json_integer(millisecondsSince(crawl.started))},
+           {"items", json_integer(json_int_t(crawl.progress))}});
+    }
+    return json_object(
+        {{"state", typed_string_to_json("waiting")},
+         {"priority", json_integer(crawl.lastPriority)},
+         {"wait_ms", json_integer(millisecondsSince(crawl.queued))}});
+  }
+  return json_null();
+}
+
+json_ref CrawlScheduler::getSummary() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return json_object(
+      {{"max_concurrent", json_integer(json_int_t(options_.maxConcurrent))},
+       {"running", json_integer(json_int_t(running_))},
+       {"waiting", json_integer(json_int_t(crawls_.size() - running_))}});
+}
+
+} // namespace watchman
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+/**
+ * Limits how many full crawls run at once across all of the roots of the
+ * daemon.
+ *
+ * After a sleep and resume, or the loss of the inotify watches, every root
+ * asks for a recrawl at about the same time, and running all of those
+ * crawls together thrashes the disk so that none of them finishes quickly.
+ * Instead, the IO thread of each root waits for one of maxConcurrent
+ * slots.  A free slot goes to the waiting crawl with the highest priority,
+ * such as that of a root that a client is querying, so that the roots in
+ * use recover first.  Crawls of background roots, whose priority is zero,
+ * run one at a time, and only while nothing more important is waiting.
+ */
+class CrawlScheduler {
+ private:
+  struct Crawl;
+
+ public:
+  struct Options {
+    // Zero is unlimited
+    size_t maxConcurrent{2};
+  };
+
+  // Returns the current priority of a crawl; higher goes first.  It is
+  // called again each time a slot is handed out, with the scheduler locked,
+  // so it must be cheap and must not call back into the scheduler.
+  using Priority = std::function<int()>;
+
+  // Held for the duration of a crawl, which ends when it is destroyed
+  class Slot {
+   public:
+    Slot() = default;
+    Slot(Slot&& other) noexcept;
+    Slot& operator=(Slot&& other) noexcept;
+    ~Slot();
+
+    explicit operator bool() const {
+      return scheduler_ != nullptr;
+    }
+
+    // Records how many items the crawl has processed so far
+    void setProgress(uint64_t items);
+
+   private:
+    friend class CrawlScheduler;
+    Slot(CrawlScheduler* scheduler, std::list<Crawl>::iterator crawl)
+        : scheduler_{scheduler}, crawl_{crawl} {}
+
+    CrawlScheduler* scheduler_{nullptr};
+    std::list<Crawl>::iterator crawl_;
+  };
+
+  // The scheduler shared by every root of the daemon
+  static CrawlScheduler& get();
+
+  void setOptions(const Options& options);
+
+  // Waits until the crawl named name may start, and returns its slot.
+  // Returns an empty slot instead if stop() returns true, which is checked
+  // whenever the scheduler changes hands or wake() is called.
+  Slot acquire(
+      const std::string& name,
+      Priority priority,
+      std::function<bool()> stop = [] { return false; });
+
+  // Wakes the waiting crawls, so that they check their stop conditions
+  void wake();
+
+  // Returns the state of the crawl named name, or null if it is neither
+  // waiting nor running
+  json_ref getStatus(const std::string& name) const;
+
+  // Returns the limit and the number of crawls running and waiting
+  json_ref getSummary() const;
+
+ private:
+  struct Crawl {
+    std::string name;
+    Priority priority;
+    // As of the last time that the waiting crawls were compared
+    int lastPriority{0};
+    bool running{false};
+    bool background{false};
+    uint64_t progress{0};
+    std::chrono::steady_clock::time_point queued;
+    std::chrono::steady_clock::time_point started;
+  };
+
+  // Whether crawl, which is waiting, is the one to start next.  Updates
+  // the lastPriority of every waiting crawl.
+  bool mayStart(const Crawl& crawl);
+  void release(std::list<Crawl>::iterator crawl);
+
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  Options options_;
+  // In the order that they were queued
+  std::list<Crawl> crawls_;
+  size_t running_{0};
+  size_t runningBackground_{0};
+};
+
+} // namespace watchman
@@ -8,6 +8,8 @@
 #pragma once
 
 #include <folly/Conv.h>
+#include <chrono>
+#include <cstdint>
 #include <string>
 #include <system_error>
 
@@ -129,6 +131,35 @@ class QueryExecError : public std::runtime_error {
             std::forward<Args>(args)...)) {}
 };
 
+/**
+ * A query that was refused because its client has used up its budget for
+ * query execution; it may be sent again after retryAfter.
+ */
+class QueryAdmissionError : public QueryExecError {
+ public:
+  QueryAdmissionError(int64_t pid, std::chrono::milliseconds retryAfter)
+      : QueryExecError(
+            "client pid ",
+            pid,
+            " has used up its query budget; retry in ",
+            retryAfter.count(),
+            "ms"),
+        retryAfter(retryAfter) {}
+
+  std::chrono::milliseconds retryAfter;
+};
+
+/**
+ * A query that was abandoned part way through, because its client hung up,
+ * its query_deadline_ms passed, or the daemon is shutting down.
+ */
+class QueryCancelledError : public QueryExecError {
+ public:
+  template <typename... Args>
+  explicit QueryCancelledError(Args&&... args)
+      : QueryExecError("cancelled: ", std::forward<Args>(args)...) {}
+};
+
 /**
  * Represents an error resolving a root.
  */
@@ -25,7 +25,73 @@ void IgnoreSet::add(const w_string& path, bool is_vcs_ignore) {
   }
 }
 
+void IgnoreSet::addGlob(const w_string& root, w_string_piece pattern) {
+  glob_root = root;
+  auto patternStr = pattern.view();
+  if (patternStr.find('/') == std::string_view::npos) {
+    name_globs.add(patternStr, 0);
+  } else {
+    path_globs.add(patternStr, 0);
+  }
+}
+
+bool IgnoreSet::isBelowGlobRoot(w_string_piece path) const {
+  return path.size() > glob_root.size() + 1 && path.startsWith(glob_root) &&
+      is_slash(path[glob_root.size()]);
+}
+
+bool IgnoreSet::matchesGlob(std::string_view rel, size_t nameStart) const {
+  return name_globs.matchesAny(rel.substr(nameStart)) ||
+      path_globs.matchesAny(rel);
+}
+
 bool IgnoreSet::isIgnored(const char* path, uint32_t pathlen) const {
+  if (isIgnoredByTree(path, pathlen)) {
+    return true;
+  }
+  if (!hasGlobs() || !isBelowGlobRoot(w_string_piece(path, pathlen))) {
+    return false;
+  }
+
+  // Anything beneath an ignored dir is ignored too, so each of the parents
+  // below the root needs to be checked as well as the path itself.  The
+  // relative path is built up in unix form as we go, as the matchers need
+  // it to be NUL terminated at each step.
+  std::string rel;
+  rel.reserve(pathlen - glob_root.size() - 1);
+  size_t nameStart = 0;
+  const char* end = path + pathlen;
+  for (const char* p = path + glob_root.size() + 1;; ++p) {
+    if (p == end || is_slash(*p)) {
+      if (matchesGlob(rel, nameStart)) {
+        return true;
+      }
+      if (p == end) {
+        return false;
+      }
+      rel.push_back('/');
+      nameStart = rel.size();
+    } else {
+      rel.push_back(*p);
+    }
+  }
+}
+
+bool IgnoreSet::isIgnoredByGlob(const w_string& path) const {
+  if (!hasGlobs() || !isBelowGlobRoot(path)) {
+    return false;
+  }
+  w_string_piece rel{path};
+  rel.advance(glob_root.size() + 1);
+#ifdef _WIN32
+  // wildmatch wants unix separators
+  auto normalized = rel.asWString().normalizeSeparators();
+  rel = normalized;
+#endif
+  return matchesGlob(rel.view(), rel.size() - rel.baseName().size());
+}
+
+bool IgnoreSet::isIgnoredByTree(const char* path, uint32_t pathlen) const {
   const char* skip_prefix;
   uint32_t len;
   auto leaf = tree.longestMatch((const unsigned char*)path, (int)pathlen);
@@ -8,7 +8,9 @@
 #pragma once
 
 #include <unordered_set>
+#include "watchman/query/GlobSet.h"
 #include "watchman/thirdparty/libart/src/art.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
 #include "watchman/watchman_string.h"
 
 namespace watchman {
@@ -20,10 +22,22 @@ class IgnoreSet {
   // or a vcs-style grandchild ignore.
   void add(const w_string& path, bool is_vcs_ignore);
 
+  // Adds a wildmatch pattern to the ignore list.  Anything beneath root
+  // that matches it is ignored, along with everything below it.  A pattern
+  // without a slash is matched against the name of each file and dir, and
+  // one with a slash against its path relative to root.
+  // All of the patterns must share the same root.
+  void addGlob(const w_string& root, w_string_piece pattern);
+
   // Tests whether path is ignored.
   // Returns true if the path is ignored, false otherwise.
   bool isIgnored(const char* path, uint32_t pathlen) const;
 
+  // Tests whether path itself matches one of the glob ignores, without
+  // considering its parents, which the crawler has already ruled out.
+  // path must be the full path to a file beneath the glob root.
+  bool isIgnoredByGlob(const w_string& path) const;
+
   // Test whether path is listed in ignore vcs config
   bool isIgnoreVCS(const w_string& path) const;
 
@@ -35,6 +49,16 @@ class IgnoreSet {
   }
 
  private:
+  bool isIgnoredByTree(const char* path, uint32_t pathlen) const;
+
+  bool hasGlobs() const {
+    return !name_globs.empty() || !path_globs.empty();
+  }
+  bool isBelowGlobRoot(w_string_piece path) const;
+  // rel is a path relative to the glob root, whose final component starts
+  // at nameStart
+  bool matchesGlob(std::string_view rel, size_t nameStart) const;
+
   // if the map has an entry for a given dir, we're ignoring it */
   std::unordered_set<w_string> ignore_vcs;
   std::unordered_set<w_string> ignore_dirs;
@@ -46,6 +70,12 @@ class IgnoreSet {
    * that we can exclude things deterministically and fit within
    * system limits. */
   std::vector<w_string> dirs_vec;
+
+  // The glob ignores, split by whether they apply to the name or to the
+  // relative path of a file
+  w_string glob_root;
+  GlobSet name_globs;
+  GlobSet path_globs{WM_PATHNAME};
 };
 
 } // namespace watchman
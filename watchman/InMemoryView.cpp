@@ -7,19 +7,29 @@
 
 #include "watchman/InMemoryView.h"
 #include <folly/ScopeGuard.h>
+#include <folly/futures/Future.h>
 #include <algorithm>
 #include <chrono>
+#include <cstring>
+#include <iterator>
+#include <limits>
 #include <memory>
 #include <thread>
+#include "watchman/CrawlScheduler.h"
 #include "watchman/Errors.h"
+#include "watchman/NodeArena.h"
+#include "watchman/NumaBinding.h"
+#include "watchman/Options.h"
 #include "watchman/ThreadPool.h"
+#include "watchman/ThreadStats.h"
+#include "watchman/ViewSnapshot.h"
 #include "watchman/query/GlobTree.h"
+#include "watchman/query/LocalFileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
 #include "watchman/query/eval.h"
 #include "watchman/root/Root.h"
 #include "watchman/scm/SCM.h"
-#include "watchman/thirdparty/wildmatch/wildmatch.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watchman_file.h"
 
@@ -30,6 +40,24 @@ static std::atomic<long> next_root_number{1};
 namespace watchman {
 
 namespace {
+// How long ageOut holds the view lock before letting queries in
+constexpr std::chrono::milliseconds kAgeOutSliceDuration{10};
+
+// Below this many files, evaluating a query isn't worth handing out to
+// the thread pool
+constexpr size_t kMinFilesForParallelQuery = 8192;
+
+// The recency list is checkpointed at least this often, and keeps no more
+// than this many checkpoints
+constexpr uint64_t kMinRecencyCheckpointInterval = 256;
+constexpr size_t kMaxRecencyCheckpoints = 1024;
+
+// A since query only considers walking the dir that it is restricted to,
+// rather than the recency list, when the list walk would visit at least
+// this many files, and the dir holds at most this fraction of them.
+constexpr uint64_t kMinSinceWalkForDirScan = 16384;
+constexpr uint64_t kSinceWalkToDirScanRatio = 4;
+
 /** Concatenate dir_name and name around a unix style directory
  * separator.
  * dir_name may be NULL in which case this returns a copy of name.
@@ -56,19 +84,44 @@ InMemoryViewCaches::InMemoryViewCaches(
     const w_string& rootPath,
     size_t maxHashes,
     size_t maxSymlinks,
-    std::chrono::milliseconds errorTTL)
-    : contentHashCache(rootPath, maxHashes, errorTTL),
-      symlinkTargetCache(rootPath, maxSymlinks, errorTTL) {}
+    std::chrono::milliseconds errorTTL,
+    w_string hashXattrName)
+    : contentHashCache(
+          rootPath,
+          maxHashes,
+          errorTTL,
+          std::move(hashXattrName)),
+      symlinkTargetCache(rootPath, maxSymlinks, errorTTL),
+      contentHashWarmer(contentHashCache) {}
 
 InMemoryFileResult::InMemoryFileResult(
     const watchman_file* file,
-    InMemoryViewCaches& caches)
-    : file_(file), caches_(caches) {}
+    InMemoryViewCaches& caches,
+    w_string dirName)
+    : file_(file), dirName_(std::move(dirName)), caches_(caches) {}
+
+std::unique_ptr<InMemoryFileResult> InMemoryFileResult::make(
+    NodeArena& arena,
+    const watchman_file* file,
+    InMemoryViewCaches& caches,
+    w_string dirName) {
+  return std::unique_ptr<InMemoryFileResult>(
+      new (arena) InMemoryFileResult(file, caches, std::move(dirName)));
+}
+
+std::unique_ptr<InMemoryFileResult> InMemoryFileResult::make(
+    NodeArena& arena,
+    const InMemoryFileResult& other) {
+  return std::unique_ptr<InMemoryFileResult>(
+      new (arena) InMemoryFileResult(other));
+}
 
 void InMemoryFileResult::batchFetchProperties(
-    const std::vector<std::unique_ptr<FileResult>>& files) {
+    const std::vector<std::unique_ptr<FileResult>>& files,
+    PropertyCacheStats* cacheStats) {
   std::vector<folly::Future<folly::Unit>> readlinkFutures;
   std::vector<folly::Future<folly::Unit>> sha1Futures;
+  std::vector<folly::Future<folly::Unit>> fingerprintFutures;
 
   // Since we may initiate some async work in the body of the function
   // below, we need to ensure that we wait for it to complete before
@@ -82,13 +135,18 @@ void InMemoryFileResult::batchFetchProperties(
     if (!sha1Futures.empty()) {
       folly::collectAll(sha1Futures.begin(), sha1Futures.end()).wait();
     }
+    if (!fingerprintFutures.empty()) {
+      folly::collectAll(fingerprintFutures.begin(), fingerprintFutures.end())
+          .wait();
+    }
   };
 
   for (auto& f : files) {
     auto* file = dynamic_cast<InMemoryFileResult*>(f.get());
+    w_string relativePath;
 
     if (file->neededProperties() & FileResult::Property::SymlinkTarget) {
-      if (!file->file_->stat.isSymlink()) {
+      if (!file->fileStat().isSymlink()) {
         // If this file is not a symlink then we yield
         // a nullptr w_string instance rather than propagating an error.
         // This behavior is relied upon by the field rendering code and
@@ -106,10 +164,16 @@ void InMemoryFileResult::batchFetchProperties(
         }
 
         SymlinkTargetCacheKey key{
-            w_string::pathCat({dir, file->baseName()}), file->file_->otime};
+            w_string::pathCat({dir, file->baseName()}), file->fileOtime()};
 
+        auto target = caches_.symlinkTargetCache.get(key);
+        if (cacheStats) {
+          // Only a cached target comes back already fulfilled
+          ++(target.isReady() ? cacheStats->symlinkTarget.hits
+                              : cacheStats->symlinkTarget.misses);
+        }
         readlinkFutures.emplace_back(
-            caches_.symlinkTargetCache.get(key).thenTry(
+            std::move(target).thenTry(
                 [file](folly::Try<std::shared_ptr<
                            const SymlinkTargetCache::Node>>&& result) {
                   if (result.hasValue()) {
@@ -124,7 +188,9 @@ void InMemoryFileResult::batchFetchProperties(
       }
     }
 
-    if (file->neededProperties() & FileResult::Property::ContentSha1) {
+    if (file->neededProperties() &
+        (FileResult::Property::ContentSha1 |
+         FileResult::Property::ContentFingerprint)) {
       auto dir = file->dirName();
       dir.advance(file->caches_.contentHashCache.rootPath().size());
 
@@ -134,13 +200,37 @@ void InMemoryFileResult::batchFetchProperties(
         // front of dir
         dir.advance(1);
       }
+      relativePath = w_string::pathCat({dir, file->baseName()});
+    }
 
-      ContentHashCacheKey key{
-          w_string::pathCat({dir, file->baseName()}),
-          size_t(file->file_->stat.size),
-          file->file_->stat.mtime};
+    if (file->neededProperties() & FileResult::Property::ContentFingerprint) {
+      auto st = file->fileStat();
+      fingerprintFutures.emplace_back(
+          caches_.contentHashCache.computeFingerprint(relativePath, st)
+              .thenTry([file](folly::Try<ContentHashCache::HashValue>&&
+                                  result) {
+                file->contentFingerprint_ =
+                    makeResultWith([&] { return result.value(); });
+              }));
+
+      auto minSize = caches_.fingerprintFullHashMinSize;
+      if (minSize && uint64_t(st.size) >= minSize) {
+        caches_.contentHashWarmer.schedule(
+            ContentHashCacheKey{relativePath, size_t(st.size), st.mtime});
+      }
+    }
 
-      sha1Futures.emplace_back(caches_.contentHashCache.get(key).thenTry(
+    if (file->neededProperties() & FileResult::Property::ContentSha1) {
+      auto st = file->fileStat();
+      ContentHashCacheKey key{relativePath, size_t(st.size), st.mtime};
+
+      caches_.contentHashWarmer.noteQueried(key.relativePath);
+      auto hash = caches_.contentHashCache.get(key);
+      if (cacheStats) {
+        ++(hash.isReady() ? cacheStats->contentSha1.hits
+                          : cacheStats->contentSha1.misses);
+      }
+      sha1Futures.emplace_back(std::move(hash).thenTry(
           [file](folly::Try<std::shared_ptr<const ContentHashCache::Node>>&&
                      result) {
             file->contentSha1_ =
@@ -152,27 +242,54 @@ void InMemoryFileResult::batchFetchProperties(
   }
 }
 
+void InMemoryFileResult::detach() {
+  if (detached_) {
+    return;
+  }
+  dirName();
+  if (!symlinkTarget_.has_value()) {
+    if (auto target = file_->getSymlinkTarget()) {
+      symlinkTarget_ = std::move(target);
+    }
+  }
+  detached_ = Detached{
+      file_->getStat(),
+      file_->ctime,
+      file_->otime,
+      file_->exists,
+      file_->getName().asWString(),
+      file_};
+  file_ = nullptr;
+}
+
+const void* InMemoryFileResult::identity() const {
+  return detached_ ? detached_->node : file_;
+}
+
 std::optional<FileInformation> InMemoryFileResult::stat() {
-  return file_->stat;
+  return fileStat();
 }
 
 std::optional<size_t> InMemoryFileResult::size() {
-  return file_->stat.size;
+  return detached_ ? detached_->stat.size : file_->stat.size;
 }
 
 std::optional<struct timespec> InMemoryFileResult::accessedTime() {
-  return file_->stat.atime;
+  return fileStat().atime;
 }
 
 std::optional<struct timespec> InMemoryFileResult::modifiedTime() {
-  return file_->stat.mtime;
+  return detached_ ? detached_->stat.mtime : file_->stat.mtime();
 }
 
 std::optional<struct timespec> InMemoryFileResult::changedTime() {
-  return file_->stat.ctime;
+  return detached_ ? detached_->stat.ctime : file_->stat.ctime();
 }
 
 w_string_piece InMemoryFileResult::baseName() {
+  if (detached_) {
+    return detached_->baseName;
+  }
   return file_->getName();
 }
 
@@ -184,20 +301,20 @@ w_string_piece InMemoryFileResult::dirName() {
 }
 
 std::optional<bool> InMemoryFileResult::exists() {
-  return file_->exists;
+  return detached_ ? detached_->exists : file_->exists;
 }
 
 std::optional<w_clock_t> InMemoryFileResult::ctime() {
-  return file_->ctime;
+  return detached_ ? detached_->ctime : file_->ctime;
 }
 
 std::optional<w_clock_t> InMemoryFileResult::otime() {
-  return file_->otime;
+  return fileOtime();
 }
 
 std::optional<w_string> InMemoryFileResult::readLink() {
   if (!symlinkTarget_.has_value()) {
-    if (!file_->stat.isSymlink()) {
+    if (!fileStat().isSymlink()) {
       // If this file is not a symlink then we immediately yield
       // a nullptr w_string instance rather than propagating an error.
       // This behavior is relied upon by the field rendering code and
@@ -205,6 +322,12 @@ std::optional<w_string> InMemoryFileResult::readLink() {
       symlinkTarget_ = w_string();
       return symlinkTarget_;
     }
+    if (file_) {
+      if (auto target = file_->getSymlinkTarget()) {
+        symlinkTarget_ = std::move(target);
+        return symlinkTarget_;
+      }
+    }
     // Need to load the symlink target; batch that up
     accessorNeedsProperties(FileResult::Property::SymlinkTarget);
     return std::nullopt;
@@ -213,13 +336,13 @@ std::optional<w_string> InMemoryFileResult::readLink() {
 }
 
 std::optional<FileResult::ContentHash> InMemoryFileResult::getContentSha1() {
-  if (!file_->exists) {
+  if (!*exists()) {
     // Don't return hashes for files that we believe to be deleted.
     throw std::system_error(
         std::make_error_code(std::errc::no_such_file_or_directory));
   }
 
-  if (!file_->stat.isFile()) {
+  if (!fileStat().isFile()) {
     // We only want to compute the hash for regular files
     throw std::system_error(std::make_error_code(std::errc::is_a_directory));
   }
@@ -231,9 +354,30 @@ std::optional<FileResult::ContentHash> InMemoryFileResult::getContentSha1() {
   return contentSha1_.value();
 }
 
+std::optional<FileResult::ContentHash>
+InMemoryFileResult::getContentFingerprint() {
+  if (!*exists()) {
+    throw std::system_error(
+        std::make_error_code(std::errc::no_such_file_or_directory));
+  }
+  if (!fileStat().isFile()) {
+    throw std::system_error(std::make_error_code(std::errc::is_a_directory));
+  }
+
+  if (contentFingerprint_.empty()) {
+    accessorNeedsProperties(FileResult::Property::ContentFingerprint);
+    return std::nullopt;
+  }
+  return contentFingerprint_.value();
+}
+
 ViewDatabase::ViewDatabase(const w_string& root_path)
     : rootPath_{root_path},
-      rootDir_{std::make_unique<watchman_dir>(root_path, nullptr)} {}
+      recencyCheckpointInterval_{kMinRecencyCheckpointInterval},
+      tombstones_{&tombstones_, &tombstones_},
+      rootDir_{std::make_unique<watchman_dir>(root_path, nullptr)} {
+  pathFilter_.reset(0);
+}
 
 watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
   if (dir_name == rootPath_) {
@@ -259,6 +403,9 @@ watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
         dir_component, sep ? (sep - dir_component) : (dir_end - dir_component));
 
     auto child = dir->getChildDir(component);
+    if (child && dir == rootDir_.get()) {
+      pageInIfCold(child);
+    }
 
     if (!child && !create) {
       return nullptr;
@@ -269,15 +416,7 @@ watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
       // we have another pending item for the parent.  We'll create the
       // parent dir now and our other machinery will populate its contents
       // later.
-      w_string child_name(dir_component, (uint32_t)(sep - dir_component));
-
-      // Careful! dir->dirs is keyed by non-owning string pieces so the
-      // child_name MUST be stored or otherwise kept alive by the watchman_dir
-      // instance constructed below!
-      auto& new_child = dir->dirs[child_name];
-      new_child.reset(new watchman_dir(child_name, dir));
-
-      child = new_child.get();
+      child = createChildDir(dir, dirNames_.intern(component));
     }
 
     parent = dir;
@@ -297,12 +436,20 @@ watchman_dir* ViewDatabase::resolveDir(const w_string& dir_name, bool create) {
     dir_component = sep + 1;
   }
 
-  w_string child_name(dir_component, (uint32_t)(dir_end - dir_component));
+  return createChildDir(
+      parent,
+      dirNames_.intern(w_string_piece(dir_component, dir_end - dir_component)));
+}
+
+watchman_dir* ViewDatabase::createChildDir(
+    watchman_dir* parent,
+    w_string name) {
   // Careful! parent->dirs is keyed by non-owning string pieces so the
-  // child_name MUST be stored or otherwise kept alive by the watchman_dir
+  // name MUST be stored or otherwise kept alive by the watchman_dir
   // instance constructed below!
-  auto& new_child = parent->dirs[child_name];
-  new_child.reset(new watchman_dir(child_name, parent));
+  auto& new_child = parent->dirs[name];
+  new_child.reset(new watchman_dir(std::move(name), parent));
+  addToPathFilter(new_child->pathHash);
   return new_child.get();
 }
 
@@ -366,17 +513,317 @@ watchman_file* ViewDatabase::getOrCreateChildFile(
 
   // ... but take the shorter string from inside the file that
   // we create as the key.
-  auto file = watchman_file::make(file_name, dir);
+  auto file =
+      watchman_file::make(file_name, dir, keepSymlinkTargets_, keepAtimes_);
   auto& file_ptr = dir->files[file->getName()];
   file_ptr = std::move(file);
 
   file_ptr->ctime = ctime;
+  insertIntoSuffixIndex(file_ptr.get());
+  addToPathFilter(
+      PathFilter::hashChild(dir->pathHash, file_ptr->getName()));
 
   watcher.startWatchFile(file_ptr.get());
 
   return file_ptr.get();
 }
 
+bool ViewDatabase::mayHavePath(const w_string& fullPath) const {
+  auto path = fullPath.piece();
+  if (path.size() <= rootPath_.size() + 1 ||
+      !path.startsWith(rootPath_.piece()) ||
+      path[rootPath_.size()] != '/') {
+    // The root itself, or something that resolveDir wouldn't find anyway
+    return true;
+  }
+  path.advance(rootPath_.size() + 1);
+  if (isInColdSubtree(path)) {
+    return true;
+  }
+  return pathFilter_.mayContain(PathFilter::hashPath(path));
+}
+
+namespace {
+size_t countNodes(const watchman_dir* dir) {
+  size_t count = dir->files.size() + dir->dirs.size();
+  for (auto& it : dir->dirs) {
+    count += countNodes(it.second.get());
+  }
+  return count;
+}
+
+void fillPathFilter(PathFilter& filter, const watchman_dir* dir) {
+  for (auto& it : dir->files) {
+    filter.insert(PathFilter::hashChild(dir->pathHash, it.second->getName()));
+  }
+  for (auto& it : dir->dirs) {
+    filter.insert(it.second->pathHash);
+    fillPathFilter(filter, it.second.get());
+  }
+}
+} // namespace
+
+namespace {
+void addMemoryUsage(
+    const watchman_dir* dir,
+    ViewDatabase::MemoryUsage& usage) {
+  ++usage.numDirs;
+  usage.dirBytes += sizeof(watchman_dir) + dir->files.allocatedBytes() +
+      dir->dirs.allocatedBytes();
+  usage.numFiles += dir->files.size();
+  for (auto& it : dir->files) {
+    usage.fileBytes += it.second->allocatedSize();
+  }
+  for (auto& it : dir->dirs) {
+    addMemoryUsage(it.second.get(), usage);
+  }
+}
+} // namespace
+
+ViewDatabase::MemoryUsage ViewDatabase::getMemoryUsage() const {
+  MemoryUsage usage;
+  addMemoryUsage(rootDir_.get(), usage);
+  usage.numDirNames = dirNames_.size();
+  usage.dirNameBytes = dirNames_.stringBytes();
+  usage.suffixIndexEntries = suffixIndex_.size();
+  usage.subtreeIndexEntries = subtreeIndex_.size();
+  usage.pathFilterBytes = pathFilter_.allocatedBytes();
+  usage.numColdSubtrees = coldSubtrees_.size();
+  for (auto& [name, cold] : coldSubtrees_) {
+    usage.coldFiles += cold.numFiles;
+    usage.coldDirs += cold.numDirs;
+    usage.coldBytes += cold.segment->size();
+  }
+  return usage;
+}
+
+namespace {
+void countTree(const watchman_dir* dir, TreeSizeHints& hints) {
+  ++hints.numDirs;
+  hints.numFiles += dir->files.size();
+  for (auto& it : dir->dirs) {
+    countTree(it.second.get(), hints);
+  }
+}
+} // namespace
+
+void ViewDatabase::reserve(const TreeSizeHints& hints) {
+  pathFilter_.reset(2 * (hints.numDirs + hints.numFiles));
+  dirNames_.reserve(hints.numDirNames);
+  bulkLoaded_.reserve(hints.numFiles);
+}
+
+TreeSizeHints ViewDatabase::getTreeSizeHints() const {
+  TreeSizeHints hints;
+  countTree(rootDir_.get(), hints);
+  for (auto& [name, cold] : coldSubtrees_) {
+    hints.numDirs += cold.numDirs;
+    hints.numFiles += cold.numFiles;
+  }
+  // Not counting the names that only the cold subtrees use
+  hints.numDirNames = dirNames_.size();
+  return hints;
+}
+
+bool ViewDatabase::pageOut(const w_string& name, const w_string& segmentPath) {
+  if (bulkLoading_ || coldSubtrees_.count(name)) {
+    return false;
+  }
+  auto dir = rootDir_->getChildDir(name);
+  auto newest = getLatestFileInSubtree(name);
+  if (!dir || !newest) {
+    return false;
+  }
+
+  TreeSizeHints counts;
+  countTree(dir, counts);
+  ColdSubtree cold;
+  cold.newest = newest->otime;
+  cold.numDirs = counts.numDirs - 1;
+  cold.numFiles = counts.numFiles;
+  cold.segment = MappedSegment::create(
+      segmentPath, ViewSnapshot::serializeContents(dir));
+
+  // Freeing the nodes unlinks them from the recency, suffix and tombstone
+  // lists
+  dir->files.clear();
+  dir->dirs.clear();
+  coldSubtrees_.emplace(dir->name, std::move(cold));
+  pagedInAt_.erase(dir->name);
+  pruneSuffixIndex();
+  pruneSubtreeIndex();
+  pruneDirNames();
+  return true;
+}
+
+bool ViewDatabase::pageIn(const w_string& name) {
+  auto it = coldSubtrees_.find(name);
+  if (it == coldSubtrees_.end()) {
+    return false;
+  }
+  auto cold = std::move(it->second);
+  coldSubtrees_.erase(it);
+  auto dir = rootDir_->getChildDir(name);
+  w_check(dir != nullptr, "cold subtree lost its dir");
+
+  std::vector<watchman_file*> files;
+  try {
+    files = ViewSnapshot::deserializeContents(cold.segment->data(), *this, dir);
+  } catch (const std::exception& exc) {
+    // The segment was written by this process, so this is only if something
+    // is badly wrong.  The dir is left empty, and not to be skipped by
+    // crawls, so that crawling it finds its contents again.
+    logf(
+        ERR,
+        "lost the paged out contents of {}: {}\n",
+        dir->getFullPath(),
+        exc.what());
+    dir->last_crawl = 0;
+    return true;
+  }
+  pagedInAt_[dir->name] = std::chrono::steady_clock::now();
+
+  // The recency list is ordered most recent first.  The files are older
+  // than most of what is already in it, so they are merged in from the
+  // head rather than moved to it.
+  std::stable_sort(
+      files.begin(), files.end(), [](watchman_file* a, watchman_file* b) {
+        return a->otime.ticks > b->otime.ticks;
+      });
+  watchman_file** pos = &latestFile_;
+  for (auto file : files) {
+    while (*pos && (*pos)->otime.ticks > file->otime.ticks) {
+      pos = &(*pos)->next;
+    }
+    file->next = *pos;
+    if (file->next) {
+      file->next->prev = &file->next;
+    }
+    file->prev = pos;
+    *pos = file;
+    pos = &file->next;
+    insertIntoSuffixIndex(file);
+  }
+  // The checkpoints bound how many files changed since their ticks, which
+  // the merged files can only add to
+  recencyMoves_ += files.size();
+
+  // Nothing else is below the dir, so its subtree list is just these
+  auto& subtreeHead = subtreeIndex_[dir->name];
+  for (auto rit = files.rbegin(); rit != files.rend(); ++rit) {
+    auto file = *rit;
+    file->subtreeNext = subtreeHead;
+    if (file->subtreeNext) {
+      file->subtreeNext->subtreePrev = &file->subtreeNext;
+    }
+    subtreeHead = file;
+    file->subtreePrev = &subtreeHead;
+  }
+
+  // As is the tombstone list, oldest first
+  auto tombstone = tombstones_.next;
+  for (auto rit = files.rbegin(); rit != files.rend(); ++rit) {
+    auto file = *rit;
+    if (file->exists) {
+      continue;
+    }
+    while (tombstone != &tombstones_ &&
+           watchman_file::fromTombstoneLink(tombstone)->otime.ticks <=
+               file->otime.ticks) {
+      tombstone = tombstone->next;
+    }
+    file->tombstone.insertBefore(tombstone);
+  }
+
+  rebuildPathFilter();
+  return true;
+}
+
+std::vector<w_string> ViewDatabase::getIdleSubtrees(
+    time_t changedBefore,
+    std::chrono::steady_clock::time_point pagedInBefore,
+    size_t minFiles) const {
+  std::vector<w_string> names;
+  for (auto& it : rootDir_->dirs) {
+    auto dir = it.second.get();
+    if (coldSubtrees_.count(dir->name)) {
+      continue;
+    }
+    auto newest = getLatestFileInSubtree(dir->name);
+    if (!newest || newest->otime.timestamp >= changedBefore) {
+      continue;
+    }
+    auto pagedIn = pagedInAt_.find(dir->name);
+    if (pagedIn != pagedInAt_.end() && pagedIn->second >= pagedInBefore) {
+      continue;
+    }
+    TreeSizeHints counts;
+    countTree(dir, counts);
+    if (counts.numFiles >= minFiles) {
+      names.push_back(dir->name);
+    }
+  }
+  return names;
+}
+
+std::optional<bool> ViewDatabase::coldFileExists(
+    const w_string& fullPath) const {
+  if (coldSubtrees_.empty()) {
+    return std::nullopt;
+  }
+  auto path = fullPath.piece();
+  if (path.size() <= rootPath_.size() + 1 ||
+      !path.startsWith(rootPath_.piece()) ||
+      path[rootPath_.size()] != '/') {
+    return std::nullopt;
+  }
+  path.advance(rootPath_.size() + 1);
+  auto sep = (const char*)memchr(path.data(), '/', path.size());
+  if (!sep) {
+    // The top level dir itself, which stays in the root
+    return std::nullopt;
+  }
+  auto it = coldSubtrees_.find(
+      w_string(path.data(), size_t(sep - path.data()), W_STRING_BYTE));
+  if (it == coldSubtrees_.end()) {
+    return std::nullopt;
+  }
+  auto relPath = w_string_piece(sep + 1, path.data() + path.size() - sep - 1);
+  try {
+    return ViewSnapshot::lookupInContents(it->second.segment->data(), relPath)
+        .value_or(false);
+  } catch (const std::exception&) {
+    return false;
+  }
+}
+
+bool ViewDatabase::isInColdSubtree(w_string_piece relPath) const {
+  if (coldSubtrees_.empty()) {
+    return false;
+  }
+  auto sep = (const char*)memchr(relPath.data(), '/', relPath.size());
+  auto len = sep ? size_t(sep - relPath.data()) : relPath.size();
+  return coldSubtrees_.count(w_string(relPath.data(), len, W_STRING_BYTE));
+}
+
+void ViewDatabase::pageInIfCold(const watchman_dir* dir) {
+  if (!coldSubtrees_.empty()) {
+    pageIn(dir->name);
+  }
+}
+
+void ViewDatabase::rebuildPathFilter() {
+  pathFilter_.reset(2 * countNodes(rootDir_.get()));
+  fillPathFilter(pathFilter_, rootDir_.get());
+}
+
+void ViewDatabase::addToPathFilter(PathFilter::Hash hash) {
+  if (pathFilter_.full()) {
+    rebuildPathFilter();
+  }
+  pathFilter_.insert(hash);
+}
+
 void ViewDatabase::markFileChanged(
     Watcher& watcher,
     watchman_file* file,
@@ -387,12 +834,99 @@ void ViewDatabase::markFileChanged(
 
   file->otime = otime;
 
-  if (latestFile_ != file) {
+  if (file->prev == &bulkLoadedHead_) {
+    // Already waiting for endBulkLoad
+  } else if (bulkLoading_ && !file->prev) {
+    file->prev = &bulkLoadedHead_;
+    bulkLoaded_.push_back(file);
+  } else if (latestFile_ != file) {
     // unlink from list
     file->removeFromFileList();
 
     // and move to the head
     insertAtHeadOfFileList(file);
+    insertAtHeadOfSubtreeList(file);
+    if (++recencyMoves_ % recencyCheckpointInterval_ == 0) {
+      addRecencyCheckpoint(otime.ticks);
+    }
+  }
+  updateTombstoneList(file);
+
+  if (journal_ && journal_->isRecording()) {
+    auto fullPath = file->parent->getFullPathToChild(file->getName());
+    w_string_piece name(fullPath);
+    name.advance(rootPath_.size() + 1);
+    journal_->append(otime, file->exists, name);
+  }
+}
+
+void ViewDatabase::endBulkLoad() {
+  bulkLoading_ = false;
+
+  // The crawler marks the contents of a dir one after another, so most
+  // files share the subtree of the one before
+  const watchman_dir* lastParent = nullptr;
+  watchman_file** subtreeHead = nullptr;
+  for (auto file : bulkLoaded_) {
+    file->prev = nullptr;
+    insertAtHeadOfFileList(file);
+
+    if (file->parent != lastParent) {
+      lastParent = file->parent;
+      subtreeHead = getSubtreeHead(lastParent);
+    }
+    if (subtreeHead) {
+      file->subtreeNext = *subtreeHead;
+      if (file->subtreeNext) {
+        file->subtreeNext->subtreePrev = &file->subtreeNext;
+      }
+      *subtreeHead = file;
+      file->subtreePrev = subtreeHead;
+    }
+
+    if (++recencyMoves_ % recencyCheckpointInterval_ == 0) {
+      addRecencyCheckpoint(file->otime.ticks);
+    }
+  }
+
+  // There may have been millions of them
+  std::vector<watchman_file*>().swap(bulkLoaded_);
+  bulkLoadedHead_ = nullptr;
+}
+
+void ViewDatabase::addRecencyCheckpoint(uint32_t ticks) {
+  if (recencyCheckpoints_.size() >= kMaxRecencyCheckpoints) {
+    size_t kept = 0;
+    for (size_t i = 0; i < recencyCheckpoints_.size(); i += 2) {
+      recencyCheckpoints_[kept++] = recencyCheckpoints_[i];
+    }
+    recencyCheckpoints_.resize(kept);
+    recencyCheckpointInterval_ *= 2;
+  }
+  recencyCheckpoints_.push_back({ticks, recencyMoves_});
+}
+
+uint64_t ViewDatabase::estimateFilesChangedSince(uint32_t ticks) const {
+  if (!latestFile_ || latestFile_->otime.ticks <= ticks) {
+    return 0;
+  }
+  // The last checkpoint taken at or before ticks; every move since then
+  // may have brought a different file to the head
+  auto it = std::upper_bound(
+      recencyCheckpoints_.begin(),
+      recencyCheckpoints_.end(),
+      ticks,
+      [](uint32_t t, const RecencyCheckpoint& cp) { return t < cp.ticks; });
+  if (it == recencyCheckpoints_.begin()) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  return recencyMoves_ - std::prev(it)->moves;
+}
+
+void ViewDatabase::updateTombstoneList(struct watchman_file* file) {
+  file->tombstone.unlink();
+  if (!file->exists) {
+    file->tombstone.insertBefore(&tombstones_);
   }
 }
 
@@ -405,6 +939,10 @@ void ViewDatabase::markDirDeleted(
     // If we know that it doesn't exist, return early
     return;
   }
+  if (dir->parent == rootDir_.get()) {
+    // Its files are to be marked
+    pageInIfCold(dir);
+  }
   dir->last_check_existed = false;
 
   for (auto& it : dir->files) {
@@ -427,6 +965,185 @@ void ViewDatabase::markDirDeleted(
   }
 }
 
+bool ViewDatabase::moveDir(
+    Watcher& watcher,
+    const w_string& from,
+    const w_string& to,
+    w_clock_t otime,
+    std::vector<w_string>& movedDirs) {
+  auto isAtOrBelow = [](w_string_piece path, w_string_piece dir) {
+    return path.size() >= dir.size() && path.startsWith(dir) &&
+        (path.size() == dir.size() || is_slash(path[dir.size()]));
+  };
+  if (from == rootPath_ || to == rootPath_ || isAtOrBelow(from, to) ||
+      isAtOrBelow(to, from)) {
+    return false;
+  }
+
+  auto src = resolveDir(from, false);
+  if (!src || !src->last_check_existed) {
+    return false;
+  }
+  auto srcFile = src->parent->getChildFile(from.baseName());
+  if (!srcFile || !srcFile->exists || !srcFile->stat.isDir()) {
+    return false;
+  }
+
+  auto dstParent = resolveDir(to.dirName(), false);
+  if (!dstParent || !dstParent->last_check_existed) {
+    return false;
+  }
+  auto dstName = to.baseName();
+  auto dstFile = dstParent->getChildFile(dstName);
+  if (dstFile && dstFile->exists) {
+    return false;
+  }
+  auto dst = dstParent->getChildDir(dstName);
+  if (dst && dst->last_check_existed) {
+    return false;
+  }
+  if (!dst) {
+    dst = createChildDir(dstParent, dirNames_.intern(dstName));
+  }
+
+  logf(DBG, "moving {} to {} in the view\n", from, to);
+  copyDirContents(watcher, src, dst, otime, movedDirs);
+
+  dstFile = getOrCreateChildFile(watcher, dstParent, dstName, otime);
+  dstFile->ctime = otime;
+  dstFile->setStat(srcFile->getStat());
+  dstFile->exists = true;
+  markFileChanged(watcher, dstFile, otime);
+
+  srcFile->exists = false;
+  markFileChanged(watcher, srcFile, otime);
+  markDirDeleted(watcher, src, otime, true);
+  return true;
+}
+
+void ViewDatabase::copyDirContents(
+    Watcher& watcher,
+    const watchman_dir* from,
+    watchman_dir* to,
+    w_clock_t otime,
+    std::vector<w_string>& movedDirs) {
+  to->last_check_existed = true;
+  movedDirs.push_back(to->getFullPath());
+
+  for (auto& it : from->files) {
+    auto file = it.second.get();
+    if (!file->exists) {
+      continue;
+    }
+    auto copy =
+        getOrCreateChildFile(watcher, to, w_string(file->getName()), otime);
+    if (!copy->exists) {
+      // The path is new, even if the file isn't
+      copy->ctime = otime;
+    }
+    copy->setStat(file->getStat());
+    copy->setSymlinkTarget(file->getSymlinkTarget());
+    copy->exists = true;
+    markFileChanged(watcher, copy, otime);
+  }
+
+  for (auto& it : from->dirs) {
+    auto child = it.second.get();
+    if (!child->last_check_existed) {
+      continue;
+    }
+    auto copy = to->getChildDir(child->name);
+    if (!copy) {
+      copy = createChildDir(to, child->name);
+    }
+    copyDirContents(watcher, child, copy, otime, movedDirs);
+  }
+}
+
+void ViewDatabase::insertIntoSuffixIndex(struct watchman_file* file) {
+  auto suffix = file->getName().asLowerCaseSuffix();
+  if (!suffix) {
+    return;
+  }
+  auto& head = suffixIndex_[suffix];
+  file->suffixNext = head;
+  if (file->suffixNext) {
+    file->suffixNext->suffixPrev = &file->suffixNext;
+  }
+  head = file;
+  file->suffixPrev = &head;
+}
+
+watchman_file* ViewDatabase::getFilesWithSuffix(const w_string& suffix) const {
+  auto it = suffixIndex_.find(suffix);
+  if (it == suffixIndex_.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+void ViewDatabase::pruneSuffixIndex() {
+  for (auto it = suffixIndex_.begin(); it != suffixIndex_.end();) {
+    if (it->second) {
+      ++it;
+    } else {
+      it = suffixIndex_.erase(it);
+    }
+  }
+}
+
+void ViewDatabase::pruneDirNames() {
+  dirNames_.prune();
+}
+
+watchman_file** ViewDatabase::getSubtreeHead(const watchman_dir* dir) {
+  // Find the top level directory that holds dir
+  auto* top = dir;
+  if (!top->parent) {
+    // The root; not part of any subtree
+    return nullptr;
+  }
+  while (top->parent->parent) {
+    top = top->parent;
+  }
+  return &subtreeIndex_[top->name];
+}
+
+void ViewDatabase::insertAtHeadOfSubtreeList(struct watchman_file* file) {
+  auto head = getSubtreeHead(file->parent);
+  if (!head) {
+    // Directly in the root; not part of any subtree
+    return;
+  }
+
+  file->removeFromSubtreeList();
+  file->subtreeNext = *head;
+  if (file->subtreeNext) {
+    file->subtreeNext->subtreePrev = &file->subtreeNext;
+  }
+  *head = file;
+  file->subtreePrev = head;
+}
+
+watchman_file* ViewDatabase::getLatestFileInSubtree(
+    const w_string& name) const {
+  auto it = subtreeIndex_.find(name);
+  if (it == subtreeIndex_.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+
+void ViewDatabase::pruneSubtreeIndex() {
+  for (auto it = subtreeIndex_.begin(); it != subtreeIndex_.end();) {
+    if (it->second) {
+      ++it;
+    } else {
+      it = subtreeIndex_.erase(it);
+    }
+  }
+}
+
 void ViewDatabase::insertAtHeadOfFileList(struct watchman_file* file) {
   file->next = latestFile_;
   if (file->next) {
@@ -481,20 +1198,131 @@ InMemoryView::InMemoryView(
           config_.getInt("content_hash_max_items", 128 * 1024),
           config_.getInt("symlink_target_max_items", 32 * 1024),
           std::chrono::milliseconds(
-              config_.getInt("content_hash_negative_cache_ttl_ms", 2000))),
+              config_.getInt("content_hash_negative_cache_ttl_ms", 2000)),
+          w_string(config_.getString("content_hash_xattr", ""))),
       enableContentCacheWarming_(
           config_.getBool("content_hash_warming", false)),
+      enableMergeBasePrecompute_(
+          config_.getBool("scm_precompute_merge_base", true)),
       maxFilesToWarmInContentCache_(
           size_t(config_.getInt("content_hash_max_warm_per_settle", 1024))),
       syncContentCacheWarming_(
           config_.getBool("content_hash_warm_wait_before_settle", false)),
-      scm_(SCM::scmForPath(root_path)) {
+      viewSnapshotInterval_(
+          config_.getInt("view_snapshot_interval_seconds", 3600)),
+      viewSnapshotScmSeed_(config_.getBool("view_snapshot_scm_seed", false)),
+      contentHashPersistInterval_(
+          config_.getInt("content_hash_persist_interval_seconds", 3600)),
+      crawlStatParallelism_(std::max<json_int_t>(
+          1,
+          config_.getInt("crawl_stat_parallelism", 1))),
+      changeStatParallelism_(std::max<json_int_t>(
+          1,
+          config_.getInt("change_stat_parallelism", 1))),
+      detachedQueryEvaluation_(
+          config_.getBool("detached_query_evaluation", false)),
+      queryParallelism_(size_t(
+          std::max<json_int_t>(1, config_.getInt("query_parallelism", 1)))),
+      coalesceDirRescanThreshold_(size_t(std::max<json_int_t>(
+          0,
+          config_.getInt("coalesce_dir_rescan_threshold", 0)))),
+      syncWithoutCookies_(config_.getBool("sync_without_cookies", false)),
+      lazyCrawl_(config_.getBool("lazy_crawl", false)),
+      settleDeltaMaxFiles_(size_t(std::max<json_int_t>(
+          0,
+          config_.getInt("subscription_delta_max_files", 0)))),
+      unsettledDeltaMaxFiles_(size_t(std::max<json_int_t>(
+          0,
+          config_.getInt("fast_subscription_max_files", 1024)))) {
   json_int_t in_memory_view_ring_log_size =
       config_.getInt("in_memory_view_ring_log_size", 0);
   if (in_memory_view_ring_log_size) {
-    this->processedPaths_ = std::make_unique<RingBuffer<PendingChangeLogEntry>>(
-        in_memory_view_ring_log_size);
+    this->processedPaths_ =
+        std::make_unique<ThreadLocalRingBuffer<PendingChangeLogEntry>>(
+            in_memory_view_ring_log_size);
+  }
+  view_.wlock()->setKeepSymlinkTargets(
+      config_.getBool("inline_symlink_targets", false));
+  view_.wlock()->setKeepAtimes(config_.getBool("keep_atime", true));
+  if (auto hints = TreeSizeHints::lookup(rootPath_)) {
+    view_.wlock()->reserve(*hints);
   }
+  auto journalMaxBytes = config_.getInt("change_journal_max_bytes", 0);
+  if (journalMaxBytes > 0) {
+    auto journalPath = ChangeJournal::pathForRoot(
+        flags.watchman_state_file, rootPath_, rootNumber_);
+    if (journalPath) {
+      journal_ = std::make_unique<ChangeJournal>(
+          journalPath, uint64_t(journalMaxBytes));
+      view_.wlock()->setChangeJournal(journal_.get());
+    } else {
+      logf(
+          ERR,
+          "ignoring change_journal_max_bytes for {}: there is no state file "
+          "to keep the journal beside\n",
+          root_path);
+    }
+  }
+  if (config_.getBool("view_snapshot", false)) {
+    viewSnapshotPath_ = ViewSnapshot::pathForRoot(rootPath_);
+  }
+  if (config_.getBool("content_hash_persist", false)) {
+    contentHashCachePath_ = ContentHashCache::pathForRoot(rootPath_);
+  }
+  ContentHashWarmer::Budget budget;
+  budget.bytesPerSecond = uint64_t(std::max<json_int_t>(
+      0, config_.getInt("content_hash_warm_bytes_per_second", 0)));
+  budget.maxInFlight = size_t(std::max<json_int_t>(
+      1, config_.getInt("content_hash_warm_max_in_flight", 8)));
+  caches_.contentHashWarmer.setBudget(budget);
+  caches_.fingerprintFullHashMinSize = uint64_t(std::max<json_int_t>(
+      0, config_.getInt("content_fingerprint_full_hash_min_size", 0)));
+
+  w_string_piece prune =
+      config_.getString("recrawl_prune_unchanged_dirs", "off");
+  if (prune == "listing") {
+    recrawlPrune_ = RecrawlPrune::Listing;
+  } else if (prune == "subtree") {
+    recrawlPrune_ = RecrawlPrune::Subtree;
+  } else if (prune != "off") {
+    logf(
+        ERR,
+        "ignoring invalid recrawl_prune_unchanged_dirs value {} for {}; "
+        "expected off, listing or subtree\n",
+        prune,
+        root_path);
+  }
+
+  w_string_piece idempotent =
+      config_.getString("ignore_idempotent_writes", "off");
+  if (idempotent == "metadata") {
+    idempotentWrites_ = IdempotentWrites::IgnoreMetadata;
+  } else if (idempotent == "content") {
+    idempotentWrites_ = IdempotentWrites::IgnoreContent;
+  } else if (idempotent != "off") {
+    logf(
+        ERR,
+        "ignoring invalid ignore_idempotent_writes value {} for {}; "
+        "expected off, metadata or content\n",
+        idempotent,
+        root_path);
+  }
+
+  resyncOnOverflow_ = config_.getBool("resync_on_overflow", false);
+
+  pageOutIdle_ = std::chrono::seconds(std::max<json_int_t>(
+      0, config_.getInt("view_page_out_idle_seconds", 0)));
+  pageOutMinFiles_ = size_t(std::max<json_int_t>(
+      0, config_.getInt("view_page_out_min_files", 1024)));
+  lastPageOutScan_ = std::chrono::steady_clock::now();
+
+  SettleController::Options settle;
+  settle.adaptive = config_.getBool("adaptive_settle", false);
+  settle.minSettle = std::chrono::milliseconds(
+      config_.getInt("adaptive_settle_min_ms", settle.minSettle.count()));
+  settle.maxSettle = std::chrono::milliseconds(
+      config_.getInt("adaptive_settle_max_ms", settle.maxSettle.count()));
+  settleController_.wlock()->setOptions(settle);
 }
 
 InMemoryView::~InMemoryView() = default;
@@ -523,65 +1351,411 @@ w_clock_t InMemoryView::ageOutFile(
 
 void InMemoryView::ageOut(PerfSample& sample, std::chrono::seconds minAge) {
   uint32_t num_aged_files = 0;
-  uint32_t num_walked = 0;
+  uint32_t num_slices = 0;
+  std::chrono::steady_clock::duration longest_slice{};
   std::unordered_set<w_string> dirs_to_erase;
 
   auto now = std::chrono::system_clock::now();
   lastAgeOutTimestamp_ = now;
-  auto view = view_.wlock();
 
-  watchman_file* file = view->getLatestFile();
-  watchman_file* prior = nullptr;
-  while (file) {
-    ++num_walked;
-    if (file->exists ||
-        std::chrono::system_clock::from_time_t(file->otime.timestamp) + minAge >
-            now) {
-      prior = file;
-      file = file->next;
-      continue;
+  // Only deleted files are candidates, and the tombstone list holds them
+  // oldest first, so this stops at the first one that is too young.  The
+  // work is done in slices so that queries needn't wait for all of it.
+  auto isOldEnough = [&](const watchman_file* file) {
+    return std::chrono::system_clock::from_time_t(file->otime.timestamp) +
+        minAge <=
+        now;
+  };
+  bool done = false;
+  while (!done) {
+    auto view = view_.wlock();
+    if (resultIdentityPin_.use_count() > 1) {
+      // A query is deduping its results by the addresses of their nodes;
+      // see pinResultIdentities.  What's left is aged out next time.
+      logf(DBG, "age out deferred while queries are deduping results\n");
+      break;
     }
+    auto sliceStart = std::chrono::steady_clock::now();
+    auto sliceEnd = sliceStart + kAgeOutSliceDuration;
+    ++num_slices;
+
+    uint32_t inSlice = 0;
+    while (true) {
+      auto file = view->getOldestTombstone();
+      if (!file || !isOldEnough(file)) {
+        done = true;
+        break;
+      }
 
-    auto agedOtime = ageOutFile(dirs_to_erase, file);
-
-    // Revise tick for fresh instance reporting
-    lastAgeOutTick_ = std::max(lastAgeOutTick_, agedOtime.ticks);
+      auto agedOtime = ageOutFile(dirs_to_erase, file);
 
-    num_aged_files++;
+      // Revise tick for fresh instance reporting
+      lastAgeOutTick_ = std::max(lastAgeOutTick_, agedOtime.ticks);
 
-    // Go back to last good file node; we can't trust that the
-    // value of file->next saved before age_out_file is a valid
-    // file node as anything past that point may have also been
-    // aged out along with it.
-    file = prior;
+      num_aged_files++;
+      // Checking the time is relatively expensive; don't do it for every file
+      if (++inSlice % 64 == 0 && std::chrono::steady_clock::now() >= sliceEnd) {
+        break;
+      }
+    }
+    longest_slice =
+        std::max(longest_slice, std::chrono::steady_clock::now() - sliceStart);
   }
 
+  auto view = view_.wlock();
   for (auto& name : dirs_to_erase) {
     auto parent = view->resolveDir(name.dirName(), false);
-    if (parent) {
+    // Between slices the iothread may have seen it come back, in which case
+    // it has a file node again and is to be kept
+    if (parent && !parent->getChildFile(name.baseName())) {
       parent->dirs.erase(name.baseName());
     }
   }
+  if (num_aged_files) {
+    view->pruneSuffixIndex();
+    view->pruneSubtreeIndex();
+  }
+  if (!dirs_to_erase.empty()) {
+    view->pruneDirNames();
+  }
 
+  // Age out is the main source of freed nodes; give any slabs that it
+  // emptied back to the system.
+  size_t releasedBytes = 0;
   if (num_aged_files + dirs_to_erase.size()) {
+    releasedBytes = getNodeArena().trim();
     logf(ERR, "aged {} files, {} dirs\n", num_aged_files, dirs_to_erase.size());
   }
   sample.add_meta(
       "age_out",
       json_object(
-          {{"walked", json_integer(num_walked)},
-           {"files", json_integer(num_aged_files)},
-           {"dirs", json_integer(dirs_to_erase.size())}}));
+          {{"files", json_integer(num_aged_files)},
+           {"dirs", json_integer(dirs_to_erase.size())},
+           {"released_bytes", json_integer(releasedBytes)},
+           {"slices", json_integer(num_slices)},
+           {"longest_slice_us",
+            json_integer(std::chrono::duration_cast<std::chrono::microseconds>(
+                             longest_slice)
+                             .count())}}));
+}
+
+void InMemoryView::processFile(
+    const Query* query,
+    QueryContext* ctx,
+    const watchman_file* file) const {
+  if (ctx->kernel) {
+    // Nothing to load, so it is as cheap to render the file now as it
+    // would be to hold on to it
+    ctx->kernel(ctx, file);
+    return;
+  }
+  if (ctx->gatheredFiles) {
+    ctx->gatheredFiles->push_back(file);
+    return;
+  }
+  auto result = InMemoryFileResult::make(
+      ctx->arena, file, caches_, ctx->getCachedDirFullPath(file->parent));
+  if (!detachedQueryEvaluation_) {
+    w_query_process_file(query, ctx, std::move(result));
+    return;
+  }
+  result->detach();
+  ctx->deferEvaluation(std::move(result));
+}
+
+void InMemoryView::generateInParallel(
+    const Query* query,
+    QueryContext* ctx,
+    folly::FunctionRef<void()> walk) const {
+  // A kernel evaluates a file for less than it costs to hand it over
+  if (queryParallelism_ <= 1 || detachedQueryEvaluation_ ||
+      ctx->gatheredFiles || ctx->kernel) {
+    walk();
+    return;
+  }
+
+  std::vector<const watchman_file*> files;
+  ctx->gatheredFiles = &files;
+  {
+    SCOPE_EXIT {
+      ctx->gatheredFiles = nullptr;
+    };
+    walk();
+  }
+
+  if (files.size() < kMinFilesForParallelQuery) {
+    for (auto file : files) {
+      w_query_process_file(
+          query,
+          ctx,
+          InMemoryFileResult::make(
+              ctx->arena, file, caches_, ctx->getDirFullPath(file->parent)));
+    }
+    return;
+  }
+  evaluateInParallel(query, ctx, files);
+}
+
+void InMemoryView::evaluateInParallel(
+    const Query* query,
+    QueryContext* ctx,
+    const std::vector<const watchman_file*>& files) const {
+  struct Shard {
+    // The results of the shard's files, which the context adopts once they
+    // are handed over to it, so that they don't all contend for its arena
+    std::unique_ptr<NodeArena> arena{std::make_unique<NodeArena>(
+        /*hugePages=*/false, MemoryTag::QueryTemporaries)};
+    std::vector<std::unique_ptr<FileResult>> matched;
+    // Files that need data loaded before they can be evaluated
+    std::vector<std::unique_ptr<FileResult>> undecided;
+    // The evaluations of the terms of a query that is being explained
+    std::vector<TermEvaluations> terms;
+  };
+  size_t chunkSize = (files.size() + queryParallelism_ - 1) / queryParallelism_;
+  std::vector<Shard> shards((files.size() + chunkSize - 1) / chunkSize);
+
+  auto evaluateShard = [&](size_t index) {
+    // The terms only consult the context for the current file's name and
+    // the query's clocks, so each shard gets a context of its own
+    QueryContext shardCtx{query, ctx->root, ctx->disableFreshInstance};
+    shardCtx.since = ctx->since;
+    shardCtx.clockAtStartOfQuery = ctx->clockAtStartOfQuery;
+    shardCtx.lastAgeOutTickValueAtStartOfQuery =
+        ctx->lastAgeOutTickValueAtStartOfQuery;
+
+    auto& shard = shards[index];
+    if (ctx->termEvaluations) {
+      shard.terms.resize(ctx->termEvaluations->size());
+      shardCtx.termEvaluations = &shard.terms;
+    }
+    size_t end = std::min(files.size(), (index + 1) * chunkSize);
+    for (size_t i = index * chunkSize; i < end; ++i) {
+      std::unique_ptr<FileResult> result = InMemoryFileResult::make(
+          *shard.arena,
+          files[i],
+          caches_,
+          shardCtx.getDirFullPath(files[i]->parent));
+      auto match = w_query_evaluate_file(query, &shardCtx, result);
+      if (!match.has_value()) {
+        shard.undecided.push_back(std::move(result));
+      } else if (*match) {
+        shard.matched.push_back(std::move(result));
+      }
+    }
+  };
+
+  // The first shard is ours, along with any that the pool refuses
+  std::vector<folly::Future<folly::Unit>> futures;
+  size_t scheduled = 1;
+  try {
+    for (; scheduled < shards.size(); ++scheduled) {
+      futures.emplace_back(folly::via(
+          &getThreadPool(),
+          [&evaluateShard, index = scheduled] { evaluateShard(index); }));
+    }
+  } catch (const std::exception& exc) {
+    log(DBG, "evaluateInParallel: unable to schedule: ", exc.what(), "\n");
+  }
+
+  std::exception_ptr error;
+  try {
+    evaluateShard(0);
+    for (size_t i = scheduled; i < shards.size(); ++i) {
+      evaluateShard(i);
+    }
+  } catch (const std::exception&) {
+    error = std::current_exception();
+  }
+  // The shards reference our locals, so wait for them even if we failed
+  auto results = folly::collectAll(futures.begin(), futures.end()).get();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  for (auto& result : results) {
+    result.value();
+  }
+
+  // Dedup and render on this thread, in the order that the files were
+  // visited
+  for (auto& shard : shards) {
+    ctx->adoptedArenas.push_back(std::move(shard.arena));
+    for (size_t i = 0; i < shard.terms.size(); ++i) {
+      (*ctx->termEvaluations)[i] += shard.terms[i];
+    }
+    for (auto& file : shard.matched) {
+      w_query_emit_matched_file(query, ctx, std::move(file));
+    }
+    for (auto& file : shard.undecided) {
+      w_query_process_file(query, ctx, std::move(file));
+    }
+  }
+}
+
+bool InMemoryView::timeGeneratorFromSettleDelta(
+    const Query* query,
+    QueryContext* ctx) const {
+  auto delta = settleDelta_.copy();
+  if (!delta || ctx->since.clock.ticks < delta->fromTick) {
+    return false;
+  }
+  {
+    // The tick only advances while the view is write locked, so this
+    // tells us whether anything changed after the delta was taken.
+    auto view = view_.rlock();
+    if (mostRecentTick_.load(std::memory_order_acquire) != delta->toTick) {
+      return false;
+    }
+    ctx->generationStarted();
+  }
+
+  for (auto& file : delta->files) {
+    auto result = InMemoryFileResult::make(ctx->arena, file);
+    if (result->otime()->ticks <= ctx->since.clock.ticks) {
+      break;
+    }
+    ctx->bumpNumWalked();
+    if (!ctx->dirMatchesRelativeRoot(result->dirName())) {
+      continue;
+    }
+    w_query_process_file(query, ctx, std::move(result));
+  }
+  return true;
+}
+
+void InMemoryView::unsettledGenerator(
+    const Query* query,
+    uint32_t sinceTicks,
+    QueryContext* ctx) const {
+  auto delta = unsettledDelta_.copy();
+  if (!delta) {
+    return;
+  }
+  ctx->generationStarted();
+
+  for (auto& file : delta->files) {
+    auto result = InMemoryFileResult::make(ctx->arena, file);
+    if (result->otime()->ticks <= sinceTicks) {
+      break;
+    }
+    ctx->bumpNumWalked();
+    if (!ctx->dirMatchesRelativeRoot(result->dirName())) {
+      continue;
+    }
+    w_query_process_file(query, ctx, std::move(result));
+  }
 }
 
 void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
+  if (!journal_ || ctx->since.is_timestamp) {
+    timeGeneratorFromView(query, ctx);
+    return;
+  }
+
+  // Only the files aged out before the view is walked are missing from it
+  uint32_t agedOutTick;
+  {
+    auto view = view_.rlock();
+    agedOutTick = lastAgeOutTick_;
+  }
+  timeGeneratorFromView(query, ctx);
+  if (ctx->since.clock.ticks < agedOutTick && !ctx->haveEnoughResults()) {
+    agedOutGenerator(query, ctx, agedOutTick);
+  }
+}
+
+void InMemoryView::agedOutGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    uint32_t agedOutTick) const {
+  ctx->noteGenerator("change_journal");
+
+  // The most recent change to each file since the query's clock, if that
+  // deleted it
+  std::unordered_map<w_string, w_clock_t> deleted;
+  journal_->forEachSince(
+      ctx->since.clock.ticks, [&](const ChangeJournal::Change& change) {
+        ctx->bumpNumWalked();
+        w_string name(change.name.data(), change.name.size(), W_STRING_BYTE);
+        if (change.exists) {
+          deleted.erase(name);
+        } else {
+          deleted[name] = change.clock;
+        }
+      });
+
+  std::vector<std::pair<w_string, w_clock_t>> agedOut;
+  {
+    auto view = view_.rlock();
+    for (auto& [name, clock] : deleted) {
+      if (clock.ticks > agedOutTick) {
+        continue;
+      }
+      auto fullPath = w_string::pathCat({rootPath_, name});
+      if (!ctx->fileMatchesRelativeRoot(fullPath)) {
+        continue;
+      }
+      auto dir = view->resolveDir(fullPath.dirName());
+      if (dir && dir->getChildFile(fullPath.baseName())) {
+        // Still in the view, so the walk of it reported the file
+        continue;
+      }
+      agedOut.emplace_back(std::move(fullPath), clock);
+    }
+  }
+
+  for (auto& [fullPath, clock] : agedOut) {
+    w_query_process_file(
+        query,
+        ctx,
+        std::make_unique<LocalFileResult>(
+            fullPath, clock, ctx->root->case_sensitive));
+    if (ctx->haveEnoughResults()) {
+      break;
+    }
+  }
+}
+
+void InMemoryView::timeGeneratorFromView(
+    const Query* query,
+    QueryContext* ctx) const {
   struct watchman_file* f;
 
+  if (!ctx->since.is_timestamp && timeGeneratorFromSettleDelta(query, ctx)) {
+    return;
+  }
+
+  // When the query is restricted to a relative root we only need to
+  // consider the files below its top level directory, which have their
+  // own recency list.
+  w_string subtree;
+  if (query->relative_root && query->relative_root.size() > rootPath_.size()) {
+    w_string_piece rel(query->relative_root);
+    rel.advance(rootPath_.size() + 1);
+    auto sep = (const char*)memchr(rel.data(), '/', rel.size());
+    subtree = w_string(
+        rel.data(), sep ? sep - rel.data() : rel.size(), W_STRING_BYTE);
+  }
+
   // Walk back in time until we hit the boundary
   auto view = view_.rlock();
   ctx->generationStarted();
 
-  for (f = view->getLatestFile(); f; f = f->next) {
+  if (!subtree && !ctx->since.is_timestamp) {
+    auto sinceTicks = ctx->since.clock.ticks;
+    if (auto dir = findCheaperDirForSince(*view, query, sinceTicks)) {
+      ctx->noteGenerator("dir");
+      generateInParallel(query, ctx, [&] {
+        changedInDirGenerator(
+            query, ctx, dir, query->plannedDirDepth, sinceTicks);
+      });
+      return;
+    }
+  }
+
+  for (f = subtree ? view->getLatestFileInSubtree(subtree)
+                   : view->getLatestFile();
+       f;
+       f = subtree ? f->subtreeNext : f->next) {
     ctx->bumpNumWalked();
     // Note that we use <= for the time comparisons in here so that we
     // report the things that changed inclusive of the boundary presented.
@@ -591,16 +1765,96 @@ void InMemoryView::timeGenerator(const Query* query, QueryContext* ctx) const {
     if (ctx->since.is_timestamp && f->otime.timestamp <= ctx->since.timestamp) {
       break;
     }
-    if (!ctx->since.is_timestamp && f->otime.ticks <= ctx->since.clock.ticks) {
-      break;
+    if (!ctx->since.is_timestamp && f->otime.ticks <= ctx->since.clock.ticks) {
+      break;
+    }
+
+    if (!ctx->fileMatchesRelativeRoot(f)) {
+      continue;
+    }
+
+    processFile(query, ctx, f);
+    if (ctx->haveEnoughResults()) {
+      break;
+    }
+  }
+}
+
+namespace {
+// Counts the files below dir, to the given depth, giving up once there are
+// more than limit of them
+uint64_t countFilesUpTo(
+    const watchman_dir* dir,
+    uint32_t depth,
+    uint64_t limit) {
+  uint64_t count = dir->files.size();
+  if (depth > 0) {
+    for (auto& it : dir->dirs) {
+      if (count > limit) {
+        break;
+      }
+      count += countFilesUpTo(it.second.get(), depth - 1, limit - count);
+    }
+  }
+  return count;
+}
+} // namespace
+
+const watchman_dir* InMemoryView::findCheaperDirForSince(
+    const ViewDatabase& view,
+    const Query* query,
+    uint32_t sinceTicks) const {
+  if (!query->plannedDirName || query->plannedDirName->empty()) {
+    return nullptr;
+  }
+  auto walk = view.estimateFilesChangedSince(sinceTicks);
+  if (walk < kMinSinceWalkForDirScan) {
+    return nullptr;
+  }
+  auto dir = view.resolveDir(w_string::pathCat(
+      {query->relative_root ? query->relative_root : rootPath_,
+       *query->plannedDirName}));
+  if (!dir) {
+    return nullptr;
+  }
+  auto limit = walk / kSinceWalkToDirScanRatio;
+  if (countFilesUpTo(dir, query->plannedDirDepth, limit) > limit) {
+    return nullptr;
+  }
+  return dir;
+}
+
+void InMemoryView::changedInDirGenerator(
+    const Query* query,
+    QueryContext* ctx,
+    const watchman_dir* dir,
+    uint32_t depth,
+    uint32_t sinceTicks) const {
+  auto verdict = ctx->evaluateDir(dir);
+  bool havePath = false;
+  for (auto& it : dir->files) {
+    if (!verdict.filesMayMatch()) {
+      // The expression rules them all out by their dir
+      break;
+    }
+    auto file = it.second.get();
+    ctx->bumpNumWalked();
+    if (file->otime.ticks <= sinceTicks) {
+      continue;
+    }
+    if (!havePath) {
+      // Let the results for these files share one copy of the path
+      ctx->getDirFullPath(dir);
+      havePath = true;
     }
+    processFile(query, ctx, file);
+  }
 
-    if (!ctx->fileMatchesRelativeRoot(f)) {
-      continue;
+  if (depth > 0 && verdict.subtreeMayMatch()) {
+    for (auto& it : dir->dirs) {
+      changedInDirGenerator(
+          query, ctx, it.second.get(), depth - 1, sinceTicks);
     }
-
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
   }
 }
 
@@ -631,6 +1885,11 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
       goto is_dir;
     }
 
+    if (!view->mayHavePath(full_name)) {
+      // Doesn't exist, and never has
+      continue;
+    }
+
     // Ideally, we'd just resolve it directly as a dir and be done.
     // It's not quite so simple though, because we may resolve a dir
     // that had been deleted and replaced by a file.
@@ -654,8 +1913,7 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
       // If it's a file (but not an existent dir)
       if (f && (!f->exists || !f->stat.isDir())) {
         ctx->bumpNumWalked();
-        w_query_process_file(
-            query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+        processFile(query, ctx, f);
         continue;
       }
     }
@@ -669,25 +1927,140 @@ void InMemoryView::pathGenerator(const Query* query, QueryContext* ctx) const {
   is_dir:
     // We got a dir; process recursively to specified depth
     if (dir) {
-      dirGenerator(query, ctx, dir, path.depth);
+      generateInParallel(query, ctx, [&] {
+        dirGenerator(query, ctx, dir, path.depth);
+      });
+    }
+  }
+}
+
+namespace {
+// Calls func(file) for each file beneath dir whose path relative to dir
+// matches relPath with ASCII case ignored.  A case sensitive tree may hold
+// several of them.
+template <typename Func>
+void forEachFileCaseless(
+    const watchman_dir* dir,
+    w_string_piece relPath,
+    Func& func) {
+  auto sep = (const char*)memchr(relPath.data(), '/', relPath.size());
+  if (!sep) {
+    dir->files.forEachCaseless(
+        relPath, [&](w_string_piece, const auto& file) { func(file.get()); });
+    return;
+  }
+
+  w_string_piece component(relPath.data(), sep - relPath.data());
+  w_string_piece rest(sep + 1, relPath.data() + relPath.size() - (sep + 1));
+  dir->dirs.forEachCaseless(component, [&](w_string_piece, const auto& child) {
+    forEachFileCaseless(child.get(), rest, func);
+  });
+}
+} // namespace
+
+void InMemoryView::wholeNamesGenerator(
+    const Query* query,
+    const std::vector<w_string>& names,
+    CaseSensitivity caseSensitive,
+    QueryContext* ctx) const {
+  auto relative_root =
+      query->relative_root ? query->relative_root : rootPath_;
+  // Alternatives of an anyof may name the same file more than once
+  std::unordered_set<w_string_piece> seen;
+
+  auto view = view_.rlock();
+  ctx->generationStarted();
+
+  if (caseSensitive == CaseSensitivity::CaseInSensitive) {
+    // The path filter hashes names as they are spelled, so it can't help
+    // here.  Differently cased names may resolve to the same file.
+    const auto base = view->resolveDir(relative_root);
+    if (!base) {
+      return;
+    }
+    std::unordered_set<const watchman_file*> visited;
+    auto visit = [&](const watchman_file* file) {
+      if (visited.insert(file).second) {
+        ctx->bumpNumWalked();
+        processFile(query, ctx, file);
+      }
+    };
+    for (auto& name : names) {
+      if (seen.insert(name.piece()).second) {
+        forEachFileCaseless(base, name, visit);
+      }
+    }
+    return;
+  }
+
+  for (auto& name : names) {
+    if (!seen.insert(name.piece()).second) {
+      continue;
+    }
+
+    auto full_name = w_string::pathCat({relative_root, name});
+    if (!view->mayHavePath(full_name)) {
+      continue;
+    }
+    auto dir_name = full_name.dirName();
+    if (!dir_name) {
+      continue;
+    }
+
+    const auto dir = view->resolveDir(dir_name);
+    if (!dir) {
+      continue;
+    }
+
+    const auto file = dir->getChildFile(full_name.baseName());
+    if (file) {
+      ctx->bumpNumWalked();
+      processFile(query, ctx, file);
     }
   }
 }
 
+void InMemoryView::subtreeGenerator(
+    const Query* query,
+    const w_string& dirName,
+    uint32_t maxDepth,
+    QueryContext* ctx) const {
+  auto full_name = w_string::pathCat(
+      {query->relative_root ? query->relative_root : rootPath_, dirName});
+
+  auto view = view_.rlock();
+  ctx->generationStarted();
+
+  auto dir = view->resolveDir(full_name);
+  if (dir) {
+    generateInParallel(query, ctx, [&] {
+      dirGenerator(query, ctx, dir, maxDepth);
+    });
+  }
+}
+
 void InMemoryView::dirGenerator(
     const Query* query,
     QueryContext* ctx,
     const watchman_dir* dir,
     uint32_t depth) const {
-  for (auto& it : dir->files) {
-    auto file = it.second.get();
-    ctx->bumpNumWalked();
+  // Skips the files, or the subtree, that the expression rules out by
+  // their dir alone, rather than ruling them out one by one
+  auto verdict = ctx->evaluateDir(dir);
+  if (verdict.filesMayMatch()) {
+    if (!dir->files.empty()) {
+      // Let the results for these files share one copy of the path
+      ctx->getDirFullPath(dir);
+    }
+    for (auto& it : dir->files) {
+      auto file = it.second.get();
+      ctx->bumpNumWalked();
 
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(file, caches_));
+      processFile(query, ctx, file);
+    }
   }
 
-  if (depth > 0) {
+  if (depth > 0 && verdict.subtreeMayMatch()) {
     for (auto& it : dir->dirs) {
       const auto child = it.second.get();
 
@@ -714,10 +2087,18 @@ void InMemoryView::globGeneratorDoublestar(
     const GlobTree* node,
     const char* dir_name,
     uint32_t dir_name_len) const {
-  bool matched;
+  if (!dir->files.empty()) {
+    // Let the results for these files share one copy of the path
+    ctx->getDirFullPath(dir);
+  }
+  auto verdict = ctx->evaluateDir(dir);
 
   // First step is to walk the set of files contained in this node
   for (auto& it : dir->files) {
+    if (!verdict.filesMayMatch()) {
+      // The expression rules them all out by their dir
+      break;
+    }
     auto file = it.second.get();
     auto file_name = file->getName();
 
@@ -732,34 +2113,19 @@ void InMemoryView::globGeneratorDoublestar(
         dir_name, dir_name_len, file_name.data(), file_name.size());
 
     // Now that we have computed the name of this candidate file node,
-    // attempt to match against each of the possible doublestar patterns
-    // in turn.  As soon as any one of them matches we can stop this loop
-    // as it doesn't make a lot of sense to yield multiple results for
-    // the same file.
-    for (const auto& child_node : node->doublestar_children) {
-      matched =
-          wildmatch(
-              child_node->pattern.c_str(),
-              subject.c_str(),
-              ctx->query->glob_flags | WM_PATHNAME |
-                  (ctx->query->case_sensitive == CaseSensitivity::CaseSensitive
-                       ? 0
-                       : WM_CASEFOLD),
-              0) == WM_MATCH;
-
-      if (matched) {
-        w_query_process_file(
-            ctx->query,
-            ctx,
-            std::make_unique<InMemoryFileResult>(file, caches_));
-        // No sense running multiple matches for this same file node
-        // if this one succeeded.
-        break;
-      }
+    // attempt to match against the possible doublestar patterns.  As soon
+    // as any one of them matches we can stop, as it doesn't make a lot of
+    // sense to yield multiple results for the same file.
+    if (node->doublestar_matcher.matchesAny(subject)) {
+      processFile(ctx->query, ctx, file);
     }
   }
 
-  // And now walk down to any dirs; all dirs are eligible
+  // And now walk down to any dirs; all dirs are eligible, unless the
+  // expression rules out everything beneath them
+  if (!verdict.subtreeMayMatch()) {
+    return;
+  }
   for (auto& it : dir->dirs) {
     const auto child = it.second.get();
 
@@ -783,95 +2149,73 @@ void InMemoryView::globGeneratorTree(
     globGeneratorDoublestar(ctx, dir, node, nullptr, 0);
   }
 
-  for (const auto& child_node : node->children) {
-    w_assert(!child_node->is_doublestar, "should not get here with ** glob");
-
-    // If there are child dirs, consider them for recursion.
-    // Note that we don't restrict this to !leaf because the user may have
-    // set their globs list to something like ["some_dir", "some_dir/file"]
-    // and we don't want to preclude matching the latter.
-    if (!dir->dirs.empty()) {
-      // Attempt direct lookup if possible
-      if (!child_node->had_specials &&
-          ctx->query->case_sensitive == CaseSensitivity::CaseSensitive) {
-        w_string_piece component(
-            child_node->pattern.data(), child_node->pattern.size());
-        const auto child_dir = dir->getChildDir(component);
-
-        if (child_dir) {
-          globGeneratorTree(ctx, child_node.get(), child_dir);
-        }
-      } else {
-        // Otherwise we have to walk and match
-        for (auto& it : dir->dirs) {
-          const auto child_dir = it.second.get();
-
-          if (!child_dir->last_check_existed) {
-            // Globs can only match files in dirs that exist
-            continue;
-          }
-
-          if (wildmatch(
-                  child_node->pattern.c_str(),
-                  child_dir->name.c_str(),
-                  ctx->query->glob_flags |
-                      (ctx->query->case_sensitive ==
-                               CaseSensitivity::CaseSensitive
-                           ? 0
-                           : WM_CASEFOLD),
-                  0) == WM_MATCH) {
-            globGeneratorTree(ctx, child_node.get(), child_dir);
-          }
-        }
+  // Children without any specials can be found by direct lookup when the
+  // query is case sensitive
+  if (ctx->query->case_sensitive == CaseSensitivity::CaseSensitive) {
+    for (const auto& child_node : node->children) {
+      w_assert(!child_node->is_doublestar, "should not get here with ** glob");
+      if (child_node->had_specials) {
+        continue;
+      }
+      w_string_piece component(
+          child_node->pattern.data(), child_node->pattern.size());
+
+      // Note that we don't restrict this to !leaf because the user may have
+      // set their globs list to something like ["some_dir", "some_dir/file"]
+      // and we don't want to preclude matching the latter.
+      const auto child_dir = dir->getChildDir(component);
+      if (child_dir) {
+        globGeneratorTree(ctx, child_node.get(), child_dir);
       }
-    }
 
-    // If the node is a leaf we are in a position to match files.
-    if (child_node->is_leaf && !dir->files.empty()) {
-      // Attempt direct lookup if possible
-      if (!child_node->had_specials &&
-          ctx->query->case_sensitive == CaseSensitivity::CaseSensitive) {
-        w_string_piece component(
-            child_node->pattern.data(), child_node->pattern.size());
+      // If the node is a leaf we are in a position to match files.
+      if (child_node->is_leaf) {
         auto file = dir->getChildFile(component);
 
         if (file) {
           ctx->bumpNumWalked();
           if (file->exists) {
             // Globs can only match files that exist
-            w_query_process_file(
-                ctx->query,
-                ctx,
-                std::make_unique<InMemoryFileResult>(file, caches_));
+            processFile(ctx->query, ctx, file);
           }
         }
-      } else {
-        for (auto& it : dir->files) {
-          // Otherwise we have to walk and match
-          auto file = it.second.get();
-          auto file_name = file->getName();
-          ctx->bumpNumWalked();
+      }
+    }
+  }
 
-          if (!file->exists) {
-            // Globs can only match files that exist
-            continue;
-          }
+  // Otherwise we have to walk and match, which the matchers do for all of
+  // the remaining children at once
+  if (!node->dir_matcher.empty()) {
+    for (auto& it : dir->dirs) {
+      const auto child_dir = it.second.get();
 
-          if (wildmatch(
-                  child_node->pattern.c_str(),
-                  file_name.data(),
-                  ctx->query->glob_flags |
-                      (ctx->query->case_sensitive ==
-                               CaseSensitivity::CaseSensitive
-                           ? 0
-                           : WM_CASEFOLD),
-                  0) == WM_MATCH) {
-            w_query_process_file(
-                ctx->query,
-                ctx,
-                std::make_unique<InMemoryFileResult>(file, caches_));
-          }
-        }
+      if (!child_dir->last_check_existed) {
+        // Globs can only match files in dirs that exist
+        continue;
+      }
+
+      node->dir_matcher.forEachMatch(child_dir->name.view(), [&](size_t i) {
+        globGeneratorTree(ctx, node->children[i].get(), child_dir);
+        return true;
+      });
+    }
+  }
+
+  if (!node->file_matcher.empty() && !dir->files.empty()) {
+    // Let the results for these files share one copy of the path
+    ctx->getDirFullPath(dir);
+    for (auto& it : dir->files) {
+      auto file = it.second.get();
+      auto file_name = file->getName();
+      ctx->bumpNumWalked();
+
+      if (!file->exists) {
+        // Globs can only match files that exist
+        continue;
+      }
+
+      if (node->file_matcher.matchesAny(file_name.view())) {
+        processFile(ctx->query, ctx, file);
       }
     }
   }
@@ -897,7 +2241,9 @@ void InMemoryView::globGenerator(const Query* query, QueryContext* ctx) const {
         "relative_root parameter!"));
   }
 
-  globGeneratorTree(ctx, query->glob_tree.get(), dir);
+  generateInParallel(query, ctx, [&] {
+    globGeneratorTree(ctx, query->glob_tree.get(), dir);
+  });
 }
 
 void InMemoryView::allFilesGenerator(const Query* query, QueryContext* ctx)
@@ -906,14 +2252,57 @@ void InMemoryView::allFilesGenerator(const Query* query, QueryContext* ctx)
   auto view = view_.rlock();
   ctx->generationStarted();
 
-  for (f = view->getLatestFile(); f; f = f->next) {
-    ctx->bumpNumWalked();
-    if (!ctx->fileMatchesRelativeRoot(f)) {
-      continue;
+  auto walk = [&] {
+    for (f = view->getLatestFile(); f; f = f->next) {
+      ctx->bumpNumWalked();
+      if (!ctx->fileMatchesRelativeRoot(f)) {
+        continue;
+      }
+
+      processFile(query, ctx, f);
+      if (ctx->haveEnoughResults()) {
+        break;
+      }
     }
+  };
 
-    w_query_process_file(
-        query, ctx, std::make_unique<InMemoryFileResult>(f, caches_));
+  if (query->limitedToMostRecent()) {
+    // Finding the most recently changed files only takes a walk down the
+    // start of the list, so don't gather the whole list to evaluate
+    walk();
+  } else {
+    generateInParallel(query, ctx, walk);
+  }
+}
+
+void InMemoryView::suffixGenerator(
+    const Query* query,
+    const std::vector<w_string>& suffixes,
+    QueryContext* ctx) const {
+  // The index is keyed by the portion of the name following the final dot,
+  // so a multi-part suffix such as "tar.gz" is found via "gz".  The query
+  // expression is still evaluated against each file, so visiting a superset
+  // of the matches is fine, but we must not visit the same list twice.
+  std::unordered_set<w_string_piece> keys;
+  for (auto& suffix : suffixes) {
+    auto piece = suffix.piece();
+    auto key = piece.suffix();
+    keys.insert(key == nullptr ? piece : key);
+  }
+
+  auto view = view_.rlock();
+  ctx->generationStarted();
+
+  for (auto& key : keys) {
+    for (auto* f = view->getFilesWithSuffix(key.asWString()); f;
+         f = f->suffixNext) {
+      ctx->bumpNumWalked();
+      if (!ctx->fileMatchesRelativeRoot(f)) {
+        continue;
+      }
+
+      processFile(query, ctx, f);
+    }
   }
 }
 
@@ -921,6 +2310,12 @@ ClockPosition InMemoryView::getMostRecentRootNumberAndTickValue() const {
   return ClockPosition(rootNumber_, mostRecentTick_);
 }
 
+ClockPosition InMemoryView::getLastChangePosition() const {
+  auto view = view_.rlock();
+  auto latest = view->getLatestFile();
+  return ClockPosition(rootNumber_, latest ? latest->otime.ticks : 0);
+}
+
 w_string InMemoryView::getCurrentClockString() const {
   char clockbuf[128];
   if (!clock_id_string(
@@ -930,7 +2325,18 @@ w_string InMemoryView::getCurrentClockString() const {
   return w_string(clockbuf, W_STRING_UNICODE);
 }
 
+std::shared_ptr<const void> InMemoryView::pinResultIdentities() const {
+  // Only age out frees nodes, and it checks for pins with the view write
+  // locked, so a pin taken with the view locked for a query holds it off
+  // until the query is done with it
+  return resultIdentityPin_;
+}
+
 uint32_t InMemoryView::getLastAgeOutTickValue() const {
+  // The journal can report what has been aged out, as far back as it goes
+  if (journal_) {
+    return std::min(lastAgeOutTick_, journal_->coversTicksAfter());
+  }
   return lastAgeOutTick_;
 }
 
@@ -946,6 +2352,7 @@ void InMemoryView::startThreads(const std::shared_ptr<Root>& root) {
   std::thread notifyThreadInstance([self, root]() {
     w_set_thread_name(
         "notify ", uintptr_t(self.get()), " ", self->rootPath_.view());
+    ThreadStats::setCurrentThreadRoot(std::string(self->rootPath_.view()));
     try {
       self->notifyThread(root);
     } catch (const std::exception& e) {
@@ -963,6 +2370,9 @@ void InMemoryView::startThreads(const std::shared_ptr<Root>& root) {
   std::thread ioThreadInstance([self, root]() {
     w_set_thread_name(
         "io ", uintptr_t(self.get()), " ", self->rootPath_.view());
+    ThreadStats::setCurrentThreadRoot(std::string(self->rootPath_.view()));
+    // The IO thread builds the view, so its nodes are placed on this node
+    NumaBinding numa(int(root->config.getInt("numa_node", -1)));
     try {
       self->ioThread(root);
     } catch (const std::exception& e) {
@@ -979,12 +2389,41 @@ void InMemoryView::stopThreads() {
   stopThreads_.store(true, std::memory_order_release);
   watcher_->stopThreads();
   pendingFromWatcher_.lock()->ping();
+  // The IO thread may be waiting for its turn to crawl
+  CrawlScheduler::get().wake();
 }
 
 void InMemoryView::wakeThreads() {
   pendingFromWatcher_.lock()->ping();
 }
 
+bool InMemoryView::resyncFrom(std::chrono::system_clock::time_point lastGood) {
+  if (!resyncOnOverflow_.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  // Keep the earliest of the times if the iothread has yet to act on an
+  // earlier resync
+  auto since = std::max(
+      time_t(1), std::chrono::system_clock::to_time_t(lastGood));
+  auto current = resyncSince_.load(std::memory_order_acquire);
+  while ((current == 0 || since < current) &&
+         !resyncSince_.compare_exchange_weak(
+             current, since, std::memory_order_acq_rel)) {
+  }
+  overflowResyncs_.fetch_add(1, std::memory_order_relaxed);
+
+  // Flagging the crawl as desynced aborts the outstanding cookies once
+  // it completes, just as a recrawl would, but the view is kept as it is
+  auto pending = pendingFromWatcher_.lock();
+  pending->add(
+      rootPath_,
+      std::chrono::system_clock::now(),
+      W_PENDING_RECURSIVE | W_PENDING_IS_DESYNCED | W_PENDING_CRAWL_ONLY);
+  pending->ping();
+  return true;
+}
+
 folly::SemiFuture<folly::Unit> InMemoryView::waitForSettle(
     std::chrono::milliseconds settle_period) {
   auto [p, f] = folly::makePromiseContract<folly::Unit>();
@@ -1012,8 +2451,26 @@ folly::SemiFuture<folly::Unit> InMemoryView::waitForSettle(
  * inaccessible. */
 CookieSync::SyncResult InMemoryView::syncToNow(
     const std::shared_ptr<Root>& root,
-    std::chrono::milliseconds timeout) {
-  auto syncResult = syncToNowCookies(root, timeout);
+    std::chrono::milliseconds timeout,
+    const w_string& scope) {
+  if (syncWithoutCookies_) {
+    auto flushed = watcher_->flushToNow();
+    if (flushed.valid()) {
+      try {
+        std::move(flushed).get(timeout);
+      } catch (folly::FutureTimeout&) {
+        auto why = folly::to<std::string>(
+            "syncToNow: timed out waiting for the watcher to flush within ",
+            timeout.count(),
+            " milliseconds");
+        log(ERR, why, "\n");
+        throw std::system_error(ETIMEDOUT, std::generic_category(), why);
+      }
+      return CookieSync::SyncResult{};
+    }
+  }
+
+  auto syncResult = syncToNowCookies(root, timeout, scope);
 
   // Some watcher implementations (notably, FSEvents) reorder change events
   // before they're reported, and cookie files are not sufficient. Instead, the
@@ -1045,9 +2502,10 @@ CookieSync::SyncResult InMemoryView::syncToNow(
 
 CookieSync::SyncResult InMemoryView::syncToNowCookies(
     const std::shared_ptr<Root>& root,
-    std::chrono::milliseconds timeout) {
+    std::chrono::milliseconds timeout,
+    const w_string& scope) {
   try {
-    return root->cookies.syncToNow(timeout);
+    return root->cookies.syncToNow(timeout, scope);
   } catch (const std::system_error& exc) {
     auto cookieDirs = root->cookies.cookieDirs();
 
@@ -1071,7 +2529,7 @@ CookieSync::SyncResult InMemoryView::syncToNowCookies(
           // The cookie dir was a VCS subdir and it got deleted.  Let's
           // focus instead on the parent dir and recursively retry.
           root->cookies.setCookieDir(rootPath_);
-          return root->cookies.syncToNow(timeout);
+          return root->cookies.syncToNow(timeout, scope);
         }
       } else {
         // Split watchers have one watch on the root and watches for nested
@@ -1126,6 +2584,15 @@ bool InMemoryView::doAnyOfTheseFilesExist(
   auto view = view_.rlock();
   for (auto& name : fileNames) {
     auto fullName = w_string::pathCat({rootPath_, name});
+    if (!view->mayHavePath(fullName)) {
+      continue;
+    }
+    if (auto exists = view->coldFileExists(fullName)) {
+      if (*exists) {
+        return true;
+      }
+      continue;
+    }
     const auto dir = view->resolveDir(fullName.dirName());
     if (!dir) {
       continue;
@@ -1170,21 +2637,284 @@ json_ref InMemoryView::getViewDebugInfo() const {
       json_array_append(processedPathsResult, entry.asJsonValue());
     }
   }
-  return json_object({
+  auto result = json_object({
       {"processed_paths", processedPathsResult},
+      {"ignored_paths_pruned", json_integer(ignoredPathsPruned_.load())},
+      {"recrawl_dirs_pruned", json_integer(recrawlDirsPruned_.load())},
+      {"dirs_moved_in_place", json_integer(dirsMovedInPlace_.load())},
+      {"overflow_resyncs", json_integer(overflowResyncs_.load())},
+      {"idempotent_writes_ignored",
+       json_integer(idempotentWritesIgnored_.load())},
+      {"hash_on_change_started", json_integer(hashOnChangeStarted_.load())},
+      {"hash_on_change_skipped", json_integer(hashOnChangeSkipped_.load())},
+  });
+  if (journal_) {
+    auto stats = journal_->getStats();
+    result.set(
+        "change_journal",
+        json_object(
+            {{"recording", json_boolean(journal_->isRecording())},
+             {"bytes", json_integer(stats.bytes)},
+             {"changes", json_integer(stats.changes)},
+             {"segments", json_integer(stats.segments)},
+             {"covers_ticks_after", json_integer(stats.coversTicksAfter)}}));
+  }
+  return result;
+}
+
+uint32_t InMemoryView::getPendingItemCount() const {
+  return pendingFromWatcher_.lock()->getPendingItemCount();
+}
+
+json_ref InMemoryView::getSettleStatus() const {
+  return settleController_.rlock()->getStatus();
+}
+
+std::optional<TreeSizeHints> InMemoryView::getTreeSizeHints() const {
+  return TreeSizeHints::lookup(rootPath_);
+}
+
+namespace {
+
+// Returns the name of the top level dir of the root at rootPath that holds
+// fullPath, or nullopt if fullPath is the root itself
+std::optional<w_string> topLevelName(
+    const w_string& rootPath,
+    const w_string& fullPath) {
+  auto path = fullPath.piece();
+  if (path.size() <= rootPath.size() + 1 ||
+      !path.startsWith(rootPath.piece())) {
+    return std::nullopt;
+  }
+  path.advance(rootPath.size() + 1);
+  auto sep = (const char*)memchr(path.data(), '/', path.size());
+  return w_string(
+      path.data(),
+      sep ? size_t(sep - path.data()) : path.size(),
+      W_STRING_BYTE);
+}
+
+} // namespace
+
+w_string InMemoryView::nextColdSegmentPath() {
+  auto base = ViewSnapshot::pathForRoot(rootPath_);
+  if (base.empty()) {
+    return w_string();
+  }
+  return w_string::format(
+      "{}.cold-{}-{}",
+      base,
+      rootNumber_,
+      nextColdSegment_.fetch_add(1, std::memory_order_relaxed));
+}
+
+void InMemoryView::pageInForQuery(
+    const std::vector<w_string>& dirs,
+    const QuerySince& since) {
+  if (pageOutIdle_.count() == 0) {
+    return;
+  }
+
+  bool wholeTree = dirs.empty();
+  std::unordered_set<w_string> names;
+  for (auto& dir : dirs) {
+    auto name = topLevelName(rootPath_, dir);
+    if (!name) {
+      wholeTree = true;
+      break;
+    }
+    names.insert(*name);
+  }
+
+  // Queries from scratch are the ones that page dirs back in whatever has
+  // changed; remember them so that the dirs aren't paged out from under
+  // the next one
+  if (!since.is_timestamp && since.clock.is_fresh_instance) {
+    auto now = std::chrono::steady_clock::now();
+    auto use = subtreeUse_.wlock();
+    if (wholeTree) {
+      use->wholeTree = now;
+    } else {
+      for (auto& name : names) {
+        use->subtrees[name] = now;
+      }
+    }
+  }
+
+  // A query since a point after anything in a dir last changed can't
+  // match anything in it, so the dir may stay where it is
+  auto mayMatch = [&](const ViewDatabase::ColdSubtree& cold) {
+    if (since.is_timestamp) {
+      return cold.newest.timestamp >= since.timestamp;
+    }
+    return since.clock.is_fresh_instance ||
+        cold.newest.ticks > since.clock.ticks;
+  };
+
+  std::vector<w_string> needed;
+  {
+    auto view = view_.rlock();
+    for (auto& it : view->getColdSubtrees()) {
+      if ((wholeTree || names.count(it.first)) && mayMatch(it.second)) {
+        needed.push_back(it.first);
+      }
+    }
+  }
+  if (needed.empty()) {
+    return;
+  }
+  auto view = view_.wlock();
+  for (auto& name : needed) {
+    view->pageIn(name);
+  }
+}
+
+size_t InMemoryView::pageOutIdleSubtrees() {
+  if (pageOutIdle_.count() == 0) {
+    return 0;
+  }
+  auto steadyNow = std::chrono::steady_clock::now();
+  auto idleSince = steadyNow - pageOutIdle_;
+
+  std::unordered_set<w_string> recentlyUsed;
+  {
+    auto use = subtreeUse_.wlock();
+    if (use->wholeTree && *use->wholeTree < idleSince) {
+      use->wholeTree.reset();
+    }
+    for (auto it = use->subtrees.begin(); it != use->subtrees.end();) {
+      if (it->second < idleSince) {
+        it = use->subtrees.erase(it);
+      } else {
+        recentlyUsed.insert(it->first);
+        ++it;
+      }
+    }
+    if (use->wholeTree) {
+      return 0;
+    }
+  }
+
+  auto changedBefore = std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now() - pageOutIdle_);
+  auto candidates = view_.rlock()->getIdleSubtrees(
+      changedBefore, idleSince, pageOutMinFiles_);
+
+  size_t pagedOut = 0;
+  for (auto& name : candidates) {
+    if (recentlyUsed.count(name)) {
+      continue;
+    }
+    // One dir at a time, so that queries can get in between
+    auto view = view_.wlock();
+    if (resultIdentityPin_.use_count() > 1) {
+      // As for ageOut: the queries deduping their results by node
+      // addresses need the nodes to stay put
+      logf(DBG, "page out deferred while queries are deduping results\n");
+      break;
+    }
+    if (view->pageOut(name, nextColdSegmentPath())) {
+      ++pagedOut;
+    }
+  }
+
+  if (pagedOut) {
+    auto releasedBytes = getNodeArena().trim();
+    logf(
+        ERR,
+        "paged out {} idle dirs of {}, releasing {} bytes\n",
+        pagedOut,
+        rootPath_,
+        releasedBytes);
+  }
+  return pagedOut;
+}
+
+json_ref InMemoryView::getMemoryUsage() const {
+  auto usage = view_.rlock()->getMemoryUsage();
+  auto result = json_object({
+      {"files", json_integer(usage.numFiles)},
+      {"file_bytes", json_integer(usage.fileBytes)},
+      {"dirs", json_integer(usage.numDirs)},
+      {"dir_bytes", json_integer(usage.dirBytes)},
+      {"dir_names", json_integer(usage.numDirNames)},
+      {"dir_name_bytes", json_integer(usage.dirNameBytes)},
+      {"suffix_index_entries", json_integer(usage.suffixIndexEntries)},
+      {"subtree_index_entries", json_integer(usage.subtreeIndexEntries)},
+      {"path_filter_bytes", json_integer(usage.pathFilterBytes)},
+      {"cold_subtrees", json_integer(usage.numColdSubtrees)},
+      {"cold_files", json_integer(usage.coldFiles)},
+      {"cold_dirs", json_integer(usage.coldDirs)},
+      {"cold_bytes", json_integer(usage.coldBytes)},
+      {"content_hash_cache_entries",
+       json_integer(caches_.contentHashCache.stats().size)},
+      {"symlink_target_cache_entries",
+       json_integer(caches_.symlinkTargetCache.stats().size)},
+      {"pending_items", json_integer(getPendingItemCount())},
   });
+  auto watcherUsage = watcher_->getMemoryUsage();
+  if (!watcherUsage.isNull()) {
+    result.set("watcher", std::move(watcherUsage));
+  }
+  return result;
 }
 
 void InMemoryView::clearViewDebugInfo() {
   if (processedPaths_) {
     processedPaths_->clear();
   }
+  ignoredPathsPruned_.store(0, std::memory_order_release);
+  recrawlDirsPruned_.store(0, std::memory_order_release);
+  dirsMovedInPlace_.store(0, std::memory_order_release);
+  overflowResyncs_.store(0, std::memory_order_release);
+  idempotentWritesIgnored_.store(0, std::memory_order_release);
+  hashOnChangeStarted_.store(0, std::memory_order_release);
+  hashOnChangeSkipped_.store(0, std::memory_order_release);
 }
 
 SCM* InMemoryView::getSCM() const {
+  // Looking for the repository means probing each parent of the root, which
+  // adds up when the daemon is re-establishing many watches at startup, so
+  // it waits until a query first needs to know.
+  std::call_once(scmDetected_, [&] { scm_ = SCM::scmForPath(rootPath_); });
   return scm_.get();
 }
 
+void InMemoryView::precomputeMergeBases(Root& root) {
+  if (!enableMergeBasePrecompute_) {
+    return;
+  }
+  auto* scm = getSCM();
+  if (!scm) {
+    return;
+  }
+  auto commits = scm->takeMergeBasesToPrecompute();
+  if (commits.empty()) {
+    return;
+  }
+
+  // The root keeps the view, and so the SCM, alive until we're done
+  getThreadPool(ThreadPool::Priority::Scm)
+      .add([root = root.shared_from_this(),
+            scm,
+            commits = std::move(commits)] {
+        for (auto& commit : commits) {
+          try {
+            auto mergeBase = scm->mergeBaseWith(commit);
+            scm->getFilesChangedSinceMergeBaseWith(mergeBase);
+          } catch (const std::exception& exc) {
+            log(DBG,
+                "failed to precompute the merge base with ",
+                commit,
+                ": ",
+                exc.what(),
+                "\n");
+          }
+        }
+        scm->donePrecomputingMergeBases();
+      });
+}
+
 void InMemoryView::warmContentCache() {
   if (!enableContentCacheWarming_) {
     return;
@@ -1192,10 +2922,8 @@ void InMemoryView::warmContentCache() {
 
   log(DBG, "considering files for content hash cache warming\n");
 
+  auto& warmer = caches_.contentHashWarmer;
   size_t n = 0;
-  std::deque<folly::Future<std::shared_ptr<const ContentHashCache::Node>>>
-      futures;
-
   {
     // Walk back in time until we hit the boundary, or hit the limit
     // on the number of files we should warm up.
@@ -1213,32 +2941,30 @@ void InMemoryView::warmContentCache() {
         break;
       }
 
+      auto dirStr = f->parent->getFullPath();
+      w_string_piece dir(dirStr);
+      dir.advance(caches_.contentHashCache.rootPath().size());
+
+      // If dirName is the root, dir.size() will now be zero
+      if (dir.size() > 0) {
+        // if not at the root, skip the slash character at the
+        // front of dir
+        dir.advance(1);
+      }
+      auto relativePath = w_string::pathCat({dir, f->getName()});
+
       if (f->exists && f->stat.isFile()) {
         // Note: we could also add an expression to further constrain
         // the things we warm up here.  Let's see if we need it before
         // going ahead and adding.
-
-        auto dirStr = f->parent->getFullPath();
-        w_string_piece dir(dirStr);
-        dir.advance(caches_.contentHashCache.rootPath().size());
-
-        // If dirName is the root, dir.size() will now be zero
-        if (dir.size() > 0) {
-          // if not at the root, skip the slash character at the
-          // front of dir
-          dir.advance(1);
-        }
-        ContentHashCacheKey key{
-            w_string::pathCat({dir, f->getName()}),
-            size_t(f->stat.size),
-            f->stat.mtime};
-
-        log(DBG, "warmContentCache: lookup ", key.relativePath, "\n");
-        auto f = caches_.contentHashCache.get(key);
-        if (syncContentCacheWarming_) {
-          futures.emplace_back(std::move(f));
-        }
+        log(DBG, "warmContentCache: schedule ", relativePath, "\n");
+        warmer.schedule(ContentHashCacheKey{
+            std::move(relativePath), size_t(f->stat.size), f->stat.mtime()});
         ++n;
+      } else {
+        // If we had scheduled it before it went away, there is no longer
+        // any point hashing it
+        warmer.cancel(relativePath);
       }
     }
 
@@ -1250,14 +2976,10 @@ void InMemoryView::warmContentCache() {
       lastWarmedTick_,
       " scheduled ",
       n,
-      " files for hashing, will wait for ",
-      futures.size(),
-      " lookups to finish\n");
+      " files for hashing\n");
 
   if (syncContentCacheWarming_) {
-    // Wait for them to finish, but don't use get() because we don't
-    // care about any errors that may have occurred.
-    folly::collectAll(futures.begin(), futures.end()).wait();
+    warmer.waitUntilIdle();
     log(DBG, "warmContentCache: hashing complete\n");
   }
 }
@@ -6,22 +6,38 @@
  */
 
 #pragma once
+#include <folly/Function.h>
 #include <folly/Synchronized.h>
+#include <atomic>
+#include <chrono>
+#include <ctime>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
+#include "watchman/ChangeJournal.h"
 #include "watchman/ContentHash.h"
+#include "watchman/ContentHashWarmer.h"
 #include "watchman/CookieSync.h"
+#include "watchman/MappedSegment.h"
+#include "watchman/NameInterner.h"
+#include "watchman/NodeArena.h"
+#include "watchman/PathFilter.h"
 #include "watchman/PendingCollection.h"
 #include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Result.h"
-#include "watchman/RingBuffer.h"
+#include "watchman/ThreadLocalRingBuffer.h"
+#include "watchman/SettleController.h"
 #include "watchman/SymlinkTargets.h"
+#include "watchman/TreeSizeHints.h"
+#include "watchman/ViewSnapshot.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/DirHandle.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/query/FileResult.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
@@ -31,7 +47,6 @@ struct watchman_file;
 
 namespace watchman {
 
-class FileSystem;
 class RootConfig;
 struct GlobTree;
 class Watcher;
@@ -40,17 +55,55 @@ class Watcher;
 struct InMemoryViewCaches {
   ContentHashCache contentHashCache;
   SymlinkTargetCache symlinkTargetCache;
+  ContentHashWarmer contentHashWarmer;
+  // When a query asks for the content.fingerprint of a file at least this
+  // large, its full content hash is computed in the background by
+  // contentHashWarmer, for a later content.sha1hex; 0 for never.
+  uint64_t fingerprintFullHashMinSize{0};
 
   InMemoryViewCaches(
       const w_string& rootPath,
       size_t maxHashes,
       size_t maxSymlinks,
-      std::chrono::milliseconds errorTTL);
+      std::chrono::milliseconds errorTTL,
+      w_string hashXattrName = w_string());
 };
 
 class InMemoryFileResult final : public FileResult {
  public:
-  InMemoryFileResult(const watchman_file* file, InMemoryViewCaches& caches);
+  // dirName, if known, is the full path to the file's parent, which saves
+  // building it again
+  InMemoryFileResult(
+      const watchman_file* file,
+      InMemoryViewCaches& caches,
+      w_string dirName = w_string());
+
+  // Generators make one of these for every file that they visit, so they
+  // are allocated from the arena of the query that they are made for,
+  // rather than from the general purpose allocator.  See
+  // QueryContext::arena.
+  static std::unique_ptr<InMemoryFileResult> make(
+      NodeArena& arena,
+      const watchman_file* file,
+      InMemoryViewCaches& caches,
+      w_string dirName = w_string());
+  // Copies other, such as one of the results held by a settle delta
+  static std::unique_ptr<InMemoryFileResult> make(
+      NodeArena& arena,
+      const InMemoryFileResult& other);
+
+  static void* operator new(size_t size, NodeArena& arena) {
+    return arena.allocate(size);
+  }
+  // Only used if the constructor throws
+  static void operator delete(void* ptr, NodeArena& arena) {
+    arena.deallocate(ptr, sizeof(InMemoryFileResult));
+  }
+  static void operator delete(void* ptr, size_t size) {
+    // Returned to whichever arena the block came from
+    getNodeArena().deallocate(ptr, size);
+  }
+
   std::optional<FileInformation> stat() override;
   std::optional<struct timespec> accessedTime() override;
   std::optional<struct timespec> modifiedTime() override;
@@ -63,15 +116,46 @@ class InMemoryFileResult final : public FileResult {
   std::optional<w_clock_t> ctime() override;
   std::optional<w_clock_t> otime() override;
   std::optional<FileResult::ContentHash> getContentSha1() override;
+  std::optional<FileResult::ContentHash> getContentFingerprint() override;
+  const void* identity() const override;
   void batchFetchProperties(
-      const std::vector<std::unique_ptr<FileResult>>& files) override;
+      const std::vector<std::unique_ptr<FileResult>>& files,
+      PropertyCacheStats* cacheStats) override;
+
+  /**
+   * Copies the properties of the file out of the view so that this
+   * result no longer references the watchman_file, and may be used after
+   * the view lock is released.  Must be called with the view locked.
+   */
+  void detach();
 
  private:
+  // The properties copied by detach()
+  struct Detached {
+    FileInformation stat;
+    w_clock_t ctime;
+    w_clock_t otime;
+    bool exists;
+    w_string baseName;
+    // Only the address is used, as the identity(); the node may have been
+    // freed since
+    const watchman_file* node{nullptr};
+  };
+
+  FileInformation fileStat() const {
+    return detached_ ? detached_->stat : file_->getStat();
+  }
+  const w_clock_t& fileOtime() const {
+    return detached_ ? detached_->otime : file_->otime;
+  }
+
   const watchman_file* file_;
+  std::optional<Detached> detached_;
   w_string dirName_;
   InMemoryViewCaches& caches_;
   std::optional<w_string> symlinkTarget_;
   Result<FileResult::ContentHash> contentSha1_;
+  Result<FileResult::ContentHash> contentFingerprint_;
 };
 
 /**
@@ -95,8 +179,34 @@ class ViewDatabase {
     rootInode_ = ino;
   }
 
+  /**
+   * Makes the file nodes created from now on keep the targets of symlinks,
+   * so that they can be rendered without reading the link.
+   */
+  void setKeepSymlinkTargets(bool keep) {
+    keepSymlinkTargets_ = keep;
+  }
+
+  /**
+   * Makes the file nodes created from now on keep the atimes of the files
+   * or not.  Without them, the atime is reported as the mtime.
+   */
+  void setKeepAtimes(bool keep) {
+    keepAtimes_ = keep;
+  }
+
+  /**
+   * Makes markFileChanged record each change in journal, which must
+   * outlive the view.
+   */
+  void setChangeJournal(ChangeJournal* journal) {
+    journal_ = journal;
+  }
+
+  // Pages back in the top level dir that dirname is in, if it is cold
   watchman_dir* resolveDir(const w_string& dirname, bool create);
 
+  // Doesn't page anything in: the contents of a cold dir appear empty
   const watchman_dir* resolveDir(const w_string& dirname) const;
 
   /**
@@ -115,6 +225,44 @@ class ViewDatabase {
    */
   void markFileChanged(Watcher& watcher, watchman_file* file, w_clock_t otime);
 
+  /**
+   * Until endBulkLoad, the files that markFileChanged sees for the first
+   * time are only collected, rather than each moved to the head of the
+   * recency lists, and endBulkLoad links them all at once.  For full
+   * crawls, which mark everything with the same tick and hold the lock
+   * throughout, so that nothing walks the lists in the meantime.  No file
+   * may be freed while bulk loading.
+   */
+  void beginBulkLoad() {
+    bulkLoading_ = true;
+  }
+  void endBulkLoad();
+
+  /**
+   * Returns an upper bound on the number of files in the recency list that
+   * changed after ticks, which is about how many a walk of the list back to
+   * ticks would visit.  Found by a binary search of the checkpoints taken
+   * as files are moved to the head of the list; if ticks is older than all
+   * of them, returns the largest possible value.
+   */
+  uint64_t estimateFilesChangedSince(uint32_t ticks) const;
+
+  /**
+   * Returns the file that has been deleted for longest, or nullptr if every
+   * file exists.  Those deleted after it follow in order; see
+   * getNextTombstone.
+   */
+  watchman_file* getOldestTombstone() const {
+    return getNextTombstone(&tombstones_);
+  }
+
+  /**
+   * Returns the file deleted next after file, or nullptr if there are none.
+   */
+  watchman_file* getNextTombstone(const watchman_file* file) const {
+    return getNextTombstone(&file->tombstone);
+  }
+
   /**
    * Mark a directory as being removed from the view. Marks the contained set of
    * files as deleted. If recursive is true, is recursively invoked on child
@@ -126,20 +274,260 @@ class ViewDatabase {
       w_clock_t otime,
       bool recursive);
 
+  /**
+   * Moves what the view knows about the dir at `from` to `to`, as when the
+   * watcher reports that it was renamed, without statting anything.  The
+   * files below `to` are reported as changed at otime, with the metadata
+   * that they had at `from`, and those below `from` as deleted.  The full
+   * paths of the dirs below `to`, including `to` itself, are appended to
+   * `movedDirs`; the caller should crawl each of them to check that they
+   * hold what we expect.
+   *
+   * Returns false, leaving the view alone, unless `from` is an existing dir
+   * and `to` is in an existing dir and is not itself existing.
+   */
+  bool moveDir(
+      Watcher& watcher,
+      const w_string& from,
+      const w_string& to,
+      w_clock_t otime,
+      std::vector<w_string>& movedDirs);
+
+  /**
+   * Returns the head of the list of files whose lowercased suffix (as
+   * computed by w_string_piece::asLowerCaseSuffix) is `suffix`, or nullptr if
+   * there are none.  The remainder of the list is linked via suffixNext.
+   */
+  watchman_file* getFilesWithSuffix(const w_string& suffix) const;
+
+  /**
+   * Drop suffix index entries that no longer reference any files.
+   */
+  void pruneSuffixIndex();
+
+  /**
+   * Returns the most recently changed file below the top level directory
+   * of the root named `name`, or nullptr if there are none.  The remainder
+   * of the files below that directory follow in recency order, linked via
+   * subtreeNext.
+   */
+  watchman_file* getLatestFileInSubtree(const w_string& name) const;
+
+  /**
+   * Drop subtree index entries that no longer reference any files.
+   */
+  void pruneSubtreeIndex();
+
+  /**
+   * Drop interned dir names that are no longer used by any dir.
+   */
+  void pruneDirNames();
+
+  /**
+   * Returns false if there is definitely no file or dir node at fullPath,
+   * sparing the caller from walking the tree to find that out.  Returns
+   * true if there may be one, including when the file it names is deleted.
+   */
+  bool mayHavePath(const w_string& fullPath) const;
+
+  /**
+   * Refills the path filter from the nodes in the tree, sizing it to hold
+   * twice as many.
+   */
+  void rebuildPathFilter();
+
+  struct MemoryUsage {
+    size_t numFiles{0};
+    // Includes the names, which are stored inline
+    size_t fileBytes{0};
+    size_t numDirs{0};
+    // Includes the child maps, but not the interned names
+    size_t dirBytes{0};
+    size_t numDirNames{0};
+    size_t dirNameBytes{0};
+    size_t suffixIndexEntries{0};
+    size_t subtreeIndexEntries{0};
+    size_t pathFilterBytes{0};
+    size_t numColdSubtrees{0};
+    size_t coldFiles{0};
+    size_t coldDirs{0};
+    // The size of their segments, whether mapped or not
+    size_t coldBytes{0};
+  };
+
+  /**
+   * Walks the tree to total up the memory held by its nodes.  The bytes are
+   * what the view asked for, so allocator overhead is not included.
+   */
+  MemoryUsage getMemoryUsage() const;
+
+  /**
+   * Sizes the tables of an empty view to hold a tree of the size of hints,
+   * so that the initial crawl doesn't grow them as it goes.
+   */
+  void reserve(const TreeSizeHints& hints);
+
+  // Walks the tree to count its dirs and files
+  TreeSizeHints getTreeSizeHints() const;
+
+  /**
+   * A top level dir of the root whose contents have been paged out of the
+   * view.  Its node stays in the root, empty, and the nodes below it are
+   * kept in the encoding of ViewSnapshot::serializeContents.
+   */
+  struct ColdSubtree {
+    std::unique_ptr<MappedSegment> segment;
+    // The most recent change to any file below the dir
+    w_clock_t newest{0, 0};
+    // Not counting the dir itself
+    size_t numDirs{0};
+    size_t numFiles{0};
+  };
+  using ColdSubtrees = std::unordered_map<w_string, ColdSubtree>;
+
+  /**
+   * Pages out the contents of the top level dir named name into a segment
+   * kept in a file at segmentPath, or in memory if that is null, freeing
+   * their nodes.  Returns false, leaving the view alone, if there is no
+   * such dir, if it is cold already or has no files below it, or while bulk
+   * loading.
+   *
+   * The dir is paged back in by anything that resolves a dir below it for
+   * writing, or marks it deleted, so the changes that the watcher reports
+   * in it are applied as usual.  Readers under the read lock see it empty,
+   * so queries that may need what is in it must pageIn first.
+   */
+  bool pageOut(const w_string& name, const w_string& segmentPath);
+
+  /**
+   * Restores the contents of the cold top level dir named name, linking
+   * its files into the recency index where their otimes put them.  Returns
+   * false if it isn't cold.
+   */
+  bool pageIn(const w_string& name);
+
+  const ColdSubtrees& getColdSubtrees() const {
+    return coldSubtrees_;
+  }
+
+  /**
+   * If fullPath is in a cold top level dir, returns whether there is an
+   * existing file there, which is as it was when the dir was paged out.
+   * Returns nullopt for the paths that aren't.
+   */
+  std::optional<bool> coldFileExists(const w_string& fullPath) const;
+
+  /**
+   * Returns the names of the top level dirs, other than the cold ones, in
+   * which nothing has changed since changedBefore, that haven't been paged
+   * in since pagedInBefore, and that have at least minFiles files below
+   * them.
+   */
+  std::vector<w_string> getIdleSubtrees(
+      time_t changedBefore,
+      std::chrono::steady_clock::time_point pagedInBefore,
+      size_t minFiles) const;
+
  private:
   void insertAtHeadOfFileList(struct watchman_file* file);
+  void insertIntoSuffixIndex(struct watchman_file* file);
+  // Moves file to the head of the recency list for its top level directory
+  void insertAtHeadOfSubtreeList(struct watchman_file* file);
+  // The head of the recency list for the top level directory that holds
+  // dir, or nullptr if dir is the root
+  watchman_file** getSubtreeHead(const watchman_dir* dir);
+  // Links file at the end of the tombstone list if it is deleted, or
+  // unlinks it if it exists
+  void updateTombstoneList(struct watchman_file* file);
+  void addToPathFilter(PathFilter::Hash hash);
+  // name must be the interned name, as the dir keeps it alive for the key
+  watchman_dir* createChildDir(watchman_dir* parent, w_string name);
+  void copyDirContents(
+      Watcher& watcher,
+      const watchman_dir* from,
+      watchman_dir* to,
+      w_clock_t otime,
+      std::vector<w_string>& movedDirs);
+  void addRecencyCheckpoint(uint32_t ticks);
+  // Whether the path, relative to the root, is in a cold top level dir
+  bool isInColdSubtree(w_string_piece relPath) const;
+  // dir must be a child of rootDir_
+  void pageInIfCold(const watchman_dir* dir);
+
+  watchman_file* getNextTombstone(const watchman_tombstone_link* link) const {
+    return link->next == &tombstones_
+        ? nullptr
+        : watchman_file::fromTombstoneLink(link->next);
+  }
+
+  friend class ViewSnapshot;
 
   const w_string rootPath_;
 
   /* the most recently changed file */
   watchman_file* latestFile_ = nullptr;
 
+  struct RecencyCheckpoint {
+    // The tick of the file moved to the head of the recency list, and the
+    // number of moves up to and including that one
+    uint32_t ticks;
+    uint64_t moves;
+  };
+
+  // Taken every recencyCheckpointInterval_ moves, oldest first.  Every other
+  // one is dropped, and the interval doubled, when there get to be too
+  // many, so that they keep covering the whole life of the view.
+  std::vector<RecencyCheckpoint> recencyCheckpoints_;
+  uint64_t recencyMoves_{0};
+  uint64_t recencyCheckpointInterval_;
+
+  // Heads of the per-suffix file lists.  The file nodes point back into
+  // this map when they are unlinked during destruction, so it must be
+  // declared before (and thus destroyed after) rootDir_.
+  std::unordered_map<w_string, watchman_file*> suffixIndex_;
+
+  // Heads of the per top level directory recency lists, keyed by the name
+  // of the directory.  As with suffixIndex_, this must outlive rootDir_.
+  std::unordered_map<w_string, watchman_file*> subtreeIndex_;
+
+  // Sentinel of the circular list of deleted files, oldest first, that
+  // ageOut works through.  As with suffixIndex_, this must outlive rootDir_.
+  watchman_tombstone_link tombstones_;
+
+  // The names of the dirs below rootDir_, shared between dirs of the same
+  // name.
+  NameInterner dirNames_;
+
+  // Every node created since the filter was last rebuilt, including those
+  // that have since been deleted or aged out.  The nodes in cold subtrees
+  // aren't in it after a rebuild; mayHavePath checks coldSubtrees_ for them.
+  PathFilter pathFilter_;
+
+  // Keyed by the name of the top level dir
+  ColdSubtrees coldSubtrees_;
+  // When each of the top level dirs that have been paged in was last paged
+  // in, so that they aren't paged out again straight away
+  std::unordered_map<w_string, std::chrono::steady_clock::time_point>
+      pagedInAt_;
+
   std::unique_ptr<watchman_dir> rootDir_;
 
   // Inode number for the root dir.  This is used to detect what should
   // be impossible situations, but is needed in practice to workaround
   // eg: BTRFS not delivering all events for subvolumes
   ino_t rootInode_{0};
+
+  bool keepSymlinkTargets_{false};
+  bool keepAtimes_{true};
+
+  ChangeJournal* journal_{nullptr};
+
+  bool bulkLoading_{false};
+  // The files, in the order that they were first marked, for endBulkLoad
+  // to link into the recency lists.  Their prev points at bulkLoadedHead_
+  // until then, so that they are collected once.
+  std::vector<watchman_file*> bulkLoaded_;
+  watchman_file* bulkLoadedHead_{nullptr};
 };
 
 /**
@@ -159,6 +547,7 @@ class InMemoryView final : public QueryableView {
   InMemoryView& operator=(InMemoryView&&) = delete;
 
   ClockPosition getMostRecentRootNumberAndTickValue() const override;
+  ClockPosition getLastChangePosition() const override;
   uint32_t getLastAgeOutTickValue() const override;
   std::chrono::system_clock::time_point getLastAgeOutTimeStamp() const override;
   w_string getCurrentClockString() const override;
@@ -171,12 +560,14 @@ class InMemoryView final : public QueryableView {
   }
 
   void ageOut(PerfSample& sample, std::chrono::seconds minAge) override;
+  std::shared_ptr<const void> pinResultIdentities() const override;
 
   folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period) override;
   CookieSync::SyncResult syncToNow(
       const std::shared_ptr<Root>& root,
-      std::chrono::milliseconds timeout) override;
+      std::chrono::milliseconds timeout,
+      const w_string& scope) override;
 
   bool doAnyOfTheseFilesExist(
       const std::vector<w_string>& fileNames) const override;
@@ -189,6 +580,28 @@ class InMemoryView final : public QueryableView {
 
   void allFilesGenerator(const Query* query, QueryContext* ctx) const override;
 
+  void wholeNamesGenerator(
+      const Query* query,
+      const std::vector<w_string>& names,
+      CaseSensitivity caseSensitive,
+      QueryContext* ctx) const override;
+
+  void subtreeGenerator(
+      const Query* query,
+      const w_string& dirName,
+      uint32_t maxDepth,
+      QueryContext* ctx) const override;
+
+  void suffixGenerator(
+      const Query* query,
+      const std::vector<w_string>& suffixes,
+      QueryContext* ctx) const override;
+
+  void unsettledGenerator(
+      const Query* query,
+      uint32_t sinceTicks,
+      QueryContext* ctx) const override;
+
   /**
    * Returns a SemiFuture that completes when any pending recrawls are
    * completed. The primary use of this is so that "watch-project" doesn't send
@@ -199,9 +612,25 @@ class InMemoryView final : public QueryableView {
    */
   folly::SemiFuture<folly::Unit> waitUntilReadyToQuery() override;
 
+  folly::SemiFuture<folly::Unit> waitForCrawl(
+      std::vector<w_string> dirs) override;
+
+  void pageInForQuery(
+      const std::vector<w_string>& dirs,
+      const QuerySince& since) override;
+
+  /**
+   * Pages out the top level dirs of the root that have had nothing change
+   * in them, and haven't been paged in or needed by a query, for the
+   * configured view_page_out_idle_seconds.  Called on the IO thread when
+   * the view settles.  Returns how many dirs were paged out.
+   */
+  size_t pageOutIdleSubtrees();
+
   void startThreads(const std::shared_ptr<Root>& root) override;
   void stopThreads() override;
   void wakeThreads() override;
+  bool resyncFrom(std::chrono::system_clock::time_point lastGood) override;
   void clientModeCrawl(const std::shared_ptr<Root>& root);
 
   const w_string& getName() const override;
@@ -210,20 +639,38 @@ class InMemoryView final : public QueryableView {
   void clearWatcherDebugInfo() override;
   json_ref getViewDebugInfo() const;
   void clearViewDebugInfo();
+  json_ref getSettleStatus() const override;
+  json_ref getMemoryUsage() const override;
+  std::optional<TreeSizeHints> getTreeSizeHints() const override;
+
+  // The number of paths from the watcher waiting for the IO thread.  This
+  // doesn't include batches pushed since the IO thread last woke.
+  uint32_t getPendingItemCount() const;
 
   // If content cache warming is configured, do the warm up now
   void warmContentCache();
 
+  // If the working copy commit has moved, look up the merge bases that
+  // queries asked for recently, and the files changed since them, on the
+  // thread pool, so that the next query finds them in the SCM's caches.
+  void precomputeMergeBases(Root& root);
+
   SCM* getSCM() const override;
 
   InMemoryViewCaches& debugAccessCaches() const {
     return caches_;
   }
 
+  // Null unless change_journal_max_bytes is set
+  ChangeJournal* getChangeJournal() const {
+    return journal_.get();
+  }
+
  private:
   CookieSync::SyncResult syncToNowCookies(
       const std::shared_ptr<Root>& root,
-      std::chrono::milliseconds timeout);
+      std::chrono::milliseconds timeout,
+      const w_string& scope);
 
   // Returns the erased file's otime.
   w_clock_t ageOutFile(
@@ -236,12 +683,88 @@ class InMemoryView final : public QueryableView {
   // caller will abort all pending cookies after processAllPending returns.
   enum class IsDesynced { Yes, No };
 
+  /**
+   * Passes file to w_query_process_file, or when detached evaluation is
+   * enabled, detaches it and defers its evaluation until the generator
+   * has released the view lock.
+   */
+  void processFile(
+      const Query* query,
+      QueryContext* ctx,
+      const watchman_file* file) const;
+
+  /**
+   * Runs walk, a generator's walk of the view, which passes the files that
+   * it visits to processFile.  With query_parallelism set, and enough of
+   * them, the files are gathered up and evaluated by evaluateInParallel
+   * once the walk is done.  Must be called with the view locked.
+   */
+  void generateInParallel(
+      const Query* query,
+      QueryContext* ctx,
+      folly::FunctionRef<void()> walk) const;
+
+  /**
+   * Evaluates query against files on the thread pool, split into
+   * queryParallelism_ shards that each have a QueryContext of their own,
+   * then dedups and renders the matches into ctx on this thread.
+   */
+  void evaluateInParallel(
+      const Query* query,
+      QueryContext* ctx,
+      const std::vector<const watchman_file*>& files) const;
+
+  /**
+   * Satisfies a clock based time generator from the settle delta, if it
+   * covers the query's since clock and nothing has changed since it was
+   * published.  Returns false if the view must be walked instead.
+   */
+  bool timeGeneratorFromSettleDelta(const Query* query, QueryContext* ctx)
+      const;
+
+  /**
+   * Walks the recency index, or the cheapest thing standing in for it, for
+   * the files that changed after the query's since.
+   */
+  void timeGeneratorFromView(const Query* query, QueryContext* ctx) const;
+
+  /**
+   * Completes a clock based time generator from the change journal, with
+   * the files that were deleted after the query's since clock and had been
+   * aged out of the view, by agedOutTick, before it was walked.
+   */
+  void agedOutGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      uint32_t agedOutTick) const;
+
   /** Recursively walks files under a specified dir */
   void dirGenerator(
       const Query* query,
       QueryContext* ctx,
       const watchman_dir* dir,
       uint32_t depth) const;
+
+  /**
+   * Returns the dir that the query is restricted to, if walking it for the
+   * files that changed after sinceTicks is cheaper than walking the recency
+   * list back to sinceTicks.  Must be called with the view locked.
+   */
+  const watchman_dir* findCheaperDirForSince(
+      const ViewDatabase& view,
+      const Query* query,
+      uint32_t sinceTicks) const;
+
+  /**
+   * Like dirGenerator, but only visits the files that changed after
+   * sinceTicks.
+   */
+  void changedInDirGenerator(
+      const Query* query,
+      QueryContext* ctx,
+      const watchman_dir* dir,
+      uint32_t depth,
+      uint32_t sinceTicks) const;
   void globGeneratorTree(
       QueryContext* ctx,
       const GlobTree* node,
@@ -259,13 +782,57 @@ class InMemoryView final : public QueryableView {
 
   void ioThread(const std::shared_ptr<Root>& root);
 
+  // Stat results obtained by prefetchPendingStats, keyed by full path.
+  using PendingStats = std::unordered_map<w_string, DirEntry>;
+
   // Consume entries from `pending` and apply them to the InMemoryView. Any new
   // pending paths generated by processPath will be crawled before
-  // processAllPending returns.
+  // processAllPending returns.  Entries found in preStats use that stat
+  // result rather than statting the path again.
   IsDesynced processAllPending(
       const std::shared_ptr<Root>& root,
       ViewDatabase& view,
-      PendingChanges& pending);
+      PendingChanges& pending,
+      PendingStats* preStats = nullptr);
+
+  /**
+   * Called before processAllPending when queries are syncing with a scope:
+   * processes just the entries of `pending` in those scopes, and the new
+   * entries that they lead to, and settles the cookies of the queries once
+   * it has.  The rest are left in `pending`.  Returns true if any cookies
+   * were settled, in which case the caller lets the queries see the view
+   * before it processes the rest.
+   */
+  bool processScopedPending(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& pending,
+      PendingStats* preStats);
+
+  /**
+   * If change_stat_parallelism is configured and enough changed paths are
+   * pending, stat them in parallel on the thread pool.  This is called
+   * before the view lock is taken, so that neither queries nor the IO
+   * thread wait on those stats in series.
+   */
+  PendingStats prefetchPendingStats(const Root& root, PendingChanges& pending);
+
+  /**
+   * Returns true if ignore_idempotent_writes says that a change to file,
+   * whose fresh stat is st, should not be reported because it left the
+   * file as it was.  relativePath is that of file, relative to the root.
+   */
+  bool isIdempotentWrite(
+      const watchman_file* file,
+      const FileInformation& st,
+      w_string_piece relativePath);
+
+  /**
+   * If content_hash_on_change_max_size allows it, starts hashing the file
+   * at relativePath, whose fresh stat is st, on the thread pool, so that
+   * its hash is in the cache before a query asks for it.
+   */
+  void hashOnChange(w_string_piece relativePath, const FileInformation& st);
 
   void processPath(
       const std::shared_ptr<Root>& root,
@@ -284,14 +851,72 @@ class InMemoryView final : public QueryableView {
    *  - W_PENDING_VIA_NOTIFY when the watcher only supports directory
    *    notification (W_PENDING_NONRECURSIVE_SCAN), this will stat all
    *    the files and directories contained in the passed in directory and stop.
+   *
+   * If notified is non-null, it holds the names of children that the watcher
+   * reported as changed; they are processed as if they had arrived via
+   * W_PENDING_VIA_NOTIFY, even if they no longer appear in the directory.
    */
   void crawler(
       const std::shared_ptr<Root>& root,
       ViewDatabase& view,
       PendingChanges& coll,
       const PendingChange& pending,
+      std::vector<w_string>& pendingCookies,
+      const std::unordered_set<w_string>* notified = nullptr);
+
+  /**
+   * Called by processAllPending when coalesce_dir_rescan_threshold is set.
+   * Directories with more than that many watcher notifications for their
+   * immediate children are rescanned with a single crawl of the directory,
+   * and the individual notifications are removed from the chain.  Returns
+   * what remains of the chain.
+   */
+  std::shared_ptr<watchman_pending_fs> rescanBusyDirs(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& coll,
+      std::shared_ptr<watchman_pending_fs> pending,
       std::vector<w_string>& pendingCookies);
 
+  /**
+   * Called by processAllPending before anything in the chain is processed,
+   * so that the view still holds the dirs that the watcher saw renamed when
+   * their old paths are found to be gone.  Each dir whose new path is
+   * marked as moved from an old one has its subtree moved with
+   * ViewDatabase::moveDir, and each of the moved dirs is queued up for a
+   * crawl to check it, rather than for the recursive crawl, and stat of
+   * every file, that a new dir gets.
+   */
+  void applyDirMoves(
+      const std::shared_ptr<Root>& root,
+      ViewDatabase& view,
+      PendingChanges& coll,
+      const watchman_pending_fs* pending);
+
+  /**
+   * A directory entry discovered by the crawler that needs to be passed
+   * through processPath.
+   */
+  struct CrawlEntry {
+    w_string name;
+    w_string fullPath;
+    PendingFlags flags;
+    DirEntry dirent{};
+  };
+
+  // Below this many entries it isn't worth dispatching stat work to the
+  // thread pool.
+  static constexpr size_t kMinEntriesForParallelStat = 32;
+
+  /**
+   * If crawl_stat_parallelism is configured, stat the entries that don't
+   * already have stat information in parallel on the thread pool, so that
+   * the crawler can hand them to statPath as pre_stat results.
+   */
+  void prefetchCrawlStats(
+      std::vector<CrawlEntry>& entries,
+      CaseSensitivity caseSensitive);
+
   bool propagateToParentDirIfAppropriate(
       const RootConfig& root,
       PendingChanges& coll,
@@ -361,13 +986,101 @@ class InMemoryView final : public QueryableView {
       PendingCollection& pendingFromWatcher,
       PendingChanges& localPending);
 
+  /**
+   * Seed the view from the snapshot left behind by a previous daemon, if
+   * there is one and it is still plausibly valid, along with the named
+   * cursors of the root.  The caller must follow up with a full crawl to
+   * pick up any changes since it was written, except in client mode, where
+   * nothing is watched.  Returns the header of the snapshot if the view was
+   * restored.
+   */
+  std::optional<ViewSnapshot::Header> restoreViewSnapshot(
+      Root& root,
+      ViewDatabase& view,
+      bool watchFiles);
+
+  /**
+   * Asks the SCM, on its thread pool, for the files that may differ from
+   * what they were when the working copy was at commit: those changed
+   * between the merge base of the working copy with commit and either of
+   * them, and those changed in the working copy.
+   */
+  folly::SemiFuture<std::vector<w_string>> filesChangedSinceCommit(
+      const std::shared_ptr<Root>& root,
+      w_string commit);
+
+  // Puts a warning on the root's responses if the view snapshot that
+  // client mode restored is older than the configured maximum age
+  void warnIfViewSnapshotIsStale(Root& root);
+
+  /**
+   * Performs the initial crawl when lazy_crawl is set.  Rather than holding
+   * the view lock until the whole tree has been crawled, the crawl is done
+   * in short slices so that queries can run in between, and the parts of
+   * the tree that those queries are waiting for in waitForCrawl are crawled
+   * ahead of everything else.
+   *
+   * Given the files that changed since the view snapshot that the view was
+   * restored from, the view is declared ready as soon as they, and the
+   * cookie dirs, have been looked at, and the rest of the crawl carries on
+   * in the background to verify the remainder of the snapshot.
+   */
+  void crawlInSlices(
+      const std::shared_ptr<Root>& root,
+      folly::Synchronized<ViewDatabase>::WLockedPtr& view,
+      PendingCollection& pendingFromWatcher,
+      PendingChanges& localPending,
+      std::chrono::system_clock::time_point start,
+      std::optional<folly::SemiFuture<std::vector<w_string>>> seed =
+          std::nullopt);
+
+  /**
+   * Write out the view snapshot, if one is configured.
+   */
+  void saveViewSnapshot(const Root& root);
+
+  /**
+   * Takes the view lock for the IO thread, counting the time spent waiting
+   * for it, behind queries, as wait time in ThreadStats.
+   */
+  folly::Synchronized<ViewDatabase>::WLockedPtr lockViewForUpdate();
+
+  /**
+   * Write out the content hash cache, if it is persisted and has changed
+   * since it was last written.
+   */
+  void saveContentHashCache();
+
+  /**
+   * Replace the settle delta with the files that changed since the one
+   * that was last published.  Called on the IO thread before subscribers
+   * are told that the view has settled.
+   */
+  void publishSettleDelta();
+
+  /**
+   * Replace the unsettled delta with the files that changed since the view
+   * last settled.  Called on the IO thread, with the view locked, after it
+   * processes a batch of changes.  Returns false, clearing the delta, if
+   * too many files have changed for it to be worth holding on to.
+   */
+  bool publishUnsettledDelta(const ViewDatabase& view);
+
   // Performs settle-time actions.
   // Returns whether the root was reaped and the IO thread should terminate.
   Continue doSettleThings(Root& root, IoThreadState& state);
 
   FileSystem& fileSystem_;
   const Configuration config_;
-
+  // The dirs that statPath has recently looked in, so that the entries of
+  // a dir are statted relative to it.  Only used by the IO thread, which
+  // clears it once it is done with each batch of changes.
+  DirFdCache statDirs_;
+
+  // Records the changes to view_, so that ageOut can drop deleted files
+  // without since queries losing track of them.  Declared before view_,
+  // which points to it.
+  std::unique_ptr<ChangeJournal> journal_;
   folly::Synchronized<ViewDatabase> view_;
   // The most recently observed tick value of an item in the view
   // Only incremented by the iothread, but may be read by other threads.
@@ -376,6 +1089,10 @@ class InMemoryView final : public QueryableView {
   const w_string rootPath_;
 
   uint32_t lastAgeOutTick_{0};
+  // Handed out by pinResultIdentities; age out is held off while anybody
+  // but us holds it
+  const std::shared_ptr<const bool> resultIdentityPin_{
+      std::make_shared<const bool>(true)};
   // This is system_clock instead of steady_clock because it's compared with a
   // file's otime.
   std::chrono::system_clock::time_point lastAgeOutTimestamp_{};
@@ -406,8 +1123,14 @@ class InMemoryView final : public QueryableView {
   // const methods
   mutable InMemoryViewCaches caches_;
 
+  // Chooses the settle period from the rate at which the watcher is
+  // reporting changes.  Updated by the iothread; read by debug-status.
+  folly::Synchronized<SettleController> settleController_;
+
   // Should we warm the cache when we settle?
   bool enableContentCacheWarming_{false};
+  // Should we precompute the SCM merge bases when we settle?
+  bool enableMergeBasePrecompute_{true};
   // How many of the most recent files to warm up when settling?
   size_t maxFilesToWarmInContentCache_{1024};
   // If true, we will wait for the items to be hashed before
@@ -416,8 +1139,125 @@ class InMemoryView final : public QueryableView {
   // Remember what we've already warmed up
   uint32_t lastWarmedTick_{0};
 
-  // The source control system that we detected during initialization
-  std::unique_ptr<SCM> scm_;
+  // If non-null, the view is persisted here so that it can be restored by
+  // the next incarnation of the daemon.
+  w_string viewSnapshotPath_;
+  // How often to refresh the snapshot while the view is settled.
+  std::chrono::seconds viewSnapshotInterval_{0};
+  // Whether the snapshot records the commit of the working copy, so that
+  // the view can be restored from it by statting only the files that the
+  // SCM says have changed since, rather than waiting for a full crawl.
+  bool viewSnapshotScmSeed_{false};
+  // Only accessed on the iothread.
+  std::chrono::steady_clock::time_point lastViewSnapshot_;
+
+  // If non-null, the content hash cache is persisted here so that files
+  // need not be re-hashed by the next incarnation of the daemon.
+  w_string contentHashCachePath_;
+  // How often to refresh the persisted hashes while the view is settled.
+  std::chrono::seconds contentHashPersistInterval_{0};
+  // Only accessed on the iothread.
+  std::chrono::steady_clock::time_point lastContentHashSave_;
+  size_t lastContentHashSaveStores_{0};
+
+  // How many thread pool workers the crawler may use to stat the contents
+  // of a directory.  1 means the crawler stats everything on the IO thread.
+  size_t crawlStatParallelism_{1};
+  // How many thread pool workers may be used to stat the paths reported by
+  // the watcher.  1 means that they are statted on the IO thread.
+  size_t changeStatParallelism_{1};
+
+  // When set, generators copy the candidate files out of the view and
+  // evaluate the query against those copies only after releasing the view
+  // lock, trading memory for shorter read-side critical sections.
+  bool detachedQueryEvaluation_{false};
+
+  // How many threads, including the client's own, may evaluate a query
+  // that visits many files.  1 evaluates every query on the client thread.
+  size_t queryParallelism_{1};
+
+  // A directory with more than this many changed children is rescanned
+  // as a whole rather than child by child.  0 disables coalescing.
+  size_t coalesceDirRescanThreshold_{0};
+
+  // Whether a recursive crawl may skip reading a dir that is evidently
+  // unchanged since the crawler last read it.  Listing re-examines the
+  // dir's known entries instead; Subtree trusts that its files are
+  // unchanged too, and only descends into its child dirs.
+  enum class RecrawlPrune { Off, Listing, Subtree };
+  RecrawlPrune recrawlPrune_{RecrawlPrune::Off};
+  // Incremented by the iothread; reported by debug-watcher-info
+  std::atomic<uint64_t> recrawlDirsPruned_{0};
+  // The dirs that applyDirMoves moved rather than left to be crawled;
+  // incremented by the iothread and reported by debug-watcher-info
+  std::atomic<uint64_t> dirsMovedInPlace_{0};
+
+  // Whether a watcher that loses events may have the crawler rescan just
+  // the dirs that changed since its last good event, keeping the view,
+  // rather than recrawling the whole tree.
+  std::atomic<bool> resyncOnOverflow_{false};
+  // The earliest last good event time of the resyncs that the iothread has
+  // yet to pick up, or 0.  Set by the watcher threads.
+  std::atomic<time_t> resyncSince_{0};
+  // The resync time for the batch that the iothread is processing, or 0
+  time_t activeResyncSince_{0};
+  // Incremented by resyncFrom; reported by debug-watcher-info
+  std::atomic<uint64_t> overflowResyncs_{0};
+
+  // Whether syncToNow asks the watcher to flush rather than writing a
+  // cookie file, for watchers that support it.
+  bool syncWithoutCookies_{false};
+
+  // Whether the initial crawl is done by crawlInSlices
+  bool lazyCrawl_{false};
+
+  struct CrawlWaiter {
+    std::vector<w_string> dirs;
+    folly::Promise<folly::Unit> promise;
+  };
+  struct LazyCrawlState {
+    // Set once the initial crawl has finished
+    bool complete{false};
+    // Queries waiting on parts of the tree that crawlInSlices has yet to
+    // pick up
+    std::vector<CrawlWaiter> waiters;
+  };
+  folly::Synchronized<LazyCrawlState> lazyCrawlState_;
+
+  /**
+   * The files that changed between two settles, copied out of the view.
+   * The subscriptions that are dispatched when the view settles can all
+   * evaluate their queries against this one batch rather than each
+   * walking the recency index under the view lock.
+   */
+  struct SettleDelta {
+    // Holds the files with fromTick < otime.ticks <= toTick
+    uint32_t fromTick;
+    uint32_t toTick;
+    // Most recently changed first, as the time generator yields them
+    std::vector<InMemoryFileResult> files;
+  };
+
+  // Settle deltas with more than this many files are not published.
+  // 0 disables settle deltas.
+  size_t settleDeltaMaxFiles_{0};
+  // The toTick of the most recently built delta.  Only accessed on the
+  // iothread.
+  uint32_t lastSettleDeltaTick_{0};
+  folly::Synchronized<std::shared_ptr<const SettleDelta>> settleDelta_;
+
+  // The files that have changed since the view last settled, published
+  // after each batch of changes while the root has fast subscriptions.
+  // Deltas with more than this many files are not published.
+  size_t unsettledDeltaMaxFiles_{1024};
+  // The most recent tick at the time the view last settled.  Only accessed
+  // on the iothread.
+  uint32_t lastSettledTick_{0};
+  folly::Synchronized<std::shared_ptr<const SettleDelta>> unsettledDelta_;
+
+  // The source control system that contains the root, detected on first use
+  mutable std::once_flag scmDetected_;
+  mutable std::unique_ptr<SCM> scm_;
 
   struct PendingChangeLogEntry {
     PendingChangeLogEntry() noexcept {
@@ -448,7 +1288,55 @@ class InMemoryView final : public QueryableView {
   static_assert(88 == sizeof(PendingChangeLogEntry));
 
   // If set, paths processed by processPending are logged here.
-  std::unique_ptr<RingBuffer<PendingChangeLogEntry>> processedPaths_;
+  std::unique_ptr<ThreadLocalRingBuffer<PendingChangeLogEntry>>
+      processedPaths_;
+
+  // Paths that statPath or the crawler dropped because they are ignored,
+  // and so were never stat'd, recorded or watched.
+  std::atomic<uint64_t> ignoredPathsPruned_{0};
+
+  // Whether a notification for a file that is unchanged is reported, and
+  // how closely the file is compared to decide that it is unchanged.
+  enum class IdempotentWrites { Report, IgnoreMetadata, IgnoreContent };
+  IdempotentWrites idempotentWrites_{IdempotentWrites::Report};
+  // Changes that isIdempotentWrite suppressed
+  std::atomic<uint64_t> idempotentWritesIgnored_{0};
+
+  // Regular files no larger than this are hashed by hashOnChange as soon
+  // as statPath sees them change, while their pages are likely to still
+  // be cached; 0 disables it.
+  uint64_t hashOnChangeMaxSize_{0};
+  // hashOnChange leaves a file to the query path rather than queue it
+  // behind this many hashes, so that a crawl can't fill the pool's queue.
+  static constexpr size_t kMaxQueuedHashOnChange = 1024;
+  // Hashes that hashOnChange started, and those that it skipped because
+  // the queue was full
+  std::atomic<uint64_t> hashOnChangeStarted_{0};
+  std::atomic<uint64_t> hashOnChangeSkipped_{0};
+
+  // Returns the path for the file of the next paged out dir, or null to
+  // keep it in memory, when the daemon has no state dir.
+  w_string nextColdSegmentPath();
+
+  // How long a top level dir must have been left alone before
+  // pageOutIdleSubtrees pages it out.  0 disables paging out.
+  std::chrono::seconds pageOutIdle_{0};
+  // Top level dirs with fewer files than this are left in memory.
+  size_t pageOutMinFiles_{1024};
+  // Only accessed on the iothread.
+  std::chrono::steady_clock::time_point lastPageOutScan_;
+  std::atomic<uint64_t> nextColdSegment_{0};
+
+  // When queries last needed the contents of the top level dirs, so that
+  // those that are queried from scratch, which page them back in, aren't
+  // paged out again straight away.
+  struct SubtreeUse {
+    // Set by the queries that aren't confined to any top level dir
+    std::optional<std::chrono::steady_clock::time_point> wholeTree;
+    std::unordered_map<w_string, std::chrono::steady_clock::time_point>
+        subtrees;
+  };
+  folly::Synchronized<SubtreeUse> subtreeUse_;
 };
 
 } // namespace watchman
@@ -8,10 +8,13 @@
 #pragma once
 #include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
+#include <algorithm>
 #include <chrono>
 #include <deque>
 #include <memory>
 #include <unordered_map>
+#include <vector>
+#include "watchman/MemoryProfile.h"
 #include "watchman/WatchmanConfig.h"
 
 namespace watchman {
@@ -68,7 +71,8 @@ class TailQHead;
  * the underlying value is immutable.
  */
 template <typename KeyType, typename ValueType>
-class Node {
+class Node
+    : public MemoryProfiled<Node<KeyType, ValueType>, MemoryTag::Caches> {
   friend class TailQHead<Node<KeyType, ValueType>>;
   friend class LRUCache<KeyType, ValueType>;
 
@@ -180,6 +184,9 @@ class TailQHead {
   Node* head() {
     return first_;
   }
+  const Node* head() const {
+    return first_;
+  }
 };
 
 struct Stats {
@@ -210,6 +217,18 @@ struct Stats {
     cacheErase = 0;
     ++clearCount;
   }
+
+  Stats& operator+=(const Stats& other) {
+    cacheHit += other.cacheHit;
+    cacheShare += other.cacheShare;
+    cacheMiss += other.cacheMiss;
+    cacheEvict += other.cacheEvict;
+    cacheStore += other.cacheStore;
+    cacheLoad += other.cacheLoad;
+    cacheErase += other.cacheErase;
+    clearCount += other.clearCount;
+    return *this;
+  }
 };
 
 // Factoring out the internal state struct here, as MSVC
@@ -558,6 +577,17 @@ class LRUCache {
     return state->map.size();
   }
 
+  // Calls func(key, value) for each successfully populated item, from the
+  // least to the most recently used.  The cache is locked for the duration,
+  // so func must not call back into the cache.
+  template <typename Func>
+  void forEachValue(Func&& func) const {
+    auto state = state_.rlock();
+    for (auto* node = state->evictionOrder.head(); node; node = node->next_) {
+      func(node->key_, node->value_.value());
+    }
+  }
+
   // Returns cache statistics
   CacheStats stats() const {
     auto state = state_.rlock();
@@ -660,4 +690,114 @@ class LRUCache {
   const std::chrono::milliseconds fetchTimeout_;
   folly::Synchronized<State> state_;
 };
+
+// A cache made of independent LRUCache shards selected by the hash of the
+// key, so that concurrent lookups of different keys rarely contend on the
+// same lock.  Recency and capacity are tracked per shard: each holds up to
+// maxItems / numShards entries, and an item may be evicted from a full shard
+// while others still have room.  The interface mirrors that of LRUCache.
+template <typename KeyType, typename ValueType>
+class ShardedLRUCache {
+  using Shard = LRUCache<KeyType, ValueType>;
+
+ public:
+  using NodeType = typename Shard::NodeType;
+
+  static constexpr size_t kDefaultNumShards = 16;
+
+  ShardedLRUCache(
+      size_t maxItems,
+      std::chrono::milliseconds errorTTL,
+      size_t numShards = kDefaultNumShards,
+      std::chrono::milliseconds fetchTimeout = std::chrono::seconds(300)) {
+    // Small caches don't benefit from sharding and would otherwise end up
+    // with almost no capacity per shard.
+    numShards = std::max<size_t>(1, std::min(numShards, maxItems / 64));
+    auto perShard = (maxItems + numShards - 1) / numShards;
+    shards_.reserve(numShards);
+    for (size_t i = 0; i < numShards; ++i) {
+      shards_.push_back(
+          std::make_unique<Shard>(perShard, errorTTL, fetchTimeout));
+    }
+  }
+
+  ShardedLRUCache(const ShardedLRUCache&) = delete;
+  ShardedLRUCache& operator=(const ShardedLRUCache&) = delete;
+
+  std::shared_ptr<const NodeType> get(
+      const KeyType& key,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).get(key, now);
+  }
+
+  template <typename Func>
+  folly::Future<std::shared_ptr<const NodeType>> get(
+      const KeyType& key,
+      Func&& getter,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).get(key, std::forward<Func>(getter), now);
+  }
+
+  std::shared_ptr<const NodeType> set(
+      const KeyType& key,
+      ValueType&& value,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now()) {
+    return shardFor(key).set(key, std::move(value), now);
+  }
+
+  std::shared_ptr<const NodeType> erase(const KeyType& key) {
+    return shardFor(key).erase(key);
+  }
+
+  size_t size() const {
+    size_t size = 0;
+    for (auto& shard : shards_) {
+      size += shard->size();
+    }
+    return size;
+  }
+
+  size_t numShards() const {
+    return shards_.size();
+  }
+
+  // As LRUCache::forEachValue, but visits one shard at a time, so the order
+  // is least to most recently used within each shard.
+  template <typename Func>
+  void forEachValue(Func&& func) const {
+    for (auto& shard : shards_) {
+      shard->forEachValue(func);
+    }
+  }
+
+  // Returns the sum of the statistics of the shards
+  CacheStats stats() const {
+    lrucache::Stats total;
+    size_t size = 0;
+    for (auto& shard : shards_) {
+      auto stats = shard->stats();
+      total += stats;
+      size += stats.size;
+    }
+    // clear() clears every shard, so each has counted it
+    total.clearCount /= shards_.size();
+    return CacheStats(total, size);
+  }
+
+  void clear() {
+    for (auto& shard : shards_) {
+      shard->clear();
+    }
+  }
+
+ private:
+  Shard& shardFor(const KeyType& key) const {
+    return *shards_[std::hash<KeyType>()(key) % shards_.size()];
+  }
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
 } // namespace watchman
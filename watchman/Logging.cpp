@@ -9,13 +9,18 @@
 
 #include <folly/ScopeGuard.h>
 #include <folly/ThreadLocal.h>
+#include <folly/experimental/LockFreeRingBuffer.h>
 #include <folly/experimental/symbolizer/Symbolizer.h>
 #include <folly/system/ThreadName.h>
 
 #include <array>
+#include <chrono>
 #include <limits>
 #include <optional>
 #include <sstream>
+#include <thread>
+
+#include "watchman/ThreadStats.h"
 
 #ifdef __APPLE__
 #include <pthread.h>
@@ -138,6 +143,7 @@ const char* Log::setThreadName(std::string&& name) {
     folly::setThreadName(name);
   }
 
+  ThreadStats::registerCurrentThread(name);
   threadName->emplace(name);
   return threadName->value().c_str();
 }
@@ -183,6 +189,130 @@ void Log::setStdErrLoggingLevel(LogLevel level) {
   }
 }
 
+namespace {
+// A line that is queued for the stderr writer thread.  The ring needs a
+// trivially copyable type, so the text is held inline.
+struct LogRecord {
+  static constexpr size_t kMaxLength = 1024 - sizeof(uint32_t);
+
+  uint32_t length{0};
+  char text[kMaxLength];
+};
+
+// Write at most this much to stderr per syscall
+constexpr size_t kMaxStdErrBatch = 64 * 1024;
+} // namespace
+
+struct Log::AsyncStdErr {
+  explicit AsyncStdErr(uint32_t capacity)
+      : ring{capacity}, next{ring.currentHead()} {}
+
+  void run() {
+    std::string batch;
+    LogRecord record;
+    while (true) {
+      if (!ring.waitAndTryRead(record, next)) {
+        // It was overwritten before we got to it.  Skip ahead of the
+        // writers by enough that the next few records are likely intact.
+        auto tail = ring.currentTail(0.25);
+        uint64_t skipped = 0;
+        do {
+          next.moveForward();
+          ++skipped;
+        } while (next < tail);
+        dropped += skipped;
+        auto notice = folly::to<std::string>(
+            "stderr logging fell behind; dropped ", skipped, " lines\n");
+        ignore_result(::write(STDERR_FILENO, notice.data(), notice.size()));
+        handled += skipped;
+        continue;
+      }
+
+      // Gather whatever else is ready into the same write
+      uint64_t lines = 0;
+      do {
+        batch.append(record.text, record.length);
+        next.moveForward();
+        ++lines;
+      } while (batch.size() < kMaxStdErrBatch && ring.tryRead(record, next));
+
+      ignore_result(::write(STDERR_FILENO, batch.data(), batch.size()));
+      batch.clear();
+      written += lines;
+      handled += lines;
+    }
+  }
+
+  void enqueue(const w_string& line) {
+    LogRecord record;
+    record.length = uint32_t(line.size());
+    memcpy(record.text, line.data(), line.size());
+    ring.write(record);
+    ++queued;
+  }
+
+  void flush() {
+    auto target = queued.load();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (handled.load() < target &&
+           std::chrono::steady_clock::now() < deadline) {
+      /* sleep override */ std::this_thread::sleep_for(
+          std::chrono::milliseconds(1));
+    }
+  }
+
+  folly::LockFreeRingBuffer<LogRecord> ring;
+  // Only used by the writer thread
+  folly::LockFreeRingBuffer<LogRecord>::Cursor next;
+  std::atomic<uint64_t> queued{0};
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> dropped{0};
+  // written + dropped, so that flush() can tell when it has caught up
+  std::atomic<uint64_t> handled{0};
+};
+
+void Log::startAsyncStdErr(uint32_t capacity) {
+  if (async_.load()) {
+    return;
+  }
+  auto async = new AsyncStdErr(std::max(capacity, uint32_t(16)));
+  std::thread([async] {
+    w_set_thread_name("stderr-log");
+    async->run();
+  }).detach();
+  async_.store(async);
+}
+
+void Log::flushStdErr() {
+  if (auto async = async_.load()) {
+    async->flush();
+  }
+}
+
+Log::AsyncStats Log::getAsyncStats() const {
+  AsyncStats stats;
+  if (auto async = async_.load()) {
+    stats.enabled = true;
+    stats.queued = async->queued.load();
+    stats.written = async->written.load();
+    stats.dropped = async->dropped.load();
+  }
+  return stats;
+}
+
+void Log::writeStdErr(const w_string& line) {
+  auto async = async_.load();
+  if (async && line.size() <= LogRecord::kMaxLength) {
+    async->enqueue(line);
+    return;
+  }
+  if (async) {
+    // Too long for a record; keep it in order with what is queued
+    async->flush();
+  }
+  ignore_result(::write(STDERR_FILENO, line.data(), line.size()));
+}
+
 void Log::doLogToStdErr() {
   std::vector<std::shared_ptr<const watchman::Publisher::Item>> items;
 
@@ -197,8 +327,7 @@ void Log::doLogToStdErr() {
   static w_string kAbort("abort");
 
   for (auto& item : items) {
-    auto& log = json_to_w_string(item->payload.get("log"));
-    ignore_result(::write(STDERR_FILENO, log.data(), log.size()));
+    writeStdErr(json_to_w_string(item->payload.get("log")));
 
     auto level = json_to_w_string(item->payload.get("level"));
     if (level == kFatal) {
@@ -209,6 +338,8 @@ void Log::doLogToStdErr() {
   }
 
   if (doFatal || doAbort) {
+    // Make sure that the reason, and what led up to it, make it out
+    flushStdErr();
     log_stack_trace();
     if (doAbort) {
       abort();
@@ -6,6 +6,7 @@
  */
 
 #pragma once
+#include <atomic>
 #include "folly/Synchronized.h"
 #include "watchman/PubSub.h"
 #include "watchman/watchman_preprocessor.h"
@@ -33,6 +34,28 @@ class Log {
 
   void setStdErrLoggingLevel(LogLevel level);
 
+  // Moves the writes to stderr onto a dedicated thread, so that a thread
+  // that logs isn't held up by them.  Lines are queued in a lock-free ring
+  // of `capacity` fixed size records; if the writer falls more than that
+  // far behind, the oldest lines are dropped and counted.  Lines too long
+  // to fit in a record, and fatal errors, are still written synchronously,
+  // after waiting for the queue to drain.  Can only be called once, and
+  // should be called before other threads start logging.
+  void startAsyncStdErr(uint32_t capacity);
+
+  // Waits, for a bounded time, for the lines queued so far to be written
+  void flushStdErr();
+
+  struct AsyncStats {
+    bool enabled{false};
+    // Lines handed to the writer thread
+    uint64_t queued{0};
+    uint64_t written{0};
+    // Lines overwritten before the writer thread got to them
+    uint64_t dropped{0};
+  };
+  AsyncStats getAsyncStats() const;
+
   // Build a string and log it
   template <typename... Args>
   void log(LogLevel level, Args&&... args) {
@@ -105,11 +128,17 @@ class Log {
   //    writing to stderr.
   folly::Synchronized<Subscribers, std::mutex> subscribers_;
 
+  struct AsyncStdErr;
+  // Set once by startAsyncStdErr and never freed, since other threads may
+  // be logging right up until the process exits
+  std::atomic<AsyncStdErr*> async_{nullptr};
+
   inline Publisher& levelToPub(LogLevel level) {
     return level == DBG ? *debugPub_ : *errorPub_;
   }
 
   void doLogToStdErr();
+  void writeStdErr(const w_string& line);
 };
 
 // Get the logger singleton
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MappedSegment.h"
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <folly/portability/Fcntl.h>
+#include <folly/portability/Unistd.h>
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+std::unique_ptr<MappedSegment> MappedSegment::create(
+    const w_string& path,
+    std::string data) {
+  std::unique_ptr<MappedSegment> segment(new MappedSegment);
+  if (path.empty() || data.empty()) {
+    segment->buffer_ = std::move(data);
+    return segment;
+  }
+
+  if (!folly::writeFile(
+          data, path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) {
+    logf(
+        ERR,
+        "keeping a segment in memory as it can't be written to {}: {}\n",
+        path,
+        folly::errnoStr(errno));
+    unlink(path.c_str());
+    segment->buffer_ = std::move(data);
+    return segment;
+  }
+  try {
+    segment->mapping_.emplace(path.c_str());
+  } catch (const std::exception& exc) {
+    logf(
+        ERR,
+        "keeping a segment in memory as {} can't be mapped: {}\n",
+        path,
+        exc.what());
+    unlink(path.c_str());
+    segment->buffer_ = std::move(data);
+    return segment;
+  }
+  // The mapping keeps the contents alive without the name, except on
+  // systems that won't remove a file that is open
+  if (unlink(path.c_str()) != 0) {
+    segment->path_ = path;
+  }
+  return segment;
+}
+
+MappedSegment::~MappedSegment() {
+  mapping_.reset();
+  if (!path_.empty()) {
+    unlink(path_.c_str());
+  }
+}
+
+std::string_view MappedSegment::data() const {
+  if (mapping_) {
+    auto range = mapping_->range();
+    return std::string_view(
+        reinterpret_cast<const char*>(range.data()), range.size());
+  }
+  return buffer_;
+}
+
+} // namespace watchman
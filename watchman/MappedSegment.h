@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/system/MemoryMapping.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A read-only run of bytes that is kept in a file and mapped into memory,
+ * so that the kernel can drop its pages when memory is short and read them
+ * back when they are next touched, rather than them taking up the anonymous
+ * memory of the process.
+ *
+ * The file is removed as soon as it is mapped where the system allows it,
+ * and otherwise when the segment is destroyed.  If there is no path for the
+ * file, or it can't be written, the bytes are kept in an ordinary buffer.
+ */
+class MappedSegment {
+ public:
+  /**
+   * Writes data to a new file at path and maps it.  path may be null, in
+   * which case data is kept as it is.
+   */
+  static std::unique_ptr<MappedSegment> create(
+      const w_string& path,
+      std::string data);
+
+  ~MappedSegment();
+
+  MappedSegment(const MappedSegment&) = delete;
+  MappedSegment& operator=(const MappedSegment&) = delete;
+
+  std::string_view data() const;
+
+  size_t size() const {
+    return data().size();
+  }
+
+  // Whether the bytes are in a mapped file rather than in a buffer
+  bool isMapped() const {
+    return mapping_.has_value();
+  }
+
+ private:
+  MappedSegment() = default;
+
+  std::optional<folly::MemoryMapping> mapping_;
+  std::string buffer_;
+  // Set while the file is yet to be removed
+  w_string path_;
+};
+
+} // namespace watchman
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MemoryProfile.h"
+#include <folly/CPortability.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+namespace {
+
+using TagStats = MemoryProfile::TagStats;
+
+// The frames of recordSample() and MemoryProfile::allocated()
+constexpr size_t kSkipFrames = 2;
+
+std::atomic<size_t> sampleInterval{MemoryProfile::kDefaultSampleInterval};
+
+// The counts of one thread.  Only the thread itself stores to them, so
+// they need no read-modify-write; the atomics just let a report read
+// them while the thread runs.
+struct Counters {
+  struct Tag {
+    std::atomic<int64_t> allocatedBytes{0};
+    std::atomic<int64_t> allocatedObjects{0};
+    std::atomic<int64_t> freedBytes{0};
+    std::atomic<int64_t> freedObjects{0};
+
+    void addTo(TagStats& stats) const {
+      auto bytes = allocatedBytes.load(std::memory_order_relaxed);
+      auto objects = allocatedObjects.load(std::memory_order_relaxed);
+      stats.liveBytes += bytes - freedBytes.load(std::memory_order_relaxed);
+      stats.liveObjects +=
+          objects - freedObjects.load(std::memory_order_relaxed);
+      stats.totalBytes += uint64_t(bytes);
+      stats.totalObjects += uint64_t(objects);
+    }
+  };
+  std::array<Tag, kNumMemoryTags> tags;
+
+  // The interval that the thread last saw, the bytes left to allocate
+  // until the next sample, and the state of the generator that spaces the
+  // samples out
+  size_t interval{0};
+  int64_t untilSample{0};
+  uint64_t random{0};
+
+  static void bump(std::atomic<int64_t>& counter, int64_t delta) {
+    counter.store(
+        counter.load(std::memory_order_relaxed) + delta,
+        std::memory_order_relaxed);
+  }
+
+  void addTo(std::array<TagStats, kNumMemoryTags>& stats) const {
+    for (size_t i = 0; i < kNumMemoryTags; ++i) {
+      tags[i].addTo(stats[i]);
+    }
+  }
+
+  // Returns the distance to the sample after this one: uniformly spread
+  // around interval, so that a loop making allocations of a fixed size
+  // doesn't always sample the same one of them
+  int64_t nextSampleDistance(size_t interval) {
+    // xorshift64
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    return int64_t(interval / 2 + random % (interval + 1));
+  }
+};
+
+struct Sample {
+  MemoryTag tag;
+  std::chrono::steady_clock::time_point time;
+  // The bytes that the sample stands for
+  uint64_t weight;
+  size_t numFrames;
+  std::array<void*, MemoryProfile::kMaxFrames> frames;
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::unordered_set<const Counters*> live;
+  // The counts of the threads that have exited
+  std::array<TagStats, kNumMemoryTags> exited;
+  // Counts made by threads after their counters were released
+  Counters::Tag lateCounts[kNumMemoryTags];
+
+  std::mutex samplesMutex;
+  std::vector<Sample> samples;
+  size_t nextSample{0};
+};
+
+// Leaked, as memory is still freed after static destructors have run
+Registry& getRegistry() {
+  static auto* registry = new Registry;
+  return *registry;
+}
+
+// Both are trivially destructible, so remain usable while the thread exits
+thread_local Counters* threadCounters = nullptr;
+thread_local bool threadExited = false;
+
+// Folds the counts of the thread into the exited totals when it exits
+struct Registration {
+  std::unique_ptr<Counters> counters;
+
+  ~Registration() {
+    threadExited = true;
+    threadCounters = nullptr;
+    if (!counters) {
+      return;
+    }
+    auto& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.live.erase(counters.get());
+    counters->addTo(registry.exited);
+  }
+};
+
+thread_local Registration registration;
+
+Counters* getCounters() {
+  if (threadCounters) {
+    return threadCounters;
+  }
+  if (threadExited) {
+    return nullptr;
+  }
+  auto counters = std::make_unique<Counters>();
+  // Any non-zero seed will do, as long as threads differ
+  counters->random = reinterpret_cast<uintptr_t>(counters.get()) | 1;
+  auto& registry = getRegistry();
+  {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.live.insert(counters.get());
+  }
+  threadCounters = counters.get();
+  registration.counters = std::move(counters);
+  return threadCounters;
+}
+
+FOLLY_NOINLINE void recordSample(MemoryTag tag, uint64_t weight) {
+  Sample sample;
+  sample.tag = tag;
+  sample.time = std::chrono::steady_clock::now();
+  sample.weight = weight;
+  sample.numFrames = 0;
+#ifdef HAVE_BACKTRACE
+  std::array<void*, MemoryProfile::kMaxFrames + kSkipFrames> frames;
+  auto numFrames = size_t(backtrace(frames.data(), int(frames.size())));
+  if (numFrames > kSkipFrames) {
+    sample.numFrames = numFrames - kSkipFrames;
+    std::copy_n(
+        frames.begin() + kSkipFrames, sample.numFrames, sample.frames.begin());
+  }
+#endif
+
+  auto& registry = getRegistry();
+  std::lock_guard<std::mutex> lock(registry.samplesMutex);
+  if (registry.samples.size() < MemoryProfile::kMaxSamples) {
+    registry.samples.push_back(sample);
+  } else {
+    registry.samples[registry.nextSample] = sample;
+  }
+  registry.nextSample = (registry.nextSample + 1) % MemoryProfile::kMaxSamples;
+}
+
+std::vector<std::string> symbolize(const void* const* frames, size_t n) {
+  std::vector<std::string> result;
+  result.reserve(n);
+#ifdef HAVE_BACKTRACE_SYMBOLS
+  auto strings = backtrace_symbols(const_cast<void**>(frames), int(n));
+  if (strings) {
+    for (size_t i = 0; i < n; ++i) {
+      result.emplace_back(strings[i]);
+    }
+    free(strings);
+    return result;
+  }
+#endif
+  for (size_t i = 0; i < n; ++i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%p", frames[i]);
+    result.emplace_back(buf);
+  }
+  return result;
+}
+
+} // namespace
+
+const char* memoryTagName(MemoryTag tag) {
+  switch (tag) {
+    case MemoryTag::ViewNodes:
+      return "view_nodes";
+    case MemoryTag::Pending:
+      return "pending";
+    case MemoryTag::PubSub:
+      return "pubsub";
+    case MemoryTag::QueryTemporaries:
+      return "query_temporaries";
+    case MemoryTag::Caches:
+      return "caches";
+    case MemoryTag::Json:
+      return "json";
+  }
+  return "unknown";
+}
+
+void MemoryProfile::allocated(MemoryTag tag, size_t size) {
+  auto* counters = getCounters();
+  if (!counters) {
+    auto& late = getRegistry().lateCounts[size_t(tag)];
+    late.allocatedBytes.fetch_add(int64_t(size), std::memory_order_relaxed);
+    late.allocatedObjects.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  auto& counts = counters->tags[size_t(tag)];
+  Counters::bump(counts.allocatedBytes, int64_t(size));
+  Counters::bump(counts.allocatedObjects, 1);
+
+  auto interval = sampleInterval.load(std::memory_order_relaxed);
+  if (interval == 0) {
+    return;
+  }
+  if (interval != counters->interval) {
+    // Started, or the interval changed since the last sample
+    counters->interval = interval;
+    counters->untilSample = counters->nextSampleDistance(interval);
+  }
+  counters->untilSample -= int64_t(size);
+  if (counters->untilSample <= 0) {
+    counters->untilSample = counters->nextSampleDistance(interval);
+    recordSample(tag, std::max(uint64_t(size), uint64_t(interval)));
+  }
+}
+
+void MemoryProfile::freed(MemoryTag tag, size_t size) {
+  auto* counters = getCounters();
+  if (!counters) {
+    auto& late = getRegistry().lateCounts[size_t(tag)];
+    late.freedBytes.fetch_add(int64_t(size), std::memory_order_relaxed);
+    late.freedObjects.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  auto& counts = counters->tags[size_t(tag)];
+  Counters::bump(counts.freedBytes, int64_t(size));
+  Counters::bump(counts.freedObjects, 1);
+}
+
+void MemoryProfile::setSampleInterval(size_t bytes) {
+  sampleInterval.store(bytes, std::memory_order_relaxed);
+}
+
+size_t MemoryProfile::getSampleInterval() {
+  return sampleInterval.load(std::memory_order_relaxed);
+}
+
+std::array<MemoryProfile::TagStats, kNumMemoryTags>
+MemoryProfile::getTagStats() {
+  auto& registry = getRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  auto stats = registry.exited;
+  for (auto* counters : registry.live) {
+    counters->addTo(stats);
+  }
+  for (size_t i = 0; i < kNumMemoryTags; ++i) {
+    registry.lateCounts[i].addTo(stats[i]);
+  }
+  return stats;
+}
+
+MemoryProfile::Report MemoryProfile::getReport(size_t topN) {
+  Report report;
+  report.tags = getTagStats();
+  report.sampleInterval = getSampleInterval();
+
+  std::vector<Sample> samples;
+  {
+    auto& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.samplesMutex);
+    samples = registry.samples;
+  }
+  report.samples = samples.size();
+  if (samples.empty()) {
+    return report;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  auto oldest = now;
+  std::map<std::pair<MemoryTag, std::vector<void*>>, Site> sites;
+  for (auto& sample : samples) {
+    oldest = std::min(oldest, sample.time);
+    std::vector<void*> frames(
+        sample.frames.begin(), sample.frames.begin() + sample.numFrames);
+    auto& site = sites[std::make_pair(sample.tag, std::move(frames))];
+    site.tag = sample.tag;
+    site.bytes += sample.weight;
+    ++site.samples;
+  }
+  report.window = now - oldest;
+
+  std::vector<std::pair<const std::vector<void*>*, Site*>> heaviest;
+  heaviest.reserve(sites.size());
+  for (auto& it : sites) {
+    heaviest.emplace_back(&it.first.second, &it.second);
+  }
+  auto n = std::min(topN, heaviest.size());
+  std::partial_sort(
+      heaviest.begin(),
+      heaviest.begin() + n,
+      heaviest.end(),
+      [](const auto& a, const auto& b) {
+        return a.second->bytes > b.second->bytes;
+      });
+
+  report.sites.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    auto& frames = *heaviest[i].first;
+    auto site = std::move(*heaviest[i].second);
+    site.frames = symbolize(frames.data(), frames.size());
+    report.sites.push_back(std::move(site));
+  }
+  return report;
+}
+
+void MemoryProfile::clearSamples() {
+  auto& registry = getRegistry();
+  std::lock_guard<std::mutex> lock(registry.samplesMutex);
+  registry.samples.clear();
+  registry.nextSample = 0;
+}
+
+} // namespace watchman
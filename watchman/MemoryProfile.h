@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace watchman {
+
+// The subsystems whose memory is accounted for by MemoryProfile
+enum class MemoryTag : uint8_t {
+  // watchman_file and watchman_dir nodes of the in-memory views
+  ViewNodes,
+  // Entries of pending collections
+  Pending,
+  // Items published through a Publisher
+  PubSub,
+  // FileResults and other blocks allocated from the arena of a query
+  QueryTemporaries,
+  // Nodes of the LRU caches
+  Caches,
+  // json values
+  Json,
+};
+
+constexpr size_t kNumMemoryTags = 6;
+
+// Returns the name that reports use for tag, such as "view_nodes"
+const char* memoryTagName(MemoryTag tag);
+
+/**
+ * Accounts for the memory that the main subsystems of the daemon allocate,
+ * so that growth can be attributed to, say, pending changes piling up
+ * rather than to the view, without having to run under jemalloc.
+ *
+ * Every allocation made on behalf of a tagged subsystem is counted exactly:
+ * the counters are per thread and are only summed when a report is made,
+ * so counting costs a few unshared stores.  The size counted is that of the
+ * object itself; what it owns, such as the buffer of a vector that it
+ * holds, is only counted if that is tagged too.
+ *
+ * In addition, about one allocation in every sample interval bytes has its
+ * stack captured.  The most recent kMaxSamples samples are retained, and
+ * getReport() groups them by tag and stack to show which sites have been
+ * allocating the most lately.  Each sample stands for the interval bytes
+ * allocated around it, so the bytes of a site are an estimate of what it
+ * allocated over the window that the samples cover, not of what it holds.
+ */
+class MemoryProfile {
+ public:
+  static constexpr size_t kMaxFrames = 16;
+  static constexpr size_t kMaxSamples = 4096;
+  static constexpr size_t kDefaultSampleInterval = 1024 * 1024;
+
+  struct TagStats {
+    // Allocated and not yet freed
+    int64_t liveBytes{0};
+    int64_t liveObjects{0};
+    // Allocated since the process started
+    uint64_t totalBytes{0};
+    uint64_t totalObjects{0};
+  };
+
+  struct Site {
+    MemoryTag tag;
+    // Estimated bytes allocated from the site over the window
+    uint64_t bytes{0};
+    size_t samples{0};
+    // Innermost first
+    std::vector<std::string> frames;
+  };
+
+  struct Report {
+    std::array<TagStats, kNumMemoryTags> tags;
+    // The heaviest sites, heaviest first
+    std::vector<Site> sites;
+    // The samples retained, and how long ago the oldest of them was taken
+    size_t samples{0};
+    std::chrono::steady_clock::duration window{0};
+    size_t sampleInterval{0};
+  };
+
+  // Counts an allocation of size bytes against tag
+  static void allocated(MemoryTag tag, size_t size);
+
+  // Counts the release of an allocation of size bytes against tag.  It
+  // need not be made on the thread that made the allocation.
+  static void freed(MemoryTag tag, size_t size);
+
+  // Sets how many bytes are allocated, on average, between samples.
+  // Zero turns sampling off; counting is always on.
+  static void setSampleInterval(size_t bytes);
+  static size_t getSampleInterval();
+
+  static std::array<TagStats, kNumMemoryTags> getTagStats();
+
+  // Returns the counts of every tag and the topN heaviest sites among the
+  // samples retained.  Symbolizing the sites makes this much slower than
+  // getTagStats().
+  static Report getReport(size_t topN);
+
+  // Discards the samples retained so far
+  static void clearSamples();
+};
+
+/**
+ * Counts each instance of Derived against Tag for as long as it exists.
+ * Derive from this rather than calling MemoryProfile from the constructors
+ * and destructor, so that copies are counted too.
+ */
+template <typename Derived, MemoryTag Tag>
+class MemoryProfiled {
+ public:
+  MemoryProfiled() noexcept {
+    MemoryProfile::allocated(Tag, sizeof(Derived));
+  }
+  MemoryProfiled(const MemoryProfiled&) noexcept : MemoryProfiled() {}
+  MemoryProfiled& operator=(const MemoryProfiled&) noexcept {
+    return *this;
+  }
+  ~MemoryProfiled() {
+    MemoryProfile::freed(Tag, sizeof(Derived));
+  }
+};
+
+} // namespace watchman
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Metrics.h"
+#include <fmt/core.h>
+#include <folly/Synchronized.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+
+namespace watchman {
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration elapsed) {
+  auto us = uint64_t(std::max<int64_t>(
+      0,
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+  auto bucket = std::lower_bound(
+                    kBucketBoundsUs.begin(), kBucketBoundsUs.end(), us) -
+      kBucketBoundsUs.begin();
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  sumUs_.fetch_add(us, std::memory_order_relaxed);
+}
+
+LatencyHistogram::Snapshot LatencyHistogram::snapshot() const {
+  Snapshot snap;
+  for (size_t i = 0; i < kNumBuckets; ++i) {
+    snap.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+    snap.count += snap.buckets[i];
+  }
+  snap.sumUs = sumUs_.load(std::memory_order_relaxed);
+  return snap;
+}
+
+namespace {
+// Histograms are never removed, so references handed out remain valid.
+folly::Synchronized<
+    std::map<std::string, std::unique_ptr<LatencyHistogram>, std::less<>>>&
+commandLatencies() {
+  static auto* latencies = new folly::Synchronized<
+      std::map<std::string, std::unique_ptr<LatencyHistogram>, std::less<>>>;
+  return *latencies;
+}
+
+std::string escapeLabelValue(std::string_view value) {
+  std::string result;
+  result.reserve(value.size());
+  for (auto c : value) {
+    switch (c) {
+      case '\\':
+        result.append("\\\\");
+        break;
+      case '"':
+        result.append("\\\"");
+        break;
+      case '\n':
+        result.append("\\n");
+        break;
+      default:
+        result.push_back(c);
+    }
+  }
+  return result;
+}
+} // namespace
+
+LatencyHistogram& commandLatency(std::string_view name) {
+  auto& latencies = commandLatencies();
+  {
+    auto rlock = latencies.rlock();
+    auto it = rlock->find(name);
+    if (it != rlock->end()) {
+      return *it->second;
+    }
+  }
+  auto wlock = latencies.wlock();
+  auto& histogram = (*wlock)[std::string(name)];
+  if (!histogram) {
+    histogram = std::make_unique<LatencyHistogram>();
+  }
+  return *histogram;
+}
+
+void forEachCommandLatency(
+    const std::function<void(const std::string&, const LatencyHistogram&)>&
+        func) {
+  auto rlock = commandLatencies().rlock();
+  for (auto& it : *rlock) {
+    func(it.first, *it.second);
+  }
+}
+
+void OpenMetricsWriter::family(
+    std::string_view name,
+    std::string_view type,
+    std::string_view help) {
+  out_.append(
+      fmt::format("# TYPE {} {}\n# HELP {} {}\n", name, type, name, help));
+}
+
+void OpenMetricsWriter::sample(
+    std::string_view name,
+    std::string_view suffix,
+    const Labels& labels,
+    std::string_view extraLabel,
+    std::string_view extraValue,
+    const std::string& value) {
+  out_.append(name.data(), name.size());
+  out_.append(suffix.data(), suffix.size());
+  if (!labels.empty() || !extraLabel.empty()) {
+    out_.push_back('{');
+    bool first = true;
+    auto append = [&](std::string_view label, std::string_view labelValue) {
+      if (!first) {
+        out_.push_back(',');
+      }
+      first = false;
+      out_.append(
+          fmt::format("{}=\"{}\"", label, escapeLabelValue(labelValue)));
+    };
+    for (auto& [label, labelValue] : labels) {
+      append(label, labelValue);
+    }
+    if (!extraLabel.empty()) {
+      append(extraLabel, extraValue);
+    }
+    out_.push_back('}');
+  }
+  out_.push_back(' ');
+  out_.append(value);
+  out_.push_back('\n');
+}
+
+void OpenMetricsWriter::gauge(
+    std::string_view name,
+    const Labels& labels,
+    double value) {
+  sample(name, "", labels, "", "", fmt::format("{}", value));
+}
+
+void OpenMetricsWriter::counter(
+    std::string_view name,
+    const Labels& labels,
+    uint64_t value) {
+  sample(name, "_total", labels, "", "", fmt::format("{}", value));
+}
+
+void OpenMetricsWriter::histogram(
+    std::string_view name,
+    const Labels& labels,
+    const LatencyHistogram::Snapshot& snap) {
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < LatencyHistogram::kNumBuckets; ++i) {
+    cumulative += snap.buckets[i];
+    auto le = i < LatencyHistogram::kBucketBoundsUs.size()
+        ? fmt::format("{}", LatencyHistogram::kBucketBoundsUs[i] / 1e6)
+        : std::string("+Inf");
+    sample(name, "_bucket", labels, "le", le, fmt::format("{}", cumulative));
+  }
+  sample(name, "_count", labels, "", "", fmt::format("{}", snap.count));
+  sample(name, "_sum", labels, "", "", fmt::format("{}", snap.sumUs / 1e6));
+}
+
+std::string OpenMetricsWriter::finish() {
+  out_.append("# EOF\n");
+  return std::move(out_);
+}
+
+} // namespace watchman
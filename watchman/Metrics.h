@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * A histogram of durations with fixed bucket bounds.  Recording is a couple
+ * of relaxed atomic increments, so it is cheap enough to do on every command
+ * dispatch or cookie sync.
+ */
+class LatencyHistogram {
+ public:
+  // Upper bounds of the buckets, in microseconds.  There is an implicit
+  // +Inf bucket after the last of these.
+  static constexpr std::array<uint64_t, 14> kBucketBoundsUs = {
+      100,
+      500,
+      1000,
+      2500,
+      5000,
+      10000,
+      25000,
+      50000,
+      100000,
+      250000,
+      500000,
+      1000000,
+      5000000,
+      30000000,
+  };
+  static constexpr size_t kNumBuckets = kBucketBoundsUs.size() + 1;
+
+  struct Snapshot {
+    // Per-bucket (not cumulative) counts; the last is the +Inf bucket.
+    std::array<uint64_t, kNumBuckets> buckets{};
+    uint64_t count{0};
+    uint64_t sumUs{0};
+  };
+
+  void record(std::chrono::steady_clock::duration elapsed);
+  Snapshot snapshot() const;
+
+ private:
+  std::array<std::atomic<uint64_t>, kNumBuckets> buckets_{};
+  std::atomic<uint64_t> sumUs_{0};
+};
+
+/**
+ * Returns the latency histogram for the named command.  The histogram lives
+ * for the remainder of the process.
+ */
+LatencyHistogram& commandLatency(std::string_view name);
+
+/**
+ * Calls func(name, histogram) for each command that has been dispatched at
+ * least once, in name order.
+ */
+void forEachCommandLatency(
+    const std::function<void(const std::string&, const LatencyHistogram&)>&
+        func);
+
+/**
+ * Builds a document in the OpenMetrics text exposition format.
+ *
+ * Each metric family must be declared with family() before its samples are
+ * written, and all samples of a family must be written together.
+ */
+class OpenMetricsWriter {
+ public:
+  using Labels = std::vector<std::pair<std::string_view, std::string_view>>;
+
+  // type is one of "gauge", "counter" or "histogram"
+  void family(
+      std::string_view name,
+      std::string_view type,
+      std::string_view help);
+
+  void gauge(std::string_view name, const Labels& labels, double value);
+  // Writes name_total, as OpenMetrics requires for counter samples.
+  void counter(std::string_view name, const Labels& labels, uint64_t value);
+  // Writes the name_bucket, name_count and name_sum samples, in seconds.
+  void histogram(
+      std::string_view name,
+      const Labels& labels,
+      const LatencyHistogram::Snapshot& snap);
+
+  // Terminates the document and returns it.
+  std::string finish();
+
+ private:
+  void sample(
+      std::string_view name,
+      std::string_view suffix,
+      const Labels& labels,
+      std::string_view extraLabel,
+      std::string_view extraValue,
+      const std::string& value);
+
+  std::string out_;
+};
+
+} // namespace watchman
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NameInterner.h"
+
+namespace watchman {
+
+w_string NameInterner::intern(w_string_piece name) {
+  auto it = names_.find(name);
+  if (it != names_.end()) {
+    return it->second;
+  }
+  w_string value(name.data(), name.size(), W_STRING_BYTE);
+  w_string_piece key(value);
+  return names_.emplace(key, std::move(value)).first->second;
+}
+
+size_t NameInterner::prune() {
+  size_t pruned = 0;
+  for (auto it = names_.begin(); it != names_.end();) {
+    w_string_t* str = it->second;
+    if (str->refcnt.load(std::memory_order_relaxed) == 1) {
+      it = names_.erase(it);
+      ++pruned;
+    } else {
+      ++it;
+    }
+  }
+  return pruned;
+}
+
+size_t NameInterner::stringBytes() const {
+  size_t bytes = 0;
+  for (auto& it : names_) {
+    bytes += sizeof(w_string_t) + it.second.size() + 1;
+  }
+  return bytes;
+}
+
+} // namespace watchman
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <unordered_map>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A table of shared strings for the path components held by the in-memory
+ * view.  The same directory names (src, node_modules, __tests__, ...) recur
+ * throughout large trees; interning them means that each distinct name is
+ * allocated once and every dir node holding it shares the reference.
+ *
+ * Not thread safe; the view accesses it under its own lock.
+ */
+class NameInterner {
+ public:
+  /**
+   * Returns a string equal to name, sharing its storage with the previously
+   * interned copy if there is one.
+   */
+  w_string intern(w_string_piece name);
+
+  /**
+   * Drops the names that are no longer referenced outside of the table.
+   * Returns the number of names dropped.
+   */
+  size_t prune();
+
+  size_t size() const {
+    return names_.size();
+  }
+
+  void reserve(size_t count) {
+    names_.reserve(count);
+  }
+
+  // The bytes held by the interned strings
+  size_t stringBytes() const;
+
+ private:
+  // Keyed by a piece of the value, which the table keeps alive
+  std::unordered_map<w_string_piece, w_string> names_;
+};
+
+} // namespace watchman
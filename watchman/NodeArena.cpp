@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NodeArena.h"
+#include <folly/Memory.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace watchman {
+
+namespace {
+constexpr size_t kSlabHeaderSize = 64;
+// Nodes beyond this many share arenas
+constexpr size_t kMaxNumaNodes = 64;
+
+#ifdef MADV_HUGEPAGE
+constexpr bool kHaveHugePages = true;
+#else
+constexpr bool kHaveHugePages = false;
+#endif
+
+bool hugePageArenas = false;
+thread_local NodeArena* threadArena = nullptr;
+std::array<std::atomic<NodeArena*>, kMaxNumaNodes> numaArenas;
+
+NodeArena& sharedArena() {
+  // Intentionally leaked: nodes may be freed by static destructors that run
+  // during process teardown.
+  static auto* arena = new NodeArena(hugePageArenas);
+  return *arena;
+}
+} // namespace
+
+void configureNodeArenas(bool hugePages) {
+  hugePageArenas = hugePages;
+}
+
+NodeArena& getNodeArena() {
+  return threadArena ? *threadArena : sharedArena();
+}
+
+NodeArena& getNumaNodeArena(int node) {
+  if (node < 0) {
+    return sharedArena();
+  }
+  static std::mutex mutex;
+  auto& slot = numaArenas[size_t(node) % kMaxNumaNodes];
+  auto* arena = slot.load(std::memory_order_acquire);
+  if (!arena) {
+    std::lock_guard<std::mutex> lock(mutex);
+    arena = slot.load(std::memory_order_acquire);
+    if (!arena) {
+      // Leaked, as above
+      arena = new NodeArena(hugePageArenas);
+      slot.store(arena, std::memory_order_release);
+    }
+  }
+  return *arena;
+}
+
+NodeArena* setThreadNodeArena(NodeArena* arena) {
+  auto previous = threadArena;
+  threadArena = arena;
+  return previous;
+}
+
+NodeArena::Stats getNodeArenaStats() {
+  auto total = sharedArena().stats();
+  for (auto& slot : numaArenas) {
+    if (auto* arena = slot.load(std::memory_order_acquire)) {
+      auto stats = arena->stats();
+      total.numSlabs += stats.numSlabs;
+      total.liveBlocks += stats.liveBlocks;
+      total.liveBytes += stats.liveBytes;
+    }
+  }
+  return total;
+}
+
+NodeArena::NodeArena(bool hugePages, MemoryTag tag)
+    : hugePages_(kHaveHugePages && hugePages), tag_(tag) {}
+
+char* NodeArena::Slab::blocks() {
+  return reinterpret_cast<char*>(this) + kSlabHeaderSize;
+}
+
+NodeArena::~NodeArena() {
+  // Only slabs with available blocks are reachable from here; an arena
+  // should not be destroyed while any of its blocks are still live.
+  for (auto& head : available_) {
+    while (head) {
+      auto* slab = head;
+      head = slab->next;
+      if (!slab->inChunk) {
+        folly::aligned_free(slab);
+      }
+    }
+  }
+#ifdef MADV_HUGEPAGE
+  for (auto* chunk : chunks_) {
+    munmap(chunk, kChunkSize);
+  }
+#endif
+}
+
+NodeArena::Slab* NodeArena::slabOf(void* ptr) {
+  return reinterpret_cast<Slab*>(
+      reinterpret_cast<uintptr_t>(ptr) & ~uintptr_t(kSlabSize - 1));
+}
+
+NodeArena::Slab* NodeArena::newSlab(size_t sizeClass) {
+  static_assert(sizeof(Slab) <= kSlabHeaderSize);
+  void* mem = hugePages_ ? chunkSlab()
+                         : folly::aligned_malloc(kSlabSize, kSlabSize);
+  if (!mem) {
+    throw std::bad_alloc();
+  }
+  auto* slab = static_cast<Slab*>(mem);
+  slab->next = nullptr;
+  slab->prev = nullptr;
+  slab->freeList = nullptr;
+  slab->owner = this;
+  slab->inChunk = hugePages_;
+  slab->sizeClass = uint32_t(sizeClass);
+  slab->live = 0;
+  slab->carved = 0;
+  slab->capacity =
+      uint32_t((kSlabSize - kSlabHeaderSize) / blockSizeFor(sizeClass));
+  ++numSlabs_;
+  return slab;
+}
+
+void* NodeArena::chunkSlab() {
+#ifdef MADV_HUGEPAGE
+  if (spareSlabs_.empty()) {
+    // Map twice the size so that an aligned chunk fits, and unmap the rest
+    auto size = 2 * kChunkSize;
+    void* mem = mmap(
+        nullptr,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+    if (mem == MAP_FAILED) {
+      return nullptr;
+    }
+    auto start = reinterpret_cast<uintptr_t>(mem);
+    auto chunk = (start + kChunkSize - 1) & ~uintptr_t(kChunkSize - 1);
+    if (chunk > start) {
+      munmap(mem, chunk - start);
+    }
+    auto tail = start + size - (chunk + kChunkSize);
+    if (tail > 0) {
+      munmap(reinterpret_cast<void*>(chunk + kChunkSize), tail);
+    }
+    // Only a hint; without THP the chunk is just regular memory
+    madvise(reinterpret_cast<void*>(chunk), kChunkSize, MADV_HUGEPAGE);
+    chunks_.push_back(reinterpret_cast<void*>(chunk));
+
+    // Hand the slabs out in address order
+    for (auto offset = kChunkSize; offset > 0; offset -= kSlabSize) {
+      spareSlabs_.push_back(
+          reinterpret_cast<void*>(chunk + offset - kSlabSize));
+    }
+  }
+  auto* slab = spareSlabs_.back();
+  spareSlabs_.pop_back();
+  return slab;
+#else
+  return nullptr;
+#endif
+}
+
+void NodeArena::releaseSlab(Slab* slab) {
+#ifdef MADV_HUGEPAGE
+  if (slab->inChunk) {
+    madvise(slab, kSlabSize, MADV_DONTNEED);
+    spareSlabs_.push_back(slab);
+    return;
+  }
+#endif
+  folly::aligned_free(slab);
+}
+
+void NodeArena::linkAvailable(Slab* slab) {
+  auto& head = available_[slab->sizeClass];
+  slab->prev = nullptr;
+  slab->next = head;
+  if (head) {
+    head->prev = slab;
+  }
+  head = slab;
+}
+
+void NodeArena::unlinkAvailable(Slab* slab) {
+  if (slab->prev) {
+    slab->prev->next = slab->next;
+  } else {
+    available_[slab->sizeClass] = slab->next;
+  }
+  if (slab->next) {
+    slab->next->prev = slab->prev;
+  }
+  slab->next = nullptr;
+  slab->prev = nullptr;
+}
+
+void* NodeArena::allocate(size_t size) {
+  if (size > kMaxBlockSize || size == 0) {
+    void* mem = malloc(size ? size : 1);
+    if (!mem) {
+      throw std::bad_alloc();
+    }
+    MemoryProfile::allocated(tag_, size);
+    return mem;
+  }
+
+  auto sizeClass = sizeClassFor(size);
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  auto* slab = available_[sizeClass];
+  if (!slab) {
+    slab = newSlab(sizeClass);
+    linkAvailable(slab);
+  }
+
+  void* block;
+  if (slab->freeList) {
+    block = slab->freeList;
+    slab->freeList = slab->freeList->next;
+  } else {
+    block = slab->blocks() + size_t(slab->carved) * blockSizeFor(sizeClass);
+    ++slab->carved;
+  }
+
+  if (++slab->live == slab->capacity) {
+    unlinkAvailable(slab);
+  }
+  ++liveBlocks_;
+  liveBytes_ += blockSizeFor(sizeClass);
+  // Counted outside of the lock, as it may capture a stack
+  lock.unlock();
+  MemoryProfile::allocated(tag_, blockSizeFor(sizeClass));
+  return block;
+}
+
+void NodeArena::deallocate(void* ptr, size_t size) noexcept {
+  if (!ptr) {
+    return;
+  }
+  if (size > kMaxBlockSize || size == 0) {
+    free(ptr);
+    MemoryProfile::freed(tag_, size);
+    return;
+  }
+
+  auto* slab = slabOf(ptr);
+  if (slab->owner != this) {
+    slab->owner->deallocate(ptr, size);
+    return;
+  }
+  MemoryProfile::freed(tag_, blockSizeFor(slab->sizeClass));
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto* block = static_cast<FreeBlock*>(ptr);
+  block->next = slab->freeList;
+  slab->freeList = block;
+
+  if (slab->live-- == slab->capacity) {
+    // It was full, so it wasn't on the available list
+    linkAvailable(slab);
+  }
+  --liveBlocks_;
+  liveBytes_ -= blockSizeFor(slab->sizeClass);
+}
+
+size_t NodeArena::trim() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t released = 0;
+  for (auto head : available_) {
+    auto* slab = head;
+    while (slab) {
+      auto* next = slab->next;
+      if (slab->live == 0) {
+        unlinkAvailable(slab);
+        releaseSlab(slab);
+        --numSlabs_;
+        released += kSlabSize;
+      }
+      slab = next;
+    }
+  }
+  return released;
+}
+
+NodeArena::Stats NodeArena::stats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Stats stats;
+  stats.numSlabs = numSlabs_;
+  stats.liveBlocks = liveBlocks_;
+  stats.liveBytes = liveBytes_;
+  return stats;
+}
+
+} // namespace watchman
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "watchman/MemoryProfile.h"
+
+namespace watchman {
+
+/**
+ * A size-classed slab allocator for the small, long-lived nodes that make up
+ * the in-memory view (watchman_file and watchman_dir).
+ *
+ * Allocations are rounded up to kGranularity and carved out of kSlabSize
+ * slabs that each serve a single size class.  Compared to the general
+ * purpose allocator this avoids the per-allocation header and keeps nodes
+ * that are created together (eg: the contents of a directory during a crawl)
+ * adjacent in memory.
+ *
+ * Freed blocks are recycled within their slab.  Slabs that become entirely
+ * free are retained until trim() is called, which returns them to the
+ * system; the view does this after aging out deleted nodes.
+ *
+ * Requests larger than kMaxBlockSize are passed through to malloc.
+ * Callers must pass the same size to deallocate() that they passed to
+ * allocate().  A block may be deallocated through any arena; it is returned
+ * to the arena that its slab belongs to.
+ *
+ * An arena constructed with hugePages carves its slabs out of kChunkSize
+ * chunks that are advised to be backed by transparent huge pages, which
+ * cuts the TLB misses of walking a large view.  Trimming such a slab
+ * discards its memory but keeps its address range for reuse, since
+ * unmapping it would split the chunk.
+ *
+ * The blocks of an arena are counted against its tag in the MemoryProfile:
+ * the nodes of the views by default, and the temporaries of a query for the
+ * arenas of a QueryContext.
+ */
+class NodeArena {
+ public:
+  static constexpr size_t kSlabSize = 64 * 1024;
+  static constexpr size_t kGranularity = 16;
+  static constexpr size_t kMaxBlockSize = 512;
+  static constexpr size_t kChunkSize = 2 * 1024 * 1024;
+
+  struct Stats {
+    // Number of slabs currently held by the arena
+    size_t numSlabs{0};
+    // Number of blocks handed out and not yet deallocated
+    size_t liveBlocks{0};
+    // Number of bytes occupied by those blocks, including rounding
+    size_t liveBytes{0};
+  };
+
+  explicit NodeArena(
+      bool hugePages = false,
+      MemoryTag tag = MemoryTag::ViewNodes);
+  ~NodeArena();
+  NodeArena(const NodeArena&) = delete;
+  NodeArena& operator=(const NodeArena&) = delete;
+
+  /**
+   * Allocate size bytes.  The memory is not initialized.
+   * Throws std::bad_alloc on failure.
+   */
+  void* allocate(size_t size);
+
+  /**
+   * Release memory obtained from allocate(size).
+   */
+  void deallocate(void* ptr, size_t size) noexcept;
+
+  /**
+   * Release any entirely empty slabs back to the system.
+   * Returns the number of bytes released.
+   */
+  size_t trim();
+
+  Stats stats() const;
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  struct Slab {
+    // Linkage in the list of slabs that have available blocks
+    Slab* next;
+    Slab* prev;
+    FreeBlock* freeList;
+    NodeArena* owner;
+    uint32_t sizeClass;
+    uint32_t live;
+    uint32_t carved;
+    uint32_t capacity;
+    // Set if the slab is part of one of chunks_
+    bool inChunk;
+
+    char* blocks();
+  };
+
+  static constexpr size_t kNumClasses = kMaxBlockSize / kGranularity;
+
+  static size_t sizeClassFor(size_t size) {
+    return (size + kGranularity - 1) / kGranularity - 1;
+  }
+  static size_t blockSizeFor(size_t sizeClass) {
+    return (sizeClass + 1) * kGranularity;
+  }
+  static Slab* slabOf(void* ptr);
+
+  Slab* newSlab(size_t sizeClass);
+  void* chunkSlab();
+  void releaseSlab(Slab* slab);
+  void linkAvailable(Slab* slab);
+  void unlinkAvailable(Slab* slab);
+
+  const bool hugePages_;
+  const MemoryTag tag_;
+  mutable std::mutex mutex_;
+  // Per size class list of slabs that have at least one free block
+  std::array<Slab*, kNumClasses> available_{};
+  size_t numSlabs_{0};
+  size_t liveBlocks_{0};
+  size_t liveBytes_{0};
+  // Huge page chunks, and the slabs of them that aren't in use
+  std::vector<void*> chunks_;
+  std::vector<void*> spareSlabs_;
+};
+
+/**
+ * Sets whether the arenas returned below use huge pages.  Must be called
+ * before the first of them is used.
+ */
+void configureNodeArenas(bool hugePages);
+
+/**
+ * Returns the arena used for the nodes of in-memory views that the calling
+ * thread allocates: the one set by setThreadNodeArena, or else the arena
+ * shared by all other threads.
+ */
+NodeArena& getNodeArena();
+
+/**
+ * Returns the arena for the threads bound to the given NUMA node.
+ */
+NodeArena& getNumaNodeArena(int node);
+
+/**
+ * Makes arena the one that getNodeArena returns on this thread, or
+ * restores the shared arena if arena is nullptr.  Returns the previous
+ * setting.
+ */
+NodeArena* setThreadNodeArena(NodeArena* arena);
+
+/**
+ * Returns the sum of the stats of all the arenas above.
+ */
+NodeArena::Stats getNodeArenaStats();
+
+} // namespace watchman
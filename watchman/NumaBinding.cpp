@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NumaBinding.h"
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <string>
+#include <vector>
+#include "watchman/Logging.h"
+#include "watchman/NodeArena.h"
+
+namespace watchman {
+
+#ifdef __linux__
+namespace {
+
+// Parses a cpulist such as "0-7,16-23" from sysfs
+bool readNodeCpus(int node, cpu_set_t& cpus) {
+  std::string list;
+  if (!folly::readFile(
+          folly::to<std::string>(
+              "/sys/devices/system/node/node", node, "/cpulist")
+              .c_str(),
+          list)) {
+    return false;
+  }
+
+  CPU_ZERO(&cpus);
+  bool any = false;
+  std::vector<folly::StringPiece> ranges;
+  folly::split(',', folly::trimWhitespace(list), ranges);
+  for (auto range : ranges) {
+    if (range.empty()) {
+      continue;
+    }
+    auto dash = range.find('-');
+    auto first = folly::tryTo<int>(range.subpiece(0, dash));
+    auto last = dash == folly::StringPiece::npos
+        ? first
+        : folly::tryTo<int>(range.subpiece(dash + 1));
+    if (!first || !last) {
+      return false;
+    }
+    for (int cpu = *first; cpu <= *last && cpu < CPU_SETSIZE; ++cpu) {
+      CPU_SET(cpu, &cpus);
+      any = true;
+    }
+  }
+  return any;
+}
+
+} // namespace
+#endif
+
+NumaBinding::NumaBinding(int node) {
+#ifdef __linux__
+  if (node < 0) {
+    return;
+  }
+  cpu_set_t cpus;
+  if (!readNodeCpus(node, cpus)) {
+    log(DBG, "no CPUs found for NUMA node ", node, "\n");
+    return;
+  }
+  if (sched_getaffinity(0, sizeof(previousCpus_), &previousCpus_) != 0 ||
+      sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+    log(ERR,
+        "failed to bind to NUMA node ",
+        node,
+        ": ",
+        folly::errnoStr(errno),
+        "\n");
+    return;
+  }
+  bound_ = true;
+  previousArena_ = setThreadNodeArena(&getNumaNodeArena(node));
+#else
+  (void)node;
+#endif
+}
+
+NumaBinding::~NumaBinding() {
+#ifdef __linux__
+  if (bound_) {
+    setThreadNodeArena(previousArena_);
+    sched_setaffinity(0, sizeof(previousCpus_), &previousCpus_);
+  }
+#endif
+}
+
+} // namespace watchman
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace watchman {
+
+class NodeArena;
+
+/**
+ * Binds the calling thread to the CPUs of a NUMA node for the lifetime of
+ * this object.  The view nodes that the thread allocates meanwhile come
+ * from the arena of that node, whose slabs are first touched by threads
+ * bound to the node, so the kernel places their memory there.
+ *
+ * A negative node, or a node that the system doesn't have, leaves the
+ * thread as it is.  Only Linux supports binding.
+ */
+class NumaBinding {
+ public:
+  explicit NumaBinding(int node);
+  ~NumaBinding();
+  NumaBinding(const NumaBinding&) = delete;
+  NumaBinding& operator=(const NumaBinding&) = delete;
+
+  bool bound() const {
+    return bound_;
+  }
+
+ private:
+  bool bound_{false};
+  NodeArena* previousArena_{nullptr};
+#ifdef __linux__
+  cpu_set_t previousCpus_;
+#endif
+};
+
+} // namespace watchman
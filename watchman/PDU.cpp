@@ -7,16 +7,129 @@
 
 #include "watchman/PDU.h"
 #include <folly/Range.h>
+#include <folly/ScopeGuard.h>
 #include <folly/String.h>
+#include <folly/compression/Compression.h>
+#include <folly/io/IOBuf.h>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Constants.h"
 #include "watchman/Logging.h"
+#include "watchman/Tracing.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/bser.h"
 #include "watchman/watchman_stream.h"
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
 using namespace watchman;
 
 W_CAP_REG("bser-v2")
+W_CAP_REG("bser-v2-zstd")
+W_CAP_REG("bser-v2-prefix-strings")
+#ifdef __linux__
+W_CAP_REG("bser-v2-fd")
+#endif
+
+namespace {
+
+bool haveZstd() {
+  static const bool have = folly::io::hasCodec(folly::io::CodecType::ZSTD);
+  return have;
+}
+
+// Replaces the zstd compressed body [start, end) of a pdu with its
+// uncompressed contents
+bool uncompressBody(
+    const char* start,
+    const char* end,
+    std::string& uncompressed,
+    json_error_t* jerr) {
+  json_int_t needed;
+  json_int_t len;
+  if (!bunser_int(start, end - start, &needed, &len) || len < 0) {
+    snprintf(
+        jerr->text, sizeof(jerr->text), "failed to read uncompressed size");
+    return false;
+  }
+  if (!haveZstd()) {
+    snprintf(
+        jerr->text,
+        sizeof(jerr->text),
+        "received a zstd compressed PDU, but zstd is not available");
+    return false;
+  }
+  try {
+    uncompressed = folly::io::getCodec(folly::io::CodecType::ZSTD)
+                       ->uncompress(
+                           folly::StringPiece(start + needed, end),
+                           folly::Optional<uint64_t>(uint64_t(len)));
+  } catch (const std::exception& exc) {
+    snprintf(
+        jerr->text,
+        sizeof(jerr->text),
+        "failed to uncompress PDU: %s",
+        exc.what());
+    return false;
+  }
+  return true;
+}
+
+int appendToString(const char* buffer, size_t size, void* ptr) {
+  static_cast<std::string*>(ptr)->append(buffer, size);
+  return 0;
+}
+
+// Returns size as an encoded integer
+std::string encodeSize(json_int_t size) {
+  std::string encoded;
+  bser_ctx_t ctx{2, 0, appendToString};
+  w_bser_dump(&ctx, json_integer(size), &encoded);
+  return encoded;
+}
+
+// A batch of pdus is written out once it holds this many bytes
+constexpr size_t kMaxBatchBytes = 1024 * 1024;
+
+// Writes all of iov to stm, which may take several calls
+bool writeIovecs(w_stm_t stm, std::vector<struct iovec>& iov) {
+  // Write at most this many buffers per syscall
+  constexpr size_t kMaxIovecs = 16;
+
+  size_t next = 0;
+  while (next < iov.size()) {
+    if (iov[next].iov_len == 0) {
+      ++next;
+      continue;
+    }
+    int x =
+        stm->writev(&iov[next], int(std::min(iov.size() - next, kMaxIovecs)));
+    if (x <= 0) {
+      return false;
+    }
+    // Skip past whatever was written, which may end part way through
+    // a buffer
+    size_t wrote = x;
+    while (wrote > 0) {
+      auto n = std::min(wrote, iov[next].iov_len);
+      iov[next].iov_base = static_cast<char*>(iov[next].iov_base) + n;
+      iov[next].iov_len -= n;
+      wrote -= n;
+      if (iov[next].iov_len == 0) {
+        ++next;
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace
 watchman_json_buffer::watchman_json_buffer()
     : buf((char*)malloc(WATCHMAN_IO_BUF_SIZE)),
       allocd(WATCHMAN_IO_BUF_SIZE),
@@ -258,7 +371,32 @@ json_ref watchman_json_buffer::readBserPdu(
     wpos += r;
   }
 
-  obj = bunser(buf + rpos, buf + wpos, &needed, jerr);
+  if (bser_capabilities & BSER_CAP_FD_BODY) {
+    // Only the server sends these, and only to clients that ask for them
+    snprintf(
+        jerr->text,
+        sizeof(jerr->text),
+        "received a PDU whose body is in a memory file, which is not "
+        "supported here");
+    rpos = wpos;
+    stm->setNonBlock(true);
+    return nullptr;
+  }
+
+  const char* start = buf + rpos;
+  const char* end = buf + wpos;
+  std::string uncompressed;
+  if (bser_capabilities & BSER_CAP_ZSTD_BODY) {
+    if (!uncompressBody(start, start + val, uncompressed, jerr)) {
+      rpos = wpos;
+      stm->setNonBlock(true);
+      return nullptr;
+    }
+    start = uncompressed.data();
+    end = start + uncompressed.size();
+  }
+
+  obj = bunser(start, end, &needed, jerr);
   if (!obj) {
     // obj is a nullptr because deserialization failed. Log the message that
     // failed to deserialize to stderr
@@ -267,7 +405,8 @@ json_ref watchman_json_buffer::readBserPdu(
         "decoding BSER failed. The first KB of the hex representation of "
         "message follows:\n{:.1024}\n",
         folly::hexlify(folly::ByteRange{
-            reinterpret_cast<const unsigned char*>(buf + rpos), wpos - rpos}));
+            reinterpret_cast<const unsigned char*>(start),
+            size_t(end - start)}));
   }
 
   // Ensure that we move the read position to the wpos; we consumed it all
@@ -495,7 +634,9 @@ bool watchman_json_buffer::passThru(
     return false;
   }
 
-  if (pdu_type == output_pdu) {
+  if (pdu_type == output_pdu && !(capabilities & BSER_CAP_FD_BODY) &&
+      (!(capabilities & BSER_CAP_ZSTD_BODY) ||
+       (output_capabilities & BSER_CAP_ACCEPT_ZSTD))) {
     // We can stream it through
     if (!streamPdu(stm, &jerr)) {
       logf(ERR, "stream_pdu: {}\n", jerr.text);
@@ -582,22 +723,207 @@ struct jbuffer_write_data {
   }
 };
 
+// Accumulates an encoded pdu body in a chain of fixed size chunks, the first
+// of which is the buffer's own, so that the body is encoded in a single pass
+// and only then prefixed by its length header.  Large bodies grow by adding
+// chunks rather than by reallocating and copying.
+struct jbuffer_chunk_data {
+  w_jbuffer_t* jr;
+  std::vector<std::unique_ptr<char[]>> extra;
+  // Bytes used in the most recent chunk
+  uint32_t used{0};
+  json_int_t size{0};
+
+  char* current() {
+    return extra.empty() ? jr->buf : extra.back().get();
+  }
+
+  uint32_t capacity() const {
+    return extra.empty() ? jr->allocd : kIoBufSize;
+  }
+
+  static int append(const char* buffer, size_t size, void* ptr) {
+    return static_cast<jbuffer_chunk_data*>(ptr)->append(buffer, size);
+  }
+
+  int append(const char* buffer, size_t size) {
+    while (size) {
+      if (used == capacity()) {
+        extra.emplace_back(new char[kIoBufSize]);
+        used = 0;
+      }
+      auto room = std::min<size_t>(capacity() - used, size);
+      memcpy(current() + used, buffer, room);
+      buffer += room;
+      size -= room;
+      used += room;
+      this->size += room;
+    }
+    return 0;
+  }
+
+  bool flush(w_stm_t stm, const std::string& header) {
+    std::vector<struct iovec> iov;
+    iov.reserve(extra.size() + 2);
+    iov.push_back({const_cast<char*>(header.data()), header.size()});
+    iov.push_back({jr->buf, extra.empty() ? used : jr->allocd});
+    for (size_t i = 0; i < extra.size(); ++i) {
+      iov.push_back(
+          {extra[i].get(), i + 1 == extra.size() ? used : kIoBufSize});
+    }
+    return writeIovecs(stm, iov);
+  }
+
+  // Returns the body in the form described by BSER_CAP_ZSTD_BODY, or
+  // nullptr if it could not be compressed
+  std::unique_ptr<folly::IOBuf> compress() {
+    if (!haveZstd()) {
+      return nullptr;
+    }
+    auto chain =
+        folly::IOBuf::wrapBuffer(jr->buf, extra.empty() ? used : jr->allocd);
+    for (size_t i = 0; i < extra.size(); ++i) {
+      chain->prependChain(folly::IOBuf::wrapBuffer(
+          extra[i].get(), i + 1 == extra.size() ? used : kIoBufSize));
+    }
+
+    try {
+      auto body = folly::IOBuf::copyBuffer(encodeSize(size));
+      body->prependChain(
+          folly::io::getCodec(folly::io::CodecType::ZSTD)->compress(
+              chain.get()));
+      return body;
+    } catch (const std::exception& exc) {
+      logf(ERR, "failed to compress PDU, sending it as is: {}\n", exc.what());
+      return nullptr;
+    }
+  }
+
+  // Returns a sealed memory file holding the pdu in the form described by
+  // BSER_CAP_FD_BODY, or nullptr if one could not be made
+  std::unique_ptr<watchman_stream> toMemoryFile(const std::string& header) {
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+    FileDescriptor fd(
+        memfd_create("watchman-pdu", MFD_CLOEXEC | MFD_ALLOW_SEALING),
+        FileDescriptor::FDType::Generic);
+    if (!fd) {
+      logf(
+          ERR,
+          "memfd_create failed, sending PDU as is: {}\n",
+          folly::errnoStr(errno));
+      return nullptr;
+    }
+    auto file = w_stm_fdopen(std::move(fd));
+    // Sealing it means that the client can trust its size and contents
+    // without copying them
+    if (!flush(file.get(), header) ||
+        fcntl(
+            file->getFileDescriptor().fd(),
+            F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+      logf(
+          ERR,
+          "failed to fill memory file, sending PDU as is: {}\n",
+          folly::errnoStr(errno));
+      return nullptr;
+    }
+    return file;
+#else
+    (void)header;
+    return nullptr;
+#endif
+  }
+
+  static bool flushCompressed(
+      w_stm_t stm,
+      const std::string& header,
+      const folly::IOBuf& body) {
+    std::vector<struct iovec> iov;
+    iov.push_back({const_cast<char*>(header.data()), header.size()});
+    for (auto range : body) {
+      iov.push_back(
+          {const_cast<unsigned char*>(range.data()), range.size()});
+    }
+    return writeIovecs(stm, iov);
+  }
+};
+
 bool watchman_json_buffer::bserEncodeToStream(
     uint32_t bser_version,
     uint32_t bser_capabilities,
     const json_ref& json,
     w_stm_t stm) {
-  struct jbuffer_write_data data = {stm, this};
-  int res;
+  return bserEncodePdu(
+      bser_version, bser_capabilities, json, nullptr, nullptr, stm);
+}
 
-  res = w_bser_write_pdu(
-      bser_version, bser_capabilities, jbuffer_write_data::write, json, &data);
+bool watchman_json_buffer::bserEncodeToStream(
+    uint32_t bser_version,
+    uint32_t bser_capabilities,
+    const json_ref& json,
+    const char* key,
+    const bser_field_dump_t& dumpField,
+    w_stm_t stm) {
+  return bserEncodePdu(
+      bser_version, bser_capabilities, json, key, &dumpField, stm);
+}
 
-  if (res != 0) {
+bool watchman_json_buffer::bserEncodePdu(
+    uint32_t bser_version,
+    uint32_t bser_capabilities,
+    const json_ref& json,
+    const char* key,
+    const bser_field_dump_t* dumpField,
+    w_stm_t stm) {
+  // Whatever was left over from an earlier failed write is not wanted
+  clear();
+  SCOPE_EXIT {
+    clear();
+  };
+
+  // Only set in the header of a pdu that actually has such a body, even if
+  // they were set by the peer whose capabilities we are echoing
+  bser_capabilities &= ~(BSER_CAP_ZSTD_BODY | BSER_CAP_FD_BODY);
+
+  jbuffer_chunk_data data{this};
+  bser_ctx_t ctx{bser_version, bser_capabilities, jbuffer_chunk_data::append};
+  if (w_bser_dump_pdu_body(&ctx, json, key, dumpField, &data) != 0) {
     return false;
   }
+  WATCHMAN_TRACE(bser_pdu_encoded, data.size);
+
+  if (bser_version == 2 && (bser_capabilities & BSER_CAP_ACCEPT_FD) &&
+      stm->canPassDescriptors() &&
+      data.size >= cfg_get_int("bser_shared_memory_min_size", 1048576)) {
+    auto header =
+        w_bser_pdu_header(bser_version, bser_capabilities, data.size);
+    if (auto file = data.toMemoryFile(header)) {
+      auto body = encodeSize(json_int_t(header.size()) + data.size);
+      auto pdu = w_bser_pdu_header(
+                     bser_version,
+                     bser_capabilities | BSER_CAP_FD_BODY,
+                     body.size()) +
+          body;
+      return stm->writeWithDescriptor(
+          pdu.data(), int(pdu.size()), file->getFileDescriptor());
+    }
+  }
 
-  return data.flush();
+  if (bser_version == 2 && (bser_capabilities & BSER_CAP_ACCEPT_ZSTD) &&
+      data.size >= cfg_get_int("bser_compression_min_size", 65536)) {
+    if (auto body = data.compress()) {
+      return jbuffer_chunk_data::flushCompressed(
+          stm,
+          w_bser_pdu_header(
+              bser_version,
+              bser_capabilities | BSER_CAP_ZSTD_BODY,
+              body->computeChainDataLength()),
+          *body);
+    }
+  }
+
+  return data.flush(
+      stm, w_bser_pdu_header(bser_version, bser_capabilities, data.size));
 }
 
 bool watchman_json_buffer::jsonEncodeToStream(
@@ -625,19 +951,115 @@ bool watchman_json_buffer::pduEncodeToStream(
     uint32_t capabilities,
     const json_ref& json,
     w_stm_t stm) {
+  bool ok = false;
+  WATCHMAN_TRACE(pdu_encode_begin, int(pdu_type));
   switch (pdu_type) {
     case is_json_compact:
-      return jsonEncodeToStream(json, stm, JSON_COMPACT);
+      ok = jsonEncodeToStream(json, stm, JSON_COMPACT);
+      break;
     case is_json_pretty:
-      return jsonEncodeToStream(json, stm, JSON_INDENT(4));
+      ok = jsonEncodeToStream(json, stm, JSON_INDENT(4));
+      break;
     case is_bser:
-      return bserEncodeToStream(1, capabilities, json, stm);
+      ok = bserEncodeToStream(1, capabilities, json, stm);
+      break;
     case is_bser_v2:
-      return bserEncodeToStream(2, capabilities, json, stm);
+      ok = bserEncodeToStream(2, capabilities, json, stm);
+      break;
     case need_data:
     default:
+      break;
+  }
+  WATCHMAN_TRACE(pdu_encode_end, int(pdu_type), int(ok));
+  return ok;
+}
+
+bool watchman_json_buffer::pduEncodeBatchToStream(
+    enum w_pdu_type pdu_type,
+    uint32_t capabilities,
+    const std::vector<json_ref>& jsons,
+    w_stm_t stm) {
+  bool isBser = pdu_type == is_bser || pdu_type == is_bser_v2;
+  if (jsons.size() == 1 ||
+      (!isBser && pdu_type != is_json_compact &&
+       pdu_type != is_json_pretty)) {
+    for (auto& json : jsons) {
+      if (!pduEncodeToStream(pdu_type, capabilities, json, stm)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint32_t bserVersion = pdu_type == is_bser_v2 ? 2 : 1;
+  auto bserCapabilities =
+      capabilities & ~(BSER_CAP_ZSTD_BODY | BSER_CAP_FD_BODY);
+  // Bodies of at least this size take one of the special forms that only
+  // bserEncodePdu produces
+  auto maxBatchedBody = std::numeric_limits<json_int_t>::max();
+  if (bserVersion == 2 && (capabilities & BSER_CAP_ACCEPT_ZSTD)) {
+    maxBatchedBody = std::min(
+        maxBatchedBody, cfg_get_int("bser_compression_min_size", 65536));
+  }
+  if (bserVersion == 2 && (capabilities & BSER_CAP_ACCEPT_FD) &&
+      stm->canPassDescriptors()) {
+    maxBatchedBody = std::min(
+        maxBatchedBody,
+        cfg_get_int("bser_shared_memory_min_size", 1048576));
+  }
+
+  std::string batch;
+  std::string body;
+  auto flush = [&] {
+    if (batch.empty()) {
+      return true;
+    }
+    std::vector<struct iovec> iov{{batch.data(), batch.size()}};
+    auto ok = writeIovecs(stm, iov);
+    batch.clear();
+    return ok;
+  };
+
+  for (auto& json : jsons) {
+    WATCHMAN_TRACE(pdu_encode_begin, int(pdu_type));
+    bool ok;
+    if (isBser) {
+      body.clear();
+      bser_ctx_t ctx{bserVersion, bserCapabilities, appendToString};
+      ok = w_bser_dump_pdu_body(&ctx, json, nullptr, nullptr, &body) == 0;
+      if (ok && json_int_t(body.size()) >= maxBatchedBody) {
+        // Encoded a second time, but it is rare and costly to send anyway
+        ok = flush() && pduEncodeToStream(pdu_type, capabilities, json, stm);
+        WATCHMAN_TRACE(pdu_encode_end, int(pdu_type), int(ok));
+        if (!ok) {
+          return false;
+        }
+        continue;
+      }
+      if (ok) {
+        WATCHMAN_TRACE(bser_pdu_encoded, json_int_t(body.size()));
+        batch += w_bser_pdu_header(
+            bserVersion, bserCapabilities, json_int_t(body.size()));
+        batch += body;
+      }
+    } else {
+      ok = json_dump_callback(
+               json,
+               appendToString,
+               &batch,
+               pdu_type == is_json_compact ? JSON_COMPACT
+                                           : JSON_INDENT(4)) == 0;
+      batch += "\n";
+    }
+    if (ok && batch.size() >= kMaxBatchBytes) {
+      ok = flush();
+    }
+    WATCHMAN_TRACE(pdu_encode_end, int(pdu_type), int(ok));
+    if (!ok) {
       return false;
+    }
   }
+  return flush();
 }
 
 /* vim:ts=2:sw=2:et:
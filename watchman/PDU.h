@@ -8,6 +8,8 @@
 #pragma once
 
 #include <stdint.h>
+#include <vector>
+#include "watchman/bser.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 
 class watchman_stream;
@@ -40,6 +42,14 @@ struct watchman_json_buffer {
       uint32_t bser_capabilities,
       const json_ref& json,
       watchman_stream* stm);
+  // As above, but the pdu also holds key with a value emitted by dumpField.
+  bool bserEncodeToStream(
+      uint32_t bser_version,
+      uint32_t bser_capabilities,
+      const json_ref& json,
+      const char* key,
+      const bser_field_dump_t& dumpField,
+      watchman_stream* stm);
 
   bool pduEncodeToStream(
       w_pdu_type pdu_type,
@@ -47,6 +57,18 @@ struct watchman_json_buffer {
       const json_ref& json,
       watchman_stream* stm);
 
+  // Encodes each of jsons as a pdu, as pduEncodeToStream does, but writes
+  // them together so that a client that is owed many of them, such as one
+  // with a subscription per project, doesn't take a syscall and a wakeup
+  // for each.  Pdus big enough to be sent compressed or through a memory
+  // file are still written on their own, in order.  Returns false if any
+  // of them could not be encoded or written.
+  bool pduEncodeBatchToStream(
+      w_pdu_type pdu_type,
+      uint32_t capabilities,
+      const std::vector<json_ref>& jsons,
+      watchman_stream* stm);
+
   json_ref decodeNext(watchman_stream* stm, json_error_t* jerr);
 
   bool passThru(
@@ -56,6 +78,13 @@ struct watchman_json_buffer {
       watchman_stream* stm);
 
  private:
+  bool bserEncodePdu(
+      uint32_t bser_version,
+      uint32_t bser_capabilities,
+      const json_ref& json,
+      const char* key,
+      const bser_field_dump_t* dumpField,
+      watchman_stream* stm);
   bool readAndDetectPdu(watchman_stream* stm, json_error_t* jerr);
   inline uint32_t shuntDown();
   bool fillBuffer(watchman_stream* stm);
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PathFilter.h"
+#include <cstring>
+#include "watchman/watchman_hash.h"
+
+namespace watchman {
+
+namespace {
+
+// With 16 bits per entry and 4 probes, about 1 in 400 lookups of a path
+// that isn't present is a false positive.
+constexpr size_t kBitsPerEntry = 16;
+constexpr uint32_t kNumProbes = 4;
+constexpr uint32_t kMinLog2Bits = 12;
+
+// The splitmix64 finalizer; spreads the bits of x over the whole word
+uint64_t mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+} // namespace
+
+PathFilter::Hash PathFilter::hashChild(Hash parent, w_string_piece name) {
+  auto nameHash = w_hash_bytes(name.data(), name.size(), uint32_t(parent));
+  return mix(
+      (parent ^ ((uint64_t(nameHash) << 32) | name.size())) +
+      0x9e3779b97f4a7c15ULL);
+}
+
+PathFilter::Hash PathFilter::hashPath(w_string_piece relPath) {
+  Hash hash = kRootHash;
+  if (relPath.empty()) {
+    return hash;
+  }
+
+  const char* component = relPath.data();
+  const char* end = component + relPath.size();
+  while (true) {
+    auto sep = (const char*)memchr(component, '/', end - component);
+    hash = hashChild(
+        hash, w_string_piece(component, (sep ? sep : end) - component));
+    if (!sep) {
+      return hash;
+    }
+    component = sep + 1;
+  }
+}
+
+void PathFilter::reset(size_t expected) {
+  log2Bits_ = kMinLog2Bits;
+  while ((size_t(1) << log2Bits_) < expected * kBitsPerEntry) {
+    ++log2Bits_;
+  }
+  bits_.assign((size_t(1) << log2Bits_) / 64, 0);
+  capacity_ = (size_t(1) << log2Bits_) / kBitsPerEntry;
+  size_ = 0;
+}
+
+void PathFilter::insert(Hash hash) {
+  ++size_;
+  if (bits_.empty()) {
+    return;
+  }
+  auto step = mix(hash) | 1;
+  for (uint32_t i = 0; i < kNumProbes; ++i) {
+    auto bit = hash >> (64 - log2Bits_);
+    bits_[bit / 64] |= uint64_t(1) << (bit % 64);
+    hash += step;
+  }
+}
+
+bool PathFilter::mayContain(Hash hash) const {
+  if (bits_.empty()) {
+    return true;
+  }
+  auto step = mix(hash) | 1;
+  for (uint32_t i = 0; i < kNumProbes; ++i) {
+    auto bit = hash >> (64 - log2Bits_);
+    if (!(bits_[bit / 64] & (uint64_t(1) << (bit % 64)))) {
+      return false;
+    }
+    hash += step;
+  }
+  return true;
+}
+
+} // namespace watchman
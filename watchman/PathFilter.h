@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A Bloom filter over the paths, relative to the root, of the nodes held by
+ * the in-memory view.  It answers "is there no node at this path?" without
+ * walking the tree, which is what existence checks over many names mostly
+ * want to know.  A positive answer only means that there may be such a
+ * node, so callers still look it up to find out.
+ *
+ * Paths are hashed a component at a time so that a dir node can remember
+ * its own hash and extend it for its children, and so that a path string
+ * splits into components exactly as ViewDatabase::resolveDir splits it.
+ *
+ * Entries cannot be removed; the owner rebuilds the filter from the tree
+ * when it fills up.  Not thread safe; the view accesses it under its own
+ * lock.
+ */
+class PathFilter {
+ public:
+  using Hash = uint64_t;
+
+  // The hash of the root itself, which every other path extends
+  static constexpr Hash kRootHash = 0;
+
+  /**
+   * Returns the hash of the path formed by appending the component name to
+   * the path whose hash is parent.
+   */
+  static Hash hashChild(Hash parent, w_string_piece name);
+
+  /**
+   * Returns the hash of relPath, a '/' separated path relative to the root.
+   */
+  static Hash hashPath(w_string_piece relPath);
+
+  /**
+   * Empties the filter and sizes it to hold expected entries before it
+   * reports itself full.
+   */
+  void reset(size_t expected);
+
+  void insert(Hash hash);
+
+  /**
+   * Returns false if hash was definitely never inserted since the last
+   * reset.
+   */
+  bool mayContain(Hash hash) const;
+
+  bool full() const {
+    return size_ >= capacity_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  size_t allocatedBytes() const {
+    return bits_.capacity() * sizeof(uint64_t);
+  }
+
+ private:
+  std::vector<uint64_t> bits_;
+  // The filter holds 2^log2Bits_ bits
+  uint32_t log2Bits_{0};
+  size_t capacity_{0};
+  size_t size_{0};
+};
+
+} // namespace watchman
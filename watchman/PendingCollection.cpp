@@ -7,8 +7,11 @@
 
 #include "watchman/PendingCollection.h"
 #include <folly/Synchronized.h>
+#include <string_view>
+#include <vector>
 #include "watchman/Cookie.h"
 #include "watchman/Logging.h"
+#include "watchman/ThreadStats.h"
 #include "watchman/watchman_dir.h"
 
 using namespace watchman;
@@ -49,11 +52,55 @@ bool is_path_prefix(
   return is_slash(path[common_prefix]);
 }
 
+namespace {
+
+// Returns true if path is the path to name in dir, comparing it with the
+// names of the dir and its parents rather than building the path
+bool isPathToChild(
+    std::string_view path,
+    const watchman_dir* dir,
+    std::string_view name) {
+  auto removeSuffix = [&path](std::string_view suffix) {
+    if (path.size() < suffix.size() ||
+        path.substr(path.size() - suffix.size()) != suffix) {
+      return false;
+    }
+    path.remove_suffix(suffix.size());
+    return true;
+  };
+  if (!removeSuffix(name)) {
+    return false;
+  }
+  for (auto d = dir; d; d = d->parent) {
+    if (!removeSuffix("/") || !removeSuffix(d->name.view())) {
+      return false;
+    }
+  }
+  return path.empty();
+}
+
+// The same as isPossiblyACookie on the path to name in dir.  The cookie
+// prefix has no slash, so it can only appear within one of the names.
+bool isPossiblyACookieChild(const watchman_dir* dir, w_string_piece name) {
+  if (isPossiblyACookie(name)) {
+    return true;
+  }
+  for (auto d = dir; d; d = d->parent) {
+    if (isPossiblyACookie(d->name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
 } // namespace watchman
 
 void PendingChanges::clear() {
   pending_.reset();
   tree_.clear();
+  dirChildren_.clear();
   syncs_.clear();
 }
 
@@ -61,16 +108,23 @@ void PendingChanges::add(
     const w_string& path,
     std::chrono::system_clock::time_point now,
     PendingFlags flags) {
+  addItem(path, now, flags);
+}
+
+watchman_pending_fs* PendingChanges::addItem(
+    const w_string& path,
+    std::chrono::system_clock::time_point now,
+    PendingFlags flags) {
   auto existing = tree_.search(path);
   if (existing) {
     /* Entry already exists: consolidate */
     consolidateItem(existing->get(), flags);
     /* all done */
-    return;
+    return nullptr;
   }
 
   if (isObsoletedByContainingDir(path)) {
-    return;
+    return nullptr;
   }
 
   // Try to allocate the new node before we prune any children.
@@ -81,7 +135,9 @@ void PendingChanges::add(
   logf(DBG, "add_pending: {} {}\n", path, flags.format());
 
   tree_.insert(path, p);
+  auto item = p.get();
   linkHead(std::move(p));
+  return item;
 }
 
 void PendingChanges::add(
@@ -89,7 +145,45 @@ void PendingChanges::add(
     const char* name,
     std::chrono::system_clock::time_point now,
     PendingFlags flags) {
-  return add(dir->getFullPathToChild(name), now, flags);
+  w_string_piece childName(name);
+  auto it = dirChildren_.find(DirChild{dir, childName});
+  if (it != dirChildren_.end() &&
+      isPathToChild(it->second->path.view(), dir, childName.view())) {
+    /* Entry already exists: consolidate */
+    consolidateItem(it->second, flags);
+    return;
+  }
+
+  if (isObsoletedByContainingDir(dir, childName)) {
+    return;
+  }
+
+  // Entries added by path, or under dirs that aren't indexed, still need
+  // the checks against the tree
+  auto p = addItem(dir->getFullPathToChild(childName), now, flags);
+  if (p) {
+    p->dir = dir;
+    dirChildren_[DirChild{dir, w_string_piece(p->path).baseName()}] = p;
+  }
+}
+
+void PendingChanges::addMove(
+    const w_string& from,
+    const w_string& to,
+    std::chrono::system_clock::time_point now,
+    PendingFlags flags) {
+  watchman_pending_fs* p;
+  if (auto existing = tree_.search(to)) {
+    p = existing->get();
+    consolidateItem(p, flags);
+  } else {
+    // Null if it is obsoleted by a recursive crawl of a containing dir,
+    // which takes care of the move anyway
+    p = addItem(to, now, flags);
+  }
+  if (p && !p->movedFrom) {
+    p->movedFrom = from;
+  }
 }
 
 void PendingChanges::addSync(folly::Promise<folly::Unit> promise) {
@@ -106,6 +200,9 @@ void PendingChanges::append(
     if (target_p) {
       /* Entry already exists: consolidate */
       consolidateItem(target_p->get(), p->flags);
+      if (p->movedFrom && !(*target_p)->movedFrom) {
+        (*target_p)->movedFrom = std::move(p->movedFrom);
+      }
       p = std::move(p->next);
       continue;
     }
@@ -117,6 +214,8 @@ void PendingChanges::append(
     maybePruneObsoletedChildren(p->path, p->flags);
 
     auto next = std::move(p->next);
+    // Only the items added to this collection are indexed by their dir
+    p->dir = nullptr;
     tree_.insert(p->path, p);
     linkHead(std::move(p));
 
@@ -131,6 +230,7 @@ void PendingChanges::append(
 
 std::shared_ptr<watchman_pending_fs> PendingChanges::stealItems() {
   tree_.clear();
+  dirChildren_.clear();
   return std::move(pending_);
 }
 
@@ -155,70 +255,62 @@ void PendingChanges::maybePruneObsoletedChildren(
     PendingFlags flags) {
   if ((flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
       W_PENDING_RECURSIVE) {
-    uint32_t pruned = 0;
-
-    // Since deletion invalidates the iterator, we need to repeatedly
-    // call this to prune out the nodes.  It will return 0 once no
-    // matching prefixes are found and deleted.
-    // Deletion is a bit awkward in this radix tree implementation.
-    // We can't recursively delete a given prefix as a built-in operation
-    // and it is non-trivial to add that functionality right now.
-    // When we lop-off a portion of a tree that we're going to analyze
-    // recursively, we have to iterate each leaf and explicitly delete
-    // that leaf.
-    // Since deletion invalidates the iteration state we have to signal
-    // to stop iteration after each deletion and then retry the prefix
-    // deletion.
+    // Deletion invalidates the iteration state of this radix tree, so
+    // collect the obsoleted children in one pass over the prefix and then
+    // delete each of them.  Restarting the iteration after every deletion
+    // would make pruning a large subtree quadratic.
     //
     // We need to compare the prefix to make sure that we don't delete
     // a sibling node by mistake (see commentary on the is_path_prefix
     // function for more on that).
+    std::vector<w_string> obsoleted;
+    tree_.iterPrefix(
+        reinterpret_cast<const uint8_t*>(path.data()),
+        path.size(),
+        [&](const w_string& key,
+            std::shared_ptr<watchman_pending_fs>& p) -> int {
+          w_check(
+              p,
+              "Pending changes should be removed from both the list and the "
+              "tree.");
+
+          if (!p->flags.contains(W_PENDING_CRAWL_ONLY) &&
+              key.size() > path.size() &&
+              is_path_prefix(
+                  (const char*)key.data(),
+                  key.size(),
+                  path.data(),
+                  path.size()) &&
+              !isPossiblyACookie(p->path)) {
+            obsoleted.push_back(key);
+          }
+          return 0;
+        });
+
+    for (auto& key : obsoleted) {
+      auto p = tree_.search(key);
+      logf(
+          DBG,
+          "delete_kids: removing ({}) {} from pending because it is "
+          "obsoleted by ({}) {}\n",
+          key.size(),
+          key,
+          path.size(),
+          path);
 
-    auto callback = [&](const w_string& key,
-                        std::shared_ptr<watchman_pending_fs>& p) -> int {
-      w_check(
-          p,
-          "Pending changes should be removed from both the list and the tree.");
-
-      if (!p->flags.contains(W_PENDING_CRAWL_ONLY) &&
-          key.size() > path.size() &&
-          is_path_prefix(
-              (const char*)key.data(), key.size(), path.data(), path.size()) &&
-          !isPossiblyACookie(p->path)) {
-        logf(
-            DBG,
-            "delete_kids: removing ({}) {} from pending because it is "
-            "obsoleted by ({}) {}\n",
-            p->path.size(),
-            p->path,
-            path.size(),
-            path);
-
-        // Unlink the child from the pending index.
-        unlinkItem(p);
-
-        // Remove it from the art tree.
-        tree_.erase(key);
-
-        // Stop iteration because we just invalidated the iterator state
-        // by modifying the tree mid-iteration.
-        return 1;
-      }
-
-      return 0;
-    };
+      // Unlink the child from the pending index.
+      unlinkItem(*p);
+      forgetDirChild(p->get());
 
-    while (tree_.iterPrefix(
-        reinterpret_cast<const uint8_t*>(path.data()), path.size(), callback)) {
-      // OK; try again
-      ++pruned;
+      // Remove it from the art tree.
+      tree_.erase(key);
     }
 
-    if (pruned) {
+    if (!obsoleted.empty()) {
       logf(
           DBG,
           "maybePruneObsoletedChildren: pruned {} nodes under ({}) {}\n",
-          pruned,
+          obsoleted.size(),
           path.size(),
           path);
     }
@@ -246,31 +338,70 @@ void PendingChanges::consolidateItem(
 // return true to indicate that there is no need to track this new path
 // due to the already scheduled higher level path.
 bool PendingChanges::isObsoletedByContainingDir(const w_string& path) {
-  auto leaf = tree_.longestMatch((const uint8_t*)path.data(), path.size());
-  if (!leaf) {
+  // Look at every entry on the path rather than only the longest match:
+  // the longest match for "a/b/d" may be "a" when the tree also holds
+  // "a/b/c", even though it holds "a/b" too.
+  std::shared_ptr<watchman_pending_fs> obsoletedBy;
+  tree_.iterPathPrefixes(
+      (const uint8_t*)path.data(),
+      path.size(),
+      [](unsigned char c) { return is_slash(char(c)); },
+      [&](const w_string&, std::shared_ptr<watchman_pending_fs>& p) -> int {
+        if ((p->flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
+            W_PENDING_RECURSIVE) {
+          obsoletedBy = p;
+          return 1;
+        }
+        return 0;
+      });
+  if (!obsoletedBy || isPossiblyACookie(path)) {
     return false;
   }
-  auto p = leaf->value;
 
-  if ((p->flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
-          W_PENDING_RECURSIVE &&
-      is_path_prefix(
-          path.data(),
-          path.size(),
-          (const char*)leaf->key.data(),
-          leaf->key.size())) {
-    if (isPossiblyACookie(path)) {
-      return false;
-    }
+  // Yes: the pre-existing entry higher up in the tree obsoletes this
+  // one that we would add now.
+  logf(
+      DBG,
+      "is_obsoleted: SKIP {} is obsoleted by {}\n",
+      path,
+      obsoletedBy->path);
+  return true;
+}
 
-    // Yes: the pre-existing entry higher up in the tree obsoletes this
-    // one that we would add now.
-    logf(DBG, "is_obsoleted: SKIP {} is obsoleted by {}\n", path, p->path);
-    return true;
+bool PendingChanges::isObsoletedByContainingDir(
+    const watchman_dir* dir,
+    w_string_piece name) {
+  // Each dir on the way up would have been indexed as a child of its parent
+  for (auto d = dir; d->parent; d = d->parent) {
+    auto it = dirChildren_.find(DirChild{d->parent, d->name});
+    if (it == dirChildren_.end()) {
+      continue;
+    }
+    auto p = it->second;
+    if ((p->flags & (W_PENDING_RECURSIVE | W_PENDING_CRAWL_ONLY)) ==
+            W_PENDING_RECURSIVE &&
+        isPathToChild(p->path.view(), d->parent, d->name.view())) {
+      if (isPossiblyACookieChild(dir, name)) {
+        return false;
+      }
+      logf(DBG, "is_obsoleted: SKIP {} in {} is obsoleted\n", name, p->path);
+      return true;
+    }
   }
   return false;
 }
 
+void PendingChanges::forgetDirChild(const watchman_pending_fs* p) {
+  if (!p->dir) {
+    return;
+  }
+  auto it = dirChildren_.find(
+      DirChild{p->dir, w_string_piece(p->path).baseName()});
+  if (it != dirChildren_.end() && it->second == p) {
+    dirChildren_.erase(it);
+  }
+}
+
 // Helper to doubly-link a pending item to the head of a collection.
 void PendingChanges::linkHead(std::shared_ptr<watchman_pending_fs>&& p) {
   p->prev.reset();
@@ -321,20 +452,77 @@ PendingCollection::PendingCollection()
           folly::in_place,
           cond_} {}
 
+PendingCollection::~PendingCollection() {
+  auto* batch = pushed_.exchange(nullptr, std::memory_order_acquire);
+  while (batch) {
+    auto* next = batch->next;
+    delete batch;
+    batch = next;
+  }
+}
+
+void PendingCollection::push(
+    std::shared_ptr<watchman_pending_fs> chain,
+    std::vector<folly::Promise<folly::Unit>> syncs) {
+  auto* batch = new Batch{std::move(chain), std::move(syncs)};
+  batch->next = pushed_.load(std::memory_order_relaxed);
+  while (!pushed_.compare_exchange_weak(
+      batch->next, batch, std::memory_order_seq_cst)) {
+  }
+
+  // Pairs with the store to waiting_ in lockAndWait: either the consumer
+  // observes our batch before it waits, or we observe that it is waiting
+  // and wake it.  Taking the lock ensures that the notification cannot fall
+  // between its check and its wait.
+  if (waiting_.load(std::memory_order_seq_cst)) {
+    auto lock = this->lock();
+    cond_.notify_all();
+  }
+}
+
+void PendingCollection::mergePushed(PendingCollectionBase& coll) {
+  auto* batch = pushed_.exchange(nullptr, std::memory_order_acquire);
+  if (!batch) {
+    return;
+  }
+
+  // Reverse the stack so that batches are applied in push order.
+  Batch* ordered = nullptr;
+  while (batch) {
+    auto* next = batch->next;
+    batch->next = ordered;
+    ordered = batch;
+    batch = next;
+  }
+
+  while (ordered) {
+    std::unique_ptr<Batch> current{ordered};
+    ordered = current->next;
+    coll.append(std::move(current->chain), std::move(current->syncs));
+  }
+}
+
 PendingCollection::LockedPtr PendingCollection::lockAndWait(
     std::chrono::milliseconds timeoutms) {
   auto lock = this->lock();
 
+  mergePushed(*lock);
   if (lock->checkAndResetPinged()) {
     return lock;
   }
 
-  if (timeoutms.count() == -1) {
-    cond_.wait(lock.as_lock());
-  } else {
-    cond_.wait_for(lock.as_lock(), timeoutms);
+  waiting_.store(true, std::memory_order_seq_cst);
+  if (!pushed_.load(std::memory_order_seq_cst)) {
+    ThreadStats::Wait wait;
+    if (timeoutms.count() == -1) {
+      cond_.wait(lock.as_lock());
+    } else {
+      cond_.wait_for(lock.as_lock(), timeoutms);
+    }
   }
+  waiting_.store(false, std::memory_order_relaxed);
 
+  mergePushed(*lock);
   lock->checkAndResetPinged();
   return lock;
 }
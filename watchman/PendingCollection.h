@@ -9,8 +9,11 @@
 
 #include <folly/Synchronized.h>
 #include <folly/futures/Promise.h>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <unordered_map>
+#include "watchman/MemoryProfile.h"
 #include "watchman/OptionSet.h"
 #include "watchman/thirdparty/libart/src/art.h"
 #include "watchman/watchman_string.h"
@@ -82,9 +85,16 @@ struct PendingChange {
   w_string path;
   std::chrono::system_clock::time_point now;
   PendingFlags flags;
+  // Set when the watcher saw the dir at path renamed from here, so that the
+  // IO thread can move what it knows about the dir rather than crawl it
+  w_string movedFrom{};
 };
 
-struct watchman_pending_fs : watchman::PendingChange {
+struct watchman_pending_fs
+    : watchman::PendingChange,
+      watchman::MemoryProfiled<
+          watchman_pending_fs,
+          watchman::MemoryTag::Pending> {
   // We own the next entry and will destroy that chain when we
   // are destroyed.
   std::shared_ptr<watchman_pending_fs> next;
@@ -98,6 +108,8 @@ struct watchman_pending_fs : watchman::PendingChange {
  private:
   // Only used for unlinking during pruning.
   std::weak_ptr<watchman_pending_fs> prev;
+  // The dir that the item was added under with add(dir, name), if it was
+  const watchman_dir* dir{nullptr};
   friend class PendingChanges;
 };
 
@@ -121,6 +133,10 @@ class PendingChanges {
   /**
    * Add a pending entry.  Will consolidate an existing entry with the same
    * name. The caller must own the collection lock.
+   *
+   * Entries added as a child of a dir are also indexed by the dir, so that
+   * repeated events for the child, and events under a recursive entry
+   * that was added that way, are consolidated without building the path.
    */
   void add(
       const w_string& path,
@@ -132,6 +148,17 @@ class PendingChanges {
       std::chrono::system_clock::time_point now,
       PendingFlags flags);
 
+  /**
+   * Add a pending entry for the dir at `to`, which the watcher saw renamed
+   * from `from`.  If the entry is consolidated with an existing one that
+   * wasn't a move, that one becomes this move.
+   */
+  void addMove(
+      const w_string& from,
+      const w_string& to,
+      std::chrono::system_clock::time_point now,
+      PendingFlags flags);
+
   /**
    * Add a sync request. The consumer of this sync should fulfill it after
    * processing all of the pending items.
@@ -171,11 +198,44 @@ class PendingChanges {
   std::vector<folly::Promise<folly::Unit>> syncs_;
 
  private:
+  struct DirChild {
+    const watchman_dir* dir;
+    w_string_piece name;
+
+    bool operator==(const DirChild& other) const {
+      return dir == other.dir && name == other.name;
+    }
+  };
+  struct DirChildHash {
+    size_t operator()(const DirChild& key) const {
+      return std::hash<const watchman_dir*>()(key.dir) * 31 +
+          key.name.hashValue();
+    }
+  };
+
+  // Returns the new item, or nullptr if the path was consolidated with an
+  // existing one or obsoleted by a recursive one
+  watchman_pending_fs* addItem(
+      const w_string& path,
+      std::chrono::system_clock::time_point now,
+      PendingFlags flags);
   void maybePruneObsoletedChildren(w_string path, PendingFlags flags);
   inline void consolidateItem(watchman_pending_fs* p, PendingFlags flags);
   bool isObsoletedByContainingDir(const w_string& path);
+  bool isObsoletedByContainingDir(
+      const watchman_dir* dir,
+      w_string_piece name);
+  void forgetDirChild(const watchman_pending_fs* p);
   inline void linkHead(std::shared_ptr<watchman_pending_fs>&& p);
   inline void unlinkItem(std::shared_ptr<watchman_pending_fs>& p);
+
+  // The items added by add(dir, name), keyed by the dir and the name, so
+  // that later events for them, or under the recursive ones, can be
+  // consolidated without building a path.  The name is a piece of the
+  // item's path.  The dir may have been deleted and its address reused
+  // since, so a match only counts if the item's path leads to the child.
+  std::unordered_map<DirChild, watchman_pending_fs*, DirChildHash>
+      dirChildren_;
 };
 
 class PendingCollectionBase : public PendingChanges {
@@ -204,18 +264,50 @@ class PendingCollection
     : public folly::Synchronized<PendingCollectionBase, std::mutex> {
  public:
   PendingCollection();
+  ~PendingCollection();
+
+  /**
+   * Hands a batch of items (usually from a stealItems() call) and syncs to
+   * the consumer without acquiring the lock, so that a busy producer such
+   * as the notify thread does not contend with the IO thread.
+   *
+   * The batch is merged into the collection, and consolidated with what is
+   * already there, by the next lockAndWait() call.  The consumer is woken
+   * if it is waiting.
+   */
+  void push(
+      std::shared_ptr<watchman_pending_fs> chain,
+      std::vector<folly::Promise<folly::Unit>> syncs);
 
   /**
    * If previously pinged or non-empty, returns a locked PendingCollectionBase.
-   * Otherwise, waits up to timeoutms (or indefinitely if -1 ms) for a ping().
+   * Otherwise, waits up to timeoutms (or indefinitely if -1 ms) for a ping()
+   * or a push().
    *
-   * The internal pinged state is always false after this call.
+   * Any pushed batches are merged in before returning.  The internal pinged
+   * state is always false after this call.
    */
   LockedPtr lockAndWait(std::chrono::milliseconds timeoutms);
 
  private:
+  struct Batch {
+    std::shared_ptr<watchman_pending_fs> chain;
+    std::vector<folly::Promise<folly::Unit>> syncs;
+    Batch* next{nullptr};
+  };
+
+  // Merges the pushed batches, in the order they were pushed.  The caller
+  // must hold the lock.
+  void mergePushed(PendingCollectionBase& coll);
+
   // Notified on ping().
   std::condition_variable cond_;
+
+  // A stack of pushed batches, most recent first.
+  std::atomic<Batch*> pushed_{nullptr};
+  // Set while the consumer is blocked in lockAndWait(); push() only needs to
+  // acquire the lock to wake it in that case.
+  std::atomic<bool> waiting_{false};
 };
 
 // Since the tree has no internal knowledge about path structures, when we
@@ -8,11 +8,13 @@
 #include "watchman/PerfSample.h"
 #include <folly/Synchronized.h>
 #include <condition_variable>
+#include <optional>
 #include <thread>
 #include "watchman/ChildProcess.h"
 #include "watchman/Logging.h"
 #include "watchman/Options.h"
 #include "watchman/WatchmanConfig.h"
+#include "watchman/bser.h"
 #include "watchman/sockname.h"
 #include "watchman/watchman_system.h"
 #include "watchman/watchman_time.h"
@@ -27,6 +29,8 @@ class PerfLogThread {
 
     bool running;
     json_ref samples;
+    // Samples that addSample refused because too many were already queued
+    uint64_t dropped{0};
   };
 
   folly::Synchronized<State, std::mutex> state_;
@@ -59,15 +63,85 @@ class PerfLogThread {
   }
 
   void addSample(json_ref&& sample) {
+    auto maxQueued = cfg_get_int("perf_logger_max_queued_samples", 10000);
     auto wlock = state_.lock();
     if (!wlock->samples) {
       wlock->samples = json_array();
+    } else if (
+        maxQueued > 0 && json_array_size(wlock->samples) >= size_t(maxQueued)) {
+      // The logger isn't keeping up; don't let the backlog grow without
+      // bound.
+      ++wlock->dropped;
+      return;
     }
     json_array_append_new(wlock->samples, std::move(sample));
     cond_.notify_one();
   }
 };
 
+/**
+ * A perf_logger_command that is started once and then fed batches of
+ * samples, as BSER pdus, through its stdin.  If it goes away, it is
+ * started again for the next batch.
+ */
+class PersistentPerfLogger {
+ public:
+  PersistentPerfLogger(json_ref command, w_string stateDir)
+      : command_(std::move(command)), stateDir_(std::move(stateDir)) {}
+
+  ~PersistentPerfLogger() {
+    stop();
+  }
+
+  void send(const std::string& batch) {
+    try {
+      if (!proc_) {
+        start();
+      }
+      const char* data = batch.data();
+      size_t size = batch.size();
+      while (size > 0) {
+        auto result = stdin_->write.write(data, size);
+        result.throwIfError();
+        data += result.value();
+        size -= result.value();
+      }
+    } catch (const std::exception& exc) {
+      log(ERR, "failed to send samples to perf logger: ", exc.what(), "\n");
+      stop();
+    }
+  }
+
+ private:
+  void start() {
+    ChildProcess::Options opts;
+    opts.environment().set(
+        {{"WATCHMAN_STATE_DIR", stateDir_},
+         {"WATCHMAN_SOCK", get_sock_name_legacy()}});
+    opts.pipeStdin();
+    opts.open(STDOUT_FILENO, "/dev/null", O_WRONLY, 0666);
+    opts.open(STDERR_FILENO, "/dev/null", O_WRONLY, 0666);
+
+    proc_ = std::make_unique<ChildProcess>(command_, std::move(opts));
+    stdin_ = proc_->takeStdin();
+  }
+
+  // Closing stdin is how the logger learns that there is nothing more to
+  // come, so this waits for it to finish up.
+  void stop() {
+    stdin_.reset();
+    if (proc_) {
+      proc_->wait();
+      proc_.reset();
+    }
+  }
+
+  json_ref command_;
+  w_string stateDir_;
+  std::unique_ptr<ChildProcess> proc_;
+  std::unique_ptr<Pipe> stdin_;
+};
+
 PerfLogThread& getPerfThread(bool start = true) {
   // Get the perf logging thread, starting it on the first call.
   // Meyer's singleton!
@@ -76,6 +150,27 @@ PerfLogThread& getPerfThread(bool start = true) {
 }
 } // namespace
 
+std::string encodeSampleBatch(
+    const json_ref& samples,
+    uint64_t droppedSamples) {
+  std::string buffer;
+  auto batch = json_object(
+      {{"samples", samples},
+       {"dropped_samples", json_integer(droppedSamples)}});
+  if (w_bser_write_pdu(
+          2,
+          0,
+          [](const char* buf, size_t size, void* data) {
+            static_cast<std::string*>(data)->append(buf, size);
+            return 0;
+          },
+          batch,
+          &buffer) != 0) {
+    throw std::runtime_error("failed to encode perf samples");
+  }
+  return buffer;
+}
+
 void processSamples(
     size_t argv_limit,
     size_t maximum_batch_size,
@@ -112,6 +207,7 @@ PerfSample::PerfSample(const char* description) : description(description) {
 #ifdef HAVE_SYS_RESOURCE_H
   getrusage(RUSAGE_SELF, &usage_begin);
 #endif
+  thread_usage_begin = ThreadStats::currentThreadUsage();
 }
 
 bool PerfSample::finish() {
@@ -141,6 +237,11 @@ bool PerfSample::finish() {
 #undef DIFFU
 #endif
 
+  auto threadUsage = ThreadStats::currentThreadUsage();
+  thread_usage.cpu = threadUsage.cpu - thread_usage_begin.cpu;
+  thread_usage.wait = threadUsage.wait - thread_usage_begin.wait;
+  thread_name = ThreadStats::currentThreadName();
+
   if (!will_log) {
     if (wall_time_elapsed_thresh == 0) {
       auto thresh = cfg_get_json("perf_sampling_thresh");
@@ -197,6 +298,14 @@ void PerfLogThread::loop() noexcept {
 
   sample_batch = cfg_get_int("perf_logger_command_max_samples_per_call", 4);
 
+  // Rather than spawning the logger for every few samples, keep a single
+  // instance running and stream everything that has queued up to it.
+  std::optional<PersistentPerfLogger> persistentLogger;
+  if (cfg_get_bool("perf_logger_persistent", false)) {
+    persistentLogger.emplace(perf_cmd, stateDir);
+  }
+  uint64_t dropped = 0;
+
   while (true) {
     {
       auto state = state_.lock();
@@ -214,9 +323,22 @@ void PerfLogThread::loop() noexcept {
 
       samples = nullptr;
       std::swap(samples, state->samples);
+      if (state->dropped != dropped) {
+        logf(
+            ERR,
+            "perf logger is falling behind; {} samples dropped so far\n",
+            state->dropped);
+        dropped = state->dropped;
+      }
     }
 
-    if (samples) {
+    if (samples && persistentLogger) {
+      try {
+        persistentLogger->send(encodeSampleBatch(samples, dropped));
+      } catch (const std::exception& exc) {
+        log(ERR, "failed to send samples to perf logger: ", exc.what(), "\n");
+      }
+    } else if (samples) {
       // Hack: Divide by two because this limit includes environment variables
       // and perf_cmd.
       // It's possible to compute this correctly on every platform given the
@@ -323,6 +445,16 @@ void PerfSample::log() {
   ADDTV("system_time", usage.ru_stime);
 #endif // HAVE_SYS_RESOURCE_H
 #undef ADDTV
+  info.set(
+      {{"thread_cpu_time",
+        json_real(std::chrono::duration<double>(thread_usage.cpu).count())},
+       {"thread_wait_time",
+        json_real(std::chrono::duration<double>(thread_usage.wait).count())}});
+  if (!thread_name.empty()) {
+    info.set(
+        "thread_name",
+        typed_string_to_json(thread_name.c_str(), W_STRING_UNICODE));
+  }
 
   // Log to the log file
   auto dumped = json_dumps(info, 0);
@@ -7,8 +7,10 @@
 
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
+#include "watchman/ThreadStats.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 
 // Performance metrics sampling
@@ -48,6 +50,13 @@ class PerfSample {
   struct rusage usage;
 #endif
 
+  // The usage of the thread that took the sample, which, unlike the
+  // process-wide figures above, is attributable to the action being
+  // sampled if it ran on that thread.
+  std::string thread_name;
+  ThreadStats::Usage thread_usage_begin;
+  ThreadStats::Usage thread_usage;
+
   // Initialize and mark the start of a sample
   explicit PerfSample(const char* description);
 
@@ -76,6 +85,16 @@ class PerfSample {
 
 void perf_shutdown();
 
+/**
+ * Encodes a batch of samples for a perf_logger_command that runs with
+ * perf_logger_persistent set, as a single BSER pdu holding
+ * {"samples": [...], "dropped_samples": n}.  The pdu header carries the
+ * length of the batch, so the logger can read one batch at a time from its
+ * stdin.  droppedSamples counts the samples that this process has dropped
+ * so far because the logger wasn't keeping up.
+ */
+std::string encodeSampleBatch(const json_ref& samples, uint64_t droppedSamples);
+
 void processSamples(
     size_t argv_limit,
     size_t maximum_batch_size,
@@ -8,6 +8,7 @@
 #include "watchman/PubSub.h"
 #include <algorithm>
 #include <iterator>
+#include <limits>
 
 namespace watchman {
 
@@ -32,6 +33,7 @@ Publisher::Subscriber::~Subscriber() {
 
   {
     auto wlock = publisher_->state_.wlock();
+    uint64_t minSerial = std::numeric_limits<uint64_t>::max();
     auto it = wlock->subscribers.begin();
     while (it != wlock->subscribers.end()) {
       auto sub = it->lock();
@@ -40,14 +42,17 @@ Publisher::Subscriber::~Subscriber() {
         it = wlock->subscribers.erase(it);
       } else {
         ++it;
+        minSerial = std::min(minSerial, sub->getSerial());
         // Defer releasing the sub reference until after we've
         // release the wlock!
         subscribers.emplace_back(std::move(sub));
       }
     }
+    publisher_->numSubscribers_.store(
+        wlock->subscribers.size(), std::memory_order_release);
     // Take this opportunity to reap anything that is no longer
     // referenced now that we've removed some subscriber(s)
-    wlock->collectGarbage();
+    wlock->collectGarbage(minSerial);
   }
 
   // It is now safe for subscribers to be torn down and release
@@ -56,40 +61,43 @@ Publisher::Subscriber::~Subscriber() {
 
 void Publisher::Subscriber::getPending(
     std::vector<std::shared_ptr<const Item>>& pending) {
-  {
-    auto rlock = publisher_->state_.rlock();
-    auto& items = rlock->items;
-
-    if (items.empty()) {
-      return;
-    }
-
-    // First we walk back to find the end of the range that
-    // we have seen previously.
-    int firstIndex;
-    for (firstIndex = int(items.size()) - 1; firstIndex >= 0; --firstIndex) {
-      if (items[firstIndex]->serial <= serial_) {
-        break;
-      }
-    }
+  auto serial = serial_.load(std::memory_order_relaxed);
+  // Items that are dropped are counted in missed_ before lastSerial_ moves
+  // past them, and the subscriber is notified after both, so there is
+  // nothing to do here until it is told that there is.
+  if (serial >= publisher_->lastSerial_.load(std::memory_order_acquire) &&
+      missed_.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
 
-    // We found the item before the one we really want, so
-    // increment the index; we'll copy the remaining items.
-    ++firstIndex;
-    bool updated = false;
+  auto rlock = publisher_->state_.rlock();
+  auto& items = rlock->items;
 
-    while (firstIndex < int(items.size())) {
-      pending.push_back(items[firstIndex]);
-      ++firstIndex;
-      updated = true;
-    }
+  auto missed = missed_.exchange(0);
+  if (missed) {
+    totalMissed_ += missed;
+  }
+  if (missed && publisher_->lagPayload_) {
+    auto marker = std::make_shared<Item>();
+    // Sorts just before the oldest item that is still retained
+    marker->serial = items.empty() ? serial : items.front()->serial - 1;
+    marker->payload = publisher_->lagPayload_;
+    pending.push_back(std::move(marker));
+  }
 
-    if (updated) {
-      serial_ = pending.back()->serial;
-    }
+  if (items.empty()) {
+    return;
+  }
 
+  // The serials are consecutive, so the first unseen item is found
+  // without searching for it
+  auto firstSerial = items.front()->serial;
+  size_t first = serial < firstSerial ? 0 : size_t(serial - firstSerial + 1);
+  if (first >= items.size()) {
     return;
   }
+  pending.insert(pending.end(), items.begin() + first, items.end());
+  serial_.store(items.back()->serial, std::memory_order_relaxed);
 }
 
 void getPending(
@@ -104,32 +112,25 @@ void getPending(
   }
 }
 
+Publisher::Publisher(size_t maxItems, json_ref lagPayload)
+    : maxItems_(maxItems), lagPayload_(std::move(lagPayload)) {}
+
 std::shared_ptr<Publisher::Subscriber> Publisher::subscribe(
     Notifier notify,
     const json_ref& info) {
   auto sub =
       std::make_shared<Publisher::Subscriber>(shared_from_this(), notify, info);
-  state_.wlock()->subscribers.emplace_back(sub);
+  auto wlock = state_.wlock();
+  wlock->subscribers.emplace_back(sub);
+  numSubscribers_.store(wlock->subscribers.size(), std::memory_order_release);
   return sub;
 }
 
 bool Publisher::hasSubscribers() const {
-  return !state_.rlock()->subscribers.empty();
+  return numSubscribers_.load(std::memory_order_acquire) != 0;
 }
 
-void Publisher::state::collectGarbage() {
-  if (items.empty()) {
-    return;
-  }
-
-  uint64_t minSerial = std::numeric_limits<uint64_t>::max();
-  for (auto& it : subscribers) {
-    auto sub = it.lock();
-    if (sub) {
-      minSerial = std::min(minSerial, sub->getSerial());
-    }
-  }
-
+void Publisher::state::collectGarbage(uint64_t minSerial) {
   while (!items.empty() && items.front()->serial < minSerial) {
     items.pop_front();
   }
@@ -144,6 +145,9 @@ bool Publisher::enqueue(json_ref&& payload) {
     // We need to collect live references for the notify portion,
     // but since we're holding the wlock, take this opportunity to
     // detect and prune dead subscribers and clean up some garbage.
+    // This is the only pass over the subscribers.
+    uint64_t minSerial = std::numeric_limits<uint64_t>::max();
+    subscribers.reserve(wlock->subscribers.size());
     auto it = wlock->subscribers.begin();
     while (it != wlock->subscribers.end()) {
       auto sub = it->lock();
@@ -152,13 +156,16 @@ bool Publisher::enqueue(json_ref&& payload) {
         it = wlock->subscribers.erase(it);
       } else {
         ++it;
+        minSerial = std::min(minSerial, sub->getSerial());
         // Remember that live reference so that we can notify
         // outside of the lock below.
         subscribers.emplace_back(std::move(sub));
       }
     }
+    numSubscribers_.store(
+        wlock->subscribers.size(), std::memory_order_release);
 
-    wlock->collectGarbage();
+    wlock->collectGarbage(minSerial);
 
     if (subscribers.empty()) {
       return false;
@@ -168,6 +175,20 @@ bool Publisher::enqueue(json_ref&& payload) {
     item->payload = std::move(payload);
     item->serial = wlock->nextSerial++;
     wlock->items.emplace_back(std::move(item));
+
+    // Don't let a subscriber that has stopped consuming make us retain
+    // an unbounded number of items.
+    while (maxItems_ && wlock->items.size() > maxItems_) {
+      auto serial = wlock->items.front()->serial;
+      for (auto& sub : subscribers) {
+        if (sub->getSerial() < serial) {
+          ++sub->missed_;
+        }
+      }
+      wlock->items.pop_front();
+      ++wlock->droppedItems;
+    }
+    lastSerial_.store(wlock->nextSerial - 1, std::memory_order_release);
   }
 
   // and notify them outside of the lock
@@ -180,11 +201,29 @@ bool Publisher::enqueue(json_ref&& payload) {
   return true;
 }
 
+Publisher::Stats Publisher::getStats() const {
+  Stats stats;
+  auto rlock = state_.rlock();
+  stats.queuedItems = rlock->items.size();
+  stats.droppedItems = rlock->droppedItems;
+  for (auto& sub_ref : rlock->subscribers) {
+    auto sub = sub_ref.lock();
+    if (sub) {
+      ++stats.numSubscribers;
+      stats.maxSubscriberLag = std::max(
+          stats.maxSubscriberLag, rlock->nextSerial - 1 - sub->getSerial());
+    }
+  }
+  return stats;
+}
+
 json_ref Publisher::getDebugInfo() const {
   auto ret = json_object();
 
   auto rlock = state_.rlock();
   ret.set("next_serial", json_integer(rlock->nextSerial));
+  ret.set("max_items", json_integer(maxItems_));
+  ret.set("dropped_items", json_integer(rlock->droppedItems));
 
   auto subscribers = json_array();
   auto& subscribers_arr = subscribers.array();
@@ -194,6 +233,8 @@ json_ref Publisher::getDebugInfo() const {
     if (sub) {
       auto sub_json = json_object(
           {{"serial", json_integer(sub->getSerial())},
+           {"queued", json_integer(rlock->nextSerial - 1 - sub->getSerial())},
+           {"missed", json_integer(sub->totalMissed_.load())},
            {"info", sub->getInfo()}});
       subscribers_arr.emplace_back(sub_json);
     } else {
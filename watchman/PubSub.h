@@ -7,10 +7,12 @@
 
 #pragma once
 #include <folly/Synchronized.h>
+#include "watchman/MemoryProfile.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
 
+#include <atomic>
 #include <deque>
 #include <functional>
 #include <vector>
@@ -19,7 +21,7 @@ namespace watchman {
 
 class Publisher : public std::enable_shared_from_this<Publisher> {
  public:
-  struct Item {
+  struct Item : MemoryProfiled<Item, MemoryTag::PubSub> {
     // copy of nextSerial_ at the time this was created.
     // The item can be released when all subscribers have
     // observed this serial number.
@@ -34,8 +36,9 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
   // Each subscriber is represented by one of these
   class Subscriber : public std::enable_shared_from_this<Subscriber> {
     // The serial of the last Item to be consumed by
-    // this subscriber.
-    uint64_t serial_;
+    // this subscriber.  Only advanced by getPending, but read by the
+    // publisher to tell which items it may release.
+    std::atomic<uint64_t> serial_;
     // Subscriber keeps the publisher alive so that no Items are lost
     // if the Publisher is released before all of the subscribers.
     std::shared_ptr<Publisher> publisher_;
@@ -43,6 +46,13 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     Notifier notify_;
     // Information for debugging purposes
     const json_ref info_;
+    // Items that the publisher dropped before this subscriber saw them,
+    // and that it has not yet been told about.
+    std::atomic<uint64_t> missed_{0};
+    // The total number of items that this subscriber has missed
+    std::atomic<uint64_t> totalMissed_{0};
+
+    friend class Publisher;
 
    public:
     ~Subscriber();
@@ -53,10 +63,12 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     Subscriber(const Subscriber&) = delete;
 
     // Returns all as yet unseen published items for this subscriber.
+    // If items were dropped before this subscriber could see them, the
+    // publisher's lag payload is returned in their place.
     void getPending(std::vector<std::shared_ptr<const Item>>& pending);
 
     inline uint64_t getSerial() const {
-      return serial_;
+      return serial_.load(std::memory_order_relaxed);
     }
 
     inline Notifier& getNotify() {
@@ -68,6 +80,16 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
     }
   };
 
+  // Construct a publisher that retains every item until all of its
+  // subscribers have seen it.
+  Publisher() = default;
+
+  // Construct a publisher that retains at most maxItems items.  When a
+  // subscriber falls further behind than that, the oldest items are dropped
+  // and the subscriber is given a single item with lagPayload in their
+  // place, which should prompt it to resynchronize.
+  Publisher(size_t maxItems, json_ref lagPayload);
+
   // Register a new subscriber.
   // When the Subscriber object is released, the registration is
   // automatically removed.
@@ -87,21 +109,47 @@ class Publisher : public std::enable_shared_from_this<Publisher> {
   // Return debugging info useful for state inspection.
   json_ref getDebugInfo() const;
 
+  struct Stats {
+    // Items retained because some subscriber has not yet seen them
+    size_t queuedItems{0};
+    size_t numSubscribers{0};
+    // The most items that any one subscriber has yet to see
+    uint64_t maxSubscriberLag{0};
+    uint64_t droppedItems{0};
+  };
+
+  // Return a summary of the queue, cheaper to produce than getDebugInfo.
+  Stats getStats() const;
+
  private:
   struct state {
     state() = default;
     state(const state&) = delete;
     // Serial number to use for the next Item
     uint64_t nextSerial{1};
-    // The stream of Items
+    // The stream of Items.  Their serials are consecutive, so the one
+    // that follows a given serial is found by subtracting the serial of
+    // the first.
     std::deque<std::shared_ptr<const Item>> items;
     // The subscribers
     std::vector<std::weak_ptr<Subscriber>> subscribers;
+    // How many items were dropped to respect maxItems_
+    uint64_t droppedItems{0};
 
-    void collectGarbage();
+    // Releases the items that every subscriber has seen, given the
+    // lowest serial that any of them has seen.
+    void collectGarbage(uint64_t minSerial);
     void enqueue(json_ref&& payload);
   };
   folly::Synchronized<state> state_;
+  // Copies of state_, kept so that subscribers can tell that there is
+  // nothing for them, and loggers that there is no one to log to, without
+  // taking the lock.  Only written with the lock held.
+  std::atomic<uint64_t> lastSerial_{0};
+  std::atomic<size_t> numSubscribers_{0};
+  // 0 means unbounded
+  const size_t maxItems_{0};
+  const json_ref lagPayload_;
 
   friend class Subscriber;
 };
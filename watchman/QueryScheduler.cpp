@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/QueryScheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include "watchman/Errors.h"
+#include "watchman/ThreadStats.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+namespace {
+// How many queries are admitted between sweeps for clients with nothing
+// worth remembering
+constexpr uint64_t kAdmitsPerSweep = 256;
+
+double toMillis(QueryScheduler::Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+} // namespace
+
+QueryScheduler& getQueryScheduler() {
+  static QueryScheduler scheduler([] {
+    QueryScheduler::Options options;
+    options.maxConcurrent =
+        size_t(std::max(json_int_t(0), cfg_get_int("query_max_concurrent", 0)));
+    options.costPerSecond = std::chrono::milliseconds(std::max(
+        json_int_t(0), cfg_get_int("query_client_cost_ms_per_second", 0)));
+    options.costBurst = std::chrono::milliseconds(std::max(
+        json_int_t(0),
+        cfg_get_int(
+            "query_client_cost_burst_ms", 10 * options.costPerSecond.count())));
+    return options;
+  }());
+  return scheduler;
+}
+
+QueryScheduler::Ticket::Ticket(Ticket&& other) noexcept
+    : scheduler_(std::exchange(other.scheduler_, nullptr)),
+      pid_(other.pid_),
+      admitted_(other.admitted_) {}
+
+QueryScheduler::Ticket::~Ticket() {
+  release();
+}
+
+void QueryScheduler::Ticket::release(Clock::time_point now) {
+  if (auto scheduler = std::exchange(scheduler_, nullptr)) {
+    scheduler->release(pid_, admitted_, now);
+  }
+}
+
+QueryScheduler::QueryScheduler(Options options) : options_(options) {}
+
+QueryScheduler::Client& QueryScheduler::getClient(
+    pid_t pid,
+    Clock::time_point now) {
+  auto it = clients_.find(pid);
+  if (it == clients_.end()) {
+    Client client;
+    client.budget = toMillis(options_.costBurst);
+    client.refilled = now;
+    client.decayed = now;
+    it = clients_.emplace(pid, client).first;
+  }
+  return it->second;
+}
+
+void QueryScheduler::refill(Client& client, Clock::time_point now) const {
+  if (now <= client.refilled) {
+    return;
+  }
+  client.budget = std::min(
+      toMillis(options_.costBurst),
+      client.budget +
+          toMillis(now - client.refilled) *
+              double(options_.costPerSecond.count()) / 1000);
+  client.refilled = now;
+}
+
+double QueryScheduler::decayedCost(const Client& client, Clock::time_point now)
+    const {
+  if (now <= client.decayed) {
+    return client.recentCost;
+  }
+  return client.recentCost *
+      std::exp2(-toMillis(now - client.decayed) / toMillis(kCostHalfLife));
+}
+
+QueryScheduler::Ticket QueryScheduler::admit(
+    pid_t pid,
+    Clock::time_point now) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (++admitsSinceSweep_ >= kAdmitsPerSweep) {
+    forgetIdleClients(now);
+  }
+
+  auto& client = getClient(pid, now);
+  if (options_.costPerSecond.count() > 0 && pid != 0) {
+    refill(client, now);
+    if (client.budget <= 0) {
+      ++client.rejected;
+      // How long until the budget is back to holding a millisecond
+      auto retryAfter = std::chrono::milliseconds(int64_t(std::ceil(
+          (1 - client.budget) * 1000 /
+          double(options_.costPerSecond.count()))));
+      throw QueryAdmissionError(pid, retryAfter);
+    }
+  }
+
+  if (options_.maxConcurrent > 0 &&
+      (running_ >= options_.maxConcurrent || !waiters_.empty())) {
+    Waiter waiter{pid, nextSeq_++};
+    waiters_.push_back(&waiter);
+    ++client.waiting;
+    ++client.waited;
+    {
+      ThreadStats::Wait wait;
+      cond_.wait(lock, [&] { return waiter.admitted; });
+    }
+    // admitNextWaiter took the waiter off the list and counted it as
+    // running.  The client may have been rehashed, but never forgotten,
+    // while we waited.
+    auto& waited = clients_.at(pid);
+    --waited.waiting;
+    ++waited.admitted;
+    ++waited.running;
+    return Ticket(this, pid, Clock::now());
+  }
+
+  ++running_;
+  ++client.admitted;
+  ++client.running;
+  return Ticket(this, pid, now);
+}
+
+void QueryScheduler::release(
+    pid_t pid,
+    Clock::time_point admitted,
+    Clock::time_point now) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto cost = now > admitted ? toMillis(now - admitted) : 0.0;
+  auto& client = clients_.at(pid);
+  refill(client, now);
+  client.budget -= cost;
+  client.recentCost = decayedCost(client, now) + cost;
+  client.decayed = now;
+  client.totalCost += cost;
+  --client.running;
+  --running_;
+  admitNextWaiter(now);
+}
+
+void QueryScheduler::admitNextWaiter(Clock::time_point now) {
+  if (waiters_.empty() || running_ >= options_.maxConcurrent) {
+    return;
+  }
+  auto best = waiters_.begin();
+  auto bestCost = decayedCost(clients_.at((*best)->pid), now);
+  for (auto it = std::next(best); it != waiters_.end(); ++it) {
+    // The list is in arrival order, so ties go to the earliest
+    auto cost = decayedCost(clients_.at((*it)->pid), now);
+    if (cost < bestCost) {
+      best = it;
+      bestCost = cost;
+    }
+  }
+  (*best)->admitted = true;
+  waiters_.erase(best);
+  ++running_;
+  cond_.notify_all();
+}
+
+void QueryScheduler::forgetIdleClients(Clock::time_point now) {
+  admitsSinceSweep_ = 0;
+  for (auto it = clients_.begin(); it != clients_.end();) {
+    auto& client = it->second;
+    refill(client, now);
+    bool idle = client.running == 0 && client.waiting == 0 &&
+        client.budget >= toMillis(options_.costBurst) &&
+        decayedCost(client, now) < 1;
+    if (idle) {
+      it = clients_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+QueryScheduler::Stats QueryScheduler::getStats(Clock::time_point now) const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  Stats stats;
+  stats.running = running_;
+  stats.waiting = waiters_.size();
+  for (auto& it : clients_) {
+    auto& client = it.second;
+    stats.clients.push_back(ClientStats{
+        it.first,
+        client.admitted,
+        client.rejected,
+        client.waited,
+        client.running,
+        std::chrono::milliseconds(int64_t(client.totalCost)),
+        std::chrono::milliseconds(int64_t(decayedCost(client, now)))});
+  }
+  std::sort(
+      stats.clients.begin(),
+      stats.clients.end(),
+      [](const ClientStats& a, const ClientStats& b) { return a.pid < b.pid; });
+  return stats;
+}
+
+} // namespace watchman
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+/**
+ * Decides when the queries that clients send may execute, so that one
+ * client issuing expensive queries in a tight loop can't crowd out the
+ * others.
+ *
+ * The cost of a query is the time that it spends executing, and is charged
+ * to the pid of the client that sent it.  Each pid has a budget of cost
+ * that refills over time; a pid that has spent all of it is refused until
+ * it has refilled.  When the number of queries that may execute at once is
+ * limited, those waiting for a turn are let in least recently costly pid
+ * first, so the clients that ask for little don't queue behind those that
+ * ask for a lot.
+ *
+ * Queries from pid 0, whose sender is unknown, have no budget.
+ */
+class QueryScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    // How many queries may execute at once; 0 for no limit
+    size_t maxConcurrent{0};
+    // How much execution time each pid's budget gains per second; 0 for
+    // no budget
+    std::chrono::milliseconds costPerSecond{0};
+    // The most that a pid's budget can hold
+    std::chrono::milliseconds costBurst{0};
+  };
+
+  struct ClientStats {
+    pid_t pid;
+    uint64_t admitted;
+    uint64_t rejected;
+    uint64_t waited;
+    size_t running;
+    // The total cost of the pid's queries, and the cost that it has run up
+    // recently, which decays with a half life of kCostHalfLife
+    std::chrono::milliseconds totalCost;
+    std::chrono::milliseconds recentCost;
+  };
+
+  struct Stats {
+    size_t running;
+    size_t waiting;
+    std::vector<ClientStats> clients;
+  };
+
+  static constexpr std::chrono::seconds kCostHalfLife{10};
+
+  /**
+   * Held while a query executes.  Releasing it, which the destructor does
+   * if it hasn't been done already, charges the pid for the time since it
+   * was admitted and lets the next waiting query in.
+   */
+  class Ticket {
+   public:
+    Ticket(Ticket&& other) noexcept;
+    Ticket& operator=(Ticket&&) = delete;
+    ~Ticket();
+
+    void release(Clock::time_point now = Clock::now());
+
+   private:
+    friend class QueryScheduler;
+    Ticket(QueryScheduler* scheduler, pid_t pid, Clock::time_point admitted)
+        : scheduler_(scheduler), pid_(pid), admitted_(admitted) {}
+
+    QueryScheduler* scheduler_;
+    pid_t pid_;
+    Clock::time_point admitted_;
+  };
+
+  explicit QueryScheduler(Options options);
+
+  /**
+   * Waits until a query from pid may execute.  Throws QueryAdmissionError
+   * if pid has spent its budget.
+   */
+  Ticket admit(pid_t pid, Clock::time_point now = Clock::now());
+
+  Stats getStats(Clock::time_point now = Clock::now()) const;
+
+ private:
+  struct Client {
+    // Milliseconds of execution time; negative once overspent by the
+    // queries that were running when it ran out
+    double budget;
+    Clock::time_point refilled;
+    double recentCost{0};
+    Clock::time_point decayed;
+    double totalCost{0};
+    uint64_t admitted{0};
+    uint64_t rejected{0};
+    uint64_t waited{0};
+    size_t running{0};
+    size_t waiting{0};
+  };
+
+  struct Waiter {
+    pid_t pid;
+    uint64_t seq;
+    bool admitted{false};
+  };
+
+  Client& getClient(pid_t pid, Clock::time_point now);
+  void refill(Client& client, Clock::time_point now) const;
+  double decayedCost(const Client& client, Clock::time_point now) const;
+  void release(pid_t pid, Clock::time_point admitted, Clock::time_point now);
+  // Lets in the waiter whose pid has the least recent cost, if there is
+  // room for it
+  void admitNextWaiter(Clock::time_point now);
+  void forgetIdleClients(Clock::time_point now);
+
+  const Options options_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::unordered_map<pid_t, Client> clients_;
+  std::deque<Waiter*> waiters_;
+  uint64_t nextSeq_{0};
+  size_t running_{0};
+  uint64_t admitsSinceSweep_{0};
+};
+
+// Returns the scheduler for the queries that clients send, configured from
+// the global config the first time that it is called
+QueryScheduler& getQueryScheduler();
+
+} // namespace watchman
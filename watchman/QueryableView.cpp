@@ -31,6 +31,32 @@ void QueryableView::allFilesGenerator(const Query*, QueryContext*) const {
   throw QueryExecError("allFilesGenerator not implemented");
 }
 
+void QueryableView::wholeNamesGenerator(
+    const Query* query,
+    const std::vector<w_string>&,
+    CaseSensitivity,
+    QueryContext* ctx) const {
+  allFilesGenerator(query, ctx);
+}
+
+void QueryableView::subtreeGenerator(
+    const Query* query,
+    const w_string&,
+    uint32_t,
+    QueryContext* ctx) const {
+  allFilesGenerator(query, ctx);
+}
+
+void QueryableView::suffixGenerator(
+    const Query* query,
+    const std::vector<w_string>&,
+    QueryContext* ctx) const {
+  allFilesGenerator(query, ctx);
+}
+
+void QueryableView::unsettledGenerator(const Query*, uint32_t, QueryContext*)
+    const {}
+
 uint32_t QueryableView::getLastAgeOutTickValue() const {
   return 0;
 }
@@ -8,10 +8,13 @@
 #pragma once
 
 #include <folly/futures/Future.h>
+#include <chrono>
+#include <optional>
 #include <vector>
 #include "watchman/Clock.h"
 #include "watchman/CookieSync.h"
 #include "watchman/PerfSample.h"
+#include "watchman/TreeSizeHints.h"
 #include "watchman/watchman_string.h"
 
 namespace watchman {
@@ -46,17 +49,77 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
 
   virtual void allFilesGenerator(const Query* query, QueryContext* ctx) const;
 
+  /**
+   * Looks up each of the supplied names, which are relative to the query's
+   * relative root, ignoring ASCII case if caseSensitive is CaseInSensitive.
+   * The default implementation walks all files.
+   */
+  virtual void wholeNamesGenerator(
+      const Query* query,
+      const std::vector<w_string>& names,
+      CaseSensitivity caseSensitive,
+      QueryContext* ctx) const;
+
+  /**
+   * Walks all files beneath dirName, which is relative to the query's
+   * relative root, that are no more than maxDepth levels of directories
+   * below it.  The default implementation walks all files.
+   */
+  virtual void subtreeGenerator(
+      const Query* query,
+      const w_string& dirName,
+      uint32_t maxDepth,
+      QueryContext* ctx) const;
+
+  /**
+   * Walks files whose name has one of the supplied lowercased suffixes.
+   * Views that don't maintain a suffix index fall back to walking all files.
+   */
+  virtual void suffixGenerator(
+      const Query* query,
+      const std::vector<w_string>& suffixes,
+      QueryContext* ctx) const;
+
+  /**
+   * Walks the files that changed after sinceTicks and since the view last
+   * settled, for subscriptions that want to hear about changes before the
+   * view settles.  Views that don't collect those changes yield nothing.
+   */
+  virtual void unsettledGenerator(
+      const Query* query,
+      uint32_t sinceTicks,
+      QueryContext* ctx) const;
+
   virtual ClockPosition getMostRecentRootNumberAndTickValue() const = 0;
+  // The position of the most recent change to the files in the view.  This
+  // trails getMostRecentRootNumberAndTickValue when ticks are spent on
+  // things, such as cookie files, that leave the files as they were.
+  virtual ClockPosition getLastChangePosition() const {
+    return getMostRecentRootNumberAndTickValue();
+  }
   virtual w_string getCurrentClockString() const = 0;
   virtual uint32_t getLastAgeOutTickValue() const;
   virtual std::chrono::system_clock::time_point getLastAgeOutTimeStamp() const;
   virtual void ageOut(PerfSample& sample, std::chrono::seconds minAge);
 
+  /**
+   * Keeps FileResult::identity unique among the results of the view for as
+   * long as the returned token is held, by holding off whatever would free
+   * the nodes that the identities are taken from, and hand out their
+   * addresses again.  Returns nullptr if its results have no identities.
+   */
+  virtual std::shared_ptr<const void> pinResultIdentities() const {
+    return nullptr;
+  }
+
   virtual folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period) = 0;
+  // scope, if not empty, names the dir beneath which the caller needs
+  // the changes; see CookieSync::syncToNow.
   virtual CookieSync::SyncResult syncToNow(
       const std::shared_ptr<Root>& root,
-      std::chrono::milliseconds timeout) = 0;
+      std::chrono::milliseconds timeout,
+      const w_string& scope) = 0;
 
   // Specialized query function that is used to test whether
   // version control files exist as part of some settling handling.
@@ -79,13 +142,60 @@ class QueryableView : public std::enable_shared_from_this<QueryableView> {
    * Request that helper threads wake up and re-evaluate their state.
    */
   virtual void wakeThreads() {}
+  /**
+   * Called when the watcher has lost events, to bring the view back in
+   * sync by rescanning only what changed after lastGood, the time of the
+   * last event that the watcher knows it delivered.  Returns false if the
+   * view can't do that, and the caller should schedule a recrawl instead.
+   */
+  virtual bool resyncFrom(
+      std::chrono::system_clock::time_point /*lastGood*/) {
+    return false;
+  }
 
   virtual const w_string& getName() const = 0;
   virtual json_ref getWatcherDebugInfo() const = 0;
   virtual void clearWatcherDebugInfo() = 0;
+
+  // Describes how the view chooses its settle period, for debug-status.
+  // Returns null for views that leave settling to something else.
+  virtual json_ref getSettleStatus() const {
+    return json_null();
+  }
+
+  // Describes the memory held by the view, for debug-memory and
+  // debug-status.  Returns null for views that don't keep the tree in
+  // memory.
+  virtual json_ref getMemoryUsage() const {
+    return json_null();
+  }
+
+  // How big the tree was when it was last crawled, for the saved state.
+  // Returns nullopt for views that don't crawl, or that haven't yet and
+  // weren't given hints from an earlier crawl.
+  virtual std::optional<TreeSizeHints> getTreeSizeHints() const {
+    return std::nullopt;
+  }
   FOLLY_NODISCARD virtual folly::SemiFuture<folly::Unit>
   waitUntilReadyToQuery() = 0;
 
+  /**
+   * Returns a SemiFuture that completes once the view holds everything at
+   * and below each of the full paths in `dirs`.  Only views that can answer
+   * queries before their initial crawl has finished need to override this.
+   */
+  FOLLY_NODISCARD virtual folly::SemiFuture<folly::Unit> waitForCrawl(
+      std::vector<w_string> /*dirs*/) {
+    return folly::makeSemiFuture();
+  }
+
+  // Brings back whatever the view has paged out that a query confined to
+  // the full paths in `dirs`, and to changes since `since`, may need to
+  // see.  Only views that page parts of the tree out need to override this.
+  virtual void pageInForQuery(
+      const std::vector<w_string>& /*dirs*/,
+      const QuerySince& /*since*/) {}
+
   // Return the SCM detected for this watched root
   virtual SCM* getSCM() const = 0;
 };
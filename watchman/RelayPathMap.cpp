@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/RelayPathMap.h"
+#include <algorithm>
+#include <stdexcept>
+#include "watchman/Errors.h"
+
+namespace watchman {
+
+namespace {
+
+// Returns path with the dir `from` that it is in, or is, replaced by `to`
+std::optional<w_string>
+replaceDir(w_string_piece path, const w_string& from, const w_string& to) {
+  if (!path.startsWith(from.piece())) {
+    return std::nullopt;
+  }
+  if (path.size() == from.size()) {
+    return to;
+  }
+  if (!is_slash(path[from.size()])) {
+    return std::nullopt;
+  }
+  path.advance(from.size() + 1);
+  return w_string::pathCat({to, path});
+}
+
+w_string_piece withoutTrailingSlash(w_string_piece dir) {
+  while (dir.size() > 1 && is_slash(dir[dir.size() - 1])) {
+    dir = w_string_piece(dir.data(), dir.size() - 1);
+  }
+  return dir;
+}
+
+} // namespace
+
+RelayPathMap::RelayPathMap(const json_ref& mapping) {
+  if (!mapping.isObject()) {
+    throw std::domain_error("relay_path_map must be an object");
+  }
+  for (auto& it : mapping.object()) {
+    if (!it.second.isString() ||
+        !w_is_path_absolute_cstr(it.first.c_str()) ||
+        !w_is_path_absolute_cstr(json_string_value(it.second))) {
+      throw std::domain_error(
+          "relay_path_map must map absolute paths to absolute paths");
+    }
+    dirs_.emplace_back(
+        withoutTrailingSlash(it.first.piece()).asWString(),
+        withoutTrailingSlash(json_to_w_string(it.second).piece())
+            .asWString());
+  }
+  // So that a dir mapped inside another is matched in preference to it
+  std::sort(dirs_.begin(), dirs_.end(), [](const auto& a, const auto& b) {
+    return a.first.size() > b.first.size();
+  });
+}
+
+std::optional<w_string> RelayPathMap::toUpstream(w_string_piece path) const {
+  for (auto& [local, upstream] : dirs_) {
+    if (auto translated = replaceDir(path, local, upstream)) {
+      return translated;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<w_string> RelayPathMap::toLocal(w_string_piece path) const {
+  // Where upstream dirs overlap, the longest local dir isn't necessarily
+  // the best match, so look for the longest upstream dir
+  const std::pair<w_string, w_string>* best = nullptr;
+  for (auto& dir : dirs_) {
+    if (replaceDir(path, dir.second, dir.first) &&
+        (!best || dir.second.size() > best->second.size())) {
+      best = &dir;
+    }
+  }
+  if (!best) {
+    return std::nullopt;
+  }
+  return replaceDir(path, best->second, best->first);
+}
+
+void RelayPathMap::translateRequest(json_ref& request) const {
+  if (!request.isArray() || request.array().size() < 2) {
+    return;
+  }
+  auto& root = request.array()[1];
+  if (!root.isString() || !w_is_path_absolute_cstr(json_string_value(root))) {
+    return;
+  }
+  auto translated = toUpstream(json_to_w_string(root));
+  if (!translated) {
+    throw CommandValidationError(
+        json_string_value(root),
+        " is not beneath any of the dirs of relay_path_map");
+  }
+  root = w_string_to_json(*translated);
+}
+
+void RelayPathMap::translateResponse(json_ref& response) const {
+  if (!response.isObject()) {
+    return;
+  }
+  for (auto key : {"watch", "root"}) {
+    auto value = response.get_default(key);
+    if (value && value.isString()) {
+      if (auto translated = toLocal(json_to_w_string(value))) {
+        response.set(key, w_string_to_json(*translated));
+      }
+    }
+  }
+  auto roots = response.get_default("roots");
+  if (roots && roots.isArray()) {
+    auto visible = json_array();
+    for (auto& root : roots.array()) {
+      if (!root.isString()) {
+        continue;
+      }
+      if (auto translated = toLocal(json_to_w_string(root))) {
+        visible.array().push_back(w_string_to_json(*translated));
+      }
+    }
+    response.set("roots", std::move(visible));
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <optional>
+#include <utility>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Translates between the paths that the clients of a relay see and the
+ * paths that the daemon it relays to sees, such as those of a checkout
+ * that is bind-mounted into a container from the host.
+ */
+class RelayPathMap {
+ public:
+  RelayPathMap() = default;
+
+  /**
+   * mapping is an object whose keys are dirs as the relay's clients see
+   * them, and whose values are the same dirs as the daemon sees them.
+   * Throws std::domain_error if it is anything else.
+   */
+  explicit RelayPathMap(const json_ref& mapping);
+
+  // Returns path as the daemon sees it, or nullopt if it is beneath none
+  // of the mapped dirs.
+  std::optional<w_string> toUpstream(w_string_piece path) const;
+  // Returns path as the relay's clients see it, or nullopt if it is
+  // beneath none of the mapped dirs.
+  std::optional<w_string> toLocal(w_string_piece path) const;
+
+  /**
+   * Translates the root that a request names as its second element, when
+   * that is an absolute path.  Throws CommandValidationError if the path
+   * is beneath none of the mapped dirs, as the daemon can't see it.
+   */
+  void translateRequest(json_ref& request) const;
+
+  /**
+   * Translates the roots that a response or a unilateral PDU names.  The
+   * roots that the relay's clients can't see are left out of lists of
+   * them, such as that of watch-list.
+   */
+  void translateResponse(json_ref& response) const;
+
+ private:
+  // Pairs of the local and upstream dirs, longest local dir first
+  std::vector<std::pair<w_string, w_string>> dirs_;
+};
+
+} // namespace watchman
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SettleController.h"
+#include <algorithm>
+#include <cmath>
+
+namespace watchman {
+
+void SettleController::setOptions(const Options& options) {
+  options_ = options;
+  options_.minSettle =
+      std::max(options_.minSettle, std::chrono::milliseconds{1});
+  options_.maxSettle = std::max(options_.maxSettle, options_.minSettle);
+}
+
+void SettleController::recordBatch(
+    uint32_t items,
+    std::chrono::steady_clock::time_point now) {
+  if (lastBatch_) {
+    std::chrono::duration<double> elapsed = now - *lastBatch_;
+    std::chrono::duration<double> window = kRateWindow;
+    decayedCount_ *=
+        std::exp(-std::max(0.0, elapsed.count()) / window.count());
+  }
+  decayedCount_ += items;
+  rate_ = decayedCount_ /
+      std::chrono::duration<double>(kRateWindow).count();
+  lastBatch_ = now;
+  ++batches_;
+  items_ += items;
+}
+
+std::chrono::milliseconds SettleController::settleFor(
+    std::chrono::milliseconds fixed) {
+  if (!options_.adaptive) {
+    lastSettle_ = fixed;
+    return fixed;
+  }
+
+  // Interpolate on a log scale, since the rates of interest span orders
+  // of magnitude
+  double position = 0;
+  if (rate_ > kInteractiveRate) {
+    position = std::min(
+        1.0, std::log(rate_ / kInteractiveRate) /
+            std::log(kBulkRate / kInteractiveRate));
+  }
+  double minMs = double(options_.minSettle.count());
+  double maxMs = double(options_.maxSettle.count());
+  lastSettle_ = std::chrono::milliseconds{
+      int64_t(std::lround(minMs * std::pow(maxMs / minMs, position)))};
+  return lastSettle_;
+}
+
+json_ref SettleController::getStatus() const {
+  return json_object({
+      {"adaptive", json_boolean(options_.adaptive)},
+      {"settle_ms", json_integer(lastSettle_.count())},
+      {"min_settle_ms", json_integer(options_.minSettle.count())},
+      {"max_settle_ms", json_integer(options_.maxSettle.count())},
+      {"events_per_second", json_real(rate_)},
+      {"batches", json_integer(batches_)},
+      {"events", json_integer(items_)},
+  });
+}
+
+} // namespace watchman
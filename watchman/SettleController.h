@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+/**
+ * Picks how long the IO thread waits for the watcher to go quiet before
+ * it considers a root settled, based on how quickly changes have been
+ * arriving.
+ *
+ * A trickle of changes, such as someone saving files in an editor, gets a
+ * short settle period so that subscribers hear about it promptly.  A flood
+ * of changes, such as a rebase or a build, gets a longer one, so that
+ * subscribers are not dispatched over and over against a tree that is
+ * still changing underneath them.
+ *
+ * Only the IO thread records batches, but the status may be read from any
+ * thread, so the owner is expected to synchronize access.
+ */
+class SettleController {
+ public:
+  struct Options {
+    // When false, settleFor always returns the fixed settle period
+    bool adaptive{false};
+    std::chrono::milliseconds minSettle{5};
+    std::chrono::milliseconds maxSettle{500};
+  };
+
+  // Below this many changes per second the minimum settle period is used
+  static constexpr double kInteractiveRate = 100;
+  // At and above this many changes per second the maximum is used
+  static constexpr double kBulkRate = 10000;
+  // Changes older than about this much are forgotten
+  static constexpr std::chrono::milliseconds kRateWindow{1000};
+
+  void setOptions(const Options& options);
+
+  // Records that the IO thread has taken a batch of `items` changes from
+  // the watcher at time now.
+  void recordBatch(
+      uint32_t items,
+      std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now());
+
+  // Returns the settle period to wait for; fixed is the root's `settle`
+  // configuration, used when the controller is not adaptive.
+  std::chrono::milliseconds settleFor(std::chrono::milliseconds fixed);
+
+  // The estimated number of changes per second
+  double getRate() const {
+    return rate_;
+  }
+
+  json_ref getStatus() const;
+
+ private:
+  Options options_;
+  // Recent changes, each weighted by how long ago it was recorded
+  double decayedCount_{0};
+  double rate_{0};
+  std::optional<std::chrono::steady_clock::time_point> lastBatch_;
+  uint64_t batches_{0};
+  uint64_t items_{0};
+  std::chrono::milliseconds lastSettle_{0};
+};
+
+} // namespace watchman
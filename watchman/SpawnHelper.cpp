@@ -0,0 +1,630 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SpawnHelper.h"
+#ifndef _WIN32
+#include <dirent.h>
+#include <fcntl.h>
+#include <folly/String.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include "watchman/Logging.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+namespace {
+
+// More than any ChildProcess arranges for its children
+constexpr size_t kMaxPassedFds = 32;
+
+// The helper sends fixed size replies of these kinds
+enum ReplyKind : int32_t { kSpawned = 1, kExited = 2 };
+struct Reply {
+  int32_t kind;
+  int32_t pid;
+  // The posix_spawnp result for kSpawned, the wait status for kExited
+  int32_t value;
+};
+
+SpawnHelper* helper = nullptr;
+
+// The request is sent as a length prefixed buffer of 32 bit integers and
+// length prefixed strings
+class Encoder {
+ public:
+  void i32(int32_t value) {
+    buf_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  void str(const std::string& value) {
+    i32(int32_t(value.size()));
+    buf_.append(value);
+  }
+
+  void strs(const std::vector<std::string>& values) {
+    i32(int32_t(values.size()));
+    for (auto& value : values) {
+      str(value);
+    }
+  }
+
+  const std::string& buffer() const {
+    return buf_;
+  }
+
+ private:
+  std::string buf_;
+};
+
+class Decoder {
+ public:
+  explicit Decoder(const std::string& buf) : buf_(buf) {}
+
+  int32_t i32() {
+    int32_t value;
+    need(sizeof(value));
+    memcpy(&value, buf_.data() + pos_, sizeof(value));
+    pos_ += sizeof(value);
+    return value;
+  }
+
+  std::string str() {
+    auto len = size(i32());
+    need(len);
+    std::string value(buf_.data() + pos_, len);
+    pos_ += len;
+    return value;
+  }
+
+  std::vector<std::string> strs() {
+    std::vector<std::string> values(size(i32()));
+    for (auto& value : values) {
+      value = str();
+    }
+    return values;
+  }
+
+ private:
+  size_t size(int32_t len) {
+    if (len < 0) {
+      throw std::runtime_error("malformed spawn request");
+    }
+    return size_t(len);
+  }
+
+  void need(size_t len) {
+    if (buf_.size() - pos_ < len) {
+      throw std::runtime_error("truncated spawn request");
+    }
+  }
+
+  const std::string& buf_;
+  size_t pos_{0};
+};
+
+bool writeAll(int fd, const void* data, size_t size) {
+  auto buf = static_cast<const char*>(data);
+  while (size > 0) {
+    auto wrote = ::write(fd, buf, size);
+    if (wrote < 0 && errno == EINTR) {
+      continue;
+    }
+    if (wrote <= 0) {
+      return false;
+    }
+    buf += wrote;
+    size -= size_t(wrote);
+  }
+  return true;
+}
+
+bool readAll(int fd, void* data, size_t size) {
+  auto buf = static_cast<char*>(data);
+  while (size > 0) {
+    auto got = ::read(fd, buf, size);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      return false;
+    }
+    buf += got;
+    size -= size_t(got);
+  }
+  return true;
+}
+
+// Encodes req, replacing the descriptor numbers of the dup2 actions with
+// indices into fds, which holds the descriptors to pass along
+std::string encodeRequest(const SpawnRequest& req, std::vector<int>& fds) {
+  Encoder enc;
+  enc.strs(req.argv);
+  enc.strs(req.envp);
+  enc.i32(int32_t(req.actions.size()));
+  for (auto& action : req.actions) {
+    int32_t source = -1;
+    if (action.kind == SpawnRequest::FileAction::Dup2) {
+      auto it = std::find(fds.begin(), fds.end(), action.sourceFd);
+      source = int32_t(it - fds.begin());
+      if (it == fds.end()) {
+        fds.push_back(action.sourceFd);
+      }
+    }
+    enc.i32(action.kind);
+    enc.i32(source);
+    enc.i32(action.targetFd);
+    enc.str(action.path);
+    enc.i32(action.oflag);
+    enc.i32(action.mode);
+  }
+  enc.i32(req.flags);
+  std::vector<int32_t> blocked;
+  if (req.sigMask) {
+    for (int sig = 1; sig < NSIG; ++sig) {
+      if (sigismember(&*req.sigMask, sig) == 1) {
+        blocked.push_back(sig);
+      }
+    }
+  }
+  enc.i32(req.sigMask ? 1 : 0);
+  enc.i32(int32_t(blocked.size()));
+  for (auto sig : blocked) {
+    enc.i32(sig);
+  }
+  return enc.buffer();
+}
+
+SpawnRequest decodeRequest(const std::string& buf) {
+  Decoder dec(buf);
+  SpawnRequest req;
+  req.argv = dec.strs();
+  req.envp = dec.strs();
+  req.actions.resize(size_t(std::max(0, dec.i32())));
+  for (auto& action : req.actions) {
+    action.kind = SpawnRequest::FileAction::Kind(dec.i32());
+    action.sourceFd = dec.i32();
+    action.targetFd = dec.i32();
+    action.path = dec.str();
+    action.oflag = dec.i32();
+    action.mode = dec.i32();
+  }
+  req.flags = short(dec.i32());
+  bool hasMask = dec.i32() != 0;
+  auto numBlocked = dec.i32();
+  if (hasMask) {
+    req.sigMask.emplace();
+    sigemptyset(&*req.sigMask);
+  }
+  for (int32_t i = 0; i < numBlocked; ++i) {
+    auto sig = dec.i32();
+    if (req.sigMask) {
+      sigaddset(&*req.sigMask, sig);
+    }
+  }
+  if (req.argv.empty()) {
+    throw std::runtime_error("spawn request has no argv");
+  }
+  return req;
+}
+
+// Reads a request, and the descriptors passed along with it.  Returns
+// false when the service has gone away.
+bool receiveRequest(int sock, std::string& buf, std::vector<int>& fds) {
+  uint32_t len;
+  struct iovec iov {
+    &len, sizeof(len)
+  };
+  union {
+    struct cmsghdr hdr;
+    char data[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  } control{};
+  struct msghdr msg {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data;
+  msg.msg_controllen = sizeof(control.data);
+
+  ssize_t got;
+  do {
+    got = ::recvmsg(
+        sock,
+        &msg,
+#ifdef MSG_CMSG_CLOEXEC
+        MSG_CMSG_CLOEXEC
+#else
+        0
+#endif
+    );
+  } while (got < 0 && errno == EINTR);
+  if (got <= 0) {
+    return false;
+  }
+
+  fds.clear();
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+      continue;
+    }
+    auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (size_t i = 0; i < count; ++i) {
+      int fd;
+      memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+#ifndef MSG_CMSG_CLOEXEC
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+      fds.push_back(fd);
+    }
+  }
+
+  if (size_t(got) < sizeof(len) &&
+      !readAll(sock, (char*)&len + got, sizeof(len) - size_t(got))) {
+    return false;
+  }
+  buf.resize(len);
+  return readAll(sock, &buf[0], len);
+}
+
+// Spawns the child described by req in the helper, returning the
+// posix_spawnp result
+int spawnRequest(
+    const SpawnRequest& req,
+    const std::vector<int>& fds,
+    const sigset_t& defaultMask,
+    pid_t* pid) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawnattr_init(&attr);
+
+  int err = 0;
+  std::string cwd;
+  for (auto& action : req.actions) {
+    switch (action.kind) {
+      case SpawnRequest::FileAction::Dup2:
+        if (action.sourceFd < 0 || size_t(action.sourceFd) >= fds.size()) {
+          err = EBADF;
+          break;
+        }
+        err = posix_spawn_file_actions_adddup2(
+            &actions, fds[action.sourceFd], action.targetFd);
+        break;
+      case SpawnRequest::FileAction::Open:
+        err = posix_spawn_file_actions_addopen(
+            &actions,
+            action.targetFd,
+            action.path.c_str(),
+            action.oflag,
+            action.mode);
+        break;
+      case SpawnRequest::FileAction::Chdir:
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+        err = posix_spawn_file_actions_addchdir_np(
+            &actions, action.path.c_str());
+#else
+        cwd = action.path;
+#endif
+        break;
+      default:
+        err = EINVAL;
+    }
+    if (err) {
+      break;
+    }
+  }
+
+  // Nothing else runs in the helper, so it can change its own directory
+  // for the child without any locking
+  char savedCwd[WATCHMAN_NAME_MAX];
+  if (!err && !cwd.empty()) {
+    if (!getcwd(savedCwd, sizeof(savedCwd)) || chdir(cwd.c_str()) != 0) {
+      err = errno;
+      cwd.clear();
+    }
+  }
+
+  if (!err) {
+    posix_spawnattr_setsigmask(
+        &attr, req.sigMask ? &*req.sigMask : &defaultMask);
+    err = posix_spawnattr_setflags(
+        &attr, short(req.flags | POSIX_SPAWN_SETSIGMASK));
+  }
+
+  if (!err) {
+    std::vector<char*> argv;
+    for (auto& arg : req.argv) {
+      argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    std::vector<char*> envp;
+    for (auto& env : req.envp) {
+      envp.push_back(const_cast<char*>(env.c_str()));
+    }
+    envp.push_back(nullptr);
+    err = posix_spawnp(pid, argv[0], &actions, &attr, &argv[0], &envp[0]);
+  }
+
+  if (!cwd.empty()) {
+    ignore_result(chdir(savedCwd));
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  return err;
+}
+
+int childExitedPipe[2] = {-1, -1};
+
+void onChildExited(int) {
+  auto savedErrno = errno;
+  char byte = 0;
+  ignore_result(::write(childExitedPipe[1], &byte, 1));
+  errno = savedErrno;
+}
+
+// Closes everything that the service had open when the helper was forked,
+// such as its pidfile lock, so that the helper doesn't keep them alive
+void closeInheritedDescriptors(int keep) {
+  std::vector<int> fds;
+  auto dir = opendir("/dev/fd");
+  if (!dir) {
+    return;
+  }
+  while (auto ent = readdir(dir)) {
+    char* end;
+    auto fd = strtol(ent->d_name, &end, 10);
+    if (*end == '\0' && end != ent->d_name && fd > STDERR_FILENO &&
+        fd != keep && fd != dirfd(dir)) {
+      fds.push_back(int(fd));
+    }
+  }
+  closedir(dir);
+  for (auto fd : fds) {
+    ::close(fd);
+  }
+}
+
+[[noreturn]] void serve(int sock) {
+  closeInheritedDescriptors(sock);
+
+  // Children inherit the signal mask that the service had, unless their
+  // request says otherwise
+  sigset_t defaultMask;
+  sigprocmask(SIG_SETMASK, nullptr, &defaultMask);
+
+  if (::pipe(childExitedPipe) != 0) {
+    _exit(1);
+  }
+  for (auto fd : childExitedPipe) {
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+  struct sigaction sa {};
+  sa.sa_handler = onChildExited;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, nullptr);
+  sigset_t chld;
+  sigemptyset(&chld);
+  sigaddset(&chld, SIGCHLD);
+  sigprocmask(SIG_UNBLOCK, &chld, nullptr);
+
+  std::string buf;
+  std::vector<int> fds;
+  while (true) {
+    struct pollfd pfds[2] = {
+        {sock, POLLIN, 0}, {childExitedPipe[0], POLLIN, 0}};
+    if (::poll(pfds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      _exit(1);
+    }
+
+    if (pfds[1].revents & POLLIN) {
+      char drain[64];
+      while (::read(childExitedPipe[0], drain, sizeof(drain)) > 0) {
+        ;
+      }
+      int status;
+      pid_t pid;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        Reply reply{kExited, pid, status};
+        if (!writeAll(sock, &reply, sizeof(reply))) {
+          _exit(0);
+        }
+      }
+    }
+
+    if (pfds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      if (!receiveRequest(sock, buf, fds)) {
+        // The service has exited
+        _exit(0);
+      }
+      Reply reply{kSpawned, 0, 0};
+      try {
+        auto req = decodeRequest(buf);
+        pid_t pid = 0;
+        reply.value = spawnRequest(req, fds, defaultMask, &pid);
+        reply.pid = pid;
+      } catch (const std::exception&) {
+        reply.value = EINVAL;
+      }
+      for (auto fd : fds) {
+        ::close(fd);
+      }
+      if (!writeAll(sock, &reply, sizeof(reply))) {
+        _exit(0);
+      }
+    }
+  }
+}
+
+} // namespace
+
+void SpawnHelper::start() {
+  if (helper) {
+    return;
+  }
+
+  SocketPair pair;
+  pair.read.clearNonBlock();
+  pair.write.clearNonBlock();
+
+  auto pid = fork();
+  if (pid < 0) {
+    log(ERR, "failed to fork the spawn helper: ", folly::errnoStr(errno), "\n");
+    return;
+  }
+  if (pid == 0) {
+    w_set_thread_name("spawn-helper");
+    serve(pair.write.fd());
+  }
+
+  pair.write.close();
+  log(DBG, "spawn helper is pid ", pid, "\n");
+  helper = new SpawnHelper(std::move(pair.read));
+}
+
+SpawnHelper* SpawnHelper::get() {
+  return helper;
+}
+
+SpawnHelper::SpawnHelper(FileDescriptor sock) : sock_(std::move(sock)) {
+  std::thread([this] {
+    w_set_thread_name("spawn-replies");
+    readReplies();
+  }).detach();
+}
+
+void SpawnHelper::readReplies() {
+  Reply reply;
+  while (readAll(sock_.fd(), &reply, sizeof(reply))) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (reply.kind == kSpawned) {
+      spawnReply_ = std::make_pair(pid_t(reply.pid), int(reply.value));
+    } else if (disowned_.erase(reply.pid) == 0) {
+      exited_[reply.pid] = reply.value;
+    }
+    cond_.notify_all();
+  }
+
+  log(ERR, "the spawn helper has exited; spawning children directly\n");
+  std::unique_lock<std::mutex> lock(mutex_);
+  dead_ = true;
+  cond_.notify_all();
+}
+
+bool SpawnHelper::spawn(const SpawnRequest& req, pid_t* pid, int* err) {
+  std::vector<int> fds;
+  auto body = encodeRequest(req, fds);
+  if (fds.size() > kMaxPassedFds) {
+    return false;
+  }
+
+  std::unique_lock<std::mutex> requestLock(requestMutex_);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (dead_) {
+      return false;
+    }
+  }
+
+  uint32_t len = uint32_t(body.size());
+  struct iovec iov {
+    &len, sizeof(len)
+  };
+  union {
+    struct cmsghdr hdr;
+    char data[CMSG_SPACE(sizeof(int) * kMaxPassedFds)];
+  } control{};
+  struct msghdr msg {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (!fds.empty()) {
+    msg.msg_control = control.data;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+  }
+
+  ssize_t sent;
+  do {
+    sent = ::sendmsg(sock_.fd(), &msg, 0);
+  } while (sent < 0 && errno == EINTR);
+  // Once the length and the descriptors are sent, we're committed to the
+  // rest of the request
+  if (sent <= 0) {
+    return false;
+  }
+  if ((size_t(sent) < sizeof(len) &&
+       !writeAll(
+           sock_.fd(), (char*)&len + sent, sizeof(len) - size_t(sent))) ||
+      !writeAll(sock_.fd(), body.data(), body.size())) {
+    throw std::system_error(
+        errno, std::generic_category(), "sending to the spawn helper");
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [&] { return spawnReply_.has_value() || dead_; });
+  if (!spawnReply_) {
+    throw std::system_error(
+        EPIPE, std::generic_category(), "the spawn helper has exited");
+  }
+  *pid = spawnReply_->first;
+  *err = spawnReply_->second;
+  spawnReply_.reset();
+  return true;
+}
+
+bool SpawnHelper::poll(pid_t pid, int* status) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto it = exited_.find(pid);
+  if (it == exited_.end()) {
+    if (dead_) {
+      // We'll never know
+      *status = -1;
+      return true;
+    }
+    return false;
+  }
+  *status = it->second;
+  exited_.erase(it);
+  return true;
+}
+
+int SpawnHelper::wait(pid_t pid) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [&] { return exited_.count(pid) || dead_; });
+  auto it = exited_.find(pid);
+  if (it == exited_.end()) {
+    throw std::system_error(
+        ECHILD, std::generic_category(), "the spawn helper has exited");
+  }
+  auto status = it->second;
+  exited_.erase(it);
+  return status;
+}
+
+void SpawnHelper::disown(pid_t pid) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (exited_.erase(pid) == 0 && !dead_) {
+    disowned_.insert(pid);
+  }
+}
+
+} // namespace watchman
+#endif
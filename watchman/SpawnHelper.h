@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/types.h>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "watchman/fs/FileDescriptor.h"
+
+namespace watchman {
+
+// A description of a child process to spawn, in a form that another
+// process can replay: it refers to descriptors by number rather than
+// holding posix_spawn state.
+struct SpawnRequest {
+  struct FileAction {
+    enum Kind { Dup2, Open, Chdir };
+    Kind kind;
+    int sourceFd{-1};
+    int targetFd{-1};
+    std::string path;
+    int oflag{0};
+    int mode{0};
+  };
+
+  std::vector<std::string> argv;
+  std::vector<std::string> envp;
+  std::vector<FileAction> actions;
+  short flags{0};
+  std::optional<sigset_t> sigMask;
+};
+
+/**
+ * A small process, forked from the service before it has started any
+ * threads or built any views, that spawns child processes on the service's
+ * behalf.  However large the service grows, the cost of spawning stays
+ * that of spawning from the helper.
+ *
+ * The service sends each SpawnRequest over a unix socket, passing the
+ * descriptors that the child should inherit with SCM_RIGHTS.  The helper
+ * replies with the pid of the child and later with its exit status, since
+ * only the helper can wait for it.
+ */
+class SpawnHelper {
+ public:
+  // Forks the helper.  Must be called before the service starts any other
+  // threads.  Failure is logged and leaves children spawned by the service.
+  static void start();
+
+  // Returns the helper, or nullptr if it isn't running
+  static SpawnHelper* get();
+
+  // Has the helper spawn a child.  Returns false if the helper can't take
+  // the request, in which case the caller should spawn the child itself.
+  // Otherwise sets *err to the posix_spawnp result and, on success, *pid.
+  bool spawn(const SpawnRequest& req, pid_t* pid, int* err);
+
+  // Returns true, setting *status, if the child has exited.  If the helper
+  // went away first, the child is reported as exited with a status of -1.
+  bool poll(pid_t pid, int* status);
+
+  // Blocks until the child has exited, and returns its status.  Throws
+  // if the helper went away before it could report the status.
+  int wait(pid_t pid);
+
+  // Forgets about the child; its exit status is discarded
+  void disown(pid_t pid);
+
+ private:
+  explicit SpawnHelper(FileDescriptor sock);
+  void readReplies();
+
+  FileDescriptor sock_;
+
+  // Serializes requests, so that the helper answers them in order
+  std::mutex requestMutex_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool dead_{false};
+  std::optional<std::pair<pid_t, int>> spawnReply_;
+  std::unordered_map<pid_t, int> exited_;
+  std::unordered_set<pid_t> disowned_;
+};
+
+} // namespace watchman
+#endif
@@ -38,7 +38,7 @@ struct hash<watchman::SymlinkTargetCacheKey> {
 namespace watchman {
 class SymlinkTargetCache {
  public:
-  using Node = LRUCache<SymlinkTargetCacheKey, w_string>::NodeType;
+  using Node = ShardedLRUCache<SymlinkTargetCacheKey, w_string>::NodeType;
 
   // Construct a cache for a given root, holding the specified
   // maximum number of items, using the configured negative
@@ -72,7 +72,7 @@ class SymlinkTargetCache {
   CacheStats stats() const;
 
  private:
-  LRUCache<SymlinkTargetCacheKey, w_string> cache_;
+  ShardedLRUCache<SymlinkTargetCacheKey, w_string> cache_;
   w_string rootPath_;
 };
 } // namespace watchman
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SyncFreshness.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace watchman {
+
+std::shared_ptr<SyncFreshness::Sync> SyncFreshness::start() {
+  auto sync = std::make_shared<Sync>();
+  sync->started = Clock::now();
+  auto state = state_.lock();
+  sync->generation = state->generation;
+  state->inFlight.push_back(sync);
+  return sync;
+}
+
+void SyncFreshness::finish(const std::shared_ptr<Sync>& sync, bool succeeded) {
+  {
+    auto state = state_.lock();
+    auto& inFlight = state->inFlight;
+    inFlight.erase(
+        std::remove(inFlight.begin(), inFlight.end(), sync), inFlight.end());
+    // A sync that straddled an invalidation may be missing changes
+    if (succeeded && sync->generation == state->generation &&
+        (!state->lastSynced || *state->lastSynced < sync->started)) {
+      state->lastSynced = sync->started;
+    }
+  }
+
+  // Outside of the lock, as the waiters may sync again
+  if (succeeded) {
+    sync->promise.setValue();
+  } else {
+    sync->promise.setException(
+        folly::make_exception_wrapper<std::runtime_error>(
+            "the sync that this query waited for failed"));
+  }
+}
+
+std::optional<SyncFreshness::Reuse> SyncFreshness::reuse(
+    Clock::duration maxStaleness) {
+  auto now = Clock::now();
+  auto state = state_.lock();
+  if (state->lastSynced && now - *state->lastSynced <= maxStaleness) {
+    return Reuse{now - *state->lastSynced, folly::makeSemiFuture()};
+  }
+  for (auto& sync : state->inFlight) {
+    if (sync->generation == state->generation &&
+        now - sync->started <= maxStaleness) {
+      return Reuse{now - sync->started, sync->promise.getSemiFuture()};
+    }
+  }
+  return std::nullopt;
+}
+
+void SyncFreshness::invalidate() {
+  auto state = state_.lock();
+  state->lastSynced.reset();
+  ++state->generation;
+}
+
+} // namespace watchman
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Remembers when the full syncs of a root started, so that a query that can
+ * tolerate results that are slightly out of date can do without a sync of
+ * its own.
+ *
+ * A sync that succeeds guarantees that the view reflects every change made
+ * before it started, so once it completes, the view is only as stale as
+ * the time since then.  A query may instead wait for a sync that is already
+ * in flight, as long as that started recently enough, which costs it the
+ * remainder of that sync rather than a whole round trip of its own.
+ */
+class SyncFreshness {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Sync {
+    Clock::time_point started;
+    // Of the freshness that was current when the sync started
+    uint64_t generation;
+    folly::SharedPromise<folly::Unit> promise;
+  };
+
+  struct Reuse {
+    // How far behind the view is, as of the call to reuse(), once ready
+    // has completed
+    Clock::duration staleness;
+    // Already complete if a finished sync was recent enough; otherwise
+    // completes along with the sync in flight that was, and fails if it
+    // does.
+    folly::SemiFuture<folly::Unit> ready;
+  };
+
+  // Registers a full sync that starts now, which must then be passed to
+  // finish().
+  std::shared_ptr<Sync> start();
+
+  // Records whether sync succeeded, and completes the queries waiting on
+  // it.
+  void finish(const std::shared_ptr<Sync>& sync, bool succeeded);
+
+  // Returns how a caller can see a view that is at most maxStaleness behind
+  // without syncing, or nullopt if it must sync.  Of the syncs in flight,
+  // the one that started first is chosen, as it is likely to finish first.
+  std::optional<Reuse> reuse(Clock::duration maxStaleness);
+
+  // Forgets every sync made so far, including those still in flight, such
+  // as when the watcher may have missed changes that they would have
+  // waited for.
+  void invalidate();
+
+ private:
+  struct State {
+    // When the most recent of the syncs that succeeded started
+    std::optional<Clock::time_point> lastSynced;
+    uint64_t generation{0};
+    // In the order that they started
+    std::vector<std::shared_ptr<Sync>> inFlight;
+  };
+  folly::Synchronized<State, std::mutex> state_;
+};
+
+} // namespace watchman
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <folly/Synchronized.h>
+#include <folly/ThreadLocal.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Fixed-size ring buffer for the event logs that are written from hot
+ * paths, such as those of the watchers and of the IO thread.
+ *
+ * Each thread that writes gets a ring of its own, so a write never waits
+ * for another: it is a copy of the entry into the thread's next slot and
+ * a relaxed increment of the shared sequence number.  Readers copy the
+ * entries out of every ring, dropping any that a writer overwrites while
+ * they do so, and merge them by sequence number.
+ *
+ * As the entries are copied while they may be being overwritten, they
+ * must be fixed-size records that are trivially copyable.  The rings of
+ * threads that have exited are kept, along with their entries.
+ */
+template <typename T>
+class ThreadLocalRingBuffer {
+  static_assert(
+      std::is_trivially_copyable_v<T>,
+      "entries are copied without synchronizing with their writer");
+
+ public:
+  /**
+   * Each thread keeps its most recent capacity entries, and readAll()
+   * returns the most recent capacity entries of them all.
+   */
+  explicit ThreadLocalRingBuffer(uint32_t capacity)
+      : capacity_{std::max<uint32_t>(1, capacity)} {}
+
+  void clear() {
+    lastClear_.store(
+        nextSequence_.load(std::memory_order_acquire),
+        std::memory_order_release);
+  }
+
+  void write(const T& entry) {
+    auto& ring = localRing();
+    auto sequence = nextSequence_.fetch_add(1, std::memory_order_relaxed) + 1;
+    auto& slot = ring.slots[ring.head++ % capacity_];
+    // Readers skip slots whose sequence is 0, or changes while they copy
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.entry = entry;
+    slot.sequence.store(sequence, std::memory_order_release);
+  }
+
+  std::vector<T> readAll() const {
+    auto lastClear = lastClear_.load(std::memory_order_acquire);
+
+    std::vector<std::pair<uint64_t, T>> sequenced;
+    {
+      auto rings = rings_.rlock();
+      for (auto& ring : *rings) {
+        for (auto& slot : ring->slots) {
+          auto sequence = slot.sequence.load(std::memory_order_acquire);
+          if (sequence <= lastClear) {
+            continue;
+          }
+          T entry = slot.entry;
+          std::atomic_thread_fence(std::memory_order_acquire);
+          if (slot.sequence.load(std::memory_order_relaxed) == sequence) {
+            sequenced.emplace_back(sequence, entry);
+          }
+        }
+      }
+    }
+
+    std::sort(
+        sequenced.begin(), sequenced.end(), [](const auto& a, const auto& b) {
+          return a.first < b.first;
+        });
+    auto begin = sequenced.size() > capacity_
+        ? sequenced.end() - capacity_
+        : sequenced.begin();
+    std::vector<T> entries;
+    entries.reserve(sequenced.end() - begin);
+    for (auto it = begin; it != sequenced.end(); ++it) {
+      entries.push_back(it->second);
+    }
+    return entries;
+  }
+
+ private:
+  ThreadLocalRingBuffer(ThreadLocalRingBuffer&&) = delete;
+  ThreadLocalRingBuffer(const ThreadLocalRingBuffer&) = delete;
+  ThreadLocalRingBuffer& operator=(ThreadLocalRingBuffer&&) = delete;
+  ThreadLocalRingBuffer& operator=(const ThreadLocalRingBuffer&) = delete;
+
+  struct Slot {
+    // 0 while the slot is empty or being written
+    std::atomic<uint64_t> sequence{0};
+    T entry{};
+  };
+
+  struct Ring {
+    explicit Ring(uint32_t capacity) : slots(capacity) {}
+
+    // Only accessed by the thread that writes to the ring
+    uint64_t head{0};
+    std::vector<Slot> slots;
+  };
+
+  Ring& localRing() {
+    auto& ring = *localRing_;
+    if (!ring) {
+      auto owned = std::make_unique<Ring>(capacity_);
+      ring = owned.get();
+      rings_.wlock()->push_back(std::move(owned));
+    }
+    return *ring;
+  }
+
+  const uint32_t capacity_;
+  std::atomic<uint64_t> nextSequence_{0};
+  std::atomic<uint64_t> lastClear_{0};
+  folly::Synchronized<std::vector<std::unique_ptr<Ring>>> rings_;
+  // Points into rings_, which owns the rings
+  folly::ThreadLocal<Ring*> localRing_;
+};
+
+} // namespace watchman
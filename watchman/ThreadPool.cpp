@@ -7,6 +7,7 @@
 
 #include "watchman/ThreadPool.h"
 #include "watchman/Logging.h"
+#include "watchman/ThreadStats.h"
 
 namespace watchman {
 
@@ -15,10 +16,31 @@ ThreadPool& getThreadPool() {
   return pool;
 }
 
+ThreadPool::ThreadPool() {
+  executors_.reserve(kNumPriorities);
+  for (size_t i = 0; i < kNumPriorities; ++i) {
+    executors_.emplace_back(*this, Priority(i));
+  }
+}
+
 ThreadPool::~ThreadPool() {
   stop();
 }
 
+const char* ThreadPool::priorityName(Priority priority) {
+  switch (priority) {
+    case Priority::Interactive:
+      return "interactive";
+    case Priority::Hashing:
+      return "hashing";
+    case Priority::Scm:
+      return "scm";
+    case Priority::Warming:
+      return "warming";
+  }
+  return "unknown";
+}
+
 void ThreadPool::start(size_t numWorkers, size_t maxItems) {
   std::unique_lock<std::mutex> lock(mutex_);
   if (!workers_.empty()) {
@@ -37,21 +59,61 @@ void ThreadPool::start(size_t numWorkers, size_t maxItems) {
   }
 }
 
+void ThreadPool::setConcurrencyLimit(Priority priority, size_t limit) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    queues_[size_t(priority)].limit = limit;
+  }
+  // Raising a limit may have made queued work runnable
+  condition_.notify_all();
+}
+
+ThreadPool::Queue* ThreadPool::nextRunnableQueue() {
+  for (auto& queue : queues_) {
+    if (!queue.tasks.empty() &&
+        (queue.limit == 0 || queue.running < queue.limit)) {
+      return &queue;
+    }
+  }
+  return nullptr;
+}
+
 void ThreadPool::runWorker() {
   while (true) {
     folly::Func task;
+    Queue* queue;
 
     {
       std::unique_lock<std::mutex> lock(mutex_);
-      condition_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
-      if (stopping_ && tasks_.empty()) {
+      {
+        ThreadStats::Wait wait;
+        condition_.wait(lock, [&] {
+          queue = nextRunnableQueue();
+          return queue || (stopping_ && numQueued_ == 0);
+        });
+      }
+      if (!queue) {
         return;
       }
-      task = std::move(tasks_.front());
-      tasks_.pop_front();
+      task = std::move(queue->tasks.front());
+      queue->tasks.pop_front();
+      --numQueued_;
+      ++queue->running;
     }
 
     task();
+    // Release anything the task captured before we account for it
+    task = nullptr;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      --queue->running;
+      if (queue->limit != 0 && !queue->tasks.empty()) {
+        // Another worker may be idle only because this queue was at its
+        // limit, and we may pick something more important ourselves
+        condition_.notify_one();
+      }
+    }
   }
 }
 
@@ -70,18 +132,33 @@ void ThreadPool::stop(bool join) {
 }
 
 void ThreadPool::add(folly::Func func) {
+  add(Priority::Interactive, std::move(func));
+}
+
+void ThreadPool::add(Priority priority, folly::Func func) {
   {
     std::unique_lock<std::mutex> lock(mutex_);
     if (stopping_) {
       throw std::runtime_error("cannot add tasks after pool has stopped");
     }
-    if (tasks_.size() + 1 >= maxItems_) {
+    if (numQueued_ + 1 >= maxItems_) {
       throw std::runtime_error("thread pool queue is full");
     }
 
-    tasks_.emplace_back(std::move(func));
+    queues_[size_t(priority)].tasks.emplace_back(std::move(func));
+    ++numQueued_;
   }
 
   condition_.notify_one();
 }
+
+folly::Executor& ThreadPool::executor(Priority priority) {
+  return executors_[size_t(priority)];
+}
+
+ThreadPool::QueueStats ThreadPool::getQueueStats(Priority priority) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto& queue = queues_[size_t(priority)];
+  return QueueStats{queue.tasks.size(), queue.running};
+}
 } // namespace watchman
@@ -7,6 +7,7 @@
 
 #pragma once
 #include <folly/Executor.h>
+#include <array>
 #include <condition_variable>
 #include <deque>
 #include <mutex>
@@ -24,10 +25,36 @@ namespace watchman {
 // thread pool with an unspecified number of threads.
 // Constraining the concurrency is important for watchman so
 // that we can limit the amount of I/O that we might induce.
+//
+// Tasks are queued by priority class.  Every worker serves every
+// class, always taking from the most important class that has work
+// and is below its concurrency limit, so a large batch of hashing
+// cannot occupy the whole pool and leave queries waiting behind it,
+// yet idle workers still pick up background work when nothing more
+// urgent is queued.
 
 class ThreadPool : public folly::Executor {
  public:
-  ThreadPool() = default;
+  // In order of decreasing importance
+  enum class Priority {
+    // Work that a client is waiting on, such as stat()ing files for a
+    // crawl or resolving symlink targets for a query
+    Interactive,
+    // Computing content hashes
+    Hashing,
+    // Talking to source control
+    Scm,
+    // Speculative work, such as warming the content hash cache
+    Warming,
+  };
+  static constexpr size_t kNumPriorities = 4;
+
+  struct QueueStats {
+    size_t queued{0};
+    size_t running{0};
+  };
+
+  ThreadPool();
   ~ThreadPool() override;
 
   // Start a thread pool with the specified number of worker threads
@@ -39,28 +66,77 @@ class ThreadPool : public folly::Executor {
   // pool.
   void start(size_t numWorkers, size_t maxItems);
 
+  // Limit the number of workers that may run tasks of the given
+  // priority at the same time.  A limit of zero means that the
+  // only limit is the number of workers.
+  void setConcurrencyLimit(Priority priority, size_t limit);
+
   // Request that the worker threads terminate.
   // If `join` is true, wait for the worker threads to terminate.
   void stop(bool join = true);
 
-  // Run a function in the thread pool.
+  // Run a function in the thread pool at Interactive priority.
   // This queues up the function for asynchronous execution and
   // may return before func has been executed.
   // If the thread pool has been stopped, throws a runtime_error.
   void add(folly::Func func) override;
 
+  // As add(func), but at the specified priority.
+  void add(Priority priority, folly::Func func);
+
+  // Returns an executor that adds its tasks to this pool at the
+  // specified priority, for use with folly::via().
+  folly::Executor& executor(Priority priority);
+
+  QueueStats getQueueStats(Priority priority);
+
+  static const char* priorityName(Priority priority);
+
  private:
+  class PriorityExecutor : public folly::Executor {
+   public:
+    PriorityExecutor(ThreadPool& pool, Priority priority)
+        : pool_(pool), priority_(priority) {}
+
+    void add(folly::Func func) override {
+      pool_.add(priority_, std::move(func));
+    }
+
+   private:
+    ThreadPool& pool_;
+    Priority priority_;
+  };
+
+  struct Queue {
+    std::deque<folly::Func> tasks;
+    size_t running{0};
+    size_t limit{0};
+  };
+
   std::vector<std::thread> workers_;
-  std::deque<folly::Func> tasks_;
+  std::array<Queue, kNumPriorities> queues_;
+  std::vector<PriorityExecutor> executors_;
+  size_t numQueued_{0};
 
   std::mutex mutex_;
   std::condition_variable condition_;
   bool stopping_{false};
   size_t maxItems_;
 
+  // Returns the queue that a free worker should take its next task
+  // from, or nullptr if there is nothing that it may run.
+  // Must be called with mutex_ held.
+  Queue* nextRunnableQueue();
+
   void runWorker();
 };
 
 // Return a reference to the shared thread pool for the watchman process.
 ThreadPool& getThreadPool();
+
+// Return an executor that runs tasks in the shared thread pool at
+// the specified priority.
+inline folly::Executor& getThreadPool(ThreadPool::Priority priority) {
+  return getThreadPool().executor(priority);
+}
 } // namespace watchman
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadStats.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <windows.h> // @manual
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+
+namespace watchman {
+
+namespace {
+
+using Usage = ThreadStats::Usage;
+
+#ifdef _WIN32
+std::chrono::nanoseconds cpuOfHandle(HANDLE handle) {
+  FILETIME creation, exit, kernel, user;
+  if (!GetThreadTimes(handle, &creation, &exit, &kernel, &user)) {
+    return std::chrono::nanoseconds(0);
+  }
+  auto ticks = [](const FILETIME& ft) {
+    return (uint64_t(ft.dwHighDateTime) << 32) | ft.dwLowDateTime;
+  };
+  // FILETIME counts in units of 100ns
+  return std::chrono::nanoseconds((ticks(kernel) + ticks(user)) * 100);
+}
+#else
+std::chrono::nanoseconds cpuOfClock(clockid_t clock) {
+  struct timespec ts;
+  if (clock_gettime(clock, &ts) != 0) {
+    return std::chrono::nanoseconds(0);
+  }
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+#endif
+
+// A registered thread, and the means of reading its CPU time from another
+// thread
+struct Thread {
+  std::string name;
+  std::string root;
+  std::atomic<int64_t> waitNanos{0};
+#if defined(_WIN32)
+  HANDLE handle{nullptr};
+#elif defined(__APPLE__)
+  mach_port_t port{MACH_PORT_NULL};
+#else
+  clockid_t clock{CLOCK_THREAD_CPUTIME_ID};
+  bool haveClock{false};
+#endif
+
+  Thread() {
+#if defined(_WIN32)
+    DuplicateHandle(
+        GetCurrentProcess(),
+        GetCurrentThread(),
+        GetCurrentProcess(),
+        &handle,
+        THREAD_QUERY_LIMITED_INFORMATION,
+        FALSE,
+        0);
+#elif defined(__APPLE__)
+    port = pthread_mach_thread_np(pthread_self());
+#else
+    haveClock = pthread_getcpuclockid(pthread_self(), &clock) == 0;
+#endif
+  }
+
+  ~Thread() {
+#ifdef _WIN32
+    if (handle) {
+      CloseHandle(handle);
+    }
+#endif
+  }
+
+  Thread(const Thread&) = delete;
+  Thread& operator=(const Thread&) = delete;
+
+  // Must only be called while the thread is running, which the registry
+  // lock ensures for other threads
+  std::chrono::nanoseconds cpu() const {
+#if defined(_WIN32)
+    return handle ? cpuOfHandle(handle) : std::chrono::nanoseconds(0);
+#elif defined(__APPLE__)
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    if (thread_info(
+            port, THREAD_BASIC_INFO, (thread_info_t)&info, &count) !=
+        KERN_SUCCESS) {
+      return std::chrono::nanoseconds(0);
+    }
+    return std::chrono::seconds(
+               info.user_time.seconds + info.system_time.seconds) +
+        std::chrono::microseconds(
+               info.user_time.microseconds + info.system_time.microseconds);
+#else
+    return haveClock ? cpuOfClock(clock) : std::chrono::nanoseconds(0);
+#endif
+  }
+
+  Usage usage() const {
+    return Usage{cpu(), std::chrono::nanoseconds(waitNanos.load())};
+  }
+};
+
+struct Registry {
+  std::mutex mutex;
+  std::unordered_set<Thread*> live;
+  ThreadStats::Totals exited;
+  std::unordered_map<std::string, ThreadStats::Totals> exitedByRoot;
+};
+
+// Leaked, as threads may still exit after static destructors have run
+Registry& getRegistry() {
+  static auto* registry = new Registry;
+  return *registry;
+}
+
+// Moves the usage of the thread to the exited totals when it exits
+struct Registration {
+  std::unique_ptr<Thread> thread;
+
+  ~Registration() {
+    if (!thread) {
+      return;
+    }
+    auto usage = thread->usage();
+    auto& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.live.erase(thread.get());
+    registry.exited.usage += usage;
+    ++registry.exited.threads;
+    if (!thread->root.empty()) {
+      auto& totals = registry.exitedByRoot[thread->root];
+      totals.usage += usage;
+      ++totals.threads;
+    }
+  }
+};
+
+thread_local Registration registration;
+
+} // namespace
+
+void ThreadStats::registerCurrentThread(const std::string& name) {
+  auto& registry = getRegistry();
+  if (!registration.thread) {
+    auto thread = std::make_unique<Thread>();
+    thread->name = name;
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.live.insert(thread.get());
+    registration.thread = std::move(thread);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  registration.thread->name = name;
+}
+
+void ThreadStats::setCurrentThreadRoot(const std::string& rootPath) {
+  if (!registration.thread) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(getRegistry().mutex);
+  registration.thread->root = rootPath;
+}
+
+ThreadStats::Usage ThreadStats::currentThreadUsage() {
+  if (registration.thread) {
+    return registration.thread->usage();
+  }
+#ifdef _WIN32
+  return Usage{cpuOfHandle(GetCurrentThread()), std::chrono::nanoseconds(0)};
+#else
+  return Usage{
+      cpuOfClock(CLOCK_THREAD_CPUTIME_ID), std::chrono::nanoseconds(0)};
+#endif
+}
+
+std::string ThreadStats::currentThreadName() {
+  if (!registration.thread) {
+    return std::string();
+  }
+  std::lock_guard<std::mutex> lock(getRegistry().mutex);
+  return registration.thread->name;
+}
+
+void ThreadStats::addWait(std::chrono::nanoseconds duration) {
+  if (registration.thread) {
+    registration.thread->waitNanos.fetch_add(
+        duration.count(), std::memory_order_relaxed);
+  }
+}
+
+std::vector<ThreadStats::ThreadUsage> ThreadStats::getLiveThreads() {
+  auto& registry = getRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  std::vector<ThreadUsage> result;
+  result.reserve(registry.live.size());
+  for (auto* thread : registry.live) {
+    result.push_back(ThreadUsage{thread->name, thread->root, thread->usage()});
+  }
+  return result;
+}
+
+ThreadStats::Totals ThreadStats::getRootTotals(const std::string& rootPath) {
+  auto& registry = getRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  Totals totals;
+  auto it = registry.exitedByRoot.find(rootPath);
+  if (it != registry.exitedByRoot.end()) {
+    totals = it->second;
+  }
+  for (auto* thread : registry.live) {
+    if (thread->root == rootPath) {
+      totals.usage += thread->usage();
+      ++totals.threads;
+    }
+  }
+  return totals;
+}
+
+ThreadStats::Totals ThreadStats::getExitedTotals() {
+  auto& registry = getRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  return registry.exited;
+}
+
+} // namespace watchman
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Accounts for where the threads of the daemon spend their time, so that a
+ * spike in CPU can be attributed to, say, the IO thread of one root rather
+ * than to the client threads rendering results.
+ *
+ * A thread is registered when it is named through w_set_thread_name.  Its
+ * CPU time is read from the kernel when asked for, so costs nothing while
+ * it runs.  Its wait time is the time that it has spent in the waits that
+ * are wrapped in a ThreadStats::Wait: acquiring the view lock, and waiting
+ * on the condition variables of the thread pool, the pending collection,
+ * the query scheduler, the trigger scheduler and the crawl scheduler.
+ *
+ * A thread may be associated with a root, such as the IO and notify
+ * threads of a view, and the usage of those threads is then also summed
+ * per root, including threads that have since exited.
+ */
+class ThreadStats {
+ public:
+  struct Usage {
+    std::chrono::nanoseconds cpu{0};
+    std::chrono::nanoseconds wait{0};
+
+    Usage& operator+=(const Usage& other) {
+      cpu += other.cpu;
+      wait += other.wait;
+      return *this;
+    }
+  };
+
+  struct ThreadUsage {
+    std::string name;
+    // Empty if the thread is not associated with a root
+    std::string root;
+    Usage usage;
+  };
+
+  struct Totals {
+    Usage usage;
+    // How many threads contributed
+    size_t threads{0};
+  };
+
+  // Registers the calling thread under name, or renames it if it is
+  // already registered.
+  static void registerCurrentThread(const std::string& name);
+
+  // Associates the calling thread, which must be registered, with the
+  // root at rootPath.
+  static void setCurrentThreadRoot(const std::string& rootPath);
+
+  // The usage of the calling thread so far; the wait time is zero if the
+  // thread is not registered.
+  static Usage currentThreadUsage();
+
+  // Returns the name of the calling thread, or an empty string if it is
+  // not registered.
+  static std::string currentThreadName();
+
+  // Adds to the wait time of the calling thread, if it is registered.
+  static void addWait(std::chrono::nanoseconds duration);
+
+  // Returns the usage of every registered thread that is still running
+  static std::vector<ThreadUsage> getLiveThreads();
+
+  // Returns the total usage of the threads, live or exited, associated
+  // with the root at rootPath
+  static Totals getRootTotals(const std::string& rootPath);
+
+  // Returns the total usage of the registered threads that have exited
+  static Totals getExitedTotals();
+
+  // Adds the time that it is in scope to the wait time of the calling
+  // thread
+  class Wait {
+   public:
+    Wait() : start_(std::chrono::steady_clock::now()) {}
+    ~Wait() {
+      addWait(std::chrono::steady_clock::now() - start_);
+    }
+    Wait(const Wait&) = delete;
+    Wait& operator=(const Wait&) = delete;
+
+   private:
+    std::chrono::steady_clock::time_point start_;
+  };
+};
+
+} // namespace watchman
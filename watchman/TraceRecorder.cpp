@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/TraceRecorder.h"
+#include <folly/system/ThreadId.h>
+#include <algorithm>
+#include "watchman/Logging.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+namespace {
+json_int_t microsSince(
+    TraceRecorder::Clock::time_point origin,
+    TraceRecorder::Clock::time_point when) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(when - origin)
+      .count();
+}
+} // namespace
+
+TraceRecorder& TraceRecorder::get() {
+  static TraceRecorder recorder;
+  return recorder;
+}
+
+bool TraceRecorder::start(size_t maxEvents) {
+  auto capture = capture_.lock();
+  if (capture->running) {
+    return false;
+  }
+  capture->running = true;
+  capture->maxEvents = maxEvents;
+  capture->dropped = 0;
+  capture->started = Clock::now();
+  capture->spans.clear();
+  capture->threadNames.clear();
+  enabled_.store(true, std::memory_order_relaxed);
+  return true;
+}
+
+json_ref TraceRecorder::stop() {
+  std::vector<Span> spans;
+  std::unordered_map<uint64_t, std::string> threadNames;
+  Clock::time_point started;
+  size_t dropped;
+  {
+    auto capture = capture_.lock();
+    enabled_.store(false, std::memory_order_relaxed);
+    capture->running = false;
+    std::swap(spans, capture->spans);
+    std::swap(threadNames, capture->threadNames);
+    started = capture->started;
+    dropped = capture->dropped;
+  }
+
+  std::sort(spans.begin(), spans.end(), [](const Span& a, const Span& b) {
+    return a.begin < b.begin;
+  });
+
+  auto pid = json_integer(::getpid());
+  auto events = json_array();
+  auto& arr = events.array();
+  arr.reserve(threadNames.size() + spans.size());
+
+  for (auto& [tid, name] : threadNames) {
+    auto args = json_object(
+        {{"name", typed_string_to_json(name.c_str(), W_STRING_MIXED)}});
+    arr.push_back(json_object(
+        {{"name", typed_string_to_json("thread_name", W_STRING_UNICODE)},
+         {"ph", typed_string_to_json("M", W_STRING_UNICODE)},
+         {"pid", pid},
+         {"tid", json_integer(tid)},
+         {"args", args}}));
+  }
+
+  for (auto& span : spans) {
+    auto args = span.args ? span.args : json_object();
+    if (!span.root.empty()) {
+      args.set("root", w_string_to_json(span.root));
+    }
+    arr.push_back(json_object(
+        {{"name", typed_string_to_json(span.name, W_STRING_UNICODE)},
+         {"cat", typed_string_to_json(span.category, W_STRING_UNICODE)},
+         {"ph", typed_string_to_json("X", W_STRING_UNICODE)},
+         {"ts", json_integer(microsSince(started, span.begin))},
+         {"dur", json_integer(microsSince(span.begin, span.end))},
+         {"pid", pid},
+         {"tid", json_integer(span.tid)},
+         {"args", args}}));
+  }
+
+  return json_object(
+      {{"traceEvents", events},
+       {"displayTimeUnit", typed_string_to_json("ms", W_STRING_UNICODE)},
+       {"otherData",
+        json_object({{"dropped_events", json_integer(dropped)}})}});
+}
+
+void TraceRecorder::record(
+    const char* category,
+    const char* name,
+    const w_string& root,
+    Clock::time_point begin,
+    Clock::time_point end,
+    json_ref args) {
+  if (!enabled()) {
+    return;
+  }
+  auto tid = folly::getOSThreadID();
+  auto capture = capture_.lock();
+  if (!capture->running || begin < capture->started) {
+    // Started before the capture did, so it would have a negative time
+    return;
+  }
+  if (capture->spans.size() >= capture->maxEvents) {
+    ++capture->dropped;
+    return;
+  }
+  if (capture->threadNames.find(tid) == capture->threadNames.end()) {
+    capture->threadNames.emplace(tid, Log::getThreadName());
+  }
+  capture->spans.push_back(
+      Span{category, name, root, begin, end, tid, std::move(args)});
+}
+
+TraceSpan::TraceSpan(const char* category, const char* name, w_string root)
+    : category_(category), name_(name), root_(std::move(root)) {
+  if (TraceRecorder::get().enabled()) {
+    begin_ = TraceRecorder::Clock::now();
+  }
+}
+
+TraceSpan::~TraceSpan() {
+  if (begin_) {
+    TraceRecorder::get().record(
+        category_,
+        name_,
+        root_,
+        *begin_,
+        TraceRecorder::Clock::now(),
+        std::move(args_));
+  }
+}
+
+void TraceSpan::addArg(const char* key, json_ref value) {
+  if (!begin_) {
+    return;
+  }
+  if (!args_) {
+    args_ = json_object();
+  }
+  args_.set(key, std::move(value));
+}
+
+} // namespace watchman
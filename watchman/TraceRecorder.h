@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/Synchronized.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Collects timed spans of daemon activity while a capture is running, and
+ * turns them into a timeline in the Chrome trace event format, which both
+ * chrome://tracing and Perfetto can load.  This is what the debug-trace
+ * command uses to show how the work on the various threads interleaved,
+ * for instance to see why a subscription fired late.
+ *
+ * Recording is skipped entirely, short of one relaxed load, when no capture
+ * is running.
+ */
+class TraceRecorder {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  static TraceRecorder& get();
+
+  bool enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Begins a capture that holds at most maxEvents spans.  Returns false if
+   * a capture is already running.
+   */
+  bool start(size_t maxEvents);
+
+  /**
+   * Ends the capture and returns its spans as a Chrome trace json object,
+   * {"traceEvents": [...], "displayTimeUnit": "ms"}.  Spans are ordered by
+   * start time and timestamped in microseconds since the capture began.
+   */
+  json_ref stop();
+
+  /**
+   * Records a span on the current thread.  root, if not empty, and the
+   * members of args, if set, are shown as the args of the span.
+   */
+  void record(
+      const char* category,
+      const char* name,
+      const w_string& root,
+      Clock::time_point begin,
+      Clock::time_point end,
+      json_ref args = nullptr);
+
+ private:
+  struct Span {
+    const char* category;
+    const char* name;
+    w_string root;
+    Clock::time_point begin;
+    Clock::time_point end;
+    uint64_t tid;
+    json_ref args;
+  };
+
+  struct Capture {
+    bool running{false};
+    size_t maxEvents{0};
+    size_t dropped{0};
+    Clock::time_point started;
+    std::vector<Span> spans;
+    std::unordered_map<uint64_t, std::string> threadNames;
+  };
+
+  std::atomic<bool> enabled_{false};
+  folly::Synchronized<Capture, std::mutex> capture_;
+};
+
+/**
+ * Records a span from its construction to its destruction, if a capture
+ * was running when it was constructed.
+ */
+class TraceSpan {
+ public:
+  TraceSpan(const char* category, const char* name, w_string root = {});
+  ~TraceSpan();
+
+  TraceSpan(const TraceSpan&) = delete;
+  TraceSpan& operator=(const TraceSpan&) = delete;
+
+  // Adds key to the args shown for the span; does nothing if not tracing
+  void addArg(const char* key, json_ref value);
+
+ private:
+  const char* category_;
+  const char* name_;
+  w_string root_;
+  std::optional<TraceRecorder::Clock::time_point> begin_;
+  json_ref args_;
+};
+
+} // namespace watchman
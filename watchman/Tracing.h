@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <folly/tracing/StaticTracepoint.h>
+
+/**
+ * Static tracepoints for the hot paths, for use with bpftrace, perf or
+ * SystemTap, e.g.:
+ *
+ *   bpftrace -e 'usdt:/usr/local/bin/watchman:watchman:crawl_dir
+ *     { printf("%s\n", str(arg0)); }'
+ *
+ * On ELF platforms each expands to a single nop plus a note describing
+ * where to find its arguments, so a tracepoint that nobody is attached to
+ * costs nothing beyond keeping the arguments live.  Elsewhere they compile
+ * away.  Arguments must be integers or pointers; pass strings as a
+ * NUL-terminated const char*.
+ *
+ * The tracepoints are:
+ *
+ *   process_path_begin(path, flags), process_path_end(path)
+ *   crawl_dir(path, recursive)
+ *   cookie_create(path), cookie_observe(path, matched)
+ *   query_state(ctx, state) as each query moves through QueryContextState
+ *   pdu_encode_begin(type), pdu_encode_end(type, ok)
+ *   bser_pdu_encoded(size), before the encoded pdu is written
+ *   content_hash_miss(path)
+ */
+#define WATCHMAN_TRACE(name, ...) FOLLY_SDT(watchman, name, ##__VA_ARGS__)
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/TreeSizeHints.h"
+#include <folly/Synchronized.h>
+#include <mutex>
+#include <unordered_map>
+
+namespace watchman {
+
+namespace {
+
+using HintTable = folly::Synchronized<
+    std::unordered_map<w_string, TreeSizeHints>,
+    std::mutex>;
+
+HintTable& getHintTable() {
+  static auto* table = new HintTable;
+  return *table;
+}
+
+std::optional<uint64_t> getCount(const json_ref& value, const char* key) {
+  auto count = value.get_default(key);
+  if (!count || !count.isInt() || count.asInt() < 0) {
+    return std::nullopt;
+  }
+  return uint64_t(count.asInt());
+}
+
+} // namespace
+
+json_ref TreeSizeHints::toJson() const {
+  return json_object({
+      {"dirs", json_integer(json_int_t(numDirs))},
+      {"files", json_integer(json_int_t(numFiles))},
+      {"dir_names", json_integer(json_int_t(numDirNames))},
+  });
+}
+
+std::optional<TreeSizeHints> TreeSizeHints::fromJson(const json_ref& value) {
+  if (!value || !value.isObject()) {
+    return std::nullopt;
+  }
+  auto dirs = getCount(value, "dirs");
+  auto files = getCount(value, "files");
+  auto dirNames = getCount(value, "dir_names");
+  if (!dirs || !files || !dirNames) {
+    return std::nullopt;
+  }
+  return TreeSizeHints{*dirs, *files, *dirNames};
+}
+
+void TreeSizeHints::remember(
+    const w_string& rootPath,
+    const TreeSizeHints& hints) {
+  (*getHintTable().lock())[rootPath] = hints;
+}
+
+std::optional<TreeSizeHints> TreeSizeHints::lookup(const w_string& rootPath) {
+  auto table = getHintTable().lock();
+  auto it = table->find(rootPath);
+  if (it == table->end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+} // namespace watchman
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * How big the tree of a root was when it was last crawled, so that the
+ * next watch of it can size its tables up front rather than growing them
+ * one rehash at a time while the initial crawl fills them.
+ *
+ * The view records them after each full crawl and they are saved along
+ * with the root in the state file.  When the state is loaded they are
+ * remembered here, against the path of the root, until the root is
+ * watched again.
+ */
+struct TreeSizeHints {
+  uint64_t numDirs{0};
+  uint64_t numFiles{0};
+  // The distinct names of the dirs, which the view interns
+  uint64_t numDirNames{0};
+
+  json_ref toJson() const;
+  // Returns nullopt if value isn't an object of the shape toJson makes
+  static std::optional<TreeSizeHints> fromJson(const json_ref& value);
+
+  /**
+   * Remembers the hints for the root at rootPath, replacing any that were
+   * remembered before.
+   */
+  static void remember(const w_string& rootPath, const TreeSizeHints& hints);
+
+  /**
+   * Returns the hints last remembered for the root at rootPath, if any.
+   */
+  static std::optional<TreeSizeHints> lookup(const w_string& rootPath);
+};
+
+} // namespace watchman
@@ -6,23 +6,27 @@
  */
 
 #include "watchman/TriggerCommand.h"
-#include <folly/String.h>
+#include <algorithm>
+#include <thread>
 #include "watchman/Errors.h"
 #include "watchman/PDU.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
-#include "watchman/UserDir.h"
+#include "watchman/TraceRecorder.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
 #include "watchman/root/Root.h"
 #include "watchman/sockname.h"
-#include "watchman/watchman_stream.h"
 
 namespace watchman {
 
 namespace {
 
+// How often to check whether a process has exited while a run is
+// waiting for a max_concurrency slot
+constexpr std::chrono::milliseconds kReapInterval{50};
+
 void parse_redirection(
     json_ref trig,
     std::string& name,
@@ -61,15 +65,8 @@ void parse_redirection(
   }
 }
 
-std::unique_ptr<watchman_stream> prepare_stdin(
-    struct TriggerCommand* cmd,
-    QueryResult* res) {
-  char stdin_file_name[WATCHMAN_NAME_MAX];
-
-  if (cmd->stdin_style == trigger_input_style::input_dev_null) {
-    return w_stm_open("/dev/null", O_RDONLY | O_CLOEXEC);
-  }
-
+// Returns the input for the child process
+std::string prepare_stdin(struct TriggerCommand* cmd, QueryResult* res) {
   // Adjust result to fit within the specified limit
   if (cmd->max_files_stdin > 0) {
     auto& fileList = res->resultsArray.array();
@@ -77,61 +74,61 @@ std::unique_ptr<watchman_stream> prepare_stdin(
     fileList.resize(std::min(fileList.size(), n_files));
   }
 
-  /* prepare the input stream for the child process */
-  snprintf(
-      stdin_file_name,
-      sizeof(stdin_file_name),
-      "%s/wmanXXXXXX",
-      getTemporaryDirectory().c_str());
-  auto stdin_file = w_mkstemp(stdin_file_name);
-  if (!stdin_file) {
-    logf(
-        ERR,
-        "unable to create a temporary file: {} {}\n",
-        stdin_file_name,
-        folly::errnoStr(errno));
-    return NULL;
-  }
-
-  /* unlink the file, we don't need it in the filesystem;
-   * we'll pass the fd on to the child as stdin */
-  unlink(stdin_file_name); // FIXME: windows path translation
-
+  std::string input;
   switch (cmd->stdin_style) {
-    case input_json: {
-      w_jbuffer_t buffer;
-
-      logf(DBG, "input_json: sending json object to stm\n");
-      if (!buffer.jsonEncodeToStream(res->resultsArray, stdin_file.get(), 0)) {
-        logf(
-            ERR,
-            "input_json: failed to write json data to stream: {}\n",
-            folly::errnoStr(errno));
-        return NULL;
-      }
+    case input_json:
+      logf(DBG, "input_json: sending json object to stdin\n");
+      input = json_dumps(res->resultsArray, 0);
+      input.push_back('\n');
       break;
-    }
     case input_name_list:
       for (auto& name : res->resultsArray.array()) {
         auto& nameStr = json_to_w_string(name);
-        if (stdin_file->write(nameStr.data(), nameStr.size()) !=
-                (int)nameStr.size() ||
-            stdin_file->write("\n", 1) != 1) {
-          logf(
-              ERR,
-              "write failure while producing trigger stdin: {}\n",
-              folly::errnoStr(errno));
-          return nullptr;
-        }
+        input.append(nameStr.data(), nameStr.size());
+        input.push_back('\n');
       }
       break;
     case input_dev_null:
-      // already handled above
+      // spawn_command has the child open the null device itself
       break;
   }
+  return input;
+}
 
-  stdin_file->rewind();
-  return stdin_file;
+// Writes input to the stdin pipe of a child process and then closes it.
+// This is done by a thread of its own as the child reads its input at its
+// own pace, and may go on to do other things before it has read all of it;
+// the write fails, ending the thread, if the child exits without doing so.
+void feed_stdin(
+    const w_string& triggername,
+    std::unique_ptr<Pipe> pipe,
+    std::string input) {
+  std::thread([triggername,
+               pipe = std::move(pipe),
+               input = std::move(input)]() {
+    w_set_thread_name("trigger stdin ", triggername);
+    size_t written = 0;
+    while (written < input.size()) {
+      auto result = pipe->write.write(
+          input.data() + written,
+          int(std::min(input.size() - written, size_t(1024 * 1024))));
+      if (result.hasError()) {
+        if (result.error() == std::errc::interrupted) {
+          continue;
+        }
+        log(DBG,
+            "trigger ",
+            triggername,
+            ": stopped writing stdin after ",
+            written,
+            " bytes: ",
+            result.error().message(),
+            "\n");
+        return;
+      }
+      written += size_t(result.value());
+    }
+  }).detach();
 }
 
 void spawn_command(
@@ -155,20 +152,17 @@ void spawn_command(
     file_overflow = true;
   }
 
-  auto stdin_file = prepare_stdin(cmd, res);
-  if (!stdin_file) {
-    logf(
-        ERR,
-        "trigger {}:{} {}\n",
-        root->root_path,
-        cmd->triggername,
-        folly::errnoStr(errno));
-    return;
+  // The input is passed through a pipe, which avoids a temporary file and
+  // lets the child start on it while the rest of it is written
+  std::string stdin_input;
+  if (cmd->stdin_style != input_dev_null) {
+    stdin_input = prepare_stdin(cmd, res);
   }
 
   // Assumption: that only one thread will be executing on a given
   // cmd instance so that mutation of cmd->env is safe.
-  // This is guaranteed in the current architecture.
+  // This is guaranteed in the current architecture.  Each process gets
+  // its own copy, so this is also safe while earlier ones are running.
 
   // It is way too much of a hassle to try to recreate the clock value if it's
   // not a relative clock spec, and it's only going to happen on the first run
@@ -199,10 +193,7 @@ void spawn_command(
       argspace_remaining -= strlen(ele) + 1 + sizeof(char*);
     }
 
-    // Dry run with env to compute space
-    size_t env_size;
-    cmd->env.asEnviron(&env_size);
-    argspace_remaining -= env_size;
+    argspace_remaining -= cmd->env.environSize();
 
     for (const auto& item : res->dedupedFileNames) {
       // also: NUL terminator and entry in argv
@@ -229,21 +220,9 @@ void spawn_command(
 #endif
   opts.setFlags(POSIX_SPAWN_SETPGROUP);
 
-  opts.dup2(stdin_file->getFileDescriptor(), STDIN_FILENO);
-
-  if (!cmd->stdout_name.empty()) {
-    opts.open(STDOUT_FILENO, cmd->stdout_name.c_str(), cmd->stdout_flags, 0666);
-  } else {
-    opts.dup2(FileDescriptor::stdOut(), STDOUT_FILENO);
-  }
-
-  if (!cmd->stderr_name.empty()) {
-    opts.open(STDERR_FILENO, cmd->stderr_name.c_str(), cmd->stderr_flags, 0666);
-  } else {
-    opts.dup2(FileDescriptor::stdErr(), STDERR_FILENO);
-  }
-
-  // Figure out the appropriate cwd
+  // Figure out the appropriate cwd.  This is set first because the child
+  // may change to it as a file action, and the stdout and stderr paths
+  // are relative to it.
   w_string working_dir(cmd->query->relative_root);
   if (!working_dir) {
     working_dir = root->root_path;
@@ -262,12 +241,42 @@ void spawn_command(
   log(DBG, "using ", working_dir, " for working dir\n");
   opts.chdir(working_dir.c_str());
 
+  if (cmd->stdin_style != input_dev_null) {
+    opts.pipeStdin();
+  } else {
+    opts.nullStdin();
+  }
+
+  if (!cmd->stdout_name.empty()) {
+    opts.open(STDOUT_FILENO, cmd->stdout_name.c_str(), cmd->stdout_flags, 0666);
+  } else {
+    opts.dup2(FileDescriptor::stdOut(), STDOUT_FILENO);
+  }
+
+  if (!cmd->stderr_name.empty()) {
+    opts.open(STDERR_FILENO, cmd->stderr_name.c_str(), cmd->stderr_flags, 0666);
+  } else {
+    opts.dup2(FileDescriptor::stdErr(), STDERR_FILENO);
+  }
+
+  bool spawned = false;
+  TraceSpan span("trigger", "spawn", root->root_path);
+  span.addArg("trigger", w_string_to_json(cmd->triggername));
   try {
-    if (cmd->current_proc) {
-      cmd->current_proc->kill();
-      cmd->current_proc->wait();
+    if (cmd->max_concurrency == 0) {
+      for (auto& proc : cmd->current_procs) {
+        proc->kill();
+        proc->wait();
+      }
+      cmd->current_procs.clear();
     }
-    cmd->current_proc = std::make_unique<ChildProcess>(args, std::move(opts));
+    auto proc = std::make_unique<ChildProcess>(args, std::move(opts));
+    if (auto stdinPipe = proc->takePipe(STDIN_FILENO)) {
+      feed_stdin(
+          cmd->triggername, std::move(stdinPipe), std::move(stdin_input));
+    }
+    cmd->current_procs.push_back(std::move(proc));
+    spawned = true;
   } catch (const std::exception& exc) {
     log(ERR,
         "trigger ",
@@ -280,7 +289,7 @@ void spawn_command(
   }
 
   // We have integration tests that check for this string
-  log(cmd->current_proc ? DBG : ERR, "posix_spawnp: ", cmd->triggername, "\n");
+  log(spawned ? DBG : ERR, "posix_spawnp: ", cmd->triggername, "\n");
 }
 
 } // namespace
@@ -293,10 +302,10 @@ TriggerCommand::TriggerCommand(
       append_files(false),
       stdin_style(input_dev_null),
       max_files_stdin(0),
+      max_concurrency(0),
       stdout_flags(0),
       stderr_flags(0),
-      savedStateFactory_{savedStateFactory},
-      ping_(w_event_make_sockets()) {
+      savedStateFactory_{savedStateFactory} {
   auto queryDef = json_object();
   auto expr = definition.get_default("expression");
   if (expr) {
@@ -333,6 +342,7 @@ TriggerCommand::TriggerCommand(
     // "easy" workaround, we'll capture the list of names from the deduping
     // mechanism.
     query->dedup_results = true;
+    query->dedup_by_name = true;
   }
 
   auto ele = definition.get_default("stdin");
@@ -363,6 +373,22 @@ TriggerCommand::TriggerCommand(
   }
   max_files_stdin = ival;
 
+  auto parse_millis = [&](const char* label) {
+    auto ms = trig.get_default(label, json_integer(0)).asInt();
+    if (ms < 0) {
+      throw CommandValidationError(label, " must be >= 0");
+    }
+    return std::chrono::milliseconds(ms);
+  };
+  debounce = parse_millis("debounce_ms");
+  max_batch = parse_millis("max_batch_ms");
+
+  ival = trig.get_default("max_concurrency", json_integer(0)).asInt();
+  if (ival < 0) {
+    throw CommandValidationError("max_concurrency must be >= 0");
+  }
+  max_concurrency = ival;
+
   parse_redirection(trig, stdout_name, &stdout_flags, "stdout");
   parse_redirection(trig, stderr_name, &stderr_flags, "stderr");
 
@@ -374,78 +400,75 @@ TriggerCommand::TriggerCommand(
 }
 
 TriggerCommand::~TriggerCommand() {
-  if (triggerThread_.joinable() && !stopTrigger_) {
+  if (root_) {
     // We could try to call stop() here, but that is paving over the problem,
-    // especially if we happen to be the triggerThread_ for some reason.
+    // especially if we happen to be running in a dispatch for some reason.
     log(FATAL, "destroying trigger without stopping it first\n");
   }
 }
 
-void TriggerCommand::run(const std::shared_ptr<Root>& root) {
-  std::vector<std::shared_ptr<const Publisher::Item>> pending;
-  w_set_thread_name(
-      "trigger ", triggername.view(), " ", root->root_path.view());
-
-  try {
-    watchman_event_poll pfd[1];
-    pfd[0].evt = ping_.get();
-
-    log(DBG, "waiting for settle\n");
-
-    while (!w_is_stopping() && !stopTrigger_) {
-      ignore_result(w_poll_events(pfd, 1, 86400));
-      if (w_is_stopping() || stopTrigger_) {
-        break;
-      }
-      while (ping_->testAndClear()) {
-        pending.clear();
-        subscriber_->getPending(pending);
-        bool seenSettle = false;
-        for (auto& item : pending) {
-          if (item->payload.get_default("settled")) {
-            seenSettle = true;
-            break;
-          }
-        }
+TriggerScheduler::Deadline TriggerCommand::dispatch() {
+  if (w_is_stopping() || stopTrigger_) {
+    return std::nullopt;
+  }
 
-        if (seenSettle) {
-          if (!maybeSpawn(root)) {
-            continue;
-          }
-          waitNoIntr();
-        }
+  pending_.clear();
+  subscriber_->getPending(pending_);
+  for (auto& item : pending_) {
+    if (item->payload.get_default("settled")) {
+      lastSettle_ = std::chrono::steady_clock::now();
+      if (!batchStart_) {
+        batchStart_ = lastSettle_;
       }
+      break;
     }
+  }
 
-    if (current_proc) {
-      current_proc->kill();
-      current_proc->wait();
-    }
-  } catch (const std::exception& exc) {
-    log(ERR, "Uncaught exception in trigger thread: ", exc.what(), "\n");
+  reapChildren();
+  if (!batchStart_) {
+    return std::nullopt;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  auto due = batchDue(*batchStart_, lastSettle_);
+  if (due > now) {
+    return due;
+  }
+  if (!hasCapacity()) {
+    // We are only waiting for one of our processes to exit, and nothing
+    // will tell us when that happens
+    return now + kReapInterval;
   }
 
-  log(DBG, "out of loop\n");
+  batchStart_.reset();
+  maybeSpawn(root_);
+  return std::nullopt;
 }
 
 void TriggerCommand::stop() {
   stopTrigger_ = true;
-  if (triggerThread_.joinable()) {
-    ping_->notify();
-    triggerThread_.join();
+  if (!root_) {
+    return;
   }
+
+  // Once this returns no dispatch is running or will run, so the rest of
+  // our state is ours to tear down
+  getTriggerScheduler().remove(this);
+  subscriber_.reset();
+
+  for (auto& proc : current_procs) {
+    proc->kill();
+    proc->wait();
+  }
+  current_procs.clear();
+  root_.reset();
 }
 
 void TriggerCommand::start(const std::shared_ptr<Root>& root) {
-  subscriber_ =
-      root->unilateralResponses->subscribe([this] { ping_->notify(); });
-  triggerThread_ = std::thread([this, root] {
-    try {
-      run(root);
-    } catch (const std::exception& e) {
-      log(ERR, "exception in trigger thread: ", e.what(), "\n");
-    }
-  });
+  root_ = root;
+  getTriggerScheduler().add(this);
+  subscriber_ = root->unilateralResponses->subscribe(
+      [this] { getTriggerScheduler().wake(this); });
 }
 
 bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
@@ -513,14 +536,29 @@ bool TriggerCommand::maybeSpawn(const std::shared_ptr<Root>& root) {
   }
 }
 
-bool TriggerCommand::waitNoIntr() {
-  if (!w_is_stopping() && !stopTrigger_) {
-    if (current_proc && current_proc->terminated()) {
-      current_proc.reset();
-      return true;
-    }
+void TriggerCommand::reapChildren() {
+  current_procs.erase(
+      std::remove_if(
+          current_procs.begin(),
+          current_procs.end(),
+          [](const std::unique_ptr<ChildProcess>& proc) {
+            return proc->terminated();
+          }),
+      current_procs.end());
+}
+
+bool TriggerCommand::hasCapacity() const {
+  return max_concurrency == 0 || current_procs.size() < max_concurrency;
+}
+
+std::chrono::steady_clock::time_point TriggerCommand::batchDue(
+    std::chrono::steady_clock::time_point batchStart,
+    std::chrono::steady_clock::time_point lastSettle) const {
+  auto due = lastSettle + debounce;
+  if (max_batch.count() > 0) {
+    due = std::min(due, batchStart + max_batch);
   }
-  return false;
+  return due;
 }
 
 } // namespace watchman
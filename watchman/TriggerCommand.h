@@ -7,14 +7,16 @@
 
 #pragma once
 
-#include <thread>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <vector>
 
 #include "watchman/ChildProcess.h"
 #include "watchman/PubSub.h"
+#include "watchman/TriggerScheduler.h"
 #include "watchman/saved_state/SavedStateInterface.h"
 
-class watchman_event;
-
 namespace watchman {
 
 class Root;
@@ -38,9 +40,19 @@ struct TriggerCommand {
   std::string stdout_name;
   std::string stderr_name;
 
-  /* While we are running, this holds the pid
-   * of the running process */
-  std::unique_ptr<watchman::ChildProcess> current_proc;
+  /* Settles that arrive within debounce of the previous one are batched
+   * into a single run, but a batch is run no later than max_batch after
+   * the settle that started it.  Zero disables either limit. */
+  std::chrono::milliseconds debounce{0};
+  std::chrono::milliseconds max_batch{0};
+
+  /* If non-zero, up to this many processes may run at once and further
+   * runs wait for one of them to exit.  Otherwise each run replaces the
+   * process that is still running, if any. */
+  uint32_t max_concurrency;
+
+  /* The processes that we have spawned and not yet seen exit */
+  std::vector<std::unique_ptr<watchman::ChildProcess>> current_procs;
 
   TriggerCommand(
       SavedStateFactory savedStateFactory,
@@ -58,15 +70,32 @@ struct TriggerCommand {
   TriggerCommand& operator=(const TriggerCommand&) = delete;
   TriggerCommand& operator=(TriggerCommand&&) = delete;
 
-  void run(const std::shared_ptr<Root>& root);
+  // Called by the TriggerScheduler when we have been woken, or when the
+  // deadline that we returned last time has passed.  Returns when we next
+  // want to be dispatched even if nothing wakes us.
+  TriggerScheduler::Deadline dispatch();
   bool maybeSpawn(const std::shared_ptr<Root>& root);
-  bool waitNoIntr();
+  // Forgets the processes that have exited
+  void reapChildren();
+  bool hasCapacity() const;
+  // When the batch that started at batchStart should be run
+  std::chrono::steady_clock::time_point batchDue(
+      std::chrono::steady_clock::time_point batchStart,
+      std::chrono::steady_clock::time_point lastSettle) const;
 
   const SavedStateFactory savedStateFactory_;
-  std::thread triggerThread_;
+  // Set between start() and stop()
+  std::shared_ptr<Root> root_;
   std::shared_ptr<watchman::Publisher::Subscriber> subscriber_;
-  std::unique_ptr<watchman_event> ping_;
-  bool stopTrigger_{false};
+  std::atomic<bool> stopTrigger_{false};
+
+  // Only accessed by dispatch(), and by stop() once dispatching has ended
+  std::vector<std::shared_ptr<const Publisher::Item>> pending_;
+  // Set while there is a settle that we have yet to run for
+  std::optional<std::chrono::steady_clock::time_point> batchStart_;
+  std::chrono::steady_clock::time_point lastSettle_;
+
+  friend class TriggerScheduler;
 };
 
 } // namespace watchman
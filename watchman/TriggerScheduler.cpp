@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/TriggerScheduler.h"
+#include <algorithm>
+#include "watchman/Logging.h"
+#include "watchman/ThreadStats.h"
+#include "watchman/TriggerCommand.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+TriggerScheduler& getTriggerScheduler() {
+  static TriggerScheduler scheduler;
+  return scheduler;
+}
+
+TriggerScheduler::~TriggerScheduler() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  ready_.notify_all();
+
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+}
+
+void TriggerScheduler::add(TriggerCommand* trigger) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (workers_.empty()) {
+    auto numWorkers =
+        std::max(json_int_t(1), cfg_get_int("trigger_dispatch_threads", 2));
+    for (json_int_t i = 0; i < numWorkers; ++i) {
+      workers_.emplace_back([this, i]() noexcept {
+        w_set_thread_name("trigger-", i);
+        runWorker();
+      });
+    }
+  }
+
+  triggers_.emplace(trigger, State{});
+}
+
+void TriggerScheduler::remove(TriggerCommand* trigger) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [&] {
+    auto it = triggers_.find(trigger);
+    return it == triggers_.end() || !it->second.dispatching;
+  });
+  triggers_.erase(trigger);
+}
+
+void TriggerScheduler::wake(TriggerCommand* trigger) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = triggers_.find(trigger);
+    if (it == triggers_.end()) {
+      return;
+    }
+    it->second.woken = true;
+  }
+  ready_.notify_one();
+}
+
+void TriggerScheduler::runWorker() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    auto now = std::chrono::steady_clock::now();
+    TriggerCommand* next = nullptr;
+    Deadline earliest;
+    for (auto& [trigger, state] : triggers_) {
+      if (state.dispatching) {
+        continue;
+      }
+      if (state.woken || (state.deadline && *state.deadline <= now)) {
+        next = trigger;
+        break;
+      }
+      if (state.deadline && (!earliest || *state.deadline < *earliest)) {
+        earliest = state.deadline;
+      }
+    }
+
+    if (!next) {
+      ThreadStats::Wait wait;
+      if (earliest) {
+        ready_.wait_until(lock, *earliest);
+      } else {
+        ready_.wait(lock);
+      }
+      continue;
+    }
+
+    auto& state = triggers_[next];
+    state.dispatching = true;
+    state.woken = false;
+    state.deadline.reset();
+    lock.unlock();
+
+    Deadline deadline;
+    try {
+      deadline = next->dispatch();
+    } catch (const std::exception& exc) {
+      log(ERR, "Uncaught exception in trigger dispatch: ", exc.what(), "\n");
+    }
+
+    lock.lock();
+    // remove() waits for us, so the trigger is still present
+    auto& finished = triggers_[next];
+    finished.dispatching = false;
+    finished.deadline = deadline;
+    idle_.notify_all();
+    if (finished.woken) {
+      // It was woken while we were busy with it, and the other threads
+      // skipped it, so make sure that somebody looks again
+      ready_.notify_one();
+    }
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace watchman {
+
+struct TriggerCommand;
+
+// Runs every trigger in the process on a small, fixed set of threads,
+// rather than giving each trigger a thread of its own that spends almost
+// all of its time asleep.
+//
+// A trigger is dispatched when it is woken, which happens when its root
+// publishes something, or when the deadline that its previous dispatch
+// asked for has passed.  A trigger is never dispatched on two threads at
+// once.
+class TriggerScheduler {
+ public:
+  using Deadline = std::optional<std::chrono::steady_clock::time_point>;
+
+  ~TriggerScheduler();
+
+  // Starts dispatching trigger.  The worker threads are started on first
+  // use, the number of them coming from `trigger_dispatch_threads`.
+  void add(TriggerCommand* trigger);
+
+  // Stops dispatching trigger, waiting for a dispatch that is already
+  // underway on another thread to finish.  Must not be called from within
+  // a dispatch.
+  void remove(TriggerCommand* trigger);
+
+  // Arranges for trigger to be dispatched as soon as a thread is free.
+  // Does nothing if trigger has been removed.
+  void wake(TriggerCommand* trigger);
+
+ private:
+  struct State {
+    bool woken{false};
+    bool dispatching{false};
+    Deadline deadline;
+  };
+
+  void runWorker();
+
+  std::mutex mutex_;
+  // Signalled when there is a trigger that may be ready for dispatch
+  std::condition_variable ready_;
+  // Signalled when a dispatch finishes
+  std::condition_variable idle_;
+  std::unordered_map<TriggerCommand*, State> triggers_;
+  std::vector<std::thread> workers_;
+  bool stopping_{false};
+};
+
+// Returns the scheduler shared by every trigger in the process
+TriggerScheduler& getTriggerScheduler();
+
+} // namespace watchman
@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ViewSnapshot.h"
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <algorithm>
+#include <cstring>
+#include "watchman/InMemoryView.h"
+#include "watchman/Options.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+#include "watchman/watchman_hash.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[8] = {'W', 'M', 'V', 'I', 'E', 'W', 'S', '\0'};
+constexpr uint32_t kVersion = 4;
+
+constexpr uint8_t kFileExists = 1;
+constexpr uint8_t kDirLastCheckExisted = 1;
+
+template <typename T>
+void put(std::string& out, const T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void putString(std::string& out, w_string_piece str) {
+  put(out, uint32_t(str.size()));
+  out.append(str.data(), str.size());
+}
+
+void putClock(std::string& out, const w_clock_t& clock) {
+  put(out, clock.ticks);
+  put(out, int64_t(clock.timestamp));
+}
+
+// coldSubtrees are those of the view, when dir is its root; the contents of
+// each are already in the form that serializeDir gives them
+void serializeDir(
+    std::string& out,
+    const watchman_dir* dir,
+    const ViewDatabase::ColdSubtrees* coldSubtrees = nullptr) {
+  put(out, uint32_t(dir->files.size()));
+  for (auto& it : dir->files) {
+    auto* file = it.second.get();
+    putString(out, file->getName());
+    put(out, uint8_t(file->exists ? kFileExists : 0));
+    putClock(out, file->otime);
+    putClock(out, file->ctime);
+    put(out, file->getStat());
+  }
+
+  put(out, uint32_t(dir->dirs.size()));
+  for (auto& it : dir->dirs) {
+    auto* child = it.second.get();
+    putString(out, child->name);
+    put(out, uint8_t(child->last_check_existed ? kDirLastCheckExisted : 0));
+    if (coldSubtrees) {
+      auto cold = coldSubtrees->find(child->name);
+      if (cold != coldSubtrees->end()) {
+        auto contents = cold->second.segment->data();
+        out.append(contents.data(), contents.size());
+        continue;
+      }
+    }
+    serializeDir(out, child);
+  }
+}
+
+class Reader {
+ public:
+  explicit Reader(std::string_view data) : data_(data) {}
+
+  template <typename T>
+  T get() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    memcpy(&value, take(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  w_string getString() {
+    auto piece = getPiece();
+    return w_string(piece.data(), piece.size(), W_STRING_BYTE);
+  }
+
+  // As getString(), but referencing the snapshot data rather than copying
+  w_string_piece getPiece() {
+    auto len = get<uint32_t>();
+    auto* buf = take(len);
+    return w_string_piece(buf, len);
+  }
+
+  w_clock_t getClock() {
+    w_clock_t clock;
+    clock.ticks = get<uint32_t>();
+    clock.timestamp = time_t(get<int64_t>());
+    return clock;
+  }
+
+  bool atEnd() const {
+    return offset_ == data_.size();
+  }
+
+ private:
+  const char* take(size_t len) {
+    if (data_.size() - offset_ < len) {
+      throw std::runtime_error("view snapshot is truncated");
+    }
+    auto* result = data_.data() + offset_;
+    offset_ += len;
+    return result;
+  }
+
+  std::string_view data_;
+  size_t offset_{0};
+};
+
+void deserializeDir(
+    Reader& reader,
+    watchman_dir* dir,
+    NameInterner& dirNames,
+    bool keepAtimes,
+    std::vector<watchman_file*>& files) {
+  auto numFiles = reader.get<uint32_t>();
+  dir->files.reserve(numFiles);
+  for (uint32_t i = 0; i < numFiles; ++i) {
+    auto name = reader.getString();
+    auto flags = reader.get<uint8_t>();
+
+    auto file = watchman_file::make(name, dir, false, keepAtimes);
+    file->exists = flags & kFileExists;
+    file->otime = reader.getClock();
+    file->ctime = reader.getClock();
+    file->setStat(reader.get<FileInformation>());
+
+    files.push_back(file.get());
+    // Key by the name stored inside the file node; see getOrCreateChildFile.
+    auto& slot = dir->files[file->getName()];
+    if (slot) {
+      throw std::runtime_error("view snapshot contains a duplicate file");
+    }
+    slot = std::move(file);
+  }
+
+  auto numDirs = reader.get<uint32_t>();
+  dir->dirs.reserve(numDirs);
+  for (uint32_t i = 0; i < numDirs; ++i) {
+    auto name = dirNames.intern(reader.getPiece());
+    auto flags = reader.get<uint8_t>();
+
+    // dir->dirs is keyed by non-owning string pieces, so the key must be
+    // the name owned by the child.
+    auto child = std::make_unique<watchman_dir>(name, dir);
+    child->last_check_existed = flags & kDirLastCheckExisted;
+    auto* childPtr = child.get();
+    auto& slot = dir->dirs[childPtr->name];
+    if (slot) {
+      throw std::runtime_error("view snapshot contains a duplicate dir");
+    }
+    slot = std::move(child);
+
+    deserializeDir(reader, childPtr, dirNames, keepAtimes, files);
+  }
+}
+
+void skipDir(Reader& reader) {
+  auto numFiles = reader.get<uint32_t>();
+  for (uint32_t i = 0; i < numFiles; ++i) {
+    reader.getPiece();
+    reader.get<uint8_t>();
+    reader.getClock();
+    reader.getClock();
+    reader.get<FileInformation>();
+  }
+  auto numDirs = reader.get<uint32_t>();
+  for (uint32_t i = 0; i < numDirs; ++i) {
+    reader.getPiece();
+    reader.get<uint8_t>();
+    skipDir(reader);
+  }
+}
+
+std::optional<bool> lookupFile(Reader& reader, w_string_piece relPath) {
+  auto sep = (const char*)memchr(relPath.data(), '/', relPath.size());
+  auto component = w_string_piece(
+      relPath.data(), sep ? size_t(sep - relPath.data()) : relPath.size());
+
+  auto numFiles = reader.get<uint32_t>();
+  for (uint32_t i = 0; i < numFiles; ++i) {
+    auto name = reader.getPiece();
+    auto flags = reader.get<uint8_t>();
+    reader.getClock();
+    reader.getClock();
+    reader.get<FileInformation>();
+    if (!sep && name == component) {
+      return bool(flags & kFileExists);
+    }
+  }
+  if (!sep) {
+    return std::nullopt;
+  }
+
+  auto rest =
+      w_string_piece(sep + 1, relPath.data() + relPath.size() - sep - 1);
+  auto numDirs = reader.get<uint32_t>();
+  for (uint32_t i = 0; i < numDirs; ++i) {
+    auto name = reader.getPiece();
+    reader.get<uint8_t>();
+    if (name == component) {
+      return lookupFile(reader, rest);
+    }
+    skipDir(reader);
+  }
+  return std::nullopt;
+}
+
+} // namespace
+
+std::string ViewSnapshot::serialize(
+    const ViewDatabase& view,
+    uint32_t tick,
+    uint32_t lastAgeOutTick,
+    const Cursors& cursors,
+    const w_string& scmCommit,
+    const w_string& watcherPosition) {
+  std::string out;
+  out.append(kMagic, sizeof(kMagic));
+  put(out, kVersion);
+  put(out, uint32_t(sizeof(FileInformation)));
+  put(out, tick);
+  put(out, uint64_t(view.rootInode_));
+  putString(out, view.rootPath_);
+
+  put(out, lastAgeOutTick);
+  put(out, uint32_t(cursors.size()));
+  for (auto& [name, cursorTick] : cursors) {
+    putString(out, name);
+    put(out, cursorTick);
+  }
+  putString(out, scmCommit);
+  putString(out, watcherPosition);
+
+  serializeDir(out, view.rootDir_.get(), &view.coldSubtrees_);
+  return out;
+}
+
+std::string ViewSnapshot::serializeContents(const watchman_dir* dir) {
+  std::string out;
+  serializeDir(out, dir);
+  return out;
+}
+
+std::optional<bool> ViewSnapshot::lookupInContents(
+    std::string_view data,
+    w_string_piece relPath) {
+  Reader reader(data);
+  return lookupFile(reader, relPath);
+}
+
+std::vector<watchman_file*> ViewSnapshot::deserializeContents(
+    std::string_view data,
+    ViewDatabase& view,
+    watchman_dir* dir) {
+  w_check(
+      dir->files.empty() && dir->dirs.empty(),
+      "can only restore the contents of an empty dir");
+
+  Reader reader(data);
+  std::vector<watchman_file*> files;
+  try {
+    deserializeDir(reader, dir, view.dirNames_, view.keepAtimes_, files);
+    if (!reader.atEnd()) {
+      throw std::runtime_error("dir contents have trailing data");
+    }
+  } catch (const std::exception&) {
+    dir->files.clear();
+    dir->dirs.clear();
+    view.dirNames_.prune();
+    throw;
+  }
+  return files;
+}
+
+ViewSnapshot::Header ViewSnapshot::deserialize(
+    std::string_view data,
+    ViewDatabase& view,
+    const w_string& rootPath,
+    ino_t rootInode) {
+  w_check(
+      view.latestFile_ == nullptr && view.rootDir_->files.empty() &&
+          view.rootDir_->dirs.empty(),
+      "can only restore a snapshot into an empty view");
+
+  Reader reader(data);
+  char magic[sizeof(kMagic)];
+  for (auto& c : magic) {
+    c = reader.get<char>();
+  }
+  if (memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error("not a view snapshot");
+  }
+  if (reader.get<uint32_t>() != kVersion ||
+      reader.get<uint32_t>() != sizeof(FileInformation)) {
+    throw std::runtime_error("view snapshot was written by another version");
+  }
+
+  Header header;
+  header.mostRecentTick = reader.get<uint32_t>();
+  header.rootInode = ino_t(reader.get<uint64_t>());
+  header.rootPath = reader.getString();
+  if (header.rootPath != rootPath) {
+    throw std::runtime_error(folly::to<std::string>(
+        "view snapshot is for ",
+        header.rootPath.view(),
+        " rather than ",
+        rootPath.view()));
+  }
+  if (header.rootInode != rootInode) {
+    throw std::runtime_error("the root was replaced since the view snapshot");
+  }
+
+  header.lastAgeOutTick = reader.get<uint32_t>();
+  auto numCursors = reader.get<uint32_t>();
+  for (uint32_t i = 0; i < numCursors; ++i) {
+    auto name = reader.getString();
+    auto cursorTick = reader.get<uint32_t>();
+    if (cursorTick > header.mostRecentTick) {
+      throw std::runtime_error("view snapshot has a cursor from the future");
+    }
+    // A cursor from before the last age out would need a fresh instance
+    // anyway, which is what not having it at all gives us.
+    if (cursorTick >= header.lastAgeOutTick) {
+      header.cursors.emplace(std::move(name), cursorTick);
+    }
+  }
+  if (auto scmCommit = reader.getPiece(); !scmCommit.empty()) {
+    header.scmCommit = scmCommit.asWString();
+  }
+  if (auto position = reader.getPiece(); !position.empty()) {
+    header.watcherPosition = position.asWString();
+  }
+
+  std::vector<watchman_file*> files;
+  try {
+    deserializeDir(
+        reader, view.rootDir_.get(), view.dirNames_, view.keepAtimes_, files);
+    if (!reader.atEnd()) {
+      throw std::runtime_error("view snapshot has trailing data");
+    }
+  } catch (const std::exception&) {
+    // Leave the view empty rather than partially restored.
+    view.rootDir_->files.clear();
+    view.rootDir_->dirs.clear();
+    view.dirNames_.prune();
+    throw;
+  }
+
+  // Rebuild the recency index.  The list is ordered most recent first, so
+  // link the oldest files first.
+  std::stable_sort(
+      files.begin(), files.end(), [](watchman_file* a, watchman_file* b) {
+        return a->otime.ticks < b->otime.ticks;
+      });
+  for (auto* file : files) {
+    view.insertAtHeadOfFileList(file);
+    view.insertIntoSuffixIndex(file);
+    view.insertAtHeadOfSubtreeList(file);
+    view.updateTombstoneList(file);
+  }
+  view.rebuildPathFilter();
+  view.rootInode_ = header.rootInode;
+
+  return header;
+}
+
+void ViewSnapshot::write(const w_string& path, std::string_view data) {
+  int err = folly::writeFileAtomicNoThrow(
+      folly::StringPiece(path.data(), path.size()),
+      folly::ByteRange(folly::StringPiece(data.data(), data.size())),
+      0600);
+  if (err) {
+    throw std::system_error(
+        err,
+        std::generic_category(),
+        folly::to<std::string>("writing view snapshot ", path.view()));
+  }
+}
+
+std::optional<ViewSnapshot::Header> ViewSnapshot::load(
+    const w_string& path,
+    ViewDatabase& view,
+    const w_string& rootPath,
+    ino_t rootInode) {
+  std::string data;
+  if (!folly::readFile(path.c_str(), data)) {
+    if (errno == ENOENT) {
+      return std::nullopt;
+    }
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        folly::to<std::string>("reading view snapshot ", path.view()));
+  }
+  return deserialize(data, view, rootPath, rootInode);
+}
+
+w_string ViewSnapshot::pathForRoot(const w_string& rootPath) {
+  if (flags.watchman_state_file.empty()) {
+    return w_string();
+  }
+  return w_string::format(
+      "{}.view-{:08x}",
+      flags.watchman_state_file,
+      w_hash_bytes_lookup3(rootPath.data(), rootPath.size(), 0));
+}
+
+} // namespace watchman
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "watchman/watchman_string.h"
+#include "watchman/watchman_system.h"
+
+struct watchman_dir;
+struct watchman_file;
+
+namespace watchman {
+
+class ViewDatabase;
+
+/**
+ * Serializes the contents of a ViewDatabase (the directory tree, the file
+ * nodes with their clocks and stat data) to a compact binary form so that a
+ * restarted daemon can seed its view rather than starting from nothing.
+ *
+ * The encoding uses fixed-size records in host byte order and is only
+ * intended to be read back by the same build of watchman that wrote it: the
+ * header records a format version and the size of the FileInformation struct
+ * and snapshots that don't match are rejected.
+ *
+ * The root's named cursors are stored along with the view.  Their tick
+ * values are only meaningful against the clock of the view that they were
+ * taken from, so they are restored only with that view, which continues
+ * its tick sequence.
+ */
+class ViewSnapshot {
+ public:
+  using Cursors = std::unordered_map<w_string, uint32_t>;
+
+  struct Header {
+    // The tick value of the view at the time the snapshot was taken.
+    uint32_t mostRecentTick{0};
+    // The most recent tick that had been aged out of the view.
+    uint32_t lastAgeOutTick{0};
+    ino_t rootInode{0};
+    w_string rootPath;
+    // Named cursors that still refer to ticks held in the view.
+    Cursors cursors;
+    // The commit that the working copy was based on when the snapshot was
+    // taken, if it was asked to record one.
+    w_string scmCommit;
+    // How far through its change history the watcher had got, for watchers
+    // that keep one; see Watcher::getChangeHistoryPosition.
+    w_string watcherPosition;
+  };
+
+  /**
+   * Encode `view` into a byte buffer, along with the named cursors of its
+   * root, the commit of its working copy and the position of its watcher
+   * in its change history.  The commit and the position must have been
+   * looked up before the view was read, so that what changed since them
+   * covers everything that changed since the snapshot.
+   */
+  static std::string serialize(
+      const ViewDatabase& view,
+      uint32_t tick,
+      uint32_t lastAgeOutTick = 0,
+      const Cursors& cursors = {},
+      const w_string& scmCommit = w_string(),
+      const w_string& watcherPosition = w_string());
+
+  /**
+   * Decode `data` and populate `view` with its contents.  `view` must be
+   * empty.  The restored files are linked into the recency index in otime
+   * order.
+   *
+   * Throws std::runtime_error if the data is malformed, or was produced for a
+   * different root, a root with a different inode number, or by an
+   * incompatible version.  `view` is left empty in that case.
+   */
+  static Header deserialize(
+      std::string_view data,
+      ViewDatabase& view,
+      const w_string& rootPath,
+      ino_t rootInode);
+
+  /**
+   * Encodes the contents of dir, its files and its dirs with theirs, as
+   * serialize() does for each dir of the view.  This is how the view pages
+   * out the subtrees that it hasn't needed for a while.
+   */
+  static std::string serializeContents(const watchman_dir* dir);
+
+  /**
+   * Decodes contents made by serializeContents() into dir, which must be
+   * empty, and returns the file nodes that it made, which have yet to be
+   * linked into the recency index.
+   *
+   * Throws std::runtime_error if the data is malformed, leaving dir empty.
+   */
+  static std::vector<watchman_file*> deserializeContents(
+      std::string_view data,
+      ViewDatabase& view,
+      watchman_dir* dir);
+
+  /**
+   * Looks up the file at relPath, relative to the dir whose contents were
+   * encoded by serializeContents() as data, without decoding the rest.
+   * Returns whether it exists, or nullopt if there's no file there.
+   *
+   * Throws std::runtime_error if the data is malformed.
+   */
+  static std::optional<bool> lookupInContents(
+      std::string_view data,
+      w_string_piece relPath);
+
+  /**
+   * Atomically replace the file at `path` with `data`, which was produced
+   * by serialize().
+   * Throws std::system_error on failure.
+   */
+  static void write(const w_string& path, std::string_view data);
+
+  /**
+   * Read the snapshot at `path` into `view`.
+   * Returns std::nullopt if there is no snapshot at that path.
+   * Throws if the snapshot is unreadable or invalid.
+   */
+  static std::optional<Header> load(
+      const w_string& path,
+      ViewDatabase& view,
+      const w_string& rootPath,
+      ino_t rootInode);
+
+  /**
+   * Returns the path at which the snapshot for rootPath should be stored,
+   * which is alongside the state file.  Returns a null w_string if the
+   * daemon isn't configured with a state file.
+   */
+  static w_string pathForRoot(const w_string& rootPath);
+};
+
+} // namespace watchman
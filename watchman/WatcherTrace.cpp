@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/WatcherTrace.h"
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cstring>
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr char kMagic[8] = {'W', 'M', 'T', 'R', 'A', 'C', 'E', '1'};
+
+// The fixed size part of a record: offset, flags and path length
+constexpr size_t kRecordHeaderSize =
+    sizeof(int64_t) + sizeof(uint8_t) + sizeof(uint32_t);
+
+template <typename T>
+void put(std::string& out, const T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+T get(const char* data) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  T value;
+  memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+} // namespace
+
+std::string_view WatcherTrace::header() {
+  return std::string_view(kMagic, sizeof(kMagic));
+}
+
+void WatcherTrace::append(std::string& out, const Event& event) {
+  put(out, int64_t(event.offset.count()));
+  put(out, event.flags.asRaw());
+  put(out, uint32_t(event.path.size()));
+  out.append(event.path.data(), event.path.size());
+}
+
+std::vector<WatcherTrace::Event> WatcherTrace::parse(std::string_view data) {
+  if (data.size() < sizeof(kMagic) ||
+      memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+    throw std::runtime_error("not a watcher trace");
+  }
+
+  std::vector<Event> events;
+  size_t offset = sizeof(kMagic);
+  while (data.size() - offset >= kRecordHeaderSize) {
+    const char* record = data.data() + offset;
+    auto micros = get<int64_t>(record);
+    auto flags = get<uint8_t>(record + sizeof(int64_t));
+    auto len = get<uint32_t>(record + sizeof(int64_t) + sizeof(uint8_t));
+    if (data.size() - offset - kRecordHeaderSize < len) {
+      // Cut short while it was being written
+      break;
+    }
+    events.push_back(Event{
+        std::chrono::microseconds(micros),
+        w_string(record + kRecordHeaderSize, len, W_STRING_BYTE),
+        PendingFlags::raw(flags)});
+    offset += kRecordHeaderSize + len;
+  }
+  return events;
+}
+
+std::vector<WatcherTrace::Event> WatcherTrace::load(const w_string& path) {
+  std::string data;
+  if (!folly::readFile(path.c_str(), data)) {
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        folly::to<std::string>("reading watcher trace ", path.view()));
+  }
+  return parse(data);
+}
+
+WatcherTraceWriter::WatcherTraceWriter(
+    const w_string& path,
+    const w_string& rootPath)
+    : path_(path),
+      rootPath_(rootPath),
+      file_(w_stm_open(
+          path.c_str(),
+          O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC,
+          0600)),
+      started_(std::chrono::system_clock::now()) {
+  if (!file_) {
+    throw std::system_error(
+        errno,
+        std::generic_category(),
+        folly::to<std::string>("opening watcher trace ", path.view()));
+  }
+  buffer_.append(WatcherTrace::header());
+  flush();
+}
+
+void WatcherTraceWriter::add(const PendingChange& change) {
+  if (failed_) {
+    return;
+  }
+
+  w_string_piece path = change.path;
+  w_string relative;
+  if (path.size() > rootPath_.size() && path.startsWith(rootPath_) &&
+      is_slash(path.data()[rootPath_.size()])) {
+    relative = w_string(
+        path.data() + rootPath_.size() + 1,
+        path.size() - rootPath_.size() - 1,
+        W_STRING_BYTE);
+  } else if (path != rootPath_) {
+    return;
+  }
+
+  auto offset = std::chrono::duration_cast<std::chrono::microseconds>(
+      change.now - started_);
+  WatcherTrace::append(
+      buffer_,
+      WatcherTrace::Event{
+          std::max(offset, std::chrono::microseconds(0)),
+          std::move(relative),
+          change.flags});
+}
+
+void WatcherTraceWriter::flush() {
+  size_t written = 0;
+  while (!failed_ && written < buffer_.size()) {
+    auto n = file_->write(
+        buffer_.data() + written,
+        int(std::min(buffer_.size() - written, size_t(1024 * 1024))));
+    if (n <= 0) {
+      log(ERR,
+          "writing watcher trace ",
+          path_,
+          " failed: ",
+          folly::errnoStr(errno),
+          "; no longer recording\n");
+      failed_ = true;
+    } else {
+      written += size_t(n);
+    }
+  }
+  buffer_.clear();
+}
+
+} // namespace watchman
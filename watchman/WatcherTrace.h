@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <chrono>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "watchman/PendingCollection.h"
+#include "watchman/watchman_stream.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * A recording of the changes that a watcher reported for a root, which the
+ * "replay" watcher can feed into a view again later on, so that the way
+ * that the view, settling and subscriptions deal with a storm of changes
+ * can be measured and reproduced away from the machine that saw it.
+ *
+ * The encoding is a magic string followed by a record per change: the
+ * microseconds between the start of the recording and the change, its
+ * PendingFlags, and its path relative to the root, in host byte order.
+ * There is no trailer, so a recording that was cut short by the daemon
+ * going away is still readable up to the last whole record.
+ */
+class WatcherTrace {
+ public:
+  struct Event {
+    // Since the recording began
+    std::chrono::microseconds offset;
+    // Relative to the root; empty for the root itself
+    w_string path;
+    PendingFlags flags;
+  };
+
+  // The bytes that a recording starts with
+  static std::string_view header();
+
+  // Appends the encoding of event to out
+  static void append(std::string& out, const Event& event);
+
+  /**
+   * Decodes a recording.  A trailing partial record is ignored.
+   * Throws std::runtime_error if data is not a recording.
+   */
+  static std::vector<Event> parse(std::string_view data);
+
+  /**
+   * Reads and decodes the recording at path.
+   * Throws std::system_error if it can't be read, or std::runtime_error if
+   * it is not a recording.
+   */
+  static std::vector<Event> load(const w_string& path);
+};
+
+/**
+ * Writes the changes reported by a watcher for a root to a recording as
+ * they happen.  Only used by the notify thread.
+ */
+class WatcherTraceWriter {
+ public:
+  /**
+   * Creates or truncates the file at path.
+   * Throws std::system_error if that fails.
+   */
+  WatcherTraceWriter(const w_string& path, const w_string& rootPath);
+
+  // Records change, if it is in the root, once flush() is next called
+  void add(const PendingChange& change);
+
+  /**
+   * Writes out the changes added since the last call.  Logs, rather than
+   * throws, if the recording can't be written to.
+   */
+  void flush();
+
+ private:
+  w_string path_;
+  w_string rootPath_;
+  std::unique_ptr<watchman_stream> file_;
+  std::chrono::system_clock::time_point started_;
+  std::string buffer_;
+  // Set once a write fails, after which nothing more is recorded
+  bool failed_{false};
+};
+
+} // namespace watchman
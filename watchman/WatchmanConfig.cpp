@@ -425,6 +425,9 @@ namespace watchman {
 
 Configuration::Configuration(const json_ref& local) : local_(local) {}
 
+Configuration::Configuration(const json_ref& local, const json_ref& profile)
+    : local_(local), profile_(profile) {}
+
 json_ref Configuration::get(const char* name) const {
   // Highest precedence: options set locally
   json_ref val;
@@ -444,6 +447,10 @@ json_ref Configuration::get(const char* name) const {
   if (!val) {
     val = cfg_get_raw(name, &state->global_cfg);
   }
+  // and last: the profile for the filesystem
+  if (!val && profile_) {
+    val = profile_.get_default(name);
+  }
   return val;
 }
 
@@ -35,6 +35,9 @@ class Configuration {
  public:
   Configuration() = default;
   explicit Configuration(const json_ref& local);
+  // The options in profile are consulted after all others; see
+  // getFSTypeProfile().
+  Configuration(const json_ref& local, const json_ref& profile);
 
   json_ref get(const char* name) const;
   const char* getString(const char* name, const char* defval) const;
@@ -42,8 +45,13 @@ class Configuration {
   bool getBool(const char* name, bool defval) const;
   double getDouble(const char* name, double defval) const;
 
+  const json_ref& getProfile() const {
+    return profile_;
+  }
+
  private:
   json_ref local_;
+  json_ref profile_;
 };
 
 } // namespace watchman
@@ -8,6 +8,9 @@
 #include "watchman/bser.h"
 #include "watchman/Logging.h"
 #include "watchman/thirdparty/jansson/jansson_private.h"
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
 
 /*
  * This defines a binary serialization of the JSON data objects in this
@@ -38,6 +41,10 @@
 #define BSER_TEMPLATE 0x0b
 #define BSER_SKIP 0x0c
 #define BSER_UTF8STRING 0x0d
+// An int holding how many bytes to take from the start of the string
+// before this one, in the same array or template column, followed by a
+// string holding the rest; see BSER_CAP_ACCEPT_PREFIX_STRINGS
+#define BSER_PREFIX_STRING 0x0e
 
 static const char bser_true = BSER_TRUE;
 static const char bser_false = BSER_FALSE;
@@ -48,6 +55,7 @@ static const char bser_object_hdr = BSER_OBJECT;
 static const char bser_template_hdr = BSER_TEMPLATE;
 static const char bser_utf8string_hdr = BSER_UTF8STRING;
 static const char bser_skip = BSER_SKIP;
+static const char bser_prefix_string_hdr = BSER_PREFIX_STRING;
 
 static bool is_bser_version_supported(const bser_ctx_t* ctx) {
   return ctx->bser_version == 1 || ctx->bser_version == 2;
@@ -82,7 +90,7 @@ bool bunser_generic_string(
   avail -= ineed + 1;
   *needed = ineed + 1 + *len;
 
-  if (*len > avail) {
+  if (*len < 0 || *len > avail) {
     return false;
   }
 
@@ -242,6 +250,102 @@ bser_mixedstring(const bser_ctx_t* ctx, w_string_piece str, void* data) {
   }
 }
 
+static int bser_typed_string(
+    const bser_ctx_t* ctx,
+    w_string_piece str,
+    w_string_type_t type,
+    void* data) {
+  switch (type) {
+    case W_STRING_BYTE:
+      return bser_bytestring(ctx, str, data);
+    case W_STRING_UNICODE:
+      return bser_utf8string(ctx, str, data);
+    case W_STRING_MIXED:
+      return bser_mixedstring(ctx, str, data);
+    default:
+      w_assert(false, "unknown string type 0x%02x", type);
+      return -1;
+  }
+}
+
+// How many of the leading bytes of str a BSER_PREFIX_STRING would take
+// from prev, or 0 if that wouldn't be any shorter than all of str.  The
+// split never falls inside a UTF-8 sequence, so that the rest of a valid
+// UTF-8 string is valid UTF-8 too.
+static size_t bser_shared_prefix(w_string_piece prev, w_string_piece str) {
+  auto n = std::min(prev.size(), str.size());
+  auto shared =
+      size_t(std::mismatch(str.data(), str.data() + n, prev.data()).first -
+             str.data());
+  while (shared > 0 && shared < str.size() &&
+         (uint8_t(str.data()[shared]) & 0xc0) == 0x80) {
+    --shared;
+  }
+  // The cost of the prefix string's header and length
+  if (shared <= 2 + size_t(INT_SIZE(json_int_t(shared)))) {
+    return 0;
+  }
+  return shared;
+}
+
+bool w_bser_accepts_prefix_strings(const bser_ctx_t* ctx) {
+  return ctx->bser_version == 2 &&
+      (ctx->bser_capabilities & BSER_CAP_ACCEPT_PREFIX_STRINGS);
+}
+
+int w_bser_dump_string_after(
+    const bser_ctx_t* ctx,
+    std::optional<w_string_piece> prev,
+    w_string_piece str,
+    w_string_type_t type,
+    void* data) {
+  if (prev && type != W_STRING_MIXED && w_bser_accepts_prefix_strings(ctx)) {
+    auto shared = bser_shared_prefix(*prev, str);
+    if (shared) {
+      if (ctx->dump(
+              &bser_prefix_string_hdr, sizeof(bser_prefix_string_hdr), data)) {
+        return -1;
+      }
+      if (bser_int(ctx, json_int_t(shared), data)) {
+        return -1;
+      }
+      return bser_typed_string(
+          ctx,
+          w_string_piece(str.data() + shared, str.size() - shared),
+          type,
+          data);
+    }
+  }
+  return bser_typed_string(ctx, str, type, data);
+}
+
+// Emits val as the element of an array or template column that follows
+// prev, and then sets prev for the element after it.  The strings that
+// prev refers to belong to the json being emitted.
+static int bser_element(
+    const bser_ctx_t* ctx,
+    const json_ref& val,
+    std::optional<w_string_piece>& prev,
+    void* data) {
+  if (!w_bser_accepts_prefix_strings(ctx)) {
+    return w_bser_dump(ctx, val, data);
+  }
+  if (!val.isString()) {
+    prev.reset();
+    return w_bser_dump(ctx, val, data);
+  }
+  auto& wstr = json_to_w_string(val);
+  if (w_bser_dump_string_after(ctx, prev, wstr, wstr.type(), data)) {
+    return -1;
+  }
+  if (wstr.type() == W_STRING_MIXED) {
+    prev.reset();
+  } else {
+    prev = w_string_piece(wstr);
+  }
+  return 0;
+}
+
 static int bser_array(const bser_ctx_t* ctx, const json_t* array, void* data);
 
 static int bser_template(
@@ -272,12 +376,25 @@ static int bser_template(
   }
 
   pn = json_array_size(templ);
+  // The value of each column in the row before, for BSER_PREFIX_STRING
+  std::vector<std::optional<w_string_piece>> prev(pn);
 
   // For each object
   for (i = 0; i < n; i++) {
     auto obj = json_array_get(array, i);
     size_t pi;
 
+    if (json_record_get_keys(obj) == templ) {
+      // The values are already in template order
+      auto values = json_record_get_values(obj);
+      for (pi = 0; pi < pn; pi++) {
+        if (bser_element(ctx, values[pi], prev[pi], data)) {
+          return -1;
+        }
+      }
+      continue;
+    }
+
     // For each factored key
     for (pi = 0; pi < pn; pi++) {
       const char* key = json_string_value(json_array_get(templ, pi));
@@ -289,11 +406,12 @@ static int bser_template(
         if (ctx->dump(&bser_skip, sizeof(bser_skip), data)) {
           return -1;
         }
+        prev[pi].reset();
         continue;
       }
 
       // Emit value
-      if (w_bser_dump(ctx, val, data)) {
+      if (bser_element(ctx, val, prev[pi], data)) {
         return -1;
       }
     }
@@ -323,10 +441,11 @@ static int bser_array(const bser_ctx_t* ctx, const json_t* array, void* data) {
     return -1;
   }
 
+  std::optional<w_string_piece> prev;
   for (i = 0; i < n; i++) {
     auto val = json_array_get(array, i);
 
-    if (w_bser_dump(ctx, val, data)) {
+    if (bser_element(ctx, val, prev, data)) {
       return -1;
     }
   }
@@ -334,7 +453,12 @@ static int bser_array(const bser_ctx_t* ctx, const json_t* array, void* data) {
   return 0;
 }
 
-static int bser_object(const bser_ctx_t* ctx, const json_ref& obj, void* data) {
+static int bser_object(
+    const bser_ctx_t* ctx,
+    const json_ref& obj,
+    void* data,
+    const char* extraKey = nullptr,
+    const bser_field_dump_t* extraField = nullptr) {
   size_t n;
 
   if (!is_bser_version_supported(ctx)) {
@@ -346,10 +470,36 @@ static int bser_object(const bser_ctx_t* ctx, const json_ref& obj, void* data) {
   }
 
   n = json_object_size(obj);
+  if (extraField) {
+    ++n;
+  }
   if (bser_int(ctx, n, data)) {
     return -1;
   }
 
+  if (extraField) {
+    if (bser_bytestring(ctx, extraKey, data)) {
+      return -1;
+    }
+    if ((*extraField)(ctx, data)) {
+      return -1;
+    }
+  }
+
+  if (auto keys = json_record_get_keys(obj)) {
+    auto values = json_record_get_values(obj);
+    for (size_t i = 0; i < json_array_size(keys); ++i) {
+      if (bser_bytestring(
+              ctx, json_to_w_string(json_array_get(keys, i)), data)) {
+        return -1;
+      }
+      if (w_bser_dump(ctx, values[i], data)) {
+        return -1;
+      }
+    }
+    return 0;
+  }
+
   for (auto& it : obj.object()) {
     auto& key = it.first;
     auto& val = it.second;
@@ -385,17 +535,7 @@ int w_bser_dump(const bser_ctx_t* ctx, const json_ref& json, void* data) {
       return bser_int(ctx, json.asInt(), data);
     case JSON_STRING: {
       auto& wstr = json_to_w_string(json);
-      switch (wstr.type()) {
-        case W_STRING_BYTE:
-          return bser_bytestring(ctx, wstr, data);
-        case W_STRING_UNICODE:
-          return bser_utf8string(ctx, wstr, data);
-        case W_STRING_MIXED:
-          return bser_mixedstring(ctx, wstr, data);
-        default:
-          w_assert(false, "unknown string type 0x%02x", wstr.type());
-          return -1;
-      }
+      return bser_typed_string(ctx, wstr, wstr.type(), data);
     }
     case JSON_ARRAY:
       return bser_array(ctx, json, data);
@@ -406,17 +546,97 @@ int w_bser_dump(const bser_ctx_t* ctx, const json_ref& json, void* data) {
   }
 }
 
+int w_bser_dump_bytestring(
+    const bser_ctx_t* ctx,
+    w_string_piece str,
+    void* data) {
+  return bser_bytestring(ctx, str, data);
+}
+
+int w_bser_dump_bool(const bser_ctx_t* ctx, bool value, void* data) {
+  if (!is_bser_version_supported(ctx)) {
+    return -1;
+  }
+  return value ? ctx->dump(&bser_true, sizeof(bser_true), data)
+               : ctx->dump(&bser_false, sizeof(bser_false), data);
+}
+
+int w_bser_dump_array_header(const bser_ctx_t* ctx, size_t n, void* data) {
+  if (!is_bser_version_supported(ctx)) {
+    return -1;
+  }
+  if (ctx->dump(&bser_array_hdr, sizeof(bser_array_hdr), data)) {
+    return -1;
+  }
+  return bser_int(ctx, n, data);
+}
+
+int w_bser_dump_template_header(
+    const bser_ctx_t* ctx,
+    const json_ref& keys,
+    size_t n,
+    void* data) {
+  if (!is_bser_version_supported(ctx)) {
+    return -1;
+  }
+  if (ctx->dump(&bser_template_hdr, sizeof(bser_template_hdr), data)) {
+    return -1;
+  }
+  if (bser_array(ctx, keys, data)) {
+    return -1;
+  }
+  return bser_int(ctx, n, data);
+}
+
 static int measure(const char*, size_t size, void* ptr) {
   auto tot = (json_int_t*)ptr;
   *tot += size;
   return 0;
 }
 
-int w_bser_write_pdu(
+// Encodes the body of a pdu; either json itself, or json with an extra
+// pre-encoded field.
+static int bser_pdu_body(
+    const bser_ctx_t* ctx,
+    const json_ref& json,
+    const char* extraKey,
+    const bser_field_dump_t* extraField,
+    void* data) {
+  if (extraField) {
+    return bser_object(ctx, json, data, extraKey, extraField);
+  }
+  return w_bser_dump(ctx, json, data);
+}
+
+static int bser_pdu_header(
+    const bser_ctx_t* ctx,
+    json_int_t bodySize,
+    void* data) {
+  if (ctx->bser_version == 2) {
+    if (ctx->dump(BSER_V2_MAGIC, 2, data)) {
+      return -1;
+    }
+    if (ctx->dump(
+            (const char*)&ctx->bser_capabilities,
+            sizeof(ctx->bser_capabilities),
+            data)) {
+      return -1;
+    }
+  } else {
+    if (ctx->dump(BSER_MAGIC, 2, data)) {
+      return -1;
+    }
+  }
+  return bser_int(ctx, bodySize, data);
+}
+
+static int bser_write_pdu(
     const uint32_t bser_version,
     const uint32_t bser_capabilities,
     json_dump_callback_t dump,
     const json_ref& json,
+    const char* extraKey,
+    const bser_field_dump_t* extraField,
     void* data) {
   json_int_t m_size = 0;
   bser_ctx_t ctx{bser_version, bser_capabilities, measure};
@@ -425,42 +645,152 @@ int w_bser_write_pdu(
     return -1;
   }
 
-  if (w_bser_dump(&ctx, json, &m_size)) {
+  if (bser_pdu_body(&ctx, json, extraKey, extraField, &m_size)) {
     return -1;
   }
 
   // To actually write the contents
   ctx.dump = dump;
 
-  if (bser_version == 2) {
-    if (dump(BSER_V2_MAGIC, 2, data)) {
-      return -1;
-    }
-  } else {
-    if (dump(BSER_MAGIC, 2, data)) {
-      return -1;
-    }
+  if (bser_pdu_header(&ctx, m_size, data)) {
+    return -1;
   }
 
-  if (bser_version == 2) {
-    if (dump(
-            (const char*)&bser_capabilities, sizeof(bser_capabilities), data)) {
-      return -1;
-    }
+  if (bser_pdu_body(&ctx, json, extraKey, extraField, data)) {
+    return -1;
   }
 
-  if (bser_int(&ctx, m_size, data)) {
+  return 0;
+}
+
+int w_bser_dump_pdu_body(
+    const bser_ctx_t* ctx,
+    const json_ref& json,
+    const char* key,
+    const bser_field_dump_t* dumpField,
+    void* data) {
+  if (!is_bser_version_supported(ctx)) {
     return -1;
   }
-
-  if (w_bser_dump(&ctx, json, data)) {
+  if (dumpField && !json.isObject()) {
     return -1;
   }
+  return bser_pdu_body(ctx, json, key, dumpField, data);
+}
 
+static int append_to_string(const char* buffer, size_t size, void* ptr) {
+  static_cast<std::string*>(ptr)->append(buffer, size);
   return 0;
 }
 
+std::string w_bser_pdu_header(
+    uint32_t bser_version,
+    uint32_t bser_capabilities,
+    json_int_t bodySize) {
+  bser_ctx_t ctx{bser_version, bser_capabilities, append_to_string};
+  std::string header;
+  bser_pdu_header(&ctx, bodySize, &header);
+  return header;
+}
+
+int w_bser_write_pdu(
+    const uint32_t bser_version,
+    const uint32_t bser_capabilities,
+    json_dump_callback_t dump,
+    const json_ref& json,
+    void* data) {
+  return bser_write_pdu(
+      bser_version, bser_capabilities, dump, json, nullptr, nullptr, data);
+}
+
+int w_bser_write_pdu_with_field(
+    const uint32_t bser_version,
+    const uint32_t bser_capabilities,
+    json_dump_callback_t dump,
+    const json_ref& json,
+    const char* key,
+    const bser_field_dump_t& dumpField,
+    void* data) {
+  if (!json.isObject()) {
+    return -1;
+  }
+  return bser_write_pdu(
+      bser_version, bser_capabilities, dump, json, key, &dumpField, data);
+}
+
+namespace {
+
+// The object keys seen so far while decoding a PDU.  Requests and responses
+// repeat the same handful of keys in every object, so each distinct key is
+// only materialized as a w_string once.  The views refer to the bytes being
+// decoded, and so the cache mustn't outlive the call to bunser.
+using bunser_keys_t = std::unordered_map<std::string_view, w_string>;
+
+// How many elements a container that claims to hold nelems could really
+// hold, given that each of them takes at least a byte of what is left to
+// decode.  Used to size containers up front without trusting the input.
+size_t bunser_capacity(json_int_t nelems, const char* buf, const char* end) {
+  return size_t(std::clamp(nelems, json_int_t(0), json_int_t(end - buf)));
+}
+
+} // namespace
+
+static json_ref bunser_value(
+    bunser_keys_t& keys,
+    const char* buf,
+    const char* end,
+    json_int_t* needed,
+    json_error_t* jerr);
+
+// Decodes the BSER_PREFIX_STRING at buf, which follows prev in its array
+// or template column
+static json_ref bunser_prefix_string(
+    const json_ref& prev,
+    const char* buf,
+    const char* end,
+    json_int_t* needed,
+    json_error_t* jerr) {
+  json_int_t ineed, shared;
+  if (end - buf < 2 ||
+      !bunser_int(buf + 1, end - buf - 1, &ineed, &shared)) {
+    *needed = -1;
+    snprintf(
+        jerr->text, sizeof(jerr->text), "invalid prefix string length");
+    return nullptr;
+  }
+  buf += 1 + ineed;
+
+  const char* start;
+  json_int_t len, sneed;
+  if (buf >= end || (*buf != BSER_BYTESTRING && *buf != BSER_UTF8STRING) ||
+      !bunser_generic_string(buf, end - buf, &sneed, &start, &len)) {
+    *needed = -1;
+    snprintf(
+        jerr->text, sizeof(jerr->text), "invalid prefix string encoding");
+    return nullptr;
+  }
+  *needed = 1 + ineed + sneed;
+
+  if (!prev || !prev.isString() || shared < 0 ||
+      size_t(shared) > json_to_w_string(prev).size()) {
+    snprintf(
+        jerr->text,
+        sizeof(jerr->text),
+        "prefix string of %d bytes doesn't follow a long enough string",
+        (int)shared);
+    return nullptr;
+  }
+
+  std::string str(json_to_w_string(prev).data(), size_t(shared));
+  str.append(start, size_t(len));
+  return typed_string_to_json(
+      str.data(),
+      str.size(),
+      *buf == BSER_BYTESTRING ? W_STRING_BYTE : W_STRING_UNICODE);
+}
+
 static json_ref bunser_array(
+    bunser_keys_t& keys,
     const char* buf,
     const char* end,
     json_int_t* used,
@@ -496,10 +826,13 @@ static json_ref bunser_array(
   total += needed;
   buf += needed;
 
-  auto arrval = json_array();
+  auto arrval = json_array_of_size(bunser_capacity(nelems, buf, end));
+  json_ref prev;
   for (i = 0; i < nelems; i++) {
     needed = 0;
-    auto item = bunser(buf, end, &needed, jerr);
+    auto item = buf < end && *buf == BSER_PREFIX_STRING
+        ? bunser_prefix_string(prev, buf, end, &needed, jerr)
+        : bunser_value(keys, buf, end, &needed, jerr);
 
     total += needed;
     buf += needed;
@@ -509,6 +842,7 @@ static json_ref bunser_array(
       return nullptr;
     }
 
+    prev = item;
     if (json_array_append_new(arrval, std::move(item))) {
       *used = total;
       snprintf(jerr->text, sizeof(jerr->text), "failed to append array item");
@@ -521,6 +855,7 @@ static json_ref bunser_array(
 }
 
 static json_ref bunser_template(
+    bunser_keys_t& keys,
     const char* buf,
     const char* end,
     json_int_t* used,
@@ -544,7 +879,7 @@ static json_ref bunser_template(
   }
 
   // Load in the property names template
-  auto templ = bunser_array(buf, end, &needed, jerr);
+  auto templ = bunser_array(keys, buf, end, &needed, jerr);
   if (!templ) {
     *used = needed + total;
     return nullptr;
@@ -569,19 +904,39 @@ static json_ref bunser_template(
 
   np = json_array_size(templ);
 
+  // Every row shares a key string per column, rather than each cell
+  // getting its own copy.  Keys are bytestrings, as they are for objects.
+  // A key that isn't a string can't be set, so its values are dropped.
+  std::vector<w_string> templKeys;
+  templKeys.reserve(np);
+  for (auto& key : templ.array()) {
+    if (!key.isString()) {
+      templKeys.emplace_back();
+      continue;
+    }
+    auto& str = json_to_w_string(key);
+    templKeys.push_back(
+        str.type() == W_STRING_BYTE ? str : w_string(str.data(), str.size()));
+  }
+
   // Now load up the array with object values
-  auto arrval = json_array_of_size((size_t)nelems);
+  auto arrval = json_array_of_size(bunser_capacity(nelems, buf, end));
+  // The value of each column in the row before, for BSER_PREFIX_STRING
+  std::vector<json_ref> prev(size_t(std::max(np, json_int_t(0))));
   for (i = 0; i < nelems; i++) {
     auto item = json_object_of_size((size_t)np);
     for (ip = 0; ip < np; ip++) {
       if (*buf == BSER_SKIP) {
         buf++;
         total++;
+        prev[ip].reset();
         continue;
       }
 
       needed = 0;
-      auto val = bunser(buf, end, &needed, jerr);
+      auto val = *buf == BSER_PREFIX_STRING
+          ? bunser_prefix_string(prev[ip], buf, end, &needed, jerr)
+          : bunser_value(keys, buf, end, &needed, jerr);
       if (!val) {
         *used = needed + total;
         return nullptr;
@@ -589,10 +944,10 @@ static json_ref bunser_template(
       buf += needed;
       total += needed;
 
-      json_object_set_new_nocheck(
-          item,
-          json_string_value(json_array_get(templ, (size_t)ip)),
-          std::move(val));
+      prev[ip] = val;
+      if (templKeys[ip]) {
+        item.set(templKeys[ip], std::move(val));
+      }
     }
 
     json_array_append_new(arrval, std::move(item));
@@ -603,6 +958,7 @@ static json_ref bunser_template(
 }
 
 static json_ref bunser_object(
+    bunser_keys_t& keys,
     const char* buf,
     const char* end,
     json_int_t* used,
@@ -610,7 +966,6 @@ static json_ref bunser_object(
   json_int_t needed;
   json_int_t total = 0;
   json_int_t i, nelems;
-  char keybuf[128];
 
   total = 1;
   buf++;
@@ -627,7 +982,7 @@ static json_ref bunser_object(
   total += needed;
   buf += needed;
 
-  auto objval = json_object();
+  auto objval = json_object_of_size(bunser_capacity(nelems, buf, end));
   for (i = 0; i < nelems; i++) {
     const char* start;
     json_int_t slen;
@@ -642,17 +997,14 @@ static json_ref bunser_object(
     total += needed;
     buf += needed;
 
-    // Saves us allocating a string when the library is going to
-    // do that anyway
-    if ((uint16_t)slen > sizeof(keybuf) - 1) {
-      snprintf(jerr->text, sizeof(jerr->text), "object key is too long");
-      return nullptr;
+    std::string_view keyView(start, (size_t)slen);
+    auto key = keys.find(keyView);
+    if (key == keys.end()) {
+      key = keys.emplace(keyView, w_string(start, (size_t)slen)).first;
     }
-    memcpy(keybuf, start, (size_t)slen);
-    keybuf[slen] = '\0';
 
     // Read value
-    auto item = bunser(buf, end, &needed, jerr);
+    auto item = bunser_value(keys, buf, end, &needed, jerr);
     total += needed;
     buf += needed;
 
@@ -661,18 +1013,15 @@ static json_ref bunser_object(
       return nullptr;
     }
 
-    if (json_object_set_new_nocheck(objval, keybuf, std::move(item))) {
-      *used = total;
-      snprintf(jerr->text, sizeof(jerr->text), "failed to add object property");
-      return nullptr;
-    }
+    objval.set(key->second, std::move(item));
   }
 
   *used = total;
   return objval;
 }
 
-json_ref bunser(
+static json_ref bunser_value(
+    bunser_keys_t& keys,
     const char* buf,
     const char* end,
     json_int_t* needed,
@@ -723,11 +1072,11 @@ json_ref bunser(
       *needed = 1;
       return json_null();
     case BSER_ARRAY:
-      return bunser_array(buf, end, needed, jerr);
+      return bunser_array(keys, buf, end, needed, jerr);
     case BSER_TEMPLATE:
-      return bunser_template(buf, end, needed, jerr);
+      return bunser_template(keys, buf, end, needed, jerr);
     case BSER_OBJECT:
-      return bunser_object(buf, end, needed, jerr);
+      return bunser_object(keys, buf, end, needed, jerr);
     default:
       snprintf(
           jerr->text,
@@ -742,5 +1091,14 @@ json_ref bunser(
 #endif
 }
 
+json_ref bunser(
+    const char* buf,
+    const char* end,
+    json_int_t* needed,
+    json_error_t* jerr) {
+  bunser_keys_t keys;
+  return bunser_value(keys, buf, end, needed, jerr);
+}
+
 /* vim:ts=2:sw=2:et:
  */
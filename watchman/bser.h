@@ -7,6 +7,9 @@
 
 #pragma once
 
+#include <functional>
+#include <optional>
+#include <string>
 #include "watchman/thirdparty/jansson/jansson.h"
 
 typedef struct bser_ctx {
@@ -21,6 +24,26 @@ typedef struct bser_ctx {
 // BSERv2 capabilities. Must be powers of 2.
 #define BSER_CAP_DISABLE_UNICODE 0x1
 #define BSER_CAP_DISABLE_UNICODE_FOR_ERRORS 0x2
+// Set by a client that can decode responses with BSER_CAP_ZSTD_BODY set;
+// the server only compresses responses that are larger than
+// bser_compression_min_size.
+#define BSER_CAP_ACCEPT_ZSTD 0x4
+// The body of this pdu is its uncompressed size, as an encoded integer,
+// followed by a zstd frame holding the uncompressed body.
+#define BSER_CAP_ZSTD_BODY 0x8
+// Set by a client on a unix domain socket that can receive responses with
+// BSER_CAP_FD_BODY set; the server only does this for responses that are
+// larger than bser_shared_memory_min_size.
+#define BSER_CAP_ACCEPT_FD 0x10
+// The body of this pdu is the size, as an encoded integer, of a complete
+// pdu held in a sealed memory file.  The descriptor of that file is passed
+// over the socket, using SCM_RIGHTS, along with the first byte of this pdu.
+#define BSER_CAP_FD_BODY 0x20
+// Set by a client that can decode BSER_PREFIX_STRING values: a string in
+// an array, or in a column of a template, that takes its first bytes from
+// the string before it.  Query results repeat long directory prefixes from
+// one name to the next, and this leaves only what differs.
+#define BSER_CAP_ACCEPT_PREFIX_STRINGS 0x40
 
 int w_bser_write_pdu(
     const uint32_t bser_version,
@@ -29,6 +52,71 @@ int w_bser_write_pdu(
     const json_ref& json,
     void* data);
 int w_bser_dump(const bser_ctx_t* ctx, const json_ref& json, void* data);
+
+// Emit a single string or boolean value, for callers that produce the
+// values of a template or array without building json for them.
+int w_bser_dump_bytestring(
+    const bser_ctx_t* ctx,
+    w_string_piece str,
+    void* data);
+int w_bser_dump_bool(const bser_ctx_t* ctx, bool value, void* data);
+
+// Whether strings may be emitted as BSER_PREFIX_STRINGs for this client
+bool w_bser_accepts_prefix_strings(const bser_ctx_t* ctx);
+
+// Emit str, of the given type, as the value that follows prev in an array
+// or in a column of a template.  It may be emitted as a BSER_PREFIX_STRING
+// that takes its start from prev, which must be what was emitted for the
+// value before it, or nullopt if that wasn't a string or was a
+// W_STRING_MIXED string, which isn't emitted as its own bytes.
+int w_bser_dump_string_after(
+    const bser_ctx_t* ctx,
+    std::optional<w_string_piece> prev,
+    w_string_piece str,
+    w_string_type_t type,
+    void* data);
+
+// Emit the header for an array of n values; the caller then emits
+// the values themselves.
+int w_bser_dump_array_header(const bser_ctx_t* ctx, size_t n, void* data);
+
+// Emit the header for a template of n objects with the specified array of
+// keys; the caller then emits the values of each object in key order.
+int w_bser_dump_template_header(
+    const bser_ctx_t* ctx,
+    const json_ref& keys,
+    size_t n,
+    void* data);
+
+// Emits an already encoded value via ctx->dump.
+using bser_field_dump_t = std::function<int(const bser_ctx_t* ctx, void* data)>;
+
+// Like w_bser_write_pdu, but json must be an object and the pdu will
+// additionally hold key with the value emitted by dumpField.
+// dumpField is called twice; once to measure and once to write.
+int w_bser_write_pdu_with_field(
+    const uint32_t bser_version,
+    const uint32_t capabilities,
+    json_dump_callback_t dump,
+    const json_ref& json,
+    const char* key,
+    const bser_field_dump_t& dumpField,
+    void* data);
+// Encodes the body of a pdu in a single pass, without first measuring it.
+// If key is set, json must be an object and the body will additionally
+// hold key with the value emitted by dumpField.  The body must be preceded
+// by the header returned by w_bser_pdu_header for the size of the body.
+int w_bser_dump_pdu_body(
+    const bser_ctx_t* ctx,
+    const json_ref& json,
+    const char* key,
+    const bser_field_dump_t* dumpField,
+    void* data);
+std::string w_bser_pdu_header(
+    uint32_t bser_version,
+    uint32_t bser_capabilities,
+    json_int_t bodySize);
+
 bool bunser_int(
     const char* buf,
     json_int_t avail,
@@ -5,8 +5,7 @@
  * LICENSE file in the root directory of this source tree.
  */
 
-use ahash::AHashMap;
-use jwalk::WalkDir;
+use jwalk::WalkDirGeneric;
 use serde::Deserialize;
 use std::io::ErrorKind;
 #[cfg(unix)]
@@ -102,7 +101,7 @@ impl AuditCmd {
         let filesystem_state_handle = {
             let resolved = resolved.clone();
             tokio::spawn(async move {
-                let mut filesystem_state: AHashMap<PathBuf, std::fs::Metadata> = AHashMap::new();
+                let mut filesystem_state: Vec<(PathBuf, std::fs::Metadata)> = Vec::new();
 
                 let start_crawl = Instant::now();
 
@@ -110,26 +109,36 @@ impl AuditCmd {
                 let resolved_path = Arc::new(resolved.path());
 
                 let resolved_path_copy = resolved_path.clone();
-                let walk_dir = WalkDir::new(&*resolved_path)
-                    .skip_hidden(false)
-                    .process_read_dir(move |_depth, path, _read_dir_state, children| {
-                        let resolved_path: &Path = resolved_path_copy.as_ref();
-                        let from_root = match path.strip_prefix(resolved_path) {
-                            Ok(from_root) => from_root,
-                            Err(_) => {
-                                return;
-                            }
-                        };
-
-                        if from_root == Path::new("") {
-                            children.retain(|child| match child {
-                                Ok(child) => {
-                                    ignore_dirs.iter().all(|i| i.as_os_str() != child.file_name)
-                                }
-                                Err(_) => true,
-                            });
+                // Each entry carries its metadata, which is fetched as its
+                // dir is read, on the walk's threads, rather than one entry at
+                // a time as they are consumed below.
+                let walk_dir = WalkDirGeneric::<(
+                    (),
+                    Option<Result<std::fs::Metadata, jwalk::Error>>,
+                )>::new(&*resolved_path)
+                .skip_hidden(false)
+                .process_read_dir(move |_depth, path, _read_dir_state, children| {
+                    let resolved_path: &Path = resolved_path_copy.as_ref();
+                    let from_root = match path.strip_prefix(resolved_path) {
+                        Ok(from_root) => from_root,
+                        Err(_) => {
+                            return;
                         }
-                    });
+                    };
+
+                    if from_root == Path::new("") {
+                        children.retain(|child| match child {
+                            Ok(child) => {
+                                ignore_dirs.iter().all(|i| i.as_os_str() != child.file_name)
+                            }
+                            Err(_) => true,
+                        });
+                    }
+
+                    for child in children.iter_mut().flatten() {
+                        child.client_state = Some(child.metadata());
+                    }
+                });
 
                 for entry in walk_dir {
                     let entry = match entry {
@@ -154,9 +163,12 @@ impl AuditCmd {
                         }
                     };
 
-                    let metadata = match entry.metadata() {
-                        Ok(metadata) => metadata,
-                        Err(err) => {
+                    let metadata = match entry.client_state {
+                        Some(Ok(metadata)) => metadata,
+                        // The root, which watchman doesn't return information
+                        // about
+                        None => continue,
+                        Some(Err(err)) => {
                             if err.io_error().map(|e| e.kind() == ErrorKind::NotFound) != Some(true)
                             {
                                 eprintln!(
@@ -168,12 +180,13 @@ impl AuditCmd {
                             continue;
                         }
                     };
-                    filesystem_state.insert(relpath.to_path_buf(), metadata);
+                    filesystem_state.push((relpath.to_path_buf(), metadata));
                 }
-                // Watchman doesn't return information about the root, so remove it here.
-                filesystem_state.remove(&PathBuf::new());
                 eprintln!("Crawled filesystem in {:?}", start_crawl.elapsed());
 
+                // Sorted, so that it can be merged with the query results
+                filesystem_state.sort_unstable_by(|a, b| a.0.cmp(&b.0));
+
                 filesystem_state
             })
         };
@@ -270,18 +283,30 @@ impl AuditCmd {
         let mut phantoms = vec![];
         let mut missing = vec![];
 
-        let mut watchman_state: AHashMap<&Path, &AuditQueryResult> =
-            AHashMap::with_capacity(watchman_files.len());
-        for watchman_file in &watchman_files {
-            let filename = &*watchman_file.name;
-            // Skip cookies when diffing.
-            if is_cookie(filename) {
-                continue;
+        // Both sides are walked in path order, so that each file is matched
+        // up with its counterpart without building a map of either of them.
+        let mut watchman_state: Vec<&AuditQueryResult> = watchman_files
+            .iter()
+            .filter(|file| !is_cookie(&*file.name))
+            .collect();
+        watchman_state.sort_unstable_by(|a, b| (*a.name).cmp(&*b.name));
+        let mut filesystem_entries = filesystem_state
+            .iter()
+            .filter(|(path, _)| !is_cookie(path))
+            .peekable();
+
+        for watchman_file in watchman_state {
+            let filename: &Path = &*watchman_file.name;
+
+            while let Some(entry) =
+                filesystem_entries.next_if(|(path, _)| path.as_path() < filename)
+            {
+                missing.push(entry);
             }
-            watchman_state.insert(filename, watchman_file);
 
-            let metadata = match filesystem_state.get(filename) {
-                Some(metadata) => metadata,
+            let metadata = match filesystem_entries.next_if(|(path, _)| path.as_path() == filename)
+            {
+                Some((_, metadata)) => metadata,
                 None => {
                     phantoms.push(watchman_file);
                     continue;
@@ -363,17 +388,7 @@ impl AuditCmd {
             }
         }
 
-        for (path, val) in &filesystem_state {
-            if is_cookie(path) {
-                continue;
-            }
-            if !watchman_state.contains_key(&path.as_path()) {
-                missing.push((path, val));
-            }
-        }
-
-        phantoms.sort_by(|x, y| x.name.cmp(&y.name));
-        missing.sort_by(|x, y| x.0.cmp(&y.0));
+        missing.extend(filesystem_entries);
 
         if !phantoms.is_empty() {
             println!(
@@ -7,11 +7,18 @@
 
 #include <folly/chrono/Conv.h>
 #include <iomanip>
+#include <thread>
+#include "watchman/CrawlScheduler.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/LRUCache.h"
 #include "watchman/Logging.h"
+#include "watchman/MemoryProfile.h"
+#include "watchman/NodeArena.h"
 #include "watchman/Poison.h"
+#include "watchman/QueryScheduler.h"
 #include "watchman/QueryableView.h"
+#include "watchman/ThreadStats.h"
+#include "watchman/TraceRecorder.h"
 #include "watchman/root/Root.h"
 #include "watchman/watchman_client.h"
 #include "watchman/watchman_cmd.h"
@@ -253,10 +260,63 @@ W_CMD_REG(
     CMD_DAEMON,
     w_cmd_realpath_root)
 
+static void cmd_debug_slow_queries(
+    struct watchman_client* clientbase,
+    const json_ref& args) {
+  auto* client = static_cast<watchman_user_client*>(clientbase);
+
+  auto root = resolveRoot(client, args);
+  auto queries = json_array();
+  if (root->slowQueries) {
+    for (auto& entry : root->slowQueries->readAll()) {
+      json_array_append(queries, entry.asJsonValue());
+    }
+  }
+
+  auto response = make_response();
+  response.set(
+      {{"root", w_string_to_json(root->root_path)},
+       {"threshold_ms", json_integer(root->slowQueryThreshold.count())},
+       {"slow_queries", std::move(queries)}});
+  send_and_dispose_response(client, std::move(response));
+}
+W_CMD_REG(
+    "debug-slow-queries",
+    cmd_debug_slow_queries,
+    CMD_DAEMON,
+    w_cmd_realpath_root)
+
+static json_ref threadUsageToJson(const ThreadStats::Usage& usage) {
+  auto toMs = [](std::chrono::nanoseconds duration) {
+    return json_integer(
+        std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+            .count());
+  };
+  return json_object(
+      {{"cpu_ms", toMs(usage.cpu)}, {"wait_ms", toMs(usage.wait)}});
+}
+
 static void cmd_debug_status(struct watchman_client* client, const json_ref&) {
   auto resp = make_response();
   auto roots = Root::getStatusForAllRoots();
   resp.set("roots", std::move(roots));
+  resp.set("crawl_scheduler", CrawlScheduler::get().getSummary());
+
+  auto threads = json_array();
+  for (auto& thread : ThreadStats::getLiveThreads()) {
+    auto info = threadUsageToJson(thread.usage);
+    info.set("name", typed_string_to_json(thread.name.c_str(), W_STRING_BYTE));
+    if (!thread.root.empty()) {
+      info.set(
+          "root", typed_string_to_json(thread.root.c_str(), W_STRING_BYTE));
+    }
+    json_array_append(threads, info);
+  }
+  resp.set("threads", std::move(threads));
+  auto exited = ThreadStats::getExitedTotals();
+  auto exitedInfo = threadUsageToJson(exited.usage);
+  exitedInfo.set("threads", json_integer(exited.threads));
+  resp.set("exited_threads", std::move(exitedInfo));
   send_and_dispose_response(client, std::move(resp));
 }
 W_CMD_REG(
@@ -265,6 +325,176 @@ W_CMD_REG(
     CMD_DAEMON | CMD_ALLOW_ANY_USER,
     NULL)
 
+static void cmd_debug_memory(
+    struct watchman_client* client,
+    const json_ref& args) {
+  if (json_array_size(args) != 2) {
+    send_error_response(client, "wrong number of arguments for 'debug-memory'");
+    return;
+  }
+
+  auto root = resolveRoot(client, args);
+
+  // The nodes of every root come from the same few arenas
+  auto arena = getNodeArenaStats();
+  auto resp = make_response();
+  resp.set(
+      {{"root", root->getMemoryUsage()},
+       {"node_arena",
+        json_object(
+            {{"slabs", json_integer(arena.numSlabs)},
+             {"slab_bytes",
+              json_integer(arena.numSlabs * NodeArena::kSlabSize)},
+             {"live_blocks", json_integer(arena.liveBlocks)},
+             {"live_bytes", json_integer(arena.liveBytes)}})}});
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG(
+    "debug-memory",
+    cmd_debug_memory,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    w_cmd_realpath_root)
+
+static void cmd_debug_memory_profile(
+    struct watchman_client* client,
+    const json_ref& args) {
+  // An optional second argument sets how many sites to report
+  size_t topN = 20;
+  if (json_array_size(args) > 2 ||
+      (json_array_size(args) == 2 && !args.at(1).isInt())) {
+    send_error_response(
+        client, "wrong arguments for 'debug-memory-profile'");
+    return;
+  }
+  if (json_array_size(args) == 2) {
+    topN = size_t(std::max(json_int_t(0), args.at(1).asInt()));
+  }
+
+  auto report = MemoryProfile::getReport(topN);
+
+  auto tags = json_object();
+  for (size_t i = 0; i < kNumMemoryTags; ++i) {
+    auto& stats = report.tags[i];
+    tags.set(
+        memoryTagName(MemoryTag(i)),
+        json_object(
+            {{"live_bytes", json_integer(stats.liveBytes)},
+             {"live_objects", json_integer(stats.liveObjects)},
+             {"total_bytes", json_integer(stats.totalBytes)},
+             {"total_objects", json_integer(stats.totalObjects)}}));
+  }
+
+  auto sites = json_array_of_size(report.sites.size());
+  for (auto& site : report.sites) {
+    auto frames = json_array_of_size(site.frames.size());
+    for (auto& frame : site.frames) {
+      json_array_append(frames, typed_string_to_json(frame.c_str()));
+    }
+    json_array_append(
+        sites,
+        json_object(
+            {{"tag", typed_string_to_json(memoryTagName(site.tag))},
+             {"bytes", json_integer(site.bytes)},
+             {"samples", json_integer(site.samples)},
+             {"stack", frames}}));
+  }
+
+  auto resp = make_response();
+  resp.set(
+      {{"tags", tags},
+       {"sample_interval", json_integer(report.sampleInterval)},
+       {"samples", json_integer(report.samples)},
+       {"window_ms",
+        json_integer(std::chrono::duration_cast<std::chrono::milliseconds>(
+                         report.window)
+                         .count())},
+       {"sites", sites}});
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG(
+    "debug-memory-profile",
+    cmd_debug_memory_profile,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    NULL)
+
+static void cmd_debug_query_scheduler(
+    struct watchman_client* client,
+    const json_ref&) {
+  auto stats = getQueryScheduler().getStats();
+  auto clients = json_array_of_size(stats.clients.size());
+  for (auto& c : stats.clients) {
+    clients.array().push_back(json_object(
+        {{"pid", json_integer(c.pid)},
+         {"admitted", json_integer(c.admitted)},
+         {"rejected", json_integer(c.rejected)},
+         {"waited", json_integer(c.waited)},
+         {"running", json_integer(c.running)},
+         {"total_cost_ms", json_integer(c.totalCost.count())},
+         {"recent_cost_ms", json_integer(c.recentCost.count())}}));
+  }
+  auto resp = make_response();
+  resp.set(
+      {{"running", json_integer(stats.running)},
+       {"waiting", json_integer(stats.waiting)},
+       {"clients", std::move(clients)}});
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG(
+    "debug-query-scheduler",
+    cmd_debug_query_scheduler,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    NULL)
+
+// debug-trace [seconds [max_events]]
+// Records the spans of daemon activity across all roots for a while and
+// returns them as a Chrome trace, loadable by chrome://tracing or Perfetto.
+static void cmd_debug_trace(
+    struct watchman_client* client,
+    const json_ref& args) {
+  constexpr json_int_t kMaxSeconds = 300;
+  json_int_t seconds = 5;
+  json_int_t maxEvents = 100000;
+
+  auto numArgs = json_array_size(args);
+  if (numArgs > 3) {
+    send_error_response(client, "wrong number of arguments for 'debug-trace'");
+    return;
+  }
+  if (numArgs > 1) {
+    const auto& arg = args.at(1);
+    if (!arg.isInt() || json_integer_value(arg) <= 0 ||
+        json_integer_value(arg) > kMaxSeconds) {
+      send_error_response(
+          client,
+          "debug-trace: seconds must be an integer between 1 and %d",
+          int(kMaxSeconds));
+      return;
+    }
+    seconds = json_integer_value(arg);
+  }
+  if (numArgs > 2) {
+    const auto& arg = args.at(2);
+    if (!arg.isInt() || json_integer_value(arg) <= 0) {
+      send_error_response(
+          client, "debug-trace: max_events must be a positive integer");
+      return;
+    }
+    maxEvents = json_integer_value(arg);
+  }
+
+  auto& recorder = TraceRecorder::get();
+  if (!recorder.start(maxEvents)) {
+    send_error_response(client, "debug-trace: a trace is already running");
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+
+  auto resp = make_response();
+  resp.set("trace", recorder.stop());
+  send_and_dispose_response(client, std::move(resp));
+}
+W_CMD_REG("debug-trace", cmd_debug_trace, CMD_DAEMON, NULL)
+
 static void cmd_debug_watcher_info(
     struct watchman_client* clientbase,
     const json_ref& args) {
@@ -326,9 +556,16 @@ void debugContentHashCache(
     return;
   }
 
-  auto stats = view->debugAccessCaches().contentHashCache.stats();
+  auto& caches = view->debugAccessCaches();
+  auto stats = caches.contentHashCache.stats();
+  auto warming = caches.contentHashWarmer.getStats();
   auto resp = make_response();
   addCacheStats(resp, stats);
+  resp.set(
+      {{"warmQueued", json_integer(warming.queued)},
+       {"warmInFlight", json_integer(warming.inFlight)},
+       {"warmed", json_integer(warming.warmed)},
+       {"warmSuperseded", json_integer(warming.superseded)}});
   send_and_dispose_response(client, std::move(resp));
 }
 W_CMD_REG(
@@ -5,6 +5,7 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include "watchman/QueryScheduler.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -29,8 +30,11 @@ static void cmd_find(struct watchman_client* client, const json_ref& args) {
     query->sync_timeout = std::chrono::milliseconds(0);
   }
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->clientGone = [client] { return client->hungUp(); };
 
+  auto admission = getQueryScheduler().admit(query->clientPid);
   auto res = w_query_execute(query.get(), root, nullptr, getInterface);
+  admission.release();
   auto response = make_response();
   response.set(
       {{"clock", res.clockAtStartOfQuery.toJson()},
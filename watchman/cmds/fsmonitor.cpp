@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <string>
+#include "watchman/Clock.h"
+#include "watchman/QueryScheduler.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/eval.h"
+#include "watchman/query/parse.h"
+#include "watchman/saved_state/SavedStateFactory.h"
+#include "watchman/watchman_client.h"
+#include "watchman/watchman_cmd.h"
+
+using namespace watchman;
+
+namespace {
+
+// git's tokens are whatever we answered it with last time, but it starts
+// with one of its own, and a named cursor would be changed by the query.
+// Anything other than a clock is answered as a fresh instance.
+json_ref sinceForToken(const json_ref& token) {
+  try {
+    if (ClockSpec(token).tag == w_cs_clock) {
+      return token;
+    }
+  } catch (const std::exception&) {
+  }
+  return typed_string_to_json("c:0:0", W_STRING_UNICODE);
+}
+
+} // namespace
+
+/* fsmonitor-v2 /root <token>
+ * Answers version 2 of git's core.fsmonitor hook protocol: the response
+ * carries "fsmonitor", the hook's output ready to be written as is.  That
+ * is the new token and then the files that changed since the old one,
+ * each terminated by a NUL, or "/" in place of the files if git has to
+ * assume that anything may have changed.  Holding it all in one string
+ * saves the hook rendering and parsing an array of names. */
+static void cmd_fsmonitor_v2(
+    struct watchman_client* client,
+    const json_ref& args) {
+  if (json_array_size(args) != 3 || !args.at(2).isString()) {
+    send_error_response(client, "wrong number of arguments for 'fsmonitor-v2'");
+    return;
+  }
+
+  // git runs the hook from the top of the work tree, which it may never
+  // have asked us to watch
+  auto root = resolveOrCreateRoot(client, args);
+
+  auto query = parseQuery(
+      root,
+      json_object(
+          {{"since", sinceForToken(args.at(2))},
+           {"fields", json_array({typed_string_to_json("name")})},
+           {"empty_on_fresh_instance", json_true()},
+           {"expression",
+            json_array(
+                {typed_string_to_json("not"),
+                 json_array(
+                     {typed_string_to_json("anyof"),
+                      json_array(
+                          {typed_string_to_json("dirname"),
+                           typed_string_to_json(".git")}),
+                      json_array(
+                          {typed_string_to_json("name"),
+                           typed_string_to_json(".git")})})})}}));
+  query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->clientGone = [client] { return client->hungUp(); };
+  if (client->client_mode) {
+    query->sync_timeout = std::chrono::milliseconds(0);
+  }
+
+  auto admission = getQueryScheduler().admit(query->clientPid);
+  auto res = w_query_execute(query.get(), root, nullptr, getInterface);
+  admission.release();
+
+  auto token = res.clockAtStartOfQuery.toJson();
+  std::string output = json_string_value(token);
+  output.push_back('\0');
+  if (res.isFreshInstance) {
+    output.append("/");
+    output.push_back('\0');
+  } else {
+    for (auto& name : res.resultsArray.array()) {
+      auto str = json_to_w_string(name);
+      output.append(str.data(), str.size());
+      output.push_back('\0');
+    }
+  }
+
+  auto response = make_response();
+  response.set(
+      {{"clock", std::move(token)},
+       {"is_fresh_instance", json_boolean(res.isFreshInstance)},
+       {"fsmonitor",
+        typed_string_to_json(output.data(), output.size(), W_STRING_BYTE)}});
+  add_root_warnings_to_response(response, root);
+  send_and_dispose_response(client, std::move(response));
+}
+W_CMD_REG(
+    "fsmonitor-v2",
+    cmd_fsmonitor_v2,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    w_cmd_realpath_root)
+
+/* vim:ts=2:sw=2:et:
+ */
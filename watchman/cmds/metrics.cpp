@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <array>
+#include "watchman/InMemoryView.h"
+#include "watchman/LRUCache.h"
+#include "watchman/Logging.h"
+#include "watchman/Metrics.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/root/Root.h"
+#include "watchman/root/watchlist.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watchman_client.h"
+#include "watchman/watchman_cmd.h"
+
+using namespace watchman;
+
+namespace {
+
+struct RootMetrics {
+  std::shared_ptr<Root> root;
+  std::string path;
+  OpenMetricsWriter::Labels labels;
+  // Null if the root isn't backed by an InMemoryView
+  std::shared_ptr<InMemoryView> view;
+  json_ref watcherInfo;
+};
+
+std::vector<RootMetrics> collectRoots() {
+  std::vector<RootMetrics> roots;
+  {
+    auto map = watched_roots.rlock();
+    roots.reserve(map->size());
+    for (const auto& it : *map) {
+      roots.emplace_back();
+      roots.back().root = it.second;
+    }
+  }
+  for (auto& r : roots) {
+    r.path = r.root->root_path.string();
+    r.view = std::dynamic_pointer_cast<InMemoryView>(r.root->view());
+    if (r.view) {
+      r.watcherInfo = r.view->getWatcher()->getDebugInfo();
+    }
+  }
+  // Labels point into path, so take them after the vector stops moving
+  for (auto& r : roots) {
+    r.labels = {{"root", r.path}};
+  }
+  return roots;
+}
+
+// Emits a gauge for watcher debug info fields that only some watchers
+// report, eg: the inotify queue depth.
+void watcherGauge(
+    OpenMetricsWriter& writer,
+    const std::vector<RootMetrics>& roots,
+    const char* name,
+    const char* key,
+    const char* help) {
+  bool declared = false;
+  for (auto& r : roots) {
+    if (!r.watcherInfo || !r.watcherInfo.isObject()) {
+      continue;
+    }
+    auto value = r.watcherInfo.get_default(key);
+    if (!value || !value.isInt()) {
+      continue;
+    }
+    if (!declared) {
+      writer.family(name, "gauge", help);
+      declared = true;
+    }
+    writer.gauge(name, r.labels, value.asInt());
+  }
+}
+
+void cacheMetrics(
+    OpenMetricsWriter& writer,
+    const std::vector<RootMetrics>& roots) {
+  std::vector<std::pair<OpenMetricsWriter::Labels, CacheStats>> samples;
+  for (auto& r : roots) {
+    if (!r.view) {
+      continue;
+    }
+    auto& caches = r.view->debugAccessCaches();
+    auto labels = r.labels;
+    labels.emplace_back("cache", "content_hash");
+    samples.emplace_back(labels, caches.contentHashCache.stats());
+    labels.back().second = "symlink_target";
+    samples.emplace_back(labels, caches.symlinkTargetCache.stats());
+  }
+  if (samples.empty()) {
+    return;
+  }
+
+  auto counter = [&](const char* name, const char* help, auto field) {
+    writer.family(name, "counter", help);
+    for (auto& [labels, stats] : samples) {
+      writer.counter(name, labels, stats.*field);
+    }
+  };
+  counter(
+      "watchman_cache_hits",
+      "Cache lookups that found a value",
+      &CacheStats::cacheHit);
+  counter(
+      "watchman_cache_shares",
+      "Cache lookups that joined an in-flight fetch",
+      &CacheStats::cacheShare);
+  counter(
+      "watchman_cache_misses",
+      "Cache lookups that had to fetch a value",
+      &CacheStats::cacheMiss);
+  counter(
+      "watchman_cache_evictions",
+      "Cache entries evicted to make room",
+      &CacheStats::cacheEvict);
+
+  writer.family("watchman_cache_entries", "gauge", "Entries in the cache");
+  for (auto& [labels, stats] : samples) {
+    writer.gauge("watchman_cache_entries", labels, stats.size);
+  }
+}
+
+std::string renderMetrics() {
+  auto roots = collectRoots();
+  OpenMetricsWriter writer;
+
+  writer.family("watchman_clients", "gauge", "Connected clients");
+  writer.gauge("watchman_clients", {}, clients.rlock()->size());
+  writer.family("watchman_roots", "gauge", "Watched roots");
+  writer.gauge("watchman_roots", {}, roots.size());
+
+  auto& pool = getThreadPool();
+  std::array<ThreadPool::QueueStats, ThreadPool::kNumPriorities> poolStats;
+  for (size_t i = 0; i < poolStats.size(); ++i) {
+    poolStats[i] = pool.getQueueStats(ThreadPool::Priority(i));
+  }
+  auto poolGauge = [&](const char* name, const char* help, auto field) {
+    writer.family(name, "gauge", help);
+    for (size_t i = 0; i < poolStats.size(); ++i) {
+      writer.gauge(
+          name,
+          {{"priority", ThreadPool::priorityName(ThreadPool::Priority(i))}},
+          poolStats[i].*field);
+    }
+  };
+  poolGauge(
+      "watchman_thread_pool_queued_tasks",
+      "Thread pool tasks waiting for a worker",
+      &ThreadPool::QueueStats::queued);
+  poolGauge(
+      "watchman_thread_pool_running_tasks",
+      "Thread pool tasks being run",
+      &ThreadPool::QueueStats::running);
+
+  auto logStats = getLog().getAsyncStats();
+  if (logStats.enabled) {
+    writer.family(
+        "watchman_log_queued_lines",
+        "gauge",
+        "Log lines waiting for the stderr writer thread");
+    writer.gauge(
+        "watchman_log_queued_lines",
+        {},
+        logStats.queued - logStats.written - logStats.dropped);
+    writer.family(
+        "watchman_log_dropped_lines",
+        "counter",
+        "Log lines dropped because the stderr writer thread fell behind");
+    writer.counter("watchman_log_dropped_lines", {}, logStats.dropped);
+  }
+
+  writer.family(
+      "watchman_command_duration_seconds",
+      "histogram",
+      "Time taken to dispatch each command");
+  forEachCommandLatency(
+      [&](const std::string& name, const LatencyHistogram& histogram) {
+        writer.histogram(
+            "watchman_command_duration_seconds",
+            {{"command", name}},
+            histogram.snapshot());
+      });
+
+  if (roots.empty()) {
+    return writer.finish();
+  }
+
+  writer.family(
+      "watchman_root_recrawls", "counter", "Times the root was recrawled");
+  for (auto& r : roots) {
+    writer.counter(
+        "watchman_root_recrawls",
+        r.labels,
+        r.root->recrawlInfo.rlock()->recrawlCount);
+  }
+
+  writer.family(
+      "watchman_root_cookie_sync_duration_seconds",
+      "histogram",
+      "Time taken for cookie syncs to be observed");
+  for (auto& r : roots) {
+    writer.histogram(
+        "watchman_root_cookie_sync_duration_seconds",
+        r.labels,
+        r.root->cookies.getSyncLatency().snapshot());
+  }
+
+  bool declared = false;
+  for (auto& r : roots) {
+    if (!r.view) {
+      continue;
+    }
+    if (!declared) {
+      writer.family(
+          "watchman_root_pending_paths",
+          "gauge",
+          "Paths from the watcher waiting to be processed");
+      declared = true;
+    }
+    writer.gauge(
+        "watchman_root_pending_paths", r.labels, r.view->getPendingItemCount());
+  }
+
+  watcherGauge(
+      writer,
+      roots,
+      "watchman_root_watcher_kernel_queued_bytes",
+      "kernel_queued_bytes",
+      "Bytes of notifications queued in the kernel");
+  watcherGauge(
+      writer,
+      roots,
+      "watchman_root_watcher_queued_events",
+      "queued_event_count",
+      "Notifications read from the kernel but not yet consumed");
+
+  std::vector<Publisher::Stats> pubStats;
+  for (auto& r : roots) {
+    pubStats.push_back(r.root->unilateralResponses->getStats());
+  }
+  auto pubGauge = [&](const char* name, const char* help, auto field) {
+    writer.family(name, "gauge", help);
+    for (size_t i = 0; i < roots.size(); ++i) {
+      writer.gauge(name, roots[i].labels, pubStats[i].*field);
+    }
+  };
+  pubGauge(
+      "watchman_root_subscribers",
+      "Subscribers to the root's unilateral responses",
+      &Publisher::Stats::numSubscribers);
+  pubGauge(
+      "watchman_root_publisher_queued_items",
+      "Unilateral responses not yet seen by every subscriber",
+      &Publisher::Stats::queuedItems);
+  pubGauge(
+      "watchman_root_publisher_max_lag_items",
+      "Unilateral responses the slowest subscriber has yet to see",
+      &Publisher::Stats::maxSubscriberLag);
+  writer.family(
+      "watchman_root_publisher_dropped_items",
+      "counter",
+      "Unilateral responses dropped because subscribers fell behind");
+  for (size_t i = 0; i < roots.size(); ++i) {
+    writer.counter(
+        "watchman_root_publisher_dropped_items",
+        roots[i].labels,
+        pubStats[i].droppedItems);
+  }
+
+  cacheMetrics(writer, roots);
+
+  return writer.finish();
+}
+
+void cmd_metrics(struct watchman_client* client, const json_ref&) {
+  auto resp = make_response();
+  auto text = renderMetrics();
+  resp.set("metrics", typed_string_to_json(text.c_str(), W_STRING_MIXED));
+  send_and_dispose_response(client, std::move(resp));
+}
+
+} // namespace
+
+W_CMD_REG("metrics", cmd_metrics, CMD_DAEMON, NULL)
+
+/* vim:ts=2:sw=2:et:
+ */
@@ -5,6 +5,14 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/ScopeGuard.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "watchman/Errors.h"
+#include "watchman/QueryScheduler.h"
+#include "watchman/query/BserResultsRenderer.h"
+#include "watchman/query/ColumnarResultsRenderer.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -14,6 +22,32 @@
 
 using namespace watchman;
 
+// Sets the members of a query response that describe the query rather
+// than the files that it matched
+static void set_query_metadata(
+    json_ref& response,
+    QueryResult& res,
+    const std::shared_ptr<Root>& root) {
+  response.set(
+      {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
+       {"clock", res.clockAtStartOfQuery.toJson()},
+       {"debug", res.debugInfo.render()}});
+  if (res.savedStateInfo) {
+    response.set({{"saved-state-info", std::move(res.savedStateInfo)}});
+  }
+  if (res.continuation) {
+    response.set("continuation", w_string_to_json(res.continuation));
+  }
+  if (res.staleness) {
+    response.set("staleness_ms", json_integer(res.staleness->count()));
+  }
+  if (res.explain) {
+    response.set("explain", std::move(res.explain));
+  }
+
+  add_root_warnings_to_response(response, root);
+}
+
 /* query /root {query} */
 static void cmd_query(struct watchman_client* client, const json_ref& args) {
   if (json_array_size(args) != 3) {
@@ -26,25 +60,90 @@ static void cmd_query(struct watchman_client* client, const json_ref& args) {
   const auto& query_spec = args.at(2);
   auto query = parseQuery(root, query_spec);
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->clientGone = [client] { return client->hungUp(); };
 
   if (client->client_mode) {
     query->sync_timeout = std::chrono::milliseconds(0);
   }
 
-  auto res = w_query_execute(query.get(), root, nullptr, getInterface);
+  // Streamed chunks are written directly to the client rather than being
+  // queued, as the point is to avoid holding the entire result set.  Each
+  // chunk is marked as partial; the final response carries the remaining
+  // files along with the clock and other metadata.
+  std::function<void(json_ref&&)> resultsSink;
+  if (query->streamResultsChunkSize > 0 && client->stm &&
+      !client->client_mode) {
+    resultsSink = [client](json_ref&& files) {
+      auto chunk = make_response();
+      chunk.set({{"partial", json_true()}, {"files", std::move(files)}});
+
+      client->stm->setNonBlock(false);
+      SCOPE_EXIT {
+        client->stm->setNonBlock(true);
+      };
+      if (!client->writer.pduEncodeToStream(
+              client->pdu_type,
+              client->capabilities,
+              chunk,
+              client->stm.get())) {
+        throw QueryExecError("failed to send streamed results to the client");
+      }
+    };
+  }
+
+  // BSER clients get their results encoded as they are rendered, which
+  // saves building and then walking an object per file.
+  std::unique_ptr<BserResultsRenderer> bserResults;
+  if (!resultsSink && client->stm && !client->client_mode &&
+      (client->pdu_type == is_bser || client->pdu_type == is_bser_v2)) {
+    bserResults = std::make_unique<BserResultsRenderer>(
+        client->pdu_type == is_bser_v2 ? 2 : 1, client->capabilities);
+  }
+
+  auto admission = getQueryScheduler().admit(query->clientPid);
+  auto res = w_query_execute(
+      query.get(),
+      root,
+      nullptr,
+      getInterface,
+      std::move(resultsSink),
+      std::move(bserResults));
+  admission.release();
   auto response = make_response();
-  response.set(
-      {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
-       {"clock", res.clockAtStartOfQuery.toJson()},
-       {"files", std::move(res.resultsArray)},
-       {"debug", res.debugInfo.render()}});
-  if (res.savedStateInfo) {
-    response.set({{"saved-state-info", std::move(res.savedStateInfo)}});
+  set_query_metadata(response, res, root);
+
+  if (res.aggregate) {
+    response.set("aggregate", std::move(res.aggregate));
+    send_and_dispose_response(client, std::move(response));
+    return;
   }
 
-  add_root_warnings_to_response(response, root);
+  if (!res.bserResults) {
+    response.set("files", std::move(res.resultsArray));
+    send_and_dispose_response(client, std::move(response));
+    return;
+  }
 
-  send_and_dispose_response(client, std::move(response));
+  // The pre-encoded files can't be held in the response queue, so send
+  // the response here.  Anything already queued is unilateral and may be
+  // delivered in any order relative to this response.
+  auto& rendered = *res.bserResults;
+  const auto& fieldList = query->fieldList;
+  client->stm->setNonBlock(false);
+  SCOPE_EXIT {
+    client->stm->setNonBlock(true);
+  };
+  if (!client->writer.bserEncodeToStream(
+          rendered.bserVersion(),
+          rendered.bserCapabilities(),
+          response,
+          "files",
+          [&](const bser_ctx_t* ctx, void* data) {
+            return rendered.dump(fieldList, ctx, data);
+          },
+          client->stm.get())) {
+    throw QueryExecError("failed to send query results to the client");
+  }
 }
 W_CMD_REG(
     "query",
@@ -52,5 +151,193 @@ W_CMD_REG(
     CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER,
     w_cmd_realpath_root)
 
+/* export-view /root [{query}]
+ * Bulk export for consumers of the whole file list: the results are sent as
+ * one array per field, with the directory names shared between files; see
+ * ColumnarResultsRenderer. */
+static void cmd_export_view(
+    struct watchman_client* client,
+    const json_ref& args) {
+  auto numArgs = json_array_size(args);
+  if (numArgs != 2 && numArgs != 3) {
+    send_error_response(client, "wrong number of arguments for 'export-view'");
+    return;
+  }
+
+  auto root = resolveRoot(client, args);
+
+  auto query = parseQuery(root, numArgs == 3 ? args.at(2) : json_object());
+  if (query->orderBy || query->aggregate) {
+    // The columns are rendered as the view is walked
+    send_error_response(
+        client,
+        "export-view doesn't support aggregate, order_by, limit or "
+        "continuation");
+    return;
+  }
+  query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->clientGone = [client] { return client->hungUp(); };
+  if (client->client_mode) {
+    query->sync_timeout = std::chrono::milliseconds(0);
+  }
+
+  auto admission = getQueryScheduler().admit(query->clientPid);
+  auto res = w_query_execute(
+      query.get(),
+      root,
+      nullptr,
+      getInterface,
+      nullptr,
+      nullptr,
+      std::make_unique<ColumnarResultsRenderer>(query->fieldList));
+  admission.release();
+  auto response = make_response();
+  response.set(
+      {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
+       {"clock", res.clockAtStartOfQuery.toJson()},
+       {"files", res.columnarResults->takeResults()}});
+  add_root_warnings_to_response(response, root);
+  send_and_dispose_response(client, std::move(response));
+}
+W_CMD_REG(
+    "export-view",
+    cmd_export_view,
+    CMD_DAEMON | CMD_CLIENT | CMD_ALLOW_ANY_USER,
+    w_cmd_realpath_root)
+
+namespace {
+
+// How many of the queries of a multi-query execute at once.  Each of them
+// is also admitted by the QueryScheduler, which bounds the daemon as a
+// whole; this bounds the threads that one command can occupy.
+constexpr size_t kMaxParallelQueries = 16;
+
+struct MultiQueryItem {
+  json_ref rootName;
+  std::shared_ptr<Root> root;
+  std::unique_ptr<Query> query;
+  json_ref response;
+};
+
+// The arguments of a single root command, for the root resolving helpers
+json_ref rootArgs(const json_ref& rootName) {
+  return json_array(
+      {typed_string_to_json("multi-query", W_STRING_UNICODE), rootName});
+}
+
+} // namespace
+
+/* The client side validator for multi-query: resolves each of the roots,
+ * as w_cmd_realpath_root does for commands that take a single one. */
+static void w_cmd_realpath_roots(json_ref& args) {
+  if (json_array_size(args) != 2 || !args.at(1).isArray()) {
+    throw CommandValidationError(
+        "multi-query expects an array of [root, query] pairs");
+  }
+  for (auto& pair : args.array()[1].array()) {
+    if (!pair.isArray() || json_array_size(pair) != 2) {
+      throw CommandValidationError(
+          "multi-query expects an array of [root, query] pairs");
+    }
+    auto resolved = rootArgs(pair.at(0));
+    w_cmd_realpath_root(resolved);
+    pair.array()[0] = resolved.at(1);
+  }
+}
+
+/* multi-query [[/root, {query}], ...]
+ * Runs a query against each of the roots, concurrently, so that tools that
+ * query many roots wait for the slowest of them rather than for the sum of
+ * their round trips and cookie syncs.  The responses are returned in the
+ * order of the pairs; one that fails carries an error without failing the
+ * others. */
+static void cmd_multi_query(
+    struct watchman_client* client,
+    const json_ref& args) {
+  if (json_array_size(args) != 2 || !args.at(1).isArray()) {
+    send_error_response(client, "wrong number of arguments for 'multi-query'");
+    return;
+  }
+
+  auto clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+
+  // Resolving and parsing are cheap, and resolving touches the client, so
+  // do them here; only the execution is spread over threads.
+  auto& pairs = args.at(1).array();
+  std::vector<MultiQueryItem> items(pairs.size());
+  for (size_t i = 0; i < pairs.size(); ++i) {
+    auto& item = items[i];
+    try {
+      const auto& pair = pairs[i];
+      if (!pair.isArray() || json_array_size(pair) != 2) {
+        throw QueryParseError("expected a [root, query] pair");
+      }
+      item.rootName = pair.at(0);
+      item.root = resolveRoot(client, rootArgs(pair.at(0)));
+      item.query = parseQuery(item.root, pair.at(1));
+      item.query->clientPid = clientPid;
+      item.query->clientGone = [client] { return client->hungUp(); };
+    } catch (const std::exception& exc) {
+      item.response = json_object(
+          {{"error", typed_string_to_json(exc.what(), W_STRING_MIXED)}});
+    }
+  }
+
+  std::atomic<size_t> next{0};
+  auto runQueries = [&] {
+    for (size_t i = next++; i < items.size(); i = next++) {
+      auto& item = items[i];
+      if (item.response) {
+        continue;
+      }
+      try {
+        auto admission = getQueryScheduler().admit(item.query->clientPid);
+        auto res = w_query_execute(
+            item.query.get(), item.root, nullptr, getInterface);
+        admission.release();
+
+        auto response = json_object();
+        set_query_metadata(response, res, item.root);
+        if (res.aggregate) {
+          response.set("aggregate", std::move(res.aggregate));
+        } else {
+          response.set("files", std::move(res.resultsArray));
+        }
+        item.response = std::move(response);
+      } catch (const std::exception& exc) {
+        item.response = json_object(
+            {{"error", typed_string_to_json(exc.what(), W_STRING_MIXED)}});
+      }
+    }
+  };
+
+  // This thread runs queries too, so a single pair needs no other thread
+  std::vector<std::thread> workers;
+  auto numWorkers = std::min(items.size(), kMaxParallelQueries);
+  for (size_t i = 1; i < numWorkers; ++i) {
+    workers.emplace_back(runQueries);
+  }
+  runQueries();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  auto results = json_array_of_size(items.size());
+  for (auto& item : items) {
+    if (item.rootName) {
+      item.response.set("root", std::move(item.rootName));
+    }
+    results.array().push_back(std::move(item.response));
+  }
+  auto response = make_response();
+  response.set("results", std::move(results));
+  send_and_dispose_response(client, std::move(response));
+}
+W_CMD_REG(
+    "multi-query",
+    cmd_multi_query,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    w_cmd_realpath_roots)
+
 /* vim:ts=2:sw=2:et:
  */
@@ -11,6 +11,7 @@
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
+#include "watchman/Metrics.h"
 #include "watchman/PDU.h"
 #include "watchman/Poison.h"
 #include "watchman/WatchmanConfig.h"
@@ -112,8 +113,11 @@ bool dispatch_command(
           sample_name, sizeof(sample_name), "dispatch_command:%s", def->name);
       PerfSample sample(sample_name);
       client->perf_sample = &sample;
+      auto& latency = commandLatency(def->name);
+      auto started = std::chrono::steady_clock::now();
       SCOPE_EXIT {
         client->perf_sample = nullptr;
+        latency.record(std::chrono::steady_clock::now() - started);
       };
 
       sample.set_wall_time_thresh(
@@ -133,6 +137,15 @@ bool dispatch_command(
     }
 
     return true;
+  } catch (const QueryAdmissionError& e) {
+    // Tell the client when to try again.  Being refused is routine for a
+    // client that queries too often, so this isn't logged as an error.
+    auto resp = make_response();
+    resp.set(
+        {{"error", typed_string_to_json(e.what(), W_STRING_MIXED)},
+         {"retry_after_ms", json_integer(e.retryAfter.count())}});
+    send_and_dispose_response(client, std::move(resp));
+    return false;
   } catch (const std::exception& e) {
     auto what = folly::exceptionStr(e);
     send_error_response(client, "%s", what.c_str());
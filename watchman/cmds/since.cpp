@@ -5,9 +5,14 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/ScopeGuard.h>
+#include "watchman/ChangeJournal.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/QueryScheduler.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
+#include "watchman/root/Root.h"
 #include "watchman/saved_state/SavedStateFactory.h"
 #include "watchman/watchman_client.h"
 #include "watchman/watchman_cmd.h"
@@ -35,8 +40,11 @@ static void cmd_since(struct watchman_client* client, const json_ref& args) {
 
   auto query = parseQueryLegacy(root, args, 3, nullptr, clockspec, nullptr);
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
+  query->clientGone = [client] { return client->hungUp(); };
 
+  auto admission = getQueryScheduler().admit(query->clientPid);
   auto res = w_query_execute(query.get(), root, nullptr, getInterface);
+  admission.release();
   auto response = make_response();
   response.set(
       {{"is_fresh_instance", json_boolean(res.isFreshInstance)},
@@ -56,5 +64,137 @@ W_CMD_REG(
     CMD_DAEMON | CMD_ALLOW_ANY_USER,
     w_cmd_realpath_root)
 
+// How many changes each partial response of changes-since holds
+constexpr size_t kDefaultChangesChunkSize = 1024;
+
+/* changes-since /root <clock> [options]
+ * Streams the changes recorded in the change journal of the root after
+ * clock, oldest first, in partial responses followed by a final one that
+ * holds the clock to pass next time.
+ */
+static void cmd_changes_since(
+    struct watchman_client* client,
+    const json_ref& args) {
+  auto numArgs = json_array_size(args);
+  if (numArgs != 3 && numArgs != 4) {
+    send_error_response(
+        client, "wrong number of arguments for 'changes-since'");
+    return;
+  }
+
+  auto syncTimeout = kDefaultQuerySyncTimeout;
+  auto chunkSize = kDefaultChangesChunkSize;
+  if (numArgs == 4) {
+    auto& opts = args.at(3);
+    if (!opts.isObject()) {
+      send_error_response(
+          client, "the options passed to 'changes-since' must be an object");
+      return;
+    }
+    auto sync = opts.get_default("sync_timeout");
+    if (sync) {
+      if (!sync.isInt() || sync.asInt() < 0) {
+        send_error_response(
+            client, "sync_timeout must be an integer value >= 0");
+        return;
+      }
+      syncTimeout = std::chrono::milliseconds(sync.asInt());
+    }
+    auto chunk = opts.get_default("chunk_size");
+    if (chunk) {
+      if (!chunk.isInt() || chunk.asInt() <= 0) {
+        send_error_response(client, "chunk_size must be an integer value > 0");
+        return;
+      }
+      chunkSize = size_t(chunk.asInt());
+    }
+  }
+
+  auto root = resolveRoot(client, args);
+
+  auto view = std::dynamic_pointer_cast<InMemoryView>(root->view());
+  auto journal = view ? view->getChangeJournal() : nullptr;
+  if (!journal) {
+    send_error_response(
+        client,
+        "changes-since requires change_journal_max_bytes to be set for %s",
+        root->root_path.c_str());
+    return;
+  }
+
+  std::unique_ptr<ClockSpec> clockSpec;
+  try {
+    clockSpec = ClockSpec::parseOptionalClockSpec(args.at(2));
+  } catch (const std::domain_error& exc) {
+    send_error_response(client, "invalid clock: %s", exc.what());
+    return;
+  }
+  if (!clockSpec || clockSpec->tag == w_cs_timestamp ||
+      clockSpec->hasScmParams()) {
+    send_error_response(
+        client, "changes-since requires a clock or named cursor");
+    return;
+  }
+
+  if (syncTimeout.count()) {
+    root->syncToNow(syncTimeout);
+  }
+
+  // Taken before the journal is read, so that a change recorded while it
+  // is being read is reported again next time rather than not at all
+  auto position = view->getMostRecentRootNumberAndTickValue();
+  auto since = clockSpec->evaluate(
+      position, view->getLastAgeOutTickValue(), &root->inner.cursors);
+
+  auto response = make_response();
+  response.set(
+      {{"clock", w_string_to_json(position.toClockString())},
+       {"is_fresh_instance", json_boolean(since.clock.is_fresh_instance)}});
+  auto changes = json_array();
+  if (!since.clock.is_fresh_instance) {
+    // Partial responses are written directly to the client rather than
+    // being queued, as the point is to avoid holding all of the changes
+    bool stream = client->stm && !client->client_mode;
+    journal->forEachSince(
+        since.clock.ticks, [&](const ChangeJournal::Change& change) {
+          json_array_append(
+              changes,
+              json_object(
+                  {{"name",
+                    typed_string_to_json(
+                        change.name.data(), change.name.size(), W_STRING_BYTE)},
+                   {"exists", json_boolean(change.exists)}}));
+          if (!stream || json_array_size(changes) < chunkSize) {
+            return;
+          }
+          auto chunk = make_response();
+          chunk.set({{"partial", json_true()}, {"changes", changes}});
+          changes = json_array();
+
+          client->stm->setNonBlock(false);
+          SCOPE_EXIT {
+            client->stm->setNonBlock(true);
+          };
+          if (!client->writer.pduEncodeToStream(
+                  client->pdu_type,
+                  client->capabilities,
+                  chunk,
+                  client->stm.get())) {
+            throw std::runtime_error(
+                "failed to send changes to the client");
+          }
+        });
+  }
+  response.set("changes", std::move(changes));
+
+  add_root_warnings_to_response(response, root);
+  send_and_dispose_response(client, std::move(response));
+}
+W_CMD_REG(
+    "changes-since",
+    cmd_changes_since,
+    CMD_DAEMON | CMD_ALLOW_ANY_USER,
+    w_cmd_realpath_root)
+
 /* vim:ts=2:sw=2:et:
  */
@@ -10,6 +10,8 @@
 #include "watchman/MapUtil.h"
 #include "watchman/QueryableView.h"
 #include "watchman/query/Query.h"
+#include "watchman/query/QueryContext.h"
+#include "watchman/query/QueryExpr.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
 #include "watchman/root/Root.h"
@@ -35,6 +37,9 @@ watchman_client_subscription::lockClient() {
 }
 
 watchman_client_subscription::~watchman_client_subscription() {
+  if (fast) {
+    root->fastSubscriptions.fetch_sub(1, std::memory_order_acq_rel);
+  }
   auto client = lockClient();
   if (client) {
     client->unsubByName(name);
@@ -165,6 +170,10 @@ void watchman_client_subscription::processSubscriptionImpl() {
           "\n");
       executeQuery = false;
     } else if (action == sub_action::defer) {
+      // Nothing is accumulated while we defer.  last_sub_tick stays put, so
+      // once the state is vacated the time generator walks just the files
+      // changed since then, most recent first, each of them once however
+      // often it changed.  That list is already the backlog.
       log(DBG,
           "deferring subscription notifications for ",
           name,
@@ -205,11 +214,130 @@ void watchman_client_subscription::processSubscriptionImpl() {
   }
 }
 
+void watchman_client_subscription::processUnsettledChanges() {
+  auto client = lockClient();
+  if (!client) {
+    return;
+  }
+
+  sub_action action;
+  w_string policy_name;
+  auto position = root->view()->getMostRecentRootNumberAndTickValue();
+  std::tie(action, policy_name) = get_subscription_action(this, root, position);
+  if (action != sub_action::execute ||
+      (vcs_defer && root->view()->isVCSOperationInProgress())) {
+    // Whatever holds back the settled notification holds back this one too
+    return;
+  }
+
+  auto since_spec = query->since_spec.get();
+  if (!since_spec || since_spec->tag != w_cs_clock ||
+      since_spec->position().rootNumber != position.rootNumber) {
+    // Leave fresh instances to the settled notification
+    return;
+  }
+  auto sinceTicks = std::max(since_spec->position().ticks, last_unsettled_tick);
+
+  query->sync_timeout = std::chrono::milliseconds(0);
+  query->lock_timeout =
+      uint32_t(root->config.getInt("subscription_lock_timeout_ms", 100));
+
+  try {
+    auto res = w_query_execute(
+        query.get(),
+        root,
+        [sinceTicks](
+            const Query* q, const std::shared_ptr<Root>& r, QueryContext* ctx) {
+          ctx->noteGenerator("unsettled");
+          r->view()->unsettledGenerator(q, sinceTicks, ctx);
+        },
+        getInterface);
+    last_unsettled_tick = res.clockAtStartOfQuery.position().ticks;
+
+    logf(
+        DBG,
+        "subscription {} generated {} unsettled results\n",
+        name,
+        res.resultsArray.array().size());
+    if (res.isFreshInstance || res.resultsArray.array().empty()) {
+      return;
+    }
+
+    auto response = make_response();
+    response.set(
+        {{"is_fresh_instance", json_false()},
+         {"clock", res.clockAtStartOfQuery.toJson()},
+         {"files", std::move(res.resultsArray)},
+         {"root", w_string_to_json(root->root_path)},
+         {"subscription", w_string_to_json(name)},
+         {"settled", json_false()},
+         {"unilateral", json_true()}});
+    sentUnsettled = true;
+    client->enqueueResponse(std::move(response), false);
+  } catch (const std::exception& exc) {
+    // The settled notification will report these changes regardless
+    log(ERR,
+        "Error while reporting unsettled changes for subscription ",
+        name,
+        ": ",
+        exc.what(),
+        "\n");
+  }
+}
+
 void watchman_client_subscription::updateSubscriptionTicks(QueryResult* res) {
   // create a new spec that will be used the next time
   query->since_spec = std::make_unique<ClockSpec>(res->clockAtStartOfQuery);
 }
 
+QueryResult watchman_client_subscription::executeQuery(
+    const std::shared_ptr<Root>& root) {
+  auto since_spec = query->since_spec.get();
+  bool share = sharedResultsKey && since_spec && since_spec->tag == w_cs_clock &&
+      !since_spec->hasScmParams() && !since_spec->hasSavedStateParams();
+
+  if (share) {
+    auto position = root->view()->getMostRecentRootNumberAndTickValue();
+    auto shared = root->sharedSubscriptionResults.rlock();
+    auto it = shared->find(sharedResultsKey);
+    if (it != shared->end() && it->second.since == since_spec->position() &&
+        it->second.clockAtStartOfQuery.position() == position) {
+      logf(DBG, "subscription {} is reusing shared results\n", name);
+      QueryResult res;
+      res.isFreshInstance = it->second.isFreshInstance;
+      res.resultsArray = it->second.resultsArray;
+      res.clockAtStartOfQuery = it->second.clockAtStartOfQuery;
+      res.stateTransCountAtStartOfQuery =
+          it->second.stateTransCountAtStartOfQuery;
+      res.savedStateInfo = it->second.savedStateInfo;
+      return res;
+    }
+  }
+
+  auto res = w_query_execute(query.get(), root, time_generator, getInterface);
+
+  if (share && !res.bserResults) {
+    auto shared = root->sharedSubscriptionResults.wlock();
+    // Results computed against an older view are of no further use.
+    auto position = res.clockAtStartOfQuery.position();
+    for (auto it = shared->begin(); it != shared->end();) {
+      if (it->second.clockAtStartOfQuery.position() != position) {
+        it = shared->erase(it);
+      } else {
+        ++it;
+      }
+    }
+    (*shared)[sharedResultsKey] = Root::SharedSubscriptionResult{
+        since_spec->position(),
+        res.clockAtStartOfQuery,
+        res.stateTransCountAtStartOfQuery,
+        res.isFreshInstance,
+        res.resultsArray,
+        res.savedStateInfo};
+  }
+  return res;
+}
+
 json_ref watchman_client_subscription::buildSubscriptionResults(
     const std::shared_ptr<Root>& root,
     ClockSpec& position,
@@ -238,7 +366,7 @@ json_ref watchman_client_subscription::buildSubscriptionResults(
   logf(DBG, "running subscription {} {}\n", name, fmt::ptr(this));
 
   try {
-    auto res = w_query_execute(query.get(), root, time_generator, getInterface);
+    auto res = executeQuery(root);
 
     logf(
         DBG,
@@ -265,8 +393,11 @@ json_ref watchman_client_subscription::buildSubscriptionResults(
     // and the mergeBase has changed or this is a fresh instance.
     bool mergeBaseChanged = scmAwareQuery &&
         res.clockAtStartOfQuery.scmMergeBase != query->since_spec->scmMergeBase;
+    // A fast subscription is told that the view settled even when nothing
+    // matched, if it was told about unsettled changes first.
+    bool confirmUnsettled = std::exchange(sentUnsettled, false);
     if (res.resultsArray.array().empty() && !mergeBaseChanged &&
-        !res.isFreshInstance) {
+        !res.isFreshInstance && !confirmUnsettled) {
       updateSubscriptionTicks(&res);
       return nullptr;
     }
@@ -291,6 +422,9 @@ json_ref watchman_client_subscription::buildSubscriptionResults(
     if (res.savedStateInfo) {
       response.set({{"saved-state-info", std::move(res.savedStateInfo)}});
     }
+    if (fast) {
+      response.set("settled", json_true());
+    }
 
     return response;
   } catch (const QueryExecError& e) {
@@ -518,6 +652,16 @@ static void cmd_subscribe(
   query_spec = args.at(3);
 
   query = parseQuery(root, query_spec);
+  if (query->limit > 0 || query->continuation) {
+    // Each notification must carry every change since the last one
+    send_error_response(
+        client, "subscriptions don't support limit or continuation");
+    return;
+  }
+  if (query->aggregate) {
+    send_error_response(client, "subscriptions don't support aggregate");
+    return;
+  }
   query->clientPid = client->stm ? client->stm->getPeerProcessID() : 0;
   query->subscriptionName = json_to_w_string(jname);
 
@@ -538,6 +682,10 @@ static void cmd_subscribe(
 
   sub->name = json_to_w_string(jname);
   sub->query = query;
+  if (root->config.getBool("subscription_share_results", false)) {
+    sub->sharedResultsKey =
+        w_string(json_dumps(query_spec, JSON_SORT_KEYS | JSON_COMPACT));
+  }
 
   auto defer = query_spec.get_default("defer_vcs", json_true());
   if (!defer.isBool()) {
@@ -546,6 +694,41 @@ static void cmd_subscribe(
   }
   sub->vcs_defer = defer.asBool();
 
+  auto fast = query_spec.get_default("fast", json_false());
+  if (!fast.isBool()) {
+    send_error_response(client, "fast must be boolean");
+    return;
+  }
+  if (fast.asBool()) {
+    // Unsettled changes are reported straight from the files that the IO
+    // thread just processed, so the query must be cheap to evaluate
+    // against each of them and must not depend on anything else.
+    if (query->paths || query->glob_tree ||
+        (query->since_spec && query->since_spec->hasScmParams())) {
+      send_error_response(
+          client,
+          "fast subscriptions must select files with an expression, not "
+          "with path, glob or SCM aware generators");
+      return;
+    }
+    if (query->expr &&
+        query->expr->evaluationCost() > EvaluationCost::Pattern) {
+      send_error_response(
+          client, "fast subscriptions cannot use regular expression terms");
+      return;
+    }
+    if (query->isFieldRequested("content.sha1hex")) {
+      send_error_response(
+          client, "fast subscriptions cannot request content.sha1hex");
+      return;
+    }
+    if (query->isFieldRequested("content.fingerprint")) {
+      send_error_response(
+          client, "fast subscriptions cannot request content.fingerprint");
+      return;
+    }
+  }
+
   if (drop_list || defer_list) {
     size_t i;
 
@@ -601,6 +784,10 @@ static void cmd_subscribe(
             info_json)));
   }
 
+  if (fast.asBool()) {
+    sub->fast = true;
+    root->fastSubscriptions.fetch_add(1, std::memory_order_acq_rel);
+  }
   client->subscriptions[sub->name] = sub;
 
   resp = make_response();
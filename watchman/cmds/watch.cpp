@@ -5,10 +5,14 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <folly/Synchronized.h>
+#include <optional>
+#include <unordered_map>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/LogConfig.h"
 #include "watchman/QueryableView.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/watchlist.h"
 #include "watchman/watchman_cmd.h"
@@ -195,6 +199,95 @@ bool find_project_root(
   return false;
 }
 
+namespace {
+
+// The watches and relative paths that the paths passed to watch-project
+// resolved to, so that tools that run it on every startup, often from deep
+// inside the project, don't each take the realpath of the path and search
+// the watched roots for it.  A watch that encloses the path is used in
+// preference to any root_files beneath it, so an entry remains good for as
+// long as its root is watched and the path still names the same dir.
+struct ResolvedProject {
+  std::weak_ptr<Root> root;
+  w_string relpath;
+  dev_t dev{0};
+  ino_t ino{0};
+};
+
+constexpr size_t kMaxResolvedProjects = 1024;
+
+folly::Synchronized<std::unordered_map<w_string, ResolvedProject>>
+    resolvedProjects;
+
+// Returns the information that tells whether path still names the dir
+// that it named when its resolution was remembered, or nullopt if there
+// is nothing to tell that by.
+std::optional<FileInformation> projectPathInformation(const w_string& path) {
+  if (!w_is_path_absolute_cstr(path.c_str())) {
+    return std::nullopt;
+  }
+  try {
+    auto info = getFileInformation(path.c_str());
+    if (!info.isDir() || info.ino == 0) {
+      return std::nullopt;
+    }
+    return info;
+  } catch (const std::system_error&) {
+    return std::nullopt;
+  }
+}
+
+std::shared_ptr<Root> lookupResolvedProject(
+    const w_string& path,
+    const std::optional<FileInformation>& info,
+    w_string& relpath) {
+  if (!info) {
+    return nullptr;
+  }
+  ResolvedProject resolved;
+  {
+    auto map = resolvedProjects.rlock();
+    auto it = map->find(path);
+    if (it == map->end()) {
+      return nullptr;
+    }
+    resolved = it->second;
+  }
+  auto root = resolved.root.lock();
+  if (!root || root->inner.cancelled || info->dev != resolved.dev ||
+      info->ino != resolved.ino) {
+    return nullptr;
+  }
+  relpath = resolved.relpath;
+  return root;
+}
+
+void rememberResolvedProject(
+    const w_string& path,
+    const std::optional<FileInformation>& info,
+    const std::shared_ptr<Root>& root,
+    const w_string& relpath) {
+  if (!info) {
+    return;
+  }
+  auto map = resolvedProjects.wlock();
+  if (map->size() >= kMaxResolvedProjects) {
+    for (auto it = map->begin(); it != map->end();) {
+      if (it->second.root.expired()) {
+        it = map->erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (map->size() >= kMaxResolvedProjects) {
+      map->clear();
+    }
+  }
+  (*map)[path] = ResolvedProject{root, relpath, info->dev, info->ino};
+}
+
+} // namespace
+
 // For watch-project, take a root path string and resolve the
 // containing project directory, then update the args to reflect
 // that path.
@@ -307,9 +400,28 @@ static void cmd_watch_project(
   }
 
   w_string rel_path_from_watch;
-  auto dir_to_watch = resolve_projpath(args, rel_path_from_watch);
+  std::optional<w_string> requested;
+  std::optional<FileInformation> requested_info;
+  if (auto path = json_string_value(json_array_get(args, 1))) {
+    requested = w_string(path, W_STRING_BYTE);
+    // Taken before the path is resolved, so that a resolution that races
+    // with a change to where the path leads isn't used afterwards
+    requested_info = projectPathInformation(*requested);
+    if (auto project = lookupResolvedProject(
+            *requested, requested_info, rel_path_from_watch)) {
+      json_array_set_new(args, 1, w_string_to_json(project->root_path));
+      requested.reset();
+    }
+  }
+  if (requested) {
+    resolve_projpath(args, rel_path_from_watch);
+  }
 
   auto root = resolveOrCreateRoot(client, args);
+  if (requested && !root->failure_reason && !root->inner.cancelled) {
+    rememberResolvedProject(
+        *requested, requested_info, root, rel_path_from_watch);
+  }
 
   root->view()->waitUntilReadyToQuery().get();
 
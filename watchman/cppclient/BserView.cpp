@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "BserView.h"
+
+#include <cstring>
+
+#include "WatchmanConnection.h"
+
+namespace watchman {
+
+namespace {
+
+constexpr uint8_t kArray = 0x00;
+constexpr uint8_t kObject = 0x01;
+constexpr uint8_t kByteString = 0x02;
+constexpr uint8_t kInt8 = 0x03;
+constexpr uint8_t kInt16 = 0x04;
+constexpr uint8_t kInt32 = 0x05;
+constexpr uint8_t kInt64 = 0x06;
+constexpr uint8_t kReal = 0x07;
+constexpr uint8_t kTrue = 0x08;
+constexpr uint8_t kFalse = 0x09;
+constexpr uint8_t kNull = 0x0a;
+constexpr uint8_t kTemplate = 0x0b;
+constexpr uint8_t kSkip = 0x0c;
+constexpr uint8_t kUtf8String = 0x0d;
+
+[[noreturn]] void malformed(const char* what) {
+  throw WatchmanError(std::string("malformed BSER: ") + what);
+}
+
+void need(const uint8_t* p, const uint8_t* end, size_t len) {
+  if (size_t(end - p) < len) {
+    malformed("truncated");
+  }
+}
+
+template <typename T>
+T load(const uint8_t* p, const uint8_t* end) {
+  need(p, end, sizeof(T));
+  T value;
+  memcpy(&value, p, sizeof(T));
+  return value;
+}
+
+// Reads the integer whose type byte is at p, and advances p past it
+int64_t readInt(const uint8_t*& p, const uint8_t* end) {
+  need(p, end, 1);
+  auto type = *p++;
+  switch (type) {
+    case kInt8: {
+      auto v = load<int8_t>(p, end);
+      p += sizeof(v);
+      return v;
+    }
+    case kInt16: {
+      auto v = load<int16_t>(p, end);
+      p += sizeof(v);
+      return v;
+    }
+    case kInt32: {
+      auto v = load<int32_t>(p, end);
+      p += sizeof(v);
+      return v;
+    }
+    case kInt64: {
+      auto v = load<int64_t>(p, end);
+      p += sizeof(v);
+      return v;
+    }
+    default:
+      malformed("expected an integer");
+  }
+}
+
+size_t readLength(const uint8_t*& p, const uint8_t* end) {
+  auto len = readInt(p, end);
+  if (len < 0) {
+    malformed("negative length");
+  }
+  return size_t(len);
+}
+
+// Reads the string whose type byte is at p, and advances p past it
+std::string_view readString(const uint8_t*& p, const uint8_t* end) {
+  need(p, end, 1);
+  if (*p != kByteString && *p != kUtf8String) {
+    malformed("expected a string");
+  }
+  ++p;
+  auto len = readLength(p, end);
+  need(p, end, len);
+  std::string_view result(reinterpret_cast<const char*>(p), len);
+  p += len;
+  return result;
+}
+
+// Returns a pointer just past the value whose type byte is at p
+const uint8_t* skipValue(const uint8_t* p, const uint8_t* end) {
+  need(p, end, 1);
+  switch (*p) {
+    case kArray: {
+      ++p;
+      auto n = readLength(p, end);
+      for (size_t i = 0; i < n; ++i) {
+        p = skipValue(p, end);
+      }
+      return p;
+    }
+    case kObject: {
+      ++p;
+      auto n = readLength(p, end);
+      for (size_t i = 0; i < n; ++i) {
+        readString(p, end);
+        p = skipValue(p, end);
+      }
+      return p;
+    }
+    case kByteString:
+    case kUtf8String:
+      readString(p, end);
+      return p;
+    case kInt8:
+    case kInt16:
+    case kInt32:
+    case kInt64:
+      readInt(p, end);
+      return p;
+    case kReal:
+      need(p, end, 1 + sizeof(double));
+      return p + 1 + sizeof(double);
+    case kTrue:
+    case kFalse:
+    case kNull:
+    case kSkip:
+      return p + 1;
+    case kTemplate: {
+      ++p;
+      need(p, end, 1);
+      if (*p != kArray) {
+        malformed("template keys must be an array");
+      }
+      ++p;
+      auto numKeys = readLength(p, end);
+      for (size_t i = 0; i < numKeys; ++i) {
+        readString(p, end);
+      }
+      auto numRows = readLength(p, end);
+      for (size_t i = 0; i < numRows * numKeys; ++i) {
+        p = skipValue(p, end);
+      }
+      return p;
+    }
+    default:
+      malformed("unknown type");
+  }
+}
+
+} // namespace
+
+BserValue::Type BserValue::type() const {
+  if (keys_) {
+    return Type::Object;
+  }
+  need(data_, end_, 1);
+  switch (*data_) {
+    case kArray:
+    case kTemplate:
+      return Type::Array;
+    case kObject:
+      return Type::Object;
+    case kByteString:
+    case kUtf8String:
+      return Type::String;
+    case kInt8:
+    case kInt16:
+    case kInt32:
+    case kInt64:
+      return Type::Integer;
+    case kReal:
+      return Type::Real;
+    case kTrue:
+    case kFalse:
+      return Type::Bool;
+    case kNull:
+      return Type::Null;
+    default:
+      malformed("unknown type");
+  }
+}
+
+std::string_view BserValue::asString() const {
+  if (keys_) {
+    malformed("expected a string");
+  }
+  auto p = data_;
+  return readString(p, end_);
+}
+
+int64_t BserValue::asInt() const {
+  if (keys_) {
+    malformed("expected an integer");
+  }
+  auto p = data_;
+  return readInt(p, end_);
+}
+
+double BserValue::asDouble() const {
+  if (type() == Type::Integer) {
+    return double(asInt());
+  }
+  if (type() != Type::Real) {
+    malformed("expected a real");
+  }
+  return load<double>(data_ + 1, end_);
+}
+
+bool BserValue::asBool() const {
+  if (type() != Type::Bool) {
+    malformed("expected a bool");
+  }
+  return *data_ == kTrue;
+}
+
+size_t BserValue::size() const {
+  if (keys_) {
+    auto p = keys_ + 1;
+    return readLength(p, end_);
+  }
+  need(data_, end_, 1);
+  auto p = data_ + 1;
+  switch (*data_) {
+    case kArray:
+    case kObject:
+      return readLength(p, end_);
+    case kTemplate: {
+      ++p;
+      auto numKeys = readLength(p, end_);
+      for (size_t i = 0; i < numKeys; ++i) {
+        readString(p, end_);
+      }
+      return readLength(p, end_);
+    }
+    default:
+      malformed("expected an array or object");
+  }
+}
+
+void BserValue::forEach(
+    folly::FunctionRef<void(const BserValue&)> func) const {
+  if (keys_) {
+    malformed("expected an array");
+  }
+  need(data_, end_, 1);
+  auto p = data_ + 1;
+  if (*data_ == kArray) {
+    auto n = readLength(p, end_);
+    for (size_t i = 0; i < n; ++i) {
+      BserValue element(p, end_, nullptr);
+      p = skipValue(p, end_);
+      func(element);
+    }
+    return;
+  }
+  if (*data_ != kTemplate) {
+    malformed("expected an array");
+  }
+
+  auto keys = p;
+  need(p, end_, 1);
+  ++p;
+  auto numKeys = readLength(p, end_);
+  for (size_t i = 0; i < numKeys; ++i) {
+    readString(p, end_);
+  }
+  auto numRows = readLength(p, end_);
+  for (size_t i = 0; i < numRows; ++i) {
+    BserValue row(p, end_, keys);
+    for (size_t k = 0; k < numKeys; ++k) {
+      p = skipValue(p, end_);
+    }
+    func(row);
+  }
+}
+
+void BserValue::forEachItem(
+    folly::FunctionRef<void(std::string_view, const BserValue&)> func) const {
+  if (keys_) {
+    auto k = keys_ + 1;
+    auto numKeys = readLength(k, end_);
+    auto p = data_;
+    for (size_t i = 0; i < numKeys; ++i) {
+      auto key = readString(k, end_);
+      need(p, end_, 1);
+      if (*p == kSkip) {
+        ++p;
+        continue;
+      }
+      BserValue value(p, end_, nullptr);
+      p = skipValue(p, end_);
+      func(key, value);
+    }
+    return;
+  }
+
+  need(data_, end_, 1);
+  if (*data_ != kObject) {
+    malformed("expected an object");
+  }
+  auto p = data_ + 1;
+  auto n = readLength(p, end_);
+  for (size_t i = 0; i < n; ++i) {
+    auto key = readString(p, end_);
+    BserValue value(p, end_, nullptr);
+    p = skipValue(p, end_);
+    func(key, value);
+  }
+}
+
+std::optional<BserValue> BserValue::get(std::string_view key) const {
+  std::optional<BserValue> result;
+  // Objects are small and unordered, so a linear scan is the best we can
+  // do without an index; it stops at the first match.
+  if (keys_) {
+    auto k = keys_ + 1;
+    auto numKeys = readLength(k, end_);
+    auto p = data_;
+    for (size_t i = 0; i < numKeys; ++i) {
+      auto candidate = readString(k, end_);
+      if (candidate == key) {
+        need(p, end_, 1);
+        if (*p != kSkip) {
+          result = BserValue(p, end_, nullptr);
+        }
+        return result;
+      }
+      p = skipValue(p, end_);
+    }
+    return result;
+  }
+
+  need(data_, end_, 1);
+  if (*data_ != kObject) {
+    malformed("expected an object");
+  }
+  auto p = data_ + 1;
+  auto n = readLength(p, end_);
+  for (size_t i = 0; i < n; ++i) {
+    auto candidate = readString(p, end_);
+    if (candidate == key) {
+      result = BserValue(p, end_, nullptr);
+      return result;
+    }
+    p = skipValue(p, end_);
+  }
+  return result;
+}
+
+folly::dynamic BserValue::toDynamic() const {
+  switch (type()) {
+    case Type::Array: {
+      auto result = folly::dynamic::array();
+      forEach([&](const BserValue& element) {
+        result.push_back(element.toDynamic());
+      });
+      return result;
+    }
+    case Type::Object: {
+      auto result = folly::dynamic::object();
+      forEachItem([&](std::string_view key, const BserValue& value) {
+        result.insert(std::string(key), value.toDynamic());
+      });
+      return result;
+    }
+    case Type::String:
+      return std::string(asString());
+    case Type::Integer:
+      return asInt();
+    case Type::Real:
+      return asDouble();
+    case Type::Bool:
+      return asBool();
+    case Type::Null:
+      return nullptr;
+  }
+  malformed("unknown type");
+}
+
+BserValue BserValue::fromPdu(const folly::IOBuf& buf) {
+  auto p = buf.data();
+  auto end = p + buf.length();
+  need(p, end, 2);
+  if (p[0] != 0 || (p[1] != 1 && p[1] != 2)) {
+    malformed("bad PDU header");
+  }
+  // Version 2 has the capabilities ahead of the length
+  p += p[1] == 2 ? 2 + sizeof(uint32_t) : 2;
+  auto len = readLength(p, end);
+  need(p, end, len);
+  return BserValue(p, p + len, nullptr);
+}
+
+BserResponse::BserResponse(std::vector<std::unique_ptr<folly::IOBuf>> pdus)
+    : pdus_(std::move(pdus)) {
+  if (pdus_.empty()) {
+    throw WatchmanError("BserResponse needs at least one PDU");
+  }
+  for (auto& pdu : pdus_) {
+    pdu->coalesce();
+  }
+}
+
+BserValue BserResponse::root() const {
+  return BserValue::fromPdu(*pdus_.back());
+}
+
+void BserResponse::forEachFile(
+    folly::FunctionRef<void(const BserValue&)> func) const {
+  for (auto& pdu : pdus_) {
+    auto files = BserValue::fromPdu(*pdu).get("files");
+    if (files && files->type() == BserValue::Type::Array) {
+      files->forEach(func);
+    }
+  }
+}
+
+folly::dynamic BserResponse::toDynamic() const {
+  auto result = root().toDynamic();
+  if (pdus_.size() > 1) {
+    auto files = folly::dynamic::array();
+    forEachFile([&](const BserValue& file) {
+      files.push_back(file.toDynamic());
+    });
+    result["files"] = std::move(files);
+  }
+  return result;
+}
+
+} // namespace watchman
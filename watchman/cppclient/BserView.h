@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <folly/Function.h>
+#include <folly/dynamic.h>
+#include <folly/io/IOBuf.h>
+
+namespace watchman {
+
+// A read-only view of a BSER encoded value that decodes lazily, straight
+// out of the buffer holding the encoded data.  Nothing is copied or
+// allocated until a caller asks for it, which makes it much cheaper than
+// folly::bser::parseBser for iterating over large query results.
+//
+// A BserValue only refers to the memory owned by the BserResponse that it
+// came from, and must not outlive it.  The accessors throw WatchmanError
+// if the data is malformed or the value is not of the requested type.
+class BserValue {
+ public:
+  enum class Type {
+    Array,
+    Object,
+    String,
+    Integer,
+    Real,
+    Bool,
+    Null,
+  };
+
+  Type type() const;
+  bool isNull() const {
+    return type() == Type::Null;
+  }
+
+  // Strings are returned as they were encoded; BSER makes no promise that
+  // byte strings are valid UTF-8.
+  std::string_view asString() const;
+  int64_t asInt() const;
+  double asDouble() const;
+  bool asBool() const;
+
+  // The number of elements of an array, or of keys of an object
+  size_t size() const;
+
+  // Calls func for each element of an array, in order.  The rows of a
+  // templated array are presented as objects.
+  void forEach(folly::FunctionRef<void(const BserValue&)> func) const;
+
+  // Calls func for each key and value of an object.  Keys that a row of a
+  // templated array has no value for are skipped.
+  void forEachItem(
+      folly::FunctionRef<void(std::string_view, const BserValue&)> func) const;
+
+  // Returns the value for key in an object, or std::nullopt if it has none
+  std::optional<BserValue> get(std::string_view key) const;
+
+  // Materializes the value, for when the convenience is worth the cost
+  folly::dynamic toDynamic() const;
+
+  // Returns a view of the value encoded by the PDU in buf, which must be
+  // contiguous and remain valid for as long as the view is used.
+  static BserValue fromPdu(const folly::IOBuf& buf);
+
+ private:
+  BserValue(const uint8_t* data, const uint8_t* end, const uint8_t* keys)
+      : data_(data), end_(end), keys_(keys) {}
+
+  // Points at the type byte of the value, or at the first value of a row
+  // of a templated array
+  const uint8_t* data_;
+  // The end of the encoded data
+  const uint8_t* end_;
+  // For a row of a templated array, points at the array of keys from the
+  // template; otherwise nullptr
+  const uint8_t* keys_;
+};
+
+// The response to a command issued by WatchmanConnection::runRaw, which
+// owns the encoded data referenced by the BserValues that it hands out.
+class BserResponse {
+ public:
+  explicit BserResponse(std::vector<std::unique_ptr<folly::IOBuf>> pdus);
+
+  // The response itself.  For a query with stream_results, this is the
+  // final PDU, and its files are only the last of them; use forEachFile
+  // to see them all.
+  BserValue root() const;
+
+  // Calls func for each element of the files arrays of the response and
+  // of any partial responses that preceded it, in order.
+  void forEachFile(folly::FunctionRef<void(const BserValue&)> func) const;
+
+  // Materializes the response as WatchmanConnection::run would have
+  // returned it.
+  folly::dynamic toDynamic() const;
+
+ private:
+  // One per PDU, each a single contiguous buffer
+  std::vector<std::unique_ptr<folly::IOBuf>> pdus_;
+};
+
+} // namespace watchman
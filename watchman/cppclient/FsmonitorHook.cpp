@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+  A git fsmonitor hook that answers from watchman's fsmonitor-v2 command,
+  in place of a script that runs a query and reformats its results.
+  Configure it with:
+  $ git config core.fsmonitor /path/to/FsmonitorHook
+
+  Build with something like:
+  $ LDFLAGS=$(pkg-config watchmanclient --libs) \
+      CPPFLAGS=$(pkg-config watchmanclient --cflags) \
+      make FsmonitorHook
+
+  If the hook fails, git scans the work tree for itself.
+*/
+
+#include <watchman/cppclient/WatchmanConnection.h>
+
+#include <unistd.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include <folly/io/async/ScopedEventBaseThread.h>
+
+using namespace watchman;
+
+int main(int argc, char** argv) {
+  if (argc != 3 || strcmp(argv[1], "2") != 0) {
+    // git tries the hook with version 1 when 2 fails
+    std::cerr << "usage: " << argv[0] << " 2 <token>" << std::endl;
+    return 1;
+  }
+
+  // git runs the hook from the top of the work tree
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    perror("getcwd");
+    return 1;
+  }
+
+  folly::ScopedEventBaseThread sebt;
+  auto c = std::make_shared<WatchmanConnection>(sebt.getEventBase());
+  try {
+    c->connect(folly::dynamic::object(
+                   "required", folly::dynamic::array("cmd-fsmonitor-v2")))
+        .get();
+    auto res =
+        c->run(folly::dynamic::array("fsmonitor-v2", cwd, argv[2])).get();
+    c->close();
+
+    const auto& output = res["fsmonitor"].getString();
+    if (fwrite(output.data(), 1, output.size(), stdout) != output.size() ||
+        fflush(stdout) != 0) {
+      perror("write");
+      return 1;
+    }
+  } catch (const std::exception& ex) {
+    std::cerr << "watchman fsmonitor hook: " << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
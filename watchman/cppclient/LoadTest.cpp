@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+  A load generator for sizing a watchman daemon.  It runs a number of
+  concurrent clients against a root, each issuing a mix of queries, since
+  queries and clock calls, while another thread churns files in the root
+  and a number of subscriptions wait to hear about them.  Once done, it
+  reports how many of each request completed, and their p50, p99 and p999
+  latencies, along with how long the subscriptions took to hear about the
+  files that were changed.
+
+  Run with something like:
+  $ LoadTest --root=/path/to/tree --clients=16 --duration_seconds=30 \
+      --mix=query:6,since:3,clock:1 --subscriptions=4 --churn_per_second=500
+
+  The files are churned in a dir named watchman-load-test in the root,
+  which is removed again at the end.
+
+  Build with something like:
+  $ LDFLAGS=$(pkg-config watchmanclient --libs) \
+      CPPFLAGS=$(pkg-config watchmanclient --cflags) \
+      make LoadTest
+*/
+
+#include <watchman/cppclient/WatchmanClient.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <folly/Conv.h>
+#include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <folly/executors/CPUThreadPoolExecutor.h>
+#include <folly/init/Init.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include <folly/json.h>
+#include <folly/portability/GFlags.h>
+
+DEFINE_string(root, "", "the dir to load; it is watched if it isn't already");
+DEFINE_int32(clients, 8, "the number of concurrent clients");
+DEFINE_int32(duration_seconds, 10, "how long to run for");
+DEFINE_string(
+    mix,
+    "query:6,since:3,clock:1",
+    "the relative weights of the requests each client makes: query, a "
+    "query of the whole root; since, a query for the changes since the "
+    "client's last one; clock, a clock call");
+DEFINE_string(
+    query,
+    R"({"expression": ["type", "f"], "fields": ["name"]})",
+    "the query that the query and since requests make, as JSON");
+DEFINE_int32(subscriptions, 2, "the number of subscriptions to the root");
+DEFINE_int32(churn_files, 1000, "the number of files that are churned");
+DEFINE_int32(
+    churn_per_second,
+    100,
+    "how many files are created, modified or deleted each second");
+DEFINE_bool(json, false, "report the results as JSON");
+
+using namespace watchman;
+using SteadyClock = std::chrono::steady_clock;
+
+namespace {
+
+const char* const kChurnDir = "watchman-load-test";
+
+enum class Op { Query, Since, Clock };
+
+const char* opName(Op op) {
+  switch (op) {
+    case Op::Query:
+      return "query";
+    case Op::Since:
+      return "since";
+    case Op::Clock:
+      return "clock";
+  }
+  return "unknown";
+}
+
+struct Weight {
+  Op op;
+  int weight;
+};
+
+std::vector<Weight> parseMix(const std::string& mix) {
+  std::vector<std::string> items;
+  folly::split(',', mix, items, true);
+  std::vector<Weight> weights;
+  for (auto& item : items) {
+    std::string name;
+    int weight;
+    if (!folly::split(':', item, name, weight) || weight < 0) {
+      throw std::invalid_argument("--mix wants name:weight,...; got " + item);
+    }
+    if (name == "query") {
+      weights.push_back({Op::Query, weight});
+    } else if (name == "since") {
+      weights.push_back({Op::Since, weight});
+    } else if (name == "clock") {
+      weights.push_back({Op::Clock, weight});
+    } else {
+      throw std::invalid_argument("--mix has no request named " + name);
+    }
+  }
+  return weights;
+}
+
+// The latencies of one kind of request, in microseconds
+struct Samples {
+  std::vector<int64_t> latencies;
+  size_t errors{0};
+
+  void add(SteadyClock::duration latency) {
+    latencies.push_back(
+        std::chrono::duration_cast<std::chrono::microseconds>(latency)
+            .count());
+  }
+
+  void merge(const Samples& other) {
+    latencies.insert(
+        latencies.end(), other.latencies.begin(), other.latencies.end());
+    errors += other.errors;
+  }
+};
+
+// Returns the pth percentile of sorted, in milliseconds
+double percentile(const std::vector<int64_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  auto index = size_t(p / 100 * double(sorted.size() - 1) + 0.5);
+  return double(sorted[std::min(index, sorted.size() - 1)]) / 1000;
+}
+
+// When each of the churned files was last changed
+using ChangeTimes = folly::Synchronized<
+    std::unordered_map<std::string, SteadyClock::time_point>>;
+
+void runClient(
+    const std::string& root,
+    const std::vector<Weight>& weights,
+    const folly::dynamic& query,
+    SteadyClock::time_point deadline,
+    unsigned seed,
+    std::map<Op, Samples>& results) {
+  folly::ScopedEventBaseThread sebt;
+  WatchmanClient client(sebt.getEventBase());
+  client.connect().get();
+  auto watch = client.watch(root).get();
+  auto clock = client.getClock(watch).get();
+
+  int total = 0;
+  for (auto& w : weights) {
+    total += w.weight;
+  }
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<int> pick(0, std::max(0, total - 1));
+
+  while (SteadyClock::now() < deadline) {
+    auto roll = pick(rng);
+    auto op = weights.front().op;
+    for (auto& w : weights) {
+      if (roll < w.weight) {
+        op = w.op;
+        break;
+      }
+      roll -= w.weight;
+    }
+
+    auto start = SteadyClock::now();
+    try {
+      switch (op) {
+        case Op::Query:
+          client.query(query, watch).get();
+          break;
+        case Op::Since: {
+          auto sinceQuery = query;
+          sinceQuery["since"] = clock;
+          auto res = client.query(sinceQuery, watch).get();
+          clock = res.raw_["clock"].getString();
+          break;
+        }
+        case Op::Clock:
+          client.getClock(watch).get();
+          break;
+      }
+      results[op].add(SteadyClock::now() - start);
+    } catch (const std::exception& ex) {
+      results[op].errors++;
+      LOG(ERROR) << opName(op) << " failed: " << ex.what();
+    }
+  }
+  client.close();
+}
+
+// Creates, modifies and deletes the files in the churn dir at the rate
+// that was asked for
+void runChurn(
+    const std::string& root,
+    SteadyClock::time_point deadline,
+    ChangeTimes& changeTimes,
+    std::atomic<size_t>& changes) {
+  if (FLAGS_churn_per_second <= 0 || FLAGS_churn_files <= 0) {
+    return;
+  }
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> pick(0, FLAGS_churn_files - 1);
+  auto interval = std::chrono::duration_cast<SteadyClock::duration>(
+      std::chrono::duration<double>(1.0 / FLAGS_churn_per_second));
+
+  auto next = SteadyClock::now();
+  while (next < deadline) {
+    std::this_thread::sleep_until(next);
+    next += interval;
+
+    auto name = folly::to<std::string>(kChurnDir, "/f", pick(rng));
+    auto path = root + "/" + name;
+    bool exists = access(path.c_str(), F_OK) == 0;
+    changeTimes.wlock()->insert_or_assign(name, SteadyClock::now());
+    if (exists && rng() % 3 == 0) {
+      unlink(path.c_str());
+    } else if (auto* file = fopen(path.c_str(), "a")) {
+      fputs("x", file);
+      fclose(file);
+    }
+    changes++;
+  }
+}
+
+void removeChurnDir(const std::string& root) {
+  auto dir = root + "/" + kChurnDir;
+  for (int i = 0; i < FLAGS_churn_files; ++i) {
+    unlink(folly::to<std::string>(dir, "/f", i).c_str());
+  }
+  rmdir(dir.c_str());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  if (FLAGS_root.empty() || FLAGS_clients < 0) {
+    std::cerr << "usage: " << argv[0] << " --root=<dir> [options]; see --help"
+              << std::endl;
+    return 1;
+  }
+
+  std::vector<Weight> weights;
+  folly::dynamic query;
+  try {
+    weights = parseMix(FLAGS_mix);
+    query = folly::parseJson(FLAGS_query);
+  } catch (const std::exception& ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+  if (weights.empty() && FLAGS_clients > 0) {
+    std::cerr << "--mix has no requests" << std::endl;
+    return 1;
+  }
+
+  auto root = FLAGS_root;
+  auto churnDir = root + "/" + kChurnDir;
+  if (mkdir(churnDir.c_str(), 0755) != 0 && errno != EEXIST) {
+    perror(churnDir.c_str());
+    return 1;
+  }
+
+  // The subscriptions share a connection and report the time from each
+  // change to its delivery
+  ChangeTimes changeTimes;
+  folly::Synchronized<Samples> deliveries;
+  folly::CPUThreadPoolExecutor callbacks(1);
+  folly::ScopedEventBaseThread subscriberThread;
+  WatchmanClient subscriber(subscriberThread.getEventBase());
+  std::vector<SubscriptionPtr> subscriptions;
+  try {
+    subscriber.connect().get();
+    auto watch = subscriber.watch(root).get();
+    for (int i = 0; i < FLAGS_subscriptions; ++i) {
+      subscriptions.push_back(
+          subscriber
+              .subscribe(
+                  folly::dynamic::object(
+                      "expression",
+                      folly::dynamic::array("dirname", kChurnDir))(
+                      "fields", folly::dynamic::array("name")),
+                  watch,
+                  &callbacks,
+                  [&](folly::Try<folly::dynamic>&& data) {
+                    if (!data.hasValue() ||
+                        data->getDefault("is_fresh_instance", false)
+                            .asBool()) {
+                      return;
+                    }
+                    auto files = data->getDefault("files");
+                    if (!files.isArray()) {
+                      return;
+                    }
+                    auto now = SteadyClock::now();
+                    auto times = changeTimes.rlock();
+                    auto samples = deliveries.wlock();
+                    for (auto& name : files) {
+                      auto it = times->find(name.asString());
+                      if (it != times->end()) {
+                        samples->add(now - it->second);
+                      }
+                    }
+                  })
+              .get());
+    }
+  } catch (const std::exception& ex) {
+    std::cerr << "failed to subscribe to " << root << ": " << ex.what()
+              << std::endl;
+    return 1;
+  }
+
+  auto start = SteadyClock::now();
+  auto deadline = start + std::chrono::seconds(FLAGS_duration_seconds);
+
+  std::atomic<size_t> changes{0};
+  std::thread churn(
+      [&] { runChurn(root, deadline, changeTimes, changes); });
+
+  std::vector<std::map<Op, Samples>> clientResults(FLAGS_clients);
+  std::vector<std::thread> clients;
+  for (int i = 0; i < FLAGS_clients; ++i) {
+    clients.emplace_back([&, i] {
+      try {
+        runClient(
+            root, weights, query, deadline, unsigned(i), clientResults[i]);
+      } catch (const std::exception& ex) {
+        LOG(ERROR) << "client " << i << " failed: " << ex.what();
+      }
+    });
+  }
+  for (auto& client : clients) {
+    client.join();
+  }
+  churn.join();
+  auto elapsed =
+      std::chrono::duration<double>(SteadyClock::now() - start).count();
+
+  // Give the subscriptions a moment to hear about the last of the churn
+  for (auto& sub : subscriptions) {
+    try {
+      subscriber.flushSubscription(sub, std::chrono::seconds(10)).get();
+    } catch (const std::exception&) {
+    }
+  }
+  for (auto& sub : subscriptions) {
+    subscriber.unsubscribe(sub).get();
+  }
+  callbacks.join();
+  subscriber.close();
+  removeChurnDir(root);
+
+  std::map<Op, Samples> totals;
+  for (auto& results : clientResults) {
+    for (auto& it : results) {
+      totals[it.first].merge(it.second);
+    }
+  }
+
+  std::map<std::string, Samples*> report;
+  for (auto& it : totals) {
+    report[opName(it.first)] = &it.second;
+  }
+  auto delivered = deliveries.wlock();
+  if (FLAGS_subscriptions > 0) {
+    report["subscription"] = &*delivered;
+  }
+
+  auto json = folly::dynamic::object("elapsed_seconds", elapsed)(
+      "churned_files", int64_t(changes.load()));
+  if (!FLAGS_json) {
+    printf(
+        "%.1fs, %zu files churned\n"
+        "%-14s %10s %10s %10s %10s %10s %8s\n",
+        elapsed,
+        changes.load(),
+        "",
+        "count",
+        "per sec",
+        "p50 ms",
+        "p99 ms",
+        "p999 ms",
+        "errors");
+  }
+  for (auto& it : report) {
+    auto& samples = *it.second;
+    std::sort(samples.latencies.begin(), samples.latencies.end());
+    auto count = samples.latencies.size();
+    auto rate = double(count) / elapsed;
+    auto p50 = percentile(samples.latencies, 50);
+    auto p99 = percentile(samples.latencies, 99);
+    auto p999 = percentile(samples.latencies, 99.9);
+    if (FLAGS_json) {
+      json[it.first] = folly::dynamic::object("count", int64_t(count))(
+          "per_second", rate)("p50_ms", p50)("p99_ms", p99)(
+          "p999_ms", p999)("errors", int64_t(samples.errors));
+    } else {
+      printf(
+          "%-14s %10zu %10.1f %10.2f %10.2f %10.2f %8zu\n",
+          it.first.c_str(),
+          count,
+          rate,
+          p50,
+          p99,
+          p999,
+          samples.errors);
+    }
+  }
+  if (FLAGS_json) {
+    std::cout << folly::toPrettyJson(json) << std::endl;
+  }
+  return 0;
+}
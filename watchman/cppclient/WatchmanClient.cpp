@@ -88,6 +88,10 @@ SemiFuture<dynamic> WatchmanClient::run(const dynamic& cmd) {
   return conn_->run(cmd);
 }
 
+SemiFuture<BserResponse> WatchmanClient::runRaw(const dynamic& cmd) {
+  return conn_->runRaw(cmd);
+}
+
 Future<WatchPathPtr> WatchmanClient::watchImpl(std::string_view path) {
   return conn_->run(dynamic::array("watch-project", path))
       .thenValue([=](dynamic&& data) {
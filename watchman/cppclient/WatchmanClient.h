@@ -179,6 +179,13 @@ struct WatchmanClient {
    */
   folly::SemiFuture<folly::dynamic> run(const folly::dynamic& cmd);
 
+  /**
+   * As run(), but the response is left encoded so that it can be read in
+   * place through BserValue, which avoids building a folly::dynamic for
+   * every file in a large query result.
+   */
+  folly::SemiFuture<BserResponse> runRaw(const folly::dynamic& cmd);
+
   /**
    * Create a watch for a path, automatically sharing scarce OS resources
    * between multiple watchers of the same (super-)tree. This should be the
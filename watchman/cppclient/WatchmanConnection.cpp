@@ -11,8 +11,10 @@
 
 #include <folly/ExceptionWrapper.h>
 #include <folly/SocketAddress.h>
+#include <folly/compression/Compression.h>
 #include <folly/executors/InlineExecutor.h>
 #include <folly/experimental/bser/Bser.h>
+#include <folly/io/Cursor.h>
 
 #ifdef _WIN32
 #include <eden/fs/utils/SpawnedProcess.h> // @manual
@@ -33,6 +35,97 @@ static const std::vector<dynamic> kUnilateralLabels{"subscription", "log"};
 
 static const dynamic kError("error");
 static const dynamic kCapabilities("capabilities");
+static const dynamic kZstdCapability("bser-v2-zstd");
+
+// BSER v2 capabilities, as defined by watchman/bser.h
+static constexpr uint32_t kCapAcceptZstd = 0x4;
+static constexpr uint32_t kCapZstdBody = 0x8;
+
+// Reads an encoded integer, returning its value and its encoded size
+static std::pair<int64_t, size_t> readBserInt(io::Cursor& curs) {
+  switch (curs.read<int8_t>()) {
+    case 0x03:
+      return {curs.read<int8_t>(), 1 + sizeof(int8_t)};
+    case 0x04:
+      return {curs.read<int16_t>(), 1 + sizeof(int16_t)};
+    case 0x05:
+      return {curs.read<int32_t>(), 1 + sizeof(int32_t)};
+    case 0x06:
+      return {curs.read<int64_t>(), 1 + sizeof(int64_t)};
+    default:
+      throw WatchmanError("invalid BSER integer encoding");
+  }
+}
+
+// Returns the size of the PDU at the front of buf, header included, which
+// folly's decodePduLength can't do for BSER v2.  Throws std::out_of_range
+// if buf doesn't hold all of the header yet.
+static size_t decodeAnyPduLength(const IOBuf* buf) {
+  io::Cursor curs(buf);
+  uint8_t magic[2];
+  curs.pull(magic, sizeof(magic));
+  if (magic[0] != 0 || (magic[1] != 1 && magic[1] != 2)) {
+    throw WatchmanError("invalid BSER magic header");
+  }
+  size_t headerLen = sizeof(magic);
+  if (magic[1] == 2) {
+    curs.skip(sizeof(uint32_t));
+    headerLen += sizeof(uint32_t);
+  }
+  auto [len, intSize] = readBserInt(curs);
+  return headerLen + intSize + len;
+}
+
+// folly only produces BSER v1 PDUs; this turns one into a v2 PDU with the
+// given capabilities
+static std::unique_ptr<IOBuf> toV2Pdu(
+    std::unique_ptr<IOBuf> pdu,
+    uint32_t capabilities) {
+  auto header = IOBuf::create(2 + sizeof(capabilities));
+  memcpy(header->writableData(), "\x00\x02", 2);
+  memcpy(header->writableData() + 2, &capabilities, sizeof(capabilities));
+  header->append(2 + sizeof(capabilities));
+  pdu->coalesce();
+  pdu->trimStart(2);
+  header->prependChain(std::move(pdu));
+  return header;
+}
+
+// folly only decodes BSER v1 PDUs; this turns a v2 PDU into the v1
+// equivalent, uncompressing its body if need be.  The body is shared with
+// pdu rather than copied.
+static std::unique_ptr<IOBuf> toV1Pdu(std::unique_ptr<IOBuf> pdu) {
+  io::Cursor curs(pdu.get());
+  uint8_t magic[2];
+  curs.pull(magic, sizeof(magic));
+  if (magic[1] != 2) {
+    return pdu;
+  }
+  auto capabilities = curs.read<uint32_t>();
+  int64_t len = readBserInt(curs).first;
+  std::unique_ptr<IOBuf> body;
+  curs.clone(body, len);
+
+  if (capabilities & kCapZstdBody) {
+    io::Cursor bodyCurs(body.get());
+    auto [uncompressedLen, intSize] = readBserInt(bodyCurs);
+    std::unique_ptr<IOBuf> compressed;
+    bodyCurs.clone(compressed, len - intSize);
+    body = io::getCodec(io::CodecType::ZSTD)
+               ->uncompress(compressed.get(), uint64_t(uncompressedLen));
+    len = uncompressedLen;
+  }
+
+  auto header = IOBuf::create(3 + sizeof(len));
+  auto p = header->writableData();
+  p[0] = 0;
+  p[1] = 1;
+  p[2] = 0x06;
+  memcpy(p + 3, &len, sizeof(len));
+  header->append(3 + sizeof(len));
+  header->prependChain(std::move(body));
+  return header;
+}
 
 // We'll just dispatch bser decodes and callbacks inline unless they
 // give us an alternative environment
@@ -117,6 +210,11 @@ Future<dynamic> WatchmanConnection::connect(folly::dynamic versionArgs) {
   if (!versionArgs.isObject()) {
     throw WatchmanError("versionArgs must be object");
   }
+  if (compressRequested_ && io::hasCodec(io::CodecType::ZSTD)) {
+    auto optional = versionArgs.getDefault("optional", dynamic::array());
+    optional.push_back(kZstdCapability);
+    versionArgs["optional"] = std::move(optional);
+  }
   versionCmd_ = folly::dynamic::array("version", versionArgs);
 
   auto res = getSockPath().thenValue(
@@ -181,6 +279,11 @@ void WatchmanConnection::connectSuccess() noexcept {
                 shared_this->watchmanResponseToTry(std::move(result)));
             return;
           }
+          auto zstd = result[kCapabilities].get_ptr(kZstdCapability);
+          if (shared_this->compressRequested_ && zstd && zstd->isBool() &&
+              zstd->asBool()) {
+            shared_this->compressResponses_ = true;
+          }
           shared_this->connectPromise_.setValue(std::move(result));
         })
         .thenError([shared_this =
@@ -204,34 +307,60 @@ void WatchmanConnection::connectErr(
 WatchmanConnection::QueuedCommand::QueuedCommand(const dynamic& command)
     : cmd(command) {}
 
-Future<dynamic> WatchmanConnection::run(const dynamic& command) noexcept {
-  auto cmd = std::make_shared<QueuedCommand>(command);
+void WatchmanConnection::QueuedCommand::fail(
+    const folly::exception_wrapper& ex) {
+  if (rawPromise) {
+    if (!rawPromise->isFulfilled()) {
+      rawPromise->setException(ex);
+    }
+  } else if (!promise.isFulfilled()) {
+    promise.setException(ex);
+  }
+}
+
+void WatchmanConnection::queueCommand(
+    const std::shared_ptr<QueuedCommand>& cmd) {
   if (broken_) {
-    cmd->promise.setException(WatchmanError("The connection was broken"));
-    return cmd->promise.getFuture();
+    cmd->fail(make_exception_wrapper<WatchmanError>(
+        "The connection was broken"));
+    return;
   }
   if (!sock_) {
-    cmd->promise.setException(WatchmanError(
+    cmd->fail(make_exception_wrapper<WatchmanError>(
         "No socket (did you call connect() and check result for exceptions?)"));
-    return cmd->promise.getFuture();
+    return;
   }
 
   bool shouldWrite;
   {
     std::lock_guard<std::mutex> g(mutex_);
-    // We only need to call sendCommand if we don't have a command in
-    // progress; the completion handler will trigger it once we receive
-    // the response
-    shouldWrite = commandQ_.empty();
     commandQ_.push_back(cmd);
+    // One scheduled write sends everything queued up to that point
+    shouldWrite = !writeScheduled_;
+    writeScheduled_ = true;
   }
 
   if (shouldWrite) {
-    eventBase_->runInEventBaseThread(
-        [shared_this = shared_from_this()] { shared_this->sendCommand(); });
+    eventBase_->runInEventBaseThread([shared_this = shared_from_this()] {
+      shared_this->sendPendingCommands();
+    });
   }
+}
 
-  return cmd->promise.getFuture();
+Future<dynamic> WatchmanConnection::run(const dynamic& command) noexcept {
+  auto cmd = std::make_shared<QueuedCommand>(command);
+  auto future = cmd->promise.getFuture();
+  queueCommand(cmd);
+  return future;
+}
+
+Future<BserResponse> WatchmanConnection::runRaw(
+    const dynamic& command) noexcept {
+  auto cmd = std::make_shared<QueuedCommand>(command);
+  cmd->rawPromise.emplace();
+  auto future = cmd->rawPromise->getFuture();
+  queueCommand(cmd);
+  return future;
 }
 
 // Generate a failure for all queued commands
@@ -240,12 +369,11 @@ void WatchmanConnection::failQueuedCommands(
   std::lock_guard<std::mutex> g(mutex_);
   auto q = commandQ_;
   commandQ_.clear();
+  numSent_ = 0;
 
   broken_ = true;
   for (auto& cmd : q) {
-    if (!cmd->promise.isFulfilled()) {
-      cmd->promise.setException(ex);
-    }
+    cmd->fail(ex);
   }
 
   // If the user has explicitly closed the connection no need for callback
@@ -256,29 +384,57 @@ void WatchmanConnection::failQueuedCommands(
   }
 }
 
-// Sends the next eligible command to the Watchman service
-void WatchmanConnection::sendCommand(bool pop) {
-  std::shared_ptr<QueuedCommand> cmd;
-
+// Sends every queued command that hasn't been sent yet.  The server reads
+// and answers the commands on a connection one at a time, in order, so
+// there is no need to wait for a response before sending the next command,
+// and the responses can be matched up with the commands in the same order.
+void WatchmanConnection::sendPendingCommands() {
+  std::vector<std::shared_ptr<QueuedCommand>> toSend;
   {
     std::lock_guard<std::mutex> g(mutex_);
+    writeScheduled_ = false;
+    toSend.assign(commandQ_.begin() + numSent_, commandQ_.end());
+    numSent_ = commandQ_.size();
+  }
 
-    if (pop) {
-      // We finished processing this one, discard it and focus
-      // on the next item, if any.
-      commandQ_.pop_front();
-    }
-    if (commandQ_.empty()) {
+  for (auto& cmd : toSend) {
+    if (!sock_) {
+      // close() got there first; it has failed the commands already
       return;
     }
-    cmd = commandQ_.front();
+    auto pdu = toBserIOBuf(cmd->cmd, serialization_opts());
+    if (compressResponses_) {
+      pdu = toV2Pdu(std::move(pdu), kCapAcceptZstd);
+    }
+    sock_->writeChain(this, std::move(pdu));
   }
+}
 
-  sock_->writeChain(this, toBserIOBuf(cmd->cmd, serialization_opts()));
+std::shared_ptr<WatchmanConnection::QueuedCommand>
+WatchmanConnection::popCommand() {
+  std::lock_guard<std::mutex> g(mutex_);
+  if (commandQ_.empty() || numSent_ == 0) {
+    return nullptr;
+  }
+  auto cmd = std::move(commandQ_.front());
+  commandQ_.pop_front();
+  --numSent_;
+  return cmd;
 }
 
-void WatchmanConnection::popAndSendCommand() {
-  sendCommand(/* pop = */ true);
+void WatchmanConnection::dispatchRawResponse(
+    const std::shared_ptr<QueuedCommand>& cmd,
+    std::unique_ptr<folly::IOBuf> pdu,
+    bool isError) {
+  if (isError) {
+    // Errors are rare and small, so the convenience of a dynamic wins
+    cmd->rawPromise->setTry(
+        Try<BserResponse>(make_exception_wrapper<WatchmanResponseError>(
+            parseBser(pdu.get()))));
+    return;
+  }
+  cmd->rawPdus.push_back(std::move(pdu));
+  cmd->rawPromise->setValue(BserResponse(std::move(cmd->rawPdus)));
 }
 
 // Called when AsyncSocket::writeChain completes
@@ -321,7 +477,7 @@ std::unique_ptr<folly::IOBuf> WatchmanConnection::splitNextPdu() {
   // Do we have enough data to decode the next item?
   size_t pdu_len = 0;
   try {
-    pdu_len = decodePduLength(bufQ_.front());
+    pdu_len = decodeAnyPduLength(bufQ_.front());
   } catch (const std::out_of_range&) {
     // Don't have enough data yet
     return nullptr;
@@ -361,50 +517,121 @@ void WatchmanConnection::decodeNextResponse() {
     }
 
     try {
-      auto decoded = parseBser(pdu.get());
+      pdu = toV1Pdu(std::move(pdu));
+
+      // The command that this is the response to, unless it turns out to
+      // be a unilateral response
+      std::shared_ptr<QueuedCommand> front;
+      {
+        std::lock_guard<std::mutex> g(mutex_);
+        if (!commandQ_.empty()) {
+          front = commandQ_.front();
+        }
+      }
+
+      // A raw command has its response inspected in place, and is only
+      // decoded if it is unilateral or an error
+      std::optional<BserValue> view;
+      dynamic decoded;
+      if (front && front->rawPromise) {
+        pdu->coalesce();
+        view = BserValue::fromPdu(*pdu);
+      } else {
+        decoded = parseBser(pdu.get());
+      }
 
       bool is_unilateral = false;
-      // Check for a unilateral response
-      for (const auto& k : kUnilateralLabels) {
-        if (decoded.get_ptr(k)) {
-          // This is a unilateral response
-          if (callback_.has_value()) {
-            callback_.value()(watchmanResponseToTry(std::move(decoded)));
+      bool is_error = false;
+      bool is_partial = false;
+      if (view) {
+        // A single pass over the keys, which skips over the values without
+        // decoding them
+        view->forEachItem([&](std::string_view key, const BserValue& value) {
+          for (const auto& k : kUnilateralLabels) {
+            if (key == k.getString()) {
+              is_unilateral = true;
+            }
+          }
+          if (key == kError.getString()) {
+            is_error = true;
+          } else if (key == "partial") {
+            is_partial =
+                value.type() == BserValue::Type::Bool && value.asBool();
+          }
+        });
+      } else {
+        for (const auto& k : kUnilateralLabels) {
+          if (decoded.get_ptr(k)) {
             is_unilateral = true;
             break;
           }
+        }
+      }
+
+      // Check for a unilateral response
+      if (is_unilateral) {
+        if (!callback_.has_value()) {
           // No callback; usage error :-/
           failQueuedCommands(
               std::runtime_error("No unilateral callback has been installed"));
           return;
         }
-      }
-      if (is_unilateral) {
+        if (view) {
+          decoded = parseBser(pdu.get());
+        }
+        callback_.value()(watchmanResponseToTry(std::move(decoded)));
         continue;
       }
 
-      // It's actually a command response; get the cmd so that we
-      // can fulfil its promise
-      std::shared_ptr<QueuedCommand> cmd;
-      {
-        std::lock_guard<std::mutex> g(mutex_);
-        if (commandQ_.empty()) {
-          failQueuedCommands(
-              std::runtime_error("No commands have been queued"));
+      // It's actually a command response for the command at the front of
+      // the queue
+      if (!front) {
+        failQueuedCommands(std::runtime_error("No commands have been queued"));
+        return;
+      }
+      auto& cmd = front;
+
+      if (view) {
+        if (is_partial && !is_error) {
+          cmd->rawPdus.push_back(std::move(pdu));
+          continue;
+        }
+        if (!popCommand()) {
+          failQueuedCommands(std::runtime_error("No commands have been sent"));
           return;
         }
-        cmd = commandQ_.front();
+        dispatchRawResponse(cmd, std::move(pdu), is_error);
+        continue;
       }
 
-      // Dispatch outside of the lock in case it tries to send another
-      // command
-      cmd->promise.setTry(watchmanResponseToTry(std::move(decoded)));
+      // A query that set stream_results is answered by a series of partial
+      // responses followed by the final response; combine their files so
+      // that the caller sees a single response.
+      auto* files = decoded.get_ptr("files");
+      if (files && files->isArray()) {
+        auto* partial = decoded.get_ptr("partial");
+        if (partial && partial->isBool() && partial->asBool()) {
+          for (auto& file : *files) {
+            cmd->streamedFiles.push_back(std::move(file));
+          }
+          continue;
+        }
+        if (!cmd->streamedFiles.empty()) {
+          for (auto& file : *files) {
+            cmd->streamedFiles.push_back(std::move(file));
+          }
+          *files = std::move(cmd->streamedFiles);
+        }
+      }
 
-      // Now we're in a position to send the next queued command.
-      // We remove it after dispatching the try above in case that
-      // queued up more commands; we want to be the one thing that
-      // is responsible for sending the next queued command here
-      popAndSendCommand();
+      // Remove it from the queue before dispatching, in case the callback
+      // issues more commands or closes the connection.  Dispatch outside
+      // of the lock for the same reason.
+      if (!popCommand()) {
+        failQueuedCommands(std::runtime_error("No commands have been sent"));
+        return;
+      }
+      cmd->promise.setTry(watchmanResponseToTry(std::move(decoded)));
     } catch (const std::exception& ex) {
       failQueuedCommands(
           folly::exception_wrapper{std::current_exception(), ex});
@@ -19,6 +19,8 @@
 #include <folly/io/async/AsyncSocket.h>
 #include <folly/io/async/EventBase.h>
 
+#include "BserView.h"
+
 namespace watchman {
 
 // General watchman error
@@ -69,9 +71,24 @@ class WatchmanConnection
           folly::dynamic::array("relative_root")));
 
   // Issue a watchman command, yielding the results at a later time.
-  // If the connection was terminated, will throw immediately
+  // If the connection was terminated, will throw immediately.
+  // Commands are sent as soon as they are issued, without waiting for the
+  // responses to earlier commands; the server answers them in order.
   folly::Future<folly::dynamic> run(const folly::dynamic& command) noexcept;
 
+  // As run(), but yields the encoded response rather than decoding it into
+  // a folly::dynamic, so that large results can be read in place.  Error
+  // responses are still reported as WatchmanResponseError.
+  folly::Future<BserResponse> runRaw(const folly::dynamic& command) noexcept;
+
+  // Asks the server to compress large responses, which helps when the
+  // socket is slow, e.g. because it is forwarded from another machine.
+  // Must be called before connect().  Has no effect if the server doesn't
+  // support compression, or if folly was built without zstd.
+  void setCompressResponses(bool compress) {
+    compressRequested_ = compress;
+  }
+
   // Close the connection.  All queued commands will be cancelled
   void close();
 
@@ -86,18 +103,34 @@ class WatchmanConnection
   }
 
  private:
-  // Represents a command queued up by the run() function
+  // Represents a command queued up by the run() or runRaw() functions
   struct QueuedCommand {
     folly::dynamic cmd;
     folly::Promise<folly::dynamic> promise;
+    // Files from the partial responses to a query with stream_results
+    folly::dynamic streamedFiles = folly::dynamic::array;
+    // Set for runRaw(), in which case promise is unused
+    std::optional<folly::Promise<BserResponse>> rawPromise;
+    // The PDUs of the partial responses so far, for runRaw()
+    std::vector<std::unique_ptr<folly::IOBuf>> rawPdus;
 
     explicit QueuedCommand(const folly::dynamic& command);
+
+    void fail(const folly::exception_wrapper& ex);
   };
 
   folly::Future<std::string> getSockPath();
   void failQueuedCommands(const folly::exception_wrapper& ex);
-  void sendCommand(bool pop = false);
-  void popAndSendCommand();
+  // Queues cmd to be sent, or fails it if the connection can't be used
+  void queueCommand(const std::shared_ptr<QueuedCommand>& cmd);
+  void sendPendingCommands();
+  // Removes the command at the front of the queue, which the response just
+  // received belongs to, and returns it
+  std::shared_ptr<QueuedCommand> popCommand();
+  void dispatchRawResponse(
+      const std::shared_ptr<QueuedCommand>& cmd,
+      std::unique_ptr<folly::IOBuf> pdu,
+      bool isError);
   void decodeNextResponse();
   folly::Try<folly::dynamic> watchmanResponseToTry(folly::dynamic&& value);
   std::unique_ptr<folly::IOBuf> splitNextPdu();
@@ -126,10 +159,17 @@ class WatchmanConnection
   folly::dynamic versionCmd_;
   std::shared_ptr<folly::AsyncSocket> sock_;
   std::mutex mutex_;
+  // Commands that have been issued and not yet answered, in order.  The
+  // first numSent_ of them have been written to the socket.
   std::deque<std::shared_ptr<QueuedCommand>> commandQ_;
+  size_t numSent_{0};
+  bool writeScheduled_{false};
   folly::IOBufQueue bufQ_{folly::IOBufQueue::cacheChainLength()};
   bool broken_{false};
   bool closing_{false};
+  bool compressRequested_{false};
+  // Set once the server has agreed to compress responses
+  std::atomic<bool> compressResponses_{false};
   std::atomic<bool> decoding_{false};
 };
 } // namespace watchman
@@ -16,6 +16,10 @@ struct DirEntry {
   bool has_stat;
   const char* d_name;
   FileInformation stat;
+  // The type of the entry, as reported by the listing itself.  This is
+  // known on most filesystems even when has_stat is false, and is
+  // DType::Unknown when it isn't.
+  DType dtype{DType::Unknown};
 };
 
 class DirHandle {
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/FSProfile.h"
+#include "watchman/Logging.h"
+#include "watchman/WatchmanConfig.h"
+
+namespace watchman {
+
+namespace {
+
+// Filesystems that answer stats quickly and keep the change time of a dir
+// up to date: stats are worth running in parallel, unchanged dirs need not
+// be read again by a recrawl, and the inotify watcher can sync without
+// cookie files.
+json_ref localProfile() {
+  return json_object({
+      {"crawl_stat_parallelism", json_integer(4)},
+      {"change_stat_parallelism", json_integer(2)},
+      {"recrawl_prune_unchanged_dirs", typed_string_to_json("listing")},
+      {"sync_without_cookies", json_true()},
+  });
+}
+
+// Network and userspace filesystems, where each stat is a round trip,
+// attributes may be cached, and changes made elsewhere may trickle in.
+json_ref remoteProfile() {
+  return json_object({
+      {"crawl_stat_parallelism", json_integer(1)},
+      {"trust_dir_change_times", json_false()},
+      {"settle", json_integer(100)},
+  });
+}
+
+// Names fuse filesystems of every kind, which report as "fuse.<kind>", by
+// the profile that they share.
+w_string_piece profileName(w_string_piece fsType) {
+  if (fsType.startsWith("fuse.")) {
+    return w_string_piece("fuse");
+  }
+  return fsType;
+}
+
+} // namespace
+
+json_ref getBuiltinFSTypeProfile(w_string_piece fsType) {
+  auto name = profileName(fsType);
+  for (auto local : {"ext4", "xfs", "btrfs", "tmpfs", "apfs"}) {
+    if (name == w_string_piece(local)) {
+      return localProfile();
+    }
+  }
+  if (name == "nfs") {
+    // Notifications only cover the changes made by this host
+    auto profile = remoteProfile();
+    profile.set("watcher", typed_string_to_json("poll"));
+    return profile;
+  }
+  for (auto remote : {"cifs", "smb", "smbfs", "9p", "vboxsf", "fuse"}) {
+    if (name == w_string_piece(remote)) {
+      return remoteProfile();
+    }
+  }
+  return nullptr;
+}
+
+json_ref getFSTypeProfile(const w_string& fsType) {
+  auto overrides = cfg_get_json("fstype_profiles");
+  if (overrides && overrides.isObject()) {
+    auto profile = overrides.get_default(fsType.c_str());
+    if (!profile && fsType.piece().startsWith("fuse.")) {
+      profile = overrides.get_default("fuse");
+    }
+    if (profile) {
+      if (!profile.isObject()) {
+        logf(
+            ERR,
+            "ignoring fstype_profiles entry for {}: it is not an object\n",
+            fsType);
+      } else if (json_object_size(profile) == 0) {
+        return nullptr;
+      } else {
+        return profile;
+      }
+    }
+  } else if (overrides) {
+    logf(ERR, "ignoring fstype_profiles: it is not an object\n");
+  }
+  return getBuiltinFSTypeProfile(fsType);
+}
+
+} // namespace watchman
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Returns the config options that suit roots on filesystems of type
+ * fsType, as reported by w_fstype(), or null if there are none.
+ *
+ * The options are only defaults: Configuration consults them after the
+ * root's .watchmanconfig, the command line and the global config.  The
+ * built-in profile for a type is replaced by the entry for it, if any, in
+ * the global fstype_profiles object, and an empty entry turns the profile
+ * for that type off.
+ */
+json_ref getFSTypeProfile(const w_string& fsType);
+
+/**
+ * The built-in profile, not taking fstype_profiles into account.
+ */
+json_ref getBuiltinFSTypeProfile(w_string_piece fsType);
+
+} // namespace watchman
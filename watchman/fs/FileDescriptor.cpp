@@ -511,6 +511,36 @@ Result<int, std::error_code> FileDescriptor::read(void* buf, int size) const {
 #endif
 }
 
+Result<int, std::error_code> FileDescriptor::pread(
+    void* buf,
+    int size,
+    int64_t offset) const {
+#ifndef _WIN32
+  auto result = ::pread(fd_, buf, size, off_t(offset));
+  if (result == -1) {
+    int errcode = errno;
+    return Result<int, std::error_code>(
+        std::error_code(errcode, std::generic_category()));
+  }
+  return Result<int, std::error_code>(result);
+#else
+  OVERLAPPED overlapped{};
+  overlapped.Offset = DWORD(uint64_t(offset));
+  overlapped.OffsetHigh = DWORD(uint64_t(offset) >> 32);
+  DWORD result = 0;
+  if (!ReadFile((HANDLE)fd_, buf, size, &result, &overlapped)) {
+    auto err = GetLastError();
+    if (err == ERROR_HANDLE_EOF) {
+      result = 0;
+    } else {
+      return Result<int, std::error_code>(
+          std::error_code(err, std::system_category()));
+    }
+  }
+  return Result<int, std::error_code>(result);
+#endif
+}
+
 Result<int, std::error_code> FileDescriptor::write(const void* buf, int size)
     const {
 #ifndef _WIN32
@@ -194,6 +194,9 @@ class FileDescriptor {
   /** read(2), but yielding a Result for system independent error reporting */
   Result<int, std::error_code> read(void* buf, int size) const;
 
+  /** pread(2): as read, but at offset, and leaving the file position be */
+  Result<int, std::error_code> pread(void* buf, int size, int64_t offset) const;
+
   /** write(2), but yielding a Result for system independent error reporting */
   Result<int, std::error_code> write(const void* buf, int size) const;
 
@@ -7,6 +7,7 @@
 
 #include "watchman/fs/FileSystem.h"
 #include <folly/String.h>
+#include <unordered_map>
 #include "watchman/fs/FSDetect.h"
 #include "watchman/watchman_stream.h"
 #include "watchman/watchman_string.h"
@@ -40,6 +41,13 @@ class RealFileSystem final : public FileSystem {
     return watchman::getFileInformation(path, caseSensitive);
   }
 
+  FileInformation getFileInformationRelative(
+      const char* path,
+      CaseSensitivity caseSensitive,
+      DirFdCache& dirs) override {
+    return watchman::getFileInformationRelative(path, caseSensitive, dirs);
+  }
+
   /**
    * Watchman-specific API for creating an empty file on the filesystem.
    * On unix, the created file will have mode 0700.
@@ -300,6 +308,166 @@ FileInformation getFileInformation(
 #endif
 }
 
+const FileDescriptor& DirFdCache::get(const w_string& path) {
+  auto it = dirs_.find(path);
+  if (it != dirs_.end()) {
+    return it->second;
+  }
+  auto handle =
+      openFileHandle(path.c_str(), OpenFileHandleOptions::queryFileInfo());
+  if (dirs_.size() >= capacity_) {
+    // Crawls and batches of changes move on from the dirs that they are
+    // done with, so there is no need to track which were used last
+    dirs_.clear();
+  }
+  return dirs_.emplace(path, std::move(handle)).first->second;
+}
+
+FileInformation getFileInformationRelative(
+    const char* path,
+    CaseSensitivity caseSensitive,
+    DirFdCache& dirs) {
+#ifndef _WIN32
+  if (caseSensitive == CaseSensitivity::Unknown) {
+    caseSensitive = getCaseSensitivityForPath(path);
+  }
+  if (caseSensitive != CaseSensitivity::CaseInSensitive) {
+    // The dir was opened with the same strict name checks as
+    // getFileInformation applies to the whole path, and the leaf is not
+    // followed, so the result is the same.
+    w_string_piece pathPiece(path);
+    auto& dir = dirs.get(pathPiece.dirName().asWString());
+    struct stat st;
+    if (fstatat(
+            dir.fd(), pathPiece.baseName().data(), &st, AT_SYMLINK_NOFOLLOW)) {
+      throw std::system_error(errno, std::generic_category(), "fstatat");
+    }
+    return FileInformation(st);
+  }
+#endif
+  return getFileInformation(path, caseSensitive);
+}
+
+namespace {
+// The fallback for getFileInformationInDir; resolves each path in full
+void getFileInformationForEach(
+    const char* dirPath,
+    const std::vector<w_string_piece>& names,
+    CaseSensitivity caseSensitive,
+    std::vector<std::optional<FileInformation>>& result) {
+  for (size_t i = 0; i < names.size(); ++i) {
+    try {
+      result[i] = getFileInformation(
+          w_string::pathCat({dirPath, names[i]}).c_str(), caseSensitive);
+    } catch (const std::system_error&) {
+      // Leave it as nullopt
+    }
+  }
+}
+} // namespace
+
+std::vector<std::optional<FileInformation>> getFileInformationInDir(
+    const char* dirPath,
+    const std::vector<w_string_piece>& names,
+    CaseSensitivity caseSensitive) {
+  std::vector<std::optional<FileInformation>> result(names.size());
+#ifndef _WIN32
+  if (caseSensitive == CaseSensitivity::Unknown) {
+    caseSensitive = getCaseSensitivityForPath(dirPath);
+  }
+
+#ifdef HAVE_GETATTRLISTBULK
+  // Listing the whole dir only pays off if we want a good share of it
+  constexpr size_t kMinNamesForBulkDirStat = 16;
+  if (names.size() >= kMinNamesForBulkDirStat) {
+    std::unordered_map<w_string_piece, size_t> wanted;
+    wanted.reserve(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+      wanted.emplace(names[i], i);
+    }
+    std::vector<bool> listed(names.size(), false);
+
+    auto dir = openDir(dirPath, /* strict= */ false);
+    while (auto* ent = dir->readDir()) {
+      // The names come back in their canonical case, so an exact match
+      // also settles the case question for case insensitive filesystems
+      auto it = wanted.find(w_string_piece(ent->d_name));
+      if (it == wanted.end()) {
+        continue;
+      }
+      listed[it->second] = true;
+      if (ent->has_stat) {
+        result[it->second] = ent->stat;
+      }
+    }
+
+    // Bulk stat may be disabled, in which case we only learned the names
+    for (size_t i = 0; i < names.size(); ++i) {
+      struct stat st;
+      if (listed[i] && !result[i] &&
+          fstatat(
+              dir->getFd(),
+              names[i].asWString().c_str(),
+              &st,
+              AT_SYMLINK_NOFOLLOW) == 0) {
+        result[i] = FileInformation(st);
+      }
+    }
+    return result;
+  }
+#endif
+
+  if (caseSensitive == CaseSensitivity::CaseInSensitive) {
+    // Each name needs its case checking, which getFileInformation does
+    getFileInformationForEach(dirPath, names, caseSensitive, result);
+    return result;
+  }
+
+  auto options = OpenFileHandleOptions::queryFileInfo();
+  options.caseSensitive = caseSensitive;
+  auto dir = openFileHandle(dirPath, options);
+  for (size_t i = 0; i < names.size(); ++i) {
+    struct stat st;
+    if (fstatat(
+            dir.fd(),
+            names[i].asWString().c_str(),
+            &st,
+            AT_SYMLINK_NOFOLLOW) == 0) {
+      result[i] = FileInformation(st);
+    }
+  }
+#else
+  getFileInformationForEach(dirPath, names, caseSensitive, result);
+#endif
+  return result;
+}
+
+std::vector<DType> getDTypesInDir(
+    const char* dirPath,
+    const std::vector<w_string_piece>& names) {
+  std::vector<DType> result(names.size(), DType::Unknown);
+  std::unordered_map<w_string_piece, size_t> wanted;
+  wanted.reserve(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    wanted.emplace(names[i], i);
+  }
+
+  auto dir = openDir(dirPath, /* strict= */ false);
+  while (!wanted.empty()) {
+    auto* ent = dir->readDir();
+    if (!ent) {
+      break;
+    }
+    auto it = wanted.find(w_string_piece(ent->d_name));
+    if (it == wanted.end()) {
+      continue;
+    }
+    result[it->second] = ent->dtype;
+    wanted.erase(it);
+  }
+  return result;
+}
+
 #ifdef _WIN32
 namespace {
 
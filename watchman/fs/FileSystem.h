@@ -6,10 +6,14 @@
  */
 
 #pragma once
+#include <optional>
+#include <unordered_map>
+#include <vector>
 #include "watchman/Result.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/FileInformation.h"
+#include "watchman/watchman_string.h"
 
 /** This header defines platform independent helper functions for
  * operating on the filesystem at a low level.
@@ -26,6 +30,35 @@
 
 namespace watchman {
 
+/**
+ * Holds the most recently used dirs open, so that getFileInformationRelative
+ * can stat the entries in them relative to the dir, rather than the kernel
+ * resolving each path from the root of the filesystem again.
+ *
+ * A held dir is the same dir if it is renamed, so a cache should only be
+ * kept for as long as one batch of changes: the events for a rename in the
+ * meantime have the paths looked at again in a later batch.  Not thread
+ * safe.
+ */
+class DirFdCache {
+ public:
+  explicit DirFdCache(size_t capacity = 64) : capacity_(capacity) {}
+
+  /**
+   * Returns the handle of the dir at path, opening and holding it if it
+   * isn't held already.  Throws std::system_error if it can't be opened.
+   */
+  const FileDescriptor& get(const w_string& path);
+
+  void clear() {
+    dirs_.clear();
+  }
+
+ private:
+  size_t capacity_;
+  std::unordered_map<w_string, FileDescriptor> dirs_;
+};
+
 class FileSystem {
  public:
   virtual ~FileSystem() = default;
@@ -46,6 +79,17 @@ class FileSystem {
       const char* path,
       CaseSensitivity caseSensitive = CaseSensitivity::Unknown) = 0;
 
+  /**
+   * Like getFileInformation, but the dir containing path may be held open
+   * by dirs from an earlier call, and the stat made relative to that.
+   */
+  virtual FileInformation getFileInformationRelative(
+      const char* path,
+      CaseSensitivity caseSensitive,
+      DirFdCache& /*dirs*/) {
+    return getFileInformation(path, caseSensitive);
+  }
+
   /**
    * Watchman-specific API for creating an empty file on the filesystem.
    * On unix, the created file will have mode 0700.
@@ -73,6 +117,49 @@ FileInformation getFileInformation(
     const char* path,
     CaseSensitivity caseSensitive = CaseSensitivity::Unknown);
 
+/**
+ * Like getFileInformation, but with the stat made relative to the dir that
+ * contains path, which dirs holds open for the calls that follow.  On
+ * Windows, and for case insensitive paths, whose case is checked against
+ * the whole path, this is the same as getFileInformation.
+ */
+FileInformation getFileInformationRelative(
+    const char* path,
+    CaseSensitivity caseSensitive,
+    DirFdCache& dirs);
+
+/**
+ * Like getFileInformation for each of names, which are the names of
+ * entries in the dir dirPath, but resolving dirPath only once.  Where
+ * getattrlistbulk() is available and there are enough names to make it
+ * worthwhile, the attributes of the whole dir are read in bulk.
+ *
+ * The result holds the information for each name in order, or nullopt if
+ * that name doesn't exist or couldn't be examined.  Throws
+ * std::system_error if dirPath can't be opened.
+ */
+std::vector<std::optional<FileInformation>> getFileInformationInDir(
+    const char* dirPath,
+    const std::vector<w_string_piece>& names,
+    CaseSensitivity caseSensitive = CaseSensitivity::Unknown);
+
+/**
+ * Returns the type of each of names, which are the names of entries in the
+ * dir dirPath, from a single listing of that dir.  Most filesystems report
+ * the type of each entry as part of the listing, which saves stat()ing
+ * files when their type is all that is wanted.
+ *
+ * The result holds the type for each name in order.  It is DType::Unknown
+ * for those names that weren't listed, and for those whose type the
+ * listing didn't report; the caller has to stat those as usual.  Names are
+ * matched exactly, so a name whose case differs from the canonical one is
+ * left for the stat to settle.  Throws std::system_error if dirPath can't
+ * be opened.
+ */
+std::vector<DType> getDTypesInDir(
+    const char* dirPath,
+    const std::vector<w_string_piece>& names);
+
 /** equivalent to realpath() */
 w_string realPath(const char* path);
 
@@ -18,6 +18,10 @@
 #include <dirent.h>
 #endif
 
+#ifdef __linux__
+#include <sys/sysmacros.h>
+#endif
+
 #ifdef __APPLE__
 #include <sys/attr.h> // @manual
 #include <sys/utsname.h> // @manual
@@ -71,6 +75,14 @@ class UnixDirHandle : public DirHandle {
 #endif
   DIR* d_{nullptr};
   struct DirEntry ent_;
+#ifdef __linux__
+  // When set, readDir() stats each entry relative to the directory fd,
+  // which is considerably cheaper than resolving the full path for each
+  // entry again later on.
+  bool statEntries_{false};
+
+  bool statEntry(const char* name);
+#endif
 
  public:
   explicit UnixDirHandle(const char* path, bool strict);
@@ -128,6 +140,30 @@ static bool use_bulkstat_by_default() {
 #endif
 
 #ifndef _WIN32
+#ifdef __linux__
+// Equivalent to FileInformation(struct stat), but for the data returned
+// by statx().
+#ifdef HAVE_STATX
+static FileInformation fileInformationFromStatx(const struct statx& stx) {
+  FileInformation info;
+  info.mode = stx.stx_mode;
+  info.size = stx.stx_size;
+  info.uid = stx.stx_uid;
+  info.gid = stx.stx_gid;
+  info.ino = stx.stx_ino;
+  info.dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+  info.nlink = stx.stx_nlink;
+  info.atime.tv_sec = stx.stx_atime.tv_sec;
+  info.atime.tv_nsec = stx.stx_atime.tv_nsec;
+  info.mtime.tv_sec = stx.stx_mtime.tv_sec;
+  info.mtime.tv_nsec = stx.stx_mtime.tv_nsec;
+  info.ctime.tv_sec = stx.stx_ctime.tv_sec;
+  info.ctime.tv_nsec = stx.stx_ctime.tv_nsec;
+  return info;
+}
+#endif
+#endif
+
 std::unique_ptr<DirHandle> openDir(const char* path, bool strict) {
   return std::make_unique<UnixDirHandle>(path, strict);
 }
@@ -215,7 +251,41 @@ UnixDirHandle::UnixDirHandle(const char* path, bool strict)
         std::generic_category(),
         std::string(strict ? "opendir_nofollow: " : "opendir: ") + path);
   }
+#ifdef __linux__
+  statEntries_ = cfg_get_bool("_use_bulkstat", true);
+#endif
+}
+
+#ifdef __linux__
+// Populate ent_.stat for name, which is relative to the open directory.
+// The names that we get from readdir() are already canonical, and the
+// directory itself was opened with the requested strictness, so this
+// yields the same information as getFileInformation() on the full path
+// in a single syscall.
+// Returns false if the stat failed; the caller will then report the entry
+// without stat information and the full stat path will deal with the error.
+bool UnixDirHandle::statEntry(const char* name) {
+#ifdef HAVE_STATX
+  struct statx stx;
+  if (statx(
+          dirfd(d_),
+          name,
+          AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+          STATX_BASIC_STATS,
+          &stx) != 0) {
+    return false;
+  }
+  ent_.stat = fileInformationFromStatx(stx);
+#else
+  struct stat st;
+  if (fstatat(dirfd(d_), name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+    return false;
+  }
+  ent_.stat = FileInformation(st);
+#endif
+  return true;
 }
+#endif
 
 const DirEntry* UnixDirHandle::readDir() {
 #ifdef HAVE_GETATTRLISTBULK
@@ -308,6 +378,7 @@ const DirEntry* UnixDirHandle::readDir() {
       // Getting the name means that we can at least enumerate the dir
       // contents.
       ent_.has_stat = false;
+      ent_.dtype = DType::Unknown;
       return &ent_;
     }
 
@@ -334,6 +405,7 @@ const DirEntry* UnixDirHandle::readDir() {
       // We can still yield the name, so we don't need to throw an exception
       // in this case.
       ent_.has_stat = false;
+      ent_.dtype = DType::Unknown;
       return &ent_;
     }
 
@@ -376,6 +448,7 @@ const DirEntry* UnixDirHandle::readDir() {
         break;
     }
     ent_.has_stat = true;
+    ent_.dtype = ent_.stat.dtype();
     return &ent_;
   }
 #endif
@@ -394,6 +467,21 @@ const DirEntry* UnixDirHandle::readDir() {
 
   ent_.d_name = dent->d_name;
   ent_.has_stat = false;
+#if defined(_DIRENT_HAVE_D_TYPE) || defined(__APPLE__) || defined(__FreeBSD__)
+  ent_.dtype = static_cast<DType>(dent->d_type);
+#else
+  ent_.dtype = DType::Unknown;
+#endif
+#ifdef __linux__
+  if (statEntries_ &&
+      !(dent->d_name[0] == '.' &&
+        (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, "..")))) {
+    ent_.has_stat = statEntry(dent->d_name);
+    if (ent_.has_stat && ent_.dtype == DType::Unknown) {
+      ent_.dtype = ent_.stat.dtype();
+    }
+  }
+#endif
   return &ent_;
 }
 
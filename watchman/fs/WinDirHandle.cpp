@@ -115,6 +115,7 @@ class WinDirHandle : public DirHandle {
     FILETIME_LARGE_INTEGER_to_timespec(info_->LastAccessTime, &ent_.stat.atime);
     FILETIME_LARGE_INTEGER_to_timespec(info_->LastWriteTime, &ent_.stat.mtime);
     ent_.stat.size = info_->EndOfFile.QuadPart;
+    ent_.dtype = ent_.stat.dtype();
 
     // Advance the pointer to the next entry ready for the next read
     info_ = info_->NextEntryOffset == 0
@@ -133,8 +134,20 @@ class WinDirHandle : public DirHandle {
       std::wstring strWPath(dirWPath_);
       strWPath += L"\\*";
 
-      hDirFind_ = FindFirstFileW(strWPath.c_str(), &findFileData);
+      // FindExInfoBasic skips generating the short 8.3 names, which we
+      // never look at, and FIND_FIRST_EX_LARGE_FETCH lets each trip into
+      // the kernel return a larger batch of entries
+      hDirFind_ = FindFirstFileExW(
+          strWPath.c_str(),
+          FindExInfoBasic,
+          &findFileData,
+          FindExSearchNameMatch,
+          nullptr,
+          FIND_FIRST_EX_LARGE_FETCH);
       success = hDirFind_ != INVALID_HANDLE_VALUE;
+      if (!success) {
+        hDirFind_ = nullptr;
+      }
     } else {
       success = FindNextFileW(hDirFind_, &findFileData);
     }
@@ -146,7 +159,7 @@ class WinDirHandle : public DirHandle {
       throw std::system_error(
           GetLastError(),
           std::system_category(),
-          hDirFind_ ? "FindNextFileW" : "FindFirstFileW");
+          hDirFind_ ? "FindNextFileW" : "FindFirstFileExW");
     }
 
     DWORD len = WideCharToMultiByte(
@@ -176,6 +189,7 @@ class WinDirHandle : public DirHandle {
     fileSize.HighPart = findFileData.nFileSizeHigh;
     fileSize.LowPart = findFileData.nFileSizeLow;
     ent_.stat.size = fileSize.QuadPart;
+    ent_.dtype = ent_.stat.dtype();
 
     return &ent_;
   }
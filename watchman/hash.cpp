@@ -10,6 +10,7 @@
 // Origin: http://www.burtleburtle.net/bob/c/lookup3.c
 
 #include "watchman/watchman_system.h"
+#include "watchman/watchman_hash.h"
 
 #if HAVE_SYS_PARAM_H
 #include <sys/param.h> /* attempt to define endianness */
@@ -100,7 +101,8 @@ static inline bool running_on_valgrind() {
 #define running_on_valgrind() 0
 #endif
 
-uint32_t w_hash_bytes(const void* key, size_t length, uint32_t initval) {
+uint32_t
+w_hash_bytes_lookup3(const void* key, size_t length, uint32_t initval) {
   uint32_t a, b, c; /* internal state */
   union {
     const void* ptr;
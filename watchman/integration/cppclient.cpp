@@ -140,6 +140,40 @@ int main(int argc, char** argv) {
     LOG(INFO) << "PASS: one-off query saw the touched hit file";
   }
 
+  LOG(INFO) << "Testing pipelined raw queries";
+  {
+    auto project =
+        c.run(dynamic::array("watch-project", current_dir)).get();
+    auto query_obj =
+        dynamic::object("expression", dynamic::array("name", "hit"))(
+            "fields", dynamic::array("name", "size"))(
+            "since", clock_before_hit);
+    if (auto* relative = project.get_ptr("relative_path")) {
+      query_obj["relative_root"] = *relative;
+    }
+    auto raw_query = dynamic::array("query", project["watch"], query_obj);
+    // Issue both before waiting on either, so that they are in flight at
+    // the same time
+    auto first = c.runRaw(raw_query);
+    auto second = c.run(raw_query);
+    auto raw = std::move(first).get();
+    auto decoded = std::move(second).get();
+
+    size_t raw_hits = 0;
+    raw.forEachFile([&](const BserValue& file) {
+      auto name = file.get("name");
+      if (name && name->asString().find("hit") != std::string_view::npos) {
+        ++raw_hits;
+      }
+    });
+    if (raw_hits != 1 || raw.toDynamic()["files"] != decoded["files"]) {
+      LOG(ERROR) << "FAIL: raw query returned " << toJson(raw.toDynamic())
+                 << " rather than " << toJson(decoded);
+      return 1;
+    }
+    LOG(INFO) << "PASS: raw query matches the decoded one";
+  }
+
   LOG(INFO) << "Flushing subscription";
   auto flush_res =
       c.flushSubscription(sub, std::chrono::milliseconds(1000)).wait().value();
@@ -0,0 +1,89 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import os
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestAggregate(WatchmanTestCase.WatchmanTestCase):
+    def makeTree(self):
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "lib"))
+        os.mkdir(os.path.join(root, "src"))
+        with open(os.path.join(root, "lib", "a.so"), "w") as f:
+            f.write("12345")
+        with open(os.path.join(root, "lib", "b.SO"), "w") as f:
+            f.write("123")
+        with open(os.path.join(root, "src", "c.c"), "w") as f:
+            f.write("1")
+        self.touchRelative(root, "README")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(
+            root, ["README", "lib", "lib/a.so", "lib/b.SO", "src", "src/c.c"]
+        )
+        return root
+
+    def test_totals(self):
+        root = self.makeTree()
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "expression": ["suffix", "so"],
+                "fields": ["name"],
+                "aggregate": True,
+            },
+        )
+        self.assertEqual({"count": 2, "size": 8}, res["aggregate"])
+        self.assertNotIn("files", res)
+        self.assertIn("clock", res)
+
+    def test_group_by(self):
+        root = self.makeTree()
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"expression": ["type", "f"], "aggregate": {"group_by": "suffix"}},
+        )
+        groups = res["aggregate"]["groups"]
+        self.assertEqual({"count": 2, "size": 8}, groups["so"])
+        self.assertEqual({"count": 1, "size": 1}, groups["c"])
+        self.assertEqual({"count": 1, "size": 0}, groups[""])
+        self.assertEqual(4, res["aggregate"]["count"])
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"expression": ["type", "f"], "aggregate": {"group_by": "dir"}},
+        )
+        groups = res["aggregate"]["groups"]
+        self.assertEqual({"count": 2, "size": 8}, groups["lib"])
+        self.assertEqual({"count": 1, "size": 1}, groups["src"])
+        self.assertEqual({"count": 1, "size": 0}, groups[""])
+
+        res = self.watchmanCommand("query", root, {"aggregate": {"group_by": "type"}})
+        groups = res["aggregate"]["groups"]
+        self.assertEqual(4, groups["f"]["count"])
+        self.assertEqual(2, groups["d"]["count"])
+
+    def test_invalid_aggregate(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        for opts in [
+            {"aggregate": "count"},
+            {"aggregate": {"group_by": "owner"}},
+            {"aggregate": True, "limit": 10},
+        ]:
+            with self.assertRaises(Exception) as ctx:
+                self.watchmanCommand("query", root, opts)
+            self.assertIn("aggregate", str(ctx.exception))
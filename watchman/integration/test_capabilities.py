@@ -108,14 +108,19 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "cmd-debug-drop-privs",
             "cmd-debug-get-asserted-states",
             "cmd-debug-get-subscriptions",
+            "cmd-debug-memory",
             "cmd-debug-poison",
+            "cmd-debug-query-scheduler",
             "cmd-debug-recrawl",
             "cmd-debug-set-subscriptions-paused",
             "cmd-debug-show-cursors",
+            "cmd-debug-slow-queries",
             "cmd-debug-status",
             "cmd-debug-symlink-target-cache",
+            "cmd-debug-trace",
             "cmd-debug-watcher-info",
             "cmd-debug-watcher-info-clear",
+            "cmd-export-view",
             "cmd-find",
             "cmd-flush-subscriptions",
             "cmd-get-config",
@@ -125,6 +130,7 @@ class TestCapabilities(WatchmanTestCase.WatchmanTestCase):
             "cmd-list-capabilities",
             "cmd-log",
             "cmd-log-level",
+            "cmd-metrics",
             "cmd-query",
             "cmd-shutdown-server",
             "cmd-since",
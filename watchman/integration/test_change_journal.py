@@ -0,0 +1,68 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestChangeJournal(WatchmanTestCase.WatchmanTestCase):
+    def watchJournaledRoot(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"change_journal_max_bytes": 1024 * 1024}))
+        self.touchRelative(root, "kept")
+        self.touchRelative(root, "deleted")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, [".watchmanconfig", "kept", "deleted"])
+        return root
+
+    def test_since_reports_aged_out_deletions(self):
+        root = self.watchJournaledRoot()
+        clock = self.watchmanCommand("clock", root, {"sync_timeout": 2000})["clock"]
+
+        os.unlink(os.path.join(root, "deleted"))
+        self.assertFileList(root, [".watchmanconfig", "kept"])
+        self.watchmanCommand("debug-ageout", root, 0)
+
+        res = self.watchmanCommand(
+            "query", root, {"since": clock, "fields": ["name", "exists"]}
+        )
+        self.assertFalse(res["is_fresh_instance"])
+        self.assertEqual([{"name": "deleted", "exists": False}], res["files"])
+
+    def test_changes_since_streams_the_journal(self):
+        root = self.watchJournaledRoot()
+        clock = self.watchmanCommand("clock", root, {"sync_timeout": 2000})["clock"]
+
+        self.touchRelative(root, "added")
+        os.unlink(os.path.join(root, "deleted"))
+        self.assertFileList(root, [".watchmanconfig", "kept", "added"])
+
+        res = self.watchmanCommand("changes-since", root, clock)
+        self.assertFalse(res["is_fresh_instance"])
+        changes = {change["name"]: change["exists"] for change in res["changes"]}
+        self.assertEqual(True, changes["added"])
+        self.assertEqual(False, changes["deleted"])
+        self.assertNotIn("kept", changes)
+
+        res = self.watchmanCommand("changes-since", root, res["clock"])
+        self.assertEqual([], res["changes"])
+
+    def test_changes_since_requires_a_journal(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        with self.assertRaises(Exception) as ctx:
+            self.watchmanCommand("changes-since", root, clock)
+        self.assertIn("change_journal_max_bytes", str(ctx.exception))
@@ -29,3 +29,19 @@ class TestClock(WatchmanTestCase.WatchmanTestCase):
         self.assertRegex(clock2["clock"], "^c:\\d+:\\d+:\\d+:\\d+$")
 
         self.assertNotEqual(clock1, clock2)
+
+    def test_clock_follows_rewatch(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        clock1 = self.watchmanCommand("clock", root)["clock"]
+        self.watchmanCommand("clock", root)
+
+        # The root that resolved the earlier commands is gone
+        self.watchmanCommand("watch-del", root)
+        with self.assertRaises(Exception) as ctx:
+            self.watchmanCommand("clock", root)
+        self.assertIn("not watched", str(ctx.exception))
+
+        self.watchmanCommand("watch", root)
+        clock2 = self.watchmanCommand("clock", root)["clock"]
+        self.assertNotEqual(clock1.split(":")[3], clock2.split(":")[3])
@@ -141,6 +141,34 @@ class TestContentHash(WatchmanTestCase.WatchmanTestCase):
         )
         self.assertEqual(expect_hex, res["files"][0]["content.sha1hex"])
 
+    def test_contentHashWarmingBudget(self):
+        root = self.mkdtemp()
+
+        for name in ("foo", "bar", "baz"):
+            self.write_file_and_hash(os.path.join(root, name), name + "\n")
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(
+                json.dumps(
+                    {
+                        "content_hash_warming": True,
+                        "content_hash_warm_max_in_flight": 1,
+                        "content_hash_warm_bytes_per_second": 1024,
+                    }
+                )
+            )
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, [".watchmanconfig", "foo", "bar", "baz"])
+
+        def warmed():
+            stats = self.watchmanCommand("debug-contenthash", root)
+            return stats["warmed"] == 4 and stats["warmQueued"] == 0
+
+        self.waitFor(warmed)
+        stats = self.watchmanCommand("debug-contenthash", root)
+        self.assertEqual(stats["warmInFlight"], 0)
+        self.assertEqual(stats["cacheStore"], 4)
+
     def test_cacheLimit(self):
         root = self.mkdtemp()
 
@@ -0,0 +1,37 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import os
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestDebugMemory(WatchmanTestCase.WatchmanTestCase):
+    def test_debug_memory(self):
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "dir"))
+        self.touchRelative(root, "dir", "a")
+        self.touchRelative(root, "b")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["dir", "dir/a", "b"])
+
+        res = self.watchmanCommand("debug-memory", root)
+        self.assertGreater(res["node_arena"]["live_bytes"], 0)
+        view = res["root"].get("view")
+        if view is None:
+            self.skipTest("watcher does not use the in-memory view")
+        self.assertEqual(view["files"], 3)
+        self.assertEqual(view["dirs"], 2)
+        self.assertGreater(view["file_bytes"], 0)
+
+        status = self.watchmanCommand("debug-status")
+        for info in status["roots"]:
+            if info["path"] == root:
+                self.assertEqual(info["memory"]["view"]["files"], 3)
@@ -0,0 +1,51 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import threading
+import time
+
+import pywatchman
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestDebugTrace(WatchmanTestCase.WatchmanTestCase):
+    def test_debug_trace(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["a"])
+
+        # debug-trace holds on to its connection for the whole capture
+        tracer = self.getClient(no_cache=True)
+        self.addCleanup(tracer.close)
+        result = {}
+
+        def capture():
+            result["res"] = tracer.query("debug-trace", 2)
+
+        thread = threading.Thread(target=capture)
+        thread.start()
+        time.sleep(0.5)
+        self.touchRelative(root, "b")
+        self.watchmanCommand("query", root, {"fields": ["name"]})
+        thread.join()
+
+        events = result["res"]["trace"]["traceEvents"]
+        spans = [e for e in events if e["ph"] == "X"]
+        names = {(e["cat"], e["name"]) for e in spans if e["args"].get("root") == root}
+        self.assertIn(("cookie", "sync_to_now"), names)
+        self.assertIn(("query", "Generating"), names)
+        for span in spans:
+            self.assertGreaterEqual(span["ts"], 0)
+            self.assertGreaterEqual(span["dur"], 0)
+
+    def test_debug_trace_args(self):
+        with self.assertRaisesRegex(pywatchman.CommandError, "seconds must be"):
+            self.watchmanCommand("debug-trace", 0)
@@ -62,3 +62,35 @@ class TestDirMove(WatchmanTestCase.WatchmanTestCase):
         self.build_under(root, "dir", latency=1)
 
         self.assertFileList(root, ["dir", "dir/a"])
+
+    def test_renamedTreeIsMovedInPlace(self):
+        root = self.mkdtemp()
+        os.makedirs(os.path.join(root, "src", "sub"))
+        self.touchRelative(root, "src", "a")
+        self.touchRelative(root, "src", "sub", "b")
+        watch = self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["src", "src/a", "src/sub", "src/sub/b"])
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        os.rename(os.path.join(root, "src"), os.path.join(root, "dst"))
+        self.assertFileList(root, ["dst", "dst/a", "dst/sub", "dst/sub/b"])
+
+        res = self.watchmanCommand(
+            "query", root, {"since": clock, "fields": ["name", "exists"]}
+        )
+        changes = {change["name"]: change["exists"] for change in res["files"]}
+        for name in ["src", "src/a", "src/sub", "src/sub/b"]:
+            self.assertEqual(False, changes[name])
+        for name in ["dst", "dst/a", "dst/sub", "dst/sub/b"]:
+            self.assertEqual(True, changes[name])
+
+        # Changes made after the move are seen at the new paths
+        self.touchRelative(root, "dst", "sub", "c")
+        self.assertFileList(root, ["dst", "dst/a", "dst/sub", "dst/sub/b", "dst/sub/c"])
+
+        if watch["watcher"] == "inotify":
+            # Both sides of the rename arrive together, so the dirs were
+            # moved rather than crawled
+            info = self.watchmanCommand("debug-watcher-info", root)
+            view = info["watcher-debug-info"]["view"]
+            self.assertEqual(2, view["dirs_moved_in_place"])
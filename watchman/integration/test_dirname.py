@@ -114,3 +114,40 @@ class TestDirName(WatchmanTestCase.WatchmanTestCase):
             )
 
             self.assertFileListsEqual(results["files"], expect, label)
+
+    def test_dirname_depth_bound(self):
+        root = self.mkdtemp()
+        os.makedirs(os.path.join(root, "1", "1", "1"))
+        self.touchRelative(root, "a")
+        self.touchRelative(root, "1", "a")
+        self.touchRelative(root, "1", "1", "a")
+        self.touchRelative(root, "1", "1", "1", "a")
+
+        self.watchmanCommand("watch", root)
+
+        tests = [
+            ["", ["depth", "eq", 0], ["a"]],
+            ["", ["depth", "lt", 2], ["a", "1/a"]],
+            ["1", ["depth", "le", 1], ["1/a", "1/1/a"]],
+            ["1", ["depth", "eq", 1], ["1/1/a"]],
+            ["1", ["depth", "lt", 0], []],
+        ]
+
+        for (dirname, depth, expect) in tests:
+            term = ["dirname", dirname, depth]
+            label = repr([dirname, depth, expect])
+
+            # The depth bound must hold whichever way around the planner
+            # combines it with the other terms
+            for expr in [
+                ["allof", term, ["name", "a"]],
+                [
+                    "anyof",
+                    ["allof", term, ["name", "a"]],
+                    ["allof", term, ["false"]],
+                ],
+            ]:
+                results = self.watchmanCommand(
+                    "query", root, {"expression": expr, "fields": ["name"]}
+                )
+                self.assertFileListsEqual(results["files"], expect, label)
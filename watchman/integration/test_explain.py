@@ -0,0 +1,80 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import os
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestExplain(WatchmanTestCase.WatchmanTestCase):
+    def makeTree(self):
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "lib"))
+        with open(os.path.join(root, "lib", "a.so"), "w") as f:
+            f.write("12345")
+        with open(os.path.join(root, "lib", "b.so"), "w") as f:
+            f.write("123")
+        self.touchRelative(root, "README")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["README", "lib", "lib/a.so", "lib/b.so"])
+        return root
+
+    def test_only_when_asked(self):
+        root = self.makeTree()
+        res = self.watchmanCommand("query", root, {"fields": ["name"]})
+        self.assertNotIn("explain", res)
+
+    def test_generators_and_terms(self):
+        root = self.makeTree()
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {
+                "expression": ["allof", ["type", "f"], ["suffix", "so"]],
+                "fields": ["name"],
+                "explain": True,
+            },
+        )
+        self.assertFileListsEqual(["lib/a.so", "lib/b.so"], res["files"])
+
+        explain = res["explain"]
+        self.assertEqual(
+            [{"name": "suffix", "walked": 2, "matched": 2}], explain["generators"]
+        )
+        self.assertEqual(2, explain["matched"])
+
+        terms = explain["terms"]
+        self.assertEqual("allof", terms[0]["term"])
+        self.assertEqual(0, terms[0]["depth"])
+        self.assertEqual(2, terms[0]["evaluated"])
+        self.assertEqual(2, terms[0]["matched"])
+        self.assertEqual(["suffix", "type"], sorted(t["term"] for t in terms[1:]))
+        for term in terms[1:]:
+            self.assertEqual(1, term["depth"])
+
+        for phase in ("cookie_sync", "view_lock_wait", "generation", "render"):
+            self.assertIn(phase + "_ms", explain)
+
+    def test_fetches_and_caches(self):
+        root = self.makeTree()
+        query = {
+            "expression": ["suffix", "so"],
+            "fields": ["name", "content.sha1hex"],
+            "explain": True,
+        }
+        explain = self.watchmanCommand("query", root, query)["explain"]
+        self.assertEqual(2, explain["render_fetches"]["files"])
+        self.assertEqual(2, explain["render_fetches"]["properties"]["content_sha1"])
+        self.assertEqual(2, explain["caches"]["content.sha1hex"]["misses"])
+
+        # The hashes are cached now
+        explain = self.watchmanCommand("query", root, query)["explain"]
+        self.assertEqual(2, explain["caches"]["content.sha1hex"]["hits"])
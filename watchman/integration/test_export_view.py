@@ -0,0 +1,60 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import os
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestExportView(WatchmanTestCase.WatchmanTestCase):
+    def exportedNames(self, files):
+        dirs = files["dirs"]
+        columns = files["columns"]
+        names = []
+        for dir_index, name in zip(columns["dir"], columns["name"]):
+            names.append(dirs[dir_index] + "/" + name if dirs[dir_index] else name)
+        return names
+
+    def test_export_view(self):
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "dir"))
+        self.touchRelative(root, "dir", "a")
+        self.touchRelative(root, "dir", "b")
+        self.touchRelative(root, "top")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["dir", "dir/a", "dir/b", "top"])
+
+        res = self.watchmanCommand(
+            "export-view", root, {"fields": ["name", "size", "type"]}
+        )
+        files = res["files"]
+        self.assertEqual(files["num_files"], 4)
+        self.assertEqual(sorted(files["dirs"]), ["", "dir"])
+        self.assertEqual(len(files["columns"]["size"]), 4)
+        self.assertFileListsEqual(
+            self.exportedNames(files), ["dir", "dir/a", "dir/b", "top"]
+        )
+        types = dict(zip(self.exportedNames(files), files["columns"]["type"]))
+        self.assertEqual(types["dir"], "d")
+        self.assertEqual(types["top"], "f")
+
+    def test_export_view_since(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["a"])
+
+        clock = self.watchmanCommand("clock", root)["clock"]
+        self.touchRelative(root, "b")
+        self.assertFileList(root, files=["a", "b"])
+
+        res = self.watchmanCommand("export-view", root, {"since": clock})
+        self.assertFalse(res["is_fresh_instance"])
+        self.assertEqual(self.exportedNames(res["files"]), ["b"])
@@ -0,0 +1,47 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+import os.path
+import shutil
+import sys
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestFanotify(WatchmanTestCase.WatchmanTestCase):
+    def checkOSApplicability(self):
+        if not sys.platform.startswith("linux"):
+            self.skipTest("N/A unless Linux")
+
+    def test_fanotify_tracks_changes(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"watcher": "fanotify"}))
+
+        watch = self.watchmanCommand("watch", root)
+        # fanotify needs privileges that the tests don't usually have, in
+        # which case another watcher is selected instead
+        if watch["watcher"] != "fanotify":
+            return
+
+        os.mkdir(os.path.join(root, "dir"))
+        self.touchRelative(root, "dir", "one")
+        self.assertFileList(root, [".watchmanconfig", "dir", "dir/one"])
+
+        os.rename(os.path.join(root, "dir"), os.path.join(root, "moved"))
+        self.touchRelative(root, "moved", "two")
+        self.assertFileList(
+            root, [".watchmanconfig", "moved", "moved/one", "moved/two"]
+        )
+
+        shutil.rmtree(os.path.join(root, "moved"))
+        self.assertFileList(root, [".watchmanconfig"])
@@ -0,0 +1,53 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import os
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestFsmonitor(WatchmanTestCase.WatchmanTestCase):
+    def fsmonitor(self, root, token):
+        res = self.watchmanCommand("fsmonitor-v2", root, token)
+        output = res["fsmonitor"]
+        if not isinstance(output, str):
+            output = output.decode("utf-8")
+        # Each entry is terminated by a NUL
+        self.assertTrue(output.endswith("\0"))
+        entries = output[:-1].split("\0")
+        self.assertEqual(res["clock"], entries[0])
+        return entries[0], entries[1:]
+
+    def test_fsmonitor_v2(self):
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, ".git"))
+        self.touchRelative(root, "a")
+
+        # git's own first token is answered as a fresh instance
+        token, files = self.fsmonitor(root, "")
+        self.assertEqual(["/"], files)
+
+        self.touchRelative(root, "b")
+        self.touchRelative(root, ".git", "index")
+        self.assertFileList(root, ["a", "b", ".git", ".git/index"])
+
+        token, files = self.fsmonitor(root, token)
+        self.assertEqual(["b"], files)
+
+        token, files = self.fsmonitor(root, token)
+        self.assertEqual([], files)
+
+    def test_fsmonitor_named_cursor(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        # Named cursors aren't tokens that we hand out
+        token, files = self.fsmonitor(root, "n:foo")
+        self.assertEqual(["/"], files)
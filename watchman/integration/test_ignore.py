@@ -89,3 +89,21 @@ class TestIgnore(WatchmanTestCase.WatchmanTestCase):
                 "foo",
             ],
         )
+
+    def test_ignored_dirs_are_pruned(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"ignore_dirs": ["build"]}, f)
+        os.makedirs(os.path.join(root, "build", "lower"))
+        self.touchRelative(root, "build", "lower", "baz")
+        self.touchRelative(root, "foo")
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[".watchmanconfig", "foo"])
+
+        info = self.watchmanCommand("debug-watcher-info", root)
+        view = info["watcher-debug-info"].get("view")
+        if view is None:
+            self.skipTest("watcher does not use the in-memory view")
+        # build was found by the crawl and dropped without being descended
+        self.assertGreater(view["ignored_paths_pruned"], 0)
@@ -0,0 +1,63 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+import os.path
+import sys
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestInotifyReader(WatchmanTestCase.WatchmanTestCase):
+    def checkOSApplicability(self):
+        if not sys.platform.startswith("linux"):
+            self.skipTest("N/A unless Linux")
+
+    def test_reader_thread_with_coalescing(self):
+        root = self.mkdtemp()
+        os.mkdir(os.path.join(root, "dir"))
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            # Coalesce every batch so that the directory scans are exercised
+            f.write(
+                json.dumps(
+                    {"inotify_reader_thread": True, "inotify_coalesce_backlog": 1}
+                )
+            )
+
+        watch = self.watchmanCommand("watch", root)
+        if watch["watcher"] != "inotify":
+            return
+
+        self.assertFileList(root, [".watchmanconfig", "dir"])
+        clock = self.watchmanCommand("clock", root)["clock"]
+
+        expect = ["dir/f%d" % i for i in range(0, 20)]
+        for name in expect:
+            self.touchRelative(root, name)
+        os.mkdir(os.path.join(root, "dir", "sub"))
+        self.touchRelative(root, "dir", "sub", "nested")
+        expect += ["dir/sub", "dir/sub/nested"]
+
+        self.assertFileList(root, [".watchmanconfig", "dir"] + expect)
+
+        res = self.watchmanCommand(
+            "query",
+            root,
+            {"since": clock, "expression": ["exists"], "fields": ["name"]},
+        )
+        self.assertFalse(res["is_fresh_instance"], res)
+        self.assertTrue("warning" not in res, res)
+        self.assertFileListsEqual(res["files"], ["dir"] + expect)
+
+        info = self.watchmanCommand("debug-watcher-info", root)
+        info = info["watcher-debug-info"]
+        self.assertIn("queued_event_count", info)
+        self.assertGreater(info["max_queued_event_count"], 0)
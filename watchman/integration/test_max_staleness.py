@@ -0,0 +1,48 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestMaxStaleness(WatchmanTestCase.WatchmanTestCase):
+    def test_reports_staleness(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, ["a"])
+
+        # Whether or not this reuses the sync made by assertFileList, the
+        # view is no further behind than was asked for
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name"], "max_staleness_ms": 60000}
+        )
+        self.assertFileListsEqual(res["files"], ["a"])
+        self.assertGreaterEqual(res["staleness_ms"], 0)
+        self.assertLessEqual(res["staleness_ms"], 60000)
+
+        # Without a window, the query syncs itself
+        self.touchRelative(root, "b")
+        res = self.watchmanCommand(
+            "query", root, {"fields": ["name"], "max_staleness_ms": 0}
+        )
+        self.assertFileListsEqual(res["files"], ["a", "b"])
+        self.assertEqual(res["staleness_ms"], 0)
+
+        res = self.watchmanCommand("query", root, {"fields": ["name"]})
+        self.assertNotIn("staleness_ms", res)
+
+    def test_invalid_max_staleness(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        for staleness in [-1, "soon"]:
+            with self.assertRaises(Exception) as ctx:
+                self.watchmanCommand("query", root, {"max_staleness_ms": staleness})
+            self.assertIn("max_staleness_ms", str(ctx.exception))
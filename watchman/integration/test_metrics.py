@@ -0,0 +1,43 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestMetrics(WatchmanTestCase.WatchmanTestCase):
+    def test_metrics(self):
+        root = self.mkdtemp()
+        self.touchRelative(root, "a")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["a"])
+        self.watchmanCommand("query", root, {"fields": ["name"]})
+
+        text = self.watchmanCommand("metrics")["metrics"]
+        self.assertTrue(text.endswith("# EOF\n"), text)
+
+        lines = text.splitlines()
+        self.assertIn("# TYPE watchman_clients gauge", lines)
+        query_count = 'watchman_command_duration_seconds_count{command="query"} '
+        self.assertTrue(any(line.startswith(query_count) for line in lines), text)
+
+        label = 'root="%s"' % root.replace("\\", "\\\\")
+        sync_prefix = "watchman_root_cookie_sync_duration_seconds_count{"
+        sync_count = [
+            line for line in lines if line.startswith(sync_prefix) and label in line
+        ]
+        self.assertEqual(1, len(sync_count), text)
+        self.assertGreaterEqual(int(sync_count[0].split(" ")[-1]), 1)
+        self.assertTrue(
+            any(
+                line.startswith("watchman_root_recrawls_total{") and label in line
+                for line in lines
+            ),
+            text,
+        )
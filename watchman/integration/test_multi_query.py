@@ -0,0 +1,52 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestMultiQuery(WatchmanTestCase.WatchmanTestCase):
+    def test_multi_query(self):
+        first = self.mkdtemp()
+        self.touchRelative(first, "a")
+        second = self.mkdtemp()
+        self.touchRelative(second, "b")
+        self.touchRelative(second, "c")
+        unwatched = self.mkdtemp()
+
+        for root in (first, second):
+            self.watchmanCommand("watch", root)
+        self.assertFileList(first, files=["a"])
+        self.assertFileList(second, files=["b", "c"])
+
+        res = self.watchmanCommand(
+            "multi-query",
+            [
+                [first, {"fields": ["name"]}],
+                [second, {"fields": ["name"], "expression": ["name", "c"]}],
+                [unwatched, {"fields": ["name"]}],
+                [second, {"expression": ["bogus"]}],
+            ],
+        )
+        results = res["results"]
+        self.assertEqual(4, len(results))
+
+        self.assertFileListsEqual(results[0]["files"], ["a"])
+        self.assertIn("clock", results[0])
+        self.assertEqual(results[1]["files"], ["c"])
+
+        # A failing query doesn't fail the others
+        self.assertIn("unable to resolve root", results[2]["error"])
+        self.assertIn("bogus", results[3]["error"])
+        self.assertNotIn("files", results[3])
+
+    def test_invalid_multi_query(self):
+        with self.assertRaises(Exception) as ctx:
+            self.watchmanCommand("multi-query", {"root": "/"})
+        self.assertIn("multi-query", str(ctx.exception))
@@ -0,0 +1,201 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+"""Measures how long the common operations take on a tree of a given size.
+
+The suite only runs when WATCHMAN_PERF_FILES is set to the number of files
+to create, so that it stays out of the way of the ordinary test runs:
+
+    WATCHMAN_PERF_FILES=100000 python3 runtests.py --watcher inotify \\
+        integration/test_perf.py
+
+It uses the watcher that runtests.py was asked for.  Along with the files,
+these are read from the environment:
+
+    WATCHMAN_PERF_CHANGES     files changed before the since query (100)
+    WATCHMAN_PERF_THRESHOLDS  a JSON file mapping metric names to the most
+                              that each may be; the test fails if any is
+                              over
+    WATCHMAN_PERF_RESULTS     a file to append the results to, one JSON
+                              object per run
+
+The results are also printed on a line starting with WATCHMAN_PERF.  The
+metrics are:
+
+    crawl_ms                  watching the tree until a query sees it all
+    since_query_ms            a since query after the changes
+    subscription_ms           a change until a subscription reports it
+    recrawl_ms                a recrawl until a query sees it all again
+    rss_bytes_per_million_files
+                              what the tree added to the daemon's resident
+                              memory, scaled to a million files
+"""
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+import subprocess
+import sys
+import time
+
+import WatchmanInstance
+import WatchmanTestCase
+
+
+FILES_PER_DIR = 100
+
+
+def getEnvInt(name, default):
+    value = os.environ.get(name)
+    return int(value) if value else default
+
+
+def getRss(pid):
+    """Returns the resident memory of pid in bytes, or None if it can't
+    be found out on this system"""
+    try:
+        import psutil
+
+        return psutil.Process(pid).memory_info().rss
+    except ImportError:
+        pass
+    if os.path.exists("/proc/%d/status" % pid):
+        with open("/proc/%d/status" % pid) as f:
+            for line in f:
+                if line.startswith("VmRSS:"):
+                    return int(line.split()[1]) * 1024
+    if os.name != "nt":
+        out = subprocess.check_output(["ps", "-o", "rss=", "-p", str(pid)])
+        return int(out.strip()) * 1024
+    return None
+
+
+def getWatcher():
+    # runtests.py gives the shared instance the watcher that it was asked for
+    try:
+        with open(WatchmanInstance.getSharedInstance().cfg_file) as f:
+            return json.load(f).get("watcher", "auto")
+    except Exception:
+        return "auto"
+
+
+@WatchmanTestCase.expand_matrix
+class TestPerf(WatchmanTestCase.WatchmanTestCase):
+    def checkOSApplicability(self):
+        if not getEnvInt("WATCHMAN_PERF_FILES", 0):
+            self.skipTest("WATCHMAN_PERF_FILES is not set")
+        # Once is enough; the transports are measured by the clients' tests
+        transport = "namedpipe" if os.name == "nt" else "unix"
+        if self.transport != transport or self.encoding != "bser":
+            self.skipTest("measured over %s bser only" % transport)
+
+    def makeTree(self, root, numFiles):
+        for i in range(numFiles):
+            if i % FILES_PER_DIR == 0:
+                os.mkdir(os.path.join(root, "d%d" % (i // FILES_PER_DIR)))
+            self.touchRelative(root, "d%d" % (i // FILES_PER_DIR), "f%d" % i)
+
+    def countFiles(self, root):
+        res = self.watchmanCommand(
+            "query", root, {"expression": ["type", "f"], "fields": ["name"]}
+        )
+        return len(res["files"])
+
+    def waitForCount(self, root, numFiles):
+        self.assertWaitFor(
+            lambda: self.countFiles(root) == numFiles,
+            timeout=600,
+            message="the view never held all %d files" % numFiles,
+        )
+
+    def test_perf(self):
+        numFiles = getEnvInt("WATCHMAN_PERF_FILES", 0)
+        numChanges = min(numFiles, getEnvInt("WATCHMAN_PERF_CHANGES", 100))
+        watcher = getWatcher()
+        metrics = {}
+
+        root = self.mkdtemp()
+        self.makeTree(root, numFiles)
+
+        with WatchmanInstance.Instance(config={"watcher": watcher}) as inst:
+            inst.start()
+            self.getClient(inst, replace_cached=True)
+            rssBefore = getRss(inst.pid)
+
+            start = time.time()
+            self.watchmanCommand("watch", root)
+            self.waitForCount(root, numFiles)
+            metrics["crawl_ms"] = (time.time() - start) * 1000
+
+            rssAfter = getRss(inst.pid)
+            if rssBefore is not None and rssAfter is not None:
+                metrics["rss_bytes_per_million_files"] = int(
+                    (rssAfter - rssBefore) * 1000000 / numFiles
+                )
+
+            clock = self.watchmanCommand("clock", root)["clock"]
+            for i in range(numChanges):
+                name = os.path.join(root, "d%d" % (i // FILES_PER_DIR), "f%d" % i)
+                with open(name, "a") as f:
+                    f.write("changed")
+            start = time.time()
+            res = self.watchmanCommand(
+                "query", root, {"since": clock, "fields": ["name"]}
+            )
+            metrics["since_query_ms"] = (time.time() - start) * 1000
+            self.assertGreaterEqual(len(res["files"]), numChanges)
+
+            self.watchmanCommand(
+                "subscribe",
+                root,
+                "perf",
+                {"expression": ["name", "probe"], "fields": ["name"]},
+            )
+            self.waitForSub("perf", root=root)
+            start = time.time()
+            self.touchRelative(root, "probe")
+            sub = self.waitForSub(
+                "perf",
+                root=root,
+                accept=lambda data: any("probe" in d["files"] for d in data),
+                timeout=600,
+            )
+            metrics["subscription_ms"] = (time.time() - start) * 1000
+            self.assertIsNotNone(sub)
+            self.watchmanCommand("unsubscribe", root, "perf")
+
+            start = time.time()
+            self.watchmanCommand("debug-recrawl", root)
+            # The cookie that syncs the query is seen once the crawl is done.
+            # The probe is a file too.
+            self.waitForCount(root, numFiles + 1)
+            metrics["recrawl_ms"] = (time.time() - start) * 1000
+
+        result = {
+            "platform": sys.platform,
+            "watcher": watcher,
+            "files": numFiles,
+            "changes": numChanges,
+            "metrics": metrics,
+        }
+        print("WATCHMAN_PERF", json.dumps(result, sort_keys=True))
+        resultsFile = os.environ.get("WATCHMAN_PERF_RESULTS")
+        if resultsFile:
+            with open(resultsFile, "a") as f:
+                f.write(json.dumps(result, sort_keys=True) + "\n")
+
+        thresholdsFile = os.environ.get("WATCHMAN_PERF_THRESHOLDS")
+        if thresholdsFile:
+            with open(thresholdsFile) as f:
+                thresholds = json.load(f)
+            over = [
+                "%s: %d > %d" % (name, metrics[name], limit)
+                for name, limit in sorted(thresholds.items())
+                if name in metrics and metrics[name] > limit
+            ]
+            self.assertEqual([], over, "metrics over their thresholds")
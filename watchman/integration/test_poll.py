@@ -0,0 +1,47 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+import os.path
+import shutil
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestPoll(WatchmanTestCase.WatchmanTestCase):
+    def test_poll_tracks_changes(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(
+                json.dumps(
+                    {
+                        "watcher": "poll",
+                        "poll_min_interval_ms": 50,
+                        "poll_max_interval_ms": 200,
+                    }
+                )
+            )
+
+        watch = self.watchmanCommand("watch", root)
+        self.assertEqual("poll", watch["watcher"])
+
+        os.mkdir(os.path.join(root, "dir"))
+        self.touchRelative(root, "dir", "one")
+        self.assertFileList(root, [".watchmanconfig", "dir", "dir/one"])
+
+        os.rename(os.path.join(root, "dir"), os.path.join(root, "moved"))
+        self.touchRelative(root, "moved", "two")
+        self.assertFileList(
+            root, [".watchmanconfig", "moved", "moved/one", "moved/two"]
+        )
+
+        shutil.rmtree(os.path.join(root, "moved"))
+        self.assertFileList(root, [".watchmanconfig"])
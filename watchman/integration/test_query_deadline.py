@@ -0,0 +1,45 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryDeadline(WatchmanTestCase.WatchmanTestCase):
+    def test_queries_within_their_deadline_complete(self):
+        root = self.mkdtemp()
+        expect = []
+        for i in range(0, 25):
+            name = "f%d" % i
+            self.touchRelative(root, name)
+            expect.append(name)
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, expect)
+
+        for deadline in [0, 60000]:
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "expression": ["type", "f"],
+                    "fields": ["name"],
+                    "query_deadline_ms": deadline,
+                },
+            )
+            self.assertFileListsEqual(res["files"], expect, repr(deadline))
+
+    def test_invalid_query_deadline(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        for deadline in [-1, "soon"]:
+            with self.assertRaises(Exception) as ctx:
+                self.watchmanCommand("query", root, {"query_deadline_ms": deadline})
+            self.assertIn("query_deadline_ms", str(ctx.exception))
@@ -0,0 +1,65 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestQueryResultCache(WatchmanTestCase.WatchmanTestCase):
+    def makeRoot(self, cache_size):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"query_result_cache_size": cache_size}))
+        self.touchRelative(root, "a")
+        self.touchRelative(root, "b")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[".watchmanconfig", "a", "b"])
+        return root
+
+    def test_identical_queries_share_results(self):
+        root = self.makeRoot(8)
+        clock = self.watchmanCommand("clock", root)["clock"]
+        self.touchRelative(root, "c")
+        query = {"since": clock, "fields": ["name"]}
+
+        first = self.watchmanCommand("query", root, query)
+        self.assertFalse(first["debug"]["result_cache_hit"])
+        self.assertFileListsEqual(first["files"], ["c"])
+
+        second = self.watchmanCommand("query", root, query)
+        self.assertTrue(second["debug"]["result_cache_hit"])
+        self.assertFileListsEqual(second["files"], ["c"])
+
+        # A different spec is a different entry
+        other = self.watchmanCommand(
+            "query", root, {"since": clock, "fields": ["name", "exists"]}
+        )
+        self.assertFalse(other["debug"]["result_cache_hit"])
+
+    def test_changes_invalidate_results(self):
+        root = self.makeRoot(8)
+        clock = self.watchmanCommand("clock", root)["clock"]
+        self.touchRelative(root, "c")
+        query = {"since": clock, "fields": ["name"]}
+        self.watchmanCommand("query", root, query)
+
+        self.touchRelative(root, "d")
+        res = self.watchmanCommand("query", root, query)
+        self.assertFalse(res["debug"]["result_cache_hit"])
+        self.assertFileListsEqual(res["files"], ["c", "d"])
+
+    def test_zero_size_disables_cache(self):
+        root = self.makeRoot(0)
+        query = {"fields": ["name"]}
+        self.watchmanCommand("query", root, query)
+        res = self.watchmanCommand("query", root, query)
+        self.assertFalse(res["debug"]["result_cache_hit"])
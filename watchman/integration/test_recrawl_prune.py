@@ -0,0 +1,56 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+import time
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestRecrawlPrune(WatchmanTestCase.WatchmanTestCase):
+    def getViewInfo(self, root):
+        info = self.watchmanCommand("debug-watcher-info", root)
+        return info["watcher-debug-info"].get("view")
+
+    def test_recrawl_skips_unchanged_dirs(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            json.dump({"recrawl_prune_unchanged_dirs": "listing"}, f)
+        os.makedirs(os.path.join(root, "a", "b"))
+        self.touchRelative(root, "a", "b", "c")
+        # The dirs must have changed visibly earlier than the crawl that
+        # first reads them
+        time.sleep(3)
+
+        self.watchmanCommand("watch", root)
+        files = [".watchmanconfig", "a", "a/b", "a/b/c"]
+        self.assertFileList(root, files=files)
+
+        status = self.watchmanCommand("debug-status")
+        for info in status["roots"]:
+            if info["path"] == root and (
+                info["fstype"].startswith("fuse")
+                or info["fstype"] in ("nfs", "cifs", "smb", "smbfs")
+            ):
+                self.skipTest("dir change times are not trusted on this fs")
+        if self.getViewInfo(root) is None:
+            self.skipTest("watcher does not use the in-memory view")
+
+        self.watchmanCommand("debug-recrawl", root)
+        self.assertFileList(root, files=files)
+        self.assertWaitFor(
+            lambda: self.getViewInfo(root)["recrawl_dirs_pruned"] >= 2,
+            message="a and a/b were not read again",
+        )
+
+        # Changes made after the recrawl are still noticed
+        self.touchRelative(root, "a", "b", "d")
+        self.assertFileList(root, files=files + ["a/b/d"])
@@ -0,0 +1,58 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import os
+
+import WatchmanInstance
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestSharedWatch(WatchmanTestCase.WatchmanTestCase):
+    def rootStatus(self, client, path):
+        for info in client.query("debug-status")["roots"]:
+            if info["path"] == path:
+                return info
+        self.fail("%s is not watched" % path)
+
+    def test_nested_watch_shares_view(self):
+        config = {"share_enclosing_watch": True}
+        with WatchmanInstance.Instance(config=config) as inst:
+            inst.start()
+            client = self.getClient(inst, replace_cached=True)
+
+            root = self.mkdtemp()
+            inner = os.path.join(root, "sub")
+            os.mkdir(inner)
+            self.touchRelative(root, "top")
+            self.touchRelative(inner, "a")
+
+            client.query("watch", root)
+            self.assertFileList(root, ["top", "sub", "sub/a"])
+            client.query("watch", inner)
+            self.assertFileList(inner, ["a"])
+
+            status = self.rootStatus(client, inner)
+            self.assertEqual(root, status["enclosing_root"])
+            self.assertTrue(status["done_initial"])
+
+            # Changes observed by the enclosing root's watcher appear
+            # in the queries of the nested root
+            clock = client.query("clock", inner)["clock"]
+            self.touchRelative(inner, "b")
+            self.touchRelative(root, "elsewhere")
+            self.assertFileList(inner, ["a", "b"])
+            res = client.query("query", inner, {"since": clock, "fields": ["name"]})
+            self.assertEqual(["b"], res["files"])
+
+            # and the nested root goes along with the enclosing one
+            client.query("watch-del", root)
+            self.assertWaitFor(
+                lambda: inner not in client.query("watch-list")["roots"]
+            )
@@ -0,0 +1,51 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestSlowQueries(WatchmanTestCase.WatchmanTestCase):
+    def test_queries_over_threshold_are_logged(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"slow_query_log_threshold_ms": 0}))
+        self.touchRelative(root, "a")
+        self.touchRelative(root, "b")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[".watchmanconfig", "a", "b"])
+
+        self.watchmanCommand(
+            "query", root, {"expression": ["name", "a"], "fields": ["name"]}
+        )
+        self.watchmanCommand("query", root, {"glob": ["*"], "fields": ["name"]})
+
+        res = self.watchmanCommand("debug-slow-queries", root)
+        self.assertEqual(0, res["threshold_ms"])
+        entries = res["slow_queries"]
+        self.assertGreaterEqual(len(entries), 2)
+
+        by_generator = {e["generators"]: e for e in entries}
+        self.assertIn("all", by_generator)
+        self.assertIn("glob", by_generator)
+        self.assertEqual(1, by_generator["all"]["num_results"])
+        self.assertGreaterEqual(by_generator["all"]["num_walked"], 3)
+        for entry in entries:
+            for key in ["total_ms", "generation_ms", "render_ms", "spec_hash"]:
+                self.assertIn(key, entry)
+
+    def test_fast_queries_are_not_logged(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+        self.watchmanCommand("query", root, {"fields": ["name"]})
+        res = self.watchmanCommand("debug-slow-queries", root)
+        self.assertEqual([], res["slow_queries"])
@@ -0,0 +1,92 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestStreamResults(WatchmanTestCase.WatchmanTestCase):
+    def test_streamed_results_match_unstreamed(self):
+        root = self.mkdtemp()
+        expect = []
+        for i in range(0, 25):
+            name = "f%d" % i
+            self.touchRelative(root, name)
+            expect.append(name)
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, expect)
+
+        for stream in [True, 1, 7, 1000]:
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "expression": ["type", "f"],
+                    "fields": ["name"],
+                    "stream_results": stream,
+                },
+            )
+            self.assertFileListsEqual(res["files"], expect, repr(stream))
+            self.assertIn("clock", res)
+            self.assertNotIn("partial", res)
+
+    def test_invalid_stream_results(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        for stream in [0, -1, "yes"]:
+            with self.assertRaises(Exception) as ctx:
+                self.watchmanCommand("query", root, {"stream_results": stream})
+            self.assertIn("stream_results", str(ctx.exception))
+
+    def test_render_batches_match_unbatched(self):
+        root = self.mkdtemp()
+        expect = []
+        for i in range(0, 25):
+            name = "f%d" % i
+            self.touchRelative(root, name)
+            expect.append(name)
+
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, expect)
+
+        for size, deadline in [(1, 0), (7, 0), (7, 1), (1000, 1)]:
+            res = self.watchmanCommand(
+                "query",
+                root,
+                {
+                    "expression": ["type", "f"],
+                    "fields": ["name", "content.sha1hex"],
+                    "render_batch_size": size,
+                    "render_batch_deadline_ms": deadline,
+                },
+            )
+            self.assertEqual(len(expect), len(res["files"]), repr(size))
+            self.assertFileListsEqual(
+                [f["name"] for f in res["files"]], expect, repr(size)
+            )
+            for f in res["files"]:
+                self.assertEqual(
+                    "da39a3ee5e6b4b0d3255bfef95601890afd80709",
+                    f["content.sha1hex"],
+                )
+
+    def test_invalid_render_batch(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        for opts in [
+            {"render_batch_size": 0},
+            {"render_batch_size": "many"},
+            {"render_batch_deadline_ms": -1},
+        ]:
+            with self.assertRaises(Exception) as ctx:
+                self.watchmanCommand("query", root, opts)
+            self.assertIn(list(opts)[0], str(ctx.exception))
@@ -318,6 +318,58 @@ class TestSubscribe(WatchmanTestCase.WatchmanTestCase):
         )
         self.assertNotEqual(None, dat)
 
+    def test_fast_subscription(self):
+        root = self.mkdtemp()
+        # A long settle period makes sure that the unsettled notification
+        # has to come first
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"settle": 2000}))
+        self.watchmanCommand("watch", root)
+
+        self.watchmanCommand(
+            "subscribe",
+            root,
+            "fast",
+            {"expression": ["suffix", "js"], "fields": ["name"], "fast": True},
+        )
+        self.waitForSub("fast", root=root)
+
+        self.touchRelative(root, "a.js")
+        self.touchRelative(root, "b.txt")
+
+        def hasUpdate(settled):
+            def accept(subdata):
+                for sub in subdata:
+                    if sub.get("settled") == settled and "a.js" in sub.get(
+                        "files", []
+                    ):
+                        return True
+                return False
+
+            return accept
+
+        dat = self.waitForSub("fast", root=root, accept=hasUpdate(False))
+        self.assertNotEqual(None, dat)
+        for sub in dat:
+            self.assertFalse(sub.get("settled", False))
+
+        dat = self.waitForSub("fast", root=root, accept=hasUpdate(True))
+        self.assertNotEqual(None, dat)
+        self.assertFileListsEqual(dat[-1]["files"], ["a.js"])
+
+    def test_fast_subscription_rejects_expensive_queries(self):
+        root = self.mkdtemp()
+        self.watchmanCommand("watch", root)
+
+        for query in (
+            {"expression": ["pcre", "^a"], "fields": ["name"]},
+            {"glob": ["*.js"], "fields": ["name"]},
+            {"fields": ["name", "content.sha1hex"]},
+        ):
+            query["fast"] = True
+            with self.assertRaises(pywatchman.WatchmanError):
+                self.watchmanCommand("subscribe", root, "fast", query)
+
     def test_multi_cancel(self):
         """Test that for multiple subscriptions on the same socket, we receive
         cancellation notices for all of them."""
@@ -345,6 +397,30 @@ class TestSubscribe(WatchmanTestCase.WatchmanTestCase):
             self.assertTrue(dat["canceled"])
             self.assertTrue(dat["unilateral"])
 
+    def test_many_subscriptions_see_each_change(self):
+        """The updates of all of the subscriptions on the same socket are
+        written together after a settle; each must arrive intact."""
+        root = self.mkdtemp()
+        self.touchRelative(root, "lemon")
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=["lemon"])
+
+        for n in range(32):
+            sub_name = "sub%d" % n
+            self.watchmanCommand("subscribe", root, sub_name, {"fields": ["name"]})
+            self.waitForSub(sub_name, root, remove=True)
+
+        self.touchRelative(root, "orange")
+
+        for n in range(32):
+            dat = self.waitForSub(
+                "sub%d" % n,
+                root,
+                accept=lambda x: self.findSubscriptionContainingFile(x, "orange"),
+            )
+            self.assertNotEqual(None, dat)
+            self.assertEqual(False, dat[0]["is_fresh_instance"])
+
     def test_subscribe(self):
         root = self.mkdtemp()
         a_dir = os.path.join(root, "a")
@@ -0,0 +1,102 @@
+# vim:ts=4:sw=4:et:
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+# no unicode literals
+from __future__ import absolute_import, division, print_function
+
+import json
+import os
+
+import WatchmanTestCase
+
+
+@WatchmanTestCase.expand_matrix
+class TestSubscriptionDelta(WatchmanTestCase.WatchmanTestCase):
+    def requiresPersistentSession(self):
+        return True
+
+    def hasFile(self, subdata, name, exists=True):
+        for sub in subdata:
+            for f in sub.get("files", []):
+                if f["name"] == name and f["exists"] == exists:
+                    return True
+        return False
+
+    def test_subscriptions_share_settle_delta(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"subscription_delta_max_files": 100}))
+        os.mkdir(os.path.join(root, "sub"))
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[".watchmanconfig", "sub"])
+
+        self.watchmanCommand(
+            "subscribe", root, "all", {"fields": ["name", "exists"]}
+        )
+        self.watchmanCommand(
+            "subscribe",
+            root,
+            "rel",
+            {"fields": ["name", "exists"], "relative_root": "sub"},
+        )
+        self.waitForSub("all", root)
+        self.waitForSub("rel", root)
+
+        self.touchRelative(root, "sub", "a")
+        self.touchRelative(root, "b")
+        self.assertNotEqual(
+            None,
+            self.waitForSub("all", root, accept=lambda x: self.hasFile(x, "sub/a")),
+        )
+        dat = self.waitForSub("rel", root, accept=lambda x: self.hasFile(x, "a"))
+        self.assertNotEqual(None, dat)
+        self.assertFalse(self.hasFile(dat, "b"))
+
+        os.unlink(os.path.join(root, "sub", "a"))
+        self.assertNotEqual(
+            None,
+            self.waitForSub(
+                "all", root, accept=lambda x: self.hasFile(x, "sub/a", False)
+            ),
+        )
+
+    def test_large_changes_fall_back_to_the_view(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"subscription_delta_max_files": 2}))
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[".watchmanconfig"])
+
+        self.watchmanCommand(
+            "subscribe", root, "all", {"fields": ["name", "exists"]}
+        )
+        self.waitForSub("all", root)
+
+        for i in range(0, 5):
+            self.touchRelative(root, "f%d" % i)
+        self.assertNotEqual(
+            None,
+            self.waitForSub("all", root, accept=lambda x: self.hasFile(x, "f4")),
+        )
+
+    def test_identical_subscriptions_share_results(self):
+        root = self.mkdtemp()
+        with open(os.path.join(root, ".watchmanconfig"), "w") as f:
+            f.write(json.dumps({"subscription_share_results": True}))
+        self.watchmanCommand("watch", root)
+        self.assertFileList(root, files=[".watchmanconfig"])
+
+        spec = {"fields": ["name", "exists"], "expression": ["type", "f"]}
+        self.watchmanCommand("subscribe", root, "one", spec)
+        self.watchmanCommand("subscribe", root, "two", spec)
+        self.waitForSub("one", root)
+        self.waitForSub("two", root)
+
+        self.touchRelative(root, "a")
+        for name in ["one", "two"]:
+            dat = self.waitForSub(name, root, accept=lambda x: self.hasFile(x, "a"))
+            self.assertNotEqual(None, dat)
+            self.assertEqual(name, dat[-1]["subscription"])
@@ -76,6 +76,20 @@ class TestTriggerError(WatchmanTestCase.WatchmanTestCase):
             {"name": "oink", "command": ["cat"], "max_files_stdin": -1},
         )
 
+        self.assertTriggerRegError(
+            "debounce_ms must be >= 0",
+            "trigger",
+            root,
+            {"name": "oink", "command": ["cat"], "debounce_ms": -1},
+        )
+
+        self.assertTriggerRegError(
+            "max_concurrency must be >= 0",
+            "trigger",
+            root,
+            {"name": "oink", "command": ["cat"], "max_concurrency": -1},
+        )
+
         self.assertTriggerRegError(
             "stdout: must be prefixed with either > or >>, got out",
             "trigger",
@@ -131,3 +131,22 @@ class TestWatchProject(WatchmanTestCase.WatchmanTestCase):
         res = self.watchmanCommand("watch-project", abc)
         self.assertEqual(d, norm_absolute_path(res["watch"]))
         self.assertEqual("a/b/c", norm_relative_path(res["relative_path"]))
+
+    def test_reResolveAfterWatchDel(self):
+        d = self.mkdtemp()
+        make_empty_watchmanconfig(d)
+        abc = os.path.join(d, "a", "b", "c")
+        os.makedirs(abc, 0o777)
+
+        for _ in range(2):
+            res = self.watchmanCommand("watch-project", abc)
+            self.assertEqual(d, norm_absolute_path(res["watch"]))
+            self.assertEqual("a/b/c", norm_relative_path(res["relative_path"]))
+
+        # The remembered resolution goes with the watch
+        self.watchmanCommand("watch-del", d)
+        ab = os.path.join(d, "a", "b")
+        make_empty_watchmanconfig(ab)
+        res = self.watchmanCommand("watch-project", abc)
+        self.assertEqual(norm_absolute_path(ab), norm_absolute_path(res["watch"]))
+        self.assertEqual("c", norm_relative_path(res["relative_path"]))
@@ -23,11 +23,13 @@ import java.nio.charset.CharsetDecoder;
 import java.nio.charset.CodingErrorAction;
 import java.nio.charset.StandardCharsets;
 
+import java.util.AbstractList;
 import java.util.ArrayList;
 import java.util.Collections;
 import java.util.LinkedHashMap;
 import java.util.List;
 import java.util.Map;
+import java.util.RandomAccess;
 import java.util.TreeMap;
 
 import javax.annotation.Nullable;
@@ -45,6 +47,11 @@ public class BserDeserializer implements Deserializer {
       SORTED
   }
 
+  public enum Decoding {
+      EAGER,
+      LAZY
+  }
+
   /**
    * Exception thrown when BSER parser unexpectedly reaches the end of
    * the input stream.
@@ -61,6 +68,7 @@ public class BserDeserializer implements Deserializer {
   }
 
   private final KeyOrdering keyOrdering;
+  private final Decoding decoding;
   private final CharsetDecoder utf8Decoder;
 
   /**
@@ -70,7 +78,22 @@ public class BserDeserializer implements Deserializer {
    * same order with which they were encoded.
    */
   public BserDeserializer(KeyOrdering keyOrdering) {
+    this(keyOrdering, Decoding.EAGER);
+  }
+
+  /**
+   * If {@code decoding} is {@code LAZY}, arrays in the resulting value
+   * are {@link LazyArray}s and templated arrays are {@link LazyTemplate}s,
+   * which keep the bytes that were read and decode an element each time
+   * that it is accessed, rather than building every element up front.
+   * That is much quicker for large query results of which only part is
+   * looked at, or which are looked at only once, but an element that is
+   * accessed repeatedly is decoded repeatedly.  The strings are not
+   * checked to be valid UTF-8 until they are decoded.
+   */
+  public BserDeserializer(KeyOrdering keyOrdering, Decoding decoding) {
     this.keyOrdering = keyOrdering;
+    this.decoding = decoding;
     this.utf8Decoder = StandardCharsets.UTF_8
         .newDecoder()
         .onMalformedInput(CodingErrorAction.REPORT);
@@ -92,7 +115,13 @@ public class BserDeserializer implements Deserializer {
   @Nullable
   public Object deserializeBserValue(InputStream inputStream) throws IOException {
     try {
-      return deserializeRecursive(readBserBuffer(inputStream));
+      ByteBuffer buffer = readBserBuffer(inputStream);
+      if (decoding == Decoding.LAZY) {
+        // The lazy values go on decoding after this returns, perhaps on
+        // other threads, so they share a decoder of their own
+        return new BserDeserializer(keyOrdering, decoding).deserializeRecursive(buffer);
+      }
+      return deserializeRecursive(buffer);
     } catch (BufferUnderflowException e) {
       throw new BserEofException("Prematurely reached end of BSER buffer", e);
     }
@@ -249,12 +278,7 @@ public class BserDeserializer implements Deserializer {
     if (numItems == 0) {
       return Collections.emptyMap();
     }
-    Map<String, Object> map;
-    if (keyOrdering == KeyOrdering.UNSORTED) {
-      map = new LinkedHashMap<String, Object>(numItems);
-    } else {
-      map = new TreeMap<String, Object>();
-    }
+    Map<String, Object> map = newMap(numItems);
     for (int i = 0; i < numItems; i++) {
       byte stringType = buffer.get();
       if (stringType != BSER_STRING) {
@@ -280,12 +304,7 @@ public class BserDeserializer implements Deserializer {
     int numItems = deserializeIntLen(buffer, numItemsType);
     ArrayList<Map<String, Object>> result = new ArrayList<Map<String, Object>>();
     for (int itemIdx = 0; itemIdx < numItems; itemIdx++) {
-      Map<String, Object> obj;
-      if (keyOrdering == KeyOrdering.UNSORTED) {
-        obj = new LinkedHashMap<String, Object>();
-      } else {
-        obj = new TreeMap<String, Object>();
-      }
+      Map<String, Object> obj = newMap(keys.size());
       for (int keyIdx = 0; keyIdx < keys.size(); keyIdx++) {
         byte keyValueType = buffer.get();
         if (keyValueType != BSER_SKIP) {
@@ -298,6 +317,228 @@ public class BserDeserializer implements Deserializer {
     return result;
   }
 
+  private Map<String, Object> newMap(int numItems) {
+    if (keyOrdering == KeyOrdering.UNSORTED) {
+      return new LinkedHashMap<String, Object>(numItems);
+    }
+    return new TreeMap<String, Object>();
+  }
+
+  private List<Object> deserializeLazyArray(ByteBuffer buffer) throws IOException {
+    byte intType = buffer.get();
+    int numItems = deserializeIntLen(buffer, intType);
+    if (numItems == 0) {
+      return Collections.emptyList();
+    }
+    return new LazyArray(this, buffer, numItems);
+  }
+
+  /**
+   * Advances {@code buffer} past a value of the given type, whose type
+   * byte has just been read, without decoding it.
+   */
+  private void skipValue(ByteBuffer buffer, byte type) throws IOException {
+    switch (type) {
+      case BSER_INT8:
+        skipBytes(buffer, 1);
+        break;
+      case BSER_INT16:
+        skipBytes(buffer, 2);
+        break;
+      case BSER_INT32:
+        skipBytes(buffer, 4);
+        break;
+      case BSER_INT64:
+      case BSER_REAL:
+        skipBytes(buffer, 8);
+        break;
+      case BSER_TRUE:
+      case BSER_FALSE:
+      case BSER_NULL:
+      case BSER_SKIP:
+        break;
+      case BSER_STRING:
+        skipBytes(buffer, deserializeIntLen(buffer, buffer.get()));
+        break;
+      case BSER_ARRAY: {
+        int numItems = deserializeIntLen(buffer, buffer.get());
+        for (int i = 0; i < numItems; i++) {
+          skipValue(buffer, buffer.get());
+        }
+        break;
+      }
+      case BSER_OBJECT: {
+        int numItems = deserializeIntLen(buffer, buffer.get());
+        for (int i = 0; i < numItems; i++) {
+          skipValue(buffer, buffer.get());
+          skipValue(buffer, buffer.get());
+        }
+        break;
+      }
+      case BSER_TEMPLATE: {
+        byte arrayType = buffer.get();
+        if (arrayType != BSER_ARRAY) {
+          throw new IOException(
+              String.format("Expected ARRAY to follow TEMPLATE, got %d", arrayType));
+        }
+        int numKeys = deserializeIntLen(buffer, buffer.get());
+        for (int i = 0; i < numKeys; i++) {
+          skipValue(buffer, buffer.get());
+        }
+        int numItems = deserializeIntLen(buffer, buffer.get());
+        for (int i = 0; i < numItems; i++) {
+          for (int j = 0; j < numKeys; j++) {
+            skipValue(buffer, buffer.get());
+          }
+        }
+        break;
+      }
+      default:
+        throw new IOException(String.format("Unrecognized BSER value type %d", type));
+    }
+  }
+
+  private static void skipBytes(ByteBuffer buffer, int len) {
+    if (len > buffer.remaining()) {
+      throw new BufferUnderflowException();
+    }
+    buffer.position(buffer.position() + len);
+  }
+
+  /**
+   * The {@link List} for an array when decoding lazily.  The elements are
+   * decoded from the bytes of the PDU each time that they are accessed.
+   */
+  public static final class LazyArray extends AbstractList<Object> implements RandomAccess {
+    private final BserDeserializer decoder;
+    private final ByteBuffer buffer;
+    // Where each element starts in buffer
+    private final int[] offsets;
+
+    private LazyArray(BserDeserializer decoder, ByteBuffer buffer, int numItems)
+        throws IOException {
+      this.decoder = decoder;
+      this.buffer = buffer.duplicate().order(buffer.order());
+      this.offsets = new int[numItems];
+      for (int i = 0; i < numItems; i++) {
+        offsets[i] = buffer.position();
+        decoder.skipValue(buffer, buffer.get());
+      }
+    }
+
+    @Override
+    public int size() {
+      return offsets.length;
+    }
+
+    @Override
+    @Nullable
+    public Object get(int index) {
+      synchronized (decoder) {
+        buffer.position(offsets[index]);
+        try {
+          return decoder.deserializeRecursive(buffer);
+        } catch (IOException e) {
+          throw new IllegalStateException("Invalid BSER array element", e);
+        }
+      }
+    }
+  }
+
+  /**
+   * The {@link List} for a templated array when decoding lazily, as used
+   * for the files of query results.  The rows are decoded from the bytes
+   * of the PDU each time that they are accessed, and {@link #column} can
+   * decode a single field from every row without building the rows.
+   */
+  public static final class LazyTemplate extends AbstractList<Map<String, Object>>
+      implements RandomAccess {
+    private final BserDeserializer decoder;
+    private final ByteBuffer buffer;
+    private final List<Object> keys;
+    // Where each row starts in buffer
+    private final int[] offsets;
+
+    private LazyTemplate(BserDeserializer decoder, ByteBuffer buffer) throws IOException {
+      byte arrayType = buffer.get();
+      if (arrayType != BSER_ARRAY) {
+        throw new IOException(
+            String.format("Expected ARRAY to follow TEMPLATE, got %d", arrayType));
+      }
+      this.decoder = decoder;
+      this.keys = decoder.deserializeArray(buffer);
+      int numItems = decoder.deserializeIntLen(buffer, buffer.get());
+      this.buffer = buffer.duplicate().order(buffer.order());
+      this.offsets = new int[numItems];
+      for (int i = 0; i < numItems; i++) {
+        offsets[i] = buffer.position();
+        for (int j = 0; j < keys.size(); j++) {
+          decoder.skipValue(buffer, buffer.get());
+        }
+      }
+    }
+
+    /**
+     * The names of the fields of the rows.
+     */
+    public List<Object> keys() {
+      return Collections.unmodifiableList(keys);
+    }
+
+    @Override
+    public int size() {
+      return offsets.length;
+    }
+
+    @Override
+    public Map<String, Object> get(int index) {
+      synchronized (decoder) {
+        buffer.position(offsets[index]);
+        Map<String, Object> obj = decoder.newMap(keys.size());
+        try {
+          for (int keyIdx = 0; keyIdx < keys.size(); keyIdx++) {
+            byte keyValueType = buffer.get();
+            if (keyValueType != BSER_SKIP) {
+              String key = (String) keys.get(keyIdx);
+              obj.put(key, decoder.deserializeRecursiveWithType(buffer, keyValueType));
+            }
+          }
+        } catch (IOException e) {
+          throw new IllegalStateException("Invalid BSER template row", e);
+        }
+        return obj;
+      }
+    }
+
+    /**
+     * Decodes the value of the field {@code key} from every row, with
+     * {@code null} for the rows that have no such field.
+     */
+    public List<Object> column(String key) {
+      int keyIdx = keys.indexOf(key);
+      if (keyIdx < 0) {
+        return Collections.<Object>nCopies(offsets.length, null);
+      }
+      ArrayList<Object> values = new ArrayList<Object>(offsets.length);
+      synchronized (decoder) {
+        try {
+          for (int offset : offsets) {
+            buffer.position(offset);
+            for (int i = 0; i < keyIdx; i++) {
+              decoder.skipValue(buffer, buffer.get());
+            }
+            byte type = buffer.get();
+            values.add(
+                type == BSER_SKIP ? null : decoder.deserializeRecursiveWithType(buffer, type));
+          }
+        } catch (IOException e) {
+          throw new IllegalStateException("Invalid BSER template row", e);
+        }
+      }
+      return values;
+    }
+  }
+
   @Nullable
   private Object deserializeRecursive(ByteBuffer buffer) throws IOException {
     byte type = buffer.get();
@@ -322,10 +563,16 @@ public class BserDeserializer implements Deserializer {
       case BSER_STRING:
         return deserializeString(buffer);
       case BSER_ARRAY:
+        if (decoding == Decoding.LAZY) {
+          return deserializeLazyArray(buffer);
+        }
         return deserializeArray(buffer);
       case BSER_OBJECT:
         return deserializeObject(buffer);
       case BSER_TEMPLATE:
+        if (decoding == Decoding.LAZY) {
+          return new LazyTemplate(this, buffer);
+        }
         return deserializeTemplate(buffer);
       default:
         throw new IOException(String.format("Unrecognized BSER value type %d", type));
@@ -188,6 +188,64 @@ public class BserDeserializerTest {
                 Matchers.<String, Object>hasEntry("age", (byte) 25))));
   }
 
+  @Test
+  public void deserializeTemplateLazily() throws IOException {
+    BserDeserializer deserializer = new BserDeserializer(
+        BserDeserializer.KeyOrdering.UNSORTED,
+        BserDeserializer.Decoding.LAZY);
+    BserDeserializer.LazyTemplate deserialized = (BserDeserializer.LazyTemplate)
+        deserializer.deserializeBserValue(
+            getByteStream(
+                "000103280B0003020203046E616D6502030361676503030203046672656403140203" +
+                "0470657465031E0C0319"));
+
+    assertThat(deserialized.size(), equalTo(3));
+    assertThat(
+        deserialized.get(1),
+        equalTo((Map<String, Object>) ImmutableMap.<String, Object>of(
+            "name", "pete",
+            "age", (byte) 30)));
+    assertThat(
+        deserialized.get(2),
+        equalTo((Map<String, Object>) ImmutableMap.<String, Object>of("age", (byte) 25)));
+    assertThat(deserialized.column("name"), contains((Object) "fred", "pete", null));
+    assertThat(
+        deserialized.column("age"),
+        contains((Object) (byte) 20, (byte) 30, (byte) 25));
+    assertThat(deserialized.column("size"), contains((Object) null, null, null));
+  }
+
+  @Test
+  public void deserializeNestedArraysLazily() throws IOException {
+    BserDeserializer deserializer = new BserDeserializer(
+        BserDeserializer.KeyOrdering.UNSORTED,
+        BserDeserializer.Decoding.LAZY);
+    // {"files": ["foo", [0x23, 0x42]], "fresh": true}
+    List<Object> files = (List<Object>) ((Map<String, Object>) deserializer.deserializeBserValue(
+        getByteStream(
+            "0001032401030202030566696C6573000302020303666F6F" +
+            "00030203230342020305667265736808")))
+        .get("files");
+
+    assertThat(files, Matchers.instanceOf(BserDeserializer.LazyArray.class));
+    assertThat(files.size(), equalTo(2));
+    assertThat(files.get(0), equalTo((Object) "foo"));
+    assertThat(
+        files.get(1),
+        equalTo((Object) ImmutableList.<Object>of((byte) 0x23, (byte) 0x42)));
+    assertThat(files.get(0), equalTo((Object) "foo"));
+  }
+
+  @Test
+  public void throwIfLazyArrayLengthTooShort() throws IOException {
+    thrown.expect(BserDeserializer.BserEofException.class);
+    thrown.expectMessage("Prematurely reached end of BSER buffer");
+    BserDeserializer deserializer = new BserDeserializer(
+        BserDeserializer.KeyOrdering.UNSORTED,
+        BserDeserializer.Decoding.LAZY);
+    deserializer.deserializeBserValue(getByteStream("000103050003020323"));
+  }
+
   @Test
   public void deserializeInt8() throws IOException {
     BserDeserializer deserializer = new BserDeserializer(BserDeserializer.KeyOrdering.UNSORTED);
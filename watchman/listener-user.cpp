@@ -31,7 +31,10 @@ W_CMD_REG("shutdown-server", cmd_shutdown, CMD_DAEMON | CMD_POISON_IMMUNE, NULL)
 void add_root_warnings_to_response(
     json_ref& response,
     const std::shared_ptr<Root>& root) {
-  auto info = root->recrawlInfo.rlock();
+  // A root that shares the view of the root enclosing it is recrawled
+  // along with that root
+  const auto& owner = root->viewOwner();
+  auto info = owner.recrawlInfo.rlock();
 
   if (!info->warning) {
     return;
@@ -44,9 +47,9 @@ void add_root_warnings_to_response(
           "\n",
           "To clear this warning, run:\n"
           "`watchman watch-del '",
-          root->root_path,
+          owner.root_path,
           "' ; watchman watch-project '",
-          root->root_path,
+          owner.root_path,
           "'`\n")));
 }
 
@@ -12,21 +12,30 @@
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <folly/net/NetworkSocket.h>
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <optional>
 #include <thread>
+#include <unordered_map>
 #include "watchman/Constants.h"
 #include "watchman/GroupLookup.h"
+#include "watchman/RelayPathMap.h"
 #include "watchman/SanityCheck.h"
 #include "watchman/Shutdown.h"
 #include "watchman/SignalHandler.h"
+#include "watchman/ThreadPool.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/sockname.h"
 #include "watchman/state.h"
 #include "watchman/watchman_client.h"
 #include "watchman/watchman_cmd.h"
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
 using namespace watchman;
 
 folly::Synchronized<std::unordered_set<std::shared_ptr<watchman_client>>>
@@ -123,22 +132,212 @@ void watchman_client::enqueueResponse(json_ref&& resp, bool ping) {
   }
 }
 
-// The client thread reads and decodes json packets,
-// then dispatches the commands that it finds
-static void client_thread(
-    std::shared_ptr<watchman_user_client> client) noexcept {
-  // Keep a persistent vector around so that we can avoid allocating
-  // and releasing heap memory when we collect items from the publisher
-  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
+// Reads and decodes a request from the client, dispatching the command
+// that it holds.  Returns false if the client disconnected or sent us
+// data that we couldn't decode.
+static bool process_client_input(
+    const std::shared_ptr<watchman_user_client>& client) {
+  json_error_t jerr;
+  auto request = client->reader.decodeNext(client->stm.get(), &jerr);
+
+  if (!request && errno == EAGAIN) {
+    // That's fine
+    return true;
+  }
+  if (!request) {
+    // Not so cool
+    if (client->reader.wpos == client->reader.rpos) {
+      // If they disconnected in between PDUs, no need to log
+      // any error
+      return false;
+    }
+    send_error_response(
+        client.get(),
+        "invalid json at position %d: %s",
+        jerr.position,
+        jerr.text);
+    logf(ERR, "invalid data from client: {}\n", jerr.text);
+    return false;
+  }
+
+  client->pdu_type = client->reader.pdu_type;
+  // Whether the request was compressed says nothing about how the response
+  // should be encoded
+  client->capabilities = client->reader.capabilities &
+      ~(BSER_CAP_ZSTD_BODY | BSER_CAP_FD_BODY);
+  dispatch_command(client.get(), request, CMD_DAEMON);
+  return true;
+}
+
+// Called when the client's ping event is signalled; moves any pending
+// log and subscription payloads into the response queue.
+// `pending` is scratch space, passed in so that its storage can be reused.
+static void process_client_pings(
+    const std::shared_ptr<watchman_user_client>& client,
+    std::vector<std::shared_ptr<const watchman::Publisher::Item>>& pending) {
+  while (client->ping->testAndClear()) {
+    // Enqueue refs to pending log payloads
+    pending.clear();
+    getPending(pending, client->debugSub, client->errorSub);
+    for (auto& item : pending) {
+      client->enqueueResponse(json_ref(item->payload), false);
+    }
+
+    // Maybe we have subscriptions to dispatch?
+    std::vector<w_string> subsToDelete;
+    for (auto& subiter : client->unilateralSub) {
+      auto sub = subiter.first;
+      auto subStream = subiter.second;
+
+      watchman::log(
+          watchman::DBG, "consider fan out sub ", sub->name, "\n");
+
+      pending.clear();
+      subStream->getPending(pending);
+      bool seenSettle = false;
+      bool seenUnsettled = false;
+      for (auto& item : pending) {
+        auto dumped = json_dumps(item->payload, 0);
+        watchman::log(
+            watchman::DBG,
+            "Unilateral payload for sub ",
+            sub->name,
+            " ",
+            dumped,
+            "\n");
+
+        if (item->payload.get_default("canceled")) {
+          watchman::log(
+              watchman::ERR,
+              "Cancel subscription ",
+              sub->name,
+              " due to root cancellation\n");
+
+          auto resp = make_response();
+          resp.set(
+              {{"root", item->payload.get_default("root")},
+               {"unilateral", json_true()},
+               {"canceled", json_true()},
+               {"subscription", w_string_to_json(sub->name)}});
+          client->enqueueResponse(std::move(resp), false);
+          // Remember to cancel this subscription.
+          // We can't do it in this loop because that would
+          // invalidate the iterators and cause a headache.
+          subsToDelete.push_back(sub->name);
+          continue;
+        }
+
+        if (item->payload.get_default("state-enter") ||
+            item->payload.get_default("state-leave")) {
+          auto resp = make_response();
+          json_object_update(item->payload, resp);
+          // We have the opportunity to populate additional response
+          // fields here (since we don't want to block the command).
+          // We don't populate the fat clock for SCM aware queries
+          // because determination of mergeBase could add latency.
+          resp.set(
+              {{"unilateral", json_true()},
+               {"subscription", w_string_to_json(sub->name)}});
+          client->enqueueResponse(std::move(resp), false);
+
+          watchman::log(
+              watchman::DBG,
+              "Fan out subscription state change for ",
+              sub->name,
+              "\n");
+          continue;
+        }
+
+        if (!sub->debug_paused && item->payload.get_default("settled")) {
+          seenSettle = true;
+          continue;
+        }
+
+        if (!sub->debug_paused && sub->fast &&
+            item->payload.get_default("unsettled")) {
+          seenUnsettled = true;
+          continue;
+        }
+      }
+
+      if (seenSettle) {
+        sub->processSubscription();
+      } else if (seenUnsettled) {
+        sub->processUnsettledChanges();
+      }
+    }
+
+    for (auto& name : subsToDelete) {
+      client->unsubByName(name);
+    }
+  }
+}
 
+// Sends the queued responses to the client.
+// Returns false if the client could not be written to.
+static bool send_client_responses(
+    const std::shared_ptr<watchman_user_client>& client) {
+  if (client->responses.empty()) {
+    return true;
+  }
+  // The responses that accumulated since the client was last written to,
+  // such as one per subscription after a settle, are written together
+  std::vector<json_ref> batch(
+      std::make_move_iterator(client->responses.begin()),
+      std::make_move_iterator(client->responses.end()));
+  client->responses.clear();
+
+  client->stm->setNonBlock(false);
+  /* Return the data in the same format that was used to ask for it.
+   * Update client liveness based on send success.
+   */
+  bool client_alive = client->writer.pduEncodeBatchToStream(
+      client->pdu_type, client->capabilities, batch, client->stm.get());
   client->stm->setNonBlock(true);
+
+  for (auto& response_to_send : batch) {
+    json_ref subscriptionValue = response_to_send.get_default("subscription");
+    if (kResponseLogLimit && subscriptionValue &&
+        subscriptionValue.isString() &&
+        json_string_value(subscriptionValue)) {
+      auto subscriptionName = json_to_w_string(subscriptionValue);
+      if (auto* sub =
+              folly::get_ptr(client->subscriptions, subscriptionName)) {
+        if ((*sub)->lastResponses.size() >= kResponseLogLimit) {
+          (*sub)->lastResponses.pop_front();
+        }
+        (*sub)->lastResponses.push_back(
+            watchman_client_subscription::LoggedResponse{
+                std::chrono::system_clock::now(), response_to_send});
+      }
+    }
+  }
+  return client_alive;
+}
+
+static void set_client_thread_name(
+    const char* prefix,
+    const std::shared_ptr<watchman_user_client>& client) {
   w_set_thread_name(
+      prefix,
       "client=",
       client->unique_id,
       ":stm=",
       uintptr_t(client->stm.get()),
       ":pid=",
       client->stm->getPeerProcessID());
+}
+
+// The client thread reads and decodes json packets,
+// then dispatches the commands that it finds
+static void client_thread(
+    std::shared_ptr<watchman_user_client> client) noexcept {
+  // Keep a persistent vector around so that we can avoid allocating
+  // and releasing heap memory when we collect items from the publisher
+  std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
+
+  client->stm->setNonBlock(true);
+  set_client_thread_name("", client);
 
   client->client_is_owner = client->stm->peerIsOwner();
 
@@ -157,173 +356,415 @@ static void client_thread(
       break;
     }
 
-    if (pfd[0].ready) {
-      json_error_t jerr;
-      auto request = client->reader.decodeNext(client->stm.get(), &jerr);
+    if (pfd[0].ready && !process_client_input(client)) {
+      break;
+    }
 
-      if (!request && errno == EAGAIN) {
-        // That's fine
-      } else if (!request) {
-        // Not so cool
-        if (client->reader.wpos == client->reader.rpos) {
-          // If they disconnected in between PDUs, no need to log
-          // any error
-          goto disconnected;
-        }
+    if (pfd[1].ready) {
+      process_client_pings(client, pending);
+    }
+
+    client_alive = send_client_responses(client);
+  }
+
+  set_client_thread_name("NOT_CONN:", client);
+  // Remove the client from the map before we tear it down, as this makes
+  // it easier to flush out pending writes on windows without worrying
+  // about w_log_to_clients contending for the write buffers
+  clients.wlock()->erase(client);
+}
+
+#ifndef _WIN32
+namespace {
+
+// Where the clients of a relay are sent, such as a daemon on the host
+// whose socket is mounted into the container that the relay runs in.
+struct RelayTarget {
+  w_string sockname;
+  RelayPathMap paths;
+};
+
+// Returns the target that clients are relayed to, or nullptr if they
+// are served by this daemon.
+const RelayTarget* getRelayTarget() {
+  static const std::unique_ptr<RelayTarget> target =
+      []() -> std::unique_ptr<RelayTarget> {
+    auto sockname = cfg_get_string("relay_sockname", nullptr);
+    if (!sockname) {
+      return nullptr;
+    }
+    auto relay = std::make_unique<RelayTarget>();
+    relay->sockname = w_string(sockname, W_STRING_BYTE);
+    if (auto paths = cfg_get_json("relay_path_map")) {
+      try {
+        relay->paths = RelayPathMap(paths);
+      } catch (const std::exception& exc) {
+        // Without the map, no root can be relayed
+        logf(ERR, "ignoring relay_path_map: {}\n", exc.what());
+      }
+    }
+    logf(ERR, "relaying clients to {}\n", relay->sockname);
+    return relay;
+  }();
+  return target.get();
+}
+
+// Reads and forwards the client's requests, until it has no more.
+// Returns false if the client disconnected, or the daemon that it is
+// relayed to couldn't be written to.
+bool relay_client_requests(
+    const std::shared_ptr<watchman_user_client>& client,
+    const RelayTarget& target,
+    std::unique_ptr<watchman_stream>& upstream,
+    w_jbuffer_t& writer) {
+  while (true) {
+    json_error_t jerr;
+    auto request = client->reader.decodeNext(client->stm.get(), &jerr);
+    if (!request && errno == EAGAIN) {
+      return true;
+    }
+    if (!request) {
+      if (client->reader.wpos != client->reader.rpos) {
         send_error_response(
             client.get(),
             "invalid json at position %d: %s",
             jerr.position,
             jerr.text);
-        logf(ERR, "invalid data from client: {}\n", jerr.text);
+      }
+      return false;
+    }
 
-        goto disconnected;
-      } else if (request) {
-        client->pdu_type = client->reader.pdu_type;
-        client->capabilities = client->reader.capabilities;
-        dispatch_command(client.get(), request, CMD_DAEMON);
+    client->pdu_type = client->reader.pdu_type;
+    client->capabilities = client->reader.capabilities &
+        ~(BSER_CAP_ZSTD_BODY | BSER_CAP_FD_BODY);
+
+    w_string_piece name;
+    if (auto cmd = json_string_value(json_array_get(request, 0))) {
+      name = cmd;
+    }
+    // These are about the relay, rather than about the daemon
+    if (name == "get-pid" || name == "get-sockname" ||
+        name == "shutdown-server") {
+      dispatch_command(client.get(), request, CMD_DAEMON);
+      continue;
+    }
+    // Triggers would run on the far side of the relay, and the others
+    // affect the clients of every relay
+    if (name == "trigger" || name == "watch-del-all") {
+      send_error_response(
+          client.get(),
+          "%.*s is not available to clients of a relay",
+          int(name.size()),
+          name.data());
+      continue;
+    }
+    try {
+      target.paths.translateRequest(request);
+    } catch (const std::exception& exc) {
+      send_error_response(client.get(), "%s", exc.what());
+      continue;
+    }
+
+    if (!upstream) {
+      upstream = w_stm_connect_unix(target.sockname.c_str(), 10000);
+      if (!upstream) {
+        send_error_response(
+            client.get(),
+            "unable to relay to %s: %s",
+            target.sockname.c_str(),
+            folly::errnoStr(errno).c_str());
+        continue;
       }
+      upstream->setNonBlock(true);
+    }
+    upstream->setNonBlock(false);
+    bool sent = writer.pduEncodeToStream(
+        client->pdu_type, client->capabilities, request, upstream.get());
+    upstream->setNonBlock(true);
+    if (!sent) {
+      send_error_response(
+          client.get(), "lost the relay to %s", target.sockname.c_str());
+      return false;
     }
+  }
+}
 
-    if (pfd[1].ready) {
-      while (client->ping->testAndClear()) {
-        // Enqueue refs to pending log payloads
-        pending.clear();
-        getPending(pending, client->debugSub, client->errorSub);
-        for (auto& item : pending) {
-          client->enqueueResponse(json_ref(item->payload), false);
-        }
+// Queues the responses and unilateral PDUs that the daemon has sent, until
+// it has sent no more.  Returns false if the connection to it was lost.
+bool relay_upstream_responses(
+    const std::shared_ptr<watchman_user_client>& client,
+    const RelayTarget& target,
+    watchman_stream* upstream,
+    w_jbuffer_t& reader) {
+  while (true) {
+    json_error_t jerr;
+    auto response = reader.decodeNext(upstream, &jerr);
+    if (!response && errno == EAGAIN) {
+      return true;
+    }
+    if (!response) {
+      logf(
+          ERR,
+          "lost the relay to {} for client {}: {}\n",
+          target.sockname,
+          client->unique_id,
+          jerr.text);
+      return false;
+    }
+    target.paths.translateResponse(response);
+    client->enqueueResponse(std::move(response), false);
+  }
+}
 
-        // Maybe we have subscriptions to dispatch?
-        std::vector<w_string> subsToDelete;
-        for (auto& subiter : client->unilateralSub) {
-          auto sub = subiter.first;
-          auto subStream = subiter.second;
+// Serves a client of a relay.  Its requests are forwarded over a
+// connection of its own, so that the daemon applies its checks to each
+// client, and what comes back is passed on.  The roots that either names
+// are translated by relay_path_map.
+void relay_client_thread(
+    std::shared_ptr<watchman_user_client> client,
+    const RelayTarget& target) noexcept {
+  client->stm->setNonBlock(true);
+  set_client_thread_name("relay:", client);
 
-          watchman::log(
-              watchman::DBG, "consider fan out sub ", sub->name, "\n");
-
-          pending.clear();
-          subStream->getPending(pending);
-          bool seenSettle = false;
-          for (auto& item : pending) {
-            auto dumped = json_dumps(item->payload, 0);
-            watchman::log(
-                watchman::DBG,
-                "Unilateral payload for sub ",
-                sub->name,
-                " ",
-                dumped,
-                "\n");
-
-            if (item->payload.get_default("canceled")) {
-              watchman::log(
-                  watchman::ERR,
-                  "Cancel subscription ",
-                  sub->name,
-                  " due to root cancellation\n");
-
-              auto resp = make_response();
-              resp.set(
-                  {{"root", item->payload.get_default("root")},
-                   {"unilateral", json_true()},
-                   {"canceled", json_true()},
-                   {"subscription", w_string_to_json(sub->name)}});
-              client->enqueueResponse(std::move(resp), false);
-              // Remember to cancel this subscription.
-              // We can't do it in this loop because that would
-              // invalidate the iterators and cause a headache.
-              subsToDelete.push_back(sub->name);
-              continue;
-            }
-
-            if (item->payload.get_default("state-enter") ||
-                item->payload.get_default("state-leave")) {
-              auto resp = make_response();
-              json_object_update(item->payload, resp);
-              // We have the opportunity to populate additional response
-              // fields here (since we don't want to block the command).
-              // We don't populate the fat clock for SCM aware queries
-              // because determination of mergeBase could add latency.
-              resp.set(
-                  {{"unilateral", json_true()},
-                   {"subscription", w_string_to_json(sub->name)}});
-              client->enqueueResponse(std::move(resp), false);
-
-              watchman::log(
-                  watchman::DBG,
-                  "Fan out subscription state change for ",
-                  sub->name,
-                  "\n");
-              continue;
-            }
-
-            if (!sub->debug_paused && item->payload.get_default("settled")) {
-              seenSettle = true;
-              continue;
-            }
-          }
-
-          if (seenSettle) {
-            sub->processSubscription();
-          }
-        }
+  client->client_is_owner = client->stm->peerIsOwner();
 
-        for (auto& name : subsToDelete) {
-          client->unsubByName(name);
-        }
+  std::unique_ptr<watchman_stream> upstream;
+  w_jbuffer_t upstreamReader;
+  w_jbuffer_t upstreamWriter;
+
+  bool client_alive = true;
+  while (!w_is_stopping() && client_alive) {
+    struct watchman_event_poll pfd[2] = {};
+    pfd[0].evt = client->stm->getEvents();
+    pfd[1].evt = upstream ? upstream->getEvents() : nullptr;
+
+    ignore_result(w_poll_events(pfd, upstream ? 2 : 1, 2000));
+    if (w_is_stopping()) {
+      break;
+    }
+
+    // Connects on the first request that needs the daemon
+    bool had_upstream = bool(upstream);
+    if (pfd[0].ready &&
+        !relay_client_requests(client, target, upstream, upstreamWriter)) {
+      client_alive = false;
+    }
+    if (client_alive && had_upstream && pfd[1].ready &&
+        !relay_upstream_responses(
+            client, target, upstream.get(), upstreamReader)) {
+      client_alive = false;
+    }
+
+    client_alive = send_client_responses(client) && client_alive;
+  }
+
+  set_client_thread_name("NOT_CONN:", client);
+  clients.wlock()->erase(client);
+}
+
+} // namespace
+#endif
+
+#ifdef __linux__
+namespace {
+
+// Multiplexes many clients over a small number of reactor threads, rather
+// than dedicating a thread to each client.
+//
+// The reactors only wait for a client's socket or ping event to become
+// ready.  Servicing the client means dispatching commands that may block
+// on cookie syncs, SCM queries and so on, so that is done by a dedicated
+// ThreadPool; it is separate from the shared pool so that a command
+// waiting on work queued to the shared pool can never starve it.
+//
+// Both descriptors are registered with EPOLLONESHOT and re-armed once the
+// client has been serviced, so at most one worker is servicing a given
+// client at a time and the client needs no additional locking.
+class ClientEventLoop {
+ public:
+  ClientEventLoop(size_t numReactors, size_t numWorkers) {
+    workers_.start(numWorkers, 1024 * 1024);
+    for (size_t i = 0; i < numReactors; ++i) {
+      auto reactor = std::make_unique<Reactor>();
+      reactor->epoll = FileDescriptor(
+          epoll_create1(EPOLL_CLOEXEC),
+          "epoll_create1 for client event loop",
+          FileDescriptor::FDType::Generic);
+      reactors_.push_back(std::move(reactor));
+    }
+    for (size_t i = 0; i < reactors_.size(); ++i) {
+      std::thread thr([this, i]() noexcept {
+        w_set_thread_name("client-reactor-", i);
+        runReactor(*reactors_[i]);
+      });
+      thr.detach();
+    }
+  }
+
+  void add(std::shared_ptr<watchman_user_client> client) {
+    client->stm->setNonBlock(true);
+    client->client_is_owner = client->stm->peerIsOwner();
+
+    auto reg = std::make_shared<Registration>();
+    reg->client = std::move(client);
+    reg->reactor = reactors_[nextReactor_++ % reactors_.size()].get();
+    reg->reactor->registrations.wlock()->emplace(reg.get(), reg);
+
+    for (auto fd : reg->fds()) {
+      struct epoll_event ev {};
+      ev.events = EPOLLIN | EPOLLONESHOT;
+      ev.data.ptr = reg.get();
+      if (epoll_ctl(
+              reg->reactor->epoll.system_handle(), EPOLL_CTL_ADD, fd, &ev) !=
+          0) {
+        auto err = errno;
+        remove(reg.get());
+        folly::throwSystemErrorExplicit(
+            err, "epoll_ctl ADD for client descriptor");
       }
     }
+  }
+
+ private:
+  struct Reactor;
+
+  struct Registration {
+    std::shared_ptr<watchman_user_client> client;
+    Reactor* reactor;
+    // Set while a worker is servicing the client
+    std::atomic<bool> scheduled{false};
+    std::vector<std::shared_ptr<const watchman::Publisher::Item>> pending;
+
+    std::array<int, 2> fds() const {
+      return {
+          int(client->stm->getEvents()->system_handle()),
+          int(client->ping->system_handle())};
+    }
+  };
 
-    /* now send our response(s) */
-    while (!client->responses.empty() && client_alive) {
-      auto& response_to_send = client->responses.front();
-
-      client->stm->setNonBlock(false);
-      /* Return the data in the same format that was used to ask for it.
-       * Update client liveness based on send success.
-       */
-      client_alive = client->writer.pduEncodeToStream(
-          client->pdu_type,
-          client->capabilities,
-          response_to_send,
-          client->stm.get());
-      client->stm->setNonBlock(true);
-
-      json_ref subscriptionValue = response_to_send.get_default("subscription");
-      if (kResponseLogLimit && subscriptionValue &&
-          subscriptionValue.isString() &&
-          json_string_value(subscriptionValue)) {
-        auto subscriptionName = json_to_w_string(subscriptionValue);
-        if (auto* sub =
-                folly::get_ptr(client->subscriptions, subscriptionName)) {
-          if ((*sub)->lastResponses.size() >= kResponseLogLimit) {
-            (*sub)->lastResponses.pop_front();
-          }
-          (*sub)->lastResponses.push_back(
-              watchman_client_subscription::LoggedResponse{
-                  std::chrono::system_clock::now(), response_to_send});
+  struct Reactor {
+    FileDescriptor epoll;
+    folly::Synchronized<
+        std::unordered_map<Registration*, std::shared_ptr<Registration>>>
+        registrations;
+  };
+
+  void runReactor(Reactor& reactor) {
+    constexpr int kMaxEvents = 64;
+    struct epoll_event events[kMaxEvents];
+
+    while (!w_is_stopping()) {
+      int n =
+          epoll_wait(reactor.epoll.system_handle(), events, kMaxEvents, 2000);
+      for (int i = 0; i < n; ++i) {
+        // The event may be stale if the client was removed after it was
+        // collected, so look it up rather than dereferencing it directly.
+        auto self = folly::get_default(
+            *reactor.registrations.rlock(),
+            static_cast<Registration*>(events[i].data.ptr));
+        if (!self || self->scheduled.exchange(true)) {
+          // Gone, or already being serviced in which case the descriptor
+          // will be re-armed once that completes.
+          continue;
+        }
+        try {
+          workers_.add([this, self] { service(self.get()); });
+        } catch (const std::exception& exc) {
+          log(ERR, "failed to schedule client: ", exc.what(), "\n");
+          remove(self.get());
         }
       }
+    }
 
-      client->responses.pop_front();
+    // Shutting down; let w_start_listener see that our clients are gone
+    auto regs = std::move(*reactor.registrations.wlock());
+    for (auto& it : regs) {
+      clients.wlock()->erase(it.second->client);
     }
   }
 
-disconnected:
-  w_set_thread_name(
-      "NOT_CONN:client=",
-      client->unique_id,
-      ":stm=",
-      uintptr_t(client->stm.get()),
-      ":pid=",
-      client->stm->getPeerProcessID());
-  // Remove the client from the map before we tear it down, as this makes
-  // it easier to flush out pending writes on windows without worrying
-  // about w_log_to_clients contending for the write buffers
-  clients.wlock()->erase(client);
+  void service(Registration* reg) {
+    auto& client = reg->client;
+    bool alive = false;
+    try {
+      alive = !w_is_stopping() && process_client_input(client);
+      if (alive) {
+        process_client_pings(client, reg->pending);
+        alive = send_client_responses(client) && !w_is_stopping();
+      }
+    } catch (const std::exception& exc) {
+      log(ERR, "error servicing client: ", exc.what(), "\n");
+      alive = false;
+    }
+
+    if (!alive) {
+      remove(reg);
+      return;
+    }
+
+    reg->scheduled = false;
+    for (auto fd : reg->fds()) {
+      struct epoll_event ev {};
+      ev.events = EPOLLIN | EPOLLONESHOT;
+      ev.data.ptr = reg;
+      if (epoll_ctl(
+              reg->reactor->epoll.system_handle(), EPOLL_CTL_MOD, fd, &ev) !=
+          0) {
+        log(ERR,
+            "failed to re-arm client descriptor: ",
+            folly::errnoStr(errno),
+            "\n");
+        remove(reg);
+        return;
+      }
+    }
+  }
+
+  void remove(Registration* reg) {
+    for (auto fd : reg->fds()) {
+      epoll_ctl(
+          reg->reactor->epoll.system_handle(), EPOLL_CTL_DEL, fd, nullptr);
+    }
+    auto self = [&] {
+      auto regs = reg->reactor->registrations.wlock();
+      auto it = regs->find(reg);
+      if (it == regs->end()) {
+        return std::shared_ptr<Registration>();
+      }
+      auto found = std::move(it->second);
+      regs->erase(it);
+      return found;
+    }();
+    if (self) {
+      set_client_thread_name("NOT_CONN:", self->client);
+      clients.wlock()->erase(self->client);
+    }
+  }
+
+  std::vector<std::unique_ptr<Reactor>> reactors_;
+  std::atomic<size_t> nextReactor_{0};
+  ThreadPool workers_;
+};
+
+// Returns the client event loop, or nullptr if each client should get
+// its own thread.
+ClientEventLoop* getClientEventLoop() {
+  // Intentionally leaked; the reactor threads are detached and may still
+  // be running during static destruction.
+  static ClientEventLoop* loop = []() -> ClientEventLoop* {
+    auto reactors = cfg_get_int("client_event_loop_threads", 0);
+    if (reactors <= 0) {
+      return nullptr;
+    }
+    auto workers = cfg_get_int("client_event_loop_workers", 32);
+    return new ClientEventLoop(reactors, std::max<json_int_t>(1, workers));
+  }();
+  return loop;
 }
 
+} // namespace
+#endif
+
 #if defined(HAVE_KQUEUE) || defined(HAVE_FSEVENTS)
 #ifdef __OpenBSD__
 #include <sys/siginfo.h> // @manual
@@ -502,6 +943,31 @@ static std::shared_ptr<watchman_client> make_new_client(
 
   clients.wlock()->insert(client);
 
+#ifndef _WIN32
+  if (auto* relay = getRelayTarget()) {
+    try {
+      std::thread thr([client, relay] { relay_client_thread(client, *relay); });
+      thr.detach();
+    } catch (const std::exception&) {
+      clients.wlock()->erase(client);
+      throw;
+    }
+    return client;
+  }
+#endif
+
+#ifdef __linux__
+  if (auto* loop = getClientEventLoop()) {
+    try {
+      loop->add(client);
+    } catch (const std::exception&) {
+      clients.wlock()->erase(client);
+      throw;
+    }
+    return client;
+  }
+#endif
+
   // Start a thread for the client.
   // We used to use libevent for this, but we have
   // a low volume of concurrent clients and the json
@@ -535,92 +1001,143 @@ static FileDescriptor create_pipe_server(const char* path) {
       FileDescriptor::FDType::Pipe);
 }
 
-static void named_pipe_accept_loop_internal(
-    std::shared_ptr<watchman_event> listener_event) {
-  HANDLE handles[2];
-  auto olap = OVERLAPPED();
-  HANDLE connected_event = CreateEvent(NULL, FALSE, TRUE, NULL);
-  auto path = get_named_pipe_sock_path();
-
-  if (!connected_event) {
-    logf(
-        ERR,
-        "named_pipe_accept_loop_internal: CreateEvent failed: {}\n",
-        win32_strerror(GetLastError()));
-    return;
-  }
-
-  handles[0] = connected_event;
-  handles[1] = (HANDLE)listener_event->system_handle();
-  olap.hEvent = connected_event;
+namespace {
+// An instance of the named pipe that is waiting for a client to connect
+struct PipeInstance {
+  FileDescriptor pipe;
+  OVERLAPPED olap;
+  // Signalled when the pending ConnectNamedPipe completes
+  HANDLE connected{nullptr};
+};
+} // namespace
 
-  logf(ERR, "waiting for pipe clients on {}\n", get_named_pipe_sock_path());
+// Replaces the pipe held by inst with a new instance and starts waiting for
+// a client to connect to it.  Clients that are already connected by the
+// time that we ask are handed off straight away.  If the pipe can't be set
+// up, inst is left without one, and gets retried on the next wakeup.
+static void listen_on_pipe_instance(
+    const std::string& path,
+    PipeInstance& inst) {
   while (!w_is_stopping()) {
-    FileDescriptor client_fd;
-    DWORD res;
-
-    client_fd = create_pipe_server(path.c_str());
-    if (!client_fd) {
+    inst.pipe = create_pipe_server(path.c_str());
+    if (!inst.pipe) {
       logf(
           ERR,
-          "CreateNamedPipe(%s) failed: %s\n",
+          "CreateNamedPipe({}) failed: {}\n",
           path,
           win32_strerror(GetLastError()));
-      continue;
+      return;
     }
 
-    ResetEvent(connected_event);
-    if (!ConnectNamedPipe((HANDLE)client_fd.handle(), &olap)) {
-      res = GetLastError();
-
-      if (res == ERROR_PIPE_CONNECTED) {
-        make_new_client(w_stm_fdopen(std::move(client_fd)));
-        continue;
+    ResetEvent(inst.connected);
+    inst.olap = OVERLAPPED();
+    inst.olap.hEvent = inst.connected;
+    if (!ConnectNamedPipe((HANDLE)inst.pipe.handle(), &inst.olap)) {
+      auto res = GetLastError();
+      if (res == ERROR_IO_PENDING) {
+        return;
       }
-
-      if (res != ERROR_IO_PENDING) {
-        logf(ERR, "ConnectNamedPipe: {}\n", win32_strerror(GetLastError()));
-        continue;
-      }
-
-      res = WaitForMultipleObjectsEx(2, handles, false, INFINITE, true);
-      if (res == WAIT_OBJECT_0 + 1) {
-        // Signalled to stop
-        CancelIoEx((HANDLE)client_fd.handle(), &olap);
-        continue;
-      }
-
-      if (res != WAIT_OBJECT_0) {
-        logf(
-            ERR,
-            "WaitForMultipleObjectsEx: ConnectNamedPipe: "
-            "unexpected status {}\n",
-            res);
-        CancelIoEx((HANDLE)client_fd.handle(), &olap);
-        continue;
+      if (res != ERROR_PIPE_CONNECTED) {
+        logf(ERR, "ConnectNamedPipe: {}\n", win32_strerror(res));
+        inst.pipe = FileDescriptor();
+        return;
       }
     }
-    make_new_client(w_stm_fdopen(std::move(client_fd)));
+    make_new_client(w_stm_fdopen(std::move(inst.pipe)));
   }
-  logf(ERR, "is_stopping is true, so acceptor is done\n");
 }
 
+// Keeps a pool of pipe instances waiting for clients, so that a burst of
+// short lived connections, such as many CLI invocations at once, doesn't
+// have to wait for each new instance to be created.  A single thread
+// services the whole pool; each connected client is then handed off to its
+// own thread, just like the clients of the unix socket.
 static void named_pipe_accept_loop() {
-  log(DBG, "Starting pipe listener on ", get_named_pipe_sock_path(), "\n");
+  const auto& path = get_named_pipe_sock_path();
+  log(DBG, "Starting pipe listener on ", path, "\n");
 
   std::shared_ptr<watchman_event> listener_event = w_event_make_named_pipe();
   w_push_listener_thread_event(listener_event);
 
-  std::vector<std::thread> acceptors;
-  for (json_int_t i = 0; i < cfg_get_int("win32_concurrent_accepts", 32); ++i) {
-    acceptors.push_back(std::thread([i, listener_event]() {
-      w_set_thread_name("accept", i);
-      named_pipe_accept_loop_internal(listener_event);
-    }));
+  // We wait for all of the instances, plus the listener event, with a single
+  // WaitForMultipleObjectsEx call, which caps the size of the pool
+  auto numInstances = std::clamp(
+      cfg_get_int("win32_concurrent_accepts", 32),
+      json_int_t(1),
+      json_int_t(MAXIMUM_WAIT_OBJECTS - 1));
+  std::vector<PipeInstance> instances(numInstances);
+  std::vector<HANDLE> handles;
+  for (auto& inst : instances) {
+    inst.connected = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    if (!inst.connected) {
+      logf(
+          ERR,
+          "named_pipe_accept_loop: CreateEvent failed: {}\n",
+          win32_strerror(GetLastError()));
+      for (auto& created : instances) {
+        if (created.connected) {
+          CloseHandle(created.connected);
+        }
+      }
+      return;
+    }
+    handles.push_back(inst.connected);
+  }
+  handles.push_back((HANDLE)listener_event->system_handle());
+
+  logf(ERR, "waiting for pipe clients on {}\n", path);
+  for (auto& inst : instances) {
+    listen_on_pipe_instance(path, inst);
+  }
+
+  while (!w_is_stopping()) {
+    auto res = WaitForMultipleObjectsEx(
+        DWORD(handles.size()), handles.data(), false, INFINITE, true);
+    if (res == WAIT_IO_COMPLETION) {
+      continue;
+    }
+    if (res == WAIT_OBJECT_0 + instances.size()) {
+      // Signalled to stop
+      continue;
+    }
+    if (res >= WAIT_OBJECT_0 + instances.size()) {
+      logf(
+          ERR,
+          "WaitForMultipleObjectsEx: ConnectNamedPipe: "
+          "unexpected status {}\n",
+          res);
+      continue;
+    }
+
+    auto& inst = instances[res - WAIT_OBJECT_0];
+    DWORD bytes;
+    if (GetOverlappedResult(
+            (HANDLE)inst.pipe.handle(), &inst.olap, &bytes, FALSE)) {
+      make_new_client(w_stm_fdopen(std::move(inst.pipe)));
+    } else {
+      logf(ERR, "ConnectNamedPipe: {}\n", win32_strerror(GetLastError()));
+    }
+    listen_on_pipe_instance(path, inst);
+
+    // Retry any instances that we previously failed to set up
+    for (auto& idle : instances) {
+      if (!idle.pipe) {
+        listen_on_pipe_instance(path, idle);
+      }
+    }
   }
-  for (auto& thr : acceptors) {
-    thr.join();
+
+  for (auto& inst : instances) {
+    if (inst.pipe) {
+      // Wait for the cancellation so that the OVERLAPPED outlives the IO
+      DWORD bytes;
+      CancelIoEx((HANDLE)inst.pipe.handle(), &inst.olap);
+      GetOverlappedResult(
+          (HANDLE)inst.pipe.handle(), &inst.olap, &bytes, TRUE);
+    }
+    CloseHandle(inst.connected);
   }
+  logf(ERR, "is_stopping is true, so acceptor is done\n");
 }
 #endif
 
@@ -12,18 +12,23 @@
 #include <folly/String.h>
 #include <folly/net/NetworkSocket.h>
 
+#include <algorithm>
 #include <stdio.h>
 #include <variant>
 
 #include "watchman/ChildProcess.h"
 #include "watchman/Clock.h"
+#include "watchman/CrawlScheduler.h"
 #include "watchman/GroupLookup.h"
 #include "watchman/LogConfig.h"
 #include "watchman/Logging.h"
+#include "watchman/MemoryProfile.h"
+#include "watchman/NodeArena.h"
 #include "watchman/Options.h"
 #include "watchman/PDU.h"
 #include "watchman/PerfSample.h"
 #include "watchman/ProcessLock.h"
+#include "watchman/SpawnHelper.h"
 #include "watchman/ThreadPool.h"
 #include "watchman/UserDir.h"
 #include "watchman/WatchmanConfig.h"
@@ -166,11 +171,49 @@ void detect_low_process_priority() {
     sigaddset(&sigset, SIGCHLD);
     sigprocmask(SIG_BLOCK, &sigset, NULL);
   }
+
+  // The helper is a copy of this process, so fork it now, while it has
+  // only this thread and before any views are built
+  if (cfg_get_bool("spawn_helper", false)) {
+    watchman::SpawnHelper::start();
+  }
 #endif
 
-  watchman::getThreadPool().start(
-      cfg_get_int("thread_pool_worker_threads", 16),
-      cfg_get_int("thread_pool_max_items", 1024 * 1024));
+  if (cfg_get_bool("async_stderr_logging", false)) {
+    watchman::getLog().startAsyncStdErr(uint32_t(std::max(
+        json_int_t(16), cfg_get_int("async_stderr_logging_records", 4096))));
+  }
+
+  {
+    using Priority = watchman::ThreadPool::Priority;
+    auto& pool = watchman::getThreadPool();
+    auto numWorkers = cfg_get_int("thread_pool_worker_threads", 16);
+    // By default, keep a quarter of the workers free of hashing and
+    // source control work, and give cache warming only a quarter
+    auto limit = [&](const char* name, json_int_t def) {
+      return size_t(std::max(json_int_t(1), cfg_get_int(name, def)));
+    };
+    auto share = std::max(json_int_t(1), numWorkers / 4);
+    pool.setConcurrencyLimit(
+        Priority::Hashing,
+        limit("thread_pool_hashing_max_concurrency", numWorkers - share));
+    pool.setConcurrencyLimit(
+        Priority::Scm,
+        limit("thread_pool_scm_max_concurrency", numWorkers - share));
+    pool.setConcurrencyLimit(
+        Priority::Warming, limit("thread_pool_warming_max_concurrency", share));
+    pool.start(numWorkers, cfg_get_int("thread_pool_max_items", 1024 * 1024));
+  }
+
+  watchman::configureNodeArenas(cfg_get_bool("node_arena_huge_pages", false));
+  watchman::MemoryProfile::setSampleInterval(size_t(std::max(
+      json_int_t(0),
+      cfg_get_int(
+          "memory_profile_sample_bytes",
+          watchman::MemoryProfile::kDefaultSampleInterval))));
+  watchman::CrawlScheduler::get().setOptions(
+      watchman::CrawlScheduler::Options{size_t(
+          std::max(json_int_t(0), cfg_get_int("crawl_max_concurrent", 2)))});
 
   ClockSpec::init();
   w_state_load();
@@ -180,6 +223,7 @@ void detect_low_process_priority() {
   cfg_shutdown();
 
   log(ERR, "Exiting from service with res=", res, "\n");
+  watchman::getLog().flushStdErr();
 
   if (res) {
     exit(0);
@@ -798,6 +842,59 @@ static bool should_start(int err) {
   return false;
 }
 
+// Returns true if cmd is a query that asked for its results to be streamed
+static bool is_streamed_query(json_t* cmd) {
+  if (!json_is_array(cmd) || json_array_size(cmd) < 3) {
+    return false;
+  }
+  auto name = json_string_value(json_array_get(cmd, 0));
+  if (!name || strcmp(name, "query")) {
+    return false;
+  }
+  auto stream = json_object_get(json_array_get(cmd, 2), "stream_results");
+  return stream && !json_is_false(stream);
+}
+
+// Read the partial responses to a streamed query and print them as a single
+// response, so that the output is the same as for an unstreamed query.
+static bool pass_thru_streamed_query(
+    w_jbuffer_t* buffer,
+    w_jbuffer_t* output_pdu_buffer,
+    w_stm_t stm) {
+  auto files = json_array();
+  while (true) {
+    json_error_t jerr;
+    stm->setNonBlock(false);
+    auto response = buffer->decodeNext(stm, &jerr);
+    if (!response) {
+      logf(ERR, "failed to parse response: {}\n", jerr.text);
+      return false;
+    }
+
+    auto chunk = response.get_default("files");
+    if (chunk && chunk.isArray()) {
+      if (!json_array_get_template(files) &&
+          json_array_get_template(chunk)) {
+        json_array_set_template(files, json_array_get_template(chunk));
+      }
+      for (auto& file : chunk.array()) {
+        files.array().push_back(file);
+      }
+    }
+
+    if (response.get_default("partial")) {
+      continue;
+    }
+
+    if (chunk) {
+      response.set("files", std::move(files));
+    }
+    output_pdu_buffer->clear();
+    return output_pdu_buffer->pduEncodeToStream(
+        output_pdu, output_capabilities, response, w_stm_stdout());
+  }
+}
+
 static bool try_command(json_t* cmd, int timeout) {
   auto client = w_stm_connect(timeout * 1000);
   if (!client) {
@@ -827,6 +924,10 @@ static bool try_command(json_t* cmd, int timeout) {
 
   buffer.clear();
 
+  if (!flags.persistent && is_streamed_query(cmd)) {
+    return pass_thru_streamed_query(&buffer, &output_pdu_buffer, client.get());
+  }
+
   do {
     if (!buffer.passThru(
             output_pdu,
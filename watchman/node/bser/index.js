@@ -217,10 +217,13 @@ var MAX_INT8 = 127;
 var MAX_INT16 = 32767;
 var MAX_INT32 = 2147483647;
 
-function BunserBuf() {
+// options may have:
+//   lazy: decode arrays and templates as BserArray and BserTemplate
+function BunserBuf(options) {
   EE.call(this);
   this.buf = new Accumulator();
   this.state = ST_NEED_PDU;
+  this.lazy = !!(options && options.lazy);
 }
 util.inherits(BunserBuf, EE);
 exports.BunserBuf = BunserBuf;
@@ -289,7 +292,7 @@ BunserBuf.prototype.process = function(synchronous) {
     }
 
     // We have enough to decode it
-    var val = this.decodeAny();
+    var val = this.lazy ? this.decodeLazily() : this.decodeAny();
     if (synchronous) {
       return val;
     }
@@ -302,6 +305,18 @@ BunserBuf.prototype.process = function(synchronous) {
   }
 }
 
+// Decode the PDU at the read offset as lazy values that refer to its
+// bytes, and start a new accumulator for the data that follows it, so
+// that the bytes don't get overwritten by the data appended later on.
+BunserBuf.prototype.decodeLazily = function() {
+  var acc = this.buf;
+  var end = acc.readOffset + this.pduLen;
+  var val = new Cursor(acc.buf, acc.readOffset, end).decodeAny();
+  this.buf = new Accumulator(acc.writeOffset - end);
+  this.buf.append(acc.buf.slice(end, acc.writeOffset));
+  return val;
+}
+
 BunserBuf.prototype.raise = function(reason) {
   throw new Error(reason + ", in Buffer of length " +
       this.buf.buf.length + " (" + this.buf.readAvail() +
@@ -340,11 +355,72 @@ BunserBuf.prototype.decodeAny = function() {
     case BSER_STRING:
       return this.decodeString();
     case BSER_ARRAY:
-      return this.decodeArray();
+      return this.lazy ? this.decodeLazy(BserArray) : this.decodeArray();
     case BSER_OBJECT:
       return this.decodeObject();
     case BSER_TEMPLATE:
-      return this.decodeTemplate();
+      return this.lazy ? this.decodeLazy(BserTemplate) : this.decodeTemplate();
+    default:
+      this.raise("unhandled bser opcode " + code);
+  }
+}
+
+// Make a lazy value of the given type for the value at the read offset,
+// and advance past it
+BunserBuf.prototype.decodeLazy = function(LazyType) {
+  var val = new LazyType(this.buf.buf, this.buf.readOffset,
+      this.buf.writeOffset);
+  this.skipAny();
+  return val;
+}
+
+// Advance past the value at the read offset without decoding it
+BunserBuf.prototype.skipAny = function() {
+  var code = this.buf.peekInt(1);
+  switch (code) {
+    case BSER_INT8:
+    case BSER_INT16:
+    case BSER_INT32:
+    case BSER_INT64:
+      this.buf.readAdvance(1 + intSize(code));
+      return;
+    case BSER_REAL:
+      this.buf.readAdvance(9);
+      return;
+    case BSER_TRUE:
+    case BSER_FALSE:
+    case BSER_NULL:
+    case BSER_SKIP:
+      this.buf.readAdvance(1);
+      return;
+    case BSER_STRING:
+      this.buf.readAdvance(1);
+      this.buf.readAdvance(this.decodeInt());
+      return;
+    case BSER_ARRAY:
+      this.buf.readAdvance(1);
+      for (var nitems = this.decodeInt(); nitems > 0; --nitems) {
+        this.skipAny();
+      }
+      return;
+    case BSER_OBJECT:
+      this.buf.readAdvance(1);
+      for (var nitems = this.decodeInt(); nitems > 0; --nitems) {
+        this.skipAny();
+        this.skipAny();
+      }
+      return;
+    case BSER_TEMPLATE:
+      this.buf.readAdvance(1);
+      this.expectCode(BSER_ARRAY);
+      var nkeys = this.decodeInt();
+      for (var i = 0; i < nkeys; ++i) {
+        this.skipAny();
+      }
+      for (var nitems = this.decodeInt() * nkeys; nitems > 0; --nitems) {
+        this.skipAny();
+      }
+      return;
     default:
       this.raise("unhandled bser opcode " + code);
   }
@@ -410,34 +486,199 @@ BunserBuf.prototype.decodeInt = function(relaxSizeAsserts) {
     this.buf.assertReadableSize(1);
   }
   var code = this.buf.peekInt(1);
-  var size = 0;
+  var size = intSize(code);
+  if (!size) {
+    this.raise("invalid bser int encoding " + code);
+  }
+
+  if (relaxSizeAsserts && (this.buf.readAvail() < 1 + size)) {
+    return false;
+  }
+  this.buf.readAdvance(1);
+  return this.buf.readInt(size);
+}
+
+// The number of bytes in an integer with the given opcode, or 0 if the
+// opcode is not that of an integer
+function intSize(code) {
   switch (code) {
     case BSER_INT8:
-      size = 1;
-      break;
+      return 1;
     case BSER_INT16:
-      size = 2;
-      break;
+      return 2;
     case BSER_INT32:
-      size = 4;
-      break;
+      return 4;
     case BSER_INT64:
-      size = 8;
-      break;
+      return 8;
     default:
-      this.raise("invalid bser int encoding " + code);
+      return 0;
+  }
+}
+
+// Decodes the values in a Buffer that holds a whole PDU, for the lazy
+// values that refer to it.  It has the decoding methods of BunserBuf.
+function Cursor(buf, offset, end) {
+  this.buf = Object.create(Accumulator.prototype);
+  this.buf.buf = buf;
+  this.buf.readOffset = offset;
+  this.buf.writeOffset = end;
+  this.lazy = true;
+}
+
+['raise', 'expectCode', 'decodeAny', 'decodeArray', 'decodeObject',
+ 'decodeTemplate', 'decodeString', 'decodeInt', 'decodeLazy',
+ 'skipAny'].forEach(function(name) {
+  Cursor.prototype[name] = BunserBuf.prototype[name];
+});
+
+// Decode the value at offset
+Cursor.prototype.decodeAt = function(offset) {
+  this.buf.readOffset = offset;
+  return this.decodeAny();
+}
+
+// Returns the offsets of the next count values, advancing past them
+Cursor.prototype.offsetsOf = function(count, valuesEach) {
+  var offsets = new Float64Array(count);
+  for (var i = 0; i < count; ++i) {
+    offsets[i] = this.buf.readOffset;
+    for (var j = 0; j < valuesEach; ++j) {
+      this.skipAny();
+    }
   }
+  return offsets;
+}
 
-  if (relaxSizeAsserts && (this.buf.readAvail() < 1 + size)) {
-    return false;
+// An array decoded with the lazy option: the elements are decoded from
+// the bytes of the PDU each time that they are accessed, rather than all
+// up front.  Use toArray() to decode all of them into an Array.
+function BserArray(buf, offset, end) {
+  this.cursor = new Cursor(buf, offset, end);
+  this.cursor.expectCode(BSER_ARRAY);
+  this.length = this.cursor.decodeInt();
+  this.start = this.cursor.buf.readOffset;
+  // Where each element starts, once one has been accessed
+  this.offsets = null;
+}
+exports.BserArray = BserArray;
+
+BserArray.prototype.get = function(index) {
+  if (!(index >= 0 && index < this.length)) {
+    return undefined;
   }
-  this.buf.readAdvance(1);
-  return this.buf.readInt(size);
+  if (!this.offsets) {
+    this.cursor.buf.readOffset = this.start;
+    this.offsets = this.cursor.offsetsOf(this.length, 1);
+  }
+  return this.cursor.decodeAt(this.offsets[index]);
+}
+
+BserArray.prototype.toArray = function() {
+  this.cursor.buf.readOffset = this.start;
+  var arr = new Array(this.length);
+  for (var i = 0; i < this.length; ++i) {
+    arr[i] = this.cursor.decodeAny();
+  }
+  return arr;
+}
+
+BserArray.prototype.toJSON = BserArray.prototype.toArray;
+
+BserArray.prototype[Symbol.iterator] = function() {
+  return this.toArray()[Symbol.iterator]();
+}
+
+// A template array decoded with the lazy option, as used for the files of
+// query results: the rows are decoded from the bytes of the PDU each time
+// that they are accessed, and column() decodes a single field from every
+// row without building the rows.  Use toArray() to decode all of the rows
+// into an Array.
+function BserTemplate(buf, offset, end) {
+  this.cursor = new Cursor(buf, offset, end);
+  this.cursor.expectCode(BSER_TEMPLATE);
+  this.keys = this.cursor.decodeArray();
+  this.length = this.cursor.decodeInt();
+  this.start = this.cursor.buf.readOffset;
+  // Where each row starts, once one has been accessed
+  this.offsets = null;
+}
+exports.BserTemplate = BserTemplate;
+
+// Decode the row at the read offset
+BserTemplate.prototype.decodeRow = function() {
+  var obj = {};
+  for (var keyidx = 0; keyidx < this.keys.length; ++keyidx) {
+    if (this.cursor.buf.peekInt(1) == BSER_SKIP) {
+      this.cursor.buf.readAdvance(1);
+      continue;
+    }
+    obj[this.keys[keyidx]] = this.cursor.decodeAny();
+  }
+  return obj;
+}
+
+BserTemplate.prototype.rowOffsets = function() {
+  if (!this.offsets) {
+    this.cursor.buf.readOffset = this.start;
+    this.offsets = this.cursor.offsetsOf(this.length, this.keys.length);
+  }
+  return this.offsets;
+}
+
+BserTemplate.prototype.get = function(index) {
+  if (!(index >= 0 && index < this.length)) {
+    return undefined;
+  }
+  this.cursor.buf.readOffset = this.rowOffsets()[index];
+  return this.decodeRow();
+}
+
+// Returns an Array of the values of the field key in each row, with
+// undefined for the rows that have no such field
+BserTemplate.prototype.column = function(key) {
+  var values = [];
+  var keyidx = this.keys.indexOf(key);
+  var offsets = keyidx < 0 ? null : this.rowOffsets();
+  var cursor = this.cursor;
+  for (var i = 0; i < this.length; ++i) {
+    if (!offsets) {
+      values.push(undefined);
+      continue;
+    }
+    cursor.buf.readOffset = offsets[i];
+    for (var j = 0; j < keyidx; ++j) {
+      cursor.skipAny();
+    }
+    values.push(cursor.buf.peekInt(1) == BSER_SKIP ?
+        undefined : cursor.decodeAny());
+  }
+  return values;
 }
 
-// synchronously BSER decode a string and return the value
-function loadFromBuffer(input) {
-  var buf = new BunserBuf();
+BserTemplate.prototype.toArray = function() {
+  this.cursor.buf.readOffset = this.start;
+  var arr = new Array(this.length);
+  for (var i = 0; i < this.length; ++i) {
+    arr[i] = this.decodeRow();
+  }
+  return arr;
+}
+
+BserTemplate.prototype.toJSON = BserTemplate.prototype.toArray;
+
+BserTemplate.prototype[Symbol.iterator] = function() {
+  return this.toArray()[Symbol.iterator]();
+}
+
+// synchronously BSER decode a string and return the value.
+// options may have:
+//   lazy: decode arrays and templates as BserArray and BserTemplate.  If
+//         input is a Buffer they refer to it, so it must not be modified.
+function loadFromBuffer(input, options) {
+  if (options && options.lazy && Buffer.isBuffer(input)) {
+    return loadLazilyFromBuffer(input);
+  }
+  var buf = new BunserBuf(options);
   var result = buf.append(input, true);
   if (buf.buf.readAvail()) {
     throw Error(
@@ -451,6 +692,22 @@ function loadFromBuffer(input) {
 }
 exports.loadFromBuffer = loadFromBuffer
 
+function loadLazilyFromBuffer(input) {
+  var cursor = new Cursor(input, 0, input.length);
+  cursor.expectCode(0);
+  cursor.expectCode(1);
+  var pduLen = cursor.decodeInt(true /* relaxed */);
+  if (pduLen === false || cursor.buf.readAvail() < pduLen) {
+    throw Error(
+        'no bser found in string and no error raised!?');
+  }
+  if (cursor.buf.readAvail() > pduLen) {
+    throw Error(
+        'excess data found after input buffer, use BunserBuf instead');
+  }
+  return cursor.decodeAny();
+}
+
 // Byteswap an arbitrary buffer, flipping from one endian
 // to the other, returning a new buffer with the resultant data
 function byteswap64(buf) {
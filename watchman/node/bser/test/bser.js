@@ -91,3 +91,52 @@ assert.equal(buffer.toString('hex'), "000105020000000301");
 buffer = bser.dumpToBuffer(1.1);
 assert.equal(buffer.toString('hex'), "00010509000000079a9999999999f13f");
 
+
+// Lazily decode the template from both a string and a Buffer
+[template, Buffer.from(template, 'binary')].forEach(function(input) {
+  var lazy = bser.loadFromBuffer(input, {lazy: true});
+  assert.ok(lazy instanceof bser.BserTemplate);
+  assert.equal(lazy.length, 3);
+  assert.deepStrictEqual(lazy.keys, ['name', 'age']);
+  assert.deepStrictEqual(lazy.get(1), {"name": "pete", "age": 30});
+  assert.deepStrictEqual(lazy.get(2), {"age": 25});
+  assert.strictEqual(lazy.get(3), undefined);
+  assert.deepStrictEqual(lazy.column('name'), ['fred', 'pete', undefined]);
+  assert.deepStrictEqual(lazy.column('age'), [20, 30, 25]);
+  assert.deepStrictEqual(lazy.column('size'), [undefined, undefined, undefined]);
+  assert.deepStrictEqual(lazy.toArray(), val);
+  assert.deepStrictEqual(Array.from(lazy), val);
+});
+
+// Lazy arrays nest, and decode the same values as the eager decoder
+var nested = {
+  files: ['foo', [1, 'bar', {baz: [true, null]}], 1.5],
+  clock: 'c:123',
+};
+var lazy = bser.loadFromBuffer(bser.dumpToBuffer(nested), {lazy: true});
+assert.equal(lazy.clock, 'c:123');
+assert.ok(lazy.files instanceof bser.BserArray);
+assert.equal(lazy.files.length, 3);
+assert.equal(lazy.files.get(0), 'foo');
+assert.ok(lazy.files.get(1).get(2).baz instanceof bser.BserArray);
+assert.equal(lazy.files.get(2), 1.5);
+assert.deepStrictEqual(JSON.parse(JSON.stringify(lazy)), nested);
+
+// Each PDU from a lazy BunserBuf keeps its own bytes
+var bunser = new bser.BunserBuf({lazy: true});
+var values = [];
+bunser.on('value', function(obj) {
+  values.push(obj);
+});
+var first = bser.dumpToBuffer(['one', 'two']);
+var second = bser.dumpToBuffer(['three', 'x'.repeat(10000)]);
+bunser.append(Buffer.concat([first, second.slice(0, 20)]));
+setImmediate(function() {
+  // Making room for the rest of the second PDU moves it over the first
+  bunser.append(second.slice(20));
+});
+process.on('exit', function() {
+  assert.equal(values.length, 2);
+  assert.deepStrictEqual(values[0].toArray(), ['one', 'two']);
+  assert.deepStrictEqual(values[1].get(0), 'three');
+});
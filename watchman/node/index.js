@@ -21,6 +21,8 @@ var unilateralTags = ['subscription', 'log'];
  *   * 'watchmanBinaryPath' (string) Absolute path to the watchman binary.
  *     If not provided, the Client locates the binary using the PATH specified
  *     by the node child_process's default env.
+ *   * 'lazyDecode' (boolean) Decode the arrays in responses as lazy
+ *     bser.BserArray and bser.BserTemplate objects rather than Arrays.
  */
 function Client(options) {
   var self = this;
@@ -30,6 +32,7 @@ function Client(options) {
   if (options && options.watchmanBinaryPath) {
     this.watchmanBinaryPath = options.watchmanBinaryPath.trim();
   };
+  this.lazyDecode = !!(options && options.lazyDecode);
   this.commands = [];
 }
 util.inherits(Client, EE);
@@ -76,7 +79,7 @@ Client.prototype.connect = function() {
 
   function makeSock(sockname) {
     // bunser will decode the watchman BSER protocol for us
-    self.bunser = new bser.BunserBuf();
+    self.bunser = new bser.BunserBuf({lazy: self.lazyDecode});
     // For each decoded line:
     self.bunser.on('value', function(obj) {
       // Figure out if this is a unliteral response or if it is the
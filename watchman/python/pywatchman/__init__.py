@@ -8,8 +8,10 @@ from __future__ import absolute_import, division, print_function
 
 import inspect
 import math
+import mmap
 import os
 import socket
+import struct
 import subprocess
 import sys
 import time
@@ -28,6 +30,11 @@ try:
 except ImportError:
     from . import pybser as bser
 
+try:
+    import zstandard
+except ImportError:
+    zstandard = None
+
 
 if os.name == "nt":
     import ctypes
@@ -306,6 +313,13 @@ class SocketTransport(Transport):
 class UnixSocketTransport(SocketTransport):
     """local unix domain socket transport"""
 
+    # Whether the server can pass us file descriptors
+    can_receive_fds = sys.platform.startswith("linux") and hasattr(
+        socket.socket, "recvmsg"
+    )
+    # Set by the codec once it asks for descriptors to be sent
+    receive_fds = False
+
     def __init__(self, sockpath, timeout):
         super(UnixSocketTransport, self).__init__()
         self.sockpath = sockpath
@@ -319,6 +333,29 @@ class UnixSocketTransport(SocketTransport):
         except socket.error as e:
             sock.close()
             raise SocketConnectError(self.sockpath.unix_domain, e)
+        self.received_fds = []
+
+    def close(self):
+        super(UnixSocketTransport, self).close()
+        while self.received_fds:
+            os.close(self.received_fds.pop())
+
+    def readBytes(self, size):
+        if not self.receive_fds:
+            return super(UnixSocketTransport, self).readBytes(size)
+        int_size = struct.calcsize("i")
+        try:
+            buf, ancdata, _, _ = self.sock.recvmsg(size, socket.CMSG_SPACE(int_size))
+        except socket.timeout:
+            raise SocketTimeout("timed out waiting for response")
+        for level, kind, data in ancdata:
+            if level == socket.SOL_SOCKET and kind == socket.SCM_RIGHTS:
+                count = len(data) // int_size
+                fds = struct.unpack("%di" % count, data[: count * int_size])
+                self.received_fds.extend(fds)
+        if not buf:
+            raise WatchmanError("empty watchman response")
+        return buf
 
 
 class WindowsUnixSocketTransport(SocketTransport):
@@ -675,10 +712,21 @@ class CLIProcessTransport(Transport):
 class BserCodec(Codec):
     """use the BSER encoding.  This is the default, preferred codec"""
 
-    def __init__(self, transport, value_encoding, value_errors):
+    def __init__(
+        self,
+        transport,
+        value_encoding,
+        value_errors,
+        lazy=False,
+        compress=False,
+        shared_memory=False,
+    ):
         super(BserCodec, self).__init__(transport)
         self._value_encoding = value_encoding
         self._value_errors = value_errors
+        self._lazy = lazy
+        self._compress = compress
+        self._shared_memory = shared_memory
 
     def _loads(self, response):
         return bser.loads(
@@ -721,22 +769,57 @@ class ImmutableBserCodec(BserCodec):
             False,
             value_encoding=self._value_encoding,
             value_errors=self._value_errors,
+            lazy=self._lazy,
         )
 
 
 class Bser2WithFallbackCodec(BserCodec):
     """use BSER v2 encoding"""
 
-    def __init__(self, transport, value_encoding, value_errors):
+    # BSER v2 capabilities, as defined by watchman/bser.h
+    CAP_ACCEPT_ZSTD = 0x4
+    CAP_ZSTD_BODY = 0x8
+    CAP_ACCEPT_FD = 0x10
+    CAP_FD_BODY = 0x20
+    CAP_ACCEPT_PREFIX_STRINGS = 0x40
+
+    def __init__(
+        self,
+        transport,
+        value_encoding,
+        value_errors,
+        lazy=False,
+        compress=False,
+        shared_memory=False,
+    ):
         super(Bser2WithFallbackCodec, self).__init__(
-            transport, value_encoding, value_errors
+            transport, value_encoding, value_errors, lazy, compress, shared_memory
         )
         if compat.PYTHON3:
             bserv2_key = "required"
         else:
             bserv2_key = "optional"
 
-        self.send(["version", {bserv2_key: ["bser-v2"]}])
+        version_args = {bserv2_key: ["bser-v2"]}
+        compress = compress and zstandard is not None
+        if compress:
+            version_args["optional"] = version_args.get("optional", []) + [
+                "bser-v2-zstd"
+            ]
+        shared_memory = shared_memory and getattr(transport, "can_receive_fds", False)
+        if shared_memory:
+            version_args["optional"] = version_args.get("optional", []) + [
+                "bser-v2-fd"
+            ]
+            transport.receive_fds = True
+        # Front-coded strings can't be decoded one element at a time, which
+        # would undo lazy decoding
+        prefix_strings = not lazy
+        if prefix_strings:
+            version_args["optional"] = version_args.get("optional", []) + [
+                "bser-v2-prefix-strings"
+            ]
+        self.send(["version", version_args])
 
         capabilities = self.receive()
 
@@ -749,6 +832,14 @@ class Bser2WithFallbackCodec(BserCodec):
         if capabilities["capabilities"]["bser-v2"]:
             self.bser_version = 2
             self.bser_capabilities = 0
+            if compress and capabilities["capabilities"].get("bser-v2-zstd"):
+                self.bser_capabilities |= self.CAP_ACCEPT_ZSTD
+            if shared_memory and capabilities["capabilities"].get("bser-v2-fd"):
+                self.bser_capabilities |= self.CAP_ACCEPT_FD
+            if prefix_strings and capabilities["capabilities"].get(
+                "bser-v2-prefix-strings"
+            ):
+                self.bser_capabilities |= self.CAP_ACCEPT_PREFIX_STRINGS
         else:
             self.bser_version = 1
             self.bser_capabilities = 0
@@ -771,11 +862,69 @@ class Bser2WithFallbackCodec(BserCodec):
             rlen += len(buf[-1])
 
         response = b"".join(buf)
+        mapped = None
         try:
+            if recv_bser_capabilities & self.CAP_FD_BODY:
+                response = mapped = self._map_fd(response)
+            elif recv_bser_capabilities & self.CAP_ZSTD_BODY:
+                response = self._uncompress(response, recv_bser_capabilities)
             res = self._loads(response)
             return res
         except ValueError as e:
             raise WatchmanError("watchman response decode error: %s" % e)
+        finally:
+            # Decoding copies everything that it needs out of the mapping
+            if mapped is not None:
+                mapped.close()
+
+    _int_sizes = {0x03: 1, 0x04: 2, 0x05: 4, 0x06: 8}
+    _int_formats = {1: "=b", 2: "=h", 4: "=i", 8: "=q"}
+
+    def _read_int(self, buf, offset):
+        """returns the value of the encoded integer at offset, and the
+        offset just past it"""
+        if offset >= len(buf):
+            raise ValueError("bser int runs past the end of the pdu")
+        size = self._int_sizes.get(struct.unpack_from("=B", buf, offset)[0])
+        if size is None:
+            raise ValueError("invalid bser int encoding")
+        end = offset + 1 + size
+        if end > len(buf):
+            raise ValueError("bser int runs past the end of the pdu")
+        return struct.unpack(self._int_formats[size], buf[offset + 1 : end])[0], end
+
+    def _uncompress(self, response, capabilities):
+        """turns a pdu with a zstd compressed body into the equivalent
+        uncompressed pdu"""
+        if zstandard is None:
+            raise ValueError("received a compressed pdu without zstandard")
+        # magic, capabilities and the length of the body
+        _, body_start = self._read_int(response, 6)
+        size, data_start = self._read_int(response, body_start)
+        body = zstandard.ZstdDecompressor().decompress(
+            response[data_start:], max_output_size=size
+        )
+        return (
+            b"\x00\x02"
+            + struct.pack("=I", capabilities & ~self.CAP_ZSTD_BODY)
+            + b"\x06"
+            + struct.pack("=q", len(body))
+            + body
+        )
+
+    def _map_fd(self, response):
+        """returns a read only mapping of the pdu held in the memory file
+        that was passed along with response"""
+        fds = getattr(self.transport, "received_fds", None)
+        if not fds:
+            raise ValueError("received a pdu without its file descriptor")
+        fd = fds.pop(0)
+        try:
+            _, body_start = self._read_int(response, 6)
+            size, _ = self._read_int(response, body_start)
+            return mmap.mmap(fd, size, access=mmap.ACCESS_READ)
+        finally:
+            os.close(fd)
 
     def send(self, *args):
         if hasattr(self, "bser_version"):
@@ -831,6 +980,18 @@ class JsonCodec(Codec):
         self.transport.write(cmd + b"\n")
 
 
+class _StreamedImmutableResponse(object):
+    """Presents an immutable final response to a streamed query with the
+    files from all of the partial responses."""
+
+    def __init__(self, res, files):
+        self._res = res
+        self.files = files
+
+    def __getattr__(self, name):
+        return getattr(self._res, name)
+
+
 class client(object):
     """Handles the communication with the watchman service"""
 
@@ -846,6 +1007,9 @@ class client(object):
     unilateral = ["log", "subscription"]
     tport = None
     useImmutableBser = None
+    lazyResults = None
+    compressResponses = None
+    sharedMemoryResults = None
     pid = None
 
     def __init__(
@@ -862,12 +1026,21 @@ class client(object):
         valueEncoding=False,
         valueErrors=False,
         binpath=None,
+        # only used with useImmutableBser
+        lazyResults=False,
+        # needs the zstandard module; ignored without it
+        compressResponses=False,
+        # only used with the unix socket transport on Linux
+        sharedMemoryResults=False,
     ):
         if sockpath is not None and not isinstance(sockpath, SockPath):
             sockpath = SockPath(sockpath=sockpath, tcp_address=tcpAddress)
         self.sockpath = sockpath
         self.timeout = timeout
         self.useImmutableBser = useImmutableBser
+        self.lazyResults = lazyResults
+        self.compressResponses = compressResponses
+        self.sharedMemoryResults = sharedMemoryResults
         self.binpath = _default_binpath(binpath)
 
         if inspect.isclass(transport) and issubclass(transport, Transport):
@@ -927,7 +1100,14 @@ class client(object):
 
     def _makeBSERCodec(self, codec):
         def make_codec(transport):
-            return codec(transport, self.valueEncoding, self.valueErrors)
+            return codec(
+                transport,
+                self.valueEncoding,
+                self.valueErrors,
+                self.lazyResults,
+                self.compressResponses,
+                self.sharedMemoryResults,
+            )
 
         return make_codec
 
@@ -1156,9 +1336,9 @@ class client(object):
         try:
             self.sendConn.send(args)
 
-            res = self.receive()
-            while self.isUnilateralResponse(res):
-                res = self.receive()
+            res = self._receiveResponse()
+            if self._hasprop(res, "partial"):
+                res = self._receiveStreamedResponse(res)
 
             return res
         except EnvironmentError as ee:
@@ -1174,6 +1354,32 @@ class client(object):
             ex.setCommand(args)
             raise
 
+    def _receiveResponse(self):
+        res = self.receive()
+        while self.isUnilateralResponse(res):
+            res = self.receive()
+        return res
+
+    def _receiveStreamedResponse(self, res):
+        """A query that set stream_results is answered by a series of
+        partial responses carrying some of the files, followed by the
+        final response.  Combine them so that the caller sees a single
+        response, as though the results had not been streamed."""
+        files = []
+        while self._hasprop(res, "partial"):
+            if self.useImmutableBser:
+                files.extend(res.files)
+            else:
+                files.extend(res["files"])
+            res = self._receiveResponse()
+
+        if self.useImmutableBser:
+            files.extend(res.files)
+            return _StreamedImmutableResponse(res, files)
+        files.extend(res["files"])
+        res["files"] = files
+        return res
+
     def capabilityCheck(self, optional=None, required=None):
         """Perform a server capability check"""
         res = self.query(
@@ -47,6 +47,7 @@ typedef unsigned __int64 uint64_t;
 #define BSER_TEMPLATE  0x0b
 #define BSER_SKIP      0x0c
 #define BSER_UTF8STRING 0x0d
+#define BSER_PREFIX_STRING 0x0e
 // clang-format on
 
 // An immutable object representation of BSER_OBJECT.
@@ -228,10 +229,14 @@ typedef struct loads_ctx {
   const char* value_errors;
   uint32_t bser_version;
   uint32_t bser_capabilities;
+  // Decode the arrays and templates in the top level object lazily
+  int lazy;
 } unser_ctx_t;
 
 static PyObject*
 bser_loads_recursive(const char** ptr, const char* end, const unser_ctx_t* ctx);
+static PyObject*
+bunser_lazy(const char** ptr, const char* end, const unser_ctx_t* ctx);
 
 static const char bser_true = BSER_TRUE;
 static const char bser_false = BSER_FALSE;
@@ -629,12 +634,106 @@ static int bunser_bytestring(
   return 1;
 }
 
+static PyObject* bunser_string_value(
+    const char* start,
+    int64_t len,
+    char type,
+    const unser_ctx_t* ctx) {
+  if (len > LONG_MAX) {
+    PyErr_Format(PyExc_ValueError, "string too long for python");
+    return NULL;
+  }
+
+  if (type == BSER_UTF8STRING) {
+    return PyUnicode_Decode(start, (long)len, "utf-8", "strict");
+  }
+  if (ctx->value_encoding != NULL) {
+    return PyUnicode_Decode(
+        start, (long)len, ctx->value_encoding, ctx->value_errors);
+  }
+  return PyBytes_FromStringAndSize(start, (long)len);
+}
+
+// The bytes of the element before the one being decoded in an array or a
+// template column, if it was a string, for a BSER_PREFIX_STRING to take
+// its start from
+typedef struct {
+  char* buf;
+  int64_t len; // -1 if the element before wasn't a string
+  int64_t cap;
+} bunser_prev_t;
+
+static const bunser_prev_t bunser_no_prev = {NULL, -1, 0};
+
+// Decodes the element of an array or template column that *ptr points to,
+// and then sets prev for the element after it
+static PyObject* bunser_element(
+    const char** ptr,
+    const char* end,
+    const unser_ctx_t* ctx,
+    bunser_prev_t* prev) {
+  const char* buf = *ptr;
+  const char* start;
+  int64_t shared = 0, len, total;
+  char type;
+
+  if (buf >= end) {
+    PyErr_SetString(PyExc_ValueError, "input buffer to small for bser value");
+    return NULL;
+  }
+
+  if (buf[0] == BSER_PREFIX_STRING) {
+    buf++;
+    if (!bunser_int(&buf, end, &shared)) {
+      return NULL;
+    }
+    if (shared < 0 || shared > prev->len) {
+      PyErr_Format(
+          PyExc_ValueError,
+          "prefix string of %lld bytes doesn't follow a long enough string",
+          (long long)shared);
+      return NULL;
+    }
+    if (buf >= end ||
+        (buf[0] != BSER_BYTESTRING && buf[0] != BSER_UTF8STRING)) {
+      PyErr_Format(
+          PyExc_ValueError, "Expect a string to follow PREFIX_STRING");
+      return NULL;
+    }
+    *ptr = buf;
+  } else if (buf[0] != BSER_BYTESTRING && buf[0] != BSER_UTF8STRING) {
+    prev->len = -1;
+    return bser_loads_recursive(ptr, end, ctx);
+  }
+
+  type = buf[0];
+  if (!bunser_bytestring(ptr, end, &start, &len)) {
+    return NULL;
+  }
+
+  // Keep the whole string for the element after this one
+  total = shared + len;
+  if (total > prev->cap) {
+    char* grown = PyMem_Realloc(prev->buf, (size_t)total);
+    if (!grown) {
+      return PyErr_NoMemory();
+    }
+    prev->buf = grown;
+    prev->cap = total;
+  }
+  memcpy(prev->buf + shared, start, (size_t)len);
+  prev->len = total;
+
+  return bunser_string_value(prev->buf, total, type, ctx);
+}
+
 static PyObject*
 bunser_array(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   const char* buf = *ptr;
   int64_t nitems, i;
   int mutable = ctx->mutable;
   PyObject* res;
+  bunser_prev_t prev = bunser_no_prev;
 
   // skip array header
   buf++;
@@ -655,9 +754,10 @@ bunser_array(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   }
 
   for (i = 0; i < nitems; i++) {
-    PyObject* ele = bser_loads_recursive(ptr, end, ctx);
+    PyObject* ele = bunser_element(ptr, end, ctx, &prev);
 
     if (!ele) {
+      PyMem_Free(prev.buf);
       Py_DECREF(res);
       return NULL;
     }
@@ -670,6 +770,7 @@ bunser_array(const char** ptr, const char* end, const unser_ctx_t* ctx) {
     // DECREF(ele) not required as SET_ITEM steals the ref
   }
 
+  PyMem_Free(prev.buf);
   return res;
 }
 
@@ -680,6 +781,10 @@ bunser_object(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   int mutable = ctx->mutable;
   PyObject* res;
   bserObject* obj;
+  unser_ctx_t value_ctx = *ctx;
+
+  // Only the values of the top level object are candidates for lazy decoding
+  value_ctx.lazy = 0;
 
   // skip array header
   buf++;
@@ -731,7 +836,11 @@ bunser_object(const char** ptr, const char* end, const unser_ctx_t* ctx) {
       return NULL;
     }
 
-    ele = bser_loads_recursive(ptr, end, ctx);
+    if (ctx->lazy && (**ptr == BSER_ARRAY || **ptr == BSER_TEMPLATE)) {
+      ele = bunser_lazy(ptr, end, &value_ctx);
+    } else {
+      ele = bser_loads_recursive(ptr, end, &value_ctx);
+    }
 
     if (!ele) {
       Py_DECREF(key);
@@ -753,6 +862,15 @@ bunser_object(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   return res;
 }
 
+static void bunser_free_prevs(bunser_prev_t* prevs, Py_ssize_t n) {
+  Py_ssize_t i;
+
+  for (i = 0; i < n; i++) {
+    PyMem_Free(prevs[i].buf);
+  }
+  PyMem_Free(prevs);
+}
+
 static PyObject*
 bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   const char* buf = *ptr;
@@ -761,6 +879,7 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
   PyObject* arrval;
   PyObject* keys;
   Py_ssize_t numkeys, keyidx;
+  bunser_prev_t* prevs;
   unser_ctx_t keys_ctx = {0};
   if (mutable) {
     keys_ctx.mutable = 1;
@@ -808,6 +927,18 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
     return NULL;
   }
 
+  // The string before in each column, for BSER_PREFIX_STRING
+  prevs = PyMem_Malloc((numkeys ? numkeys : 1) * sizeof(bunser_prev_t));
+  if (!prevs) {
+    PyErr_NoMemory();
+    Py_DECREF(keys);
+    Py_DECREF(arrval);
+    return NULL;
+  }
+  for (keyidx = 0; keyidx < numkeys; keyidx++) {
+    prevs[keyidx] = bunser_no_prev;
+  }
+
   for (i = 0; i < nitems; i++) {
     PyObject* dict = NULL;
     bserObject* obj = NULL;
@@ -825,6 +956,7 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
     }
     if (!dict) {
     fail:
+      bunser_free_prevs(prevs, numkeys);
       Py_DECREF(keys);
       Py_DECREF(arrval);
       return NULL;
@@ -838,8 +970,9 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
         *ptr = *ptr + 1;
         ele = Py_None;
         Py_INCREF(ele);
+        prevs[keyidx].len = -1;
       } else {
-        ele = bser_loads_recursive(ptr, end, ctx);
+        ele = bunser_element(ptr, end, ctx, &prevs[keyidx]);
       }
 
       if (!ele) {
@@ -860,11 +993,371 @@ bunser_template(const char** ptr, const char* end, const unser_ctx_t* ctx) {
     // DECREF(obj) not required as SET_ITEM steals the ref
   }
 
+  bunser_free_prevs(prevs, numkeys);
   Py_DECREF(keys);
 
   return arrval;
 }
 
+// Advances *ptr past the value that it points to, without decoding it
+static int bunser_skip(const char** ptr, const char* end) {
+  const char* buf = *ptr;
+  int64_t nitems, numkeys, i;
+
+  if (buf >= end) {
+    PyErr_SetString(PyExc_ValueError, "input buffer to small for bser value");
+    return 0;
+  }
+
+  switch (buf[0]) {
+    case BSER_INT8:
+    case BSER_INT16:
+    case BSER_INT32:
+    case BSER_INT64:
+      return bunser_int(ptr, end, &nitems);
+
+    case BSER_REAL:
+      if (end - buf < 1 + (Py_ssize_t)sizeof(double)) {
+        PyErr_SetString(
+            PyExc_ValueError, "input buffer to small for real encoding");
+        return 0;
+      }
+      *ptr = buf + 1 + sizeof(double);
+      return 1;
+
+    case BSER_TRUE:
+    case BSER_FALSE:
+    case BSER_NULL:
+      *ptr = buf + 1;
+      return 1;
+
+    case BSER_BYTESTRING:
+    case BSER_UTF8STRING: {
+      const char* start;
+      int64_t len;
+      return bunser_bytestring(ptr, end, &start, &len);
+    }
+
+    case BSER_PREFIX_STRING: {
+      const char* start;
+      int64_t len;
+      buf++;
+      if (!bunser_int(&buf, end, &len)) {
+        return 0;
+      }
+      if (buf >= end ||
+          (buf[0] != BSER_BYTESTRING && buf[0] != BSER_UTF8STRING)) {
+        PyErr_Format(
+            PyExc_ValueError, "Expect a string to follow PREFIX_STRING");
+        return 0;
+      }
+      *ptr = buf;
+      return bunser_bytestring(ptr, end, &start, &len);
+    }
+
+    case BSER_ARRAY:
+    case BSER_OBJECT: {
+      // An object holds a key as well as a value for each of its items
+      int per_item = buf[0] == BSER_OBJECT ? 2 : 1;
+
+      buf++;
+      if (!bunser_int(&buf, end, &nitems)) {
+        return 0;
+      }
+      *ptr = buf;
+      for (i = 0; i < nitems * per_item; i++) {
+        if (!bunser_skip(ptr, end)) {
+          return 0;
+        }
+      }
+      return 1;
+    }
+
+    case BSER_TEMPLATE:
+      if (end - buf < 2 || buf[1] != BSER_ARRAY) {
+        PyErr_Format(PyExc_ValueError, "Expect ARRAY to follow TEMPLATE");
+        return 0;
+      }
+      buf += 2;
+      if (!bunser_int(&buf, end, &numkeys)) {
+        return 0;
+      }
+      *ptr = buf;
+      for (i = 0; i < numkeys; i++) {
+        if (!bunser_skip(ptr, end)) {
+          return 0;
+        }
+      }
+      if (!bunser_int(ptr, end, &nitems)) {
+        return 0;
+      }
+      for (i = 0; i < nitems * numkeys; i++) {
+        if (*ptr < end && **ptr == BSER_SKIP) {
+          *ptr = *ptr + 1;
+        } else if (!bunser_skip(ptr, end)) {
+          return 0;
+        }
+      }
+      return 1;
+
+    default:
+      PyErr_Format(PyExc_ValueError, "unhandled bser opcode 0x%02x", buf[0]);
+      return 0;
+  }
+}
+
+// A BSER_ARRAY or BSER_TEMPLATE from the top level object of a
+// loads(lazy=True) result.  Rather than decoding every element up front,
+// this keeps a copy of the encoded elements along with the offset of each
+// one, and decodes an element each time that it is accessed.  Nothing is
+// cached, so walking the files of a very large query result only holds
+// one decoded file at a time, on top of the encoded data.
+// clang-format off
+typedef struct {
+  PyObject_HEAD
+  PyObject *data;         // bytes holding the encoded elements
+  PyObject *keys;         // tuple of template keys, or NULL for an array
+  Py_ssize_t *offsets;    // nitems + 1 offsets of the elements in data
+  Py_ssize_t nitems;
+  char *value_encoding;
+  char *value_errors;
+} bserLazyArray;
+// clang-format on
+
+static Py_ssize_t bserlazy_length(PyObject* o) {
+  bserLazyArray* arr = (bserLazyArray*)o;
+
+  return arr->nitems;
+}
+
+static PyObject* bserlazy_item(PyObject* o, Py_ssize_t i) {
+  bserLazyArray* arr = (bserLazyArray*)o;
+  const char* data;
+  const char* ptr;
+  const char* end;
+  unser_ctx_t ctx = {0};
+  Py_ssize_t numkeys, keyidx;
+  bserObject* obj;
+
+  if (i < 0 || i >= arr->nitems) {
+    PyErr_SetString(PyExc_IndexError, "bser lazy array index out of range");
+    return NULL;
+  }
+
+  data = PyBytes_AS_STRING(arr->data);
+  ptr = data + arr->offsets[i];
+  end = data + arr->offsets[i + 1];
+  ctx.value_encoding = arr->value_encoding;
+  ctx.value_errors = arr->value_errors;
+
+  if (!arr->keys) {
+    return bser_loads_recursive(&ptr, end, &ctx);
+  }
+
+  numkeys = PyTuple_GET_SIZE(arr->keys);
+  obj = PyObject_New(bserObject, &bserObjectType);
+  if (!obj) {
+    return NULL;
+  }
+  obj->keys = arr->keys;
+  Py_INCREF(obj->keys);
+  obj->values = PyTuple_New(numkeys);
+  if (!obj->values) {
+    Py_DECREF(obj);
+    return NULL;
+  }
+
+  for (keyidx = 0; keyidx < numkeys; keyidx++) {
+    PyObject* ele;
+
+    if (*ptr == BSER_SKIP) {
+      ptr++;
+      ele = Py_None;
+      Py_INCREF(ele);
+    } else {
+      ele = bser_loads_recursive(&ptr, end, &ctx);
+    }
+
+    if (!ele) {
+      Py_DECREF(obj);
+      return NULL;
+    }
+    PyTuple_SET_ITEM(obj->values, keyidx, ele);
+  }
+
+  return (PyObject*)obj;
+}
+
+// clang-format off
+static PySequenceMethods bserlazy_sq = {
+  bserlazy_length,           /* sq_length */
+  0,                         /* sq_concat */
+  0,                         /* sq_repeat */
+  bserlazy_item,             /* sq_item */
+  0,                         /* sq_ass_item */
+  0,                         /* sq_contains */
+  0,                         /* sq_inplace_concat */
+  0                          /* sq_inplace_repeat */
+};
+// clang-format on
+
+static void bserlazy_dealloc(PyObject* o) {
+  bserLazyArray* arr = (bserLazyArray*)o;
+
+  Py_CLEAR(arr->data);
+  Py_CLEAR(arr->keys);
+  PyMem_Free(arr->offsets);
+  PyMem_Free(arr->value_encoding);
+  PyMem_Free(arr->value_errors);
+  PyObject_Del(o);
+}
+
+// clang-format off
+PyTypeObject bserLazyArrayType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "bser_lazy_array",         /* tp_name */
+  sizeof(bserLazyArray),     /* tp_basicsize */
+  0,                         /* tp_itemsize */
+  bserlazy_dealloc,          /* tp_dealloc */
+  0,                         /* tp_print */
+  0,                         /* tp_getattr */
+  0,                         /* tp_setattr */
+  0,                         /* tp_compare */
+  0,                         /* tp_repr */
+  0,                         /* tp_as_number */
+  &bserlazy_sq,              /* tp_as_sequence */
+  0,                         /* tp_as_mapping */
+  0,                         /* tp_hash  */
+  0,                         /* tp_call */
+  0,                         /* tp_str */
+  0,                         /* tp_getattro */
+  0,                         /* tp_setattro */
+  0,                         /* tp_as_buffer */
+  Py_TPFLAGS_DEFAULT,        /* tp_flags */
+  "lazily decoded bser array", /* tp_doc */
+};
+// clang-format on
+
+// Sets *copy to a PyMem_Malloc'd copy of str, or to NULL if str is NULL
+static int bser_strdup(const char* str, char** copy) {
+  size_t len;
+
+  *copy = NULL;
+  if (!str) {
+    return 1;
+  }
+  len = strlen(str) + 1;
+  *copy = PyMem_Malloc(len);
+  if (!*copy) {
+    PyErr_NoMemory();
+    return 0;
+  }
+  memcpy(*copy, str, len);
+  return 1;
+}
+
+static PyObject*
+bunser_lazy(const char** ptr, const char* end, const unser_ctx_t* ctx) {
+  const char* buf = *ptr;
+  const char* start;
+  PyObject* keys = NULL;
+  Py_ssize_t numkeys = 0, keyidx;
+  int64_t nitems, i;
+  unser_ctx_t keys_ctx = {0};
+  bserLazyArray* arr;
+
+  if (buf[0] == BSER_TEMPLATE) {
+    if (end - buf < 2 || buf[1] != BSER_ARRAY) {
+      PyErr_Format(PyExc_ValueError, "Expect ARRAY to follow TEMPLATE");
+      return NULL;
+    }
+    // Keys are bytestrings, just as they are for an immutable template
+    *ptr = buf + 1;
+    keys = bunser_array(ptr, end, &keys_ctx);
+    if (!keys) {
+      return NULL;
+    }
+    numkeys = PyTuple_GET_SIZE(keys);
+  } else {
+    *ptr = buf + 1;
+  }
+
+  if (!bunser_int(ptr, end, &nitems)) {
+    Py_XDECREF(keys);
+    return NULL;
+  }
+  if (nitems < 0 ||
+      (uint64_t)nitems >= PY_SSIZE_T_MAX / sizeof(Py_ssize_t)) {
+    PyErr_Format(PyExc_ValueError, "too many items for python array");
+    Py_XDECREF(keys);
+    return NULL;
+  }
+
+  arr = PyObject_New(bserLazyArray, &bserLazyArrayType);
+  if (!arr) {
+    Py_XDECREF(keys);
+    return NULL;
+  }
+  arr->data = NULL;
+  arr->keys = keys;
+  arr->nitems = (Py_ssize_t)nitems;
+  arr->value_encoding = NULL;
+  arr->value_errors = NULL;
+  arr->offsets = PyMem_Malloc((arr->nitems + 1) * sizeof(Py_ssize_t));
+  if (!arr->offsets) {
+    PyErr_NoMemory();
+    goto fail;
+  }
+
+  // Find where each element starts, checking the encoding as we go so that
+  // a malformed PDU is reported now rather than on access
+  start = *ptr;
+  for (i = 0; i < nitems; i++) {
+    arr->offsets[i] = *ptr - start;
+    if (!keys) {
+      if (*ptr < end && **ptr == BSER_PREFIX_STRING) {
+        goto front_coded;
+      }
+      if (!bunser_skip(ptr, end)) {
+        goto fail;
+      }
+      continue;
+    }
+    for (keyidx = 0; keyidx < numkeys; keyidx++) {
+      if (*ptr < end && **ptr == BSER_SKIP) {
+        *ptr = *ptr + 1;
+      } else if (*ptr < end && **ptr == BSER_PREFIX_STRING) {
+        goto front_coded;
+      } else if (!bunser_skip(ptr, end)) {
+        goto fail;
+      }
+    }
+  }
+  arr->offsets[nitems] = *ptr - start;
+
+  arr->data = PyBytes_FromStringAndSize(start, *ptr - start);
+  if (!arr->data || !bser_strdup(ctx->value_encoding, &arr->value_encoding) ||
+      !bser_strdup(ctx->value_errors, &arr->value_errors)) {
+    goto fail;
+  }
+
+  return (PyObject*)arr;
+
+front_coded:
+  // Each element takes its start from the one before, so none of them can
+  // be decoded on its own; decode them all now instead
+  Py_DECREF(arr);
+  *ptr = buf;
+  if (buf[0] == BSER_TEMPLATE) {
+    return bunser_template(ptr, end, ctx);
+  }
+  return bunser_array(ptr, end, ctx);
+
+fail:
+  Py_DECREF(arr);
+  return NULL;
+}
+
 static PyObject* bser_loads_recursive(
     const char** ptr,
     const char* end,
@@ -913,27 +1406,7 @@ static PyObject* bser_loads_recursive(
       Py_INCREF(Py_None);
       return Py_None;
 
-    case BSER_BYTESTRING: {
-      const char* start;
-      int64_t len;
-
-      if (!bunser_bytestring(ptr, end, &start, &len)) {
-        return NULL;
-      }
-
-      if (len > LONG_MAX) {
-        PyErr_Format(PyExc_ValueError, "string too long for python");
-        return NULL;
-      }
-
-      if (ctx->value_encoding != NULL) {
-        return PyUnicode_Decode(
-            start, (long)len, ctx->value_encoding, ctx->value_errors);
-      } else {
-        return PyBytes_FromStringAndSize(start, (long)len);
-      }
-    }
-
+    case BSER_BYTESTRING:
     case BSER_UTF8STRING: {
       const char* start;
       int64_t len;
@@ -942,12 +1415,7 @@ static PyObject* bser_loads_recursive(
         return NULL;
       }
 
-      if (len > LONG_MAX) {
-        PyErr_Format(PyExc_ValueError, "string too long for python");
-        return NULL;
-      }
-
-      return PyUnicode_Decode(start, (long)len, "utf-8", "strict");
+      return bunser_string_value(start, len, buf[0], ctx);
     }
 
     case BSER_ARRAY:
@@ -993,10 +1461,12 @@ static int _pdu_info_helper(
 
   if (bser_version == 2) {
     // Expect an integer telling us what capabilities are supported by the
-    // remote server (currently unused).
-    if (!memcpy(&bser_capabilities, &data, sizeof(bser_capabilities))) {
+    // remote server
+    if (end - data < (Py_ssize_t)sizeof(bser_capabilities)) {
+      PyErr_SetString(PyExc_ValueError, "input buffer to small for bser pdu");
       return 0;
     }
+    memcpy(&bser_capabilities, data, sizeof(bser_capabilities));
     data += sizeof(bser_capabilities);
   }
 
@@ -1074,7 +1544,7 @@ static PyObject* bser_pdu_len(PyObject* self, PyObject* args) {
 
 static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
   const char* data = NULL;
-  Py_ssize_t datalen = 0;
+  Py_buffer view;
   const char* start;
   const char* end;
   int64_t expected_len;
@@ -1082,23 +1552,25 @@ static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
   PyObject* mutable_obj = NULL;
   const char* value_encoding = NULL;
   const char* value_errors = NULL;
+  PyObject* lazy_obj = NULL;
+  PyObject* res = NULL;
   unser_ctx_t ctx = {1, 0};
 
   static char* kw_list[] = {
-      "buf", "mutable", "value_encoding", "value_errors", NULL};
+      "buf", "mutable", "value_encoding", "value_errors", "lazy", NULL};
 
   (void)self;
 
   if (!PyArg_ParseTupleAndKeywords(
           args,
           kw,
-          "s#|Ozz:loads",
+          "s*|OzzO:loads",
           kw_list,
-          &start,
-          &datalen,
+          &view,
           &mutable_obj,
           &value_encoding,
-          &value_errors)) {
+          &value_errors,
+          &lazy_obj)) {
     return NULL;
   }
 
@@ -1113,27 +1585,41 @@ static PyObject* bser_loads(PyObject* self, PyObject* args, PyObject* kw) {
   } else {
     ctx.value_errors = value_errors;
   }
-  data = start;
-  end = data + datalen;
+  // Any buffer will do, so that a pdu can be decoded straight out of an
+  // mmap, say, without first copying it into bytes
+  start = view.buf;
+  end = start + view.len;
 
   if (!_pdu_info_helper(
-          data,
+          start,
           end,
           &ctx.bser_version,
           &ctx.bser_capabilities,
           &expected_len,
           &position)) {
-    return NULL;
+    goto done;
   }
 
   data = start + position;
   // Verify
   if (expected_len + data != end) {
     PyErr_SetString(PyExc_ValueError, "bser data len != header len");
-    return NULL;
+    goto done;
+  }
+
+  // Lazy elements are always decoded as immutable objects, since changes
+  // made to one would be lost the next time that it was accessed
+  if (lazy_obj && PyObject_IsTrue(lazy_obj) > 0 && !ctx.mutable &&
+      data < end && *data == BSER_OBJECT) {
+    ctx.lazy = 1;
+    res = bunser_object(&data, end, &ctx);
+  } else {
+    res = bser_loads_recursive(&data, end, &ctx);
   }
 
-  return bser_loads_recursive(&data, end, &ctx);
+done:
+  PyBuffer_Release(&view);
+  return res;
 }
 
 static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
@@ -1146,21 +1632,23 @@ static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
   PyObject* mutable_obj = NULL;
   PyObject* value_encoding = NULL;
   PyObject* value_errors = NULL;
+  PyObject* lazy_obj = NULL;
 
   static char* kw_list[] = {
-      "fp", "mutable", "value_encoding", "value_errors", NULL};
+      "fp", "mutable", "value_encoding", "value_errors", "lazy", NULL};
 
   (void)self;
 
   if (!PyArg_ParseTupleAndKeywords(
           args,
           kw,
-          "O|OOO:load",
+          "O|OOOO:load",
           kw_list,
           &fp,
           &mutable_obj,
           &value_encoding,
-          &value_errors)) {
+          &value_errors,
+          &lazy_obj)) {
     return NULL;
   }
 
@@ -1191,6 +1679,9 @@ static PyObject* bser_load(PyObject* self, PyObject* args, PyObject* kw) {
   if (value_errors) {
     PyDict_SetItemString(load_method_kwargs, "value_errors", value_errors);
   }
+  if (lazy_obj) {
+    PyDict_SetItemString(load_method_kwargs, "lazy", lazy_obj);
+  }
   string = PyObject_Call(load_method, load_method_args, load_method_kwargs);
   Py_DECREF(load_method_kwargs);
   Py_DECREF(load_method_args);
@@ -1229,6 +1720,7 @@ PyMODINIT_FUNC PyInit_bser(void) {
 
   mod = PyModule_Create(&bser_module);
   PyType_Ready(&bserObjectType);
+  PyType_Ready(&bserLazyArrayType);
 
   return mod;
 }
@@ -1237,6 +1729,7 @@ PyMODINIT_FUNC PyInit_bser(void) {
 PyMODINIT_FUNC initbser(void) {
   (void)Py_InitModule("bser", bser_methods);
   PyType_Ready(&bserObjectType);
+  PyType_Ready(&bserLazyArrayType);
 }
 #endif // PY_MAJOR_VERSION >= 3
 
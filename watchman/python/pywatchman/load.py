@@ -42,7 +42,7 @@ def _read_bytes(fp, buf):
     return offset
 
 
-def load(fp, mutable=True, value_encoding=None, value_errors=None):
+def load(fp, mutable=True, value_encoding=None, value_errors=None, lazy=False):
     """Deserialize a BSER-encoded blob.
 
     @param fp: The file-object to deserialize.
@@ -59,6 +59,14 @@ def load(fp, mutable=True, value_encoding=None, value_errors=None):
                          The other most common argument is 'surrogateescape' on
                          Python 3. If value_encoding is None, this is ignored.
     @type value_errors: str
+
+    @param lazy: Whether to decode the arrays in the top level object of an
+                 immutable result as their elements are accessed, rather
+                 than all at once. This keeps the memory used for a very
+                 large query result down to little more than its encoded
+                 size. Only the C extension does this; it is ignored if
+                 mutable is True.
+    @type lazy: bool
     """
     buf = ctypes.create_string_buffer(8192)
     SNIFF_BUFFER_SIZE = len(EMPTY_HEADER)
@@ -81,4 +89,5 @@ def load(fp, mutable=True, value_encoding=None, value_errors=None):
         mutable,
         value_encoding,
         value_errors,
+        lazy,
     )
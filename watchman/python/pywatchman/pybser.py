@@ -31,6 +31,7 @@ BSER_NULL = b"\x0a"
 BSER_TEMPLATE = b"\x0b"
 BSER_SKIP = b"\x0c"
 BSER_UTF8STRING = b"\x0d"
+BSER_PREFIX_STRING = b"\x0e"
 
 if compat.PYTHON3:
     STRING_TYPES = (str, bytes)
@@ -343,11 +344,46 @@ class Bunser(object):
             # str_len stays the same because that's the length in bytes
         return (str_val, pos + str_len)
 
+    def _string_value(self, raw, val_type):
+        if val_type == BSER_UTF8STRING:
+            return raw.decode("utf-8")
+        if self.value_encoding is not None:
+            return raw.decode(self.value_encoding, self.value_errors)
+        return raw
+
+    def unser_element(self, buf, pos, prev):
+        """Decodes the element of an array or template column at pos.  prev
+        holds the bytes of the element before it, if that was a string, for
+        a BSER_PREFIX_STRING to take its start from.  Returns the element,
+        its bytes if it is a string, and the position after it."""
+        val_type = _buf_pos(buf, pos)
+        shared = 0
+        if val_type == BSER_PREFIX_STRING:
+            shared, pos = self.unser_int(buf, pos + 1)
+            if prev is None or shared < 0 or shared > len(prev):
+                raise ValueError(
+                    "prefix string of %d bytes doesn't follow a long enough "
+                    "string at position %s" % (shared, pos)
+                )
+            val_type = _buf_pos(buf, pos)
+            if val_type != BSER_BYTESTRING and val_type != BSER_UTF8STRING:
+                raise ValueError("Expect a string to follow PREFIX_STRING")
+        elif val_type != BSER_BYTESTRING and val_type != BSER_UTF8STRING:
+            val, pos = self.loads_recursive(buf, pos)
+            return val, None, pos
+
+        str_len, pos = self.unser_int(buf, pos + 1)
+        raw = struct.unpack_from(tobytes(str_len) + b"s", buf, pos)[0]
+        if shared:
+            raw = prev[:shared] + raw
+        return self._string_value(raw, val_type), raw, pos + str_len
+
     def unser_array(self, buf, pos):
         arr_len, pos = self.unser_int(buf, pos + 1)
         arr = []
+        prev = None
         for _ in range(arr_len):
-            arr_item, pos = self.loads_recursive(buf, pos)
+            arr_item, prev, pos = self.unser_element(buf, pos, prev)
             arr.append(arr_item)
 
         if not self.mutable:
@@ -386,6 +422,8 @@ class Bunser(object):
         keys, pos = keys_bunser.unser_array(buf, pos + 1)
         nitems, pos = self.unser_int(buf, pos)
         arr = []
+        # The bytes of each column of the row before, for BSER_PREFIX_STRING
+        prevs = [None] * len(keys)
         for _ in range(nitems):
             if self.mutable:
                 obj = {}
@@ -396,8 +434,11 @@ class Bunser(object):
                 if _buf_pos(buf, pos) == BSER_SKIP:
                     pos += 1
                     ele = None
+                    prevs[keyidx] = None
                 else:
-                    ele, pos = self.loads_recursive(buf, pos)
+                    ele, prevs[keyidx], pos = self.unser_element(
+                        buf, pos, prevs[keyidx]
+                    )
 
                 if self.mutable:
                     key = keys[keyidx]
@@ -474,7 +515,7 @@ def pdu_len(buf):
     return info[2] + info[3]
 
 
-def loads(buf, mutable=True, value_encoding=None, value_errors=None):
+def loads(buf, mutable=True, value_encoding=None, value_errors=None, lazy=False):
     """Deserialize a BSER-encoded blob.
 
     @param buf: The buffer to deserialize.
@@ -491,6 +532,10 @@ def loads(buf, mutable=True, value_encoding=None, value_errors=None):
                          The other most common argument is 'surrogateescape' on
                          Python 3. If value_encoding is None, this is ignored.
     @type value_errors: str
+
+    @param lazy: Accepted for compatibility with the C extension (see
+                 pywatchman.load.load); everything is decoded up front here.
+    @type lazy: bool
     """
 
     info = _pdu_info_helper(buf)
@@ -509,7 +554,7 @@ def loads(buf, mutable=True, value_encoding=None, value_errors=None):
     return bunser.loads_recursive(buf, pos)[0]
 
 
-def load(fp, mutable=True, value_encoding=None, value_errors=None):
+def load(fp, mutable=True, value_encoding=None, value_errors=None, lazy=False):
     from . import load
 
-    return load.load(fp, mutable, value_encoding, value_errors)
+    return load.load(fp, mutable, value_encoding, value_errors, lazy)
@@ -11,14 +11,18 @@ import binascii
 import collections
 import inspect
 import os
+import socket
+import struct
 import sys
 import tempfile
 import uuid
 
 from pywatchman import (
+    Bser2WithFallbackCodec,
     SocketConnectError,
     SocketTimeout,
     Transport,
+    UnixSocketTransport,
     WatchmanError,
     bser,
     client,
@@ -375,6 +379,107 @@ class TestBSERDump(unittest.TestCase):
         for i in range(0, len(exp)):
             self.assertItemAttributes(exp[i], res[i])
 
+    def test_lazy(self):
+        files = [{"name": b"a", "size": 1}, {"name": b"b", "size": 2}]
+        enc = self.bser_mod.dumps({"files": files, "clock": b"c:123"})
+        res = self.bser_mod.loads(enc, False, lazy=True)
+        self.assertEqual(b"c:123", res.clock)
+        self.assertEqual(len(files), len(res.files))
+        self.assertItemAttributes(files[1], res.files[1])
+        self.assertItemAttributes(files[1], res.files[-1])
+        for exp, got in zip(files, res.files):
+            self.assertItemAttributes(exp, got)
+        self.assertEqual(len(files), len(list(res.files)))
+        self.assertRaises(IndexError, lambda: res.files[len(files)])
+
+        fp = FakeFile(enc)
+        res = self.bser_mod.load(fp, False, lazy=True)
+        self.assertItemAttributes(files[0], res.files[0])
+
+        # The same template as test_template, as the value of "files"
+        templ = (
+            b"\x00\x01\x03\x33\x01\x03\x01\x02\x03\x05files"
+            + b"\x0b\x00\x03\x02\x02\x03\x04\x6e\x61\x6d\x65\x02"
+            + b"\x03\x03\x61\x67\x65\x03\x03\x02\x03\x04\x66\x72"
+            + b"\x65\x64\x03\x14\x02\x03\x04\x70\x65\x74\x65\x03"
+            + b"\x1e\x0c\x03\x19"
+        )
+        res = self.bser_mod.loads(templ, False, lazy=True)
+        exp = [
+            {"name": b"fred", "age": 20},
+            {"name": b"pete", "age": 30},
+            {"name": None, "age": 25},
+        ]
+        self.assertEqual(len(exp), len(res.files))
+        for i in range(0, len(exp)):
+            self.assertItemAttributes(exp[i], res.files[i])
+
+        # Mutable results are always decoded up front
+        res = self.bser_mod.loads(templ, True, lazy=True)
+        self.assertEqual({"files": exp}, res)
+
+    def test_lazy_garbage(self):
+        # A truncated element is reported when decoding, not on access.
+        # (pybser reports it with a struct.error rather than a ValueError)
+        enc = self.bser_mod.dumps({"files": [b"hello"]})
+        enc = enc[:-8] + b"\x02\x03\x07hello"
+        self.assertRaises(Exception, self.bser_mod.loads, enc, False, lazy=True)
+
+    def test_prefix_strings(self):
+        def pdu(body):
+            return b"\x00\x01\x05" + struct.pack("=i", len(body)) + body
+
+        # The second element takes "fbcode/" from the first
+        arr = (
+            b"\x00\x03\x02\x02\x03\x0cfbcode/a.cpp"
+            + b"\x0e\x03\x07\x02\x03\x05b.cpp"
+        )
+        self.assertEqual(
+            [b"fbcode/a.cpp", b"fbcode/b.cpp"], self.bser_mod.loads(pdu(arr))
+        )
+
+        # In a template, from the same column of the row before, which is a
+        # utf-8 string if the rest of it is
+        templ = (
+            b"\x0b\x00\x03\x02\x02\x03\x04name\x02\x03\x04size\x03\x03"
+            + b"\x02\x03\x0cfbcode/a.cpp\x03\x01"
+            + b"\x0e\x03\x07\x0d\x03\x05b.cpp\x03\x02"
+            + b"\x0c\x03\x03"
+        )
+        exp = [
+            {"name": b"fbcode/a.cpp", "size": 1},
+            {"name": u"fbcode/b.cpp", "size": 2},
+            {"name": None, "size": 3},
+        ]
+        self.assertEqual(exp, self.bser_mod.loads(pdu(templ)))
+        res = self.bser_mod.loads(pdu(templ), False)
+        for i in range(0, len(exp)):
+            self.assertItemAttributes(exp[i], res[i])
+
+        # Lazy decoding gives way to decoding them all up front
+        res = self.bser_mod.loads(
+            pdu(b"\x01\x03\x01\x02\x03\x05files" + templ), False, lazy=True
+        )
+        for i in range(0, len(exp)):
+            self.assertItemAttributes(exp[i], res.files[i])
+
+        # With no string before, or one that is too short
+        self.assertRaises(
+            ValueError,
+            self.bser_mod.loads,
+            pdu(b"\x00\x03\x01\x0e\x03\x01\x02\x03\x01x"),
+        )
+        self.assertRaises(
+            ValueError,
+            self.bser_mod.loads,
+            pdu(b"\x00\x03\x02\x03\x01\x0e\x03\x01\x02\x03\x01x"),
+        )
+        self.assertRaises(
+            ValueError,
+            self.bser_mod.loads,
+            pdu(b"\x00\x03\x02\x02\x03\x01x\x0e\x03\x02\x02\x03\x01y"),
+        )
+
     def test_pdu_info(self):
         enc = self.bser_mod.dumps(1)
         DEFAULT_BSER_VERSION = 1
@@ -413,6 +518,143 @@ class TestBSERDump(unittest.TestCase):
         self.assertRaises(ValueError, self.bser_mod.pdu_info, b"\x00\x02")
 
 
+try:
+    import zstandard
+except ImportError:
+    zstandard = None
+
+
+class FakeTransport(Transport):
+    def __init__(self, responses):
+        self.responses = b"".join(responses)
+        self.written = []
+
+    def readBytes(self, size):
+        res = self.responses[:size]
+        self.responses = self.responses[size:]
+        return res
+
+    def write(self, buf):
+        self.written.append(buf)
+
+
+def pdu_body(pdu):
+    # Strip the v1 magic and the encoded length from pdu
+    int_size = {3: 1, 4: 2, 5: 4, 6: 8}[bytearray(pdu)[2]]
+    return pdu[3 + int_size :]
+
+
+class TestCompressedPdu(unittest.TestCase):
+    @unittest.skipUnless(zstandard, "needs the zstandard module")
+    def test_compressed_response(self):
+        val = {"files": ["file%d" % i for i in range(1000)]}
+        body = pdu_body(bser.dumps(val))
+        compressed = pdu_body(bser.dumps(len(body)))
+        compressed += zstandard.ZstdCompressor().compress(body)
+        version = bser.dumps(
+            {"version": "1.0", "capabilities": {"bser-v2": True, "bser-v2-zstd": True}},
+            version=2,
+        )
+        response = (
+            b"\x00\x02\x0c\x00\x00\x00"
+            + pdu_body(bser.dumps(len(compressed)))
+            + compressed
+        )
+
+        tport = FakeTransport([version, response])
+        codec = Bser2WithFallbackCodec(tport, "utf-8", "strict", compress=True)
+        self.assertEqual(
+            bser.loads(tport.written[0], value_encoding="utf-8"),
+            [
+                "version",
+                {
+                    "required": ["bser-v2"],
+                    "optional": ["bser-v2-zstd", "bser-v2-prefix-strings"],
+                },
+            ],
+        )
+        self.assertEqual(codec.bser_capabilities, 0x4)
+        self.assertEqual(codec.receive(), val)
+
+
+class TestPrefixStrings(unittest.TestCase):
+    def test_negotiated_unless_lazy(self):
+        version = bser.dumps(
+            {
+                "version": "1.0",
+                "capabilities": {"bser-v2": True, "bser-v2-prefix-strings": True},
+            },
+            version=2,
+        )
+        tport = FakeTransport([version])
+        codec = Bser2WithFallbackCodec(tport, "utf-8", "strict")
+        self.assertEqual(
+            bser.loads(tport.written[0], value_encoding="utf-8"),
+            [
+                "version",
+                {"required": ["bser-v2"], "optional": ["bser-v2-prefix-strings"]},
+            ],
+        )
+        self.assertEqual(codec.bser_capabilities, 0x40)
+
+        tport = FakeTransport([version])
+        codec = Bser2WithFallbackCodec(tport, "utf-8", "strict", lazy=True)
+        self.assertEqual(
+            bser.loads(tport.written[0], value_encoding="utf-8"),
+            ["version", {"required": ["bser-v2"]}],
+        )
+        self.assertEqual(codec.bser_capabilities, 0)
+
+
+class TestSharedMemoryPdu(unittest.TestCase):
+    @unittest.skipUnless(
+        UnixSocketTransport.can_receive_fds and hasattr(os, "memfd_create"),
+        "needs descriptor passing and memfd_create",
+    )
+    def test_shared_memory_response(self):
+        val = {"files": ["file%d" % i for i in range(1000)]}
+        pdu = bser.dumps(val, version=2)
+        size = pdu_body(bser.dumps(len(pdu)))
+        response = (
+            b"\x00\x02\x20\x00\x00\x00" + pdu_body(bser.dumps(len(size))) + size
+        )
+        version = bser.dumps(
+            {"version": "1.0", "capabilities": {"bser-v2": True, "bser-v2-fd": True}},
+            version=2,
+        )
+
+        server, sock = socket.socketpair(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.addCleanup(server.close)
+        tport = UnixSocketTransport.__new__(UnixSocketTransport)
+        tport.sock = sock
+        tport.received_fds = []
+        self.addCleanup(tport.close)
+
+        fd = os.memfd_create("test")
+        try:
+            os.write(fd, pdu)
+            server.sendall(version)
+            fds = (socket.SOL_SOCKET, socket.SCM_RIGHTS, struct.pack("i", fd))
+            server.sendmsg([response], [fds])
+        finally:
+            os.close(fd)
+
+        codec = Bser2WithFallbackCodec(tport, "utf-8", "strict", shared_memory=True)
+        self.assertEqual(
+            bser.loads(server.recv(1024), value_encoding="utf-8"),
+            [
+                "version",
+                {
+                    "required": ["bser-v2"],
+                    "optional": ["bser-v2-fd", "bser-v2-prefix-strings"],
+                },
+            ],
+        )
+        self.assertEqual(codec.bser_capabilities, 0x10)
+        self.assertEqual(codec.receive(), val)
+        self.assertEqual(tport.received_fds, [])
+
+
 if __name__ == "__main__":
     suite = load_tests(unittest.TestLoader())
     unittest.TextTestRunner().run(suite)
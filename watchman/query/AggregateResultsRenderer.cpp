@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/AggregateResultsRenderer.h"
+#include "watchman/query/QueryContext.h"
+
+namespace watchman {
+
+AggregateResultsRenderer::AggregateResultsRenderer(
+    const QueryAggregate& aggregate)
+    : groupBy_(aggregate.groupBy) {
+  if (groupBy_ == QueryAggregate::GroupBy::Type) {
+    typeField_.add(w_string("type", W_STRING_UNICODE));
+  }
+}
+
+bool AggregateResultsRenderer::render(
+    FileResult* file,
+    const QueryContext* ctx) {
+  auto size = file->size();
+  if (!size.has_value()) {
+    // Need data to be loaded
+    return false;
+  }
+
+  w_string group;
+  switch (groupBy_) {
+    case QueryAggregate::GroupBy::None:
+      break;
+    case QueryAggregate::GroupBy::Suffix:
+      group = file->baseName().asLowerCaseSuffix(W_STRING_UNICODE);
+      break;
+    case QueryAggregate::GroupBy::Type: {
+      auto type = typeField_.front()->make(file, ctx);
+      if (!type.has_value()) {
+        return false;
+      }
+      group = json_to_w_string(*type);
+      break;
+    }
+    case QueryAggregate::GroupBy::Dir: {
+      // The top level dir, of the relative root if there is one
+      auto wholeName = ctx->computeWholeName(file);
+      auto name = wholeName.view();
+      auto slash = name.find('/');
+      if (slash != std::string_view::npos) {
+        group = w_string{name.substr(0, slash)};
+      }
+      break;
+    }
+  }
+
+  total_.count++;
+  total_.size += json_int_t(*size);
+  if (groupBy_ != QueryAggregate::GroupBy::None) {
+    // Files without a suffix, or directly in the root, share the empty name
+    auto& totals = groups_[group ? group : w_string("", W_STRING_UNICODE)];
+    totals.count++;
+    totals.size += json_int_t(*size);
+  }
+  return true;
+}
+
+json_ref AggregateResultsRenderer::Totals::render() const {
+  return json_object(
+      {{"count", json_integer(count)}, {"size", json_integer(size)}});
+}
+
+json_ref AggregateResultsRenderer::takeResults() {
+  auto results = total_.render();
+  if (groupBy_ != QueryAggregate::GroupBy::None) {
+    auto groups = json_object_of_size(groups_.size());
+    for (auto& it : groups_) {
+      groups.set(it.first, it.second.render());
+    }
+    results.set("groups", std::move(groups));
+  }
+  total_ = Totals{};
+  groups_.clear();
+  return results;
+}
+
+} // namespace watchman
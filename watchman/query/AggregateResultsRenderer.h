@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include "watchman/query/Query.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class FileResult;
+struct QueryContext;
+
+/**
+ * Totals up the matching files of a query that asked for an aggregate,
+ * rather than rendering them.
+ *
+ * Monitoring asks questions such as how many files changed under a dir, or
+ * how large the shared objects are, and has no use for the files
+ * themselves.  Counting them as they match keeps the response the same
+ * size however many files there are, and only the size, and the type when
+ * grouping by it, have to be known for each of them.
+ */
+class AggregateResultsRenderer {
+ public:
+  explicit AggregateResultsRenderer(const QueryAggregate& aggregate);
+
+  /**
+   * Adds file to the totals.  Returns false, leaving them unchanged, if
+   * the data needed to count it has yet to be loaded.
+   */
+  bool render(FileResult* file, const QueryContext* ctx);
+
+  // The number of files counted so far
+  size_t size() const {
+    return size_t(total_.count);
+  }
+
+  /**
+   * Returns {"count", "size"}, along with "groups" holding the same for
+   * each group if the files were grouped.  Consumes the totals.
+   */
+  json_ref takeResults();
+
+ private:
+  struct Totals {
+    json_int_t count{0};
+    json_int_t size{0};
+
+    json_ref render() const;
+  };
+
+  QueryAggregate::GroupBy groupBy_;
+  // Renders the type of a file when grouping by it
+  QueryFieldList typeField_;
+  Totals total_;
+  std::unordered_map<w_string, Totals> groups_;
+};
+
+} // namespace watchman
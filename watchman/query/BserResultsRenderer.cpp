@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/BserResultsRenderer.h"
+#include "watchman/Errors.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryContext.h"
+#include "watchman/query/parse.h"
+
+namespace watchman {
+
+namespace {
+int append_to_string(const char* buffer, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buffer, size);
+  return 0;
+}
+} // namespace
+
+BserResultsRenderer::BserResultsRenderer(
+    uint32_t bserVersion,
+    uint32_t bserCapabilities)
+    : ctx_{bserVersion, bserCapabilities, append_to_string} {}
+
+bool BserResultsRenderer::render(
+    const QueryFieldList& fieldList,
+    FileResult* file,
+    const QueryContext* ctx) {
+  // Make every field before emitting any, so that a row that needs more
+  // data leaves nothing behind, not even in prev_
+  values_.clear();
+  for (auto& f : fieldList) {
+    auto ele = f->make(file, ctx);
+    if (!ele.has_value()) {
+      return false;
+    }
+    values_.push_back(std::move(ele.value()));
+  }
+
+  auto rowStart = rows_.size();
+  for (size_t i = 0; i < values_.size(); ++i) {
+    if (dumpValue(i, values_[i])) {
+      rows_.resize(rowStart);
+      throw QueryExecError(
+          "failed to encode ", fieldList[i]->name.view(), " as BSER");
+    }
+  }
+
+  ++numResults_;
+  return true;
+}
+
+int BserResultsRenderer::dumpValue(size_t column, const json_ref& val) {
+  if (val.isString()) {
+    auto& str = json_to_w_string(val);
+    return dumpString(column, str, str.type());
+  }
+  if (column < prev_.size()) {
+    prev_[column].reset();
+  }
+  return w_bser_dump(&ctx_, val, &rows_);
+}
+
+int BserResultsRenderer::dumpString(
+    size_t column,
+    w_string_piece str,
+    w_string_type_t type) {
+  if (!w_bser_accepts_prefix_strings(&ctx_)) {
+    return w_bser_dump_string_after(&ctx_, std::nullopt, str, type, &rows_);
+  }
+  if (column >= prev_.size()) {
+    prev_.resize(column + 1);
+  }
+  auto& prev = prev_[column];
+  std::optional<w_string_piece> prevPiece;
+  if (prev) {
+    prevPiece = w_string_piece(prev->data(), prev->size());
+  }
+  if (w_bser_dump_string_after(&ctx_, prevPiece, str, type, &rows_)) {
+    return -1;
+  }
+  if (type == W_STRING_MIXED) {
+    prev.reset();
+  } else if (prev) {
+    prev->assign(str.data(), str.size());
+  } else {
+    prev.emplace(str.data(), str.size());
+  }
+  return 0;
+}
+
+int BserResultsRenderer::dump(
+    const QueryFieldList& fieldList,
+    const bser_ctx_t* ctx,
+    void* data) const {
+  if (ctx->bser_version != ctx_.bser_version ||
+      ctx->bser_capabilities != ctx_.bser_capabilities) {
+    return -1;
+  }
+
+  // Mirror the shape produced by QueryContext::renderResults: a single
+  // field is a plain array of values, otherwise a template with the
+  // field names as its keys.
+  if (fieldList.size() == 1) {
+    if (w_bser_dump_array_header(ctx, numResults_, data)) {
+      return -1;
+    }
+  } else if (w_bser_dump_template_header(
+                 ctx,
+                 field_list_to_json_name_array(fieldList),
+                 numResults_,
+                 data)) {
+    return -1;
+  }
+
+  return ctx->dump(rows_.data(), rows_.size(), data);
+}
+
+} // namespace watchman
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+#include "watchman/Errors.h"
+#include "watchman/bser.h"
+
+namespace watchman {
+
+class FileResult;
+class QueryFieldList;
+struct QueryContext;
+
+/**
+ * Renders query results directly into a BSER encoded buffer.
+ *
+ * The usual path renders each matching file into a json object keyed by
+ * field name, holds all of those until the query completes, and then walks
+ * them again to encode the response.  For clients speaking BSER we instead
+ * encode each field value as soon as it is produced, as one row of a BSER
+ * template array, so that no per-file object is ever built.
+ *
+ * For a client that accepts BSER_CAP_ACCEPT_PREFIX_STRINGS, each string
+ * value is front-coded against the value of its field in the row before,
+ * which is usually the name of a file in the same directory.
+ *
+ * The encoding depends on the bser version and capabilities of the client,
+ * so the renderer must be created for the client that will receive the
+ * results, and the results must be sent with those same parameters.
+ */
+class BserResultsRenderer {
+ public:
+  BserResultsRenderer(uint32_t bserVersion, uint32_t bserCapabilities);
+
+  /**
+   * Appends the rendered fields of file as a new row.
+   * Returns false, leaving the buffer unchanged, if some of the data
+   * needed to render the fields has yet to be loaded.
+   */
+  bool render(
+      const QueryFieldList& fieldList,
+      FileResult* file,
+      const QueryContext* ctx);
+
+  /**
+   * Appends a row whose values are emitted by encode(ctx, buffer), for
+   * callers that produce them without a FileResult; see QueryKernel.
+   * encode returns non-zero if it fails, in which case the row is
+   * discarded and QueryExecError is thrown.
+   */
+  template <typename Encode>
+  void renderRow(Encode&& encode) {
+    auto rowStart = rows_.size();
+    if (encode(&ctx_, &rows_)) {
+      rows_.resize(rowStart);
+      throw QueryExecError("failed to encode a result as BSER");
+    }
+    ++numResults_;
+  }
+
+  /**
+   * Emits str, of the given type, as the value of the column'th field of
+   * the row that renderRow is encoding, front-coded against the value of
+   * that field in the row before it.
+   */
+  int dumpString(size_t column, w_string_piece str, w_string_type_t type);
+
+  // The number of rows rendered so far
+  size_t size() const {
+    return numResults_;
+  }
+
+  /**
+   * Emits the encoded results array via ctx->dump; the ctx must
+   * have the same version and capabilities as the renderer.
+   * Suitable for use as a bser_field_dump_t.
+   */
+  int dump(const QueryFieldList& fieldList, const bser_ctx_t* ctx, void* data)
+      const;
+
+  uint32_t bserVersion() const {
+    return ctx_.bser_version;
+  }
+  uint32_t bserCapabilities() const {
+    return ctx_.bser_capabilities;
+  }
+
+ private:
+  // Emits val as the value of the column'th field of the current row
+  int dumpValue(size_t column, const json_ref& val);
+
+  bser_ctx_t ctx_;
+  std::string rows_;
+  size_t numResults_{0};
+  // The string emitted for each field of the last row, if it was one that
+  // a BSER_PREFIX_STRING may follow
+  std::vector<std::optional<std::string>> prev_;
+  // The fields of the row being rendered
+  std::vector<json_ref> values_;
+};
+
+} // namespace watchman
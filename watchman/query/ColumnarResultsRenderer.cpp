@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/ColumnarResultsRenderer.h"
+#include <unordered_set>
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryContext.h"
+
+namespace watchman {
+
+ColumnarResultsRenderer::ColumnarResultsRenderer(
+    const QueryFieldList& fieldList) {
+  std::unordered_set<w_string> names;
+  for (auto& f : fieldList) {
+    if (!names.insert(f->name).second) {
+      continue;
+    }
+    if (f->name == "name") {
+      haveName_ = true;
+      dirColumn_ = json_array();
+      dirs_ = json_array();
+    }
+    columns_.push_back(Column{f, json_array()});
+  }
+}
+
+bool ColumnarResultsRenderer::render(
+    FileResult* file,
+    const QueryContext* ctx) {
+  std::vector<json_ref> row;
+  row.reserve(columns_.size());
+  w_string dirName;
+
+  for (auto& column : columns_) {
+    if (haveName_ && column.field->name == "name") {
+      auto wholeName = ctx->computeWholeName(file);
+      auto name = wholeName.view();
+      auto slash = name.rfind('/');
+      if (slash == std::string_view::npos) {
+        dirName = w_string{"", 0};
+        row.push_back(w_string_to_json(wholeName));
+      } else {
+        dirName = w_string{name.substr(0, slash)};
+        row.push_back(w_string_to_json(w_string{name.substr(slash + 1)}));
+      }
+      continue;
+    }
+
+    auto ele = column.field->make(file, ctx);
+    if (!ele.has_value()) {
+      // Need data to be loaded
+      return false;
+    }
+    row.push_back(std::move(ele.value()));
+  }
+
+  for (size_t i = 0; i < columns_.size(); ++i) {
+    json_array_append_new(columns_[i].values, std::move(row[i]));
+  }
+  if (haveName_) {
+    auto [it, inserted] =
+        dirIndex_.emplace(dirName, json_int_t(dirIndex_.size()));
+    if (inserted) {
+      json_array_append_new(dirs_, w_string_to_json(dirName));
+    }
+    json_array_append_new(dirColumn_, json_integer(it->second));
+  }
+
+  ++numResults_;
+  return true;
+}
+
+json_ref ColumnarResultsRenderer::takeResults() {
+  auto columns = json_object();
+  for (auto& column : columns_) {
+    columns.set(column.field->name, std::move(column.values));
+    column.values = json_array();
+  }
+
+  if (haveName_) {
+    columns.set("dir", std::move(dirColumn_));
+  }
+  auto results = json_object(
+      {{"num_files", json_integer(numResults_)},
+       {"columns", std::move(columns)}});
+  if (haveName_) {
+    results.set("dirs", std::move(dirs_));
+    dirColumn_ = json_array();
+    dirs_ = json_array();
+    dirIndex_.clear();
+  }
+  numResults_ = 0;
+  return results;
+}
+
+} // namespace watchman
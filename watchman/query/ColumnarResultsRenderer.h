@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+class FileResult;
+class QueryFieldList;
+struct QueryFieldRenderer;
+struct QueryContext;
+
+/**
+ * Renders query results as one array per field rather than one object per
+ * file, for the export-view command.
+ *
+ * Bulk consumers that pull every file in the view spend most of their time
+ * decoding the per-file objects, and most of the bytes on the repeated
+ * field names and directory prefixes.  Here each field name appears once,
+ * and the name field is split into a "name" column holding the basename and
+ * a "dir" column holding an index into a shared table of directory names.
+ */
+class ColumnarResultsRenderer {
+ public:
+  explicit ColumnarResultsRenderer(const QueryFieldList& fieldList);
+
+  /**
+   * Appends the fields of file to the columns.  Returns false, leaving the
+   * columns unchanged, if some of the data needed to render the fields has
+   * yet to be loaded.
+   */
+  bool render(FileResult* file, const QueryContext* ctx);
+
+  // The number of rows rendered so far
+  size_t size() const {
+    return numResults_;
+  }
+
+  /**
+   * Returns {"num_files", "columns"}, along with "dirs" if the name field
+   * was requested.  Consumes the rendered columns.
+   */
+  json_ref takeResults();
+
+ private:
+  struct Column {
+    const QueryFieldRenderer* field;
+    json_ref values;
+  };
+
+  // One per distinct field name, in the order of the field list
+  std::vector<Column> columns_;
+  // The name column and its companion, if the name field was requested
+  bool haveName_{false};
+  json_ref dirColumn_;
+  json_ref dirs_;
+  std::unordered_map<w_string, json_int_t> dirIndex_;
+  size_t numResults_{0};
+};
+
+} // namespace watchman
@@ -19,4 +19,8 @@ std::optional<DType> FileResult::dtype() {
   return statInfo->dtype();
 }
 
+std::optional<FileResult::ContentHash> FileResult::getContentFingerprint() {
+  return getContentSha1();
+}
+
 } // namespace watchman
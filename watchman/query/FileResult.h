@@ -15,6 +15,18 @@
 
 namespace watchman {
 
+// Counts, for a query that is being explained, how many of the symlink
+// targets and content hashes that batchFetchProperties() loaded were
+// already in the view's caches
+struct PropertyCacheStats {
+  struct Counts {
+    uint64_t hits{0};
+    uint64_t misses{0};
+  };
+  Counts symlinkTarget;
+  Counts contentSha1;
+};
+
 // A View-independent way of accessing file properties in the
 // query engine.  A FileResult is not intended to be accessed
 // concurrently from multiple threads and may be unsafe to
@@ -65,6 +77,12 @@ class FileResult {
   using ContentHash = std::array<uint8_t, 20>;
   virtual std::optional<ContentHash> getContentSha1() = 0;
 
+  // Returns a value that changes when the file does, at a cost that
+  // doesn't grow with the size of the file; see
+  // ContentHashCache::computeFingerprintImmediate.  The default is the
+  // SHA-1, for views where that is already cheap.
+  virtual std::optional<ContentHash> getContentFingerprint();
+
   // Maybe return the dtype.
   // Returns folly::none if the dtype is not currently known.
   // Returns DType::Unknown if we have dtype data but it doesn't
@@ -72,6 +90,14 @@ class FileResult {
   // on linux).
   virtual std::optional<DType> dtype();
 
+  // Returns a value that two results share only if they are for the same
+  // file, which lets the query dedup them without building their names,
+  // or nullptr if the view can't tell.  Only meaningful while the view is
+  // pinned; see QueryableView::pinResultIdentities.
+  virtual const void* identity() const {
+    return nullptr;
+  }
+
   // A bitset of Property values
   using Properties = uint_least16_t;
 
@@ -103,6 +129,8 @@ class FileResult {
     SymlinkTarget = 1 << 8,
     // Need full stat metadata
     FullFileInformation = 1 << 9,
+    // The getContentFingerprint() method will be called
+    ContentFingerprint = 1 << 10,
   };
 
   // Perform a batch fetch to fill in some missing data.
@@ -121,8 +149,11 @@ class FileResult {
   // batch.
   // The implementation of batchFetchProperties must clear
   // neededProperties_ to None.
+  // If cacheStats is set, the implementation counts its cache lookups
+  // there, if it has any caches.
   virtual void batchFetchProperties(
-      const std::vector<std::unique_ptr<FileResult>>& files) = 0;
+      const std::vector<std::unique_ptr<FileResult>>& files,
+      PropertyCacheStats* cacheStats) = 0;
 
  protected:
   // To be called by one of the FileResult accessors when it needs
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/GlobSet.h"
+#include <cstring>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+namespace watchman {
+
+namespace {
+
+// Characters that end a run of literal text in a pattern.  '/' is
+// included because wildmatch lets "**/" match nothing at all, and
+// collapses runs of slashes, so the text either side of a slash need
+// not appear verbatim in the subject.
+bool endsLiteral(char c) {
+  return strchr("*?[]\\/", c) != nullptr;
+}
+
+char lowerAscii(char c) {
+  return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+} // namespace
+
+std::string_view GlobSet::extensionOf(std::string_view name) {
+  auto dot = name.rfind('.');
+  return dot == std::string_view::npos ? std::string_view{} : name.substr(dot);
+}
+
+std::string GlobSet::foldCase(std::string_view str) const {
+  std::string result{str};
+  if (flags_ & WM_CASEFOLD) {
+    for (auto& c : result) {
+      c = lowerAscii(c);
+    }
+  }
+  return result;
+}
+
+void GlobSet::add(std::string_view pattern, size_t id) {
+  size_t prefixLen = 0;
+  while (prefixLen < pattern.size() && !endsLiteral(pattern[prefixLen])) {
+    ++prefixLen;
+  }
+
+  if (prefixLen == pattern.size()) {
+    // No wildcards: only an exact match will do
+    literals_[foldCase(pattern)].push_back(id);
+    return;
+  }
+
+  size_t suffixStart = pattern.size();
+  while (suffixStart > prefixLen && !endsLiteral(pattern[suffixStart - 1])) {
+    --suffixStart;
+  }
+
+  Pattern compiled{
+      std::string{pattern},
+      foldCase(pattern.substr(0, prefixLen)),
+      foldCase(pattern.substr(suffixStart)),
+      id,
+      classify(pattern, prefixLen, suffixStart),
+      {}};
+  if (compiled.shape == Shape::Contains) {
+    compiled.infix = std::string{pattern.substr(1, pattern.size() - 2)};
+  }
+
+  auto idx = uint32_t(patterns_.size());
+  auto ext = extensionOf(compiled.suffix);
+  if (ext.empty()) {
+    unindexed_.push_back(idx);
+  } else {
+    byExtension_[std::string{ext}].push_back(idx);
+  }
+  patterns_.push_back(std::move(compiled));
+}
+
+GlobSet::Shape GlobSet::classify(
+    std::string_view pattern,
+    size_t prefixLen,
+    size_t suffixStart) const {
+  auto isLiteral = [](std::string_view text) {
+    for (auto c : text) {
+      if (endsLiteral(c)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  if (pattern.size() == prefixLen + 1 && pattern.back() == '*') {
+    // "prefix*"
+    return Shape::Star;
+  }
+  if (prefixLen == 0 && suffixStart == 1 && pattern[0] == '*') {
+    // "*suffix", including "*" itself
+    return Shape::Star;
+  }
+  if (prefixLen == 0 && pattern.size() > 2 && pattern[0] == '*' &&
+      pattern.back() == '*' && !(flags_ & WM_CASEFOLD) &&
+      isLiteral(pattern.substr(1, pattern.size() - 2))) {
+    return Shape::Contains;
+  }
+  if ((flags_ & WM_PATHNAME) && prefixLen == 0 && suffixStart == 3 &&
+      suffixStart < pattern.size() && pattern.substr(0, 3) == "**/" &&
+      !((flags_ & WM_PERIOD) && pattern[3] == '.')) {
+    // A name that starts with a period would be exempt from the check
+    // for hidden dirs in wildmatch, so leave it to wildmatch
+    return Shape::AnyDir;
+  }
+  return Shape::Wild;
+}
+
+bool GlobSet::matches(const Pattern& pattern, std::string_view subject)
+    const {
+  auto& prefix = pattern.prefix;
+  auto& suffix = pattern.suffix;
+  if (subject.size() < prefix.size() || subject.size() < suffix.size()) {
+    return false;
+  }
+
+  bool fold = flags_ & WM_CASEFOLD;
+  auto sameText = [fold](const char* a, const std::string& b) {
+    if (!fold) {
+      return memcmp(a, b.data(), b.size()) == 0;
+    }
+    for (size_t i = 0; i < b.size(); ++i) {
+      if (lowerAscii(a[i]) != b[i]) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  if (!sameText(subject.data(), prefix) ||
+      !sameText(subject.data() + subject.size() - suffix.size(), suffix)) {
+    return false;
+  }
+
+  bool pathname = flags_ & WM_PATHNAME;
+  bool period = flags_ & WM_PERIOD;
+  switch (pattern.shape) {
+    case Shape::Wild:
+      break;
+    case Shape::Star:
+      // The literal text has no slash, so the star has to match any
+      return !(pathname && subject.find('/') != std::string_view::npos) &&
+          !(period && prefix.empty() && !subject.empty() && subject[0] == '.');
+    case Shape::Contains:
+      return subject.find(pattern.infix) != std::string_view::npos &&
+          !(pathname && subject.find('/') != std::string_view::npos) &&
+          !(period && subject[0] == '.');
+    case Shape::AnyDir:
+      if (subject.size() == suffix.size()) {
+        return true;
+      }
+      return subject[subject.size() - suffix.size() - 1] == '/' &&
+          !(period &&
+            (subject[0] == '.' ||
+             subject.find("/.") != std::string_view::npos));
+  }
+
+  return wildmatch(pattern.pattern.c_str(), subject.data(), flags_, 0) ==
+      WM_MATCH;
+}
+
+} // namespace watchman
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * A set of wildmatch patterns that can be matched against a name in one
+ * pass, rather than by calling wildmatch once for each pattern.
+ *
+ * Patterns without wildcards are kept in a hash table.  The others are
+ * bucketed by the extension of the literal text that they must end with,
+ * so that a name is only handed to wildmatch for the patterns that could
+ * plausibly match it, and each of those is first checked against the
+ * literal prefix and suffix that the pattern requires.  The common shapes
+ * of pattern, such as "*.ext", "prefix*" or a name under any dir, are
+ * decided by those checks alone; only the rest are handed to wildmatch.
+ */
+class GlobSet {
+ public:
+  // flags are the wildmatch flags that every pattern is matched with
+  explicit GlobSet(int flags = 0) : flags_(flags) {}
+
+  // Adds pattern to the set; id is what forEachMatch reports for it
+  void add(std::string_view pattern, size_t id);
+
+  bool empty() const {
+    return patterns_.empty();
+  }
+
+  // Calls func(id) for each pattern that matches subject, in no particular
+  // order, until func returns false.  subject must be NUL terminated.
+  template <typename Func>
+  void forEachMatch(std::string_view subject, Func&& func) const {
+    if (!literals_.empty()) {
+      auto it = literals_.find(foldCase(subject));
+      if (it != literals_.end()) {
+        for (auto id : it->second) {
+          if (!func(id)) {
+            return;
+          }
+        }
+      }
+    }
+    if (!byExtension_.empty()) {
+      auto it = byExtension_.find(foldCase(extensionOf(subject)));
+      if (it != byExtension_.end()) {
+        for (auto idx : it->second) {
+          if (matches(patterns_[idx], subject) && !func(patterns_[idx].id)) {
+            return;
+          }
+        }
+      }
+    }
+    for (auto idx : unindexed_) {
+      if (matches(patterns_[idx], subject) && !func(patterns_[idx].id)) {
+        return;
+      }
+    }
+  }
+
+  // Returns true if any pattern matches subject
+  bool matchesAny(std::string_view subject) const {
+    bool matched = false;
+    forEachMatch(subject, [&](size_t) {
+      matched = true;
+      return false;
+    });
+    return matched;
+  }
+
+ private:
+  // How a pattern is matched once its prefix and suffix have been checked
+  enum class Shape : uint8_t {
+    // Run wildmatch
+    Wild,
+    // "*suffix" or "prefix*": the star must not have to match a slash
+    // with WM_PATHNAME, nor a leading period with WM_PERIOD
+    Star,
+    // "*text*", case sensitive: the subject must also contain the text
+    Contains,
+    // "**/name" with WM_PATHNAME: the suffix must be a whole component
+    // that isn't under a hidden dir with WM_PERIOD
+    AnyDir,
+  };
+
+  struct Pattern {
+    std::string pattern;
+    // Literal text that any matching subject must begin and end with
+    std::string prefix;
+    std::string suffix;
+    size_t id;
+    Shape shape;
+    // The text for Shape::Contains
+    std::string infix;
+  };
+
+  static std::string_view extensionOf(std::string_view name);
+  Shape classify(
+      std::string_view pattern,
+      size_t prefixLen,
+      size_t suffixStart) const;
+  std::string foldCase(std::string_view str) const;
+  bool matches(const Pattern& pattern, std::string_view subject) const;
+
+  int flags_;
+  std::vector<Pattern> patterns_;
+  std::unordered_map<std::string, std::vector<size_t>> literals_;
+  // Indices into patterns_, keyed by the extension that the pattern's
+  // suffix ends with
+  std::unordered_map<std::string, std::vector<uint32_t>> byExtension_;
+  std::vector<uint32_t> unindexed_;
+};
+
+} // namespace watchman
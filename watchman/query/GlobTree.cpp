@@ -8,6 +8,7 @@
 #include "watchman/query/GlobTree.h"
 #include <folly/Conv.h>
 #include <folly/Range.h>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
 
 namespace watchman {
 
@@ -17,6 +18,28 @@ GlobTree::GlobTree(const char* pattern, uint32_t pattern_len)
       had_specials(0),
       is_doublestar(0) {}
 
+void GlobTree::compile(int flags, bool case_sensitive) {
+  dir_matcher = GlobSet{flags};
+  file_matcher = GlobSet{flags};
+  doublestar_matcher = GlobSet{flags | WM_PATHNAME};
+
+  for (size_t i = 0; i < children.size(); ++i) {
+    auto& child = children[i];
+    // Case sensitive literals are looked up directly by name instead
+    if (child->had_specials || !case_sensitive) {
+      dir_matcher.add(child->pattern, i);
+      if (child->is_leaf) {
+        file_matcher.add(child->pattern, i);
+      }
+    }
+    child->compile(flags, case_sensitive);
+  }
+
+  for (size_t i = 0; i < doublestar_children.size(); ++i) {
+    doublestar_matcher.add(doublestar_children[i]->pattern, i);
+  }
+}
+
 std::vector<std::string> GlobTree::unparse() const {
   std::vector<std::string> result;
   unparse_into(result, "");
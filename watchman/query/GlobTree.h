@@ -10,6 +10,7 @@
 #include <memory>
 #include <string>
 #include <vector>
+#include "watchman/query/GlobSet.h"
 
 namespace watchman {
 
@@ -28,8 +29,22 @@ struct GlobTree {
   unsigned had_specials : 1; // if false, can do simple string compare
   unsigned is_doublestar : 1; // pattern begins with **
 
+  // Built by compile(); these match the names in a directory against all
+  // of the children that can't be found by a direct lookup, in one pass.
+  // The ids that they report are indices into children.
+  GlobSet dir_matcher;
+  GlobSet file_matcher;
+  // Likewise over the doublestar_children
+  GlobSet doublestar_matcher;
+
   GlobTree(const char* pattern, uint32_t pattern_len);
 
+  // Prepares the matchers for this node and its descendants.  Must be
+  // called once all of the globs have been added to the tree.
+  // flags are the wildmatch flags to match with, including WM_CASEFOLD
+  // for case insensitive queries.
+  void compile(int flags, bool case_sensitive);
+
   // Produces a list of globs from the glob tree, effectively
   // performing the reverse of the original parsing operation.
   std::vector<std::string> unparse() const;
@@ -6,10 +6,23 @@
  */
 
 #include "watchman/query/LocalFileResult.h"
+#include <unordered_map>
 #include "watchman/ContentHash.h"
 
 namespace watchman {
 
+namespace {
+// The properties that are loaded by stat()ing the file.  Reading a symlink
+// target needs the stat too, to tell whether the file is a symlink at all.
+constexpr FileResult::Properties kStatProperties = FileResult::FileDType |
+    FileResult::Exists | FileResult::Size | FileResult::StatTimeStamps |
+    FileResult::FullFileInformation | FileResult::SymlinkTarget;
+
+// Listing a dir costs about as much as a few stat() calls, but it yields the
+// type of every entry, so it only pays off for a good share of the dir.
+constexpr size_t kMinFilesForDirListing = 16;
+} // namespace
+
 LocalFileResult::LocalFileResult(
     w_string fullPath,
     w_clock_t clock,
@@ -48,6 +61,17 @@ std::optional<size_t> LocalFileResult::size() {
   return info_->size;
 }
 
+std::optional<DType> LocalFileResult::dtype() {
+  if (dtype_ != DType::Unknown) {
+    return dtype_;
+  }
+  if (!info_.has_value()) {
+    accessorNeedsProperties(FileResult::Property::FileDType);
+    return std::nullopt;
+  }
+  return info_->dtype();
+}
+
 std::optional<struct timespec> LocalFileResult::accessedTime() {
   if (!info_.has_value()) {
     accessorNeedsProperties(FileResult::Property::StatTimeStamps);
@@ -112,11 +136,117 @@ std::optional<FileResult::ContentHash> LocalFileResult::getContentSha1() {
   return contentSha1_.value();
 }
 
-void LocalFileResult::batchFetchProperties(
+std::optional<FileResult::ContentHash>
+LocalFileResult::getContentFingerprint() {
+  if (contentFingerprint_.empty()) {
+    // The fingerprint covers the metadata too
+    accessorNeedsProperties(
+        FileResult::Property::ContentFingerprint |
+        FileResult::Property::FullFileInformation);
+    return std::nullopt;
+  }
+  return contentFingerprint_.value();
+}
+
+bool LocalFileResult::needsStat() const {
+  auto needed = neededProperties() & kStatProperties;
+  if (dtype_ != DType::Unknown) {
+    needed &= ~FileResult::Property::FileDType;
+  }
+  return needed && !info_.has_value();
+}
+
+void LocalFileResult::getDTypesByDir(
+    const std::vector<std::unique_ptr<FileResult>>& files) {
+  std::unordered_map<w_string_piece, std::vector<LocalFileResult*>> byDir;
+  for (auto& f : files) {
+    auto localFile = dynamic_cast<LocalFileResult*>(f.get());
+    if (!localFile->info_.has_value() &&
+        (localFile->neededProperties() & kStatProperties) ==
+            FileResult::Property::FileDType) {
+      byDir[localFile->dirName()].push_back(localFile);
+    }
+  }
+
+  for (auto& [dir, dirFiles] : byDir) {
+    if (dirFiles.size() < kMinFilesForDirListing) {
+      continue;
+    }
+    std::vector<w_string_piece> names;
+    names.reserve(dirFiles.size());
+    for (auto* file : dirFiles) {
+      names.push_back(file->baseName());
+    }
+
+    std::vector<DType> dtypes;
+    try {
+      dtypes = getDTypesInDir(dir.asWString().c_str(), names);
+    } catch (const std::exception&) {
+      // Leave these to getInfo, which deals with the error
+      continue;
+    }
+    for (size_t i = 0; i < dirFiles.size(); ++i) {
+      // Those the listing couldn't type are stat()ed as usual
+      dirFiles[i]->dtype_ = dtypes[i];
+    }
+  }
+}
+
+void LocalFileResult::getInfoByDir(
     const std::vector<std::unique_ptr<FileResult>>& files) {
+  std::unordered_map<w_string_piece, std::vector<LocalFileResult*>> byDir;
   for (auto& f : files) {
     auto localFile = dynamic_cast<LocalFileResult*>(f.get());
-    localFile->getInfo();
+    if (localFile->needsStat()) {
+      byDir[localFile->dirName()].push_back(localFile);
+    }
+  }
+
+  for (auto& [dir, dirFiles] : byDir) {
+    if (dirFiles.size() < 2) {
+      continue;
+    }
+    std::vector<w_string_piece> names;
+    names.reserve(dirFiles.size());
+    for (auto* file : dirFiles) {
+      names.push_back(file->baseName());
+    }
+
+    std::vector<std::optional<FileInformation>> infos;
+    try {
+      infos = getFileInformationInDir(
+          dir.asWString().c_str(), names, dirFiles.front()->caseSensitivity_);
+    } catch (const std::exception&) {
+      // Leave these to getInfo, which deals with the error
+      continue;
+    }
+    for (size_t i = 0; i < dirFiles.size(); ++i) {
+      auto* file = dirFiles[i];
+      if (infos[i]) {
+        file->exists_ = true;
+        file->info_ = std::move(infos[i]);
+      } else {
+        // Treat any error as effectively deleted, as getInfo does
+        file->exists_ = false;
+        file->info_ = FileInformation::makeDeletedFileInformation();
+      }
+    }
+  }
+}
+
+void LocalFileResult::batchFetchProperties(
+    const std::vector<std::unique_ptr<FileResult>>& files,
+    PropertyCacheStats*) {
+  getDTypesByDir(files);
+  getInfoByDir(files);
+  for (auto& f : files) {
+    auto localFile = dynamic_cast<LocalFileResult*>(f.get());
+    // The content hash alone doesn't need a stat: hashing a missing file or
+    // a dir fails, and make_sha1_hex reports that as a null hash just as it
+    // would have done after the stat.
+    if (localFile->needsStat()) {
+      localFile->getInfo();
+    }
 
     if (localFile->neededProperties() & FileResult::Property::SymlinkTarget) {
       if (!localFile->info_->isSymlink()) {
@@ -140,6 +270,16 @@ void LocalFileResult::batchFetchProperties(
       });
     }
 
+    if (localFile->neededProperties() &
+        FileResult::Property::ContentFingerprint) {
+      // As above, a missing file or a dir fails to hash and is reported
+      // as having no fingerprint
+      localFile->contentFingerprint_ = makeResultWith([&] {
+        return ContentHashCache::computeFingerprintImmediate(
+            localFile->fullPath_.c_str(), *localFile->info_);
+      });
+    }
+
     localFile->clearNeededProperties();
   }
 }
@@ -44,6 +44,9 @@ class LocalFileResult : public FileResult {
   std::optional<struct timespec> modifiedTime() override;
   std::optional<struct timespec> changedTime() override;
   std::optional<size_t> size() override;
+  // Returns the type of the file, which may have come from a listing of
+  // its dir rather than from stat()ing it
+  std::optional<DType> dtype() override;
 
   // Returns the name of the file in its containing dir
   w_string_piece baseName() override;
@@ -60,21 +63,36 @@ class LocalFileResult : public FileResult {
 
   // Returns the SHA-1 hash of the file contents
   std::optional<FileResult::ContentHash> getContentSha1() override;
+  std::optional<FileResult::ContentHash> getContentFingerprint() override;
 
   void batchFetchProperties(
-      const std::vector<std::unique_ptr<FileResult>>& files) override;
+      const std::vector<std::unique_ptr<FileResult>>& files,
+      PropertyCacheStats* cacheStats) override;
 
  private:
   void getInfo();
+  // Fills in info_ for those of files that don't have it yet, resolving
+  // each containing dir only once
+  static void getInfoByDir(
+      const std::vector<std::unique_ptr<FileResult>>& files);
+  // Fills in dtype_ for those of files that need nothing but their type,
+  // from a listing of each dir that holds enough of them
+  static void getDTypesByDir(
+      const std::vector<std::unique_ptr<FileResult>>& files);
+  // Returns true if satisfying the needed properties requires a stat
+  bool needsStat() const;
   w_string getFullPath();
 
   bool exists_{true};
   std::optional<FileInformation> info_;
+  // Known without info_ when the dir listing reported it
+  DType dtype_{DType::Unknown};
   w_string fullPath_;
   w_clock_t clock_;
   CaseSensitivity caseSensitivity_;
   std::optional<w_string> symlinkTarget_;
   Result<FileResult::ContentHash> contentSha1_;
+  Result<FileResult::ContentHash> contentFingerprint_;
 };
 
 } // namespace watchman
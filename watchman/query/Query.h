@@ -7,9 +7,15 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <limits>
 #include <optional>
 #include "watchman/Clock.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/query/FileResult.h"
+#include "watchman/query/QueryKernel.h"
+#include "watchman/query/ResultOrder.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 
@@ -23,6 +29,8 @@ class QueryExpr;
 struct QueryFieldRenderer {
   w_string name;
   std::optional<json_ref> (*make)(FileResult* file, const QueryContext* ctx);
+  // The FileResult properties that make uses
+  FileResult::Properties properties;
 };
 
 class QueryFieldList : public std::vector<QueryFieldRenderer*> {
@@ -33,6 +41,11 @@ class QueryFieldList : public std::vector<QueryFieldRenderer*> {
    * Throws QueryParseError if the name is invalid.
    */
   void add(const w_string& name);
+
+  /**
+   * Returns the FileResult properties that rendering these fields uses.
+   */
+  FileResult::Properties neededProperties() const;
 };
 
 struct QueryPath {
@@ -40,12 +53,24 @@ struct QueryPath {
   int depth;
 };
 
+// What the matching files of a query are grouped by, if anything, when
+// only their totals are wanted
+struct QueryAggregate {
+  enum class GroupBy : uint8_t { None, Suffix, Type, Dir };
+
+  GroupBy groupBy{GroupBy::None};
+};
+
 struct Query {
   CaseSensitivity case_sensitive = CaseSensitivity::CaseInSensitive;
   bool fail_if_no_saved_state = false;
   bool empty_on_fresh_instance = false;
   bool omit_changed_files = false;
   bool dedup_results = false;
+  // Set along with dedup_results when the names of the results are wanted
+  // in QueryResult::dedupedFileNames, so they can't be told apart by their
+  // FileResult::identity instead
+  bool dedup_by_name = false;
   uint32_t bench_iterations = 0;
 
   /**
@@ -89,6 +114,40 @@ struct Query {
 
   std::unique_ptr<QueryExpr> expr;
 
+  /**
+   * Populated by the query planner from the expression.  When no other
+   * generator applies, these allow the query to visit only the named files,
+   * the subtree, or the files with one of the suffixes, that the expression
+   * requires.
+   */
+  std::optional<std::vector<w_string>> plannedWholeNames;
+  bool plannedWholeNamesCaseless = false;
+  std::optional<w_string> plannedDirName;
+  // How many levels of directories beneath plannedDirName need walking
+  uint32_t plannedDirDepth = std::numeric_limits<uint32_t>::max();
+  std::optional<std::vector<w_string>> plannedSuffixes;
+  // Whether the expression can rule out the files of a directory, or its
+  // subtree, from the path of the directory alone
+  bool plannedDirVerdicts = false;
+
+  // Set if the query has a shape that a specialized loop can evaluate
+  std::optional<QueryKernel> kernel;
+
+  /**
+   * Set if the client asked for an account of how the query produced its
+   * results; see QueryExplain.
+   */
+  bool explain{false};
+
+  struct ExplainedTerm {
+    const char* name;
+    // How many terms this one is nested within
+    uint32_t depth;
+  };
+  // When explaining, the terms of expr, each followed by those that it is
+  // made of
+  std::vector<ExplainedTerm> explainedTerms;
+
   // The query that we parsed into this struct
   json_ref query_spec;
 
@@ -100,6 +159,69 @@ struct Query {
 
   bool alwaysIncludeDirectories{false};
 
+  /**
+   * If non-zero, the client asked for the results to be sent in chunks of
+   * this many files as they are produced, rather than in a single response.
+   * Only honored by the query command.
+   */
+  uint32_t streamResultsChunkSize{0};
+
+  /**
+   * Files whose fields need data to be loaded, such as content.sha1hex,
+   * are fetched in batches of up to this many files.
+   */
+  uint32_t renderBatchSize{1024};
+
+  /**
+   * If non-zero, a partially filled render batch is also fetched once its
+   * oldest file has waited this long, so that the results for early
+   * matches can be rendered (and streamed) while the generators continue.
+   */
+  std::chrono::milliseconds renderBatchDeadline{0};
+
+  /**
+   * If set, the query doesn't sync if a full sync that has finished, or
+   * that is in flight, leaves the view at most this far behind.
+   */
+  std::optional<std::chrono::milliseconds> maxStaleness;
+
+  /**
+   * If non-zero, the query is abandoned with an error once it has run for
+   * this long, rather than holding the view while it runs to completion.
+   */
+  std::chrono::milliseconds deadline{0};
+
+  /**
+   * If set, returns true once the client that issued the query has gone
+   * away, in which case the query is abandoned.  Set by the commands that
+   * execute a query while their client waits for the response.
+   */
+  std::function<bool()> clientGone;
+
+  /**
+   * Set if the results are to be sorted, which they are if the client
+   * asked for an order_by, a limit or a continuation.  Ordered results are
+   * always rendered into a single response.
+   */
+  std::optional<ResultOrder> orderBy;
+  // If non-zero, only this many of the ordered results are returned
+  uint32_t limit{0};
+  // Only the ordered results after this position are returned
+  std::optional<ResultPosition> continuation;
+
+  // Returns true if the query asks for only the most recently changed files,
+  // which are those at the start of the view's recency list
+  bool limitedToMostRecent() const {
+    return limit > 0 && orderBy && orderBy->key == ResultOrder::Key::OTime &&
+        orderBy->descending;
+  }
+
+  /**
+   * Set if the client asked for the totals of the matching files rather
+   * than the files themselves; see AggregateResultsRenderer.
+   */
+  std::optional<QueryAggregate> aggregate;
+
   ~Query();
 
   /** Returns true if the supplied name is contained in
@@ -7,6 +7,12 @@
 
 #include "watchman/query/QueryContext.h"
 
+#include <algorithm>
+#include "watchman/Errors.h"
+#include "watchman/QueryableView.h"
+#include "watchman/Shutdown.h"
+#include "watchman/TraceRecorder.h"
+#include "watchman/Tracing.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/eval.h"
 #include "watchman/query/parse.h"
@@ -17,15 +23,29 @@ using namespace watchman;
 
 namespace {
 
-constexpr size_t kMaximumRenderBatchSize = 1024;
-
 std::optional<json_ref> file_result_to_json(
     const QueryFieldList& fieldList,
     const std::unique_ptr<FileResult>& file,
-    const QueryContext* ctx) {
+    const QueryContext* ctx,
+    const json_ref& recordKeys) {
   if (fieldList.size() == 1) {
     return fieldList.front()->make(file.get(), ctx);
   }
+
+  if (recordKeys) {
+    std::vector<json_ref> values;
+    values.reserve(fieldList.size());
+    for (auto& f : fieldList) {
+      auto ele = f->make(file.get(), ctx);
+      if (!ele.has_value()) {
+        // Need data to be loaded
+        return std::nullopt;
+      }
+      values.push_back(std::move(ele.value()));
+    }
+    return json_record(recordKeys, std::move(values));
+  }
+
   auto value = json_object_of_size(fieldList.size());
 
   for (auto& f : fieldList) {
@@ -41,18 +61,64 @@ std::optional<json_ref> file_result_to_json(
 
 } // namespace
 
+void QueryContext::generationStarted() {
+  viewLockWaitDuration = stopWatch.lap();
+  ThreadStats::addWait(viewLockWaitDuration.load());
+  setState(QueryContextState::Generating);
+  // The view may have changed while it was unlocked
+  lastDir_ = nullptr;
+  lastDirPath_.reset();
+  // The view is locked, so this is before any of the results are made
+  if (query->dedup_results && !query->dedup_by_name && !identityPin) {
+    identityPin = root->view()->pinResultIdentities();
+  }
+}
+
 void QueryContext::resetWholeName() {
-  wholename_.reset();
+  haveWholename_ = false;
 }
 
-const w_string& QueryContext::getWholeName() {
-  if (!wholename_) {
-    wholename_ = computeWholeName(file.get());
+w_string_piece QueryContext::getWholeName() {
+  if (!haveWholename_) {
+    auto parent = computeWholeNameDirName(file.get());
+    auto base = file->baseName();
+    wholename_.clear();
+    if (!parent.empty()) {
+      wholename_.append(parent.data(), parent.size());
+      wholename_.push_back('/');
+    }
+    wholename_.append(base.data(), base.size());
+    haveWholename_ = true;
   }
-  return wholename_;
+  return w_string_piece(wholename_.data(), wholename_.size());
 }
 
-w_string QueryContext::computeWholeName(FileResult* file) const {
+w_string_piece QueryContext::getWholeName(const watchman_file* file) {
+  // The buffer no longer holds the name of the current file
+  haveWholename_ = false;
+
+  const auto& base = query->relative_root ? query->relative_root
+                                          : root->root_path;
+  w_string_piece parent = getDirFullPath(file->parent);
+  auto name = file->getName();
+  wholename_.clear();
+  // As computeWholeNameDirName does
+  if (base.size() + 1 <= parent.size()) {
+    parent.advance(base.size() + 1);
+    if (!parent.empty()) {
+      wholename_.append(parent.data(), parent.size());
+      wholename_.push_back('/');
+    }
+  }
+  wholename_.append(name.data(), name.size());
+  return w_string_piece(wholename_.data(), wholename_.size());
+}
+
+w_string_piece QueryContext::getWholeNameDirName() {
+  return computeWholeNameDirName(file.get());
+}
+
+w_string_piece QueryContext::computeWholeNameDirName(FileResult* file) const {
   uint32_t name_start;
 
   if (query->relative_root) {
@@ -66,9 +132,17 @@ w_string QueryContext::computeWholeName(FileResult* file) const {
   // Record the name relative to the root
   auto parent = file->dirName();
   if (name_start > parent.size()) {
-    return file->baseName().asWString();
+    return w_string_piece();
   }
   parent.advance(name_start);
+  return parent;
+}
+
+w_string QueryContext::computeWholeName(FileResult* file) const {
+  auto parent = computeWholeNameDirName(file);
+  if (parent.empty()) {
+    return file->baseName().asWString();
+  }
   return w_string::build(parent, "/", file->baseName());
 }
 
@@ -101,7 +175,36 @@ bool QueryContext::fileMatchesRelativeRoot(const watchman_file* f) {
     return true;
   }
 
-  return dirMatchesRelativeRoot(f->parent->getFullPath());
+  return dirMatchesRelativeRoot(getDirFullPath(f->parent));
+}
+
+const w_string& QueryContext::getDirFullPath(const watchman_dir* dir) {
+  if (dir != lastDir_) {
+    lastDirPath_ = dir->getFullPath();
+    lastDir_ = dir;
+  }
+  return lastDirPath_;
+}
+
+const w_string& QueryContext::getCachedDirFullPath(
+    const watchman_dir* dir) const {
+  static const w_string kNull;
+  return dir == lastDir_ ? lastDirPath_ : kNull;
+}
+
+DirVerdict QueryContext::evaluateDir(const watchman_dir* dir) {
+  if (!query->plannedDirVerdicts) {
+    return {};
+  }
+  const auto& base = query->relative_root ? query->relative_root
+                                          : root->root_path;
+  w_string_piece path = getDirFullPath(dir);
+  if (path.size() <= base.size()) {
+    path = w_string_piece();
+  } else {
+    path.advance(base.size() + 1);
+  }
+  return query->expr->evaluateDir(path);
 }
 
 QueryContext::QueryContext(
@@ -111,7 +214,71 @@ QueryContext::QueryContext(
     : created(std::chrono::steady_clock::now()),
       query(q),
       root(root),
-      disableFreshInstance{disableFreshInstance} {}
+      disableFreshInstance{disableFreshInstance} {
+  if (TraceRecorder::get().enabled()) {
+    stateEntered_ = created;
+  }
+
+  // Every FileResult knows its name and clocks without fetching anything
+  auto fetched = q->fieldList.neededProperties() &
+      ~(FileResult::Name | FileResult::CTime | FileResult::OTime);
+  probeFieldsOnMiss_ = (fetched & (fetched - 1)) != 0;
+}
+
+const char* watchman::queryContextStateName(QueryContextState state) {
+  switch (state) {
+    case QueryContextState::NotStarted:
+      return "NotStarted";
+    case QueryContextState::WaitingForCookieSync:
+      return "WaitingForCookieSync";
+    case QueryContextState::WaitingForCrawl:
+      return "WaitingForCrawl";
+    case QueryContextState::WaitingForViewLock:
+      return "WaitingForViewLock";
+    case QueryContextState::Generating:
+      return "Generating";
+    case QueryContextState::Rendering:
+      return "Rendering";
+    case QueryContextState::Completed:
+      return "Completed";
+  }
+  return "?";
+}
+
+void QueryContext::setState(QueryContextState newState) {
+  auto oldState = state.exchange(newState);
+  WATCHMAN_TRACE(query_state, this, int(newState));
+
+  auto& recorder = TraceRecorder::get();
+  if (!recorder.enabled()) {
+    stateEntered_.reset();
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (stateEntered_) {
+    recorder.record(
+        "query",
+        queryContextStateName(oldState),
+        root->root_path,
+        *stateEntered_,
+        now);
+  }
+  stateEntered_ = now;
+}
+
+void QueryContext::throwIfCancelled() const {
+  if (w_is_stopping()) {
+    throw QueryCancelledError("the server is shutting down");
+  }
+  if (query->deadline.count() > 0 &&
+      std::chrono::steady_clock::now() - created >= query->deadline) {
+    throw QueryCancelledError(
+        "query_deadline_ms of ", query->deadline.count(), " expired");
+  }
+  if (query->clientGone && query->clientGone()) {
+    throw QueryCancelledError("the client hung up");
+  }
+}
 
 void QueryContext::addToEvalBatch(std::unique_ptr<FileResult>&& file) {
   evalBatch_.emplace_back(std::move(file));
@@ -128,7 +295,12 @@ void QueryContext::fetchEvalBatchNow() {
   if (evalBatch_.empty()) {
     return;
   }
-  evalBatch_.front()->batchFetchProperties(evalBatch_);
+  throwIfCancelled();
+  if (explain) {
+    explain->noteBatchFetch(explain->evalFetches, evalBatch_);
+  }
+  evalBatch_.front()->batchFetchProperties(
+      evalBatch_, explain ? &explain->caches : nullptr);
 
   auto toProcess = std::move(evalBatch_);
 
@@ -139,35 +311,210 @@ void QueryContext::fetchEvalBatchNow() {
   w_assert(evalBatch_.empty(), "should have no files that NeedDataLoad");
 }
 
+void QueryContext::deferEvaluation(std::unique_ptr<FileResult>&& file) {
+  deferred_.emplace_back(std::move(file));
+}
+
+void QueryContext::evaluateDeferredNow() {
+  auto toProcess = std::move(deferred_);
+  deferred_.clear();
+
+  for (auto& file : toProcess) {
+    w_query_process_file(query, this, std::move(file));
+  }
+}
+
 json_ref QueryContext::renderResults() {
   // build a template for the serializer
   auto results = json_array();
   if (query->fieldList.size() > 1) {
+    // Sharing the record keys lets the BSER encoder emit record values
+    // without looking them up by name
     json_array_set_template_new(
-        results, field_list_to_json_name_array(query->fieldList));
+        results,
+        recordKeys_ ? json_ref(recordKeys_)
+                    : field_list_to_json_name_array(query->fieldList));
   }
 
   for (auto& result : resultsArray) {
     json_array_append_new(results, std::move(result));
   }
+  resultsArray.clear();
 
   return results;
 }
 
-void QueryContext::maybeRender(std::unique_ptr<FileResult>&& file) {
-  auto maybeRendered = file_result_to_json(query->fieldList, file, this);
-  if (maybeRendered.has_value()) {
-    resultsArray.push_back(std::move(maybeRendered.value()));
+std::optional<ResultPosition> QueryContext::orderedPosition(FileResult* file) {
+  ResultPosition position;
+  switch (query->orderBy->key) {
+    case ResultOrder::Key::Name:
+      break;
+    case ResultOrder::Key::MTime: {
+      auto mtime = file->modifiedTime();
+      if (!mtime) {
+        return std::nullopt;
+      }
+      position.value = int64_t(mtime->tv_sec) * 1000000000 + mtime->tv_nsec;
+      break;
+    }
+    case ResultOrder::Key::Size: {
+      auto size = file->size();
+      if (!size) {
+        return std::nullopt;
+      }
+      position.value = int64_t(*size);
+      break;
+    }
+    case ResultOrder::Key::OTime: {
+      auto otime = file->otime();
+      if (!otime) {
+        return std::nullopt;
+      }
+      position.value = otime->ticks;
+      break;
+    }
+  }
+  position.name = computeWholeName(file);
+  return position;
+}
+
+void QueryContext::trimOrderedResults() {
+  if (orderedResults_.size() <= query->limit) {
     return;
   }
+  auto& order = *query->orderBy;
+  std::nth_element(
+      orderedResults_.begin(),
+      orderedResults_.begin() + query->limit,
+      orderedResults_.end(),
+      [&](const OrderedResult& a, const OrderedResult& b) {
+        return order.before(a.position, b.position);
+      });
+  orderedResults_.resize(query->limit);
+  droppedOrderedResults_ = true;
+}
 
-  addToRenderBatch(std::move(file));
+bool QueryContext::haveEnoughResults() const {
+  return query->limitedToMostRecent() &&
+      (droppedOrderedResults_ || orderedResults_.size() > query->limit);
+}
+
+w_string QueryContext::finishOrderedResults() {
+  if (query->limit > 0) {
+    trimOrderedResults();
+  }
+  auto& order = *query->orderBy;
+  std::sort(
+      orderedResults_.begin(),
+      orderedResults_.end(),
+      [&](const OrderedResult& a, const OrderedResult& b) {
+        return order.before(a.position, b.position);
+      });
+
+  w_string continuation;
+  if (droppedOrderedResults_ && !orderedResults_.empty()) {
+    continuation = order.encodeContinuation(orderedResults_.back().position);
+  }
+  for (auto& result : orderedResults_) {
+    resultsArray.push_back(std::move(result.rendered));
+  }
+  orderedResults_.clear();
+  return continuation;
+}
+
+const json_ref& QueryContext::recordKeys() {
+  if (!recordKeysComputed_) {
+    recordKeysComputed_ = true;
+    // Records can't represent a field list that names a field twice,
+    // as objects keep only the last value for each name
+    std::unordered_set<w_string> names;
+    for (auto& f : query->fieldList) {
+      if (!names.insert(f->name).second) {
+        return recordKeys_;
+      }
+    }
+    recordKeys_ = field_list_to_json_name_array(query->fieldList);
+  }
+  return recordKeys_;
+}
+
+void QueryContext::maybeStreamResults() {
+  if (!resultsSink || resultsArray.size() < query->streamResultsChunkSize) {
+    return;
+  }
+  numStreamed_ += resultsArray.size();
+  resultsSink(renderResults());
+}
+
+bool QueryContext::renderFile(const std::unique_ptr<FileResult>& file) {
+  if (bserResults) {
+    return bserResults->render(query->fieldList, file.get(), this);
+  }
+  if (columnarResults) {
+    return columnarResults->render(file.get(), this);
+  }
+  if (aggregateResults) {
+    return aggregateResults->render(file.get(), this);
+  }
+
+  std::optional<ResultPosition> position;
+  if (query->orderBy) {
+    position = orderedPosition(file.get());
+    if (!position) {
+      return false;
+    }
+    if (query->continuation &&
+        !query->orderBy->before(*query->continuation, *position)) {
+      // An earlier page held this one
+      return true;
+    }
+  }
+
+  auto maybeRendered =
+      file_result_to_json(query->fieldList, file, this, recordKeys());
+  if (!maybeRendered.has_value()) {
+    return false;
+  }
+  if (position) {
+    orderedResults_.push_back(
+        OrderedResult{std::move(*position), std::move(*maybeRendered)});
+    // Keep no more than about twice the limit, however many files match
+    if (query->limit > 0 &&
+        orderedResults_.size() >= 2 * size_t(query->limit)) {
+      trimOrderedResults();
+    }
+    return true;
+  }
+  resultsArray.push_back(std::move(maybeRendered.value()));
+  maybeStreamResults();
+  return true;
+}
+
+void QueryContext::maybeRender(std::unique_ptr<FileResult>&& file) {
+  if (!renderFile(file)) {
+    noteMissingRenderData(file.get());
+    addToRenderBatch(std::move(file));
+  }
+}
+
+void QueryContext::noteMissingRenderData(FileResult* file) {
+  if (!probeFieldsOnMiss_) {
+    return;
+  }
+  for (auto& f : query->fieldList) {
+    f->make(file, this);
+  }
 }
 
 void QueryContext::addToRenderBatch(std::unique_ptr<FileResult>&& file) {
+  auto now = std::chrono::steady_clock::now();
+  if (renderBatch_.empty()) {
+    renderBatchStarted_ = now;
+  }
   renderBatch_.emplace_back(std::move(file));
-  // TODO: maybe allow passing this number in via the query?
-  if (renderBatch_.size() >= kMaximumRenderBatchSize) {
+  if (renderBatch_.size() >= query->renderBatchSize ||
+      (query->renderBatchDeadline.count() > 0 &&
+       now - renderBatchStarted_ >= query->renderBatchDeadline)) {
     fetchRenderBatchNow();
   }
 }
@@ -176,15 +523,19 @@ bool QueryContext::fetchRenderBatchNow() {
   if (renderBatch_.empty()) {
     return true;
   }
-  renderBatch_.front()->batchFetchProperties(renderBatch_);
+  throwIfCancelled();
+  if (explain) {
+    explain->noteBatchFetch(explain->renderFetches, renderBatch_);
+  }
+  renderBatch_.front()->batchFetchProperties(
+      renderBatch_, explain ? &explain->caches : nullptr);
 
   auto toProcess = std::move(renderBatch_);
 
+  renderBatchStarted_ = std::chrono::steady_clock::now();
   for (auto& file : toProcess) {
-    auto maybeRendered = file_result_to_json(query->fieldList, file, this);
-    if (maybeRendered.has_value()) {
-      resultsArray.push_back(std::move(maybeRendered.value()));
-    } else {
+    if (!renderFile(file)) {
+      noteMissingRenderData(file.get());
       renderBatch_.emplace_back(std::move(file));
     }
   }
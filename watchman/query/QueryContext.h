@@ -7,11 +7,25 @@
 
 #pragma once
 
+#include <folly/container/F14Set.h>
 #include <folly/stop_watch.h>
+#include <functional>
+#include <optional>
+#include <string>
 #include <unordered_set>
+#include <vector>
 #include "watchman/Clock.h"
+#include "watchman/NodeArena.h"
+#include "watchman/ThreadStats.h"
+#include "watchman/query/AggregateResultsRenderer.h"
+#include "watchman/query/BserResultsRenderer.h"
+#include "watchman/query/ColumnarResultsRenderer.h"
+#include "watchman/query/QueryExplain.h"
+#include "watchman/query/QueryKernel.h"
 #include "watchman/query/QueryExpr.h"
+#include "watchman/query/ResultOrder.h"
 
+struct watchman_dir;
 struct watchman_file;
 
 namespace watchman {
@@ -23,14 +37,27 @@ class Root;
 enum class QueryContextState {
   NotStarted,
   WaitingForCookieSync,
+  WaitingForCrawl,
   WaitingForViewLock,
   Generating,
   Rendering,
   Completed,
 };
 
+const char* queryContextStateName(QueryContextState state);
+
 // Holds state for the execution of a query
 struct QueryContext : QueryContextBase {
+  // The per-file temporaries of the query, such as the FileResults that the
+  // generators make for the files they visit, are allocated from here and
+  // released in one go along with the context, rather than contending for
+  // the general purpose allocator with every other query.  Declared ahead
+  // of everything that may hold them, so that it outlives them.
+  NodeArena arena{/*hugePages=*/false, MemoryTag::QueryTemporaries};
+  // The arenas of the threads that evaluated files in parallel for this
+  // query, whose results were passed back to it
+  std::vector<std::unique_ptr<NodeArena>> adoptedArenas;
+
   std::chrono::time_point<std::chrono::steady_clock> created;
   folly::stop_watch<std::chrono::milliseconds> stopWatch;
   std::atomic<QueryContextState> state{QueryContextState::NotStarted};
@@ -43,10 +70,12 @@ struct QueryContext : QueryContextBase {
   std::atomic<std::chrono::milliseconds> renderDuration{
       std::chrono::milliseconds(0)};
 
-  void generationStarted() {
-    viewLockWaitDuration = stopWatch.lap();
-    state = QueryContextState::Generating;
-  }
+  // Moves to newState, and records the state being left in any running
+  // debug-trace capture.
+  void setState(QueryContextState newState);
+
+  // Called by the generators once they have locked the view
+  void generationStarted();
 
   const Query* query;
   std::shared_ptr<Root> root;
@@ -56,9 +85,40 @@ struct QueryContext : QueryContextBase {
   // Rendered results
   std::vector<json_ref> resultsArray;
 
+  // If set, receives the rendered results in chunks of at most
+  // query->streamResultsChunkSize files as they are produced, rather than
+  // letting them accumulate in resultsArray.  Each chunk is in the same form
+  // as the value returned by renderResults().
+  std::function<void(json_ref&& files)> resultsSink;
+
+  // If set, results are encoded directly into this renderer instead of
+  // being accumulated in resultsArray.  Not used together with resultsSink.
+  std::unique_ptr<BserResultsRenderer> bserResults;
+
+  // If set, results are rendered as columns into this renderer instead of
+  // being accumulated in resultsArray.  Not used together with resultsSink
+  // or bserResults.
+  std::unique_ptr<ColumnarResultsRenderer> columnarResults;
+
+  // If set, the query only wants the totals of the matching files, which
+  // are counted here rather than being rendered.  Not used together with
+  // any of the above.
+  std::unique_ptr<AggregateResultsRenderer> aggregateResults;
+
   // When deduping the results, set<wholename> of
   // the files held in results
   std::unordered_set<w_string> dedup;
+  // Or, for those with a FileResult::identity, their identities, which
+  // saves building the names of the duplicates
+  folly::F14FastSet<const void*> dedupIdentities;
+  // Held while dedupIdentities is in use; see
+  // QueryableView::pinResultIdentities
+  std::shared_ptr<const void> identityPin;
+
+  // Whether results with a FileResult::identity go in dedupIdentities
+  bool dedupsByIdentity() const {
+    return identityPin != nullptr;
+  }
 
   // When unconditional_log_if_results_contain_file_prefixes is set
   // and one of those prefixes matches a file in the generated results,
@@ -69,9 +129,34 @@ struct QueryContext : QueryContextBase {
   // How many times we suppressed a result due to dedup checking
   uint32_t num_deduped{0};
 
+  // Comma separated names of the generators that produced files, for
+  // the slow query log.
+  std::string generatorNames;
+
+  void noteGenerator(const char* name) {
+    if (!generatorNames.empty()) {
+      generatorNames.push_back(',');
+    }
+    generatorNames.append(name);
+    if (explain) {
+      explain->generatorStarted(name, numWalked_);
+    }
+  }
+
+  // Set if the query is explaining itself; see Query::explain
+  std::unique_ptr<QueryExplain> explain;
+
   // Disable fresh instance queries
   bool disableFreshInstance{false};
 
+  // If set, the InMemoryView generators pass the files that they visit to
+  // this, rather than making FileResults for them; see QueryKernel
+  QueryKernel::ProcessFile kernel{nullptr};
+
+  // When set by a generator, the files that it visits are gathered here to
+  // be evaluated together once it is done, rather than one by one
+  std::vector<const watchman_file*>* gatheredFiles{nullptr};
+
   QueryContext(
       const Query* q,
       const std::shared_ptr<Root>& root,
@@ -79,23 +164,65 @@ struct QueryContext : QueryContextBase {
   QueryContext(const QueryContext&) = delete;
   QueryContext& operator=(const QueryContext&) = delete;
 
-  // Increment numWalked_ by the specified amount
+  // Increment numWalked_ by the specified amount.  The generators call this
+  // for every file that they visit, so it is also where a query notices
+  // that it has been cancelled; see throwIfCancelled().
   inline void bumpNumWalked(int64_t amount = 1) {
     numWalked_ += amount;
+    untilCancelCheck_ -= amount;
+    if (untilCancelCheck_ <= 0) {
+      untilCancelCheck_ = kCancelCheckInterval;
+      throwIfCancelled();
+    }
   }
 
+  // Throws QueryCancelledError if the query ought to be abandoned: because
+  // its client has hung up, its deadline has passed, or the daemon is
+  // shutting down.  The generators and the batch fetches call this every so
+  // often, so that a query that nobody is waiting for stops holding the
+  // view and burning CPU.
+  void throwIfCancelled() const;
+
   int64_t getNumWalked() const {
     return numWalked_;
   }
 
+  // The total number of results, including any already passed to
+  // resultsSink.
+  size_t getNumResults() const {
+    return numStreamed_ + resultsArray.size() + orderedResults_.size() +
+        (bserResults ? bserResults->size() : 0) +
+        (columnarResults ? columnarResults->size() : 0) +
+        (aggregateResults ? aggregateResults->size() : 0);
+  }
+
+  // Returns true once a query that returns the files that changed most
+  // recently has all of the results that it can return.  The rest of the
+  // files changed less recently, so generators walking the recency list
+  // can stop.
+  bool haveEnoughResults() const;
+
+  // Sorts the results of an ordered query into resultsArray, keeping only
+  // those within its limit.  Returns the continuation token if any were
+  // left out, otherwise a null string.
+  w_string finishOrderedResults();
+
   void resetWholeName();
 
   /**
-   * Returns a shared reference to the wholename
-   * of the file.  The caller must not delref
-   * the reference.
+   * Returns the wholename of the current file, which is valid until the
+   * next call to resetWholeName().
+   */
+  w_string_piece getWholeName() override;
+
+  w_string_piece getWholeNameDirName() override;
+
+  /**
+   * Returns the wholename of file, rather than of the current file, which
+   * is valid until the next call to either getWholeName().  Must be called
+   * with the view locked.
    */
-  const w_string& getWholeName() override;
+  w_string_piece getWholeName(const watchman_file* file);
 
   /**
    * Returns a JSON array containing the query results.
@@ -116,7 +243,33 @@ struct QueryContext : QueryContextBase {
   // them to w_query_process_file().
   void fetchEvalBatchNow();
 
+  // Holds on to `file` so that it is evaluated by evaluateDeferredNow()
+  // rather than immediately.  Generators use this to defer work until
+  // they have released any locks held while producing their results.
+  void deferEvaluation(std::unique_ptr<FileResult>&& file);
+
+  // Pass the files held by deferEvaluation() to w_query_process_file().
+  void evaluateDeferredNow();
+
   void maybeRender(std::unique_ptr<FileResult>&& file);
+
+  // Called when file couldn't be rendered.  Rendering stops at the first
+  // field whose data is missing, so when the fields use more than one kind
+  // of data the rest of them are asked as well, so that their accessors
+  // record what they lack too, and a single batch fetch loads all of it.
+  void noteMissingRenderData(FileResult* file);
+
+  // Renders file into bserResults or resultsArray.  Returns false if
+  // more data needs to be loaded before it can be rendered.
+  bool renderFile(const std::unique_ptr<FileResult>& file);
+
+  // The keys of the records that multi-field results are rendered into,
+  // or null if they must be rendered as objects.  See json_record().
+  const json_ref& recordKeys();
+
+  // Pass the accumulated results to resultsSink if enough of them have
+  // been rendered.
+  void maybeStreamResults();
   void addToRenderBatch(std::unique_ptr<FileResult>&& file);
 
   // Perform a batch load of the items in the render batch,
@@ -127,6 +280,10 @@ struct QueryContext : QueryContextBase {
 
   w_string computeWholeName(FileResult* file) const;
 
+  // Returns the directory portion of computeWholeName(file), which points
+  // into the file's dirName()
+  w_string_piece computeWholeNameDirName(FileResult* file) const;
+
   // Returns true if the filename associated with `f` matches
   // the relative_root constraint set on the query.
   // Delegates to dirMatchesRelativeRoot().
@@ -144,12 +301,71 @@ struct QueryContext : QueryContextBase {
   // If relative_root is not set, always returns true.
   bool dirMatchesRelativeRoot(w_string_piece fullDirectoryPath);
 
+  // Returns the full path to dir.  Generators visit the files of a
+  // directory together, so the path of the most recent dir is remembered
+  // for the results of its files to share, rather than each walking the
+  // parents to build their own.  Must only be called by a generator while
+  // it holds the view lock.
+  const w_string& getDirFullPath(const watchman_dir* dir);
+
+  // Returns the remembered path if it belongs to dir, or a null string
+  const w_string& getCachedDirFullPath(const watchman_dir* dir) const;
+
+  // Returns what the query's expression is known to evaluate to for the
+  // files beneath dir, from its path alone.  Must only be called by a
+  // generator while it holds the view lock.
+  DirVerdict evaluateDir(const watchman_dir* dir);
+
  private:
-  w_string wholename_;
+  // Reused for each file so that evaluating terms against the wholename
+  // doesn't allocate
+  std::string wholename_;
+  bool haveWholename_{false};
+
+  const watchman_dir* lastDir_{nullptr};
+  w_string lastDirPath_;
+
+  // When the current state was entered, if a trace capture was running
+  std::optional<std::chrono::steady_clock::time_point> stateEntered_;
 
   // Number of files considered as part of running this query
   int64_t numWalked_{0};
 
+  // Checking whether the client hung up costs a system call, so the
+  // generators only check after walking this many files
+  static constexpr int64_t kCancelCheckInterval = 4096;
+  int64_t untilCancelCheck_{kCancelCheckInterval};
+
+  json_ref recordKeys_;
+  bool recordKeysComputed_{false};
+
+  // Whether noteMissingRenderData() needs to ask every field
+  bool probeFieldsOnMiss_{false};
+
+  // Number of results already passed to resultsSink
+  size_t numStreamed_{0};
+
+  struct OrderedResult {
+    ResultPosition position;
+    json_ref rendered;
+  };
+
+  // Returns the position of file in the order of the query's results, or
+  // nullopt if the data that it needs must be loaded first
+  std::optional<ResultPosition> orderedPosition(FileResult* file);
+
+  // Drops all but the first query->limit of orderedResults_
+  void trimOrderedResults();
+
+  // The rendered results of an ordered query, in no particular order until
+  // finishOrderedResults()
+  std::vector<OrderedResult> orderedResults_;
+  // Whether trimOrderedResults() dropped any
+  bool droppedOrderedResults_{false};
+
+  // Files passed to deferEvaluation()
+  std::vector<std::unique_ptr<FileResult>> deferred_;
+
   // Files for which we encountered NeedMoreData and that we
   // will re-evaluate once we have enough of them accumulated
   // to batch fetch the required data
@@ -160,6 +376,9 @@ struct QueryContext : QueryContextBase {
   // expression and are just pending data to be loaded
   // for rendering the result fields.
   std::vector<std::unique_ptr<FileResult>> renderBatch_;
+
+  // When the oldest file in renderBatch_ was added
+  std::chrono::steady_clock::time_point renderBatchStarted_;
 };
 
 } // namespace watchman
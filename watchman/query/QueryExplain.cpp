@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryExplain.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryContext.h"
+
+namespace watchman {
+
+namespace {
+
+// Counts the evaluations of the term that it wraps
+class CountedExpr : public QueryExpr {
+ public:
+  CountedExpr(size_t index, std::unique_ptr<QueryExpr> expr)
+      : index_(index), expr_(std::move(expr)) {}
+
+  EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
+    auto result = expr_->evaluate(ctx, file);
+    // Not set for the iterations of a bench query
+    if (ctx->termEvaluations) {
+      auto& counts = (*ctx->termEvaluations)[index_];
+      ++counts.evaluated;
+      if (!result.has_value()) {
+        ++counts.undecided;
+      } else if (*result) {
+        ++counts.matched;
+      }
+    }
+    return result;
+  }
+
+  const char* termName() const override {
+    return expr_->termName();
+  }
+
+  DirVerdict evaluateDir(w_string_piece dirName) const override {
+    return expr_->evaluateDir(dirName);
+  }
+
+  bool evaluatesDirs() const override {
+    return expr_->evaluatesDirs();
+  }
+
+  EvaluationCost evaluationCost() const override {
+    return expr_->evaluationCost();
+  }
+
+ private:
+  size_t index_;
+  std::unique_ptr<QueryExpr> expr_;
+};
+
+std::unique_ptr<QueryExpr> instrumentTerm(
+    std::unique_ptr<QueryExpr> expr,
+    std::vector<Query::ExplainedTerm>& terms,
+    uint32_t depth) {
+  auto index = terms.size();
+  terms.push_back(Query::ExplainedTerm{expr->termName(), depth});
+  expr->wrapTerms([&](std::unique_ptr<QueryExpr> term) {
+    return instrumentTerm(std::move(term), terms, depth + 1);
+  });
+  return std::make_unique<CountedExpr>(index, std::move(expr));
+}
+
+constexpr std::pair<FileResult::Property, const char*> kPropertyNames[] = {
+    {FileResult::Property::Name, "name"},
+    {FileResult::Property::StatTimeStamps, "stat_timestamps"},
+    {FileResult::Property::FileDType, "dtype"},
+    {FileResult::Property::CTime, "ctime"},
+    {FileResult::Property::OTime, "otime"},
+    {FileResult::Property::ContentSha1, "content_sha1"},
+    {FileResult::Property::Exists, "exists"},
+    {FileResult::Property::Size, "size"},
+    {FileResult::Property::SymlinkTarget, "symlink_target"},
+    {FileResult::Property::FullFileInformation, "stat"},
+    {FileResult::Property::ContentFingerprint, "content_fingerprint"},
+};
+constexpr size_t kNumProperties =
+    sizeof(kPropertyNames) / sizeof(kPropertyNames[0]);
+
+json_ref renderBatchFetches(const QueryExplain::BatchFetches& fetches) {
+  auto properties = json_object();
+  for (size_t i = 0; i < kNumProperties; ++i) {
+    if (fetches.properties[i]) {
+      properties.set(
+          kPropertyNames[i].second, json_integer(fetches.properties[i]));
+    }
+  }
+  return json_object({
+      {"batches", json_integer(fetches.batches)},
+      {"files", json_integer(fetches.files)},
+      {"properties", std::move(properties)},
+  });
+}
+
+json_ref renderCounts(const PropertyCacheStats::Counts& counts) {
+  return json_object({
+      {"hits", json_integer(counts.hits)},
+      {"misses", json_integer(counts.misses)},
+  });
+}
+
+json_int_t toMs(std::chrono::milliseconds ms) {
+  return json_int_t(ms.count());
+}
+
+} // namespace
+
+QueryExplain::QueryExplain(const Query& query)
+    : terms(query.explainedTerms.size()) {
+  evalFetches.properties.resize(kNumProperties);
+  renderFetches.properties.resize(kNumProperties);
+}
+
+void QueryExplain::instrument(Query& query) {
+  query.explainedTerms.clear();
+  if (query.expr) {
+    query.expr =
+        instrumentTerm(std::move(query.expr), query.explainedTerms, 0);
+  }
+}
+
+void QueryExplain::generatorStarted(const char* name, int64_t walked) {
+  generatorsFinished(walked);
+  generators.push_back(Generator{name});
+  walkedBefore_ = walked;
+  matchedBefore_ = matched;
+  generating_ = true;
+}
+
+void QueryExplain::generatorsFinished(int64_t walked) {
+  if (!generating_) {
+    if (generators.empty() && (walked > 0 || matched > 0)) {
+      // The files came from a generator of the command's own
+      generators.push_back(Generator{"custom", walked, matched});
+    }
+    return;
+  }
+  auto& generator = generators.back();
+  generator.walked = walked - walkedBefore_;
+  generator.matched = matched - matchedBefore_;
+  generating_ = false;
+}
+
+void QueryExplain::noteBatchFetch(
+    BatchFetches& fetches,
+    const std::vector<std::unique_ptr<FileResult>>& files) {
+  ++fetches.batches;
+  fetches.files += files.size();
+  for (auto& file : files) {
+    auto needed = file->neededProperties();
+    for (size_t i = 0; i < kNumProperties; ++i) {
+      if (needed & kPropertyNames[i].first) {
+        ++fetches.properties[i];
+      }
+    }
+  }
+}
+
+json_ref QueryExplain::render(const QueryContext& ctx) const {
+  auto generatorList = json_array_of_size(generators.size());
+  for (auto& generator : generators) {
+    generatorList.array().push_back(json_object({
+        {"name", typed_string_to_json(generator.name.c_str())},
+        {"walked", json_integer(generator.walked)},
+        {"matched", json_integer(generator.matched)},
+    }));
+  }
+
+  auto termList = json_array_of_size(terms.size());
+  for (size_t i = 0; i < terms.size(); ++i) {
+    const auto& term = ctx.query->explainedTerms[i];
+    termList.array().push_back(json_object({
+        {"term", typed_string_to_json(term.name)},
+        {"depth", json_integer(term.depth)},
+        {"evaluated", json_integer(terms[i].evaluated)},
+        {"matched", json_integer(terms[i].matched)},
+        {"undecided", json_integer(terms[i].undecided)},
+    }));
+  }
+
+  return json_object({
+      {"generators", std::move(generatorList)},
+      {"kernel", json_boolean(ctx.kernel != nullptr)},
+      {"walked", json_integer(ctx.getNumWalked())},
+      {"matched", json_integer(matched)},
+      {"deduped", json_integer(ctx.num_deduped)},
+      {"terms", std::move(termList)},
+      {"eval_fetches", renderBatchFetches(evalFetches)},
+      {"render_fetches", renderBatchFetches(renderFetches)},
+      {"caches",
+       json_object({
+           {"symlink_target", renderCounts(caches.symlinkTarget)},
+           {"content.sha1hex", renderCounts(caches.contentSha1)},
+       })},
+      {"cookie_sync_ms", json_integer(toMs(ctx.cookieSyncDuration))},
+      {"view_lock_wait_ms", json_integer(toMs(ctx.viewLockWaitDuration))},
+      {"generation_ms", json_integer(toMs(ctx.generationDuration))},
+      {"render_ms", json_integer(toMs(ctx.renderDuration))},
+  });
+}
+
+} // namespace watchman
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "watchman/query/FileResult.h"
+#include "watchman/query/QueryExpr.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace watchman {
+
+struct Query;
+struct QueryContext;
+
+/**
+ * An account of how a query that set `explain` produced its results, which
+ * is returned along with them so that its client can see why it is slow:
+ * the generators that it used, with the files that each walked and
+ * matched, how often each term of its expression was evaluated, how many
+ * files needed their properties fetched and whether the view's caches had
+ * them, and how long each phase took.
+ */
+struct QueryExplain {
+  struct Generator {
+    std::string name;
+    int64_t walked{0};
+    uint64_t matched{0};
+  };
+  std::vector<Generator> generators;
+
+  // Indexed as Query::explainedTerms
+  std::vector<TermEvaluations> terms;
+
+  struct BatchFetches {
+    uint64_t batches{0};
+    uint64_t files{0};
+    // How many of the files needed each FileResult::Property, by bit
+    std::vector<uint64_t> properties;
+  };
+  // The fetches of the data that terms needed to be evaluated, and that
+  // fields needed to be rendered
+  BatchFetches evalFetches;
+  BatchFetches renderFetches;
+
+  PropertyCacheStats caches;
+
+  // Files that matched and weren't deduped
+  uint64_t matched{0};
+
+  explicit QueryExplain(const Query& query);
+
+  /**
+   * Wraps each term of the planned expression of query so that it counts
+   * its evaluations into QueryContextBase::termEvaluations, and lists the
+   * terms in query.explainedTerms.  Called once the query is parsed, so
+   * that the wrappers don't get in the way of the planner.
+   */
+  static void instrument(Query& query);
+
+  // Called as each generator starts, with the number of files walked so
+  // far, so that the walks and matches that follow are counted against it
+  void generatorStarted(const char* name, int64_t walked);
+  // Called once the last generator is done
+  void generatorsFinished(int64_t walked);
+
+  void noteBatchFetch(
+      BatchFetches& fetches,
+      const std::vector<std::unique_ptr<FileResult>>& files);
+
+  json_ref render(const QueryContext& ctx) const;
+
+ private:
+  int64_t walkedBefore_{0};
+  uint64_t matchedBefore_{0};
+  bool generating_{false};
+};
+
+} // namespace watchman
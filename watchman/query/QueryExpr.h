@@ -7,7 +7,10 @@
 
 #pragma once
 
+#include <functional>
+#include <memory>
 #include <optional>
+#include <vector>
 #include "watchman/Clock.h"
 #include "watchman/watchman_string.h"
 
@@ -16,21 +19,68 @@ namespace watchman {
 using EvaluateResult = std::optional<bool>;
 class FileResult;
 
+// How often a term of the expression of a query that is being explained
+// was evaluated, and what it returned
+struct TermEvaluations {
+  uint64_t evaluated{0};
+  uint64_t matched{0};
+  // Needed data to be loaded before it could say
+  uint64_t undecided{0};
+
+  TermEvaluations& operator+=(const TermEvaluations& other) {
+    evaluated += other.evaluated;
+    matched += other.matched;
+    undecided += other.undecided;
+    return *this;
+  }
+};
+
 class QueryContextBase {
  public:
   // root number, ticks at start of query execution
   ClockSpec clockAtStartOfQuery;
   uint32_t lastAgeOutTickValueAtStartOfQuery;
 
+  // Set if the query is being explained, in which case each term of its
+  // expression counts its evaluations here, indexed as
+  // Query::explainedTerms
+  std::vector<TermEvaluations>* termEvaluations{nullptr};
+
   virtual ~QueryContextBase() = default;
 
   /**
    * Returns the wholename of this query's current file.
 
-   * Note: The wholename is lazily computed and the returned reference is valid
-   * until the next file is set.
+   * Note: The wholename is lazily computed into a buffer that is reused from
+   * file to file, so the returned piece is only valid until the next file is
+   * set.  Take a copy of it to keep it any longer.
    */
-  virtual const w_string& getWholeName() = 0;
+  virtual w_string_piece getWholeName() = 0;
+
+  /**
+   * Returns the portion of the current file's wholename that precedes its
+   * final slash, which is empty for files at the top of the query root.
+   * Unlike getWholeName(), this doesn't need to build a new string.
+   */
+  virtual w_string_piece getWholeNameDirName() = 0;
+};
+
+/**
+ * What an expression is known to evaluate to for the files beneath a
+ * directory, without looking at the files themselves.
+ */
+struct DirVerdict {
+  // The result for every file directly inside the directory
+  std::optional<bool> files;
+  // The result for every file in its subdirectories, at any depth
+  std::optional<bool> subtree;
+
+  bool filesMayMatch() const {
+    return files.value_or(true);
+  }
+  bool subtreeMayMatch() const {
+    return subtree.value_or(true);
+  }
 };
 
 /**
@@ -41,11 +91,41 @@ enum AggregateOp {
   AllOf,
 };
 
+/**
+ * Rough relative cost of evaluating a term.  The query planner uses this to
+ * evaluate cheap terms before expensive ones within allof and anyof, so that
+ * they can short-circuit the evaluation.
+ */
+enum class EvaluationCost {
+  // The result doesn't depend on the file
+  Constant,
+  // Compares the name of the file against a fixed set of strings
+  NameLookup,
+  // Inspects the metadata of the file
+  Metadata,
+  // Matches the name of the file against a wildmatch pattern
+  Pattern,
+  // Matches the name of the file against a regular expression
+  Regex,
+};
+
 class QueryExpr {
  public:
   virtual ~QueryExpr() = default;
   virtual EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) = 0;
 
+  // The name of the term, such as "allof" or "iname", for explaining the
+  // query
+  virtual const char* termName() const = 0;
+
+  using WrapTerm =
+      std::function<std::unique_ptr<QueryExpr>(std::unique_ptr<QueryExpr>)>;
+
+  // Replaces each of the terms that this expression is made of with
+  // wrap(term).  Used to count the evaluations of each term of a query
+  // that is being explained, once it has been planned.
+  virtual void wrapTerms(const WrapTerm& /*wrap*/) {}
+
   // If OTHER can be aggregated with THIS, returns a new expression instance
   // representing the combined state.  Op provides information on the containing
   // query and can be used to determine how aggregation is done.
@@ -55,6 +135,72 @@ class QueryExpr {
       const AggregateOp /*op*/) const {
     return nullptr;
   }
+
+  // Returns the set of lowercased suffixes of which every file matching this
+  // expression must have at least one, or std::nullopt if the expression
+  // doesn't constrain the suffix.  This allows the query to be driven from
+  // the view's suffix index rather than by walking every file.
+  virtual std::optional<std::vector<w_string>> computeSuffixes() const {
+    return std::nullopt;
+  }
+
+  // Returns the wholenames, relative to the query's relative root, of which
+  // every file matching this expression must have one, or std::nullopt if
+  // the expression doesn't constrain them.  This allows the query to look up
+  // just those files rather than walking the tree.
+  virtual std::optional<std::vector<w_string>> computeWholeNames() const {
+    return std::nullopt;
+  }
+
+  // Whether the names from computeWholeNames() are to be looked up with
+  // their ASCII case ignored.
+  virtual bool wholeNamesAreCaseless() const {
+    return false;
+  }
+
+  // Returns the directory, relative to the query's relative root, beneath
+  // which every file matching this expression must be found, or std::nullopt
+  // if the expression doesn't constrain that.  This allows the query to walk
+  // only that portion of the tree.
+  virtual std::optional<w_string> computeRequiredDirName() const {
+    return std::nullopt;
+  }
+
+  // Returns how many levels of directories beneath dirName, which is
+  // relative to the query's relative root, can hold the files that match
+  // this expression, or std::nullopt if the expression doesn't bound that.
+  // 0 means that every match is directly inside dirName.
+  virtual std::optional<uint32_t> computeRequiredDirDepth(
+      w_string_piece /*dirName*/) const {
+    return std::nullopt;
+  }
+
+  // Returns what this expression evaluates to for the files beneath the
+  // directory whose path relative to the query's relative root is dirName,
+  // which is empty for the relative root itself.  Generators that walk the
+  // tree use this to skip the files, and whole subtrees, that can't match,
+  // rather than evaluating the same dir-dependent terms for every file.
+  virtual DirVerdict evaluateDir(w_string_piece /*dirName*/) const {
+    return {};
+  }
+
+  // Whether evaluateDir() can ever know anything, so that generators need
+  // only compute the paths of the directories that they walk if it can
+  virtual bool evaluatesDirs() const {
+    return false;
+  }
+
+  virtual EvaluationCost evaluationCost() const {
+    return EvaluationCost::Metadata;
+  }
+
+  // Called by the query planner after parsing.  Returns an equivalent but
+  // cheaper expression to use in place of this one, or nullptr if this
+  // expression cannot be simplified.  Implementations with children are
+  // responsible for simplifying them.
+  virtual std::unique_ptr<QueryExpr> simplify() {
+    return nullptr;
+  }
 };
 
 } // namespace watchman
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/QueryKernel.h"
+#include <algorithm>
+#include "watchman/bser.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryContext.h"
+#include "watchman/query/QueryExpr.h"
+#include "watchman/watchman_file.h"
+
+namespace watchman {
+
+namespace {
+
+struct AllFiles {
+  static bool matches(const QueryKernel&, w_string_piece) {
+    return true;
+  }
+};
+
+struct Suffixes {
+  static bool matches(const QueryKernel& kernel, w_string_piece name) {
+    return kernel.suffixes()->matches(name.view());
+  }
+};
+
+// As the "new" field renders it
+bool isNew(const QueryContext* ctx, const watchman_file* file) {
+  if (!ctx->since.is_timestamp && ctx->since.clock.is_fresh_instance) {
+    return true;
+  }
+  if (ctx->since.is_timestamp) {
+    return ctx->since.timestamp > file->ctime.timestamp;
+  }
+  return file->ctime.ticks > ctx->since.clock.ticks;
+}
+
+struct BserOutput {
+  static void render(
+      const QueryKernel& kernel,
+      QueryContext* ctx,
+      const watchman_file* file,
+      w_string_piece name) {
+    auto& results = *ctx->bserResults;
+    results.renderRow([&](const bser_ctx_t* bser, void* buffer) {
+      size_t column = 0;
+      for (auto field : kernel.fields()) {
+        int res = 0;
+        switch (field) {
+          case QueryKernel::Field::Name:
+            res = results.dumpString(column, name, W_STRING_BYTE);
+            break;
+          case QueryKernel::Field::Exists:
+            res = w_bser_dump_bool(bser, file->exists, buffer);
+            break;
+          case QueryKernel::Field::New:
+            res = w_bser_dump_bool(bser, isNew(ctx, file), buffer);
+            break;
+        }
+        if (res) {
+          return res;
+        }
+        ++column;
+      }
+      return 0;
+    });
+  }
+};
+
+struct JsonOutput {
+  static json_ref value(
+      QueryKernel::Field field,
+      const QueryContext* ctx,
+      const watchman_file* file,
+      w_string_piece name) {
+    switch (field) {
+      case QueryKernel::Field::Name:
+        return w_string_to_json(name.asWString());
+      case QueryKernel::Field::Exists:
+        return json_boolean(file->exists);
+      case QueryKernel::Field::New:
+        return json_boolean(isNew(ctx, file));
+    }
+    return json_null();
+  }
+
+  static void render(
+      const QueryKernel& kernel,
+      QueryContext* ctx,
+      const watchman_file* file,
+      w_string_piece name) {
+    auto& fields = kernel.fields();
+    if (fields.size() == 1) {
+      ctx->resultsArray.push_back(value(fields.front(), ctx, file, name));
+    } else {
+      std::vector<json_ref> values;
+      values.reserve(fields.size());
+      for (auto field : fields) {
+        values.push_back(value(field, ctx, file, name));
+      }
+      ctx->resultsArray.push_back(
+          json_record(ctx->recordKeys(), std::move(values)));
+    }
+    ctx->maybeStreamResults();
+  }
+};
+
+// Does what w_query_process_file and QueryContext::renderFile do for the
+// shape of query that the kernel was recognized for
+template <typename Predicate, typename Output>
+void processFile(QueryContext* ctx, const watchman_file* file) {
+  auto& kernel = *ctx->query->kernel;
+  if (!Predicate::matches(kernel, file->getName())) {
+    return;
+  }
+  // Fresh instances only report the files that currently exist
+  if (!file->exists && !ctx->disableFreshInstance &&
+      !ctx->since.is_timestamp && ctx->since.clock.is_fresh_instance) {
+    return;
+  }
+
+  if (ctx->query->dedup_results && ctx->dedupsByIdentity() &&
+      !ctx->dedupIdentities.insert(file).second) {
+    ctx->num_deduped++;
+    return;
+  }
+  auto name = ctx->getWholeName(file);
+  if (ctx->query->dedup_results && !ctx->dedupsByIdentity() &&
+      !ctx->dedup.insert(name.asWString()).second) {
+    ctx->num_deduped++;
+    return;
+  }
+  if (ctx->explain) {
+    ctx->explain->matched++;
+  }
+  Output::render(kernel, ctx, file, name);
+}
+
+template <typename Predicate>
+QueryKernel::ProcessFile selectOutput(const QueryContext& ctx) {
+  if (ctx.bserResults) {
+    return processFile<Predicate, BserOutput>;
+  }
+  if (ctx.columnarResults || ctx.aggregateResults) {
+    return nullptr;
+  }
+  return processFile<Predicate, JsonOutput>;
+}
+
+} // namespace
+
+std::optional<QueryKernel> QueryKernel::recognize(
+    const Query& query,
+    const json_ref& expression) {
+  if (query.relative_root || query.orderBy || query.aggregate ||
+      query.fieldList.empty()) {
+    return std::nullopt;
+  }
+
+  QueryKernel kernel;
+  if (expression || query.expr) {
+    // Only a lone suffix term, whose parsed form holds exactly its suffixes
+    if (!expression || !query.expr || !expression.isArray() ||
+        json_array_size(expression) != 2) {
+      return std::nullopt;
+    }
+    const auto& term = expression.at(0);
+    if (!term.isString() || json_to_w_string(term) != w_string("suffix")) {
+      return std::nullopt;
+    }
+    auto suffixes = query.expr->computeSuffixes();
+    if (!suffixes || suffixes->empty()) {
+      return std::nullopt;
+    }
+    kernel.suffixes_ = SuffixMatcher::of(*suffixes);
+  }
+
+  for (auto* f : query.fieldList) {
+    Field field;
+    if (f->name == w_string("name")) {
+      field = Field::Name;
+    } else if (f->name == w_string("exists")) {
+      field = Field::Exists;
+    } else if (f->name == w_string("new")) {
+      field = Field::New;
+    } else {
+      return std::nullopt;
+    }
+    if (std::find(kernel.fields_.begin(), kernel.fields_.end(), field) !=
+        kernel.fields_.end()) {
+      return std::nullopt;
+    }
+    kernel.fields_.push_back(field);
+  }
+  return kernel;
+}
+
+QueryKernel::ProcessFile QueryKernel::select(const QueryContext& ctx) const {
+  if (!suffixes_) {
+    return selectOutput<AllFiles>(ctx);
+  }
+  return selectOutput<Suffixes>(ctx);
+}
+
+} // namespace watchman
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <optional>
+#include <vector>
+#include "watchman/query/SuffixMatcher.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+struct watchman_file;
+
+namespace watchman {
+
+struct Query;
+struct QueryContext;
+
+/**
+ * A loop specialized for one of the handful of query shapes that make up
+ * most interactive traffic, such as a since query with a suffix expression
+ * that asks for name, exists and new, or a glob that asks for name alone.
+ *
+ * The generic path makes a FileResult for every file that a generator
+ * visits, evaluates the expression through QueryExpr::evaluate, and renders
+ * each field through its QueryFieldRenderer into a json value.  A kernel
+ * instead reads the watchman_file directly, matches its suffixes inline,
+ * and encodes the fields straight into the BSER renderer or the results
+ * array.  Each combination of predicate and output is a separate template
+ * instantiation, so none of that goes through a virtual call.
+ *
+ * A query has a kernel if its expression is absent or a single suffix
+ * term, it asks for some of name, exists and new, each at most once, and
+ * it needs none of relative_root, ordering or aggregation.  Which
+ * instantiation to use is decided once the query is executed, as that
+ * depends on how the results are rendered.
+ */
+class QueryKernel {
+ public:
+  enum class Field : uint8_t { Name, Exists, New };
+
+  // Evaluates and renders file for ctx, if it matches the query
+  using ProcessFile = void (*)(QueryContext* ctx, const watchman_file* file);
+
+  /**
+   * Returns the kernel for a parsed query, or nullopt if it doesn't have
+   * the shape of one.  expression is the expression that the query was
+   * parsed from, if any.
+   */
+  static std::optional<QueryKernel> recognize(
+      const Query& query,
+      const json_ref& expression);
+
+  /**
+   * Returns the loop that renders the results of the query of ctx, or
+   * nullptr if ctx renders them in a way that the kernel doesn't.
+   */
+  ProcessFile select(const QueryContext& ctx) const;
+
+  const std::vector<Field>& fields() const {
+    return fields_;
+  }
+  // Matches the suffixes that the files must have one of, or is unset if
+  // all files match
+  const std::optional<SuffixMatcher>& suffixes() const {
+    return suffixes_;
+  }
+
+ private:
+  std::vector<Field> fields_;
+  std::optional<SuffixMatcher> suffixes_;
+};
+
+} // namespace watchman
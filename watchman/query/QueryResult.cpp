@@ -16,6 +16,7 @@ json_ref QueryDebugInfo::render() const {
   }
   return json_object({
       {"cookie_files", arr},
+      {"result_cache_hit", json_boolean(resultCacheHit)},
   });
 }
 
@@ -7,9 +7,14 @@
 
 #pragma once
 
+#include <chrono>
+#include <memory>
+#include <optional>
 #include <unordered_set>
 #include <vector>
 #include "watchman/Clock.h"
+#include "watchman/query/BserResultsRenderer.h"
+#include "watchman/query/ColumnarResultsRenderer.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 
@@ -17,6 +22,8 @@ namespace watchman {
 
 struct QueryDebugInfo {
   std::vector<w_string> cookieFileNames;
+  // Whether the results came from the root's query result cache
+  bool resultCacheHit{false};
 
   json_ref render() const;
 };
@@ -24,12 +31,30 @@ struct QueryDebugInfo {
 struct QueryResult {
   bool isFreshInstance;
   json_ref resultsArray;
+  // Only populated if the results were rendered directly to BSER, in which
+  // case resultsArray is empty.  May be shared with the query result cache.
+  std::shared_ptr<const BserResultsRenderer> bserResults;
+  // Only populated if the results were rendered as columns, in which case
+  // resultsArray is empty.
+  std::shared_ptr<ColumnarResultsRenderer> columnarResults;
+  // Only populated if the query asked for an aggregate, in which case
+  // resultsArray is empty.  See AggregateResultsRenderer::takeResults().
+  json_ref aggregate;
+  // Set when an ordered query left out results beyond its limit; passing
+  // it back as the continuation of the same query returns the next ones
+  w_string continuation;
   // Only populated if the query was set to dedup_results
   std::unordered_set<w_string> dedupedFileNames;
   ClockSpec clockAtStartOfQuery;
   uint32_t stateTransCountAtStartOfQuery;
   json_ref savedStateInfo;
   QueryDebugInfo debugInfo;
+  // Only populated if the query set explain; see QueryExplain::render()
+  json_ref explain;
+  // Only populated if the query set max_staleness_ms: how far behind the
+  // filesystem the view may have been when the query was synced, which is
+  // zero if the query synced itself
+  std::optional<std::chrono::milliseconds> staleness;
 };
 
 } // namespace watchman
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/ResultOrder.h"
+#include <folly/Conv.h>
+#include <string_view>
+#include "watchman/Errors.h"
+
+namespace watchman {
+
+namespace {
+
+struct KeyName {
+  ResultOrder::Key key;
+  std::string_view name;
+  // Identifies the key in continuation tokens
+  char tag;
+};
+
+constexpr KeyName kKeyNames[] = {
+    {ResultOrder::Key::Name, "name", 'n'},
+    {ResultOrder::Key::MTime, "mtime", 'm'},
+    {ResultOrder::Key::Size, "size", 's'},
+    {ResultOrder::Key::OTime, "otime", 'o'},
+};
+
+const KeyName& keyName(ResultOrder::Key key) {
+  for (auto& k : kKeyNames) {
+    if (k.key == key) {
+      return k;
+    }
+  }
+  throw std::logic_error("unknown result order key");
+}
+
+} // namespace
+
+ResultOrder ResultOrder::parse(const json_ref& spec) {
+  if (!spec.isString()) {
+    throw QueryParseError("'order_by' must be a string");
+  }
+  std::string_view text = json_string_value(spec);
+  auto space = text.find(' ');
+  auto name = text.substr(0, space);
+  auto direction =
+      space == std::string_view::npos ? std::string_view{} : text.substr(space);
+  while (!direction.empty() && direction.front() == ' ') {
+    direction.remove_prefix(1);
+  }
+
+  ResultOrder order;
+  bool known = false;
+  for (auto& k : kKeyNames) {
+    if (k.name == name) {
+      order.key = k.key;
+      known = true;
+    }
+  }
+  if (!known) {
+    throw QueryParseError(
+        "'order_by' must be one of name, mtime, size or otime, not '",
+        name,
+        "'");
+  }
+
+  if (direction == "desc") {
+    order.descending = true;
+  } else if (!direction.empty() && direction != "asc") {
+    throw QueryParseError(
+        "'order_by' direction must be asc or desc, not '", direction, "'");
+  }
+  return order;
+}
+
+bool ResultOrder::before(const ResultPosition& a, const ResultPosition& b)
+    const {
+  auto& first = descending ? b : a;
+  auto& second = descending ? a : b;
+  if (first.value != second.value) {
+    return first.value < second.value;
+  }
+  return first.name.view() < second.name.view();
+}
+
+w_string ResultOrder::encodeContinuation(const ResultPosition& last) const {
+  // The name goes last, as it may contain anything, including colons
+  return w_string::build(
+      keyName(key).tag,
+      descending ? 'd' : 'a',
+      ":",
+      last.value,
+      ":",
+      last.name);
+}
+
+ResultPosition ResultOrder::decodeContinuation(w_string_piece token) const {
+  std::string_view text = token.view();
+  auto& k = keyName(key);
+  auto invalid = [&] {
+    return QueryParseError(
+        "'continuation' is not from a query with the same order_by");
+  };
+  if (text.size() < 3 || text[0] != k.tag ||
+      text[1] != (descending ? 'd' : 'a') || text[2] != ':') {
+    throw invalid();
+  }
+  text.remove_prefix(3);
+  auto colon = text.find(':');
+  if (colon == std::string_view::npos) {
+    throw invalid();
+  }
+  auto value = folly::tryTo<int64_t>(text.substr(0, colon));
+  if (!value.hasValue()) {
+    throw invalid();
+  }
+  auto name = text.substr(colon + 1);
+  return ResultPosition{
+      value.value(), w_string{name.data(), name.size(), W_STRING_BYTE}};
+}
+
+} // namespace watchman
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <cstdint>
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+// Where a file sorts among the results of an ordered query
+struct ResultPosition {
+  // The mtime in nanoseconds, the size or the otime ticks, depending on
+  // the order's key; 0 when ordering by name
+  int64_t value{0};
+  // The name of the file as it appears in the results
+  w_string name;
+};
+
+/**
+ * The order_by of a query.  The results are sorted by one key, with ties
+ * broken by name, so that every file has a distinct position.  A response
+ * limited to the first few results carries a continuation token that
+ * encodes the position of its last file; the next query passes it back to
+ * carry on from there, without the daemon holding on to anything between
+ * the two.
+ */
+struct ResultOrder {
+  enum class Key : uint8_t { Name, MTime, Size, OTime };
+
+  Key key{Key::Name};
+  bool descending{false};
+
+  // Parses a key name, optionally followed by "asc" or "desc", such as
+  // "mtime desc".  Throws QueryParseError if it isn't one.
+  static ResultOrder parse(const json_ref& spec);
+
+  // Returns true if a sorts before b
+  bool before(const ResultPosition& a, const ResultPosition& b) const;
+
+  w_string encodeContinuation(const ResultPosition& last) const;
+
+  // Throws QueryParseError if the token wasn't produced for this order
+  ResultPosition decodeContinuation(w_string_piece token) const;
+};
+
+} // namespace watchman
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/SlowQueryLog.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryContext.h"
+#include "watchman/root/Root.h"
+#include "watchman/watchman_hash.h"
+
+namespace watchman {
+
+namespace {
+
+uint32_t toMs(std::chrono::milliseconds ms) {
+  return uint32_t(std::min<int64_t>(
+      ms.count(), std::numeric_limits<uint32_t>::max()));
+}
+
+} // namespace
+
+SlowQueryLogEntry::SlowQueryLogEntry(const QueryContext& ctx) noexcept {
+  finished = std::chrono::system_clock::now();
+  clientPid = ctx.query->clientPid;
+
+  auto spec = json_dumps(ctx.query->query_spec, JSON_SORT_KEYS | JSON_COMPACT);
+  specHash = w_hash_bytes(spec.data(), spec.size(), 0);
+
+  totalMs = toMs(std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - ctx.created));
+  cookieSyncMs = toMs(ctx.cookieSyncDuration);
+  viewLockWaitMs = toMs(ctx.viewLockWaitDuration);
+  generationMs = toMs(ctx.generationDuration);
+  renderMs = toMs(ctx.renderDuration);
+  numWalked = ctx.getNumWalked();
+  numResults = int64_t(ctx.getNumResults());
+
+  storeTruncatedTail(
+      generators,
+      ctx.generatorNames.empty() ? w_string_piece("custom")
+                                 : w_string_piece(ctx.generatorNames));
+  storeTruncatedTail(subscription, ctx.query->subscriptionName);
+}
+
+json_ref SlowQueryLogEntry::asJsonValue() const {
+  return json_object({
+      {"finished",
+       json_integer(std::chrono::duration_cast<std::chrono::milliseconds>(
+                        finished.time_since_epoch())
+                        .count())},
+      {"client_pid", json_integer(clientPid)},
+      {"spec_hash", json_integer(specHash)},
+      {"total_ms", json_integer(totalMs)},
+      {"cookie_sync_ms", json_integer(cookieSyncMs)},
+      {"view_lock_wait_ms", json_integer(viewLockWaitMs)},
+      {"generation_ms", json_integer(generationMs)},
+      {"render_ms", json_integer(renderMs)},
+      {"num_walked", json_integer(numWalked)},
+      {"num_results", json_integer(numResults)},
+      {"generators",
+       w_string_to_json(
+           w_string{generators, strnlen(generators, kNameLength)})},
+      {"subscription",
+       w_string_to_json(
+           w_string{subscription, strnlen(subscription, kNameLength)})},
+  });
+}
+
+void maybeLogSlowQuery(const QueryContext& ctx) {
+  auto& root = *ctx.root;
+  if (!root.slowQueries) {
+    return;
+  }
+  if (std::chrono::steady_clock::now() - ctx.created <
+      root.slowQueryThreshold) {
+    return;
+  }
+  root.slowQueries->write(SlowQueryLogEntry(ctx));
+}
+
+} // namespace watchman
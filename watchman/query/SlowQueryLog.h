@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include "watchman/RingBuffer.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/watchman_system.h"
+
+namespace watchman {
+
+struct QueryContext;
+
+/**
+ * The cost of a query that took longer than the root's slow query
+ * threshold.  Stored in a RingBuffer, so this must be trivially copyable
+ * and of fixed size.
+ */
+struct SlowQueryLogEntry {
+  SlowQueryLogEntry() noexcept {
+    // time_point is not noexcept so this can't be defaulted.
+  }
+  explicit SlowQueryLogEntry(const QueryContext& ctx) noexcept;
+
+  json_ref asJsonValue() const;
+
+  static constexpr size_t kNameLength = 32;
+
+  // When the query finished
+  std::chrono::system_clock::time_point finished;
+  pid_t clientPid;
+  // w_hash_bytes of the canonical query spec, for spotting repeat offenders
+  uint32_t specHash;
+  // Phase timings
+  uint32_t totalMs;
+  uint32_t cookieSyncMs;
+  uint32_t viewLockWaitMs;
+  uint32_t generationMs;
+  uint32_t renderMs;
+  int64_t numWalked;
+  int64_t numResults;
+  // Comma separated names of the generators that produced the files
+  char generators[kNameLength];
+  // The tail of the subscription name, if any
+  char subscription[kNameLength];
+};
+
+/**
+ * Record ctx in the slow query log of its root if it took at least as
+ * long as the configured threshold.
+ */
+void maybeLogSlowQuery(const QueryContext& ctx);
+
+} // namespace watchman
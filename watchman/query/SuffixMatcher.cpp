@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/SuffixMatcher.h"
+#include <algorithm>
+#include <cstring>
+
+namespace watchman {
+
+namespace {
+
+constexpr uint64_t kOnes = 0x0101010101010101ULL;
+constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+// Lowercases the ASCII letters of a word, as tolower does byte by byte.
+// None of the additions can carry out of a byte, as the 7 bit value of
+// each byte is at most 0x7f.
+uint64_t foldCase(uint64_t word) {
+  uint64_t heptets = word & ~kHighBits;
+  uint64_t aboveZ = heptets + kOnes * (0x7f - 'Z');
+  uint64_t atLeastA = heptets + kOnes * (0x80 - 'A');
+  uint64_t upper = (atLeastA ^ aboveZ) & ~word & kHighBits;
+  return word | (upper >> 2);
+}
+
+char lower(char c) {
+  return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+} // namespace
+
+SuffixMatcher::SuffixMatcher(const std::vector<std::string_view>& suffixes) {
+  bool fits = suffixes.size() <= kMaxPacked;
+  bool dotted = false;
+  for (auto suffix : suffixes) {
+    if (std::find(suffixes_.begin(), suffixes_.end(), suffix) !=
+        suffixes_.end()) {
+      continue;
+    }
+    suffixes_.emplace_back(suffix);
+    fits = fits && suffix.size() < kSlotSize;
+    dotted = dotted || suffix.find('.') != std::string_view::npos;
+  }
+
+  if (fits && (suffixes_.size() < 3 || !dotted)) {
+    mode_ = Mode::Packed;
+    for (auto& suffix : suffixes_) {
+      char value[kSlotSize] = {};
+      char mask[kSlotSize] = {};
+      size_t size = suffix.size() + 1;
+      value[kSlotSize - size] = '.';
+      memcpy(value + kSlotSize - suffix.size(), suffix.data(), suffix.size());
+      memset(mask + kSlotSize - size, 0xff, size);
+
+      Slot slot;
+      memcpy(slot.value.data(), value, sizeof(value));
+      memcpy(slot.mask.data(), mask, sizeof(mask));
+      slot.size = size;
+      slots_.push_back(slot);
+    }
+  } else if (suffixes_.size() < 3) {
+    mode_ = Mode::Each;
+  } else {
+    mode_ = Mode::Lookup;
+    lookup_.insert(suffixes_.begin(), suffixes_.end());
+  }
+}
+
+bool SuffixMatcher::matchesPacked(std::string_view name) const {
+  // The last kSlotSize bytes of the name, right aligned.  A shorter name
+  // has zeroes in front, which the size check keeps from matching.
+  std::array<uint64_t, 2> words;
+  if (name.size() >= kSlotSize) {
+    memcpy(words.data(), name.data() + name.size() - kSlotSize, kSlotSize);
+  } else {
+    char tail[kSlotSize] = {};
+    memcpy(tail + kSlotSize - name.size(), name.data(), name.size());
+    memcpy(words.data(), tail, sizeof(tail));
+  }
+  words[0] = foldCase(words[0]);
+  words[1] = foldCase(words[1]);
+
+  for (auto& slot : slots_) {
+    if ((words[1] & slot.mask[1]) == slot.value[1] &&
+        (words[0] & slot.mask[0]) == slot.value[0] &&
+        name.size() >= slot.size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SuffixMatcher::matchesEach(std::string_view name) const {
+  for (auto& suffix : suffixes_) {
+    if (name.size() < suffix.size() + 1) {
+      continue;
+    }
+    auto base = name.size() - suffix.size();
+    if (name[base - 1] != '.') {
+      continue;
+    }
+    bool same = true;
+    for (size_t i = 0; same && i < suffix.size(); ++i) {
+      same = lower(name[base + i]) == suffix[i];
+    }
+    if (same) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SuffixMatcher::matchesLookup(std::string_view name) const {
+  // name is a base name, so there are no slashes to stop at
+  auto dot = name.rfind('.');
+  if (dot == std::string_view::npos) {
+    return false;
+  }
+  std::string suffix(name.substr(dot + 1));
+  std::transform(suffix.begin(), suffix.end(), suffix.begin(), lower);
+  return lookup_.count(suffix) != 0;
+}
+
+} // namespace watchman
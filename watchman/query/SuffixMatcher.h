@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace watchman {
+
+/**
+ * Matches a file name against the set of suffixes of a suffix term.
+ *
+ * A name matches a suffix if it ends with a dot followed by the suffix,
+ * ignoring ASCII case.  A suffix set usually holds a handful of short
+ * extensions, so they are packed into 16 byte slots, right aligned after
+ * their dot, along with a mask of the bytes that each occupies.  The last
+ * 16 bytes of a name are loaded once and lowercased a word at a time, and
+ * each slot is then a masked compare of two words, with no allocation and
+ * no hashing.
+ *
+ * Sets that don't fit, with more than kMaxPacked suffixes or with suffixes
+ * of kSlotSize bytes or more, are matched as the suffix term always has:
+ * by comparing each suffix in turn if there are fewer than three of them,
+ * or else by looking up the part of the name after its last dot.  Packing
+ * is also skipped for sets of three or more that contain a dotted suffix,
+ * as the lookup never matches those, and the packed compare would.
+ */
+class SuffixMatcher {
+ public:
+  static constexpr size_t kSlotSize = 16;
+  static constexpr size_t kMaxPacked = 16;
+
+  // suffixes must already be lowercased, and exclude the leading dot
+  explicit SuffixMatcher(const std::vector<std::string_view>& suffixes);
+
+  // As above, for a container of strings such as w_string
+  template <typename Container>
+  static SuffixMatcher of(const Container& suffixes) {
+    std::vector<std::string_view> views;
+    views.reserve(suffixes.size());
+    for (auto& suffix : suffixes) {
+      views.emplace_back(suffix.data(), suffix.size());
+    }
+    return SuffixMatcher(views);
+  }
+
+  bool matches(std::string_view name) const {
+    switch (mode_) {
+      case Mode::Packed:
+        return matchesPacked(name);
+      case Mode::Each:
+        return matchesEach(name);
+      case Mode::Lookup:
+        return matchesLookup(name);
+    }
+    return false;
+  }
+
+  // Whether the suffixes were packed; exposed for testing
+  bool packed() const {
+    return mode_ == Mode::Packed;
+  }
+
+ private:
+  enum class Mode : uint8_t { Packed, Each, Lookup };
+
+  struct Slot {
+    // The dot and the suffix, right aligned, and the bytes that they occupy
+    std::array<uint64_t, 2> value;
+    std::array<uint64_t, 2> mask;
+    // The length of the dot and the suffix
+    size_t size;
+  };
+
+  bool matchesPacked(std::string_view name) const;
+  bool matchesEach(std::string_view name) const;
+  bool matchesLookup(std::string_view name) const;
+
+  Mode mode_;
+  std::vector<Slot> slots_;
+  std::vector<std::string> suffixes_;
+  std::unordered_set<std::string> lookup_;
+};
+
+} // namespace watchman
@@ -9,6 +9,7 @@
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -16,6 +17,13 @@ using namespace watchman;
 
 /* Basic boolean and compound expressions */
 
+static std::optional<bool> negate(std::optional<bool> result) {
+  if (!result.has_value()) {
+    return result;
+  }
+  return !*result;
+}
+
 class NotExpr : public QueryExpr {
   std::unique_ptr<QueryExpr> expr;
 
@@ -24,13 +32,32 @@ class NotExpr : public QueryExpr {
       : expr(std::move(other_expr)) {}
 
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
-    auto res = expr->evaluate(ctx, file);
-    if (!res.has_value()) {
-      return res;
-    }
-    return !*res;
+    return negate(expr->evaluate(ctx, file));
+  }
+
+  const char* termName() const override {
+    return "not";
+  }
+
+  void wrapTerms(const WrapTerm& wrap) override {
+    expr = wrap(std::move(expr));
+  }
+
+  DirVerdict evaluateDir(w_string_piece dirName) const override {
+    auto verdict = expr->evaluateDir(dirName);
+    return DirVerdict{negate(verdict.files), negate(verdict.subtree)};
+  }
+
+  bool evaluatesDirs() const override {
+    return expr->evaluatesDirs();
+  }
+
+  EvaluationCost evaluationCost() const override {
+    return expr->evaluationCost();
   }
 
+  std::unique_ptr<QueryExpr> simplify() override;
+
   static std::unique_ptr<QueryExpr> parse(Query* query, const json_ref& term) {
     /* rigidly require ["not", expr] */
     if (!term.isArray() || json_array_size(term) != 2) {
@@ -51,6 +78,18 @@ class TrueExpr : public QueryExpr {
     return true;
   }
 
+  const char* termName() const override {
+    return "true";
+  }
+
+  DirVerdict evaluateDir(w_string_piece) const override {
+    return DirVerdict{true, true};
+  }
+
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Constant;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref&) {
     return std::make_unique<TrueExpr>();
   }
@@ -64,6 +103,18 @@ class FalseExpr : public QueryExpr {
     return false;
   }
 
+  const char* termName() const override {
+    return "false";
+  }
+
+  DirVerdict evaluateDir(w_string_piece) const override {
+    return DirVerdict{false, false};
+  }
+
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Constant;
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref&) {
     return std::make_unique<FalseExpr>();
   }
@@ -113,6 +164,230 @@ class ListExpr : public QueryExpr {
     return allof;
   }
 
+  const char* termName() const override {
+    return allof ? "allof" : "anyof";
+  }
+
+  void wrapTerms(const WrapTerm& wrap) override {
+    for (auto& expr : exprs) {
+      expr = wrap(std::move(expr));
+    }
+  }
+
+  DirVerdict evaluateDir(w_string_piece dirName) const override {
+    // Known once one term decides it, or if every term agrees
+    auto combine = [this](
+                       std::optional<bool>& result, std::optional<bool> term) {
+      if (result == !allof) {
+        return;
+      }
+      if (!term.has_value()) {
+        result = std::nullopt;
+      } else if (*term != allof) {
+        result = term;
+      }
+    };
+    DirVerdict result{allof, allof};
+    for (auto& expr : exprs) {
+      auto verdict = expr->evaluateDir(dirName);
+      combine(result.files, verdict.files);
+      combine(result.subtree, verdict.subtree);
+    }
+    return result;
+  }
+
+  bool evaluatesDirs() const override {
+    for (auto& expr : exprs) {
+      if (expr->evaluatesDirs()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  EvaluationCost evaluationCost() const override {
+    auto cost = EvaluationCost::Constant;
+    for (auto& expr : exprs) {
+      cost = std::max(cost, expr->evaluationCost());
+    }
+    return cost;
+  }
+
+  std::optional<w_string> computeRequiredDirName() const override {
+    if (allof) {
+      for (auto& expr : exprs) {
+        if (auto dirName = expr->computeRequiredDirName()) {
+          return dirName;
+        }
+      }
+      return std::nullopt;
+    }
+
+    // All alternatives must agree on the same directory.
+    std::optional<w_string> result;
+    for (auto& expr : exprs) {
+      auto dirName = expr->computeRequiredDirName();
+      if (!dirName || (result && *result != *dirName)) {
+        return std::nullopt;
+      }
+      result = std::move(dirName);
+    }
+    return result;
+  }
+
+  std::optional<uint32_t> computeRequiredDirDepth(
+      w_string_piece dirName) const override {
+    std::optional<uint32_t> result;
+    for (auto& expr : exprs) {
+      auto depth = expr->computeRequiredDirDepth(dirName);
+      if (allof) {
+        if (depth && (!result || *depth < *result)) {
+          result = depth;
+        }
+      } else {
+        // Every alternative must be bounded
+        if (!depth) {
+          return std::nullopt;
+        }
+        result = std::max(result.value_or(0), *depth);
+      }
+    }
+    return result;
+  }
+
+  std::unique_ptr<QueryExpr> simplify() override {
+    std::vector<std::unique_ptr<QueryExpr>> flattened;
+    flattened.reserve(exprs.size());
+
+    for (auto& expr : exprs) {
+      if (auto simplified = expr->simplify()) {
+        expr = std::move(simplified);
+      }
+
+      // allof(a, allof(b, c)) is allof(a, b, c), and likewise for anyof.
+      auto* list = dynamic_cast<ListExpr*>(expr.get());
+      if (list && list->allof == allof) {
+        for (auto& child : list->exprs) {
+          flattened.push_back(std::move(child));
+        }
+        continue;
+      }
+
+      if (dynamic_cast<TrueExpr*>(expr.get())) {
+        if (!allof) {
+          return std::make_unique<TrueExpr>();
+        }
+        // Doesn't affect the result of allof
+        continue;
+      }
+      if (dynamic_cast<FalseExpr*>(expr.get())) {
+        if (allof) {
+          return std::make_unique<FalseExpr>();
+        }
+        // Doesn't affect the result of anyof
+        continue;
+      }
+
+      flattened.push_back(std::move(expr));
+    }
+
+    if (flattened.empty()) {
+      if (allof) {
+        return std::make_unique<TrueExpr>();
+      }
+      return std::make_unique<FalseExpr>();
+    }
+
+    // The result of both allof and anyof is independent of the order in
+    // which the terms are evaluated, so evaluate the cheapest first to give
+    // them the chance to short-circuit the more expensive ones.
+    std::stable_sort(
+        flattened.begin(), flattened.end(), [](auto& a, auto& b) {
+          return a->evaluationCost() < b->evaluationCost();
+        });
+
+    // Flattening and sorting may have made mergeable terms adjacent.
+    auto op = allof ? AggregateOp::AllOf : AggregateOp::AnyOf;
+    std::vector<std::unique_ptr<QueryExpr>> merged;
+    merged.reserve(flattened.size());
+    for (auto& expr : flattened) {
+      if (!merged.empty()) {
+        if (auto aggExpr = merged.back()->aggregate(expr.get(), op)) {
+          merged.back() = std::move(aggExpr);
+          continue;
+        }
+      }
+      merged.push_back(std::move(expr));
+    }
+
+    if (merged.size() == 1) {
+      return std::move(merged.front());
+    }
+    exprs = std::move(merged);
+    return nullptr;
+  }
+
+  std::optional<std::vector<w_string>> computeSuffixes() const override {
+    if (allof) {
+      // Any one constrained term is sufficient; pick the narrowest.
+      std::optional<std::vector<w_string>> best;
+      for (auto& expr : exprs) {
+        auto suffixes = expr->computeSuffixes();
+        if (suffixes && (!best || suffixes->size() < best->size())) {
+          best = std::move(suffixes);
+        }
+      }
+      return best;
+    }
+
+    // Every alternative must be constrained for the union to be.
+    std::vector<w_string> result;
+    for (auto& expr : exprs) {
+      auto suffixes = expr->computeSuffixes();
+      if (!suffixes) {
+        return std::nullopt;
+      }
+      result.insert(result.end(), suffixes->begin(), suffixes->end());
+    }
+    return result;
+  }
+
+  std::optional<std::vector<w_string>> computeWholeNames() const override {
+    if (allof) {
+      // Any one constrained term is sufficient; pick the narrowest.
+      std::optional<std::vector<w_string>> best;
+      for (auto& expr : exprs) {
+        auto names = expr->computeWholeNames();
+        if (names && (!best || names->size() < best->size())) {
+          best = std::move(names);
+        }
+      }
+      return best;
+    }
+
+    // Every alternative must be constrained for the union to be.
+    std::vector<w_string> result;
+    for (auto& expr : exprs) {
+      auto names = expr->computeWholeNames();
+      if (!names) {
+        return std::nullopt;
+      }
+      result.insert(result.end(), names->begin(), names->end());
+    }
+    return result;
+  }
+
+  bool wholeNamesAreCaseless() const override {
+    // Looking up every name caselessly finds a superset of the files, which
+    // the expression then filters
+    for (auto& expr : exprs) {
+      if (expr->wholeNamesAreCaseless()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   static std::unique_ptr<QueryExpr>
   parse(Query* query, const json_ref& term, bool allof) {
     std::vector<std::unique_ptr<QueryExpr>> list;
@@ -164,5 +439,22 @@ class ListExpr : public QueryExpr {
 W_TERM_PARSER(anyof, ListExpr::parseAnyOf);
 W_TERM_PARSER(allof, ListExpr::parseAllOf);
 
+std::unique_ptr<QueryExpr> NotExpr::simplify() {
+  if (auto simplified = expr->simplify()) {
+    expr = std::move(simplified);
+  }
+  if (auto* inner = dynamic_cast<NotExpr*>(expr.get())) {
+    // not(not(x)) is x
+    return std::move(inner->expr);
+  }
+  if (dynamic_cast<TrueExpr*>(expr.get())) {
+    return std::make_unique<FalseExpr>();
+  }
+  if (dynamic_cast<FalseExpr*>(expr.get())) {
+    return std::make_unique<TrueExpr>();
+  }
+  return nullptr;
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -11,7 +11,10 @@
 #include "watchman/query/TermRegistry.h"
 #include "watchman/query/intcompare.h"
 
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <string>
 
 using namespace watchman;
 
@@ -22,9 +25,31 @@ static inline bool is_dir_sep(int c) {
 class DirNameExpr : public QueryExpr {
   w_string dirname;
   struct w_query_int_compare depth;
-  using StartsWith = bool (*)(w_string_t* str, w_string_t* prefix);
+  using StartsWith = bool (w_string_piece::*)(w_string_piece prefix) const;
   StartsWith startswith;
 
+  // The result of the depth comparison for every depth of at least
+  // minDepth, if they all agree
+  std::optional<bool> depthVerdict(json_int_t minDepth) const {
+    auto comp = depth;
+    bool atMinDepth = eval_int_compare(minDepth, &comp);
+    switch (depth.op) {
+      case W_QUERY_ICMP_GT:
+      case W_QUERY_ICMP_GE:
+        return atMinDepth ? std::optional<bool>{true} : std::nullopt;
+      case W_QUERY_ICMP_LT:
+      case W_QUERY_ICMP_LE:
+        return atMinDepth ? std::nullopt : std::optional<bool>{false};
+      case W_QUERY_ICMP_EQ:
+        return depth.operand < minDepth ? std::optional<bool>{false}
+                                        : std::nullopt;
+      case W_QUERY_ICMP_NE:
+        return depth.operand < minDepth ? std::optional<bool>{true}
+                                        : std::nullopt;
+    }
+    return std::nullopt;
+  }
+
  public:
   explicit DirNameExpr(
       w_string dirname,
@@ -33,7 +58,7 @@ class DirNameExpr : public QueryExpr {
       : dirname(dirname), depth(depth), startswith(startswith) {}
 
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult*) override {
-    auto& str = ctx->getWholeName();
+    auto str = ctx->getWholeName();
 
     if (str.size() <= dirname.size()) {
       // Either it doesn't prefix match, or file name is == dirname.
@@ -52,7 +77,7 @@ class DirNameExpr : public QueryExpr {
       return false;
     }
 
-    if (!startswith(str, dirname)) {
+    if (!(str.*startswith)(dirname)) {
       return false;
     }
 
@@ -68,6 +93,88 @@ class DirNameExpr : public QueryExpr {
     return eval_int_compare(actual_depth, &depth);
   }
 
+  const char* termName() const override {
+    return "dirname";
+  }
+
+  DirVerdict evaluateDir(w_string_piece dirName) const override {
+    // The wholenames of the files beneath dirName all begin with this
+    std::string known{dirName.view()};
+    if (!known.empty()) {
+      known.push_back('/');
+    }
+    w_string_piece prefix{known.data(), known.size()};
+
+    if (!dirname.empty() && dirname.size() >= prefix.size()) {
+      // The names below prefix decide whether they are beneath dirname,
+      // but they can only be if dirname continues from prefix
+      if (!(w_string_piece(dirname).*startswith)(prefix)) {
+        return DirVerdict{false, false};
+      }
+      return {};
+    }
+
+    // As evaluate(), but only over the part of the names that we know
+    if (!dirname.empty() && !is_dir_sep(prefix.data()[dirname.size()])) {
+      return DirVerdict{false, false};
+    }
+    if (!(prefix.*startswith)(dirname)) {
+      return DirVerdict{false, false};
+    }
+    json_int_t minDepth = 0;
+    for (size_t i = dirname.size() + 1; i < prefix.size(); i++) {
+      if (is_dir_sep(prefix.data()[i])) {
+        minDepth++;
+      }
+    }
+    // A separator in a file's own name counts towards its depth, so the
+    // files directly inside are only known to be at least that deep
+    return DirVerdict{depthVerdict(minDepth), depthVerdict(minDepth + 1)};
+  }
+
+  bool evaluatesDirs() const override {
+    return true;
+  }
+
+  std::optional<w_string> computeRequiredDirName() const override {
+    // The view's tree is case sensitive, so a caseless match can't be
+    // satisfied by walking a single subtree.  The root is no constraint.
+    if (startswith != &w_string_piece::startsWith || dirname.empty() ||
+        is_dir_sep(dirname.data()[dirname.size() - 1])) {
+      return std::nullopt;
+    }
+    return dirname;
+  }
+
+  std::optional<uint32_t> computeRequiredDirDepth(
+      w_string_piece dirName) const override {
+    if (startswith != &w_string_piece::startsWith || dirName != dirname) {
+      return std::nullopt;
+    }
+    json_int_t maxDepth;
+    switch (depth.op) {
+      case W_QUERY_ICMP_EQ:
+      case W_QUERY_ICMP_LE:
+        maxDepth = depth.operand;
+        break;
+      case W_QUERY_ICMP_LT:
+        maxDepth = depth.operand - 1;
+        break;
+      default:
+        return std::nullopt;
+    }
+    // A bound below 0 matches nothing; we still have to walk the files
+    // directly in dirname to find that out.
+    return uint32_t(std::clamp(
+        maxDepth,
+        json_int_t(0),
+        json_int_t(std::numeric_limits<uint32_t>::max())));
+  }
+
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::NameLookup;
+  }
+
   // ["dirname", "foo"] -> ["dirname", "foo", ["depth", "ge", 0]]
   static std::unique_ptr<QueryExpr>
   parse(Query*, const json_ref& term, CaseSensitivity case_sensitive) {
@@ -119,8 +226,8 @@ class DirNameExpr : public QueryExpr {
         json_to_w_string(name),
         depth_comp,
         case_sensitive == CaseSensitivity::CaseInSensitive
-            ? w_string_startswith_caseless
-            : w_string_startswith);
+            ? &w_string_piece::startsWithCaseInsensitive
+            : &w_string_piece::startsWith);
   }
   static std::unique_ptr<QueryExpr> parseDirName(
       Query* query,
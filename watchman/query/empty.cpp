@@ -21,6 +21,10 @@ class ExistsExpr : public QueryExpr {
     return file->exists();
   }
 
+  const char* termName() const override {
+    return "exists";
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref&) {
     return std::make_unique<ExistsExpr>();
   }
@@ -56,6 +60,10 @@ class EmptyExpr : public QueryExpr {
     return false;
   }
 
+  const char* termName() const override {
+    return "empty";
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref&) {
     return std::make_unique<EmptyExpr>();
   }
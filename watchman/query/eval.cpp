@@ -8,15 +8,19 @@
 #include "watchman/query/eval.h"
 #include <fmt/chrono.h>
 #include <folly/ScopeGuard.h>
+#include <optional>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
+#include "watchman/NumaBinding.h"
 #include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
+#include "watchman/TraceRecorder.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/LocalFileResult.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/query/SlowQueryLog.h"
 #include "watchman/root/Root.h"
 #include "watchman/saved_state/SavedStateInterface.h"
 #include "watchman/scm/SCM.h"
@@ -45,21 +49,64 @@ const std::vector<w_string>& getUnconditionalLogFilePrefixes() {
       computeUnconditionalLogFilePrefixes();
   return names;
 }
-} // namespace
 
-/* Query evaluator */
-void w_query_process_file(
+bool isAtOrBelow(w_string_piece path, w_string_piece dir) {
+  return path == dir ||
+      (path.size() > dir.size() && path.startsWith(dir) &&
+       is_slash(path[dir.size()]));
+}
+
+// Returns the path beneath which the query needs the changes in order to
+// be answered: its relative_root, narrowed to the common ancestor of its
+// paths if it has any.  Empty if that is the whole root.
+w_string syncScopeOf(const Query* query, const w_string& rootPath) {
+  if (!query->paths || query->paths->empty()) {
+    return query->relative_root;
+  }
+  const auto& base =
+      query->relative_root.empty() ? rootPath : query->relative_root;
+
+  std::optional<w_string> scope;
+  for (const auto& path : *query->paths) {
+    if (path.name.view().find("..") != std::string_view::npos) {
+      // Can't tell where it leads without resolving it
+      return query->relative_root;
+    }
+    auto full =
+        path.name.empty() ? base : w_string::pathCat({base, path.name});
+    if (!scope) {
+      scope = full;
+      continue;
+    }
+    while (scope->size() > base.size() && !isAtOrBelow(full, *scope)) {
+      scope = scope->dirName();
+    }
+  }
+  if (scope->size() <= base.size()) {
+    return query->relative_root;
+  }
+  return *scope;
+}
+
+// Returns the full paths of the dirs that the query is confined to
+std::vector<w_string> queryDirsOf(
     const Query* query,
-    QueryContext* ctx,
-    std::unique_ptr<FileResult> file) {
-  // TODO: Should this be implicit by assigning a file to the QueryContext? It
-  // could be cleared when resetting the file.
-  ctx->resetWholeName();
-  ctx->file = std::move(file);
-  SCOPE_EXIT {
-    ctx->file.reset();
-  };
+    const w_string& rootPath) {
+  const auto& base = query->relative_root ? query->relative_root : rootPath;
+  std::vector<w_string> dirs;
+  if (query->paths) {
+    for (auto& path : *query->paths) {
+      dirs.push_back(w_string::pathCat({base, path.name}));
+    }
+  } else {
+    dirs.push_back(base);
+  }
+  return dirs;
+}
+} // namespace
 
+// Evaluates query against ctx->file
+static std::optional<bool> fileMatches(const Query* query, QueryContext* ctx) {
   // For fresh instances, only return files that currently exist
   // TODO: shift this clause to execute_common and generate
   // a wrapped query: ["allof", "exists", EXPR] and execute that
@@ -70,46 +117,44 @@ void w_query_process_file(
       ctx->since.clock.is_fresh_instance) {
     auto exists = ctx->file->exists();
     if (!exists.has_value()) {
-      // Reconsider this one later
-      ctx->addToEvalBatch(std::move(ctx->file));
-      return;
+      return std::nullopt;
     }
     if (!exists.value()) {
-      return;
+      return false;
     }
   }
 
   // We produce an output for this file if there is no expression,
   // or if the expression matched.
   if (query->expr) {
-    auto match = query->expr->evaluate(ctx, ctx->file.get());
-
-    if (!match.has_value()) {
-      // Reconsider this one later
-      ctx->addToEvalBatch(std::move(ctx->file));
-      return;
-    } else if (!*match) {
-      return;
-    }
+    return query->expr->evaluate(ctx, ctx->file.get());
   }
+  return true;
+}
 
+// Dedups and renders ctx->file, which has matched the query
+static void emitFile(const Query* query, QueryContext* ctx) {
   if (ctx->query->dedup_results) {
-    auto name = ctx->getWholeName();
-
-    auto inserted = ctx->dedup.insert(name);
-    if (!inserted.second) {
+    auto identity = ctx->file->identity();
+    bool inserted = identity && ctx->dedupsByIdentity()
+        ? ctx->dedupIdentities.insert(identity).second
+        : ctx->dedup.insert(ctx->getWholeName().asWString()).second;
+    if (!inserted) {
       // Already present in the results, no need to emit it again
       ctx->num_deduped++;
       return;
     }
   }
+  if (ctx->explain) {
+    ctx->explain->matched++;
+  }
 
   auto logPrefixes = getUnconditionalLogFilePrefixes();
   if (!logPrefixes.empty()) {
     auto name = ctx->getWholeName();
     for (auto& prefix : logPrefixes) {
-      if (name.piece().startsWith(prefix)) {
-        ctx->namesToLog.push_back(name);
+      if (name.startsWith(prefix)) {
+        ctx->namesToLog.push_back(name.asWString());
       }
     }
   }
@@ -117,10 +162,60 @@ void w_query_process_file(
   ctx->maybeRender(std::move(ctx->file));
 }
 
+/* Query evaluator */
+void w_query_process_file(
+    const Query* query,
+    QueryContext* ctx,
+    std::unique_ptr<FileResult> file) {
+  // TODO: Should this be implicit by assigning a file to the QueryContext? It
+  // could be cleared when resetting the file.
+  ctx->resetWholeName();
+  ctx->file = std::move(file);
+  SCOPE_EXIT {
+    ctx->file.reset();
+  };
+
+  auto match = fileMatches(query, ctx);
+  if (!match.has_value()) {
+    // Reconsider this one later
+    ctx->addToEvalBatch(std::move(ctx->file));
+    return;
+  } else if (!*match) {
+    return;
+  }
+
+  emitFile(query, ctx);
+}
+
+std::optional<bool> w_query_evaluate_file(
+    const Query* query,
+    QueryContext* ctx,
+    std::unique_ptr<FileResult>& file) {
+  ctx->resetWholeName();
+  ctx->file = std::move(file);
+  SCOPE_EXIT {
+    file = std::move(ctx->file);
+  };
+  return fileMatches(query, ctx);
+}
+
+void w_query_emit_matched_file(
+    const Query* query,
+    QueryContext* ctx,
+    std::unique_ptr<FileResult> file) {
+  ctx->resetWholeName();
+  ctx->file = std::move(file);
+  SCOPE_EXIT {
+    ctx->file.reset();
+  };
+  emitFile(query, ctx);
+}
+
 void time_generator(
     const Query* query,
     const std::shared_ptr<Root>& root,
     QueryContext* ctx) {
+  ctx->noteGenerator("time");
   root->view()->timeGenerator(query, ctx);
 }
 
@@ -137,19 +232,40 @@ static void default_generators(
   }
 
   if (query->paths.has_value()) {
+    ctx->noteGenerator("path");
     root->view()->pathGenerator(query, ctx);
     generated = true;
   }
 
   if (query->glob_tree) {
+    ctx->noteGenerator("glob");
     root->view()->globGenerator(query, ctx);
     generated = true;
   }
 
   // And finally, if there were no other generators, we walk all known
-  // files
+  // files, or just those that the query planner determined the expression
+  // could possibly match.
   if (!generated) {
-    root->view()->allFilesGenerator(query, ctx);
+    if (query->plannedWholeNames) {
+      ctx->noteGenerator("name");
+      root->view()->wholeNamesGenerator(
+          query,
+          *query->plannedWholeNames,
+          query->plannedWholeNamesCaseless ? CaseSensitivity::CaseInSensitive
+                                           : CaseSensitivity::CaseSensitive,
+          ctx);
+    } else if (query->plannedDirName) {
+      ctx->noteGenerator("subtree");
+      root->view()->subtreeGenerator(
+          query, *query->plannedDirName, query->plannedDirDepth, ctx);
+    } else if (query->plannedSuffixes) {
+      ctx->noteGenerator("suffix");
+      root->view()->suffixGenerator(query, *query->plannedSuffixes, ctx);
+    } else {
+      ctx->noteGenerator("all");
+      root->view()->allFilesGenerator(query, ctx);
+    }
   }
 }
 
@@ -174,8 +290,13 @@ static void execute_common(
     }
     generator(ctx->query, ctx->root, ctx);
   }
+  if (ctx->explain) {
+    ctx->explain->generatorsFinished(ctx->getNumWalked());
+  }
+  // Generators may have deferred evaluation until they released the view
+  ctx->evaluateDeferredNow();
   ctx->generationDuration = ctx->stopWatch.lap();
-  ctx->state = QueryContextState::Rendering;
+  ctx->setState(QueryContextState::Rendering);
 
   // We may have some file results pending re-evaluation,
   // so make sure that we process them before we get to
@@ -188,7 +309,7 @@ static void execute_common(
   }
 
   ctx->renderDuration = ctx->stopWatch.lap();
-  ctx->state = QueryContextState::Completed;
+  ctx->setState(QueryContextState::Completed);
 
   // For Eden instances it is possible that when running the query it was
   // discovered that it is actually a fresh instance [e.g. mount generation
@@ -220,16 +341,118 @@ static void execute_common(
         json_object(
             {{"fresh_instance", json_boolean(res->isFreshInstance)},
              {"num_deduped", json_integer(ctx->num_deduped)},
-             {"num_results", json_integer(ctx->resultsArray.size())},
+             {"num_results", json_integer(ctx->getNumResults())},
              {"num_walked", json_integer(ctx->getNumWalked())},
              {"query", ctx->query->query_spec}}));
     sample->log();
   }
 
+  if (sample) {
+    // Not for the bench iterations
+    maybeLogSlowQuery(*ctx);
+  }
+
+  if (ctx->query->orderBy) {
+    res->continuation = ctx->finishOrderedResults();
+  }
+  if (ctx->aggregateResults) {
+    res->aggregate = ctx->aggregateResults->takeResults();
+  }
+  if (ctx->explain) {
+    res->explain = ctx->explain->render(*ctx);
+  }
   res->resultsArray = ctx->renderResults();
+  res->bserResults = std::move(ctx->bserResults);
+  res->columnarResults = std::move(ctx->columnarResults);
   res->dedupedFileNames = std::move(ctx->dedup);
 }
 
+// Returns the key under which the results of query are cached, or a null
+// string if they can't be.  Cached results were produced by the default
+// generators, so any other generator opts out, as do the queries whose
+// results depend on more than the view, or are consumed by more than the
+// response, or come with a continuation.
+static w_string queryResultCacheKey(
+    const Query* query,
+    const QueryContext& ctx,
+    bool hasGenerator,
+    const BserResultsRenderer* bserResults) {
+  if (ctx.root->queryResultCacheSize == 0 || hasGenerator ||
+      !query->query_spec || ctx.resultsSink || ctx.columnarResults ||
+      ctx.aggregateResults || query->dedup_results || query->limit > 0 ||
+      query->bench_iterations > 0 || query->explain ||
+      (query->since_spec &&
+       (query->since_spec->hasScmParams() ||
+        query->since_spec->hasSavedStateParams()))) {
+    return nullptr;
+  }
+
+  // The spec names the since clock, but a named cursor, or a clock from a
+  // previous instance, only shows where it points once it is evaluated
+  auto since = ctx.since.is_timestamp
+      ? w_string::build("t", ctx.since.timestamp)
+      : ctx.since.clock.is_fresh_instance
+      ? w_string("f", W_STRING_UNICODE)
+      : w_string::build("c", ctx.since.clock.ticks);
+  auto spec = json_dumps(query->query_spec, JSON_SORT_KEYS | JSON_COMPACT);
+  return w_string::build(
+      since,
+      ":",
+      bserResults ? bserResults->bserVersion() : 0,
+      ":",
+      bserResults ? bserResults->bserCapabilities() : 0,
+      ":",
+      spec);
+}
+
+static bool lookupCachedQueryResult(
+    const Root& root,
+    const QueryContext& ctx,
+    const ClockPosition& position,
+    const w_string& key,
+    QueryResult* res) {
+  auto cache = root.queryResultCache.rlock();
+  if (cache->position != position ||
+      cache->lastAgeOutTick != ctx.lastAgeOutTickValueAtStartOfQuery) {
+    return false;
+  }
+  auto it = cache->entries.find(key);
+  if (it == cache->entries.end()) {
+    return false;
+  }
+  res->isFreshInstance = it->second.isFreshInstance;
+  res->resultsArray = it->second.resultsArray;
+  res->bserResults = it->second.bserResults;
+  res->debugInfo.resultCacheHit = true;
+  return true;
+}
+
+static void storeCachedQueryResult(
+    Root& root,
+    const QueryContext& ctx,
+    const ClockPosition& position,
+    const w_string& key,
+    const QueryResult& res) {
+  auto cache = root.queryResultCache.wlock();
+  if (cache->position != position ||
+      cache->lastAgeOutTick != ctx.lastAgeOutTickValueAtStartOfQuery) {
+    if (cache->position.rootNumber == position.rootNumber &&
+        cache->position.ticks > position.ticks) {
+      // Another query has already seen a newer view than this one
+      return;
+    }
+    cache->entries.clear();
+    cache->position = position;
+    cache->lastAgeOutTick = ctx.lastAgeOutTickValueAtStartOfQuery;
+  }
+  if (cache->entries.size() >= root.queryResultCacheSize &&
+      cache->entries.find(key) == cache->entries.end()) {
+    cache->entries.erase(cache->entries.begin());
+  }
+  cache->entries[key] = Root::CachedQueryResult{
+      res.isFreshInstance, res.resultsArray, res.bserResults};
+}
+
 // Capability indicating support for scm-aware since queries
 W_CAP_REG("scm-since")
 
@@ -237,12 +460,18 @@ QueryResult w_query_execute(
     const Query* query,
     const std::shared_ptr<Root>& root,
     QueryGenerator generator,
-    SavedStateFactory savedStateFactory) {
+    SavedStateFactory savedStateFactory,
+    std::function<void(json_ref&& files)> resultsSink,
+    std::unique_ptr<BserResultsRenderer> bserResults,
+    std::unique_ptr<ColumnarResultsRenderer> columnarResults) {
   QueryResult res;
   ClockSpec resultClock(ClockPosition{});
   bool disableFreshInstance{false};
   auto requestId = query->request_id;
 
+  // Walk the view from the NUMA node that holds it
+  NumaBinding numa(int(root->config.getInt("numa_node", -1)));
+
   PerfSample sample("query_execute");
   if (requestId && !requestId.empty()) {
     log(DBG, "request_id = ", requestId, "\n");
@@ -262,8 +491,13 @@ QueryResult w_query_execute(
     // determine if SCM operations ocurred concurrent with query execution.
     res.stateTransCountAtStartOfQuery = root->stateTransCount.load();
     resultClock.scmMergeBaseWith = query->since_spec->scmMergeBaseWith;
-    resultClock.scmMergeBase =
-        scm->mergeBaseWith(resultClock.scmMergeBaseWith, requestId);
+    // The view keeps the merge base with this commit up to date from now on
+    scm->noteMergeBaseWith(resultClock.scmMergeBaseWith);
+    {
+      TraceSpan span("scm", "mergeBaseWith", root->root_path);
+      resultClock.scmMergeBase =
+          scm->mergeBaseWith(resultClock.scmMergeBaseWith, requestId);
+    }
     // Always update the saved state storage type and key, but conditionally
     // update the saved state commit id below based on wether the mergebase has
     // changed.
@@ -319,9 +553,14 @@ QueryResult w_query_execute(
                         const Query* q,
                         const std::shared_ptr<Root>& r,
                         QueryContext* c) {
-          auto changedFiles =
-              root->view()->getSCM()->getFilesChangedSinceMergeBaseWith(
-                  modifiedMergebase, requestId);
+          std::vector<w_string> changedFiles;
+          {
+            TraceSpan span(
+                "scm", "getFilesChangedSinceMergeBaseWith", root->root_path);
+            changedFiles =
+                root->view()->getSCM()->getFilesChangedSinceMergeBaseWith(
+                    modifiedMergebase, requestId);
+          }
 
           auto pathList = json_array_of_size(changedFiles.size());
           for (auto& f : changedFiles) {
@@ -335,7 +574,9 @@ QueryResult w_query_execute(
           for (auto& pathEntry : pathList.array()) {
             auto path = json_to_w_string(pathEntry);
 
-            auto fullPath = w_string::pathCat({r->root_path, path});
+            // The paths are relative to the root whose view has the SCM
+            auto fullPath =
+                w_string::pathCat({r->viewOwner().root_path, path});
             if (!c->fileMatchesRelativeRoot(fullPath)) {
               continue;
             }
@@ -375,6 +616,31 @@ QueryResult w_query_execute(
     };
   }
   QueryContext ctx{query, root, disableFreshInstance};
+  if (query->explain) {
+    ctx.explain = std::make_unique<QueryExplain>(*query);
+    ctx.termEvaluations = &ctx.explain->terms;
+  }
+  if (query->aggregate) {
+    // Only the totals are sent, however the client asked for the files
+    ctx.aggregateResults =
+        std::make_unique<AggregateResultsRenderer>(*query->aggregate);
+  } else if (!query->orderBy) {
+    // Ordered results can only be sent once they have all been rendered,
+    // and sorted, so they are always rendered into resultsArray
+    if (query->streamResultsChunkSize > 0) {
+      ctx.resultsSink = std::move(resultsSink);
+    }
+    if (!ctx.resultsSink) {
+      ctx.bserResults = std::move(bserResults);
+    }
+    if (!ctx.resultsSink && !ctx.bserResults) {
+      ctx.columnarResults = std::move(columnarResults);
+    }
+  }
+  // The kernels don't know to log the names that match these
+  if (query->kernel && getUnconditionalLogFilePrefixes().empty()) {
+    ctx.kernel = query->kernel->select(ctx);
+  }
 
   // Track the query against the root.
   // This is to enable the `watchman debug-status` diagnostic command.
@@ -394,11 +660,27 @@ QueryResult w_query_execute(
           query->settle_timeouts->settle_timeout));
     }
   }
-  if (query->sync_timeout.count()) {
-    ctx.state = QueryContextState::WaitingForCookieSync;
+  if (query->sync_timeout.count() && query->maxStaleness) {
+    ctx.setState(QueryContextState::WaitingForCookieSync);
     ctx.stopWatch.reset();
+    res.staleness =
+        root->reuseRecentSync(*query->maxStaleness, query->sync_timeout);
+    if (res.staleness) {
+      ctx.cookieSyncDuration = ctx.stopWatch.lap();
+    }
+  }
+  if (query->sync_timeout.count() && !res.staleness) {
+    ctx.setState(QueryContextState::WaitingForCookieSync);
+    ctx.stopWatch.reset();
+    if (query->maxStaleness) {
+      res.staleness = std::chrono::milliseconds(0);
+    }
     try {
-      auto result = root->syncToNow(query->sync_timeout);
+      // A query confined to a relative_root, or to paths, only needs the
+      // changes beneath it, which the IO thread can process ahead of the
+      // rest, and which only the cookie dirs covering it need to see.
+      auto result = root->syncToNow(
+          query->sync_timeout, syncScopeOf(query, root->root_path));
       res.debugInfo.cookieFileNames = std::move(result.cookieFileNames);
     } catch (const std::exception& exc) {
       throw QueryExecError("synchronization failed: ", exc.what());
@@ -406,6 +688,15 @@ QueryResult w_query_execute(
     ctx.cookieSyncDuration = ctx.stopWatch.lap();
   }
 
+  if (!root->viewOwner().inner.done_initial.load(std::memory_order_acquire)) {
+    // The view may be able to answer us before its initial crawl has
+    // finished, as long as it has crawled the parts that we look at
+    ctx.setState(QueryContextState::WaitingForCrawl);
+    root->view()->waitForCrawl(queryDirsOf(query, root->root_path)).get();
+  }
+  // The client may have given up while we waited
+  ctx.throwIfCancelled();
+
   /* The first stage of execution is generation.
    * We generate a series of file inputs to pass to
    * the query executor.
@@ -434,6 +725,24 @@ QueryResult w_query_execute(
                                       &root->inner.cursors)
                                 : w_query_since();
 
+  // Identical queries issued at the same position, such as the since
+  // queries of parallel build workers, can share one set of results
+  auto cacheKey =
+      queryResultCacheKey(query, ctx, bool(generator), ctx.bserResults.get());
+  ClockPosition cachePosition;
+  if (cacheKey) {
+    // Keyed on the last change rather than the current tick, as the cookie
+    // that synced each query spends a tick without changing any file
+    cachePosition = root->view()->getLastChangePosition();
+    if (lookupCachedQueryResult(*root, ctx, cachePosition, cacheKey, &res)) {
+      return res;
+    }
+  }
+
+  // The parts of the tree that the view has paged out have to be brought
+  // back before the generators can walk them
+  root->view()->pageInForQuery(queryDirsOf(query, root->root_path), ctx.since);
+
   if (query->bench_iterations > 0) {
     for (uint32_t i = 0; i < query->bench_iterations; ++i) {
       QueryContext c{query, root, ctx.disableFreshInstance};
@@ -445,6 +754,9 @@ QueryResult w_query_execute(
   }
 
   execute_common(&ctx, &sample, &res, generator);
+  if (cacheKey) {
+    storeCachedQueryResult(*root, ctx, cachePosition, cacheKey, res);
+  }
   return res;
 }
 
@@ -9,6 +9,7 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
 #include "watchman/query/FileResult.h"
 #include "watchman/query/QueryResult.h"
 #include "watchman/saved_state/SavedStateInterface.h"
@@ -33,12 +34,25 @@ using QueryGenerator = std::function<void(
  *
  * savedStateFactory allows testing this function without pulling in a wide
  * set of dependencies.
+ *
+ * If the query requested streamed results and resultsSink is set, chunks of
+ * rendered results are passed to resultsSink as they are produced and the
+ * resultsArray of the returned QueryResult holds only the final chunk.
+ *
+ * If bserResults is set, and results are not being streamed, the results
+ * are rendered into it rather than into resultsArray and it is returned
+ * as the bserResults of the QueryResult.  Similarly for columnarResults,
+ * which is used only if neither of the others is.
  */
 watchman::QueryResult w_query_execute(
     const watchman::Query* query,
     const std::shared_ptr<watchman::Root>& root,
     watchman::QueryGenerator generator,
-    watchman::SavedStateFactory savedStateFactory);
+    watchman::SavedStateFactory savedStateFactory,
+    std::function<void(json_ref&& files)> resultsSink = nullptr,
+    std::unique_ptr<watchman::BserResultsRenderer> bserResults = nullptr,
+    std::unique_ptr<watchman::ColumnarResultsRenderer> columnarResults =
+        nullptr);
 
 // Allows a generator to process a file node
 // through the query engine
@@ -47,6 +61,22 @@ void w_query_process_file(
     watchman::QueryContext* ctx,
     std::unique_ptr<watchman::FileResult> file);
 
+// Evaluates query against file as w_query_process_file does, but without
+// rendering it.  Returns nullopt if some of the file's data must be loaded
+// before it can be evaluated.  Safe to call on several threads at once as
+// long as each has its own ctx.
+std::optional<bool> w_query_evaluate_file(
+    const watchman::Query* query,
+    watchman::QueryContext* ctx,
+    std::unique_ptr<watchman::FileResult>& file);
+
+// Dedups and renders a file that w_query_evaluate_file found to match,
+// as w_query_process_file would have done.
+void w_query_emit_matched_file(
+    const watchman::Query* query,
+    watchman::QueryContext* ctx,
+    std::unique_ptr<watchman::FileResult> file);
+
 void time_generator(
     const watchman::Query* query,
     const std::shared_ptr<watchman::Root>& root,
@@ -28,9 +28,12 @@ std::optional<json_ref> make_symlink(FileResult* file, const QueryContext*) {
   return *target ? w_string_to_json(*target) : json_null();
 }
 
-std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
+// Renders the hash that getHash yields for file as hex
+std::optional<json_ref> make_hash_hex(
+    FileResult* file,
+    std::optional<FileResult::ContentHash> (FileResult::*getHash)()) {
   try {
-    auto hash = file->getContentSha1();
+    auto hash = (file->*getHash)();
     if (!hash.has_value()) {
       // Need to load it still
       return std::nullopt;
@@ -62,6 +65,16 @@ std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
   }
 }
 
+std::optional<json_ref> make_sha1_hex(FileResult* file, const QueryContext*) {
+  return make_hash_hex(file, &FileResult::getContentSha1);
+}
+
+std::optional<json_ref> make_fingerprint(
+    FileResult* file,
+    const QueryContext*) {
+  return make_hash_hex(file, &FileResult::getContentFingerprint);
+}
+
 std::optional<json_ref> make_size(FileResult* file, const QueryContext*) {
   auto size = file->size();
   if (!size.has_value()) {
@@ -188,11 +201,11 @@ MAKE_INT_FIELD(nlink, nlink)
 
 // clang-format off
 #define MAKE_TIME_FIELD_DEFS(type) \
-  { #type "time", make_##type##time}, \
-  { #type "time_ms", make_##type##time_ms},\
-  { #type "time_us", make_##type##time_us}, \
-  { #type "time_ns", make_##type##time_ns}, \
-  { #type "time_f", make_##type##time_f}
+  { #type "time", make_##type##time, FileResult::StatTimeStamps}, \
+  { #type "time_ms", make_##type##time_ms, FileResult::StatTimeStamps},\
+  { #type "time_us", make_##type##time_us, FileResult::StatTimeStamps}, \
+  { #type "time_ns", make_##type##time_ns, FileResult::StatTimeStamps}, \
+  { #type "time_f", make_##type##time_f, FileResult::StatTimeStamps}
 // clang-format on
 
 std::optional<json_ref> make_type_field(FileResult* file, const QueryContext*) {
@@ -268,30 +281,38 @@ std::unordered_map<w_string, QueryFieldRenderer> build_defs() {
   struct {
     const char* name;
     std::optional<json_ref> (*make)(FileResult* file, const QueryContext* ctx);
+    FileResult::Properties properties;
   } defs[] = {
-      {"name", make_name},
-      {"symlink_target", make_symlink},
-      {"exists", make_exists},
-      {"size", make_size},
-      {"mode", make_mode},
-      {"uid", make_uid},
-      {"gid", make_gid},
+      {"name", make_name, FileResult::Name},
+      {"symlink_target", make_symlink, FileResult::SymlinkTarget},
+      {"exists", make_exists, FileResult::Exists},
+      {"size", make_size, FileResult::Size},
+      {"mode", make_mode, FileResult::FullFileInformation},
+      {"uid", make_uid, FileResult::FullFileInformation},
+      {"gid", make_gid, FileResult::FullFileInformation},
       MAKE_TIME_FIELD_DEFS(a),
       MAKE_TIME_FIELD_DEFS(m),
       MAKE_TIME_FIELD_DEFS(c),
-      {"ino", make_ino},
-      {"dev", make_dev},
-      {"nlink", make_nlink},
-      {"new", make_new},
-      {"oclock", make_oclock},
-      {"cclock", make_cclock},
-      {"type", make_type_field},
-      {"content.sha1hex", make_sha1_hex},
+      {"ino", make_ino, FileResult::FullFileInformation},
+      {"dev", make_dev, FileResult::FullFileInformation},
+      {"nlink", make_nlink, FileResult::FullFileInformation},
+      {"new", make_new, FileResult::CTime},
+      {"oclock", make_oclock, FileResult::OTime},
+      {"cclock", make_cclock, FileResult::CTime},
+      // dtype() falls back to the full stat when the type isn't known
+      {"type",
+       make_type_field,
+       FileResult::Properties(
+           FileResult::FileDType | FileResult::FullFileInformation)},
+      {"content.sha1hex", make_sha1_hex, FileResult::ContentSha1},
+      {"content.fingerprint",
+       make_fingerprint,
+       FileResult::ContentFingerprint},
   };
   std::unordered_map<w_string, QueryFieldRenderer> map;
   for (auto& def : defs) {
     w_string name(def.name, W_STRING_UNICODE);
-    map.emplace(name, QueryFieldRenderer{name, def.make});
+    map.emplace(name, QueryFieldRenderer{name, def.make, def.properties});
   }
 
   return map;
@@ -315,6 +336,14 @@ void QueryFieldList::add(const w_string& name) {
   this->push_back(&it->second);
 }
 
+FileResult::Properties QueryFieldList::neededProperties() const {
+  FileResult::Properties properties = FileResult::None;
+  for (auto& f : *this) {
+    properties |= f->properties;
+  }
+  return properties;
+}
+
 json_ref field_list_to_json_name_array(const QueryFieldList& fieldList) {
   auto templ = json_array_of_size(fieldList.size());
 
@@ -149,6 +149,12 @@ bool add_glob(GlobTree* tree, const w_string& glob_str) {
   return true;
 }
 
+void compile_glob_tree(Query* res) {
+  auto case_sensitive = res->case_sensitive == CaseSensitivity::CaseSensitive;
+  res->glob_tree->compile(
+      res->glob_flags | (case_sensitive ? 0 : WM_CASEFOLD), case_sensitive);
+}
+
 } // namespace
 
 void parse_globs(Query* res, const json_ref& query) {
@@ -189,6 +195,7 @@ void parse_globs(Query* res, const json_ref& query) {
       throw QueryParseError("failed to compile multi-glob");
     }
   }
+  compile_glob_tree(res);
 }
 
 static w_string parse_suffix(const json_ref& ele) {
@@ -238,6 +245,7 @@ void parse_suffixes(Query* res, const json_ref& query) {
       throw QueryParseError("failed to compile multi-glob");
     }
   }
+  compile_glob_tree(res);
 }
 
 } // namespace watchman
@@ -109,6 +109,10 @@ class SizeExpr : public QueryExpr {
     return eval_int_compare(size.value(), &comp);
   }
 
+  const char* termName() const override {
+    return "size";
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     if (!term.isArray()) {
       throw QueryParseError("Expected array for 'size' term");
@@ -5,11 +5,14 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
 #include <string>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/query/FileResult.h"
+#include "watchman/query/GlobSet.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
@@ -17,12 +20,34 @@
 
 namespace watchman {
 
+namespace {
+
+char lowerAscii(char c) {
+  return c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+}
+
+// Returns the text that every name matching pattern must begin with: its
+// leading literal characters, with runs of slashes collapsed as wildmatch
+// does
+std::string literalPrefix(const char* pattern, bool caseless) {
+  std::string prefix;
+  for (auto p = pattern; *p && !strchr("*?[]\\", *p); ++p) {
+    if (*p == '/' && !prefix.empty() && prefix.back() == '/') {
+      continue;
+    }
+    prefix.push_back(caseless ? lowerAscii(*p) : *p);
+  }
+  return prefix;
+}
+
+} // namespace
+
 class WildMatchExpr : public QueryExpr {
-  std::string pattern;
-  CaseSensitivity caseSensitive;
+  GlobSet matcher;
   bool wholename;
-  bool noescape;
-  bool includedotfiles;
+  bool caseless;
+  // When matching the wholename, the text that it must begin with
+  std::string prefix;
 
  public:
   WildMatchExpr(
@@ -31,15 +56,21 @@ class WildMatchExpr : public QueryExpr {
       bool wholename,
       bool noescape,
       bool includedotfiles)
-      : pattern(pat),
-        caseSensitive(caseSensitive),
+      : matcher(
+            (includedotfiles ? 0 : WM_PERIOD) | (noescape ? WM_NOESCAPE : 0) |
+            (wholename ? WM_PATHNAME : 0) |
+            (caseSensitive == CaseSensitivity::CaseInSensitive ? WM_CASEFOLD
+                                                               : 0)),
         wholename(wholename),
-        noescape(noescape),
-        includedotfiles(includedotfiles) {}
+        caseless(caseSensitive == CaseSensitivity::CaseInSensitive) {
+    matcher.add(pat, 0);
+    if (wholename) {
+      prefix = literalPrefix(pat, caseless);
+    }
+  }
 
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
     w_string_piece str;
-    bool res;
 
     if (wholename) {
       str = ctx->getWholeName();
@@ -53,17 +84,38 @@ class WildMatchExpr : public QueryExpr {
     str = normBuf;
 #endif
 
-    res =
-        wildmatch(
-            pattern.c_str(),
-            str.data(),
-            (includedotfiles ? 0 : WM_PERIOD) | (noescape ? WM_NOESCAPE : 0) |
-                (wholename ? WM_PATHNAME : 0) |
-                (caseSensitive == CaseSensitivity::CaseInSensitive ? WM_CASEFOLD
-                                                                   : 0),
-            0) == WM_MATCH;
+    // Cheaply rejects most names by the literal text that the pattern
+    // requires before running wildmatch
+    return matcher.matchesAny(str.view());
+  }
 
-    return res;
+  const char* termName() const override {
+    return "match";
+  }
+
+  DirVerdict evaluateDir(w_string_piece dirName) const override {
+    if (prefix.empty()) {
+      return {};
+    }
+    // The wholenames beneath dirName all begin with it and a slash
+    auto dir = dirName.view();
+    auto known = std::min(prefix.size(), dir.empty() ? 0 : dir.size() + 1);
+    for (size_t i = 0; i < known; ++i) {
+      char c = i < dir.size() ? dir[i] : '/';
+#ifdef _WIN32
+      if (c == '\\') {
+        c = '/';
+      }
+#endif
+      if ((caseless ? lowerAscii(c) : c) != prefix[i]) {
+        return DirVerdict{false, false};
+      }
+    }
+    return {};
+  }
+
+  bool evaluatesDirs() const override {
+    return !prefix.empty();
   }
 
   static std::unique_ptr<QueryExpr>
@@ -145,6 +197,10 @@ class WildMatchExpr : public QueryExpr {
       const json_ref& term) {
     return parse(query, term, CaseSensitivity::CaseInSensitive);
   }
+
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Pattern;
+  }
 };
 W_TERM_PARSER(match, WildMatchExpr::parseMatch);
 W_TERM_PARSER(imatch, WildMatchExpr::parseIMatch);
@@ -11,65 +11,129 @@
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 
+#include <cctype>
 #include <unordered_set>
+#include <vector>
 
 using namespace watchman;
 
+namespace {
+
+// A name split at its final slash, so that a file can be looked up by its
+// wholename without having to build that string for every candidate
+struct SplitName {
+  w_string_piece dir;
+  w_string_piece base;
+};
+
+uint8_t foldByte(char c, bool caseless) {
+  return caseless ? uint8_t(tolower(uint8_t(c))) : uint8_t(c);
+}
+
+struct SplitNameHash {
+  bool caseless;
+
+  size_t operator()(const SplitName& name) const {
+    // FNV-1a, which can be run across both parts without joining them
+    uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&](w_string_piece str) {
+      for (size_t i = 0; i < str.size(); ++i) {
+        hash = (hash ^ foldByte(str[i], caseless)) * 1099511628211ULL;
+      }
+    };
+    mix(name.dir);
+    hash = (hash ^ '/') * 1099511628211ULL;
+    mix(name.base);
+    return hash;
+  }
+};
+
+struct SplitNameEqual {
+  bool caseless;
+
+  bool operator()(const SplitName& a, const SplitName& b) const {
+    if (caseless) {
+      return w_string_equal_caseless(a.dir, b.dir) &&
+          w_string_equal_caseless(a.base, b.base);
+    }
+    return a.dir == b.dir && a.base == b.base;
+  }
+};
+
+// Wholenames are relative, so one with a leading slash can never match; it
+// mustn't be split into a name at the top of the root
+bool couldBeWholeName(w_string_piece name) {
+  return !name.empty() && name[0] != '/';
+}
+
+using SplitNameSet =
+    std::unordered_set<SplitName, SplitNameHash, SplitNameEqual>;
+
+} // namespace
+
 class NameExpr : public QueryExpr {
-  w_string name;
-  std::unordered_set<w_string> set;
+  // Owns the strings that set refers into
+  std::vector<w_string> names;
+  SplitNameSet set;
   CaseSensitivity caseSensitive;
   bool wholename;
-  explicit NameExpr(
-      std::unordered_set<w_string>&& set,
+
+  NameExpr(
+      std::vector<w_string>&& names,
       CaseSensitivity caseSensitive,
       bool wholename)
-      : set(std::move(set)),
+      : names(std::move(names)),
+        set(this->names.size(),
+            SplitNameHash{caseSensitive == CaseSensitivity::CaseInSensitive},
+            SplitNameEqual{caseSensitive == CaseSensitivity::CaseInSensitive}),
         caseSensitive(caseSensitive),
-        wholename(wholename) {}
+        wholename(wholename) {
+    for (auto& name : this->names) {
+      auto piece = name.piece();
+      if (!wholename) {
+        set.insert(SplitName{w_string_piece(), piece});
+      } else if (couldBeWholeName(piece)) {
+        set.insert(SplitName{piece.dirName(), piece.baseName()});
+      }
+    }
+  }
 
  public:
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
-    if (!set.empty()) {
-      bool matched;
-      w_string str;
-
-      if (wholename) {
-        str = ctx->getWholeName();
-        if (caseSensitive == CaseSensitivity::CaseInSensitive) {
-          str = str.piece().asLowerCase();
-        }
-      } else {
-        str = caseSensitive == CaseSensitivity::CaseInSensitive
-            ? file->baseName().asLowerCase()
-            : file->baseName().asWString();
-      }
+    SplitName name{
+        wholename ? ctx->getWholeNameDirName() : w_string_piece(),
+        file->baseName()};
+    return set.find(name) != set.end();
+  }
 
-      matched = set.find(str) != set.end();
+  const char* termName() const override {
+    return "name";
+  }
 
-      return matched;
+  std::optional<std::vector<w_string>> computeWholeNames() const override {
+    if (!wholename) {
+      return std::nullopt;
     }
-
-    w_string_piece str;
-
-    if (wholename) {
-      str = ctx->getWholeName();
-    } else {
-      str = file->baseName();
+    std::vector<w_string> result;
+    result.reserve(names.size());
+    for (auto& name : names) {
+      if (couldBeWholeName(name)) {
+        result.push_back(name);
+      }
     }
+    return result;
+  }
 
-    if (caseSensitive == CaseSensitivity::CaseInSensitive) {
-      return w_string_equal_caseless(str, name);
-    }
-    return str == name;
+  bool wholeNamesAreCaseless() const override {
+    return caseSensitive == CaseSensitivity::CaseInSensitive;
   }
 
   static std::unique_ptr<QueryExpr>
   parse(Query*, const json_ref& term, CaseSensitivity caseSensitive) {
-    const char *pattern = nullptr, *scope = "basename";
+    const char* scope = "basename";
     const char* which =
         caseSensitive == CaseSensitivity::CaseInSensitive ? "iname" : "name";
-    std::unordered_set<w_string> set;
+    std::vector<w_string> names;
 
     if (!term.isArray()) {
       throw QueryParseError("Expected array for '", which, "' term");
@@ -108,23 +172,12 @@ class NameExpr : public QueryExpr {
         }
       }
 
-      set.reserve(json_array_size(name));
+      names.reserve(json_array_size(name));
       for (i = 0; i < json_array_size(name); i++) {
-        w_string element;
-        const auto& jele = name.at(i);
-        auto ele = json_to_w_string(jele);
-
-        if (caseSensitive == CaseSensitivity::CaseInSensitive) {
-          element = ele.piece().asLowerCase(ele.type()).normalizeSeparators();
-        } else {
-          element = ele.normalizeSeparators();
-        }
-
-        set.insert(element);
+        names.push_back(json_to_w_string(name.at(i)).normalizeSeparators());
       }
-
     } else if (name.isString()) {
-      pattern = json_string_value(name);
+      names.push_back(json_to_w_string(name).normalizeSeparators());
     } else {
       throw QueryParseError(
           "Argument 2 to '",
@@ -132,14 +185,8 @@ class NameExpr : public QueryExpr {
           "' must be either a string or an array of string");
     }
 
-    auto data = new NameExpr(
-        std::move(set), caseSensitive, !strcmp(scope, "wholename"));
-
-    if (pattern) {
-      data->name = json_to_w_string(name).normalizeSeparators();
-    }
-
-    return std::unique_ptr<QueryExpr>(data);
+    return std::unique_ptr<QueryExpr>(new NameExpr(
+        std::move(names), caseSensitive, !strcmp(scope, "wholename")));
   }
 
   static std::unique_ptr<QueryExpr> parseName(
@@ -152,6 +199,10 @@ class NameExpr : public QueryExpr {
       const json_ref& term) {
     return parse(query, term, CaseSensitivity::CaseInSensitive);
   }
+
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::NameLookup;
+  }
 };
 
 W_TERM_PARSER(name, NameExpr::parseName);
@@ -6,10 +6,13 @@
  */
 
 #include "watchman/query/parse.h"
+#include <algorithm>
+#include <limits>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/Query.h"
+#include "watchman/query/QueryExplain.h"
 #include "watchman/query/QueryExpr.h"
 #include "watchman/query/TermRegistry.h"
 #include "watchman/root/Root.h"
@@ -86,21 +89,25 @@ void parse_relative_root(
     const std::shared_ptr<Root>& root,
     Query* res,
     const json_ref& query) {
+  w_string path;
   auto relative_root = query.get_default("relative_root");
-  if (!relative_root) {
-    return;
-  }
-
-  if (!relative_root.isString()) {
-    throw QueryParseError("'relative_root' must be a string");
+  if (relative_root) {
+    if (!relative_root.isString()) {
+      throw QueryParseError("'relative_root' must be a string");
+    }
+    path = json_to_w_string(relative_root).normalizeSeparators();
   }
 
-  auto path = json_to_w_string(relative_root).normalizeSeparators();
   if (path.empty()) {
     // An empty relative_root is equivalent to not specifying
     // a relative root.  Importantly, we want to avoid setting
     // relative_root to "" because that introduces some complexities
     // in handling that case for eg: eden.
+    if (root->enclosingRoot) {
+      // The view also holds the rest of the enclosing root
+      res->relative_root = root->root_path;
+      res->relative_root_slash = w_string::build(res->relative_root, "/");
+    }
     return;
   }
 
@@ -119,6 +126,30 @@ void parse_query_expression(Query* res, const json_ref& query) {
   res->expr = parseQueryExpr(res, exp);
 }
 
+// Simplify the parsed expression and work out which generators it allows
+// us to use.
+void plan_query_expression(Query* res) {
+  if (!res->expr) {
+    return;
+  }
+
+  if (auto simplified = res->expr->simplify()) {
+    res->expr = std::move(simplified);
+  }
+
+  res->plannedWholeNames = res->expr->computeWholeNames();
+  res->plannedWholeNamesCaseless = res->expr->wholeNamesAreCaseless();
+  res->plannedDirName = res->expr->computeRequiredDirName();
+  // The root is no constraint on its own, but a depth bound beneath it is
+  auto dirName = res->plannedDirName.value_or(w_string("", W_STRING_BYTE));
+  if (auto depth = res->expr->computeRequiredDirDepth(dirName)) {
+    res->plannedDirName = dirName;
+    res->plannedDirDepth = *depth;
+  }
+  res->plannedSuffixes = res->expr->computeSuffixes();
+  res->plannedDirVerdicts = res->expr->evaluatesDirs();
+}
+
 void parse_request_id(Query* res, const json_ref& query) {
   auto request_id = query.get_default("request_id");
   if (!request_id) {
@@ -172,7 +203,14 @@ void parse_sync(Query* res, const json_ref& query) {
                        .count()));
   res->sync_timeout = std::chrono::milliseconds{
       parse_nonnegative_integer("sync_timeout", sync_timeout)};
+
+  auto max_staleness = query.get_default("max_staleness_ms");
+  if (max_staleness) {
+    res->maxStaleness = std::chrono::milliseconds{
+        parse_nonnegative_integer("max_staleness_ms", max_staleness)};
+  }
 }
+W_CAP_REG("max_staleness_ms")
 
 void parse_lock_timeout(Query* res, const json_ref& query) {
   auto lock_timeout = query.get_default(
@@ -232,6 +270,135 @@ void parse_always_include_directories(Query* res, const json_ref& query) {
       parse_bool_param(query, "always_include_directories", false);
 }
 
+void parse_stream_results(Query* res, const json_ref& query) {
+  // Either a boolean to use the default chunk size, or a chunk size.
+  auto stream = query.get_default("stream_results");
+  if (!stream) {
+    return;
+  }
+  if (stream.isBool()) {
+    res->streamResultsChunkSize =
+        stream.asBool() ? kDefaultStreamResultsChunkSize : 0;
+    return;
+  }
+  if (!stream.isInt() || stream.asInt() <= 0) {
+    throw QueryParseError(
+        "'stream_results' must be a boolean or a positive integer");
+  }
+  res->streamResultsChunkSize = uint32_t(std::min<json_int_t>(
+      stream.asInt(), std::numeric_limits<uint32_t>::max()));
+}
+W_CAP_REG("stream_results")
+
+void parse_render_batch(Query* res, const json_ref& query) {
+  auto size = query.get_default("render_batch_size");
+  if (size) {
+    if (!size.isInt() || size.asInt() <= 0) {
+      throw QueryParseError("'render_batch_size' must be a positive integer");
+    }
+    res->renderBatchSize = uint32_t(std::min<json_int_t>(
+        size.asInt(), std::numeric_limits<uint32_t>::max()));
+  }
+
+  auto deadline = query.get_default("render_batch_deadline_ms");
+  if (deadline) {
+    if (!deadline.isInt() || deadline.asInt() < 0) {
+      throw QueryParseError(
+          "'render_batch_deadline_ms' must be a non-negative integer");
+    }
+    res->renderBatchDeadline = std::chrono::milliseconds(deadline.asInt());
+  }
+}
+W_CAP_REG("render_batch_size")
+
+void parse_deadline(Query* res, const json_ref& query) {
+  auto deadline = query.get_default("query_deadline_ms");
+  if (deadline) {
+    if (!deadline.isInt() || deadline.asInt() < 0) {
+      throw QueryParseError(
+          "'query_deadline_ms' must be a non-negative integer");
+    }
+    res->deadline = std::chrono::milliseconds(deadline.asInt());
+  }
+}
+W_CAP_REG("query_deadline_ms")
+
+void parse_result_order(Query* res, const json_ref& query) {
+  auto order = query.get_default("order_by");
+  auto limit = query.get_default("limit");
+  auto continuation = query.get_default("continuation");
+  if (!order && !limit && !continuation) {
+    return;
+  }
+
+  // Pages of results are only stable if they are sorted by something, so
+  // a limit on its own sorts by name
+  res->orderBy = order ? ResultOrder::parse(order) : ResultOrder{};
+
+  if (limit) {
+    if (!limit.isInt() || limit.asInt() <= 0) {
+      throw QueryParseError("'limit' must be a positive integer");
+    }
+    res->limit = uint32_t(std::min<json_int_t>(
+        limit.asInt(), std::numeric_limits<uint32_t>::max()));
+  }
+
+  if (continuation) {
+    if (!continuation.isString()) {
+      throw QueryParseError("'continuation' must be a string");
+    }
+    res->continuation =
+        res->orderBy->decodeContinuation(json_to_w_string(continuation));
+  }
+}
+W_CAP_REG("order_by")
+
+void parse_aggregate(Query* res, const json_ref& query) {
+  auto aggregate = query.get_default("aggregate");
+  if (!aggregate || (aggregate.isBool() && !aggregate.asBool())) {
+    return;
+  }
+  if (!aggregate.isBool() && !aggregate.isObject()) {
+    throw QueryParseError("'aggregate' must be a boolean or an object");
+  }
+  if (res->orderBy) {
+    throw QueryParseError(
+        "'aggregate' can't be combined with order_by, limit or continuation");
+  }
+
+  QueryAggregate spec;
+  auto groupBy =
+      aggregate.isObject() ? aggregate.get_default("group_by") : json_ref();
+  if (groupBy) {
+    static const std::pair<const char*, QueryAggregate::GroupBy> kGroups[] = {
+        {"suffix", QueryAggregate::GroupBy::Suffix},
+        {"type", QueryAggregate::GroupBy::Type},
+        {"dir", QueryAggregate::GroupBy::Dir},
+    };
+    bool known = false;
+    if (groupBy.isString()) {
+      auto name = json_to_w_string(groupBy).view();
+      for (auto& group : kGroups) {
+        if (name == group.first) {
+          spec.groupBy = group.second;
+          known = true;
+        }
+      }
+    }
+    if (!known) {
+      throw QueryParseError(
+          "'aggregate' group_by must be one of suffix, type or dir");
+    }
+  }
+  res->aggregate = spec;
+}
+W_CAP_REG("aggregate")
+
+void parse_explain(Query* res, const json_ref& query) {
+  res->explain = parse_bool_param(query, "explain", false);
+}
+W_CAP_REG("explain")
+
 void parse_benchmark(Query* res, const json_ref& query) {
   // Preserve behavior by supporting a boolean value. Also support int values.
   auto bench = query.get_default("bench");
@@ -275,6 +442,12 @@ std::shared_ptr<Query> parseQuery(
   parse_fail_if_no_saved_state(res, query);
   parse_omit_changed_files(res, query);
   parse_always_include_directories(res, query);
+  parse_stream_results(res, query);
+  parse_render_batch(res, query);
+  parse_deadline(res, query);
+  parse_result_order(res, query);
+  parse_aggregate(res, query);
+  parse_explain(res, query);
 
   /* Look for path generators */
   parse_paths(res, query);
@@ -289,11 +462,20 @@ std::shared_ptr<Query> parseQuery(
   parse_since(res, query);
 
   parse_query_expression(res, query);
+  plan_query_expression(res);
 
   parse_request_id(res, query);
 
   parse_field_list(query.get_default("fields"), &res->fieldList);
 
+  res->kernel = QueryKernel::recognize(*res, query.get_default("expression"));
+
+  // Only once the expression has been planned, and the kernel recognized,
+  // as the wrappers that count the evaluations of its terms hide them
+  if (res->explain) {
+    QueryExplain::instrument(*res);
+  }
+
   res->query_spec = query;
 
   return result;
@@ -19,6 +19,7 @@ class QueryFieldList;
 class Root;
 
 constexpr inline std::chrono::milliseconds kDefaultQuerySyncTimeout{60000};
+constexpr inline uint32_t kDefaultStreamResultsChunkSize = 1024;
 
 std::shared_ptr<watchman::Query> parseQuery(
     const std::shared_ptr<watchman::Root>& root,
@@ -14,33 +14,163 @@
 #include "watchman/query/TermRegistry.h"
 #include "watchman/watchman_system.h"
 
-#ifdef HAVE_PCRE_H
+#if defined(HAVE_PCRE2_H) || defined(HAVE_PCRE_H)
 
+#include "watchman/LRUCache.h"
+#include "watchman/WatchmanConfig.h"
+
+#ifdef HAVE_PCRE2_H
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h> // @manual
+#else
 #include <pcre.h> // @manual
+#endif
 
 using namespace watchman;
 
-class PcreExpr : public QueryExpr {
-  pcre* re;
-  pcre_extra* extra;
-  bool wholename;
+namespace {
 
+// A compiled pattern.  It is immutable once compiled, so a single copy can
+// be shared by any number of queries, on any number of threads.
+class CompiledPcre {
  public:
-  explicit PcreExpr(pcre* re, pcre_extra* extra, bool wholename)
-      : re(re), extra(extra), wholename(wholename) {}
+  CompiledPcre(const char* pattern, bool caseless, const char* which) {
+    auto fail = [&](int errcode, const char* message, size_t erroff) {
+      throw QueryParseError(folly::to<std::string>(
+          "invalid ",
+          which,
+          ": code ",
+          errcode,
+          " ",
+          message,
+          " at offset ",
+          erroff,
+          " in ",
+          pattern));
+    };
 
-  ~PcreExpr() override {
-    if (re) {
-      pcre_free(re);
+#ifdef HAVE_PCRE2_H
+    int errcode = 0;
+    PCRE2_SIZE erroff = 0;
+    code_ = pcre2_compile(
+        reinterpret_cast<PCRE2_SPTR>(pattern),
+        PCRE2_ZERO_TERMINATED,
+        caseless ? PCRE2_CASELESS : 0,
+        &errcode,
+        &erroff,
+        nullptr);
+    if (!code_) {
+      PCRE2_UCHAR message[256];
+      pcre2_get_error_message(errcode, message, sizeof(message));
+      fail(errcode, reinterpret_cast<const char*>(message), erroff);
     }
-    if (extra) {
-      pcre_free(extra);
+    // If the JIT is unavailable, matching falls back to the interpreter
+    pcre2_jit_compile(code_, PCRE2_JIT_COMPLETE);
+#else
+    const char* errptr = nullptr;
+    int erroff = 0;
+    int errcode = 0;
+    re_ = pcre_compile2(
+        pattern,
+        caseless ? PCRE_CASELESS : 0,
+        &errcode,
+        &errptr,
+        &erroff,
+        nullptr);
+    if (!re_) {
+      fail(errcode, errptr, erroff);
+    }
+    int studyOptions = 0;
+#ifdef PCRE_STUDY_JIT_COMPILE
+    studyOptions |= PCRE_STUDY_JIT_COMPILE;
+#endif
+    extra_ = pcre_study(re_, studyOptions, &errptr);
+#endif
+  }
+
+  ~CompiledPcre() {
+#ifdef HAVE_PCRE2_H
+    pcre2_code_free(code_);
+#else
+    pcre_free(re_);
+    if (extra_) {
+      pcre_free_study(extra_);
     }
+#endif
   }
 
+  CompiledPcre(const CompiledPcre&) = delete;
+  CompiledPcre& operator=(const CompiledPcre&) = delete;
+
+  bool matches(w_string_piece str) const {
+#ifdef HAVE_PCRE2_H
+    struct MatchDataFree {
+      void operator()(pcre2_match_data* data) const {
+        pcre2_match_data_free(data);
+      }
+    };
+    // Match data that isn't created from a pattern can be used with any of
+    // them, so each thread keeps one around rather than allocating it per
+    // file.  Only whether there is a match matters, so one pair is enough;
+    // a return value of 0 means that there was a match that didn't fit.
+    thread_local std::unique_ptr<pcre2_match_data, MatchDataFree> matchData{
+        pcre2_match_data_create(1, nullptr)};
+
+    int rc = pcre2_match(
+        code_,
+        reinterpret_cast<PCRE2_SPTR>(str.data()),
+        str.size(),
+        0,
+        0,
+        matchData.get(),
+        nullptr);
+#else
+    int rc = pcre_exec(re_, extra_, str.data(), str.size(), 0, 0, nullptr, 0);
+#endif
+    // Anything else is either no match or an error, which isn't actionable
+    // here
+    return rc >= 0;
+  }
+
+ private:
+#ifdef HAVE_PCRE2_H
+  pcre2_code* code_{nullptr};
+#else
+  pcre* re_{nullptr};
+  pcre_extra* extra_{nullptr};
+#endif
+};
+
+// Subscriptions and repeated queries tend to use the same few patterns, so
+// they share compiled copies rather than compiling them every time
+std::shared_ptr<const CompiledPcre>
+compilePcre(const char* pattern, bool caseless, const char* which) {
+  static LRUCache<std::string, std::shared_ptr<const CompiledPcre>> cache(
+      Configuration(), "pcre", 256, 5);
+
+  auto key = folly::to<std::string>(caseless ? "i:" : "c:", pattern);
+  if (auto node = cache.get(key)) {
+    return node->value();
+  }
+
+  auto compiled =
+      std::make_shared<const CompiledPcre>(pattern, caseless, which);
+  cache.set(key, std::shared_ptr<const CompiledPcre>{compiled});
+  return compiled;
+}
+
+} // namespace
+
+class PcreExpr : public QueryExpr {
+  std::shared_ptr<const CompiledPcre> re;
+  bool wholename;
+
+ public:
+  explicit PcreExpr(std::shared_ptr<const CompiledPcre> re, bool wholename)
+      : re(std::move(re)), wholename(wholename) {}
+
   EvaluateResult evaluate(QueryContextBase* ctx, FileResult* file) override {
     w_string_piece str;
-    int rc;
 
     if (wholename) {
       str = ctx->getWholeName();
@@ -48,16 +178,11 @@ class PcreExpr : public QueryExpr {
       str = file->baseName();
     }
 
-    rc = pcre_exec(re, extra, str.data(), str.size(), 0, 0, nullptr, 0);
+    return re->matches(str);
+  }
 
-    if (rc == PCRE_ERROR_NOMATCH) {
-      return false;
-    }
-    if (rc >= 0) {
-      return true;
-    }
-    // An error.  It's not actionable here
-    return false;
+  const char* termName() const override {
+    return "pcre";
   }
 
   static std::unique_ptr<QueryExpr>
@@ -65,10 +190,6 @@ class PcreExpr : public QueryExpr {
     const char *pattern, *scope = "basename";
     const char* which =
         caseSensitive == CaseSensitivity::CaseInSensitive ? "ipcre" : "pcre";
-    pcre* re;
-    const char* errptr = nullptr;
-    int erroff = 0;
-    int errcode = 0;
 
     if (term.array().size() > 1 && term.at(1).isString()) {
       pattern = json_string_value(term.at(1));
@@ -93,29 +214,12 @@ class PcreExpr : public QueryExpr {
           "Invalid scope '", scope, "' for ", which, " expression"));
     }
 
-    re = pcre_compile2(
-        pattern,
-        caseSensitive == CaseSensitivity::CaseInSensitive ? PCRE_CASELESS : 0,
-        &errcode,
-        &errptr,
-        &erroff,
-        nullptr);
-    if (!re) {
-      throw QueryParseError(folly::to<std::string>(
-          "invalid ",
-          which,
-          ": code ",
-          errcode,
-          " ",
-          errptr,
-          " at offset ",
-          erroff,
-          " in ",
-          pattern));
-    }
-
     return std::make_unique<PcreExpr>(
-        re, pcre_study(re, 0, &errptr), !strcmp(scope, "wholename"));
+        compilePcre(
+            pattern,
+            caseSensitive == CaseSensitivity::CaseInSensitive,
+            which),
+        !strcmp(scope, "wholename"));
   }
   static std::unique_ptr<QueryExpr> parsePcre(
       Query* query,
@@ -127,6 +231,10 @@ class PcreExpr : public QueryExpr {
       const json_ref& term) {
     return parse(query, term, CaseSensitivity::CaseInSensitive);
   }
+
+  EvaluationCost evaluationCost() const override {
+    return EvaluationCost::Regex;
+  }
 };
 W_TERM_PARSER(pcre, PcreExpr::parsePcre);
 W_TERM_PARSER(ipcre, PcreExpr::parseIPcre);
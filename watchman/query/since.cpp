@@ -91,6 +91,10 @@ class SinceExpr : public QueryExpr {
     return tval >= since.timestamp;
   }
 
+  const char* termName() const override {
+    return "since";
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     auto selected_field = since_what::SINCE_OCLOCK;
     const char* fieldname = "oclock";
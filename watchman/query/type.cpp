@@ -77,6 +77,10 @@ class TypeExpr : public QueryExpr {
     }
   }
 
+  const char* termName() const override {
+    return "type";
+  }
+
   static std::unique_ptr<QueryExpr> parse(Query*, const json_ref& term) {
     const char *typestr, *found;
     char arg;
@@ -7,23 +7,33 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <optional>
 #include <unordered_map>
+#include "watchman/Clock.h"
 #include "watchman/CookieSync.h"
 #include "watchman/IgnoreSet.h"
 #include "watchman/PendingCollection.h"
 #include "watchman/PubSub.h"
+#include "watchman/SyncFreshness.h"
 #include "watchman/WatchmanConfig.h"
 #include "watchman/fs/FileSystem.h"
+#include "watchman/query/SlowQueryLog.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/watchman_string.h"
 
 /* Prune out nodes that were deleted roughly 12-36 hours ago */
 #define DEFAULT_GC_AGE (86400 / 2)
 #define DEFAULT_GC_INTERVAL 86400
+/* With a change journal to answer for them, they needn't be kept as long */
+#define JOURNALED_GC_AGE 300
+#define JOURNALED_GC_INTERVAL 300
 
 namespace watchman {
 
+class BserResultsRenderer;
 class Root;
 struct TriggerCommand;
 class QueryableView;
@@ -128,6 +138,9 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
       triggers;
 
   CookieSync cookies;
+  // The full syncs of the root, for queries that accept slightly stale
+  // results; see reuseRecentSync()
+  SyncFreshness syncFreshness;
 
   /* config options loaded via json file */
   json_ref config_file;
@@ -196,6 +209,48 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
     std::chrono::steady_clock::time_point last_reap_timestamp;
   } inner;
 
+  /**
+   * The most recent results of subscriptions with shareable queries, keyed
+   * by their canonical query spec.  An entry is reused by any subscription
+   * with the same spec and since clock for as long as the view is at the
+   * position that it was computed at.
+   */
+  struct SharedSubscriptionResult {
+    ClockPosition since;
+    ClockSpec clockAtStartOfQuery;
+    uint32_t stateTransCountAtStartOfQuery;
+    bool isFreshInstance;
+    json_ref resultsArray;
+    json_ref savedStateInfo;
+  };
+  folly::Synchronized<std::unordered_map<w_string, SharedSubscriptionResult>>
+      sharedSubscriptionResults;
+
+  /**
+   * The results of recent queries, keyed by their canonical query spec, the
+   * point that their since resolved to, and the encoding of the results.
+   * All of the entries were computed with the view at position, and they
+   * are dropped once the view moves on.  Only used if queryResultCacheSize,
+   * from `query_result_cache_size`, is non-zero.
+   */
+  struct CachedQueryResult {
+    bool isFreshInstance;
+    json_ref resultsArray;
+    std::shared_ptr<const BserResultsRenderer> bserResults;
+  };
+  struct QueryResultCache {
+    ClockPosition position;
+    uint32_t lastAgeOutTick{0};
+    std::unordered_map<w_string, CachedQueryResult> entries;
+  };
+  folly::Synchronized<QueryResultCache> queryResultCache;
+  size_t queryResultCacheSize{0};
+
+  // The number of subscriptions on this root that want to hear about
+  // changes before the root settles.  The IO thread only collects the
+  // changes for them while this is non-zero.
+  std::atomic<size_t> fastSubscriptions{0};
+
   // For debugging and diagnostic purposes, this set references
   // all outstanding query contexts that are executing against this root.
   // If is only safe to read the query contexts while the queries.rlock()
@@ -203,6 +258,20 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   // are not changed by the query exection.
   folly::Synchronized<std::unordered_set<QueryContext*>> queries;
 
+  // The most recent queries that took at least slowQueryThreshold to run.
+  // Null if the slow query log is disabled.
+  std::unique_ptr<RingBuffer<SlowQueryLogEntry>> slowQueries;
+  std::chrono::milliseconds slowQueryThreshold{0};
+
+  /**
+   * Set if this root is a dir beneath another watched root, and is served
+   * by the view of that root rather than crawling and watching the same
+   * files a second time; see `share_enclosing_watch`.  Queries against this
+   * root are restricted to its part of the view, and it follows the
+   * changes, cookies and cancellation of the enclosing root.
+   */
+  const std::shared_ptr<Root> enclosingRoot;
+
   /**
    * Returns the view with which this Root was constructed.
    */
@@ -210,6 +279,15 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
     return view_;
   }
 
+  /**
+   * Returns the root whose threads maintain view(): the enclosing root if
+   * the view is shared, or this root.  The crawl state and the recrawl
+   * warnings are kept by it.
+   */
+  const Root& viewOwner() const {
+    return enclosingRoot ? *enclosingRoot : *this;
+  }
+
   Root(
       FileSystem& fileSystem,
       const w_string& root_path,
@@ -217,15 +295,35 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
       json_ref config_file,
       Configuration config,
       std::shared_ptr<QueryableView> view,
-      SaveGlobalStateHook saveGlobalStateHook);
+      SaveGlobalStateHook saveGlobalStateHook,
+      std::shared_ptr<Root> enclosingRoot = nullptr);
   ~Root();
 
+  // For a root with an enclosingRoot, starts passing the changes that the
+  // enclosing root publishes on to this root's subscribers, in place of
+  // starting the view's threads.
+  void followEnclosingRoot();
+
   void considerAgeOut();
   void performAgeOut(std::chrono::seconds min_age);
   folly::SemiFuture<folly::Unit> waitForSettle(
       std::chrono::milliseconds settle_period);
-  CookieSync::SyncResult syncToNow(std::chrono::milliseconds timeout);
+  CookieSync::SyncResult syncToNow(
+      std::chrono::milliseconds timeout,
+      const w_string& scope = w_string());
+  // Returns how far behind the view is, if a full sync that has finished,
+  // or that is in flight and finishes within timeout, leaves it at most
+  // maxStaleness behind; otherwise returns nullopt, and the caller needs
+  // to sync.
+  std::optional<std::chrono::milliseconds> reuseRecentSync(
+      std::chrono::milliseconds maxStaleness,
+      std::chrono::milliseconds timeout);
   void scheduleRecrawl(const char* why);
+  // Like scheduleRecrawl, for a watcher that lost events after lastGood,
+  // but lets the view rescan only what changed since then if it can.
+  void scheduleResync(
+      const char* why,
+      std::chrono::system_clock::time_point lastGood);
   void recrawlTriggered(const char* why);
 
   // Requests cancellation of the root.
@@ -243,6 +341,10 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
   static json_ref getStatusForAllRoots();
   json_ref getStatus() const;
 
+  // Describes the memory held on behalf of this root, for debug-memory and
+  // getStatus.
+  json_ref getMemoryUsage() const;
+
   // Annotate the sample with some standard metadata taken from a root.
   void addPerfSampleMetadata(PerfSample& sample) const;
 
@@ -253,6 +355,10 @@ class Root : public RootConfig, public std::enable_shared_from_this<Root> {
  private:
   const std::shared_ptr<QueryableView> view_;
 
+  // Receives what the enclosing root publishes, if the view is shared.
+  folly::Synchronized<std::shared_ptr<Publisher::Subscriber>>
+      enclosingSubscriber_;
+
   /// A hook that allows saving Watchman's state after key operations. Usually
   /// holds w_state_save.
   SaveGlobalStateHook saveGlobalStateHook_;
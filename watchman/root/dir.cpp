@@ -6,6 +6,8 @@
  */
 
 #include "watchman/watchman_dir.h"
+#include "watchman/NodeArena.h"
+#include "watchman/PathFilter.h"
 #include "watchman/watchman_file.h"
 
 void watchman_dir::Deleter::operator()(watchman_file* file) const {
@@ -13,7 +15,19 @@ void watchman_dir::Deleter::operator()(watchman_file* file) const {
 }
 
 watchman_dir::watchman_dir(w_string name, watchman_dir* parent)
-    : name(std::move(name)), parent(parent) {}
+    : name(std::move(name)),
+      parent(parent),
+      pathHash(
+          parent ? watchman::PathFilter::hashChild(parent->pathHash, this->name)
+                 : watchman::PathFilter::kRootHash) {}
+
+void* watchman_dir::operator new(size_t size) {
+  return watchman::getNodeArena().allocate(size);
+}
+
+void watchman_dir::operator delete(void* ptr, size_t size) noexcept {
+  watchman::getNodeArena().deallocate(ptr, size);
+}
 
 w_string watchman_dir::getFullPath() const {
   return getFullPathToChild(w_string_piece());
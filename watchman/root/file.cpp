@@ -6,6 +6,10 @@
  */
 
 #include "watchman/watchman_file.h"
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include "watchman/NodeArena.h"
 #ifdef __APPLE__
 #include <sys/attr.h> // @manual
 #endif
@@ -24,6 +28,36 @@ void watchman_file::removeFromFileList() {
   }
 }
 
+void watchman_file::removeFromSuffixList() {
+  if (suffixNext) {
+    suffixNext->suffixPrev = suffixPrev;
+  }
+  if (suffixPrev) {
+    *suffixPrev = suffixNext;
+  }
+  suffixPrev = nullptr;
+  suffixNext = nullptr;
+}
+
+void watchman_file::removeFromSubtreeList() {
+  if (subtreeNext) {
+    subtreeNext->subtreePrev = subtreePrev;
+  }
+  if (subtreePrev) {
+    *subtreePrev = subtreeNext;
+  }
+  subtreePrev = nullptr;
+  subtreeNext = nullptr;
+}
+
+watchman_file* watchman_file::fromTombstoneLink(watchman_tombstone_link* link) {
+  static_assert(
+      std::is_standard_layout_v<watchman_file>,
+      "offsetof is only valid for standard layout types");
+  return reinterpret_cast<watchman_file*>(
+      reinterpret_cast<char*>(link) - offsetof(watchman_file, tombstone));
+}
+
 /* We embed our name string in the tail end of the struct that we're
  * allocating here.  This turns out to be more memory efficient due
  * to the way that the allocator bins sizeof(watchman_file); there's
@@ -31,12 +65,39 @@ void watchman_file::removeFromFileList() {
  * to be about the right size to fit a typical filename.
  * Embedding the name in the end allows us to make the most of this
  * memory and free up the separate heap allocation for file_name.
+ * The atime and then a symlink target, when the node has room for them,
+ * follow the name.  The nodes themselves come from the NodeArena, so the
+ * size must be recomputed from the name when the node is freed.
  */
+static_assert(alignof(w_string) == alignof(int64_t));
+
+static size_t tail_offset(size_t nameLen) {
+  auto end = sizeof(watchman_file) + sizeof(uint32_t) + nameLen + 1;
+  return (end + alignof(w_string) - 1) & ~(alignof(w_string) - 1);
+}
+
+static size_t symlink_target_offset(size_t nameLen, bool atime) {
+  return tail_offset(nameLen) + (atime ? sizeof(int64_t) : 0);
+}
+
+static size_t file_node_size(size_t nameLen, bool symlinkTarget, bool atime) {
+  if (symlinkTarget) {
+    return symlink_target_offset(nameLen, atime) + sizeof(w_string);
+  }
+  if (atime) {
+    return tail_offset(nameLen) + sizeof(int64_t);
+  }
+  return sizeof(watchman_file) + sizeof(uint32_t) + nameLen + 1;
+}
+
 std::unique_ptr<watchman_file, watchman_dir::Deleter> watchman_file::make(
     const w_string& name,
-    watchman_dir* parent) {
-  auto file = (watchman_file*)calloc(
-      1, sizeof(watchman_file) + sizeof(uint32_t) + name.size() + 1);
+    watchman_dir* parent,
+    bool symlinkTarget,
+    bool atime) {
+  auto size = file_node_size(name.size(), symlinkTarget, atime);
+  auto file = (watchman_file*)watchman::getNodeArena().allocate(size);
+  memset(file, 0, size);
   std::unique_ptr<watchman_file, watchman_dir::Deleter> filePtr(
       file, watchman_dir::Deleter());
 
@@ -49,17 +110,60 @@ std::unique_ptr<watchman_file, watchman_dir::Deleter> watchman_file::make(
 
   file->parent = parent;
   file->exists = true;
+  file->has_atime = atime;
+  if (symlinkTarget) {
+    file->has_symlink_target = true;
+    new (file->symlinkTargetSlot()) w_string();
+  }
 
   return filePtr;
 }
 
+w_string* watchman_file::symlinkTargetSlot() const {
+  return reinterpret_cast<w_string*>(
+      reinterpret_cast<char*>(const_cast<watchman_file*>(this)) +
+      symlink_target_offset(getName().size(), has_atime));
+}
+
+int64_t* watchman_file::atimeSlot() const {
+  return reinterpret_cast<int64_t*>(
+      reinterpret_cast<char*>(const_cast<watchman_file*>(this)) +
+      tail_offset(getName().size()));
+}
+
+watchman::FileInformation watchman_file::getStat() const {
+  auto info = stat.expand();
+  info.atime = has_atime
+      ? watchman::CompactFileInformation::nsToTimespec(*atimeSlot())
+      : info.mtime;
+  return info;
+}
+
+void watchman_file::setStat(const watchman::FileInformation& info) {
+  stat = watchman::CompactFileInformation(info);
+  if (has_atime) {
+    *atimeSlot() = watchman::CompactFileInformation::timespecToNs(info.atime);
+  }
+}
+
 watchman_file::~watchman_file() {
   removeFromFileList();
+  removeFromSuffixList();
+  removeFromSubtreeList();
+  tombstone.unlink();
+  if (has_symlink_target) {
+    symlinkTargetSlot()->~w_string();
+  }
+}
+
+size_t watchman_file::allocatedSize() const {
+  return file_node_size(getName().size(), has_symlink_target, has_atime);
 }
 
 void free_file_node(struct watchman_file* file) {
+  auto size = file->allocatedSize();
   file->~watchman_file();
-  free(file);
+  watchman::getNodeArena().deallocate(file, size);
 }
 
 /* vim:ts=2:sw=2:et:
@@ -6,7 +6,10 @@
  */
 
 #include <folly/String.h>
+#include <algorithm>
+#include "watchman/ChangeJournal.h"
 #include "watchman/Logging.h"
+#include "watchman/Options.h"
 #include "watchman/QueryableView.h"
 #include "watchman/TriggerCommand.h"
 #include "watchman/fs/DirHandle.h"
@@ -189,6 +192,13 @@ w_string computeCookieDir(
   return root_path;
 }
 
+// Whether the view of root_path will journal its changes; see
+// InMemoryView
+bool hasChangeJournal(const w_string& root_path, const Configuration& config) {
+  return config.getInt("change_journal_max_bytes", 0) > 0 &&
+      ChangeJournal::pathForRoot(flags.watchman_state_file, root_path, 0);
+}
+
 } // namespace
 
 IgnoreSet computeIgnoreSet(
@@ -216,6 +226,23 @@ IgnoreSet computeIgnoreSet(
     }
   }
 
+  if (auto globs = config.get("ignore_globs")) {
+    if (!globs.isArray()) {
+      logf(ERR, "ignore_globs must be an array of strings\n");
+    } else {
+      for (auto& jglob : globs.array()) {
+        if (!jglob.isString()) {
+          logf(ERR, "ignore_globs must be an array of strings\n");
+          continue;
+        }
+
+        auto pattern = json_to_w_string(jglob);
+        result.addGlob(root_path, pattern);
+        logf(DBG, "ignoring {} matching {}\n", root_path, pattern);
+      }
+    }
+  }
+
   auto ignores = getIgnoreVcs(config);
   for (auto& jignore : ignores.array()) {
     if (!jignore.isString()) {
@@ -242,7 +269,8 @@ Root::Root(
     json_ref config_file,
     Configuration config_,
     std::shared_ptr<QueryableView> view,
-    SaveGlobalStateHook saveGlobalStateHook)
+    SaveGlobalStateHook saveGlobalStateHook,
+    std::shared_ptr<Root> enclosingRoot)
     : RootConfig{root_path, fs_type, getCaseSensitivityForPath(root_path.c_str()), computeIgnoreSet(root_path, config_)},
       cookies(
           fileSystem,
@@ -250,12 +278,23 @@ Root::Root(
       config_file(std::move(config_file)),
       config(std::move(config_)),
       trigger_settle(int(config.getInt("settle", kDefaultSettlePeriod))),
-      gc_interval(
-          int(config.getInt("gc_interval_seconds", DEFAULT_GC_INTERVAL))),
-      gc_age(int(config.getInt("gc_age_seconds", DEFAULT_GC_AGE))),
+      gc_interval(int(config.getInt(
+          "gc_interval_seconds",
+          hasChangeJournal(root_path, config) ? JOURNALED_GC_INTERVAL
+                                              : DEFAULT_GC_INTERVAL))),
+      gc_age(int(config.getInt(
+          "gc_age_seconds",
+          hasChangeJournal(root_path, config) ? JOURNALED_GC_AGE
+                                              : DEFAULT_GC_AGE))),
       idle_reap_age(
           int(config.getInt("idle_reap_age_seconds", kDefaultReapAge))),
-      unilateralResponses(std::make_shared<Publisher>()),
+      // A subscriber that falls too far behind is told that the view
+      // settled, prompting its subscriptions to catch up by clock.
+      unilateralResponses(std::make_shared<Publisher>(
+          size_t(std::max<json_int_t>(
+              0, config.getInt("subscription_max_queued_items", 0))),
+          json_object({{"settled", json_true()}, {"resync", json_true()}}))),
+      enclosingRoot{std::move(enclosingRoot)},
       view_{std::move(view)},
       saveGlobalStateHook_{std::move(saveGlobalStateHook)} {
   // This just opens and releases the dir.  If an exception is thrown
@@ -268,6 +307,17 @@ Root::Root(
 
   inner.last_cmd_timestamp = std::chrono::steady_clock::now();
 
+  auto slowQueryLogSize = config.getInt("slow_query_log_size", 64);
+  if (slowQueryLogSize > 0) {
+    slowQueries = std::make_unique<RingBuffer<SlowQueryLogEntry>>(
+        uint32_t(slowQueryLogSize));
+    slowQueryThreshold = std::chrono::milliseconds(
+        config.getInt("slow_query_log_threshold_ms", 1000));
+  }
+
+  queryResultCacheSize = size_t(
+      std::max<json_int_t>(0, config.getInt("query_result_cache_size", 0)));
+
   if (!view_->requiresCrawl) {
     // This watcher can resolve queries without needing a crawl.
     inner.done_initial = true;
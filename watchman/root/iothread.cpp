@@ -6,9 +6,21 @@
  */
 
 #include <fmt/chrono.h>
+#include <folly/ExceptionString.h>
 #include <chrono>
+#include <deque>
+#include <thread>
+#include <unordered_set>
+#include "watchman/CrawlScheduler.h"
 #include "watchman/Errors.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/Shutdown.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/ThreadStats.h"
+#include "watchman/TraceRecorder.h"
+#include "watchman/Tracing.h"
+#include "watchman/ViewSnapshot.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/warnerr.h"
 #include "watchman/watcher/Watcher.h"
@@ -25,15 +37,91 @@ folly::SemiFuture<folly::Unit> InMemoryView::waitUntilReadyToQuery() {
   return std::move(f);
 }
 
+folly::Synchronized<ViewDatabase>::WLockedPtr
+InMemoryView::lockViewForUpdate() {
+  ThreadStats::Wait wait;
+  return view_.wlock();
+}
+
+namespace {
+
+// Roots used this recently are worth crawling ahead of the idle ones
+constexpr std::chrono::minutes kRecentlyUsed{1};
+
+// The order in which the CrawlScheduler runs the crawls of the roots that
+// want to crawl at once: those being queried, then those with subscribers,
+// then those that were recently used or are being watched for the first
+// time.  The rest are crawled in the background.
+int crawlPriority(const Root& root, bool initialCrawl) {
+  if (!root.queries.rlock()->empty()) {
+    return 3;
+  }
+  if (root.unilateralResponses->hasSubscribers()) {
+    return 2;
+  }
+  auto lastCmd = root.inner.last_cmd_timestamp.load(std::memory_order_acquire);
+  if (initialCrawl ||
+      std::chrono::steady_clock::now() - lastCmd < kRecentlyUsed) {
+    return 1;
+  }
+  return 0;
+}
+
+} // namespace
+
 void InMemoryView::fullCrawl(
     const std::shared_ptr<Root>& root,
     PendingCollection& pendingFromWatcher,
     PendingChanges& localPending) {
+  bool initialCrawl = root->recrawlInfo.rlock()->recrawlCount == 0;
+
+  // Wait for our turn, so that the roots that all want to recrawl at once,
+  // say after a resume, don't thrash the disk
+  CrawlScheduler::Slot slot;
+  {
+    ThreadStats::Wait wait;
+    slot = CrawlScheduler::get().acquire(
+        root->root_path.string(),
+        [&root, initialCrawl] { return crawlPriority(*root, initialCrawl); },
+        [this] { return stopThreads_.load(std::memory_order_acquire); });
+  }
+  if (!slot) {
+    // Stopping; the IO thread will notice before calling us again
+    return;
+  }
+
   root->recrawlInfo.wlock()->crawlStart = std::chrono::steady_clock::now();
 
   PerfSample sample("full-crawl");
 
-  auto view = view_.wlock();
+  if (contentHashCachePath_ && initialCrawl) {
+    try {
+      auto numHashes = caches_.contentHashCache.load(contentHashCachePath_);
+      logf(ERR, "restored {} content hashes\n", numHashes);
+    } catch (const std::exception& exc) {
+      log(ERR, "not using saved content hashes: ", exc.what(), "\n");
+    }
+    lastContentHashSaveStores_ = caches_.contentHashCache.stats().cacheStore;
+    lastContentHashSave_ = std::chrono::steady_clock::now();
+  }
+
+  auto view = lockViewForUpdate();
+  // The files that have changed since the snapshot was taken, according to
+  // the watcher's change history or else the SCM
+  std::optional<folly::SemiFuture<std::vector<w_string>>> seed;
+  if (viewSnapshotPath_ && initialCrawl) {
+    auto header = restoreViewSnapshot(*root, *view, true);
+    if (header && header->watcherPosition) {
+      if (auto changed = watcher_->getChangesSince(header->watcherPosition)) {
+        seed = folly::makeSemiFuture(std::move(*changed));
+      }
+    }
+    if (!seed && header && header->scmCommit && viewSnapshotScmSeed_ &&
+        getSCM()) {
+      seed = filesChangedSinceCommit(root, header->scmCommit);
+    }
+  }
+
   // Ensure that we observe these files with a new, distinct clock,
   // otherwise a fresh subscription established immediately after a watch
   // can get stuck with an empty view until another change is observed
@@ -41,6 +129,15 @@ void InMemoryView::fullCrawl(
 
   auto start = std::chrono::system_clock::now();
   pendingFromWatcher.lock()->add(root->root_path, start, W_PENDING_RECURSIVE);
+  if (seed || (lazyCrawl_ && initialCrawl)) {
+    crawlInSlices(
+        root, view, pendingFromWatcher, localPending, start, std::move(seed));
+  }
+  // Everything is marked with the tick above, under the lock that we hold
+  // until we're done, so the crawled files can be linked into the recency
+  // lists all at once
+  view->beginBulkLoad();
+  uint64_t itemsCrawled = 0;
   while (true) {
     // There is the potential for a subtle race condition here.  Since we now
     // coalesce overlaps we must consume our outstanding set before we merge
@@ -57,13 +154,24 @@ void InMemoryView::fullCrawl(
       break;
     }
 
+    itemsCrawled += localPending.getPendingItemCount();
+    slot.setProgress(itemsCrawled);
     (void)processAllPending(root, *view, localPending);
   }
+  view->endBulkLoad();
+  // For the next watch of this root, which may be after a restart, to size
+  // its tables by
+  TreeSizeHints::remember(root->root_path, view->getTreeSizeHints());
 
   auto recrawlInfo = root->recrawlInfo.wlock();
   recrawlInfo->shouldRecrawl = false;
   recrawlInfo->crawlFinish = std::chrono::steady_clock::now();
   root->inner.done_initial.store(true, std::memory_order_release);
+  if (journal_) {
+    // Journaling the initial crawl would record every file in the tree;
+    // the journal need only cover the changes that ageOut drops later
+    journal_->begin(mostRecentTick_.load(std::memory_order_acquire));
+  }
 
   // There is no need to hold locks while logging, and abortAllCookies resolves
   // a Promise which can run arbitrary code, so locks must be released here.
@@ -71,6 +179,18 @@ void InMemoryView::fullCrawl(
   recrawlInfo.unlock();
   view.unlock();
 
+  if (lazyCrawl_ || viewSnapshotPath_) {
+    std::vector<CrawlWaiter> waiters;
+    {
+      auto state = lazyCrawlState_.wlock();
+      state->complete = true;
+      std::swap(waiters, state->waiters);
+    }
+    for (auto& waiter : waiters) {
+      waiter.promise.setValue();
+    }
+  }
+
   root->cookies.abortAllCookies();
 
   root->addPerfSampleMetadata(sample);
@@ -80,6 +200,433 @@ void InMemoryView::fullCrawl(
   sample.log();
 
   logf(ERR, "{}crawl complete\n", recrawlCount ? "re" : "");
+
+  // Save the sizes that were just learned along with the root
+  if (auto saveGlobalStateHook = root->getSaveGlobalStateHook()) {
+    saveGlobalStateHook();
+  }
+}
+
+folly::SemiFuture<folly::Unit> InMemoryView::waitForCrawl(
+    std::vector<w_string> dirs) {
+  if (!lazyCrawl_ && !viewSnapshotPath_) {
+    return folly::makeSemiFuture();
+  }
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  {
+    auto state = lazyCrawlState_.wlock();
+    if (state->complete) {
+      return folly::makeSemiFuture();
+    }
+    state->waiters.push_back(CrawlWaiter{std::move(dirs), std::move(p)});
+  }
+  return std::move(f);
+}
+
+namespace {
+
+// How long crawlInSlices holds the view lock before letting queries in
+constexpr std::chrono::milliseconds kCrawlSliceDuration{20};
+
+bool isAtOrBelow(w_string_piece path, w_string_piece dir) {
+  return path == dir ||
+      (path.size() > dir.size() && path.startsWith(dir) &&
+       is_slash(path[dir.size()]));
+}
+
+} // namespace
+
+void InMemoryView::crawlInSlices(
+    const std::shared_ptr<Root>& root,
+    folly::Synchronized<ViewDatabase>::WLockedPtr& view,
+    PendingCollection& pendingFromWatcher,
+    PendingChanges& localPending,
+    std::chrono::system_clock::time_point start,
+    std::optional<folly::SemiFuture<std::vector<w_string>>> seed) {
+  // Everything that remains to be processed, split by whether a query is
+  // waiting for it.  Only paths below urgentDirs are urgent.
+  std::deque<std::shared_ptr<watchman_pending_fs>> urgent;
+  std::deque<std::shared_ptr<watchman_pending_fs>> rest;
+  std::vector<w_string> urgentDirs;
+  // The urgent dirs that have been crawled.  The crawl of their parent will
+  // want to crawl them again once it gets there, which isn't necessary.
+  std::unordered_set<w_string> crawledEarly;
+  // Queries whose dirs are in urgentDirs, waiting for urgent to drain
+  std::vector<CrawlWaiter> waiters;
+
+  auto isUrgent = [&](const w_string& path) {
+    for (auto& dir : urgentDirs) {
+      if (isAtOrBelow(path, dir)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  std::vector<folly::Promise<folly::Unit>> syncs;
+  auto sweep = [&](PendingChanges& coll) {
+    auto chain = coll.stealItems();
+    for (auto& sync : coll.stealSyncs()) {
+      syncs.push_back(std::move(sync));
+    }
+    while (chain) {
+      auto next = std::move(chain->next);
+      // Queries syncing to now are waiting for their cookies
+      bool isCookie = root->cookies.isCookiePrefix(chain->path);
+      (isCookie || isUrgent(chain->path) ? urgent : rest)
+          .push_back(std::move(chain));
+      chain = std::move(next);
+    }
+  };
+
+  auto promote = [&](const w_string& dir) {
+    urgentDirs.push_back(dir);
+    auto remaining = std::move(rest);
+    rest.clear();
+    for (auto& item : remaining) {
+      (isAtOrBelow(item->path, dir) ? urgent : rest).push_back(std::move(item));
+    }
+
+    // If dir hasn't been seen by the crawl of its parent yet then it isn't
+    // queued, so have it looked at now.  Its parent is created in the view
+    // as necessary.
+    if (dir == rootPath_) {
+      return;
+    }
+    auto parent = view->resolveDir(dir.dirName(), false);
+    if (!parent || !parent->getChildFile(dir.baseName())) {
+      urgent.push_back(std::make_shared<watchman_pending_fs>(
+          dir, start, W_PENDING_RECURSIVE));
+    }
+  };
+
+  // Whether the files from seed are queued, ahead of everything else, and
+  // the view is to be declared ready once they're done
+  bool seeding = false;
+  bool seeded = false;
+
+  std::vector<w_string> pendingCookies;
+  while (!stopThreads_.load(std::memory_order_acquire)) {
+    sweep(*pendingFromWatcher.lock());
+    if (seed && seed->isReady()) {
+      auto changed = std::move(*seed).getTry();
+      seed.reset();
+      if (changed.hasException()) {
+        auto reason = folly::exceptionStr(changed.exception());
+        log(ERR,
+            "crawling in full rather than trusting the view snapshot: ",
+            w_string_piece(reason.data(), reason.size()),
+            "\n");
+      } else {
+        for (auto& name : *changed) {
+          urgent.push_back(std::make_shared<watchman_pending_fs>(
+              w_string::pathCat({rootPath_, name}), start, PendingFlags{}));
+        }
+        // The cookies of the queries that come in once we're ready must be
+        // seen by the watcher, so its watches on the cookie dirs are needed
+        // first
+        for (auto& dir : root->cookies.cookieDirs()) {
+          urgent.push_back(std::make_shared<watchman_pending_fs>(
+              dir, start, W_PENDING_NONRECURSIVE_SCAN));
+        }
+        seeding = true;
+        logf(
+            ERR,
+            "checking the {} files that changed since the view snapshot\n",
+            changed->size());
+      }
+    }
+    {
+      auto state = lazyCrawlState_.wlock();
+      for (auto& waiter : state->waiters) {
+        for (auto& dir : waiter.dirs) {
+          if (!isUrgent(dir)) {
+            promote(dir);
+          }
+        }
+        waiters.push_back(std::move(waiter));
+      }
+      state->waiters.clear();
+    }
+
+    auto sliceEnd = std::chrono::steady_clock::now() + kCrawlSliceDuration;
+    while ((!urgent.empty() || !rest.empty()) &&
+           std::chrono::steady_clock::now() < sliceEnd) {
+      auto& queue = urgent.empty() ? rest : urgent;
+      auto pending = std::move(queue.front());
+      queue.pop_front();
+
+      if (pending->flags & W_PENDING_CRAWL_ONLY) {
+        // Crawls that were queued by the crawl, rather than because of
+        // something that the watcher told us, are redundant once the dir
+        // has been crawled early
+        if (pending->now <= start && crawledEarly.count(pending->path)) {
+          continue;
+        }
+        if (isUrgent(pending->path)) {
+          crawledEarly.insert(pending->path);
+        }
+      }
+
+      processPath(root, *view, localPending, *pending, nullptr, pendingCookies);
+      sweep(localPending);
+    }
+
+    bool done = urgent.empty() && rest.empty();
+    bool ready = seeding && urgent.empty();
+    if (ready) {
+      // The rest of the crawl only verifies what the snapshot told us
+      seeding = false;
+      seeded = true;
+      root->inner.done_initial.store(true, std::memory_order_release);
+      if (journal_) {
+        journal_->begin(mostRecentTick_.load(std::memory_order_acquire));
+      }
+    }
+    view.unlock();
+    statDirs_.clear();
+
+    for (auto& cookie : pendingCookies) {
+      root->cookies.notifyCookie(cookie);
+    }
+    pendingCookies.clear();
+    for (auto& sync : syncs) {
+      sync.setValue();
+    }
+    syncs.clear();
+    if (urgent.empty()) {
+      for (auto& waiter : waiters) {
+        waiter.promise.setValue();
+      }
+      waiters.clear();
+      urgentDirs.clear();
+    }
+    if (ready) {
+      std::vector<CrawlWaiter> stragglers;
+      {
+        auto state = lazyCrawlState_.wlock();
+        state->complete = true;
+        std::swap(stragglers, state->waiters);
+      }
+      for (auto& waiter : stragglers) {
+        waiter.promise.setValue();
+      }
+      logf(ERR, "view is ready; verifying the rest of the view snapshot\n");
+    }
+
+    if (!root->queries.rlock()->empty()) {
+      // Readers that were waiting for the lock need a moment to take it,
+      // otherwise we may well get it straight back
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    view = lockViewForUpdate();
+    if (seeded) {
+      // Queries may have seen the view since we let go of it, so what we
+      // find from here on has to be newer than what they saw
+      mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+    }
+    if (done && pendingFromWatcher.lock()->empty()) {
+      break;
+    }
+  }
+
+  // Anything left over goes back to the caller, which finishes the crawl
+  // the usual way.  The waiters are resolved once it is done.
+  for (auto& item : urgent) {
+    localPending.add(item->path, item->now, item->flags);
+  }
+  for (auto& item : rest) {
+    localPending.add(item->path, item->now, item->flags);
+  }
+  if (!waiters.empty()) {
+    auto state = lazyCrawlState_.wlock();
+    for (auto& waiter : waiters) {
+      state->waiters.push_back(std::move(waiter));
+    }
+  }
+}
+
+std::optional<ViewSnapshot::Header> InMemoryView::restoreViewSnapshot(
+    Root& root,
+    ViewDatabase& view,
+    bool watchFiles) {
+  std::optional<ViewSnapshot::Header> header;
+  try {
+    auto st =
+        fileSystem_.getFileInformation(rootPath_.c_str(), root.case_sensitive);
+    header = ViewSnapshot::load(viewSnapshotPath_, view, rootPath_, st.ino);
+  } catch (const std::exception& exc) {
+    log(ERR,
+        "not using view snapshot ",
+        viewSnapshotPath_,
+        ": ",
+        exc.what(),
+        "\n");
+    return std::nullopt;
+  }
+  if (!header) {
+    return std::nullopt;
+  }
+
+  // The restored otimes must not be newer than any clock we hand out from
+  // here on, otherwise they would be reported as changes in since queries.
+  if (mostRecentTick_.load(std::memory_order_acquire) <
+      header->mostRecentTick) {
+    mostRecentTick_.store(header->mostRecentTick, std::memory_order_release);
+  }
+  lastAgeOutTick_ = std::max(lastAgeOutTick_, header->lastAgeOutTick);
+
+  // The cursors continue from where they left off, as the ticks that they
+  // refer to are carried over along with the view.  Anything that has
+  // already been established in this process takes precedence.
+  if (!header->cursors.empty()) {
+    auto cursors = root.inner.cursors.wlock();
+    for (auto& [name, ticks] : header->cursors) {
+      cursors->emplace(name, ticks);
+    }
+  }
+
+  // The watcher has never seen these files, so establish any per-file
+  // watches now; the following crawl will only do so for changed files.
+  size_t numFiles = 0;
+  for (auto* file = view.getLatestFile(); file; file = file->next) {
+    if (watchFiles && file->exists) {
+      watcher_->startWatchFile(file);
+    }
+    ++numFiles;
+  }
+
+  logf(
+      ERR,
+      "restored {} files and {} cursors from view snapshot\n",
+      numFiles,
+      header->cursors.size());
+  return header;
+}
+
+folly::SemiFuture<std::vector<w_string>> InMemoryView::filesChangedSinceCommit(
+    const std::shared_ptr<Root>& root,
+    w_string commit) {
+  auto [p, f] = folly::makePromiseContract<std::vector<w_string>>();
+  // The root keeps the view, and so the SCM, alive until we're done
+  getThreadPool(ThreadPool::Priority::Scm)
+      .add([root, scm = getSCM(), commit, p = std::move(p)]() mutable {
+        p.setWith([&] {
+          auto mergeBase = scm->mergeBaseWith(commit);
+          auto files = scm->getFilesChangedSinceMergeBaseWith(mergeBase);
+          if (mergeBase != commit) {
+            // The working copy has moved off the branch that commit is on,
+            // so what changed on the way from the merge base to commit has
+            // changed back since
+            auto status = scm->getFilesChangedBetweenCommits(
+                {mergeBase.string(), commit.string()}, nullptr, false);
+            for (auto* list :
+                 {&status.changedFiles,
+                  &status.addedFiles,
+                  &status.removedFiles}) {
+              files.insert(files.end(), list->begin(), list->end());
+            }
+          }
+          return files;
+        });
+      });
+  return std::move(f);
+}
+
+void InMemoryView::saveViewSnapshot(const Root& root) {
+  // Looked up before the view is read; see ViewSnapshot::serialize
+  auto watcherPosition = watcher_->getChangeHistoryPosition();
+  w_string scmCommit;
+  if (viewSnapshotScmSeed_) {
+    if (auto* scm = getSCM()) {
+      try {
+        scmCommit = scm->getWorkingCopyCommit();
+      } catch (const std::exception& exc) {
+        log(ERR,
+            "not recording the working copy commit in the view snapshot: ",
+            exc.what(),
+            "\n");
+      }
+    }
+  }
+
+  std::string data;
+  {
+    auto view = view_.rlock();
+    data = ViewSnapshot::serialize(
+        *view,
+        mostRecentTick_.load(std::memory_order_acquire),
+        lastAgeOutTick_,
+        *root.inner.cursors.rlock(),
+        scmCommit,
+        watcherPosition);
+  }
+  try {
+    ViewSnapshot::write(viewSnapshotPath_, data);
+  } catch (const std::exception& exc) {
+    log(ERR, "failed to save view snapshot: ", exc.what(), "\n");
+  }
+  lastViewSnapshot_ = std::chrono::steady_clock::now();
+}
+
+void InMemoryView::saveContentHashCache() {
+  auto stores = caches_.contentHashCache.stats().cacheStore;
+  if (stores != lastContentHashSaveStores_) {
+    try {
+      caches_.contentHashCache.save(contentHashCachePath_);
+      lastContentHashSaveStores_ = stores;
+    } catch (const std::exception& exc) {
+      log(ERR, "failed to save content hashes: ", exc.what(), "\n");
+    }
+  }
+  lastContentHashSave_ = std::chrono::steady_clock::now();
+}
+
+void InMemoryView::publishSettleDelta() {
+  auto view = view_.rlock();
+  auto toTick = mostRecentTick_.load(std::memory_order_acquire);
+  if (toTick == lastSettleDeltaTick_) {
+    // Nothing changed, so the current delta (if any) is still accurate.
+    return;
+  }
+
+  auto delta = std::make_shared<SettleDelta>();
+  delta->fromTick = lastSettleDeltaTick_;
+  delta->toTick = toTick;
+  lastSettleDeltaTick_ = toTick;
+
+  for (auto* f = view->getLatestFile();
+       f && f->otime.ticks > delta->fromTick;
+       f = f->next) {
+    if (delta->files.size() >= settleDeltaMaxFiles_) {
+      // Too large to be worth holding on to; subscribers will walk the view.
+      *settleDelta_.wlock() = nullptr;
+      return;
+    }
+    delta->files.emplace_back(f, caches_);
+    delta->files.back().detach();
+  }
+  *settleDelta_.wlock() = std::move(delta);
+}
+
+bool InMemoryView::publishUnsettledDelta(const ViewDatabase& view) {
+  auto delta = std::make_shared<SettleDelta>();
+  delta->fromTick = lastSettledTick_;
+  delta->toTick = mostRecentTick_.load(std::memory_order_acquire);
+
+  for (auto* f = view.getLatestFile();
+       f && f->otime.ticks > delta->fromTick;
+       f = f->next) {
+    if (delta->files.size() >= unsettledDeltaMaxFiles_) {
+      // A change this large will be reported when the view settles.
+      *unsettledDelta_.wlock() = nullptr;
+      return false;
+    }
+    delta->files.emplace_back(f, caches_);
+    delta->files.back().detach();
+  }
+  *unsettledDelta_.wlock() = std::move(delta);
+  return true;
 }
 
 InMemoryView::Continue InMemoryView::doSettleThings(
@@ -87,6 +634,7 @@ InMemoryView::Continue InMemoryView::doSettleThings(
     IoThreadState& state) {
   // No new pending items were given to us, so consider that
   // we may now be settled.
+  TraceSpan span("io", "settle", root.root_path);
 
   std::chrono::milliseconds sinceUnsettle = state.lastUnsettle
       ? std::chrono::duration_cast<std::chrono::milliseconds>(
@@ -94,6 +642,12 @@ InMemoryView::Continue InMemoryView::doSettleThings(
       : std::chrono::milliseconds{0};
 
   warmContentCache();
+  precomputeMergeBases(root);
+  if (settleDeltaMaxFiles_ > 0) {
+    publishSettleDelta();
+  }
+  lastSettledTick_ = mostRecentTick_.load(std::memory_order_acquire);
+  *unsettledDelta_.wlock() = nullptr;
 
   root.unilateralResponses->enqueue(json_object({{"settled", json_true()}}));
 
@@ -126,16 +680,100 @@ InMemoryView::Continue InMemoryView::doSettleThings(
   }
 
   root.considerAgeOut();
+
+  // Nothing can become idle for longer than pageOutIdle_ in less time than
+  // that, so there's no point in looking more often
+  if (pageOutIdle_.count() > 0 &&
+      std::chrono::steady_clock::now() - lastPageOutScan_ >= pageOutIdle_) {
+    lastPageOutScan_ = std::chrono::steady_clock::now();
+    pageOutIdleSubtrees();
+  }
+
+  if (viewSnapshotPath_ && viewSnapshotInterval_.count() > 0 &&
+      std::chrono::steady_clock::now() - lastViewSnapshot_ >=
+          viewSnapshotInterval_) {
+    saveViewSnapshot(root);
+  }
+  if (contentHashCachePath_ && contentHashPersistInterval_.count() > 0 &&
+      std::chrono::steady_clock::now() - lastContentHashSave_ >=
+          contentHashPersistInterval_) {
+    saveContentHashCache();
+  }
   return Continue::Continue;
 }
 
 void InMemoryView::clientModeCrawl(const std::shared_ptr<Root>& root) {
+  // Answering from the snapshot left behind by the daemon saves the crawl,
+  // but can't see anything that has changed since it was written, so it is
+  // opt in, and the results carry a warning when the snapshot is old.
+  if (viewSnapshotPath_ &&
+      config_.getBool("client_mode_view_snapshot", false)) {
+    auto view = view_.wlock();
+    if (restoreViewSnapshot(*root, *view, false)) {
+      root->inner.done_initial.store(true, std::memory_order_release);
+      view.unlock();
+      warnIfViewSnapshotIsStale(*root);
+      return;
+    }
+  }
+
   PendingChanges pending;
   fullCrawl(root, pendingFromWatcher_, pending);
 }
 
+void InMemoryView::warnIfViewSnapshotIsStale(Root& root) {
+  auto maxAge = std::chrono::seconds(
+      config_.getInt("client_mode_view_snapshot_max_age_seconds", 300));
+  std::chrono::seconds age{0};
+  try {
+    auto st = fileSystem_.getFileInformation(viewSnapshotPath_.c_str());
+    age = std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now() -
+        std::chrono::system_clock::from_time_t(st.mtime.tv_sec));
+  } catch (const std::exception&) {
+    // We just read it, so this can only be a race with its replacement
+    return;
+  }
+  if (age <= maxAge) {
+    return;
+  }
+
+  auto warning = w_string::format(
+      "These results come from a view snapshot that was written {} seconds "
+      "ago, and don't reflect any changes made since then.  Start the "
+      "watchman service for up to date results.",
+      age.count());
+  log(ERR, warning, "\n");
+  root.recrawlInfo.wlock()->warning = warning;
+}
+
 namespace {
 
+// How much older than the crawler's last read of a dir its change time
+// must be before the dir can be assumed to be unchanged since that read.
+// This covers filesystems that only record times to the second, or to two
+// seconds.
+constexpr time_t kDirChangeTimeMargin = 2;
+
+// Network and userspace filesystems may cache attributes or not update
+// the change time of a dir when its entries change.  The
+// trust_dir_change_times option overrides this guess.
+bool dirChangeTimeIsReliable(const Root& root) {
+#ifdef _WIN32
+  // The ctime that we have on Windows is the creation time
+  (void)root;
+  return false;
+#else
+  bool reliable = !root.fs_type.piece().startsWith("fuse");
+  for (auto unreliable : {"nfs", "cifs", "smb", "smbfs", "9p", "vboxsf"}) {
+    if (root.fs_type.piece() == w_string_piece(unreliable)) {
+      reliable = false;
+    }
+  }
+  return root.config.getBool("trust_dir_change_times", reliable);
+#endif
+}
+
 std::chrono::milliseconds getBiggestTimeout(const Root& root) {
   std::chrono::milliseconds biggest_timeout = root.gc_interval;
 
@@ -153,11 +791,49 @@ std::chrono::milliseconds getBiggestTimeout(const Root& root) {
 } // namespace
 
 void InMemoryView::ioThread(const std::shared_ptr<Root>& root) {
+  if (recrawlPrune_ != RecrawlPrune::Off &&
+      !dirChangeTimeIsReliable(*root)) {
+    logf(
+        ERR,
+        "not pruning unchanged dirs from recrawls of {}: the change time of "
+        "a dir isn't trusted on {} filesystems\n",
+        root->root_path,
+        root->fs_type);
+    recrawlPrune_ = RecrawlPrune::Off;
+  }
+  if (resyncOnOverflow_ && !dirChangeTimeIsReliable(*root)) {
+    logf(
+        ERR,
+        "recrawling {} in full after an overflow: the change time of a dir "
+        "isn't trusted on {} filesystems\n",
+        root->root_path,
+        root->fs_type);
+    resyncOnOverflow_ = false;
+  }
+
   IoThreadState state{getBiggestTimeout(*root)};
   state.currentTimeout = root->trigger_settle;
 
   while (Continue::Continue == stepIoThread(root, state, pendingFromWatcher_)) {
   }
+
+  if (viewSnapshotPath_) {
+    if (root->inner.cancelled.load(std::memory_order_acquire) &&
+        !w_is_stopping()) {
+      // The watch was removed; there is nothing to restore next time.
+      unlink(viewSnapshotPath_.c_str());
+    } else if (root->inner.done_initial.load(std::memory_order_acquire)) {
+      saveViewSnapshot(*root);
+    }
+  }
+  if (contentHashCachePath_) {
+    if (root->inner.cancelled.load(std::memory_order_acquire) &&
+        !w_is_stopping()) {
+      unlink(contentHashCachePath_.c_str());
+    } else {
+      saveContentHashCache();
+    }
+  }
 }
 
 InMemoryView::Continue InMemoryView::stepIoThread(
@@ -172,7 +848,8 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     state.lastUnsettle = std::chrono::steady_clock::now();
     // Reduce sleep timeout to the settle duration ready for the next loop
     // through.
-    state.currentTimeout = root->trigger_settle;
+    state.currentTimeout =
+        settleController_.wlock()->settleFor(root->trigger_settle);
   };
 
   if (!root->inner.done_initial.load(std::memory_order_acquire)) {
@@ -190,6 +867,9 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     auto targetPendingLock =
         pendingFromWatcher.lockAndWait(state.currentTimeout);
     logf(DBG, " ... wake up\n");
+    if (auto items = targetPendingLock->getPendingItemCount()) {
+      settleController_.wlock()->recordBatch(items);
+    }
     state.localPending.append(
         targetPendingLock->stealItems(), targetPendingLock->stealSyncs());
   }
@@ -225,6 +905,8 @@ InMemoryView::Continue InMemoryView::stepIoThread(
   }
 
   // Otherwise we have pending items to stat and crawl
+  TraceSpan span("io", "batch", rootPath_);
+  span.addArg("items", json_integer(state.localPending.getPendingItemCount()));
 
   // Some Linux kernels between 5.3 and 5.6 will report inotify events before
   // the file has been evicted from the cache, causing Watchman to incorrectly
@@ -238,16 +920,46 @@ InMemoryView::Continue InMemoryView::stepIoThread(
     std::this_thread::sleep_for(std::chrono::milliseconds(notify_sleep_ms));
   }
 
-  auto view = view_.wlock();
+  auto preStats = prefetchPendingStats(*root, state.localPending);
+
+  auto view = lockViewForUpdate();
 
   mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
 
-  auto isDesynced = processAllPending(root, *view, state.localPending);
+  // resyncFrom sets the time before it queues the root, so a batch holding
+  // that crawl sees the time too
+  activeResyncSince_ = resyncSince_.exchange(0, std::memory_order_acq_rel);
+
+  if (processScopedPending(root, *view, state.localPending, &preStats)) {
+    // Let the queries whose cookies were settled early in, before the rest
+    // of the batch.  What's processed after this has to be newer than what
+    // they saw, so that a query since their clock sees it.
+    view.unlock();
+    if (!root->queries.rlock()->empty()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    view = lockViewForUpdate();
+    mostRecentTick_.fetch_add(1, std::memory_order_acq_rel);
+  }
+
+  auto isDesynced =
+      processAllPending(root, *view, state.localPending, &preStats);
+  activeResyncSince_ = 0;
   if (isDesynced == IsDesynced::Yes) {
     logf(ERR, "recrawl complete, aborting all pending cookies\n");
     root->cookies.abortAllCookies();
   }
 
+  // Let fast subscriptions see this batch without waiting for the settle
+  bool publishUnsettled =
+      root->fastSubscriptions.load(std::memory_order_acquire) > 0 &&
+      publishUnsettledDelta(*view);
+  view.unlock();
+  if (publishUnsettled) {
+    root->unilateralResponses->enqueue(
+        json_object({{"unsettled", json_true()}}));
+  }
+
   // Always mark unsettled after processing events because settle durations
   // should only include idle time, not time spent processing events.
   markUnsettled(state);
@@ -257,7 +969,8 @@ InMemoryView::Continue InMemoryView::stepIoThread(
 InMemoryView::IsDesynced InMemoryView::processAllPending(
     const std::shared_ptr<Root>& root,
     ViewDatabase& view,
-    PendingChanges& coll) {
+    PendingChanges& coll,
+    PendingStats* preStats) {
   auto desyncState = IsDesynced::No;
 
   // Don't resolve any of these until any recursive crawls are done.
@@ -288,6 +1001,16 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
       allSyncs.push_back(std::move(syncs));
     }
 
+    if (!stopThreads_.load(std::memory_order_acquire)) {
+      applyDirMoves(root, view, coll, pending.get());
+    }
+
+    if (coalesceDirRescanThreshold_ > 0 &&
+        !stopThreads_.load(std::memory_order_acquire)) {
+      pending = rescanBusyDirs(
+          root, view, coll, std::move(pending), pendingCookies);
+    }
+
     while (pending) {
       if (!stopThreads_.load(std::memory_order_acquire)) {
         if (pending->flags & W_PENDING_IS_DESYNCED) {
@@ -304,8 +1027,22 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
           }
         }
 
+        const DirEntry* preStat = nullptr;
+        PendingStats::iterator preStatIt;
+        if (preStats && !preStats->empty()) {
+          preStatIt = preStats->find(pending->path);
+          if (preStatIt != preStats->end()) {
+            preStat = &preStatIt->second;
+          }
+        }
+
         // processPath may insert new pending items into `coll`
-        processPath(root, view, coll, *pending, nullptr, pendingCookies);
+        processPath(root, view, coll, *pending, preStat, pendingCookies);
+
+        if (preStat) {
+          // Should the path be reported again, it must be statted again
+          preStats->erase(preStatIt);
+        }
       }
 
       // TODO: Document that continuing to run this loop when stopThreads_ is
@@ -313,6 +1050,8 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
       pending = std::move(pending->next);
     }
   }
+  // The dirs may be renamed or replaced before the next batch
+  statDirs_.clear();
 
   for (auto& pendingCookie : pendingCookies) {
     if (processedPaths_) {
@@ -339,6 +1078,206 @@ InMemoryView::IsDesynced InMemoryView::processAllPending(
   return desyncState;
 }
 
+bool InMemoryView::processScopedPending(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    PendingStats* preStats) {
+  auto scopes = root->cookies.getPendingScopes();
+  if (scopes.empty()) {
+    return false;
+  }
+
+  auto pending = coll.stealItems();
+  for (auto* item = pending.get(); item; item = item->next.get()) {
+    if (item->flags & W_PENDING_IS_DESYNCED) {
+      // The cookies are going to be aborted once the crawl is done
+      coll.append(std::move(pending), {});
+      return false;
+    }
+  }
+
+  // A dir above a scope is in it too: its entries may be what's changed
+  // beneath the scope, or the scope itself.  So are the cookie dirs, as
+  // crawling them is how some watchers find the cookies.
+  auto cookieDirs = root->cookies.cookieDirs();
+  auto inScope = [&](const watchman_pending_fs& item) {
+    if (root->cookies.isCookiePrefix(item.path)) {
+      return root->cookies.isScopedCookie(item.path);
+    }
+    if (cookieDirs.count(item.path)) {
+      return true;
+    }
+    for (auto& scope : scopes) {
+      if (isAtOrBelow(item.path, scope) || isAtOrBelow(scope, item.path)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  // Everything else waits for processAllPending, as do the syncs
+  PendingChanges deferred;
+  std::vector<w_string> pendingCookies;
+  while (pending) {
+    while (pending) {
+      auto next = std::move(pending->next);
+      if (stopThreads_.load(std::memory_order_acquire) ||
+          !inScope(*pending)) {
+        deferred.append(std::move(pending), {});
+      } else {
+        const DirEntry* preStat = nullptr;
+        PendingStats::iterator preStatIt;
+        if (preStats && !preStats->empty()) {
+          preStatIt = preStats->find(pending->path);
+          if (preStatIt != preStats->end()) {
+            preStat = &preStatIt->second;
+          }
+        }
+
+        // processPath may insert new pending items into `coll`
+        processPath(root, view, coll, *pending, preStat, pendingCookies);
+
+        if (preStat) {
+          preStats->erase(preStatIt);
+        }
+      }
+      pending = std::move(next);
+    }
+    pending = coll.stealItems();
+  }
+  coll.append(deferred.stealItems(), {});
+
+  bool notified = false;
+  for (auto& cookie : pendingCookies) {
+    if (!root->cookies.isScopedCookie(cookie)) {
+      // Found by crawling the cookie dir; it has to wait for the rest of
+      // the batch, and be considered again when it's processed then.
+      coll.add(cookie, std::chrono::system_clock::now(), W_PENDING_VIA_NOTIFY);
+      continue;
+    }
+    if (processedPaths_) {
+      processedPaths_->write(PendingChangeLogEntry{
+          PendingChange{
+              cookie, std::chrono::system_clock::now(), W_PENDING_CRAWL_ONLY},
+          make_error_code(error_code::too_many_symbolic_link_levels),
+          FileInformation{}});
+    }
+    root->cookies.notifyCookie(cookie);
+    notified = true;
+  }
+  return notified;
+}
+
+void InMemoryView::applyDirMoves(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    const watchman_pending_fs* pending) {
+  std::vector<w_string> movedDirs;
+  for (auto* item = pending; item; item = item->next.get()) {
+    // A recursive crawl of the new path is going to look at everything
+    // anyway, and one of the old path obsoletes what we know about it
+    if (!item->movedFrom ||
+        (item->flags & (W_PENDING_RECURSIVE | W_PENDING_IS_DESYNCED))) {
+      continue;
+    }
+    // The crawler doesn't descend into these, so the view wouldn't have
+    // what to move, or shouldn't have it after the move
+    auto& from = item->movedFrom;
+    auto& to = item->path;
+    if (root->ignore.isIgnored(to.data(), to.size()) ||
+        root->ignore.isIgnoreVCS(from.dirName()) ||
+        root->ignore.isIgnoreVCS(to.dirName()) ||
+        root->cookies.isCookiePrefix(to)) {
+      continue;
+    }
+
+    movedDirs.clear();
+    if (!view.moveDir(*watcher_, from, to, getClock(item->now), movedDirs)) {
+      logf(DBG, "can't move {} to {} in the view; crawling it\n", from, to);
+      continue;
+    }
+    dirsMovedInPlace_.fetch_add(movedDirs.size(), std::memory_order_relaxed);
+    for (auto& dir : movedDirs) {
+      coll.add(dir, item->now, W_PENDING_CRAWL_ONLY);
+    }
+  }
+}
+
+std::shared_ptr<watchman_pending_fs> InMemoryView::rescanBusyDirs(
+    const std::shared_ptr<Root>& root,
+    ViewDatabase& view,
+    PendingChanges& coll,
+    std::shared_ptr<watchman_pending_fs> pending,
+    std::vector<w_string>& pendingCookies) {
+  // Only plain watcher notifications are candidates; anything that is
+  // already a crawl, or is desynced, keeps its own semantics.  Cookies are
+  // left alone because they may be gone again by the time we read the
+  // directory and their notification must not be lost.
+  auto isCandidate = [&](const watchman_pending_fs& item) {
+    return item.flags == W_PENDING_VIA_NOTIFY &&
+        !root->cookies.isCookiePrefix(item.path);
+  };
+
+  struct BusyDir {
+    std::chrono::system_clock::time_point now;
+    std::unordered_set<w_string> names;
+  };
+  std::unordered_map<w_string, BusyDir> dirs;
+  for (auto* item = pending.get(); item; item = item->next.get()) {
+    if (!isCandidate(*item)) {
+      continue;
+    }
+    auto& dir = dirs[item->path.dirName()];
+    dir.names.insert(item->path.baseName());
+    dir.now = std::max(dir.now, item->now);
+  }
+
+  for (auto it = dirs.begin(); it != dirs.end();) {
+    // The directory must already be in the view: a new directory is crawled
+    // recursively on behalf of its own notification.
+    if (it->second.names.size() <= coalesceDirRescanThreshold_ ||
+        root->ignore.isIgnoreDir(it->first) ||
+        root->ignore.isIgnoreVCS(it->first) ||
+        !view.resolveDir(it->first, false)) {
+      it = dirs.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (dirs.empty()) {
+    return pending;
+  }
+
+  // Unlink the notifications that the rescans will take care of,
+  // preserving the order of the rest.
+  std::shared_ptr<watchman_pending_fs> remaining;
+  auto* tail = &remaining;
+  while (pending) {
+    auto next = std::move(pending->next);
+    if (!isCandidate(*pending) ||
+        dirs.find(pending->path.dirName()) == dirs.end()) {
+      *tail = std::move(pending);
+      tail = &(*tail)->next;
+    }
+    pending = std::move(next);
+  }
+
+  for (auto& [dirName, dir] : dirs) {
+    logf(
+        DBG,
+        "coalescing {} changes in {} into a single rescan\n",
+        dir.names.size(),
+        dirName);
+    PendingChange rescan{
+        dirName, dir.now, W_PENDING_NONRECURSIVE_SCAN | W_PENDING_CRAWL_ONLY};
+    crawler(root, view, coll, rescan, pendingCookies, &dir.names);
+  }
+
+  return remaining;
+}
+
 void InMemoryView::processPath(
     const std::shared_ptr<Root>& root,
     ViewDatabase& view,
@@ -349,6 +1288,8 @@ void InMemoryView::processPath(
   w_assert(
       pending.path.size() >= rootPath_.size(),
       "full_path must be a descendant of the root directory\n");
+  WATCHMAN_TRACE(
+      process_path_begin, pending.path.c_str(), pending.flags.asRaw());
 
   /* From a particular query's point of view, there are four sorts of cookies we
    * can observe:
@@ -386,6 +1327,7 @@ void InMemoryView::processPath(
     }
 
     // Never allow cookie files to show up in the tree
+    WATCHMAN_TRACE(process_path_end, pending.path.c_str());
     return;
   }
 
@@ -395,10 +1337,36 @@ void InMemoryView::processPath(
   } else {
     statPath(*root, root->cookies, view, coll, pending, pre_stat);
   }
+  WATCHMAN_TRACE(process_path_end, pending.path.c_str());
 }
 
 namespace {
 
+// Calls func(i) for each i in [0, count), split into at most `parallelism`
+// chunks that run on the thread pool, and waits for them all to finish.
+// If the pool refuses work, the indices that it refused are skipped; the
+// callers treat them as not yet statted.
+template <typename Func>
+void forEachInParallel(size_t count, size_t parallelism, const Func& func) {
+  size_t chunkSize = (count + parallelism - 1) / parallelism;
+  std::vector<folly::Future<folly::Unit>> futures;
+  try {
+    for (size_t begin = 0; begin < count; begin += chunkSize) {
+      size_t end = std::min(count, begin + chunkSize);
+      futures.emplace_back(folly::via(&getThreadPool(), [&func, begin, end] {
+        for (size_t i = begin; i < end; ++i) {
+          func(i);
+        }
+      }));
+    }
+  } catch (const std::exception& exc) {
+    // The pool is full or stopping; whatever was scheduled still runs.
+    log(DBG, "forEachInParallel: unable to schedule: ", exc.what(), "\n");
+  }
+
+  folly::collectAll(futures.begin(), futures.end()).wait();
+}
+
 void apply_dir_size_hint(watchman_dir* dir, uint32_t ndirs, uint32_t nfiles) {
   if (dir->files.empty() && nfiles > 0) {
     dir->files.reserve(nfiles);
@@ -410,14 +1378,98 @@ void apply_dir_size_hint(watchman_dir* dir, uint32_t ndirs, uint32_t nfiles) {
 
 } // namespace
 
+void InMemoryView::prefetchCrawlStats(
+    std::vector<CrawlEntry>& entries,
+    CaseSensitivity caseSensitive) {
+  if (crawlStatParallelism_ <= 1) {
+    return;
+  }
+
+  std::vector<CrawlEntry*> needStat;
+  for (auto& entry : entries) {
+    if (!entry.dirent.has_stat) {
+      needStat.push_back(&entry);
+    }
+  }
+  if (needStat.size() < kMinEntriesForParallelStat) {
+    return;
+  }
+
+  // Any entry that fails to stat here is left without a pre_stat so that
+  // statPath retries it on the IO thread and handles the error in the usual
+  // way.
+  forEachInParallel(needStat.size(), crawlStatParallelism_, [&](size_t i) {
+    auto* entry = needStat[i];
+    try {
+      entry->dirent.stat = fileSystem_.getFileInformation(
+          entry->fullPath.c_str(), caseSensitive);
+      entry->dirent.has_stat = true;
+    } catch (const std::system_error&) {
+      entry->dirent.has_stat = false;
+    }
+  });
+}
+
+InMemoryView::PendingStats InMemoryView::prefetchPendingStats(
+    const Root& root,
+    PendingChanges& pending) {
+  PendingStats result;
+  if (changeStatParallelism_ <= 1 ||
+      pending.getPendingItemCount() < kMinEntriesForParallelStat) {
+    return result;
+  }
+
+  // Take the items so that we can walk them, then put them back as they
+  // were for processAllPending.
+  auto items = pending.stealItems();
+  auto syncs = pending.stealSyncs();
+
+  // Only the paths that processPath will hand to statPath; the rest are
+  // crawled, are cookies, or are ignored.
+  std::vector<const w_string*> paths;
+  for (auto* item = items.get(); item; item = item->next.get()) {
+    if ((item->flags & W_PENDING_CRAWL_ONLY) || item->path == rootPath_ ||
+        root.cookies.isCookiePrefix(item->path) ||
+        root.ignore.isIgnored(item->path.data(), item->path.size())) {
+      continue;
+    }
+    paths.push_back(&item->path);
+  }
+
+  if (paths.size() >= kMinEntriesForParallelStat) {
+    std::vector<DirEntry> stats(paths.size(), DirEntry{});
+    forEachInParallel(paths.size(), changeStatParallelism_, [&](size_t i) {
+      try {
+        stats[i].stat = fileSystem_.getFileInformation(
+            paths[i]->c_str(), root.case_sensitive);
+        stats[i].has_stat = true;
+      } catch (const std::system_error&) {
+        // Leave it to statPath, which deals with the error
+      }
+    });
+
+    result.reserve(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+      if (stats[i].has_stat) {
+        result.emplace(*paths[i], stats[i]);
+      }
+    }
+  }
+
+  pending.append(std::move(items), std::move(syncs));
+  return result;
+}
+
 void InMemoryView::crawler(
     const std::shared_ptr<Root>& root,
     ViewDatabase& view,
     PendingChanges& coll,
     const PendingChange& pending,
-    std::vector<w_string>& pendingCookies) {
+    std::vector<w_string>& pendingCookies,
+    const std::unordered_set<w_string>* notified) {
   bool recursive = pending.flags.contains(W_PENDING_RECURSIVE);
   bool stat_all = pending.flags.contains(W_PENDING_NONRECURSIVE_SCAN);
+  WATCHMAN_TRACE(crawl_dir, pending.path.c_str(), int(recursive));
 
   auto dir = view.resolveDir(pending.path, true);
 
@@ -462,6 +1514,16 @@ void InMemoryView::crawler(
   logf(
       DBG, "opendir({}) recursive={} stat_all={}\n", path, recursive, stat_all);
 
+  // statPath never records an ignored dir, but a crawl can still be
+  // scheduled for one by a watcher or an earlier view of the ignore rules.
+  // Don't spend a kernel watch on it.
+  if (path != root->root_path &&
+      root->ignore.isIgnored(path.data(), path.size())) {
+    logf(DBG, "not crawling ignored dir {}\n", path);
+    ignoredPathsPruned_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
   /* Start watching and open the dir for crawling.
    * Whether we open the dir prior to watching or after is watcher specific,
    * so the operations are rolled together in our abstraction */
@@ -476,7 +1538,10 @@ void InMemoryView::crawler(
     return;
   }
 
-  if (dir->files.empty()) {
+  // A dir that we haven't read before is sized once we know how many
+  // entries it has
+  bool sizeFromListing = dir->files.empty();
+  if (sizeFromListing) {
     // Pre-size our hash(es) if we can, so that we can avoid collisions
     // and re-hashing during initial crawl
     uint32_t num_dirs = 0;
@@ -491,10 +1556,71 @@ void InMemoryView::crawler(
     // If it is less than 2 then it doesn't follow that convention.
     // We just pass it through for the dir size hint and the hash
     // table implementation will round that up to the next power of 2
-    apply_dir_size_hint(
-        dir,
-        num_dirs,
-        uint32_t(root->config.getInt("hint_num_files_per_dir", 64)));
+    apply_dir_size_hint(dir, num_dirs, 0);
+  }
+
+  // A recursive crawl, such as the one that follows a notification
+  // overflow, can skip reading a dir whose change time shows that its
+  // entries are the same as when we last read them.  While resyncing after
+  // an overflow, the same goes for a dir that hasn't changed since the
+  // watcher's last good event, as we already know about everything before
+  // that.
+  bool resyncing =
+      activeResyncSince_ != 0 && (pending.flags & W_PENDING_IS_DESYNCED);
+  bool unchanged = false;
+  bool resynced = false;
+  time_t crawlTime = 0;
+  uint64_t crawlIno = 0;
+#ifndef _WIN32
+  if ((recrawlPrune_ != RecrawlPrune::Off || resyncOnOverflow_) &&
+      path != root->root_path) {
+    struct stat dirSt;
+    int dfd = osdir->getFd();
+    if (dfd != -1 && fstat(dfd, &dirSt) == 0) {
+      crawlTime = time(nullptr);
+      crawlIno = uint64_t(dirSt.st_ino);
+      bool known = recursive && !notified && dir->last_crawl != 0 &&
+          dir->last_crawl_ino == crawlIno;
+      unchanged = known && recrawlPrune_ != RecrawlPrune::Off &&
+          dirSt.st_ctime + kDirChangeTimeMargin < dir->last_crawl;
+      resynced = known && resyncing &&
+          dirSt.st_ctime + kDirChangeTimeMargin < activeResyncSince_;
+    }
+  }
+#endif
+
+  if (unchanged || resynced) {
+    osdir.reset();
+    recrawlDirsPruned_.fetch_add(1, std::memory_order_relaxed);
+    logf(DBG, "{} is unchanged since it was last crawled\n", path);
+
+    // Everything that we know to be in the dir is still there.  Check the
+    // child dirs in turn and, unless we're asked to trust the files too,
+    // look at each of them again, as a crawl would.  The files' contents
+    // may have changed since the last good event, so a resync always looks.
+    bool trustFiles = unchanged && recrawlPrune_ == RecrawlPrune::Subtree;
+    auto desynced = pending.flags & W_PENDING_IS_DESYNCED;
+    std::vector<w_string> files;
+    for (auto& it : dir->files) {
+      auto file = it.second.get();
+      if (!file->exists) {
+        continue;
+      }
+      if (file->stat.isDir()) {
+        coll.add(
+            dir,
+            file->getName().data(),
+            pending.now,
+            desynced | W_PENDING_RECURSIVE);
+      } else if (!trustFiles) {
+        files.push_back(dir->getFullPathToChild(file->getName()));
+      }
+    }
+    for (auto& file : files) {
+      PendingChange full_pending{std::move(file), pending.now, desynced};
+      processPath(root, view, coll, full_pending, nullptr, pendingCookies);
+    }
+    return;
   }
 
   /* flag for delete detection */
@@ -505,6 +1631,13 @@ void InMemoryView::crawler(
     }
   }
 
+  // Enumerate the directory up front so that the stat work for its children
+  // can be fanned out before we apply the results to the view.
+  std::vector<CrawlEntry> entries;
+  std::unordered_set<w_string> unseen;
+  if (notified) {
+    unseen = *notified;
+  }
   try {
     while (const DirEntry* dirent = osdir->readDir()) {
       // Don't follow parent/self links
@@ -513,15 +1646,14 @@ void InMemoryView::crawler(
         continue;
       }
 
-      // Queue it up for analysis if the file is newly existing
       w_string name(dirent->d_name, W_STRING_BYTE);
       struct watchman_file* file = dir->getChildFile(name);
       if (file) {
         file->maybe_deleted = false;
       }
-      if (!file || !file->exists || stat_all || recursive) {
-        auto full_path = dir->getFullPathToChild(name);
-
+      bool wasNotified = notified && unseen.erase(name) > 0;
+      // Queue it up for analysis if the file is newly existing
+      if (!file || !file->exists || stat_all || recursive || wasNotified) {
         PendingFlags newFlags;
         if (recursive || !file || !file->exists) {
           newFlags.set(W_PENDING_RECURSIVE);
@@ -529,16 +1661,18 @@ void InMemoryView::crawler(
         if (pending.flags & W_PENDING_IS_DESYNCED) {
           newFlags.set(W_PENDING_IS_DESYNCED);
         }
+        if (wasNotified) {
+          newFlags.set(W_PENDING_VIA_NOTIFY);
+        }
 
-        logf(
-            DBG,
-            "in crawler calling processPath on {} oldflags={} newflags={}\n",
-            full_path,
-            pending.flags.asRaw(),
-            newFlags.asRaw());
-
-        PendingChange full_pending{std::move(full_path), pending.now, newFlags};
-        processPath(root, view, coll, full_pending, dirent, pendingCookies);
+        auto& entry = entries.emplace_back();
+        entry.fullPath = dir->getFullPathToChild(name);
+        entry.flags = newFlags;
+        entry.dirent.has_stat = dirent->has_stat;
+        if (dirent->has_stat) {
+          entry.dirent.stat = dirent->stat;
+        }
+        entry.name = std::move(name);
       }
     }
   } catch (const std::system_error& exc) {
@@ -549,8 +1683,45 @@ void InMemoryView::crawler(
         exc.what(),
         ", re-adding to pending list to re-assess\n");
     coll.add(path, pending.now, {});
+    crawlTime = 0;
   }
   osdir.reset();
+  if (crawlTime != 0) {
+    dir->last_crawl = crawlTime;
+    dir->last_crawl_ino = crawlIno;
+  }
+
+  if (sizeFromListing) {
+    // Every entry of the dir is new, and so is in entries
+    apply_dir_size_hint(dir, 0, uint32_t(entries.size()));
+  }
+
+  // Notified children that are no longer listed still need to be processed
+  // so that their removal (or fleeting existence) is reported.
+  for (auto& name : unseen) {
+    auto& entry = entries.emplace_back();
+    entry.fullPath = dir->getFullPathToChild(name);
+    entry.flags = W_PENDING_VIA_NOTIFY;
+    entry.name = name;
+  }
+
+  prefetchCrawlStats(entries, root->case_sensitive);
+
+  for (auto& entry : entries) {
+    // The name storage is stable now that the vector is fully built.
+    entry.dirent.d_name = entry.name.c_str();
+
+    logf(
+        DBG,
+        "in crawler calling processPath on {} oldflags={} newflags={}\n",
+        entry.fullPath,
+        pending.flags.asRaw(),
+        entry.flags.asRaw());
+
+    PendingChange full_pending{
+        std::move(entry.fullPath), pending.now, entry.flags};
+    processPath(root, view, coll, full_pending, &entry.dirent, pendingCookies);
+  }
 
   // Anything still in maybe_deleted is actually deleted.
   // Arrange to re-process it shortly
@@ -656,6 +1827,67 @@ bool InMemoryView::propagateToParentDirIfAppropriate(
   return false;
 }
 
+bool InMemoryView::isIdempotentWrite(
+    const watchman_file* file,
+    const FileInformation& st,
+    w_string_piece relativePath) {
+  auto saved = file->getStat();
+  if (!did_file_change(&saved, &st)) {
+    // Only the notification says that anything happened
+    return idempotentWrites_ != IdempotentWrites::Report;
+  }
+  if (idempotentWrites_ != IdempotentWrites::IgnoreContent ||
+      !file->stat.isFile() || !st.isFile()) {
+    return false;
+  }
+
+  // A file rewritten with the same bytes differs only in its times
+  auto sameTimes = st;
+  sameTimes.mtime = saved.mtime;
+  sameTimes.ctime = saved.ctime;
+  if (did_file_change(&saved, &sameTimes)) {
+    return false;
+  }
+
+  // Hashing the new content is only worth it if we already know the old
+  // hash, which content_hash_warming or a query asking for content.sha1hex
+  // will have stored
+  auto& cache = caches_.contentHashCache;
+  auto previous = cache.getCached(ContentHashCacheKey{
+      relativePath.asWString(), size_t(saved.size), saved.mtime});
+  if (!previous) {
+    return false;
+  }
+  try {
+    return cache.computeHashImmediate(ContentHashCacheKey{
+               relativePath.asWString(), size_t(st.size), st.mtime}) ==
+        *previous;
+  } catch (const std::exception& exc) {
+    logf(DBG, "failed to hash {}: {}\n", relativePath, exc.what());
+    return false;
+  }
+}
+
+void InMemoryView::hashOnChange(
+    w_string_piece relativePath,
+    const FileInformation& st) {
+  if (!st.isFile() || uint64_t(st.size) > hashOnChangeMaxSize_) {
+    return;
+  }
+  auto& pool = getThreadPool();
+  if (pool.getQueueStats(ThreadPool::Priority::Hashing).queued >=
+      kMaxQueuedHashOnChange) {
+    hashOnChangeSkipped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  hashOnChangeStarted_.fetch_add(1, std::memory_order_relaxed);
+  // The result goes into the cache; errors are left for a query that
+  // wants the hash to see for itself.
+  (void)caches_.contentHashCache.get(
+      ContentHashCacheKey{relativePath.asWString(), size_t(st.size), st.mtime},
+      ThreadPool::Priority::Hashing);
+}
+
 void InMemoryView::statPath(
     const RootConfig& root,
     const CookieSync& cookies,
@@ -667,8 +1899,13 @@ void InMemoryView::statPath(
   const bool via_notify = pending.flags.contains(W_PENDING_VIA_NOTIFY);
   const PendingFlags desynced_flag = pending.flags & W_PENDING_IS_DESYNCED;
 
-  if (root.ignore.isIgnoreDir(pending.path)) {
-    logf(DBG, "{} matches ignore_dir rules\n", pending.path);
+  // Checking the whole path, rather than just whether it is itself an
+  // ignore_dir, also catches notifications for paths below an ignored dir,
+  // which some watchers can't filter out in the kernel.  Nothing ignored is
+  // recorded, so the crawler never descends into or watches it.
+  if (root.ignore.isIgnored(pending.path.data(), pending.path.size())) {
+    logf(DBG, "{} matches ignore rules\n", pending.path);
+    ignoredPathsPruned_.fetch_add(1, std::memory_order_relaxed);
     return;
   }
 
@@ -687,7 +1924,8 @@ void InMemoryView::statPath(
     st = pre_stat->stat;
   } else {
     try {
-      st = fileSystem_.getFileInformation(path.c_str(), root.case_sensitive);
+      st = fileSystem_.getFileInformationRelative(
+          path.c_str(), root.case_sensitive, statDirs_);
       log(DBG,
           "getFileInformation(",
           path,
@@ -762,7 +2000,7 @@ void InMemoryView::statPath(
             root,
             coll,
             pending.now,
-            file->stat,
+            file->getStat(),
             dir_name,
             parentDir,
             /* isUnlink= */ true) &&
@@ -807,7 +2045,22 @@ void InMemoryView::statPath(
        * to crawl it again */
       recursive = true;
     }
-    if (!file->exists || via_notify || did_file_change(&file->stat, &st)) {
+    bool changed = !file->exists || via_notify;
+    if (!changed) {
+      auto saved = file->getStat();
+      changed = did_file_change(&saved, &st);
+    }
+    if (changed && file->exists &&
+        idempotentWrites_ != IdempotentWrites::Report) {
+      w_string_piece relativePath(path);
+      relativePath.advance(std::min(path.size(), root.root_path.size() + 1));
+      if (isIdempotentWrite(file, st, relativePath)) {
+        logf(DBG, "{} is unchanged; not reporting it\n", path);
+        idempotentWritesIgnored_.fetch_add(1, std::memory_order_relaxed);
+        changed = false;
+      }
+    }
+    if (changed) {
       logf(
           DBG,
           "file changed exists={} via_notify={} stat-changed={} isdir={} size={} {}\n",
@@ -829,7 +2082,27 @@ void InMemoryView::statPath(
       }
     }
 
-    memcpy(&file->stat, &st, sizeof(file->stat));
+    file->setStat(st);
+
+    if (changed && hashOnChangeMaxSize_) {
+      w_string_piece relativePath(path);
+      relativePath.advance(std::min(path.size(), root.root_path.size() + 1));
+      hashOnChange(relativePath, st);
+    }
+
+    if (file->has_symlink_target &&
+        (changed || (st.isSymlink() && !file->getSymlinkTarget()))) {
+      // Keep the target in the node, so that queries needn't read the link
+      w_string target;
+      if (st.isSymlink()) {
+        try {
+          target = readSymbolicLink(path.c_str());
+        } catch (const std::system_error& exc) {
+          logf(DBG, "readSymbolicLink({}) failed: {}\n", path, exc.what());
+        }
+      }
+      file->setSymlinkTarget(std::move(target));
+    }
 
     if (st.isDir()) {
       if (dir_ent == NULL) {
@@ -7,6 +7,7 @@
 
 #include "watchman/Constants.h"
 #include "watchman/InMemoryView.h"
+#include "watchman/WatcherTrace.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/Watcher.h"
 
@@ -34,6 +35,18 @@ void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
   // io thread after this point
   pendingFromWatcher_.lock()->ping();
 
+  // Records what the watcher reports, for the replay watcher
+  std::unique_ptr<WatcherTraceWriter> trace;
+  auto tracePath = config_.getString("watcher_trace_file", "");
+  if (*tracePath) {
+    try {
+      trace = std::make_unique<WatcherTraceWriter>(
+          w_string(tracePath, W_STRING_BYTE), root->root_path);
+    } catch (const std::exception& exc) {
+      log(ERR, "not recording the watcher: ", exc.what(), "\n");
+    }
+  }
+
   while (!stopThreads_.load(std::memory_order_acquire)) {
     // big number because not all watchers can deal with
     // -1 meaning infinite wait at the moment
@@ -53,9 +66,21 @@ void InMemoryView::notifyThread(const std::shared_ptr<Root>& root) {
     } while (watcher_->waitNotify(0));
 
     if (!fromWatcher.empty()) {
-      auto lock = pendingFromWatcher_.lock();
-      lock->append(fromWatcher.stealItems(), fromWatcher.stealSyncs());
-      lock->ping();
+      auto items = fromWatcher.stealItems();
+      if (trace) {
+        // Our cookies only mean something to the queries that are waiting
+        // for them, which won't be there when the trace is replayed
+        for (auto* item = items.get(); item; item = item->next.get()) {
+          if (!root->cookies.isCookiePrefix(item->path)) {
+            trace->add(*item);
+          }
+        }
+        trace->flush();
+      }
+      // Hand the batch over without contending with the IO thread for the
+      // lock; it is consolidated into the collection when the IO thread
+      // next waits for work.
+      pendingFromWatcher_.push(std::move(items), fromWatcher.stealSyncs());
     }
   }
 }
@@ -6,9 +6,13 @@
  */
 
 #include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <optional>
+#include <unordered_map>
 #include "watchman/Errors.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/fs/FSDetect.h"
+#include "watchman/fs/FSProfile.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/watchlist.h"
@@ -56,6 +60,48 @@ bool root_check_restrict(const char* watch_path) {
   return false;
 }
 
+/* Returns the watched root that a new watch of root_path can share the view
+ * of, if share_enclosing_watch is enabled, or nullptr.  That root must crawl
+ * root_path in full, which rules out roots that ignore any part of the path
+ * down to it, and roots that are served by a view that doesn't crawl. */
+std::shared_ptr<Root> find_shareable_enclosing_root(const w_string& root_path) {
+  if (!cfg_get_bool("share_enclosing_watch", false)) {
+    return nullptr;
+  }
+
+  std::shared_ptr<Root> owner;
+  auto name = root_path.piece();
+  {
+    auto map = watched_roots.rlock();
+    for (const auto& it : *map) {
+      const auto& candidate = it.second;
+      if (candidate->inner.cancelled || candidate->enclosingRoot ||
+          name.size() <= it.first.size() ||
+          !name.startsWith(it.first.piece()) ||
+          !is_slash(name[it.first.size()])) {
+        continue;
+      }
+      // Prefer the innermost of nested owners, which crawls the least
+      if (!owner || owner->root_path.size() < it.first.size()) {
+        owner = candidate;
+      }
+    }
+  }
+  if (!owner || !owner->view()->requiresCrawl) {
+    return nullptr;
+  }
+
+  for (w_string_piece dir = root_path; dir.size() > owner->root_path.size();
+       dir = dir.dirName()) {
+    auto path = dir.asWString();
+    if (owner->ignore.isIgnored(path.data(), path.size()) ||
+        owner->ignore.isIgnoreVCS(path)) {
+      return nullptr;
+    }
+  }
+  return owner;
+}
+
 static void check_allowed_fs(const char* filename, const w_string& fs_type) {
   uint32_t i;
   const char* advice = NULL;
@@ -124,6 +170,87 @@ json_ref load_root_config(const char* path) {
   return json_load_file(cfgfilename, 0);
 }
 
+// Treat this as new activity for aging purposes; this roughly maps
+// to a client querying something about the root and should extend
+// the lifetime of the root
+void touchRoot(Root& root) {
+  // Note that this write potentially races with the read in consider_reap
+  // but we're "OK" with it because the latter is performed under a write
+  // lock and the worst case side effect is that we (safely) decide to reap
+  // at the same instant that a new command comes in.  The reap intervals
+  // are typically on the order of days.
+  root.inner.last_cmd_timestamp.store(
+      std::chrono::steady_clock::now(), std::memory_order_release);
+}
+
+// The roots that the paths passed by clients resolved to, so that the
+// many tiny commands of a script that runs watchman in a loop don't each
+// have to take the realpath of their root.  An entry is only used if the
+// path still names the same dir, and the root is still watched.
+struct ResolvedRoot {
+  std::weak_ptr<Root> root;
+  dev_t dev;
+  ino_t ino;
+};
+
+constexpr size_t kMaxResolvedRoots = 1024;
+
+folly::Synchronized<std::unordered_map<w_string, ResolvedRoot>>
+    resolvedRoots;
+
+std::shared_ptr<Root> lookupResolvedRoot(const w_string& filename) {
+  ResolvedRoot resolved;
+  {
+    auto map = resolvedRoots.rlock();
+    auto it = map->find(filename);
+    if (it == map->end()) {
+      return nullptr;
+    }
+    resolved = it->second;
+  }
+  auto root = resolved.root.lock();
+  if (!root || root->inner.cancelled) {
+    return nullptr;
+  }
+  try {
+    // Not following a symlink at the end of the path, which is why only
+    // the paths of dirs are remembered.  A symlink further up the path that
+    // now leads elsewhere leads to a different dir.
+    auto info = getFileInformation(filename.c_str());
+    if (!info.isDir() || info.dev != resolved.dev ||
+        info.ino != resolved.ino) {
+      return nullptr;
+    }
+  } catch (const std::system_error&) {
+    return nullptr;
+  }
+  return root;
+}
+
+void rememberResolvedRoot(
+    const w_string& filename,
+    const std::shared_ptr<Root>& root,
+    const FileInformation& info) {
+  if (!info.isDir() || info.ino == 0) {
+    // Nothing to tell whether the path still leads to the same place
+    return;
+  }
+  auto map = resolvedRoots.wlock();
+  if (map->size() >= kMaxResolvedRoots) {
+    for (auto it = map->begin(); it != map->end();) {
+      if (it->second.root.expired()) {
+        it = map->erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (map->size() >= kMaxResolvedRoots) {
+      map->clear();
+    }
+  }
+  (*map)[filename] = ResolvedRoot{root, info.dev, info.ino};
+}
+
 } // namespace
 
 std::shared_ptr<Root>
@@ -144,12 +271,20 @@ root_resolve(const char* filename, bool auto_watch, bool* created) {
     throw RootResolveError("cannot watch \"/\"");
   }
 
+  w_string name(filename, W_STRING_BYTE);
+  root = lookupResolvedRoot(name);
+  if (root) {
+    touchRoot(*root);
+    return root;
+  }
+
   w_string root_str;
+  std::optional<FileInformation> info;
 
   try {
     root_str = realPath(filename);
     try {
-      getFileInformation(filename);
+      info = getFileInformation(filename);
     } catch (const std::system_error& exc) {
       if (exc.code() == error_code::no_such_file_or_directory) {
         throw RootResolveError(
@@ -194,17 +329,10 @@ root_resolve(const char* filename, bool auto_watch, bool* created) {
       throw RootResolveError("directory ", root_str.view(), " is not watched");
     }
 
-    // Treat this as new activity for aging purposes; this roughly maps
-    // to a client querying something about the root and should extend
-    // the lifetime of the root
-
-    // Note that this write potentially races with the read in consider_reap
-    // but we're "OK" with it because the latter is performed under a write
-    // lock and the worst case side effect is that we (safely) decide to reap
-    // at the same instant that a new command comes in.  The reap intervals
-    // are typically on the order of days.
-    root->inner.last_cmd_timestamp.store(
-        std::chrono::steady_clock::now(), std::memory_order_release);
+    if (info) {
+      rememberResolvedRoot(name, root, *info);
+    }
+    touchRoot(*root);
     return root;
   }
 
@@ -235,15 +363,39 @@ root_resolve(const char* filename, bool auto_watch, bool* created) {
   }
 
   auto config_file = load_root_config(root_str.c_str());
-  Configuration config{config_file};
-  root = std::make_shared<Root>(
-      realFileSystem,
-      root_str,
-      fs_type,
-      config_file,
-      config,
-      WatcherRegistry::initWatcher(root_str, fs_type, config),
-      &w_state_save);
+  Configuration config{config_file, getFSTypeProfile(fs_type)};
+  if (config.getProfile()) {
+    logf(
+        DBG,
+        "defaulting options for {} from the {} profile: {}\n",
+        root_str,
+        fs_type,
+        json_dumps(config.getProfile(), JSON_COMPACT));
+  }
+  // A root with a .watchmanconfig of its own may want a different view
+  auto enclosing =
+      config_file ? nullptr : find_shareable_enclosing_root(root_str);
+  if (enclosing) {
+    logf(DBG, "{} shares the view of {}\n", root_str, enclosing->root_path);
+    root = std::make_shared<Root>(
+        realFileSystem,
+        root_str,
+        fs_type,
+        config_file,
+        config,
+        enclosing->view(),
+        &w_state_save,
+        enclosing);
+  } else {
+    root = std::make_shared<Root>(
+        realFileSystem,
+        root_str,
+        fs_type,
+        config_file,
+        config,
+        WatcherRegistry::initWatcher(root_str, fs_type, config),
+        &w_state_save);
+  }
 
   {
     auto wlock = watched_roots.wlock();
@@ -268,7 +420,11 @@ std::shared_ptr<Root> w_root_resolve(const char* filename, bool auto_watch) {
 
   if (created) {
     try {
-      root->view()->startThreads(root);
+      if (root->enclosingRoot) {
+        root->followEnclosingRoot();
+      } else {
+        root->view()->startThreads(root);
+      }
     } catch (const std::exception& e) {
       log(ERR, "w_root_resolve, while calling startThreads: ", e.what());
       root->cancel();
@@ -5,8 +5,10 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include "watchman/Logging.h"
 #include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
+#include "watchman/TraceRecorder.h"
 #include "watchman/root/Root.h"
 
 using namespace watchman;
@@ -16,11 +18,25 @@ folly::SemiFuture<folly::Unit> Root::waitForSettle(
   return view()->waitForSettle(settle_period);
 }
 
-CookieSync::SyncResult Root::syncToNow(std::chrono::milliseconds timeout) {
+CookieSync::SyncResult Root::syncToNow(
+    std::chrono::milliseconds timeout,
+    const w_string& scope) {
+  if (enclosingRoot) {
+    // Only the enclosing root's threads observe the cookies; the query
+    // only needs this root's part of them.
+    return enclosingRoot->syncToNow(
+        timeout, scope.empty() ? root_path : scope);
+  }
   PerfSample sample("sync_to_now");
+  TraceSpan span("cookie", "sync_to_now", root_path);
   auto root = shared_from_this();
+  // Only a sync of the whole view can stand in for the syncs of others
+  auto fullSync = scope.empty() ? syncFreshness.start() : nullptr;
   try {
-    auto result = view()->syncToNow(root, timeout);
+    auto result = view()->syncToNow(root, timeout, scope);
+    if (fullSync) {
+      syncFreshness.finish(fullSync, true);
+    }
     if (sample.finish()) {
       root->addPerfSampleMetadata(sample);
       sample.add_meta(
@@ -32,6 +48,9 @@ CookieSync::SyncResult Root::syncToNow(std::chrono::milliseconds timeout) {
     }
     return result;
   } catch (const std::exception& exc) {
+    if (fullSync) {
+      syncFreshness.finish(fullSync, false);
+    }
     sample.force_log();
     sample.finish();
     root->addPerfSampleMetadata(sample);
@@ -46,5 +65,29 @@ CookieSync::SyncResult Root::syncToNow(std::chrono::milliseconds timeout) {
   }
 }
 
+std::optional<std::chrono::milliseconds> Root::reuseRecentSync(
+    std::chrono::milliseconds maxStaleness,
+    std::chrono::milliseconds timeout) {
+  if (enclosingRoot) {
+    return enclosingRoot->reuseRecentSync(maxStaleness, timeout);
+  }
+  auto reuse = syncFreshness.reuse(maxStaleness);
+  if (!reuse) {
+    return std::nullopt;
+  }
+  try {
+    std::move(reuse->ready).get(timeout);
+  } catch (const std::exception& exc) {
+    log(DBG,
+        root_path,
+        ": the sync in flight didn't finish in time for a query: ",
+        exc.what(),
+        "\n");
+    return std::nullopt;
+  }
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      reuse->staleness);
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -13,11 +13,18 @@ using namespace watchman;
 
 void Root::recrawlTriggered(const char* why) {
   recrawlInfo.wlock()->recrawlCount++;
+  // The syncs made so far may not have seen what the crawl will find
+  syncFreshness.invalidate();
 
   log(ERR, root_path, ": ", why, ": tree recrawl triggered\n");
 }
 
 void Root::scheduleRecrawl(const char* why) {
+  if (enclosingRoot) {
+    // The crawl belongs to the root whose view we share
+    enclosingRoot->scheduleRecrawl(why);
+    return;
+  }
   {
     auto info = recrawlInfo.wlock();
 
@@ -38,13 +45,72 @@ void Root::scheduleRecrawl(const char* why) {
     }
     info->shouldRecrawl = true;
   }
+  syncFreshness.invalidate();
   view()->wakeThreads();
 }
 
+void Root::scheduleResync(
+    const char* why,
+    std::chrono::system_clock::time_point lastGood) {
+  if (!view()->resyncFrom(lastGood)) {
+    scheduleRecrawl(why);
+    return;
+  }
+  syncFreshness.invalidate();
+  log(ERR,
+      root_path,
+      ": ",
+      why,
+      ": rescanning the dirs that changed since the last good event\n");
+}
+
 void Root::stopThreads() {
+  if (enclosingRoot) {
+    // The threads serve the enclosing root too; stop following it instead
+    enclosingSubscriber_.wlock()->reset();
+    return;
+  }
   view()->stopThreads();
 }
 
+void Root::followEnclosingRoot() {
+  std::weak_ptr<Root> weakSelf = shared_from_this();
+  auto subscriber = enclosingRoot->unilateralResponses->subscribe([weakSelf] {
+    auto self = weakSelf.lock();
+    if (!self) {
+      return;
+    }
+    std::vector<std::shared_ptr<const Publisher::Item>> pending;
+    {
+      auto locked = self->enclosingSubscriber_.wlock();
+      if (!*locked) {
+        // Not yet stored, or no longer following
+        return;
+      }
+      (*locked)->getPending(pending);
+    }
+
+    for (auto& item : pending) {
+      const auto& payload = item->payload;
+      if (payload.get_default("canceled")) {
+        // Without the enclosing root's threads the view goes stale
+        self->cancel();
+        return;
+      }
+      // State assertions belong to the root that they were made against,
+      // but the changes to the view matter to all of its roots
+      if (payload.get_default("settled") || payload.get_default("unsettled")) {
+        self->unilateralResponses->enqueue(json_ref(payload));
+      }
+      if (payload.get_default("settled") && self->considerReap()) {
+        self->stopWatch();
+        return;
+      }
+    }
+  });
+  *enclosingSubscriber_.wlock() = std::move(subscriber);
+}
+
 // Cancels a watch.
 bool Root::cancel() {
   if (inner.cancelled.exchange(true, std::memory_order_acq_rel)) {
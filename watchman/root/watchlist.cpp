@@ -8,6 +8,8 @@
 #include "watchman/root/watchlist.h"
 #include <folly/Synchronized.h>
 #include <vector>
+#include "watchman/CrawlScheduler.h"
+#include "watchman/ThreadStats.h"
 #include "watchman/TriggerCommand.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
@@ -146,17 +148,29 @@ json_ref Root::getStatus() const {
     cookie_array.array().push_back(w_string_to_json(name));
   }
 
+  // The crawl of a shared view is that of the root that owns it
+  const auto& owner = viewOwner();
+  auto scheduledCrawl =
+      CrawlScheduler::get().getStatus(owner.root_path.string());
   std::string crawl_status;
   auto recrawl_info = json_object();
   {
-    auto info = recrawlInfo.rlock();
+    auto info = owner.recrawlInfo.rlock();
     recrawl_info.set({
         {"count", json_integer(info->recrawlCount)},
         {"should-recrawl", json_boolean(info->shouldRecrawl)},
         {"warning", w_string_to_json(info->warning)},
     });
 
-    if (!inner.done_initial) {
+    if (!scheduledCrawl.isNull() &&
+        scheduledCrawl.get("state").asString().view() == "waiting") {
+      crawl_status = folly::to<std::string>(
+          "waiting ",
+          scheduledCrawl.get("wait_ms").asInt(),
+          "ms for its turn to ",
+          info->recrawlCount ? "re" : "",
+          "crawl");
+    } else if (!owner.inner.done_initial) {
       crawl_status = folly::to<std::string>(
           info->recrawlCount ? "re-" : "",
           "crawling for ",
@@ -194,27 +208,7 @@ json_ref Root::getStatus() const {
       auto info = json_object();
       auto elapsed = now - ctx->created;
 
-      const char* queryState = "?";
-      switch (ctx->state.load()) {
-        case QueryContextState::NotStarted:
-          queryState = "NotStarted";
-          break;
-        case QueryContextState::WaitingForCookieSync:
-          queryState = "WaitingForCookieSync";
-          break;
-        case QueryContextState::WaitingForViewLock:
-          queryState = "WaitingForViewLock";
-          break;
-        case QueryContextState::Generating:
-          queryState = "Generating";
-          break;
-        case QueryContextState::Rendering:
-          queryState = "Rendering";
-          break;
-        case QueryContextState::Completed:
-          queryState = "Completed";
-          break;
-      }
+      const char* queryState = queryContextStateName(ctx->state.load());
 
       info.set({
           {"elapsed-milliseconds",
@@ -266,14 +260,60 @@ json_ref Root::getStatus() const {
       {"cookie_list", std::move(cookie_array)},
       {"recrawl_info", std::move(recrawl_info)},
       {"queries", std::move(query_info)},
-      {"done_initial", json_boolean(inner.done_initial)},
+      {"done_initial", json_boolean(owner.inner.done_initial)},
       {"cancelled", json_boolean(inner.cancelled)},
       {"crawl-status",
        w_string_to_json(w_string(crawl_status.data(), crawl_status.size()))},
   });
+  if (!scheduledCrawl.isNull()) {
+    obj.set("scheduled_crawl", std::move(scheduledCrawl));
+  }
+  if (config.getProfile()) {
+    obj.set("fstype_profile", json_ref(config.getProfile()));
+  }
+  if (enclosingRoot) {
+    obj.set("enclosing_root", w_string_to_json(enclosingRoot->root_path));
+  }
+  auto settle = view()->getSettleStatus();
+  if (!settle.isNull()) {
+    obj.set("settle", std::move(settle));
+  }
+  obj.set("memory", getMemoryUsage());
+
+  // The threads that work on the view belong to the root that owns it
+  auto threads =
+      ThreadStats::getRootTotals(std::string(owner.root_path.view()));
+  auto toMs = [](std::chrono::nanoseconds duration) {
+    return json_integer(
+        std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+            .count());
+  };
+  obj.set(
+      "thread_usage",
+      json_object({
+          {"threads", json_integer(threads.threads)},
+          {"cpu_ms", toMs(threads.usage.cpu)},
+          {"wait_ms", toMs(threads.usage.wait)},
+      }));
   return obj;
 }
 
+json_ref Root::getMemoryUsage() const {
+  auto unilateral = unilateralResponses->getStats();
+  auto usage = json_object({
+      {"unilateral_queued_items", json_integer(unilateral.queuedItems)},
+      {"query_result_cache_entries",
+       json_integer(queryResultCache.rlock()->entries.size())},
+      {"shared_subscription_results",
+       json_integer(sharedSubscriptionResults.rlock()->size())},
+  });
+  auto viewUsage = view()->getMemoryUsage();
+  if (!viewUsage.isNull()) {
+    usage.set("view", std::move(viewUsage));
+  }
+  return usage;
+}
+
 json_ref Root::triggerListToJson() const {
   auto arr = json_array();
   {
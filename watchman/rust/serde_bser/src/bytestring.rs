@@ -9,6 +9,9 @@ use std::ffi::OsString;
 use std::fmt::Write;
 use std::path::PathBuf;
 
+use serde::de::{Deserialize, Deserializer, Visitor};
+use serde::ser::{Serialize, Serializer};
+
 /// The ByteString type represents values encoded using BSER_BYTESTRING.
 /// The purpose of this encoding is to represent bytestrings with an arbitrary
 /// encoding.
@@ -69,35 +72,37 @@ impl ByteString {
     /// string, with invalid sequences escaped using `\xXX` hex notation.
     /// This is for diagnostic and display purposes.
     pub fn as_escaped_string(&self) -> String {
-        let mut input = self.0.as_slice();
-        let mut output = String::new();
+        escape_bytes(self.0.as_slice())
+    }
+}
 
-        loop {
-            match ::std::str::from_utf8(input) {
-                Ok(valid) => {
-                    output.push_str(valid);
-                    break;
-                }
-                Err(error) => {
-                    let (valid, after_valid) = input.split_at(error.valid_up_to());
-                    unsafe {
-                        output.push_str(::std::str::from_utf8_unchecked(valid))
-                    }
+/// Renders bytes as a mostly-utf-8 string, escaping invalid sequences.
+fn escape_bytes(mut input: &[u8]) -> String {
+    let mut output = String::new();
+
+    loop {
+        match ::std::str::from_utf8(input) {
+            Ok(valid) => {
+                output.push_str(valid);
+                break;
+            }
+            Err(error) => {
+                let (valid, after_valid) = input.split_at(error.valid_up_to());
+                unsafe { output.push_str(::std::str::from_utf8_unchecked(valid)) }
 
-                    if let Some(invalid_sequence_length) = error.error_len() {
-                        for b in &after_valid[..invalid_sequence_length] {
-                            write!(output, "\\x{:x}", b).unwrap();
-                        }
-                        input = &after_valid[invalid_sequence_length..];
-                    } else {
-                        break;
+                if let Some(invalid_sequence_length) = error.error_len() {
+                    for b in &after_valid[..invalid_sequence_length] {
+                        write!(output, "\\x{:x}", b).unwrap();
                     }
+                    input = &after_valid[invalid_sequence_length..];
+                } else {
+                    break;
                 }
             }
         }
-
-        output
     }
+
+    output
 }
 
 /// Guaranteed conversion from an owned byte vector to a ByteString
@@ -185,3 +190,103 @@ impl TryInto<ByteString> for PathBuf {
         Ok(self.into_os_string().try_into()?)
     }
 }
+
+/// ByteStr is the borrowed counterpart of ByteString: it refers to the
+/// bytes of a BSER_BYTESTRING (or BSER_UTF8STRING) in place, rather than
+/// copying them into a `Vec<u8>` of their own.
+///
+/// It can only be deserialized by `from_slice`, since that is the only way
+/// that the input outlives the deserialized value; `from_reader` reports an
+/// "invalid type" error for it.  Use `ByteString` when that's not suitable,
+/// or `to_byte_string` to take a copy of a value that needs to be kept.
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+pub struct ByteStr<'a>(&'a [u8]);
+
+impl<'a> ByteStr<'a> {
+    /// Returns the raw bytes, which live as long as the deserialized input
+    pub fn as_bytes(&self) -> &'a [u8] {
+        self.0
+    }
+
+    /// See `ByteString::as_escaped_string`
+    pub fn as_escaped_string(&self) -> String {
+        escape_bytes(self.0)
+    }
+
+    /// Returns an owned copy of the bytes
+    pub fn to_byte_string(&self) -> ByteString {
+        ByteString(self.0.to_vec())
+    }
+}
+
+impl<'a> std::fmt::Debug for ByteStr<'a> {
+    fn fmt(&self, fmt: &mut std::fmt::Formatter<'_>) -> Result<(), std::fmt::Error> {
+        let escaped = self.as_escaped_string();
+        write!(fmt, "\"{}\"", escaped.escape_debug())
+    }
+}
+
+impl<'a> std::fmt::Display for ByteStr<'a> {
+    fn fmt(&self, fmt: &mut std::fmt::Formatter<'_>) -> Result<(), std::fmt::Error> {
+        let escaped = self.as_escaped_string();
+        write!(fmt, "\"{}\"", escaped.escape_default())
+    }
+}
+
+impl<'a> std::ops::Deref for ByteStr<'a> {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        self.0
+    }
+}
+
+impl<'a> From<&'a [u8]> for ByteStr<'a> {
+    fn from(bytes: &'a [u8]) -> Self {
+        Self(bytes)
+    }
+}
+
+impl<'a> From<&'a str> for ByteStr<'a> {
+    fn from(s: &'a str) -> Self {
+        Self(s.as_bytes())
+    }
+}
+
+impl<'a> Serialize for ByteStr<'a> {
+    fn serialize<S>(&self, serializer: S) -> Result<S::Ok, S::Error>
+    where
+        S: Serializer,
+    {
+        serializer.serialize_bytes(self.0)
+    }
+}
+
+impl<'de: 'a, 'a> Deserialize<'de> for ByteStr<'a> {
+    fn deserialize<D>(deserializer: D) -> Result<Self, D::Error>
+    where
+        D: Deserializer<'de>,
+    {
+        struct ByteStrVisitor;
+
+        impl<'de> Visitor<'de> for ByteStrVisitor {
+            type Value = ByteStr<'de>;
+
+            fn expecting(&self, formatter: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+                formatter.write_str("a borrowed bytestring")
+            }
+
+            #[inline]
+            fn visit_borrowed_bytes<E>(self, value: &'de [u8]) -> Result<Self::Value, E> {
+                Ok(ByteStr(value))
+            }
+
+            #[inline]
+            fn visit_borrowed_str<E>(self, value: &'de str) -> Result<Self::Value, E> {
+                Ok(ByteStr(value.as_bytes()))
+            }
+        }
+
+        deserializer.deserialize_bytes(ByteStrVisitor)
+    }
+}
@@ -150,6 +150,74 @@ where
     make_visit_num!(visit_i64, next_i64);
     make_visit_num!(visit_f64, next_f64);
 
+    /// Consume the next value without handing any of it to a visitor. This is
+    /// what `IgnoredAny` turns into, e.g. for the values of keys that a struct
+    /// has no field for, so it's worth not building anything along the way.
+    fn skip_value(&mut self) -> Result<()> {
+        match self.bunser.peek()? {
+            BSER_ARRAY => {
+                let _guard = self.remaining_depth.acquire("array")?;
+                self.bunser.discard();
+                let nitems = self.bunser.check_next_int()?;
+                for _ in 0..nitems {
+                    self.skip_value()?;
+                }
+            }
+            BSER_OBJECT => {
+                let _guard = self.remaining_depth.acquire("object")?;
+                self.bunser.discard();
+                let nitems = self.bunser.check_next_int()?;
+                for _ in 0..nitems {
+                    self.skip_value()?;
+                    self.skip_value()?;
+                }
+            }
+            BSER_TEMPLATE => {
+                let _guard = self.remaining_depth.acquire("template")?;
+                self.bunser.discard();
+                match self.bunser.peek()? {
+                    BSER_ARRAY => self.bunser.discard(),
+                    ch => {
+                        return Err(Error::DeInvalidStartByte {
+                            kind: "template keys".into(),
+                            byte: ch,
+                        });
+                    }
+                }
+                let nkeys = self.bunser.check_next_int()?;
+                for _ in 0..nkeys {
+                    self.skip_value()?;
+                }
+                let nitems = self.bunser.check_next_int()?;
+                for _ in 0..(nitems * nkeys) {
+                    match self.bunser.peek()? {
+                        BSER_SKIP => self.bunser.discard(),
+                        _ => self.skip_value()?,
+                    }
+                }
+            }
+            BSER_TRUE | BSER_FALSE | BSER_NULL => self.bunser.discard(),
+            BSER_BYTESTRING | BSER_UTF8STRING => {
+                self.bunser.discard();
+                let len = self.bunser.check_next_int()?;
+                self.bunser.read_bytes(len)?;
+            }
+            BSER_REAL => {
+                self.bunser.next_f64()?;
+            }
+            BSER_INT8 | BSER_INT16 | BSER_INT32 | BSER_INT64 => {
+                self.bunser.check_next_int()?;
+            }
+            ch => {
+                return Err(Error::DeInvalidStartByte {
+                    kind: "next item".into(),
+                    byte: ch,
+                });
+            }
+        }
+        Ok(())
+    }
+
     fn template_keys(&mut self) -> Result<Vec<template::Key<'de>>> {
         // The list of keys is actually an array, so just use the deserializer
         // to process it.
@@ -283,9 +351,17 @@ where
         }
     }
 
+    #[inline]
+    fn deserialize_ignored_any<V>(self, visitor: V) -> Result<V::Value>
+    where
+        V: de::Visitor<'de>,
+    {
+        self.skip_value()?;
+        visitor.visit_unit()
+    }
+
     forward_to_deserialize_any! {
         bool i8 i16 i32 i64 u8 u16 u32 u64 f32 f64 char str string bytes
         byte_buf unit unit_struct seq tuple tuple_struct map struct identifier
-        ignored_any
     }
 }
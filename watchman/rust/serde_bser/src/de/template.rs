@@ -109,7 +109,25 @@ where
     where
         V: de::Visitor<'de>,
     {
-        visitor.visit_map(TemplateObject::new(&mut *self.de, self.keys))
+        visitor.visit_map(TemplateObject::new(&mut *self.de, self.keys, false))
+    }
+
+    /// The fast path for the common case of a template row going straight
+    /// into a `#[derive(Deserialize)]` struct: keys whose value is BSER_SKIP
+    /// are never handed to the visitor, so the struct treats them as missing
+    /// fields (`None` for an `Option`, or the `#[serde(default)]`) without a
+    /// round trip through `deserialize_option` for each one.
+    #[inline]
+    fn deserialize_struct<V>(
+        self,
+        _name: &'static str,
+        _fields: &'static [&'static str],
+        visitor: V,
+    ) -> Result<V::Value>
+    where
+        V: de::Visitor<'de>,
+    {
+        visitor.visit_map(TemplateObject::new(&mut *self.de, self.keys, true))
     }
 
     #[inline]
@@ -130,12 +148,12 @@ where
     where
         V: de::Visitor<'de>,
     {
-        visitor.visit_map(TemplateObject::new(&mut *self.de, self.keys))
+        visitor.visit_map(TemplateObject::new(&mut *self.de, self.keys, false))
     }
 
     forward_to_deserialize_any! {
         bool i8 i16 i32 i64 u8 u16 u32 u64 f32 f64 char str string bytes
-        byte_buf unit unit_struct seq tuple tuple_struct map struct identifier
+        byte_buf unit unit_struct seq tuple tuple_struct map identifier
         ignored_any option
     }
 }
@@ -144,14 +162,22 @@ struct TemplateObject<'a, 'de, R> {
     de: &'a mut Deserializer<R>,
     keys: Rc<Vec<Key<'de>>>,
     cur: usize,
+    /// Whether keys whose value is BSER_SKIP are left out of the object
+    /// entirely, rather than being visited with a `None` value.
+    omit_skipped: bool,
 }
 
 impl<'a, 'de, R> TemplateObject<'a, 'de, R>
 where
     R: 'a + DeRead<'de>,
 {
-    fn new(de: &'a mut Deserializer<R>, keys: Rc<Vec<Key<'de>>>) -> Self {
-        TemplateObject { de, keys, cur: 0 }
+    fn new(de: &'a mut Deserializer<R>, keys: Rc<Vec<Key<'de>>>, omit_skipped: bool) -> Self {
+        TemplateObject {
+            de,
+            keys,
+            cur: 0,
+            omit_skipped,
+        }
     }
 }
 
@@ -165,6 +191,14 @@ where
     where
         K: de::DeserializeSeed<'de>,
     {
+        if self.omit_skipped {
+            // The values are laid out in key order, so a skipped value can be
+            // consumed here before the key that it belongs to is looked at.
+            while self.cur < self.keys.len() && self.de.bunser.peek()? == BSER_SKIP {
+                self.de.bunser.discard();
+                self.cur += 1;
+            }
+        }
         if self.cur == self.keys.len() {
             Ok(None)
         } else {
@@ -262,11 +296,25 @@ where
         visitor.visit_newtype_struct(self)
     }
 
+    #[inline]
+    fn deserialize_ignored_any<V>(self, visitor: V) -> Result<V::Value>
+    where
+        V: de::Visitor<'de>,
+    {
+        match self.de.bunser.peek()? {
+            BSER_SKIP => {
+                self.de.bunser.discard();
+                visitor.visit_unit()
+            }
+            _ => de::Deserializer::deserialize_ignored_any(&mut *self.de, visitor),
+        }
+    }
+
     // TODO: do we also need to do enum here?
 
     forward_to_deserialize_any! {
         bool i8 i16 i32 i64 u8 u16 u32 u64 f32 f64 char str string bytes
         byte_buf unit unit_struct seq tuple tuple_struct map struct identifier
-        ignored_any enum
+        enum
     }
 }
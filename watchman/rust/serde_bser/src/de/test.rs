@@ -11,6 +11,7 @@ use std::borrow::Cow;
 use std::collections::HashMap;
 use std::io::Cursor;
 
+use crate::bytestring::ByteStr;
 use crate::from_reader;
 use crate::from_slice;
 
@@ -504,3 +505,69 @@ fn test_arrays_untagged_enum() {
         })
     );
 }
+
+// Logical expansion of this template:
+// [
+//   {"abc": 1, "def": "x", "extra": [1, 2]},
+//   {"abc": 2},
+// ]
+//
+// The second "def" and "extra" are skipped.
+const TEMPLATE_WITH_EXTRA: &[u8] = b"\x00\x02\x00\x00\x00\x00\x03\x2c\x0b\x00\x03\x03\x03\x02\
+    \x03\x03abc\x02\x03\x03def\x02\x03\x05extra\x03\x02\x03\x01\x02\x03\x01x\x00\x03\x02\x03\
+    \x01\x03\x02\x03\x02\x0c\x0c";
+
+#[derive(Debug, Deserialize, PartialEq)]
+struct DefaultedTemplateObject {
+    abc: i64,
+    #[serde(default)]
+    def: String,
+}
+
+#[test]
+fn test_template_struct_defaults_skipped_fields() {
+    let expected = vec![
+        DefaultedTemplateObject {
+            abc: 1,
+            def: "x".into(),
+        },
+        DefaultedTemplateObject {
+            abc: 2,
+            def: "".into(),
+        },
+    ];
+
+    let decoded = from_slice::<Vec<DefaultedTemplateObject>>(TEMPLATE_WITH_EXTRA).unwrap();
+    assert_eq!(decoded, expected);
+
+    let reader = Cursor::new(TEMPLATE_WITH_EXTRA.to_vec());
+    let decoded: Vec<DefaultedTemplateObject> = from_reader(reader).unwrap();
+    assert_eq!(decoded, expected);
+}
+
+#[derive(Debug, Deserialize, PartialEq)]
+struct BorrowedTemplateObject<'a> {
+    abc: i64,
+    #[serde(borrow)]
+    def: Option<ByteStr<'a>>,
+}
+
+#[test]
+fn test_template_borrowed_bytestr() {
+    let decoded = from_slice::<Vec<BorrowedTemplateObject<'_>>>(TEMPLATE_WITH_EXTRA).unwrap();
+    assert_eq!(
+        decoded,
+        vec![
+            BorrowedTemplateObject {
+                abc: 1,
+                def: Some(ByteStr::from("x")),
+            },
+            BorrowedTemplateObject { abc: 2, def: None },
+        ]
+    );
+
+    // The bytes are borrowed straight out of the input
+    let def = decoded[0].def.unwrap();
+    let offset = def.as_bytes().as_ptr() as usize - TEMPLATE_WITH_EXTRA.as_ptr() as usize;
+    assert_eq!(&TEMPLATE_WITH_EXTRA[offset..offset + 1], b"x");
+}
@@ -54,7 +54,6 @@ use tokio::io::{AsyncRead, AsyncWrite, AsyncWriteExt};
 use tokio::net::UnixStream;
 use tokio::process::Command;
 use tokio::sync::mpsc::{Receiver, Sender, UnboundedReceiver, UnboundedSender};
-use tokio::sync::Mutex;
 use tokio_util::codec::{Decoder, FramedRead};
 
 /// The next id number to use when generating a subscription name
@@ -161,8 +160,14 @@ enum TaskError {
 pub struct Connector {
     watchman_cli_path: Option<PathBuf>,
     unix_domain: Option<PathBuf>,
+    pipeline_depth: Option<usize>,
+    subscription_buffer: Option<usize>,
+    bulk_query_connection: bool,
 }
 
+/// How many requests are sent ahead of their responses by default
+const DEFAULT_PIPELINE_DEPTH: usize = 16;
+
 impl Connector {
     /// Set up the connector with the system defaults.
     /// If `WATCHMAN_SOCK` is set in the environment it will preset the
@@ -193,6 +198,38 @@ impl Connector {
         self
     }
 
+    /// Set how many requests may be sent to the server before their
+    /// responses have arrived.  The server answers the requests on a
+    /// connection in the order that they were sent, so concurrent callers
+    /// don't need to wait for each other's round trips.  The default is 16;
+    /// 1 sends each request only once the previous one has been answered.
+    pub fn pipeline_depth(mut self, depth: usize) -> Self {
+        self.pipeline_depth = Some(depth.max(1));
+        self
+    }
+
+    /// Hold no more than `size` undelivered notifications for each
+    /// subscription.  Once a subscription's buffer is full, the connection
+    /// stops reading from the server until `Subscription::next` makes room,
+    /// so that a slow consumer leaves the backlog with the server, which
+    /// bounds and coalesces it, rather than growing without bound in this
+    /// process.  That also holds up everything else on the connection, so
+    /// the subscriptions of a client that uses this should all be drained
+    /// promptly.  By default the buffers are unbounded.
+    pub fn subscription_buffer(mut self, size: usize) -> Self {
+        self.subscription_buffer = Some(size.max(1));
+        self
+    }
+
+    /// Send queries, and globs, over a connection of their own, so that the
+    /// notifications for subscriptions are never held up behind a large
+    /// query response, nor their decoding behind the decoding of one.
+    /// The default is to use a single connection.
+    pub fn bulk_query_connection(mut self, enable: bool) -> Self {
+        self.bulk_query_connection = enable;
+        self
+    }
+
     /// Resolve the unix domain socket path, taking either the override
     /// or performing discovery.
     async fn resolve_unix_domain_path(&self) -> Result<PathBuf, Error> {
@@ -248,13 +285,26 @@ impl Connector {
     pub async fn connect(&self) -> Result<Client, Error> {
         let sock_path = self.resolve_unix_domain_path().await?;
 
+        let inner = self.connect_task(&sock_path).await?;
+        let bulk = if self.bulk_query_connection {
+            Some(self.connect_task(&sock_path).await?)
+        } else {
+            None
+        };
+
+        Ok(Client { inner, bulk })
+    }
+
+    /// Connect to the server at `sock_path` and start a task to serve
+    /// the connection.
+    async fn connect_task(&self, sock_path: &Path) -> Result<Arc<ClientInner>, Error> {
         #[cfg(unix)]
         let stream = UnixStream::connect(sock_path)
             .await
             .map_err(Error::ConnectionError)?;
 
         #[cfg(windows)]
-        let stream = named_pipe::NamedPipe::connect(sock_path).await?;
+        let stream = named_pipe::NamedPipe::connect(sock_path.to_path_buf()).await?;
 
         let stream: Box<dyn ReadWriteStream> = Box::new(stream);
 
@@ -267,7 +317,9 @@ impl Connector {
             reader: FramedRead::new(reader, BserSplitter),
             request_rx,
             request_queue: VecDeque::new(),
-            waiting_response: false,
+            in_flight: 0,
+            pipeline_depth: self.pipeline_depth.unwrap_or(DEFAULT_PIPELINE_DEPTH),
+            streamed_files: vec![],
             subscriptions: HashMap::new(),
         };
         tokio::spawn(async move {
@@ -276,9 +328,10 @@ impl Connector {
             }
         });
 
-        let inner = Arc::new(Mutex::new(ClientInner { request_tx }));
-
-        Ok(Client { inner })
+        Ok(Arc::new(ClientInner {
+            request_tx,
+            subscription_buffer: self.subscription_buffer,
+        }))
     }
 }
 
@@ -398,9 +451,67 @@ enum SubscriptionNotification {
     Canceled,
 }
 
+/// Where the client task delivers the notifications for a subscription
+enum SubscriptionSender {
+    Unbounded(UnboundedSender<SubscriptionNotification>),
+    Bounded(Sender<SubscriptionNotification>),
+}
+
+impl SubscriptionSender {
+    /// Returns false if the `Subscription` was dropped
+    async fn send(&self, msg: SubscriptionNotification) -> bool {
+        match self {
+            Self::Unbounded(tx) => tx.send(msg).is_ok(),
+            Self::Bounded(tx) => tx.send(msg).await.is_ok(),
+        }
+    }
+}
+
+enum SubscriptionReceiver {
+    Unbounded(UnboundedReceiver<SubscriptionNotification>),
+    Bounded(Receiver<SubscriptionNotification>),
+}
+
+impl SubscriptionReceiver {
+    async fn recv(&mut self) -> Option<SubscriptionNotification> {
+        match self {
+            Self::Unbounded(rx) => rx.recv().await,
+            Self::Bounded(rx) => rx.recv().await,
+        }
+    }
+
+    fn close(&mut self) {
+        match self {
+            Self::Unbounded(rx) => rx.close(),
+            Self::Bounded(rx) => rx.close(),
+        }
+    }
+}
+
+/// Returns a channel for the notifications of a subscription, holding at
+/// most `buffer` of them if set
+fn subscription_channel(buffer: Option<usize>) -> (SubscriptionSender, SubscriptionReceiver) {
+    match buffer {
+        Some(size) => {
+            let (tx, rx) = tokio::sync::mpsc::channel(size);
+            (
+                SubscriptionSender::Bounded(tx),
+                SubscriptionReceiver::Bounded(rx),
+            )
+        }
+        None => {
+            let (tx, rx) = tokio::sync::mpsc::unbounded_channel();
+            (
+                SubscriptionSender::Unbounded(tx),
+                SubscriptionReceiver::Unbounded(rx),
+            )
+        }
+    }
+}
+
 enum TaskItem {
     QueueRequest(SendRequest),
-    RegisterSubscription(String, UnboundedSender<SubscriptionNotification>),
+    RegisterSubscription(String, SubscriptionSender),
 }
 
 /// Splits BSER mesages out of a stream. Does not attempt to actually decode them.
@@ -452,7 +563,9 @@ impl Decoder for BserSplitter {
 /// A live connection to a watchman server.
 /// Use [Connector](struct.Connector.html) to establish a connection.
 pub struct Client {
-    inner: Arc<Mutex<ClientInner>>,
+    inner: Arc<ClientInner>,
+    /// The connection for queries, if they have one of their own
+    bulk: Option<Arc<ClientInner>>,
 }
 
 /// The client task coordinates sending requests with processing
@@ -461,9 +574,15 @@ struct ClientTask {
     writer: tokio::io::WriteHalf<Box<dyn ReadWriteStream>>,
     reader: FramedRead<tokio::io::ReadHalf<Box<dyn ReadWriteStream>>, BserSplitter>,
     request_rx: Receiver<TaskItem>,
+    /// The requests that have yet to be answered, in the order that they
+    /// were queued; the first `in_flight` of them have been sent.
     request_queue: VecDeque<SendRequest>,
-    waiting_response: bool,
-    subscriptions: HashMap<String, UnboundedSender<SubscriptionNotification>>,
+    in_flight: usize,
+    /// How many requests may be in flight at once
+    pipeline_depth: usize,
+    /// Files from the partial responses to a query that set `stream_results`
+    streamed_files: Vec<Value>,
+    subscriptions: HashMap<String, SubscriptionSender>,
 }
 
 impl Drop for ClientTask {
@@ -509,11 +628,7 @@ impl ClientTask {
         Ok(())
     }
 
-    fn register_subscription(
-        &mut self,
-        name: String,
-        tx: UnboundedSender<SubscriptionNotification>,
-    ) {
+    fn register_subscription(&mut self, name: String, tx: SubscriptionSender) {
         self.subscriptions.insert(name, tx);
     }
 
@@ -526,22 +641,21 @@ impl ClientTask {
         }
     }
 
-    /// If we're not waiting for the response to a request,
-    /// then send the next one!
-    async fn send_next_request(&mut self) -> Result<(), TaskError> {
-        if !self.waiting_response && !self.request_queue.is_empty() {
-            match self
+    /// Send the queued requests that haven't been sent yet, as far as
+    /// the pipeline depth allows.  The server answers them in order, so
+    /// the responses are matched up with the front of the queue.
+    async fn send_queued_requests(&mut self) -> Result<(), TaskError> {
+        while self.in_flight < self.pipeline_depth && self.in_flight < self.request_queue.len() {
+            if let Err(err) = self
                 .writer
-                .write_all(&self.request_queue.front().expect("not empty").buf)
+                .write_all(&self.request_queue[self.in_flight].buf)
                 .await
             {
-                Err(err) => {
-                    // A failed write breaks our world; we don't want to
-                    // try to continue
-                    return Err(err.into());
-                }
-                Ok(_) => self.waiting_response = true,
+                // A failed write breaks our world; we don't want to
+                // try to continue
+                return Err(err.into());
             }
+            self.in_flight += 1;
         }
         Ok(())
     }
@@ -550,10 +664,35 @@ impl ClientTask {
     /// check to see if we can send a queued request to the server.
     async fn queue_request(&mut self, request: SendRequest) -> Result<(), TaskError> {
         self.request_queue.push_back(request);
-        self.send_next_request().await?;
+        self.send_queued_requests().await?;
         Ok(())
     }
 
+    /// Take the request that the next response answers
+    fn pop_in_flight(&mut self) -> SendRequest {
+        self.in_flight -= 1;
+        self.request_queue
+            .pop_front()
+            .expect("in_flight is only non-zero when request_queue is not empty")
+    }
+
+    /// Prepend the files accumulated from partial responses to those in
+    /// the final response of a streamed query.
+    fn merge_streamed_files(&mut self, pdu: &[u8]) -> Result<Bytes, Error> {
+        let mut response: HashMap<String, Value> = bunser(pdu)?;
+        let mut files = std::mem::take(&mut self.streamed_files);
+        if let Some(Value::Array(last)) = response.remove("files") {
+            files.extend(last);
+        }
+        response.insert("files".to_string(), Value::Array(files));
+
+        let mut buf = vec![];
+        serde_bser::ser::serialize(&mut buf, &response).map_err(|source| Error::Serialize {
+            source: source.into(),
+        })?;
+        Ok(buf.into())
+    }
+
     /// Dispatch a PDU that we just read to the appropriate client code.
     async fn process_pdu(&mut self, pdu: Bytes) -> Result<(), TaskError> {
         use serde::Deserialize;
@@ -573,27 +712,56 @@ impl ClientTask {
                     SubscriptionNotification::Pdu(pdu)
                 };
 
-                if subscription.send(msg).is_err() || unilateral.canceled {
+                if !subscription.send(msg).await || unilateral.canceled {
                     // The `Subscription` was dropped; we don't need to
                     // treat this as terminal for this client session,
                     // so just de-register the handler
                     self.subscriptions.remove(&unilateral.subscription);
                 }
             }
-        } else if self.waiting_response {
-            let request = self
-                .request_queue
-                .pop_front()
-                .expect("waiting_response is only true when request_queue is not empty");
-            self.waiting_response = false;
-
-            request.respond(Ok(pdu));
+        } else if self.in_flight > 0 {
+            #[derive(Deserialize, Debug)]
+            pub struct Partial {
+                #[serde(default)]
+                pub partial: bool,
+            }
+            #[derive(Deserialize, Debug)]
+            pub struct PartialFiles {
+                pub files: Vec<Value>,
+            }
+
+            // A query that set stream_results is answered by a series of
+            // partial responses followed by the final response; combine
+            // them so that the caller sees a single response.
+            if let Ok(Partial { partial: true }) = bunser::<Partial>(&pdu) {
+                match bunser::<PartialFiles>(&pdu) {
+                    Ok(chunk) => {
+                        self.streamed_files.extend(chunk.files);
+                        return Ok(());
+                    }
+                    Err(err) => {
+                        self.streamed_files.clear();
+                        self.pop_in_flight().respond(Err(err.to_string()));
+                        self.send_queued_requests().await?;
+                        return Ok(());
+                    }
+                }
+            }
+
+            let pdu = if self.streamed_files.is_empty() {
+                Ok(pdu)
+            } else {
+                self.merge_streamed_files(&pdu)
+                    .map_err(|err| err.to_string())
+            };
+
+            self.pop_in_flight().respond(pdu);
         } else {
             // This should never happen as we're not doing any subscription stuff
             return Err(TaskError::UnilateralPdu);
         }
 
-        self.send_next_request().await?;
+        self.send_queued_requests().await?;
         Ok(())
     }
 }
@@ -611,6 +779,8 @@ where
 
 struct ClientInner {
     request_tx: Sender<TaskItem>,
+    /// The size of the buffer of each subscription, if bounded
+    subscription_buffer: Option<usize>,
 }
 
 impl ClientInner {
@@ -620,7 +790,7 @@ impl ClientInner {
     /// consumer of this crate needs to issue a command for which we haven't
     /// yet made an ergonomic wrapper.
     pub(crate) async fn generic_request<Request, Response>(
-        &mut self,
+        &self,
         request: Request,
     ) -> Result<Response, Error>
     where
@@ -736,9 +906,9 @@ where
     F: serde::de::DeserializeOwned + std::fmt::Debug + Clone + QueryFieldList,
 {
     name: String,
-    inner: Arc<Mutex<ClientInner>>,
+    inner: Arc<ClientInner>,
     root: ResolvedRoot,
-    responses: UnboundedReceiver<SubscriptionNotification>,
+    responses: SubscriptionReceiver,
     _phantom: PhantomData<F>,
 }
 
@@ -795,8 +965,8 @@ where
     /// then it is recommended that you call `cancel` so that the server
     /// will stop delivering data about it.
     pub async fn cancel(self) -> Result<(), Error> {
-        let mut inner = self.inner.lock().await;
-        let _: UnsubscribeResponse = inner
+        let _: UnsubscribeResponse = self
+            .inner
             .generic_request(Unsubscribe("unsubscribe", self.root.root, self.name))
             .await?;
         Ok(())
@@ -818,8 +988,7 @@ impl Client {
         Request: serde::Serialize + std::fmt::Debug,
         Response: serde::de::DeserializeOwned,
     {
-        let mut inner = self.inner.lock().await;
-        let response: Response = inner.generic_request(request).await?;
+        let response: Response = self.inner.generic_request(request).await?;
         Ok(response)
     }
 
@@ -993,7 +1162,8 @@ impl Client {
             },
         );
 
-        let response: QueryResult<F> = self.generic_request(query.clone()).await?;
+        let inner = self.bulk.as_ref().unwrap_or(&self.inner);
+        let response: QueryResult<F> = inner.generic_request(query.clone()).await?;
 
         Ok(response)
     }
@@ -1038,16 +1208,13 @@ impl Client {
             },
         );
 
-        let (tx, responses) = tokio::sync::mpsc::unbounded_channel();
+        let (tx, responses) = subscription_channel(self.inner.subscription_buffer);
 
-        {
-            let inner = self.inner.lock().await;
-            inner
-                .request_tx
-                .send(TaskItem::RegisterSubscription(name.clone(), tx))
-                .await
-                .map_err(|_| ConnectionLost::ClientTaskExited)?;
-        }
+        self.inner
+            .request_tx
+            .send(TaskItem::RegisterSubscription(name.clone(), tx))
+            .await
+            .map_err(|_| ConnectionLost::ClientTaskExited)?;
 
         let subscription = Subscription::<F> {
             name,
@@ -363,6 +363,15 @@ pub struct QueryRequestCommon {
     #[serde(default, skip_serializing_if = "is_false")]
     pub dedup_results: bool,
 
+    /// If set, the server sends the results in chunks of up to this many
+    /// files as they are produced, rather than building the entire result
+    /// set before responding.  This reduces the memory used by the server
+    /// and the time until the first results are available for very large
+    /// result sets.  The client reassembles the chunks, so the response is
+    /// the same either way.
+    #[serde(skip_serializing_if = "Option::is_none")]
+    pub stream_results: Option<u32>,
+
     /// Controls the duration that the server will wait to obtain a lock on the
     /// filesystem view.
     /// You should not normally need to change this.
@@ -6,10 +6,16 @@
  */
 
 #include "watchman/saved_state/LocalSavedStateInterface.h"
+#include <folly/Synchronized.h>
+#include <ctime>
+#include <unordered_map>
+#include <unordered_set>
 #include "watchman/CommandRegistry.h"
 #include "watchman/Errors.h"
 #include "watchman/Logging.h"
+#include "watchman/fs/DirHandle.h"
 #include "watchman/fs/FileInformation.h"
+#include "watchman/fs/FileSystem.h"
 #include "watchman/scm/SCM.h"
 
 static const int kDefaultMaxCommits{10};
@@ -18,6 +24,68 @@ W_CAP_REG("saved-state-local")
 
 namespace watchman {
 
+namespace {
+
+using NameSet = std::unordered_set<w_string>;
+
+struct DirListing {
+  struct timespec mtime;
+  // The directory was modified so recently that a further change might not
+  // move its mtime, so the listing mustn't be reused
+  bool racy;
+  std::shared_ptr<const NameSet> names;
+};
+
+// The names in each storage directory that has been searched for saved
+// states, shared by all of the interface instances, which only live for
+// one query.  A listing is reused for as long as the directory's mtime is
+// unchanged, as adding or removing a saved state changes it, so each lookup
+// costs one stat rather than one per candidate commit.
+folly::Synchronized<std::unordered_map<w_string, DirListing>> dirListings;
+
+std::shared_ptr<const NameSet> listStorageDir(const w_string& dir) {
+  FileInformation info;
+  try {
+    info = getFileInformation(dir.c_str());
+  } catch (const std::system_error&) {
+    // No saved states have been stored for this project
+    dirListings.wlock()->erase(dir);
+    return nullptr;
+  }
+
+  {
+    auto listings = dirListings.rlock();
+    auto it = listings->find(dir);
+    if (it != listings->end() && !it->second.racy &&
+        it->second.mtime.tv_sec == info.mtime.tv_sec &&
+        it->second.mtime.tv_nsec == info.mtime.tv_nsec) {
+      return it->second.names;
+    }
+  }
+
+  auto names = std::make_shared<NameSet>();
+  try {
+    auto handle = openDir(dir.c_str());
+    while (auto* entry = handle->readDir()) {
+      w_string_piece name{entry->d_name};
+      if (name != "." && name != "..") {
+        names->insert(name.asWString());
+      }
+    }
+  } catch (const std::system_error& exc) {
+    log(ERR, "failed to list saved states in ", dir, ": ", exc.what(), "\n");
+    return nullptr;
+  }
+
+  // Allow for filesystems that only store mtimes to the second
+  bool racy = time(nullptr) <= info.mtime.tv_sec + 1;
+  dirListings.wlock()->insert_or_assign(
+      dir, DirListing{info.mtime, racy, names});
+  return names;
+}
+
+} // namespace
+
 LocalSavedStateInterface::LocalSavedStateInterface(
     const json_ref& savedStateConfig,
     const SCM* scm)
@@ -61,15 +129,25 @@ LocalSavedStateInterface::getMostRecentSavedStateImpl(
     w_string_piece lookupCommitId) const {
   auto commitIds =
       scm_->getCommitsPriorToAndIncluding(lookupCommitId, maxCommits_);
+  auto names = listStorageDir(w_string::pathCat({localStoragePath_, project_}));
   for (auto& commitId : commitIds) {
-    auto path = getLocalPath(commitId);
     // We could return a path that no longer exists if the path is removed
     // (for example by saved state GC) after we check that the path exists
     // here, but before the client reads the state. We've explicitly chosen to
     // return the state without additional safety guarantees, and leave it to
     // the client to ensure GC happens only after states are no longer likely
     // to be used.
-    if (w_path_exists(path.c_str())) {
+    auto fileName = getLocalFileName(commitId);
+    auto path = getLocalPath(commitId);
+    bool exists;
+    if (names && fileName.view().find('/') == std::string_view::npos) {
+      exists = names->count(fileName) > 0;
+    } else {
+      // Either the directory couldn't be listed, or the metadata puts the
+      // saved state in a subdirectory that wasn't
+      exists = w_path_exists(path.c_str());
+    }
+    if (exists) {
       log(DBG, "Found saved state for commit ", commitId, "\n");
       SavedStateInterface::SavedStateResult result;
       result.commitId = commitId;
@@ -86,13 +164,16 @@ LocalSavedStateInterface::getMostRecentSavedStateImpl(
   return result;
 }
 
-w_string LocalSavedStateInterface::getLocalPath(w_string_piece commitId) const {
-  w_string filename;
+w_string LocalSavedStateInterface::getLocalFileName(
+    w_string_piece commitId) const {
   if (!projectMetadata_) {
-    filename = w_string::build(commitId);
-  } else {
-    filename = w_string::build(commitId, w_string("_"), projectMetadata_);
+    return w_string::build(commitId);
   }
-  return w_string::pathCat({localStoragePath_, project_, filename});
+  return w_string::build(commitId, w_string("_"), projectMetadata_);
+}
+
+w_string LocalSavedStateInterface::getLocalPath(w_string_piece commitId) const {
+  return w_string::pathCat(
+      {localStoragePath_, project_, getLocalFileName(commitId)});
 }
 } // namespace watchman
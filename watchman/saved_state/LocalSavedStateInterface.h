@@ -33,6 +33,9 @@ class LocalSavedStateInterface : public SavedStateInterface {
   w_string getLocalPath(w_string_piece commitId) const;
 
  private:
+  // The name of the saved state for commitId within the project directory
+  w_string getLocalFileName(w_string_piece commitId) const;
+
   json_int_t maxCommits_;
   w_string localStoragePath_;
   const SCM* scm_;
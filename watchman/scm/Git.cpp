@@ -7,9 +7,11 @@
 
 #include "watchman/scm/Git.h"
 #include <folly/String.h>
+#include <optional>
 #include "watchman/ChildProcess.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Logging.h"
+#include "watchman/ThreadPool.h"
 #include "watchman/fs/FileSystem.h"
 
 // Capability indicating support for the git SCM
@@ -61,6 +63,28 @@ GitResult runGit(
   return GitResult{std::move(outputs.first)};
 }
 
+// Runs func against the in-process repository, if there is one.  Returns
+// nullopt if there isn't, or if it fails, in which case the caller runs the
+// equivalent git command instead.
+template <typename Func>
+auto tryInProcess(InProcessGit* git, std::string_view description, Func func)
+    -> std::optional<decltype(func(*git))> {
+  if (!git) {
+    return std::nullopt;
+  }
+  try {
+    return func(*git);
+  } catch (const SCMError& exc) {
+    log(DBG,
+        "failed to ",
+        description,
+        " in-process, running git instead: ",
+        exc.what(),
+        "\n");
+    return std::nullopt;
+  }
+}
+
 } // namespace
 
 namespace watchman {
@@ -113,13 +137,17 @@ Git::Git(w_string_piece rootPath, w_string_piece scmRoot)
       filesChangedBetweenCommits_(
           Configuration(),
           "scm_git_files_between_commits",
-          32,
+          128,
           10),
       filesChangedSinceMergeBaseWith_(
           Configuration(),
           "scm_git_files_since_mergebase",
           32,
-          10) {}
+          10) {
+  if (cfg_get_bool("git_in_process", true)) {
+    inProcess_ = InProcessGit::open(getSCMRoot());
+  }
+}
 
 ChildProcess::Options Git::makeGitOptions(w_string requestId) const {
   ChildProcess::Options opt;
@@ -157,6 +185,15 @@ w_string Git::mergeBaseWith(w_string_piece commitId, w_string requestId) const {
       .get(
           key,
           [this, commit, requestId](const std::string&) {
+            if (auto base = tryInProcess(
+                    inProcess_.get(),
+                    "query for the merge base",
+                    [&](InProcessGit& git) {
+                      return git.mergeBaseWith(commit);
+                    })) {
+              return folly::makeFuture(std::move(*base));
+            }
+
             auto result = runGit(
                 {gitExecutablePath(), "merge-base", commit, "HEAD"},
                 makeGitOptions(requestId),
@@ -180,6 +217,11 @@ w_string Git::mergeBaseWith(w_string_piece commitId, w_string requestId) const {
       ->value();
 }
 
+w_string Git::getWorkingCopyCommit(w_string requestId) const {
+  // The merge base of HEAD with itself is HEAD, and is cached as such
+  return mergeBaseWith("HEAD", requestId);
+}
+
 std::vector<w_string> Git::getFilesChangedSinceMergeBaseWith(
     w_string_piece commitId,
     w_string requestId) const {
@@ -192,6 +234,15 @@ std::vector<w_string> Git::getFilesChangedSinceMergeBaseWith(
           key,
           [this, commit = std::move(commitCopy), requestId](
               const std::string&) {
+            if (auto files = tryInProcess(
+                    inProcess_.get(),
+                    "query for files changed since merge base",
+                    [&](InProcessGit& git) {
+                      return git.getFilesChangedSince(commit);
+                    })) {
+              return folly::makeFuture(std::move(*files));
+            }
+
             auto result = runGit(
                 {gitExecutablePath(), "diff", "--name-only", "-z", commit},
                 makeGitOptions(requestId),
@@ -209,32 +260,49 @@ SCM::StatusResult Git::getFilesChangedBetweenCommits(
     std::vector<std::string> commits,
     w_string requestId,
     bool /*includeDirectories*/) const {
-  GitStatusAccumulator result;
+  // Each transition is independent of the others, so diff them concurrently
+  auto mtime = getIndexMtime();
+  std::vector<folly::Future<w_string>> outputs;
   for (size_t i = 0; i + 1 < commits.size(); ++i) {
-    auto mtime = getIndexMtime();
     auto& commitA = commits[i];
     auto& commitB = commits[i + 1];
-    auto key = folly::to<std::string>(
-        commitA, ":", commitB, ":", mtime.tv_sec, ":", mtime.tv_nsec);
-
-    result.add(filesChangedBetweenCommits_
-                   .get(
-                       key,
-                       [&](const std::string&) {
-                         auto gitresult = runGit(
-                             {gitExecutablePath(),
-                              "diff",
-                              "--name-status",
-                              "-z",
-                              commitA,
-                              commitB},
-                             makeGitOptions(requestId),
-                             "get files changed between commits");
-
-                         return folly::makeFuture(gitresult.output);
-                       })
-                   .get()
-                   ->value());
+    auto key = commitRangeCacheKey(commitA, commitB, mtime);
+
+    outputs.push_back(
+        filesChangedBetweenCommits_
+            .get(
+                key,
+                [this, commitA, commitB, requestId](const std::string&) {
+                  return folly::via(
+                      &getThreadPool(ThreadPool::Priority::Scm),
+                      [this, commitA, commitB, requestId] {
+                        if (auto output = tryInProcess(
+                                inProcess_.get(),
+                                "get files changed between commits",
+                                [&](InProcessGit& git) {
+                                  return git.getNameStatusBetween(
+                                      commitA, commitB);
+                                })) {
+                          return std::move(*output);
+                        }
+                        return runGit(
+                                   {gitExecutablePath(),
+                                    "diff",
+                                    "--name-status",
+                                    "-z",
+                                    commitA,
+                                    commitB},
+                                   makeGitOptions(requestId),
+                                   "get files changed between commits")
+                            .output;
+                      });
+                })
+            .thenValue([](auto&& node) { return node->value(); }));
+  }
+
+  GitStatusAccumulator result;
+  for (auto& output : outputs) {
+    result.add(std::move(output).get());
   }
   return result.finalize();
 }
@@ -242,6 +310,13 @@ SCM::StatusResult Git::getFilesChangedBetweenCommits(
 std::chrono::time_point<std::chrono::system_clock> Git::getCommitDate(
     w_string_piece commitId,
     w_string requestId) const {
+  if (auto time = tryInProcess(
+          inProcess_.get(), "get commit date", [&](InProcessGit& git) {
+            return git.getCommitTime(commitId);
+          })) {
+    return system_clock::from_time_t(*time);
+  }
+
   auto result = runGit(
       {gitExecutablePath(), "log", "--format:%ct", "-n", "1", commitId.view()},
       makeGitOptions(requestId),
@@ -270,6 +345,16 @@ std::vector<w_string> Git::getCommitsPriorToAndIncluding(
           key,
           [this, commit = std::move(commitCopy), numCommits, requestId](
               const std::string&) {
+            if (auto commits = tryInProcess(
+                    inProcess_.get(),
+                    "get prior commits",
+                    [&](InProcessGit& git) {
+                      return git.getCommitsPriorToAndIncluding(
+                          commit, numCommits);
+                    })) {
+              return folly::makeFuture(std::move(*commits));
+            }
+
             auto result = runGit(
                 {gitExecutablePath(),
                  "log",
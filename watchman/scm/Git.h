@@ -12,6 +12,7 @@
 #include <vector>
 #include "watchman/ChildProcess.h"
 #include "watchman/LRUCache.h"
+#include "watchman/scm/InProcessGit.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
@@ -34,6 +35,7 @@ class Git : public SCM {
   Git(w_string_piece rootPath, w_string_piece scmRoot);
   w_string mergeBaseWith(w_string_piece commitId, w_string requestId = nullptr)
       const override;
+  w_string getWorkingCopyCommit(w_string requestId = nullptr) const override;
   std::vector<w_string> getFilesChangedSinceMergeBaseWith(
       w_string_piece commitId,
       w_string requestId = nullptr) const override;
@@ -53,6 +55,11 @@ class Git : public SCM {
       int numCommits,
       w_string requestId = nullptr) const override;
 
+ protected:
+  struct timespec getWorkingCopyStateMtime() const override {
+    return getIndexMtime();
+  }
+
  private:
   std::string indexPath_;
   mutable LRUCache<std::string, std::vector<w_string>> commitsPrior_;
@@ -60,6 +67,8 @@ class Git : public SCM {
   mutable LRUCache<std::string, w_string> filesChangedBetweenCommits_;
   mutable LRUCache<std::string, std::vector<w_string>>
       filesChangedSinceMergeBaseWith_;
+  // Null if libgit2 is unavailable or disabled via git_in_process
+  std::unique_ptr<InProcessGit> inProcess_;
 
   ChildProcess::Options makeGitOptions(w_string requestId) const;
   struct timespec getIndexMtime() const;
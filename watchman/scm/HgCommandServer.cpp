@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/HgCommandServer.h"
+#include <folly/String.h>
+#include <algorithm>
+#include <cctype>
+
+namespace watchman {
+
+namespace {
+
+void putBigEndian32(std::string& buf, uint32_t value) {
+  buf.push_back(char(value >> 24));
+  buf.push_back(char(value >> 16));
+  buf.push_back(char(value >> 8));
+  buf.push_back(char(value));
+}
+
+uint32_t getBigEndian32(const unsigned char* buf) {
+  return (uint32_t(buf[0]) << 24) | (uint32_t(buf[1]) << 16) |
+      (uint32_t(buf[2]) << 8) | uint32_t(buf[3]);
+}
+
+} // namespace
+
+HgCommandServer::HgCommandServer(
+    FileDescriptor toServer,
+    FileDescriptor fromServer,
+    std::unique_ptr<ChildProcess> proc)
+    : toServer_(std::move(toServer)),
+      fromServer_(std::move(fromServer)),
+      proc_(std::move(proc)) {}
+
+HgCommandServer::~HgCommandServer() {
+  if (!proc_) {
+    return;
+  }
+  if (!healthy_) {
+    // It may be stuck part way through a command
+    proc_->kill();
+  }
+  // The server exits when it sees EOF on its input
+  toServer_.close();
+  fromServer_.close();
+  proc_->wait();
+}
+
+std::unique_ptr<HgCommandServer> HgCommandServer::spawn(
+    const std::string& hgPath,
+    ChildProcess::Options options) {
+  options.pipeStdin();
+  options.pipeStdout();
+  auto proc = std::make_unique<ChildProcess>(
+      std::vector<std::string_view>{hgPath, "serve", "--cmdserver", "pipe"},
+      std::move(options));
+  auto toServer = proc->takePipe(STDIN_FILENO);
+  auto fromServer = proc->takePipe(STDOUT_FILENO);
+
+  auto server = std::make_unique<HgCommandServer>(
+      std::move(toServer->write), std::move(fromServer->read), std::move(proc));
+  server->handshake();
+  return server;
+}
+
+void HgCommandServer::fail(std::string_view what) {
+  healthy_ = false;
+  throw HgCommandServerError("hg command server: ", what);
+}
+
+void HgCommandServer::readFull(void* buf, size_t size) {
+  auto* ptr = static_cast<char*>(buf);
+  while (size > 0) {
+    auto result = fromServer_.read(ptr, int(size));
+    if (result.hasError()) {
+      fail(folly::to<std::string>("read failed: ", result.error().message()));
+    }
+    if (result.value() == 0) {
+      fail("server closed its output");
+    }
+    ptr += result.value();
+    size -= result.value();
+  }
+}
+
+void HgCommandServer::writeFull(const void* buf, size_t size) {
+  auto* ptr = static_cast<const char*>(buf);
+  while (size > 0) {
+    auto result = toServer_.write(ptr, int(size));
+    if (result.hasError()) {
+      fail(folly::to<std::string>("write failed: ", result.error().message()));
+    }
+    ptr += result.value();
+    size -= result.value();
+  }
+}
+
+std::pair<char, uint32_t> HgCommandServer::readChannelHeader() {
+  unsigned char header[5];
+  readFull(header, sizeof(header));
+  return {char(header[0]), getBigEndian32(header + 1)};
+}
+
+void HgCommandServer::handshake() {
+  auto [channel, length] = readChannelHeader();
+  if (channel != 'o') {
+    fail(folly::to<std::string>(
+        "expected a hello message, got channel ", int(channel)));
+  }
+  std::string hello(length, '\0');
+  readFull(hello.data(), hello.size());
+
+  std::vector<folly::StringPiece> lines;
+  folly::split('\n', hello, lines);
+  for (auto line : lines) {
+    if (!line.removePrefix("capabilities:")) {
+      continue;
+    }
+    std::vector<folly::StringPiece> caps;
+    folly::split(' ', line, caps, true);
+    for (auto cap : caps) {
+      if (cap == "runcommand") {
+        return;
+      }
+    }
+  }
+  fail(folly::to<std::string>("runcommand is not supported: ", hello));
+}
+
+HgCommandServer::Result HgCommandServer::runCommand(
+    const std::vector<std::string_view>& args) {
+  if (!healthy_) {
+    fail("session has already failed");
+  }
+
+  std::string request = "runcommand\n";
+  size_t argsSize = 0;
+  for (auto arg : args) {
+    argsSize += arg.size() + 1;
+  }
+  putBigEndian32(request, args.empty() ? 0 : argsSize - 1);
+  for (size_t i = 0; i < args.size(); ++i) {
+    if (i > 0) {
+      request.push_back('\0');
+    }
+    request.append(args[i]);
+  }
+  writeFull(request.data(), request.size());
+
+  std::string output;
+  std::string error;
+  std::string ignored;
+  while (true) {
+    auto [channel, length] = readChannelHeader();
+    switch (channel) {
+      case 'o':
+      case 'e': {
+        auto& buf = channel == 'o' ? output : error;
+        auto offset = buf.size();
+        buf.resize(offset + length);
+        readFull(buf.data() + offset, length);
+        break;
+      }
+      case 'r': {
+        if (length != 4) {
+          fail(folly::to<std::string>("bad result length ", length));
+        }
+        unsigned char code[4];
+        readFull(code, sizeof(code));
+        return Result{
+            int32_t(getBigEndian32(code)),
+            w_string{output.data(), output.size()},
+            w_string{error.data(), error.size()}};
+      }
+      case 'I':
+      case 'L': {
+        // The command wants input, and there is none to give it
+        std::string eof;
+        putBigEndian32(eof, 0);
+        writeFull(eof.data(), eof.size());
+        break;
+      }
+      default:
+        // Upper case channels are required to be handled; lower case ones,
+        // such as the debug channel, can be skipped.
+        if (isupper(static_cast<unsigned char>(channel))) {
+          fail(folly::to<std::string>("unsupported channel ", channel));
+        }
+        ignored.resize(length);
+        readFull(ignored.data(), length);
+        break;
+    }
+  }
+}
+
+HgCommandServerPool::HgCommandServerPool(size_t maxSessions, Factory factory)
+    : maxSessions_(std::max(maxSessions, size_t(1))),
+      factory_(std::move(factory)) {}
+
+std::unique_ptr<HgCommandServer> HgCommandServerPool::acquire() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idleCond_.wait(
+        lock, [&] { return !idle_.empty() || numSessions_ < maxSessions_; });
+    if (!idle_.empty()) {
+      auto session = std::move(idle_.back());
+      idle_.pop_back();
+      return session;
+    }
+    ++numSessions_;
+  }
+
+  // Start the server without holding the lock, so that callers that are
+  // waiting on busy sessions aren't also held up by the startup
+  try {
+    auto session = factory_();
+    if (!session) {
+      throw HgCommandServerError("hg command server: failed to start");
+    }
+    return session;
+  } catch (...) {
+    release(nullptr);
+    throw;
+  }
+}
+
+void HgCommandServerPool::release(std::unique_ptr<HgCommandServer> session) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (session && session->healthy()) {
+      idle_.push_back(std::move(session));
+    } else {
+      --numSessions_;
+    }
+  }
+  idleCond_.notify_one();
+  // A failed session, if any, is destroyed here, outside of the lock
+}
+
+HgCommandServer::Result HgCommandServerPool::run(
+    const std::vector<std::string_view>& args) {
+  auto session = acquire();
+  try {
+    auto result = session->runCommand(args);
+    release(std::move(session));
+    return result;
+  } catch (...) {
+    release(std::move(session));
+    throw;
+  }
+}
+
+} // namespace watchman
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "watchman/ChildProcess.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/scm/SCM.h"
+
+namespace watchman {
+
+// Thrown when the command server itself misbehaves or goes away, as opposed
+// to a command that ran and failed.  The session is unusable afterwards.
+class HgCommandServerError : public SCMError {
+ public:
+  using SCMError::SCMError;
+};
+
+// A session with a long-lived `hg serve --cmdserver pipe` process.  Running
+// commands through it avoids paying the python startup and extension loading
+// cost of a fresh hg for every query.
+// See https://www.mercurial-scm.org/wiki/CommandServer for the protocol.
+// Not thread safe; HgCommandServerPool hands each session to one caller at a
+// time.
+class HgCommandServer {
+ public:
+  struct Result {
+    int exitCode{0};
+    w_string output;
+    w_string error;
+  };
+
+  // Speaks the protocol over the provided descriptors.  If proc is set, it
+  // is the server process, and is terminated when the session is destroyed.
+  HgCommandServer(
+      FileDescriptor toServer,
+      FileDescriptor fromServer,
+      std::unique_ptr<ChildProcess> proc = nullptr);
+  ~HgCommandServer();
+
+  HgCommandServer(const HgCommandServer&) = delete;
+  HgCommandServer& operator=(const HgCommandServer&) = delete;
+
+  // Starts `hgPath serve --cmdserver pipe` and waits for its hello message.
+  // The options must not set up stdin or stdout; they are piped here.
+  static std::unique_ptr<HgCommandServer> spawn(
+      const std::string& hgPath,
+      ChildProcess::Options options);
+
+  // Reads the hello message and checks that the server can run commands.
+  void handshake();
+
+  // Runs `hg <args>` in the server and returns its exit code and output.
+  // Throws HgCommandServerError if the session breaks down.
+  Result runCommand(const std::vector<std::string_view>& args);
+
+  // False once the session has failed and should be discarded
+  bool healthy() const {
+    return healthy_;
+  }
+
+ private:
+  FileDescriptor toServer_;
+  FileDescriptor fromServer_;
+  std::unique_ptr<ChildProcess> proc_;
+  bool healthy_{true};
+
+  void readFull(void* buf, size_t size);
+  void writeFull(const void* buf, size_t size);
+  // Reads a channel identifier and the length that follows it
+  std::pair<char, uint32_t> readChannelHeader();
+  [[noreturn]] void fail(std::string_view what);
+};
+
+// Up to maxSessions command servers for a repository, started on demand.
+// Callers that find every session busy queue until one is returned.
+class HgCommandServerPool {
+ public:
+  using Factory = std::function<std::unique_ptr<HgCommandServer>()>;
+
+  HgCommandServerPool(size_t maxSessions, Factory factory);
+
+  // Runs `hg <args>` in an idle session.  A session that fails is discarded
+  // and the error rethrown; the next caller starts a replacement.
+  HgCommandServer::Result run(const std::vector<std::string_view>& args);
+
+ private:
+  const size_t maxSessions_;
+  Factory factory_;
+  std::mutex mutex_;
+  std::condition_variable idleCond_;
+  std::vector<std::unique_ptr<HgCommandServer>> idle_;
+  // Sessions that exist or are being started, whether idle or not
+  size_t numSessions_{0};
+
+  std::unique_ptr<HgCommandServer> acquire();
+  void release(std::unique_ptr<HgCommandServer> session);
+};
+
+} // namespace watchman
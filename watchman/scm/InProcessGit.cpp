@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/InProcessGit.h"
+#include "watchman/Logging.h"
+#include "watchman/scm/SCM.h"
+
+#ifdef HAVE_LIBGIT2
+#include <git2.h> // @manual
+#endif
+
+namespace watchman {
+
+#ifdef HAVE_LIBGIT2
+
+namespace {
+
+template <typename T, void (*Free)(T*)>
+struct GitFree {
+  void operator()(T* ptr) const {
+    Free(ptr);
+  }
+};
+
+using GitObject =
+    std::unique_ptr<git_object, GitFree<git_object, git_object_free>>;
+using GitCommit =
+    std::unique_ptr<git_commit, GitFree<git_commit, git_commit_free>>;
+using GitTree = std::unique_ptr<git_tree, GitFree<git_tree, git_tree_free>>;
+using GitIndex =
+    std::unique_ptr<git_index, GitFree<git_index, git_index_free>>;
+using GitDiff = std::unique_ptr<git_diff, GitFree<git_diff, git_diff_free>>;
+using GitRevwalk =
+    std::unique_ptr<git_revwalk, GitFree<git_revwalk, git_revwalk_free>>;
+
+void check(int result, std::string_view what) {
+  if (result < 0) {
+    auto* err = git_error_last();
+    throw SCMError(
+        "libgit2: failed to ",
+        what,
+        ": ",
+        err ? err->message : "unknown error");
+  }
+}
+
+w_string oidToString(const git_oid* oid) {
+  char hex[GIT_OID_HEXSZ + 1];
+  git_oid_tostr(hex, sizeof(hex), oid);
+  return w_string{hex, W_STRING_BYTE};
+}
+
+GitCommit resolveCommit(git_repository* repo, w_string_piece spec) {
+  auto specStr = spec.string();
+  git_object* obj = nullptr;
+  check(
+      git_revparse_single(&obj, repo, specStr.c_str()),
+      folly::to<std::string>("resolve ", specStr));
+  GitObject object{obj};
+
+  git_object* peeled = nullptr;
+  check(
+      git_object_peel(&peeled, object.get(), GIT_OBJECT_COMMIT),
+      folly::to<std::string>("resolve ", specStr, " to a commit"));
+  return GitCommit{reinterpret_cast<git_commit*>(peeled)};
+}
+
+GitTree commitTree(const GitCommit& commit) {
+  git_tree* tree = nullptr;
+  check(git_commit_tree(&tree, commit.get()), "look up commit tree");
+  return GitTree{tree};
+}
+
+} // namespace
+
+std::unique_ptr<InProcessGit> InProcessGit::open(w_string_piece scmRoot) {
+  static std::once_flag initialized;
+  std::call_once(initialized, [] { git_libgit2_init(); });
+
+  git_repository* repo = nullptr;
+  auto path = scmRoot.string();
+  if (git_repository_open(&repo, path.c_str()) < 0) {
+    auto* err = git_error_last();
+    log(ERR,
+        "libgit2 failed to open ",
+        path,
+        ", running git instead: ",
+        err ? err->message : "unknown error",
+        "\n");
+    return nullptr;
+  }
+  return std::unique_ptr<InProcessGit>(new InProcessGit(repo));
+}
+
+InProcessGit::InProcessGit(git_repository* repo) : repo_(repo) {}
+
+InProcessGit::~InProcessGit() {
+  git_repository_free(repo_);
+}
+
+w_string InProcessGit::mergeBaseWith(w_string_piece commitId) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto commit = resolveCommit(repo_, commitId);
+  auto head = resolveCommit(repo_, "HEAD");
+  git_oid base;
+  check(
+      git_merge_base(
+          &base, repo_, git_commit_id(commit.get()), git_commit_id(head.get())),
+      "compute the merge base");
+  return oidToString(&base);
+}
+
+std::vector<w_string> InProcessGit::getFilesChangedSince(
+    w_string_piece commitId) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto tree = commitTree(resolveCommit(repo_, commitId));
+
+  // The index may have been changed by git since we last looked at it
+  git_index* idx = nullptr;
+  check(git_repository_index(&idx, repo_), "open the index");
+  GitIndex index{idx};
+  check(git_index_read(index.get(), false), "read the index");
+
+  // Like `git diff <commit>`, this compares the tree with the working copy,
+  // using the index to avoid reading files that are unchanged
+  git_diff* d = nullptr;
+  check(
+      git_diff_tree_to_workdir_with_index(&d, repo_, tree.get(), nullptr),
+      "diff against the working copy");
+  GitDiff diff{d};
+
+  std::vector<w_string> files;
+  auto numDeltas = git_diff_num_deltas(diff.get());
+  files.reserve(numDeltas);
+  for (size_t i = 0; i < numDeltas; ++i) {
+    auto* delta = git_diff_get_delta(diff.get(), i);
+    files.emplace_back(delta->new_file.path, W_STRING_BYTE);
+  }
+  return files;
+}
+
+w_string InProcessGit::getNameStatusBetween(
+    w_string_piece commitA,
+    w_string_piece commitB) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto treeA = commitTree(resolveCommit(repo_, commitA));
+  auto treeB = commitTree(resolveCommit(repo_, commitB));
+
+  git_diff* d = nullptr;
+  check(
+      git_diff_tree_to_tree(&d, repo_, treeA.get(), treeB.get(), nullptr),
+      "diff commits");
+  GitDiff diff{d};
+
+  std::string output;
+  auto numDeltas = git_diff_num_deltas(diff.get());
+  for (size_t i = 0; i < numDeltas; ++i) {
+    auto* delta = git_diff_get_delta(diff.get(), i);
+    output.push_back(git_diff_status_char(delta->status));
+    output.push_back('\0');
+    output.append(delta->new_file.path);
+    output.push_back('\0');
+  }
+  return w_string{output.data(), output.size(), W_STRING_BYTE};
+}
+
+time_t InProcessGit::getCommitTime(w_string_piece commitId) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return git_commit_time(resolveCommit(repo_, commitId).get());
+}
+
+std::vector<w_string> InProcessGit::getCommitsPriorToAndIncluding(
+    w_string_piece commitId,
+    int numCommits) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto commit = resolveCommit(repo_, commitId);
+
+  git_revwalk* w = nullptr;
+  check(git_revwalk_new(&w, repo_), "start a revision walk");
+  GitRevwalk walk{w};
+  // `git log` shows commits in reverse chronological order by default
+  check(git_revwalk_sorting(walk.get(), GIT_SORT_TIME), "sort the walk");
+  check(git_revwalk_push(walk.get(), git_commit_id(commit.get())), "walk");
+
+  std::vector<w_string> commits;
+  git_oid oid;
+  while (int(commits.size()) < numCommits &&
+         git_revwalk_next(&oid, walk.get()) == 0) {
+    commits.push_back(oidToString(&oid));
+  }
+  return commits;
+}
+
+#else
+
+std::unique_ptr<InProcessGit> InProcessGit::open(w_string_piece) {
+  return nullptr;
+}
+
+InProcessGit::InProcessGit(git_repository* repo) : repo_(repo) {}
+
+InProcessGit::~InProcessGit() {}
+
+w_string InProcessGit::mergeBaseWith(w_string_piece) {
+  throw SCMError("watchman was built without libgit2");
+}
+
+std::vector<w_string> InProcessGit::getFilesChangedSince(w_string_piece) {
+  throw SCMError("watchman was built without libgit2");
+}
+
+w_string InProcessGit::getNameStatusBetween(w_string_piece, w_string_piece) {
+  throw SCMError("watchman was built without libgit2");
+}
+
+time_t InProcessGit::getCommitTime(w_string_piece) {
+  throw SCMError("watchman was built without libgit2");
+}
+
+std::vector<w_string> InProcessGit::getCommitsPriorToAndIncluding(
+    w_string_piece,
+    int) {
+  throw SCMError("watchman was built without libgit2");
+}
+
+#endif
+
+} // namespace watchman
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "watchman/watchman_string.h"
+
+struct git_repository;
+
+namespace watchman {
+
+// Answers the queries that Git otherwise runs `git` for by reading the
+// repository in-process with libgit2, which avoids a fork and exec per
+// query.  Only available when watchman is built with libgit2.
+// Each method throws SCMError if it fails, in which case the caller is
+// expected to fall back to the git CLI.
+// Thread safe: calls are serialized on a single repository handle.
+class InProcessGit {
+ public:
+  // Returns nullptr if watchman was built without libgit2, or if the
+  // repository can't be opened.
+  static std::unique_ptr<InProcessGit> open(w_string_piece scmRoot);
+  ~InProcessGit();
+
+  InProcessGit(const InProcessGit&) = delete;
+  InProcessGit& operator=(const InProcessGit&) = delete;
+
+  // Equivalent to `git merge-base commitId HEAD`
+  w_string mergeBaseWith(w_string_piece commitId);
+
+  // Equivalent to `git diff --name-only commitId`
+  std::vector<w_string> getFilesChangedSince(w_string_piece commitId);
+
+  // Equivalent to `git diff --name-status -z commitA commitB`, in the same
+  // NUL separated format so that GitStatusAccumulator can consume either
+  w_string getNameStatusBetween(
+      w_string_piece commitA,
+      w_string_piece commitB);
+
+  // Returns the committer time of commitId
+  time_t getCommitTime(w_string_piece commitId);
+
+  // Equivalent to `git log -n numCommits --format=%H commitId`
+  std::vector<w_string> getCommitsPriorToAndIncluding(
+      w_string_piece commitId,
+      int numCommits);
+
+ private:
+  explicit InProcessGit(git_repository* repo);
+
+  std::mutex mutex_;
+  git_repository* repo_;
+};
+
+} // namespace watchman
@@ -13,6 +13,7 @@
 #include "watchman/ChildProcess.h"
 #include "watchman/CommandRegistry.h"
 #include "watchman/Logging.h"
+#include "watchman/ThreadPool.h"
 #include "watchman/fs/FileSystem.h"
 #include "watchman/sockname.h"
 
@@ -115,16 +116,17 @@ SCM::StatusResult StatusAccumulator::finalize() const {
   return combined;
 }
 
-ChildProcess::Options Mercurial::makeHgOptions(w_string requestId) const {
-  ChildProcess::Options opt;
+void Mercurial::setHgEnvironment(
+    ChildProcess::Environment& env,
+    w_string requestId) const {
   // Ensure that the hgrc doesn't mess with the behavior
   // of the commands that we're runing.
-  opt.environment().set("HGPLAIN", w_string("1"));
+  env.set("HGPLAIN", w_string("1"));
   // Ensure that we do not telemetry log profiling data for the commands we are
   // running by default. This is to avoid a significant increase in the rate of
   // logging.
   if (!cfg_get_bool("enable_hg_telemetry_logging", false)) {
-    opt.environment().set("NOSCMLOG", w_string("1"));
+    env.set("NOSCMLOG", w_string("1"));
   }
   // chg can elect to kill all children if an error occurs in any child.
   // This can cause commands we spawn to fail transiently.  While we'd
@@ -132,14 +134,14 @@ ChildProcess::Options Mercurial::makeHgOptions(w_string requestId) const {
   // with our ability to deliver notifications to our clients in a timely
   // manner, so we disable the use of chg for the mercurial processes
   // that we spawn.
-  opt.environment().set("CHGDISABLE", w_string("1"));
+  env.set("CHGDISABLE", w_string("1"));
   // This method is called from the eden watcher and can trigger before
   // mercurial has finalized writing out its history data.  Setting this
   // environmental variable allows us to break the view isolation and read
   // information about the commit before the transaction is complete.
-  opt.environment().set("HG_PENDING", getRootPath());
+  env.set("HG_PENDING", getRootPath());
   if (requestId && !requestId.empty()) {
-    opt.environment().set("HGREQUESTID", requestId);
+    env.set("HGREQUESTID", requestId);
   }
 
   // Default to strict hg status.  HGDETECTRACE is used by some deployments
@@ -149,13 +151,17 @@ ChildProcess::Options Mercurial::makeHgOptions(w_string requestId) const {
   // CLI invocation.  Watchman is ready to handle this case in a reasonably
   // defined manner, so we are safe to enable it.
   if (cfg_get_bool("fsmonitor.detectrace", true)) {
-    opt.environment().set("HGDETECTRACE", w_string("1"));
+    env.set("HGDETECTRACE", w_string("1"));
   }
 
   // Ensure that mercurial uses this path to communicate with us,
   // rather than whatever is hardcoded in its config.
-  opt.environment().set("WATCHMAN_SOCK", get_sock_name_legacy());
+  env.set("WATCHMAN_SOCK", get_sock_name_legacy());
+}
 
+ChildProcess::Options Mercurial::makeHgOptions(w_string requestId) const {
+  ChildProcess::Options opt;
+  setHgEnvironment(opt.environment(), requestId);
   opt.nullStdin();
   opt.pipeStdout();
   opt.pipeStderr();
@@ -164,6 +170,55 @@ ChildProcess::Options Mercurial::makeHgOptions(w_string requestId) const {
   return opt;
 }
 
+ChildProcess::Options Mercurial::makeHgServerOptions() const {
+  ChildProcess::Options opt;
+  // The server outlives any one request, so it can't carry HGREQUESTID
+  setHgEnvironment(opt.environment(), nullptr);
+  // The command server protocol runs over stdin and stdout.  Anything the
+  // server writes to stderr outside of the protocol goes to our log.
+  opt.chdir(getRootPath());
+  return opt;
+}
+
+w_string Mercurial::runHg(
+    std::vector<std::string_view> args,
+    w_string requestId,
+    std::string_view description) const {
+  if (commandServers_) {
+    try {
+      auto result = commandServers_->run(args);
+      if (result.exitCode) {
+        auto output = std::string{result.output.view()};
+        auto error = std::string{result.error.view()};
+        replaceEmbeddedNulls(output);
+        replaceEmbeddedNulls(error);
+        throw SCMError{
+            "failed to ",
+            description,
+            "\ncmd = hg ",
+            folly::join(" ", args),
+            "\nstdout = ",
+            output,
+            "\nstderr = ",
+            error};
+      }
+      return result.output;
+    } catch (const HgCommandServerError& exc) {
+      log(ERR, exc.what(), ", running hg directly instead\n");
+    } catch (const std::system_error& exc) {
+      log(ERR,
+          "failed to start hg command server: ",
+          exc.what(),
+          ", running hg directly instead\n");
+    }
+  }
+
+  auto hgPath = hgExecutablePath();
+  std::vector<std::string_view> cmdline{hgPath};
+  cmdline.insert(cmdline.end(), args.begin(), args.end());
+  return runMercurial(cmdline, makeHgOptions(requestId), description).output;
+}
+
 Mercurial::Mercurial(w_string_piece rootPath, w_string_piece scmRoot)
     : SCM(rootPath, scmRoot),
       dirStatePath_(to<std::string>(getSCMRoot().view(), "/.hg/dirstate")),
@@ -172,13 +227,21 @@ Mercurial::Mercurial(w_string_piece rootPath, w_string_piece scmRoot)
       filesChangedBetweenCommits_(
           Configuration(),
           "scm_hg_files_between_commits",
-          32,
+          128,
           10),
       filesChangedSinceMergeBaseWith_(
           Configuration(),
           "scm_hg_files_since_mergebase",
           32,
-          10) {}
+          10) {
+  if (cfg_get_bool("hg_command_server", false)) {
+    commandServers_ = std::make_unique<HgCommandServerPool>(
+        cfg_get_int("hg_command_server_sessions", 2), [this] {
+          return HgCommandServer::spawn(
+              hgExecutablePath(), makeHgServerOptions());
+        });
+  }
+}
 
 struct timespec Mercurial::getDirStateMtime() const {
   try {
@@ -208,28 +271,33 @@ w_string Mercurial::mergeBaseWith(w_string_piece commitId, w_string requestId)
           key,
           [this, commit, requestId](const std::string&) {
             auto revset = to<std::string>("ancestor(.,", commit, ")");
-            auto result = runMercurial(
-                {hgExecutablePath(), "log", "-T", "{node}", "-r", revset},
-                makeHgOptions(requestId),
+            auto output = runHg(
+                {"log", "-T", "{node}", "-r", revset},
+                requestId,
                 "query for the merge base");
 
-            if (!result.output) {
+            if (!output) {
               throw SCMError(
                   "no output was returned from `hg log -T{node} -r ", revset);
             }
 
-            if (result.output.size() != 40) {
+            if (output.size() != 40) {
               throw SCMError(
                   "expected merge base to be a 40 character string, got ",
-                  result.output.view());
+                  output.view());
             }
 
-            return folly::makeFuture(result.output);
+            return folly::makeFuture(output);
           })
       .get()
       ->value();
 }
 
+w_string Mercurial::getWorkingCopyCommit(w_string requestId) const {
+  // ancestor(., .) is just ., and is cached along with the other merge bases
+  return mergeBaseWith(".", requestId);
+}
+
 std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
     w_string_piece commitId,
     w_string requestId) const {
@@ -248,9 +316,8 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
           key,
           [this, commit = std::move(commitCopy), requestId](
               const std::string&) {
-            auto result = runMercurial(
-                {hgExecutablePath(),
-                 "--traceback",
+            auto output = runHg(
+                {"--traceback",
                  "status",
                  "-n",
                  "--rev",
@@ -258,11 +325,11 @@ std::vector<w_string> Mercurial::getFilesChangedSinceMergeBaseWith(
                  // The "" argument at the end causes paths to be printed out
                  // relative to the cwd (set to root path above).
                  ""},
-                makeHgOptions(requestId),
+                requestId,
                 "query for files changed since merge base");
 
             std::vector<w_string> lines;
-            result.output.piece().split(lines, '\n');
+            output.piece().split(lines, '\n');
             return folly::makeFuture(lines);
           })
       .get()
@@ -273,9 +340,45 @@ SCM::StatusResult Mercurial::getFilesChangedBetweenCommits(
     std::vector<std::string> commits,
     w_string requestId,
     bool includeDirectories) const {
-  StatusAccumulator result;
+  // Each transition is independent of the others, so they are looked up
+  // concurrently on the thread pool.  In practice since each transition in
+  // `commits` corresponds to an `hg update` call, the list is usually short,
+  // but rebases and stack navigation can produce several at once, and the
+  // same ranges tend to be asked about repeatedly.  If `hg status` acquires a
+  // lock on the backing storage there may not be much actual concurrency,
+  // but each command still overlaps the startup of the others.
+  auto mtime = getDirStateMtime();
+  std::vector<folly::Future<w_string>> outputs;
+  auto lookup = [&](std::string key,
+                    std::vector<std::string> args,
+                    std::string_view description,
+                    bool newlineSeparated) {
+    outputs.push_back(
+        filesChangedBetweenCommits_
+            .get(
+                key,
+                [this, args = std::move(args), requestId, description,
+                 newlineSeparated](const std::string&) {
+                  return folly::via(
+                      &getThreadPool(ThreadPool::Priority::Scm),
+                      [this, args, requestId, description, newlineSeparated] {
+                        auto output = runHg(
+                            std::vector<std::string_view>(
+                                args.begin(), args.end()),
+                            requestId,
+                            description);
+                        if (!newlineSeparated) {
+                          return output;
+                        }
+                        auto lines = std::string{output.view()};
+                        replaceEmbeddedNewLines(lines);
+                        return w_string{lines};
+                      });
+                })
+            .thenValue([](auto&& node) { return node->value(); }));
+  };
+
   for (size_t i = 0; i + 1 < commits.size(); ++i) {
-    auto mtime = getDirStateMtime();
     auto& commitA = commits[i];
     auto& commitB = commits[i + 1];
     if (commitA == commitB) {
@@ -283,90 +386,54 @@ SCM::StatusResult Mercurial::getFilesChangedBetweenCommits(
       // in which case we shouldn't ask Mercurial for the difference.
       continue;
     }
-    auto key = folly::to<std::string>(
-        commitA, ":", commitB, ":", mtime.tv_sec, ":", mtime.tv_nsec);
-    auto dirkey = folly::to<std::string>(
-        "dirs:", commitA, ":", commitB, ":", mtime.tv_sec, ":", mtime.tv_nsec);
-
-    // This loop runs `hg status` commands sequentially. There's an opportunity
-    // to run them concurrently, but:
-    // 1. In practice since each transition in `commits` corresponds to an
-    //    `hg update` call, the list is almost always short.
-    // 2. For debugging Watchman performance issues, it's nice to have the
-    //    subprocess call on the same stack.
-    // 3. If `hg status` acquires a lock on the backing storage, there may not
-    //    be much actual concurrency.
-    // 4. This codepath is most frequently executed under very fast checkout
-    //    operations between close commits, where the cost isn't that high.
-
-    result.add(
-        filesChangedBetweenCommits_
-            .get(
-                key,
-                [&](const std::string&) {
-                  auto hgresult = runMercurial(
-                      {hgExecutablePath(),
-                       "--traceback",
-                       "status",
-                       "--print0",
-                       "--rev",
-                       commitA,
-                       "--rev",
-                       commitB,
-                       // The "" argument at the end causes paths to be printed
-                       // out relative to the cwd (set to root path above).
-                       ""},
-                      makeHgOptions(requestId),
-                      "get files changed between commits");
-
-                  return folly::makeFuture(hgresult.output);
-                })
-            .get()
-            ->value());
+    auto key = commitRangeCacheKey(commitA, commitB, mtime);
+
+    lookup(
+        key,
+        {"--traceback",
+         "status",
+         "--print0",
+         "--rev",
+         commitA,
+         "--rev",
+         commitB,
+         // The "" argument at the end causes paths to be printed
+         // out relative to the cwd (set to root path above).
+         ""},
+        "get files changed between commits",
+        false);
     if (includeDirectories) {
-      result.add(filesChangedBetweenCommits_
-                     .get(
-                         dirkey,
-                         [&](const std::string&) {
-                           auto hgresult = runMercurial(
-                               {hgExecutablePath(),
-                                "--traceback",
-                                "debugdiffdirs",
-                                "--rev",
-                                commitA,
-                                "--rev",
-                                commitB,
-                                // The "" argument at the end causes paths to be
-                                // printed out relative to the cwd (set to root
-                                // path above).
-                                ""},
-                               makeHgOptions(requestId),
-                               "get dirs changed between commits");
-                           auto output = std::string{hgresult.output.view()};
-                           replaceEmbeddedNewLines(output);
-                           return folly::makeFuture(w_string{output});
-                         })
-                     .get()
-                     ->value());
+      lookup(
+          "dirs:" + key,
+          {"--traceback",
+           "debugdiffdirs",
+           "--rev",
+           commitA,
+           "--rev",
+           commitB,
+           // The "" argument at the end causes paths to be printed out
+           // relative to the cwd (set to root path above).
+           ""},
+          "get dirs changed between commits",
+          true);
     }
   }
+
+  StatusAccumulator result;
+  for (auto& output : outputs) {
+    result.add(std::move(output).get());
+  }
   return result.finalize();
 }
 
 time_point<system_clock> Mercurial::getCommitDate(
     w_string_piece commitId,
     w_string requestId) const {
-  auto result = runMercurial(
-      {hgExecutablePath(),
-       "--traceback",
-       "log",
-       "-r",
-       commitId.data(),
-       "-T",
-       "{date}\n"},
-      makeHgOptions(requestId),
+  auto output = runHg(
+      {"--traceback", "log", "-r", commitId.data(), "-T", "{date}\n"},
+      requestId,
       "get commit date");
-  return Mercurial::convertCommitDate(result.output.c_str());
+  return Mercurial::convertCommitDate(output.c_str());
 }
 
 time_point<system_clock> Mercurial::convertCommitDate(const char* commitDate) {
@@ -398,19 +465,13 @@ std::vector<w_string> Mercurial::getCommitsPriorToAndIncluding(
                 "), ",
                 numCommits,
                 "))\n");
-            auto result = runMercurial(
-                {hgExecutablePath(),
-                 "--traceback",
-                 "log",
-                 "-r",
-                 revset,
-                 "-T",
-                 "{node}\n"},
-                makeHgOptions(requestId),
+            auto output = runHg(
+                {"--traceback", "log", "-r", revset, "-T", "{node}\n"},
+                requestId,
                 "get prior commits");
 
             std::vector<w_string> lines;
-            w_string_piece(result.output).split(lines, '\n');
+            w_string_piece(output).split(lines, '\n');
             return folly::makeFuture(lines);
           })
       .get()
@@ -14,6 +14,7 @@
 #include "watchman/ChildProcess.h"
 #include "watchman/LRUCache.h"
 #include "watchman/fs/FileInformation.h"
+#include "watchman/scm/HgCommandServer.h"
 #include "watchman/scm/SCM.h"
 
 namespace watchman {
@@ -36,6 +37,7 @@ class Mercurial : public SCM {
   Mercurial(w_string_piece rootPath, w_string_piece scmRoot);
   w_string mergeBaseWith(w_string_piece commitId, w_string requestId = nullptr)
       const override;
+  w_string getWorkingCopyCommit(w_string requestId = nullptr) const override;
   std::vector<w_string> getFilesChangedSinceMergeBaseWith(
       w_string_piece commitId,
       w_string requestId = nullptr) const override;
@@ -54,6 +56,11 @@ class Mercurial : public SCM {
       int numCommits,
       w_string requestId = nullptr) const override;
 
+ protected:
+  struct timespec getWorkingCopyStateMtime() const override {
+    return getDirStateMtime();
+  }
+
  private:
   std::string dirStatePath_;
   mutable LRUCache<std::string, std::vector<w_string>> commitsPrior_;
@@ -61,9 +68,22 @@ class Mercurial : public SCM {
   mutable LRUCache<std::string, w_string> filesChangedBetweenCommits_;
   mutable LRUCache<std::string, std::vector<w_string>>
       filesChangedSinceMergeBaseWith_;
+  // Null unless hg_command_server is enabled
+  std::unique_ptr<HgCommandServerPool> commandServers_;
 
+  // Sets up the environment that hg should run with
+  void setHgEnvironment(ChildProcess::Environment& env, w_string requestId)
+      const;
   // Returns options for invoking hg
   ChildProcess::Options makeHgOptions(w_string requestId) const;
+  // Returns options for starting a command server
+  ChildProcess::Options makeHgServerOptions() const;
+  // Runs `hg <args>` in a command server if enabled, falling back to
+  // spawning hg, and returns its output.  Throws SCMError if it fails.
+  w_string runHg(
+      std::vector<std::string_view> args,
+      w_string requestId,
+      std::string_view description) const;
   struct timespec getDirStateMtime() const;
 };
 
@@ -6,6 +6,7 @@
  */
 
 #include "watchman/scm/SCM.h"
+#include <algorithm>
 #include <memory>
 #include "watchman/Logging.h"
 #include "watchman/scm/Git.h"
@@ -16,6 +17,10 @@ namespace watchman {
 static const w_string_piece kGit{".git"};
 static const w_string_piece kHg{".hg"};
 
+// How many of the commits that queries ask for the merge base with are
+// kept up to date as the working copy moves
+static constexpr size_t kMaxPrecomputedMergeBases = 4;
+
 SCM::~SCM() {}
 
 SCM::SCM(w_string_piece rootPath, w_string_piece scmRoot)
@@ -29,6 +34,71 @@ const w_string& SCM::getSCMRoot() const {
   return scmRoot_;
 }
 
+bool SCM::isCommitHash(std::string_view commitId) {
+  // SHA-1, or SHA-256 for git repositories that use it
+  if (commitId.size() != 40 && commitId.size() != 64) {
+    return false;
+  }
+  return std::all_of(commitId.begin(), commitId.end(), [](char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+        (c >= 'A' && c <= 'F');
+  });
+}
+
+std::string SCM::commitRangeCacheKey(
+    std::string_view commitA,
+    std::string_view commitB,
+    const struct timespec& mtime) {
+  if (isCommitHash(commitA) && isCommitHash(commitB)) {
+    return folly::to<std::string>(commitA, ":", commitB);
+  }
+  return folly::to<std::string>(
+      commitA, ":", commitB, ":", mtime.tv_sec, ":", mtime.tv_nsec);
+}
+
+void SCM::noteMergeBaseWith(w_string_piece commitId) {
+  auto precompute = precompute_.wlock();
+  auto& commits = precompute->commits;
+  auto it = std::find_if(commits.begin(), commits.end(), [&](auto& commit) {
+    return commit.piece() == commitId;
+  });
+  if (it == commits.begin()) {
+    return;
+  }
+  if (it != commits.end()) {
+    commits.erase(it);
+  } else if (commits.size() == kMaxPrecomputedMergeBases) {
+    commits.pop_back();
+  }
+  commits.insert(commits.begin(), commitId.asWString());
+}
+
+std::vector<w_string> SCM::takeMergeBasesToPrecompute() {
+  auto precompute = precompute_.wlock();
+  if (precompute->commits.empty() || precompute->running) {
+    return {};
+  }
+  auto mtime = getWorkingCopyStateMtime();
+  if ((mtime.tv_sec == 0 && mtime.tv_nsec == 0) ||
+      (mtime.tv_sec == precompute->lastMtime.tv_sec &&
+       mtime.tv_nsec == precompute->lastMtime.tv_nsec)) {
+    return {};
+  }
+  precompute->running = true;
+  return precompute->commits;
+}
+
+void SCM::donePrecomputingMergeBases() {
+  auto mtime = getWorkingCopyStateMtime();
+  auto precompute = precompute_.wlock();
+  precompute->lastMtime = mtime;
+  precompute->running = false;
+}
+
+struct timespec SCM::getWorkingCopyStateMtime() const {
+  return timespec{0, 0};
+}
+
 w_string findFileInDirTree(
     w_string_piece rootPath,
     std::initializer_list<w_string_piece> candidates) {
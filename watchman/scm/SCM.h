@@ -7,9 +7,12 @@
 
 #pragma once
 #include <folly/Conv.h>
+#include <folly/Synchronized.h>
 #include <chrono>
 #include <memory>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 #include <vector>
 #include "watchman/watchman_string.h"
 #include "watchman/watchman_system.h"
@@ -64,6 +67,10 @@ class SCM {
       w_string_piece commitId,
       w_string requestId = nullptr) const = 0;
 
+  // Returns the hash of the commit that the working copy is based on.
+  virtual w_string getWorkingCopyCommit(
+      w_string requestId = nullptr) const = 0;
+
   // Compute the set of paths that have changed in the commits
   // starting in the working copy and going back to the merge base
   // with the specified commitId.  This list also includes the
@@ -111,8 +118,52 @@ class SCM {
       int numCommits,
       w_string requestId = nullptr) const = 0;
 
+  // Records that a query asked for the merge base with commitId, so that
+  // takeMergeBasesToPrecompute offers it from then on.
+  void noteMergeBaseWith(w_string_piece commitId);
+
+  // Returns the commits that queries recently asked for the merge base
+  // with, if the working copy commit may have moved since they were last
+  // returned, and nothing otherwise.  Looking up the merge bases and the
+  // files changed since them then fills the caches that the next query
+  // will use.  The caller must call donePrecomputingMergeBases once it
+  // has; until then nothing further is returned.
+  std::vector<w_string> takeMergeBasesToPrecompute();
+  void donePrecomputingMergeBases();
+
+ protected:
+  // Returns the mtime of the file that the SCM updates when the working
+  // copy commit moves, such as the dirstate.  Zero if there is no such
+  // file, in which case merge bases are not precomputed.
+  virtual struct timespec getWorkingCopyStateMtime() const;
+
+  // Returns true if commitId is a full hex commit hash.  A hash always names
+  // the same commit, whereas names like `.` or a branch can move.
+  static bool isCommitHash(std::string_view commitId);
+
+  // Returns the key with which to cache results that depend only on the
+  // history between commitA and commitB.  When both are commit hashes that
+  // history can never change, so the key is just the pair and the result can
+  // be reused for as long as it stays in the cache.  Otherwise the key
+  // includes the mtime of the dirstate or index, as a proxy for the names
+  // having moved.
+  static std::string commitRangeCacheKey(
+      std::string_view commitA,
+      std::string_view commitB,
+      const struct timespec& mtime);
+
  private:
   w_string rootPath_;
   w_string scmRoot_;
+
+  struct MergeBasePrecompute {
+    // The most recently asked for first
+    std::vector<w_string> commits;
+    // As of the end of the last precompute, so that the SCM commands it
+    // ran updating the file don't count as the working copy moving
+    timespec lastMtime{0, 0};
+    bool running{false};
+  };
+  folly::Synchronized<MergeBasePrecompute> precompute_;
 };
 } // namespace watchman
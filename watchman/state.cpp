@@ -6,20 +6,26 @@
  */
 
 #include "watchman/state.h"
+#include <folly/FileUtil.h>
 #include <folly/String.h>
 #include <folly/Synchronized.h>
-#include "watchman/Errors.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 #include "watchman/Logging.h"
 #include "watchman/Options.h"
-#include "watchman/PDU.h"
+#include "watchman/PerfSample.h"
 #include "watchman/QueryableView.h"
 #include "watchman/Shutdown.h"
+#include "watchman/TreeSizeHints.h"
 #include "watchman/TriggerCommand.h"
+#include "watchman/WatchmanConfig.h"
 #include "watchman/root/Root.h"
 #include "watchman/root/resolve.h"
 #include "watchman/root/watchlist.h"
 #include "watchman/saved_state/SavedStateFactory.h"
-#include "watchman/watchman_stream.h"
 
 using namespace watchman;
 
@@ -30,23 +36,32 @@ using namespace watchman;
  * save the state when things are changing.
  *
  * This uses a simple condition variable to wait for and be
- * notified of state changes.
+ * notified of state changes.  A burst of changes, such as a script
+ * registering a trigger at a time, is saved once: the thread waits until
+ * no change has been made for state_save_settle_ms, or until the oldest
+ * unsaved change is state_save_max_delay_ms old, whichever is sooner.
+ * The file is replaced atomically, and not at all if its contents would
+ * be unchanged.
  */
 
 namespace {
 struct state {
   bool needsSave{false};
+  // When the oldest and the most recent of the unsaved changes were made
+  std::chrono::steady_clock::time_point firstChange;
+  std::chrono::steady_clock::time_point lastChange;
 };
 folly::Synchronized<state, std::mutex> saveState;
 std::condition_variable stateCond;
 std::thread state_saver_thread;
+// The contents of the state file as last read or written.  Only used by
+// the state saving thread, once it has been started.
+std::string savedContents;
 } // namespace
 
 static bool do_state_save();
 
 static void state_saver() noexcept {
-  bool do_save;
-
   w_set_thread_name("statesaver");
 
   while (!w_is_stopping()) {
@@ -55,13 +70,26 @@ static void state_saver() noexcept {
       if (!state->needsSave) {
         stateCond.wait(state.as_lock());
       }
-      do_save = state->needsSave;
+      if (!state->needsSave) {
+        continue;
+      }
+
+      auto settle =
+          std::chrono::milliseconds(cfg_get_int("state_save_settle_ms", 50));
+      auto maxDelay = std::chrono::milliseconds(
+          cfg_get_int("state_save_max_delay_ms", 1000));
+      while (!w_is_stopping()) {
+        auto deadline = std::min(
+            state->lastChange + settle, state->firstChange + maxDelay);
+        if (std::chrono::steady_clock::now() >= deadline) {
+          break;
+        }
+        stateCond.wait_until(state.as_lock(), deadline);
+      }
       state->needsSave = false;
     }
 
-    if (do_save) {
-      do_state_save();
-    }
+    do_state_save();
   }
 }
 
@@ -79,13 +107,18 @@ bool w_state_load() {
     return true;
   }
 
+  std::string contents;
+  bool haveContents =
+      folly::readFile(flags.watchman_state_file.c_str(), contents);
+  auto readError = errno;
+  if (haveContents) {
+    // So that re-establishing the watches doesn't rewrite the same file
+    savedContents = contents;
+  }
   state_saver_thread = std::thread(state_saver);
 
-  json_ref state;
-  try {
-    state = json_load_file(flags.watchman_state_file.c_str(), 0);
-  } catch (const std::system_error& exc) {
-    if (exc.code() == watchman::error_code::no_such_file_or_directory) {
+  if (!haveContents) {
+    if (readError == ENOENT) {
       // No need to alarm anyone if we've never written a state file
       return false;
     }
@@ -93,8 +126,17 @@ bool w_state_load() {
         ERR,
         "failed to load json from {}: {}\n",
         flags.watchman_state_file,
-        folly::exceptionStr(exc).toStdString());
+        folly::errnoStr(readError));
     return false;
+  }
+
+  json_ref state;
+  try {
+    json_error_t err;
+    state = json_loadb(contents.data(), contents.size(), 0, &err);
+    if (!state) {
+      throw std::runtime_error(err.text);
+    }
   } catch (const std::exception& exc) {
     logf(
         ERR,
@@ -112,22 +154,8 @@ bool w_state_load() {
 }
 
 static bool do_state_save() {
-  w_jbuffer_t buffer;
-
   auto state = json_object();
 
-  auto file = w_stm_open(
-      flags.watchman_state_file.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0600);
-  if (!file) {
-    log(ERR,
-        "save_state: unable to open ",
-        flags.watchman_state_file,
-        " for write: ",
-        folly::errnoStr(errno),
-        "\n");
-    return false;
-  }
-
   state.set("version", typed_string_to_json(PACKAGE_VERSION, W_STRING_UNICODE));
 
   /* now ask the different subsystems to fill out the state */
@@ -136,7 +164,28 @@ static bool do_state_save() {
   }
 
   /* we've prepared what we're going to save, so write it out */
-  buffer.jsonEncodeToStream(state, file.get(), JSON_INDENT(4));
+  auto contents = json_dumps(state, JSON_INDENT(4)) + "\n";
+  if (contents == savedContents) {
+    logf(DBG, "state is unchanged, not saving it\n");
+    return true;
+  }
+
+  // Written to a temporary file that is then renamed over the old one, so
+  // that a crash part way through doesn't lose every watch
+  int err = folly::writeFileAtomicNoThrow(
+      folly::StringPiece(flags.watchman_state_file),
+      folly::ByteRange(folly::StringPiece(contents)),
+      0600);
+  if (err) {
+    log(ERR,
+        "save_state: unable to write ",
+        flags.watchman_state_file,
+        ": ",
+        folly::errnoStr(err),
+        "\n");
+    return false;
+  }
+  savedContents = std::move(contents);
   return true;
 }
 
@@ -147,7 +196,15 @@ void w_state_save() {
     return;
   }
 
-  saveState.lock()->needsSave = true;
+  {
+    auto state = saveState.lock();
+    auto now = std::chrono::steady_clock::now();
+    if (!state->needsSave) {
+      state->needsSave = true;
+      state->firstChange = now;
+    }
+    state->lastChange = now;
+  }
   stateCond.notify_one();
 }
 
@@ -170,6 +227,10 @@ bool w_root_save_state(json_ref& state) {
       auto triggers = root->triggerListToJson();
       json_object_set_new(obj, "triggers", std::move(triggers));
 
+      if (auto hints = root->view()->getTreeSizeHints()) {
+        json_object_set_new(obj, "tree_size", hints->toJson());
+      }
+
       json_array_append_new(watched_dirs, std::move(obj));
     }
   }
@@ -179,81 +240,148 @@ bool w_root_save_state(json_ref& state) {
   return result;
 }
 
-bool w_root_load_state(const json_ref& state) {
-  size_t i;
+// Re-establishes the watch, and the triggers, of one of the roots recorded
+// in the state file.  Returns true if the root is being watched.
+static bool load_root_state(const json_ref& obj) {
+  bool created = false;
+  const char* filename;
+  size_t j;
 
-  auto watched = state.get_default("watched");
-  if (!watched) {
-    return true;
+  auto triggers = obj.get_default("triggers");
+  filename = json_string_value(json_object_get(obj, "path"));
+
+  // Before the watch, so that its view and watcher are sized by them
+  if (auto hints = TreeSizeHints::fromJson(obj.get_default("tree_size"))) {
+    TreeSizeHints::remember(w_string(filename, W_STRING_BYTE), *hints);
   }
 
-  if (!watched.isArray()) {
+  std::shared_ptr<Root> root;
+  try {
+    root = root_resolve(filename, true, &created);
+  } catch (const std::exception&) {
     return false;
   }
 
-  for (i = 0; i < json_array_size(watched); i++) {
-    const auto& obj = watched.at(i);
-    bool created = false;
-    const char* filename;
-    size_t j;
-
-    auto triggers = obj.get_default("triggers");
-    filename = json_string_value(json_object_get(obj, "path"));
-
-    std::shared_ptr<Root> root;
-    try {
-      root = root_resolve(filename, true, &created);
-    } catch (const std::exception&) {
-      continue;
-    }
-
-    {
-      auto wlock = root->triggers.wlock();
-      auto& map = *wlock;
-
-      /* re-create the trigger configuration */
-      for (j = 0; j < json_array_size(triggers); j++) {
-        const auto& tobj = triggers.at(j);
+  {
+    auto wlock = root->triggers.wlock();
+    auto& map = *wlock;
 
-        // Legacy rules format
-        auto rarray = tobj.get_default("rules");
-        if (rarray) {
-          continue;
-        }
+    /* re-create the trigger configuration */
+    for (j = 0; j < json_array_size(triggers); j++) {
+      const auto& tobj = triggers.at(j);
 
-        try {
-          auto cmd = std::make_unique<TriggerCommand>(getInterface, root, tobj);
-          cmd->start(root);
-          auto& mapEntry = map[cmd->triggername];
-          mapEntry = std::move(cmd);
-        } catch (const std::exception& exc) {
-          watchman::log(
-              watchman::ERR,
-              "loading trigger for ",
-              root->root_path,
-              ": ",
-              exc.what(),
-              "\n");
-        }
+      // Legacy rules format
+      auto rarray = tobj.get_default("rules");
+      if (rarray) {
+        continue;
       }
-    }
 
-    if (created) {
       try {
-        root->view()->startThreads(root);
-      } catch (const std::exception& e) {
+        auto cmd = std::make_unique<TriggerCommand>(getInterface, root, tobj);
+        cmd->start(root);
+        auto& mapEntry = map[cmd->triggername];
+        mapEntry = std::move(cmd);
+      } catch (const std::exception& exc) {
         watchman::log(
             watchman::ERR,
-            "root_start(",
+            "loading trigger for ",
             root->root_path,
-            ") failed: ",
-            e.what(),
+            ": ",
+            exc.what(),
             "\n");
-        root->cancel();
       }
     }
   }
 
+  if (created) {
+    try {
+      root->view()->startThreads(root);
+    } catch (const std::exception& e) {
+      watchman::log(
+          watchman::ERR,
+          "root_start(",
+          root->root_path,
+          ") failed: ",
+          e.what(),
+          "\n");
+      root->cancel();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool w_root_load_state(const json_ref& state) {
+  auto watched = state.get_default("watched");
+  if (!watched) {
+    return true;
+  }
+
+  if (!watched.isArray()) {
+    return false;
+  }
+
+  // Resolving a root reads its config and sets up its watcher, so a user
+  // with many roots would otherwise wait for each of them in turn before
+  // the first query could be answered.
+  auto numRoots = json_array_size(watched);
+  if (numRoots == 0) {
+    return true;
+  }
+  auto numThreads = size_t(std::clamp(
+      cfg_get_int("state_load_parallelism", 4),
+      json_int_t(1),
+      json_int_t(numRoots)));
+
+  PerfSample sample("state-load");
+  auto loadStart = std::chrono::steady_clock::now();
+  auto sinceStart = [&] {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - loadStart)
+        .count();
+  };
+
+  // One entry per root, each written only by the thread that loads it
+  std::vector<json_ref> timeline(numRoots);
+  std::atomic<size_t> next{0};
+  auto loadRoots = [&] {
+    for (auto i = next++; i < numRoots; i = next++) {
+      const auto& obj = watched.at(i);
+      auto begin = sinceStart();
+      bool watching = load_root_state(obj);
+      timeline[i] = json_object(
+          {{"path", obj.get_default("path", json_null())},
+           {"start_ms", json_real(begin)},
+           {"end_ms", json_real(sinceStart())},
+           {"watching", json_boolean(watching)}});
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < numThreads; ++i) {
+    threads.emplace_back([&, i] {
+      w_set_thread_name("stateload-", i);
+      loadRoots();
+    });
+  }
+  loadRoots();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto roots = json_array_of_size(numRoots);
+  for (auto& entry : timeline) {
+    json_array_append_new(roots, std::move(entry));
+  }
+  sample.add_meta(
+      "state_load",
+      json_object(
+          {{"parallelism", json_integer(numThreads)},
+           {"roots", std::move(roots)}}));
+  sample.finish();
+  sample.force_log();
+  sample.log();
+
   return true;
 }
 
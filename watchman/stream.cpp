@@ -34,6 +34,23 @@ std::unique_ptr<watchman_stream> w_stm_connect(int timeoutms) {
   return nullptr;
 }
 
+int watchman_stream::writev(const struct iovec* iov, int iovcnt) {
+  for (int i = 0; i < iovcnt; ++i) {
+    if (iov[i].iov_len > 0) {
+      return write(iov[i].iov_base, int(iov[i].iov_len));
+    }
+  }
+  return 0;
+}
+
+bool watchman_stream::writeWithDescriptor(
+    const void*,
+    int,
+    const watchman::FileDescriptor&) {
+  errno = ENOTSUP;
+  return false;
+}
+
 int w_poll_events(struct watchman_event_poll* p, int n, int timeoutms) {
 #ifdef _WIN32
   if (!p->evt->isSocket()) {
@@ -150,6 +150,23 @@ class UnixStream : public watchman_stream {
     return fd;
   }
 
+  bool peerHungUp() override {
+    struct pollfd pfd;
+    pfd.fd = fd.system_handle();
+    pfd.events = 0;
+    pfd.revents = 0;
+#ifdef _WIN32
+    if (WSAPoll(&pfd, 1, 0) <= 0) {
+      return false;
+    }
+#else
+    if (poll(&pfd, 1, 0) <= 0) {
+      return false;
+    }
+#endif
+    return (pfd.revents & (POLLERR | POLLHUP)) != 0;
+  }
+
   int read(void* buf, int size) override {
     auto res = fd.read(buf, size);
     if (res.hasError()) {
@@ -219,6 +236,87 @@ class UnixStream : public watchman_stream {
     return x.value();
   }
 
+#ifndef _WIN32
+  int writev(const struct iovec* iov, int iovcnt) override {
+    if (blocking_) {
+      // As in write(), don't wait forever for a peer that isn't reading
+      struct pollfd pfd;
+      pfd.fd = fd.system_handle();
+      pfd.events = POLLOUT;
+      if (poll(&pfd, 1, kWriteTimeout) == 0 ||
+          (pfd.revents & (POLLERR | POLLHUP))) {
+        return -1;
+      }
+    }
+    auto x = ::writev(fd.fd(), iov, iovcnt);
+    if (x < 0) {
+      return -1;
+    }
+    errno = 0;
+    return int(x);
+  }
+
+  bool canPassDescriptors() const override {
+    return fd.fdType() == FileDescriptor::FDType::Socket;
+  }
+
+  bool writeWithDescriptor(
+      const void* buf,
+      int size,
+      const FileDescriptor& pass) override {
+    if (blocking_) {
+      struct pollfd pfd;
+      pfd.fd = fd.system_handle();
+      pfd.events = POLLOUT;
+      if (poll(&pfd, 1, kWriteTimeout) == 0 ||
+          (pfd.revents & (POLLERR | POLLHUP))) {
+        return false;
+      }
+    }
+
+    struct iovec iov {
+      const_cast<void*>(buf), size_t(size)
+    };
+    union {
+      struct cmsghdr hdr;
+      char data[CMSG_SPACE(sizeof(int))];
+    } control{};
+    struct msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    int passFd = pass.fd();
+    memcpy(CMSG_DATA(cmsg), &passFd, sizeof(passFd));
+
+    ssize_t x;
+    do {
+      x = ::sendmsg(fd.fd(), &msg, 0);
+    } while (x < 0 && errno == EINTR);
+    if (x <= 0) {
+      return false;
+    }
+
+    // The descriptor has been sent; the rest is a plain write
+    auto rest = static_cast<const char*>(buf) + x;
+    size -= int(x);
+    while (size > 0) {
+      auto wrote = write(rest, size);
+      if (wrote <= 0) {
+        return false;
+      }
+      rest += wrote;
+      size -= wrote;
+    }
+    errno = 0;
+    return true;
+  }
+#endif
+
   w_evt_t getEvents() override {
     return &evt;
   }
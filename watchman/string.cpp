@@ -141,47 +141,109 @@ bool w_string_piece::pathIsEqual(w_string_piece other) const {
 #endif
 }
 
-w_string_piece w_string_piece::dirName() const {
-  if (e_ == s_) {
+namespace {
+
+#if defined(_WIN32) || !HAVE_MEMRCHR
+constexpr uint64_t kEachByte = 0x0101010101010101ULL;
+constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+// Reads the 8 bytes at p, which needn't be aligned
+inline uint64_t loadWord(const char* p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+// Whether any of the bytes of word is c
+inline bool hasByte(uint64_t word, char c) {
+  auto x = word ^ (kEachByte * uint8_t(c));
+  return ((x - kEachByte) & ~x & kHighBits) != 0;
+}
+
+inline bool hasSlash(uint64_t word) {
+  return hasByte(word, '/')
+#ifdef _WIN32
+      || hasByte(word, '\\')
+#endif
+      ;
+}
+#endif
+
+} // namespace
+
+const char* w_find_first_slash(const char* begin, const char* end) {
+  if (begin == end) {
     return nullptr;
   }
-  for (auto end = e_ - 1; end >= s_; --end) {
-    if (is_slash(*end)) {
-      /* found the end of the parent dir */
-#ifdef _WIN32
-      if (end > s_ && end[-1] == ':') {
-        // Special case for "C:\"; we want to keep the
-        // trailing slash for this case so that we continue
-        // to consider it an absolute path
-        return w_string_piece(s_, 1 + end - s_);
-      }
+#ifndef _WIN32
+  return (const char*)memchr(begin, '/', end - begin);
+#else
+  // Skip the words without either separator, then look for which byte of
+  // the one that has
+  while (end - begin >= 8 && !hasSlash(loadWord(begin))) {
+    begin += 8;
+  }
+  for (; begin < end; ++begin) {
+    if (is_slash(*begin)) {
+      return begin;
+    }
+  }
+  return nullptr;
 #endif
-      return w_string_piece(s_, end - s_);
+}
+
+const char* w_find_last_slash(const char* begin, const char* end) {
+  if (begin == end) {
+    return nullptr;
+  }
+#if !defined(_WIN32) && HAVE_MEMRCHR
+  return (const char*)memrchr(begin, '/', end - begin);
+#else
+  while (end - begin >= 8 && !hasSlash(loadWord(end - 8))) {
+    end -= 8;
+  }
+  while (end > begin) {
+    --end;
+    if (is_slash(*end)) {
+      return end;
     }
   }
   return nullptr;
+#endif
+}
+
+w_string_piece w_string_piece::dirName() const {
+  auto end = w_find_last_slash(s_, e_);
+  if (!end) {
+    return nullptr;
+  }
+  /* found the end of the parent dir */
+#ifdef _WIN32
+  if (end > s_ && end[-1] == ':') {
+    // Special case for "C:\"; we want to keep the
+    // trailing slash for this case so that we continue
+    // to consider it an absolute path
+    return w_string_piece(s_, 1 + end - s_);
+  }
+#endif
+  return w_string_piece(s_, end - s_);
 }
 
 w_string_piece w_string_piece::baseName() const {
-  if (e_ == s_) {
+  auto end = w_find_last_slash(s_, e_);
+  if (!end) {
     return *this;
   }
-  for (auto end = e_ - 1; end >= s_; --end) {
-    if (is_slash(*end)) {
-      /* found the end of the parent dir */
+  /* found the end of the parent dir */
 #ifdef _WIN32
-      if (end == e_ && end > s_ && end[-1] == ':') {
-        // Special case for "C:\"; we want the baseName to
-        // be this same component so that we continue
-        // to consider it an absolute path
-        return *this;
-      }
-#endif
-      return w_string_piece(end + 1, e_ - (end + 1));
-    }
+  if (end == e_ && end > s_ && end[-1] == ':') {
+    // Special case for "C:\"; we want the baseName to
+    // be this same component so that we continue
+    // to consider it an absolute path
+    return *this;
   }
-
-  return *this;
+#endif
+  return w_string_piece(end + 1, e_ - (end + 1));
 }
 
 w_string_piece w_string_piece::suffix() const {
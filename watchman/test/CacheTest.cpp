@@ -142,6 +142,47 @@ TEST(CacheTest, future) {
       << "cache should still be full (no excess) but has " << cache.size();
 }
 
+TEST(CacheTest, sharded) {
+  ShardedLRUCache<int, int> cache(1024, kErrorTTL, 4);
+  EXPECT_EQ(4, cache.numShards());
+
+  for (int i = 0; i < 100; ++i) {
+    int value = i * 2;
+    EXPECT_TRUE(cache.set(i, std::move(value)));
+  }
+  EXPECT_EQ(100, cache.size());
+  for (int i = 0; i < 100; ++i) {
+    auto node = cache.get(i);
+    ASSERT_NE(nullptr, node) << i;
+    EXPECT_EQ(i * 2, node->value());
+  }
+  EXPECT_EQ(nullptr, cache.get(1000));
+
+  auto stats = cache.stats();
+  EXPECT_EQ(100, stats.size);
+  EXPECT_EQ(100, stats.cacheStore);
+  EXPECT_EQ(100, stats.cacheHit);
+  EXPECT_EQ(1, stats.cacheMiss);
+  EXPECT_EQ(101, stats.cacheLoad);
+
+  size_t visited = 0;
+  cache.forEachValue([&](int key, int value) {
+    EXPECT_EQ(key * 2, value);
+    ++visited;
+  });
+  EXPECT_EQ(100, visited);
+
+  EXPECT_TRUE(cache.erase(5));
+  EXPECT_EQ(nullptr, cache.get(5));
+  cache.clear();
+  EXPECT_EQ(0, cache.size());
+  EXPECT_EQ(1, cache.stats().clearCount);
+
+  // Small caches are not split up
+  ShardedLRUCache<int, int> small(10, kErrorTTL, 4);
+  EXPECT_EQ(1, small.numShards());
+}
+
 int main(int argc, char* argv[]) {
   testing::InitGoogleTest(&argc, argv);
   folly::init(&argc, &argv);
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChangeJournal.h"
+#include <folly/FileUtil.h>
+#include <folly/experimental/TestUtil.h>
+#include <folly/portability/GTest.h>
+#include <string>
+#include <vector>
+
+using namespace watchman;
+
+namespace {
+
+struct Recorded {
+  uint32_t ticks;
+  bool exists;
+  std::string name;
+};
+
+std::vector<Recorded> changesSince(ChangeJournal& journal, uint32_t ticks) {
+  std::vector<Recorded> changes;
+  journal.forEachSince(ticks, [&](const ChangeJournal::Change& change) {
+    changes.push_back(
+        Recorded{change.clock.ticks, change.exists, std::string(change.name)});
+  });
+  return changes;
+}
+
+w_string prefixIn(const folly::test::TemporaryDirectory& dir) {
+  return w_string((dir.path() / "journal").string().c_str(), W_STRING_BYTE);
+}
+
+} // namespace
+
+TEST(ChangeJournal, records_nothing_until_begun) {
+  folly::test::TemporaryDirectory dir("wm-journal");
+  ChangeJournal journal(prefixIn(dir), 1024 * 1024);
+
+  journal.append(w_clock_t{2, 100}, true, "crawled");
+  EXPECT_FALSE(journal.isRecording());
+  EXPECT_EQ(UINT32_MAX, journal.coversTicksAfter());
+  EXPECT_TRUE(changesSince(journal, 0).empty());
+
+  journal.begin(5);
+  journal.append(w_clock_t{6, 101}, false, "deleted");
+  EXPECT_TRUE(journal.isRecording());
+  EXPECT_EQ(5, journal.coversTicksAfter());
+
+  auto changes = changesSince(journal, 0);
+  ASSERT_EQ(1, changes.size());
+  EXPECT_EQ(6, changes[0].ticks);
+  EXPECT_FALSE(changes[0].exists);
+  EXPECT_EQ("deleted", changes[0].name);
+}
+
+TEST(ChangeJournal, reports_the_changes_after_a_tick_oldest_first) {
+  folly::test::TemporaryDirectory dir("wm-journal");
+  ChangeJournal journal(prefixIn(dir), 1024 * 1024);
+  journal.begin(1);
+
+  journal.append(w_clock_t{2, 100}, true, "a");
+  journal.append(w_clock_t{3, 100}, true, "dir/b");
+  journal.append(w_clock_t{4, 101}, false, "a");
+
+  auto changes = changesSince(journal, 2);
+  ASSERT_EQ(2, changes.size());
+  EXPECT_EQ(3, changes[0].ticks);
+  EXPECT_EQ("dir/b", changes[0].name);
+  EXPECT_TRUE(changes[0].exists);
+  EXPECT_EQ(4, changes[1].ticks);
+  EXPECT_EQ("a", changes[1].name);
+  EXPECT_FALSE(changes[1].exists);
+
+  EXPECT_TRUE(changesSince(journal, 4).empty());
+  EXPECT_EQ(3, journal.getStats().changes);
+}
+
+TEST(ChangeJournal, discards_the_oldest_changes_to_stay_within_its_size) {
+  folly::test::TemporaryDirectory dir("wm-journal");
+  constexpr uint64_t kMaxBytes = 256 * 1024;
+  ChangeJournal journal(prefixIn(dir), kMaxBytes);
+  journal.begin(0);
+
+  std::string name(64, 'x');
+  uint32_t ticks = 0;
+  for (int i = 0; i < 50000; ++i) {
+    journal.append(w_clock_t{++ticks, 100}, true, name);
+  }
+
+  auto stats = journal.getStats();
+  EXPECT_GT(stats.coversTicksAfter, 0);
+  // The buffered changes may take it over by the size of one write
+  EXPECT_LE(stats.bytes, kMaxBytes + 64 * 1024);
+  EXPECT_GE(stats.bytes, kMaxBytes / 2);
+  EXPECT_LE(stats.segments, 2);
+
+  // Everything after the tick that it covers is still there
+  auto covered = stats.coversTicksAfter;
+  auto changes = changesSince(journal, covered);
+  ASSERT_EQ(ticks - covered, changes.size());
+  for (size_t i = 0; i < changes.size(); ++i) {
+    EXPECT_EQ(covered + 1 + i, changes[i].ticks);
+  }
+}
+
+TEST(ChangeJournal, removes_its_files_when_destroyed) {
+  folly::test::TemporaryDirectory dir("wm-journal");
+  auto segment = (dir.path() / "journal.0").string();
+  std::string contents;
+  {
+    ChangeJournal journal(prefixIn(dir), 1024 * 1024);
+    journal.begin(0);
+    journal.append(w_clock_t{1, 100}, true, "a");
+    EXPECT_EQ(1, changesSince(journal, 0).size());
+    EXPECT_TRUE(folly::readFile(segment.c_str(), contents));
+    EXPECT_FALSE(contents.empty());
+  }
+  EXPECT_FALSE(folly::readFile(segment.c_str(), contents));
+}
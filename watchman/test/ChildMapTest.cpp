@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ChildMap.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using watchman::ChildMap;
+
+namespace {
+
+// The map doesn't own its keys, so keep them alive here.
+std::vector<w_string> makeNames(size_t n) {
+  std::vector<w_string> names;
+  for (size_t i = 0; i < n; ++i) {
+    // Insert in reverse order so that the sorted path has to shift entries
+    names.push_back(w_string::format("name{:04}", n - i));
+  }
+  return names;
+}
+
+} // namespace
+
+TEST(ChildMap, small_map_is_sorted) {
+  auto names = makeNames(5);
+  ChildMap<int> map;
+  for (size_t i = 0; i < names.size(); ++i) {
+    map[names[i]] = int(i);
+  }
+  EXPECT_EQ(5, map.size());
+
+  w_string_piece prior;
+  for (auto& it : map) {
+    EXPECT_TRUE(prior < it.first);
+    prior = it.first;
+  }
+
+  auto it = map.find(w_string_piece("name0003"));
+  ASSERT_NE(map.end(), it);
+  EXPECT_EQ(2, it->second);
+  EXPECT_EQ(map.end(), map.find(w_string_piece("missing")));
+
+  EXPECT_EQ(1, map.erase(w_string_piece("name0003")));
+  EXPECT_EQ(0, map.erase(w_string_piece("name0003")));
+  EXPECT_EQ(4, map.size());
+}
+
+TEST(ChildMap, grows_into_hash_index_and_back) {
+  auto names = makeNames(ChildMap<int>::kMaxSorted * 4);
+  ChildMap<int> map;
+  for (size_t i = 0; i < names.size(); ++i) {
+    map[names[i]] = int(i);
+  }
+  EXPECT_EQ(names.size(), map.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    auto it = map.find(names[i]);
+    ASSERT_NE(map.end(), it) << names[i];
+    EXPECT_EQ(int(i), it->second);
+  }
+
+  // operator[] doesn't duplicate existing entries once indexed
+  map[names[0]] = 42;
+  EXPECT_EQ(names.size(), map.size());
+  EXPECT_EQ(42, map.find(names[0])->second);
+
+  std::vector<std::string> ordered;
+  map.forEachInOrder([&](w_string_piece name, int) {
+    ordered.push_back(name.string());
+  });
+  EXPECT_TRUE(std::is_sorted(ordered.begin(), ordered.end()));
+  EXPECT_EQ(names.size(), ordered.size());
+
+  // Shrink back down below the threshold; lookups must remain correct
+  // and iteration order must be sorted again.
+  for (size_t i = 0; i < names.size() - 3; ++i) {
+    EXPECT_EQ(1, map.erase(names[i]));
+  }
+  EXPECT_EQ(3, map.size());
+  for (size_t i = names.size() - 3; i < names.size(); ++i) {
+    ASSERT_NE(map.end(), map.find(names[i]));
+    EXPECT_EQ(int(i), map.find(names[i])->second);
+  }
+  w_string_piece prior;
+  for (auto& it : map) {
+    EXPECT_TRUE(prior < it.first);
+    prior = it.first;
+  }
+}
+
+TEST(ChildMap, caseless_lookup_finds_every_spelling) {
+  for (size_t size : {size_t(4), ChildMap<int>::kMaxSorted * 4}) {
+    auto names = makeNames(size);
+    names.push_back(w_string("Name0001"));
+    names.push_back(w_string("NAME0001"));
+    ChildMap<int> map;
+    for (size_t i = 0; i < names.size(); ++i) {
+      map[names[i]] = int(i);
+    }
+
+    std::vector<std::string> found;
+    map.forEachCaseless(
+        w_string_piece("nAmE0001"),
+        [&](w_string_piece name, int) { found.push_back(name.string()); });
+    std::sort(found.begin(), found.end());
+    EXPECT_EQ(
+        (std::vector<std::string>{"NAME0001", "Name0001", "name0001"}), found)
+        << size;
+
+    found.clear();
+    map.forEachCaseless(
+        w_string_piece("name00011"),
+        [&](w_string_piece name, int) { found.push_back(name.string()); });
+    EXPECT_TRUE(found.empty()) << size;
+
+    // Exact lookups still tell the spellings apart
+    EXPECT_EQ(
+        int(names.size() - 1), map.find(w_string_piece("NAME0001"))->second);
+  }
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CompactFileInformation.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+namespace {
+
+FileInformation makeInfo() {
+  FileInformation info;
+#ifndef _WIN32
+  info.mode = S_IFREG | 0644;
+#endif
+  info.size = 1234;
+  info.ino = 42;
+  info.nlink = 2;
+  info.dev = 7;
+  info.uid = 1000;
+  info.gid = 100;
+  info.mtime.tv_sec = 1600000000;
+  info.mtime.tv_nsec = 123456789;
+  info.ctime.tv_sec = 1600000001;
+  info.ctime.tv_nsec = 987654321;
+  return info;
+}
+
+} // namespace
+
+TEST(CompactFileInformation, expands_to_what_it_was_made_from) {
+  auto info = makeInfo();
+  auto expanded = CompactFileInformation{info}.expand();
+
+  EXPECT_EQ(info.mode, expanded.mode);
+  EXPECT_EQ(info.size, expanded.size);
+  EXPECT_EQ(info.ino, expanded.ino);
+  EXPECT_EQ(info.nlink, expanded.nlink);
+  EXPECT_EQ(info.dev, expanded.dev);
+  EXPECT_EQ(info.uid, expanded.uid);
+  EXPECT_EQ(info.gid, expanded.gid);
+  EXPECT_EQ(info.mtime.tv_sec, expanded.mtime.tv_sec);
+  EXPECT_EQ(info.mtime.tv_nsec, expanded.mtime.tv_nsec);
+  EXPECT_EQ(info.ctime.tv_sec, expanded.ctime.tv_sec);
+  EXPECT_EQ(info.ctime.tv_nsec, expanded.ctime.tv_nsec);
+  EXPECT_EQ(0, expanded.atime.tv_sec);
+}
+
+TEST(CompactFileInformation, shares_owners) {
+  auto info = makeInfo();
+  CompactFileInformation a{info};
+  info.ino = 43;
+  CompactFileInformation b{info};
+  EXPECT_EQ(a.owner, b.owner);
+
+  info.uid = 1001;
+  CompactFileInformation c{info};
+  EXPECT_NE(a.owner, c.owner);
+  EXPECT_EQ(1001, c.expand().uid);
+  // An earlier owner still expands correctly after a new one is added
+  EXPECT_EQ(1000, a.expand().uid);
+
+  EXPECT_EQ(0, CompactFileInformation{FileInformation{}}.owner);
+}
+
+TEST(CompactFileInformation, keeps_times_before_the_epoch) {
+  struct timespec ts;
+  ts.tv_sec = -2;
+  ts.tv_nsec = 250000000;
+  auto ns = CompactFileInformation::timespecToNs(ts);
+  EXPECT_EQ(-1750000000, ns);
+
+  auto back = CompactFileInformation::nsToTimespec(ns);
+  EXPECT_EQ(-2, back.tv_sec);
+  EXPECT_EQ(250000000, back.tv_nsec);
+}
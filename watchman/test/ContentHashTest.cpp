@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ContentHash.h"
+#include <folly/FileUtil.h>
+#include <folly/experimental/TestUtil.h>
+#include <folly/portability/GTest.h>
+#include <chrono>
+#include "watchman/fs/FileSystem.h"
+
+namespace {
+
+using namespace watchman;
+
+const std::chrono::milliseconds kErrorTTL{1000};
+
+TEST(ContentHashCacheTest, round_trip_preserves_hashes) {
+  folly::test::TemporaryDirectory dir("wm-hash");
+  auto root = w_string(dir.path().string().c_str(), W_STRING_BYTE);
+  folly::writeFile(std::string("hello"), (dir.path() / "a").string().c_str());
+
+  ContentHashCache original(root, 10, kErrorTTL);
+  struct stat st;
+  ASSERT_EQ(0, lstat((dir.path() / "a").string().c_str(), &st));
+  ContentHashCacheKey key{
+      w_string("a", W_STRING_BYTE), size_t(st.st_size), st.st_mtim};
+  auto expected = original.get(key).get()->value();
+
+  ContentHashCache restored(root, 10, kErrorTTL);
+  EXPECT_EQ(1, restored.deserialize(original.serialize()));
+  EXPECT_EQ(expected, restored.get(key).get()->value());
+  auto stats = restored.stats();
+  EXPECT_EQ(1, stats.cacheHit);
+  EXPECT_EQ(0, stats.cacheMiss);
+}
+
+TEST(ContentHashCacheTest, rejects_malformed_data) {
+  ContentHashCache cache(w_string("/root"), 10, kErrorTTL);
+  EXPECT_THROW(cache.deserialize("nonsense"), std::runtime_error);
+
+  std::string data =
+      ContentHashCache(w_string("/root"), 10, kErrorTTL).serialize();
+  data.append("\x05\x00\x00\x00", 4);
+  EXPECT_THROW(cache.deserialize(data), std::runtime_error);
+}
+
+TEST(ContentHashCacheTest, missing_file_loads_nothing) {
+  folly::test::TemporaryDirectory dir("wm-hash");
+  ContentHashCache cache(w_string("/root"), 10, kErrorTTL);
+  auto path =
+      w_string((dir.path() / "missing").string().c_str(), W_STRING_BYTE);
+  EXPECT_EQ(0, cache.load(path));
+
+  cache.save(path);
+  EXPECT_EQ(0, cache.load(path));
+}
+
+TEST(ContentHashCacheTest, fingerprints_sample_large_files) {
+  folly::test::TemporaryDirectory dir("wm-hash");
+  auto path = (dir.path() / "big").string();
+  std::string content(1024 * 1024, 'a');
+  folly::writeFile(content, path.c_str());
+  auto st = getFileInformation(path.c_str());
+  auto fingerprint = [&](const FileInformation& info) {
+    return ContentHashCache::computeFingerprintImmediate(path.c_str(), info);
+  };
+  auto original = fingerprint(st);
+  EXPECT_EQ(original, fingerprint(st));
+
+  // Bytes between the sampled blocks aren't looked at
+  content[ContentHashCache::kFingerprintBlockSize + 1] = 'b';
+  folly::writeFile(content, path.c_str());
+  EXPECT_EQ(original, fingerprint(st));
+
+  // but the first, middle and last blocks are
+  for (size_t offset : {size_t(0), content.size() / 2, content.size() - 1}) {
+    content[offset] = 'c';
+    folly::writeFile(content, path.c_str());
+    auto changed = fingerprint(st);
+    EXPECT_NE(original, changed);
+    content[offset] = 'a';
+  }
+
+  // as is the metadata
+  folly::writeFile(content, path.c_str());
+  auto touched = st;
+  touched.mtime.tv_sec += 1;
+  EXPECT_NE(fingerprint(st), fingerprint(touched));
+}
+
+TEST(ContentHashCacheTest, fingerprints_all_of_small_files) {
+  folly::test::TemporaryDirectory dir("wm-hash");
+  auto path = (dir.path() / "small").string();
+  std::string content(3 * ContentHashCache::kFingerprintBlockSize, 'a');
+  folly::writeFile(content, path.c_str());
+  auto st = getFileInformation(path.c_str());
+  auto fingerprint = [&] {
+    return ContentHashCache::computeFingerprintImmediate(path.c_str(), st);
+  };
+  auto original = fingerprint();
+
+  content[ContentHashCache::kFingerprintBlockSize + 1] = 'b';
+  folly::writeFile(content, path.c_str());
+  EXPECT_NE(original, fingerprint());
+}
+
+} // namespace
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CookieSync.h"
+#include <folly/portability/GTest.h>
+#include "watchman/test/lib/FakeFileSystem.h"
+
+using namespace watchman;
+
+namespace {
+
+class CookieSyncTest : public testing::Test {
+ public:
+  FakeFileSystem fs;
+  CookieSync cookies{fs, "/root"};
+
+  CookieSyncTest() {
+    fs.defineContents({"/root/"});
+  }
+
+  w_string onlyOutstandingCookie() {
+    auto outstanding = cookies.getOutstandingCookieFileList();
+    EXPECT_EQ(1, outstanding.size());
+    return outstanding.empty() ? w_string{} : outstanding.front();
+  }
+};
+
+} // namespace
+
+TEST_F(CookieSyncTest, syncs_wait_for_their_cookie) {
+  auto sync = cookies.sync();
+  auto cookie = onlyOutstandingCookie();
+  EXPECT_FALSE(sync.isReady());
+
+  cookies.notifyCookie(cookie);
+  ASSERT_TRUE(sync.isReady());
+  EXPECT_EQ(
+      std::vector<w_string>{cookie}, std::move(sync).get().cookieFileNames);
+  EXPECT_TRUE(cookies.getOutstandingCookieFileList().empty());
+}
+
+TEST_F(CookieSyncTest, syncs_behind_a_cookie_in_flight_share_the_next_one) {
+  auto first = cookies.sync();
+  auto firstCookie = onlyOutstandingCookie();
+
+  // These arrive after the first cookie was touched, so it can't tell them
+  // anything; they wait for it and then share a single cookie
+  auto second = cookies.sync();
+  auto third = cookies.sync();
+  EXPECT_EQ(firstCookie, onlyOutstandingCookie());
+
+  cookies.notifyCookie(firstCookie);
+  EXPECT_TRUE(first.isReady());
+  EXPECT_FALSE(second.isReady());
+  EXPECT_FALSE(third.isReady());
+
+  auto batchCookie = onlyOutstandingCookie();
+  EXPECT_NE(firstCookie, batchCookie);
+
+  cookies.notifyCookie(batchCookie);
+  ASSERT_TRUE(second.isReady());
+  ASSERT_TRUE(third.isReady());
+  EXPECT_EQ(
+      std::vector<w_string>{batchCookie},
+      std::move(second).get().cookieFileNames);
+  EXPECT_EQ(
+      std::vector<w_string>{batchCookie},
+      std::move(third).get().cookieFileNames);
+  EXPECT_TRUE(cookies.getOutstandingCookieFileList().empty());
+}
+
+TEST_F(CookieSyncTest, aborting_writes_the_batched_cookie) {
+  auto first = cookies.sync();
+  auto second = cookies.sync();
+
+  cookies.abortAllCookies();
+  ASSERT_TRUE(first.isReady());
+  EXPECT_TRUE(first.result().hasException<CookieSyncAborted>());
+
+  // The batch is still owed a cookie of its own
+  EXPECT_FALSE(second.isReady());
+  cookies.notifyCookie(onlyOutstandingCookie());
+  ASSERT_TRUE(second.isReady());
+  EXPECT_TRUE(second.hasValue());
+}
+
+TEST_F(CookieSyncTest, scoped_syncs_only_write_the_covering_cookie_dirs) {
+  fs.defineContents({"/root/a/", "/root/b/"});
+  cookies.addCookieDir("/root/a");
+  cookies.addCookieDir("/root/b");
+
+  using Dirs = std::unordered_set<w_string>;
+  EXPECT_EQ(
+      (Dirs{"/root/a"}), cookies.cookieDirsForScopes({"/root/a/x/y"}));
+  EXPECT_EQ((Dirs{"/root"}), cookies.cookieDirsForScopes({"/root/c"}));
+  EXPECT_EQ(
+      (Dirs{"/root/a", "/root/b"}),
+      cookies.cookieDirsForScopes({"/root/a", "/root/b/z"}));
+  // Dirs beneath the scope see some of its changes too
+  EXPECT_EQ(
+      (Dirs{"/root", "/root/a", "/root/b"}),
+      cookies.cookieDirsForScopes({"/root"}));
+  EXPECT_EQ(
+      (Dirs{"/root", "/root/a", "/root/b"}), cookies.cookieDirsForScopes({}));
+
+  auto sync = cookies.sync("/root/a/x");
+  auto cookie = onlyOutstandingCookie();
+  EXPECT_TRUE(w_string_piece(cookie).startsWith("/root/a/"));
+  cookies.notifyCookie(cookie);
+  EXPECT_TRUE(sync.isReady());
+}
@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Benchmarks for the hot paths that don't need a watched root: pending
+// change consolidation, ignore matching, path splitting, string hashing and
+// PDU encoding.
+// Run with eg:
+//   watchman_bench --depth=6 --fanout=4 --files=16
+
+#include <folly/Benchmark.h>
+#include <folly/init/Init.h>
+#include <folly/portability/GFlags.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include "watchman/IgnoreSet.h"
+#include "watchman/PendingCollection.h"
+#include "watchman/bser.h"
+#include "watchman/query/GlobSet.h"
+#include "watchman/watchman_hash.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+#include "watchman/thirdparty/libart/src/art.h"
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+DEFINE_int32(depth, 5, "depth of the synthetic directory tree");
+DEFINE_int32(fanout, 4, "number of subdirectories in each directory");
+DEFINE_int32(files, 8, "number of files in each directory");
+DEFINE_string(
+    wildmatch_cases,
+    "watchman/test/wildmatch_test.json",
+    "the wildmatch test cases, to time matching them");
+
+using namespace watchman;
+
+namespace {
+
+struct SyntheticPath {
+  w_string path;
+  bool isDir;
+};
+
+void buildTree(
+    std::vector<SyntheticPath>& paths,
+    const w_string& parent,
+    int depth) {
+  for (int i = 0; i < FLAGS_files; ++i) {
+    paths.push_back(
+        {w_string::build(parent.view(), "/file", i, ".cpp"), false});
+  }
+  for (int i = 0; i < FLAGS_fanout; ++i) {
+    // Each directory with enough children has a build output dir, so that
+    // the ignore benchmark has a realistic mix of matches and misses.
+    auto dir = i == 3 ? w_string::build(parent.view(), "/buck-out")
+                          : w_string::build(parent.view(), "/dir", i);
+    paths.push_back({dir, true});
+    if (depth > 1) {
+      buildTree(paths, dir, depth - 1);
+    }
+  }
+}
+
+// Top-down order, as produced by a crawl
+const std::vector<SyntheticPath>& syntheticTree() {
+  static auto* paths = [] {
+    auto* paths = new std::vector<SyntheticPath>;
+    buildTree(*paths, w_string("/some/root", W_STRING_BYTE), FLAGS_depth);
+    return paths;
+  }();
+  return *paths;
+}
+
+// The tree as a query result, with the fields most commonly requested
+const json_ref& syntheticResults() {
+  static auto* results = [] {
+    auto* results = new json_ref(json_array());
+    for (auto& entry : syntheticTree()) {
+      json_array_append_new(
+          *results,
+          json_object(
+              {{"name", w_string_to_json(entry.path)},
+               {"exists", json_true()},
+               {"new", json_false()},
+               {"size", json_integer(entry.path.size() * 37)},
+               {"mtime_ms", json_integer(1600000000000)},
+               {"type",
+                typed_string_to_json(
+                    entry.isDir ? "d" : "f", W_STRING_UNICODE)}}));
+    }
+    return results;
+  }();
+  return *results;
+}
+
+void addAll(
+    size_t iters,
+    bool bottomUp,
+    const std::function<PendingFlags(const SyntheticPath&)>& flagsFor) {
+  const auto& paths = syntheticTree();
+  auto now = std::chrono::system_clock::now();
+  for (size_t n = 0; n < iters; ++n) {
+    PendingChanges coll;
+    if (bottomUp) {
+      for (auto it = paths.rbegin(); it != paths.rend(); ++it) {
+        coll.add(it->path, now, flagsFor(*it));
+      }
+    } else {
+      for (auto& entry : paths) {
+        coll.add(entry.path, now, flagsFor(entry));
+      }
+    }
+    folly::doNotOptimizeAway(coll.stealItems());
+  }
+}
+
+PendingFlags crawlFlags(const SyntheticPath& entry) {
+  return entry.isDir ? W_PENDING_RECURSIVE : W_PENDING_VIA_NOTIFY;
+}
+
+PendingFlags notifyFlags(const SyntheticPath&) {
+  return W_PENDING_VIA_NOTIFY;
+}
+
+int appendToString(const char* buffer, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buffer, size);
+  return 0;
+}
+
+int discard(const char*, size_t, void*) {
+  return 0;
+}
+
+// Hash the strings that the view hashes most: the full path of each
+// entry, as in resolveDir and the query dedup set, or just the basename,
+// as in the child maps of each dir.
+void hashAll(
+    size_t iters,
+    bool baseNames,
+    uint32_t (*hash)(const void*, size_t, uint32_t)) {
+  std::vector<w_string_piece> pieces;
+  BENCHMARK_SUSPEND {
+    for (auto& entry : syntheticTree()) {
+      auto path = w_string_piece(entry.path);
+      pieces.push_back(baseNames ? path.baseName() : path);
+    }
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    uint32_t result = 0;
+    for (auto& piece : pieces) {
+      result ^= hash(piece.data(), piece.size(), 0);
+    }
+    folly::doNotOptimizeAway(result);
+  }
+}
+
+struct WildmatchCase {
+  int flags;
+  std::string text;
+  std::string pattern;
+};
+
+const std::vector<WildmatchCase>& wildmatchCases() {
+  static auto* cases = [] {
+    auto* cases = new std::vector<WildmatchCase>;
+    auto json = json_load_file(FLAGS_wildmatch_cases.c_str(), 0);
+    for (auto& entry : json.array()) {
+      cases->push_back(
+          {int(entry.at(1).asInt()),
+           json_string_value(entry.at(2)),
+           json_string_value(entry.at(3))});
+    }
+    return cases;
+  }();
+  return *cases;
+}
+
+// Match the basename of each synthetic path, as the match term does
+void matchBaseNames(size_t iters, const char* pattern, bool useGlobSet) {
+  std::vector<std::string> names;
+  GlobSet set{WM_PERIOD};
+  BENCHMARK_SUSPEND {
+    for (auto& entry : syntheticTree()) {
+      names.emplace_back(w_string_piece(entry.path).baseName().view());
+    }
+    set.add(pattern, 0);
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    size_t matched = 0;
+    for (auto& name : names) {
+      matched += useGlobSet
+          ? set.matchesAny(name)
+          : wildmatch(pattern, name.c_str(), WM_PERIOD, nullptr) == WM_MATCH;
+    }
+    folly::doNotOptimizeAway(matched);
+  }
+}
+
+} // namespace
+
+BENCHMARK(pending_add_top_down, iters) {
+  addAll(iters, false, crawlFlags);
+}
+
+BENCHMARK_RELATIVE(pending_add_bottom_up, iters) {
+  addAll(iters, true, crawlFlags);
+}
+
+BENCHMARK_RELATIVE(pending_add_notify_only, iters) {
+  addAll(iters, false, notifyFlags);
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(ignore_is_ignored, iters) {
+  IgnoreSet ignore;
+  std::vector<std::string> paths;
+  BENCHMARK_SUSPEND {
+    ignore.add(w_string("/some/root/.hg", W_STRING_BYTE), true);
+    ignore.add(w_string("/some/root/dir0/buck-out", W_STRING_BYTE), false);
+    ignore.add(w_string("/some/root/dir1/buck-out", W_STRING_BYTE), false);
+    for (auto& entry : syntheticTree()) {
+      paths.push_back(entry.path.string());
+    }
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto& path : paths) {
+      folly::doNotOptimizeAway(
+          ignore.isIgnored(path.data(), uint32_t(path.size())));
+    }
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(art_search, iters) {
+  art_tree<int, w_string> tree;
+  BENCHMARK_SUSPEND {
+    for (auto& entry : syntheticTree()) {
+      tree.insert(entry.path, 1);
+    }
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto& entry : syntheticTree()) {
+      folly::doNotOptimizeAway(tree.search(entry.path));
+    }
+  }
+}
+
+BENCHMARK_RELATIVE(art_path_prefixes, iters) {
+  art_tree<int, w_string> tree;
+  BENCHMARK_SUSPEND {
+    for (auto& entry : syntheticTree()) {
+      if (entry.isDir) {
+        tree.insert(entry.path, 1);
+      }
+    }
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto& entry : syntheticTree()) {
+      int found = 0;
+      tree.iterPathPrefixes(
+          (const unsigned char*)entry.path.data(),
+          uint32_t(entry.path.size()),
+          [](unsigned char c) { return c == '/'; },
+          [&](const w_string&, int& value) {
+            found += value;
+            return 0;
+          });
+      folly::doNotOptimizeAway(found);
+    }
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(wildmatch_test_cases, iters) {
+  const auto& cases = wildmatchCases();
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto& c : cases) {
+      folly::doNotOptimizeAway(wildmatch(
+          c.pattern.c_str(), c.text.c_str(), c.flags, nullptr));
+    }
+  }
+}
+
+BENCHMARK_RELATIVE(globset_test_cases, iters) {
+  const auto& cases = wildmatchCases();
+  std::vector<GlobSet> sets;
+  BENCHMARK_SUSPEND {
+    for (auto& c : cases) {
+      sets.emplace_back(c.flags);
+      sets.back().add(c.pattern, 0);
+    }
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    for (size_t i = 0; i < cases.size(); ++i) {
+      folly::doNotOptimizeAway(sets[i].matchesAny(cases[i].text));
+    }
+  }
+}
+
+BENCHMARK(wildmatch_extension, iters) {
+  matchBaseNames(iters, "*.cpp", false);
+}
+
+BENCHMARK_RELATIVE(globset_extension, iters) {
+  matchBaseNames(iters, "*.cpp", true);
+}
+
+BENCHMARK(wildmatch_prefix, iters) {
+  matchBaseNames(iters, "file1*", false);
+}
+
+BENCHMARK_RELATIVE(globset_prefix, iters) {
+  matchBaseNames(iters, "file1*", true);
+}
+
+BENCHMARK(wildmatch_contains, iters) {
+  matchBaseNames(iters, "*ile*", false);
+}
+
+BENCHMARK_RELATIVE(globset_contains, iters) {
+  matchBaseNames(iters, "*ile*", true);
+}
+
+BENCHMARK_DRAW_LINE();
+
+namespace {
+// The byte at a time search that dirName and baseName used to make, as the
+// baseline for w_find_last_slash
+const char* findLastSlashBytewise(const char* begin, const char* end) {
+  for (auto it = end; it > begin;) {
+    --it;
+    if (is_slash(*it)) {
+      return it;
+    }
+  }
+  return nullptr;
+}
+} // namespace
+
+BENCHMARK(last_slash_bytewise, iters) {
+  const auto& paths = syntheticTree();
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto& entry : paths) {
+      auto path = entry.path.piece();
+      folly::doNotOptimizeAway(
+          findLastSlashBytewise(path.data(), path.data() + path.size()));
+    }
+  }
+}
+
+BENCHMARK_RELATIVE(last_slash, iters) {
+  const auto& paths = syntheticTree();
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto& entry : paths) {
+      auto path = entry.path.piece();
+      folly::doNotOptimizeAway(
+          w_find_last_slash(path.data(), path.data() + path.size()));
+    }
+  }
+}
+
+BENCHMARK(split_path, iters) {
+  const auto& paths = syntheticTree();
+  std::vector<w_string_piece> components;
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto& entry : paths) {
+      components.clear();
+      entry.path.piece().split(components, '/');
+      folly::doNotOptimizeAway(components.size());
+    }
+  }
+}
+
+BENCHMARK_RELATIVE(path_components, iters) {
+  const auto& paths = syntheticTree();
+  for (size_t n = 0; n < iters; ++n) {
+    for (auto& entry : paths) {
+      size_t count = 0;
+      for (auto component : entry.path.piece().pathComponents()) {
+        count += component.size();
+      }
+      folly::doNotOptimizeAway(count);
+    }
+  }
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(hash_paths_lookup3, iters) {
+  hashAll(iters, false, w_hash_bytes_lookup3);
+}
+
+BENCHMARK_RELATIVE(hash_paths, iters) {
+  hashAll(iters, false, w_hash_bytes);
+}
+
+BENCHMARK(hash_basenames_lookup3, iters) {
+  hashAll(iters, true, w_hash_bytes_lookup3);
+}
+
+BENCHMARK_RELATIVE(hash_basenames, iters) {
+  hashAll(iters, true, w_hash_bytes);
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(encode_json, iters) {
+  const auto& results = syntheticResults();
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(json_dumps(results, JSON_COMPACT));
+  }
+}
+
+BENCHMARK_RELATIVE(encode_bser_v1, iters) {
+  const auto& results = syntheticResults();
+  bser_ctx_t ctx{1, 0, appendToString};
+  for (size_t n = 0; n < iters; ++n) {
+    std::string encoded;
+    w_bser_dump(&ctx, results, &encoded);
+    folly::doNotOptimizeAway(encoded);
+  }
+}
+
+BENCHMARK_RELATIVE(encode_bser_v2, iters) {
+  const auto& results = syntheticResults();
+  bser_ctx_t ctx{2, 0, appendToString};
+  for (size_t n = 0; n < iters; ++n) {
+    std::string encoded;
+    w_bser_dump(&ctx, results, &encoded);
+    folly::doNotOptimizeAway(encoded);
+  }
+}
+
+BENCHMARK_RELATIVE(encode_bser_v2_discard, iters) {
+  const auto& results = syntheticResults();
+  bser_ctx_t ctx{2, 0, discard};
+  for (size_t n = 0; n < iters; ++n) {
+    folly::doNotOptimizeAway(w_bser_dump(&ctx, results, nullptr));
+  }
+}
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  // Build the inputs up front so that they aren't part of the first timing
+  syntheticResults();
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/CrawlScheduler.h"
+#include <folly/portability/GTest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+CrawlScheduler::Priority priority(int value) {
+  return [value] { return value; };
+}
+
+std::string stateOf(const CrawlScheduler& scheduler, const char* name) {
+  return std::string{scheduler.getStatus(name).get("state").asString().view()};
+}
+
+json_int_t waiting(const CrawlScheduler& scheduler) {
+  return scheduler.getSummary().get("waiting").asInt();
+}
+
+void waitForWaiting(const CrawlScheduler& scheduler, json_int_t count) {
+  auto deadline = std::chrono::steady_clock::now() + 10s;
+  while (waiting(scheduler) != count &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+  ASSERT_EQ(count, waiting(scheduler));
+}
+
+} // namespace
+
+TEST(CrawlScheduler, limits_the_crawls_running_at_once) {
+  CrawlScheduler scheduler;
+  scheduler.setOptions(CrawlScheduler::Options{1});
+  auto first = scheduler.acquire("/a", priority(1));
+  ASSERT_TRUE(first);
+
+  std::atomic<bool> started{false};
+  std::thread second([&] {
+    auto slot = scheduler.acquire("/b", priority(1));
+    started = true;
+  });
+  waitForWaiting(scheduler, 1);
+  EXPECT_FALSE(started);
+  EXPECT_EQ("waiting", stateOf(scheduler, "/b"));
+  EXPECT_EQ("crawling", stateOf(scheduler, "/a"));
+  first.setProgress(42);
+  EXPECT_EQ(42, scheduler.getStatus("/a").get("items").asInt());
+
+  first = CrawlScheduler::Slot();
+  second.join();
+  EXPECT_TRUE(started);
+  EXPECT_TRUE(scheduler.getStatus("/a").isNull());
+}
+
+TEST(CrawlScheduler, the_most_important_root_goes_first) {
+  CrawlScheduler scheduler;
+  scheduler.setOptions(CrawlScheduler::Options{1});
+  auto first = scheduler.acquire("/first", priority(1));
+
+  std::mutex mutex;
+  std::vector<std::string> order;
+  std::vector<std::thread> threads;
+  auto crawl = [&](std::string name, int value) {
+    threads.emplace_back([&, name, value] {
+      auto slot = scheduler.acquire(name, priority(value));
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(name);
+    });
+  };
+  crawl("/idle", 1);
+  waitForWaiting(scheduler, 1);
+  crawl("/queried", 3);
+  waitForWaiting(scheduler, 2);
+  crawl("/also-idle", 1);
+  waitForWaiting(scheduler, 3);
+
+  first = CrawlScheduler::Slot();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(
+      (std::vector<std::string>{"/queried", "/idle", "/also-idle"}), order);
+}
+
+TEST(CrawlScheduler, background_crawls_run_one_at_a_time) {
+  CrawlScheduler scheduler;
+  scheduler.setOptions(CrawlScheduler::Options{4});
+  auto background = scheduler.acquire("/background", priority(0));
+  EXPECT_TRUE(scheduler.getStatus("/background").get("background").asBool());
+
+  std::atomic<bool> started{false};
+  std::thread other([&] {
+    auto slot = scheduler.acquire("/other-background", priority(0));
+    started = true;
+  });
+  waitForWaiting(scheduler, 1);
+
+  // Crawls that matter don't wait for the background ones
+  auto active = scheduler.acquire("/active", priority(1));
+  EXPECT_TRUE(active);
+  EXPECT_FALSE(started);
+
+  background = CrawlScheduler::Slot();
+  other.join();
+  EXPECT_TRUE(started);
+}
+
+TEST(CrawlScheduler, waiting_crawls_can_be_stopped) {
+  CrawlScheduler scheduler;
+  scheduler.setOptions(CrawlScheduler::Options{1});
+  auto first = scheduler.acquire("/a", priority(1));
+
+  std::atomic<bool> stop{false};
+  std::atomic<bool> gotSlot{true};
+  std::thread second([&] {
+    auto slot = scheduler.acquire(
+        "/b", priority(1), [&] { return stop.load(); });
+    gotSlot = bool(slot);
+  });
+  waitForWaiting(scheduler, 1);
+
+  stop = true;
+  scheduler.wake();
+  second.join();
+  EXPECT_FALSE(gotSlot);
+  EXPECT_EQ(0, waiting(scheduler));
+}
+
+TEST(CrawlScheduler, zero_is_unlimited) {
+  CrawlScheduler scheduler;
+  std::vector<CrawlScheduler::Slot> slots;
+  scheduler.setOptions(CrawlScheduler::Options{0});
+  for (int i = 0; i < 10; ++i) {
+    slots.push_back(scheduler.acquire(std::to_string(i), priority(1)));
+  }
+  EXPECT_EQ(10, scheduler.getSummary().get("running").asInt());
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/fs/FSProfile.h"
+#include <folly/ScopeGuard.h>
+#include <folly/portability/GTest.h>
+#include "watchman/WatchmanConfig.h"
+
+using namespace watchman;
+
+TEST(FSProfile, builtin_profiles) {
+  EXPECT_FALSE(getBuiltinFSTypeProfile("unknown"));
+  EXPECT_FALSE(getBuiltinFSTypeProfile("edenfs"));
+
+  auto ext4 = getBuiltinFSTypeProfile("ext4");
+  ASSERT_TRUE(ext4);
+  EXPECT_LT(1, ext4.get("crawl_stat_parallelism").asInt());
+
+  auto nfs = getBuiltinFSTypeProfile("nfs");
+  ASSERT_TRUE(nfs);
+  EXPECT_EQ(w_string("poll"), json_to_w_string(nfs.get("watcher")));
+  EXPECT_FALSE(nfs.get("trust_dir_change_times").asBool());
+
+  auto sshfs = getBuiltinFSTypeProfile("fuse.sshfs");
+  ASSERT_TRUE(sshfs);
+  EXPECT_FALSE(sshfs.get("trust_dir_change_times").asBool());
+}
+
+TEST(FSProfile, profile_is_consulted_last) {
+  auto profile = json_object(
+      {{"settle", json_integer(100)},
+       {"crawl_stat_parallelism", json_integer(4)}});
+  Configuration config{json_object({{"settle", json_integer(5)}}), profile};
+
+  EXPECT_EQ(5, config.getInt("settle", 20));
+  EXPECT_EQ(4, config.getInt("crawl_stat_parallelism", 1));
+  EXPECT_EQ(7, config.getInt("change_stat_parallelism", 7));
+
+  cfg_set_arg("crawl_stat_parallelism", json_integer(2));
+  SCOPE_EXIT {
+    cfg_shutdown();
+  };
+  EXPECT_EQ(2, config.getInt("crawl_stat_parallelism", 1));
+}
+
+TEST(FSProfile, global_config_replaces_builtin_profiles) {
+  cfg_set_arg(
+      "fstype_profiles",
+      json_object(
+          {{"ext4", json_object()},
+           {"fuse", json_object({{"settle", json_integer(300)}})}}));
+  SCOPE_EXIT {
+    cfg_shutdown();
+  };
+
+  EXPECT_FALSE(getFSTypeProfile(w_string("ext4")));
+  EXPECT_TRUE(getFSTypeProfile(w_string("xfs")));
+
+  auto sshfs = getFSTypeProfile(w_string("fuse.sshfs"));
+  ASSERT_TRUE(sshfs);
+  EXPECT_EQ(300, sshfs.get("settle").asInt());
+  EXPECT_FALSE(sshfs.get_default("trust_dir_change_times"));
+}
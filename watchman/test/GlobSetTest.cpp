@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/GlobSet.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "watchman/thirdparty/wildmatch/wildmatch.h"
+
+using namespace watchman;
+
+namespace {
+
+std::vector<size_t> matching(const GlobSet& set, const char* subject) {
+  std::vector<size_t> ids;
+  set.forEachMatch(subject, [&](size_t id) {
+    ids.push_back(id);
+    return true;
+  });
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+} // namespace
+
+TEST(GlobSet, reports_every_matching_pattern) {
+  GlobSet set;
+  set.add("*.js", 0);
+  set.add("index.js", 1);
+  set.add("*.ts", 2);
+  set.add("in*", 3);
+  set.add("*x.js", 4);
+  set.add("Makefile", 5);
+
+  EXPECT_EQ(matching(set, "index.js"), (std::vector<size_t>{0, 1, 3, 4}));
+  EXPECT_EQ(matching(set, "a.ts"), (std::vector<size_t>{2}));
+  EXPECT_EQ(matching(set, "a.min.js"), (std::vector<size_t>{0}));
+  EXPECT_EQ(matching(set, "Makefile"), (std::vector<size_t>{5}));
+  EXPECT_EQ(matching(set, "makefile"), (std::vector<size_t>{}));
+  EXPECT_EQ(matching(set, "js"), (std::vector<size_t>{}));
+}
+
+TEST(GlobSet, stops_when_asked) {
+  GlobSet set;
+  set.add("*.js", 0);
+  set.add("*.js", 1);
+
+  size_t calls = 0;
+  set.forEachMatch("a.js", [&](size_t) {
+    ++calls;
+    return false;
+  });
+  EXPECT_EQ(calls, 1u);
+}
+
+TEST(GlobSet, folds_case) {
+  GlobSet set{WM_CASEFOLD};
+  set.add("README", 0);
+  set.add("*.JPG", 1);
+
+  EXPECT_EQ(matching(set, "readme"), (std::vector<size_t>{0}));
+  EXPECT_EQ(matching(set, "photo.jpg"), (std::vector<size_t>{1}));
+  EXPECT_EQ(matching(set, "photo.Jpg"), (std::vector<size_t>{1}));
+}
+
+TEST(GlobSet, literals_either_side_of_doublestar_are_optional) {
+  GlobSet set{WM_PATHNAME};
+  set.add("**/foo.js", 0);
+  set.add("src/**/*.h", 1);
+
+  EXPECT_TRUE(set.matchesAny("foo.js"));
+  EXPECT_TRUE(set.matchesAny("a/b/foo.js"));
+  EXPECT_FALSE(set.matchesAny("a/bfoo.js"));
+  EXPECT_TRUE(set.matchesAny("src/a.h"));
+  EXPECT_TRUE(set.matchesAny("src/a/b.h"));
+  EXPECT_FALSE(set.matchesAny("lib/a.h"));
+}
+
+TEST(GlobSet, simple_shapes_match_like_wildmatch) {
+  // Every subject of up to five of these characters
+  std::vector<std::string> subjects{""};
+  for (size_t i = 0; i < subjects.size() && subjects[i].size() < 5; ++i) {
+    for (char c : std::string("aA./")) {
+      subjects.push_back(subjects[i] + c);
+    }
+  }
+
+  std::vector<std::string> patterns;
+  for (std::string text : {"", "a", "A", ".", ".a", "a.A"}) {
+    patterns.push_back("*" + text);
+    patterns.push_back(text + "*");
+    patterns.push_back("*" + text + "*");
+    patterns.push_back("**/" + text);
+  }
+
+  for (int flags = 0; flags < 16; ++flags) {
+    for (auto& pattern : patterns) {
+      GlobSet set{flags};
+      set.add(pattern, 0);
+      for (auto& subject : subjects) {
+        EXPECT_EQ(
+            wildmatch(pattern.c_str(), subject.c_str(), flags, nullptr) ==
+                WM_MATCH,
+            set.matchesAny(subject))
+            << "pattern [" << pattern << "] subject [" << subject
+            << "] flags " << flags;
+      }
+    }
+  }
+}
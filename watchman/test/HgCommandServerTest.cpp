@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/scm/HgCommandServer.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include "watchman/fs/Pipe.h"
+
+using namespace watchman;
+
+namespace {
+
+std::string frame(char channel, std::string_view data) {
+  std::string buf{channel};
+  uint32_t size = data.size();
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    buf.push_back(char(size >> shift));
+  }
+  buf.append(data);
+  return buf;
+}
+
+std::string resultFrame(int32_t code) {
+  std::string data;
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    data.push_back(char(uint32_t(code) >> shift));
+  }
+  return frame('r', data);
+}
+
+const std::string kHello = frame(
+    'o',
+    "capabilities: getencoding runcommand\nencoding: UTF-8\npid: 1234");
+
+// Stands in for the server process: the responses are written up front,
+// and the requests can be read back afterwards.
+struct FakeServer {
+  Pipe requests;
+  Pipe responses;
+
+  FakeServer() {
+    for (auto* fd : {&requests.read, &requests.write, &responses.read,
+                     &responses.write}) {
+      fd->clearNonBlock();
+    }
+  }
+
+  void respond(const std::string& data) {
+    ASSERT_EQ(
+        responses.write.write(data.data(), int(data.size())).value(),
+        int(data.size()));
+  }
+
+  std::unique_ptr<HgCommandServer> connect() {
+    return std::make_unique<HgCommandServer>(
+        std::move(requests.write), std::move(responses.read));
+  }
+
+  std::string readRequests(size_t size) {
+    std::string buf(size, '\0');
+    EXPECT_EQ(requests.read.read(buf.data(), int(size)).value(), int(size));
+    return buf;
+  }
+};
+
+} // namespace
+
+TEST(HgCommandServer, runs_commands) {
+  FakeServer fake;
+  fake.respond(kHello);
+  fake.respond(frame('e', "warning\n"));
+  fake.respond(frame('o', std::string("M a\0", 4)));
+  fake.respond(frame('d', "debug output to skip"));
+  fake.respond(frame('o', std::string("A b\0", 4)));
+  fake.respond(resultFrame(0));
+  fake.respond(frame('o', "abort: unknown revision"));
+  fake.respond(resultFrame(255));
+
+  auto server = fake.connect();
+  server->handshake();
+
+  auto result = server->runCommand({"status", "--print0", ""});
+  EXPECT_EQ(result.exitCode, 0);
+  EXPECT_EQ(result.output, w_string(std::string("M a\0A b\0", 8)));
+  EXPECT_EQ(result.error, w_string("warning\n"));
+
+  result = server->runCommand({"log", "-r", "nope"});
+  EXPECT_EQ(result.exitCode, 255);
+  EXPECT_EQ(result.output, w_string("abort: unknown revision"));
+  EXPECT_TRUE(server->healthy());
+
+  EXPECT_EQ(
+      fake.readRequests(11 + 4 + 16),
+      std::string("runcommand\n\0\0\0\x10status\0--print0\0", 31));
+  EXPECT_EQ(
+      fake.readRequests(11 + 4 + 11),
+      std::string("runcommand\n\0\0\0\x0blog\0-r\0nope", 26));
+}
+
+TEST(HgCommandServer, answers_input_requests_with_eof) {
+  FakeServer fake;
+  fake.respond(kHello);
+  // Input requests carry the size wanted in place of a length, and no data
+  fake.respond(std::string("L\0\0\x10\0", 5));
+  fake.respond(resultFrame(1));
+
+  auto server = fake.connect();
+  server->handshake();
+  EXPECT_EQ(server->runCommand({"commit"}).exitCode, 1);
+
+  fake.readRequests(11 + 4 + 6);
+  EXPECT_EQ(fake.readRequests(4), std::string(4, '\0'));
+}
+
+TEST(HgCommandServer, rejects_servers_without_runcommand) {
+  FakeServer fake;
+  fake.respond(frame('o', "capabilities: getencoding\nencoding: UTF-8"));
+
+  auto server = fake.connect();
+  EXPECT_THROW(server->handshake(), HgCommandServerError);
+  EXPECT_FALSE(server->healthy());
+}
+
+TEST(HgCommandServer, fails_when_the_server_goes_away) {
+  FakeServer fake;
+  fake.respond(kHello);
+  fake.respond(frame('o', "partial"));
+  fake.responses.write.close();
+
+  auto server = fake.connect();
+  server->handshake();
+  EXPECT_THROW(server->runCommand({"status"}), HgCommandServerError);
+  EXPECT_FALSE(server->healthy());
+  EXPECT_THROW(server->runCommand({"status"}), HgCommandServerError);
+}
+
+TEST(HgCommandServer, pool_reuses_and_replaces_sessions) {
+  std::vector<std::unique_ptr<FakeServer>> fakes;
+  HgCommandServerPool pool(1, [&] {
+    fakes.push_back(std::make_unique<FakeServer>());
+    auto& fake = *fakes.back();
+    fake.respond(kHello);
+    if (fakes.size() == 1) {
+      fake.respond(frame('o', "first"));
+      fake.respond(resultFrame(0));
+      fake.respond(frame('o', "second"));
+      fake.respond(resultFrame(0));
+      // Then dies part way through the next command
+      fake.respond(frame('o', "part"));
+      fake.responses.write.close();
+    } else {
+      fake.respond(frame('o', "replacement"));
+      fake.respond(resultFrame(0));
+    }
+    auto server = fake.connect();
+    server->handshake();
+    return server;
+  });
+
+  EXPECT_EQ(pool.run({"status"}).output, w_string("first"));
+  EXPECT_EQ(pool.run({"status"}).output, w_string("second"));
+  EXPECT_EQ(fakes.size(), 1u);
+
+  EXPECT_THROW(pool.run({"status"}), HgCommandServerError);
+  EXPECT_EQ(pool.run({"status"}).output, w_string("replacement"));
+  EXPECT_EQ(fakes.size(), 2u);
+}
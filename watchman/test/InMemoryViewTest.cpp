@@ -6,11 +6,18 @@
  */
 
 #include "watchman/InMemoryView.h"
+#include <fmt/format.h>
 #include <folly/portability/GTest.h>
+#include <algorithm>
+#include <limits>
+#include "watchman/PerfSample.h"
+#include "watchman/ThreadPool.h"
+#include "watchman/bser.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/Query.h"
 #include "watchman/query/QueryContext.h"
+#include "watchman/query/TermRegistry.h"
 #include "watchman/root/Root.h"
 #include "watchman/test/lib/FakeFileSystem.h"
 #include "watchman/test/lib/FakeWatcher.h"
@@ -74,6 +81,213 @@ TEST_F(InMemoryViewTest, drive_initial_crawl) {
   EXPECT_STREQ("dir/file.txt", ctx.resultsArray.at(1).asCString());
 }
 
+TEST_F(InMemoryViewTest, detached_evaluation_defers_until_lock_released) {
+  fs.defineContents({"/root/dir/file.txt"});
+
+  Configuration detachedConfig{
+      json_object({{"detached_query_evaluation", json_true()}})};
+  auto detachedView =
+      std::make_shared<InMemoryView>(fs, root_path, detachedConfig, watcher);
+  auto& detachedPending = detachedView->unsafeAccessPendingFromWatcher();
+  detachedPending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      detachedConfig,
+      detachedView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue,
+      detachedView->stepIoThread(root, state, detachedPending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  QueryContext ctx{&query, root, false};
+  detachedView->pathGenerator(&query, &ctx);
+  EXPECT_EQ(0, ctx.resultsArray.size());
+
+  // Changes made after generation must not be visible to the copies
+  fs.updateMetadata(
+      "/root/dir/file.txt", [&](FileInformation& fi) { fi.size = 100; });
+  detachedPending.lock()->add("/root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY);
+  detachedPending.lock()->ping();
+  EXPECT_EQ(
+      Continue::Continue,
+      detachedView->stepIoThread(root, state, detachedPending));
+
+  ctx.evaluateDeferredNow();
+  ASSERT_EQ(2, ctx.resultsArray.size());
+  EXPECT_STREQ("dir", ctx.resultsArray.at(0).get("name").asCString());
+  auto file = ctx.resultsArray.at(1);
+  EXPECT_STREQ("dir/file.txt", file.get("name").asCString());
+  EXPECT_EQ(0, file.get("size").asInt());
+}
+
+TEST_F(InMemoryViewTest, parallel_evaluation_matches_serial_results) {
+  try {
+    getThreadPool().start(2, 1024);
+  } catch (const std::runtime_error&) {
+    // Already started
+  }
+
+  fs.defineContents({"/root/dir/"});
+  for (int i = 0; i < 10000; ++i) {
+    fs.addNode(
+        fmt::format("/root/dir/file{}.txt", i).c_str(), fs.fakeFile());
+  }
+
+  Configuration parallelConfig{json_object({{"query_parallelism", 4}})};
+  auto parallelView =
+      std::make_shared<InMemoryView>(fs, root_path, parallelConfig, watcher);
+  auto& parallelPending = parallelView->unsafeAccessPendingFromWatcher();
+  parallelPending.lock()->ping();
+  auto parallelRoot = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      parallelConfig,
+      parallelView,
+      [] {});
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  InMemoryView::IoThreadState parallelState{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue,
+      parallelView->stepIoThread(parallelRoot, parallelState, parallelPending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.dedup_results = true;
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"dir", 1});
+
+  QueryContext ctx{&query, root, false};
+  view->pathGenerator(&query, &ctx);
+  QueryContext parallelCtx{&query, parallelRoot, false};
+  parallelView->pathGenerator(&query, &parallelCtx);
+  // Visiting the same files again must not produce them twice
+  parallelView->pathGenerator(&query, &parallelCtx);
+
+  ASSERT_EQ(10000, ctx.resultsArray.size());
+  ASSERT_EQ(ctx.resultsArray.size(), parallelCtx.resultsArray.size());
+  EXPECT_EQ(10000, parallelCtx.num_deduped);
+  for (size_t i = 0; i < ctx.resultsArray.size(); ++i) {
+    EXPECT_STREQ(
+        ctx.resultsArray.at(i).asCString(),
+        parallelCtx.resultsArray.at(i).asCString());
+  }
+
+  // The FileResults came from the contexts' arenas, and are all gone once
+  // they have been rendered
+  EXPECT_LT(0, ctx.arena.stats().numSlabs);
+  EXPECT_EQ(0, ctx.arena.stats().liveBlocks);
+  EXPECT_FALSE(parallelCtx.adoptedArenas.empty());
+  for (auto& arena : parallelCtx.adoptedArenas) {
+    EXPECT_EQ(0, arena->stats().liveBlocks);
+  }
+}
+
+TEST_F(InMemoryViewTest, bser_renderer_matches_json_results) {
+  fs.defineContents({"/root/dir/file.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  QueryContext ctx{&query, root, false};
+  ctx.bserResults = std::make_unique<BserResultsRenderer>(2, 0);
+  view->pathGenerator(&query, &ctx);
+  EXPECT_EQ(0, ctx.resultsArray.size());
+  EXPECT_EQ(2, ctx.getNumResults());
+
+  std::string encoded;
+  bser_ctx_t bctx{
+      2, 0, [](const char* buffer, size_t size, void* data) {
+        static_cast<std::string*>(data)->append(buffer, size);
+        return 0;
+      }};
+  ASSERT_EQ(0, ctx.bserResults->dump(query.fieldList, &bctx, &encoded));
+
+  json_int_t needed;
+  json_error_t jerr;
+  auto decoded = bunser(
+      encoded.data(), encoded.data() + encoded.size(), &needed, &jerr);
+  ASSERT_TRUE(decoded) << jerr.text;
+  ASSERT_EQ(2, decoded.array().size());
+  EXPECT_STREQ("dir", decoded.at(0).get("name").asCString());
+  EXPECT_EQ(0, decoded.at(0).get("size").asInt());
+  EXPECT_STREQ("dir/file.txt", decoded.at(1).get("name").asCString());
+  EXPECT_EQ(0, decoded.at(1).get("size").asInt());
+}
+
+TEST_F(InMemoryViewTest, columnar_renderer_shares_dir_names) {
+  fs.defineContents({"/root/dir/a.txt", "/root/dir/b.txt", "/root/top"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("size");
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 1});
+
+  QueryContext ctx{&query, root, false};
+  ctx.columnarResults = std::make_unique<ColumnarResultsRenderer>(
+      query.fieldList);
+  view->pathGenerator(&query, &ctx);
+  EXPECT_EQ(0, ctx.resultsArray.size());
+  EXPECT_EQ(4, ctx.getNumResults());
+
+  auto results = ctx.columnarResults->takeResults();
+  EXPECT_EQ(4, results.get("num_files").asInt());
+  auto& dirs = results.get("dirs");
+  auto& columns = results.get("columns");
+  EXPECT_EQ(3, json_object_size(columns));
+  auto& names = columns.get("name");
+  auto& dirIndexes = columns.get("dir");
+  ASSERT_EQ(4, names.array().size());
+  ASSERT_EQ(4, dirIndexes.array().size());
+  EXPECT_EQ(4, columns.get("size").array().size());
+
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < 4; ++i) {
+    std::string dir{dirs.at(dirIndexes.at(i).asInt()).asString().view()};
+    std::string name = names.at(i).asCString();
+    paths.push_back(dir.empty() ? name : fmt::format("{}/{}", dir, name));
+  }
+  std::sort(paths.begin(), paths.end());
+  EXPECT_EQ(
+      (std::vector<std::string>{"dir", "dir/a.txt", "dir/b.txt", "top"}),
+      paths);
+  EXPECT_EQ(2, dirs.array().size());
+}
+
 TEST_F(InMemoryViewTest, respond_to_watcher_events) {
   getLog().setStdErrLoggingLevel(DBG);
 
@@ -349,6 +563,51 @@ TEST_F(
   EXPECT_EQ(100, std::move(syncFuture).get());
 }
 
+TEST_F(InMemoryViewTest, scoped_sync_returns_before_other_events) {
+  fs.defineContents({"/root/a/file.txt", "/root/b/file.txt"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  fs.updateMetadata(
+      "/root/a/file.txt", [&](FileInformation& fi) { fi.size = 100; });
+  fs.updateMetadata(
+      "/root/b/file.txt", [&](FileInformation& fi) { fi.size = 200; });
+
+  auto fileSize = [&](const char* dirName) {
+    // The iothread has the view locked, as in
+    // syncToNow_does_not_return_until_all_pending_events_are_processed
+    const auto& viewdb = view->unsafeAccessViewDatabase();
+    return viewdb.resolveDir(dirName)->getChildFile("file.txt")->stat.size;
+  };
+
+  // A query that only needs /root/a
+  auto syncFuture =
+      root->cookies.sync(w_string{"/root/a"}).thenValue([&](auto) {
+        return std::make_pair(fileSize("/root/a"), fileSize("/root/b"));
+      });
+
+  pending.lock()->add(
+      "/root/b", {}, W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+  pending.lock()->add(
+      "/root/a", {}, W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+  pending.lock()->add(
+      "/root", {}, W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+  EXPECT_TRUE(syncFuture.isReady());
+
+  // The cookie was settled before /root/b was looked at, but the rest of
+  // the batch was still processed.
+  auto sizes = std::move(syncFuture).get();
+  EXPECT_EQ(100, sizes.first);
+  EXPECT_EQ(0, sizes.second);
+  EXPECT_EQ(200, fileSize("/root/b"));
+}
+
 TEST_F(
     InMemoryViewTest,
     syncToNow_does_not_return_until_initial_crawl_completes) {
@@ -430,4 +689,906 @@ TEST_F(InMemoryViewTest, waitUntilReadyToQuery_waits_for_initial_crawl) {
   std::move(syncFuture).get();
 }
 
+TEST_F(InMemoryViewTest, lazy_crawl_releases_waiters_and_finds_everything) {
+  fs.defineContents({
+      "/root/dir/file.txt",
+      "/root/dir/sub/nested.txt",
+      "/root/other/file.txt",
+  });
+
+  Configuration lazyConfig{json_object({{"lazy_crawl", json_true()}})};
+  auto lazyView =
+      std::make_shared<InMemoryView>(fs, root_path, lazyConfig, watcher);
+  auto& lazyPending = lazyView->unsafeAccessPendingFromWatcher();
+  lazyPending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      lazyConfig,
+      lazyView,
+      [] {});
+
+  auto crawled = lazyView->waitForCrawl({"/root/dir/sub"});
+  EXPECT_FALSE(crawled.isReady());
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, lazyView->stepIoThread(root, state, lazyPending));
+  EXPECT_TRUE(crawled.isReady());
+
+  // Once the crawl has finished there is nothing to wait for
+  EXPECT_TRUE(lazyView->waitForCrawl({"/root"}).isReady());
+
+  Query query;
+  query.fieldList.add("name");
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"", 2});
+
+  QueryContext ctx{&query, root, false};
+  lazyView->pathGenerator(&query, &ctx);
+
+  std::vector<std::string> names;
+  for (size_t i = 0; i < ctx.resultsArray.size(); ++i) {
+    names.emplace_back(ctx.resultsArray.at(i).asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ(
+      (std::vector<std::string>{
+          "dir",
+          "dir/file.txt",
+          "dir/sub",
+          "dir/sub/nested.txt",
+          "other",
+          "other/file.txt"}),
+      names);
+}
+
+TEST_F(InMemoryViewTest, suffix_generator_visits_only_indexed_files) {
+  fs.defineContents({
+      "/root/a.js",
+      "/root/dir/b.TS",
+      "/root/dir/c.txt",
+      "/root/dir/d.tar.gz",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+
+  QueryContext ctx{&query, root, false};
+  view->suffixGenerator(&query, {"js", "ts", "tar.gz", "gz"}, &ctx);
+
+  // Every file with an indexed suffix, visiting "gz" only once.
+  EXPECT_EQ(3, ctx.getNumWalked());
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ(
+      (std::vector<std::string>{"a.js", "dir/b.TS", "dir/d.tar.gz"}), names);
+}
+
+TEST_F(InMemoryViewTest, whole_names_generator_looks_up_only_those_files) {
+  fs.defineContents({
+      "/root/a/one",
+      "/root/a/b/two",
+      "/root/c/three",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+
+  QueryContext ctx{&query, root, false};
+  view->wholeNamesGenerator(
+      &query,
+      {"a/b/two", "a/b", "c/nope", "nope/three", "a/b/two"},
+      CaseSensitivity::CaseSensitive,
+      &ctx);
+
+  EXPECT_EQ(2, ctx.getNumWalked());
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<std::string>{"a/b", "a/b/two"}), names);
+}
+
+TEST_F(InMemoryViewTest, whole_names_generator_can_ignore_case) {
+  fs.defineContents({
+      "/root/A/one",
+      "/root/a/One",
+      "/root/c/three",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+
+  QueryContext ctx{&query, root, false};
+  view->wholeNamesGenerator(
+      &query,
+      {"a/ONE", "A/one", "C/Three", "c/nope"},
+      CaseSensitivity::CaseInSensitive,
+      &ctx);
+
+  // Each file is produced once however many names match it
+  EXPECT_EQ(3, ctx.getNumWalked());
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<std::string>{"A/one", "a/One", "c/three"}), names);
+}
+
+TEST_F(InMemoryViewTest, existence_checks_survive_path_filter_growth) {
+  // Enough files to outgrow the initial path filter more than once
+  fs.defineContents({"/root/dir/sub/"});
+  for (int i = 0; i < 2000; ++i) {
+    fs.addNode(
+        fmt::format("/root/dir/sub/file{}", i).c_str(), fs.fakeFile());
+  }
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  for (int i = 0; i < 2000; ++i) {
+    auto name = w_string{fmt::format("dir/sub/file{}", i).c_str()};
+    EXPECT_TRUE(view->doAnyOfTheseFilesExist({name})) << name.view();
+  }
+  EXPECT_TRUE(view->doAnyOfTheseFilesExist({w_string{"dir/sub"}}));
+  EXPECT_FALSE(view->doAnyOfTheseFilesExist(
+      {w_string{"dir/sub/file2000"},
+       w_string{"dir/file0"},
+       w_string{"dir//sub/file0"},
+       w_string{"nope"}}));
+}
+
+TEST_F(InMemoryViewTest, memory_usage_counts_the_nodes) {
+  fs.defineContents({"/root/a/one", "/root/a/b/two", "/root/three"});
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto usage = view->getMemoryUsage();
+  // The dirs are files in their parents as well
+  EXPECT_EQ(5, usage.get("files").asInt());
+  // Including the root
+  EXPECT_EQ(3, usage.get("dirs").asInt());
+  EXPECT_EQ(2, usage.get("dir_names").asInt());
+  EXPECT_GE(
+      usage.get("file_bytes").asInt(),
+      json_int_t(5 * sizeof(watchman_file)));
+  EXPECT_GE(
+      usage.get("dir_bytes").asInt(), json_int_t(3 * sizeof(watchman_dir)));
+  EXPECT_EQ(0, usage.get("pending_items").asInt());
+}
+
+TEST_F(InMemoryViewTest, subtree_generator_walks_only_the_subtree) {
+  fs.defineContents({
+      "/root/a/one",
+      "/root/a/b/two",
+      "/root/c/three",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+
+  QueryContext ctx{&query, root, false};
+  view->subtreeGenerator(
+      &query, "a", std::numeric_limits<uint32_t>::max(), &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<std::string>{"a/b", "a/b/two", "a/one"}), names);
+}
+
+TEST_F(InMemoryViewTest, subtree_generator_honours_the_depth_bound) {
+  fs.defineContents({
+      "/root/a/one",
+      "/root/a/b/two",
+      "/root/a/b/c/three",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+
+  QueryContext ctx{&query, root, false};
+  view->subtreeGenerator(&query, "a", 1, &ctx);
+
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ(
+      (std::vector<std::string>{"a/b", "a/b/c", "a/b/two", "a/one"}), names);
+}
+
+TEST_F(InMemoryViewTest, tree_walks_skip_dirs_that_the_expression_rules_out) {
+  fs.defineContents({
+      "/root/a/one",
+      "/root/a/b/two",
+      "/root/a/b/c/three",
+      "/root/d/four",
+      "/root/d/e/five",
+      "/root/f/g/six",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  auto term = [](std::initializer_list<const char*> args) {
+    auto arr = json_array();
+    for (auto arg : args) {
+      json_array_append_new(arr, typed_string_to_json(arg, W_STRING_UNICODE));
+    }
+    return arr;
+  };
+  query.expr = parseQueryExpr(
+      &query,
+      json_array(
+          {typed_string_to_json("anyof", W_STRING_UNICODE),
+           term({"dirname", "a/b"}),
+           term({"match", "d/e/*", "wholename"})}));
+  query.plannedDirVerdicts = query.expr->evaluatesDirs();
+
+  QueryContext ctx{&query, root, false};
+  view->subtreeGenerator(
+      &query, "", std::numeric_limits<uint32_t>::max(), &ctx);
+
+  // Everything but "f/g" and "f/g/six", as nothing in "f" can match
+  EXPECT_EQ(11, ctx.getNumWalked());
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ(
+      (std::vector<std::string>{"a/b/c", "a/b/c/three", "a/b/two", "d/e/five"}),
+      names);
+}
+
+TEST_F(InMemoryViewTest, kernel_renders_what_the_generic_path_does) {
+  fs.defineContents({
+      "/root/dir/a.txt",
+      "/root/dir/b.js",
+      "/root/dir/sub/c.TXT",
+      "/root/d.txt",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.fieldList.add("exists");
+  query.fieldList.add("new");
+  auto expression = json_array(
+      {typed_string_to_json("suffix", W_STRING_UNICODE),
+       typed_string_to_json("txt", W_STRING_UNICODE)});
+  query.expr = parseQueryExpr(&query, expression);
+  query.kernel = QueryKernel::recognize(query, expression);
+  ASSERT_TRUE(query.kernel);
+
+  auto render = [&](bool useKernel, bool bser) {
+    QueryContext ctx{&query, root, false};
+    if (bser) {
+      ctx.bserResults = std::make_unique<BserResultsRenderer>(2, 0);
+    }
+    if (useKernel) {
+      ctx.kernel = query.kernel->select(ctx);
+      EXPECT_NE(nullptr, ctx.kernel);
+    }
+    view->subtreeGenerator(
+        &query, "", std::numeric_limits<uint32_t>::max(), &ctx);
+    EXPECT_EQ(3, ctx.getNumResults());
+    if (!bser) {
+      return json_dumps(ctx.renderResults(), JSON_SORT_KEYS);
+    }
+    std::string encoded;
+    bser_ctx_t bctx{
+        2, 0, [](const char* buffer, size_t size, void* data) {
+          static_cast<std::string*>(data)->append(buffer, size);
+          return 0;
+        }};
+    EXPECT_EQ(0, ctx.bserResults->dump(query.fieldList, &bctx, &encoded));
+    return encoded;
+  };
+
+  EXPECT_EQ(render(false, false), render(true, false));
+  EXPECT_EQ(render(false, true), render(true, true));
+
+  // Fields that the kernels don't render need the generic path
+  query.fieldList.add("size");
+  EXPECT_FALSE(QueryKernel::recognize(query, expression));
+}
+
+TEST_F(InMemoryViewTest, time_generator_walks_only_the_relative_root) {
+  fs.defineContents({
+      "/root/a/one",
+      "/root/a/b/two",
+      "/root/c/three",
+  });
+
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  Query query;
+  query.fieldList.add("name");
+  query.relative_root = "/root/a";
+  query.relative_root_slash = "/root/a/";
+
+  QueryContext ctx{&query, root, false};
+  ctx.since.clock.is_fresh_instance = false;
+  ctx.since.clock.ticks = 0;
+  view->timeGenerator(&query, &ctx);
+
+  // Only the files below "a" are considered; "a" itself lives in the root
+  EXPECT_EQ(3, ctx.getNumWalked());
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ((std::vector<std::string>{"b", "b/two", "one"}), names);
+}
+
+TEST_F(InMemoryViewTest, old_since_scans_the_planned_dir_instead) {
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+  auto& db = view->unsafeAccessViewDatabase();
+  auto* small = db.resolveDir("/root/small", true);
+  for (uint32_t tick = 2; tick < 12; ++tick) {
+    auto* file = db.getOrCreateChildFile(
+        *watcher, small, w_string::build("file", tick), {tick, 100});
+    db.markFileChanged(*watcher, file, {tick, 100});
+  }
+  // So many changes after that that walking the recency list back to the
+  // small dir's files means visiting every file in the big dir
+  auto* big = db.resolveDir("/root/big", true);
+  for (uint32_t tick = 100; tick < 20100; ++tick) {
+    auto* file = db.getOrCreateChildFile(
+        *watcher, big, w_string::build("file", tick), {tick, 100});
+    db.markFileChanged(*watcher, file, {tick, 100});
+  }
+
+  Query query;
+  query.fieldList.add("name");
+  query.plannedDirName = w_string("small", W_STRING_BYTE);
+
+  QueryContext ctx{&query, root, false};
+  ctx.since.clock.is_fresh_instance = false;
+  ctx.since.clock.ticks = 5;
+  view->timeGenerator(&query, &ctx);
+
+  EXPECT_EQ(10, ctx.getNumWalked());
+  std::vector<std::string> names;
+  for (auto& name : ctx.resultsArray) {
+    names.push_back(name.asCString());
+  }
+  std::sort(names.begin(), names.end());
+  EXPECT_EQ(
+      (std::vector<std::string>{
+          "small/file10",
+          "small/file11",
+          "small/file6",
+          "small/file7",
+          "small/file8",
+          "small/file9"}),
+      names);
+}
+
+TEST_F(InMemoryViewTest, busy_directories_are_rescanned_as_a_whole) {
+  fs.defineContents({
+      "/root/dir/a",
+      "/root/dir/b",
+      "/root/other/c",
+  });
+
+  Configuration coalesceConfig{
+      json_object({{"coalesce_dir_rescan_threshold", json_integer(2)}})};
+  auto coalesceView =
+      std::make_shared<InMemoryView>(fs, root_path, coalesceConfig, watcher);
+  auto& coalescePending = coalesceView->unsafeAccessPendingFromWatcher();
+  coalescePending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      coalesceConfig,
+      coalesceView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue,
+      coalesceView->stepIoThread(root, state, coalescePending));
+
+  fs.updateMetadata("/root/dir/a", [&](FileInformation& fi) { fi.size = 1; });
+  fs.updateMetadata("/root/dir/b", [&](FileInformation& fi) { fi.size = 2; });
+  fs.updateMetadata(
+      "/root/other/c", [&](FileInformation& fi) { fi.size = 3; });
+  fs.addNode("/root/dir/new", fs.fakeFile());
+  {
+    auto lock = coalescePending.lock();
+    // Three changes in "dir" exceed the threshold; "gone" was created and
+    // removed before we got to it.  "other" stays below the threshold.
+    lock->add("/root/dir/a", {}, W_PENDING_VIA_NOTIFY);
+    lock->add("/root/dir/new", {}, W_PENDING_VIA_NOTIFY);
+    lock->add("/root/dir/gone", {}, W_PENDING_VIA_NOTIFY);
+    lock->add("/root/other/c", {}, W_PENDING_VIA_NOTIFY);
+    lock->ping();
+  }
+  EXPECT_EQ(
+      Continue::Continue,
+      coalesceView->stepIoThread(root, state, coalescePending));
+
+  auto& db = coalesceView->unsafeAccessViewDatabase();
+  auto* dir = db.resolveDir("/root/dir", false);
+  ASSERT_NE(nullptr, dir);
+  EXPECT_EQ(1, dir->getChildFile("a")->stat.size);
+  // Not notified, but picked up because the whole directory was rescanned
+  EXPECT_EQ(2, dir->getChildFile("b")->stat.size);
+  ASSERT_NE(nullptr, dir->getChildFile("new"));
+  EXPECT_TRUE(dir->getChildFile("new")->exists);
+  ASSERT_NE(nullptr, dir->getChildFile("gone"));
+  EXPECT_FALSE(dir->getChildFile("gone")->exists);
+
+  auto* other = db.resolveDir("/root/other", false);
+  ASSERT_NE(nullptr, other);
+  EXPECT_EQ(3, other->getChildFile("c")->stat.size);
+}
+
+TEST_F(InMemoryViewTest, idempotent_writes_can_be_ignored) {
+  fs.defineContents({"/root/dir/file.txt"});
+
+  Configuration idempotentConfig{json_object(
+      {{"ignore_idempotent_writes", w_string_to_json("metadata")}})};
+  auto idempotentView =
+      std::make_shared<InMemoryView>(fs, root_path, idempotentConfig, watcher);
+  auto& idempotentPending = idempotentView->unsafeAccessPendingFromWatcher();
+  idempotentPending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      idempotentConfig,
+      idempotentView,
+      [] {});
+
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue,
+      idempotentView->stepIoThread(root, state, idempotentPending));
+
+  auto& db = idempotentView->unsafeAccessViewDatabase();
+  auto* file = db.resolveDir("/root/dir", false)->getChildFile("file.txt");
+  ASSERT_NE(nullptr, file);
+  auto crawled = file->otime.ticks;
+
+  // A notification for a file that is just as it was is dropped
+  idempotentPending.lock()->add("/root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY);
+  idempotentPending.lock()->ping();
+  EXPECT_EQ(
+      Continue::Continue,
+      idempotentView->stepIoThread(root, state, idempotentPending));
+  EXPECT_EQ(crawled, file->otime.ticks);
+
+  // A real change is still reported
+  fs.updateMetadata(
+      "/root/dir/file.txt", [&](FileInformation& fi) { fi.size = 100; });
+  idempotentPending.lock()->add("/root/dir/file.txt", {}, W_PENDING_VIA_NOTIFY);
+  idempotentPending.lock()->ping();
+  EXPECT_EQ(
+      Continue::Continue,
+      idempotentView->stepIoThread(root, state, idempotentPending));
+  EXPECT_NE(crawled, file->otime.ticks);
+  EXPECT_EQ(100, file->stat.size);
+}
+
+TEST_F(InMemoryViewTest, small_files_are_hashed_as_they_change) {
+  try {
+    getThreadPool().start(2, 1024);
+  } catch (const std::runtime_error&) {
+    // Already started
+  }
+
+  fs.defineContents({"/root/dir/small.txt", "/root/dir/big.txt"});
+  fs.updateMetadata(
+      "/root/dir/big.txt", [&](FileInformation& fi) { fi.size = 100; });
+
+  Configuration hashConfig{
+      json_object({{"content_hash_on_change_max_size", json_integer(10)}})};
+  auto hashView =
+      std::make_shared<InMemoryView>(fs, root_path, hashConfig, watcher);
+  auto& hashPending = hashView->unsafeAccessPendingFromWatcher();
+  hashPending.lock()->ping();
+
+  auto root = std::make_shared<Root>(
+      fs,
+      root_path,
+      "fs_type",
+      w_string_to_json("{}"),
+      hashConfig,
+      hashView,
+      [] {});
+
+  // The crawl starts hashing the small file, but not the big one or the dir
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(
+      Continue::Continue, hashView->stepIoThread(root, state, hashPending));
+  auto info = hashView->getViewDebugInfo();
+  EXPECT_EQ(1, info.get("hash_on_change_started").asInt());
+  EXPECT_EQ(0, info.get("hash_on_change_skipped").asInt());
+
+  // As does a later change to it
+  fs.updateMetadata(
+      "/root/dir/small.txt", [&](FileInformation& fi) { fi.size = 5; });
+  hashPending.lock()->add("/root/dir/small.txt", {}, W_PENDING_VIA_NOTIFY);
+  hashPending.lock()->ping();
+  EXPECT_EQ(
+      Continue::Continue, hashView->stepIoThread(root, state, hashPending));
+  info = hashView->getViewDebugInfo();
+  EXPECT_EQ(2, info.get("hash_on_change_started").asInt());
+}
+
+TEST_F(InMemoryViewTest, age_out_works_through_deleted_files_in_order) {
+  auto& db = view->unsafeAccessViewDatabase();
+  auto* dir = db.resolveDir("/root/dir", true);
+  auto* kept = db.getOrCreateChildFile(*watcher, dir, "kept", {1, 100});
+  db.markFileChanged(*watcher, kept, {1, 100});
+  auto* first = db.getOrCreateChildFile(*watcher, dir, "first", {2, 100});
+  first->exists = false;
+  db.markFileChanged(*watcher, first, {2, 100});
+  auto* second = db.getOrCreateChildFile(*watcher, dir, "second", {3, 100});
+  second->exists = false;
+  db.markFileChanged(*watcher, second, {3, 100});
+
+  EXPECT_EQ(first, db.getOldestTombstone());
+  EXPECT_EQ(second, db.getNextTombstone(first));
+  EXPECT_EQ(nullptr, db.getNextTombstone(second));
+
+  // Coming back takes it off the list
+  first->exists = true;
+  db.markFileChanged(*watcher, first, {4, 100});
+  EXPECT_EQ(second, db.getOldestTombstone());
+  EXPECT_EQ(nullptr, db.getNextTombstone(second));
+
+  PerfSample sample("age_out");
+  view->ageOut(sample, std::chrono::seconds(0));
+  EXPECT_EQ(nullptr, db.getOldestTombstone());
+  EXPECT_EQ(nullptr, dir->getChildFile("second"));
+  EXPECT_NE(nullptr, dir->getChildFile("first"));
+  EXPECT_NE(nullptr, dir->getChildFile("kept"));
+  EXPECT_EQ(3, view->getLastAgeOutTickValue());
+}
+
+TEST_F(InMemoryViewTest, dedup_by_identity_holds_off_age_out) {
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+  auto& db = view->unsafeAccessViewDatabase();
+  auto* dir = db.resolveDir("/root/dir", true);
+  auto* gone = db.getOrCreateChildFile(*watcher, dir, "gone", {1, 100});
+  gone->exists = false;
+  db.markFileChanged(*watcher, gone, {1, 100});
+
+  Query query;
+  query.fieldList.add("name");
+  query.dedup_results = true;
+  query.paths.emplace();
+  query.paths->emplace_back(QueryPath{"dir", 1});
+
+  QueryContext ctx{&query, root, true};
+  view->pathGenerator(&query, &ctx);
+  view->pathGenerator(&query, &ctx);
+  ASSERT_TRUE(ctx.dedupsByIdentity());
+  EXPECT_EQ(1, ctx.resultsArray.size());
+  EXPECT_EQ(1, ctx.num_deduped);
+  EXPECT_TRUE(ctx.dedup.empty());
+
+  // While the query holds the pin, the node can't be freed and its address
+  // reused for a file that the query would take for a duplicate
+  PerfSample sample("age_out");
+  view->ageOut(sample, std::chrono::seconds(0));
+  EXPECT_EQ(gone, dir->getChildFile("gone"));
+
+  ctx.identityPin.reset();
+  view->ageOut(sample, std::chrono::seconds(0));
+  EXPECT_EQ(nullptr, dir->getChildFile("gone"));
+
+  // Triggers want the names
+  query.dedup_by_name = true;
+  QueryContext byName{&query, root, true};
+  view->pathGenerator(&query, &byName);
+  EXPECT_FALSE(byName.dedupsByIdentity());
+}
+
+TEST_F(InMemoryViewTest, moved_dirs_keep_what_is_known_about_them) {
+  fs.defineContents({"/root/old/sub/file.txt", "/root/dest/"});
+  auto root = std::make_shared<Root>(
+      fs, root_path, "fs_type", w_string_to_json("{}"), config, view, [] {});
+  InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+  EXPECT_EQ(Continue::Continue, view->stepIoThread(root, state, pending));
+
+  auto& db = view->unsafeAccessViewDatabase();
+  auto ino = db.resolveDir("/root/old/sub", false)
+                 ->getChildFile("file.txt")
+                 ->stat.ino;
+
+  std::vector<w_string> movedDirs;
+  ASSERT_TRUE(db.moveDir(
+      *watcher, "/root/old", "/root/dest/new", {10, 100}, movedDirs));
+  EXPECT_EQ(
+      (std::vector<w_string>{"/root/dest/new", "/root/dest/new/sub"}),
+      movedDirs);
+
+  auto* moved = db.resolveDir("/root/dest/new/sub", false);
+  ASSERT_NE(nullptr, moved);
+  auto* file = moved->getChildFile("file.txt");
+  ASSERT_NE(nullptr, file);
+  EXPECT_TRUE(file->exists);
+  EXPECT_EQ(ino, file->stat.ino);
+  EXPECT_EQ(10, file->otime.ticks);
+  EXPECT_EQ(10, file->ctime.ticks);
+  EXPECT_TRUE(db.mayHavePath("/root/dest/new/sub/file.txt"));
+  EXPECT_TRUE(db.resolveDir("/root/dest", false)->getChildFile("new")->exists);
+
+  auto* old = db.resolveDir("/root/old/sub", false);
+  ASSERT_NE(nullptr, old);
+  EXPECT_FALSE(old->last_check_existed);
+  EXPECT_FALSE(old->getChildFile("file.txt")->exists);
+  EXPECT_FALSE(db.resolveDir(root_path, false)->getChildFile("old")->exists);
+
+  // Nothing is moved onto what exists, or from what doesn't
+  movedDirs.clear();
+  EXPECT_FALSE(
+      db.moveDir(*watcher, "/root/old", "/root/other", {11, 100}, movedDirs));
+  EXPECT_FALSE(db.moveDir(
+      *watcher, "/root/dest/new", "/root/dest", {11, 100}, movedDirs));
+  EXPECT_TRUE(movedDirs.empty());
+
+  // Moving it back brings the old nodes back to life
+  ASSERT_TRUE(db.moveDir(
+      *watcher, "/root/dest/new", "/root/old", {12, 100}, movedDirs));
+  EXPECT_TRUE(old->last_check_existed);
+  EXPECT_TRUE(old->getChildFile("file.txt")->exists);
+  EXPECT_EQ(12, old->getChildFile("file.txt")->otime.ticks);
+  EXPECT_FALSE(moved->getChildFile("file.txt")->exists);
+}
+
+TEST_F(InMemoryViewTest, bulk_loaded_files_are_linked_at_the_end) {
+  auto& db = view->unsafeAccessViewDatabase();
+  auto* top = db.resolveDir(root_path, false);
+  auto* a = db.resolveDir("/root/a", true);
+  auto* b = db.resolveDir("/root/a/b", true);
+
+  db.beginBulkLoad();
+  auto* first = db.getOrCreateChildFile(*watcher, a, "first", {1, 100});
+  db.markFileChanged(*watcher, first, {1, 100});
+  auto* second = db.getOrCreateChildFile(*watcher, b, "second", {1, 100});
+  db.markFileChanged(*watcher, second, {1, 100});
+  auto* third = db.getOrCreateChildFile(*watcher, top, "third", {1, 100});
+  db.markFileChanged(*watcher, third, {1, 100});
+  // Marked again, but still linked only once
+  db.markFileChanged(*watcher, first, {1, 100});
+  EXPECT_EQ(nullptr, db.getLatestFile());
+  db.endBulkLoad();
+
+  EXPECT_EQ(third, db.getLatestFile());
+  EXPECT_EQ(second, third->next);
+  EXPECT_EQ(first, second->next);
+  EXPECT_EQ(nullptr, first->next);
+  EXPECT_EQ(second, db.getLatestFileInSubtree("a"));
+  EXPECT_EQ(first, second->subtreeNext);
+  EXPECT_EQ(nullptr, first->subtreeNext);
+
+  // From then on, changes move files to the head as usual
+  db.markFileChanged(*watcher, first, {2, 100});
+  EXPECT_EQ(first, db.getLatestFile());
+  EXPECT_EQ(first, db.getLatestFileInSubtree("a"));
+  EXPECT_EQ(second, first->subtreeNext);
+  EXPECT_EQ(nullptr, second->subtreeNext);
+  EXPECT_EQ(third, first->next);
+  EXPECT_EQ(nullptr, second->next);
+}
+
+TEST_F(InMemoryViewTest, estimates_files_changed_since_from_checkpoints) {
+  auto& db = view->unsafeAccessViewDatabase();
+  auto* dir = db.resolveDir("/root/dir", true);
+  for (uint32_t tick = 1; tick <= 4096; ++tick) {
+    auto* file = db.getOrCreateChildFile(
+        *watcher, dir, w_string::build("file", tick), {tick, 100});
+    db.markFileChanged(*watcher, file, {tick, 100});
+  }
+
+  EXPECT_EQ(0, db.estimateFilesChangedSince(4096));
+  // Older than the first checkpoint
+  EXPECT_EQ(
+      std::numeric_limits<uint64_t>::max(), db.estimateFilesChangedSince(0));
+
+  auto estimate = db.estimateFilesChangedSince(1000);
+  EXPECT_GE(estimate, 4096 - 1000);
+  EXPECT_LE(estimate, 4096 - 1000 + 256);
+}
+
+#ifndef _WIN32
+TEST_F(InMemoryViewTest, symlink_targets_can_be_kept_in_the_nodes) {
+  auto& db = view->unsafeAccessViewDatabase();
+  auto* dir = db.resolveDir("/root/dir", true);
+  auto* plain = db.getOrCreateChildFile(*watcher, dir, "plain", {1, 100});
+  plain->setSymlinkTarget(w_string("ignored", W_STRING_BYTE));
+  EXPECT_FALSE(plain->getSymlinkTarget());
+
+  db.setKeepSymlinkTargets(true);
+  auto* link = db.getOrCreateChildFile(*watcher, dir, "link", {2, 100});
+  EXPECT_GT(link->allocatedSize(), plain->allocatedSize());
+  EXPECT_FALSE(link->getSymlinkTarget());
+  link->stat.mode = S_IFLNK | 0777;
+  link->setSymlinkTarget(w_string("target", W_STRING_BYTE));
+
+  // Rendered without having to fetch anything
+  InMemoryViewCaches caches{"/root", 16, 16, std::chrono::milliseconds(0)};
+  InMemoryFileResult result{link, caches};
+  auto target = result.readLink();
+  ASSERT_TRUE(target.has_value());
+  EXPECT_EQ("target", target->view());
+}
+#endif
+
+
+TEST_F(InMemoryViewTest, paged_out_dirs_come_back_in_recency_order) {
+  auto& db = view->unsafeAccessViewDatabase();
+  auto* sub = db.resolveDir("/root/cold/sub", true);
+  auto* old = db.getOrCreateChildFile(*watcher, sub, "old", {1, 100});
+  db.markFileChanged(*watcher, old, {1, 100});
+  auto* gone = db.getOrCreateChildFile(*watcher, sub, "gone", {3, 100});
+  gone->exists = false;
+  db.markFileChanged(*watcher, gone, {3, 100});
+  auto* hot = db.resolveDir("/root/hot", true);
+  auto* one = db.getOrCreateChildFile(*watcher, hot, "one", {2, 100});
+  db.markFileChanged(*watcher, one, {2, 100});
+  auto* two = db.getOrCreateChildFile(*watcher, hot, "two", {4, 100});
+  db.markFileChanged(*watcher, two, {4, 100});
+
+  auto recencyOrder = [&] {
+    std::vector<std::string> order;
+    for (auto* f = db.getLatestFile(); f; f = f->next) {
+      order.push_back(f->getName().string());
+    }
+    return order;
+  };
+
+  ASSERT_TRUE(db.pageOut("cold", w_string()));
+  EXPECT_FALSE(db.pageOut("cold", w_string()));
+  EXPECT_EQ((std::vector<std::string>{"two", "one"}), recencyOrder());
+  EXPECT_EQ(nullptr, db.getOldestTombstone());
+  EXPECT_EQ(nullptr, db.getLatestFileInSubtree("cold"));
+
+  const auto& cold = db.getColdSubtrees().at("cold");
+  EXPECT_EQ(3, cold.newest.ticks);
+  EXPECT_EQ(1, cold.numDirs);
+  EXPECT_EQ(2, cold.numFiles);
+
+  // What it held can still be checked for without paging it in
+  EXPECT_TRUE(db.mayHavePath("/root/cold/sub/old"));
+  EXPECT_EQ(std::optional<bool>(true), db.coldFileExists("/root/cold/sub/old"));
+  EXPECT_EQ(
+      std::optional<bool>(false), db.coldFileExists("/root/cold/sub/gone"));
+  EXPECT_EQ(std::optional<bool>(false), db.coldFileExists("/root/cold/nope"));
+  EXPECT_EQ(std::nullopt, db.coldFileExists("/root/hot/one"));
+  EXPECT_EQ(1, db.getColdSubtrees().size());
+
+  // Looking it up to change it brings it back
+  auto* back = db.resolveDir("/root/cold/sub", false);
+  ASSERT_NE(nullptr, back);
+  EXPECT_TRUE(db.getColdSubtrees().empty());
+  EXPECT_EQ(
+      (std::vector<std::string>{"two", "gone", "one", "old"}), recencyOrder());
+
+  auto* latest = db.getLatestFileInSubtree("cold");
+  ASSERT_NE(nullptr, latest);
+  EXPECT_EQ("gone", latest->getName().string());
+  ASSERT_NE(nullptr, latest->subtreeNext);
+  EXPECT_EQ("old", latest->subtreeNext->getName().string());
+  EXPECT_EQ(nullptr, latest->subtreeNext->subtreeNext);
+
+  ASSERT_NE(nullptr, db.getOldestTombstone());
+  EXPECT_EQ("gone", db.getOldestTombstone()->getName().string());
+  EXPECT_EQ(nullptr, db.getNextTombstone(db.getOldestTombstone()));
+}
+
+TEST_F(InMemoryViewTest, idle_dirs_stay_paged_out_until_a_query_needs_them) {
+  Configuration pageConfig{json_object(
+      {{"view_page_out_idle_seconds", 1}, {"view_page_out_min_files", 1}})};
+  auto pageView =
+      std::make_shared<InMemoryView>(fs, root_path, pageConfig, watcher);
+  auto& db = pageView->unsafeAccessViewDatabase();
+  auto* dir = db.resolveDir("/root/dir", true);
+  auto* file = db.getOrCreateChildFile(*watcher, dir, "file", {2, 100});
+  db.markFileChanged(*watcher, file, {2, 100});
+
+  EXPECT_EQ(1, pageView->pageOutIdleSubtrees());
+  auto usage = pageView->getMemoryUsage();
+  EXPECT_EQ(1, usage.get("cold_subtrees").asInt());
+  EXPECT_EQ(1, usage.get("cold_files").asInt());
+  EXPECT_GT(usage.get("cold_bytes").asInt(), 0);
+  EXPECT_TRUE(pageView->doAnyOfTheseFilesExist({w_string{"dir/file"}}));
+  EXPECT_FALSE(pageView->doAnyOfTheseFilesExist({w_string{"dir/nope"}}));
+
+  // Nothing in it has changed since tick 2, so it can't matter to a query
+  // since then
+  QuerySince since;
+  since.clock.is_fresh_instance = false;
+  since.clock.ticks = 2;
+  pageView->pageInForQuery({w_string{"/root/dir"}}, since);
+  EXPECT_EQ(1, db.getColdSubtrees().size());
+
+  // But it does to one from scratch
+  pageView->pageInForQuery({root_path}, QuerySince{});
+  EXPECT_TRUE(db.getColdSubtrees().empty());
+  EXPECT_NE(nullptr, dir->getChildFile("file"));
+
+  // Which keeps it in memory for a while
+  EXPECT_EQ(0, pageView->pageOutIdleSubtrees());
+}
+
 } // namespace
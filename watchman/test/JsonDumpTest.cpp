@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <limits>
+#include <string>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace {
+
+std::string dumpString(const std::string& str, size_t flags = 0) {
+  auto json = w_string_to_json(w_string(str.data(), str.size(), W_STRING_BYTE));
+  return json_dumps(json, flags | JSON_ENCODE_ANY);
+}
+
+TEST(JsonDump, escapes_strings) {
+  EXPECT_EQ(R"("path/to/a/file.cpp")", dumpString("path/to/a/file.cpp"));
+  EXPECT_EQ(
+      R"("quote\" backslash\\ tab\t newline\n ctrl\u0001")",
+      dumpString("quote\" backslash\\ tab\t newline\n ctrl\x01"));
+  EXPECT_EQ(R"("a\/b")", dumpString("a/b", JSON_ESCAPE_SLASH));
+  EXPECT_EQ(
+      "\"caf\xc3\xa9 \xf0\x9f\x98\x80\"",
+      dumpString("caf\xc3\xa9 \xf0\x9f\x98\x80"));
+  EXPECT_EQ(
+      R"("caf\u00e9 \ud83d\ude00")",
+      dumpString("caf\xc3\xa9 \xf0\x9f\x98\x80", JSON_ENSURE_ASCII));
+  // An embedded NUL ends the string
+  EXPECT_EQ(R"("before")", dumpString(std::string("before\0after", 12)));
+  EXPECT_THROW(dumpString("invalid \xff utf-8"), std::runtime_error);
+}
+
+TEST(JsonDump, long_strings) {
+  std::string str(100000, 'x');
+  str[50000] = '"';
+  auto expected =
+      "\"" + str.substr(0, 50000) + "\\\"" + str.substr(50001) + "\"";
+  EXPECT_EQ(expected, dumpString(str));
+}
+
+TEST(JsonDump, formats_integers) {
+  auto arr = json_array(
+      {json_integer(0),
+       json_integer(7),
+       json_integer(-42),
+       json_integer(1234567890123),
+       json_integer(std::numeric_limits<json_int_t>::max()),
+       json_integer(std::numeric_limits<json_int_t>::min())});
+  EXPECT_EQ(
+      "[0,7,-42,1234567890123,9223372036854775807,-9223372036854775808]",
+      json_dumps(arr, JSON_COMPACT));
+}
+
+TEST(JsonDump, layout) {
+  auto obj = json_object(
+      {{"files", json_array({typed_string_to_json("a", W_STRING_UNICODE)})},
+       {"fresh", json_true()}});
+  EXPECT_EQ(
+      R"({"files":["a"],"fresh":true})",
+      json_dumps(obj, JSON_COMPACT | JSON_SORT_KEYS));
+  EXPECT_EQ(
+      R"({"files": ["a"], "fresh": true})", json_dumps(obj, JSON_SORT_KEYS));
+  EXPECT_EQ(
+      "{\n  \"files\": [\n    \"a\"\n  ],\n  \"fresh\": true\n}",
+      json_dumps(obj, JSON_INDENT(2) | JSON_SORT_KEYS));
+}
+
+} // namespace
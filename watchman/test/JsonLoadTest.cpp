@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <string>
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace {
+
+json_ref loadString(const std::string& text, json_error_t* err) {
+  return json_loadb(text.data(), text.size(), JSON_DECODE_ANY, err);
+}
+
+} // namespace
+
+TEST(JsonLoad, long_plain_strings) {
+  std::string value;
+  for (int i = 0; i < 100; ++i) {
+    value.push_back('a' + (i % 26));
+    auto text = "[\"" + value + "\", \"" + value + "\"]";
+    json_error_t err;
+    auto json = json_loads(text.c_str(), 0, &err);
+    ASSERT_TRUE(json) << err.text;
+    EXPECT_EQ(json.at(0).asString(), w_string(value.c_str()));
+    EXPECT_EQ(json.at(1).asString(), w_string(value.c_str()));
+  }
+}
+
+TEST(JsonLoad, escapes_and_utf8_between_runs) {
+  json_error_t err;
+  auto json = loadString(
+      "[\"some/long/path/name\\\\with\\\"escapes\xc3\xa9"
+      "and more text\", \"utf8 \xc3\xa9 in the middle of a long run\"]",
+      &err);
+  ASSERT_TRUE(json) << err.text;
+  EXPECT_EQ(
+      json.at(0).asString(),
+      w_string("some/long/path/name\\with\"escapes\xc3\xa9" "and more text"));
+  EXPECT_EQ(
+      json.at(1).asString(),
+      w_string("utf8 \xc3\xa9 in the middle of a long run"));
+}
+
+TEST(JsonLoad, object_keys) {
+  json_error_t err;
+  auto json = loadString(
+      R"({"a_reasonably_long_key": 1, "esc\"aped": 2, "": 3})", &err);
+  ASSERT_TRUE(json) << err.text;
+  EXPECT_EQ(json.get("a_reasonably_long_key").asInt(), 1);
+  EXPECT_EQ(json.get("esc\"aped").asInt(), 2);
+  EXPECT_EQ(json.get("").asInt(), 3);
+}
+
+TEST(JsonLoad, error_positions_after_long_runs) {
+  json_error_t err;
+  EXPECT_FALSE(loadString("[\"0123456789abcdef\x01\"]", &err));
+  EXPECT_EQ(err.line, 1);
+  EXPECT_EQ(err.column, 18);
+  EXPECT_EQ(err.position, 18);
+
+  EXPECT_FALSE(loadString("[\"0123456789abcdef\n\"]", &err));
+  EXPECT_EQ(err.line, 1);
+  EXPECT_EQ(err.column, 18);
+
+  EXPECT_FALSE(loadString("[\"0123456789abcdef", &err));
+  EXPECT_EQ(err.position, 18);
+
+  EXPECT_FALSE(loadString("[\"0123456789abcdef\xff\"]", &err));
+  EXPECT_EQ(err.position, 18);
+}
+
+TEST(JsonLoad, embedded_nul_in_buffer) {
+  json_error_t err;
+  EXPECT_FALSE(loadString(std::string("[\"0123456789\0abcdef\"]", 21), &err));
+  EXPECT_EQ(err.position, 12);
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/portability/GTest.h>
+#include <string>
+#include "watchman/bser.h"
+#include "watchman/thirdparty/jansson/jansson.h"
+
+namespace {
+
+json_ref makeKeys() {
+  return json_array(
+      {typed_string_to_json("name", W_STRING_UNICODE),
+       typed_string_to_json("exists", W_STRING_UNICODE),
+       typed_string_to_json("size", W_STRING_UNICODE)});
+}
+
+json_ref makeRecord(const json_ref& keys, const char* name, int size) {
+  return json_record(
+      keys,
+      {typed_string_to_json(name, W_STRING_BYTE),
+       json_true(),
+       json_integer(size)});
+}
+
+json_ref makeObject(const char* name, int size) {
+  return json_object(
+      {{"name", typed_string_to_json(name, W_STRING_BYTE)},
+       {"exists", json_true()},
+       {"size", json_integer(size)}});
+}
+
+int dumpToString(const char* buffer, size_t size, void* data) {
+  static_cast<std::string*>(data)->append(buffer, size);
+  return 0;
+}
+
+json_ref bserRoundTrip(uint32_t version, const json_ref& json) {
+  std::string buffer;
+  bser_ctx_t ctx{version, 0, dumpToString};
+  EXPECT_EQ(0, w_bser_dump(&ctx, json, &buffer));
+  json_int_t needed;
+  json_error_t jerr;
+  return bunser(buffer.data(), buffer.data() + buffer.size(), &needed, &jerr);
+}
+
+} // namespace
+
+TEST(JsonRecord, behaves_as_an_object) {
+  auto keys = makeKeys();
+  auto record = makeRecord(keys, "foo.cpp", 42);
+
+  EXPECT_TRUE(record.isObject());
+  EXPECT_EQ(json_record_get_keys(record), static_cast<json_t*>(keys));
+  EXPECT_EQ(json_object_size(record), 3u);
+  EXPECT_EQ(record.get("name").asString(), w_string("foo.cpp"));
+  EXPECT_EQ(record.get("size").asInt(), 42);
+  EXPECT_FALSE(record.get_default("mode"));
+  EXPECT_EQ(
+      json_object_get(record, "exists"), static_cast<json_t*>(json_true()));
+  EXPECT_THROW(record.get("mode"), std::range_error);
+
+  auto object = makeObject("foo.cpp", 42);
+  EXPECT_TRUE(json_equal(record, object));
+  EXPECT_TRUE(json_equal(object, record));
+  EXPECT_FALSE(json_equal(record, makeObject("foo.cpp", 43)));
+  EXPECT_TRUE(json_equal(json_deep_copy(record), object));
+
+  const json_ref& constRecord = record;
+  EXPECT_EQ(constRecord.object().size(), 3u);
+  // Reading the map leaves the record intact
+  EXPECT_EQ(json_record_get_keys(record), static_cast<json_t*>(keys));
+}
+
+TEST(JsonRecord, becomes_an_object_when_modified) {
+  auto keys = makeKeys();
+  auto record = makeRecord(keys, "foo.cpp", 42);
+
+  record.set("mode", json_integer(0644));
+  EXPECT_FALSE(json_record_get_keys(record));
+  EXPECT_FALSE(json_record_get_values(record));
+  EXPECT_EQ(json_object_size(record), 4u);
+  EXPECT_EQ(record.get("name").asString(), w_string("foo.cpp"));
+  EXPECT_EQ(record.get("mode").asInt(), 0644);
+
+  // The keys are shared, so other records are unaffected
+  auto other = makeRecord(keys, "bar.cpp", 1);
+  EXPECT_EQ(json_object_size(other), 3u);
+  EXPECT_EQ(json_object_del(other, "exists"), 0);
+  EXPECT_EQ(json_object_size(other), 2u);
+  EXPECT_EQ(json_array_size(keys), 3u);
+}
+
+TEST(JsonRecord, json_encoding) {
+  auto record = makeRecord(makeKeys(), "foo.cpp", 42);
+  EXPECT_EQ(
+      json_dumps(record, JSON_COMPACT),
+      R"({"name":"foo.cpp","exists":true,"size":42})");
+  EXPECT_EQ(
+      json_dumps(record, JSON_COMPACT | JSON_SORT_KEYS),
+      json_dumps(makeObject("foo.cpp", 42), JSON_COMPACT | JSON_SORT_KEYS));
+}
+
+TEST(JsonRecord, bser_encoding) {
+  auto keys = makeKeys();
+  auto record = makeRecord(keys, "foo.cpp", 42);
+  for (uint32_t version = 1; version <= 2; ++version) {
+    EXPECT_TRUE(json_equal(bserRoundTrip(version, record), record));
+  }
+
+  // Records that share the template keys and ones that don't
+  auto results = json_array(
+      {makeRecord(keys, "foo.cpp", 42),
+       makeRecord(makeKeys(), "bar.cpp", 1),
+       makeObject("baz.cpp", 2)});
+  json_array_set_template(results, keys);
+  auto expected = json_array(
+      {makeObject("foo.cpp", 42),
+       makeObject("bar.cpp", 1),
+       makeObject("baz.cpp", 2)});
+  for (uint32_t version = 1; version <= 2; ++version) {
+    EXPECT_TRUE(json_equal(bserRoundTrip(version, results), expected));
+  }
+}
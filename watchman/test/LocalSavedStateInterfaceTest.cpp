@@ -6,13 +6,61 @@
  */
 
 #include "watchman/saved_state/LocalSavedStateInterface.h"
+#include <folly/FileUtil.h>
+#include <folly/experimental/TestUtil.h>
 #include <folly/portability/GTest.h>
 #include <folly/test/TestUtils.h>
 #include "watchman/Errors.h"
+#include "watchman/scm/SCM.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 
 using namespace watchman;
 
+namespace {
+
+// Reports a fixed history, most recent commit first
+class FakeSCM : public SCM {
+ public:
+  explicit FakeSCM(std::vector<w_string> history)
+      : SCM("/fake", "/fake"), history_(std::move(history)) {}
+
+  w_string mergeBaseWith(w_string_piece, w_string) const override {
+    return history_.front();
+  }
+  w_string getWorkingCopyCommit(w_string) const override {
+    return history_.front();
+  }
+  std::vector<w_string> getFilesChangedSinceMergeBaseWith(
+      w_string_piece,
+      w_string) const override {
+    return {};
+  }
+  StatusResult getFilesChangedBetweenCommits(
+      std::vector<std::string>,
+      w_string,
+      bool) const override {
+    return {};
+  }
+  std::chrono::time_point<std::chrono::system_clock> getCommitDate(
+      w_string_piece,
+      w_string) const override {
+    return {};
+  }
+  std::vector<w_string> getCommitsPriorToAndIncluding(
+      w_string_piece,
+      int numCommits,
+      w_string) const override {
+    return {
+        history_.begin(),
+        history_.begin() + std::min(size_t(numCommits), history_.size())};
+  }
+
+ private:
+  std::vector<w_string> history_;
+};
+
+} // namespace
+
 void expect_query_parse_error(
     const json_ref& config,
     const char* expectedError) {
@@ -134,3 +182,34 @@ TEST(LocalSavedStateInterfaceTest, path) {
   expectedPath = "/absolute/path/foo/hash_meta";
   EXPECT_EQ(path, expectedPath);
 }
+
+TEST(LocalSavedStateInterfaceTest, finds_most_recent_saved_state) {
+  folly::test::TemporaryDirectory dir("wm-saved-state");
+  auto projectDir = (dir.path() / "foo").string();
+  ASSERT_EQ(0, mkdir(projectDir.c_str(), 0755));
+  auto addState = [&](const char* commit) {
+    folly::writeFile(std::string("state"), (projectDir + "/" + commit).c_str());
+  };
+  auto removeState = [&](const char* commit) {
+    ASSERT_EQ(0, unlink((projectDir + "/" + commit).c_str()));
+  };
+  addState("c2");
+
+  FakeSCM scm({"c4", "c3", "c2", "c1"});
+  LocalSavedStateInterface interface(
+      json_object(
+          {{"local-storage-path",
+            w_string_to_json(w_string(dir.path().string().c_str()))},
+           {"project", w_string_to_json("foo")}}),
+      &scm);
+  EXPECT_EQ(interface.getMostRecentSavedState("c4").commitId, w_string("c2"));
+
+  // Saved states that are added or removed later are noticed
+  addState("c3");
+  EXPECT_EQ(interface.getMostRecentSavedState("c4").commitId, w_string("c3"));
+  removeState("c3");
+  removeState("c2");
+  auto result = interface.getMostRecentSavedState("c4");
+  EXPECT_FALSE(result.commitId);
+  EXPECT_TRUE(result.savedStateInfo.get_default("error"));
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/MemoryProfile.h"
+#include <folly/portability/GTest.h>
+#include <thread>
+
+using namespace watchman;
+
+namespace {
+
+MemoryProfile::TagStats statsOf(MemoryTag tag) {
+  return MemoryProfile::getTagStats()[size_t(tag)];
+}
+
+struct Profiled : MemoryProfiled<Profiled, MemoryTag::PubSub> {
+  char payload[40];
+};
+
+} // namespace
+
+TEST(MemoryProfile, counts_allocations_freed_on_other_threads) {
+  auto before = statsOf(MemoryTag::Pending);
+
+  std::thread([] {
+    for (int i = 0; i < 10; ++i) {
+      MemoryProfile::allocated(MemoryTag::Pending, 100);
+    }
+  }).join();
+
+  // The thread has exited, and its counts are retained
+  auto allocated = statsOf(MemoryTag::Pending);
+  EXPECT_EQ(before.liveBytes + 1000, allocated.liveBytes);
+  EXPECT_EQ(before.liveObjects + 10, allocated.liveObjects);
+  EXPECT_EQ(before.totalBytes + 1000, allocated.totalBytes);
+
+  for (int i = 0; i < 10; ++i) {
+    MemoryProfile::freed(MemoryTag::Pending, 100);
+  }
+  auto freed = statsOf(MemoryTag::Pending);
+  EXPECT_EQ(before.liveBytes, freed.liveBytes);
+  EXPECT_EQ(before.liveObjects, freed.liveObjects);
+  EXPECT_EQ(allocated.totalBytes, freed.totalBytes);
+  EXPECT_EQ(allocated.totalObjects, freed.totalObjects);
+}
+
+TEST(MemoryProfile, profiled_objects_count_their_copies) {
+  auto before = statsOf(MemoryTag::PubSub);
+  {
+    Profiled a;
+    Profiled b = a;
+    auto during = statsOf(MemoryTag::PubSub);
+    EXPECT_EQ(before.liveObjects + 2, during.liveObjects);
+    EXPECT_EQ(
+        before.liveBytes + 2 * int64_t(sizeof(Profiled)), during.liveBytes);
+  }
+  EXPECT_EQ(before.liveObjects, statsOf(MemoryTag::PubSub).liveObjects);
+}
+
+TEST(MemoryProfile, reports_the_heaviest_sampled_sites) {
+  auto interval = MemoryProfile::getSampleInterval();
+  MemoryProfile::setSampleInterval(256);
+  MemoryProfile::clearSamples();
+
+  for (int i = 0; i < 1000; ++i) {
+    MemoryProfile::allocated(MemoryTag::Caches, 1024);
+    MemoryProfile::freed(MemoryTag::Caches, 1024);
+  }
+  MemoryProfile::allocated(MemoryTag::Json, 16);
+  MemoryProfile::freed(MemoryTag::Json, 16);
+
+  auto report = MemoryProfile::getReport(10);
+  MemoryProfile::setSampleInterval(interval);
+
+  // Allocations bigger than the interval are each sampled, though the
+  // loop may have been unrolled into more than one site
+  EXPECT_LE(1000, report.samples);
+  ASSERT_FALSE(report.sites.empty());
+  EXPECT_EQ(MemoryTag::Caches, report.sites[0].tag);
+  uint64_t cachesBytes = 0;
+  for (auto& site : report.sites) {
+    if (site.tag == MemoryTag::Caches) {
+      cachesBytes += site.bytes;
+    }
+  }
+  EXPECT_EQ(1000 * 1024, cachesBytes);
+  EXPECT_EQ(256, report.sampleInterval);
+}
+
+TEST(MemoryProfile, sampling_can_be_turned_off) {
+  auto interval = MemoryProfile::getSampleInterval();
+  MemoryProfile::setSampleInterval(0);
+  MemoryProfile::clearSamples();
+
+  auto before = statsOf(MemoryTag::Caches);
+  for (int i = 0; i < 100; ++i) {
+    MemoryProfile::allocated(MemoryTag::Caches, 1024 * 1024);
+    MemoryProfile::freed(MemoryTag::Caches, 1024 * 1024);
+  }
+  auto report = MemoryProfile::getReport(10);
+  MemoryProfile::setSampleInterval(interval);
+
+  EXPECT_EQ(0, report.samples);
+  EXPECT_TRUE(report.sites.empty());
+  EXPECT_EQ(
+      before.totalObjects + 100,
+      report.tags[size_t(MemoryTag::Caches)].totalObjects);
+}
+
+TEST(MemoryProfile, names_every_tag) {
+  for (size_t i = 0; i < kNumMemoryTags; ++i) {
+    EXPECT_STRNE("unknown", memoryTagName(MemoryTag(i)));
+  }
+}
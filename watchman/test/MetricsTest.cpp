@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/Metrics.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(Metrics, histogram_buckets_durations) {
+  LatencyHistogram histogram;
+  histogram.record(50us);
+  histogram.record(100us);
+  histogram.record(3ms);
+  histogram.record(1h);
+
+  auto snap = histogram.snapshot();
+  EXPECT_EQ(4, snap.count);
+  EXPECT_EQ(2, snap.buckets[0]);
+  EXPECT_EQ(1, snap.buckets[4]);
+  EXPECT_EQ(1, snap.buckets.back());
+  EXPECT_EQ(50 + 100 + 3000 + 3600000000ull, snap.sumUs);
+}
+
+TEST(Metrics, command_latency_is_stable) {
+  auto& a = commandLatency("metrics-test-a");
+  EXPECT_EQ(&a, &commandLatency("metrics-test-a"));
+  a.record(1ms);
+
+  size_t seen = 0;
+  forEachCommandLatency(
+      [&](const std::string& name, const LatencyHistogram& histogram) {
+        if (name == "metrics-test-a") {
+          ++seen;
+          EXPECT_EQ(1, histogram.snapshot().count);
+        }
+      });
+  EXPECT_EQ(1, seen);
+}
+
+TEST(Metrics, writes_openmetrics_text) {
+  LatencyHistogram histogram;
+  histogram.record(2ms);
+
+  OpenMetricsWriter writer;
+  writer.family("watchman_clients", "gauge", "Connected clients");
+  writer.gauge("watchman_clients", {}, 3);
+  writer.family("watchman_recrawls", "counter", "Recrawls");
+  writer.counter("watchman_recrawls", {{"root", "/a \"b\""}}, 2);
+  writer.family("watchman_sync_seconds", "histogram", "Sync time");
+  writer.histogram(
+      "watchman_sync_seconds", {{"root", "/a"}}, histogram.snapshot());
+  auto text = writer.finish();
+
+  EXPECT_NE(std::string::npos, text.find("# TYPE watchman_clients gauge\n"));
+  EXPECT_NE(std::string::npos, text.find("\nwatchman_clients 3\n"));
+  EXPECT_NE(
+      std::string::npos,
+      text.find("\nwatchman_recrawls_total{root=\"/a \\\"b\\\"\"} 2\n"));
+  // Buckets are cumulative
+  EXPECT_NE(
+      std::string::npos,
+      text.find("_bucket{root=\"/a\",le=\"0.001\"} 0\n"));
+  EXPECT_NE(
+      std::string::npos,
+      text.find("_bucket{root=\"/a\",le=\"0.0025\"} 1\n"));
+  EXPECT_NE(
+      std::string::npos, text.find("_bucket{root=\"/a\",le=\"+Inf\"} 1\n"));
+  EXPECT_NE(
+      std::string::npos,
+      text.find("\nwatchman_sync_seconds_count{root=\"/a\"} 1\n"));
+
+  std::string eof = "\n# EOF\n";
+  ASSERT_GT(text.size(), eof.size());
+  EXPECT_EQ(eof, text.substr(text.size() - eof.size()));
+}
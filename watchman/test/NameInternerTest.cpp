@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NameInterner.h"
+#include <folly/portability/GTest.h>
+
+using watchman::NameInterner;
+
+TEST(NameInterner, equal_names_share_storage) {
+  NameInterner interner;
+  std::string src = "src";
+  auto a = interner.intern(src);
+  auto b = interner.intern(w_string("src", W_STRING_BYTE));
+  auto c = interner.intern("lib");
+
+  EXPECT_EQ(a, w_string("src", W_STRING_BYTE));
+  EXPECT_EQ(a.data(), b.data());
+  EXPECT_NE(a.data(), c.data());
+  EXPECT_EQ(2, interner.size());
+}
+
+TEST(NameInterner, prune_drops_unreferenced_names) {
+  NameInterner interner;
+  auto kept = interner.intern("kept");
+  interner.intern("dropped");
+  EXPECT_EQ(2, interner.size());
+
+  EXPECT_EQ(1, interner.prune());
+  EXPECT_EQ(1, interner.size());
+  EXPECT_EQ(kept.data(), interner.intern("kept").data());
+
+  kept.reset();
+  EXPECT_EQ(1, interner.prune());
+  EXPECT_EQ(0, interner.size());
+}
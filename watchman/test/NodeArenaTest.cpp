@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/NodeArena.h"
+#include <folly/portability/GTest.h>
+#include <cstring>
+#include <vector>
+
+using watchman::NodeArena;
+
+TEST(NodeArena, blocks_are_distinct_and_reused) {
+  NodeArena arena;
+  auto* a = arena.allocate(100);
+  auto* b = arena.allocate(100);
+  EXPECT_NE(a, b);
+  memset(a, 'a', 100);
+  memset(b, 'b', 100);
+
+  auto stats = arena.stats();
+  EXPECT_EQ(1, stats.numSlabs);
+  EXPECT_EQ(2, stats.liveBlocks);
+  EXPECT_EQ(224, stats.liveBytes);
+
+  arena.deallocate(a, 100);
+  // A size that rounds to the same class gets the freed block back
+  auto* c = arena.allocate(97);
+  EXPECT_EQ(a, c);
+  EXPECT_EQ('b', static_cast<char*>(b)[99]);
+
+  arena.deallocate(b, 100);
+  arena.deallocate(c, 97);
+  EXPECT_EQ(0, arena.stats().liveBlocks);
+}
+
+TEST(NodeArena, trim_releases_only_empty_slabs) {
+  NodeArena arena;
+  std::vector<void*> blocks;
+  // Enough blocks to span several slabs
+  for (size_t i = 0; i < 3 * NodeArena::kSlabSize / 64; ++i) {
+    blocks.push_back(arena.allocate(64));
+  }
+  auto slabs = arena.stats().numSlabs;
+  EXPECT_GE(slabs, 3);
+
+  // Nothing is empty yet
+  EXPECT_EQ(0, arena.trim());
+
+  // Keep one block alive so that its slab is retained
+  auto* survivor = blocks.back();
+  blocks.pop_back();
+  for (auto* block : blocks) {
+    arena.deallocate(block, 64);
+  }
+
+  EXPECT_EQ((slabs - 1) * NodeArena::kSlabSize, arena.trim());
+  auto stats = arena.stats();
+  EXPECT_EQ(1, stats.numSlabs);
+  EXPECT_EQ(1, stats.liveBlocks);
+
+  arena.deallocate(survivor, 64);
+  EXPECT_EQ(NodeArena::kSlabSize, arena.trim());
+  EXPECT_EQ(0, arena.stats().numSlabs);
+}
+
+TEST(NodeArena, large_allocations_bypass_slabs) {
+  NodeArena arena;
+  auto* big = arena.allocate(NodeArena::kMaxBlockSize + 1);
+  memset(big, 0, NodeArena::kMaxBlockSize + 1);
+  EXPECT_EQ(0, arena.stats().numSlabs);
+  arena.deallocate(big, NodeArena::kMaxBlockSize + 1);
+}
+
+TEST(NodeArena, huge_page_slabs_are_trimmed_and_reused) {
+  NodeArena arena(/*hugePages=*/true);
+  std::vector<void*> blocks;
+  for (size_t i = 0; i < 3 * NodeArena::kSlabSize / 64; ++i) {
+    blocks.push_back(arena.allocate(64));
+    memset(blocks.back(), 'x', 64);
+  }
+  auto slabs = arena.stats().numSlabs;
+  for (auto* block : blocks) {
+    arena.deallocate(block, 64);
+  }
+  EXPECT_EQ(slabs * NodeArena::kSlabSize, arena.trim());
+  EXPECT_EQ(0, arena.stats().numSlabs);
+
+  // A trimmed slab can be carved again
+  auto* block = arena.allocate(64);
+  memset(block, 'y', 64);
+  EXPECT_EQ(1, arena.stats().numSlabs);
+  arena.deallocate(block, 64);
+}
+
+TEST(NodeArena, blocks_return_to_their_own_arena) {
+  NodeArena owner;
+  NodeArena other;
+  auto* block = owner.allocate(32);
+  other.deallocate(block, 32);
+  EXPECT_EQ(0, owner.stats().liveBlocks);
+  EXPECT_EQ(0, other.stats().liveBlocks);
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PathFilter.h"
+#include <fmt/format.h>
+#include <folly/portability/GTest.h>
+
+using watchman::PathFilter;
+
+TEST(PathFilter, path_hash_matches_child_hashes) {
+  auto a = PathFilter::hashChild(PathFilter::kRootHash, "a");
+  auto ab = PathFilter::hashChild(a, "b");
+
+  EXPECT_EQ(PathFilter::kRootHash, PathFilter::hashPath(""));
+  EXPECT_EQ(a, PathFilter::hashPath("a"));
+  EXPECT_EQ(ab, PathFilter::hashPath("a/b"));
+  EXPECT_NE(ab, PathFilter::hashPath("b/a"));
+  EXPECT_NE(ab, PathFilter::hashPath("ab"));
+  EXPECT_NE(ab, PathFilter::hashPath("a//b"));
+}
+
+TEST(PathFilter, inserted_paths_are_never_missed) {
+  PathFilter filter;
+  filter.reset(1000);
+  for (int i = 0; i < 1000; ++i) {
+    filter.insert(PathFilter::hashPath(fmt::format("dir{}/file{}", i % 7, i)));
+  }
+  EXPECT_FALSE(filter.full());
+
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(filter.mayContain(
+        PathFilter::hashPath(fmt::format("dir{}/file{}", i % 7, i))));
+  }
+
+  size_t falsePositives = 0;
+  for (int i = 0; i < 10000; ++i) {
+    if (filter.mayContain(PathFilter::hashPath(fmt::format("other{}", i)))) {
+      ++falsePositives;
+    }
+  }
+  EXPECT_LT(falsePositives, 100);
+}
+
+TEST(PathFilter, reports_full_at_capacity) {
+  PathFilter filter;
+  filter.reset(10);
+  size_t inserted = 0;
+  while (!filter.full()) {
+    filter.insert(PathFilter::hashPath(fmt::format("file{}", inserted++)));
+  }
+  EXPECT_GE(inserted, 10);
+  EXPECT_EQ(inserted, filter.size());
+
+  filter.reset(10);
+  EXPECT_EQ(0, filter.size());
+  EXPECT_FALSE(filter.mayContain(PathFilter::hashPath("file0")));
+}
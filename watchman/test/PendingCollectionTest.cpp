@@ -7,10 +7,14 @@
 
 #include "watchman/PendingCollection.h"
 #include "watchman/Logging.h"
+#include "watchman/watchman_dir.h"
 
 #include <folly/logging/xlog.h>
 #include <folly/portability/GTest.h>
 #include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
 
 using namespace watchman;
 
@@ -119,6 +123,144 @@ TEST(Pending, bench) {
   }
 }
 
+TEST(Pending, pushed_batches_are_consolidated_by_the_consumer) {
+  PendingCollection coll;
+  auto now = std::chrono::system_clock::now();
+  const size_t kProducers = 4;
+  const size_t kItemsPerProducer = 1000;
+
+  std::vector<std::thread> producers;
+  for (size_t p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&coll, now, kItemsPerProducer] {
+      for (size_t i = 0; i < kItemsPerProducer; ++i) {
+        // Every producer reports the same paths, so they must consolidate.
+        PendingChanges batch;
+        batch.add(
+            w_string::build("/some/path/file", i), now, W_PENDING_VIA_NOTIFY);
+        coll.push(batch.stealItems(), batch.stealSyncs());
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  auto lock = coll.lockAndWait(std::chrono::milliseconds(0));
+  EXPECT_EQ(kItemsPerProducer, lock->getPendingItemCount());
+  EXPECT_EQ(kItemsPerProducer, process_items(lock));
+}
+
+TEST(Pending, recursive_dirs_obsolete_their_children) {
+  PendingChanges changes;
+  auto now = std::chrono::system_clock::now();
+
+  changes.add(w_string{"/root/a/b/c"}, now, W_PENDING_CRAWL_ONLY);
+  changes.add(w_string{"/root/a/b/d/e"}, now, W_PENDING_VIA_NOTIFY);
+  changes.add(w_string{"/root/a/b/f"}, now, W_PENDING_VIA_NOTIFY);
+  changes.add(w_string{"/root/a/bc"}, now, W_PENDING_VIA_NOTIFY);
+  changes.add(w_string{"/root/a"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(5, changes.getPendingItemCount());
+
+  // The children go at once, but not the crawl, the sibling "bc" or "a"
+  changes.add(w_string{"/root/a/b"}, now, W_PENDING_RECURSIVE);
+  EXPECT_EQ(4, changes.getPendingItemCount());
+
+  // The crawl of "/root/a/b/c" sorts between "/root/a/b" and this, but
+  // doesn't hide the recursive entry
+  changes.add(w_string{"/root/a/b/d"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(4, changes.getPendingItemCount());
+
+  size_t listed = 0;
+  for (auto p = changes.stealItems(); p; p = std::move(p->next)) {
+    ++listed;
+  }
+  EXPECT_EQ(4, listed);
+}
+
+TEST(Pending, children_of_dirs_are_consolidated_by_dir) {
+  PendingChanges changes;
+  auto now = std::chrono::system_clock::now();
+  watchman_dir root{w_string{"/root"}, nullptr};
+  watchman_dir a{w_string{"a"}, &root};
+
+  changes.add(&a, "x", now, W_PENDING_VIA_NOTIFY);
+  changes.add(&a, "x", now, W_PENDING_VIA_NOTIFY);
+  // The same path, added by path, finds the same entry
+  changes.add(w_string{"/root/a/x"}, now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(1, changes.getPendingItemCount());
+
+  // A recursive entry for a prunes its children and obsoletes new ones,
+  // except for cookies
+  changes.add(&root, "a", now, W_PENDING_RECURSIVE);
+  EXPECT_EQ(1, changes.getPendingItemCount());
+  changes.add(&a, "y", now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(1, changes.getPendingItemCount());
+  changes.add(&a, ".watchman-cookie-1", now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(2, changes.getPendingItemCount());
+
+  std::vector<w_string> paths;
+  for (auto p = changes.stealItems(); p; p = std::move(p->next)) {
+    paths.push_back(p->path);
+  }
+  EXPECT_EQ(
+      (std::vector<w_string>{
+          w_string{"/root/a/.watchman-cookie-1"}, w_string{"/root/a"}}),
+      paths);
+
+  // Nothing is left indexed once the items have been taken
+  changes.add(&a, "x", now, W_PENDING_VIA_NOTIFY);
+  EXPECT_EQ(1, changes.getPendingItemCount());
+}
+
+TEST(Pending, moves_survive_consolidation) {
+  PendingChanges changes;
+  auto now = std::chrono::system_clock::now();
+
+  changes.add(w_string{"/root/b"}, now, W_PENDING_VIA_NOTIFY);
+  changes.addMove(
+      w_string{"/root/a"}, w_string{"/root/b"}, now, W_PENDING_VIA_NOTIFY);
+  changes.addMove(
+      w_string{"/root/c"}, w_string{"/root/d"}, now, W_PENDING_VIA_NOTIFY);
+
+  // Handed over in a batch, a move lands on the entry already there
+  PendingChanges batch;
+  batch.addMove(
+      w_string{"/root/e"}, w_string{"/root/f"}, now, W_PENDING_VIA_NOTIFY);
+  changes.add(w_string{"/root/f"}, now, W_PENDING_VIA_NOTIFY);
+  changes.append(batch.stealItems(), {});
+  EXPECT_EQ(3, changes.getPendingItemCount());
+
+  std::map<w_string, w_string> moves;
+  for (auto p = changes.stealItems(); p; p = std::move(p->next)) {
+    moves[p->path] = p->movedFrom;
+  }
+  EXPECT_EQ(w_string{"/root/a"}, moves[w_string{"/root/b"}]);
+  EXPECT_EQ(w_string{"/root/c"}, moves[w_string{"/root/d"}]);
+  EXPECT_EQ(w_string{"/root/e"}, moves[w_string{"/root/f"}]);
+}
+
+TEST(Pending, push_wakes_a_waiting_consumer) {
+  PendingCollection coll;
+  auto now = std::chrono::system_clock::now();
+
+  std::thread producer([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    PendingChanges batch;
+    batch.add(w_string{"/some/path"}, now, W_PENDING_VIA_NOTIFY);
+    coll.push(batch.stealItems(), batch.stealSyncs());
+  });
+
+  // Without the wakeup this would block forever.  Loop in case of a
+  // spurious wakeup.
+  size_t drained = 0;
+  while (drained == 0) {
+    auto lock = coll.lockAndWait(std::chrono::milliseconds(-1));
+    drained = process_items(lock);
+  }
+  EXPECT_EQ(1, drained);
+  producer.join();
+}
+
 namespace {
 
 template <typename Collection>
@@ -10,6 +10,7 @@
 #include <folly/ScopeGuard.h>
 #include <folly/portability/GTest.h>
 #include "watchman/WatchmanConfig.h"
+#include "watchman/bser.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 
 using namespace watchman;
@@ -122,3 +123,29 @@ TEST(Perf, large_samples_are_passed_in_stdin) {
   EXPECT_EQ("{\"value\": 1}", stdin_calls[0]);
   EXPECT_EQ("{\"value\": 2}", stdin_calls[1]);
 }
+
+TEST(Perf, sample_batches_are_length_prefixed_bser) {
+  auto samples = json_array({make_sample(1), make_sample(2)});
+  auto pdu = encodeSampleBatch(samples, 3);
+
+  ASSERT_GT(pdu.size(), 2);
+  EXPECT_EQ(std::string(BSER_V2_MAGIC, 2), pdu.substr(0, 2));
+
+  // v2 pdus carry their 32 bit capabilities ahead of the length
+  const char* buf = pdu.data() + 2 + sizeof(uint32_t);
+  const char* end = pdu.data() + pdu.size();
+  json_int_t needed;
+  json_int_t length;
+  ASSERT_TRUE(bunser_int(buf, end - buf, &needed, &length));
+  buf += needed;
+  EXPECT_EQ(end - buf, length);
+
+  json_error_t jerr;
+  auto batch = bunser(buf, end, &needed, &jerr);
+  ASSERT_TRUE(batch);
+  EXPECT_EQ(3, json_integer_value(batch.get("dropped_samples")));
+  auto& decoded = batch.get("samples").array();
+  ASSERT_EQ(2, decoded.size());
+  EXPECT_EQ(1, json_integer_value(decoded[0].get("value")));
+  EXPECT_EQ(2, json_integer_value(decoded[1].get("value")));
+}
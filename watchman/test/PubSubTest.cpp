@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/PubSub.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+
+namespace {
+
+std::vector<std::shared_ptr<const Publisher::Item>> drain(
+    const std::shared_ptr<Publisher::Subscriber>& sub) {
+  std::vector<std::shared_ptr<const Publisher::Item>> pending;
+  sub->getPending(pending);
+  return pending;
+}
+
+} // namespace
+
+TEST(PubSub, unbounded_publisher_retains_everything) {
+  auto pub = std::make_shared<Publisher>();
+  auto sub = pub->subscribe(nullptr);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_TRUE(pub->enqueue(json_integer(i)));
+  }
+  auto pending = drain(sub);
+  ASSERT_EQ(100, pending.size());
+  EXPECT_EQ(0, pending.front()->payload.asInt());
+  EXPECT_EQ(99, pending.back()->payload.asInt());
+  EXPECT_TRUE(drain(sub).empty());
+}
+
+TEST(PubSub, lagging_subscriber_gets_lag_payload) {
+  auto pub = std::make_shared<Publisher>(
+      3, json_object({{"resync", json_true()}}));
+  auto slow = pub->subscribe(nullptr);
+  auto fast = pub->subscribe(nullptr);
+
+  for (int i = 0; i < 10; ++i) {
+    pub->enqueue(json_integer(i));
+    // The fast subscriber keeps up and never misses anything
+    auto pending = drain(fast);
+    ASSERT_EQ(1, pending.size());
+    EXPECT_EQ(i, pending.front()->payload.asInt());
+  }
+
+  auto pending = drain(slow);
+  ASSERT_EQ(4, pending.size());
+  EXPECT_TRUE(pending[0]->payload.get("resync").asBool());
+  EXPECT_EQ(7, pending[1]->payload.asInt());
+  EXPECT_EQ(9, pending[3]->payload.asInt());
+
+  // Having caught up, the marker isn't repeated
+  pub->enqueue(json_integer(10));
+  pending = drain(slow);
+  ASSERT_EQ(1, pending.size());
+  EXPECT_EQ(10, pending.front()->payload.asInt());
+
+  auto info = pub->getDebugInfo();
+  EXPECT_EQ(8, info.get("dropped_items").asInt());
+  EXPECT_EQ(3, info.get("items").array().size());
+  EXPECT_EQ(7, info.get("subscribers").array()[0].get("missed").asInt());
+}
+
+TEST(PubSub, stats_summarize_the_queue) {
+  auto pub = std::make_shared<Publisher>();
+  auto slow = pub->subscribe(nullptr);
+  auto fast = pub->subscribe(nullptr);
+  for (int i = 0; i < 5; ++i) {
+    pub->enqueue(json_integer(i));
+  }
+  drain(fast);
+
+  auto stats = pub->getStats();
+  EXPECT_EQ(2, stats.numSubscribers);
+  EXPECT_EQ(5, stats.queuedItems);
+  EXPECT_EQ(5, stats.maxSubscriberLag);
+  EXPECT_EQ(0, stats.droppedItems);
+
+  drain(slow);
+  EXPECT_EQ(0, pub->getStats().maxSubscriberLag);
+}
+
+TEST(PubSub, has_subscribers_follows_registrations) {
+  auto pub = std::make_shared<Publisher>();
+  EXPECT_FALSE(pub->hasSubscribers());
+  EXPECT_FALSE(pub->enqueue(json_integer(0)));
+
+  auto sub = pub->subscribe(nullptr);
+  EXPECT_TRUE(pub->hasSubscribers());
+  EXPECT_TRUE(drain(sub).empty());
+  EXPECT_TRUE(pub->enqueue(json_integer(1)));
+  EXPECT_EQ(1, pub->getStats().queuedItems);
+
+  sub.reset();
+  EXPECT_FALSE(pub->hasSubscribers());
+  EXPECT_EQ(0, pub->getStats().queuedItems);
+}
+
+TEST(PubSub, subscribers_resume_where_they_left_off) {
+  auto pub = std::make_shared<Publisher>();
+  auto first = pub->subscribe(nullptr);
+  pub->enqueue(json_integer(0));
+  pub->enqueue(json_integer(1));
+  auto second = pub->subscribe(nullptr);
+  pub->enqueue(json_integer(2));
+
+  // The items retained for the first are there for the second, too
+  EXPECT_EQ(3, drain(second).size());
+  EXPECT_TRUE(drain(second).empty());
+
+  auto pending = drain(first);
+  ASSERT_EQ(3, pending.size());
+  pub->enqueue(json_integer(3));
+  pending = drain(first);
+  ASSERT_EQ(1, pending.size());
+  EXPECT_EQ(3, pending.front()->payload.asInt());
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Benchmarks for query execution against a synthetic, fully crawled view:
+// each generator, expression evaluation and field rendering.  Run with eg:
+//   QueryBenchmark --depth=6 --fanout=4 --files=16
+
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <folly/init/Init.h>
+#include <folly/portability/GFlags.h>
+#include "watchman/InMemoryView.h"
+#include "watchman/query/BserResultsRenderer.h"
+#include "watchman/query/Query.h"
+#include "watchman/query/QueryResult.h"
+#include "watchman/query/eval.h"
+#include "watchman/query/parse.h"
+#include "watchman/root/Root.h"
+#include "watchman/saved_state/SavedStateFactory.h"
+#include "watchman/test/lib/FakeFileSystem.h"
+#include "watchman/test/lib/FakeWatcher.h"
+
+DEFINE_int32(depth, 5, "depth of the synthetic directory tree");
+DEFINE_int32(fanout, 4, "number of subdirectories in each directory");
+DEFINE_int32(files, 8, "number of files in each directory");
+
+using namespace watchman;
+
+namespace {
+
+const w_string kRootPath{"/root"};
+
+void buildTree(FakeFileSystem& fs, const std::string& parent, int depth) {
+  for (int i = 0; i < FLAGS_files; ++i) {
+    auto ext = i % 2 ? ".cpp" : ".h";
+    fs.addNode(
+        folly::to<std::string>(parent, "/file", i, ext).c_str(),
+        fs.fakeFile());
+  }
+  for (int i = 0; i < FLAGS_fanout; ++i) {
+    auto dir = folly::to<std::string>(parent, "/dir", i);
+    fs.addNode(dir.c_str(), fs.fakeDir());
+    if (depth > 1) {
+      buildTree(fs, dir, depth - 1);
+    }
+  }
+}
+
+// A root whose view has completed its initial crawl of the synthetic tree
+struct SyntheticRoot {
+  FakeFileSystem fs;
+  Configuration config;
+  std::shared_ptr<FakeWatcher> watcher = std::make_shared<FakeWatcher>(fs);
+  std::shared_ptr<InMemoryView> view =
+      std::make_shared<InMemoryView>(fs, kRootPath, config, watcher);
+  std::shared_ptr<Root> root;
+
+  SyntheticRoot() {
+    fs.addNode(kRootPath.c_str(), fs.fakeDir());
+    buildTree(fs, kRootPath.string(), FLAGS_depth);
+
+    root = std::make_shared<Root>(
+        fs, kRootPath, "fs_type", w_string_to_json("{}"), config, view, [] {});
+
+    auto& pending = view->unsafeAccessPendingFromWatcher();
+    pending.lock()->ping();
+    InMemoryView::IoThreadState state{std::chrono::minutes(5)};
+    view->stepIoThread(root, state, pending);
+  }
+};
+
+SyntheticRoot& syntheticRoot() {
+  static auto* root = new SyntheticRoot;
+  return *root;
+}
+
+void runQuery(size_t iters, const char* spec, bool bser = false) {
+  std::shared_ptr<Query> query;
+  BENCHMARK_SUSPEND {
+    json_error_t err;
+    auto json = json_loads(spec, 0, &err);
+    // Don't measure the cookie sync; the fake watcher never observes it.
+    json.set("sync_timeout", json_integer(0));
+    query = parseQuery(syntheticRoot().root, json);
+  }
+  for (size_t n = 0; n < iters; ++n) {
+    auto res = w_query_execute(
+        query.get(),
+        syntheticRoot().root,
+        nullptr,
+        getInterface,
+        nullptr,
+        bser ? std::make_unique<BserResultsRenderer>(2, 0) : nullptr);
+    folly::doNotOptimizeAway(res);
+  }
+}
+
+} // namespace
+
+BENCHMARK(generator_all_files, iters) {
+  runQuery(iters, R"({"fields": ["name"]})");
+}
+
+BENCHMARK_RELATIVE(generator_time, iters) {
+  runQuery(iters, R"({"since": 1, "fields": ["name"]})");
+}
+
+BENCHMARK_RELATIVE(generator_path, iters) {
+  runQuery(iters, R"({"path": [""], "fields": ["name"]})");
+}
+
+BENCHMARK_RELATIVE(generator_glob, iters) {
+  runQuery(iters, R"({"glob": ["**/*.cpp"], "fields": ["name"]})");
+}
+
+BENCHMARK_RELATIVE(generator_suffix, iters) {
+  runQuery(iters, R"({"expression": ["suffix", "cpp"], "fields": ["name"]})");
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(expression_type, iters) {
+  runQuery(iters, R"({"expression": ["type", "f"], "fields": ["name"]})");
+}
+
+BENCHMARK_RELATIVE(expression_compound, iters) {
+  runQuery(
+      iters,
+      R"({"expression": ["allof", ["type", "f"],
+            ["anyof", ["match", "*3*"], ["dirname", "dir1"]],
+            ["not", ["name", "file0.h"]]],
+          "fields": ["name"]})");
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(render_name, iters) {
+  runQuery(iters, R"({"fields": ["name"]})");
+}
+
+BENCHMARK_RELATIVE(render_common_fields, iters) {
+  runQuery(
+      iters,
+      R"({"fields": ["name", "exists", "new", "size", "mtime_ms", "type"]})");
+}
+
+BENCHMARK_RELATIVE(render_common_fields_bser, iters) {
+  runQuery(
+      iters,
+      R"({"fields": ["name", "exists", "new", "size", "mtime_ms", "type"]})",
+      true);
+}
+
+int main(int argc, char** argv) {
+  folly::init(&argc, &argv);
+  // Crawl up front so that it isn't part of the first timing
+  syntheticRoot();
+  folly::runBenchmarks();
+  return 0;
+}
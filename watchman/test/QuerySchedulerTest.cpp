@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/QueryScheduler.h"
+#include <folly/portability/GTest.h>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "watchman/Errors.h"
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+size_t numWaiting(const QueryScheduler& scheduler) {
+  return scheduler.getStats().waiting;
+}
+
+void waitForWaiters(const QueryScheduler& scheduler, size_t count) {
+  while (numWaiting(scheduler) < count) {
+    std::this_thread::sleep_for(1ms);
+  }
+}
+
+} // namespace
+
+TEST(QueryScheduler, admits_everything_without_limits) {
+  QueryScheduler scheduler{QueryScheduler::Options{}};
+  auto now = QueryScheduler::Clock::now();
+  for (int i = 0; i < 100; ++i) {
+    auto ticket = scheduler.admit(42, now);
+    ticket.release(now + 1s);
+  }
+  auto stats = scheduler.getStats(now);
+  ASSERT_EQ(1, stats.clients.size());
+  EXPECT_EQ(100, stats.clients[0].admitted);
+  EXPECT_EQ(0, stats.clients[0].rejected);
+  EXPECT_EQ(100s, stats.clients[0].totalCost);
+}
+
+TEST(QueryScheduler, refuses_a_client_over_budget_until_it_refills) {
+  QueryScheduler::Options options;
+  options.costPerSecond = 100ms;
+  options.costBurst = 200ms;
+  QueryScheduler scheduler{options};
+
+  auto now = QueryScheduler::Clock::now();
+  scheduler.admit(42, now).release(now + 300ms);
+
+  // Overspent by 100ms, so it takes a second to get back into credit
+  try {
+    scheduler.admit(42, now + 300ms);
+    FAIL() << "expected the query to be refused";
+  } catch (const QueryAdmissionError& err) {
+    EXPECT_EQ(1010ms, err.retryAfter);
+  }
+
+  // Other clients, and those whose pid isn't known, are unaffected
+  scheduler.admit(43, now + 300ms).release(now + 300ms);
+  scheduler.admit(0, now + 300ms).release(now + 300ms);
+
+  scheduler.admit(42, now + 1400ms).release(now + 1400ms);
+
+  auto stats = scheduler.getStats(now + 1400ms);
+  ASSERT_EQ(3, stats.clients.size());
+  EXPECT_EQ(43, stats.clients[2].pid);
+  EXPECT_EQ(42, stats.clients[1].pid);
+  EXPECT_EQ(2, stats.clients[1].admitted);
+  EXPECT_EQ(1, stats.clients[1].rejected);
+}
+
+TEST(QueryScheduler, lets_the_least_costly_client_in_first) {
+  QueryScheduler::Options options;
+  options.maxConcurrent = 1;
+  QueryScheduler scheduler{options};
+
+  // pid 42 has been busy
+  auto now = QueryScheduler::Clock::now();
+  scheduler.admit(42, now).release(now + 5s);
+
+  auto running = std::make_optional(scheduler.admit(1));
+
+  std::vector<pid_t> order;
+  std::mutex orderMutex;
+  auto query = [&](pid_t pid) {
+    auto ticket = scheduler.admit(pid);
+    std::lock_guard<std::mutex> lock(orderMutex);
+    order.push_back(pid);
+  };
+
+  // The busy client asks first but the other one goes first
+  std::thread busy(query, 42);
+  waitForWaiters(scheduler, 1);
+  std::thread idle(query, 43);
+  waitForWaiters(scheduler, 2);
+
+  running.reset();
+  busy.join();
+  idle.join();
+
+  EXPECT_EQ((std::vector<pid_t>{43, 42}), order);
+  EXPECT_EQ(0, scheduler.getStats().running);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/RelayPathMap.h"
+#include <folly/portability/GTest.h>
+#include "watchman/Errors.h"
+
+using namespace watchman;
+
+namespace {
+
+RelayPathMap makeMap() {
+  return RelayPathMap(json_object(
+      {{"/workspace", typed_string_to_json("/ci/jobs/1/checkout")},
+       {"/workspace/cache/", typed_string_to_json("/ci/cache")}}));
+}
+
+} // namespace
+
+TEST(RelayPathMap, translates_dirs_and_their_contents) {
+  auto map = makeMap();
+  EXPECT_EQ(w_string("/ci/jobs/1/checkout"), map.toUpstream("/workspace"));
+  EXPECT_EQ(
+      w_string("/ci/jobs/1/checkout/a/b"), map.toUpstream("/workspace/a/b"));
+  EXPECT_EQ(w_string("/ci/cache/x"), map.toUpstream("/workspace/cache/x"));
+  EXPECT_FALSE(map.toUpstream("/workspaces"));
+  EXPECT_FALSE(map.toUpstream("/etc"));
+
+  EXPECT_EQ(w_string("/workspace/a"), map.toLocal("/ci/jobs/1/checkout/a"));
+  EXPECT_EQ(w_string("/workspace/cache"), map.toLocal("/ci/cache"));
+  EXPECT_FALSE(map.toLocal("/ci/jobs/2/checkout"));
+}
+
+TEST(RelayPathMap, translates_the_root_of_requests) {
+  auto map = makeMap();
+  auto request = json_array(
+      {typed_string_to_json("watch-project"),
+       typed_string_to_json("/workspace/src")});
+  map.translateRequest(request);
+  EXPECT_EQ(
+      w_string("/ci/jobs/1/checkout/src"),
+      json_to_w_string(request.array()[1]));
+
+  // Not paths, so left as they are
+  auto logLevel = json_array(
+      {typed_string_to_json("log-level"), typed_string_to_json("debug")});
+  map.translateRequest(logLevel);
+  EXPECT_EQ(w_string("debug"), json_to_w_string(logLevel.array()[1]));
+
+  auto outside = json_array(
+      {typed_string_to_json("watch"), typed_string_to_json("/etc")});
+  EXPECT_THROW(map.translateRequest(outside), CommandValidationError);
+}
+
+TEST(RelayPathMap, translates_the_roots_of_responses) {
+  auto map = makeMap();
+  auto response = json_object(
+      {{"watch", typed_string_to_json("/ci/jobs/1/checkout")},
+       {"relative_path", typed_string_to_json("src")},
+       {"roots",
+        json_array(
+            {typed_string_to_json("/ci/jobs/1/checkout"),
+             typed_string_to_json("/ci/jobs/2/checkout")})}});
+  map.translateResponse(response);
+  EXPECT_EQ(w_string("/workspace"), json_to_w_string(response.get("watch")));
+  EXPECT_EQ(w_string("src"), json_to_w_string(response.get("relative_path")));
+
+  // Other clients' roots are left out
+  auto& roots = response.get("roots").array();
+  ASSERT_EQ(1, roots.size());
+  EXPECT_EQ(w_string("/workspace"), json_to_w_string(roots[0]));
+}
+
+TEST(RelayPathMap, rejects_relative_dirs) {
+  EXPECT_THROW(
+      RelayPathMap(json_object({{"workspace", typed_string_to_json("/ci")}})),
+      std::domain_error);
+}
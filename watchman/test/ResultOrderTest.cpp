@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/ResultOrder.h"
+#include <folly/portability/GTest.h>
+#include "watchman/Errors.h"
+
+using namespace watchman;
+
+namespace {
+
+ResultOrder parse(const char* spec) {
+  return ResultOrder::parse(typed_string_to_json(spec, W_STRING_UNICODE));
+}
+
+ResultPosition position(int64_t value, const char* name) {
+  return ResultPosition{value, w_string{name, W_STRING_UNICODE}};
+}
+
+} // namespace
+
+TEST(ResultOrder, parses_key_and_direction) {
+  auto order = parse("mtime desc");
+  EXPECT_EQ(ResultOrder::Key::MTime, order.key);
+  EXPECT_TRUE(order.descending);
+
+  order = parse("size");
+  EXPECT_EQ(ResultOrder::Key::Size, order.key);
+  EXPECT_FALSE(order.descending);
+
+  order = parse("name asc");
+  EXPECT_EQ(ResultOrder::Key::Name, order.key);
+  EXPECT_FALSE(order.descending);
+
+  EXPECT_THROW(parse("ctime"), QueryParseError);
+  EXPECT_THROW(parse("otime sideways"), QueryParseError);
+  EXPECT_THROW(ResultOrder::parse(json_integer(1)), QueryParseError);
+}
+
+TEST(ResultOrder, breaks_ties_by_name) {
+  auto asc = parse("size");
+  EXPECT_TRUE(asc.before(position(1, "b"), position(2, "a")));
+  EXPECT_TRUE(asc.before(position(1, "a"), position(1, "b")));
+  EXPECT_FALSE(asc.before(position(1, "a"), position(1, "a")));
+
+  auto desc = parse("size desc");
+  EXPECT_TRUE(desc.before(position(2, "a"), position(1, "b")));
+  EXPECT_TRUE(desc.before(position(1, "b"), position(1, "a")));
+  EXPECT_FALSE(desc.before(position(1, "a"), position(1, "a")));
+}
+
+TEST(ResultOrder, continuation_round_trips) {
+  auto order = parse("mtime desc");
+  auto last = position(-1234567890123, "dir/with:colons:in it");
+  auto token = order.encodeContinuation(last);
+  auto decoded = order.decodeContinuation(token);
+  EXPECT_EQ(last.value, decoded.value);
+  EXPECT_EQ(last.name, decoded.name);
+
+  // The token only makes sense to a query with the same order
+  EXPECT_THROW(parse("mtime").decodeContinuation(token), QueryParseError);
+  EXPECT_THROW(parse("size desc").decodeContinuation(token), QueryParseError);
+  EXPECT_THROW(order.decodeContinuation("md:"), QueryParseError);
+  EXPECT_THROW(order.decodeContinuation("md:x:name"), QueryParseError);
+}
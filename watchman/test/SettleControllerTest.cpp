@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SettleController.h"
+#include <folly/portability/GTest.h>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+namespace {
+
+SettleController adaptiveController() {
+  SettleController controller;
+  SettleController::Options options;
+  options.adaptive = true;
+  options.minSettle = 5ms;
+  options.maxSettle = 500ms;
+  controller.setOptions(options);
+  return controller;
+}
+
+} // namespace
+
+TEST(SettleController, uses_fixed_settle_unless_adaptive) {
+  SettleController controller;
+  auto now = std::chrono::steady_clock::now();
+  for (int i = 0; i < 100; ++i) {
+    controller.recordBatch(1000, now + i * 1ms);
+  }
+  EXPECT_EQ(20ms, controller.settleFor(20ms));
+}
+
+TEST(SettleController, trickle_of_changes_settles_quickly) {
+  auto controller = adaptiveController();
+  auto now = std::chrono::steady_clock::now();
+  EXPECT_EQ(5ms, controller.settleFor(20ms));
+
+  for (int i = 0; i < 10; ++i) {
+    controller.recordBatch(1, now + i * 1s);
+  }
+  EXPECT_LT(controller.getRate(), SettleController::kInteractiveRate);
+  EXPECT_EQ(5ms, controller.settleFor(20ms));
+}
+
+TEST(SettleController, flood_of_changes_settles_later) {
+  auto controller = adaptiveController();
+  auto now = std::chrono::steady_clock::now();
+  for (int i = 0; i < 100; ++i) {
+    controller.recordBatch(500, now + i * 10ms);
+  }
+  EXPECT_GE(controller.getRate(), SettleController::kBulkRate);
+  EXPECT_EQ(500ms, controller.settleFor(20ms));
+
+  // Something in between lands in between
+  auto moderate = adaptiveController();
+  for (int i = 0; i < 100; ++i) {
+    moderate.recordBatch(10, now + i * 10ms);
+  }
+  auto settle = moderate.settleFor(20ms);
+  EXPECT_GT(settle, 5ms);
+  EXPECT_LT(settle, 500ms);
+}
+
+TEST(SettleController, forgets_a_flood_once_it_is_over) {
+  auto controller = adaptiveController();
+  auto now = std::chrono::steady_clock::now();
+  for (int i = 0; i < 100; ++i) {
+    controller.recordBatch(500, now + i * 10ms);
+  }
+  EXPECT_EQ(500ms, controller.settleFor(20ms));
+
+  // Somebody edits a file a minute later
+  controller.recordBatch(1, now + 1min);
+  EXPECT_EQ(5ms, controller.settleFor(20ms));
+
+  auto status = controller.getStatus();
+  EXPECT_TRUE(status.get("adaptive").asBool());
+  EXPECT_EQ(5, status.get("settle_ms").asInt());
+  EXPECT_EQ(101, status.get("batches").asInt());
+  EXPECT_EQ(50001, status.get("events").asInt());
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/query/SuffixMatcher.h"
+#include <folly/portability/GTest.h>
+#include <string>
+#include <vector>
+
+using namespace watchman;
+
+TEST(SuffixMatcher, packs_short_extensions_and_ignores_case) {
+  SuffixMatcher matcher({"js", "ts", "tsx", "json", "h"});
+  EXPECT_TRUE(matcher.packed());
+
+  EXPECT_TRUE(matcher.matches("index.js"));
+  EXPECT_TRUE(matcher.matches("INDEX.JS"));
+  EXPECT_TRUE(matcher.matches("Component.TsX"));
+  EXPECT_TRUE(matcher.matches(".h"));
+  EXPECT_TRUE(matcher.matches("a_rather_long_name_for_a_header.h"));
+  EXPECT_FALSE(matcher.matches("h"));
+  EXPECT_FALSE(matcher.matches("js"));
+  EXPECT_FALSE(matcher.matches("indexjs"));
+  EXPECT_FALSE(matcher.matches("index.jsx"));
+  EXPECT_FALSE(matcher.matches("index.js.map"));
+  EXPECT_FALSE(matcher.matches(""));
+  // Only ASCII letters are folded
+  SuffixMatcher punctuation({"@"});
+  EXPECT_FALSE(punctuation.matches("a.`"));
+  EXPECT_TRUE(punctuation.matches("a.@"));
+}
+
+TEST(SuffixMatcher, matches_as_the_suffix_term_did_when_not_packed) {
+  std::string longSuffix(SuffixMatcher::kSlotSize, 'x');
+
+  // A few suffixes are each compared, so a dotted one can match
+  SuffixMatcher few({"tar.gz", longSuffix});
+  EXPECT_FALSE(few.packed());
+  EXPECT_TRUE(few.matches("a.TAR.gz"));
+  EXPECT_TRUE(few.matches("a." + longSuffix));
+  EXPECT_FALSE(few.matches(longSuffix));
+
+  // More are looked up by what follows the last dot, which a dotted one
+  // never is
+  SuffixMatcher many({"tar.gz", "gz", "zip"});
+  EXPECT_FALSE(many.packed());
+  EXPECT_TRUE(many.matches("a.tar.GZ"));
+  EXPECT_TRUE(many.matches("a.zip"));
+  EXPECT_FALSE(many.matches("zip"));
+
+  std::vector<std::string> names;
+  for (size_t i = 0; i <= SuffixMatcher::kMaxPacked; ++i) {
+    names.push_back("s" + std::to_string(i));
+  }
+  auto lots = SuffixMatcher::of(names);
+  EXPECT_FALSE(lots.packed());
+  EXPECT_TRUE(lots.matches("a.s16"));
+  EXPECT_FALSE(lots.matches("a.s17"));
+}
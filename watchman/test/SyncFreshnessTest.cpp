@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/SyncFreshness.h"
+#include <folly/portability/GTest.h>
+#include <thread>
+
+using namespace watchman;
+using namespace std::chrono_literals;
+
+TEST(SyncFreshness, must_sync_until_a_sync_has_been_made) {
+  SyncFreshness freshness;
+  EXPECT_FALSE(freshness.reuse(1h).has_value());
+}
+
+TEST(SyncFreshness, reuses_a_recent_sync) {
+  SyncFreshness freshness;
+  freshness.finish(freshness.start(), true);
+
+  auto reuse = freshness.reuse(1h);
+  ASSERT_TRUE(reuse.has_value());
+  EXPECT_TRUE(reuse->ready.isReady());
+  EXPECT_LE(0ms, reuse->staleness);
+  EXPECT_GT(1h, reuse->staleness);
+
+  // Everything that changed since the sync started may be missing
+  std::this_thread::sleep_for(2ms);
+  EXPECT_FALSE(freshness.reuse(1ms).has_value());
+}
+
+TEST(SyncFreshness, failed_syncs_are_not_reused) {
+  SyncFreshness freshness;
+  freshness.finish(freshness.start(), false);
+  EXPECT_FALSE(freshness.reuse(1h).has_value());
+}
+
+TEST(SyncFreshness, waits_for_the_sync_in_flight) {
+  SyncFreshness freshness;
+  auto first = freshness.start();
+  auto second = freshness.start();
+
+  auto reuse = freshness.reuse(1h);
+  ASSERT_TRUE(reuse.has_value());
+  EXPECT_FALSE(reuse->ready.isReady());
+
+  // It waits on the sync that started first
+  freshness.finish(second, true);
+  EXPECT_FALSE(reuse->ready.isReady());
+  freshness.finish(first, true);
+  EXPECT_TRUE(reuse->ready.isReady());
+  EXPECT_NO_THROW(std::move(reuse->ready).get());
+}
+
+TEST(SyncFreshness, waiting_fails_along_with_the_sync) {
+  SyncFreshness freshness;
+  auto sync = freshness.start();
+  auto reuse = freshness.reuse(1h);
+  ASSERT_TRUE(reuse.has_value());
+
+  freshness.finish(sync, false);
+  EXPECT_THROW(std::move(reuse->ready).get(), std::runtime_error);
+  EXPECT_FALSE(freshness.reuse(1h).has_value());
+}
+
+TEST(SyncFreshness, invalidate_forgets_finished_and_in_flight_syncs) {
+  SyncFreshness freshness;
+  freshness.finish(freshness.start(), true);
+  auto straddling = freshness.start();
+
+  freshness.invalidate();
+  EXPECT_FALSE(freshness.reuse(1h).has_value());
+
+  // It may have missed what the invalidation was for
+  freshness.finish(straddling, true);
+  EXPECT_FALSE(freshness.reuse(1h).has_value());
+
+  freshness.finish(freshness.start(), true);
+  EXPECT_TRUE(freshness.reuse(1h).has_value());
+}
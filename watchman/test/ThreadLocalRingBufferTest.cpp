@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadLocalRingBuffer.h"
+#include <folly/portability/GTest.h>
+#include <thread>
+
+using namespace watchman;
+
+TEST(ThreadLocalRingBufferTest, writes_can_be_read) {
+  ThreadLocalRingBuffer<int> rb{2};
+  rb.write(10);
+  rb.write(11);
+  auto result = rb.readAll();
+  ASSERT_EQ(2, result.size());
+  EXPECT_EQ(10, result[0]);
+  EXPECT_EQ(11, result[1]);
+
+  rb.write(12);
+  result = rb.readAll();
+  ASSERT_EQ(2, result.size());
+  EXPECT_EQ(11, result[0]);
+  EXPECT_EQ(12, result[1]);
+}
+
+TEST(ThreadLocalRingBufferTest, writes_can_be_cleared) {
+  ThreadLocalRingBuffer<int> rb{10};
+  rb.write(3);
+  rb.write(4);
+  EXPECT_EQ(2, rb.readAll().size());
+  rb.clear();
+  rb.write(5);
+  auto result = rb.readAll();
+  ASSERT_EQ(1, result.size());
+  EXPECT_EQ(5, result[0]);
+}
+
+TEST(ThreadLocalRingBufferTest, threads_are_merged_in_write_order) {
+  ThreadLocalRingBuffer<int> rb{4};
+  rb.write(1);
+  std::thread([&] {
+    rb.write(2);
+    rb.write(3);
+  }).join();
+  rb.write(4);
+  // Outlives the thread that wrote it
+  std::thread([&] { rb.write(5); }).join();
+
+  auto result = rb.readAll();
+  EXPECT_EQ((std::vector<int>{2, 3, 4, 5}), result);
+}
+
+TEST(ThreadLocalRingBufferTest, concurrent_writers_keep_their_own_order) {
+  constexpr int kThreads = 4;
+  constexpr int kWrites = 10000;
+  struct Entry {
+    int thread;
+    int index;
+  };
+  ThreadLocalRingBuffer<Entry> rb{64};
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kWrites; ++i) {
+        rb.write({t, i});
+      }
+    });
+  }
+  // Reading while they write sees each thread's entries in order
+  for (int n = 0; n < 100; ++n) {
+    std::vector<int> last(kThreads, -1);
+    for (auto& entry : rb.readAll()) {
+      EXPECT_LT(last[entry.thread], entry.index);
+      last[entry.thread] = entry.index;
+    }
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto result = rb.readAll();
+  EXPECT_EQ(64, result.size());
+}
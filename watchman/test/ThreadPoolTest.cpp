@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadPool.h"
+#include <folly/futures/Future.h>
+#include <folly/portability/GTest.h>
+#include <folly/synchronization/Baton.h>
+#include <string>
+
+using namespace watchman;
+using Priority = ThreadPool::Priority;
+
+TEST(ThreadPool, runs_more_important_work_first) {
+  ThreadPool pool;
+  pool.start(1, 100);
+
+  folly::Baton<> started;
+  folly::Baton<> release;
+  pool.add(Priority::Interactive, [&] {
+    started.post();
+    release.wait();
+  });
+  started.wait();
+
+  // Only accessed by the single worker
+  std::string order;
+  pool.add(Priority::Warming, [&] { order += "w"; });
+  pool.add(Priority::Scm, [&] { order += "s"; });
+  pool.add(Priority::Hashing, [&] { order += "h"; });
+  pool.add([&] { order += "i"; });
+  release.post();
+
+  pool.stop();
+  EXPECT_EQ("ihsw", order);
+}
+
+TEST(ThreadPool, honors_concurrency_limits) {
+  ThreadPool pool;
+  pool.setConcurrencyLimit(Priority::Hashing, 1);
+  pool.start(2, 100);
+
+  folly::Baton<> started;
+  folly::Baton<> release;
+  pool.add(Priority::Hashing, [&] {
+    started.post();
+    release.wait();
+  });
+  started.wait();
+
+  folly::Baton<> secondRan;
+  pool.add(Priority::Hashing, [&] { secondRan.post(); });
+  // The other worker is idle, but may not take the second hashing task,
+  // while it is free to run more important work
+  auto interactive =
+      folly::via(&pool.executor(Priority::Interactive), [] { return 42; });
+  EXPECT_EQ(42, std::move(interactive).get());
+
+  auto stats = pool.getQueueStats(Priority::Hashing);
+  EXPECT_EQ(1, stats.queued);
+  EXPECT_EQ(1, stats.running);
+  EXPECT_FALSE(secondRan.ready());
+
+  release.post();
+  secondRan.wait();
+  pool.stop();
+  EXPECT_EQ(0, pool.getQueueStats(Priority::Hashing).queued);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ThreadStats.h"
+#include <folly/portability/GTest.h>
+#include <algorithm>
+#include <thread>
+
+using namespace watchman;
+
+namespace {
+
+void spin(std::chrono::milliseconds duration) {
+  auto end = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < end) {
+  }
+}
+
+bool isLive(const std::string& name) {
+  auto threads = ThreadStats::getLiveThreads();
+  return std::any_of(threads.begin(), threads.end(), [&](auto& thread) {
+    return thread.name == name;
+  });
+}
+
+} // namespace
+
+TEST(ThreadStats, accounts_for_a_thread_while_it_runs) {
+  std::thread([] {
+    ThreadStats::registerCurrentThread("stats-live");
+    spin(std::chrono::milliseconds(20));
+    {
+      ThreadStats::Wait wait;
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    auto threads = ThreadStats::getLiveThreads();
+    auto it = std::find_if(threads.begin(), threads.end(), [](auto& thread) {
+      return thread.name == "stats-live";
+    });
+    ASSERT_NE(threads.end(), it);
+    EXPECT_GE(it->usage.cpu, std::chrono::milliseconds(10));
+    EXPECT_GE(it->usage.wait, std::chrono::milliseconds(20));
+    EXPECT_EQ("stats-live", ThreadStats::currentThreadName());
+  }).join();
+  EXPECT_FALSE(isLive("stats-live"));
+}
+
+TEST(ThreadStats, root_totals_include_exited_threads) {
+  auto before = ThreadStats::getRootTotals("/stats-root");
+  auto exitedBefore = ThreadStats::getExitedTotals();
+
+  std::thread([] {
+    ThreadStats::registerCurrentThread("stats-root");
+    ThreadStats::setCurrentThreadRoot("/stats-root");
+    spin(std::chrono::milliseconds(20));
+    ThreadStats::addWait(std::chrono::milliseconds(5));
+  }).join();
+
+  auto after = ThreadStats::getRootTotals("/stats-root");
+  EXPECT_EQ(before.threads + 1, after.threads);
+  EXPECT_GE(after.usage.cpu - before.usage.cpu, std::chrono::milliseconds(10));
+  EXPECT_EQ(
+      before.usage.wait + std::chrono::milliseconds(5), after.usage.wait);
+  EXPECT_EQ(exitedBefore.threads + 1, ThreadStats::getExitedTotals().threads);
+  EXPECT_EQ(0, ThreadStats::getRootTotals("/elsewhere").threads);
+}
+
+TEST(ThreadStats, unregistered_threads_still_report_their_cpu) {
+  std::thread([] {
+    spin(std::chrono::milliseconds(20));
+    ThreadStats::addWait(std::chrono::milliseconds(5));
+    auto usage = ThreadStats::currentThreadUsage();
+    EXPECT_GE(usage.cpu, std::chrono::milliseconds(10));
+    EXPECT_EQ(std::chrono::nanoseconds(0), usage.wait);
+    EXPECT_EQ("", ThreadStats::currentThreadName());
+  }).join();
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/TraceRecorder.h"
+#include <folly/portability/GTest.h>
+#include <thread>
+#include "watchman/Logging.h"
+
+using namespace watchman;
+
+namespace {
+// Returns the complete ("X") events of a trace
+std::vector<json_ref> spansOf(const json_ref& trace) {
+  std::vector<json_ref> spans;
+  for (auto& event : trace.get("traceEvents").array()) {
+    if (json_to_w_string(event.get("ph")).view() == "X") {
+      spans.push_back(event);
+    }
+  }
+  return spans;
+}
+} // namespace
+
+TEST(TraceRecorder, spans_are_only_recorded_while_capturing) {
+  auto& recorder = TraceRecorder::get();
+  { TraceSpan before("test", "before"); }
+
+  ASSERT_TRUE(recorder.start(100));
+  EXPECT_FALSE(recorder.start(100));
+  {
+    TraceSpan span("test", "during", w_string("/root"));
+    span.addArg("answer", json_integer(42));
+  }
+  auto trace = recorder.stop();
+
+  { TraceSpan after("test", "after"); }
+
+  auto spans = spansOf(trace);
+  ASSERT_EQ(1, spans.size());
+  EXPECT_EQ("during", json_to_w_string(spans[0].get("name")).view());
+  EXPECT_EQ("test", json_to_w_string(spans[0].get("cat")).view());
+  EXPECT_GE(json_integer_value(spans[0].get("ts")), 0);
+  auto args = spans[0].get("args");
+  EXPECT_EQ("/root", json_to_w_string(args.get("root")).view());
+  EXPECT_EQ(42, json_integer_value(args.get("answer")));
+
+  EXPECT_TRUE(spansOf(recorder.stop()).empty());
+}
+
+TEST(TraceRecorder, spans_that_began_before_the_capture_are_skipped) {
+  auto& recorder = TraceRecorder::get();
+  auto begin = TraceRecorder::Clock::now();
+  ASSERT_TRUE(recorder.start(100));
+  recorder.record(
+      "test", "early", w_string(), begin, TraceRecorder::Clock::now());
+  EXPECT_TRUE(spansOf(recorder.stop()).empty());
+}
+
+TEST(TraceRecorder, captures_are_bounded) {
+  auto& recorder = TraceRecorder::get();
+  ASSERT_TRUE(recorder.start(2));
+  for (int i = 0; i < 5; ++i) {
+    TraceSpan span("test", "span");
+  }
+  auto trace = recorder.stop();
+  EXPECT_EQ(2, spansOf(trace).size());
+  EXPECT_EQ(
+      3, json_integer_value(trace.get("otherData").get("dropped_events")));
+}
+
+TEST(TraceRecorder, threads_are_named) {
+  auto& recorder = TraceRecorder::get();
+  ASSERT_TRUE(recorder.start(100));
+  std::thread thread([] {
+    w_set_thread_name("tracer");
+    TraceSpan span("test", "on_thread");
+  });
+  thread.join();
+  { TraceSpan span("test", "on_main"); }
+  auto trace = recorder.stop();
+
+  auto spans = spansOf(trace);
+  ASSERT_EQ(2, spans.size());
+  EXPECT_NE(
+      json_integer_value(spans[0].get("tid")),
+      json_integer_value(spans[1].get("tid")));
+
+  bool sawName = false;
+  for (auto& event : trace.get("traceEvents").array()) {
+    if (json_to_w_string(event.get("ph")).view() == "M" &&
+        json_to_w_string(event.get("args").get("name")).view() == "tracer") {
+      sawName = true;
+    }
+  }
+  EXPECT_TRUE(sawName);
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/TreeSizeHints.h"
+#include <folly/portability/GTest.h>
+
+using watchman::TreeSizeHints;
+
+TEST(TreeSizeHints, json_round_trip) {
+  TreeSizeHints hints{1200, 45000, 300};
+  auto parsed = TreeSizeHints::fromJson(hints.toJson());
+  ASSERT_TRUE(parsed.has_value());
+  EXPECT_EQ(1200, parsed->numDirs);
+  EXPECT_EQ(45000, parsed->numFiles);
+  EXPECT_EQ(300, parsed->numDirNames);
+}
+
+TEST(TreeSizeHints, rejects_malformed_json) {
+  EXPECT_FALSE(TreeSizeHints::fromJson(nullptr).has_value());
+  EXPECT_FALSE(TreeSizeHints::fromJson(json_integer(3)).has_value());
+  EXPECT_FALSE(
+      TreeSizeHints::fromJson(json_object({{"dirs", json_integer(3)}}))
+          .has_value());
+  EXPECT_FALSE(TreeSizeHints::fromJson(json_object({
+                                           {"dirs", json_integer(-1)},
+                                           {"files", json_integer(3)},
+                                           {"dir_names", json_integer(1)},
+                                       }))
+                   .has_value());
+}
+
+TEST(TreeSizeHints, remembered_per_root) {
+  w_string a("/tree-size-hints/a", W_STRING_BYTE);
+  w_string b("/tree-size-hints/b", W_STRING_BYTE);
+  EXPECT_FALSE(TreeSizeHints::lookup(a).has_value());
+
+  TreeSizeHints::remember(a, TreeSizeHints{1, 2, 1});
+  TreeSizeHints::remember(a, TreeSizeHints{10, 20, 5});
+  TreeSizeHints::remember(b, TreeSizeHints{7, 8, 3});
+
+  auto found = TreeSizeHints::lookup(a);
+  ASSERT_TRUE(found.has_value());
+  EXPECT_EQ(10, found->numDirs);
+  EXPECT_EQ(20, found->numFiles);
+  EXPECT_EQ(5, found->numDirNames);
+  EXPECT_EQ(7, TreeSizeHints::lookup(b)->numDirs);
+}
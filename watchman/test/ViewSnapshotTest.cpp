@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/ViewSnapshot.h"
+#include <folly/portability/GTest.h>
+#include "watchman/InMemoryView.h"
+#include "watchman/test/lib/FakeFileSystem.h"
+#include "watchman/test/lib/FakeWatcher.h"
+#include "watchman/watchman_dir.h"
+#include "watchman/watchman_file.h"
+
+namespace {
+
+using namespace watchman;
+
+const w_string kRootPath{"/root"};
+
+TEST(ViewSnapshotTest, round_trip_preserves_tree_and_recency) {
+  FakeFileSystem fs;
+  FakeWatcher watcher{fs};
+
+  ViewDatabase original{kRootPath};
+  original.setRootInode(42);
+  auto* dir = original.resolveDir("/root/dir", true);
+  auto* a = original.getOrCreateChildFile(watcher, dir, "a.txt", {1, 100});
+  original.markFileChanged(watcher, a, {2, 100});
+  auto* b = original.getOrCreateChildFile(watcher, dir, "b.txt", {3, 101});
+  b->stat.size = 1234;
+  original.markFileChanged(watcher, b, {3, 101});
+  auto* c = original.getOrCreateChildFile(
+      watcher, original.resolveDir(kRootPath, true), "c.txt", {4, 102});
+  c->exists = false;
+  original.markFileChanged(watcher, c, {5, 102});
+
+  auto data = ViewSnapshot::serialize(original, 5);
+
+  ViewDatabase restored{kRootPath};
+  auto header = ViewSnapshot::deserialize(data, restored, kRootPath, 42);
+  EXPECT_EQ(5, header.mostRecentTick);
+  EXPECT_EQ(42, restored.getRootInode());
+
+  const auto* restoredDir = restored.resolveDir(w_string{"/root/dir"});
+  ASSERT_NE(nullptr, restoredDir);
+  auto* restoredB = restoredDir->getChildFile("b.txt");
+  ASSERT_NE(nullptr, restoredB);
+  EXPECT_EQ(1234, restoredB->stat.size);
+  EXPECT_TRUE(restoredB->exists);
+  EXPECT_EQ(3, restoredB->otime.ticks);
+
+  // The recency index is rebuilt most recent first.
+  std::vector<std::string> order;
+  for (auto* f = restored.getLatestFile(); f; f = f->next) {
+    order.push_back(f->getName().string());
+  }
+  EXPECT_EQ((std::vector<std::string>{"c.txt", "b.txt", "a.txt"}), order);
+  EXPECT_FALSE(restored.getLatestFile()->exists);
+
+  // As is the list of deleted files
+  ASSERT_NE(nullptr, restored.getOldestTombstone());
+  EXPECT_EQ("c.txt", restored.getOldestTombstone()->getName().string());
+  EXPECT_EQ(nullptr, restored.getNextTombstone(restored.getOldestTombstone()));
+}
+
+TEST(ViewSnapshotTest, cursors_travel_with_the_view) {
+  ViewDatabase original{kRootPath};
+  auto data = ViewSnapshot::serialize(
+      original, 10, 4, {{w_string{"n:old"}, 3}, {w_string{"n:build"}, 7}});
+
+  ViewDatabase restored{kRootPath};
+  auto header = ViewSnapshot::deserialize(data, restored, kRootPath, 0);
+  EXPECT_EQ(4, header.lastAgeOutTick);
+  // n:old predates the last age out, so it must not survive
+  EXPECT_EQ((ViewSnapshot::Cursors{{w_string{"n:build"}, 7}}), header.cursors);
+}
+
+TEST(ViewSnapshotTest, records_where_to_look_for_changes_since) {
+  ViewDatabase original{kRootPath};
+  w_string commit{"0123456789abcdef0123456789abcdef01234567"};
+  w_string position{"usn:1234:5678"};
+  auto data = ViewSnapshot::serialize(original, 10, 0, {}, commit, position);
+
+  ViewDatabase restored{kRootPath};
+  auto header = ViewSnapshot::deserialize(data, restored, kRootPath, 0);
+  EXPECT_EQ(commit, header.scmCommit);
+  EXPECT_EQ(position, header.watcherPosition);
+
+  ViewDatabase withoutEither{kRootPath};
+  header = ViewSnapshot::deserialize(
+      ViewSnapshot::serialize(original, 10), withoutEither, kRootPath, 0);
+  EXPECT_FALSE(header.scmCommit);
+  EXPECT_FALSE(header.watcherPosition);
+}
+
+TEST(ViewSnapshotTest, rejects_cursors_from_the_future) {
+  ViewDatabase original{kRootPath};
+  auto data =
+      ViewSnapshot::serialize(original, 10, 0, {{w_string{"n:build"}, 11}});
+
+  ViewDatabase restored{kRootPath};
+  EXPECT_THROW(
+      ViewSnapshot::deserialize(data, restored, kRootPath, 0),
+      std::runtime_error);
+}
+
+TEST(ViewSnapshotTest, rejects_replaced_root) {
+  FakeFileSystem fs;
+  FakeWatcher watcher{fs};
+
+  ViewDatabase original{kRootPath};
+  original.setRootInode(42);
+  original.getOrCreateChildFile(
+      watcher, original.resolveDir(kRootPath, true), "file", {1, 100});
+  auto data = ViewSnapshot::serialize(original, 1);
+
+  ViewDatabase restored{kRootPath};
+  EXPECT_THROW(
+      ViewSnapshot::deserialize(data, restored, kRootPath, 43),
+      std::runtime_error);
+  EXPECT_EQ(nullptr, restored.getLatestFile());
+}
+
+TEST(ViewSnapshotTest, rejects_truncated_data) {
+  FakeFileSystem fs;
+  FakeWatcher watcher{fs};
+
+  ViewDatabase original{kRootPath};
+  auto* dir = original.resolveDir("/root/dir", true);
+  original.getOrCreateChildFile(watcher, dir, "file", {1, 100});
+  auto data = ViewSnapshot::serialize(original, 1);
+  data.resize(data.size() - 3);
+
+  ViewDatabase restored{kRootPath};
+  EXPECT_THROW(
+      ViewSnapshot::deserialize(data, restored, kRootPath, 0),
+      std::runtime_error);
+  EXPECT_EQ(nullptr, restored.getLatestFile());
+  EXPECT_EQ(nullptr, restored.resolveDir(w_string{"/root/dir"}));
+}
+
+} // namespace
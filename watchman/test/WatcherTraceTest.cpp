@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/WatcherTrace.h"
+#include <folly/FileUtil.h>
+#include <folly/experimental/TestUtil.h>
+#include <folly/portability/GTest.h>
+
+namespace {
+
+using namespace watchman;
+
+TEST(WatcherTraceTest, records_the_changes_in_the_root) {
+  folly::test::TemporaryDirectory dir("wm-trace");
+  auto path =
+      w_string((dir.path() / "trace").string().c_str(), W_STRING_BYTE);
+  auto now = std::chrono::system_clock::now();
+
+  {
+    WatcherTraceWriter writer(path, w_string("/root"));
+    writer.add(PendingChange{w_string("/root"), now, W_PENDING_RECURSIVE});
+    writer.add(PendingChange{
+        w_string("/root/a/b"),
+        now + std::chrono::milliseconds(5),
+        W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN});
+    writer.add(
+        PendingChange{w_string("/rootless/c"), now, W_PENDING_VIA_NOTIFY});
+    writer.add(PendingChange{w_string("/other"), now, W_PENDING_VIA_NOTIFY});
+    writer.flush();
+  }
+
+  auto events = WatcherTrace::load(path);
+  ASSERT_EQ(2, events.size());
+  EXPECT_TRUE(events[0].path.empty());
+  EXPECT_EQ(W_PENDING_RECURSIVE, events[0].flags);
+  EXPECT_EQ("a/b", events[1].path.view());
+  EXPECT_EQ(
+      W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN, events[1].flags);
+  EXPECT_LE(events[0].offset, events[1].offset);
+}
+
+TEST(WatcherTraceTest, ignores_a_partial_last_record) {
+  std::string data(WatcherTrace::header());
+  WatcherTrace::append(
+      data,
+      WatcherTrace::Event{
+          std::chrono::microseconds(10), w_string("a"), W_PENDING_VIA_NOTIFY});
+  WatcherTrace::append(
+      data,
+      WatcherTrace::Event{
+          std::chrono::microseconds(20),
+          w_string("bbbbbbbb"),
+          W_PENDING_VIA_NOTIFY});
+  data.resize(data.size() - 3);
+
+  auto events = WatcherTrace::parse(data);
+  ASSERT_EQ(1, events.size());
+  EXPECT_EQ(std::chrono::microseconds(10), events[0].offset);
+  EXPECT_EQ("a", events[0].path.view());
+}
+
+TEST(WatcherTraceTest, rejects_other_files) {
+  EXPECT_THROW(WatcherTrace::parse("{\"version\": 1}"), std::runtime_error);
+  EXPECT_THROW(WatcherTrace::parse(""), std::runtime_error);
+  EXPECT_THROW(
+      WatcherTrace::load(w_string("/no/such/watcher/trace")),
+      std::system_error);
+}
+
+} // namespace
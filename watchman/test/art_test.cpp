@@ -5,12 +5,15 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include <fcntl.h>
 #include <folly/logging/xlog.h>
 #include <folly/portability/GTest.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
+#include <string>
+#include <vector>
 #include "watchman/watchman_system.h"
 
 #include "watchman/thirdparty/libart/src/art.h"
@@ -408,3 +411,72 @@ TEST(Art, insert_search_uuid) {
   XLOG(ERR) << "maximum is " << l->key;
   EXPECT_TRUE(l && l->key == "ffffcb46-a92e-4822-82af-a7190f9c1ec5");
 }
+
+TEST(Art, iter_path_prefixes) {
+  art_tree<int> t;
+  t.insert("a", 1);
+  t.insert("a/b", 2);
+  t.insert("a/b/c", 3);
+  t.insert("a/bc", 4);
+  t.insert("a/b/d/e", 5);
+
+  auto prefixesOf = [&](const std::string& key) {
+    std::vector<int> found;
+    t.iterPathPrefixes(
+        (const unsigned char*)key.data(),
+        uint32_t(key.size()),
+        [](unsigned char c) { return c == '/'; },
+        [&](const std::string&, int& value) {
+          found.push_back(value);
+          return 0;
+        });
+    return found;
+  };
+
+  // "a/b/c" sorts between "a/b" and "a/b/d" but isn't on the path
+  EXPECT_EQ((std::vector<int>{1, 2}), prefixesOf("a/b/d"));
+  EXPECT_EQ((std::vector<int>{1, 2, 5}), prefixesOf("a/b/d/e"));
+  EXPECT_EQ((std::vector<int>{1, 4}), prefixesOf("a/bc/x"));
+  EXPECT_EQ((std::vector<int>{1}), prefixesOf("a/bcd"));
+  EXPECT_EQ((std::vector<int>{}), prefixesOf("ab"));
+
+  // The callback can stop the walk
+  int visited = 0;
+  std::string key = "a/b/c";
+  EXPECT_EQ(
+      7,
+      t.iterPathPrefixes(
+          (const unsigned char*)key.data(),
+          uint32_t(key.size()),
+          [](unsigned char c) { return c == '/'; },
+          [&](const std::string&, int&) {
+            ++visited;
+            return 7;
+          }));
+  EXPECT_EQ(1, visited);
+}
+
+TEST(Art, node16_orders_high_bytes_after_low_ones) {
+  art_tree<int> t;
+  // Enough children for a Node16, and some with the top bit set, which
+  // must sort as unsigned bytes
+  std::vector<unsigned char> bytes = {
+      0x01, 0x7f, 0x80, 0xff, 'a', 'z', 0x90, 0x20, 0xc0, 'm'};
+  for (auto b : bytes) {
+    t.insert(std::string("k") + char(b), b);
+  }
+  for (auto b : bytes) {
+    auto value = t.search(std::string("k") + char(b));
+    ASSERT_NE(nullptr, value);
+    EXPECT_EQ(b, *value);
+  }
+  EXPECT_EQ(nullptr, t.search(std::string("k") + char(0x81)));
+
+  std::vector<int> order;
+  t.iter([&](const std::string&, int& value) {
+    order.push_back(value);
+    return 0;
+  });
+  std::sort(bytes.begin(), bytes.end());
+  EXPECT_EQ(std::vector<int>(bytes.begin(), bytes.end()), order);
+}
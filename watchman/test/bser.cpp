@@ -294,5 +294,170 @@ TEST(Bser, bser_tests) {
   check_bser_typed_strings();
 }
 
+TEST(Bser, single_pass_pdu_matches_measured_pdu) {
+  bser_field_dump_t dumpField = [](const bser_ctx_t* ctx, void* data) {
+    return w_bser_dump(ctx, json_array({json_integer(1), json_true()}), data);
+  };
+
+  for (auto input : json_inputs) {
+    json_error_t jerr;
+    auto json = json_loads(input, 0, &jerr);
+    for (uint32_t version = 1; version <= 2; ++version) {
+      std::string body;
+      bser_ctx_t ctx{version, 0, dump_to_string};
+      ASSERT_EQ(0, w_bser_dump_pdu_body(&ctx, json, nullptr, nullptr, &body));
+      auto pdu = w_bser_pdu_header(version, 0, body.size()) + body;
+      EXPECT_EQ(*bdumps_pdu(version, 0, json), pdu) << input;
+
+      if (!json.isObject()) {
+        EXPECT_NE(
+            0, w_bser_dump_pdu_body(&ctx, json, "extra", &dumpField, &body));
+        continue;
+      }
+
+      std::string fieldBody;
+      ASSERT_EQ(
+          0,
+          w_bser_dump_pdu_body(&ctx, json, "extra", &dumpField, &fieldBody));
+      std::string expected;
+      ASSERT_EQ(
+          0,
+          w_bser_write_pdu_with_field(
+              version,
+              0,
+              dump_to_string,
+              json,
+              "extra",
+              dumpField,
+              &expected));
+      EXPECT_EQ(
+          expected,
+          w_bser_pdu_header(version, 0, fieldBody.size()) + fieldBody)
+          << input;
+    }
+  }
+}
+
+TEST(Bser, decoded_objects_share_their_keys) {
+  json_error_t jerr;
+  auto input = json_loads(
+      "[{\"name\": \"a\", \"size\": 1}, {\"name\": \"b\"}]", 0, &jerr);
+  // With a unicode key, which is still decoded as a bytestring
+  auto templated =
+      json_loads("[{\"name\": \"a\"}, {\"name\": \"b\"}]", 0, &jerr);
+  json_array_set_template(
+      templated, json_array({typed_string_to_json("name", W_STRING_UNICODE)}));
+
+  for (auto& json : {input, templated}) {
+    auto buf = bdumps(2, 0, json);
+    ASSERT_NE(buf, nullptr);
+    json_int_t needed;
+    auto decoded =
+        bunser(buf->data(), buf->data() + buf->size(), &needed, &jerr);
+    ASSERT_TRUE(decoded) << jerr.text;
+    EXPECT_EQ(buf->size(), needed);
+    EXPECT_TRUE(json_equal(json, decoded));
+
+    auto& rows = decoded.array();
+    ASSERT_EQ(2, rows.size());
+    auto first = rows[0].object().find(w_string("name"));
+    auto second = rows[1].object().find(w_string("name"));
+    ASSERT_NE(first, rows[0].object().end());
+    ASSERT_NE(second, rows[1].object().end());
+    EXPECT_EQ(first->first.data(), second->first.data());
+    EXPECT_EQ(W_STRING_BYTE, first->first.type());
+  }
+}
+
+TEST(Bser, rejects_negative_string_lengths) {
+  // A bytestring whose length is encoded as -1
+  auto buf = S("\x02\x03\xff");
+  json_error_t jerr;
+  json_int_t needed;
+  EXPECT_FALSE(bunser(buf.data(), buf.data() + buf.size(), &needed, &jerr));
+}
+
+TEST(Bser, prefix_strings_round_trip) {
+  json_error_t jerr;
+  auto names = json_loads(
+      "[\"fbcode/watchman/query/eval.cpp\", "
+      "\"fbcode/watchman/query/expr.cpp\", "
+      "1, "
+      "\"fbcode/watchman/query/parse.cpp\", "
+      "\"fbcode\", "
+      "\"fbcode/watchman\"]",
+      0,
+      &jerr);
+  auto templated = json_loads(
+      "[{\"name\": \"fbcode/watchman/query/eval.cpp\", \"size\": 1}, "
+      "{\"size\": 2}, "
+      "{\"name\": \"fbcode/watchman/query/expr.cpp\", \"size\": 3}, "
+      "{\"name\": \"fbcode/watchman/query/parse.cpp\", \"size\": 4}]",
+      0,
+      &jerr);
+  json_array_set_template(
+      templated,
+      json_array({typed_string_to_json("name"), typed_string_to_json("size")}));
+  // Not split inside the multibyte character that the names differ in
+  auto unicode = json_array(
+      {typed_string_to_json("dir/" UTF8_PILE_OF_POO "1", W_STRING_UNICODE),
+       typed_string_to_json("dir/\xf0\x9f\x92\xaa" "2", W_STRING_UNICODE)});
+
+  for (auto& json : {names, templated, unicode}) {
+    auto plain = bdumps(2, 0, json);
+    auto front_coded = bdumps(2, BSER_CAP_ACCEPT_PREFIX_STRINGS, json);
+    ASSERT_NE(plain, nullptr);
+    ASSERT_NE(front_coded, nullptr);
+    EXPECT_LT(front_coded->size(), plain->size());
+
+    json_int_t needed;
+    auto decoded = bunser(
+        front_coded->data(),
+        front_coded->data() + front_coded->size(),
+        &needed,
+        &jerr);
+    ASSERT_TRUE(decoded) << jerr.text;
+    EXPECT_EQ(front_coded->size(), needed);
+    EXPECT_TRUE(json_equal(json, decoded))
+        << json_dumps(json, 0) << " != " << json_dumps(decoded, 0);
+  }
+
+  // Only for clients that accept them
+  EXPECT_EQ(
+      *bdumps(1, 0, names),
+      *bdumps(1, BSER_CAP_ACCEPT_PREFIX_STRINGS, names));
+}
+
+TEST(Bser, prefix_string_encoding) {
+  auto json = json_array(
+      {typed_string_to_json("abcdefgh"), typed_string_to_json("abcdefxy")});
+  auto buf = bdumps(2, BSER_CAP_ACCEPT_PREFIX_STRINGS, json);
+  ASSERT_NE(buf, nullptr);
+  EXPECT_EQ(
+      S("\x00\x03\x02"
+        "\x02\x03\x08"
+        "abcdefgh"
+        "\x0e\x03\x06\x02\x03\x02"
+        "xy"),
+      *buf);
+}
+
+TEST(Bser, rejects_prefix_strings_without_a_string_before) {
+  json_error_t jerr;
+  json_int_t needed;
+  // The first element of an array
+  auto first = S("\x00\x03\x01\x0e\x03\x01\x02\x03\x01x");
+  EXPECT_FALSE(
+      bunser(first.data(), first.data() + first.size(), &needed, &jerr));
+  // Taking more than the string before has
+  auto longer =
+      S("\x00\x03\x02\x02\x03\x01x\x0e\x03\x02\x02\x03\x01y");
+  EXPECT_FALSE(
+      bunser(longer.data(), longer.data() + longer.size(), &needed, &jerr));
+  // Outside of an array
+  auto bare = S("\x0e\x03\x00\x02\x03\x01x");
+  EXPECT_FALSE(bunser(bare.data(), bare.data() + bare.size(), &needed, &jerr));
+}
+
 /* vim:ts=2:sw=2:et:
  */
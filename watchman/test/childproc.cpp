@@ -8,6 +8,7 @@
 #include <folly/portability/GTest.h>
 #include <list>
 #include "watchman/ChildProcess.h"
+#include "watchman/SpawnHelper.h"
 #include "watchman/watchman_system.h"
 
 using watchman::ChildProcess;
@@ -99,3 +100,27 @@ TEST(ChildProcess, inputThreaded) {
 TEST(ChildProcess, inputNotThreaded) {
   test_pipe_input(false);
 }
+
+TEST(ChildProcess, spawn_helper) {
+#ifndef _WIN32
+  watchman::SpawnHelper::start();
+  ASSERT_NE(nullptr, watchman::SpawnHelper::get());
+
+  Options opts;
+  opts.pipeStdout();
+  opts.chdir("/");
+  ChildProcess pwd({"pwd"}, std::move(opts));
+  auto outputs = pwd.communicate();
+  EXPECT_EQ(0, pwd.wait());
+  EXPECT_EQ("/\n", std::string(outputs.first.view()));
+
+  // The exit status is relayed from the helper
+  ChildProcess fail({"false"}, Options());
+  auto status = fail.wait();
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(1, WEXITSTATUS(status));
+
+  // Pipes still work once the helper is running
+  test_pipe_input(false);
+#endif
+}
@@ -106,6 +106,35 @@ TEST(Ignore, correctness) {
   run_correctness_test(&state, tests, sizeof(tests) / sizeof(tests[0]));
 }
 
+TEST(Ignore, globs) {
+  IgnoreSet state;
+  state.addGlob("/root", "node_modules");
+  state.addGlob("/root", "*.pyc");
+  state.addGlob("/root", "src/**/generated");
+
+  static const struct test_case tests[] = {
+      {"/root/node_modules", true},
+      {"/root/a/b/node_modules", true},
+      {"/root/a/node_modules/pkg/index.js", true},
+      {"/root/a/node_modules_too", false},
+      {"/root/foo.pyc", true},
+      {"/root/a/foo.pyc", true},
+      {"/root/a/foo.py", false},
+      {"/root/src/generated", true},
+      {"/root/src/a/b/generated/x.h", true},
+      {"/root/lib/generated", false},
+      {"/elsewhere/node_modules", false},
+      {"/root", false},
+  };
+  run_correctness_test(&state, tests, sizeof(tests) / sizeof(tests[0]));
+
+  // The crawler only asks about the path itself
+  EXPECT_TRUE(state.isIgnoredByGlob("/root/a/node_modules"));
+  EXPECT_TRUE(state.isIgnoredByGlob("/root/src/a/generated"));
+  EXPECT_FALSE(state.isIgnoredByGlob("/root/a/node_modules/pkg"));
+  EXPECT_FALSE(state.isIgnoredByGlob("/root/a"));
+}
+
 // Load up the words data file and build a list of strings from that list.
 // Each of those strings is prefixed with the supplied string.
 // If there are fewer than limit entries available in the data file, we will
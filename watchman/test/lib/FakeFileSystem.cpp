@@ -137,6 +137,7 @@ class FakeDirHandle : public DirHandle {
     current_.has_stat = e.stat.has_value();
     current_.d_name = e.name.c_str();
     current_.stat = e.stat ? e.stat.value() : FileInformation{};
+    current_.dtype = e.stat ? e.stat->dtype() : DType::Unknown;
     return &current_;
   }
 
@@ -30,5 +30,25 @@ TEST(Log, logging) {
   EXPECT_TRUE(logged);
 }
 
+TEST(Log, async_stderr) {
+  auto& log = watchman::getLog();
+  log.startAsyncStdErr(16);
+  auto before = log.getAsyncStats();
+  EXPECT_TRUE(before.enabled);
+
+  for (int i = 0; i < 100; ++i) {
+    logf(ERR, "async line {}\n", i);
+  }
+  // Too long for a record, so written synchronously
+  logf(ERR, "{}\n", std::string(4096, 'X'));
+  log.flushStdErr();
+
+  auto after = log.getAsyncStats();
+  EXPECT_EQ(100, after.queued - before.queued);
+  EXPECT_EQ(
+      after.queued - before.queued,
+      (after.written - before.written) + (after.dropped - before.dropped));
+}
+
 /* vim:ts=2:sw=2:et:
  */
@@ -7,6 +7,7 @@
 
 #include <folly/portability/GTest.h>
 #include <string>
+#include "watchman/watchman_hash.h"
 #include "watchman/watchman_string.h"
 
 TEST(String, fmt) {
@@ -315,6 +316,57 @@ TEST(String, basename_dirname) {
   EXPECT_EQ(str, "foo");
   str = endSlash.dirName().asWString();
   EXPECT_EQ(str, "dir");
+
+  // Long enough for the separators to be looked for a word at a time, with
+  // one in each position of a word
+  for (size_t i = 0; i < 24; ++i) {
+    std::string path(24, 'x');
+    path[i] = '/';
+    w_string_piece piece(path.data(), path.size());
+    EXPECT_EQ(piece.dirName().view(), path.substr(0, i)) << i;
+    EXPECT_EQ(piece.baseName().view(), path.substr(i + 1)) << i;
+  }
+  std::string noSlash(40, 'x');
+  EXPECT_EQ(
+      nullptr,
+      w_find_last_slash(noSlash.data(), noSlash.data() + noSlash.size()));
+  EXPECT_EQ(
+      nullptr,
+      w_find_first_slash(noSlash.data(), noSlash.data() + noSlash.size()));
+}
+
+TEST(String, path_components) {
+  auto components = [](w_string_piece path) {
+    std::vector<std::string> result;
+    for (auto component : path.pathComponents()) {
+      result.push_back(component.string());
+    }
+    return result;
+  };
+
+  using Components = std::vector<std::string>;
+  EXPECT_EQ(Components{}, components(""));
+  EXPECT_EQ(Components{}, components("/"));
+  EXPECT_EQ(Components{"foo"}, components("foo"));
+  EXPECT_EQ((Components{"foo", "bar"}), components("foo/bar"));
+  EXPECT_EQ((Components{"a", "b"}), components("/a//b/"));
+  EXPECT_EQ(
+      (Components{"some", "long", "enough", "path", "to", "split"}),
+      components("/some/long/enough/path/to/split"));
+#ifdef _WIN32
+  EXPECT_EQ((Components{"C:", "foo", "bar"}), components("C:\\foo/bar"));
+#else
+  EXPECT_EQ((Components{"foo\\bar"}), components("foo\\bar"));
+#endif
+
+  // The components point into the path itself
+  w_string_piece path("dir/file");
+  auto it = path.pathComponents().begin();
+  EXPECT_EQ(path.data(), it->data());
+  ++it;
+  EXPECT_EQ(path.data() + 4, it->data());
+  ++it;
+  EXPECT_EQ(path.pathComponents().end(), it);
 }
 
 TEST(String, operators) {
@@ -442,3 +494,30 @@ TEST(String, contains) {
   EXPECT_TRUE(haystack.contains("watchman"));
   EXPECT_FALSE(haystack.contains("watchman2"));
 }
+
+TEST(String, hash_ignores_alignment_and_length_boundaries) {
+  // Exercise each of the short, medium and 48 byte block paths, at every
+  // alignment of the input
+  std::string text;
+  for (int i = 0; i < 130; ++i) {
+    text.push_back('a' + (i * 7) % 26);
+  }
+  char buf[160];
+  for (size_t len = 0; len <= text.size(); ++len) {
+    auto expected = w_hash_bytes(text.data(), len, 0);
+    for (size_t offset = 1; offset < 8; ++offset) {
+      memcpy(buf + offset, text.data(), len);
+      EXPECT_EQ(expected, w_hash_bytes(buf + offset, len, 0)) << len;
+    }
+    if (len > 0) {
+      // Every byte contributes to the hash
+      auto changed = text.substr(0, len);
+      changed[len / 2] ^= 1;
+      EXPECT_NE(expected, w_hash_bytes(changed.data(), len, 0)) << len;
+    }
+  }
+
+  w_string str{text.c_str(), W_STRING_BYTE};
+  EXPECT_EQ(w_string_hval(str), w_string_piece(str).hashValue());
+  EXPECT_EQ(w_string_hval(str), w_hash_bytes(text.data(), text.size(), 0));
+}
@@ -10,6 +10,7 @@
 #include <folly/Conv.h>
 #include <folly/String.h>
 #include <folly/portability/GTest.h>
+#include "watchman/query/GlobSet.h"
 #include "watchman/thirdparty/jansson/jansson.h"
 #include "watchman/thirdparty/wildmatch/wildmatch.h"
 
@@ -27,6 +28,13 @@ static void run_test(const json_ref& test_case_data) {
   EXPECT_EQ(wildmatch_succeeded, wildmatch_should_succeed)
       << "Pattern [" << pattern_to_use << "] matching text [" << text_to_match
       << "] with flags " << wildmatch_flags;
+
+  // GlobSet's shortcuts must never change the outcome
+  watchman::GlobSet set{int(wildmatch_flags)};
+  set.add(pattern_to_use, 0);
+  EXPECT_EQ(set.matchesAny(text_to_match), wildmatch_should_succeed)
+      << "GlobSet pattern [" << pattern_to_use << "] matching text ["
+      << text_to_match << "] with flags " << wildmatch_flags;
 }
 
 TEST(WildMatch, tests) {
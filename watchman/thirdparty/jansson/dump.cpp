@@ -39,77 +39,153 @@ static int dump_to_file(const char* buffer, size_t size, void* data) {
   return 0;
 }
 
+namespace {
+
+/*
+ * Gathers the encoding into chunks, so that the callback, which for a
+ * stream copies it on into another buffer, is called once per chunk rather
+ * than once per token.
+ */
+class DumpOutput {
+ public:
+  DumpOutput(json_dump_callback_t dump, void* data)
+      : dump_(dump), data_(data) {}
+
+  int append(const char* buffer, size_t size) {
+    if (size > sizeof(buffer_) - length_) {
+      if (flush()) {
+        return -1;
+      }
+      if (size > sizeof(buffer_)) {
+        return dump_(buffer, size, data_);
+      }
+    }
+    memcpy(buffer_ + length_, buffer, size);
+    length_ += size;
+    return 0;
+  }
+
+  int append(char c) {
+    if (length_ == sizeof(buffer_) && flush()) {
+      return -1;
+    }
+    buffer_[length_++] = c;
+    return 0;
+  }
+
+  int flush() {
+    if (length_ == 0) {
+      return 0;
+    }
+    size_t length = length_;
+    length_ = 0;
+    return dump_(buffer_, length, data_);
+  }
+
+ private:
+  json_dump_callback_t dump_;
+  void* data_;
+  size_t length_{0};
+  char buffer_[16384];
+};
+
 /* 32 spaces (the maximum indentation size) */
-static char whitespace[] = "                                ";
-
-static int dump_indent(
-    size_t flags,
-    int depth,
-    int space,
-    json_dump_callback_t dump,
-    void* data) {
+char whitespace[] = "                                ";
+
+int dump_indent(size_t flags, int depth, int space, DumpOutput& out) {
   if (JSON_INDENT(flags) > 0) {
     int i, ws_count = JSON_INDENT(flags);
 
-    if (dump("\n", 1, data))
+    if (out.append('\n'))
       return -1;
 
     for (i = 0; i < depth; i++) {
-      if (dump(whitespace, ws_count, data))
+      if (out.append(whitespace, ws_count))
         return -1;
     }
   } else if (space && !(flags & JSON_COMPACT)) {
-    return dump(" ", 1, data);
+    return out.append(' ');
   }
   return 0;
 }
 
-static int dump_string(
-    const char* str,
-    json_dump_callback_t dump,
-    void* data,
-    size_t flags) {
-  const char *pos, *end;
-  int32_t codepoint;
+constexpr uint64_t kEachByte = 0x0101010101010101ULL;
+constexpr uint64_t kHighBits = 0x8080808080808080ULL;
+
+/* Whether any of the 8 bytes in word is a control character, a quote, a
+ * backslash or not ASCII; these are the bytes that can't simply be copied
+ * into the output.  This lets clean runs of a string be skipped over a word
+ * at a time. */
+inline bool word_needs_attention(uint64_t word) {
+  uint64_t control = (word - kEachByte * 0x20) & ~word;
+  uint64_t quote = word ^ (kEachByte * '"');
+  quote = (quote - kEachByte) & ~quote;
+  uint64_t backslash = word ^ (kEachByte * '\\');
+  backslash = (backslash - kEachByte) & ~backslash;
+  return ((control | quote | backslash | word) & kHighBits) != 0;
+}
+
+/* Encodes the string of size bytes at str, which is followed by a NUL.  As
+ * strings are NUL terminated as far as the output is concerned, an embedded
+ * NUL ends the string. */
+int dump_string(const char* str, size_t size, DumpOutput& out, size_t flags) {
+  const char* pos = str;
+  const char* end = str + size;
+  /* The word at a time scan lets slashes through */
+  bool scan_words = !(flags & JSON_ESCAPE_SLASH);
 
-  if (dump("\"", 1, data))
+  if (out.append('"'))
     return -1;
 
-  end = pos = str;
-  while (1) {
+  while (pos < end) {
+    int32_t codepoint;
+    const char* next;
     const char* text;
     char seq[13];
     int length;
 
-    while (*end) {
-      end = utf8_iterate(pos, &codepoint);
-      if (!end) {
-        return -1;
-      }
-
-      /* mandatory escape or control char */
-      if (codepoint == '\\' || codepoint == '"' || codepoint < 0x20)
-        break;
-
-      /* slash */
-      if ((flags & JSON_ESCAPE_SLASH) && codepoint == '/')
+    while (scan_words && end - pos >= 8) {
+      uint64_t word;
+      memcpy(&word, pos, sizeof(word));
+      if (word_needs_attention(word)) {
         break;
+      }
+      pos += 8;
+    }
+    if (pos == end) {
+      break;
+    }
 
+    codepoint = (unsigned char)*pos;
+    next = pos + 1;
+    if (codepoint >= 0x80) {
+      next = utf8_iterate(pos, &codepoint);
+      if (!next) {
+        return -1;
+      }
       /* non-ASCII */
-      if ((flags & JSON_ENSURE_ASCII) && codepoint > 0x7F)
-        break;
+      if (!(flags & JSON_ENSURE_ASCII)) {
+        pos = next;
+        continue;
+      }
+    } else if (
+        /* mandatory escape or control char */
+        codepoint != '\\' && codepoint != '"' && codepoint >= 0x20 &&
+        /* slash */
+        !((flags & JSON_ESCAPE_SLASH) && codepoint == '/')) {
+      pos = next;
+      continue;
+    }
 
-      pos = end;
+    if (codepoint == 0) {
+      break;
     }
 
     if (pos != str) {
-      if (dump(str, pos - str, data))
+      if (out.append(str, pos - str))
         return -1;
     }
 
-    if (end == pos)
-      break;
-
     /* handle \, /, ", and control codes */
     length = 2;
     switch (codepoint) {
@@ -161,45 +237,69 @@ static int dump_string(
       }
     }
 
-    if (dump(text, length, data))
+    if (out.append(text, length))
       return -1;
 
-    str = pos = end;
+    str = pos = next;
   }
 
-  return dump("\"", 1, data);
+  if (pos != str) {
+    if (out.append(str, pos - str))
+      return -1;
+  }
+
+  return out.append('"');
 }
 
-static int do_dump(
-    const json_t* json,
-    size_t flags,
-    int depth,
-    json_dump_callback_t dump,
-    void* data) {
+/* Formats value in decimal so that it ends just before end, and returns
+ * where it starts */
+char* format_integer(json_int_t value, char* end) {
+  static const char kDigitPairs[] =
+      "00010203040506070809101112131415161718192021222324"
+      "25262728293031323334353637383940414243444546474849"
+      "50515253545556575859606162636465666768697071727374"
+      "75767778798081828384858687888990919293949596979899";
+
+  // Negating in unsigned arithmetic copes with the most negative value
+  unsigned long long magnitude = value < 0
+      ? 0ULL - (unsigned long long)value
+      : (unsigned long long)value;
+  char* pos = end;
+  while (magnitude >= 100) {
+    auto pair = (magnitude % 100) * 2;
+    magnitude /= 100;
+    *--pos = kDigitPairs[pair + 1];
+    *--pos = kDigitPairs[pair];
+  }
+  if (magnitude >= 10) {
+    *--pos = kDigitPairs[magnitude * 2 + 1];
+    *--pos = kDigitPairs[magnitude * 2];
+  } else {
+    *--pos = char('0' + magnitude);
+  }
+  if (value < 0) {
+    *--pos = '-';
+  }
+  return pos;
+}
+
+int do_dump(const json_t* json, size_t flags, int depth, DumpOutput& out) {
   switch (json_typeof(json)) {
     case JSON_NULL:
-      return dump("null", 4, data);
+      return out.append("null", 4);
 
     case JSON_TRUE:
-      return dump("true", 4, data);
+      return out.append("true", 4);
 
     case JSON_FALSE:
-      return dump("false", 5, data);
+      return out.append("false", 5);
 
     case JSON_INTEGER: {
       char buffer[MAX_INTEGER_STR_LENGTH];
-      int size;
+      char* end = buffer + sizeof(buffer);
+      char* start = format_integer(json_integer_value(json), end);
 
-      size = snprintf(
-          buffer,
-          MAX_INTEGER_STR_LENGTH,
-          "%" JSON_INTEGER_FORMAT,
-          json_integer_value(json));
-      if (size < 0 || size >= MAX_INTEGER_STR_LENGTH) {
-        return -1;
-      }
-
-      return dump(buffer, size, data);
+      return out.append(start, end - start);
     }
 
     case JSON_REAL: {
@@ -212,11 +312,13 @@ static int do_dump(
         return -1;
       }
 
-      return dump(buffer, size, data);
+      return out.append(buffer, size);
     }
 
-    case JSON_STRING:
-      return dump_string(json_string_value(json), dump, data, flags);
+    case JSON_STRING: {
+      auto& str = json_to_w_string(json);
+      return dump_string(str.data(), str.size(), out, flags);
+    }
 
     case JSON_ARRAY: {
       int i;
@@ -224,33 +326,32 @@ static int do_dump(
 
       n = json_array_size(json);
 
-      if (dump("[", 1, data)) {
+      if (out.append('[')) {
         return -1;
       }
       if (n == 0) {
-        return dump("]", 1, data);
+        return out.append(']');
       }
-      if (dump_indent(flags, depth + 1, 0, dump, data))
+      if (dump_indent(flags, depth + 1, 0, out))
         return -1;
 
       for (i = 0; i < n; ++i) {
-        if (do_dump(json_array_get(json, i), flags, depth + 1, dump, data)) {
+        if (do_dump(json_array_get(json, i), flags, depth + 1, out)) {
           return -1;
         }
 
         if (i < n - 1) {
-          if (dump(",", 1, data) ||
-              dump_indent(flags, depth + 1, 1, dump, data)) {
+          if (out.append(',') || dump_indent(flags, depth + 1, 1, out)) {
             return -1;
           }
         } else {
-          if (dump_indent(flags, depth, 0, dump, data)) {
+          if (dump_indent(flags, depth, 0, out)) {
             return -1;
           }
         }
       }
 
-      return dump("]", 1, data);
+      return out.append(']');
     }
 
     case JSON_OBJECT: {
@@ -267,75 +368,68 @@ static int do_dump(
       }
 
       object = json_to_object(json);
-      auto it = object->map.begin();
+      size_t remaining = object->size();
 
-      if (dump("{", 1, data)) {
+      if (out.append('{')) {
         return -1;
       }
-      if (object->map.empty()) {
-        return dump("}", 1, data);
+      if (remaining == 0) {
+        return out.append('}');
       }
 
-      if (dump_indent(flags, depth + 1, 0, dump, data)) {
+      if (dump_indent(flags, depth + 1, 0, out)) {
         return -1;
       }
 
+      auto dump_member = [&](const w_string& key, const json_t* value) {
+        if (dump_string(key.data(), key.size(), out, flags) ||
+            out.append(separator, separator_length) ||
+            do_dump(value, flags, depth + 1, out)) {
+          return -1;
+        }
+
+        if (--remaining) {
+          if (out.append(',') || dump_indent(flags, depth + 1, 1, out)) {
+            return -1;
+          }
+        } else {
+          if (dump_indent(flags, depth, 0, out)) {
+            return -1;
+          }
+        }
+        return 0;
+      };
+
       if (flags & JSON_SORT_KEYS) {
         using Pair = std::pair<w_string, json_t*>;
-        std::vector<Pair> items(object->map.begin(), object->map.end());
+        std::vector<Pair> items;
+        items.reserve(remaining);
+        object->forEach([&](const w_string& key, const json_ref& value) {
+          items.emplace_back(key, value);
+        });
 
         std::sort(items.begin(), items.end(), [](const Pair& a, const Pair& b) {
           return a.first < b.first;
         });
 
-        auto sorted_it = items.begin();
-        while (sorted_it != items.end()) {
-          auto next = std::next(sorted_it);
-
-          dump_string(sorted_it->first.c_str(), dump, data, flags);
-          if (dump(separator, separator_length, data) ||
-              do_dump(sorted_it->second, flags, depth + 1, dump, data)) {
+        for (auto& item : items) {
+          if (dump_member(item.first, item.second)) {
             return -1;
           }
-
-          if (next != items.end()) {
-            if (dump(",", 1, data) ||
-                dump_indent(flags, depth + 1, 1, dump, data)) {
-              return -1;
-            }
-          } else {
-            if (dump_indent(flags, depth, 0, dump, data)) {
-              return -1;
-            }
-          }
-
-          sorted_it = next;
         }
       } else {
-        while (it != object->map.end()) {
-          auto next = std::next(it);
-
-          dump_string(it->first.c_str(), dump, data, flags);
-          if (dump(separator, separator_length, data) ||
-              do_dump(it->second, flags, depth + 1, dump, data)) {
-            return -1;
-          }
-
-          if (next != object->map.end()) {
-            if (dump(",", 1, data) ||
-                dump_indent(flags, depth + 1, 1, dump, data)) {
-              return -1;
-            }
-          } else {
-            if (dump_indent(flags, depth, 0, dump, data)) {
-              return -1;
-            }
+        // Records are visited in key order, without building their map
+        int result = 0;
+        object->forEach([&](const w_string& key, const json_ref& value) {
+          if (result == 0) {
+            result = dump_member(key, value);
           }
-
-          it = next;
+        });
+        if (result) {
+          return -1;
         }
       }
-      return dump("}", 1, data);
+      return out.append('}');
     }
 
     default:
@@ -344,6 +438,8 @@ static int do_dump(
   }
 }
 
+} // namespace
+
 std::string json_dumps(const json_t* json, size_t flags) {
   std::string strbuff;
 
@@ -380,5 +476,9 @@ int json_dump_callback(
       return -1;
   }
 
-  return do_dump(json, flags, 0, callback, data);
+  DumpOutput out(callback, data);
+  if (do_dump(json, flags, 0, out)) {
+    return -1;
+  }
+  return out.flush();
 }
@@ -277,6 +277,19 @@ int json_array_set_template(json_t* array, json_t* templ);
 int json_array_set_template_new(json_t* json, json_ref&& templ);
 json_t* json_array_get_template(const json_t* array);
 
+/* A record is an object whose keys are given by an array of strings,
+   usually shared between many records, with the values stored in the
+   same order rather than in a hash table.  It behaves as an object in
+   every respect; the encoders emit it without building the table, and
+   a BSER template array whose template is the keys array emits its
+   values directly.  keys must not contain duplicates. */
+json_ref json_record(const json_ref& keys, std::vector<json_ref>&& values);
+/* Returns the keys of a record, or NULL if json is not a record */
+json_t* json_record_get_keys(const json_t* json);
+/* Returns the values of a record in key order, or NULL if json is not a
+   record */
+const json_ref* json_record_get_values(const json_t* json);
+
 static JSON_INLINE int
 json_array_set(json_t* array, size_t index, json_t* value) {
   return json_array_set_new(array, index, json_ref(value));
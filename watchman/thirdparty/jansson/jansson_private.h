@@ -10,6 +10,7 @@
 
 #include <stddef.h>
 #include <algorithm>
+#include <mutex>
 #include <unordered_map>
 #include <vector>
 #include "jansson.h"
@@ -28,7 +29,52 @@ struct json_object_t {
   json_t json;
   std::unordered_map<w_string, json_ref> map;
 
+  // Set for objects created by json_record().  recordKeys is an array of
+  // strings, typically shared by many records, and recordValues holds the
+  // value of each of those keys in the same order.  map is left empty
+  // until something asks for it; see mapForRead()/mapForWrite().
+  json_ref recordKeys;
+  std::vector<json_ref> recordValues;
+  std::once_flag recordMaterialized;
+
   json_object_t(size_t sizeHint = 0);
+  json_object_t(json_ref&& keys, std::vector<json_ref>&& values);
+
+  bool isRecord() const {
+    return bool(recordKeys);
+  }
+
+  // Returns the map, populating it from the record values if needed.
+  // The record values remain valid, so this is safe to call concurrently
+  // with other readers.
+  const std::unordered_map<w_string, json_ref>& mapForRead();
+
+  // As mapForRead(), but then turns the record into a regular object so
+  // that the map may be modified.
+  std::unordered_map<w_string, json_ref>& mapForWrite();
+
+  // Returns the value for key, or nullptr if it isn't present
+  const json_ref* find(const char* key);
+
+  size_t size() const {
+    return isRecord() ? recordValues.size() : map.size();
+  }
+
+  // Calls func(key, value) for each member.  For records this doesn't
+  // require the map and visits the members in key order.
+  template <typename Func>
+  void forEach(Func&& func) const {
+    if (isRecord()) {
+      auto& keys = recordKeys.array();
+      for (size_t i = 0; i < recordValues.size(); ++i) {
+        func(json_to_w_string(keys[i]), recordValues[i]);
+      }
+    } else {
+      for (auto& it : map) {
+        func(it.first, it.second);
+      }
+    }
+  }
 
   typename std::unordered_map<w_string, json_ref>::iterator findCString(
       const char* key);
@@ -47,9 +47,18 @@
 typedef int (*get_func)(void* data);
 
 namespace {
+typedef struct {
+  const char* data;
+  size_t len;
+  size_t pos;
+} buffer_data_t;
+
 typedef struct {
   get_func get;
   void* data;
+  /* set when the input is entirely in memory, so that runs of plain
+     characters can be consumed without going through get */
+  buffer_data_t* direct;
   char buffer[5];
   size_t buffer_pos;
   int state;
@@ -132,9 +141,14 @@ error_set(json_error_t* error, const lex_t* lex, const char* msg, ...) {
 
 /*** lexical analyzer ***/
 
-static void stream_init(stream_t* stream, get_func get, void* data) {
+static void stream_init(
+    stream_t* stream,
+    get_func get,
+    void* data,
+    buffer_data_t* direct) {
   stream->get = get;
   stream->data = data;
+  stream->direct = direct;
   stream->buffer[0] = '\0';
   stream->buffer_pos = 0;
 
@@ -255,6 +269,56 @@ static void lex_save_cached(lex_t* lex) {
   }
 }
 
+/* true for bytes that can appear unescaped in a string and don't need
+   any of the special handling in stream_get or lex_scan_string */
+static inline bool is_plain_string_char(unsigned char c) {
+  return c >= 0x20 && c < 0x80 && c != '"' && c != '\\';
+}
+
+/* Consumes and saves the run of plain string characters that starts at
+   the current position of an in-memory stream.  The run is examined 8
+   bytes at a time; a word is only inspected bytewise once it is known to
+   contain a quote, backslash, control or non-ASCII byte.  Since the run
+   has no newlines or multi-byte sequences the position and column simply
+   advance by its length. */
+static void lex_save_plain_run(lex_t* lex) {
+  stream_t* stream = &lex->stream;
+  buffer_data_t* direct = stream->direct;
+
+  if (!direct || stream->state != STREAM_STATE_OK ||
+      stream->buffer[stream->buffer_pos] != '\0')
+    return;
+
+  const char* start = direct->data + direct->pos;
+  size_t avail = direct->len - direct->pos;
+  size_t n = 0;
+
+  const uint64_t ones = 0x0101010101010101ULL;
+  const uint64_t highs = 0x8080808080808080ULL;
+  while (n + sizeof(uint64_t) <= avail) {
+    uint64_t word;
+    memcpy(&word, start + n, sizeof(word));
+    uint64_t quote = word ^ (ones * '"');
+    uint64_t backslash = word ^ (ones * '\\');
+    uint64_t special = ((word - ones * 0x20) & ~word) |
+        ((quote - ones) & ~quote) | ((backslash - ones) & ~backslash) |
+        word;
+    if (special & highs)
+      break;
+    n += sizeof(uint64_t);
+  }
+  while (n < avail && is_plain_string_char(start[n]))
+    n++;
+
+  if (n == 0)
+    return;
+
+  lex->saved_text.append(start, n);
+  direct->pos += n;
+  stream->position += n;
+  stream->column += n;
+}
+
 /* assumes that str points to 'u' plus at least 4 valid hex digits */
 static int32_t decode_unicode_escape(const char* str) {
   int i;
@@ -283,10 +347,12 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
   const char* p;
   char* t;
   int i;
+  bool escaped = false;
 
   lex->value.string.clear();
   lex->token = TOKEN_INVALID;
 
+  lex_save_plain_run(lex);
   c = lex_get_save(lex, error);
 
   while (c != '"') {
@@ -305,6 +371,7 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
         error_set(error, lex, "control character 0x%x", c);
       goto out;
     } else if (c == '\\') {
+      escaped = true;
       c = lex_get_save(lex, error);
       if (c == 'u') {
         c = lex_get_save(lex, error);
@@ -317,14 +384,25 @@ static void lex_scan_string(lex_t* lex, json_error_t* error) {
         }
       } else if (
           c == '"' || c == '\\' || c == '/' || c == 'b' || c == 'f' ||
-          c == 'n' || c == 'r' || c == 't')
+          c == 'n' || c == 'r' || c == 't') {
+        lex_save_plain_run(lex);
         c = lex_get_save(lex, error);
-      else {
+      } else {
         error_set(error, lex, "invalid escape");
         goto out;
       }
-    } else
+    } else {
+      lex_save_plain_run(lex);
       c = lex_get_save(lex, error);
+    }
+  }
+
+  if (!escaped) {
+    /* nothing to decode; strip the quotes */
+    lex->value.string.assign(
+        lex->saved_text, 1, lex->saved_text.size() - 2);
+    lex->token = TOKEN_STRING;
+    return;
   }
 
   /* the actual value is at most of the same length as the source
@@ -605,8 +683,12 @@ static std::string lex_steal_string(lex_t* lex) {
   return result;
 }
 
-static int lex_init(lex_t* lex, get_func get, void* data) {
-  stream_init(&lex->stream, get, data);
+static int lex_init(
+    lex_t* lex,
+    get_func get,
+    void* data,
+    buffer_data_t* direct = nullptr) {
+  stream_init(&lex->stream, get, data, direct);
 
   lex->token = TOKEN_INVALID;
   return 0;
@@ -632,9 +714,6 @@ static json_ref parse_object(lex_t* lex, size_t flags, json_error_t* error) {
     }
 
     auto key = lex_steal_string(lex);
-    if (key.empty()) {
-      return nullptr;
-    }
 
     if (flags & JSON_REJECT_DUPLICATES) {
       if (json_object_get(object, key.c_str())) {
@@ -795,26 +874,20 @@ static json_ref parse_json(lex_t* lex, size_t flags, json_error_t* error) {
   return result;
 }
 
-typedef struct {
-  const char* data;
-  int pos;
-} string_data_t;
-
-static int string_get(void* data) {
+static int buffer_get(void* data) {
   char c;
-  string_data_t* stream = (string_data_t*)data;
-  c = stream->data[stream->pos];
-  if (c == '\0')
+  auto stream = (buffer_data_t*)data;
+  if (stream->pos >= stream->len)
     return EOF;
-  else {
-    stream->pos++;
-    return (unsigned char)c;
-  }
+
+  c = stream->data[stream->pos];
+  stream->pos++;
+  return (unsigned char)c;
 }
 
 json_ref json_loads(const char* string, size_t flags, json_error_t* error) {
   lex_t lex;
-  string_data_t stream_data;
+  buffer_data_t stream_data;
 
   jsonp_error_init(error, "<string>");
 
@@ -825,8 +898,9 @@ json_ref json_loads(const char* string, size_t flags, json_error_t* error) {
 
   stream_data.data = string;
   stream_data.pos = 0;
+  stream_data.len = strlen(string);
 
-  if (lex_init(&lex, string_get, (void*)&stream_data))
+  if (lex_init(&lex, buffer_get, (void*)&stream_data, &stream_data))
     return nullptr;
 
   auto result = parse_json(&lex, flags, error);
@@ -834,23 +908,6 @@ json_ref json_loads(const char* string, size_t flags, json_error_t* error) {
   return result;
 }
 
-typedef struct {
-  const char* data;
-  size_t len;
-  size_t pos;
-} buffer_data_t;
-
-static int buffer_get(void* data) {
-  char c;
-  auto stream = (buffer_data_t*)data;
-  if (stream->pos >= stream->len)
-    return EOF;
-
-  c = stream->data[stream->pos];
-  stream->pos++;
-  return (unsigned char)c;
-}
-
 json_ref json_loadb(
     const char* buffer,
     size_t buflen,
@@ -870,7 +927,7 @@ json_ref json_loadb(
   stream_data.pos = 0;
   stream_data.len = buflen;
 
-  if (lex_init(&lex, buffer_get, (void*)&stream_data))
+  if (lex_init(&lex, buffer_get, (void*)&stream_data, &stream_data))
     return nullptr;
 
   auto result = parse_json(&lex, flags, error);
@@ -13,11 +13,33 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <string>
+#include <utility>
 
 #include "utf.h"
+#include "watchman/MemoryProfile.h"
 #include "watchman/watchman_string.h"
 
+namespace {
+
+// Values are counted in the MemoryProfile by the size of their node; the
+// tables and strings that they hold are not included.
+template <typename T, typename... Args>
+T* newValue(Args&&... args) {
+  auto value = new T(std::forward<Args>(args)...);
+  watchman::MemoryProfile::allocated(watchman::MemoryTag::Json, sizeof(T));
+  return value;
+}
+
+template <typename T>
+void deleteValue(json_t* json) {
+  delete (T*)json;
+  watchman::MemoryProfile::freed(watchman::MemoryTag::Json, sizeof(T));
+}
+
+} // namespace
+
 json_ref::json_ref() : ref_(nullptr) {}
 json_ref::json_ref(std::nullptr_t) : ref_(nullptr) {}
 
@@ -100,22 +122,86 @@ const std::unordered_map<w_string, json_ref>& json_ref::object() const {
   if (!json_is_object(ref_)) {
     throw std::domain_error("json_ref::object() called for non-object");
   }
-  return json_to_object(ref_)->map;
+  return json_to_object(ref_)->mapForRead();
 }
 
 std::unordered_map<w_string, json_ref>& json_ref::object() {
   if (!json_is_object(ref_)) {
     throw std::domain_error("json_ref::object() called for non-object");
   }
-  return json_to_object(ref_)->map;
+  return json_to_object(ref_)->mapForWrite();
 }
 
 json_object_t::json_object_t(size_t sizeHint) : json(JSON_OBJECT) {
   map.reserve(sizeHint);
 }
 
+json_object_t::json_object_t(json_ref&& keys, std::vector<json_ref>&& values)
+    : json(JSON_OBJECT),
+      recordKeys(std::move(keys)),
+      recordValues(std::move(values)) {}
+
+const std::unordered_map<w_string, json_ref>& json_object_t::mapForRead() {
+  if (isRecord()) {
+    std::call_once(recordMaterialized, [this] {
+      auto& keys = recordKeys.array();
+      map.reserve(recordValues.size());
+      for (size_t i = 0; i < recordValues.size(); ++i) {
+        map.emplace(json_to_w_string(keys[i]), recordValues[i]);
+      }
+    });
+  }
+  return map;
+}
+
+std::unordered_map<w_string, json_ref>& json_object_t::mapForWrite() {
+  mapForRead();
+  recordKeys.reset();
+  recordValues.clear();
+  return map;
+}
+
+const json_ref* json_object_t::find(const char* key) {
+  if (isRecord()) {
+    auto& keys = recordKeys.array();
+    for (size_t i = 0; i < recordValues.size(); ++i) {
+      if (strcmp(json_string_value(keys[i]), key) == 0) {
+        return &recordValues[i];
+      }
+    }
+    return nullptr;
+  }
+  auto it = findCString(key);
+  if (it == map.end()) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+json_ref json_record(const json_ref& keys, std::vector<json_ref>&& values) {
+  if (!json_is_array(keys) || json_array_size(keys) != values.size()) {
+    throw std::domain_error("json_record keys and values differ in size");
+  }
+  auto object = newValue<json_object_t>(json_ref(keys), std::move(values));
+  return json_ref(&object->json, false);
+}
+
+json_t* json_record_get_keys(const json_t* json) {
+  if (!json_is_object(json)) {
+    return nullptr;
+  }
+  return json_to_object(json)->recordKeys;
+}
+
+const json_ref* json_record_get_values(const json_t* json) {
+  if (!json_is_object(json) || !json_to_object(json)->isRecord()) {
+    return nullptr;
+  }
+  return json_to_object(json)->recordValues.data();
+}
+
 json_ref json_object_of_size(size_t size) {
-  auto object = new json_object_t(size);
+  auto object = newValue<json_object_t>(size);
   return json_ref(&object->json, false);
 }
 
@@ -141,7 +227,7 @@ size_t json_object_size(const json_t* json) {
     return 0;
 
   object = json_to_object(json);
-  return object->map.size();
+  return object->size();
 }
 
 typename std::unordered_map<w_string, json_ref>::iterator
@@ -154,25 +240,23 @@ const json_ref& json_ref::get(const char* key) const {
   if (!json_is_object(ref_)) {
     throw std::domain_error("json_ref::get called on a non object type");
   }
-  auto object = json_to_object(ref_);
-  auto it = object->findCString(key);
-  if (it == object->map.end()) {
+  auto value = json_to_object(ref_)->find(key);
+  if (!value) {
     throw std::range_error(
         std::string("key '") + key + "' is not present in this json object");
   }
-  return it->second;
+  return *value;
 }
 
 json_ref json_ref::get_default(const char* key, json_ref defval) const {
   if (!json_is_object(ref_)) {
     return defval;
   }
-  auto object = json_to_object(ref_);
-  auto it = object->findCString(key);
-  if (it == object->map.end()) {
+  auto value = json_to_object(ref_)->find(key);
+  if (!value) {
     return defval;
   }
-  return it->second;
+  return *value;
 }
 
 json_t* json_object_get(const json_t* json, const char* key) {
@@ -182,11 +266,11 @@ json_t* json_object_get(const json_t* json, const char* key) {
     return NULL;
 
   object = json_to_object(json);
-  auto it = object->findCString(key);
-  if (it == object->map.end()) {
+  auto value = object->find(key);
+  if (!value) {
     return nullptr;
   }
-  return it->second;
+  return *value;
 }
 
 int json_object_set_new_nocheck(
@@ -204,12 +288,12 @@ int json_object_set_new_nocheck(
   object = json_to_object(json);
 
   w_string key_string(key);
-  object->map[key_string] = std::move(value);
+  object->mapForWrite()[key_string] = std::move(value);
   return 0;
 }
 
 void json_ref::set(const w_string& key, json_ref&& val) {
-  json_to_object(ref_)->map[key] = std::move(val);
+  json_to_object(ref_)->mapForWrite()[key] = std::move(val);
 }
 
 void json_ref::set(const char* key, json_ref&& val) {
@@ -221,7 +305,7 @@ void json_ref::set(const char* key, json_ref&& val) {
 #endif
 
   w_string key_string(key);
-  json_to_object(ref_)->map[key_string] = std::move(val);
+  json_to_object(ref_)->mapForWrite()[key_string] = std::move(val);
 }
 
 int json_object_set_new(json_t* json, const char* key, json_ref&& value) {
@@ -239,6 +323,7 @@ int json_object_del(json_t* json, const char* key) {
     return -1;
 
   object = json_to_object(json);
+  object->mapForWrite();
   auto it = object->findCString(key);
   if (it == object->map.end()) {
     return -1;
@@ -254,7 +339,7 @@ int json_object_clear(json_t* json) {
     return -1;
 
   object = json_to_object(json);
-  object->map.clear();
+  object->mapForWrite().clear();
 
   return 0;
 }
@@ -263,10 +348,11 @@ int json_object_update(const json_t* src, json_t* target) {
   if (!json_is_object(src) || !json_is_object(target))
     return -1;
 
-  auto target_obj = json_to_object(target);
-  for (auto& it : json_to_object(src)->map) {
-    target_obj->map[it.first] = it.second;
-  }
+  auto& target_map = json_to_object(target)->mapForWrite();
+  json_to_object(src)->forEach(
+      [&](const w_string& key, const json_ref& value) {
+        target_map[key] = value;
+      });
 
   return 0;
 }
@@ -275,13 +361,14 @@ int json_object_update_existing(const json_t* src, json_t* target) {
   if (!json_is_object(src) || !json_is_object(target))
     return -1;
 
-  auto target_obj = json_to_object(target);
-  for (auto& it : json_to_object(src)->map) {
-    auto find = target_obj->map.find(it.first);
-    if (find != target_obj->map.end()) {
-      target_obj->map[it.first] = it.second;
-    }
-  }
+  auto& target_map = json_to_object(target)->mapForWrite();
+  json_to_object(src)->forEach(
+      [&](const w_string& key, const json_ref& value) {
+        auto find = target_map.find(key);
+        if (find != target_map.end()) {
+          find->second = value;
+        }
+      });
 
   return 0;
 }
@@ -290,13 +377,11 @@ int json_object_update_missing(const json_t* src, json_t* target) {
   if (!json_is_object(src) || !json_is_object(target))
     return -1;
 
-  auto target_obj = json_to_object(target);
-  for (auto& it : json_to_object(src)->map) {
-    auto find = target_obj->map.find(it.first);
-    if (find == target_obj->map.end()) {
-      target_obj->map[it.first] = it.second;
-    }
-  }
+  auto& target_map = json_to_object(target)->mapForWrite();
+  json_to_object(src)->forEach(
+      [&](const w_string& key, const json_ref& value) {
+        target_map.emplace(key, value);
+      });
 
   return 0;
 }
@@ -306,19 +391,19 @@ static int json_object_equal(json_t* object1, json_t* object2) {
     return 0;
 
   auto target_obj = json_to_object(object2);
-  for (auto& it : json_to_object(object1)->map) {
-    auto other_it = target_obj->map.find(it.first);
-
-    if (other_it == target_obj->map.end()) {
-      return 0;
-    }
+  int equal = 1;
+  json_to_object(object1)->forEach(
+      [&](const w_string& key, const json_ref& value) {
+        if (!equal) {
+          return;
+        }
+        auto other = target_obj->find(key.c_str());
+        if (!other || !json_equal(value, *other)) {
+          equal = 0;
+        }
+      });
 
-    if (!json_equal(it.second, other_it->second)) {
-      return 0;
-    }
-  }
-
-  return 1;
+  return equal;
 }
 
 static json_ref json_object_copy(const json_t* object) {
@@ -338,10 +423,11 @@ static json_ref json_object_deep_copy(const json_t* object) {
   if (!result)
     return nullptr;
 
-  auto target_obj = json_to_object(result);
-  for (auto& it : json_to_object(object)->map) {
-    target_obj->map[it.first] = json_deep_copy(it.second);
-  }
+  auto& target_map = json_to_object(result)->map;
+  json_to_object(object)->forEach(
+      [&](const w_string& key, const json_ref& value) {
+        target_map[key] = json_deep_copy(value);
+      });
 
   return result;
 }
@@ -370,7 +456,7 @@ std::vector<json_ref>& json_ref::array() {
 }
 
 json_ref json_array_of_size(size_t nelems) {
-  auto array = new json_array_t(nelems);
+  auto array = newValue<json_array_t>(nelems);
   return json_ref(&array->json, false);
 }
 
@@ -379,7 +465,7 @@ json_ref json_array(void) {
 }
 
 json_ref json_array(std::initializer_list<json_ref> values) {
-  auto array = new json_array_t(std::move(values));
+  auto array = newValue<json_array_t>(std::move(values));
   return json_ref(&array->json, false);
 }
 
@@ -571,7 +657,7 @@ json_ref w_string_to_json(const w_string& str) {
     return json_null();
   }
 
-  auto string = new json_string_t(str);
+  auto string = newValue<json_string_t>(str);
   return json_ref(&string->json, false);
 }
 
@@ -607,7 +693,7 @@ json_integer_t::json_integer_t(json_int_t value)
     : json(JSON_INTEGER), value(value) {}
 
 json_ref json_integer(json_int_t value) {
-  auto integer = new json_integer_t(value);
+  auto integer = newValue<json_integer_t>(value);
   return json_ref(&integer->json, false);
 }
 
@@ -647,7 +733,7 @@ json_ref json_real(double value) {
   if (std::isnan(value) || std::isinf(value)) {
     return nullptr;
   }
-  auto real = new json_real_t(value);
+  auto real = newValue<json_real_t>(value);
   return json_ref(&real->json, false);
 }
 
@@ -709,19 +795,19 @@ json_ref json_null(void) {
 void json_ref::json_delete(json_t* json) {
   switch (json->type) {
     case JSON_OBJECT:
-      delete (json_object_t*)json;
+      deleteValue<json_object_t>(json);
       break;
     case JSON_ARRAY:
-      delete (json_array_t*)json;
+      deleteValue<json_array_t>(json);
       break;
     case JSON_STRING:
-      delete (json_string_t*)json;
+      deleteValue<json_string_t>(json);
       break;
     case JSON_INTEGER:
-      delete (json_integer_t*)json;
+      deleteValue<json_integer_t>(json);
       break;
     case JSON_REAL:
-      delete (json_real_t*)json;
+      deleteValue<json_real_t>(json);
       break;
     case JSON_TRUE:
     case JSON_FALSE:
@@ -1,7 +1,17 @@
 #include <memory>
 
-#ifdef __SSE__
+// Node16 compares the key byte with all 16 keys at once where it can.  MSVC
+// doesn't define __SSE2__, but every x64 target has it.
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ART_SIMD_SSE2 1
 #include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define ART_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
 #endif
 #include <algorithm>
 #include <new>
@@ -23,8 +33,115 @@ template <typename T, typename Deleter, typename... Args>
 std::unique_ptr<T, Deleter> make_unique_with_deleter(Args&&... args) {
   return std::unique_ptr<T, Deleter>(new T(std::forward<Args>(args)...));
 }
+
+// Returns the index of the lowest set bit in a non-zero mask
+inline unsigned lowestBit(unsigned mask) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward(&idx, mask);
+  return idx;
+#else
+  return __builtin_ctz(mask);
+#endif
 }
 
+#if ART_SIMD_SSE2 || ART_SIMD_NEON
+// Returns a mask with bit i set for each of the first num_keys of the 16
+// keys that is equal to c, or with lessThan, that c is less than.  The keys
+// compare as unsigned bytes, the same as in the scalar code.
+inline unsigned
+matchKeys16(const unsigned char* keys, unsigned num_keys, unsigned char c,
+            bool lessThan) {
+  unsigned bits;
+#if ART_SIMD_SSE2
+  auto needle = _mm_set1_epi8(char(c));
+  auto haystack = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys));
+  if (lessThan) {
+    // SSE2 only has a signed comparison; flipping the top bits of both
+    // sides makes it order them as unsigned
+    auto bias = _mm_set1_epi8(char(0x80));
+    bits = _mm_movemask_epi8(_mm_cmplt_epi8(
+        _mm_xor_si128(needle, bias), _mm_xor_si128(haystack, bias)));
+  } else {
+    bits = _mm_movemask_epi8(_mm_cmpeq_epi8(needle, haystack));
+  }
+#else
+  auto needle = vdupq_n_u8(c);
+  auto haystack = vld1q_u8(keys);
+  auto cmp = lessThan ? vcltq_u8(needle, haystack) : vceqq_u8(needle, haystack);
+  // There is no movemask; weight each lane by its bit and sum each half
+  static const uint8_t kLaneBits[16] = {
+      1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  auto weighted = vandq_u8(cmp, vld1q_u8(kLaneBits));
+  bits = unsigned(vaddv_u8(vget_low_u8(weighted))) |
+      (unsigned(vaddv_u8(vget_high_u8(weighted))) << 8);
+#endif
+  return bits & ((1u << num_keys) - 1);
+}
+#endif
+
+template <size_t Size>
+typename NodePool<Size>::Cache& NodePool<Size>::cache() {
+  static thread_local Cache cache;
+  return cache;
+}
+
+template <size_t Size>
+NodePool<Size>::Cache::~Cache() {
+  while (head) {
+    auto block = head;
+    head = block->next;
+    ::operator delete(block);
+  }
+}
+
+template <size_t Size>
+void* NodePool<Size>::allocate() {
+  static_assert(Size >= sizeof(FreeBlock), "blocks must hold a link");
+#if !ART_SANITIZE_ADDRESS
+  auto& c = cache();
+  if (c.head) {
+    auto block = c.head;
+    c.head = block->next;
+    --c.count;
+    return block;
+  }
+#endif
+  return ::operator new(Size);
+}
+
+template <size_t Size>
+void NodePool<Size>::deallocate(void* block) {
+#if !ART_SANITIZE_ADDRESS
+  // Let ASAN see every free, so that it can catch use after free
+  auto& c = cache();
+  if (c.count < kMaxCached) {
+    c.head = new (block) FreeBlock{c.head};
+    ++c.count;
+    return;
+  }
+#endif
+  ::operator delete(block);
+}
+
+template <typename T>
+void* Pooled<T>::operator new(size_t size) {
+  if (size != sizeof(T)) {
+    return ::operator new(size);
+  }
+  return NodePool<sizeof(T)>::allocate();
+}
+
+template <typename T>
+void Pooled<T>::operator delete(void* block, size_t size) {
+  if (size != sizeof(T)) {
+    ::operator delete(block);
+    return;
+  }
+  NodePool<sizeof(T)>::deallocate(block);
+}
+} // namespace detail
+
 // The ART implementation requires that no key be a full prefix of an existing
 // key during insertion.  In practice this means that each key must have a
 // terminator character.  One approach is to ensure that the key and key_len
@@ -252,20 +369,11 @@ void art_tree<ValueType, KeyType>::Node16::addChild(
     NodePtr&& child) {
   if (this->num_children < 16) {
     unsigned idx;
-#ifdef __SSE__
-    __m128i cmp;
-    unsigned mask, bitfield;
-
-    // Compare the key to all 16 stored keys
-    cmp = _mm_cmplt_epi8(_mm_set1_epi8(c), _mm_loadu_si128((__m128i*)keys));
-
-    // Use a mask to ignore children that don't exist
-    mask = (1 << this->num_children) - 1;
-    bitfield = _mm_movemask_epi8(cmp) & mask;
-
-    // Check if less than any
+#if ART_SIMD_SSE2 || ART_SIMD_NEON
+    // Find the first key that c sorts before
+    auto bitfield = detail::matchKeys16(keys, this->num_children, c, true);
     if (bitfield) {
-      idx = __builtin_ctz(bitfield);
+      idx = detail::lowestBit(bitfield);
       memmove(keys + idx + 1, keys + idx, this->num_children - idx);
       std::move_backward(
           children.begin() + idx,
@@ -301,24 +409,10 @@ void art_tree<ValueType, KeyType>::Node16::addChild(
 template <typename ValueType, typename KeyType>
 typename art_tree<ValueType, KeyType>::NodePtr*
 art_tree<ValueType, KeyType>::Node16::findChild(unsigned char c) {
-#ifdef __SSE__
-  __m128i cmp;
-  int mask, bitfield;
-
-  // Compare the key to all 16 stored keys
-  cmp = _mm_cmpeq_epi8(_mm_set1_epi8(c), _mm_loadu_si128((__m128i*)keys));
-
-  // Use a mask to ignore children that don't exist
-  mask = (1 << this->num_children) - 1;
-  bitfield = _mm_movemask_epi8(cmp) & mask;
-
-  /*
-   * If we have a match (any bit set) then we can
-   * return the pointer match using ctz to get
-   * the index.
-   */
+#if ART_SIMD_SSE2 || ART_SIMD_NEON
+  auto bitfield = detail::matchKeys16(keys, this->num_children, c, false);
   if (bitfield) {
-    return &children[__builtin_ctz(bitfield)];
+    return &children[detail::lowestBit(bitfield)];
   }
 #else
   int i;
@@ -663,6 +757,62 @@ art_tree<ValueType, KeyType>::longestMatch(
   return nullptr;
 }
 
+template <typename ValueType, typename KeyType>
+template <typename IsSeparator, typename Func>
+int art_tree<ValueType, KeyType>::iterPathPrefixes(
+    const unsigned char* key,
+    uint32_t key_len,
+    IsSeparator&& isSeparator,
+    Func&& func) const {
+  // Checks the whole key; the walk below only checks the bytes that the
+  // nodes store
+  auto visit = [&](Leaf* leaf) -> int {
+    auto len = leaf->key.size();
+    if (len > key_len ||
+        (len < key_len && !isSeparator(key[len])) ||
+        memcmp(leaf->key.data(), key, len) != 0) {
+      return 0;
+    }
+    return func(leaf->key, leaf->value);
+  };
+
+  auto n = root_.get();
+  uint32_t depth = 0;
+  while (n) {
+    if (IS_LEAF(n)) {
+      return visit(LEAF_RAW(n));
+    }
+
+    if (n->partial_len) {
+      auto prefix_len = n->checkPrefix(key, key_len, depth);
+      if (prefix_len != std::min(ART_MAX_PREFIX_LEN, n->partial_len)) {
+        return 0;
+      }
+      depth = depth + n->partial_len;
+    }
+
+    if (depth > key_len) {
+      return 0;
+    }
+
+    if (depth < key_len) {
+      // A key that ends here hangs off the implicit terminator, so it is
+      // off the path that the rest of the key takes
+      auto end = const_cast<Node*>(n)->findChild(0);
+      if (end && IS_LEAF(end->get())) {
+        if (auto stop = visit(LEAF_RAW(end->get()))) {
+          return stop;
+        }
+      }
+    }
+
+    auto child = const_cast<Node*>(n)->findChild(keyAt(key, key_len, depth));
+    n = child ? child->get() : nullptr;
+    depth++;
+  }
+  return 0;
+}
+
 template <typename ValueType, typename KeyType>
 ValueType* art_tree<ValueType, KeyType>::search(const KeyType& key) const {
   return search(reinterpret_cast<const unsigned char*>(key.data()), key.size());
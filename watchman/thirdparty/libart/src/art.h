@@ -9,6 +9,38 @@
 
 #define ART_MAX_PREFIX_LEN 10u
 
+namespace detail {
+// Recycles the blocks of one size freed on a thread for later allocations
+// on the same thread, so that trees which are repeatedly emptied and
+// refilled don't have to go back to the allocator for every node.
+template <size_t Size>
+class NodePool {
+ public:
+  static void* allocate();
+  static void deallocate(void* block);
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+  struct Cache {
+    FreeBlock* head{nullptr};
+    size_t count{0};
+    ~Cache();
+  };
+  // How many freed blocks of each size a thread holds on to
+  static constexpr size_t kMaxCached = 1024;
+  static Cache& cache();
+};
+
+// Gives T allocations from the NodePool for its size
+template <typename T>
+struct Pooled {
+  static void* operator new(size_t size);
+  static void operator delete(void* block, size_t size);
+};
+} // namespace detail
+
 /**
  * Main struct, points to root.
  */
@@ -106,7 +138,7 @@ struct art_tree {
   /**
    * Small node with only 4 children
    */
-  struct Node4 : public Node {
+  struct Node4 : public Node, public detail::Pooled<Node4> {
     unsigned char keys[4];
     std::array<NodePtr, 4> children;
 
@@ -120,7 +152,7 @@ struct art_tree {
   /**
    * Node with 16 children
    */
-  struct Node16 : public Node {
+  struct Node16 : public Node, public detail::Pooled<Node16> {
     unsigned char keys[16];
     std::array<NodePtr, 16> children;
 
@@ -136,7 +168,7 @@ struct art_tree {
    * Node with 48 children, but
    * a full 256 byte field.
    */
-  struct Node48 : public Node {
+  struct Node48 : public Node, public detail::Pooled<Node48> {
     unsigned char keys[256];
     std::array<NodePtr, 48> children;
 
@@ -151,7 +183,7 @@ struct art_tree {
   /**
    * Full node with 256 children
    */
-  struct Node256 : public Node {
+  struct Node256 : public Node, public detail::Pooled<Node256> {
     std::array<NodePtr, 256> children;
 
     Node256();
@@ -165,7 +197,7 @@ struct art_tree {
    * Represents a leaf. These are
    * of arbitrary size, as they include the key.
    */
-  struct Leaf {
+  struct Leaf : public detail::Pooled<Leaf> {
     KeyType key;
     ValueType value;
 
@@ -227,6 +259,22 @@ struct art_tree {
    */
   Leaf* longestMatch(const unsigned char* key, uint32_t key_len) const;
 
+  /**
+   * Invokes a callback for each entry whose key is a path prefix of the
+   * input key: either the key itself, or a prefix of it after which the
+   * input continues with a character for which isSeparator returns true.
+   * The entries are visited shortest key first.  Unlike longestMatch this
+   * finds "a/b" for "a/b/d" even when the tree also holds "a/b/c".
+   * If the callback returns non-zero, then the iteration stops.
+   * @return 0 on success, or the return of the callback.
+   */
+  template <typename IsSeparator, typename Func>
+  int iterPathPrefixes(
+      const unsigned char* key,
+      uint32_t key_len,
+      IsSeparator&& isSeparator,
+      Func&& func) const;
+
   /**
    * Returns the minimum valued leaf
    * @return The minimum leaf or NULL
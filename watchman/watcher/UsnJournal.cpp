@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "watchman/watcher/UsnJournal.h"
+
+#ifdef _WIN32
+
+#include <folly/Conv.h>
+#include <folly/String.h>
+#include <winioctl.h>
+#include <cstring>
+#include <system_error>
+#include "watchman/Logging.h"
+
+namespace watchman {
+
+namespace {
+
+// How much of the journal is read at a time
+constexpr DWORD kReadSize = 64 * 1024;
+
+[[noreturn]] void throwLastError(const char* what) {
+  throw std::system_error(GetLastError(), std::system_category(), what);
+}
+
+USN_JOURNAL_DATA_V0 queryJournal(const FileDescriptor& volume) {
+  USN_JOURNAL_DATA_V0 data;
+  DWORD bytes;
+  if (!DeviceIoControl(
+          (HANDLE)volume.handle(),
+          FSCTL_QUERY_USN_JOURNAL,
+          nullptr,
+          0,
+          &data,
+          sizeof(data),
+          &bytes,
+          nullptr)) {
+    throwLastError("FSCTL_QUERY_USN_JOURNAL");
+  }
+  return data;
+}
+
+} // namespace
+
+UsnJournal::UsnJournal(const w_string& rootPath) : rootPath_{rootPath} {
+  auto wroot = rootPath.piece().asWideUNC();
+  WCHAR mountPoint[MAX_PATH + 1];
+  if (!GetVolumePathNameW(wroot.c_str(), mountPoint, MAX_PATH + 1)) {
+    throwLastError("GetVolumePathNameW");
+  }
+  WCHAR volumeName[MAX_PATH + 1];
+  if (!GetVolumeNameForVolumeMountPointW(
+          mountPoint, volumeName, MAX_PATH + 1)) {
+    throwLastError("GetVolumeNameForVolumeMountPointW");
+  }
+  // The volume itself is opened without the trailing slash, which would
+  // name its root dir instead
+  auto len = wcslen(volumeName);
+  if (len > 0 && volumeName[len - 1] == L'\\') {
+    volumeName[len - 1] = 0;
+  }
+
+  volume_ = FileDescriptor(
+      intptr_t(CreateFileW(
+          volumeName,
+          GENERIC_READ,
+          FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+          nullptr,
+          OPEN_EXISTING,
+          0,
+          nullptr)),
+      FileDescriptor::FDType::Generic);
+  if (!volume_) {
+    throwLastError("opening the volume");
+  }
+
+  journalId_ = queryJournal(volume_).UsnJournalID;
+}
+
+int64_t UsnJournal::nextUsn() const {
+  auto data = queryJournal(volume_);
+  if (data.UsnJournalID != journalId_) {
+    throw std::system_error(
+        ERROR_JOURNAL_NOT_ACTIVE,
+        std::system_category(),
+        "the change journal was recreated");
+  }
+  return data.NextUsn;
+}
+
+std::optional<std::vector<UsnJournal::Change>> UsnJournal::changesBetween(
+    int64_t usn,
+    int64_t until) const {
+  READ_USN_JOURNAL_DATA_V0 read{};
+  read.StartUsn = usn;
+  read.ReasonMask = 0xffffffff;
+  read.UsnJournalID = journalId_;
+
+  std::vector<uint8_t> buf(kReadSize);
+  DirCache dirs;
+  std::vector<Change> changes;
+  // The index into changes of each name
+  std::unordered_map<w_string, size_t> seen;
+
+  while (read.StartUsn < until) {
+    DWORD bytes;
+    if (!DeviceIoControl(
+            (HANDLE)volume_.handle(),
+            FSCTL_READ_USN_JOURNAL,
+            &read,
+            sizeof(read),
+            buf.data(),
+            DWORD(buf.size()),
+            &bytes,
+            nullptr)) {
+      // Most likely ERROR_JOURNAL_ENTRY_DELETED: the records from usn have
+      // been discarded to make room
+      auto err = GetLastError();
+      logf(
+          ERR,
+          "can't read the change journal for {} from USN {}: {}\n",
+          rootPath_,
+          usn,
+          win32_strerror(err));
+      return std::nullopt;
+    }
+    // The buffer starts with the USN to continue reading from, and holds
+    // nothing else once we've caught up with the end of the journal
+    if (bytes <= sizeof(USN)) {
+      break;
+    }
+    USN next;
+    memcpy(&next, buf.data(), sizeof(next));
+
+    auto* pos = buf.data() + sizeof(USN);
+    auto* end = buf.data() + bytes;
+    while (pos < end) {
+      auto* record = reinterpret_cast<const USN_RECORD_V2*>(pos);
+      pos += record->RecordLength;
+      if (record->Usn >= until) {
+        next = until;
+        break;
+      }
+      if (record->MajorVersion != 2) {
+        logf(
+            ERR,
+            "can't read version {} change journal records for {}\n",
+            record->MajorVersion,
+            rootPath_);
+        return std::nullopt;
+      }
+
+      // A change in a dir that has since been deleted is followed by the
+      // deletion of the dir, or of one of its parents, which covers it
+      auto parent = resolveDir(record->ParentFileReferenceNumber, dirs);
+      if (!parent) {
+        continue;
+      }
+      w_string leaf(
+          reinterpret_cast<const WCHAR*>(
+              reinterpret_cast<const char*>(record) + record->FileNameOffset),
+          record->FileNameLength / sizeof(WCHAR));
+      auto name = parent.empty() ? leaf : w_string::pathCat({parent, leaf});
+      bool removed = record->Reason &
+          (USN_REASON_FILE_DELETE | USN_REASON_RENAME_OLD_NAME);
+
+      auto [it, inserted] = seen.emplace(name, changes.size());
+      if (inserted) {
+        changes.push_back(Change{std::move(name), removed});
+      } else {
+        changes[it->second].removed |= removed;
+      }
+    }
+    read.StartUsn = next;
+  }
+  return changes;
+}
+
+w_string UsnJournal::formatPosition(int64_t usn) const {
+  return w_string::format("usn:{}:{}", journalId_, usn);
+}
+
+std::optional<std::vector<UsnJournal::Change>> UsnJournal::changesSince(
+    w_string_piece position) const {
+  folly::StringPiece kind, journalId, usn;
+  if (!folly::split(':', position.view(), kind, journalId, usn) ||
+      kind != "usn") {
+    return std::nullopt;
+  }
+  auto id = folly::tryTo<uint64_t>(journalId);
+  auto from = folly::tryTo<int64_t>(usn);
+  if (!id || !from) {
+    return std::nullopt;
+  }
+  if (*id != journalId_) {
+    logf(
+        ERR,
+        "the change journal for {} was recreated since USN {}\n",
+        rootPath_,
+        *from);
+    return std::nullopt;
+  }
+
+  int64_t until;
+  try {
+    until = nextUsn();
+  } catch (const std::exception& exc) {
+    logf(
+        ERR,
+        "can't read the change journal for {}: {}\n",
+        rootPath_,
+        exc.what());
+    return std::nullopt;
+  }
+  return changesBetween(*from, until);
+}
+
+w_string UsnJournal::resolveDir(uint64_t fileReference, DirCache& cache)
+    const {
+  auto it = cache.find(fileReference);
+  if (it != cache.end()) {
+    return it->second;
+  }
+
+  w_string result;
+  FILE_ID_DESCRIPTOR id{};
+  id.dwSize = sizeof(id);
+  id.Type = FileIdType;
+  id.FileId.QuadPart = LONGLONG(fileReference);
+  HANDLE dir = OpenFileById(
+      (HANDLE)volume_.handle(),
+      &id,
+      0,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+      nullptr,
+      FILE_FLAG_BACKUP_SEMANTICS);
+  if (dir != INVALID_HANDLE_VALUE) {
+    std::vector<WCHAR> path(MAX_PATH);
+    auto len = GetFinalPathNameByHandleW(
+        dir, path.data(), DWORD(path.size()), FILE_NAME_NORMALIZED);
+    if (len >= path.size()) {
+      path.resize(len);
+      len = GetFinalPathNameByHandleW(
+          dir, path.data(), DWORD(path.size()), FILE_NAME_NORMALIZED);
+    }
+    CloseHandle(dir);
+
+    if (len > 0 && len < path.size()) {
+      // Strips the \\?\ prefix and uses our separators
+      w_string full(path.data(), len);
+      auto root = rootPath_.size();
+      if (full.piece().startsWithCaseInsensitive(rootPath_)) {
+        if (full.size() == root) {
+          result = w_string("", W_STRING_BYTE);
+        } else if (is_slash(full.data()[root])) {
+          result = w_string(
+              full.data() + root + 1, full.size() - root - 1, W_STRING_BYTE);
+        }
+      }
+    }
+  }
+  cache.emplace(fileReference, result);
+  return result;
+}
+
+} // namespace watchman
+
+#endif // _WIN32
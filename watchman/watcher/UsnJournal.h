@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#ifdef _WIN32
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/watchman_string.h"
+
+namespace watchman {
+
+/**
+ * Reads the NTFS change journal (the USN journal) of the volume that a root
+ * is on.  Every change to the volume is recorded there with an ever
+ * increasing update sequence number (USN), and the journal outlives both an
+ * overflow of the ReadDirectoryChangesW buffer and a restart of the daemon,
+ * so what changed below the root since a given USN can be looked up rather
+ * than crawling the whole root to find out.
+ *
+ * The volume bounds the size of the journal, so the oldest records are
+ * eventually discarded, as is the whole journal if it is deleted and
+ * recreated, which gives it a new ID.  Either way, asking for the changes
+ * from before that gets std::nullopt, and the caller has to crawl.
+ */
+class UsnJournal {
+ public:
+  struct Change {
+    // Relative to the root
+    w_string name;
+    // Deleted or renamed away, along with anything below it
+    bool removed{false};
+  };
+
+  /**
+   * Opens the journal of the volume that rootPath is on.  Throws
+   * std::system_error if the volume keeps no journal, or it can't be read,
+   * which needs the daemon to be running as an administrator.
+   */
+  explicit UsnJournal(const w_string& rootPath);
+
+  /**
+   * Returns the USN that the next change to the volume will be recorded
+   * with.  Throws std::system_error on failure.
+   */
+  int64_t nextUsn() const;
+
+  /**
+   * Returns the changes below the root that were recorded from usn up to,
+   * but not including, until, oldest first with each name only once.
+   * Returns std::nullopt if the journal no longer goes back that far, or
+   * can't be read.
+   */
+  std::optional<std::vector<Change>> changesBetween(
+      int64_t usn,
+      int64_t until) const;
+
+  /**
+   * Returns a token for the point in the journal at usn, which
+   * changesSince accepts from a later process.
+   */
+  w_string formatPosition(int64_t usn) const;
+
+  /**
+   * As changesBetween, from position, which formatPosition returned, up to
+   * now.  Also returns std::nullopt if position is for another journal.
+   */
+  std::optional<std::vector<Change>> changesSince(
+      w_string_piece position) const;
+
+ private:
+  using DirCache = std::unordered_map<uint64_t, w_string>;
+
+  // Returns the name of the dir with the given file reference relative to
+  // the root, an empty string for the root itself, or a null w_string if it
+  // isn't below the root or no longer exists
+  w_string resolveDir(uint64_t fileReference, DirCache& cache) const;
+
+  w_string rootPath_;
+  FileDescriptor volume_;
+  uint64_t journalId_{0};
+};
+
+} // namespace watchman
+
+#endif // _WIN32
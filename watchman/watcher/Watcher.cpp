@@ -6,6 +6,9 @@
  */
 
 #include "watchman/watcher/Watcher.h"
+#include <algorithm>
+#include "watchman/TreeSizeHints.h"
+#include "watchman/WatchmanConfig.h"
 
 namespace watchman {
 
@@ -21,4 +24,16 @@ bool Watcher::start(const std::shared_ptr<Root>&) {
   return true;
 }
 
+size_t hintNumDirs(const Configuration& config, const w_string& rootPath) {
+  if (config.get(CFG_HINT_NUM_DIRS)) {
+    return size_t(std::max<json_int_t>(
+        0, config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS)));
+  }
+  if (auto hints = TreeSizeHints::lookup(rootPath)) {
+    // Allow for the dirs created since, so that they don't rehash at once
+    return size_t(hints->numDirs + hints->numDirs / 8);
+  }
+  return HINT_NUM_DIRS;
+}
+
 } // namespace watchman
@@ -7,7 +7,9 @@
 
 #pragma once
 #include <folly/futures/Future.h>
+#include <optional>
 #include <stdexcept>
+#include <vector>
 #include "watchman/PendingCollection.h"
 #include "watchman/fs/DirHandle.h"
 #include "watchman/thirdparty/jansson/jansson.h"
@@ -19,6 +21,7 @@ struct watchman_file;
 
 namespace watchman {
 
+class Configuration;
 class QueryableView;
 class InMemoryView;
 class Root;
@@ -71,6 +74,41 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
     return folly::SemiFuture<folly::Unit>::makeEmpty();
   }
 
+  /**
+   * If the returned SemiFuture is valid(), then this watcher can synchronize
+   * without a cookie file: every change made before the call has already
+   * been queued by the OS, and the SemiFuture is completed once InMemoryView
+   * has processed everything up to that point in the queue.
+   *
+   * Otherwise, the watcher gives no such guarantee and cookie files must be
+   * used.
+   */
+  virtual folly::SemiFuture<folly::Unit> flushToNow() {
+    return folly::SemiFuture<folly::Unit>::makeEmpty();
+  }
+
+  /**
+   * Returns a token for how far the watcher has got through a history of
+   * changes that outlives the daemon, such as a filesystem change journal,
+   * if it keeps one, or a null w_string otherwise.  Everything before it
+   * was handed out by consumeNotify; the IO thread stores it with the view
+   * snapshot once what was handed out has been processed.
+   */
+  virtual w_string getChangeHistoryPosition() {
+    return w_string();
+  }
+
+  /**
+   * Returns the names, relative to the root, of what may have changed
+   * since position, which getChangeHistoryPosition returned, possibly in an
+   * earlier process.  Returns std::nullopt if the history no longer goes
+   * back that far, in which case the whole root has to be crawled.
+   */
+  virtual std::optional<std::vector<w_string>> getChangesSince(
+      w_string_piece /* position */) {
+    return std::nullopt;
+  }
+
   // Initiate an OS-level watch on the provided file
   virtual bool startWatchFile(watchman_file* file);
 
@@ -121,6 +159,23 @@ class Watcher : public std::enable_shared_from_this<Watcher> {
    * Clear any accumulated debug state.
    */
   virtual void clearDebugInfo() {}
+
+  /**
+   * Returns a JSON object describing the sizes of the structures that the
+   * watcher keeps for each watched dir or file, for debug-memory.  Returns
+   * null for watchers that keep none.
+   */
+  virtual json_ref getMemoryUsage() const {
+    return json_null();
+  }
 };
 
+/**
+ * The number of dirs that a watcher of the root at rootPath should size its
+ * tables for: the configured hint_num_dirs if there is one, else the number
+ * that the root had when it was last crawled, with some room to grow, else
+ * HINT_NUM_DIRS.
+ */
+size_t hintNumDirs(const Configuration& config, const w_string& rootPath);
+
 } // namespace watchman
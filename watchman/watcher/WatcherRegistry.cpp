@@ -87,6 +87,10 @@ std::shared_ptr<watchman::QueryableView> WatcherRegistry::initWatcher(
       try {
         return reportWatcher(
             watcherName, root_path, watcher->init_(root_path, fstype, config));
+      } catch (const watchman::TerminalWatcherError& e) {
+        // Nor fall back to the others
+        throw std::runtime_error(
+            watcherName + std::string(": ") + e.what() + std::string(". "));
       } catch (const std::exception& e) {
         failureReasons.append(
             watcherName + std::string(": ") + e.what() + std::string(". "));
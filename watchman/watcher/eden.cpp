@@ -7,6 +7,7 @@
 
 #include <cpptoml.h>
 #include <folly/String.h>
+#include <folly/Synchronized.h>
 #include <folly/futures/Future.h>
 #include <folly/io/async/AsyncSocket.h>
 #include <folly/io/async/EventBase.h>
@@ -19,13 +20,18 @@
 #include <thrift/lib/cpp2/async/RocketClientChannel.h>
 #include <algorithm>
 #include <chrono>
+#include <deque>
 #include <iterator>
+#include <optional>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include "eden/fs/service/gen-cpp2/StreamingEdenService.h"
 #include "watchman/ChildProcess.h"
 #include "watchman/Errors.h"
 #include "watchman/QueryableView.h"
 #include "watchman/ThreadPool.h"
+#include "watchman/ThreadStats.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/query/GlobTree.h"
 #include "watchman/query/Query.h"
@@ -41,9 +47,13 @@ using apache::thrift::TApplicationException;
 using facebook::eden::EdenError;
 using facebook::eden::EntryInformation;
 using facebook::eden::EntryInformationOrError;
+using facebook::eden::FileAttributeDataOrError;
+using facebook::eden::FileAttributes;
 using facebook::eden::FileDelta;
 using facebook::eden::FileInformation;
 using facebook::eden::FileInformationOrError;
+using facebook::eden::GetAttributesFromFilesParams;
+using facebook::eden::GetAttributesFromFilesResult;
 using facebook::eden::Glob;
 using facebook::eden::GlobParams;
 using facebook::eden::JournalPosition;
@@ -193,12 +203,14 @@ class EdenFileResult : public FileResult {
   EdenFileResult(
       const w_string& rootPath,
       std::shared_ptr<apache::thrift::RequestChannel> thriftChannel,
+      size_t fetchChunkSize,
       const w_string& fullName,
       JournalPosition* position = nullptr,
       bool isNew = false,
       DType dtype = DType::Unknown)
       : rootPath_(rootPath),
         thriftChannel_{std::move(thriftChannel)},
+        fetchChunkSize_{fetchChunkSize},
         fullName_(fullName),
         dtype_(dtype) {
     otime_.ticks = ctime_.ticks = 0;
@@ -248,6 +260,9 @@ class EdenFileResult : public FileResult {
   }
 
   std::optional<size_t> size() override {
+    if (fileSize_.has_value()) {
+      return fileSize_;
+    }
     if (!stat_.has_value()) {
       accessorNeedsProperties(FileResult::Property::Size);
       return std::nullopt;
@@ -350,15 +365,19 @@ class EdenFileResult : public FileResult {
   }
 
   void batchFetchProperties(
-      const std::vector<std::unique_ptr<FileResult>>& files) override {
+      const std::vector<std::unique_ptr<FileResult>>& files,
+      PropertyCacheStats*) override {
     std::vector<EdenFileResult*> getFileInformationFiles;
     std::vector<std::string> getFileInformationNames;
     // If only dtype and exists are needed, Eden has a cheaper API for
     // retrieving them.
     bool onlyEntryInfoNeeded = true;
 
-    std::vector<EdenFileResult*> getShaFiles;
-    std::vector<std::string> getShaNames;
+    // The files whose SHA-1, or whose size and existence, are fetched with
+    // getAttributesFromFiles, and the union of the attributes they need
+    std::vector<EdenFileResult*> getAttributesFiles;
+    std::vector<std::string> getAttributesNames;
+    uint64_t requestedAttributes = 0;
 
     std::vector<EdenFileResult*> getSymlinkFiles;
 
@@ -383,15 +402,27 @@ class EdenFileResult : public FileResult {
         getSymlinkFiles.emplace_back(&edenFile);
       }
 
-      if (edenFile.neededProperties() &
+      edenFile.requestedAttributes_ = 0;
+      if (edenFile.neededProperties() & FileResult::Property::ContentSha1) {
+        edenFile.requestedAttributes_ |= uint64_t(FileAttributes::SHA1_HASH);
+      }
+
+      auto statProperties = edenFile.neededProperties() &
           (FileResult::Property::FileDType | FileResult::Property::CTime |
            FileResult::Property::OTime | FileResult::Property::Exists |
            FileResult::Property::Size | FileResult::Property::StatTimeStamps |
-           FileResult::Property::FullFileInformation)) {
+           FileResult::Property::FullFileInformation);
+      if ((statProperties & FileResult::Property::Size) &&
+          !(statProperties &
+            ~(FileResult::Property::Size | FileResult::Property::Exists))) {
+        // The size tells us that the file exists too, so the attributes
+        // cover everything that is needed of the file
+        edenFile.requestedAttributes_ |= uint64_t(FileAttributes::FILE_SIZE);
+      } else if (statProperties) {
         getFileInformationFiles.emplace_back(&edenFile);
         getFileInformationNames.emplace_back(relName.data(), relName.size());
 
-        if (edenFile.neededProperties() &
+        if (statProperties &
             ~(FileResult::Property::FileDType | FileResult::Property::Exists)) {
           // We could maintain two lists and call both getFileInformation and
           // getEntryInformation in parallel, but in practice the set of
@@ -400,9 +431,10 @@ class EdenFileResult : public FileResult {
         }
       }
 
-      if (edenFile.neededProperties() & FileResult::Property::ContentSha1) {
-        getShaFiles.emplace_back(&edenFile);
-        getShaNames.emplace_back(relName.data(), relName.size());
+      if (edenFile.requestedAttributes_) {
+        getAttributesFiles.emplace_back(&edenFile);
+        getAttributesNames.emplace_back(relName.data(), relName.size());
+        requestedAttributes |= edenFile.requestedAttributes_;
       }
 
       // If we were to throw later in this method, we will have forgotten
@@ -413,8 +445,31 @@ class EdenFileResult : public FileResult {
     }
 
     auto client = getEdenClient(thriftChannel_);
+    folly::DrivableExecutor* executor =
+        folly::EventBaseManager::get()->getEventBase();
+
+    // Send the attributes request first so that Eden works on it while we
+    // wait for the file information
+    auto attributes = startChunks(
+        executor,
+        fetchChunkSize_,
+        getAttributesNames,
+        [&](std::vector<std::string> chunk) {
+          GetAttributesFromFilesParams params;
+          params.mountPoint_ref() = std::string{rootPath_.view()};
+          params.paths_ref() = std::move(chunk);
+          params.requestedAttributes_ref() = requestedAttributes;
+          params.sync_ref() = getSyncBehavior();
+          return client->semifuture_getAttributesFromFiles(params).deferValue(
+              [](GetAttributesFromFilesResult result) {
+                return std::move(*result.res_ref());
+              });
+        });
+
     loadFileInformation(
         client.get(),
+        executor,
+        fetchChunkSize_,
         rootPath_,
         getFileInformationNames,
         getFileInformationFiles,
@@ -423,38 +478,77 @@ class EdenFileResult : public FileResult {
     // TODO: add eden bulk readlink call
     loadSymlinkTargets(client.get(), getSymlinkFiles);
 
-    if (!getShaFiles.empty()) {
-      std::vector<SHA1Result> sha1s;
-      client->sync_getSHA1(
-          sha1s, std::string{rootPath_.view()}, getShaNames, getSyncBehavior());
+    bool haveAttributes = true;
+    try {
+      applyChunks(
+          executor, std::move(attributes), fetchChunkSize_, getAttributesFiles);
+    } catch (const TApplicationException& ex) {
+      if (TApplicationException::UNKNOWN_METHOD != ex.getType()) {
+        throw;
+      }
+      // getAttributesFromFiles is not available in this version of Eden.
+      // Fall back to the separate getSHA1 and getFileInformation below.
+      haveAttributes = false;
+    }
 
-      if (sha1s.size() != getShaFiles.size()) {
-        log(ERR,
-            "Requested SHA-1 of ",
-            getShaFiles.size(),
-            " but Eden returned ",
-            sha1s.size(),
-            " results -- ignoring");
-      } else {
-        auto sha1Iter = sha1s.begin();
-        for (auto& edenFile : getShaFiles) {
-          edenFile->sha1_ = *sha1Iter++;
-        }
+    std::vector<EdenFileResult*> getShaFiles;
+    std::vector<std::string> getShaNames;
+    getFileInformationFiles.clear();
+    getFileInformationNames.clear();
+    for (size_t i = 0; i < getAttributesFiles.size(); ++i) {
+      auto* edenFile = getAttributesFiles[i];
+      auto attrs = edenFile->requestedAttributes_;
+      if (!haveAttributes && (attrs & uint64_t(FileAttributes::SHA1_HASH))) {
+        getShaFiles.push_back(edenFile);
+        getShaNames.push_back(getAttributesNames[i]);
+      }
+      // Eden has no size attribute for some entries, such as directories,
+      // whose size is then taken from their file information
+      if ((attrs & uint64_t(FileAttributes::FILE_SIZE)) &&
+          !edenFile->fileSize_.has_value() &&
+          edenFile->exists_ != std::optional<bool>(false)) {
+        getFileInformationFiles.push_back(edenFile);
+        getFileInformationNames.push_back(getAttributesNames[i]);
       }
     }
+
+    fetchInChunks(
+        executor,
+        fetchChunkSize_,
+        getShaNames,
+        getShaFiles,
+        [&](std::vector<std::string> chunk) {
+          return client->semifuture_getSHA1(
+              std::string{rootPath_.view()}, chunk, getSyncBehavior());
+        });
+    loadFileInformation(
+        client.get(),
+        executor,
+        fetchChunkSize_,
+        rootPath_,
+        getFileInformationNames,
+        getFileInformationFiles,
+        /*onlyEntryInfoNeeded=*/false);
   }
 
  private:
   w_string rootPath_;
   std::shared_ptr<apache::thrift::RequestChannel> thriftChannel_;
+  // Large batches are split into requests of at most this many names,
+  // which Eden can serve concurrently
+  size_t fetchChunkSize_;
   w_string fullName_;
   std::optional<FileInformation> stat_;
+  // Set when the size comes from getAttributesFromFiles rather than stat_
+  std::optional<size_t> fileSize_;
   std::optional<bool> exists_;
   w_clock_t ctime_;
   w_clock_t otime_;
   std::optional<SHA1Result> sha1_;
   std::optional<w_string> symlinkTarget_;
   DType dtype_{DType::Unknown};
+  // The FileAttributes that the current batch requests for this file
+  uint64_t requestedAttributes_{0};
 
   // Read the symlink targets for each of the provided `files`.  The files
   // had SymlinkTarget set in neededProperties prior to clearing it in
@@ -476,45 +570,100 @@ class EdenFileResult : public FileResult {
     }
   }
 
-  static void loadFileInformation(
-      StreamingEdenServiceAsyncClient* client,
-      const w_string& rootPath,
+  // Calls fetch(names) for each chunk of at most chunkSize names, all at
+  // once, and returns the futures of their results.
+  template <typename Fetch>
+  static auto startChunks(
+      folly::DrivableExecutor* executor,
+      size_t chunkSize,
       const std::vector<std::string>& names,
-      const std::vector<EdenFileResult*>& outFiles,
-      bool onlyEntryInfoNeeded) {
-    w_assert(
-        names.size() == outFiles.size(), "names.size must == outFiles.size");
-    if (names.empty()) {
-      return;
+      Fetch fetch) {
+    using Info = typename decltype(
+        fetch(std::vector<std::string>{}))::value_type::value_type;
+
+    std::vector<folly::Future<std::vector<Info>>> futures;
+    for (size_t i = 0; i < names.size(); i += chunkSize) {
+      auto end = std::min(names.size(), i + chunkSize);
+      futures.push_back(
+          fetch(std::vector<std::string>{
+                    names.begin() + i, names.begin() + end})
+              .via(executor));
     }
+    return futures;
+  }
 
-    auto applyResults = [&](const auto& edenInfo) {
-      if (names.size() != edenInfo.size()) {
+  // Waits for the futures returned by startChunks and applies their results
+  // to the corresponding outFiles.
+  template <typename Info>
+  static void applyChunks(
+      folly::DrivableExecutor* executor,
+      std::vector<folly::Future<std::vector<Info>>> futures,
+      size_t chunkSize,
+      const std::vector<EdenFileResult*>& outFiles) {
+    for (size_t chunk = 0; chunk < futures.size(); ++chunk) {
+      auto edenInfo = std::move(futures[chunk]).getVia(executor);
+      auto begin = chunk * chunkSize;
+      auto end = std::min(outFiles.size(), begin + chunkSize);
+      if (end - begin != edenInfo.size()) {
         log(ERR,
             "Requested file information of ",
-            names.size(),
+            end - begin,
             " files but Eden returned information for ",
             edenInfo.size(),
             " files. Treating missing entries as missing files.");
       }
 
       auto infoIter = edenInfo.begin();
-      for (auto& edenFileResult : outFiles) {
+      for (auto i = begin; i < end; ++i) {
         if (infoIter == edenInfo.end()) {
-          edenFileResult->setExists(false);
+          outFiles[i]->setExists(false);
         } else {
-          edenFileResult->applyInformationOrError(*infoIter);
+          outFiles[i]->applyInformationOrError(*infoIter);
           ++infoIter;
         }
       }
-    };
+    }
+  }
+
+  template <typename Fetch>
+  static void fetchInChunks(
+      folly::DrivableExecutor* executor,
+      size_t chunkSize,
+      const std::vector<std::string>& names,
+      const std::vector<EdenFileResult*>& outFiles,
+      Fetch fetch) {
+    applyChunks(
+        executor,
+        startChunks(executor, chunkSize, names, std::move(fetch)),
+        chunkSize,
+        outFiles);
+  }
+
+  static void loadFileInformation(
+      StreamingEdenServiceAsyncClient* client,
+      folly::DrivableExecutor* executor,
+      size_t chunkSize,
+      const w_string& rootPath,
+      const std::vector<std::string>& names,
+      const std::vector<EdenFileResult*>& outFiles,
+      bool onlyEntryInfoNeeded) {
+    w_assert(
+        names.size() == outFiles.size(), "names.size must == outFiles.size");
+    if (names.empty()) {
+      return;
+    }
 
     if (onlyEntryInfoNeeded) {
-      std::vector<EntryInformationOrError> info;
       try {
-        client->sync_getEntryInformation(
-            info, std::string{rootPath.view()}, names, getSyncBehavior());
-        applyResults(info);
+        fetchInChunks(
+            executor,
+            chunkSize,
+            names,
+            outFiles,
+            [&](std::vector<std::string> chunk) {
+              return client->semifuture_getEntryInformation(
+                  std::string{rootPath.view()}, chunk, getSyncBehavior());
+            });
         return;
       } catch (const TApplicationException& ex) {
         if (TApplicationException::UNKNOWN_METHOD != ex.getType()) {
@@ -526,10 +675,15 @@ class EdenFileResult : public FileResult {
       }
     }
 
-    std::vector<FileInformationOrError> info;
-    client->sync_getFileInformation(
-        info, std::string{rootPath.view()}, names, getSyncBehavior());
-    applyResults(info);
+    fetchInChunks(
+        executor,
+        chunkSize,
+        names,
+        outFiles,
+        [&](std::vector<std::string> chunk) {
+          return client->semifuture_getFileInformation(
+              std::string{rootPath.view()}, chunk, getSyncBehavior());
+        });
   }
 
   void applyInformationOrError(const EntryInformationOrError& infoOrErr) {
@@ -556,6 +710,49 @@ class EdenFileResult : public FileResult {
       setExists(false);
     }
   }
+
+  void applyInformationOrError(const SHA1Result& sha1) {
+    sha1_ = sha1;
+  }
+
+  // Applies the attributes requested for this file.  A missing size, or an
+  // error other than ENOENT, leaves fileSize_ unset so that the caller falls
+  // back to getFileInformation for the size.
+  void applyInformationOrError(const FileAttributeDataOrError& dataOrErr) {
+    bool wantsSha1 = requestedAttributes_ & uint64_t(FileAttributes::SHA1_HASH);
+    bool wantsSize = requestedAttributes_ & uint64_t(FileAttributes::FILE_SIZE);
+
+    if (dataOrErr.getType() == FileAttributeDataOrError::Type::data) {
+      auto& data = dataOrErr.get_data();
+      if (wantsSha1) {
+        sha1_.emplace();
+        if (auto sha1 = data.sha1_ref()) {
+          sha1_->set_sha1(*sha1);
+        } else {
+          EdenError err;
+          err.message_ref() = "Eden returned no SHA-1 for the file";
+          err.errorCode_ref() = EIO;
+          sha1_->set_error(std::move(err));
+        }
+      }
+      if (wantsSize) {
+        if (auto size = data.fileSize_ref()) {
+          fileSize_ = size_t(*size);
+          setExists(true);
+        }
+      }
+      return;
+    }
+
+    auto& err = dataOrErr.get_error();
+    if (wantsSha1) {
+      sha1_.emplace();
+      sha1_->set_error(err);
+    }
+    if (wantsSize && err.errorCode_ref() && *err.errorCode_ref() == ENOENT) {
+      setExists(false);
+    }
+  }
 };
 
 static std::string escapeGlobSpecialChars(w_string_piece str) {
@@ -620,6 +817,9 @@ class EdenWrappedSCM : public SCM {
       const override {
     return inner_->mergeBaseWith(commitId, requestId);
   }
+  w_string getWorkingCopyCommit(w_string requestId = nullptr) const override {
+    return inner_->getWorkingCopyCommit(requestId);
+  }
   std::vector<w_string> getFilesChangedSinceMergeBaseWith(
       w_string_piece commitId,
       w_string requestId = nullptr) const override {
@@ -673,49 +873,71 @@ void appendGlobResultToNameAndDTypeVec(
   }
 }
 
-/** Returns the files that match the glob. */
+/** Returns the files that match the glob.
+ * With splitGlobPattern, each pattern is globbed by a separate request, with
+ * at most maxConcurrentGlobs of them in flight at once, and their results are
+ * merged. */
 std::vector<NameAndDType> globNameAndDType(
     StreamingEdenServiceAsyncClient* client,
     const std::string& mountPoint,
     const std::vector<std::string>& globPatterns,
     bool includeDotfiles,
-    bool splitGlobPattern = false) {
+    bool splitGlobPattern = false,
+    size_t maxConcurrentGlobs = 8) {
+  auto makeParams = [&](std::vector<std::string> globs) {
+    GlobParams params;
+    params.mountPoint_ref() = mountPoint;
+    params.globs_ref() = std::move(globs);
+    params.includeDotfiles_ref() = includeDotfiles;
+    params.wantDtype_ref() = true;
+    params.sync_ref() = getSyncBehavior();
+    return params;
+  };
+
   // TODO(xavierd): Once the config: "eden_split_glob_pattern" is rolled out
   // everywhere, remove this code.
   if (splitGlobPattern && globPatterns.size() > 1) {
     folly::DrivableExecutor* executor =
         folly::EventBaseManager::get()->getEventBase();
 
-    std::vector<folly::Future<Glob>> globFutures;
-    globFutures.reserve(globPatterns.size());
-    for (const std::string& globPattern : globPatterns) {
-      GlobParams params;
-      params.mountPoint_ref() = mountPoint;
-      params.globs_ref() = std::vector<std::string>{globPattern};
-      params.includeDotfiles_ref() = includeDotfiles;
-      params.wantDtype_ref() = true;
-      params.sync_ref() = getSyncBehavior();
-
+    size_t nextPattern = 0;
+    std::deque<folly::Future<Glob>> globFutures;
+    auto sendNext = [&] {
       globFutures.emplace_back(
-          client->semifuture_globFiles(params).via(executor));
+          client
+              ->semifuture_globFiles(makeParams(
+                  std::vector<std::string>{globPatterns[nextPattern++]}))
+              .via(executor));
+    };
+    while (nextPattern < globPatterns.size() &&
+           globFutures.size() < std::max<size_t>(1, maxConcurrentGlobs)) {
+      sendNext();
+    }
+
+    std::vector<NameAndDType> globResults;
+    while (!globFutures.empty()) {
+      auto glob = std::move(globFutures.front()).getVia(executor);
+      globFutures.pop_front();
+      if (nextPattern < globPatterns.size()) {
+        sendNext();
+      }
+      appendGlobResultToNameAndDTypeVec(globResults, std::move(glob));
     }
 
+    // A file matched by more than one of the patterns must only be
+    // reported once, as it would be by a single glob
     std::vector<NameAndDType> allResults;
-    for (folly::Future<Glob>& globFuture : globFutures) {
-      appendGlobResultToNameAndDTypeVec(
-          allResults, std::move(globFuture).getVia(executor));
+    allResults.reserve(globResults.size());
+    std::unordered_set<std::string> seen;
+    for (auto& item : globResults) {
+      if (seen.insert(item.name).second) {
+        allResults.push_back(std::move(item));
+      }
     }
     return allResults;
   } else {
-    GlobParams params;
-    params.mountPoint_ref() = mountPoint;
-    params.globs_ref() = globPatterns;
-    params.includeDotfiles_ref() = includeDotfiles;
-    params.wantDtype_ref() = true;
-    params.sync_ref() = getSyncBehavior();
-
     Glob glob;
-    client->sync_globFiles(glob, params);
+    client->sync_globFiles(glob, makeParams(globPatterns));
     std::vector<NameAndDType> result;
     appendGlobResultToNameAndDTypeVec(result, std::move(glob));
     return result;
@@ -760,6 +982,22 @@ class EdenView final : public QueryableView {
   std::string mountPoint_;
   folly::SharedPromise<folly::Unit> subscribeReadyPromise_;
   bool splitGlobPattern_;
+  size_t splitGlobConcurrency_;
+  size_t fetchChunkSize_;
+
+  // The results of recent globs.  Nothing has changed for as long as the
+  // journal stays at the position that they were made at, so they are all
+  // dropped as soon as it moves on.
+  struct GlobCache {
+    int64_t mountGeneration{-1};
+    int64_t sequenceNumber{-1};
+    std::unordered_map<
+        std::string,
+        std::shared_ptr<const std::vector<NameAndDType>>>
+        results;
+  };
+  mutable folly::Synchronized<GlobCache> globCache_;
+  static constexpr size_t kMaxCachedGlobs = 128;
 
  public:
   explicit EdenView(const w_string& root_path, const Configuration& config)
@@ -770,7 +1008,11 @@ class EdenView final : public QueryableView {
             config.getInt("eden_retry_connection_count", 3))),
         scm_(EdenWrappedSCM::wrap(SCM::scmForPath(root_path))),
         mountPoint_(root_path.string()),
-        splitGlobPattern_(config.getBool("eden_split_glob_pattern", false)) {
+        splitGlobPattern_(config.getBool("eden_split_glob_pattern", false)),
+        splitGlobConcurrency_(size_t(std::max<json_int_t>(
+            1, config.getInt("eden_split_glob_concurrency", 8)))),
+        fetchChunkSize_(size_t(std::max<json_int_t>(
+            1, config.getInt("eden_fetch_chunk_size", 512)))) {
     // Get the current journal position so that we can keep track of
     // cookie file changes
     auto client = getEdenClient(thriftChannel_);
@@ -989,6 +1231,7 @@ class EdenView final : public QueryableView {
       auto file = make_unique<EdenFileResult>(
           rootPath_,
           thriftChannel_,
+          fetchChunkSize_,
           w_string::pathCat({mountPoint_, item.name}),
           &resultPosition,
           isNew,
@@ -1018,7 +1261,8 @@ class EdenView final : public QueryableView {
 
   CookieSync::SyncResult syncToNow(
       const std::shared_ptr<Root>&,
-      std::chrono::milliseconds timeout) override {
+      std::chrono::milliseconds timeout,
+      const w_string&) override {
     auto client = getEdenClient(thriftChannel_);
     try {
       client
@@ -1045,12 +1289,7 @@ class EdenView final : public QueryableView {
     auto client = getEdenClient(thriftChannel_);
 
     auto includeDotfiles = (query->glob_flags & WM_PERIOD) == 0;
-    auto fileInfo = globNameAndDType(
-        client.get(),
-        mountPoint_,
-        globStrings,
-        includeDotfiles,
-        splitGlobPattern_);
+    auto fileInfo = cachedGlob(client.get(), globStrings, includeDotfiles);
 
     // Filter out any ignored files
     filterOutPaths(fileInfo, ctx);
@@ -1059,6 +1298,7 @@ class EdenView final : public QueryableView {
       auto file = make_unique<EdenFileResult>(
           rootPath_,
           thriftChannel_,
+          fetchChunkSize_,
           w_string::pathCat({mountPoint_, item.name}),
           /* position=*/nullptr,
           /*isNew=*/false,
@@ -1078,6 +1318,65 @@ class EdenView final : public QueryableView {
     ctx->bumpNumWalked(fileInfo.size());
   }
 
+  // Returns the files that match globStrings, from globCache_ if the same
+  // patterns were globbed at the current journal position.
+  std::vector<NameAndDType> cachedGlob(
+      StreamingEdenServiceAsyncClient* client,
+      const std::vector<std::string>& globStrings,
+      bool includeDotfiles) const {
+    // Read before globbing, so that the results are no older than it
+    JournalPosition position;
+    client->sync_getCurrentJournalPosition(position, mountPoint_);
+    auto mountGeneration = *position.mountGeneration_ref();
+    auto sequenceNumber = *position.sequenceNumber_ref();
+
+    auto patterns = globStrings;
+    std::sort(patterns.begin(), patterns.end());
+    std::string key = includeDotfiles ? "." : "";
+    for (auto& pattern : patterns) {
+      key.push_back('\0');
+      key.append(pattern);
+    }
+
+    {
+      auto cache = globCache_.rlock();
+      if (cache->mountGeneration == mountGeneration &&
+          cache->sequenceNumber == sequenceNumber) {
+        auto it = cache->results.find(key);
+        if (it != cache->results.end()) {
+          return *it->second;
+        }
+      }
+    }
+
+    auto fileInfo = globNameAndDType(
+        client,
+        mountPoint_,
+        globStrings,
+        includeDotfiles,
+        splitGlobPattern_,
+        splitGlobConcurrency_);
+
+    auto cache = globCache_.wlock();
+    if (cache->mountGeneration != mountGeneration ||
+        cache->sequenceNumber != sequenceNumber) {
+      if (cache->mountGeneration == mountGeneration &&
+          cache->sequenceNumber > sequenceNumber) {
+        // A later glob has already moved the cache on
+        return fileInfo;
+      }
+      cache->mountGeneration = mountGeneration;
+      cache->sequenceNumber = sequenceNumber;
+      cache->results.clear();
+    }
+    if (cache->results.size() < kMaxCachedGlobs) {
+      cache->results.emplace(
+          std::move(key),
+          std::make_shared<const std::vector<NameAndDType>>(fileInfo));
+    }
+    return fileInfo;
+  }
+
   // Helper for computing a relative path prefix piece.
   // The returned piece is owned by the supplied context object!
   w_string_piece computeRelativePathPiece(QueryContext* ctx) const {
@@ -1308,6 +1607,7 @@ class EdenView final : public QueryableView {
     };
 
     w_set_thread_name("edensub ", root->root_path.view());
+    ThreadStats::setCurrentThreadRoot(std::string(root->root_path.view()));
     log(DBG, "Started subscription thread\n");
 
     try {
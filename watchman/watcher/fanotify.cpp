@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <folly/String.h>
+#include <folly/Synchronized.h>
+#include <atomic>
+#include "watchman/Constants.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/fs/FSDetect.h"
+#include "watchman/fs/FileDescriptor.h"
+#include "watchman/fs/Pipe.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+#ifdef HAVE_FANOTIFY_INIT
+#include <fcntl.h>
+#include <sys/fanotify.h>
+
+// FAN_REPORT_DFID_NAME was added in Linux 5.9; without it fanotify cannot
+// report directory entry changes in a form that we can map to paths.
+#ifdef FAN_REPORT_DFID_NAME
+
+using namespace watchman;
+
+#define WATCHMAN_FANOTIFY_MASK                                       \
+  (FAN_ATTRIB | FAN_CREATE | FAN_DELETE | FAN_DELETE_SELF |          \
+   FAN_MODIFY | FAN_MOVE_SELF | FAN_MOVED_FROM | FAN_MOVED_TO |      \
+   FAN_ONDIR)
+
+namespace {
+
+// Returns the bytes that identify the handle, for use as a map key.
+std::string handleKey(const struct file_handle* fh) {
+  std::string key(
+      reinterpret_cast<const char*>(&fh->handle_type),
+      sizeof(fh->handle_type));
+  key.append(reinterpret_cast<const char*>(fh->f_handle), fh->handle_bytes);
+  return key;
+}
+
+} // namespace
+
+/**
+ * A watcher that places a single fanotify mark on the filesystem containing
+ * the root, rather than one inotify watch per directory.
+ *
+ * Events identify the directory containing the changed entry by its file
+ * handle.  As the crawler visits each directory, startWatchDir records the
+ * handle for its path; events for directories that we have not visited,
+ * which includes everything outside of the root, are ignored.
+ */
+struct FanotifyWatcher : public Watcher {
+  FileDescriptor fanfd_;
+  Pipe terminatePipe_;
+
+  struct Maps {
+    // map of directory file handle to the name of that dir
+    std::unordered_map<std::string, w_string> handle_to_name;
+  };
+  folly::Synchronized<Maps> maps_;
+
+  std::atomic<uint64_t> totalEventsSeen_{0};
+
+  // Each event carries a directory handle and an entry name
+  char buf_
+      [WATCHMAN_BATCH_LIMIT *
+       (sizeof(struct fanotify_event_metadata) +
+        sizeof(struct fanotify_event_info_fid) + sizeof(struct file_handle) +
+        MAX_HANDLE_SZ + NAME_MAX + 1)];
+
+  FanotifyWatcher(const w_string& rootPath, const Configuration& config);
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      struct watchman_dir* dir,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+
+  // Process a single event.  Returns true if the root directory was removed
+  // and the watch needs to be cancelled.
+  bool processEvent(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      const struct fanotify_event_metadata* meta,
+      std::chrono::system_clock::time_point now);
+
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+};
+
+FanotifyWatcher::FanotifyWatcher(
+    const w_string& rootPath,
+    const Configuration& config)
+    : Watcher("fanotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
+  fanfd_ = FileDescriptor(
+      fanotify_init(
+          FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME,
+          O_RDONLY | O_LARGEFILE),
+      FileDescriptor::FDType::Generic);
+  if (fanfd_.fd() == -1) {
+    // EINVAL indicates a kernel older than 5.9, EPERM a lack of
+    // CAP_SYS_ADMIN.
+    throw std::system_error(errno, std::generic_category(), "fanotify_init");
+  }
+
+  // A filesystem mark reports changes anywhere on the filesystem that
+  // contains the root with a single mark.
+  if (fanotify_mark(
+          fanfd_.fd(),
+          FAN_MARK_ADD | FAN_MARK_FILESYSTEM,
+          WATCHMAN_FANOTIFY_MASK,
+          AT_FDCWD,
+          rootPath.c_str()) == -1) {
+    throw std::system_error(errno, std::generic_category(), "fanotify_mark");
+  }
+
+  auto wlock = maps_.wlock();
+  wlock->handle_to_name.reserve(hintNumDirs(config, rootPath));
+}
+
+std::unique_ptr<DirHandle> FanotifyWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    struct watchman_dir*,
+    const char* path) {
+  // Carry out our very strict opendir first to ensure that we're not
+  // traversing symlinks in the context of this root
+  auto osdir = openDir(path);
+
+  // Record the handle before the caller reads the directory, so that no
+  // change made after the read can go unresolved.
+  alignas(struct file_handle) char
+      fhbuf[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+  auto* fh = reinterpret_cast<struct file_handle*>(fhbuf);
+  fh->handle_bytes = MAX_HANDLE_SZ;
+  int mountId;
+  if (name_to_handle_at(AT_FDCWD, path, fh, &mountId, 0) == -1) {
+    throw std::system_error(
+        errno, std::generic_category(), "name_to_handle_at");
+  }
+
+  {
+    auto wlock = maps_.wlock();
+    wlock->handle_to_name[handleKey(fh)] = w_string(path, W_STRING_BYTE);
+  }
+  logf(DBG, "fanotify: recorded handle for {}\n", path);
+
+  return osdir;
+}
+
+bool FanotifyWatcher::processEvent(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    const struct fanotify_event_metadata* meta,
+    std::chrono::system_clock::time_point now) {
+  if (meta->mask & FAN_Q_OVERFLOW) {
+    /* we missed something, will need to re-crawl */
+    root->scheduleRecrawl("FAN_Q_OVERFLOW");
+    return false;
+  }
+
+  // Find the directory file handle and entry name
+  const struct fanotify_event_info_fid* fid = nullptr;
+  const char* infoEnd = reinterpret_cast<const char*>(meta) + meta->event_len;
+  for (const char* info = reinterpret_cast<const char*>(meta) +
+           meta->metadata_len;
+       info + sizeof(struct fanotify_event_info_header) <= infoEnd;) {
+    auto* hdr = reinterpret_cast<const struct fanotify_event_info_header*>(info);
+    if (hdr->len == 0) {
+      break;
+    }
+    if (hdr->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME ||
+        hdr->info_type == FAN_EVENT_INFO_TYPE_DFID) {
+      fid = reinterpret_cast<const struct fanotify_event_info_fid*>(info);
+      break;
+    }
+    info += hdr->len;
+  }
+  if (!fid) {
+    return false;
+  }
+
+  auto* fh = reinterpret_cast<const struct file_handle*>(fid->handle);
+  w_string dir_name;
+  {
+    auto rlock = maps_.rlock();
+    auto it = rlock->handle_to_name.find(handleKey(fh));
+    if (it == rlock->handle_to_name.end()) {
+      // Not a directory that we have crawled; most likely outside the root.
+      return false;
+    }
+    dir_name = it->second;
+  }
+
+  // For events on the directory itself there is no name, or it is "."
+  w_string name = dir_name;
+  if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+    const char* entry =
+        reinterpret_cast<const char*>(fh->f_handle) + fh->handle_bytes;
+    if (entry[0] && strcmp(entry, ".") != 0) {
+      name = w_string::build(dir_name, "/", entry);
+    }
+  }
+
+  logf(DBG, "fanotify: mask={:x} {}\n", meta->mask, name);
+
+  PendingFlags pending_flags = W_PENDING_VIA_NOTIFY;
+
+  if (meta->mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)) {
+    if (w_string_equal(root->root_path, name)) {
+      logf(
+          ERR,
+          "root dir {} has been (re)moved, canceling watch\n",
+          root->root_path);
+      return true;
+    }
+
+    // We need to examine the parent and potentially crawl down
+    name = name.dirName();
+  }
+
+  if ((meta->mask & (FAN_MOVED_FROM | FAN_ONDIR)) ==
+          (FAN_MOVED_FROM | FAN_ONDIR) &&
+      name != dir_name) {
+    // The handles of the moved tree now refer to different paths.  If it
+    // moved within the root the crawl of its new location records them
+    // again; otherwise they must not resolve to the old paths.
+    auto wlock = maps_.wlock();
+    for (auto it = wlock->handle_to_name.begin();
+         it != wlock->handle_to_name.end();) {
+      if (w_string_equal(it->second, name) ||
+          (w_string_startswith(it->second, name) &&
+           is_path_prefix(it->second, name))) {
+        it = wlock->handle_to_name.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  if (meta->mask & (FAN_CREATE | FAN_DELETE | FAN_MOVED_TO)) {
+    pending_flags.set(W_PENDING_RECURSIVE);
+  }
+
+  coll.add(name, now, pending_flags);
+  return false;
+}
+
+Watcher::ConsumeNotifyRet FanotifyWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  ssize_t n = read(fanfd_.fd(), buf_, sizeof(buf_));
+  if (n == -1) {
+    if (errno == EINTR || errno == EAGAIN) {
+      return {false};
+    }
+    logf(
+        FATAL,
+        "read({}, {}): error {}\n",
+        fanfd_.fd(),
+        sizeof(buf_),
+        folly::errnoStr(errno));
+  }
+
+  logf(DBG, "fanotify read: returned {}.\n", n);
+  auto now = std::chrono::system_clock::now();
+
+  bool cancel = false;
+  size_t eventsSeen = 0;
+  auto* meta = reinterpret_cast<const struct fanotify_event_metadata*>(buf_);
+  while (FAN_EVENT_OK(meta, n)) {
+    if (meta->vers == FANOTIFY_METADATA_VERSION) {
+      cancel |= processEvent(root, coll, meta, now);
+    }
+    ++eventsSeen;
+    meta = FAN_EVENT_NEXT(meta, n);
+  }
+
+  // Relaxed because we don't really care exactly when the value is visible.
+  totalEventsSeen_.fetch_add(eventsSeen, std::memory_order_relaxed);
+
+  return {cancel};
+}
+
+bool FanotifyWatcher::waitNotify(int timeoutms) {
+  struct pollfd pfd[2];
+  pfd[0].fd = fanfd_.fd();
+  pfd[0].events = POLLIN;
+  pfd[1].fd = terminatePipe_.read.fd();
+  pfd[1].events = POLLIN;
+
+  int n = poll(pfd, std::size(pfd), timeoutms);
+
+  if (n > 0) {
+    if (pfd[1].revents) {
+      // We were signalled via signalThreads
+      return false;
+    }
+    return pfd[0].revents != 0;
+  }
+  return false;
+}
+
+void FanotifyWatcher::stopThreads() {
+  ignore_result(write(terminatePipe_.write.fd(), "X", 1));
+}
+
+json_ref FanotifyWatcher::getDebugInfo() {
+  return json_object({
+      {"handle_count", json_integer(maps_.rlock()->handle_to_name.size())},
+      {"total_event_count", json_integer(totalEventsSeen_.load())},
+  });
+}
+
+void FanotifyWatcher::clearDebugInfo() {
+  totalEventsSeen_.store(0, std::memory_order_release);
+}
+
+namespace {
+std::shared_ptr<QueryableView> detectFanotify(
+    const w_string& root_path,
+    const w_string& fstype,
+    const Configuration& config) {
+  if (is_edenfs_fs_type(fstype)) {
+    throw std::runtime_error("cannot watch EdenFS file systems with fanotify");
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem,
+      root_path,
+      config,
+      std::make_shared<FanotifyWatcher>(root_path, config));
+}
+} // namespace
+
+// Lower priority than inotify: fanotify requires CAP_SYS_ADMIN, so it is
+// only used when requested via the "watcher" configuration option, or if
+// inotify is unavailable.
+static WatcherRegistry reg("fanotify", detectFanotify, -1);
+
+#endif // FAN_REPORT_DFID_NAME
+#endif // HAVE_FANOTIFY_INIT
+
+/* vim:ts=2:sw=2:et:
+ */
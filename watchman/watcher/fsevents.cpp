@@ -6,15 +6,20 @@
  */
 
 #include "fsevents.h"
+#include <folly/Conv.h>
+#include <folly/Function.h>
 #include <folly/String.h>
 #include <folly/Synchronized.h>
 #include <condition_variable>
 #include <iterator>
 #include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "watchman/FlagMap.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/LogConfig.h"
+#include "watchman/ThreadStats.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/root/Root.h"
 #include "watchman/watcher/WatcherRegistry.h"
@@ -39,6 +44,19 @@ struct CFDeleter {
 template <typename T>
 using unique_ref = std::unique_ptr<std::remove_pointer_t<T>, CFDeleter>;
 
+// How long getChangesSince waits for the journal to be replayed
+constexpr std::chrono::seconds kHistoryReplayTimeout{30};
+
+w_string uuidString(CFUUIDRef uuid) {
+  unique_ref<CFStringRef> str{CFUUIDCreateString(nullptr, uuid)};
+  char buf[64];
+  if (!str ||
+      !CFStringGetCString(str.get(), buf, sizeof(buf), kCFStringEncodingUTF8)) {
+    return w_string();
+  }
+  return w_string(buf, W_STRING_BYTE);
+}
+
 } // namespace
 
 struct FSEventsStream {
@@ -279,19 +297,30 @@ propagate:
     }
 
     if (root->ignore.isIgnored(path, len)) {
+      stream->watcher->ignoredEventsSeen_.fetch_add(
+          1, std::memory_order_relaxed);
       continue;
     }
 
-    items.emplace_back(w_string(path, len), eventFlags[i]);
+    items.emplace_back(w_string(path, len), eventFlags[i], eventIds[i]);
     if (!stream->lost_sync) {
       stream->last_good = eventIds[i];
     }
   }
 
   if (!items.empty()) {
-    auto wlock = watcher->items_.lock();
-    wlock->items.push_back(std::move(items));
-    watcher->fseCond_.notify_one();
+    {
+      auto wlock = watcher->items_.lock();
+      wlock->items.push_back(std::move(items));
+      watcher->fseCond_.notify_one();
+    }
+    watcher->notifyPending();
+  }
+}
+
+void FSEventsWatcher::notifyPending() {
+  if (onPending_) {
+    onPending_();
   }
 }
 
@@ -411,8 +440,12 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
     return nullptr;
   }
 
-  FSEventStreamScheduleWithRunLoop(
-      fse_stream->stream, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
+  if (watcher->sharedQueue_) {
+    FSEventStreamSetDispatchQueue(fse_stream->stream, watcher->sharedQueue_);
+  } else {
+    FSEventStreamScheduleWithRunLoop(
+        fse_stream->stream, CFRunLoopGetCurrent(), kCFRunLoopDefaultMode);
+  }
 
   if (root->config.getBool("_use_fsevents_exclusions", true)) {
     auto& dirs_vec = root->ignore.getIgnoredDirs();
@@ -464,6 +497,7 @@ std::unique_ptr<FSEventsStream> FSEventsWatcher::fse_stream_make(
         return nullptr;
       }
     }
+    watcher->kernelExclusions_.store(appended, std::memory_order_release);
   }
 
   return fse_stream;
@@ -474,6 +508,7 @@ void FSEventsWatcher::FSEventsThread(const std::shared_ptr<Root>& root) {
   auto fdctx = CFFileDescriptorContext();
 
   w_set_thread_name("fsevents ", root->root_path.view());
+  ThreadStats::setCurrentThreadRoot(std::string(root->root_path.view()));
 
   {
     // Block until fsevents_root_start is waiting for our initialization
@@ -514,6 +549,9 @@ void FSEventsWatcher::FSEventsThread(const std::shared_ptr<Root>& root) {
       logf(ERR, "fse_thread failed: FSEventStreamStart");
       return;
     }
+    if (stream_->uuid) {
+      journalUuid_ = uuidString(stream_->uuid.get());
+    }
 
     // Signal to fsevents_root_start that we're done initializing
     fseCond_.notify_one();
@@ -525,6 +563,12 @@ void FSEventsWatcher::FSEventsThread(const std::shared_ptr<Root>& root) {
   logf(DBG, "fse_thread done\n");
 }
 
+namespace {
+std::chrono::microseconds secondsToMicros(double seconds) {
+  return std::chrono::microseconds{int64_t(std::max(seconds, 0.0) * 1000000)};
+}
+} // namespace
+
 FSEventsWatcher::FSEventsWatcher(
     bool hasFileWatching,
     const Configuration& config,
@@ -535,7 +579,13 @@ FSEventsWatcher::FSEventsWatcher(
       attemptResyncOnDrop_{config.getBool("fsevents_try_resync", false)},
       hasFileWatching_{hasFileWatching},
       enableStreamFlush_{config.getBool("fsevents_enable_stream_flush", true)},
-      subdir{std::move(dir)} {
+      historyReplay_{config.getBool("fsevents_history_replay", false)},
+      subdir{std::move(dir)},
+      baseLatency_{secondsToMicros(config.getDouble("fsevents_latency", 0.01))},
+      maxLatency_{secondsToMicros(config.getDouble("fsevents_max_latency", 0))},
+      stormEventsPerSecond_{double(std::max<json_int_t>(
+          1,
+          config.getInt("fsevents_storm_events_per_second", 10000)))} {
   // TODO: Add ring buffer logging for events in the shared kqueue+fsevents
   // logger.
 }
@@ -551,14 +601,59 @@ FSEventsWatcher::FSEventsWatcher(
   json_int_t fsevents_ring_log_size =
       config.getInt("fsevents_ring_log_size", 0);
   if (fsevents_ring_log_size) {
-    ringBuffer_ =
-        std::make_unique<RingBuffer<FSEventsLogEntry>>(fsevents_ring_log_size);
+    ringBuffer_ = std::make_unique<ThreadLocalRingBuffer<FSEventsLogEntry>>(
+        fsevents_ring_log_size);
   }
 }
 
 FSEventsWatcher::~FSEventsWatcher() = default;
 
+void FSEventsWatcher::useSharedQueue(
+    dispatch_queue_t queue,
+    std::function<void()> onPending) {
+  sharedQueue_ = queue;
+  onPending_ = std::move(onPending);
+}
+
+namespace {
+// Runs func on queue and waits for it.  Callbacks for the streams on a
+// serial queue run one at a time, so this also serializes func with them.
+void runOnQueue(dispatch_queue_t queue, folly::FunctionRef<void()> func) {
+  dispatch_sync_f(queue, &func, [](void* context) {
+    (*static_cast<folly::FunctionRef<void()>*>(context))();
+  });
+}
+} // namespace
+
 bool FSEventsWatcher::start(const std::shared_ptr<Root>& root) {
+  rootPath_ = root->root_path;
+  if (sharedQueue_) {
+    // The queue delivers our callbacks, so there is no thread to start.
+    // Create the stream on the queue so that the assignment to stream_ is
+    // ordered before any callback that might look at it.
+    bool started = false;
+    runOnQueue(sharedQueue_, [&] {
+      stream_ = fse_stream_make(
+          root, this, kFSEventStreamEventIdSinceNow, root->failure_reason);
+      if (!stream_) {
+        return;
+      }
+      if (!FSEventStreamStart(stream_->stream)) {
+        root->failure_reason = w_string(
+            "FSEventStreamStart failed", W_STRING_UNICODE);
+        return;
+      }
+      if (stream_->uuid) {
+        journalUuid_ = uuidString(stream_->uuid.get());
+      }
+      started = true;
+    });
+    if (!started) {
+      logf(ERR, "failed to start fsevents stream: {}\n", root->failure_reason);
+    }
+    return started;
+  }
+
   // Spin up the fsevents processing thread; it owns a ref on the root
 
   auto self = std::dynamic_pointer_cast<FSEventsWatcher>(shared_from_this());
@@ -602,6 +697,183 @@ bool FSEventsWatcher::start(const std::shared_ptr<Root>& root) {
   }
 }
 
+w_string FSEventsWatcher::getChangeHistoryPosition() {
+  if (!historyReplay_ || !journalUuid_) {
+    return w_string();
+  }
+  // Everything in the batch before the latest has been consumed by the
+  // time the view settles, which is when the position is stored
+  auto id = delivered_.rlock()->previous;
+  return id == 0 ? w_string()
+                 : w_string::format("fsevents:{}:{}", journalUuid_, id);
+}
+
+namespace {
+// Collects the names below rootPath that a replay of the journal reports
+struct HistoryReplay {
+  w_string rootPath;
+  std::mutex mutex;
+  std::condition_variable cond;
+  std::vector<w_string> names;
+  std::unordered_set<w_string> seen;
+  bool done{false};
+  bool failed{false};
+};
+
+void historyReplayCallback(
+    ConstFSEventStreamRef,
+    void* clientCallBackInfo,
+    size_t numEvents,
+    void* eventPaths,
+    const FSEventStreamEventFlags eventFlags[],
+    const FSEventStreamEventId[]) {
+  auto paths = reinterpret_cast<char**>(eventPaths);
+  auto replay = reinterpret_cast<HistoryReplay*>(clientCallBackInfo);
+  auto& root = replay->rootPath;
+
+  std::lock_guard<std::mutex> lock(replay->mutex);
+  for (size_t i = 0; i < numEvents && !replay->done; i++) {
+    auto flags = eventFlags[i];
+    if (flags & kFSEventStreamEventFlagHistoryDone) {
+      replay->done = true;
+      break;
+    }
+    // A replay that doesn't say exactly what changed is no use to us
+    if (flags &
+        (kFSEventStreamEventFlagMustScanSubDirs |
+         kFSEventStreamEventFlagUserDropped |
+         kFSEventStreamEventFlagKernelDropped |
+         kFSEventStreamEventFlagEventIdsWrapped |
+         kFSEventStreamEventFlagRootChanged)) {
+      char label[128];
+      w_expand_flags(kflags, flags, label, sizeof(label));
+      logf(ERR, "can't replay the fsevents journal for {}: {}\n", root, label);
+      replay->failed = true;
+      replay->done = true;
+      break;
+    }
+
+    size_t len = strlen(paths[i]);
+    while (len > 0 && paths[i][len - 1] == '/') {
+      len--;
+    }
+    if (len <= root.size() + 1 || paths[i][root.size()] != '/' ||
+        memcmp(paths[i], root.data(), root.size()) != 0) {
+      // The root itself, or outside of it
+      continue;
+    }
+    w_string name(
+        paths[i] + root.size() + 1, len - root.size() - 1, W_STRING_BYTE);
+    if (replay->seen.insert(name).second) {
+      replay->names.push_back(std::move(name));
+    }
+  }
+  if (replay->done) {
+    replay->cond.notify_one();
+  }
+}
+} // namespace
+
+std::optional<std::vector<w_string>> FSEventsWatcher::getChangesSince(
+    w_string_piece position) {
+  if (!historyReplay_ || !journalUuid_) {
+    return std::nullopt;
+  }
+  folly::StringPiece kind, uuid, id;
+  if (!folly::split(':', position.view(), kind, uuid, id) ||
+      kind != "fsevents") {
+    return std::nullopt;
+  }
+  auto since = folly::tryTo<FSEventStreamEventId>(id);
+  if (!since) {
+    return std::nullopt;
+  }
+  if (uuid != folly::StringPiece(journalUuid_.data(), journalUuid_.size())) {
+    logf(
+        ERR,
+        "the fsevents journal for {} was replaced since event {}\n",
+        rootPath_,
+        *since);
+    return std::nullopt;
+  }
+
+  // Our own stream is already running, so between them the replay and the
+  // stream miss nothing
+  HistoryReplay replay;
+  replay.rootPath = rootPath_;
+  auto ctx = FSEventStreamContext();
+  ctx.info = &replay;
+
+  unique_ref<CFStringRef> cpath{CFStringCreateWithBytes(
+      nullptr,
+      (const UInt8*)rootPath_.data(),
+      rootPath_.size(),
+      kCFStringEncodingUTF8,
+      false)};
+  if (!cpath) {
+    return std::nullopt;
+  }
+  const void* values[] = {cpath.get()};
+  unique_ref<CFArrayRef> parray{
+      CFArrayCreate(nullptr, values, 1, &kCFTypeArrayCallBacks)};
+  if (!parray) {
+    return std::nullopt;
+  }
+
+  FSEventStreamCreateFlags flags = kFSEventStreamCreateFlagNoDefer;
+  if (hasFileWatching_) {
+    flags |= kFSEventStreamCreateFlagFileEvents;
+  }
+  auto stream = FSEventStreamCreate(
+      nullptr,
+      historyReplayCallback,
+      &ctx,
+      parray.get(),
+      *since,
+      std::chrono::duration<double>(baseLatency_).count(),
+      flags);
+  if (!stream) {
+    return std::nullopt;
+  }
+  auto queue =
+      dispatch_queue_create("watchman.fsevents.replay", DISPATCH_QUEUE_SERIAL);
+  FSEventStreamSetDispatchQueue(stream, queue);
+
+  bool started = FSEventStreamStart(stream);
+  bool completed = false;
+  if (started) {
+    std::unique_lock<std::mutex> lock(replay.mutex);
+    completed = replay.cond.wait_for(
+        lock, kHistoryReplayTimeout, [&] { return replay.done; });
+  }
+
+  FSEventStreamStop(stream);
+  // No callback is running or will run once this returns
+  runOnQueue(queue, [] {});
+  FSEventStreamInvalidate(stream);
+  FSEventStreamRelease(stream);
+  dispatch_release(queue);
+
+  if (!started) {
+    logf(ERR, "FSEventStreamStart failed replaying {}\n", rootPath_);
+    return std::nullopt;
+  }
+  if (!completed) {
+    logf(ERR, "timed out replaying the fsevents journal for {}\n", rootPath_);
+    return std::nullopt;
+  }
+  if (replay.failed) {
+    return std::nullopt;
+  }
+  logf(
+      ERR,
+      "replayed {} changes to {} from fsevents event {}\n",
+      replay.names.size(),
+      rootPath_,
+      *since);
+  return std::move(replay.names);
+}
+
 folly::SemiFuture<folly::Unit> FSEventsWatcher::flushPendingEvents() {
   if (!enableStreamFlush_) {
     return folly::SemiFuture<folly::Unit>::makeEmpty();
@@ -645,9 +917,12 @@ folly::SemiFuture<folly::Unit> FSEventsWatcher::flushPendingEvents() {
 
   // Now return a Future that is fulfilled when all of the items have been
   // processed by InMemoryView.
-  auto wlock = items_.lock();
-  wlock->syncs.push_back(std::move(p));
-  fseCond_.notify_one();
+  {
+    auto wlock = items_.lock();
+    wlock->syncs.push_back(std::move(p));
+    fseCond_.notify_one();
+  }
+  notifyPending();
   return std::move(f);
 }
 
@@ -655,12 +930,54 @@ bool FSEventsWatcher::waitNotify(int timeoutms) {
   auto wlock = items_.lock();
   // First check to see if someone added elements to these lists while the lock
   // wasn't held.
-  if (!wlock->items.empty() || !wlock->syncs.empty()) {
-    // Yes, let's not wait on the condition.
-    return true;
+  if (wlock->items.empty() && wlock->syncs.empty()) {
+    fseCond_.wait_for(wlock.as_lock(), std::chrono::milliseconds(timeoutms));
+    if (wlock->items.empty() && wlock->syncs.empty()) {
+      return false;
+    }
   }
-  fseCond_.wait_for(wlock.as_lock(), std::chrono::milliseconds(timeoutms));
-  return !wlock->items.empty() || !wlock->syncs.empty();
+
+  // Only linger at the start of a batch; the notify thread polls with a zero
+  // timeout while it is draining us.  A sync means that a query is waiting,
+  // so hand everything over right away.
+  if (timeoutms > 0 && wlock->syncs.empty()) {
+    auto delay = updateCoalesceDelay();
+    if (delay.count() > 0) {
+      fseCond_.wait_for(
+          wlock.as_lock(), delay, [&] { return !wlock->syncs.empty(); });
+    }
+  }
+  return true;
+}
+
+std::chrono::microseconds FSEventsWatcher::updateCoalesceDelay() {
+  if (maxLatency_ <= baseLatency_) {
+    return std::chrono::microseconds{0};
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  auto elapsed = now - rateWindowStart_;
+  if (elapsed < std::chrono::seconds{1}) {
+    return coalesceDelay_;
+  }
+
+  auto rate = rateWindowEvents_ /
+      std::chrono::duration_cast<std::chrono::duration<double>>(elapsed)
+          .count();
+  if (rate >= stormEventsPerSecond_) {
+    coalesceDelay_ =
+        std::min(std::max(coalesceDelay_ * 2, baseLatency_), maxLatency_);
+  } else {
+    coalesceDelay_ = std::chrono::microseconds{0};
+  }
+  rateWindowStart_ = now;
+  rateWindowEvents_ = 0;
+  logf(
+      DBG,
+      "fsevents: {} events per second, coalescing for {}us\n",
+      rate,
+      coalesceDelay_.count());
+  return coalesceDelay_;
 }
 
 namespace {
@@ -690,9 +1007,19 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
   }
 
   auto now = std::chrono::system_clock::now();
+  FSEventStreamEventId lastId = 0;
+  bool wrapped = false;
+  // The flags that each path has been added with, so that the bursts of
+  // events for a path, such as those of a large write, are added once.
+  std::unordered_map<w_string, PendingFlags> added;
 
   for (auto& vec : items) {
+    rateWindowEvents_ += vec.size();
     for (auto& item : vec) {
+      lastId = std::max(lastId, item.id);
+      if (item.flags & kFSEventStreamEventFlagEventIdsWrapped) {
+        wrapped = true;
+      }
       w_expand_flags(kflags, item.flags, flags_label, sizeof(flags_label));
       logf(
           DBG,
@@ -769,6 +1096,13 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
         flags.set(W_PENDING_IS_DESYNCED);
       }
 
+      auto [it, inserted] = added.emplace(item.path, flags);
+      if (!inserted) {
+        if (it->second == flags) {
+          continue;
+        }
+        it->second = flags;
+      }
       coll.add(item.path, now, flags);
     }
   }
@@ -777,10 +1111,30 @@ Watcher::ConsumeNotifyRet FSEventsWatcher::consumeNotify(
     coll.addSync(std::move(sync));
   }
 
+  if (wrapped) {
+    // The IDs from before the wrap can't be compared with those after it
+    *delivered_.wlock() = Delivered{};
+  } else if (lastId) {
+    auto d = delivered_.wlock();
+    d->previous = d->latest;
+    d->latest = std::max(d->latest, lastId);
+  }
+
   return {cancelSelf};
 }
 
 void FSEventsWatcher::stopThreads() {
+  if (sharedQueue_) {
+    // Once this returns no callback is running or will run for the stream,
+    // so the owner may drop us.  The stream itself is released along with
+    // stream_.
+    runOnQueue(sharedQueue_, [&] {
+      if (stream_) {
+        FSEventStreamStop(stream_->stream);
+      }
+    });
+    return;
+  }
   write(fsePipe_.write.fd(), "X", 1);
 }
 
@@ -802,6 +1156,8 @@ json_ref FSEventsWatcher::getDebugInfo() {
   return json_object({
       {"events", events},
       {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"ignored_event_count", json_integer(ignoredEventsSeen_.load())},
+      {"kernel_exclusion_count", json_integer(kernelExclusions_.load())},
   });
 }
 
@@ -810,6 +1166,7 @@ void FSEventsWatcher::clearDebugInfo() {
   // totalEventsSeen_ could be stored directly if ringBuffer_ is null, or as the
   // difference between currentHead() - lastClear_ if not null.
   totalEventsSeen_.store(0, std::memory_order_release);
+  ignoredEventsSeen_.store(0, std::memory_order_release);
   if (ringBuffer_) {
     ringBuffer_->clear();
   }
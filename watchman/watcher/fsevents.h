@@ -7,8 +7,10 @@
 
 #pragma once
 
+#include <chrono>
+#include <functional>
 #include <optional>
-#include "watchman/RingBuffer.h"
+#include "watchman/ThreadLocalRingBuffer.h"
 #include "watchman/fs/Pipe.h"
 #include "watchman/watcher/Watcher.h"
 
@@ -25,9 +27,13 @@ struct FSEventsLogEntry;
 struct watchman_fsevent {
   w_string path;
   FSEventStreamEventFlags flags;
+  FSEventStreamEventId id;
 
-  watchman_fsevent(w_string&& path, FSEventStreamEventFlags flags)
-      : path(std::move(path)), flags(flags) {}
+  watchman_fsevent(
+      w_string&& path,
+      FSEventStreamEventFlags flags,
+      FSEventStreamEventId id)
+      : path(std::move(path)), flags(flags), id(id) {}
 };
 
 class FSEventsWatcher : public Watcher {
@@ -43,6 +49,17 @@ class FSEventsWatcher : public Watcher {
       std::optional<w_string> dir = std::nullopt);
   ~FSEventsWatcher();
 
+  /**
+   * Lets the kqueue+fsevents watcher serve all of its FSEventsWatchers
+   * without giving each one a thread: start() schedules the stream on the
+   * shared serial queue instead of running a CFRunLoop thread of its own,
+   * and onPending is called whenever events or syncs are queued, so that
+   * nobody needs to block in waitNotify.  Must be called before start().
+   */
+  void useSharedQueue(
+      dispatch_queue_t queue,
+      std::function<void()> onPending);
+
   bool start(const std::shared_ptr<Root>& root) override;
 
   folly::SemiFuture<folly::Unit> flushPendingEvents() override;
@@ -58,6 +75,16 @@ class FSEventsWatcher : public Watcher {
 
   bool waitNotify(int timeoutms) override;
   void stopThreads() override;
+
+  /**
+   * With fsevents_history_replay, the position is the UUID of the
+   * fseventsd journal of the device along with the ID of the last event
+   * handed out, and getChangesSince replays the journal from there on a
+   * stream of its own, until the kFSEventStreamEventFlagHistoryDone event.
+   */
+  w_string getChangeHistoryPosition() override;
+  std::optional<std::vector<w_string>> getChangesSince(
+      w_string_piece position) override;
   void FSEventsThread(const std::shared_ptr<Root>& root);
 
   json_ref getDebugInfo() override;
@@ -73,6 +100,9 @@ class FSEventsWatcher : public Watcher {
       FSEventsWatcher* watcher,
       FSEventStreamEventId since,
       w_string& failure_reason);
+  // Calls onPending_, if set; items_ must not be locked
+  void notifyPending();
+
   static void fse_callback(
       ConstFSEventStreamRef,
       void* clientCallBackInfo,
@@ -95,18 +125,59 @@ class FSEventsWatcher : public Watcher {
   folly::Synchronized<Items, std::mutex> items_;
 
   std::unique_ptr<FSEventsStream> stream_;
+  // Set by useSharedQueue; not owned
+  dispatch_queue_t sharedQueue_{nullptr};
+  std::function<void()> onPending_;
   const bool attemptResyncOnDrop_{false};
   const bool hasFileWatching_{false};
   const bool enableStreamFlush_{true};
+  const bool historyReplay_{false};
   std::optional<w_string> subdir{std::nullopt};
+  // Set by start()
+  w_string rootPath_;
+  w_string journalUuid_;
+
+  struct Delivered {
+    // The IDs of the last events handed out by consumeNotify, as of the
+    // latest batch and the one before it, or 0 if not known
+    FSEventStreamEventId previous{0};
+    FSEventStreamEventId latest{0};
+  };
+  folly::Synchronized<Delivered> delivered_;
+
+  /**
+   * During a storm of changes, waitNotify holds on to the events for a
+   * while before handing them over, so that repeated changes to the same
+   * paths are coalesced in the PendingCollection and the IO thread settles
+   * on fewer, larger batches.  The delay starts at the stream latency and
+   * doubles, up to maxLatency_, for as long as events keep arriving at
+   * stormEventsPerSecond_ or faster; it drops back to zero once they slow
+   * down.  A zero maxLatency_ disables this.
+   */
+  const std::chrono::microseconds baseLatency_;
+  const std::chrono::microseconds maxLatency_;
+  const double stormEventsPerSecond_;
+  // Only accessed by the notify thread, in waitNotify and consumeNotify
+  std::chrono::microseconds coalesceDelay_{0};
+  std::chrono::steady_clock::time_point rateWindowStart_;
+  size_t rateWindowEvents_{0};
+
+  // Updates and returns coalesceDelay_ from the recent event rate
+  std::chrono::microseconds updateCoalesceDelay();
 
   // Incremented in fse_callback
   std::atomic<size_t> totalEventsSeen_{0};
+  // Events that fse_callback dropped because they are ignored.  Those under
+  // the ignored dirs that were passed to FSEvents as exclusions never get
+  // this far.
+  std::atomic<size_t> ignoredEventsSeen_{0};
+  // How many ignored dirs the current stream excludes in the kernel
+  std::atomic<size_t> kernelExclusions_{0};
   /**
    * If not null, holds a fixed-size ring of the last `fsevents_ring_log_size`
    * FSEvents events.
    */
-  std::unique_ptr<RingBuffer<FSEventsLogEntry>> ringBuffer_;
+  std::unique_ptr<ThreadLocalRingBuffer<FSEventsLogEntry>> ringBuffer_;
 };
 
 } // namespace watchman
@@ -7,13 +7,21 @@
 
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <sys/ioctl.h>
+#include <array>
 #include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <fstream>
+#include <limits>
+#include <thread>
+#include <unordered_set>
 #include "watchman/Constants.h"
 #include "watchman/Errors.h"
 #include "watchman/FlagMap.h"
 #include "watchman/InMemoryView.h"
 #include "watchman/Poison.h"
-#include "watchman/RingBuffer.h"
+#include "watchman/ThreadLocalRingBuffer.h"
 #include "watchman/fs/FSDetect.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/Pipe.h"
@@ -70,6 +78,138 @@ struct pending_move {
       : created(created), name(name) {}
 };
 
+/**
+ * The dir watched by each watch descriptor, held in a flat table indexed
+ * by the descriptor rather than in a hash table, as the kernel hands them
+ * out in increasing order: those of a crawl are all next to each other.
+ *
+ * The kernel doesn't reuse a descriptor until it has gone through all of
+ * them, so as dirs come and go the table moves on to ever higher ones.
+ * It is held in pages, and a page is freed once none of its descriptors
+ * are in use, so that the ones that went away cost nothing.
+ */
+class WatchTable {
+ public:
+  // Returns the dir watched by wd, or nullptr if there is none
+  const w_string* find(int wd) const {
+    auto page = pageOf(wd);
+    if (page >= pages_.size() || !pages_[page]) {
+      return nullptr;
+    }
+    auto& name = pages_[page]->names[slotOf(wd)];
+    return name ? &name : nullptr;
+  }
+
+  void insert(int wd, w_string name) {
+    auto page = pageOf(wd);
+    if (page >= pages_.size()) {
+      pages_.resize(page + 1);
+    }
+    if (!pages_[page]) {
+      pages_[page] = std::make_unique<Page>();
+    }
+    auto& slot = pages_[page]->names[slotOf(wd)];
+    if (!slot) {
+      pages_[page]->count++;
+      count_++;
+    }
+    slot = std::move(name);
+  }
+
+  void erase(int wd) {
+    auto page = pageOf(wd);
+    if (page >= pages_.size() || !pages_[page]) {
+      return;
+    }
+    auto& slot = pages_[page]->names[slotOf(wd)];
+    if (!slot) {
+      return;
+    }
+    slot = w_string();
+    count_--;
+    if (--pages_[page]->count == 0) {
+      pages_[page].reset();
+      while (!pages_.empty() && !pages_.back()) {
+        pages_.pop_back();
+      }
+    }
+  }
+
+  // Points the descriptors of from, and of the dirs below it, at the same
+  // dirs below to, as the kernel keeps the watches of a renamed dir
+  void renameDir(const w_string& from, const w_string& to) {
+    for (auto& page : pages_) {
+      if (!page) {
+        continue;
+      }
+      for (auto& name : page->names) {
+        if (!name || !name.piece().startsWith(from.piece())) {
+          continue;
+        }
+        w_string_piece rest(name);
+        rest.advance(from.size());
+        if (rest.size() == 0 || is_slash(rest[0])) {
+          name = w_string::build(to, rest);
+        }
+      }
+    }
+  }
+
+  void reserve(size_t count) {
+    pages_.reserve(count / kPageSize + 1);
+  }
+
+  size_t size() const {
+    return count_;
+  }
+
+  template <typename Func>
+  void forEach(Func&& func) const {
+    for (auto& page : pages_) {
+      if (!page) {
+        continue;
+      }
+      for (auto& name : page->names) {
+        if (name) {
+          func(name);
+        }
+      }
+    }
+  }
+
+  // The bytes held by the table itself, as opposed to the names
+  size_t tableBytes() const {
+    size_t bytes = pages_.capacity() * sizeof(pages_[0]);
+    for (auto& page : pages_) {
+      if (page) {
+        bytes += sizeof(Page);
+      }
+    }
+    return bytes;
+  }
+
+ private:
+  static constexpr size_t kPageSize = 256;
+
+  struct Page {
+    std::array<w_string, kPageSize> names;
+    // How many of names are in use
+    size_t count{0};
+  };
+
+  // Descriptors are never negative, so treat those as out of range
+  static size_t pageOf(int wd) {
+    return wd < 0 ? std::numeric_limits<size_t>::max()
+                  : size_t(wd) / kPageSize;
+  }
+  static size_t slotOf(int wd) {
+    return size_t(wd) % kPageSize;
+  }
+
+  std::vector<std::unique_ptr<Page>> pages_;
+  size_t count_{0};
+};
+
 /**
  * Memory-efficient records for debugging inotify events after the fact.
  */
@@ -119,6 +259,33 @@ struct InotifyLogEntry {
 };
 static_assert(64 == sizeof(InotifyLogEntry));
 
+// Changes that only ask for an entry to be examined again, so that the
+// repeats of one within a batch, such as the IN_MODIFY stream of a large
+// write, add nothing to the first.
+constexpr uint32_t kRepeatableMask =
+    IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_ISDIR;
+// Changes that leave the names of the watched dirs as they were.
+constexpr uint32_t kKeepsNamesMask = kRepeatableMask | IN_CREATE | IN_DELETE;
+
+/**
+ * The entries whose repeatable changes have been added while processing a
+ * batch of events.  The names point into the batch.
+ */
+struct BatchEntry {
+  int wd{-1};
+  w_string_piece name;
+
+  bool operator==(const BatchEntry& other) const {
+    return wd == other.wd && name == other.name;
+  }
+};
+struct BatchEntryHash {
+  size_t operator()(const BatchEntry& key) const {
+    return std::hash<int>()(key.wd) * 31 + key.name.hashValue();
+  }
+};
+using BatchEntries = std::unordered_set<BatchEntry, BatchEntryHash>;
+
 } // namespace
 
 struct InotifyWatcher : public Watcher {
@@ -130,7 +297,7 @@ struct InotifyWatcher : public Watcher {
    * If not null, holds a fixed-size ring of the last `inotify_ring_log_size`
    * inotify events.
    */
-  std::unique_ptr<RingBuffer<InotifyLogEntry>> ringBuffer_;
+  std::unique_ptr<ThreadLocalRingBuffer<InotifyLogEntry>> ringBuffer_;
 
   /**
    * Published from consumeNotify so getDebugInfo can read a recent value.
@@ -138,8 +305,8 @@ struct InotifyWatcher : public Watcher {
   std::atomic<uint64_t> totalEventsSeen_ = 0;
 
   struct maps {
-    /* map of active watch descriptor to name of the corresponding dir */
-    std::unordered_map<int, w_string> wd_to_name;
+    /* active watch descriptor to name of the corresponding dir */
+    WatchTable wd_to_name;
     /* map of inotify cookie to corresponding name */
     std::unordered_map<uint32_t, pending_move> move_map;
   };
@@ -151,7 +318,59 @@ struct InotifyWatcher : public Watcher {
   char ibuf
       [WATCHMAN_BATCH_LIMIT * (sizeof(struct inotify_event) + (NAME_MAX + 1))];
 
-  explicit InotifyWatcher(const Configuration& config);
+  // When readEvents last took everything that the kernel had queued; only
+  // touched by whichever thread reads infd.  0 if it never has.
+  time_t lastDrained_{0};
+  // lastDrained_ as it was when readEvents found an overflow, which is the
+  // latest time before which no events were lost.  Cleared when the
+  // overflow is processed.
+  std::atomic<time_t> overflowLastGood_{0};
+
+  /**
+   * When inotify_reader_thread is enabled, a dedicated thread drains infd as
+   * quickly as it can into this buffer, so that a slow consumer does not
+   * cause the kernel queue to overflow.  The notify thread swaps the buffer
+   * out in consumeNotify.
+   */
+  struct ReaderState {
+    // Whole inotify_event records, in the order they were read.
+    std::string events;
+    size_t numEvents{0};
+    // flushToNow requests that are satisfied once these events are consumed
+    std::vector<folly::Promise<folly::Unit>> flushes;
+  };
+  const bool useReaderThread_;
+  folly::Synchronized<ReaderState, std::mutex> readerState_;
+  // Signalled when events are added, and when they are consumed.
+  std::condition_variable readerCond_;
+  std::atomic<bool> stopReader_{false};
+
+  // The reader stops draining the kernel queue beyond this many buffered
+  // events and lets the kernel queue absorb the rest.
+  const size_t maxBufferedEvents_;
+  // Once this many events are buffered, the changes are coalesced to their
+  // containing directories to help the consumer catch up.
+  const size_t coalesceBacklog_;
+
+  std::atomic<uint64_t> maxQueuedEvents_{0};
+  std::atomic<uint64_t> coalescedEvents_{0};
+  std::atomic<uint64_t> repeatedEvents_{0};
+
+  /**
+   * inotify events are queued by the kernel as part of the system call that
+   * makes the change, so everything that happened before a flushToNow call
+   * is in the queue by the time the reading thread takes the request.  The
+   * request can then be satisfied by reading exactly as far as the queue
+   * went at that point, without a cookie file.
+   */
+  folly::Synchronized<std::vector<folly::Promise<folly::Unit>>, std::mutex>
+      flushRequests_;
+  // Written to wake up whichever thread reads infd to service flushRequests_
+  Pipe flushPipe_;
+
+  InotifyWatcher(const w_string& rootPath, const Configuration& config);
+
+  bool start(const std::shared_ptr<Root>& root) override;
 
   std::unique_ptr<DirHandle> startWatchDir(
       const std::shared_ptr<Root>& root,
@@ -164,23 +383,75 @@ struct InotifyWatcher : public Watcher {
 
   bool waitNotify(int timeoutms) override;
 
+  folly::SemiFuture<folly::Unit> flushToNow() override;
+
+  // Takes the pending flushToNow requests, if any
+  std::vector<folly::Promise<folly::Unit>> takeFlushRequests();
+
+  // The number of bytes of events queued in the kernel
+  int queuedBytes();
+
+  // Reads a batch of events into ibuf and returns the number of bytes read,
+  // or -1 if the read should be retried
+  int readEvents();
+
   // Process a single inotify event and add it to the pending collection if
   // needed. Returns true if the root directory was removed and the watch needs
   // to be cancelled.
+  // If coalesce is true, changes to non-directory entries are reported as a
+  // scan of their containing directory instead.
+  // Repeats of the repeatable changes in added are skipped.
   bool process_inotify_event(
       const std::shared_ptr<Root>& root,
       PendingChanges& coll,
       struct inotify_event* ine,
-      std::chrono::system_clock::time_point now);
+      std::chrono::system_clock::time_point now,
+      bool coalesce,
+      BatchEntries& added);
+
+  // Process the inotify_event records in buf.  Returns true if the watch
+  // needs to be cancelled.
+  bool processEvents(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll,
+      const char* buf,
+      size_t len,
+      bool coalesce);
+
+  void readerThread();
 
   void stopThreads() override;
 
   json_ref getDebugInfo() override;
   void clearDebugInfo() override;
+  json_ref getMemoryUsage() const override;
 };
 
-InotifyWatcher::InotifyWatcher(const Configuration& config)
-    : Watcher("inotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
+namespace {
+// The kernel's limit on the number of events queued for an inotify instance.
+size_t kernelMaxQueuedEvents() {
+  size_t limit = 0;
+  std::ifstream in("/proc/sys/fs/inotify/max_queued_events");
+  if (in >> limit && limit > 0) {
+    return limit;
+  }
+  return WATCHMAN_BATCH_LIMIT;
+}
+} // namespace
+
+InotifyWatcher::InotifyWatcher(
+    const w_string& rootPath,
+    const Configuration& config)
+    : Watcher("inotify", WATCHER_HAS_PER_FILE_NOTIFICATIONS),
+      useReaderThread_(config.getBool("inotify_reader_thread", false)),
+      maxBufferedEvents_(size_t(std::max<json_int_t>(
+          1,
+          config.getInt("inotify_reader_max_buffered_events", 1024 * 1024)))),
+      coalesceBacklog_(size_t(std::max<json_int_t>(
+          0,
+          config.getInt(
+              "inotify_coalesce_backlog",
+              json_int_t(kernelMaxQueuedEvents() / 2))))) {
 #ifdef HAVE_INOTIFY_INIT1
   infd = FileDescriptor(
       inotify_init1(IN_CLOEXEC), FileDescriptor::FDType::Generic);
@@ -194,14 +465,171 @@ InotifyWatcher::InotifyWatcher(const Configuration& config)
 
   {
     auto wlock = maps.wlock();
-    wlock->wd_to_name.reserve(config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
+    wlock->wd_to_name.reserve(hintNumDirs(config, rootPath));
   }
 
   json_int_t inotify_ring_log_size = config.getInt("inotify_ring_log_size", 0);
   if (inotify_ring_log_size) {
-    ringBuffer_ =
-        std::make_unique<RingBuffer<InotifyLogEntry>>(inotify_ring_log_size);
+    ringBuffer_ = std::make_unique<ThreadLocalRingBuffer<InotifyLogEntry>>(
+        inotify_ring_log_size);
+  }
+}
+
+bool InotifyWatcher::start(const std::shared_ptr<Root>&) {
+  if (!useReaderThread_) {
+    return true;
+  }
+
+  try {
+    auto self = std::dynamic_pointer_cast<InotifyWatcher>(shared_from_this());
+    std::thread thread([self]() noexcept {
+      w_set_thread_name("inotify-reader");
+      try {
+        self->readerThread();
+      } catch (const std::exception& e) {
+        logf(ERR, "inotify reader thread failed: {}\n", e.what());
+      }
+    });
+    // The thread holds a reference to the watcher and cannot join itself
+    // if it turns out to be the last one.
+    thread.detach();
+    return true;
+  } catch (const std::exception& e) {
+    logf(ERR, "failed to start inotify reader thread: {}\n", e.what());
+    return false;
+  }
+}
+
+void InotifyWatcher::readerThread() {
+  while (!stopReader_.load(std::memory_order_acquire)) {
+    {
+      // Apply backpressure rather than buffering without bound
+      auto state = readerState_.lock();
+      while (state->numEvents >= maxBufferedEvents_ &&
+             !stopReader_.load(std::memory_order_acquire)) {
+        readerCond_.wait(state.as_lock());
+      }
+    }
+
+    struct pollfd pfd[3];
+    pfd[0].fd = infd.fd();
+    pfd[0].events = POLLIN;
+    pfd[1].fd = terminatePipe_.read.fd();
+    pfd[1].events = POLLIN;
+    pfd[2].fd = flushPipe_.read.fd();
+    pfd[2].events = POLLIN;
+    if (poll(pfd, std::size(pfd), -1) <= 0 || pfd[1].revents) {
+      continue;
+    }
+
+    auto flushes = takeFlushRequests();
+    int remaining = flushes.empty() ? 0 : queuedBytes();
+    bool readable = pfd[0].revents != 0 || remaining > 0;
+    while (readable) {
+      int n = readEvents();
+      if (n == -1) {
+        continue;
+      }
+
+      // The kernel only returns whole events from a read
+      size_t numEvents = 0;
+      for (char* iptr = ibuf; iptr < ibuf + n;
+           iptr += sizeof(struct inotify_event) +
+               reinterpret_cast<struct inotify_event*>(iptr)->len) {
+        ++numEvents;
+      }
+
+      auto state = readerState_.lock();
+      state->events.append(ibuf, n);
+      state->numEvents += numEvents;
+      if (state->numEvents > maxQueuedEvents_.load(std::memory_order_relaxed)) {
+        maxQueuedEvents_.store(state->numEvents, std::memory_order_relaxed);
+      }
+      readerCond_.notify_all();
+
+      remaining -= n;
+      readable = remaining > 0;
+    }
+
+    if (!flushes.empty()) {
+      auto state = readerState_.lock();
+      std::move(
+          flushes.begin(), flushes.end(), std::back_inserter(state->flushes));
+      readerCond_.notify_all();
+    }
+  }
+}
+
+folly::SemiFuture<folly::Unit> InotifyWatcher::flushToNow() {
+  auto [p, f] = folly::makePromiseContract<folly::Unit>();
+  flushRequests_.lock()->push_back(std::move(p));
+  // If the pipe is full then the reading thread is already due to wake up
+  ignore_result(write(flushPipe_.write.fd(), "F", 1));
+  return std::move(f);
+}
+
+std::vector<folly::Promise<folly::Unit>> InotifyWatcher::takeFlushRequests() {
+  // Drain the wakeups before taking the requests, so that a request made
+  // in between leaves a wakeup behind rather than going unnoticed
+  char buf[64];
+  while (read(flushPipe_.read.fd(), buf, sizeof(buf)) > 0) {
+  }
+  std::vector<folly::Promise<folly::Unit>> flushes;
+  std::swap(flushes, *flushRequests_.lock());
+  return flushes;
+}
+
+int InotifyWatcher::queuedBytes() {
+  int queued = 0;
+  if (ioctl(infd.fd(), FIONREAD, &queued) == -1) {
+    logf(
+        FATAL,
+        "ioctl({}, FIONREAD): error {}\n",
+        infd.fd(),
+        folly::errnoStr(errno));
   }
+  return queued;
+}
+
+int InotifyWatcher::readEvents() {
+  auto start = time(nullptr);
+  int n = read(infd.fd(), &ibuf, sizeof(ibuf));
+  if (n == -1) {
+    if (errno == EINTR || errno == EAGAIN) {
+      return -1;
+    }
+    logf(
+        FATAL,
+        "read({}, {}): error {}\n",
+        infd.fd(),
+        sizeof(ibuf),
+        folly::errnoStr(errno));
+  }
+
+  bool overflowed = false;
+  for (char* iptr = ibuf; iptr < ibuf + n;
+       iptr += sizeof(struct inotify_event) +
+           reinterpret_cast<struct inotify_event*>(iptr)->len) {
+    auto ine = reinterpret_cast<struct inotify_event*>(iptr);
+    if (ine->wd == -1 && (ine->mask & IN_Q_OVERFLOW)) {
+      overflowed = true;
+    }
+  }
+
+  if (overflowed) {
+    // The queue filled up at some point after we last emptied it.  Should
+    // an earlier overflow be awaiting processing, its time is the earlier.
+    time_t expected = 0;
+    overflowLastGood_.compare_exchange_strong(
+        expected, lastDrained_, std::memory_order_acq_rel);
+  } else if (
+      sizeof(ibuf) - size_t(n) >=
+      sizeof(struct inotify_event) + NAME_MAX + 1) {
+    // The kernel stops filling the buffer only once it runs out of events
+    // or of room for the next one, so there was nothing left behind
+    lastDrained_ = start;
+  }
+  return n;
 }
 
 std::unique_ptr<DirHandle> InotifyWatcher::startWatchDir(
@@ -225,7 +653,7 @@ std::unique_ptr<DirHandle> InotifyWatcher::startWatchDir(
   // record mapping
   {
     auto wlock = maps.wlock();
-    wlock->wd_to_name[newwd] = dir_name;
+    wlock->wd_to_name.insert(newwd, std::move(dir_name));
   }
   logf(DBG, "adding {} -> {} mapping\n", newwd, path);
 
@@ -236,7 +664,9 @@ bool InotifyWatcher::process_inotify_event(
     const std::shared_ptr<Root>& root,
     PendingChanges& coll,
     struct inotify_event* ine,
-    std::chrono::system_clock::time_point now) {
+    std::chrono::system_clock::time_point now,
+    bool coalesce,
+    BatchEntries& added) {
   char flags_label[128];
   w_expand_flags(inflags, ine->mask, flags_label, sizeof(flags_label));
 
@@ -252,9 +682,26 @@ bool InotifyWatcher::process_inotify_event(
     ringBuffer_->write(InotifyLogEntry{ine});
   }
 
+  if (ine->len > 0 && (ine->mask & ~kRepeatableMask) == 0) {
+    if (!added.insert(BatchEntry{ine->wd, w_string_piece{ine->name}}).second) {
+      repeatedEvents_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  } else if ((ine->mask & ~kKeepsNamesMask) != 0 && !added.empty()) {
+    // A wd may name another dir from here on, so its later changes can't
+    // be taken for repeats of the earlier ones
+    added.clear();
+  }
+
   if (ine->wd == -1 && (ine->mask & IN_Q_OVERFLOW)) {
     /* we missed something, will need to re-crawl */
-    root->scheduleRecrawl("IN_Q_OVERFLOW");
+    auto lastGood = overflowLastGood_.exchange(0, std::memory_order_acq_rel);
+    if (lastGood == 0) {
+      root->scheduleRecrawl("IN_Q_OVERFLOW");
+    } else {
+      root->scheduleResync(
+          "IN_Q_OVERFLOW", std::chrono::system_clock::from_time_t(lastGood));
+    }
   } else if (ine->wd != -1) {
     w_string name;
     char buf[WATCHMAN_NAME_MAX];
@@ -263,9 +710,8 @@ bool InotifyWatcher::process_inotify_event(
 
     {
       auto rlock = maps.rlock();
-      auto it = rlock->wd_to_name.find(ine->wd);
-      if (it != rlock->wd_to_name.end()) {
-        dir_name = it->second;
+      if (auto found = rlock->wd_to_name.find(ine->wd)) {
+        dir_name = *found;
       }
     }
 
@@ -298,8 +744,9 @@ bool InotifyWatcher::process_inotify_event(
       log(DBG, "recording move_from ", ine->cookie, " ", name, "\n");
     }
 
+    w_string movedFrom;
     if (ine->len > 0 &&
-        (ine->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_FROM | IN_ISDIR)) {
+        (ine->mask & (IN_MOVED_TO | IN_ISDIR)) == (IN_MOVED_TO | IN_ISDIR)) {
       auto wlock = maps.wlock();
       auto it = wlock->move_map.find(ine->cookie);
       if (it != wlock->move_map.end()) {
@@ -325,9 +772,13 @@ bool InotifyWatcher::process_inotify_event(
           }
         } else {
           logf(DBG, "moved {} -> {}\n", old.name.c_str(), name.c_str());
-          // TODO: assert that there is no entry in wd_to_name
-          wlock->wd_to_name[wd] = name;
+          // The watches moved along with the dirs, and the IO thread can
+          // move what it knows about them too, rather than crawl them again
+          wlock->wd_to_name.renameDir(old.name, name);
+          wlock->wd_to_name.insert(wd, name);
+          movedFrom = old.name;
         }
+        wlock->move_map.erase(it);
       } else {
         logf(
             DBG,
@@ -358,12 +809,28 @@ bool InotifyWatcher::process_inotify_event(
         pending_flags.set(W_PENDING_RECURSIVE);
       }
 
+      // Directories are left alone so that new ones are still crawled, as
+      // are cookies, which must be seen via a notification.
+      if (coalesce && ine->len > 0 &&
+          !(ine->mask &
+            (IN_ISDIR | IN_UNMOUNT | IN_IGNORED | IN_DELETE_SELF |
+             IN_MOVE_SELF)) &&
+          !root->cookies.isCookiePrefix(name)) {
+        name = dir_name;
+        pending_flags = W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN;
+        coalescedEvents_.fetch_add(1, std::memory_order_relaxed);
+      }
+
       logf(
           DBG,
           "add_pending for inotify mask={:x} {}\n",
           ine->mask,
           name.c_str());
-      coll.add(name, now, pending_flags);
+      if (movedFrom) {
+        coll.addMove(movedFrom, name, now, pending_flags);
+      } else {
+        coll.add(name, now, pending_flags);
+      }
 
       // The kernel removed the wd -> name mapping, so let's update
       // our state here also
@@ -397,29 +864,79 @@ bool InotifyWatcher::process_inotify_event(
 Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
     const std::shared_ptr<Root>& root,
     PendingChanges& coll) {
-  int n = read(infd.fd(), &ibuf, sizeof(ibuf));
-  if (n == -1) {
-    if (errno == EINTR) {
+  if (useReaderThread_) {
+    ReaderState batch;
+    {
+      auto state = readerState_.lock();
+      std::swap(batch, *state);
+      readerCond_.notify_all();
+    }
+    logf(DBG, "inotify reader: consuming {} events.\n", batch.numEvents);
+    bool coalesce = coalesceBacklog_ > 0 && batch.numEvents >= coalesceBacklog_;
+    if (coalesce) {
+      logf(
+          ERR,
+          "inotify backlog of {} events, coalescing changes to directories\n",
+          batch.numEvents);
+    }
+    bool cancel = processEvents(
+        root, coll, batch.events.data(), batch.events.size(), coalesce);
+    // The flushes were queued after the events they need to see
+    for (auto& flush : batch.flushes) {
+      coll.addSync(std::move(flush));
+    }
+    return {cancel};
+  }
+
+  auto flushes = takeFlushRequests();
+  if (flushes.empty()) {
+    if (queuedBytes() == 0) {
+      // Woken by a flush request that has already been serviced
       return {false};
     }
-    logf(
-        FATAL,
-        "read({}, {}): error {}\n",
-        infd.fd(),
-        sizeof(ibuf),
-        folly::errnoStr(errno));
+    int n = readEvents();
+    if (n == -1) {
+      return {false};
+    }
+    logf(DBG, "inotify read: returned {}.\n", n);
+    return {processEvents(root, coll, ibuf, n, false)};
   }
 
-  logf(DBG, "inotify read: returned {}.\n", n);
+  // Read as far as the queue went when the flushes were taken
+  bool cancel = false;
+  int remaining = queuedBytes();
+  while (remaining > 0) {
+    int n = readEvents();
+    if (n == -1) {
+      continue;
+    }
+    logf(DBG, "inotify read: returned {}.\n", n);
+    cancel |= processEvents(root, coll, ibuf, n, false);
+    remaining -= n;
+  }
+  for (auto& flush : flushes) {
+    coll.addSync(std::move(flush));
+  }
+  return {cancel};
+}
+
+bool InotifyWatcher::processEvents(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll,
+    const char* buf,
+    size_t len,
+    bool coalesce) {
   auto now = std::chrono::system_clock::now();
 
   struct inotify_event* ine;
   bool cancel = false;
   size_t eventsSeen = 0;
-  for (char* iptr = ibuf; iptr < ibuf + n; iptr += sizeof(*ine) + ine->len) {
+  BatchEntries added;
+  for (const char* iptr = buf; iptr < buf + len;
+       iptr += sizeof(*ine) + ine->len) {
     ine = (struct inotify_event*)iptr;
 
-    cancel |= process_inotify_event(root, coll, ine, now);
+    cancel |= process_inotify_event(root, coll, ine, now, coalesce, added);
     ++eventsSeen;
   }
 
@@ -452,15 +969,28 @@ Watcher::ConsumeNotifyRet InotifyWatcher::consumeNotify(
     }
   }
 
-  return {cancel};
+  return cancel;
 }
 
 bool InotifyWatcher::waitNotify(int timeoutms) {
-  struct pollfd pfd[2];
+  if (useReaderThread_) {
+    auto state = readerState_.lock();
+    if (state->numEvents == 0 && state->flushes.empty() &&
+        !stopReader_.load(std::memory_order_acquire)) {
+      readerCond_.wait_for(
+          state.as_lock(), std::chrono::milliseconds(timeoutms));
+    }
+    return (state->numEvents > 0 || !state->flushes.empty()) &&
+        !stopReader_.load(std::memory_order_acquire);
+  }
+
+  struct pollfd pfd[3];
   pfd[0].fd = infd.fd();
   pfd[0].events = POLLIN;
   pfd[1].fd = terminatePipe_.read.fd();
   pfd[1].events = POLLIN;
+  pfd[2].fd = flushPipe_.read.fd();
+  pfd[2].events = POLLIN;
 
   int n = poll(pfd, std::size(pfd), timeoutms);
 
@@ -469,13 +999,16 @@ bool InotifyWatcher::waitNotify(int timeoutms) {
       // We were signalled via signalThreads
       return false;
     }
-    return pfd[0].revents != 0;
+    return pfd[0].revents != 0 || pfd[2].revents != 0;
   }
   return false;
 }
 
 void InotifyWatcher::stopThreads() {
+  stopReader_.store(true, std::memory_order_release);
   ignore_result(write(terminatePipe_.write.fd(), "X", 1));
+  auto state = readerState_.lock();
+  readerCond_.notify_all();
 }
 
 json_ref InotifyWatcher::getDebugInfo() {
@@ -486,9 +1019,38 @@ json_ref InotifyWatcher::getDebugInfo() {
       json_array_append(events, entry.asJsonValue());
     }
   }
-  return json_object({
+  auto info = json_object({
       {"events", events},
       {"total_event_count", json_integer(totalEventsSeen_.load())},
+      {"repeated_event_count", json_integer(repeatedEvents_.load())},
+      {"watch_count", json_integer(maps.rlock()->wd_to_name.size())},
+  });
+
+  int kernelQueuedBytes = 0;
+  if (ioctl(infd.fd(), FIONREAD, &kernelQueuedBytes) == 0) {
+    info.set("kernel_queued_bytes", json_integer(kernelQueuedBytes));
+  }
+  if (useReaderThread_) {
+    info.set(
+        {{"queued_event_count",
+          json_integer(readerState_.lock()->numEvents)},
+         {"max_queued_event_count", json_integer(maxQueuedEvents_.load())},
+         {"coalesced_event_count", json_integer(coalescedEvents_.load())}});
+  }
+  return info;
+}
+
+json_ref InotifyWatcher::getMemoryUsage() const {
+  auto locked = maps.rlock();
+  size_t nameBytes = 0;
+  locked->wd_to_name.forEach([&](const w_string& name) {
+    nameBytes += sizeof(w_string_t) + name.size() + 1;
+  });
+  return json_object({
+      {"watch_count", json_integer(locked->wd_to_name.size())},
+      {"name_bytes", json_integer(nameBytes)},
+      {"table_bytes", json_integer(locked->wd_to_name.tableBytes())},
+      {"pending_moves", json_integer(locked->move_map.size())},
   });
 }
 
@@ -497,6 +1059,9 @@ void InotifyWatcher::clearDebugInfo() {
   // totalEventsSeen_ could be stored directly if ringBuffer_ is null, or as the
   // difference between currentHead() - lastClear_ if not null.
   totalEventsSeen_.store(0, std::memory_order_release);
+  maxQueuedEvents_.store(0, std::memory_order_release);
+  coalescedEvents_.store(0, std::memory_order_release);
+  repeatedEvents_.store(0, std::memory_order_release);
   if (ringBuffer_) {
     ringBuffer_->clear();
   }
@@ -516,7 +1081,7 @@ std::shared_ptr<QueryableView> detectInotify(
       realFileSystem,
       root_path,
       config,
-      std::make_shared<InotifyWatcher>(config));
+      std::make_shared<InotifyWatcher>(root_path, config));
 }
 } // namespace
 
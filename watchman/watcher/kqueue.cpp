@@ -32,6 +32,10 @@ enum KQueueUdata {
   IS_DIR = 1,
 };
 
+// How many file watches to give up when the process runs out of
+// descriptors
+constexpr size_t kEvictOnExhaustion = 64;
+
 bool is_udata_dir(void* udata) {
   return reinterpret_cast<uintptr_t>(udata) == IS_DIR;
 }
@@ -58,12 +62,14 @@ static const struct flag_map kflags[] = {
 };
 
 KQueueWatcher::KQueueWatcher(
-    const w_string& /*root_path*/,
+    const w_string& root_path,
     const Configuration& config,
     bool recursive)
     : Watcher("kqueue", 0),
-      maps_(maps(config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS))),
-      recursive_(recursive) {
+      maps_(maps(json_int_t(hintNumDirs(config, root_path)))),
+      recursive_(recursive),
+      maxFileWatches_(size_t(std::max<json_int_t>(
+          0, config.getInt("kqueue_max_file_watches", 0)))) {
   kq_fd = FileDescriptor(kqueue(), "kqueue", FileDescriptor::FDType::Generic);
   kq_fd.setCloExec();
 }
@@ -73,9 +79,10 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
 
   auto full_name = file->parent->getFullPathToChild(file->getName());
   {
-    auto rlock = maps_.rlock();
-    if (rlock->name_to_fd.find(full_name) != rlock->name_to_fd.end()) {
-      // Already watching it
+    auto wlock = maps_.wlock();
+    if (wlock->name_to_fd.find(full_name) != wlock->name_to_fd.end()) {
+      // Already watching it; a change to it keeps it from being evicted
+      touchFileWatch(*wlock, full_name);
       return true;
     }
   }
@@ -86,8 +93,7 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
 #if HAVE_DECL_O_SYMLINK
   openFlags |= O_SYMLINK;
 #endif
-  FileDescriptor fdHolder(
-      open(full_name.c_str(), openFlags), FileDescriptor::FDType::Generic);
+  auto fdHolder = openForWatch(full_name.c_str(), openFlags);
 
   auto rawFd = fdHolder.fd();
 
@@ -134,6 +140,13 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
     auto wlock = maps_.wlock();
     wlock->name_to_fd[full_name] = std::move(fdHolder);
     wlock->fd_to_name[rawFd] = full_name;
+    if (!isDir) {
+      wlock->file_lru.push_back(full_name);
+      wlock->file_lru_pos[full_name] = std::prev(wlock->file_lru.end());
+      if (maxFileWatches_ > 0 && wlock->file_lru.size() > maxFileWatches_) {
+        evictFileWatches(*wlock, wlock->file_lru.size() - maxFileWatches_);
+      }
+    }
   }
 
   if (kevent(kq_fd.fd(), &k, 1, nullptr, 0, 0)) {
@@ -145,9 +158,7 @@ bool KQueueWatcher::startWatchFile(struct watchman_file* file) {
         full_name.c_str(),
         folly::errnoStr(errno),
         "\n");
-    auto wlock = maps_.wlock();
-    wlock->name_to_fd.erase(full_name);
-    wlock->fd_to_name.erase(rawFd);
+    forgetWatch(*maps_.wlock(), full_name, rawFd);
   } else {
     watchman::log(
         watchman::DBG, "kevent file ", full_name, " -> ", rawFd, "\n");
@@ -165,9 +176,7 @@ std::unique_ptr<DirHandle> KQueueWatcher::startWatchDir(
 
   auto osdir = openDir(path);
 
-  FileDescriptor fdHolder(
-      open(path, O_NOFOLLOW | O_EVTONLY | O_CLOEXEC),
-      FileDescriptor::FDType::Generic);
+  auto fdHolder = openForWatch(path, O_NOFOLLOW | O_EVTONLY | O_CLOEXEC);
   auto rawFd = fdHolder.fd();
   if (rawFd == -1) {
     // directory got deleted between opendir and open
@@ -214,9 +223,7 @@ std::unique_ptr<DirHandle> KQueueWatcher::startWatchDir(
   if (kevent(kq_fd.fd(), &k, 1, nullptr, 0, 0)) {
     logf(DBG, "kevent EV_ADD dir {} failed: {}", path, folly::errnoStr(errno));
 
-    auto wlock = maps_.wlock();
-    wlock->name_to_fd.erase(dir_name);
-    wlock->fd_to_name.erase(rawFd);
+    forgetWatch(*maps_.wlock(), dir_name, rawFd);
   } else {
     watchman::log(watchman::DBG, "kevent dir ", dir_name, " -> ", rawFd, "\n");
   }
@@ -287,8 +294,7 @@ Watcher::ConsumeNotifyRet KQueueWatcher::consumeNotify(
       memset(&k, 0, sizeof(k));
       EV_SET(&k, fd, EVFILT_VNODE, EV_DELETE, 0, 0, nullptr);
       kevent(kq_fd.fd(), &k, 1, nullptr, 0, 0);
-      wlock->name_to_fd.erase(path);
-      wlock->fd_to_name.erase(fd);
+      forgetWatch(*wlock, path, fd);
     }
 
     // TODO: W_PENDING_VIA_NOTIFY should always be set
@@ -326,6 +332,77 @@ void KQueueWatcher::stopThreads() {
   ignore_result(write(terminatePipe_.write.fd(), "X", 1));
 }
 
+void KQueueWatcher::touchFileWatch(maps& m, const w_string& name) {
+  auto it = m.file_lru_pos.find(name);
+  if (it != m.file_lru_pos.end()) {
+    m.file_lru.splice(m.file_lru.end(), m.file_lru, it->second);
+  }
+}
+
+void KQueueWatcher::forgetWatch(maps& m, const w_string& name, int fd) {
+  m.name_to_fd.erase(name);
+  m.fd_to_name.erase(fd);
+  auto it = m.file_lru_pos.find(name);
+  if (it != m.file_lru_pos.end()) {
+    m.file_lru.erase(it->second);
+    m.file_lru_pos.erase(it);
+  }
+}
+
+size_t KQueueWatcher::evictFileWatches(maps& m, size_t count) {
+  size_t evicted = 0;
+  while (evicted < count && !m.file_lru.empty()) {
+    auto name = m.file_lru.front();
+    auto it = m.name_to_fd.find(name);
+    // Closing the descriptor also removes its events from the kqueue
+    forgetWatch(m, name, it == m.name_to_fd.end() ? -1 : it->second.fd());
+    ++evicted;
+  }
+  if (evicted > 0) {
+    evictedFileWatches_ += evicted;
+    logf(DBG, "evicted {} kqueue file watches\n", evicted);
+  }
+  return evicted;
+}
+
+FileDescriptor KQueueWatcher::openForWatch(const char* path, int flags) {
+  FileDescriptor fd(open(path, flags), FileDescriptor::FDType::Generic);
+  if (fd.fd() == -1 && (errno == EMFILE || errno == ENFILE)) {
+    // Files whose watches are evicted are still covered, less precisely,
+    // by the watches of their dirs, so they are worth less than this one
+    int err = errno;
+    if (evictFileWatches(*maps_.wlock(), kEvictOnExhaustion) > 0) {
+      fd = FileDescriptor(open(path, flags), FileDescriptor::FDType::Generic);
+    } else {
+      errno = err;
+    }
+  }
+  return fd;
+}
+
+json_ref KQueueWatcher::getDebugInfo() {
+  auto locked = maps_.rlock();
+  return json_object({
+      {"watch_count", json_integer(locked->fd_to_name.size())},
+      {"file_watch_count", json_integer(locked->file_lru.size())},
+      {"max_file_watches", json_integer(maxFileWatches_)},
+      {"evicted_file_watches", json_integer(evictedFileWatches_.load())},
+  });
+}
+
+json_ref KQueueWatcher::getMemoryUsage() const {
+  auto locked = maps_.rlock();
+  // Both maps refer to the same names
+  size_t nameBytes = 0;
+  for (auto& it : locked->name_to_fd) {
+    nameBytes += sizeof(w_string_t) + it.first.size() + 1;
+  }
+  return json_object({
+      {"watch_count", json_integer(locked->fd_to_name.size())},
+      {"name_bytes", json_integer(nameBytes)},
+  });
+}
+
 static RegisterWatcher<KQueueWatcher> reg(
     "kqueue",
     -1 /* last resort on macOS */);
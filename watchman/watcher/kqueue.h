@@ -5,6 +5,9 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <atomic>
+#include <list>
+#include <unordered_map>
 #include "watchman/Constants.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/fs/Pipe.h"
@@ -24,6 +27,9 @@ struct KQueueWatcher : public Watcher {
     std::unordered_map<w_string, FileDescriptor> name_to_fd;
     /* map of active watch descriptor to name of the corresponding item */
     std::unordered_map<int, w_string> fd_to_name;
+    /* the watched files, as opposed to dirs, least recently used first */
+    std::list<w_string> file_lru;
+    std::unordered_map<w_string, std::list<w_string>::iterator> file_lru_pos;
 
     explicit maps(json_int_t sizeHint) {
       name_to_fd.reserve(sizeHint);
@@ -32,6 +38,10 @@ struct KQueueWatcher : public Watcher {
   };
   folly::Synchronized<maps> maps_;
   bool recursive_;
+  // The most files to watch at once, from `kqueue_max_file_watches`; 0 if
+  // there is no limit short of running out of descriptors.
+  size_t maxFileWatches_;
+  std::atomic<uint64_t> evictedFileWatches_{0};
 
   struct kevent keventbuf[WATCHMAN_BATCH_LIMIT];
 
@@ -53,6 +63,21 @@ struct KQueueWatcher : public Watcher {
 
   bool waitNotify(int timeoutms) override;
   void stopThreads() override;
+  json_ref getDebugInfo() override;
+  json_ref getMemoryUsage() const override;
+
+ private:
+  // Marks the watch of the file named name as the most recently used
+  static void touchFileWatch(maps& m, const w_string& name);
+  // Stops tracking the watch of name, whether or not it is a file watch
+  static void forgetWatch(maps& m, const w_string& name, int fd);
+  // Stops watching up to count of the least recently used files, leaving
+  // their changes to be noticed by the watches of their dirs.  Returns the
+  // number of watches removed.
+  size_t evictFileWatches(maps& m, size_t count);
+  // Opens path for a watch, making room by evicting file watches if the
+  // process is out of descriptors.
+  FileDescriptor openForWatch(const char* path, int flags);
 };
 
 } // namespace watchman
@@ -80,12 +80,19 @@ class PendingEventsCond {
  *
  * The kqueue watches are used on the root directory and all the files at the
  * root, while the fsevents one is used on the subdirectories.
+ *
+ * Roots can have hundreds of top-level directories, so the FSEventsWatchers
+ * don't get a thread each: their streams all deliver to one serial dispatch
+ * queue, and their callbacks signal pendingCondition_ directly.  Only the
+ * kqueue watcher, which has to block on its descriptor, has a thread that
+ * waits on it.
  */
 class KQueueAndFSEventsWatcher : public Watcher {
  public:
   explicit KQueueAndFSEventsWatcher(
       const w_string& root_path,
       const Configuration& config);
+  ~KQueueAndFSEventsWatcher();
 
   bool start(const std::shared_ptr<Root>& root) override;
 
@@ -112,6 +119,8 @@ class KQueueAndFSEventsWatcher : public Watcher {
   void injectRecrawl(w_string path);
 
  private:
+  // Serves all of the streams in fseventWatchers_
+  dispatch_queue_t fseventsQueue_;
   folly::Synchronized<
       std::unordered_map<w_string, std::shared_ptr<FSEventsWatcher>>>
       fseventWatchers_;
@@ -126,9 +135,18 @@ KQueueAndFSEventsWatcher::KQueueAndFSEventsWatcher(
     const w_string& root_path,
     const Configuration& config)
     : Watcher("kqueue+fsevents", WATCHER_HAS_SPLIT_WATCH),
+      fseventsQueue_(
+          dispatch_queue_create("watchman.fsevents", DISPATCH_QUEUE_SERIAL)),
       kqueueWatcher_(std::make_shared<KQueueWatcher>(root_path, config, false)),
       pendingCondition_(std::make_shared<PendingEventsCond>()) {}
 
+KQueueAndFSEventsWatcher::~KQueueAndFSEventsWatcher() {
+  // Invalidate the streams before the queue that they are scheduled on
+  // goes away
+  fseventWatchers_.wlock()->clear();
+  dispatch_release(fseventsQueue_);
+}
+
 namespace {
 bool startThread(
     const std::shared_ptr<Root>& root,
@@ -205,12 +223,12 @@ std::unique_ptr<DirHandle> KQueueAndFSEventsWatcher::startWatchDir(
           std::make_shared<FSEventsWatcher>(
               false, root->config, std::optional(fullPath)));
       const auto& watcher = it->second;
+      watcher->useSharedQueue(fseventsQueue_, [cond = pendingCondition_] {
+        cond->notifyOneOrStop();
+      });
       if (!watcher->start(root)) {
         throw std::runtime_error("couldn't start fsEvent");
       }
-      if (!startThread(root, watcher, pendingCondition_)) {
-        throw std::runtime_error("couldn't start fsEvent");
-      }
     }
   }
 
@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include "watchman/InMemoryView.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+using namespace watchman;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+bool sameTime(const struct timespec& a, const struct timespec& b) {
+  return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+/**
+ * A watcher for filesystems that have no change notifications that we can
+ * use, such as NFS and some FUSE mounts, that stats each of the dirs that
+ * the crawler visits from time to time.
+ *
+ * A dir whose mtime is unchanged since the last look is not read again,
+ * so only the dirs that changed are crawled, and only they have their
+ * entries statted.  A dir is looked at again after an interval that
+ * doubles each time that it is found unchanged, and shrinks back when it
+ * changes, so that settled parts of the tree cost little.  The dirs that
+ * hold the sync cookies stay at the shortest one.  No more than
+ * poll_max_dirs_per_second dirs are statted in a second.
+ *
+ * Changes to the contents of a file that leave its dir alone, as opposed
+ * to the files that are created, replaced, renamed or deleted, are seen
+ * when something else changes in the dir, or when the dir is recrawled.
+ */
+class PollWatcher : public Watcher {
+ public:
+  PollWatcher(const w_string& rootPath, const Configuration& config);
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      struct watchman_dir* dir,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+ private:
+  struct DirState {
+    struct timespec mtime {};
+    struct timespec ctime {};
+    ino_t ino{0};
+    std::chrono::milliseconds interval;
+    std::multimap<Clock::time_point, w_string>::iterator scheduled;
+  };
+
+  // Must be called with mutex_ held
+  void schedule(const w_string& path, DirState& state, Clock::time_point now);
+  // How many dirs may be statted now, as of now.  Must be called with
+  // mutex_ held.
+  size_t availableBudget(Clock::time_point now);
+
+  const w_string rootPath_;
+  const std::chrono::milliseconds minInterval_;
+  const std::chrono::milliseconds maxInterval_;
+  const double maxDirsPerSecond_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stopped_{false};
+  std::unordered_map<w_string, DirState> dirs_;
+  // When each dir is next due to be looked at
+  std::multimap<Clock::time_point, w_string> schedule_;
+  // The dirs that may be statted without exceeding the budget, which
+  // accrues at maxDirsPerSecond_ up to a second's worth
+  double budget_;
+  Clock::time_point budgetUpdated_;
+
+  uint64_t totalChecks_{0};
+  uint64_t totalChanges_{0};
+};
+
+PollWatcher::PollWatcher(const w_string& rootPath, const Configuration& config)
+    : Watcher("poll", 0),
+      rootPath_(rootPath),
+      minInterval_(std::max(
+          json_int_t(1),
+          config.getInt("poll_min_interval_ms", 1000))),
+      maxInterval_(std::max(
+          json_int_t(minInterval_.count()),
+          config.getInt("poll_max_interval_ms", 60000))),
+      maxDirsPerSecond_(double(std::max(
+          json_int_t(1),
+          config.getInt("poll_max_dirs_per_second", 1000)))),
+      budget_(maxDirsPerSecond_),
+      budgetUpdated_(Clock::now()) {
+  dirs_.reserve(hintNumDirs(config, rootPath));
+}
+
+std::unique_ptr<DirHandle> PollWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    struct watchman_dir*,
+    const char* path) {
+  // Stat before the caller reads the dir, so that a change made after the
+  // read shows up as a new mtime when we next look
+  auto info = getFileInformation(path);
+  auto osdir = openDir(path);
+
+  auto name = w_string(path, W_STRING_BYTE);
+  auto now = Clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto [it, inserted] = dirs_.try_emplace(name);
+  auto& state = it->second;
+  state.mtime = info.mtime;
+  state.ctime = info.ctime;
+  state.ino = info.ino;
+  if (inserted) {
+    state.interval = minInterval_;
+    state.scheduled = schedule_.end();
+  }
+  schedule(name, state, now);
+  cond_.notify_one();
+
+  return osdir;
+}
+
+void PollWatcher::schedule(
+    const w_string& path,
+    DirState& state,
+    Clock::time_point now) {
+  if (state.scheduled != schedule_.end()) {
+    schedule_.erase(state.scheduled);
+  }
+  state.scheduled = schedule_.emplace(now + state.interval, path);
+}
+
+size_t PollWatcher::availableBudget(Clock::time_point now) {
+  std::chrono::duration<double> elapsed = now - budgetUpdated_;
+  budget_ = std::min(
+      maxDirsPerSecond_, budget_ + elapsed.count() * maxDirsPerSecond_);
+  budgetUpdated_ = now;
+  return size_t(budget_);
+}
+
+bool PollWatcher::waitNotify(int timeoutms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto deadline = Clock::now() + std::chrono::milliseconds(timeoutms);
+  while (!stopped_) {
+    auto now = Clock::now();
+    if (!schedule_.empty() && schedule_.begin()->first <= now) {
+      if (availableBudget(now) > 0) {
+        return true;
+      }
+      // Wait for the budget to allow another stat
+      auto refill = std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1.0 / maxDirsPerSecond_));
+      if (now + refill > deadline) {
+        return false;
+      }
+      cond_.wait_for(lock, refill);
+      continue;
+    }
+    if (now >= deadline) {
+      return false;
+    }
+    auto wakeAt = deadline;
+    if (!schedule_.empty()) {
+      wakeAt = std::min(wakeAt, schedule_.begin()->first);
+    }
+    cond_.wait_until(lock, wakeAt);
+  }
+  return false;
+}
+
+Watcher::ConsumeNotifyRet PollWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  auto cookieDirs = root->cookies.cookieDirs();
+
+  // Take the due dirs that the budget allows, and stat them without
+  // holding the lock, as a stat on a network filesystem can take a while
+  std::vector<w_string> due;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = Clock::now();
+    auto budget = availableBudget(now);
+    for (auto it = schedule_.begin();
+         it != schedule_.end() && it->first <= now && due.size() < budget;
+         ++it) {
+      due.push_back(it->second);
+    }
+    budget_ -= double(due.size());
+  }
+
+  struct Result {
+    w_string path;
+    std::optional<FileInformation> info;
+  };
+  std::vector<Result> results;
+  results.reserve(due.size());
+  for (auto& path : due) {
+    Result result{path, std::nullopt};
+    try {
+      result.info = getFileInformation(path.c_str());
+    } catch (const std::system_error&) {
+      // Gone, or no longer accessible
+    }
+    results.push_back(std::move(result));
+  }
+
+  bool cancel = false;
+  auto wallNow = std::chrono::system_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto now = Clock::now();
+  for (auto& result : results) {
+    totalChecks_++;
+    auto it = dirs_.find(result.path);
+    if (it == dirs_.end()) {
+      continue;
+    }
+    auto& state = it->second;
+
+    if (!result.info || !result.info->isDir()) {
+      // The crawl of its parent notices that it's gone; should it come
+      // back, that crawl will have us watch it again
+      totalChanges_++;
+      if (result.path == rootPath_) {
+        logf(ERR, "root dir {} has been removed, canceling watch\n", rootPath_);
+        cancel = true;
+      }
+      coll.add(result.path, wallNow, W_PENDING_VIA_NOTIFY);
+      schedule_.erase(state.scheduled);
+      dirs_.erase(it);
+      continue;
+    }
+
+    auto& info = *result.info;
+    bool changed = !sameTime(info.mtime, state.mtime) ||
+        !sameTime(info.ctime, state.ctime) || info.ino != state.ino;
+    if (changed) {
+      totalChanges_++;
+      logf(DBG, "poll: {} changed\n", result.path);
+      // The crawl records the new mtime when it reads the dir
+      coll.add(
+          result.path,
+          wallNow,
+          W_PENDING_VIA_NOTIFY | W_PENDING_NONRECURSIVE_SCAN);
+      state.interval = minInterval_;
+    } else if (!cookieDirs.count(result.path)) {
+      state.interval = std::min(state.interval * 2, maxInterval_);
+    }
+    schedule(result.path, state, now);
+  }
+
+  return {cancel};
+}
+
+void PollWatcher::stopThreads() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stopped_ = true;
+  cond_.notify_all();
+}
+
+json_ref PollWatcher::getDebugInfo() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return json_object({
+      {"dir_count", json_integer(dirs_.size())},
+      {"total_check_count", json_integer(totalChecks_)},
+      {"total_change_count", json_integer(totalChanges_)},
+  });
+}
+
+void PollWatcher::clearDebugInfo() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  totalChecks_ = 0;
+  totalChanges_ = 0;
+}
+
+bool isPolledFSType(const w_string& fstype) {
+  auto fstypes = cfg_get_json("poll_fstypes");
+  if (!fstypes || !fstypes.isArray()) {
+    return false;
+  }
+  for (auto& name : fstypes.array()) {
+    if (name.isString() && json_to_w_string(name) == fstype) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::shared_ptr<QueryableView> detectPoll(
+    const w_string& root_path,
+    const w_string& fstype,
+    const Configuration& config) {
+  if (strcmp(config.getString("watcher", "auto"), "poll") != 0 &&
+      !isPolledFSType(fstype)) {
+    throw std::runtime_error(
+        "not requested by the watcher option, and the filesystem type is "
+        "not listed in poll_fstypes");
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem,
+      root_path,
+      config,
+      std::make_shared<PollWatcher>(root_path, config));
+}
+
+} // namespace
+
+// Ahead of the notification based watchers, for the filesystems where
+// their notifications don't work, but only used for those that are
+// configured to be polled, or when requested via the "watcher" option.
+static WatcherRegistry reg("poll", detectPoll, 100);
+
+/* vim:ts=2:sw=2:et:
+ */
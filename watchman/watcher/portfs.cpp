@@ -10,7 +10,11 @@
 
 #include <folly/String.h>
 #include <folly/Synchronized.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <vector>
 #include "watchman/InMemoryView.h"
 
 #ifdef HAVE_PORT_CREATE
@@ -21,8 +25,15 @@ struct watchman_port_file {
   file_obj_t port_file;
   w_string name;
   bool is_dir;
+  // Event ports are one-shot: the file is dissociated by its first event
+  // until it is associated again, once its parent dir has been examined.
+  enum State { Dissociated, Queued, Associated } state{Dissociated};
 };
 
+// The bounds of the number of events read by each port_getn
+constexpr uint_t kMinPortBatch = 64;
+constexpr uint_t kMaxPortBatch = WATCHMAN_BATCH_LIMIT;
+
 using watchman::FileDescriptor;
 using watchman::Pipe;
 
@@ -30,16 +41,37 @@ struct PortFSWatcher : public Watcher {
   FileDescriptor port_fd;
   FileDescriptor port_delete_fd;
   Pipe terminatePipe_;
-
-  /* map of file name to watchman_port_file */
-  folly::Synchronized<
-      std::unordered_map<w_string, std::unique_ptr<watchman_port_file>>>
-      port_files;
+  // Written when files are queued for the notify thread to associate
+  Pipe associatePipe_;
+
+  struct PortFiles {
+    /* map of file name to watchman_port_file */
+    std::unordered_map<w_string, std::unique_ptr<watchman_port_file>>
+        byName;
+    // The files that the IO thread has re-watched since the notify thread
+    // last associated them, so that a batch of them is associated in one
+    // pass rather than each taking the lock and a syscall on the IO
+    // thread.  Their entries stay in byName, so these don't dangle.
+    std::vector<watchman_port_file*> toAssociate;
+  };
+  folly::Synchronized<PortFiles> port_files;
 
   std::unique_ptr<watchman_port_file> root_delete_w_port_file;
   bool root_deleted;
 
-  port_event_t portevents[WATCHMAN_BATCH_LIMIT];
+  // Sized by the backlog: grown while reads fill it and shrunk while they
+  // fall well short of it.
+  std::vector<port_event_t> portevents;
+
+  // For debug-watcher-info, to tell how the batching is doing
+  std::atomic<uint64_t> getnBatchSize_{kMinPortBatch};
+  std::atomic<uint64_t> getnCalls_{0};
+  std::atomic<uint64_t> getnEvents_{0};
+  std::atomic<uint64_t> getnNanos_{0};
+  std::atomic<uint64_t> maxGetnEvents_{0};
+  std::atomic<uint64_t> associateBatches_{0};
+  std::atomic<uint64_t> associations_{0};
+  std::atomic<uint64_t> associateNanos_{0};
 
   explicit PortFSWatcher(watchman_root* root);
 
@@ -58,10 +90,19 @@ struct PortFSWatcher : public Watcher {
 
   bool waitNotify(int timeoutms) override;
   void signalThreads() override;
+  json_ref getDebugInfo() override;
+  void clearDebugInfo() override;
+
+  // Associates name with the port, right away if now is true, else by
+  // queueing it for the notify thread to associate with the next batch.
   bool do_watch(
       const w_string& name,
       const watchman::FileInformation& finfo,
-      bool throw_on_error);
+      bool throw_on_error,
+      bool now);
+
+  // Associates the queued files with the port
+  void associateQueued();
 };
 
 static const struct flag_map pflags[] = {
@@ -76,6 +117,17 @@ static const struct flag_map pflags[] = {
     {0, nullptr},
 };
 
+// Sets the times that an association compares the file's against, so that
+// the changes made since finfo was taken are reported straight away.
+static void set_port_file_times(
+    watchman_port_file* f,
+    const watchman::FileInformation& finfo) {
+  f->port_file.fo_atime = finfo.atime;
+  f->port_file.fo_mtime = finfo.mtime;
+  f->port_file.fo_ctime = finfo.ctime;
+  f->is_dir = finfo.isDir();
+}
+
 static std::unique_ptr<watchman_port_file> make_port_file(
     const w_string& name,
     const watchman::FileInformation& finfo) {
@@ -83,21 +135,32 @@ static std::unique_ptr<watchman_port_file> make_port_file(
 
   f->name = name;
   f->port_file.fo_name = (char*)name.c_str();
-  f->port_file.fo_atime = finfo.atime;
-  f->port_file.fo_mtime = finfo.mtime;
-  f->port_file.fo_ctime = finfo.ctime;
-  f->is_dir = finfo.isDir();
+  set_port_file_times(f.get(), finfo);
 
   return f;
 }
 
+static uint64_t nanos_since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+static void update_max(std::atomic<uint64_t>& max, uint64_t value) {
+  auto prior = max.load(std::memory_order_relaxed);
+  while (prior < value &&
+         !max.compare_exchange_weak(prior, value, std::memory_order_relaxed)) {
+  }
+}
+
 PortFSWatcher::PortFSWatcher(watchman_root* root)
     : Watcher("portfs", 0),
       port_fd(port_create(), "port_create()"),
       port_delete_fd(port_create(), "port_create()"),
-      root_deleted(false) {
+      root_deleted(false),
+      portevents(kMinPortBatch) {
   auto wlock = port_files.wlock();
-  wlock->reserve(root->config.getInt(CFG_HINT_NUM_DIRS, HINT_NUM_DIRS));
+  wlock->byName.reserve(hintNumDirs(root->config, root->root_path));
   port_fd.setCloExec();
   port_delete_fd.setCloExec();
 }
@@ -105,16 +168,33 @@ PortFSWatcher::PortFSWatcher(watchman_root* root)
 bool PortFSWatcher::do_watch(
     const w_string& name,
     const watchman::FileInformation& finfo,
-    bool throw_on_error) {
+    bool throw_on_error,
+    bool now) {
   auto wlock = port_files.wlock();
-  if (wlock->find(name) != wlock->end()) {
-    // Already watching it
-    return true;
+  watchman_port_file* rawFile;
+  auto it = wlock->byName.find(name);
+  if (it != wlock->byName.end()) {
+    rawFile = it->second.get();
+    if (rawFile->state != watchman_port_file::Dissociated) {
+      // Already watching it
+      return true;
+    }
+    // Reuse the entry that the last event dissociated
+    set_port_file_times(rawFile, finfo);
+  } else {
+    auto f = make_port_file(name, finfo);
+    rawFile = f.get();
+    wlock->byName.emplace(name, std::move(f));
   }
 
-  auto f = make_port_file(name, finfo);
-  auto rawFile = f.get();
-  wlock->emplace(name, std::move(f));
+  if (!now) {
+    rawFile->state = watchman_port_file::Queued;
+    wlock->toAssociate.push_back(rawFile);
+    if (wlock->toAssociate.size() == 1) {
+      ignore_result(write(associatePipe_.write.fd(), "X", 1));
+    }
+    return true;
+  }
 
   logf(DBG, "watching {}\n", name);
   errno = 0;
@@ -130,16 +210,61 @@ bool PortFSWatcher::do_watch(
         "port_associate {} {}\n",
         rawFile->port_file.fo_name,
         folly::errnoStr(errno));
-    wlock->erase(name);
+    wlock->byName.erase(name);
     if (throw_on_error) {
       throw std::system_error(err, std::generic_category(), "port_associate");
     }
     return false;
   }
+  rawFile->state = watchman_port_file::Associated;
 
   return true;
 }
 
+void PortFSWatcher::associateQueued() {
+  std::vector<watchman_port_file*> batch;
+  std::swap(batch, port_files.wlock()->toAssociate);
+  if (batch.empty()) {
+    return;
+  }
+
+  // Only this thread dissociates or erases the entries, so they can be
+  // associated without holding the lock, and the IO thread leaves the
+  // queued ones alone.
+  auto start = std::chrono::steady_clock::now();
+  std::vector<watchman_port_file*> failed;
+  for (auto* f : batch) {
+    errno = 0;
+    if (port_associate(
+            port_fd.fd(),
+            PORT_SOURCE_FILE,
+            (uintptr_t)&f->port_file,
+            WATCHMAN_PORT_EVENTS,
+            (void*)f)) {
+      // Most likely deleted since it was examined, which its dir's event
+      // reports
+      logf(
+          DBG,
+          "port_associate {} {}\n",
+          f->port_file.fo_name,
+          folly::errnoStr(errno));
+      failed.push_back(f);
+    }
+  }
+  associateNanos_.fetch_add(nanos_since(start), std::memory_order_relaxed);
+  associateBatches_.fetch_add(1, std::memory_order_relaxed);
+  associations_.fetch_add(batch.size(), std::memory_order_relaxed);
+  logf(DBG, "port_associate: n={}\n", batch.size());
+
+  auto wlock = port_files.wlock();
+  for (auto* f : batch) {
+    f->state = watchman_port_file::Associated;
+  }
+  for (auto* f : failed) {
+    wlock->byName.erase(f->name);
+  }
+}
+
 /*
  * We need to have an extra port the catches the delete event on the root.
  * The reason for this is that the creation or delete of one of the
@@ -180,7 +305,7 @@ bool PortFSWatcher::startWatchFile(struct watchman_file* file) {
     return false;
   }
 
-  return do_watch(name, file->stat, false);
+  return do_watch(name, file->getStat(), false, false);
 }
 
 std::unique_ptr<DirHandle> PortFSWatcher::startWatchDir(
@@ -204,7 +329,9 @@ std::unique_ptr<DirHandle> PortFSWatcher::startWatchDir(
         std::string("fstat failed for dir ") + path);
   }
 
-  do_watch(dir->getFullPath(), watchman::FileInformation(st), true);
+  // Dirs are few enough to associate right away, which lets a failure
+  // stop the dir from being crawled
+  do_watch(dir->getFullPath(), watchman::FileInformation(st), true, true);
 
   return osdir;
 }
@@ -223,24 +350,35 @@ Watcher::ConsumeNotifyRet PortFSWatcher::consumeNotify(
   errno = 0;
 
   n = 1;
+  auto start = std::chrono::steady_clock::now();
   if (port_getn(
-          port_fd.fd(),
-          portevents,
-          sizeof(portevents) / sizeof(portevents[0]),
-          &n,
-          nullptr)) {
+          port_fd.fd(), portevents.data(), portevents.size(), &n, nullptr)) {
     if (errno == EINTR) {
       return {false, false};
     }
     logf(FATAL, "port_getn: {}\n", folly::errnoStr(errno));
   }
+  getnNanos_.fetch_add(nanos_since(start), std::memory_order_relaxed);
+  getnCalls_.fetch_add(1, std::memory_order_relaxed);
+  getnEvents_.fetch_add(n, std::memory_order_relaxed);
+  update_max(maxGetnEvents_, n);
 
-  logf(DBG, "port_getn: n={}\n", n);
+  logf(DBG, "port_getn: n={} of {}\n", n, portevents.size());
 
   if (n == 0) {
     return {false, false};
   }
 
+  // Size the next read by the backlog that this one saw.  A full read
+  // means that more are likely queued.
+  uint_t batch = portevents.size();
+  uint_t nextBatch = batch;
+  if (n == batch && batch < kMaxPortBatch) {
+    nextBatch = std::min(batch * 2, kMaxPortBatch);
+  } else if (n < batch / 4 && batch > kMinPortBatch) {
+    nextBatch = std::max(batch / 2, kMinPortBatch);
+  }
+
   auto wlock = port_files.wlock();
 
   gettimeofday(&now, nullptr);
@@ -269,8 +407,20 @@ Watcher::ConsumeNotifyRet PortFSWatcher::consumeNotify(
         (f->is_dir ? W_PENDING_RECURSIVE : 0) | W_PENDING_VIA_NOTIFY);
 
     // It was port_dissociate'd implicitly.  We'll re-establish a
-    // watch later when portfs_root_start_watch_(file|dir) are called again
-    wlock->erase(f->name);
+    // watch later when portfs_root_start_watch_(file|dir) are called again,
+    // reusing the entry unless the file went away.
+    if (pe & (FILE_DELETE | FILE_RENAME_FROM)) {
+      wlock->byName.erase(f->name);
+    } else {
+      f->state = watchman_port_file::Dissociated;
+    }
+  }
+  wlock.unlock();
+
+  if (nextBatch != batch) {
+    portevents.resize(nextBatch);
+    portevents.shrink_to_fit();
+    getnBatchSize_.store(nextBatch, std::memory_order_relaxed);
   }
 
   return {true, false};
@@ -278,7 +428,9 @@ Watcher::ConsumeNotifyRet PortFSWatcher::consumeNotify(
 
 bool PortFSWatcher::waitNotify(int timeoutms) {
   int n;
-  std::array<struct pollfd, 3> pfd;
+  std::array<struct pollfd, 4> pfd;
+
+  associateQueued();
 
   pfd[0].fd = port_fd.fd();
   pfd[0].events = POLLIN;
@@ -286,10 +438,20 @@ bool PortFSWatcher::waitNotify(int timeoutms) {
   pfd[1].events = POLLIN;
   pfd[2].fd = terminatePipe_.read.fd();
   pfd[2].events = POLLIN;
+  pfd[3].fd = associatePipe_.read.fd();
+  pfd[3].events = POLLIN;
 
   n = poll(pfd.data(), pfd.size(), timeoutms);
 
   if (n > 0) {
+    if (pfd[3].revents) {
+      // Drain the pipe before taking the queue, so that the files queued
+      // after this wake us again
+      char buf[64];
+      while (read(associatePipe_.read.fd(), buf, sizeof(buf)) > 0) {
+      }
+      associateQueued();
+    }
     if (pfd[2].revents) {
       // We were signalled via signalThreads
       return false;
@@ -308,6 +470,31 @@ void PortFSWatcher::signalThreads() {
   ignore_result(write(terminatePipe_.write.fd(), "X", 1));
 }
 
+json_ref PortFSWatcher::getDebugInfo() {
+  auto watchCount = port_files.rlock()->byName.size();
+  return json_object({
+      {"watch_count", json_integer(watchCount)},
+      {"getn_batch_size", json_integer(getnBatchSize_.load())},
+      {"getn_calls", json_integer(getnCalls_.load())},
+      {"getn_events", json_integer(getnEvents_.load())},
+      {"getn_nanos", json_integer(getnNanos_.load())},
+      {"max_getn_events", json_integer(maxGetnEvents_.load())},
+      {"associate_batches", json_integer(associateBatches_.load())},
+      {"associations", json_integer(associations_.load())},
+      {"associate_nanos", json_integer(associateNanos_.load())},
+  });
+}
+
+void PortFSWatcher::clearDebugInfo() {
+  getnCalls_.store(0, std::memory_order_release);
+  getnEvents_.store(0, std::memory_order_release);
+  getnNanos_.store(0, std::memory_order_release);
+  maxGetnEvents_.store(0, std::memory_order_release);
+  associateBatches_.store(0, std::memory_order_release);
+  associations_.store(0, std::memory_order_release);
+  associateNanos_.store(0, std::memory_order_release);
+}
+
 static RegisterWatcher<PortFSWatcher> reg(
     "portfs",
     1 /* higher priority than inotify */);
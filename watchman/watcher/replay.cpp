@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <unordered_set>
+#include "watchman/Constants.h"
+#include "watchman/InMemoryView.h"
+#include "watchman/WatcherTrace.h"
+#include "watchman/WatchmanConfig.h"
+#include "watchman/fs/FileSystem.h"
+#include "watchman/root/Root.h"
+#include "watchman/watcher/Watcher.h"
+#include "watchman/watcher/WatcherRegistry.h"
+
+using namespace watchman;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// How often to look for the cookies of queries that are syncing
+constexpr std::chrono::milliseconds kCookiePollInterval{10};
+
+/**
+ * Feeds the changes from a recording made with watcher_trace_file into the
+ * view, rather than watching the filesystem, so that a storm of changes
+ * seen elsewhere can be put through the view, settling and subscriptions
+ * again.  The paths are taken to be relative to the root being watched,
+ * which would usually be a copy of the tree that the trace was made in.
+ *
+ * The changes are replayed at replay_speed times the pace at which they
+ * were recorded, or as quickly as the view takes them if that is 0.  Once
+ * the trace is done the root sees no more changes.
+ *
+ * As the filesystem isn't watched, the cookies of the queries that sync
+ * are reported as soon as they are written, regardless of how far the
+ * replay has got.
+ */
+class ReplayWatcher : public Watcher {
+ public:
+  ReplayWatcher(const w_string& rootPath, const Configuration& config);
+
+  bool start(const std::shared_ptr<Root>& root) override;
+
+  std::unique_ptr<DirHandle> startWatchDir(
+      const std::shared_ptr<Root>& root,
+      struct watchman_dir* dir,
+      const char* path) override;
+
+  Watcher::ConsumeNotifyRet consumeNotify(
+      const std::shared_ptr<Root>& root,
+      PendingChanges& coll) override;
+
+  bool waitNotify(int timeoutms) override;
+
+  void stopThreads() override;
+
+  json_ref getDebugInfo() override;
+
+ private:
+  // When events_[index] is due.  Must be called with mutex_ held.
+  Clock::time_point dueTime(size_t index) const;
+
+  const w_string rootPath_;
+  const w_string tracePath_;
+  const std::vector<WatcherTrace::Event> events_;
+  const double speed_;
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stopped_{false};
+  // Set once start() is called; the offsets of events_ are relative to it
+  Clock::time_point started_;
+  // The root, so that waitNotify can look for cookies
+  std::weak_ptr<Root> root_;
+  // How many of events_ have been reported
+  size_t next_{0};
+  // The outstanding cookies that have been reported
+  std::unordered_set<w_string> reportedCookies_;
+};
+
+ReplayWatcher::ReplayWatcher(
+    const w_string& rootPath,
+    const Configuration& config)
+    : Watcher("replay", WATCHER_HAS_PER_FILE_NOTIFICATIONS),
+      rootPath_(rootPath),
+      tracePath_(config.getString("replay_trace_file", ""), W_STRING_BYTE),
+      events_(WatcherTrace::load(tracePath_)),
+      speed_(std::max(0.0, config.getDouble("replay_speed", 1.0))) {}
+
+bool ReplayWatcher::start(const std::shared_ptr<Root>& root) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  started_ = Clock::now();
+  root_ = root;
+  log(ERR,
+      "replaying ",
+      events_.size(),
+      " changes from ",
+      tracePath_,
+      " into ",
+      rootPath_,
+      "\n");
+  return true;
+}
+
+std::unique_ptr<DirHandle> ReplayWatcher::startWatchDir(
+    const std::shared_ptr<Root>&,
+    struct watchman_dir*,
+    const char* path) {
+  return openDir(path);
+}
+
+Clock::time_point ReplayWatcher::dueTime(size_t index) const {
+  if (speed_ == 0) {
+    return started_;
+  }
+  return started_ +
+      std::chrono::duration_cast<Clock::duration>(
+             std::chrono::duration<double, std::micro>(
+                 double(events_[index].offset.count()) / speed_));
+}
+
+bool ReplayWatcher::waitNotify(int timeoutms) {
+  auto deadline = Clock::now() + std::chrono::milliseconds(timeoutms);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopped_) {
+    auto now = Clock::now();
+    if (next_ < events_.size() && dueTime(next_) <= now) {
+      return true;
+    }
+    if (auto root = root_.lock()) {
+      for (auto& cookie : root->cookies.getOutstandingCookieFileList()) {
+        if (!reportedCookies_.count(cookie)) {
+          return true;
+        }
+      }
+    }
+    if (now >= deadline) {
+      return false;
+    }
+    auto wakeAt = std::min(deadline, now + kCookiePollInterval);
+    if (next_ < events_.size()) {
+      wakeAt = std::min(wakeAt, dueTime(next_));
+    }
+    cond_.wait_until(lock, wakeAt);
+  }
+  return false;
+}
+
+Watcher::ConsumeNotifyRet ReplayWatcher::consumeNotify(
+    const std::shared_ptr<Root>& root,
+    PendingChanges& coll) {
+  auto wallNow = std::chrono::system_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto now = Clock::now();
+
+  // No more than a batch at a time, so that it is processed the way that
+  // the same storm from a real watcher would be
+  size_t batchEnd = std::min(events_.size(), next_ + WATCHMAN_BATCH_LIMIT);
+  for (; next_ < batchEnd && dueTime(next_) <= now; ++next_) {
+    auto& event = events_[next_];
+    coll.add(
+        event.path.empty()
+            ? rootPath_
+            : w_string::pathCat({rootPath_, event.path}),
+        wallNow,
+        event.flags);
+  }
+
+  std::unordered_set<w_string> outstanding;
+  for (auto& cookie : root->cookies.getOutstandingCookieFileList()) {
+    if (!reportedCookies_.count(cookie)) {
+      coll.add(cookie, wallNow, W_PENDING_VIA_NOTIFY);
+    }
+    outstanding.insert(std::move(cookie));
+  }
+  reportedCookies_ = std::move(outstanding);
+
+  return {false};
+}
+
+void ReplayWatcher::stopThreads() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stopped_ = true;
+  cond_.notify_all();
+}
+
+json_ref ReplayWatcher::getDebugInfo() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return json_object({
+      {"trace", w_string_to_json(tracePath_)},
+      {"event_count", json_integer(events_.size())},
+      {"replayed_count", json_integer(next_)},
+  });
+}
+
+std::shared_ptr<QueryableView> detectReplay(
+    const w_string& root_path,
+    const w_string& /*fstype*/,
+    const Configuration& config) {
+  if (strcmp(config.getString("watcher", "auto"), "replay") != 0) {
+    throw std::runtime_error("only used when requested by the watcher option");
+  }
+  std::shared_ptr<Watcher> watcher;
+  try {
+    watcher = std::make_shared<ReplayWatcher>(root_path, config);
+  } catch (const std::exception& exc) {
+    // Watching the filesystem instead would defeat the point
+    throw TerminalWatcherError(exc.what());
+  }
+  return std::make_shared<InMemoryView>(
+      realFileSystem, root_path, config, std::move(watcher));
+}
+
+} // namespace
+
+static WatcherRegistry reg("replay", detectReplay);
+
+/* vim:ts=2:sw=2:et:
+ */
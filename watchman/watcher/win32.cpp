@@ -7,8 +7,10 @@
 
 #include <folly/Synchronized.h>
 #include "watchman/InMemoryView.h"
+#include "watchman/ThreadStats.h"
 #include "watchman/fs/FileDescriptor.h"
 #include "watchman/root/Root.h"
+#include "watchman/watcher/UsnJournal.h"
 #include "watchman/watcher/Watcher.h"
 #include "watchman/watcher/WatcherRegistry.h"
 
@@ -45,6 +47,18 @@ struct WinWatcher : public Watcher {
   std::condition_variable cond;
   folly::Synchronized<std::list<Item>, std::mutex> changedItems;
 
+  // Replays the changes that the ReadDirectoryChangesW buffer couldn't
+  // hold, and those made while the daemon wasn't running.  Null unless
+  // win32_usn_journal is set.
+  std::unique_ptr<UsnJournal> usnJournal;
+  struct Delivered {
+    // The USNs before which every change had been put in changedItems, as
+    // of the latest batch and the one before it
+    int64_t previous{-1};
+    int64_t latest{-1};
+  };
+  folly::Synchronized<Delivered> delivered;
+
   explicit WinWatcher(const w_string& root_path, const Configuration& config);
   ~WinWatcher();
 
@@ -58,18 +72,22 @@ struct WinWatcher : public Watcher {
       PendingChanges& coll) override;
 
   bool waitNotify(int timeoutms) override;
+  w_string getChangeHistoryPosition() override;
+  std::optional<std::vector<w_string>> getChangesSince(
+      w_string_piece position) override;
   bool start(const std::shared_ptr<Root>& root) override;
   void stopThreads() override;
   void readChangesThread(const std::shared_ptr<Root>& root);
 };
 
-WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
-    : Watcher("win32", WATCHER_HAS_PER_FILE_NOTIFICATIONS) {
+namespace {
+
+// Opens an overlapped handle so that we can avoid blocking forever
+// in ReadDirectoryChangesW
+FileDescriptor openDirHandle(const w_string& root_path) {
   auto wpath = root_path.piece().asWideUNC();
 
-  // Create an overlapped handle so that we can avoid blocking forever
-  // in ReadDirectoryChangesW
-  dir_handle = FileDescriptor(
+  FileDescriptor handle(
       intptr_t(CreateFileW(
           wpath.c_str(),
           GENERIC_READ,
@@ -80,12 +98,19 @@ WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
           nullptr)),
       FileDescriptor::FDType::Generic);
 
-  if (!dir_handle) {
+  if (!handle) {
     throw std::runtime_error(
         std::string("failed to open dir ") + root_path.c_str() + ": " +
         win32_strerror(GetLastError()));
   }
+  return handle;
+}
 
+} // namespace
+
+WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
+    : Watcher("win32", WATCHER_HAS_PER_FILE_NOTIFICATIONS),
+      dir_handle(openDirHandle(root_path)) {
   ping = CreateEvent(nullptr, TRUE, FALSE, nullptr);
   if (!ping) {
     throw std::runtime_error(
@@ -98,6 +123,17 @@ WinWatcher::WinWatcher(const w_string& root_path, const Configuration& config)
         std::string("failed to create event: ") +
         win32_strerror(GetLastError()));
   }
+  if (config.getBool("win32_usn_journal", false)) {
+    try {
+      usnJournal = std::make_unique<UsnJournal>(root_path);
+    } catch (const std::exception& exc) {
+      logf(
+          ERR,
+          "not using the change journal for {}: {}\n",
+          root_path,
+          exc.what());
+    }
+  }
 }
 
 WinWatcher::~WinWatcher() {
@@ -114,7 +150,6 @@ void WinWatcher::stopThreads() {
 }
 
 void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
-  std::vector<uint8_t> buf;
   DWORD err, filter;
   auto olap = OVERLAPPED();
   BOOL initiate_read = true;
@@ -122,6 +157,7 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
   DWORD bytes;
 
   w_set_thread_name("readchange ", root->root_path.view());
+  ThreadStats::setCurrentThreadRoot(std::string(root->root_path.view()));
   watchman::log(watchman::DBG, "initializing\n");
 
   // Artificial extra latency to impose around processing changes.
@@ -131,22 +167,54 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
   auto extraLatency = root->config.getInt("win32_batch_latency_ms", 30);
 
   DWORD size = root->config.getInt("win32_rdcw_buf_size", 16384);
+  // Each overflow doubles the buffer, up to this size
+  DWORD maxSize = std::max<DWORD>(
+      size, root->config.getInt("win32_rdcw_max_buf_size", 1024 * 1024));
 
-  // Block until winmatch_root_st is waiting for our initialization
-  {
-    auto wlock = changedItems.lock();
+  // Changes are read into one buffer while those in the other are being
+  // processed, so that the next read is always outstanding, and the OS
+  // never has to hold on to changes while we're busy.
+  std::vector<uint8_t> bufs[2];
+  size_t current = 0;
 
-    filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
-        FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
-        FILE_NOTIFY_CHANGE_LAST_WRITE;
+  filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+      FILE_NOTIFY_CHANGE_ATTRIBUTES | FILE_NOTIFY_CHANGE_SIZE |
+      FILE_NOTIFY_CHANGE_LAST_WRITE;
 
-    olap.hEvent = olapEvent;
+  olap.hEvent = olapEvent;
 
-    buf.resize(size);
+  std::list<Item> items;
 
+  // Returns the USN that the next change will be recorded with, or -1
+  bool journalFailed = false;
+  auto sampleUsn = [&]() -> int64_t {
+    if (!usnJournal || journalFailed) {
+      return -1;
+    }
+    try {
+      return usnJournal->nextUsn();
+    } catch (const std::exception& exc) {
+      // Most likely it was recreated, in which case it can't help us again
+      logf(
+          ERR,
+          "no longer using the change journal for {}: {}\n",
+          root->root_path,
+          exc.what());
+      journalFailed = true;
+      *delivered.wlock() = Delivered{};
+      return -1;
+    }
+  };
+  // Every change recorded before this USN has been put in items, or is
+  // covered by the initial crawl
+  int64_t deliveredUsn = -1;
+
+  auto issueRead = [&] {
+    auto& buf = bufs[current];
+    buf.resize(std::max<size_t>(buf.size(), size));
     if (!ReadDirectoryChangesW(
             (HANDLE)dir_handle.handle(),
-            &buf[0],
+            buf.data(),
             size,
             TRUE,
             filter,
@@ -159,6 +227,73 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
           "ReadDirectoryChangesW: failed, cancel watch. {}\n",
           win32_strerror(err));
       root->cancel();
+      return false;
+    }
+    return true;
+  };
+
+  // Looks up what changed since deliveredUsn in the change journal
+  auto replayFromJournal = [&](const char* why) {
+    if (deliveredUsn < 0) {
+      return false;
+    }
+    auto until = sampleUsn();
+    if (until < 0) {
+      return false;
+    }
+    auto changes = usnJournal->changesBetween(deliveredUsn, until);
+    if (!changes) {
+      return false;
+    }
+    for (auto& change : *changes) {
+      auto full = w_string::pathCat({root->root_path, change.name});
+      if (!root->ignore.isIgnored(full.data(), full.size())) {
+        items.emplace_back(
+            std::move(full), change.removed ? W_PENDING_RECURSIVE : 0);
+      }
+    }
+    logf(
+        ERR,
+        "{}: replayed {} changes to {} from the change journal\n",
+        why,
+        changes->size(),
+        root->root_path);
+    deliveredUsn = until;
+    return true;
+  };
+
+  // The changes were discarded because they didn't fit in the buffer
+  auto handleOverflow = [&](const char* why) {
+    if (size < maxSize) {
+      // The OS sizes the buffer that it holds changes in on the first read
+      // from a handle, so a larger buffer needs a fresh handle.  Nothing is
+      // lost, as what changed in the meantime is about to be replayed from
+      // the change journal or recrawled anyway.
+      size = std::min<DWORD>(size * 2, maxSize);
+      logf(
+          ERR,
+          "{}: growing the ReadDirectoryChangesW buffer for {} to {} bytes\n",
+          why,
+          root->root_path,
+          size);
+      dir_handle = openDirHandle(root->root_path);
+    }
+    // Watch for changes before replaying or recrawling, so that between
+    // them they see everything
+    if (!issueRead()) {
+      return false;
+    }
+    if (!replayFromJournal(why)) {
+      root->scheduleRecrawl(why);
+    }
+    return true;
+  };
+
+  // Block until winmatch_root_st is waiting for our initialization
+  {
+    auto wlock = changedItems.lock();
+
+    if (!issueRead()) {
       return;
     }
     // Signal that we are done with init.  We MUST do this AFTER our first
@@ -169,31 +304,16 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
     cond.notify_one();
   }
   initiate_read = false;
-
-  std::list<Item> items;
+  deliveredUsn = sampleUsn();
+  *delivered.wlock() = Delivered{deliveredUsn, deliveredUsn};
 
   // The mutex must not be held when we enter the loop
   while (!root->inner.cancelled) {
     if (initiate_read) {
-      if (!ReadDirectoryChangesW(
-              (HANDLE)dir_handle.handle(),
-              &buf[0],
-              size,
-              TRUE,
-              filter,
-              nullptr,
-              &olap,
-              nullptr)) {
-        err = GetLastError();
-        logf(
-            ERR,
-            "ReadDirectoryChangesW: failed, cancel watch. {}\n",
-            win32_strerror(err));
-        root->cancel();
+      if (!issueRead()) {
         break;
-      } else {
-        initiate_read = false;
       }
+      initiate_read = false;
     }
 
     watchman::log(watchman::DBG, "waiting for change notifications\n");
@@ -232,18 +352,36 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
               "with smaller buffer\n",
               root->root_path);
           size = NETWORK_BUF_SIZE;
+          maxSize = NETWORK_BUF_SIZE;
           initiate_read = true;
           continue;
         }
 
         if (err == ERROR_NOTIFY_ENUM_DIR) {
-          root->scheduleRecrawl("ERROR_NOTIFY_ENUM_DIR");
+          ResetEvent(olapEvent);
+          if (!handleOverflow("ERROR_NOTIFY_ENUM_DIR")) {
+            break;
+          }
         } else {
           logf(ERR, "Cancelling watch for {}\n", root->root_path);
           root->cancel();
           break;
         }
+      } else if (bytes == 0) {
+        // This is how an overflow is reported for local directories
+        ResetEvent(olapEvent);
+        if (!handleOverflow("ReadDirectoryChangesW overflow")) {
+          break;
+        }
       } else {
+        // Start reading into the other buffer before looking at this one
+        auto& buf = bufs[current];
+        current ^= 1;
+        ResetEvent(olapEvent);
+        if (!issueRead()) {
+          break;
+        }
+
         PFILE_NOTIFY_INFORMATION notify = (PFILE_NOTIFY_INFORMATION)buf.data();
 
         while (true) {
@@ -280,14 +418,14 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
           notify =
               (PFILE_NOTIFY_INFORMATION)(notify->NextEntryOffset + (char*)notify);
         }
-
-        ResetEvent(olapEvent);
-        initiate_read = true;
       }
     } else if (status == WAIT_OBJECT_0 + 1) {
       logf(ERR, "signalled\n");
       break;
     } else if (status == WAIT_TIMEOUT) {
+      // The outstanding read has had nothing to report for a while, so we
+      // have read every change made before now
+      auto usn = sampleUsn();
       if (!items.empty()) {
         watchman::log(
             watchman::DBG,
@@ -298,6 +436,12 @@ void WinWatcher::readChangesThread(const std::shared_ptr<Root>& root) {
         wlock->splice(wlock->end(), items);
         cond.notify_one();
       }
+      if (usn >= 0) {
+        deliveredUsn = usn;
+        auto d = delivered.wlock();
+        d->previous = d->latest;
+        d->latest = usn;
+      }
     } else {
       logf(ERR, "impossible wait status={}\n", status);
       break;
@@ -401,6 +545,33 @@ bool WinWatcher::waitNotify(int timeoutms) {
   return !wlock->empty();
 }
 
+w_string WinWatcher::getChangeHistoryPosition() {
+  if (!usnJournal) {
+    return w_string();
+  }
+  // Everything in the batch before the latest has been consumed by the
+  // time the view settles, which is when the position is stored
+  auto usn = delivered.rlock()->previous;
+  return usn < 0 ? w_string() : usnJournal->formatPosition(usn);
+}
+
+std::optional<std::vector<w_string>> WinWatcher::getChangesSince(
+    w_string_piece position) {
+  if (!usnJournal) {
+    return std::nullopt;
+  }
+  auto changes = usnJournal->changesSince(position);
+  if (!changes) {
+    return std::nullopt;
+  }
+  std::vector<w_string> names;
+  names.reserve(changes->size());
+  for (auto& change : *changes) {
+    names.push_back(std::move(change.name));
+  }
+  return names;
+}
+
 static RegisterWatcher<WinWatcher> reg("win32");
 
 #endif // _WIN32
@@ -53,6 +53,12 @@ struct watchman_client : public std::enable_shared_from_this<watchman_client> {
   virtual ~watchman_client();
 
   void enqueueResponse(json_ref&& resp, bool ping = true);
+
+  // Whether the client has gone away, such as while a command that it
+  // issued is still running
+  bool hungUp() const {
+    return stm && stm->peerHungUp();
+  }
 };
 
 struct watchman_user_client;
@@ -83,11 +89,27 @@ struct watchman_client_subscription
 
   std::deque<LoggedResponse> lastResponses;
 
+  // If set, the canonical form of the query spec, under which results are
+  // shared with identical subscriptions on the same root.
+  w_string sharedResultsKey;
+
+  // Whether changes are also reported, marked as unsettled, as soon as the
+  // IO thread has processed them
+  bool fast{false};
+  // The tick of the most recent unsettled response
+  uint32_t last_unsettled_tick{0};
+  // Whether an unsettled response has been sent since the last settle, in
+  // which case the next settled response is not suppressed
+  bool sentUnsettled{false};
+
   explicit watchman_client_subscription(
       const std::shared_ptr<watchman::Root>& root,
       std::weak_ptr<watchman_client> client);
   ~watchman_client_subscription();
   void processSubscription();
+  // Reports the changes that the IO thread has processed since the view
+  // last settled, for fast subscriptions
+  void processUnsettledChanges();
 
   std::shared_ptr<watchman_user_client> lockClient();
   json_ref buildSubscriptionResults(
@@ -102,6 +124,9 @@ struct watchman_client_subscription
       watchman_user_client* client,
       const std::shared_ptr<watchman::Root>& root);
   void updateSubscriptionTicks(QueryResult* res);
+  // Runs the query, or reuses the results of an identical subscription
+  // that already ran it against the current view.
+  QueryResult executeQuery(const std::shared_ptr<watchman::Root>& root);
   void processSubscriptionImpl();
 };
 
@@ -6,7 +6,10 @@
  */
 
 #pragma once
-#include <unordered_map>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include "watchman/ChildMap.h"
 #include "watchman/watchman_string.h"
 
 struct watchman_file;
@@ -21,18 +24,30 @@ struct watchman_dir {
   struct Deleter {
     void operator()(watchman_file*) const;
   };
-  std::unordered_map<w_string_piece, std::unique_ptr<watchman_file, Deleter>>
-      files;
+  watchman::ChildMap<std::unique_ptr<watchman_file, Deleter>> files;
 
   /* child dirs contained in this dir (keyed by dir->name) */
-  std::unordered_map<w_string_piece, std::unique_ptr<watchman_dir>> dirs;
+  watchman::ChildMap<std::unique_ptr<watchman_dir>> dirs;
 
   // If we think this dir was deleted, we'll avoid recursing
   // to its children when processing deletes.
   bool last_check_existed{true};
 
+  // When the crawler last read the entries of this dir, and the inode
+  // number that the dir had then.  Only maintained when recursive crawls
+  // may skip dirs that are unchanged since they were last read.
+  time_t last_crawl{0};
+  uint64_t last_crawl_ino{0};
+
+  // The PathFilter hash of the path to this dir, relative to the root
+  uint64_t pathHash;
+
   watchman_dir(w_string name, watchman_dir* parent);
 
+  // Dir nodes are allocated from the NodeArena alongside the file nodes.
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size) noexcept;
+
   watchman_dir* getChildDir(w_string_piece name) const;
 
   /**
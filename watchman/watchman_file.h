@@ -8,9 +8,35 @@
 #pragma once
 
 #include "watchman/Clock.h"
-#include "watchman/fs/FileInformation.h"
+#include "watchman/CompactFileInformation.h"
 #include "watchman/watchman_dir.h"
 
+/* linkage for the list of deleted files that ViewDatabase keeps for age
+ * out.  The list is circular, through a sentinel link in the ViewDatabase,
+ * so that a file can unlink itself when it is freed and the oldest entry can
+ * be found without walking the list.  Both are null when not linked. */
+struct watchman_tombstone_link {
+  watchman_tombstone_link* prev;
+  watchman_tombstone_link* next;
+
+  void unlink() {
+    if (next) {
+      next->prev = prev;
+      prev->next = next;
+      prev = nullptr;
+      next = nullptr;
+    }
+  }
+
+  // Links this immediately before `pos`
+  void insertBefore(watchman_tombstone_link* pos) {
+    prev = pos->prev;
+    next = pos;
+    prev->next = this;
+    pos->prev = this;
+  }
+};
+
 struct watchman_file {
   /* the parent dir */
   watchman_dir* parent;
@@ -20,6 +46,20 @@ struct watchman_file {
    * previous file node, or the head of the list. */
   struct watchman_file **prev, *next;
 
+  /* linkage to the other files that share the same lowercased
+   * suffix.  Follows the same convention as prev/next above; both
+   * are null for files that have no suffix. */
+  struct watchman_file **suffixPrev, *suffixNext;
+
+  /* linkage to the files below the same top level directory of the root,
+   * ordered by changed time.  Follows the same convention as prev/next;
+   * both are null for files that live directly in the root. */
+  struct watchman_file **subtreePrev, *subtreeNext;
+
+  /* linkage to the other deleted files, in the order that they were
+   * deleted; unlinked while the file exists */
+  watchman_tombstone_link tombstone;
+
   /* the time we last observed a change to this file */
   w_clock_t otime;
   /* the time we first observed this file OR the time
@@ -31,10 +71,21 @@ struct watchman_file {
   bool exists;
   /* whether we think this file might not exist */
   bool maybe_deleted;
+  /* whether the node was made with room for a symlink target after its
+   * name; see getSymlinkTarget */
+  bool has_symlink_target;
+  /* whether the node was made with room for the atime after its name;
+   * see getStat */
+  bool has_atime;
 
   /* cache stat results so we can tell if an entry
    * changed */
-  watchman::FileInformation stat;
+  watchman::CompactFileInformation stat;
+
+  /* The full stat results.  The atime is the mtime if the node has no room
+   * for it. */
+  watchman::FileInformation getStat() const;
+  void setStat(const watchman::FileInformation& info);
 
   inline w_string_piece getName() const {
     uint32_t len;
@@ -42,16 +93,46 @@ struct watchman_file {
     return w_string_piece(reinterpret_cast<const char*>(this + 1) + 4, len);
   }
 
+  // The size of the allocation that holds this node and its name
+  size_t allocatedSize() const;
+
+  /* The target of the symlink, as captured when the file was last
+   * examined.  Null if the node has no room for one, if the file isn't a
+   * symlink, or if reading the link failed, in which case the reader has to
+   * read it for itself. */
+  w_string getSymlinkTarget() const {
+    return has_symlink_target ? *symlinkTargetSlot() : w_string();
+  }
+
+  // Has no effect unless the node has room for the target
+  void setSymlinkTarget(w_string target) {
+    if (has_symlink_target) {
+      *symlinkTargetSlot() = std::move(target);
+    }
+  }
+
   void removeFromFileList();
+  void removeFromSuffixList();
+  void removeFromSubtreeList();
+
+  static watchman_file* fromTombstoneLink(watchman_tombstone_link* link);
 
   watchman_file() = delete;
   watchman_file(const watchman_file&) = delete;
   watchman_file& operator=(const watchman_file&) = delete;
   ~watchman_file();
 
+  // With symlinkTarget set, the node has room for a symlink target, and
+  // with atime, for the atime
   static std::unique_ptr<watchman_file, watchman_dir::Deleter> make(
       const w_string& name,
-      watchman_dir* parent);
+      watchman_dir* parent,
+      bool symlinkTarget = false,
+      bool atime = true);
+
+ private:
+  w_string* symlinkTargetSlot() const;
+  int64_t* atimeSlot() const;
 };
 
 void free_file_node(struct watchman_file* file);
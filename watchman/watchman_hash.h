@@ -8,9 +8,15 @@
 #ifndef WATCHMAN_HASH_H
 #define WATCHMAN_HASH_H
 
-/* Bob Jenkins' lookup3.c hash function */
+/* The hash used for w_string and friends.  It is only guaranteed to be
+ * stable within a process; use w_hash_bytes_lookup3 for anything that is
+ * persisted. */
 uint32_t w_hash_bytes(const void* key, size_t length, uint32_t initval);
 
+/* Bob Jenkins' lookup3.c hash function */
+uint32_t
+w_hash_bytes_lookup3(const void* key, size_t length, uint32_t initval);
+
 namespace watchman {
 // This is the Hash128to64 function from Google's cityhash (available
 // under the MIT License).  We use it to reduce multiple 64 bit hashes
@@ -8,6 +8,7 @@
 #ifndef WATCHMAN_STREAM_H
 #define WATCHMAN_STREAM_H
 
+#include <folly/portability/SysUio.h>
 #include <memory>
 #include "watchman/fs/FileDescriptor.h"
 
@@ -30,6 +31,20 @@ class watchman_stream {
   virtual ~watchman_stream() = default;
   virtual int read(void* buf, int size) = 0;
   virtual int write(const void* buf, int size) = 0;
+  // Gathering write.  Like write, this may write fewer bytes than were
+  // provided, and returns -1 on error.  The default writes only the first
+  // non-empty buffer.
+  virtual int writev(const struct iovec* iov, int iovcnt);
+  // Whether writeWithDescriptor can be used
+  virtual bool canPassDescriptors() const {
+    return false;
+  }
+  // Writes all of buf, passing a copy of fd to the peer with SCM_RIGHTS
+  // along with the first byte.  Returns false on error.
+  virtual bool writeWithDescriptor(
+      const void* buf,
+      int size,
+      const watchman::FileDescriptor& fd);
   virtual w_evt_t getEvents() = 0;
   virtual void setNonBlock(bool nonBlock) = 0;
   virtual bool rewind() = 0;
@@ -37,6 +52,12 @@ class watchman_stream {
   virtual bool peerIsOwner() = 0;
   virtual pid_t getPeerProcessID() const = 0;
   virtual const watchman::FileDescriptor& getFileDescriptor() const = 0;
+  // Whether the peer has closed its end, without waiting or consuming any
+  // input.  A peer that only shut down its side for writing still counts
+  // as connected, as it may be waiting for a response.
+  virtual bool peerHungUp() {
+    return false;
+  }
 };
 using w_stm_t = watchman_stream*;
 
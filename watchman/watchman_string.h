@@ -14,6 +14,7 @@
 #include <atomic>
 #include <cstring>
 #include <initializer_list>
+#include <iterator>
 #include <memory>
 #ifdef _WIN32
 #include <string>
@@ -89,6 +90,15 @@ inline bool is_slash(char c) {
       ;
 }
 
+/**
+ * Returns the first or the last path separator in [begin, end), or nullptr
+ * if there is none.  Where the system has no routine to search for them,
+ * these look at a word at a time rather than at each byte.
+ */
+const char* w_find_first_slash(const char* begin, const char* end);
+const char* w_find_last_slash(const char* begin, const char* end);
+
+class w_path_components;
 class w_string;
 
 /** Represents a view over some externally managed string storage.
@@ -190,6 +200,9 @@ class w_string_piece {
   w_string_piece baseName() const;
   w_string_piece suffix() const;
 
+  /** Iterate over the components of the path, without allocating */
+  w_path_components pathComponents() const;
+
   /** Split the string by delimiter and emit to the provided vector */
   template <typename Vector>
   void split(Vector& result, char delim) const {
@@ -237,6 +250,81 @@ class w_string_piece {
 
 bool w_string_equal_caseless(w_string_piece a, w_string_piece b);
 
+/**
+ * The components of a path, to be iterated over, which splits the path at
+ * each separator as it goes.  The empty components that leading, trailing
+ * and repeated separators would give are skipped, so that "/a//b/" has the
+ * components "a" and "b".
+ */
+class w_path_components {
+ public:
+  class iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = w_string_piece;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const w_string_piece*;
+    using reference = const w_string_piece&;
+
+    iterator(const char* pos, const char* end) : end_(end) {
+      seek(pos);
+    }
+
+    reference operator*() const {
+      return component_;
+    }
+    pointer operator->() const {
+      return &component_;
+    }
+
+    iterator& operator++() {
+      seek(component_.data() + component_.size());
+      return *this;
+    }
+    iterator operator++(int) {
+      auto prior = *this;
+      ++*this;
+      return prior;
+    }
+
+    bool operator==(const iterator& other) const {
+      return component_.data() == other.component_.data();
+    }
+    bool operator!=(const iterator& other) const {
+      return !(*this == other);
+    }
+
+   private:
+    void seek(const char* pos) {
+      while (pos < end_ && is_slash(*pos)) {
+        ++pos;
+      }
+      auto sep = w_find_first_slash(pos, end_);
+      component_ = w_string_piece(pos, (sep ? sep : end_) - pos);
+    }
+
+    w_string_piece component_;
+    const char* end_;
+  };
+
+  explicit w_path_components(w_string_piece path) : path_(path) {}
+
+  iterator begin() const {
+    return iterator(path_.data(), path_.data() + path_.size());
+  }
+  iterator end() const {
+    auto end = path_.data() + path_.size();
+    return iterator(end, end);
+  }
+
+ private:
+  w_string_piece path_;
+};
+
+inline w_path_components w_string_piece::pathComponents() const {
+  return w_path_components(*this);
+}
+
 /** A smart pointer class for tracking w_string_t instances */
 class w_string {
  public:
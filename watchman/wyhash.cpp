@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// The in-process string hash.  This follows the construction of Wang Yi's
+// wyhash (released into the public domain): input is consumed 8 or 16
+// bytes at a time and mixed with a 64x64->128 bit multiply, which is far
+// fewer operations per byte than lookup3 and has no alignment dependent
+// paths.  Short inputs, which is most path components, are read with at
+// most four overlapping loads and no loop.
+
+#include "watchman/watchman_system.h"
+
+#include <cstring>
+#include "watchman/watchman_hash.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+constexpr uint64_t kSecret[4] = {
+    0xa0761d6478bd642fULL,
+    0xe7037ed1a0b428dbULL,
+    0x8ebc6af09c88c6e3ULL,
+    0x589965cc75374cc3ULL,
+};
+
+inline void multiply(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = *a;
+  r *= *b;
+  *a = uint64_t(r);
+  *b = uint64_t(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  *a = _umul128(*a, *b, b);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32;
+  uint64_t la = uint32_t(*a), lb = uint32_t(*b);
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+  *a = lo;
+  *b = hi;
+#endif
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+  multiply(&a, &b);
+  return a ^ b;
+}
+
+// Little endian loads, so that the hash of a given string is the same on
+// every platform.
+inline uint64_t read64(const uint8_t* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+inline uint64_t read32(const uint8_t* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32(v);
+#endif
+  return v;
+}
+
+// 1 to 3 bytes
+inline uint64_t read3(const uint8_t* p, size_t k) {
+  return (uint64_t(p[0]) << 16) | (uint64_t(p[k >> 1]) << 8) | p[k - 1];
+}
+
+uint64_t hash64(const void* key, size_t len, uint64_t seed) {
+  auto p = static_cast<const uint8_t*>(key);
+  seed ^= mix(seed ^ kSecret[0], kSecret[1]);
+  uint64_t a, b;
+
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (read32(p) << 32) | read32(p + ((len >> 3) << 2));
+      b = (read32(p + len - 4) << 32) | read32(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = read3(p, len);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i >= 48) {
+      uint64_t see1 = seed, see2 = seed;
+      do {
+        seed = mix(read64(p) ^ kSecret[1], read64(p + 8) ^ seed);
+        see1 = mix(read64(p + 16) ^ kSecret[2], read64(p + 24) ^ see1);
+        see2 = mix(read64(p + 32) ^ kSecret[3], read64(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i >= 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16) {
+      seed = mix(read64(p) ^ kSecret[1], read64(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = read64(p + i - 16);
+    b = read64(p + i - 8);
+  }
+
+  a ^= kSecret[1];
+  b ^= seed;
+  multiply(&a, &b);
+  return mix(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
+
+} // namespace
+
+uint32_t w_hash_bytes(const void* key, size_t length, uint32_t initval) {
+  auto h = hash64(key, length, initval);
+  return uint32_t(h ^ (h >> 32));
+}
+
+/* vim:ts=2:sw=2:et:
+ */